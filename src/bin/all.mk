@@ -43,6 +43,15 @@ FUZZER_ARTIFACTS ?= ${BUILD_DIR}/fuzzer
 #
 FUZZER_TIMEOUT   ?= 10
 
+#
+#  "test.fuzzer.foo.perf" fails on corpus inputs whose decoding costs
+#  more than this many instructions (or ns of CPU time if instructions
+#  can't be counted), or allocates more than this many bytes, per
+#  input byte.
+#
+FUZZER_PERF_LIMIT     ?= 20000
+FUZZER_PERF_MEM_LIMIT ?= 1024
+
 #
 #  Define a function to do all of the same thing.
 #
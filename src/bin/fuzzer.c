@@ -28,14 +28,31 @@ RCSID("$Id$")
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/time.h>
 #include <freeradius-devel/io/test_point.h>
 
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
+
 /*
  *	Run from the source directory via:
  *
  *	./build/make/jlibtool --mode=execute ./build/bin/local/fuzzer_radius -D share/dictionary /path/to/corpus/directory/
+ *
+ *	Setting FR_FUZZER_PERF=<cost per byte> enables the performance
+ *	mode.  Each input is measured, and inputs which cost more than
+ *	the limit are reported and written to FR_FUZZER_PERF_DIR.  The
+ *	cost is the number of instructions executed by the decoder where
+ *	the kernel lets us count them, and nanoseconds of CPU time where
+ *	it doesn't.  FR_FUZZER_PERF_MEM=<bytes per byte> sets a limit on
+ *	the memory the decoder allocates.  If FR_FUZZER_PERF_ABORT is
+ *	set, inputs over either limit abort, so they fail the run.
  */
 
 static bool			init = false;
@@ -45,6 +62,26 @@ static fr_dict_protocol_t	*dl_proto;
 
 static fr_dict_t		*dict = NULL;
 
+static uint64_t			perf_limit;		//!< Cost per input byte, 0 if perf mode is disabled.
+static uint64_t			perf_mem_limit;		//!< Bytes allocated per input byte.
+static char const		*perf_dir;		//!< Where to write inputs over the limits.
+static bool			perf_abort;		//!< Abort on inputs over the limits.
+static int			perf_fd = -1;		//!< Instruction counter.
+
+/*
+ *	Allow for fixed costs, so that tiny inputs aren't reported.
+ */
+#define PERF_MIN_LEN		(64)
+
+#if defined(__linux__) && defined(__clang__)
+/*
+ *	libFuzzer treats a new non-zero counter as new coverage, so
+ *	setting one counter for each power of two of the cost per
+ *	byte steers the fuzzer towards more expensive inputs.
+ */
+__attribute__((section("__libfuzzer_extra_counters"))) static uint8_t perf_counters[64];
+#endif
+
 extern fr_test_point_proto_decode_t XX_PROTOCOL_XX_tp_decode_proto;
 
 int LLVMFuzzerInitialize(int *argc, char ***argv);
@@ -69,6 +106,114 @@ static void exitHandler(void)
 	fr_atexit_global_trigger_all();
 }
 
+/** Open the instruction counter, if the kernel lets us
+ *
+ */
+static void fuzzer_perf_init(void)
+{
+	char const *p;
+
+	p = getenv("FR_FUZZER_PERF");
+	if (!p) return;
+
+	perf_limit = strtoull(p, NULL, 10);
+	if (!perf_limit) return;
+
+	p = getenv("FR_FUZZER_PERF_MEM");
+	perf_mem_limit = p ? strtoull(p, NULL, 10) : 1024;
+
+	perf_dir = getenv("FR_FUZZER_PERF_DIR");
+	if (!perf_dir) perf_dir = ".";
+
+	perf_abort = (getenv("FR_FUZZER_PERF_ABORT") != NULL);
+
+#ifdef __linux__
+	{
+		struct perf_event_attr attr = {
+			.type = PERF_TYPE_HARDWARE,
+			.size = sizeof(attr),
+			.config = PERF_COUNT_HW_INSTRUCTIONS,
+			.disabled = 1,
+			.exclude_kernel = 1,
+			.exclude_hv = 1
+		};
+
+		perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+
+	fprintf(stderr, "fuzzer: Reporting inputs which cost more than %" PRIu64 " %s, "
+		"or allocate more than %" PRIu64 " bytes, per input byte\n",
+		perf_limit, (perf_fd < 0) ? "ns" : "instructions", perf_mem_limit);
+}
+
+static inline uint64_t fuzzer_perf_now(void)
+{
+	struct timespec ts;
+
+#ifdef __linux__
+	if (perf_fd >= 0) {
+		uint64_t count;
+
+		if (read(perf_fd, &count, sizeof(count)) == sizeof(count)) return count;
+	}
+#endif
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ((uint64_t) ts.tv_sec * NSEC) + ts.tv_nsec;
+}
+
+static inline void fuzzer_perf_start(void)
+{
+#ifdef __linux__
+	if (perf_fd < 0) return;
+
+	(void) ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+	(void) ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+static inline void fuzzer_perf_stop(void)
+{
+#ifdef __linux__
+	if (perf_fd < 0) return;
+
+	(void) ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+/** Check the cost of decoding one input, and report it if it's too high
+ *
+ */
+static void fuzzer_perf_check(uint8_t const *buf, size_t len, uint64_t cost, size_t allocated)
+{
+	size_t		scaled = (len < PERF_MIN_LEN) ? PERF_MIN_LEN : len;
+	uint64_t	per_byte = cost / scaled;
+	char		filename[PATH_MAX];
+	FILE		*fp;
+
+#if defined(__linux__) && defined(__clang__)
+	perf_counters[per_byte ? 63 - __builtin_clzll(per_byte) : 0] = 1;
+#endif
+
+	if ((per_byte <= perf_limit) && ((allocated / scaled) <= perf_mem_limit)) return;
+
+	snprintf(filename, sizeof(filename), "%s/perf-%08x", perf_dir, fr_hash(buf, len));
+
+	fprintf(stderr, "fuzzer: Input of %zu bytes cost %" PRIu64 " per byte, and allocated %zu bytes - written to %s\n",
+		len, per_byte, allocated, filename);
+
+	fp = fopen(filename, "w");
+	if (fp) {
+		if (fwrite(buf, 1, len, fp) != len) fprintf(stderr, "fuzzer: Failed writing %s\n", filename);
+		fclose(fp);
+	} else {
+		fprintf(stderr, "fuzzer: Failed opening %s - %s\n", filename, fr_syserror(errno));
+	}
+
+	if (perf_abort) abort();
+}
+
 static inline
 fr_dict_protocol_t *fuzzer_dict_init(void *dl_handle, char const *proto)
 {
@@ -231,6 +376,8 @@ int LLVMFuzzerInitialize(int *argc, char ***argv)
 	 */
 	dl_proto = fuzzer_dict_init(RTLD_DEFAULT, proto);
 
+	fuzzer_perf_init();
+
 	init = true;
 
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
@@ -256,7 +403,17 @@ int LLVMFuzzerTestOneInput(const uint8_t *buf, size_t len)
 		fr_exit_now(EXIT_FAILURE);
 	}
 
-	tp->func(ctx, &vps, buf, len, decode_ctx);
+	if (!perf_limit) {
+		tp->func(ctx, &vps, buf, len, decode_ctx);
+	} else {
+		uint64_t start;
+
+		fuzzer_perf_start();
+		start = fuzzer_perf_now();
+		tp->func(ctx, &vps, buf, len, decode_ctx);
+		fuzzer_perf_check(buf, len, fuzzer_perf_now() - start, talloc_total_size(ctx));
+		fuzzer_perf_stop();
+	}
 	if (fr_debug_lvl > 3) fr_pair_list_debug(&vps);
 
 	talloc_free(decode_ctx);
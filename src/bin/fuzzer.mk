@@ -119,3 +119,22 @@ test.fuzzer.$(PROTOCOL).crash: $(wildcard $(BUILD_DIR)/fuzzer/$(PROTOCOL)/crash-
 		-max_total_time=$(FUZZER_TIMEOUT) \
 		-D share/dictionary \
 		$(filter $(BUILD_DIR)/fuzzer/$(PROTOCOL)/crash-% $(BUILD_DIR)/fuzzer/$(PROTOCOL)/timeout-% $(BUILD_DIR)/fuzzer/$(PROTOCOL)/slow-unit-%, $?)
+
+#
+#  Run every input in the corpus once, in performance mode.  Inputs
+#  whose decoding is too expensive for their size fail the test, and
+#  are written to the artifacts directory.
+#
+#  Running "make fuzzer.$(PROTOCOL)" with FR_FUZZER_PERF set in the
+#  environment searches for new expensive inputs instead.
+#
+test.fuzzer.$(PROTOCOL).perf: $(TEST_BIN_DIR)/fuzzer_$(PROTOCOL) | src/tests/fuzzer-corpus/$(PROTOCOL)
+	@echo TEST-FUZZER-PERF $(PROTOCOL)
+	${Q}FR_FUZZER_PERF=$(FUZZER_PERF_LIMIT) FR_FUZZER_PERF_MEM=$(FUZZER_PERF_MEM_LIMIT) \
+		FR_FUZZER_PERF_DIR="$(FUZZER_ARTIFACTS)/$(PROTOCOL)" FR_FUZZER_PERF_ABORT=yes \
+		$(TEST_BIN_NO_TIMEOUT)/fuzzer_$(PROTOCOL) \
+		-artifact_prefix="$(FUZZER_ARTIFACTS)/$(PROTOCOL)/" \
+		-max_len=512 $(FUZZER_ARGUMENTS) \
+		-runs=0 \
+		-D share/dictionary \
+		src/tests/fuzzer-corpus/$(PROTOCOL)
@@ -33,6 +33,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/pair_legacy.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/server/packet.h>
 #include <freeradius-devel/radius/list.h>
 #include <freeradius-devel/radius/radius.h>
@@ -49,6 +50,7 @@ RCSID("$Id$")
 #endif
 
 #include <assert.h>
+#include <pthread.h>
 
 typedef struct request_s request_t;	/* to shut up warnings about mschap.h */
 
@@ -81,6 +83,12 @@ static int forced_id = -1;
 static size_t parallel = 1;
 static bool paused = false;
 
+static uint64_t load_rate = 0;
+static unsigned int load_threads = 1;
+static unsigned int load_sockets = 1;
+static fr_time_delta_t load_duration;
+static rc_request_t **load_templates = NULL;
+
 static fr_bio_fd_config_t fd_config;
 
 static fr_radius_client_config_t client_config;
@@ -172,6 +180,11 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -F                                Print the file name, packet number and reply code.\n");
 	fprintf(stderr, "  -h                                Print usage help information.\n");
 	fprintf(stderr, "  -i <id>                           Set request id to 'id'.  Values may be 0..255\n");
+	fprintf(stderr, "  -L <rate>                         Send packets at 'rate' per second, and print a latency summary.\n");
+	fprintf(stderr, "                                    The packets from the input files are used as templates.  In\n");
+	fprintf(stderr, "                                    string attributes, %%n is replaced by the packet number, and\n");
+	fprintf(stderr, "                                    %%t by the thread number.\n");
+	fprintf(stderr, "  -N <num>                          With -L, use 'num' sockets per thread (defaults to 1).\n");
 	fprintf(stderr, "  -o <port>                         Set CoA listening port (defaults to 3799)\n");
 	fprintf(stderr, "  -p <num>                          Send 'num' packets from a file in parallel.\n");
 	fprintf(stderr, "  -P <proto>                        Use proto (tcp or udp) for transport.\n");
@@ -179,6 +192,8 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -s                                Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>                         read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>                      Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <num>                          With -L, send from 'num' threads (defaults to 1).\n");
+	fprintf(stderr, "  -u <duration>                     With -L, send packets for 'duration' seconds (defaults to 10).\n");
 	fprintf(stderr, "  -v                                Show program version information.\n");
 	fprintf(stderr, "  -x                                Debugging mode.\n");
 
@@ -883,9 +898,14 @@ error:
  */
 static int radclient_sane(rc_request_t *request)
 {
-	request->packet->socket.inet.src_ipaddr = client_info->fd_info->socket.inet.src_ipaddr;
-	request->packet->socket.inet.src_port = client_info->fd_info->socket.inet.src_port;
-	request->packet->socket.inet.ifindex = client_info->fd_info->socket.inet.ifindex;
+	/*
+	 *	Load generation has a socket per thread.
+	 */
+	if (client_info) {
+		request->packet->socket.inet.src_ipaddr = client_info->fd_info->socket.inet.src_ipaddr;
+		request->packet->socket.inet.src_port = client_info->fd_info->socket.inet.src_port;
+		request->packet->socket.inet.ifindex = client_info->fd_info->socket.inet.ifindex;
+	}
 
 	if (request->packet->socket.inet.dst_port == 0) {
 		request->packet->socket.inet.dst_port = fd_config.dst_port;
@@ -1301,6 +1321,509 @@ static void  client_bio_connected(fr_bio_packet_t *client)
 }
 
 
+/***********************************************************************
+ *
+ *	Load generation.
+ *
+ *	Each thread has its own event list and sockets, and therefore
+ *	its own ID space.  Packets are scheduled at a constant rate
+ *	from when the thread starts, whether or not earlier packets
+ *	have been answered.  Latency is measured from when a packet
+ *	was scheduled to be sent, and not from when it was sent, so
+ *	that a slow server doesn't hide its own latency by slowing
+ *	down the client.
+ *
+ ***********************************************************************/
+
+typedef struct rc_load_thread_s rc_load_thread_t;
+
+/** One socket used by a load thread
+ *
+ */
+typedef struct {
+	rc_load_thread_t	*thread;	//!< which owns this socket.
+	fr_radius_client_config_t config;	//!< client configuration, with the thread's event list.
+	fr_bio_packet_t		*bio;		//!< the RADIUS client bio.
+	bool			connected;	//!< whether we can send packets.
+} rc_load_socket_t;
+
+/** A packet sent by a load thread
+ *
+ */
+typedef struct {
+	rc_load_thread_t	*thread;	//!< which sent the packet.
+	fr_packet_t		*packet;	//!< the packet we sent.
+	fr_pair_list_t		pairs;		//!< generated from the template.
+	fr_time_t		scheduled;	//!< when the packet should have been sent.
+} rc_load_packet_t;
+
+struct rc_load_thread_s {
+	unsigned int		id;		//!< of this thread.
+	pthread_t		pthread_id;
+
+	fr_event_list_t		*el;		//!< the thread's own event list.
+	fr_event_timer_t const	*ev;		//!< for sending the next packet.
+
+	rc_load_socket_t	*sockets;	//!< array of load_sockets sockets.
+	unsigned int		num_connected;	//!< sockets which are connected.
+	unsigned int		next_socket;	//!< to try.
+
+	fr_time_t		start;		//!< when we started sending.
+	fr_time_delta_t		interval;	//!< between packets sent by this thread.
+	uint64_t		total;		//!< number of packets this thread sends.
+	uint64_t		scheduled;	//!< number of packets we have sent, or tried to send.
+	size_t			outstanding;	//!< packets waiting for a reply.
+
+	fr_time_t		end;		//!< when the last reply or timeout was seen.
+
+	rc_stats_t		stats;		//!< reply codes.
+	uint64_t		received;	//!< number of replies.
+	uint64_t		errors;		//!< packets we couldn't encode or send.
+
+	fr_histogram_t		*latency;	//!< in nanoseconds, from the scheduled send time.
+};
+
+/** Replace "%n" in top level string attributes with the packet number, and "%t" with the thread number
+ *
+ */
+static void load_substitute(fr_pair_list_t *list, uint64_t num, unsigned int thread)
+{
+	fr_pair_list_foreach(list, vp) {
+		char		buffer[1024];
+		char		*out = buffer, *end = buffer + sizeof(buffer);
+		char const	*p, *q;
+
+		if (vp->vp_type != FR_TYPE_STRING) continue;
+
+		if (!memchr(vp->vp_strvalue, '%', vp->vp_length)) continue;
+
+		for (p = vp->vp_strvalue, q = p + vp->vp_length; (p < q) && (out < end); p++) {
+			if ((*p != '%') || ((p + 1) == q)) {
+				*(out++) = *p;
+				continue;
+			}
+
+			switch (p[1]) {
+			case 'n':
+				out += snprintf(out, end - out, "%" PRIu64, num);
+				p++;
+				break;
+
+			case 't':
+				out += snprintf(out, end - out, "%u", thread);
+				p++;
+				break;
+
+			case '%':
+				*(out++) = '%';
+				p++;
+				break;
+
+			default:
+				*(out++) = *p;
+				break;
+			}
+		}
+		if (out > end) out = end;
+
+		fr_pair_value_bstrndup(vp, buffer, out - buffer, true);
+	}
+}
+
+static void load_done(rc_load_thread_t *t)
+{
+	if ((t->scheduled < t->total) || (t->outstanding > 0)) return;
+
+	t->end = fr_time();
+	fr_event_loop_exit(t->el, 1);
+}
+
+/** Send one packet, which was scheduled to be sent at a particular time
+ *
+ * @return
+ *	- 0 if the packet was sent, or failed and won't be retried.
+ *	- -1 if no socket can send the packet now.
+ */
+static int load_send_one(rc_load_thread_t *t, fr_time_t scheduled)
+{
+	rc_load_socket_t	*s = NULL;
+	rc_load_packet_t	*lp;
+	rc_request_t const	*tmpl;
+	uint64_t		num;
+	unsigned int		i;
+	int			rcode;
+
+	/*
+	 *	Find a socket which has free IDs, and isn't blocked.
+	 */
+	for (i = 0; i < load_sockets; i++) {
+		rc_load_socket_t *this = &t->sockets[(t->next_socket + i) % load_sockets];
+
+		if (!this->connected || this->bio->write_blocked) continue;
+
+		if (fr_radius_client_bio_outstanding(this->bio) >= 255) continue;
+
+		s = this;
+		break;
+	}
+	if (!s) return -1;
+
+	t->next_socket = (t->next_socket + i + 1) % load_sockets;
+
+	/*
+	 *	Packet numbers are unique across all threads.
+	 */
+	num = (t->scheduled * load_threads) + t->id;
+	tmpl = load_templates[num % talloc_array_length(load_templates)];
+
+	MEM(lp = talloc_zero(t, rc_load_packet_t));
+	lp->thread = t;
+	lp->scheduled = scheduled;
+
+	MEM(lp->packet = fr_packet_alloc(lp, false));
+	lp->packet->code = tmpl->packet->code;
+	lp->packet->id = -1;
+	lp->packet->uctx = lp;
+
+	fr_pair_list_init(&lp->pairs);
+	if (fr_pair_list_copy(lp, &lp->pairs, &tmpl->request_pairs) < 0) {
+	error:
+		talloc_free(lp);
+		t->errors++;
+		return 0;
+	}
+	load_substitute(&lp->pairs, num, t->id);
+
+	if (lp->packet->code == FR_RADIUS_CODE_ACCESS_REQUEST) {
+		fr_rand_buffer(lp->packet->vector, sizeof(lp->packet->vector));
+	}
+
+	rcode = fr_bio_packet_write(s->bio, lp, lp->packet, &lp->pairs);
+	if (rcode < 0) {
+		if (rcode == fr_bio_error(IO_WOULD_BLOCK)) {
+			talloc_free(lp);
+			return -1;
+		}
+
+		goto error;
+	}
+
+	t->outstanding++;
+	return 0;
+}
+
+/** Send every packet which is due, and schedule the next one
+ *
+ */
+static void load_send(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	rc_load_thread_t	*t = talloc_get_type_abort(uctx, rc_load_thread_t);
+	uint64_t		due;
+	fr_time_t		next;
+
+	due = (fr_time_delta_unwrap(fr_time_sub(now, t->start)) / fr_time_delta_unwrap(t->interval)) + 1;
+	if (due > t->total) due = t->total;
+
+	while (t->scheduled < due) {
+		if (load_send_one(t, fr_time_add(t->start, fr_time_delta_wrap(t->scheduled * fr_time_delta_unwrap(t->interval)))) < 0) break;
+
+		t->scheduled++;
+	}
+
+	if (t->scheduled >= t->total) {
+		load_done(t);
+		return;
+	}
+
+	/*
+	 *	If we're behind, try again once some replies have
+	 *	freed up IDs.
+	 */
+	next = fr_time_add(t->start, fr_time_delta_wrap(t->scheduled * fr_time_delta_unwrap(t->interval)));
+	if (fr_time_lt(next, now)) next = fr_time_add(now, fr_time_delta_from_usec(100));
+
+	if (fr_event_timer_at(t, t->el, &t->ev, next, load_send, t) < 0) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static void load_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rc_load_socket_t	*s = uctx;
+	rc_load_thread_t	*t = s->thread;
+	rc_load_packet_t	*lp;
+	fr_packet_t		*reply;
+	fr_pair_list_t		reply_pairs;
+	int			rcode;
+
+	fr_pair_list_init(&reply_pairs);
+
+	rcode = fr_bio_packet_read(s->bio, (void **) &lp, &reply, t, &reply_pairs);
+	if (rcode < 0) {
+		ERROR("Failed reading packet - %s", fr_bio_strerror(rcode));
+		fr_exit_now(EXIT_FAILURE);
+	}
+	if (!rcode) return;
+
+	fr_histogram_add(t->latency, fr_time_delta_unwrap(fr_time_sub(reply->timestamp, lp->scheduled)));
+	t->received++;
+
+	switch (reply->code) {
+	case FR_RADIUS_CODE_ACCESS_ACCEPT:
+	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+	case FR_RADIUS_CODE_COA_ACK:
+	case FR_RADIUS_CODE_DISCONNECT_ACK:
+		t->stats.accepted++;
+		break;
+
+	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+		break;
+
+	default:
+		t->stats.rejected++;
+	}
+
+	/*
+	 *	Release the ID now, instead of waiting for duplicate
+	 *	replies.
+	 */
+	(void) fr_radius_client_fd_bio_cancel(s->bio, lp->packet);
+
+	fr_pair_list_free(&reply_pairs);
+	fr_packet_free(&reply);
+	talloc_free(lp);
+
+	t->outstanding--;
+	load_done(t);
+}
+
+static void load_write(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rc_load_socket_t	*s = uctx;
+
+	if (fr_bio_packet_write_flush(s->bio) < 0) return;
+
+	if (fr_event_filter_update(el, fd, FR_EVENT_FILTER_IO, pause_write) < 0) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static NEVER_RETURNS void load_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				     int fd_errno, UNUSED void *uctx)
+{
+	ERROR("Failed in connection - %s", fr_syserror(fd_errno));
+	fr_exit_now(EXIT_FAILURE);
+}
+
+static void load_connected(fr_bio_packet_t *bio)
+{
+	rc_load_socket_t			*s = bio->uctx;
+	rc_load_thread_t			*t = s->thread;
+	fr_radius_client_bio_info_t const	*info = fr_radius_client_bio_info(bio);
+
+	if ((fr_event_fd_insert(t, NULL, t->el, info->fd_info->socket.fd, load_read, load_write, load_error, s) < 0) ||
+	    (fr_event_filter_update(t->el, info->fd_info->socket.fd, FR_EVENT_FILTER_IO, pause_write) < 0)) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	s->connected = true;
+
+	/*
+	 *	Start the clock once all of the sockets are ready.
+	 */
+	if (++t->num_connected < load_sockets) return;
+
+	t->start = fr_time();
+	load_send(t->el, t->start, t);
+}
+
+static NEVER_RETURNS void load_failed(UNUSED fr_bio_packet_t *bio)
+{
+	ERROR("Failed connecting to server");
+	fr_exit_now(EXIT_FAILURE);
+}
+
+static int load_write_blocked(fr_bio_packet_t *bio)
+{
+	fr_radius_client_bio_info_t const *info = fr_radius_client_bio_info(bio);
+	rc_load_socket_t *s = bio->uctx;
+
+	if (fr_event_filter_update(s->thread->el, info->fd_info->socket.fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+		return fr_bio_error(GENERIC);
+	}
+
+	return 0;
+}
+
+static int load_write_resume(UNUSED fr_bio_packet_t *bio)
+{
+	return 1;
+}
+
+/** No reply was received, even after retransmissions
+ *
+ */
+static void load_release(UNUSED fr_bio_packet_t *bio, fr_packet_t *packet)
+{
+	rc_load_packet_t	*lp = packet->uctx;
+	rc_load_thread_t	*t = lp->thread;
+
+	t->stats.lost++;
+	t->outstanding--;
+
+	talloc_free(lp);
+
+	load_done(t);
+}
+
+static void *load_thread(void *arg)
+{
+	rc_load_thread_t	*t = arg;
+	unsigned int		i;
+
+	for (i = 0; i < load_sockets; i++) {
+		rc_load_socket_t *s = &t->sockets[i];
+
+		s->thread = t;
+		s->config = client_config;
+		s->config.el = t->el;
+		s->config.retry_cfg.el = t->el;
+		s->config.packet_cb_cfg = (fr_bio_packet_cb_funcs_t) {
+			.connected	= load_connected,
+			.failed		= load_failed,
+
+			.write_blocked	= load_write_blocked,
+			.write_resume	= load_write_resume,
+
+			.release	= load_release,
+		};
+
+		s->bio = fr_radius_client_bio_alloc(t, &s->config, &fd_config);
+		if (!s->bio) {
+			ERROR("Failed opening socket: %s", fr_strerror());
+			fr_exit_now(EXIT_FAILURE);
+		}
+		s->bio->uctx = s;
+
+		if (fr_event_fd_insert(t, NULL, t->el, fr_radius_client_bio_info(s->bio)->fd_info->socket.fd, NULL,
+				       fr_radius_client_bio_connect, load_error, s->bio) < 0) {
+			fr_perror("radclient");
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	(void) fr_event_loop(t->el);
+
+	return NULL;
+}
+
+/** Send packets at a constant rate from multiple threads, and print a latency summary
+ *
+ */
+static int radclient_load(void)
+{
+	rc_load_thread_t	**threads;
+	fr_histogram_t		*latency;
+	rc_stats_t		total = {};
+	uint64_t		sent = 0, received = 0, errors = 0, per_thread;
+	fr_time_t		start = fr_time_wrap(0), end = fr_time_wrap(0);
+	fr_time_delta_t		elapsed;
+	unsigned int		i = 0;
+
+	MEM(load_templates = talloc_array(autofree, rc_request_t *, fr_dlist_num_elements(&rc_request_list)));
+	fr_dlist_foreach(&rc_request_list, rc_request_t, request) load_templates[i++] = request;
+
+	MEM(threads = talloc_zero_array(autofree, rc_load_thread_t *, load_threads));
+	MEM(latency = fr_histogram_alloc(autofree));
+
+	per_thread = (uint64_t) (((double) fr_time_delta_unwrap(load_duration) * load_rate) / ((double) NSEC * load_threads));
+	if (!per_thread) per_thread = 1;
+
+	/*
+	 *	Threads are parented from NULL, as talloc isn't
+	 *	thread safe.
+	 */
+	for (i = 0; i < load_threads; i++) {
+		rc_load_thread_t *t;
+
+		MEM(t = talloc_zero(NULL, rc_load_thread_t));
+		t->id = i;
+		t->interval = fr_time_delta_wrap((NSEC * (int64_t) load_threads) / load_rate);
+		if (!fr_time_delta_ispos(t->interval)) t->interval = fr_time_delta_wrap(1);
+		t->total = per_thread;
+
+		MEM(t->sockets = talloc_zero_array(t, rc_load_socket_t, load_sockets));
+		MEM(t->latency = fr_histogram_alloc(t));
+
+		t->el = fr_event_list_alloc(t, NULL, NULL);
+		if (!t->el) {
+			ERROR("Failed opening event list: %s", fr_strerror());
+			return -1;
+		}
+
+		threads[i] = t;
+		if (pthread_create(&t->pthread_id, NULL, load_thread, t) != 0) {
+			ERROR("Failed creating thread: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	for (i = 0; i < load_threads; i++) {
+		rc_load_thread_t *t = threads[i];
+
+		(void) pthread_join(t->pthread_id, NULL);
+
+		fr_histogram_merge(latency, t->latency);
+
+		sent += t->scheduled - t->errors;
+		received += t->received;
+		errors += t->errors;
+		total.accepted += t->stats.accepted;
+		total.rejected += t->stats.rejected;
+		total.lost += t->stats.lost;
+
+		if ((i == 0) || fr_time_lt(t->start, start)) start = t->start;
+		if (fr_time_gt(t->end, end)) end = t->end;
+
+		talloc_free(t);
+	}
+
+	elapsed = fr_time_sub(end, start);
+
+	printf("Load summary:\n"
+	       "\tThreads       : %u\n"
+	       "\tSockets       : %u\n"
+	       "\tTarget rate   : %" PRIu64 "/s\n"
+	       "\tAchieved rate : %.0f/s\n"
+	       "\tSent          : %" PRIu64 "\n"
+	       "\tReceived      : %" PRIu64 "\n"
+	       "\tAccepted      : %" PRIu64 "\n"
+	       "\tRejected      : %" PRIu64 "\n"
+	       "\tLost          : %" PRIu64 "\n"
+	       "\tErrors        : %" PRIu64 "\n",
+	       load_threads, load_threads * load_sockets, load_rate,
+	       fr_time_delta_ispos(elapsed) ? ((double) received * NSEC) / fr_time_delta_unwrap(elapsed) : 0.0,
+	       sent, received, total.accepted, total.rejected, total.lost, errors);
+
+	printf("Latency from scheduled send time (usec):\n"
+	       "\tmin %" PRIu64 " mean %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64
+	       " p99 %" PRIu64 " p99.9 %" PRIu64 " p99.99 %" PRIu64 " max %" PRIu64 "\n",
+	       latency->min / 1000, fr_histogram_mean(latency) / 1000,
+	       fr_histogram_percentile(latency, 50) / 1000,
+	       fr_histogram_percentile(latency, 90) / 1000,
+	       fr_histogram_percentile(latency, 99) / 1000,
+	       fr_histogram_percentile(latency, 99.9) / 1000,
+	       fr_histogram_percentile(latency, 99.99) / 1000,
+	       latency->max / 1000);
+
+	if (total.lost || errors) return -1;
+
+	return 0;
+}
+
 /**
  *
  * @hidecallgraph
@@ -1320,6 +1843,8 @@ int main(int argc, char **argv)
 	int		retries = 5;
 	fr_time_delta_t timeout = fr_time_delta_from_sec(2);
 
+	load_duration = fr_time_delta_from_sec(10);
+
 	/*
 	 *	It's easier having two sets of flags to set the
 	 *	verbosity of library calls and the verbosity of
@@ -1405,7 +1930,7 @@ int main(int argc, char **argv)
 	 *
 	 ***********************************************************************/
 
-	while ((c = getopt(argc, argv, "46A:c:C:d:D:f:Fi:ho:p:P:r:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46A:c:C:d:D:f:Fi:hL:N:o:p:P:r:sS:t:T:u:vx")) != -1) switch (c) {
 		case '4':
 			fd_config.dst_ipaddr.af = AF_INET;
 			break;
@@ -1498,6 +2023,16 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'L':
+			load_rate = strtoull(optarg, &end, 10);
+			if (*end || !load_rate) usage();
+			break;
+
+		case 'N':
+			load_sockets = strtoul(optarg, &end, 10);
+			if (*end || !load_sockets || (load_sockets > 1024)) usage();
+			break;
+
 		case 'o':
 			coa_port = atoi(optarg);
 			if (!coa_port || (coa_port > 65535)) usage();
@@ -1577,6 +2112,19 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'T':
+			load_threads = strtoul(optarg, &end, 10);
+			if (*end || !load_threads || (load_threads > 1024)) usage();
+			break;
+
+		case 'u':
+			if (fr_time_delta_from_str(&load_duration, optarg, strlen(optarg), FR_TIME_RES_SEC) < 0) {
+				fr_perror("Failed parsing duration");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			if (!fr_time_delta_ispos(load_duration)) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1750,6 +2298,23 @@ int main(int argc, char **argv)
 		fr_exit_now(EXIT_FAILURE);
 	}
 
+	/*
+	 *	Load generation opens its own sockets, in its own
+	 *	threads.
+	 */
+	if (load_rate) {
+		fr_dlist_foreach(&rc_request_list, rc_request_t, this) {
+			if (radclient_sane(this) < 0) {
+				fr_exit_now(EXIT_FAILURE);
+			}
+		}
+
+		if (radclient_load() < 0) ret = EXIT_FAILURE;
+
+		fr_dlist_talloc_free(&rc_request_list);
+		goto done;
+	}
+
 	/***********************************************************************
 	 *
 	 *	We're done reading files, open the socket, event loop, and start sending packets.
@@ -1843,6 +2408,7 @@ int main(int argc, char **argv)
 
 	(void) fr_event_fd_delete(client_config.retry_cfg.el, client_info->fd_info->socket.fd, FR_EVENT_FILTER_IO);
 
+done:
 	fr_radius_global_free();
 
 	if (fr_dict_autofree(radclient_dict) < 0) {
@@ -32,9 +32,11 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/dependency.h>
 #include <freeradius-devel/server/map_proc.h>
+#include <freeradius-devel/server/metrics.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/radmin.h>
 #include <freeradius-devel/server/state.h>
+#include <freeradius-devel/server/trace.h>
 #include <freeradius-devel/server/virtual_servers.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/size.h>
@@ -831,6 +833,14 @@ int main(int argc, char *argv[])
 		EXIT_WITH_FAILURE;
 	}
 
+	/*
+	 *	Must be set before any event lists are allocated.
+	 */
+	if (fr_event_list_backend_set(config->event_backend) < 0) {
+		PERROR("Failed setting 'event_backend'");
+		EXIT_WITH_FAILURE;
+	}
+
 	/*
 	 *  Initialize the global event loop which handles things like
 	 *  systemd.
@@ -852,14 +862,36 @@ int main(int argc, char *argv[])
 
 		schedule = talloc_zero(global_ctx, fr_schedule_config_t);
 		schedule->max_workers = config->max_workers;
+		schedule->min_workers = config->min_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
+		schedule->work_stealing = config->work_stealing;
+		schedule->background_workers = config->background_workers;
+		schedule->background_cpus = config->background_cpus;
 
 		schedule->network.max_outstanding = config->max_requests;
+		schedule->network.dispatch = config->network_dispatch;
+		schedule->network.target_latency = config->target_latency;
+		schedule->network.latency_interval = config->latency_interval;
+		schedule->network.max_poll_time = config->poll_time;
+		schedule->worker.max_poll_time = config->poll_time;
+		schedule->network.ring_buffer_size = config->ring_buffer_size;
+		schedule->network.hugepages = config->hugepages;
+		schedule->worker.ring_buffer_size = config->ring_buffer_size;
+		schedule->worker.hugepages = config->hugepages;
+		schedule->worker.max_free_requests = config->max_free_requests;
 
 #define COPY(_x) schedule->worker._x = config->_x
 		COPY(max_requests);
 		COPY(max_request_time);
+		COPY(talloc_pool_size);
+		COPY(suppress_secrets);
+
+		schedule->worker.flight_recorder_size = config->log_flight_recorder_size;
+		schedule->worker.flight_recorder_threshold = config->log_flight_recorder_threshold;
+		schedule->worker.flight_recorder_lvl = config->log_flight_recorder_lvl;
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -870,6 +902,31 @@ int main(int argc, char *argv[])
 			el = main_loop_event_list();
 		}
 
+		/*
+		 *	Start the log thread after forking, as
+		 *	threads don't survive fork().
+		 */
+		if (config->log_async) {
+			default_log.async = fr_log_async_alloc(global_ctx, config->log_async_ring_size,
+							       config->log_async_drop);
+			if (!default_log.async) {
+				PERROR("Failed starting the log thread");
+				EXIT_WITH_FAILURE;
+			}
+		}
+
+		/*
+		 *	Module profiling has to be set before the
+		 *	workers start calling modules.
+		 */
+		unlang_module_profile_init(config->profile_modules, config->profile_slow_calls,
+					   config->profile_interval);
+
+		/*
+		 *	As does tracing.
+		 */
+		if (fr_trace_start(config) < 0) EXIT_WITH_FAILURE;
+
 		/*
 		 *	Fix spurious messages
 		 */
@@ -885,6 +942,11 @@ int main(int argc, char *argv[])
 		 *	Tell the virtual servers to open their sockets.
 		 */
 		if (virtual_servers_open(sc) < 0) EXIT_WITH_FAILURE;
+
+		/*
+		 *	Serve metrics, if they're configured.
+		 */
+		if (fr_metrics_start(config, sc) < 0) EXIT_WITH_FAILURE;
 	}
 
 	/*
@@ -1038,6 +1100,7 @@ int main(int argc, char *argv[])
 	}
 
 	fr_radmin_stop();
+	fr_metrics_stop();
 
 	/*
 	 *   Fire signal and stop triggers after ignoring SIGTERM, so handlers are
@@ -1053,6 +1116,11 @@ int main(int argc, char *argv[])
 	 */
 	(void) fr_schedule_destroy(&sc);
 
+	/*
+	 *  Export the spans the workers finished before exiting.
+	 */
+	fr_trace_stop();
+
 	/*
 	 *  We're exiting, so we can delete the PID file.
 	 *  (If it doesn't exist, we can ignore the error returned by unlink)
@@ -1114,7 +1182,24 @@ cleanup:
 	 *	This may not have been done earlier if we're
 	 *	exiting due to a startup error.
 	 */
+	fr_metrics_stop();
 	(void) fr_schedule_destroy(&sc);
+	fr_trace_stop();
+
+	/*
+	 *	All the threads which could be queueing log
+	 *	messages have exited, so write out anything
+	 *	left, and go back to writing messages directly.
+	 */
+	if (default_log.async) {
+		fr_log_async_t	*la = default_log.async;
+		uint64_t	dropped = fr_log_async_dropped(la);
+
+		default_log.async = NULL;
+		talloc_free(la);
+
+		if (dropped > 0) WARN("Dropped %" PRIu64 " log messages as the log thread couldn't keep up", dropped);
+	}
 
 	/*
 	 *	Ensure all thread local memory is cleaned up
@@ -46,17 +46,36 @@ RCSID("$Id$")
 #  include <collectd/client.h>
 #endif
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#ifdef __linux__
+#  include <linux/if_packet.h>
+#endif
+
 #include "radsniff.h"
 
 #define RS_ASSERT(_x) if (!(_x) && !fr_cond_assert(_x)) exit(1)
 
 static rs_t *conf;
-static struct timeval start_pcap = {0, 0};
-static char timestr[50];
 
-static fr_rb_tree_t *request_tree = NULL;
-static fr_rb_tree_t *link_tree = NULL;
-static fr_event_list_t *events;
+/*
+ *	With multiple capture queues, each queue thread has its own
+ *	event list, matching tables and allocation context.
+ */
+static _Thread_local struct timeval start_pcap = {0, 0};
+static _Thread_local char timestr[50];
+
+static _Thread_local fr_rb_tree_t *request_tree = NULL;
+static _Thread_local fr_rb_tree_t *link_tree = NULL;
+static _Thread_local fr_event_list_t *events;
+static _Thread_local TALLOC_CTX *packet_ctx;		//!< Parent of captured packets and requests.
+static _Thread_local rs_queue_t *rs_queue;		//!< Queue this thread is processing, if any.
+
+static atomic_uint_fast64_t captured;			//!< Packets processed by all queues.
 static bool cleanup;
 static int packets_count = 1; // Used in '$PATH/${packet}.txt.${count}'
 
@@ -109,6 +128,7 @@ fr_dict_attr_autoload_t radsniff_dict_attr[] = {
 };
 
 static NEVER_RETURNS void usage(int status);
+static void rs_signal_self(int sig);
 
 /** Fork and kill the parent process, writing out our PID
  *
@@ -593,6 +613,9 @@ static void rs_stats_process_latency(rs_latency_t *stats)
 		stats->interval.latency_average = unk;
 		stats->interval.latency_high = unk;
 		stats->interval.latency_low = unk;
+		stats->interval.latency_p50 = unk;
+		stats->interval.latency_p90 = unk;
+		stats->interval.latency_p99 = unk;
 
 		/*
 		 *	We've not yet been able to determine latency, so latency_smoothed is also NaN
@@ -607,6 +630,10 @@ static void rs_stats_process_latency(rs_latency_t *stats)
 		stats->interval.latency_average = (stats->interval.latency_total / stats->interval.linked_total);
 	}
 
+	stats->interval.latency_p50 = fr_histogram_percentile(&stats->interval.latency, 50) / 1000000.0;
+	stats->interval.latency_p90 = fr_histogram_percentile(&stats->interval.latency, 90) / 1000000.0;
+	stats->interval.latency_p99 = fr_histogram_percentile(&stats->interval.latency, 99) / 1000000.0;
+
 	if (isnan((long double)stats->latency_smoothed)) {
 		stats->latency_smoothed = 0;
 	}
@@ -655,6 +682,9 @@ static void rs_stats_print_code_fancy(rs_latency_t *stats, fr_radius_packet_code
 		INFO("\tHigh      : %.3lfms", stats->interval.latency_high);
 		INFO("\tLow       : %.3lfms", stats->interval.latency_low);
 		INFO("\tAverage   : %.3lfms", stats->interval.latency_average);
+		INFO("\tP50       : %.3lfms", stats->interval.latency_p50);
+		INFO("\tP90       : %.3lfms", stats->interval.latency_p90);
+		INFO("\tP99       : %.3lfms", stats->interval.latency_p99);
 		INFO("\tMA        : %.3lfms", stats->latency_smoothed);
 	}
 
@@ -747,6 +777,9 @@ static void rs_stats_print_csv_header(rs_update_t *this)
 			",\"%s lat low (ms)\""
 			",\"%s lat avg (ms)\""
 			",\"%s lat ma (ms)\""
+			",\"%s lat p50 (ms)\""
+			",\"%s lat p90 (ms)\""
+			",\"%s lat p99 (ms)\""
 			",\"%s lost/s\""
 			",\"%s reused/s\"",
 			name,
@@ -757,6 +790,9 @@ static void rs_stats_print_csv_header(rs_update_t *this)
 			name,
 			name,
 			name,
+			name,
+			name,
+			name,
 			name);
 
 		for (j = 1; j <= RS_RETRANSMIT_MAX; j++) {
@@ -776,7 +812,7 @@ static ssize_t rs_stats_print_code_csv(char *out, size_t outlen, rs_latency_t *s
 	size_t	i;
 	char	*p = out, *end = out + outlen;
 
-	p += snprintf(out, outlen, ",%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf",
+	p += snprintf(out, outlen, ",%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf,%.3lf",
 		      stats->interval.received,
 		      stats->interval.linked,
 		      stats->interval.unlinked,
@@ -784,6 +820,9 @@ static ssize_t rs_stats_print_code_csv(char *out, size_t outlen, rs_latency_t *s
 		      stats->interval.latency_low,
 		      stats->interval.latency_average,
 		      stats->latency_smoothed,
+		      stats->interval.latency_p50,
+		      stats->interval.latency_p90,
+		      stats->interval.latency_p99,
 		      stats->interval.lost,
 		      stats->interval.reused);
 	if (p >= end) return -1;
@@ -798,7 +837,7 @@ static ssize_t rs_stats_print_code_csv(char *out, size_t outlen, rs_latency_t *s
 
 static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED struct timeval *now)
 {
-	char buffer[2048], *p = buffer, *end = buffer + sizeof(buffer);
+	char buffer[4096], *p = buffer, *end = buffer + sizeof(buffer);
 	fr_pcap_t	*in_p;
 	size_t		i;
 	size_t		rs_codes_len = (NUM_ELEMENTS(rs_useful_codes));
@@ -838,6 +877,45 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	fprintf(stdout , "%s\n", buffer);
 }
 
+/** Add the stats for an interval from a capture queue to the main stats
+ *
+ * The queue's interval is then cleared.
+ *
+ * @note Must be called with the queue's mutex held.
+ */
+static void rs_stats_merge(rs_stats_t *stats, rs_stats_t *queue_stats)
+{
+	size_t	i;
+	int	j;
+	size_t	rs_codes_len = (NUM_ELEMENTS(rs_useful_codes));
+
+	if (timercmp(&queue_stats->quiet, &stats->quiet, >)) stats->quiet = queue_stats->quiet;
+
+	for (i = 0; i < rs_codes_len; i++) {
+		rs_latency_t *out = &stats->exchange[rs_useful_codes[i]];
+		rs_latency_t *in = &queue_stats->exchange[rs_useful_codes[i]];
+
+		out->interval.received_total += in->interval.received_total;
+		out->interval.linked_total += in->interval.linked_total;
+		out->interval.unlinked_total += in->interval.unlinked_total;
+		out->interval.reused_total += in->interval.reused_total;
+		out->interval.lost_total += in->interval.lost_total;
+		for (j = 0; j <= RS_RETRANSMIT_MAX; j++) out->interval.rt_total[j] += in->interval.rt_total[j];
+
+		out->interval.latency_total += in->interval.latency_total;
+		if (in->interval.latency_high > out->interval.latency_high) {
+			out->interval.latency_high = in->interval.latency_high;
+		}
+		if (in->interval.latency_low &&
+		    (!out->interval.latency_low || (in->interval.latency_low < out->interval.latency_low))) {
+			out->interval.latency_low = in->interval.latency_low;
+		}
+		fr_histogram_merge(&out->interval.latency, &in->interval.latency);
+
+		memset(&in->interval, 0, sizeof(in->interval));
+	}
+}
+
 /** Process stats for a single interval
  *
  */
@@ -849,6 +927,7 @@ static void rs_stats_process(fr_event_list_t *el, fr_time_t now_t, void *ctx)
 	rs_update_t	*this = ctx;
 	rs_stats_t	*stats = this->stats;
 	struct timeval	now;
+	int		q;
 
 	now = fr_time_to_timeval(now_t);
 
@@ -859,6 +938,15 @@ static void rs_stats_process(fr_event_list_t *el, fr_time_t now_t, void *ctx)
 
 	stats->intervals++;
 
+	/*
+	 *	The queues are paused while we look at their stats
+	 *	and capture handles.
+	 */
+	for (q = 0; this->queues && (q < conf->queues); q++) {
+		pthread_mutex_lock(&this->queues[q].mutex);
+		rs_stats_merge(stats, this->queues[q].stats);
+	}
+
 	for (in_p = this->in;
 	     in_p;
 	     in_p = in_p->next) {
@@ -902,6 +990,8 @@ clear:
 		       sizeof(stats->exchange[rs_useful_codes[i]].interval));
 	}
 
+	for (q = 0; this->queues && (q < conf->queues); q++) pthread_mutex_unlock(&this->queues[q].mutex);
+
 	{
 		static fr_event_timer_t const *event;
 
@@ -934,10 +1024,11 @@ static void rs_stats_update_latency(rs_latency_t *stats, struct timeval *latency
 	}
 	stats->interval.latency_total += (long double) lint;
 
+	fr_histogram_add(&stats->interval.latency, ((int64_t) latency->tv_sec * NSEC) + ((int64_t) latency->tv_usec * 1000));
 }
 
 static int rs_install_stats_processor(rs_stats_t *stats, fr_event_list_t *el,
-				      fr_pcap_t *in, struct timeval *now, bool live)
+				      fr_pcap_t *in, rs_queue_t *queues, struct timeval *now, bool live)
 {
 	static fr_event_timer_t	const *event;
 	static rs_update_t	update;
@@ -947,6 +1038,7 @@ static int rs_install_stats_processor(rs_stats_t *stats, fr_event_list_t *el,
 	update.list = el;
 	update.stats = stats;
 	update.in = in;
+	update.queues = queues;
 
 	switch (conf->stats.out) {
 	default:
@@ -1134,7 +1226,10 @@ static void _rs_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *ct
 	rs_request_t *request = talloc_get_type_abort(ctx, rs_request_t);
 
 	request->event = NULL;
+
+	if (rs_queue) pthread_mutex_lock(&rs_queue->mutex);
 	rs_packet_cleanup(request);
+	if (rs_queue) pthread_mutex_unlock(&rs_queue->mutex);
 }
 
 /** Wrapper around fr_packet_cmp to strip off the outer request struct
@@ -1279,7 +1374,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	bool			response;		/* Was it a response code */
 
 	decode_fail_t		reason;			/* Why we failed decoding the packet */
-	static uint64_t		captured = 0;
+	uint64_t		seen;
 
 	rs_status_t		status = RS_NORMAL;	/* Any special conditions (RTX, Unlinked, ID-Reused) */
 	fr_packet_t	*packet;		/* Current packet were processing */
@@ -1390,7 +1485,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	packet = fr_packet_alloc(conf, false);
+	packet = fr_packet_alloc(packet_ctx, false);
 	if (!packet) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1757,7 +1852,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = rs_request_alloc(conf);
+			original = rs_request_alloc(packet_ctx);
 			original->id = count;
 			original->in = event->in;
 			original->stats_req = &stats->exchange[packet->code];
@@ -1913,19 +2008,29 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		fr_packet_free(&packet);	/* Also frees decoded */
 	}
 
-	captured++;
+	seen = atomic_fetch_add_explicit(&captured, 1, memory_order_relaxed) + 1;
+
 	/*
 	 *	We've hit our capture limit, break out of the event loop
 	 */
-	if ((conf->limit > 0) && (captured >= conf->limit)) {
-		INFO("Captured %" PRIu64 " packets, exiting...", captured);
-		fr_event_loop_exit(events, 1);
+	if ((conf->limit > 0) && (seen >= conf->limit)) {
+		if (!rs_queue) {
+			INFO("Captured %" PRIu64 " packets, exiting...", seen);
+			fr_event_loop_exit(events, 1);
+
+		/*
+		 *	Capture queues stop when the main event loop exits.
+		 */
+		} else if (seen == conf->limit) {
+			INFO("Captured %" PRIu64 " packets, exiting...", seen);
+			rs_signal_self(SIGTERM);
+		}
 	}
 }
 
 static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *ctx)
 {
-	static uint64_t		count = 0;	/* Packets seen */
+	static _Thread_local uint64_t	count = 0;	/* Packets seen */
 	static fr_time_t	last_sync = fr_time_wrap(0);
 	fr_time_t		now_real;
 	rs_event_t		*event = talloc_get_type(ctx, rs_event_t);
@@ -1940,10 +2045,12 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 	 *	Because the event loop might be running on synthetic
 	 *	pcap file time, we need to implement our own time
 	 *	tracking here, and run the monotonic/wallclock sync
-	 *	event ourselves.
+	 *	event ourselves.  Only the first capture queue does
+	 *	this, as the offsets are global.
 	 */
 	now_real = fr_time();
-	if (fr_time_delta_gt(fr_time_sub(now_real, last_sync), fr_time_delta_from_sec(1))) {
+	if ((!rs_queue || (rs_queue->id == 0)) &&
+	    fr_time_delta_gt(fr_time_sub(now_real, last_sync), fr_time_delta_from_sec(1))) {
 		fr_time_sync();
 		last_sync = now_real;
 	}
@@ -1982,7 +2089,7 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 			 *	of the first packet in the trace.
 			 */
 			if (conf->stats.interval && !stats_started) {
-				rs_install_stats_processor(event->stats, el, NULL, &header->ts, false);
+				rs_install_stats_processor(event->stats, el, NULL, NULL, &header->ts, false);
 				stats_started = true;
 			}
 
@@ -2000,20 +2107,22 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 	 *	Consume multiple packets from the capture buffer.
 	 *	We occasionally need to yield to allow events to run.
 	 */
+	if (rs_queue) pthread_mutex_lock(&rs_queue->mutex);
 	for (i = 0; i < RS_FORCE_YIELD; i++) {
 		ret = pcap_next_ex(handle, &header, &data);
 		if (ret == 0) {
 			/* No more packets available at this time */
-			return;
+			break;
 		}
 		if (ret < 0) {
 			ERROR("Error requesting next packet, got (%i): %s", ret, pcap_geterr(handle));
-			return;
+			break;
 		}
 
 		count++;
 		rs_packet_process(count, event, header, data);
 	}
+	if (rs_queue) pthread_mutex_unlock(&rs_queue->mutex);
 }
 
 static int  _rs_event_status(UNUSED fr_time_t now, fr_time_delta_t wake_t, UNUSED void *uctx)
@@ -2260,6 +2369,214 @@ fr_event_list_t *list, int fd, int UNUSED flags, UNUSED void *ctx)
 	}
 }
 
+#ifdef PACKET_FANOUT
+/** Add a capture handle to a PACKET_FANOUT group
+ *
+ * The kernel distributes packets between the sockets in the group using
+ * a symmetric hash of the flow, so a request and its response are read
+ * from the same socket.
+ */
+static int rs_pcap_fanout(fr_pcap_t *in, uint16_t group)
+{
+	int arg = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+
+	if (setsockopt(pcap_fileno(in->handle), SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+		fr_strerror_printf("Failed joining fanout group: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+static int rs_pcap_fanout(UNUSED fr_pcap_t *in, UNUSED uint16_t group)
+{
+	fr_strerror_const("Multiple capture queues are not supported on this platform");
+	return -1;
+}
+#endif
+
+static int _rs_queues_free(rs_queue_t *queues)
+{
+	size_t i;
+
+	for (i = 0; i < talloc_array_length(queues); i++) {
+		if (queues[i].stop[0] >= 0) close(queues[i].stop[0]);
+		if (queues[i].stop[1] >= 0) close(queues[i].stop[1]);
+		pthread_mutex_destroy(&queues[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Divide the capture handles between the queues
+ *
+ * There are conf->queues handles for each interface, which are consecutive
+ * in the list.  Each set is added to its own fanout group, and each handle
+ * in the set goes to a different queue.
+ */
+static rs_queue_t *rs_queues_alloc(TALLOC_CTX *ctx, fr_pcap_t *in)
+{
+	rs_queue_t	*queues;
+	fr_pcap_t	*in_p;
+	char const	*name = NULL;
+	uint16_t	group = getpid() & 0xffff;
+	int		i, q = 0;
+
+	MEM(queues = talloc_zero_array(ctx, rs_queue_t, conf->queues));
+	for (i = 0; i < conf->queues; i++) {
+		queues[i].id = i;
+		queues[i].stop[0] = queues[i].stop[1] = -1;
+		pthread_mutex_init(&queues[i].mutex, NULL);
+		MEM(queues[i].stats = talloc_zero(queues, rs_stats_t));
+		MEM(queues[i].in = talloc_array(queues, fr_pcap_t *, 0));
+	}
+	talloc_set_destructor(queues, _rs_queues_free);
+
+	for (in_p = in; in_p; in_p = in_p->next) {
+		size_t num;
+
+		if (!name || (strcmp(name, in_p->name) != 0)) {
+			name = in_p->name;
+			group++;
+			q = 0;
+		} else {
+			q++;
+		}
+		RS_ASSERT(q < conf->queues);
+
+		if (rs_pcap_fanout(in_p, group) < 0) {
+			fr_perror("radsniff: %s", in_p->name);
+			talloc_free(queues);
+			return NULL;
+		}
+
+		num = talloc_array_length(queues[q].in);
+		MEM(queues[q].in = talloc_realloc(queues, queues[q].in, fr_pcap_t *, num + 1));
+		queues[q].in[num] = in_p;
+
+		in_p->name = talloc_typed_asprintf(in_p, "%s:%i", name, q);
+	}
+
+	return queues;
+}
+
+/** Tell a capture queue to exit
+ *
+ */
+static void rs_queue_stop(fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *ctx)
+{
+	uint8_t stop;
+
+	if (read(fd, &stop, sizeof(stop)) < 0) {
+		ERROR("Failed reading from queue pipe: %s", fr_syserror(errno));
+	}
+
+	fr_event_loop_exit(el, 1);
+}
+
+/** Capture and process packets for one queue
+ *
+ * Runs in its own thread, with its own event list, matching tables and
+ * stats.  The main thread only looks at the queue with its mutex held.
+ */
+static void *rs_queue_run(void *arg)
+{
+	rs_queue_t	*queue = arg;
+	TALLOC_CTX	*ctx;
+	size_t		i;
+
+	rs_queue = queue;
+	MEM(ctx = packet_ctx = talloc_new(NULL));
+
+	events = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!events) {
+		fr_perror("radsniff: Failed creating event list for queue %i", queue->id);
+	error:
+		rs_signal_self(SIGTERM);
+		talloc_free(ctx);
+		return NULL;
+	}
+
+	request_tree = fr_rb_inline_talloc_alloc(ctx, rs_request_t, request_node, rs_packet_cmp, _unmark_request);
+	if (!request_tree) {
+		ERROR("Failed creating request tree");
+		goto error;
+	}
+
+	if (conf->link_da_num) {
+		link_tree = fr_rb_inline_talloc_alloc(ctx, rs_request_t, link_node, rs_rtx_cmp, _unmark_link);
+		if (!link_tree) {
+			ERROR("Failed creating RTX tree");
+			goto error;
+		}
+	}
+
+	if (fr_event_fd_insert(NULL, NULL, events, queue->stop[0], rs_queue_stop, NULL, NULL, NULL) < 0) {
+		fr_perror("Failed inserting queue pipe descriptor");
+		goto error;
+	}
+
+	for (i = 0; i < talloc_array_length(queue->in); i++) {
+		rs_event_t *event;
+
+		MEM(event = talloc_zero(events, rs_event_t));
+		event->list = events;
+		event->in = queue->in[i];
+		event->stats = queue->stats;
+
+		if (fr_event_fd_insert(NULL, NULL, events, event->in->fd, rs_got_packet, NULL, NULL, event) < 0) {
+			fr_perror("Failed inserting file descriptor");
+			goto error;
+		}
+	}
+
+	fr_event_loop(events);
+
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+static int rs_queues_start(rs_queue_t *queues)
+{
+	int i, ret;
+
+	for (i = 0; i < conf->queues; i++) {
+		if (pipe(queues[i].stop) < 0) {
+			ERROR("Couldn't open queue pipe: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		ret = pthread_create(&queues[i].thread, NULL, rs_queue_run, &queues[i]);
+		if (ret != 0) {
+			ERROR("Failed starting capture queue %i: %s", i, fr_syserror(ret));
+			return -1;
+		}
+		queues[i].running = true;
+	}
+
+	return 0;
+}
+
+static void rs_queues_stop(rs_queue_t *queues)
+{
+	int i;
+
+	for (i = 0; i < conf->queues; i++) {
+		uint8_t stop = 0;
+
+		if (!queues[i].running) continue;
+
+		if (write(queues[i].stop[1], &stop, sizeof(stop)) < 0) {
+			ERROR("Failed stopping capture queue %i: %s", i, fr_syserror(errno));
+			continue;
+		}
+
+		pthread_join(queues[i].thread, NULL);
+		queues[i].running = false;
+	}
+}
+
 static NEVER_RETURNS void usage(int status)
 {
 	FILE *output = status ? stderr : stdout;
@@ -2290,6 +2607,8 @@ static NEVER_RETURNS void usage(int status)
 	fprintf(output, "  -p <port>             Filter packets by port (default is %i).\n", FR_AUTH_UDP_PORT);
 	fprintf(output, "  -P <pidfile>          Daemonize and write out <pidfile>.\n");
 	fprintf(output, "  -q                    Print less debugging information.\n");
+	fprintf(output, "  -Q <queues>           Capture from each interface with <queues> sockets, each read by\n");
+	fprintf(output, "                        its own thread (Linux only).\n");
 	fprintf(output, "  -r <filter>           RADIUS attribute request filter.\n");
 	fprintf(output, "  -R <filter>           RADIUS attribute response filter.\n");
 	fprintf(output, "  -s <secret>           RADIUS secret.\n");
@@ -2334,6 +2653,7 @@ int main(int argc, char *argv[])
 	TALLOC_CTX		*autofree;
 
 	rs_stats_t		*stats;
+	rs_queue_t		*queues = NULL;
 
 	fr_debug_lvl = 1;
 	fr_log_fp = stdout;
@@ -2363,6 +2683,7 @@ int main(int argc, char *argv[])
 	fr_pair_list_init(&conf->filter_response_vps);
 
 	stats = talloc_zero(conf, rs_stats_t);
+	packet_ctx = conf;
 
 	/*
 	 *	Set some defaults
@@ -2370,6 +2691,7 @@ int main(int argc, char *argv[])
 	conf->print_packet = true;
 	conf->limit = 0;
 	conf->promiscuous = true;
+	conf->queues = 1;
 #ifdef HAVE_COLLECTDC_H
 	conf->stats.prefix = RS_DEFAULT_PREFIX;
 #endif
@@ -2383,7 +2705,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:St:vw:xXW:T:P:N:O:Z:")) != -1) {
+	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qQ:r:R:s:St:vw:xXW:T:P:N:O:Z:")) != -1) {
 		switch (c) {
 		case 'a':
 		{
@@ -2505,6 +2827,14 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'Q':
+			conf->queues = atoi(optarg);
+			if ((conf->queues < 1) || (conf->queues > RS_MAX_QUEUES)) {
+				ERROR("Number of queues must be between 1 and %i", RS_MAX_QUEUES);
+				usage(64);
+			}
+			break;
+
 		case 'r':
 			conf->filter_request = optarg;
 			break;
@@ -2651,6 +2981,16 @@ int main(int argc, char *argv[])
 		conf->to_stdout = false;
 	}
 
+	/*
+	 *	The queues share nothing but the stats, so they can't
+	 *	write to a common output.
+	 */
+	if ((conf->queues > 1) &&
+	    (conf->from_file || conf->from_stdin || conf->to_file || conf->to_stdout || conf->to_output_dir)) {
+		ERROR("Multiple queues (-Q) can only be used when capturing from interfaces, without writing packets");
+		usage(64);
+	}
+
 	if (conf->to_stdout) {
 		out = fr_pcap_init(conf, "stdout", PCAP_STDIO_OUT);
 		if (!out) {
@@ -2942,6 +3282,26 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	/*
+	 *	Each queue needs its own handle for every interface.
+	 */
+	if (conf->queues > 1) {
+		for (in_p = in; in_p; in_p = in_p->next) {
+			int i;
+
+			for (i = 1; i < conf->queues; i++) {
+				fr_pcap_t *clone;
+
+				clone = fr_pcap_init(conf, in_p->name, PCAP_INTERFACE_IN);
+				if (!clone) goto finish;
+
+				clone->next = in_p->next;
+				in_p->next = clone;
+				in_p = clone;
+			}
+		}
+	}
+
 	/*
 	 *	This actually opens the capture interfaces/files (we just allocated the memory earlier)
 	 */
@@ -2998,6 +3358,11 @@ int main(int argc, char *argv[])
 		fr_strerror_clear();
 	}
 
+	if (conf->queues > 1) {
+		queues = rs_queues_alloc(conf, in);
+		if (!queues) goto finish;
+	}
+
 	/*
 	 *	Open our output interface (if we have one);
 	 */
@@ -3071,14 +3436,19 @@ int main(int argc, char *argv[])
 		 */
 		if (conf->stats.interval && conf->from_dev) {
 			now = fr_time_to_timeval(fr_time());
-			rs_install_stats_processor(stats, events, in, &now, false);
+			rs_install_stats_processor(stats, events, in, queues, &now, false);
 		}
 
 		/*
-		 *  Now add fd's for each of the pcap sessions we opened
+		 *  The queues read their own pcap sessions
+		 */
+		if (queues && (rs_queues_start(queues) < 0)) goto finish;
+
+		/*
+		 *  Otherwise add fd's for each of the pcap sessions we opened
 		 */
 		for (in_p = in;
-		     in_p;
+		     !queues && in_p;
 		     in_p = in_p->next) {
 			rs_event_t *event;
 
@@ -3122,7 +3492,7 @@ int main(int argc, char *argv[])
 	/*
 	 *	If we just have the pipe, then exit.
 	 */
-	if (fr_event_list_num_fds(events) == 1) goto finish;
+	if (!queues && (fr_event_list_num_fds(events) == 1)) goto finish;
 
 	/*
 	 *	Do this as late as possible so we can return an error code if something went wrong.
@@ -3150,6 +3520,8 @@ int main(int argc, char *argv[])
 finish:
 	cleanup = true;
 
+	if (queues) rs_queues_stop(queues);
+
 	if (conf->daemonize) unlink(conf->pidfile);
 
 	/*
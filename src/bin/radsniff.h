@@ -28,9 +28,11 @@
 RCSIDH(radsniff_h, "$Id$")
 
 #include <sys/types.h>
+#include <pthread.h>
 
 #include <freeradius-devel/util/pcap.h>
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/radius/radius.h>
 
 #ifdef HAVE_COLLECTDC_H
@@ -44,6 +46,7 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_MAX_QUEUES		64		//!< Maximum number of capture queues per interface.
 
 /*
  *	Logging macros
@@ -139,6 +142,11 @@ typedef struct {
 
 		double			latency_high;		//!< Latency high water mark.
 		double			latency_low;		//!< Latency low water mark.
+
+		fr_histogram_t		latency;		//!< Distribution of latency in the interval (ns).
+		double			latency_p50;		//!< Median latency.
+		double			latency_p90;		//!< 90th percentile latency.
+		double			latency_p99;		//!< 99th percentile latency.
 	} interval;
 } rs_latency_t;
 
@@ -230,6 +238,27 @@ typedef struct {
 	rs_stats_t		*stats;			//!< Where to write stats.
 } rs_event_t;
 
+/** A capture queue
+ *
+ * Each queue reads one socket of a PACKET_FANOUT group per interface, in
+ * its own thread.  The kernel hashes the flow to pick the socket, so a
+ * request and its response are seen by the same queue, which has its own
+ * request/response matching tables and stats.
+ */
+typedef struct {
+	int			id;			//!< Queue number.
+	pthread_t		thread;
+	bool			running;		//!< Whether the thread was started.
+
+	pthread_mutex_t		mutex;			//!< Held by the thread while processing packets, and
+							//!< by the stats processor while merging stats.
+	int			stop[2];		//!< Pipe used to tell the thread to exit.
+
+	fr_pcap_t		**in;			//!< Handles this queue reads from, one per interface.
+	rs_stats_t		*stats;			//!< Stats for this queue.  Merged into the main stats
+							//!< each interval.
+} rs_queue_t;
+
 typedef struct rs_update rs_update_t;
 
 /** Callback for printing stats header.
@@ -252,6 +281,7 @@ struct rs_update {
 
 	fr_pcap_t			*in;			//!< Linked list of PCAP handles to check for drops.
 	rs_stats_t			*stats;			//!< Stats to process.
+	rs_queue_t			*queues;		//!< Capture queues to merge stats from.
 	rs_stats_print_header_cb_t	head;			//!< Print header.
 	rs_stats_print_cb_t		body;			//!< Print body.
 };
@@ -303,6 +333,7 @@ struct rs {
 	rs_packet_logger_t	logger;			//!< Packet logger
 
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
+	int			queues;			//!< Number of capture queues (and threads) per interface.
 	uint64_t		limit;			//!< Maximum number of packets to capture
 
 	struct {
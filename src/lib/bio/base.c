@@ -89,6 +89,98 @@ ssize_t fr_bio_next_write(fr_bio_t *bio, void *packet_ctx, void const *buffer, s
 	return rcode;
 }
 
+/** Read multiple packets by calling read() for each one
+ *
+ *  Used for bios which don't have a native readv() function, and by native readv() functions when the bio
+ *  has changed state, and read() is no longer the function they expect.
+ */
+ssize_t fr_bio_shim_readv(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		ssize_t rcode;
+
+		rcode = bio->read(bio, vec[i].packet_ctx, vec[i].buffer, vec[i].size);
+		if (rcode < 0) return (i > 0) ? (ssize_t) i : rcode;
+		if (rcode == 0) break;
+
+		vec[i].size = rcode;
+	}
+
+	return i;
+}
+
+/** Write multiple packets by calling write() for each one
+ *
+ *  Used for bios which don't have a native writev() function, and by native writev() functions when the bio
+ *  has changed state, and write() is no longer the function they expect.
+ */
+ssize_t fr_bio_shim_writev(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		ssize_t rcode;
+
+		rcode = bio->write(bio, vec[i].packet_ctx, vec[i].buffer, vec[i].size);
+		if (rcode < 0) return (i > 0) ? (ssize_t) i : rcode;
+
+		if ((size_t) rcode < vec[i].size) {
+			if (rcode > 0) vec[i].size = rcode;
+			break;
+		}
+	}
+
+	return i;
+}
+
+/** Internal bio function which just reads multiple packets from the "next" bio.
+ *
+ */
+ssize_t fr_bio_next_readv(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	ssize_t rcode;
+	fr_bio_t *next;
+
+	next = fr_bio_next(bio);
+	fr_assert(next != NULL);
+
+	rcode = next->readv ? next->readv(next, vec, num) : fr_bio_shim_readv(next, vec, num);
+	if (rcode >= 0) return rcode;
+
+	if (rcode == fr_bio_error(IO_WOULD_BLOCK)) return rcode;
+
+	bio->read = fr_bio_fail_read;
+	bio->write = fr_bio_fail_write;
+	bio->readv = NULL;
+	bio->writev = NULL;
+	return rcode;
+}
+
+/** Internal bio function which just writes multiple packets to the "next" bio.
+ *
+ */
+ssize_t fr_bio_next_writev(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	ssize_t rcode;
+	fr_bio_t *next;
+
+	next = fr_bio_next(bio);
+	fr_assert(next != NULL);
+
+	rcode = next->writev ? next->writev(next, vec, num) : fr_bio_shim_writev(next, vec, num);
+	if (rcode >= 0) return rcode;
+
+	if (rcode == fr_bio_error(IO_WOULD_BLOCK)) return rcode;
+
+	bio->read = fr_bio_fail_read;
+	bio->write = fr_bio_fail_write;
+	bio->readv = NULL;
+	bio->writev = NULL;
+	return rcode;
+}
+
 /** Free this bio, and everything it calls.
  *
  *  We unlink the bio chain, and then free it individually.  If there's an error, the bio chain is relinked.
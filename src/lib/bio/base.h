@@ -80,6 +80,45 @@ typedef struct fr_bio_s fr_bio_t;
 typedef ssize_t	(*fr_bio_read_t)(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t size);
 typedef ssize_t	(*fr_bio_write_t)(fr_bio_t *bio, void *packet_ctx, const void *buffer, size_t size);
 
+/** One buffer in a vectored read or write
+ *
+ *  Each entry is the equivalent of one call to #fr_bio_read_t or #fr_bio_write_t.
+ */
+typedef struct {
+	void		*packet_ctx;			//!< per-packet information, as with #fr_bio_read_t
+	void		*buffer;			//!< where to read data to, or the data to write
+	size_t		size;				//!< size of the buffer.  For reads, this is updated
+							///< to the amount of data which was read.
+} fr_bio_vec_t;
+
+/**  Read multiple packets at once
+ *
+ *  Only entries which contain data are returned.  The returned entries are at the start of the vector,
+ *  in the order they were read, and the entries which weren't used are moved to the end.  The caller
+ *  therefore must not assume that vec[i] still contains the buffer it set there.
+ *
+ *  @param bio		the binary IO handler
+ *  @param vec		of buffers to read into.
+ *  @param num		number of entries in the vector.
+ *  @return
+ *	- <0 for error
+ *	- 0 for "no data available"
+ *	- >0 for the number of entries which were filled.
+ */
+typedef ssize_t	(*fr_bio_readv_t)(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num);
+
+/**  Write multiple packets at once
+ *
+ *  @param bio		the binary IO handler
+ *  @param vec		of buffers to write.
+ *  @param num		number of entries in the vector.
+ *  @return
+ *	- <0 for error, when nothing was written.
+ *	- >=0 for the number of entries which were written in full.  If the next entry was written in
+ *	  part, which can only happen for stream bios, its size is updated to the amount written.
+ */
+typedef ssize_t	(*fr_bio_writev_t)(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num);
+
 typedef int (*fr_bio_io_t)(fr_bio_t *bio); /* read / write blocked callbacks */
 
 typedef void (*fr_bio_callback_t)(fr_bio_t *bio); /* connected / shutdown callbacks */
@@ -115,6 +154,9 @@ struct fr_bio_s {
 	fr_bio_read_t	_CONST	read;			//!< read from the underlying bio
 	fr_bio_write_t	_CONST	write;			//!< write to the underlying bio
 
+	fr_bio_readv_t	_CONST	readv;			//!< read many packets, or NULL to call read() for each.
+	fr_bio_writev_t	_CONST	writev;			//!< write many packets, or NULL to call write() for each.
+
 	fr_dlist_t	_CONST entry;			//!< in the linked list of multiple bios
 };
 
@@ -181,6 +223,55 @@ static inline ssize_t CC_HINT(nonnull(1)) fr_bio_write(fr_bio_t *bio, void *pack
 	return bio->write(bio, packet_ctx, buffer, size);
 }
 
+ssize_t	fr_bio_shim_readv(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num) CC_HINT(nonnull);
+
+ssize_t	fr_bio_shim_writev(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num) CC_HINT(nonnull);
+
+/** Read multiple packets from a bio
+ *
+ *  Bios which can't read many packets at once have read() called for each entry in the vector.
+ *
+ *  @param bio		the binary IO handler
+ *  @param vec		of buffers to read into.  See #fr_bio_readv_t.
+ *  @param num		number of entries in the vector.
+ *  @return
+ *	- <0 for error.  The return code will be fr_bio_error(ERROR_NAME)
+ *	- 0 for "did not read any data".
+ *	- >0 for the number of entries which were filled.
+ */
+static inline ssize_t CC_HINT(nonnull) fr_bio_readv(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	if (num == 0) return 0;
+
+	fr_assert(!fr_bio_prev(bio));
+
+	if (bio->readv) return bio->readv(bio, vec, num);
+
+	return fr_bio_shim_readv(bio, vec, num);
+}
+
+/** Write multiple packets to a bio
+ *
+ *  Bios which can't write many packets at once have write() called for each entry in the vector.
+ *
+ *  @param bio		the binary IO handler
+ *  @param vec		of buffers to write.  See #fr_bio_writev_t.
+ *  @param num		number of entries in the vector.
+ *  @return
+ *	- <0 for error.  The return code will be fr_bio_error(ERROR_NAME)
+ *	- >=0 for the number of entries which were written in full.
+ */
+static inline ssize_t CC_HINT(nonnull) fr_bio_writev(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	if (num == 0) return 0;
+
+	fr_assert(!fr_bio_prev(bio));
+
+	if (bio->writev) return bio->writev(bio, vec, num);
+
+	return fr_bio_shim_writev(bio, vec, num);
+}
+
 int	fr_bio_shutdown_intermediate(fr_bio_t *bio) CC_HINT(nonnull);
 
 #ifndef NDEBUG
@@ -62,6 +62,25 @@ ssize_t fr_bio_next_read(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t s
 
 ssize_t fr_bio_next_write(fr_bio_t *bio, void *packet_ctx, void const *buffer, size_t size);
 
+ssize_t fr_bio_next_readv(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num);
+
+/** Move an entry which was read to the front of the vector
+ *
+ *  The entry it replaces goes to where the read entry was, so that no buffer is lost.
+ */
+static inline void fr_bio_vec_keep(fr_bio_vec_t *vec, size_t used, size_t i)
+{
+	fr_bio_vec_t tmp;
+
+	if (used == i) return;
+
+	tmp = vec[used];
+	vec[used] = vec[i];
+	vec[i] = tmp;
+}
+
+ssize_t fr_bio_next_writev(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num);
+
 /** Chain one bio after another.
  *
  *  @todo - this likely needs to be public
@@ -29,7 +29,7 @@ size_t fr_bio_buf_make_room(fr_bio_buf_t *bio_buf)
 {
 	size_t used;
 
-	if (bio_buf->read == bio_buf->start) return fr_bio_buf_write_room(bio_buf);
+	if (bio_buf->pinned || (bio_buf->read == bio_buf->start)) return fr_bio_buf_write_room(bio_buf);
 
 	used = bio_buf->write - bio_buf->read;
 	if (!used) return fr_bio_buf_write_room(bio_buf);
@@ -62,7 +62,7 @@ size_t fr_bio_buf_read(fr_bio_buf_t *bio_buf, void *buffer, size_t size)
 	if (bio_buf->read == bio_buf->write) {
 		fr_bio_buf_reset(bio_buf);
 
-	} else if ((bio_buf->end - bio_buf->read) < (bio_buf->read - bio_buf->start)) {
+	} else if (!bio_buf->pinned && (bio_buf->end - bio_buf->read) < (bio_buf->read - bio_buf->start)) {
 		/*
 		 *	The "read" pointer is closer to the end of the
 		 *	buffer than to the start.  Shift the data
@@ -70,7 +70,7 @@ size_t fr_bio_buf_read(fr_bio_buf_t *bio_buf, void *buffer, size_t size)
 		 *
 		 *	@todo - change the check instead to "(end - write) < min_room"
 		 *
-		 *	@todo - what about pending packets which point to the buffer?
+		 *	Borrowed packets pin the buffer, so we don't move anything.
 		 */
 		fr_bio_buf_make_room(bio_buf);
 	}
@@ -111,6 +111,28 @@ ssize_t	fr_bio_buf_write(fr_bio_buf_t *bio_buf, const void *buffer, size_t size)
 	return size;
 }
 
+/** Release data which was borrowed via fr_bio_buf_borrow()
+ *
+ *  Once nothing is borrowed, the buffer can be reset or compacted
+ *  again.
+ */
+void fr_bio_buf_release(fr_bio_buf_t *bio_buf, NDEBUG_UNUSED void const *buffer)
+{
+	fr_bio_buf_verify(bio_buf);
+
+	fr_assert(bio_buf->pinned > 0);
+	fr_assert(((uint8_t const *) buffer >= bio_buf->start) && ((uint8_t const *) buffer < bio_buf->read));
+
+	if (--bio_buf->pinned) return;
+
+	if (bio_buf->read == bio_buf->write) {
+		fr_bio_buf_reset(bio_buf);
+		return;
+	}
+
+	if ((bio_buf->end - bio_buf->read) < (bio_buf->read - bio_buf->start)) fr_bio_buf_make_room(bio_buf);
+}
+
 int fr_bio_buf_alloc(TALLOC_CTX *ctx, fr_bio_buf_t *bio_buf, size_t size)
 {
 	void *ptr;
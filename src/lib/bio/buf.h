@@ -32,12 +32,15 @@ typedef struct {
 
 	uint8_t		*read;		//!< where in the buffer reads are taken from
 	uint8_t		*write;		//!< where in the buffer writes are sent to
+
+	unsigned int	pinned;		//!< number of borrowed regions.  While non-zero, data is never moved.
 } fr_bio_buf_t;
 
 static inline void fr_bio_buf_init(fr_bio_buf_t *bio_buf, uint8_t *buffer, size_t size)
 {
 	bio_buf->start = bio_buf->read = bio_buf->write = buffer;
 	bio_buf->end = buffer + size;
+	bio_buf->pinned = 0;
 }
 
 size_t		fr_bio_buf_make_room(fr_bio_buf_t *bio_buf);
@@ -62,6 +65,15 @@ static inline void CC_HINT(nonnull) fr_bio_buf_reset(fr_bio_buf_t *bio_buf)
 {
 	fr_bio_buf_verify(bio_buf);
 
+	/*
+	 *	Someone still points to data before "read".  We can't
+	 *	overwrite it.
+	 */
+	if (bio_buf->pinned) {
+		bio_buf->write = bio_buf->read;
+		return;
+	}
+
 	bio_buf->read = bio_buf->write = bio_buf->start;
 }
 
@@ -148,6 +160,31 @@ static inline void CC_HINT(nonnull) fr_bio_buf_write_update(fr_bio_buf_t *bio_bu
 }
 #endif
 
+/** Borrow data from the buffer, without copying it.
+ *
+ *  The data is consumed, just as with fr_bio_buf_read().  But it
+ *  stays where it is until fr_bio_buf_release() is called.
+ *
+ * @param[in] bio_buf	to borrow from.
+ * @param[in] size	of the data to borrow.  Must be no more than fr_bio_buf_used().
+ * @return		pointer to the borrowed data.
+ */
+static inline uint8_t *CC_HINT(nonnull) fr_bio_buf_borrow(fr_bio_buf_t *bio_buf, size_t size)
+{
+	uint8_t *p;
+
+	fr_bio_buf_verify(bio_buf);
+	fr_assert(size <= fr_bio_buf_used(bio_buf));
+
+	p = bio_buf->read;
+	bio_buf->read += size;
+	bio_buf->pinned++;
+
+	return p;
+}
+
+void	fr_bio_buf_release(fr_bio_buf_t *bio_buf, void const *buffer) CC_HINT(nonnull);
+
 static inline size_t CC_HINT(nonnull) fr_bio_buf_size(fr_bio_buf_t const *bio_buf)
 {
 	fr_bio_buf_verify(bio_buf);
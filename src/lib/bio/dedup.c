@@ -850,24 +850,12 @@ static ssize_t fr_bio_dedup_write(fr_bio_t *bio, void *packet_ctx, void const *b
 	return fr_bio_dedup_blocked(my, item, rcode);
 }
 
-static ssize_t fr_bio_dedup_read(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t size)
+/** Track a packet which was read, and decide if the application should receive it.
+ *
+ */
+static bool fr_bio_dedup_receive(fr_bio_dedup_t *my, void *packet_ctx, void *buffer, size_t size)
 {
-	ssize_t rcode;
 	fr_bio_dedup_entry_t *item;
-	fr_bio_dedup_t *my = talloc_get_type_abort(bio, fr_bio_dedup_t);
-	fr_bio_t *next;
-
-	/*
-	 *	There must be a next bio.
-	 */
-	next = fr_bio_next(&my->bio);
-	fr_assert(next != NULL);
-
-	/*
-	 *	Read the packet.  If error or nothing, return immediately.
-	 */
-	rcode = next->read(next, packet_ctx, buffer, size);
-	if (rcode <= 0) return rcode;
 
 	/*
 	 *	Get a free item
@@ -880,7 +868,7 @@ static ssize_t fr_bio_dedup_read(fr_bio_t *bio, void *packet_ctx, void *buffer,
 		.my = my,
 		.packet_ctx = packet_ctx,
 		.packet = buffer,
-		.packet_size = (size_t) rcode,
+		.packet_size = size,
 		.state = FR_BIO_DEDUP_STATE_ACTIVE,
 	};
 
@@ -905,17 +893,71 @@ static ssize_t fr_bio_dedup_read(fr_bio_t *bio, void *packet_ctx, void *buffer,
 	 *	The caller should cancel any conflicting packets by calling fr_bio_dedup_entry_cancel().  Note
 	 *	that for sanity, we don't re-use the previous #fr_bio_dedup_entry_t.
 	 */
-	if (!my->receive(bio, item, packet_ctx)) {
+	if (!my->receive(&my->bio, item, packet_ctx)) {
 		item->state = FR_BIO_DEDUP_STATE_FREE;
 		fr_bio_dedup_list_insert_head(&my->free, item);
-		return 0;
+		return false;
 	}
 
 	fr_bio_dedup_list_insert_tail(&my->active, item);
 
+	return true;
+}
+
+static ssize_t fr_bio_dedup_read(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t size)
+{
+	ssize_t rcode;
+	fr_bio_dedup_t *my = talloc_get_type_abort(bio, fr_bio_dedup_t);
+	fr_bio_t *next;
+
+	/*
+	 *	There must be a next bio.
+	 */
+	next = fr_bio_next(&my->bio);
+	fr_assert(next != NULL);
+
+	/*
+	 *	Read the packet.  If error or nothing, return immediately.
+	 */
+	rcode = next->read(next, packet_ctx, buffer, size);
+	if (rcode <= 0) return rcode;
+
+	if (!fr_bio_dedup_receive(my, packet_ctx, buffer, (size_t) rcode)) return 0;
+
 	return rcode;
 }
 
+/** Read a batch of packets, and return the ones which the application should receive.
+ *
+ */
+static ssize_t fr_bio_dedup_readv(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	ssize_t rcode;
+	size_t i, used, available;
+	fr_bio_dedup_t *my = talloc_get_type_abort(bio, fr_bio_dedup_t);
+
+	if (my->bio.read != fr_bio_dedup_read) return fr_bio_shim_readv(bio, vec, num);
+
+	/*
+	 *	Each packet we read needs a free item.
+	 */
+	available = fr_bio_dedup_list_num_elements(&my->free);
+	if (num > available) num = available;
+	if (!num) return 0;
+
+	rcode = fr_bio_next_readv(bio, vec, num);
+	if (rcode <= 0) return rcode;
+
+	for (i = 0, used = 0; i < (size_t) rcode; i++) {
+		if (!fr_bio_dedup_receive(my, vec[i].packet_ctx, vec[i].buffer, vec[i].size)) continue;
+
+		fr_bio_vec_keep(vec, used, i);
+		used++;
+	}
+
+	return used;
+}
+
 static int8_t _entry_cmp(void const *one, void const *two)
 {
 	fr_bio_dedup_entry_t const *a = one;
@@ -1087,6 +1129,7 @@ fr_bio_t *fr_bio_dedup_alloc(TALLOC_CTX *ctx, size_t max_saved,
 
 	my->bio.write = fr_bio_dedup_write;
 	my->bio.read = fr_bio_dedup_read;
+	my->bio.readv = fr_bio_dedup_readv;
 
 	fr_bio_chain(&my->bio, next);
 
@@ -278,6 +278,159 @@ retry:
 	return fr_bio_error(IO);
 }
 
+#define FR_BIO_FD_VEC_MAX	(32)	//!< Maximum number of packets read or written in one system call.
+
+#ifdef HAVE_RECVMMSG
+/** Read multiple packets from a datagram socket
+ *
+ *  Works for both connected and unconnected sockets.  Connected sockets do not update per-packet contexts.
+ *
+ *  Packets of zero length are skipped, and the remaining entries are moved to the front of the vector.
+ */
+static ssize_t fr_bio_fd_readv_datagram(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	int tries = 0;
+	ssize_t rcode;
+	size_t i, used;
+	bool connected;
+	fr_bio_fd_t *my = talloc_get_type_abort(bio, fr_bio_fd_t);
+	struct mmsghdr msgvec[FR_BIO_FD_VEC_MAX];
+	struct iovec iov[FR_BIO_FD_VEC_MAX];
+	struct sockaddr_storage sockaddr[FR_BIO_FD_VEC_MAX];
+
+	/*
+	 *	We're at EOF, or the socket has failed, or we're only writing.  The shim calls the current
+	 *	read function, which does the right thing.
+	 */
+	if (bio->read == fr_bio_fd_read_connected_datagram) {
+		connected = true;
+	} else if (bio->read == fr_bio_fd_recvfrom) {
+		connected = false;
+	} else {
+		return fr_bio_shim_readv(bio, vec, num);
+	}
+
+	if (num > FR_BIO_FD_VEC_MAX) num = FR_BIO_FD_VEC_MAX;
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = vec[i].buffer;
+		iov[i].iov_len = vec[i].size;
+
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+
+		if (connected) continue;
+
+		msgvec[i].msg_hdr.msg_name = &sockaddr[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof(sockaddr[i]);
+	}
+
+retry:
+#ifdef MSG_WAITFORONE
+	rcode = recvmmsg(my->info.socket.fd, msgvec, num, MSG_WAITFORONE, NULL);
+#else
+	rcode = recvmmsg(my->info.socket.fd, msgvec, num, 0, NULL);
+#endif
+	if (rcode > 0) {
+		for (i = 0, used = 0; i < (size_t) rcode; i++) {
+			if (!msgvec[i].msg_len) continue;
+
+			fr_bio_vec_keep(vec, used, i);
+			vec[used].size = msgvec[i].msg_len;
+
+			if (!connected) {
+				fr_bio_fd_packet_ctx_t *addr = fr_bio_fd_packet_ctx(my, vec[used].packet_ctx);
+
+				ADDR_INIT;
+
+				addr->socket.inet.dst_ipaddr = my->info.socket.inet.src_ipaddr;
+				addr->socket.inet.dst_port = my->info.socket.inet.src_port;
+
+				(void) fr_ipaddr_from_sockaddr(&addr->socket.inet.src_ipaddr, &addr->socket.inet.src_port,
+							       &sockaddr[i], msgvec[i].msg_hdr.msg_namelen);
+			}
+
+			used++;
+		}
+
+		/*
+		 *	All of the packets were empty.
+		 */
+		if (!used) return 0;
+
+		rcode = used;
+	}
+
+	if (rcode == 0) return rcode;
+
+#include "fd_read.h"
+
+	return fr_bio_error(IO);
+}
+#endif
+
+#ifdef HAVE_SENDMMSG
+/** Write multiple packets to a datagram socket
+ *
+ *  Works for both connected and unconnected sockets.  Connected sockets ignore the per-packet contexts.
+ */
+static ssize_t fr_bio_fd_writev_datagram(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	int tries = 0;
+	ssize_t rcode;
+	size_t i, size;
+	bool connected;
+	fr_bio_fd_t *my = talloc_get_type_abort(bio, fr_bio_fd_t);
+	struct mmsghdr msgvec[FR_BIO_FD_VEC_MAX];
+	struct iovec iov[FR_BIO_FD_VEC_MAX];
+	struct sockaddr_storage sockaddr[FR_BIO_FD_VEC_MAX];
+
+	if (bio->write == fr_bio_fd_write) {
+		connected = true;
+	} else if (bio->write == fr_bio_fd_sendto) {
+		connected = false;
+	} else {
+		return fr_bio_shim_writev(bio, vec, num);
+	}
+
+	if (num > FR_BIO_FD_VEC_MAX) num = FR_BIO_FD_VEC_MAX;
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = vec[i].buffer;
+		iov[i].iov_len = vec[i].size;
+
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+
+		if (!connected) {
+			fr_bio_fd_packet_ctx_t *addr = fr_bio_fd_packet_ctx(my, vec[i].packet_ctx);
+			socklen_t salen;
+
+			(void) fr_ipaddr_to_sockaddr(&sockaddr[i], &salen, &addr->socket.inet.dst_ipaddr, addr->socket.inet.dst_port);
+
+			msgvec[i].msg_hdr.msg_name = &sockaddr[i];
+			msgvec[i].msg_hdr.msg_namelen = salen;
+		}
+	}
+
+	/*
+	 *	fd_write.h treats writing fewer packets than we asked for as a partial write, which means that
+	 *	the socket is blocked.
+	 */
+	size = num;
+
+retry:
+	rcode = sendmmsg(my->info.socket.fd, msgvec, num, 0);
+
+#include "fd_write.h"
+
+	return fr_bio_error(IO);
+}
+#endif
 
 #if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR) || defined(IPV6_PKTINFO)
 static ssize_t fd_fd_recvfromto_common(fr_bio_fd_t *my, void *packet_ctx, void *buffer, size_t size)
@@ -845,6 +998,9 @@ int fr_bio_fd_init_connected(fr_bio_fd_t *my)
 
 int fr_bio_fd_init_common(fr_bio_fd_t *my)
 {
+	my->bio.readv = NULL;
+	my->bio.writev = NULL;
+
 	if (my->info.socket.type == SOCK_STREAM) {				//!< stream socket
 		my->bio.read = fr_bio_fd_read_stream;
 		my->bio.write = fr_bio_fd_write;
@@ -852,10 +1008,22 @@ int fr_bio_fd_init_common(fr_bio_fd_t *my)
 	} else if (my->info.type == FR_BIO_FD_CONNECTED) {		       	//!< connected datagram
 		my->bio.read = fr_bio_fd_read_connected_datagram;
 		my->bio.write = fr_bio_fd_write;
+#ifdef HAVE_RECVMMSG
+		my->bio.readv = fr_bio_fd_readv_datagram;
+#endif
+#ifdef HAVE_SENDMMSG
+		my->bio.writev = fr_bio_fd_writev_datagram;
+#endif
 
 	} else if (!fr_ipaddr_is_inaddr_any(&my->info.socket.inet.src_ipaddr)) { //!< we know our IP address
 		my->bio.read = fr_bio_fd_recvfrom;
 		my->bio.write = fr_bio_fd_sendto;
+#ifdef HAVE_RECVMMSG
+		my->bio.readv = fr_bio_fd_readv_datagram;
+#endif
+#ifdef HAVE_SENDMMSG
+		my->bio.writev = fr_bio_fd_writev_datagram;
+#endif
 
 #if defined(IP_PKTINFO) || defined(IP_RECVDSTADDR)
 	} else if (my->info.socket.inet.src_ipaddr.af == AF_INET) {		//!< we don't know our IPv4
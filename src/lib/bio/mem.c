@@ -161,13 +161,22 @@ static ssize_t fr_bio_mem_read(fr_bio_t *bio, void *packet_ctx, void *buffer, si
 	return rcode;
 }
 
-/** Return data only if we have a complete packet.
+/** Ensure that there is a complete packet in the read buffer.
+ *
+ *  On error, the bio is shut down.
  *
+ * @param[in] bio	the #fr_bio_mem_t
+ * @param[in] packet_ctx the packet ctx
+ * @param[out] want	the size of the complete packet at the start of the read buffer.
+ * @return
+ *	- <0 on error
+ *	- 0 for "no complete packet yet"
+ *	- 1 for "there is a complete packet", and its size is in "want".
  */
-static ssize_t fr_bio_mem_read_verify(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t size)
+static ssize_t fr_bio_mem_read_verify_fill(fr_bio_t *bio, void *packet_ctx, size_t *want)
 {
 	ssize_t rcode;
-	size_t used, room, want;
+	size_t used, room;
 	uint8_t *p;
 	fr_bio_mem_t *my = talloc_get_type_abort(bio, fr_bio_mem_t);
 	fr_bio_t *next;
@@ -180,7 +189,7 @@ static ssize_t fr_bio_mem_read_verify(fr_bio_t *bio, void *packet_ctx, void *buf
 		/*
 		 *	See if there are valid packets in the buffer.
 		 */
-		rcode = fr_bio_mem_call_verify(bio, packet_ctx, &want);
+		rcode = fr_bio_mem_call_verify(bio, packet_ctx, want);
 		if (rcode < 0) {
 			rcode = fr_bio_error(VERIFY);
 			goto fail;
@@ -189,20 +198,7 @@ static ssize_t fr_bio_mem_read_verify(fr_bio_t *bio, void *packet_ctx, void *buf
 		/*
 		 *	There's at least one valid packet, return it.
 		 */
-		if (rcode == 1) {
-			/*
-			 *	This isn't a fatal error.  The caller should check how much room is needed by calling
-			 *	fr_bio_mem_call_verify(), and retry.
-			 *
-			 *	But in general, the caller should make sure that the output buffer has enough
-			 *	room for at least one packet.  The verify() function should also ensure that
-			 *	the packet is no larger than our application maximum, even if the protocol
-			 *	allows for it to be larger.
-			 */
-			if (want > size) return fr_bio_error(BUFFER_TOO_SMALL);
-
-			return fr_bio_buf_read(&my->read_buffer, buffer, want);
-		}
+		if (rcode == 1) return 1;
 
 		/*
 		 *	Else we need to read more data to have a complete packet.
@@ -222,6 +218,12 @@ static ssize_t fr_bio_mem_read_verify(fr_bio_t *bio, void *packet_ctx, void *buf
 	if (!room) {
 		room = fr_bio_buf_make_room(&my->read_buffer);
 
+		/*
+		 *	The application has borrowed packets from the buffer, so we can't move the data
+		 *	around.  It has to release them before we can read any more.  This isn't fatal.
+		 */
+		if (!room && my->read_buffer.pinned) return fr_bio_error(BUFFER_FULL);
+
 		/*
 		 *	We've tried to make room and failed.  Which means that the buffer is full, AND there
 		 *	still isn't a complete packet in the buffer.  This is therefore a fatal error.  The
@@ -249,28 +251,21 @@ static ssize_t fr_bio_mem_read_verify(fr_bio_t *bio, void *packet_ctx, void *buf
 	if (rcode > 0) {
 		(void) fr_bio_buf_write_alloc(&my->read_buffer, (size_t) rcode);
 
-		want = fr_bio_buf_used(&my->read_buffer);
-		if (size <= want) want = size;
-
 		/*
 		 *	See if there are valid packets in the buffer.
 		 */
-		rcode = fr_bio_mem_call_verify(bio, packet_ctx, &want);
+		rcode = fr_bio_mem_call_verify(bio, packet_ctx, want);
 		if (rcode < 0) {
 			rcode = fr_bio_error(VERIFY);
 			goto fail;
 		}
 
 		/*
-		 *	There's at least one valid packet, return it.
-		 */
-		if (rcode == 1) return fr_bio_buf_read(&my->read_buffer, buffer, want);
-
-		/*
-		 *	No valid packets.  The next call to read will call verify again, which will return a
-		 *	partial packet.  And then it will try to fill the buffer from the next bio.
+		 *	If there are no valid packets, the next call to read will call verify again, which
+		 *	will return a partial packet.  And then it will try to fill the buffer from the next
+		 *	bio.
 		 */
-		return 0;
+		return rcode;
 	}
 
 	/*
@@ -289,6 +284,31 @@ fail:
 	return rcode;
 }
 
+/** Return data only if we have a complete packet.
+ *
+ */
+static ssize_t fr_bio_mem_read_verify(fr_bio_t *bio, void *packet_ctx, void *buffer, size_t size)
+{
+	ssize_t rcode;
+	size_t want;
+	fr_bio_mem_t *my = talloc_get_type_abort(bio, fr_bio_mem_t);
+
+	rcode = fr_bio_mem_read_verify_fill(bio, packet_ctx, &want);
+	if (rcode <= 0) return rcode;
+
+	/*
+	 *	This isn't a fatal error.  The caller should check how much room is needed by calling
+	 *	fr_bio_mem_call_verify(), and retry.
+	 *
+	 *	But in general, the caller should make sure that the output buffer has enough room for at
+	 *	least one packet.  The verify() function should also ensure that the packet is no larger
+	 *	than our application maximum, even if the protocol allows for it to be larger.
+	 */
+	if (want > size) return fr_bio_error(BUFFER_TOO_SMALL);
+
+	return fr_bio_buf_read(&my->read_buffer, buffer, want);
+}
+
 /** Return data only if we have a complete packet.
  *
  */
@@ -361,6 +381,60 @@ fail:
 	return rcode;
 }
 
+/** Return only complete packets, from a batch read from the next bio.
+ *
+ */
+static ssize_t fr_bio_mem_readv_verify_datagram(fr_bio_t *bio, fr_bio_vec_t *vec, size_t num)
+{
+	ssize_t rcode;
+	size_t i, used;
+	fr_bio_mem_t *my = talloc_get_type_abort(bio, fr_bio_mem_t);
+
+	if (my->bio.read != fr_bio_mem_read_verify_datagram) return fr_bio_shim_readv(bio, vec, num);
+
+	rcode = fr_bio_next_readv(bio, vec, num);
+	if (rcode <= 0) {
+		if ((rcode == 0) || (rcode == fr_bio_error(IO_WOULD_BLOCK))) return rcode;
+
+		goto fail;
+	}
+
+	for (i = 0, used = 0; i < (size_t) rcode; i++) {
+		size_t want = vec[i].size;
+
+		switch (my->verify((fr_bio_t *) my, my->verify_ctx, vec[i].packet_ctx, vec[i].buffer, &want)) {
+		case FR_BIO_VERIFY_OK:
+			fr_assert(want <= vec[i].size);
+
+			fr_bio_vec_keep(vec, used, i);
+			vec[used++].size = want;
+			break;
+
+		case FR_BIO_VERIFY_WANT_MORE:
+		case FR_BIO_VERIFY_DISCARD:
+			break;
+
+			/*
+			 *	Return the packets we've already verified.  The next read will fail.
+			 */
+		case FR_BIO_VERIFY_ERROR_CLOSE:
+			bio->read = fr_bio_mem_read_eof;
+			bio->write = fr_bio_null_write;
+
+			if (used) return used;
+
+			return fr_bio_error(VERIFY);
+		}
+	}
+
+	return used;
+
+fail:
+	bio->read = fr_bio_mem_read_eof;
+	bio->write = fr_bio_null_write;
+	return rcode;
+}
+
 
 /** Pass writes to the next BIO
  *
@@ -596,6 +670,72 @@ uint8_t const *fr_bio_mem_read_peek(fr_bio_t *bio, size_t *size)
 	return my->read_buffer.read;
 }
 
+/** Borrow a complete packet from the read buffer, without copying it
+ *
+ *  The bio must have a verify function, see fr_bio_mem_set_verify().
+ *  The packet is read from the next bio into the memory buffer as
+ *  usual, but instead of being copied to a caller buffer, the caller
+ *  gets a pointer to it.  The packet stays valid until it is given
+ *  back via fr_bio_mem_read_release().
+ *
+ *  Multiple packets can be borrowed at the same time.  While any are
+ *  borrowed, the buffer is never compacted, so it can fill up.  In
+ *  which case this function returns #fr_bio_error(BUFFER_FULL), and
+ *  the caller should retry after releasing packets.
+ *
+ *  Reads via this function must not be mixed with fr_bio_read().
+ *
+ * @param[in] bio	the #fr_bio_mem_t
+ * @param[in] packet_ctx the packet ctx
+ * @param[out] packet	the borrowed packet.
+ * @return
+ *	- <0 on error
+ *	- 0 for "no complete packet yet"
+ *	- >0 the size of the borrowed packet.
+ */
+ssize_t fr_bio_mem_read_borrow(fr_bio_t *bio, void *packet_ctx, uint8_t const **packet)
+{
+	ssize_t rcode;
+	size_t want;
+	fr_bio_mem_t *my = talloc_get_type_abort(bio, fr_bio_mem_t);
+
+	if (bio->read == fr_bio_mem_read_verify) {
+		rcode = fr_bio_mem_read_verify_fill(bio, packet_ctx, &want);
+		if (rcode <= 0) return rcode;
+
+	} else if (bio->read == fr_bio_mem_read_eof) {
+		/*
+		 *	The next bio is at EOF.  Return any complete packets which are left in the buffer, and
+		 *	then discard any partial one.
+		 */
+		if (!fr_bio_buf_used(&my->read_buffer) ||
+		    (fr_bio_mem_call_verify(bio, packet_ctx, &want) != 1)) {
+			(void) fr_bio_buf_read(&my->read_buffer, NULL, fr_bio_buf_used(&my->read_buffer));
+			return fr_bio_mem_read_eof(bio, packet_ctx, NULL, 0);
+		}
+
+	} else {
+		/*
+		 *	Datagram bios, or a bio which has failed.
+		 */
+		fr_assert(bio->read != fr_bio_mem_read_verify_datagram);
+		return bio->read(bio, packet_ctx, NULL, 0);
+	}
+
+	*packet = fr_bio_buf_borrow(&my->read_buffer, want);
+	return want;
+}
+
+/** Give back a packet which was borrowed via fr_bio_mem_read_borrow()
+ *
+ */
+void fr_bio_mem_read_release(fr_bio_t *bio, uint8_t const *packet)
+{
+	fr_bio_mem_t *my = talloc_get_type_abort(bio, fr_bio_mem_t);
+
+	fr_bio_buf_release(&my->read_buffer, packet);
+}
+
 /** Discard data from the read buffer.
  *
  *  Discarding allows the caller to silently omit packets, so that
@@ -896,6 +1036,8 @@ int fr_bio_mem_set_verify(fr_bio_t *bio, fr_bio_verify_t verify, void *verify_ct
 	if (datagram) {
 		my->bio.read = fr_bio_mem_read_verify_datagram;
 		my->bio.write = fr_bio_next_write;
+		my->bio.readv = fr_bio_mem_readv_verify_datagram;
+		my->bio.writev = fr_bio_next_writev;
 
 		/*
 		 *	Might as well free the memory for the write buffer.  It won't be used.
@@ -60,6 +60,10 @@ uint8_t const	*fr_bio_mem_read_peek(fr_bio_t *bio, size_t *size) CC_HINT(nonnull
 
 void		fr_bio_mem_read_discard(fr_bio_t *bio, size_t size) CC_HINT(nonnull);
 
+ssize_t		fr_bio_mem_read_borrow(fr_bio_t *bio, void *packet_ctx, uint8_t const **packet) CC_HINT(nonnull(1,3));
+
+void		fr_bio_mem_read_release(fr_bio_t *bio, uint8_t const *packet) CC_HINT(nonnull);
+
 int		fr_bio_mem_set_verify(fr_bio_t *bio, fr_bio_verify_t verify, void *verify_ctx, bool datagram) CC_HINT(nonnull);
 
 int		fr_bio_mem_write_resume(fr_bio_t *bio) CC_HINT(nonnull);
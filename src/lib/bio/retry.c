@@ -47,8 +47,8 @@
 #include <freeradius-devel/bio/bio_priv.h>
 #include <freeradius-devel/bio/null.h>
 #include <freeradius-devel/bio/buf.h>
-#include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/timer_wheel.h>
 
 #define _BIO_RETRY_PRIVATE
 #include <freeradius-devel/bio/retry.h>
@@ -70,10 +70,10 @@ struct fr_bio_retry_entry_s {
 	fr_retry_t	retry;			//!< retry timers and counters
 
 	union {
-		fr_rb_node_t	next_retry_node;	 //!< for retries
+		fr_timer_wheel_node_t	next_retry_node; //!< for retries
 		FR_DLIST_ENTRY(fr_bio_retry_list) entry; //!< for the free list
 	};
-	fr_rb_node_t	expiry_node;		//!< for expiries
+	fr_timer_wheel_node_t	expiry_node;	//!< for expiries
 
 	fr_bio_retry_t	*my;			//!< so we can get to it from the event timer callback
 
@@ -86,11 +86,18 @@ struct fr_bio_retry_entry_s {
 
 FR_DLIST_FUNCS(fr_bio_retry_list, fr_bio_retry_entry_t, entry)
 
+/*
+ *	The timer wheels have millisecond buckets, and a rotation of about a second.  Entries which are
+ *	further in the future stay in their bucket until the right rotation comes around.
+ */
+#define RETRY_WHEEL_RESOLUTION	fr_time_delta_from_msec(1)
+#define RETRY_WHEEL_BUCKETS	(1024)
+
 struct fr_bio_retry_s {
 	FR_BIO_COMMON;
 
-	fr_rb_tree_t		next_retry_tree;	//!< when packets are retried next
-	fr_rb_tree_t		expiry_tree;		//!< when packets expire, so that we expire packets when the socket is blocked.
+	fr_timer_wheel_t	*next_retry_wheel;	//!< when packets are retried next
+	fr_timer_wheel_t	*expiry_wheel;		//!< when packets expire, so that we expire packets when the socket is blocked.
 
 	fr_bio_retry_info_t	info;
 
@@ -102,15 +109,15 @@ struct fr_bio_retry_s {
 	fr_event_timer_t const	*ev;		//!< we only need one timer event: next time we do something
 
 	/*
-	 *	The first item is cached here so that we can detect when it changes.  The insert / delete
-	 *	code can just do its work without worrying about timers.  And then when the tree manipulation
-	 *	is done, call the fr_bio_retry_timer_reset() function to reset (or not) the timer.
+	 *	When the timer is set for is cached here so that we can detect when it changes.  The insert /
+	 *	delete code can just do its work without worrying about timers.  And then when the wheel
+	 *	manipulation is done, call the fr_bio_retry_timer_reset() function to reset (or not) the timer.
 	 */
-	fr_bio_retry_entry_t	*next_retry_item;		//!< for timers
+	fr_time_t		next_timer;		//!< when the timer event is set for
 
 	/*
 	 *	Cache a partial write when IO is blocked.  Partial
-	 *	packets are left in the timer tree so that they can be expired.
+	 *	packets are left in the timer wheels so that they can be expired.
 	 */
 	fr_bio_retry_entry_t	*partial;	//!< for partial writes
 
@@ -131,7 +138,7 @@ static ssize_t fr_bio_retry_save_write(fr_bio_retry_t *my, fr_bio_retry_entry_t
 
 #define fr_bio_retry_timer_clear(_x) do { \
 		talloc_const_free((_x)->ev); \
-		(_x)->next_retry_item = NULL; \
+		(_x)->next_timer = fr_time_wrap(0); \
 	} while (0)
 
 /** Reset the expiry timer after expiring one element
@@ -139,15 +146,14 @@ static ssize_t fr_bio_retry_save_write(fr_bio_retry_t *my, fr_bio_retry_entry_t
  */
 static int fr_bio_retry_expiry_timer_reset(fr_bio_retry_t *my)
 {
-	fr_bio_retry_entry_t *first;
+	fr_time_t when;
 
 	fr_assert(my->info.write_blocked);
 
 	/*
 	 *	Nothing to do, don't set any timers.
 	 */
-	first = fr_rb_first(&my->expiry_tree);
-	if (!first) {
+	if (!fr_timer_wheel_next(my->expiry_wheel, &when)) {
 		fr_bio_retry_timer_clear(my);
 		return 0;
 	}
@@ -155,54 +161,51 @@ static int fr_bio_retry_expiry_timer_reset(fr_bio_retry_t *my)
 	/*
 	 *	The timer is already set correctly, we're done.
 	 */
-	if (first == my->next_retry_item) return 0;
+	if (my->ev && fr_time_eq(when, my->next_timer)) return 0;
 
 	/*
 	 *	Update the timer.  This should never fail.
 	 */
-	if (fr_event_timer_at(my, my->info.el, &my->ev, first->retry.end, fr_bio_retry_expiry_timer, my) < 0) return -1;
+	if (fr_event_timer_at(my, my->info.el, &my->ev, when, fr_bio_retry_expiry_timer, my) < 0) return -1;
 
-	my->next_retry_item = first;
+	my->next_timer = when;
 	return 0;
 }
 
 
-/** Reset the timer after changing the rb tree.
+/** Reset the timer after changing the timer wheel.
  *
+ *  The timer is set for the next tick which has entries.  If those entries are removed before the timer
+ *  fires, the timer just finds nothing to do, and is reset.
  */
 static int fr_bio_retry_timer_reset(fr_bio_retry_t *my)
 {
-	fr_bio_retry_entry_t *first;
+	fr_time_t when;
 
 	if (my->info.write_blocked) return fr_bio_retry_expiry_timer_reset(my);
 
 	/*
 	 *	Nothing to do, don't set any timers.
+	 *
+	 *	Or, we're partially writing a response.  Don't bother with the timer, and delete any existing
+	 *	timer.  It will be reset when the partial entry has been written.
 	 */
-	first = fr_rb_first(&my->next_retry_tree);
-	if (!first) {
-	cancel_timer:
+	if (my->partial || !fr_timer_wheel_next(my->next_retry_wheel, &when)) {
 		fr_bio_retry_timer_clear(my);
 		return 0;
 	}
 
-	/*
-	 *	We're partially writing a response.  Don't bother with the timer, and delete any existing
-	 *	timer.  It will be reset when the partial entry is placed back into the queue.
-	 */
-	if (first == my->partial) goto cancel_timer;
-
 	/*
 	 *	The timer is already set correctly, we're done.
 	 */
-	if (first == my->next_retry_item) return 0;
+	if (my->ev && fr_time_eq(when, my->next_timer)) return 0;
 
 	/*
 	 *	Update the timer.  This should never fail.
 	 */
-	if (fr_event_timer_at(my, my->info.el, &my->ev, first->retry.next, fr_bio_retry_timer, my) < 0) return -1;
+	if (fr_event_timer_at(my, my->info.el, &my->ev, when, fr_bio_retry_timer, my) < 0) return -1;
 
-	my->next_retry_item = first;
+	my->next_timer = when;
 	return 0;
 }
 
@@ -211,15 +214,13 @@ static int fr_bio_retry_timer_reset(fr_bio_retry_t *my)
  */
 static void fr_bio_retry_release(fr_bio_retry_t *my, fr_bio_retry_entry_t *item, fr_bio_retry_release_reason_t reason)
 {
-	bool timer_reset = false;
-
 	/*
 	 *	Remove the item before calling the application "release" function.
 	 */
 	if (my->partial != item) {
 		if (!item->reserved) {
-			(void) fr_rb_remove_by_inline_node(&my->next_retry_tree, &item->next_retry_node);
-			(void) fr_rb_remove_by_inline_node(&my->expiry_tree, &item->expiry_node);
+			fr_timer_wheel_remove(my->next_retry_wheel, item);
+			fr_timer_wheel_remove(my->expiry_wheel, item);
 		}
 	} else {
 		item->cancelled = true;
@@ -238,12 +239,9 @@ static void fr_bio_retry_release(fr_bio_retry_t *my, fr_bio_retry_entry_t *item,
 	if (my->partial == item) return;
 
 	/*
-	 *	We're deleting the timer entry, make sure that we clean up its events,
+	 *	We don't reset the timer here.  If this was the only item in its tick, the timer fires, finds
+	 *	nothing to do, and is reset.  That's cheaper than finding the next tick on every release.
 	 */
-	if (my->next_retry_item == item) {
-		fr_bio_retry_timer_clear(my);
-		timer_reset = true;
-	}
 
 	/*
 	 *	If we were blocked due to having no free entries, then resume writes as soon as we create a free entry.
@@ -260,15 +258,8 @@ static void fr_bio_retry_release(fr_bio_retry_t *my, fr_bio_retry_entry_t *item,
 		if (my->cb.write_resume) (void) my->cb.write_resume(&my->bio);
 	}
 
-	/*
-	 *	If write_resume() above called the application, then it might have already updated the timer.
-	 *	Don't do that again.
-	 */
-	if (timer_reset) (void) fr_bio_retry_timer_reset(my);
-
 	item->packet_ctx = NULL;
 
-	fr_assert(my->next_retry_item != item);
 	fr_bio_retry_list_insert_head(&my->free, item);
 }
 
@@ -358,11 +349,9 @@ static int fr_bio_retry_write_item(fr_bio_retry_t *my, fr_bio_retry_entry_t *ite
 	}
 
 	/*
-	 *	We wrote the whole packet.  Re-insert it, which is done _without_ doing calls to
-	 *	cmp(), so we it's OK for us to rewrite item->retry.next.
+	 *	We wrote the whole packet.  Move it to the tick of its next retry.
 	 */
-	(void) fr_rb_remove_by_inline_node(&my->next_retry_tree, &item->next_retry_node);
-	(void) fr_rb_insert(&my->next_retry_tree, item);
+	fr_timer_wheel_update(my->next_retry_wheel, item, item->retry.next);
 
 	return 1;
 }
@@ -383,14 +372,12 @@ static int fr_bio_retry_write_delayed(fr_bio_retry_t *my, fr_time_t now)
 	fr_assert(!my->partial);
 	fr_assert(!my->info.write_blocked);
 
-	while ((item = fr_rb_first(&my->next_retry_tree)) != NULL) {
+	/*
+	 *	Each item we write is moved to its next retry, or released.  So it won't be returned again.
+	 */
+	while ((item = fr_timer_wheel_peek(my->next_retry_wheel, now)) != NULL) {
 		int rcode;
 
-		/*
-		 *	This item needs to be sent in the future, we're done.
-		 */
-		if (fr_time_cmp(now, item->retry.next) > 0) break;
-
 		/*
 		 *	Write one item, and don't update timers.
 		 */
@@ -447,7 +434,6 @@ static ssize_t fr_bio_retry_write_partial(fr_bio_t *bio, void *packet_ctx, const
 	fr_bio_t *next;
 	fr_bio_retry_entry_t *item = my->partial;
 
-	fr_assert(!my->next_retry_item);
 	fr_assert(!my->ev);
 	fr_assert(my->partial != NULL);
 	fr_assert(my->buffer.start);
@@ -478,11 +464,15 @@ static ssize_t fr_bio_retry_write_partial(fr_bio_t *bio, void *packet_ctx, const
 	my->partial = NULL;
 
 	/*
-	 *	The item was cancelled, which means it's no longer in the timer tree.
+	 *	The item was cancelled while it was being written, so it was left in the timer wheels.  Remove
+	 *	it now, before the free list entry overwrites its retry node.
 	 *
-	 *	If it's not cancelled, then we leave it in the tree, and run its timers s normal.
+	 *	If it's not cancelled, then we leave it in the wheels, and run its timers as normal.
 	 */
 	if (item->cancelled) {
+		fr_timer_wheel_remove(my->next_retry_wheel, item);
+		fr_timer_wheel_remove(my->expiry_wheel, item);
+
 		item->packet_ctx = NULL;
 
 		fr_bio_retry_list_insert_head(&my->free, item);
@@ -530,7 +520,7 @@ static ssize_t fr_bio_retry_save_write(fr_bio_retry_t *my, fr_bio_retry_entry_t
 	my->bio.write = fr_bio_retry_write_partial;
 
 	/*
-	 *	We leave the entry in the timer tree so that the expiry timer will get hit.
+	 *	We leave the entry in the timer wheels so that the expiry timer will get hit.
 	 *
 	 *	And then return the size of the partial data we wrote.
 	 */
@@ -634,19 +624,13 @@ static void fr_bio_retry_expiry_timer(UNUSED fr_event_list_t *el, fr_time_t now,
 	fr_time_t expires;
 
 	/*
-	 *	For the timer to be running, there must be a "first" entry which causes the timer to fire.
-	 *
-	 *	There must also be no partially written entry.  If the IO is blocked, then all timers are
+	 *	There must be no partially written entry.  If the IO is blocked, then all timers are
 	 *	suspended.
 	 */
-	fr_assert(my->next_retry_item != NULL);
 	fr_assert(!my->partial);
 	fr_assert(my->info.write_blocked);
 
-	/*
-	 *	We should be expiring at least one entry, so nuke the timers.
-	 */
-	my->next_retry_item = NULL;
+	my->next_timer = fr_time_wrap(0);
 
 	/*
 	 *	Expire all entries which are within 10ms of "now".  That way we don't reset the event many
@@ -654,17 +638,16 @@ static void fr_bio_retry_expiry_timer(UNUSED fr_event_list_t *el, fr_time_t now,
 	 */
 	expires = fr_time_add(now, fr_time_delta_from_msec(10));
 
-	while ((item = fr_rb_first(&my->expiry_tree)) != NULL) {
-		if (fr_time_gt(item->retry.end, expires)) break;
-
+	while ((item = fr_timer_wheel_peek(my->expiry_wheel, expires)) != NULL) {
 		fr_bio_retry_release(my, item, (item->retry.replies > 0) ? FR_BIO_RETRY_DONE : FR_BIO_RETRY_NO_REPLY);
 	}
 
 	(void) fr_bio_retry_expiry_timer_reset(my);
 }
 
-/** Run a timer event.  Usually to write out another packet.
+/** Run a timer event.  Usually to write out more packets.
  *
+ *  All of the items which are due are retried, not just one.
  */
 static void fr_bio_retry_timer(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
 {
@@ -673,40 +656,34 @@ static void fr_bio_retry_timer(UNUSED fr_event_list_t *el, fr_time_t now, void *
 	fr_bio_retry_entry_t *item;
 
 	/*
-	 *	For the timer to be running, there must be a "first" entry which causes the timer to fire.
-	 *
-	 *	There must also be no partially written entry.  If the IO is blocked, then all timers are
+	 *	There must be no partially written entry.  If the IO is blocked, then all timers are
 	 *	suspended.
 	 */
-	fr_assert(my->next_retry_item != NULL);
 	fr_assert(my->partial == NULL);
 
-	item = my->next_retry_item;
-	my->next_retry_item = NULL;
+	my->next_timer = fr_time_wrap(0);
 
-	/*
-	 *	Retry one item.
-	 */
-	rcode = fr_bio_retry_write_item(my, item, now);
-	if (rcode < 0) {
-		if (rcode == fr_bio_error(IO_WOULD_BLOCK)) return;
+	while ((item = fr_timer_wheel_peek(my->next_retry_wheel, now)) != NULL) {
+		rcode = fr_bio_retry_write_item(my, item, now);
+		if (rcode < 0) {
+			if (rcode == fr_bio_error(IO_WOULD_BLOCK)) return;
 
-		my->error = rcode;
-		my->bio.write = fr_bio_retry_write_fatal;
-		return;
-	}
+			my->error = rcode;
+			my->bio.write = fr_bio_retry_write_fatal;
+			return;
+		}
 
-	/*
-	 *	Partial write - no timers get set.  We need to wait until the descriptor is writable.
-	 */
-	if (rcode == 0) {
-		fr_assert(my->partial != NULL);
-		return;
+		/*
+		 *	Partial write - no timers get set.  We need to wait until the descriptor is writable.
+		 */
+		if (rcode == 0) {
+			fr_assert(my->partial != NULL);
+			return;
+		}
 	}
 
 	/*
-	 *	We successfull wrote this item.  Reset the timer to the next one, which is likely to be a
-	 *	different one from the item we just updated.
+	 *	We successfully wrote all of the items.  Reset the timer to the next tick which has items.
 	 */
 	(void) fr_bio_retry_timer_reset(my);
 }
@@ -744,7 +721,7 @@ static ssize_t fr_bio_retry_write(fr_bio_t *bio, void *packet_ctx, void const *b
 		/*
 		 *	Grab the first item which can be expired.
 		 */
-		item = fr_rb_first(&my->expiry_tree);
+		item = fr_timer_wheel_first(my->expiry_wheel);
 		fr_assert(item != NULL);
 
 		/*
@@ -821,8 +798,8 @@ static ssize_t fr_bio_retry_write(fr_bio_t *bio, void *packet_ctx, void const *b
 	/*
 	 *	This should never fail.
 	 */
-	(void) fr_rb_insert(&my->next_retry_tree, item);
-	(void) fr_rb_insert(&my->expiry_tree, item);
+	fr_timer_wheel_insert(my->next_retry_wheel, item, item->retry.next);
+	fr_timer_wheel_insert(my->expiry_wheel, item, item->retry.end);
 
 	/*
 	 *	We only wrote part of the packet, remember to write the rest of it.
@@ -832,12 +809,9 @@ static ssize_t fr_bio_retry_write(fr_bio_t *bio, void *packet_ctx, void const *b
 	}
 
 	/*
-	 *	We've just inserted this packet into the timer tree, so it can't be used as the current timer.
-	 *	Once we've inserted it, we update the timer.
-	 */
-	fr_assert(my->next_retry_item != item);
-
-	/*
+	 *	We've just inserted this packet into the timer wheels.  Once we've inserted it, we update the
+	 *	timer.
+	 *
 	 *	If we can't set the timer, then release this item.
 	 */
 	if (fr_bio_retry_timer_reset(my) < 0) {
@@ -920,7 +894,7 @@ static ssize_t fr_bio_retry_read(fr_bio_t *bio, void *packet_ctx, void *buffer,
 	/*
 	 *	There are no more packets to send, so this connection is idle.
 	 *
-	 *	Note that partial packets aren't tracked in the timer tree.  We can't do retransmits until the
+	 *	Note that partial packets aren't tracked in the timer wheels.  We can't do retransmits until the
 	 *	socket is writable.
 	 */
 	if (fr_bio_retry_outstanding((fr_bio_t *) my) == 1) my->info.last_idle = my->info.last_reply;
@@ -939,49 +913,15 @@ static ssize_t fr_bio_retry_read(fr_bio_t *bio, void *packet_ctx, void *buffer,
 	 */
 	item->retry.next = fr_time_add_time_delta(item->retry.start, my->retry_config.mrd);
 
-	(void) fr_rb_remove_by_inline_node(&my->next_retry_tree, &item->next_retry_node);
-	(void) fr_rb_insert(&my->next_retry_tree, item);
+	fr_timer_wheel_update(my->next_retry_wheel, item, item->retry.next);
 	(void) fr_bio_retry_timer_reset(my);
 
 	return rcode;
 }
 
-/*
- *	Order the retries by what we have to do next.
- *
- *	Note that "retry.next" here is capped at "retry.end".  So if we need to expire an entry, it will
- *	happen at the "next" retry.
- */
-static int8_t _next_retry_cmp(void const *one, void const *two)
-{
-	fr_bio_retry_entry_t const *a = one;
-	fr_bio_retry_entry_t const *b = two;
-
-	fr_assert(a->buffer);
-	fr_assert(b->buffer);
-
-	return fr_time_cmp(a->retry.next, b->retry.next);
-}
-
-/*
- *	Order entries by when they expire, when we're not retrying.
- *
- *	i.e. the socket is blocked, so all retries are paused.
- */
-static int8_t _expiry_cmp(void const *one, void const *two)
-{
-	fr_bio_retry_entry_t const *a = one;
-	fr_bio_retry_entry_t const *b = two;
-
-	fr_assert(a->buffer);
-	fr_assert(b->buffer);
-
-	return fr_time_cmp(a->retry.end, b->retry.end);
-}
-
 /** Cancel one item.
  *
- *  If "item" is NULL, the last entry in the timer tree is cancelled.
+ *  If "item" is NULL, the first entry to expire is cancelled.
  *
  *  @param bio		the binary IO handler
  *  @param item		the retry context from #fr_bio_retry_sent_t
@@ -998,7 +938,7 @@ int fr_bio_retry_entry_cancel(fr_bio_t *bio, fr_bio_retry_entry_t *item)
 	 *	No item passed, try to cancel the first one to expire.
 	 */
 	if (!item) {
-		item = fr_rb_first(&my->expiry_tree);
+		item = fr_timer_wheel_first(my->expiry_wheel);
 		if (!item) return 0;
 
 		/*
@@ -1054,17 +994,15 @@ const fr_retry_t *fr_bio_retry_entry_info(UNUSED fr_bio_t *bio, fr_bio_retry_ent
  */
 static int fr_bio_retry_destructor(fr_bio_retry_t *my)
 {
-	fr_rb_iter_inorder_t iter;
 	fr_bio_retry_entry_t *item;
 
 	fr_bio_retry_timer_clear(my);
 
 	/*
-	 *	Cancel all outgoing packets.  Don't bother updating the tree or the free list, as all of the
-	 *	entries will be deleted when the memory is freed.
+	 *	Cancel all outgoing packets.  Don't bother updating the expiry wheel or the free list, as all
+	 *	of the entries will be deleted when the memory is freed.
 	 */
-	while ((item = fr_rb_iter_init_inorder(&iter, &my->next_retry_tree)) != NULL) {
-		fr_rb_iter_delete_inorder(&iter);
+	while ((item = fr_timer_wheel_pop_any(my->next_retry_wheel)) != NULL) {
 		my->release((fr_bio_t *) my, item, FR_BIO_RETRY_CANCELLED);
 	}
 
@@ -1123,8 +1061,14 @@ fr_bio_t *fr_bio_retry_alloc(TALLOC_CTX *ctx, size_t max_saved,
 		fr_bio_retry_list_insert_tail(&my->free, &items[i]);
 	}
 
-	(void) fr_rb_inline_init(&my->next_retry_tree, fr_bio_retry_entry_t, next_retry_node, _next_retry_cmp, NULL);
-	(void) fr_rb_inline_init(&my->expiry_tree, fr_bio_retry_entry_t, expiry_node, _expiry_cmp, NULL);
+	my->next_retry_wheel = fr_timer_wheel_alloc(my, fr_bio_retry_entry_t, next_retry_node,
+						    RETRY_WHEEL_RESOLUTION, RETRY_WHEEL_BUCKETS, fr_time());
+	my->expiry_wheel = fr_timer_wheel_alloc(my, fr_bio_retry_entry_t, expiry_node,
+						RETRY_WHEEL_RESOLUTION, RETRY_WHEEL_BUCKETS, fr_time());
+	if (!my->next_retry_wheel || !my->expiry_wheel) {
+		talloc_free(my);
+		return NULL;
+	}
 
 	my->sent = sent;
 	if (!rewrite) {
@@ -1167,7 +1111,7 @@ size_t fr_bio_retry_outstanding(fr_bio_t *bio)
 	fr_bio_retry_t *my = talloc_get_type_abort(bio, fr_bio_retry_t);
 	size_t num;
 
-	num = fr_rb_num_elements(&my->next_retry_tree);
+	num = fr_timer_wheel_num_elements(my->next_retry_wheel);
 
 	if (!my->partial) return num;
 
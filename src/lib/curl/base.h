@@ -93,6 +93,8 @@ typedef struct {
 	fr_event_timer_t const	*ev;			//!< Multi-Handle timer.
 	uint64_t		transfers;		//!< How many transfers are current in progress.
 	CURLM			*mandle;		//!< The multi handle.
+	CURLSH			*share;			//!< DNS and TLS session cache shared by all requests
+							///< using this multi handle.
 } fr_curl_handle_t;
 
 /** Structure representing an individual request being passed to curl for processing
@@ -136,6 +138,8 @@ int			fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle,
 
 fr_curl_io_request_t	*fr_curl_io_request_alloc(TALLOC_CTX *ctx);
 
+void			fr_curl_io_request_unshare(fr_curl_io_request_t *randle);
+
 fr_curl_handle_t	*fr_curl_io_init(TALLOC_CTX *ctx, fr_event_list_t *el, bool multiplex);
 
 int			fr_curl_response_certinfo(request_t *request, fr_curl_io_request_t *randle);
@@ -101,6 +101,7 @@ static inline void _fr_curl_io_demux(fr_curl_handle_t *mhandle, CURLM *mandle)
 			 *	ends up being junk.
 			 */
 			curl_multi_remove_handle(mandle, candle);
+			fr_curl_io_request_unshare(randle);
 
 			unlang_interpret_mark_runnable(request);
 		}
@@ -514,6 +515,13 @@ int fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle, request_t *request, fr
 		return -1;
 	}
 
+	/*
+	 *	Use the DNS and TLS session caches of the
+	 *	multi handle, so requests to the same origin
+	 *	don't repeat lookups and full handshakes.
+	 */
+	if (mhandle->share) FR_CURL_REQUEST_SET_OPTION(CURLOPT_SHARE, mhandle->share);
+
 	/*
 	 *	Increment here, else the debug output looks
 	 *	messed up is curl_multi_add_handle triggers
@@ -523,6 +531,7 @@ int fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle, request_t *request, fr
 	mret = curl_multi_add_handle(mhandle->mandle, randle->candle);
 	if (mret != CURLM_OK) {
 		mhandle->transfers--;
+		fr_curl_io_request_unshare(randle);
 		REDEBUG("Request failed: %i - %s", mret, curl_multi_strerror(mret));
 		return -1;
 	}
@@ -567,10 +576,24 @@ fr_curl_io_request_t *fr_curl_io_request_alloc(TALLOC_CTX *ctx)
 static int _mhandle_free(fr_curl_handle_t *mhandle)
 {
 	curl_multi_cleanup(mhandle->mandle);
+	if (mhandle->share) curl_share_cleanup(mhandle->share);
 
 	return 0;
 }
 
+/** Stop a request using the shared caches of its multi handle
+ *
+ * Must be called whenever a request is removed from the multi handle,
+ * as the shared caches are freed with the multi handle, which may be
+ * before the request is.
+ *
+ * @param[in] randle	to detach.
+ */
+void fr_curl_io_request_unshare(fr_curl_io_request_t *randle)
+{
+	(void) curl_easy_setopt(randle->candle, CURLOPT_SHARE, NULL);
+}
+
 /** Performs the libcurl initialisation of the thread
  *
  * @param[in] ctx		to alloc handle in.
@@ -589,6 +612,7 @@ fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 				   bool multiplex)
 {
 	CURLMcode		ret;
+	CURLSHcode		sret;
 	CURLM			*mandle;
 	fr_curl_handle_t	*mhandle;
 	char const		*option;
@@ -621,6 +645,29 @@ fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 	SET_MOPTION(mandle, CURLMOPT_PIPELINING, multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
 #endif
 
+	/*
+	 *	The multi handle already shares connections between
+	 *	its easy handles.  The share handle adds DNS results
+	 *	and TLS sessions, so new connections to a known
+	 *	origin can resume rather than renegotiate.
+	 *
+	 *	Everything is thread specific, so no locking callbacks
+	 *	are needed.
+	 */
+	mhandle->share = curl_share_init();
+	if (!mhandle->share) {
+		WARN("Curl share-handle instantiation failed, DNS and TLS sessions will not be cached");
+		return mhandle;
+	}
+
+	if (((sret = curl_share_setopt(mhandle->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS)) != CURLSHE_OK) ||
+	    ((sret = curl_share_setopt(mhandle->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION)) != CURLSHE_OK)) {
+		WARN("Failed configuring curl share-handle, DNS and TLS sessions will not be cached: %s (%i)",
+		     curl_share_strerror(sret), sret);
+		curl_share_cleanup(mhandle->share);
+		mhandle->share = NULL;
+	}
+
 	return mhandle;
 
 error:
@@ -63,6 +63,7 @@ typedef struct {
 
 	fr_io_track_create_t		track_create;  	//!< create a tracking structure
 	fr_io_track_cmp_t		track_compare;	//!< compare two tracking structures
+	fr_io_track_hash_t		track_hash;	//!< hash a tracking structure
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
@@ -56,6 +56,51 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Return a hash which identifies the flow a packet belongs to
+ *
+ * When the network dispatches packets by flow, packets with the same
+ * hash are sent to the same worker.
+ *
+ * @param[in] instance		of the #fr_app_t.
+ * @param[in] packet_ctx	from the #fr_app_io_t read() routine.
+ * @param[in] buffer		raw packet
+ * @param[in] buflen		length of the packet
+ * @return
+ *	0  - the packet doesn't belong to a flow, use the normal dispatch.
+ *	*  - the flow hash.
+ */
+typedef uint32_t (*fr_app_flow_hash_t)(void const *instance, void const *packet_ctx,
+				       uint8_t const *buffer, size_t buflen);
+
+/** Pairs decoded by the network thread
+ *
+ * This is a top-level talloc context, which holds all of the
+ * decoded pairs.  Ownership passes to the worker along with the
+ * packet.
+ */
+typedef struct {
+	fr_pair_list_t			pairs;		//!< Decoded from the packet.
+} fr_app_decoded_t;
+
+/** Decode a packet on the network thread
+ *
+ * When the listener has "predecode" set, the network thread decodes
+ * the packet before sending it to a worker.  The worker's decode()
+ * routine then takes the pairs from request->async->decoded, instead
+ * of decoding the packet itself.
+ *
+ * @param[in] instance		of the #fr_app_t.
+ * @param[in] packet_ctx	from the #fr_app_io_t read() routine.
+ * @param[in] buffer		raw packet
+ * @param[in] buflen		length of the packet
+ * @return
+ *	- NULL on failure.  The worker then decodes the packet as normal,
+ *	  and reports any errors.
+ *	- the decoded pairs.
+ */
+typedef fr_app_decoded_t *(*fr_app_predecode_t)(void const *instance, void const *packet_ctx,
+						uint8_t const *buffer, size_t buflen);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -88,6 +133,12 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_flow_hash_t		flow_hash;	//!< Identify the flow a packet belongs to.
+							///< May be NULL.
+
+	fr_app_predecode_t		predecode;	//!< Decode the packet on the network thread.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
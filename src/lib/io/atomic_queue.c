@@ -35,13 +35,19 @@ RCSID("$Id$")
 
 #define CACHE_LINE_SIZE	64
 
+/*
+ *	Reserve multiple entries with one CAS.
+ */
+#define cas_add(_store, _var, _num) atomic_compare_exchange_strong_explicit(&_store, &_var, _var + _num, memory_order_release, memory_order_relaxed)
+
 /** Entry in the queue
  *
- * @note This structure is cache line aligned for modern AMD/Intel CPUs.
- * This is to avoid contention when the producer and consumer are executing
- * on different CPU cores.
+ * @note By default, each entry is placed in its own cache line for
+ * modern AMD/Intel CPUs.  This is to avoid contention when the producer
+ * and consumer are executing on different CPU cores.  Compact queues
+ * pack several entries into each cache line.
  */
-typedef struct CC_HINT(packed, aligned(CACHE_LINE_SIZE)) {
+typedef struct CC_HINT(packed, aligned(16)) {
 	atomic_int64_t					seq;		//!< Must be seq then data to ensure
 									///< seq is 64bit aligned for 32bit address
 									///< spaces.
@@ -58,26 +64,25 @@ struct fr_atomic_queue_s {
 	atomic_int64_t					tail;
 
 	size_t						size;
+	size_t						stride;		//!< Bytes between entries.  One cache line,
+									///< unless the queue is compact.
 
 	void						*chunk;		//!< To pass to free. The non-aligned address.
 
-	alignas(CACHE_LINE_SIZE) fr_atomic_queue_entry_t entry[];	//!< The entry array, also aligned
+	alignas(CACHE_LINE_SIZE) uint8_t		entry[];	//!< The entry array, also aligned
 									///< to ensure it's not in the same cache
 									///< line as tail and size.
 };
 
-/** Create fixed-size atomic queue
- *
- * @note the queue must be freed explicitly by the ctx being freed, or by using
- * the #fr_atomic_queue_free function.
+/** Return the entry for a position in the queue
  *
- * @param[in] ctx	The talloc ctx to allocate the queue in.
- * @param[in] size	The number of entries in the queue.
- * @return
- *     - NULL on error.
- *     - fr_atomic_queue_t *, a pointer to the allocated and initialized queue.
  */
-fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
+static inline CC_HINT(always_inline) fr_atomic_queue_entry_t *aq_entry(fr_atomic_queue_t *aq, int64_t pos)
+{
+	return (fr_atomic_queue_entry_t *) &aq->entry[(pos % aq->size) * aq->stride];
+}
+
+static fr_atomic_queue_t *atomic_queue_alloc(TALLOC_CTX *ctx, size_t size, size_t stride)
 {
 	size_t			i;
 	int64_t			seq;
@@ -94,25 +99,28 @@ fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
 	 *	name of the data, too.
 	 */
 	chunk = talloc_aligned_array(ctx, (void **)&aq, CACHE_LINE_SIZE,
-				     sizeof(*aq) + (size) * sizeof(aq->entry[0]));
+				     sizeof(*aq) + (size) * stride);
 	if (!chunk) return NULL;
 	aq->chunk = chunk;
 
 	talloc_set_name_const(chunk, "fr_atomic_queue_t");
 
+	aq->size = size;
+	aq->stride = stride;
+
 	/*
 	 *	Initialize the array.  Data is NULL, and indexes are
 	 *	the array entry number.
 	 */
 	for (i = 0; i < size; i++) {
+		fr_atomic_queue_entry_t *entry = aq_entry(aq, i);
+
 		seq = i;
 
-		aq->entry[i].data = NULL;
-		store(aq->entry[i].seq, seq);
+		entry->data = NULL;
+		store(entry->seq, seq);
 	}
 
-	aq->size = size;
-
 	/*
 	 *	Set the head / tail indexes, and force other CPUs to
 	 *	see the writes.
@@ -124,6 +132,43 @@ fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
 	return aq;
 }
 
+/** Create fixed-size atomic queue
+ *
+ * @note the queue must be freed explicitly by the ctx being freed, or by using
+ * the #fr_atomic_queue_free function.
+ *
+ * @param[in] ctx	The talloc ctx to allocate the queue in.
+ * @param[in] size	The number of entries in the queue.
+ * @return
+ *     - NULL on error.
+ *     - fr_atomic_queue_t *, a pointer to the allocated and initialized queue.
+ */
+fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
+{
+	return atomic_queue_alloc(ctx, size, CACHE_LINE_SIZE);
+}
+
+/** Create fixed-size atomic queue, with several entries per cache line
+ *
+ * Compact queues use less memory, and are faster for consumers which
+ * pop whole batches of entries with #fr_atomic_queue_pop_n.  But
+ * producers and consumers working on adjacent entries contend for the
+ * same cache line.
+ *
+ * @note the queue must be freed explicitly by the ctx being freed, or by using
+ * the #fr_atomic_queue_free function.
+ *
+ * @param[in] ctx	The talloc ctx to allocate the queue in.
+ * @param[in] size	The number of entries in the queue.
+ * @return
+ *     - NULL on error.
+ *     - fr_atomic_queue_t *, a pointer to the allocated and initialized queue.
+ */
+fr_atomic_queue_t *fr_atomic_queue_alloc_compact(TALLOC_CTX *ctx, size_t size)
+{
+	return atomic_queue_alloc(ctx, size, sizeof(fr_atomic_queue_entry_t));
+}
+
 /** Free an atomic queue if it's not freed by ctx
  *
  * This function is needed because the atomic queue memory
@@ -160,7 +205,7 @@ bool fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data)
 	for (;;) {
 		int64_t seq, diff;
 
-		entry = &aq->entry[ head % aq->size ];
+		entry = aq_entry(aq, head);
 		seq = aquire(entry->seq);
 		diff = (seq - head);
 
@@ -224,7 +269,7 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 	for (;;) {
 		int64_t diff;
 
-		entry = &aq->entry[ tail % aq->size ];
+		entry = aq_entry(aq, tail);
 		seq = aquire(entry->seq);
 
 		diff = (seq - (tail + 1));
@@ -262,6 +307,126 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 	return true;
 }
 
+/** Push multiple pointers into the atomic queue
+ *
+ * All of the entries are reserved with one compare and swap, and are
+ * added to the queue in order.
+ *
+ * @param[in] aq	The atomic queue to add data to.
+ * @param[in] data	array of pointers to push.  None may be NULL.
+ * @param[in] num	number of pointers in the array.
+ * @return
+ *	- the number of pointers pushed.  This can be less than num
+ *	  if the queue is full.
+ */
+size_t fr_atomic_queue_push_n(fr_atomic_queue_t *aq, void * const *data, size_t num)
+{
+	int64_t			head, seq = 0;
+	size_t			i, avail;
+	fr_atomic_queue_entry_t	*entry;
+
+	if (!num) return 0;
+
+	head = load(aq->head);
+
+	for (;;) {
+		/*
+		 *	Count the free entries from head onwards.  Once
+		 *	an entry is free, it stays free until a producer
+		 *	reserves it.
+		 */
+		for (avail = 0; avail < num; avail++) {
+			seq = aquire(aq_entry(aq, head + avail)->seq);
+			if (seq != (int64_t) (head + avail)) break;
+		}
+
+		if (!avail) {
+			/*
+			 *	head is larger than the current entry, the queue is full.
+			 */
+			if ((seq - head) < 0) return 0;
+
+			/*
+			 *	Someone else has already written to this entry.
+			 */
+			head = load(aq->head);
+			continue;
+		}
+
+		/*
+		 *	If the CAS fails, head is updated to the current
+		 *	value, and we try again.
+		 */
+		if (cas_add(aq->head, head, avail)) break;
+	}
+
+	for (i = 0; i < avail; i++) {
+		entry = aq_entry(aq, head + i);
+		entry->data = data[i];
+		store(entry->seq, head + i + 1);
+	}
+
+	return avail;
+}
+
+/** Pop multiple pointers from the atomic queue
+ *
+ * All of the entries are claimed with one compare and swap.
+ *
+ * @param[in] aq	the atomic queue to retrieve data from.
+ * @param[out] p_data	array to write the pointers to.
+ * @param[in] num	maximum number of pointers to pop.
+ * @return
+ *	- the number of pointers popped.  0 if the queue is empty.
+ */
+size_t fr_atomic_queue_pop_n(fr_atomic_queue_t *aq, void **p_data, size_t num)
+{
+	int64_t			tail, seq = 0;
+	size_t			i, avail;
+	fr_atomic_queue_entry_t	*entry;
+
+	if (!num) return 0;
+
+	tail = load(aq->tail);
+
+	for (;;) {
+		/*
+		 *	Count the entries from tail onwards which have
+		 *	been written.  Entries which are reserved by a
+		 *	producer, but not yet written, end the batch.
+		 */
+		for (avail = 0; avail < num; avail++) {
+			seq = aquire(aq_entry(aq, tail + avail)->seq);
+			if (seq != (int64_t) (tail + avail + 1)) break;
+		}
+
+		if (!avail) {
+			/*
+			 *	tail is smaller than the current entry, the queue is empty.
+			 */
+			if ((seq - (tail + 1)) < 0) return 0;
+
+			tail = load(aq->tail);
+			continue;
+		}
+
+		if (cas_add(aq->tail, tail, avail)) break;
+	}
+
+	for (i = 0; i < avail; i++) {
+		entry = aq_entry(aq, tail + i);
+
+		/*
+		 *	Copy the pointer to the caller BEFORE updating the
+		 *	queue entry.
+		 */
+		p_data[i] = entry->data;
+		store(entry->seq, tail + i + aq->size);
+	}
+
+	return avail;
+}
+
 size_t fr_atomic_queue_size(fr_atomic_queue_t *aq)
 {
 	return aq->size;
@@ -312,7 +477,7 @@ void fr_atomic_queue_debug(fr_atomic_queue_t *aq, FILE *fp)
 	for (i = 0; i < aq->size; i++) {
 		fr_atomic_queue_entry_t *entry;
 
-		entry = &aq->entry[i];
+		entry = aq_entry(aq, i);
 
 		fprintf(fp, "\t[%zu] = { %p, %" PRId64 " }",
 			i, entry->data, load(entry->seq));
@@ -54,9 +54,12 @@ extern "C" {
 typedef struct fr_atomic_queue_s fr_atomic_queue_t;
 
 fr_atomic_queue_t	*fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size);
+fr_atomic_queue_t	*fr_atomic_queue_alloc_compact(TALLOC_CTX *ctx, size_t size);
 void			fr_atomic_queue_free(fr_atomic_queue_t **aq);
 bool			fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data);
 bool			fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data);
+size_t			fr_atomic_queue_push_n(fr_atomic_queue_t *aq, void * const *data, size_t num);
+size_t			fr_atomic_queue_pop_n(fr_atomic_queue_t *aq, void **p_data, size_t num);
 size_t			fr_atomic_queue_size(fr_atomic_queue_t *aq);
 
 #ifdef WITH_VERIFY_PTR
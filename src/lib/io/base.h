@@ -282,8 +282,8 @@ typedef void *(*fr_io_track_create_t)(void const *instance, void *thread_instanc
  * field.
  *
  * The comparison order of the fields should be "very different" to
- * "much the same".  The packets are put into an rbtree, so having a
- * large fanout at the top is useful.
+ * "much the same", so that most mismatches are found on the first
+ * field.
  *
  * Note that this function should not check if the packets are
  * completely identical.  Instead, it checks particular fields in the
@@ -301,6 +301,20 @@ typedef void *(*fr_io_track_create_t)(void const *instance, void *thread_instanc
  */
 typedef int (*fr_io_track_cmp_t)(void const *instance, void *thread_instance, fr_client_t *client, void const *one, void const *two);
 
+/** Hash a tracking structure for storing in a duplicate detection table.
+ *
+ * The hash must cover only the fields which are checked by the
+ * matching fr_io_track_cmp_t.  Two tracking structures which compare
+ * as identical MUST have the same hash.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] thread_instance	the thread instance for this function
+ * @param[in] client		the client associated with this packet
+ * @param[in] packet		packet tracking structure
+ * @return the hash of the tracking structure.
+ */
+typedef uint32_t (*fr_io_track_hash_t)(void const *instance, void *thread_instance, fr_client_t *client, void const *packet);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -120,6 +120,8 @@ typedef struct {
 
 	bool			must_signal;	//!< we need to signal the other end
 
+	atomic_bool		polling;	//!< The other end is polling our queue, so
+						///< we don't need to signal it.
 
 	uint64_t		sequence;	//!< Sequence number for this channel.
 	uint64_t		ack;		//!< Sequence number of the other end.
@@ -162,6 +164,7 @@ fr_table_num_sorted_t const channel_signals[] = {
 size_t channel_signals_len = NUM_ELEMENTS(channel_signals);
 
 fr_table_num_sorted_t const channel_packet_priority[] = {
+	{ L("background"), PRIORITY_BACKGROUND	},
 	{ L("high"),	PRIORITY_HIGH		},
 	{ L("low"),	PRIORITY_LOW		},
 	{ L("normal"),	PRIORITY_NORMAL		},
@@ -273,6 +276,23 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 {
 	fr_channel_control_t cc;
 
+	/*
+	 *	The other end is polling our queue, and will see the
+	 *	data without being woken up.
+	 *
+	 *	The fence orders our push to the atomic queue before
+	 *	the read of "polling".  The other end orders its
+	 *	write of "polling" before its last read of the queue.
+	 *	So either we see that it has stopped polling, or it
+	 *	sees our data.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&end->polling, memory_order_relaxed)) {
+		end->stats.polled++;
+		end->must_signal = false;
+		return 0;
+	}
+
 	end->stats.last_sent_signal = when;
 	end->stats.signals++;
 	end->must_signal = false;
@@ -669,6 +689,104 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 }
 
 
+/** Start or stop polling a channel for requests
+ *
+ * This function should be called by the responder.  While it is
+ * polling, the requestor doesn't signal it when it sends a request.
+ *
+ * Any requests which are in the channel are received, so that none
+ * are missed when the responder stops polling.
+ *
+ * @param[in] ch	the channel to poll.
+ * @param[in] polling	whether the responder is polling the channel.
+ * @return
+ *	- true if any requests were received.
+ *	- false if the channel was empty.
+ */
+bool fr_channel_responder_poll(fr_channel_t *ch, bool polling)
+{
+	bool received = false;
+
+	atomic_store_explicit(&ch->end[TO_RESPONDER].polling, polling, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	while (fr_channel_recv_request(ch)) received = true;
+
+	return received;
+}
+
+/** Start or stop polling a channel for replies
+ *
+ * This function should be called by the requestor.  While it is
+ * polling, the responder doesn't signal it when it sends a reply.
+ *
+ * Any replies which are in the channel are received, so that none
+ * are missed when the requestor stops polling.
+ *
+ * @param[in] ch	the channel to poll.
+ * @param[in] polling	whether the requestor is polling the channel.
+ * @return
+ *	- true if any replies were received.
+ *	- false if the channel was empty.
+ */
+bool fr_channel_requestor_poll(fr_channel_t *ch, bool polling)
+{
+	bool received = false;
+
+	atomic_store_explicit(&ch->end[TO_REQUESTOR].polling, polling, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	while (fr_channel_recv_reply(ch)) received = true;
+
+	return received;
+}
+
+/** Update the polling state with the timestamp of a received message
+ *
+ * @param[in] cp	the polling state of the receiving thread.
+ * @param[in] when	the message was sent.
+ */
+void fr_channel_poll_arrival(fr_channel_poll_t *cp, fr_time_t when)
+{
+	/*
+	 *	Messages from different channels may arrive out of
+	 *	order.  Those don't tell us anything about the
+	 *	interval.
+	 */
+	if (fr_time_lteq(when, cp->last)) return;
+
+	if (!fr_time_delta_ispos(cp->interval)) {
+		if (fr_time_gt(cp->last, fr_time_wrap(0))) cp->interval = fr_time_sub(when, cp->last);
+	} else {
+		cp->interval = RTT(cp->interval, fr_time_sub(when, cp->last));
+	}
+	cp->last = when;
+}
+
+/** Get how long a thread should poll its channels before sleeping
+ *
+ * We poll for twice the average interval between messages, so that
+ * we usually see the next message before giving up.  If messages
+ * arrive more slowly than that, polling just burns CPU, and we sleep
+ * immediately.
+ *
+ * @param[in] cp	the polling state of the receiving thread.
+ * @return
+ *	- 0 if the thread should sleep now.
+ *	- >0 the time to poll for.
+ */
+fr_time_delta_t fr_channel_poll_budget(fr_channel_poll_t const *cp)
+{
+	fr_time_delta_t budget;
+
+	if (!fr_time_delta_ispos(cp->max) || !fr_time_delta_ispos(cp->interval)) return fr_time_delta_wrap(0);
+
+	budget = fr_time_delta_add(cp->interval, cp->interval);
+	if (fr_time_delta_gt(budget, cp->max)) return fr_time_delta_wrap(0);
+
+	return budget;
+}
+
 /** Service a control-plane message
  *
  * @param[in] when		The current time.
@@ -972,6 +1090,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "\tlast write = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_RESPONDER].stats.last_read_other));
 	fr_log(log, L_INFO, file, line, "\tlast read other end = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_RESPONDER].stats.last_read_other));
 	fr_log(log, L_INFO, file, line, "\tlast signal other = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_RESPONDER].stats.last_sent_signal));
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.polled);
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
@@ -981,4 +1100,5 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "\tlast write = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_REQUESTOR].stats.last_read_other));
 	fr_log(log, L_INFO, file, line, "\tlast read other end = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_REQUESTOR].stats.last_read_other));
 	fr_log(log, L_INFO, file, line, "\tlast signal other = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_REQUESTOR].stats.last_sent_signal));
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.polled);
 }
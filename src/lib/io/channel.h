@@ -92,8 +92,23 @@ typedef struct {
 	fr_time_delta_t		message_interval; //!< Interval between messages.
 
 	fr_time_t		last_sent_signal; //!< The last time when we signaled the other end.
+	uint64_t		polled;		//!< Signals skipped because the other end was polling.
 } fr_channel_stats_t;
 
+/** Adaptive polling state for a thread which reads from channels
+ *
+ * Instead of sleeping in the event loop as soon as it runs out of
+ * work, a thread may poll its channels for a short time.  While it is
+ * polling, the other end of each channel skips the kernel signal.
+ * The time spent polling is learned from the interval between
+ * recently received messages.
+ */
+typedef struct {
+	fr_time_delta_t		max;		//!< Longest time we poll for.  Zero disables polling.
+	fr_time_delta_t		interval;	//!< Moving average of the time between messages.
+	fr_time_t		last;		//!< Timestamp of the last message we received.
+} fr_channel_poll_t;
+
 
 /**
  *  Channel information which is added to a message.
@@ -128,12 +143,15 @@ typedef struct {
 	union {
 		struct {
 			fr_time_t		recv_time;	//!< time original request was received (network -> worker)
+			void			*decoded;	//!< #fr_app_decoded_t from the network thread, or NULL.
 		} request;
 
 		struct {
 			fr_time_delta_t		cpu_time;		//!< Total CPU time, including predicted work, (only worker -> network).
 			fr_time_delta_t		processing_time; 	//!< Actual processing time for this packet (only worker -> network).
 			fr_time_t		request_time;		//!< Timestamp of the request packet.
+			bool			saturated;		//!< A backend used by the worker is saturated
+									///< (only worker -> network).
 	        } reply;
 	};
 
@@ -150,6 +168,7 @@ typedef struct {
 #define PRIORITY_HIGH   (1 << 15)
 #define PRIORITY_NORMAL (1 << 14)
 #define PRIORITY_LOW    (1 << 13)
+#define PRIORITY_BACKGROUND (1 << 12)			//!< Run on the background workers, if there are any.
 
 extern fr_table_num_sorted_t const channel_signals[];
 extern size_t channel_signals_len;
@@ -172,6 +191,12 @@ int	fr_channel_set_recv_request(fr_channel_t *ch, void *ctx, fr_channel_recv_cal
 
 int	fr_channel_responder_sleeping(fr_channel_t *ch) CC_HINT(nonnull);
 
+bool	fr_channel_responder_poll(fr_channel_t *ch, bool polling) CC_HINT(nonnull);
+bool	fr_channel_requestor_poll(fr_channel_t *ch, bool polling) CC_HINT(nonnull);
+
+void		fr_channel_poll_arrival(fr_channel_poll_t *cp, fr_time_t when) CC_HINT(nonnull);
+fr_time_delta_t	fr_channel_poll_budget(fr_channel_poll_t const *cp) CC_HINT(nonnull);
+
 int	fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, struct kevent const *kev) CC_HINT(nonnull);
 fr_channel_event_t	fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size) CC_HINT(nonnull);
 
@@ -88,25 +88,36 @@ struct fr_control_s {
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
+static ssize_t control_message_copy(fr_control_message_t *m, uint32_t *p_id, void *data, size_t data_size);
+
 static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
 	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
-	ssize_t i, num;
+	ssize_t num;
+	size_t i, popped;
 	fr_time_t now;
 	char read_buffer[256];
 	uint8_t	data[256];
+	fr_control_message_t *m[sizeof(read_buffer)];
 
 	num = read(fd, read_buffer, sizeof(read_buffer));
 	if (num <= 0) return;
 
+	/*
+	 *	There's one message in the queue for each byte we
+	 *	read, so grab them all at once.
+	 */
+	popped = fr_atomic_queue_pop_n(c->aq, (void **) m, num);
+	if (!popped) return;
+
 	now = fr_time();
 
-	for (i = 0; i < num; i++) {
+	for (i = 0; i < popped; i++) {
 		uint32_t id = 0;
-		size_t message_size;
+		ssize_t message_size;
 
-		message_size = fr_control_message_pop(c->aq, &id, data, sizeof(data));
-		if (!message_size) return;
+		message_size = control_message_copy(m[i], &id, data, sizeof(data));
+		if (message_size <= 0) continue;
 
 		if (id >= FR_CONTROL_MAX_TYPES) continue;
 
@@ -376,13 +387,22 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
  */
 ssize_t fr_control_message_pop(fr_atomic_queue_t *aq, uint32_t *p_id, void *data, size_t data_size)
 {
-	uint8_t *p;
 	fr_control_message_t *m;
 
 	MPRINT("CONTROL pop aq %p\n", aq);
 
 	if (!fr_atomic_queue_pop(aq, (void **) &m)) return 0;
 
+	return control_message_copy(m, p_id, data, data_size);
+}
+
+/** Copy the data out of a control message, and mark it done
+ *
+ */
+static ssize_t control_message_copy(fr_control_message_t *m, uint32_t *p_id, void *data, size_t data_size)
+{
+	uint8_t *p;
+
 	fr_assert_msg(m->status == FR_CONTROL_MESSAGE_USED, "Bad control message state, expected %u got %u",
 		      FR_CONTROL_MESSAGE_USED, m->status);
 
@@ -17,6 +17,7 @@
 #include <freeradius-devel/io/base.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/server/time_tracking.h>
+#include <freeradius-devel/util/log_rec.h>
 
 /** Describes a path data takes to/from the wire to/from fr_pair_ts
  *
@@ -48,6 +49,13 @@ struct fr_listen {
 							///< populated when event_list_set callback is run which doesn't
 							///< happen if the short cut is taken.
 
+	bool			read_pending;		//!< Set by the app_io read() routine when it has
+							///< already taken more packets from the socket.
+							///< The network side will then call read() again,
+							///< without waiting for the FD to become readable.
+
+	bool			predecode;		//!< Decode packets on the network thread.
+
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
 };
@@ -58,6 +66,7 @@ struct fr_listen {
 struct fr_async_s {
 	fr_time_t		recv_time;
 	fr_event_list_t		*el;
+	fr_log_rec_t		*flight;	//!< Flight recorder, when enabled.
 
 	fr_time_tracking_t	tracking;
 	fr_channel_t		*channel;
@@ -70,6 +79,12 @@ struct fr_async_s {
 	uint32_t		priority;	//!< higher == higher priority
 
 	uint32_t		sequence;	//!< higher == higher priority, too
+
+	void			*stolen;	//!< Set when the request was taken from the
+						//!< backlog of another worker.
+
+	void			*decoded;	//!< #fr_app_decoded_t from the network thread.
+						//!< The decode() routine takes ownership of it.
 };
 
 int fr_io_listen_free(fr_listen_t *li);
@@ -26,6 +26,8 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/load.h>
 
+#include <time.h>
+
 /*
  *	We use *inverse* numbers to avoid numerical calculation issues.
  *
@@ -82,6 +84,13 @@ struct fr_load_s {
 
 	fr_time_t		next;			//!< The next time we're supposed to send a packet
 	fr_event_timer_t const	*ev;
+
+	fr_histogram_t		step_latency;		//!< latency of replies received during the current step
+	fr_histogram_t		latency;		//!< latency of all replies received
+	fr_time_delta_t		start_cpu;		//!< process CPU time when the test started
+	fr_time_delta_t		step_cpu;		//!< process CPU time when the current step started
+	fr_time_delta_t		end_cpu;		//!< process CPU time when the test ended
+	fr_load_step_t		*steps;			//!< results of the completed steps
 };
 
 fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_load_config_t *config,
@@ -95,6 +104,7 @@ fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_loa
 	if (!config->start_pps) config->start_pps = 1;
 	if (!config->milliseconds) config->milliseconds = 1000;
 	if (!config->parallel) config->parallel = 1;
+	if (config->slo_percentile <= 0) config->slo_percentile = 99;
 
 	l->el = el;
 	l->config = config;
@@ -126,6 +136,68 @@ static void fr_load_generator_send(fr_load_t *l, fr_time_t now, int count)
 	}
 }
 
+/** CPU time used by all threads of the process
+ *
+ *  This includes the time spent generating the load.
+ */
+static fr_time_delta_t load_cpu_time(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) < 0) return fr_time_delta_wrap(0);
+
+	return fr_time_delta_from_timespec(&ts);
+}
+
+/** Record the results of the step which just ended
+ *
+ * @return
+ *	- true if the step breached the SLO.
+ *	- false if the step met the SLO, or there is no SLO.
+ */
+static bool load_step_end(fr_load_t *l, fr_time_t now)
+{
+	size_t		num = talloc_array_length(l->steps);
+	fr_load_step_t	*step;
+	fr_histogram_t	*h = &l->step_latency;
+	uint64_t	received = l->stats.received - l->step_received;
+	fr_time_delta_t	cpu = load_cpu_time();
+	fr_time_delta_t	elapsed = fr_time_sub(now, l->step_start);
+
+	MEM(l->steps = talloc_realloc(l, l->steps, fr_load_step_t, num + 1));
+	step = &l->steps[num];
+
+	*step = (fr_load_step_t) {
+		.pps = l->pps,
+		.received = received,
+		.p50 = fr_time_delta_wrap(fr_histogram_percentile(h, 50)),
+		.p90 = fr_time_delta_wrap(fr_histogram_percentile(h, 90)),
+		.p99 = fr_time_delta_wrap(fr_histogram_percentile(h, 99)),
+		.p999 = fr_time_delta_wrap(fr_histogram_percentile(h, 99.9)),
+		.max = fr_time_delta_wrap(h->max),
+		.slo = fr_time_delta_wrap(fr_histogram_percentile(h, l->config->slo_percentile)),
+	};
+	if (fr_time_delta_ispos(elapsed)) step->pps_accepted = (received * NSEC) / fr_time_delta_unwrap(elapsed);
+	if (received) step->cpu = fr_time_delta_wrap(fr_time_delta_unwrap(fr_time_delta_sub(cpu, l->step_cpu)) / received);
+
+	l->step_cpu = cpu;
+	fr_histogram_merge(&l->latency, h);
+	memset(h, 0, sizeof(*h));
+
+	/*
+	 *	A step where nothing came back is as far over the
+	 *	SLO as it's possible to be.
+	 */
+	if (fr_time_delta_ispos(l->config->slo_latency) &&
+	    (!received || fr_time_delta_gt(step->slo, l->config->slo_latency))) {
+		l->stats.slo_breached = true;
+		return true;
+	}
+
+	if ((int) step->pps_accepted > l->stats.slo_pps) l->stats.slo_pps = step->pps_accepted;
+	return false;
+}
+
 static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 {
 	fr_load_t *l = uctx;
@@ -143,6 +215,14 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	 *	If we're done this step, go to the next one.
 	 */
 	if (fr_time_gteq(l->next, l->step_end)) {
+		/*
+		 *	Stop ramping up once we're past the SLO.
+		 */
+		if (load_step_end(l, l->next)) {
+			l->state = FR_LOAD_STATE_DRAINING;
+			return;
+		}
+
 		l->step_start = l->next;
 		l->step_end = fr_time_add(l->next, l->config->duration);
 		l->step_received = l->stats.received;
@@ -230,7 +310,15 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 int fr_load_generator_start(fr_load_t *l)
 {
 	l->stats.start = fr_time();
+	l->stats.slo_pps = 0;
+	l->stats.slo_breached = false;
 	l->step_start = l->stats.start;
+	l->step_received = l->stats.received;
+
+	memset(&l->step_latency, 0, sizeof(l->step_latency));
+	memset(&l->latency, 0, sizeof(l->latency));
+	l->start_cpu = l->step_cpu = load_cpu_time();
+	TALLOC_FREE(l->steps);
 	l->step_end = fr_time_add(l->step_start, l->config->duration);
 
 	l->pps = l->config->start_pps;
@@ -277,6 +365,7 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	l->stats.rtt = RTT(l->stats.rtt, t);
 
 	l->stats.received++;
+	fr_histogram_add(&l->step_latency, fr_time_delta_unwrap(t));
 
 	/*
 	 *	t is in nanoseconds.
@@ -332,6 +421,15 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	if (l->stats.received < l->stats.sent) return FR_LOAD_CONTINUE;
 
 	l->stats.end = now;
+	l->end_cpu = load_cpu_time();
+
+	/*
+	 *	Replies which came in while draining don't belong to
+	 *	any step, but they're still part of the overall latency.
+	 */
+	fr_histogram_merge(&l->latency, &l->step_latency);
+	memset(&l->step_latency, 0, sizeof(l->step_latency));
+
 	return FR_LOAD_DONE;
 }
 
@@ -388,3 +486,82 @@ fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l)
 {
 	return &l->stats;
 }
+
+/** Return the results of the completed steps
+ *
+ * @param[in] l		the load generator.
+ * @param[out] num	number of steps.
+ * @return an array of steps, in the order in which they were run.
+ */
+fr_load_step_t const *fr_load_generator_steps(fr_load_t const *l, size_t *num)
+{
+	*num = talloc_array_length(l->steps);
+	return l->steps;
+}
+
+/** Return the latency histogram for all replies received so far
+ *
+ *  Values are in nanoseconds.  Replies received during the current
+ *  step are added when the step ends.
+ */
+fr_histogram_t const *fr_load_generator_latency(fr_load_t const *l)
+{
+	return &l->latency;
+}
+
+#define USEC(_x) (fr_time_delta_unwrap(_x) / 1000.0)
+
+/** Print load generator results as a JSON object
+ *
+ *  The object is not followed by a newline, so that the caller can
+ *  embed it in a larger document.
+ */
+void fr_load_generator_stats_json(fr_load_t const *l, FILE *fp)
+{
+	size_t		i, num = talloc_array_length(l->steps);
+	fr_histogram_t const *h = &l->latency;
+	double		cpu = 0;
+
+	if (l->stats.received) cpu = USEC(fr_time_delta_sub(l->end_cpu, l->start_cpu)) / l->stats.received;
+
+	fprintf(fp, "{\n"
+		"\t\"start_pps\": %u,\n"
+		"\t\"step\": %u,\n"
+		"\t\"duration\": %.3f,\n"
+		"\t\"slo\": { \"percentile\": %g, \"latency_usec\": %.3f, \"breached\": %s },\n"
+		"\t\"max_sustainable_pps\": %d,\n"
+		"\t\"sent\": %d,\n"
+		"\t\"received\": %d,\n"
+		"\t\"max_backlog\": %d,\n"
+		"\t\"cpu_usec_per_request\": %.3f,\n",
+		l->config->start_pps, l->config->step,
+		fr_time_delta_unwrap(l->config->duration) / (double) NSEC,
+		l->config->slo_percentile, USEC(l->config->slo_latency),
+		l->stats.slo_breached ? "true" : "false",
+		l->stats.slo_pps,
+		l->stats.sent, l->stats.received, l->stats.max_backlog,
+		cpu);
+
+	fprintf(fp, "\t\"latency_usec\": { \"count\": %" PRIu64 ", \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+		"\"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f },\n",
+		h->count, fr_histogram_mean(h) / 1000.0,
+		fr_histogram_percentile(h, 50) / 1000.0,
+		fr_histogram_percentile(h, 90) / 1000.0,
+		fr_histogram_percentile(h, 99) / 1000.0,
+		fr_histogram_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+
+	fprintf(fp, "\t\"steps\": [");
+	for (i = 0; i < num; i++) {
+		fr_load_step_t const *step = &l->steps[i];
+
+		fprintf(fp, "%s\n\t\t{ \"pps\": %u, \"pps_accepted\": %u, \"received\": %" PRIu64 ", "
+			"\"p50_usec\": %.3f, \"p90_usec\": %.3f, \"p99_usec\": %.3f, \"p99.9_usec\": %.3f, "
+			"\"max_usec\": %.3f, \"slo_usec\": %.3f, \"cpu_usec_per_request\": %.3f }",
+			(i > 0) ? "," : "",
+			step->pps, step->pps_accepted, step->received,
+			USEC(step->p50), USEC(step->p90), USEC(step->p99), USEC(step->p999),
+			USEC(step->max), USEC(step->slo), USEC(step->cpu));
+	}
+	fprintf(fp, "%s]\n}", num ? "\n\t" : "");
+}
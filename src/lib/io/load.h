@@ -26,6 +26,7 @@
 RCSIDH(load_h, "$Id$")
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/util/talloc.h>
 
 /** Load generation configuration.
@@ -68,6 +69,12 @@ RCSIDH(load_h, "$Id$")
  *  "duration" seconds, even if the maximum backlog is currently
  *  reached.  This increase has the effect of also increasing the
  *  maximum backlog.
+ *
+ *  If "slo_latency" is set, the generator checks the latency of the
+ *  replies received during each step.  When the "slo_percentile"
+ *  latency of a step is larger than "slo_latency", the SLO has been
+ *  breached, and the generator stops.  The accepted packets/s of the
+ *  last step which met the SLO is the maximum sustainable rate.
  */
 typedef struct {
 	uint32_t       	start_pps;	//!< start PPS
@@ -76,6 +83,8 @@ typedef struct {
 	uint32_t	step;		//!< how much to increase each load test by
 	uint32_t	parallel;	//!< how many packets in parallel to send
 	uint32_t	milliseconds;	//!< how many milliseconds of backlog to top out at
+	fr_time_delta_t	slo_latency;	//!< stop when a step's latency is larger than this, 0 for "no SLO".
+	double		slo_percentile;	//!< which latency percentile is compared to slo_latency.
 } fr_load_config_t;
 
 typedef struct {
@@ -93,8 +102,26 @@ typedef struct {
 	int		max_backlog;	//!< maximum backlog we saw during the test
 	bool		blocked;	//!< whether or not we're blocked
 	int		times[8];	//!< response time in microseconds to tens of seconds
+	int		slo_pps;	//!< highest accepted PPS of a step which met the SLO
+	bool		slo_breached;	//!< whether the test stopped because the SLO was breached
 } fr_load_stats_t;
 
+/** Results for one step of the load test
+ *
+ */
+typedef struct {
+	uint32_t	pps;		//!< offered packets/s
+	uint32_t	pps_accepted;	//!< replies/s received during the step
+	uint64_t	received;	//!< replies received during the step
+	fr_time_delta_t	p50;		//!< median latency
+	fr_time_delta_t	p90;
+	fr_time_delta_t	p99;
+	fr_time_delta_t	p999;
+	fr_time_delta_t	max;		//!< largest latency
+	fr_time_delta_t	slo;		//!< the "slo_percentile" latency
+	fr_time_delta_t	cpu;		//!< process CPU time used per reply
+} fr_load_step_t;
+
 typedef struct fr_load_s fr_load_t;
 
 /** Whether or not the application should continue.
@@ -120,3 +147,9 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen);
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l) CC_HINT(nonnull);
+
+fr_load_step_t const *fr_load_generator_steps(fr_load_t const *l, size_t *num) CC_HINT(nonnull);
+
+fr_histogram_t const *fr_load_generator_latency(fr_load_t const *l) CC_HINT(nonnull);
+
+void fr_load_generator_stats_json(fr_load_t const *l, FILE *fp) CC_HINT(nonnull);
@@ -29,8 +29,13 @@
 #include <freeradius-devel/util/debug.h>
 
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/ohash.h>
 #include <freeradius-devel/util/syserror.h>
 
+#ifdef __linux__
+#  include <linux/filter.h>
+#endif
+
 typedef struct {
 	fr_event_list_t			*el;				//!< event list, for the master socket.
 	fr_network_t			*nr;				//!< network for the master socket
@@ -38,11 +43,17 @@ typedef struct {
 	fr_trie_t			*trie;				//!< trie of clients
 	fr_heap_t			*pending_clients;		//!< heap of pending clients
 	fr_heap_t			*alive_clients;			//!< heap of active clients
+	fr_hash_table_t			*network_rates;			//!< recent dynamic client definitions,
+									///< by allowed network.
 
 	fr_listen_t			*listen;			//!< The master IO path
 	fr_listen_t			*child;				//!< The child (app_io) IO path
 	fr_schedule_t			*sc;				//!< the scheduler
 
+	module_list_t			*clients;			//!< client modules for connected sockets
+									///< on this shard.
+	unsigned int			shard;				//!< which shard of the listener this socket is.
+
 	// @todo - count num_nak_clients, and num_nak_connections, too
 	uint32_t			num_connections;		//!< number of dynamic connections
 	uint32_t			num_pending_packets;   		//!< number of pending packets
@@ -112,8 +123,8 @@ struct fr_io_client_s {
 
 	fr_io_instance_t const		*inst;		//!< parent instance for master IO handler
 	fr_io_thread_t			*thread;
-	fr_event_timer_t const		*ev;		//!< when we clean up the client
-	fr_rb_tree_t			*table;		//!< tracking table for packets
+	fr_event_wheel_timer_t		ev;		//!< when we clean up the client
+	fr_ohash_t			*table;		//!< tracking table for packets
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
@@ -164,7 +175,7 @@ static fr_event_update_t resume_read[] = {
 
 static int track_free(fr_io_track_t *track)
 {
-	if (track->ev) (void) fr_event_timer_delete(&track->ev);
+	fr_event_wheel_timer_delete(&track->ev);
 
 	talloc_free_children(track);
 
@@ -177,15 +188,89 @@ static int track_free(fr_io_track_t *track)
 static int track_dedup_free(fr_io_track_t *track)
 {
 	fr_assert(track->client->table != NULL);
-	fr_assert(fr_rb_find(track->client->table, track) != NULL);
+	fr_assert(fr_ohash_find(track->client->table, track) != NULL);
 
-	if (!fr_rb_delete(track->client->table, track)) {
+	if (!fr_ohash_delete(track->client->table, track)) {
 		fr_assert(0);
 	}
 
 	return track_free(track);
 }
 
+/** How many dynamic client definitions an allowed network has started recently
+ *
+ */
+typedef struct {
+	fr_ipaddr_t const		*network;	//!< in inst->networks
+	fr_time_t			start;		//!< of the current one second window
+	uint32_t			count;		//!< of definitions started in the window
+} fr_io_network_rate_t;
+
+static uint32_t network_rate_hash(void const *data)
+{
+	fr_io_network_rate_t const *a = data;
+
+	return fr_hash(&a->network, sizeof(a->network));
+}
+
+static int8_t network_rate_cmp(void const *one, void const *two)
+{
+	fr_io_network_rate_t const *a = one;
+	fr_io_network_rate_t const *b = two;
+
+	return CMP(a->network, b->network);
+}
+
+/** Check if an allowed network may start another dynamic client definition
+ *
+ *  Each definition runs the "new client" section in a worker, and
+ *  queues packets until it's done.  A scan of an allowed network
+ *  would otherwise fill the pending queues, and slow down the
+ *  definitions for real clients.
+ *
+ * @param[in] inst	the master IO instance.
+ * @param[in] thread	the master IO thread.
+ * @param[in] network	the allowed network the source address is in.
+ * @return
+ *	- true if the network has started too many definitions in the
+ *	  last second.
+ *	- false if a new definition may be started.
+ */
+static bool network_rate_limited(fr_io_instance_t const *inst, fr_io_thread_t *thread, fr_ipaddr_t const *network)
+{
+	fr_io_network_rate_t	*rate;
+	fr_time_t		now;
+
+	if (!inst->max_new_clients) return false;
+
+	if (!thread->network_rates) {
+		MEM(thread->network_rates = fr_hash_table_alloc(thread, network_rate_hash, network_rate_cmp, NULL));
+	}
+
+	now = fr_time();
+
+	rate = fr_hash_table_find(thread->network_rates, &(fr_io_network_rate_t){ .network = network });
+	if (!rate) {
+		MEM(rate = talloc_zero(thread->network_rates, fr_io_network_rate_t));
+		rate->network = network;
+		rate->start = now;
+		if (!fr_hash_table_insert(thread->network_rates, rate)) {
+			talloc_free(rate);
+			return false;
+		}
+	}
+
+	if (fr_time_gteq(now, fr_time_add(rate->start, fr_time_delta_from_sec(1)))) {
+		rate->start = now;
+		rate->count = 0;
+	}
+
+	if (rate->count >= inst->max_new_clients) return true;
+
+	rate->count++;
+	return false;
+}
+
 /*
  *  Return negative numbers to put 'one' at the top of the heap.
  *  Return positive numbers to put 'two' at the top of the heap.
@@ -254,6 +339,28 @@ static int8_t address_cmp(void const *one, void const *two)
 	return fr_ipaddr_cmp(&a->socket.inet.dst_ipaddr, &b->socket.inet.dst_ipaddr);
 }
 
+/*
+ *	Only hash the bytes which are checked by fr_ipaddr_cmp().
+ */
+static inline uint32_t ipaddr_hash(fr_ipaddr_t const *ipaddr, uint32_t hash)
+{
+	if (ipaddr->af == AF_INET6) return fr_hash_update(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6), hash);
+
+	return fr_hash_update(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4), hash);
+}
+
+static uint32_t address_hash(fr_io_address_t const *address)
+{
+	uint32_t hash;
+
+	hash = fr_hash(&address->socket.inet.src_port, sizeof(address->socket.inet.src_port));
+	hash = fr_hash_update(&address->socket.inet.dst_port, sizeof(address->socket.inet.dst_port), hash);
+	hash = fr_hash_update(&address->socket.inet.ifindex, sizeof(address->socket.inet.ifindex), hash);
+
+	hash = ipaddr_hash(&address->socket.inet.src_ipaddr, hash);
+	return ipaddr_hash(&address->socket.inet.dst_ipaddr, hash);
+}
+
 static uint32_t connection_hash(void const *ctx)
 {
 	uint32_t hash;
@@ -307,6 +414,38 @@ static int8_t track_cmp(void const *one, void const *two)
 }
 
 
+static uint32_t track_hash(void const *data)
+{
+	fr_io_track_t const *track = talloc_get_type_abort_const(data, fr_io_track_t);
+	uint32_t hash;
+
+	fr_assert(!track->client->connection);
+
+	/*
+	 *	Hash the same fields as track_cmp().
+	 */
+	hash = track->client->inst->app_io->track_hash(track->client->inst->app_io_instance,
+						       track->client->thread->child->thread_instance,
+						       track->client->radclient,
+						       track->packet);
+
+	return fr_hash_update(&hash, sizeof(hash), address_hash(track->address));
+}
+
+
+static uint32_t track_connected_hash(void const *data)
+{
+	fr_io_track_t const *track = talloc_get_type_abort_const(data, fr_io_track_t);
+
+	fr_assert(track->client->connection);
+
+	return track->client->inst->app_io->track_hash(track->client->inst->app_io_instance,
+						       track->client->connection->child->thread_instance,
+						       track->client->connection->client->radclient,
+						       track->packet);
+}
+
+
 static int8_t track_connected_cmp(void const *one, void const *two)
 {
 	fr_io_track_t const *a = talloc_get_type_abort_const(one, fr_io_track_t);
@@ -454,6 +593,7 @@ static int count_connections(UNUSED uint8_t const *key, UNUSED size_t keylen, vo
 
 static int _client_free(fr_io_client_t *client)
 {
+	fr_event_wheel_timer_delete(&client->ev);
 	TALLOC_FREE(client->pending);
 
 	return 0;
@@ -525,7 +665,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		 *	Add a client module into a sublist
 		 */
 		inst_name = talloc_asprintf(NULL, "%"PRIu64, thread->client_id++);
-		mi = module_instance_copy(inst->clients, inst->submodule, inst_name);
+		mi = module_instance_copy(thread->clients, inst->submodule, inst_name);
 
 		cs = cf_section_dup(mi, NULL, inst->submodule->conf,
 				    cf_section_name1(inst->submodule->conf),
@@ -580,8 +720,8 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	 *	#todo - unify the code with static clients?
 	 */
 	if (inst->app_io->track_duplicates) {
-		MEM(connection->client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node,
-									  track_connected_cmp, NULL));
+		fr_assert(inst->app_io->track_hash != NULL);
+		MEM(connection->client->table = fr_ohash_alloc(client, track_connected_hash, track_connected_cmp, 0));
 	}
 
 	/*
@@ -920,6 +1060,7 @@ static int _client_live_free(fr_io_client_t *client)
 	fr_assert(!client->connection);
 	fr_assert(fr_heap_num_elements(client->thread->alive_clients) > 0);
 
+	fr_event_wheel_timer_delete(&client->ev);
 	if (client->pending) TALLOC_FREE(client->pending);
 
 	(void) fr_trie_remove_by_key(client->thread->trie, &client->src_ipaddr.addr, client->src_ipaddr.prefix);
@@ -980,7 +1121,8 @@ static fr_io_client_t *client_alloc(TALLOC_CTX *ctx, fr_io_client_state_t state,
 	 */
 	if (inst->app_io->track_duplicates) {
 		fr_assert(inst->app_io->track_compare != NULL);
-		MEM(client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node, track_cmp, NULL));
+		fr_assert(inst->app_io->track_hash != NULL);
+		MEM(client->table = fr_ohash_alloc(client, track_hash, track_cmp, 0));
 	}
 
 	/*
@@ -1081,7 +1223,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	/*
 	 *	No existing duplicate.  Return the new tracking entry.
 	 */
-	old = fr_rb_find(client->table, track);
+	old = fr_ohash_find(client->table, track);
 	if (!old) goto do_insert;
 
 	fr_assert(old->client == client);
@@ -1091,7 +1233,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 *
 	 *	2020-08-17, this assertion fails randomly in travis.
 	 *	Which means that "track" was in the free list, *and*
-	 *	in the rbtree.
+	 *	in the tracking table.
 	 */
 	fr_assert(old != track);
 
@@ -1131,7 +1273,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 		 *	struct while the packet is in the outbound
 		 *	queue.
 		 */
-		if (old->ev) (void) fr_event_timer_delete(&old->ev);
+		fr_event_wheel_timer_delete(&old->ev);
 		return old;
 	}
 
@@ -1141,7 +1283,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 *	and insert the new one.
 	 *
 	 *	If there's no reply, then the old request is still
-	 *	"live".  Delete the old one from the tracking tree,
+	 *	"live".  Delete the old one from the tracking table,
 	 *	and return the new one.
 	 */
 	if (old->reply_len || old->do_not_respond) {
@@ -1150,10 +1292,10 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	} else {
 		fr_assert(client == old->client);
 
-		if (!fr_rb_delete(client->table, old)) {
+		if (!fr_ohash_delete(client->table, old)) {
 			fr_assert(0);
 		}
-		if (old->ev) (void) fr_event_timer_delete(&old->ev);
+		fr_event_wheel_timer_delete(&old->ev);
 
 		talloc_set_destructor(old, track_free);
 
@@ -1161,7 +1303,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	}
 
 do_insert:
-	if (!fr_rb_insert(client->table, track)) {
+	if (!fr_ohash_insert(client->table, track)) {
 		fr_assert(0);
 	}
 
@@ -1439,6 +1581,13 @@ do_read:
 		 */
 		packet_len = inst->app_io->read(child, (void **) &local_address, &recv_time,
 					  buffer, buffer_len, leftover);
+
+		/*
+		 *	The network side only looks at our listener,
+		 *	so tell it if the child has more packets.
+		 */
+		li->read_pending = child->read_pending;
+
 		if (packet_len <= 0) {
 			return packet_len;
 		}
@@ -1569,6 +1718,20 @@ do_read:
 				goto ignore;
 			}
 
+			/*
+			 *	Too many new clients from this network.
+			 *	Don't cache a NAK, the client may be
+			 *	allowed when it tries again.
+			 */
+			if (network_rate_limited(inst, thread, network)) {
+				DEBUG("proto_%s - ignoring packet from client IP address %pV - "
+				      "too many new dynamic clients from network %pV",
+				      inst->app_io->common.name, fr_box_ipaddr(address.socket.inet.src_ipaddr),
+				      fr_box_ipaddr(*network));
+				if (accept_fd >= 0) close(accept_fd);
+				return 0;
+			}
+
 			/*
 			 *	Allocate our local radclient as a
 			 *	placeholder for the dynamic client.
@@ -1733,8 +1896,8 @@ have_client:
 		 *	connection.  It's still in use, so we don't
 		 *	want to clean it up.
 		 */
-		if (client->ev) {
-			talloc_const_free(client->ev);
+		if (fr_event_wheel_timer_armed(&client->ev)) {
+			fr_event_wheel_timer_delete(&client->ev);
 			client->ready_to_delete = false;
 		}
 
@@ -1967,7 +2130,7 @@ static void client_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 		/*
 		 *	The timer is already set, don't do anything.
 		 */
-		if (client->ev) return;
+		if (fr_event_wheel_timer_armed(&client->ev)) return;
 
 		DEBUG("TIMER - setting idle timeout for connection from client %s", client->radclient->shortname);
 
@@ -2138,8 +2301,7 @@ idle_timeout:
 	delay = inst->check_interval;
 
 reset_timer:
-	if (fr_event_timer_in(client, el, &client->ev,
-			      delay, client_expiry_timer, client) < 0) {
+	if (fr_event_wheel_timer_in(el, &client->ev, delay, client_expiry_timer, client) < 0) {
 		ERROR("proto_%s - Failed adding timeout for dynamic client %s.  It will be permanent!",
 		      inst->app_io->common.name, client->radclient->shortname);
 		return;
@@ -2174,8 +2336,7 @@ static void packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 		 *	will be cleaned up when the timer
 		 *	fires.
 		 */
-		if (fr_event_timer_at(track, el, &track->ev,
-				      track->expires, packet_expiry_timer, track) == 0) {
+		if (fr_event_wheel_timer_at(el, &track->ev, track->expires, packet_expiry_timer, track) == 0) {
 			DEBUG("proto_%s - cleaning up request in %.6fs", inst->app_io->common.name,
 			      fr_time_delta_unwrap(inst->cleanup_delay) / (double)NSEC);
 			return;
@@ -2598,6 +2759,23 @@ reread:
 	return buffer_len;
 }
 
+/** Flush any packets which the child queued in mod_write()
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_thread_t *thread;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, &thread, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Close the socket.
  *
  */
@@ -2690,6 +2868,22 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	Sharding relies on the kernel spreading datagrams
+	 *	across sockets bound to the same address and port.
+	 */
+	if ((inst->num_shards > 1) && (inst->ipproto != IPPROTO_UDP)) {
+		cf_log_err(inst->app_io_conf, "'shards' can only be used with UDP sockets");
+		return -1;
+	}
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+	if (inst->shard_steering) {
+		cf_log_warn(inst->app_io_conf, "'shard_steering' is not supported on this platform, ignoring it");
+		inst->shard_steering = false;
+	}
+#endif
+
 	/*
 	 *	Ensure that the dynamic client sections exist
 	 */
@@ -2822,7 +3016,7 @@ fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_
 	 *	And now check denied networks.
 	 */
 	num = talloc_array_length(deny);
-	if (!num) return trie;
+	if (!num) goto done;
 
 	/*
 	 *	Since the default is to deny, you can only add
@@ -2895,6 +3089,14 @@ fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_
 		deny[i].af = AF_UNSPEC;
 	}
 
+done:
+	/*
+	 *	The trie is only read from now on, and is checked
+	 *	for every packet.  If compiling fails, lookups
+	 *	still work, they're just slower.
+	 */
+	(void) fr_trie_compile(trie);
+
 	return trie;
 }
 
@@ -2928,25 +3130,19 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one shard of a listener, and add it to the scheduler
+ *
+ * Each shard gets its own socket, and its own client / tracking
+ * tables.  The sockets all share the same address and port via
+ * SO_REUSEPORT, and the kernel spreads packets across them.
+ */
+static fr_listen_t *master_io_listen_shard(fr_io_instance_t *inst, fr_schedule_t *sc,
+					   size_t default_message_size, size_t num_messages,
+					   unsigned int shard)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->common.thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2983,9 +3179,21 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	thread = talloc_zero(NULL, fr_io_thread_t);
 	thread->listen = li;
 	thread->sc = sc;
+	thread->shard = shard;
 
 	talloc_set_destructor(thread, _thread_io_free);
 
+	/*
+	 *	Shards may be read by different network threads, so
+	 *	they can't share one list of client modules.
+	 */
+	if (!shard) {
+		thread->clients = inst->clients;
+	} else {
+		thread->clients = module_list_alloc(thread, &module_list_type_thread_local, "clients", false);
+		module_list_mask_set(thread->clients, MODULE_INSTANCE_BOOTSTRAPPED);
+	}
+
 	/*
 	 *	Create the trie of clients for this socket.
 	 */
@@ -3000,6 +3208,7 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->thread_instance = thread;
 	li->app_io_instance = inst;
 	li->track_duplicates = inst->app_io->track_duplicates;
+	li->predecode = inst->predecode && (inst->app->predecode != NULL);
 
 	/*
 	 *	The child listener points to the *actual* IO path.
@@ -3048,7 +3257,7 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	if (inst->app_io->open(child) < 0) {
 		cf_log_err(inst->app_io_conf, "Failed opening %s interface", inst->app_io->common.name);
 		talloc_free(li);
-		return -1;
+		return NULL;
 	}
 
 	li->fd = child->fd;	/* copy this back up */
@@ -3061,9 +3270,10 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards
+	 *	deliberately share the first shard's address and port.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && !shard) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3074,7 +3284,7 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 			ERROR("got socket %d %d\n", child->app_io_addr->inet.src_port, other->app_io_addr->inet.src_port);
 
 			talloc_free(li);
-			return -1;
+			return NULL;
 		}
 
 		(void) listen_record(child);
@@ -3084,11 +3294,99 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	 *	Add the socket to the scheduler, where it might end up
 	 *	in a different thread.
 	 */
-	if (!fr_schedule_listen_add(sc, li)) {
+	if (!fr_schedule_listen_shard_add(sc, li, shard)) {
 		talloc_free(li);
+		return NULL;
+	}
+
+	return li;
+}
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+/** Steer packets to shards by source IP address
+ *
+ * The kernel runs the filter for each packet, and uses the result
+ * as the index of the socket in the SO_REUSEPORT group.  So all
+ * packets from one client go to the same shard, and therefore to
+ * the same client and tracking tables.
+ */
+static int master_io_shard_steer(fr_listen_t *li, int af, unsigned int num_shards)
+{
+	struct sock_filter	code[] = {
+		/* A = low 32 bits of the source address */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (af == AF_INET6) ? (SKF_NET_OFF + 20) : (SKF_NET_OFF + 12) },
+		/* A = A % num_shards */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_shards },
+		/* return A */
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog	prog = {
+		.len = NUM_ELEMENTS(code),
+		.filter = code,
+	};
+
+	if (setsockopt(li->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching shard steering program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	fr_listen_t	*li;
+	unsigned int	i, num_shards;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->common.thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
 		return -1;
 	}
 
+	num_shards = inst->num_shards;
+	if (!num_shards) num_shards = 1;
+
+	if (num_shards > fr_schedule_num_networks(sc)) {
+		DEBUG("proto_%s - 'shards = %u' is larger than the number of network threads (%u)",
+		      inst->app_io->common.name, num_shards, fr_schedule_num_networks(sc));
+	}
+
+	/*
+	 *	The shards are independent of each other.  If one
+	 *	fails, the ones we've already opened are cleaned up
+	 *	when the scheduler exits.
+	 */
+	for (i = 0; i < num_shards; i++) {
+		li = master_io_listen_shard(inst, sc, default_message_size, num_messages, i);
+		if (!li) return -1;
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+		/*
+		 *	The steering program is shared by the whole
+		 *	SO_REUSEPORT group, so we only attach it once.
+		 */
+		if (!i && (num_shards > 1) && inst->shard_steering) {
+			fr_io_thread_t *thread = talloc_get_type_abort(li->thread_instance, fr_io_thread_t);
+
+			if (thread->child->app_io_addr &&
+			    (master_io_shard_steer(li, thread->child->app_io_addr->inet.src_ipaddr.af, num_shards) < 0)) {
+				cf_log_perr(inst->app_io_conf, "Failed enabling 'shard_steering'");
+				return -1;
+			}
+		}
+#endif
+	}
+
 	return 0;
 }
 
@@ -3149,6 +3447,7 @@ fr_app_io_t fr_master_app_io = {
 	.read			= mod_read,
 	.write			= mod_write,
 	.inject			= mod_inject,
+	.flush			= mod_flush,
 
 	.open			= mod_open,
 	.close			= mod_close,
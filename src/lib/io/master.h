@@ -38,8 +38,7 @@ extern "C" {
 typedef struct fr_io_client_s fr_io_client_t;
 
 typedef struct fr_io_track_s {
-	fr_rb_node_t			node;		//!< rbtree node in the tracking tree.
-	fr_event_timer_t const		*ev;		//!< when we clean up this tracking entry
+	fr_event_wheel_timer_t		ev;		//!< when we clean up this tracking entry
 	fr_time_t			timestamp;	//!< when this packet was received
 	fr_time_t			expires;	//!< when this packet expires
 	int				packets;     	//!< number of packets using this entry
@@ -78,14 +77,22 @@ typedef struct {
 	uint32_t			max_connections;		//!< maximum number of connections to allow
 	uint32_t			max_clients;			//!< maximum number of dynamic clients to allow
 	uint32_t			max_pending_packets;		//!< maximum number of pending packets
+	uint32_t			max_new_clients;		//!< maximum number of dynamic client definitions
+									///< started per second, from each allowed network.
 
 	fr_time_delta_t			cleanup_delay;			//!< for Access-Request packets
 	fr_time_delta_t			idle_timeout;			//!< for dynamic clients
 	fr_time_delta_t			nak_lifetime;			//!< lifetime of NAKed clients
 	fr_time_delta_t			check_interval;			//!< polling for closed sockets
 
+	uint32_t			num_shards;			//!< number of sockets to open on the same
+									///< address and port, spread across network threads.
+	bool				shard_steering;			//!< steer packets to shards by source IP.
+
 	bool				dynamic_clients;		//!< do we have dynamic clients.
 
+	bool				predecode;			//!< decode packets on the network thread.
+
 	CONF_SECTION			*server_cs;			//!< server CS for this listener
 
 	module_instance_t		*submodule;			//!< As provided by the transport_parse
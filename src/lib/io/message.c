@@ -105,6 +105,8 @@ struct fr_message_set_s {
 
 	size_t			max_allocation;	//!< maximum allocation size
 
+	bool			hugepages;	//!< ring buffers are backed by huge pages
+
 	int			allocated;
 	int			freed;
 
@@ -114,17 +116,18 @@ struct fr_message_set_s {
 };
 
 
-/** Create a message set
+/** Create a ring buffer for the message set
  *
- * @param[in] ctx the context for talloc
- * @param[in] num_messages size of the initial message array.  MUST be a power of 2.
- * @param[in] message_size the size of each message, INCLUDING fr_message_t, which MUST be at the start of the struct
- * @param[in] ring_buffer_size of the ring buffer.  MUST be a power of 2.
- * @return
- *	- NULL on error
- *	- newly allocated fr_message_set_t on success
  */
-fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size)
+static inline CC_HINT(always_inline) fr_ring_buffer_t *message_ring_buffer_create(fr_message_set_t *ms, size_t size)
+{
+	if (ms->hugepages) return fr_ring_buffer_create_hugepage(ms, size);
+
+	return fr_ring_buffer_create(ms, size);
+}
+
+static fr_message_set_t *message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size,
+					    size_t ring_buffer_size, bool hugepages)
 {
 	fr_message_set_t *ms;
 
@@ -156,15 +159,16 @@ fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_
 
 	CACHE_ALIGN(message_size);
 	ms->message_size = message_size;
+	ms->hugepages = hugepages;
 
-	ms->rb_array[0] = fr_ring_buffer_create(ms, ring_buffer_size);
+	ms->rb_array[0] = message_ring_buffer_create(ms, ring_buffer_size);
 	if (!ms->rb_array[0]) {
 		talloc_free(ms);
 		return NULL;
 	}
 	ms->rb_max = 0;
 
-	ms->mr_array[0] = fr_ring_buffer_create(ms, num_messages * message_size);
+	ms->mr_array[0] = message_ring_buffer_create(ms, num_messages * message_size);
 	if (!ms->mr_array[0]) {
 		talloc_free(ms);
 		return NULL;
@@ -175,6 +179,39 @@ fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_
 	return ms;
 }
 
+/** Create a message set
+ *
+ * @param[in] ctx the context for talloc
+ * @param[in] num_messages size of the initial message array.  MUST be a power of 2.
+ * @param[in] message_size the size of each message, INCLUDING fr_message_t, which MUST be at the start of the struct
+ * @param[in] ring_buffer_size of the ring buffer.  MUST be a power of 2.
+ * @return
+ *	- NULL on error
+ *	- newly allocated fr_message_set_t on success
+ */
+fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size)
+{
+	return message_set_create(ctx, num_messages, message_size, ring_buffer_size, false);
+}
+
+/** Create a message set, with ring buffers backed by huge pages
+ *
+ * The ring buffers are faulted in by the calling thread.  They
+ * should therefore be created by the thread which writes to them.
+ *
+ * @param[in] ctx the context for talloc
+ * @param[in] num_messages size of the initial message array.  MUST be a power of 2.
+ * @param[in] message_size the size of each message, INCLUDING fr_message_t, which MUST be at the start of the struct
+ * @param[in] ring_buffer_size of the ring buffer.  MUST be a power of 2.
+ * @return
+ *	- NULL on error
+ *	- newly allocated fr_message_set_t on success
+ */
+fr_message_set_t *fr_message_set_create_hugepage(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size)
+{
+	return message_set_create(ctx, num_messages, message_size, ring_buffer_size, true);
+}
+
 
 /** Mark a message as done
  *
@@ -752,7 +789,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	 *	Allocate another message ring, double the size
 	 *	of the previous maximum.
 	 */
-	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
+	mr = message_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
 	if (!mr) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		return NULL;
@@ -875,7 +912,7 @@ alloc_rb:
 	 *	Allocate another message ring, double the size
 	 *	of the previous maximum.
 	 */
-	rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2);
+	rb = message_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2);
 	if (!rb) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		goto cleanup;
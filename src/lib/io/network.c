@@ -30,6 +30,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/qsbr.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/syserror.h>
@@ -55,6 +56,11 @@ typedef struct {
 	fr_time_t		recv_time;
 } fr_network_inject_t;
 
+typedef struct {
+	fr_worker_t		*worker;
+	fr_time_delta_t		timeout;
+} fr_network_worker_remove_t;
+
 /** Associate a worker thread with a network thread
  *
  */
@@ -64,12 +70,39 @@ typedef struct {
 	fr_time_delta_t		predicted;		//!< predicted processing time for one packet
 
 	bool			blocked;		//!< is this worker blocked?
+	bool			saturated;		//!< is a backend used by this worker saturated?
+	bool			local;			//!< is this worker on the same NUMA node as us?
+	bool			background;		//!< does this worker only run background requests?
+	bool			retiring;		//!< we're not sending it packets, and will close
+							///< the channel once it has replied to the others.
+
+	fr_dlist_t		entry;			//!< in the list of retiring workers
+	fr_event_timer_t const	*ev;			//!< when we complain about a retiring worker
+	fr_time_delta_t		retire_timeout;		//!< how often we complain about a retiring worker
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
 	fr_io_stats_t		stats;
 } fr_network_worker_t;
 
+/** Admission control state
+ *
+ *  This works like CoDel.  We track the lowest latency of the replies
+ *  seen in each interval.  If even the fastest reply took longer than
+ *  the target, the workers have a standing queue.  We then drop the
+ *  lowest priority packets, and drop higher priorities for as long as
+ *  the latency stays high.  Packets with priority "high" or "now" are
+ *  never shed.
+ */
+typedef struct {
+	fr_time_t		interval_end;		//!< when the current interval ends.
+	fr_time_delta_t		min_latency;		//!< lowest latency seen in the current interval.
+	bool			seen;			//!< whether we've seen a reply in the current interval.
+
+	uint32_t		shed_priority;		//!< drop packets with a priority lower than this.
+	uint64_t		shed;			//!< number of packets we've dropped.
+} fr_network_admit_t;
+
 typedef struct {
 	fr_rb_node_t		listen_node;		//!< rbtree node for looking up by listener.
 	fr_rb_node_t		num_node;		//!< rbtree node for looking up by number.
@@ -93,6 +126,7 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets which need to be flushed
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -128,6 +162,8 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have written packets, and need
+							///< to be flushed at the end of the event loop.
 
 	fr_io_stats_t		stats;
 
@@ -136,6 +172,7 @@ struct fr_network_s {
 
 	int			num_workers;		//!< number of active workers
 	int			num_blocked;		//!< number of blocked workers
+	int			num_saturated;		//!< number of workers with saturated backends
 	int			num_pending_workers;	//!< number of workers we're waiting to start.
 	int			max_workers;		//!< maximum number of allowed workers
 	int			num_sockets;		//!< actually a counter...
@@ -146,7 +183,21 @@ struct fr_network_s {
 	bool			exiting;		//!< are we exiting?
 
 	fr_network_config_t	config;			//!< configuration
+	fr_channel_poll_t	poll;			//!< how long we poll channels before sleeping
+	fr_network_admit_t	admit;			//!< when we shed low priority packets
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+	fr_dlist_head_t		retiring;		//!< workers we're waiting for, before closing
+							///< their channels.
+
+	int			numa_node;		//!< NUMA node this network is pinned to, or -1.
+	int			num_local_workers;	//!< number of workers on the same NUMA node.
+	fr_network_worker_t	*local_workers[MAX_WORKERS]; //!< workers on the same NUMA node.
+
+	int			num_live_workers;	//!< number of workers which run normal requests.
+	fr_network_worker_t	*live_workers[MAX_WORKERS]; //!< workers which run normal requests.
+	int			num_background_workers;	//!< number of workers which only run
+							///< background requests.
+	fr_network_worker_t	*background_workers[MAX_WORKERS]; //!< workers which only run background requests.
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
@@ -303,7 +354,36 @@ int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER, &worker, sizeof(worker));
 }
 
+/** Remove a worker from a network in a different thread
+ *
+ * The network stops sending packets to the worker.  Once the worker
+ * has replied to the packets it already has, the network closes its
+ * channel.  The worker exits when all of its channels are closed.
+ *
+ * @param nr		the network
+ * @param worker	the worker
+ * @param timeout	how often to warn whilst waiting for the outstanding replies
+ */
+int fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker, fr_time_delta_t timeout)
+{
+	fr_ring_buffer_t		*rb;
+	fr_network_worker_remove_t	remove;
+
+	rb = fr_network_rb_init();
+	if (!rb) return -1;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	remove = (fr_network_worker_remove_t) {
+		.worker = worker,
+		.timeout = timeout,
+	};
+
+	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER_REMOVE, &remove, sizeof(remove));
+}
+
 static void fr_network_worker_started_callback(void *ctx, void const *data, size_t data_size, fr_time_t now);
+static void fr_network_worker_remove_callback(void *ctx, void const *data, size_t data_size, fr_time_t now);
 
 /** Add a worker to a network in the same thread
  *
@@ -474,9 +554,136 @@ static void fr_network_unsuspend(fr_network_t *nr)
 	nr->suspended = false;
 }
 
+#define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
+
+/** Remove a worker from one array of workers
+ *
+ */
+static void network_worker_array_del(fr_network_worker_t **workers, int *num_workers, fr_network_worker_t *w)
+{
+	int i;
+
+	for (i = 0; i < *num_workers; i++) {
+		if (workers[i] != w) continue;
+
+		memmove(&workers[i], &workers[i + 1], sizeof(workers[0]) * ((*num_workers - i) - 1));
+		(*num_workers)--;
+		workers[*num_workers] = NULL;
+		break;
+	}
+}
+
+/** Remove a worker from the arrays we dispatch packets from
+ *
+ */
+static void network_worker_array_remove(fr_network_t *nr, fr_network_worker_t *w)
+{
+	network_worker_array_del(nr->workers, &nr->num_workers, w);
+
+	if (w->local) network_worker_array_del(nr->local_workers, &nr->num_local_workers, w);
+
+	if (w->background) {
+		network_worker_array_del(nr->background_workers, &nr->num_background_workers, w);
+	} else {
+		network_worker_array_del(nr->live_workers, &nr->num_live_workers, w);
+	}
+
+	if (w->blocked) {
+		w->blocked = false;
+		nr->num_blocked--;
+	}
+
+	if (w->saturated) {
+		w->saturated = false;
+		nr->num_saturated--;
+	}
+}
+
+/** Close the channel to a retiring worker
+ *
+ */
+static void network_worker_close(fr_network_t *nr, fr_network_worker_t *w)
+{
+	DEBUG3("Closing channel to retiring worker");
+
+	fr_event_timer_delete(&w->ev);
+	fr_channel_signal_responder_close(w->channel);
+}
+
+/** Complain about a retiring worker which still hasn't replied
+ *
+ * Closing the channel frees the worker's replies, including the ones
+ * still in flight.  So the channel is only closed once the worker has
+ * replied to everything we sent it.  Until then, we keep waiting.
+ */
+static void network_worker_retire_timeout(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_network_worker_t	*w = talloc_get_type_abort(uctx, fr_network_worker_t);
+
+	WARN("Retiring worker still has %" PRIu64 " outstanding requests", OUTSTANDING(w));
+
+	if (fr_event_timer_in(w, el, &w->ev, w->retire_timeout, network_worker_retire_timeout, w) < 0) {
+		PERROR("Failed inserting timer for retiring worker");
+	}
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) fr_time_delta_wrap((fr_time_delta_unwrap(_new) + (fr_time_delta_unwrap(_old) * (IALPHA - 1))) / IALPHA)
 
+/** Update the admission control state from the latency of a reply
+ *
+ * @param[in] nr	the network.
+ * @param[in] latency	of the reply, from when the request was received.
+ * @param[in] now	the current time.
+ */
+static inline CC_HINT(always_inline)
+void network_admit_update(fr_network_t *nr, fr_time_delta_t latency, fr_time_t now)
+{
+	fr_network_admit_t *admit = &nr->admit;
+
+	if (!admit->seen || fr_time_delta_lt(latency, admit->min_latency)) {
+		admit->min_latency = latency;
+		admit->seen = true;
+	}
+
+	/*
+	 *	The first reply starts the first interval.
+	 */
+	if (fr_time_eq(admit->interval_end, fr_time_wrap(0))) {
+		admit->interval_end = fr_time_add(now, nr->config.latency_interval);
+		return;
+	}
+
+	if (fr_time_lt(now, admit->interval_end)) return;
+
+	/*
+	 *	The workers can't keep up.  Shed the next priority
+	 *	level up, but never "high" or "now".
+	 */
+	if (fr_time_delta_gt(admit->min_latency, nr->config.target_latency)) {
+		if (admit->shed_priority < PRIORITY_NORMAL) {
+			admit->shed_priority = PRIORITY_NORMAL;
+			RATE_LIMIT_GLOBAL(WARN, "Replies are slower than target_latency - dropping low priority packets");
+
+		} else if (admit->shed_priority < PRIORITY_HIGH) {
+			admit->shed_priority = PRIORITY_HIGH;
+			RATE_LIMIT_GLOBAL(WARN, "Replies are still slower than target_latency - dropping normal priority packets");
+		}
+
+	/*
+	 *	The queues have drained, accept more packets.
+	 */
+	} else if (admit->shed_priority >= PRIORITY_HIGH) {
+		admit->shed_priority = PRIORITY_NORMAL;
+
+	} else {
+		admit->shed_priority = 0;
+	}
+
+	admit->seen = false;
+	admit->interval_end = fr_time_add(now, nr->config.latency_interval);
+}
+
 /** Callback which handles a message being received on the network side.
  *
  * @param[in] ctx the network
@@ -490,6 +697,8 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 
 	cd->channel.ch = ch;
 
+	fr_channel_poll_arrival(&nr->poll, cd->m.when);
+
 	/*
 	 *	Update stats for the worker.
 	 */
@@ -502,6 +711,48 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 		worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
 	}
 
+	if (cd->reply.saturated != worker->saturated) {
+		worker->saturated = cd->reply.saturated;
+		if (worker->saturated) {
+			nr->num_saturated++;
+		} else {
+			nr->num_saturated--;
+		}
+	}
+
+	/*
+	 *	Background workers are slow on purpose, and don't
+	 *	delay live traffic.
+	 */
+	if (fr_time_delta_ispos(nr->config.target_latency) && !worker->background) {
+		network_admit_update(nr, fr_time_sub(cd->m.when, cd->reply.request_time), cd->m.when);
+	}
+
+	/*
+	 *	The worker frees its message set when we close the
+	 *	channel, so we can't keep any of its replies.  The
+	 *	socket doesn't count localized replies as
+	 *	outstanding, so we do that here.
+	 */
+	if (unlikely(worker->retiring)) {
+		fr_network_socket_t	*s;
+		fr_message_t		*lm;
+
+		s = fr_rb_find(nr->sockets, &(fr_network_socket_t){ .listen = cd->listen });
+		if (s && s->outstanding) s->outstanding--;
+
+		lm = fr_message_localize(nr, &cd->m, sizeof(*cd));
+		if (!lm) {
+			fr_message_done(&cd->m);
+			cd = NULL;
+		}
+
+		if (OUTSTANDING(worker) == 0) network_worker_close(nr, worker);
+		if (!cd) return;
+
+		cd = (fr_channel_data_t *) lm;
+	}
+
 	/*
 	 *	Unblock the worker.
 	 */
@@ -567,32 +818,166 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	{
 		fr_network_worker_t	*w = talloc_get_type_abort(fr_channel_requestor_uctx_get(ch),
 								   fr_network_worker_t);
-		int			i;
+
+		DEBUG3("Worker acked our close request");
 
 		/*
-		 *	Remove this worker from the array
+		 *	Retiring workers have already been removed
+		 *	from the array.
+		 *
+		 *	The worker may still be touching the
+		 *	channel, so we don't free it here.  It's
+		 *	freed with the network.
 		 */
-		for (i = 0; i < nr->num_workers; i++) {
-			DEBUG3("Worker acked our close request");
-			if (nr->workers[i] == w) {
-				nr->workers[i] = NULL;
-
-				if (i == (nr->num_workers - 1)) break;
-
-				/*
-				 *	Close the hole...
-				 */
-				memcpy(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1));
-				break;
-			}
+		if (w->retiring) {
+			fr_dlist_remove(&nr->retiring, w);
+			break;
 		}
-		nr->num_workers--;
+
+		network_worker_array_remove(nr, w);
 	}
 		break;
 	}
 }
 
-#define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
+fr_table_num_sorted_t const fr_network_dispatch_table[] = {
+	{ L("flow"),	FR_NETWORK_DISPATCH_FLOW },
+	{ L("load"),	FR_NETWORK_DISPATCH_LOAD }
+};
+size_t fr_network_dispatch_table_len = NUM_ELEMENTS(fr_network_dispatch_table);
+
+/** Pick the worker which handles this packet's flow
+ *
+ * Sending every packet in a flow to the same worker means that
+ * the per-thread caches of that worker's modules are more likely
+ * to contain the data needed to process it.
+ *
+ * @param[in] nr	the network.
+ * @param[in] cd	the message we've received.
+ * @return
+ *	- NULL if the packet doesn't belong to a flow, or if the worker
+ *	  which handles its flow is blocked or overloaded.
+ *	- the worker which handles the flow.
+ */
+static inline CC_HINT(always_inline)
+fr_network_worker_t *network_worker_flow(fr_network_t *nr, fr_channel_data_t *cd)
+{
+	fr_listen_t const	*listen = cd->listen;
+	fr_network_worker_t	*worker;
+	uint32_t		hash;
+
+	if (!listen->app->flow_hash) return NULL;
+
+	hash = listen->app->flow_hash(listen->app_instance, cd->packet_ctx, cd->m.data, cd->m.data_size);
+	if (!hash) return NULL;
+
+	worker = nr->live_workers[hash % nr->num_live_workers];
+	if (worker->blocked) return NULL;
+
+	/*
+	 *	Requests for a saturated backend would just wait in
+	 *	the worker's trunk.
+	 */
+	if (worker->saturated && (nr->num_saturated < nr->num_workers)) return NULL;
+
+	/*
+	 *	Spill over to the normal dispatch, rather than
+	 *	dropping the packet.
+	 */
+	if (nr->config.max_outstanding && (OUTSTANDING(worker) >= nr->config.max_outstanding)) return NULL;
+
+	return worker;
+}
+
+/** Pick the less loaded of two random workers from an array
+ *
+ * Workers whose backends aren't saturated are preferred.  If both
+ * workers have the same number of outstanding requests, then choose
+ * the worker which has used the least total CPU time.
+ */
+static inline CC_HINT(always_inline)
+fr_network_worker_t *network_worker_two_choices(fr_network_worker_t **workers, int num_workers)
+{
+	int64_t cmp;
+	uint32_t one, two;
+
+	one = fr_rand() % num_workers;
+	do {
+		two = fr_rand() % num_workers;
+	} while (two == one);
+
+	if (workers[one]->saturated != workers[two]->saturated) {
+		return workers[one]->saturated ? workers[two] : workers[one];
+	}
+
+	/*
+	 *	Choose a worker based on minimizing the amount
+	 *	of future work it's being asked to do.
+	 */
+	cmp = (OUTSTANDING(workers[one]) - OUTSTANDING(workers[two]));
+	if (cmp < 0) return workers[one];
+
+	if (cmp > 0) return workers[two];
+
+	if (fr_time_delta_lt(workers[one]->cpu_time, workers[two]->cpu_time)) return workers[one];
+
+	return workers[two];
+}
+
+/** Pick a background worker for a background request
+ *
+ * @return
+ *	- NULL if there's no background worker which can take the request.
+ *	- the worker.
+ */
+static fr_network_worker_t *network_worker_background(fr_network_t *nr)
+{
+	fr_network_worker_t *worker;
+
+	if (nr->num_background_workers == 1) {
+		worker = nr->background_workers[0];
+	} else {
+		worker = network_worker_two_choices(nr->background_workers, nr->num_background_workers);
+	}
+
+	if (worker->blocked) return NULL;
+
+	if (nr->config.max_outstanding && (OUTSTANDING(worker) >= nr->config.max_outstanding)) return NULL;
+
+	return worker;
+}
+
+/** Check whether we should shed a packet
+ *
+ * @param[in] nr	the network.
+ * @param[in] cd	the message we've received.
+ * @return
+ *	- true if the packet should be dropped.
+ *	- false if the packet should be sent to a worker.
+ */
+static bool network_admit_shed(fr_network_t *nr, fr_channel_data_t const *cd)
+{
+	int i;
+
+	if (cd->priority >= nr->admit.shed_priority) return false;
+
+	/*
+	 *	We only update the state when we get replies.  If
+	 *	nothing is outstanding, then there won't be any, so
+	 *	stop shedding packets.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		if (OUTSTANDING(nr->workers[i]) > 0) break;
+	}
+
+	if (i == nr->num_workers) {
+		nr->admit.shed_priority = 0;
+		return false;
+	}
+
+	nr->admit.shed++;
+	return true;
+}
 
 /** Send a message on the "best" channel.
  *
@@ -605,9 +990,42 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
+	/*
+	 *	Background requests (e.g. cron jobs) go to the
+	 *	background workers, so they don't compete with live
+	 *	traffic.  If there aren't any, they're run by the
+	 *	normal workers, after everything else.
+	 */
+	if ((cd->priority == PRIORITY_BACKGROUND) && (nr->num_background_workers > 0)) {
+		worker = network_worker_background(nr);
+		if (worker) goto send;
+
+		RATE_LIMIT_GLOBAL(ERROR, "Failed sending packet to worker - "
+				  "All background workers are busy");
+		return -1;
+	}
+
+	if (nr->admit.shed_priority && network_admit_shed(nr, cd)) {
+		RATE_LIMIT_GLOBAL(ERROR, "Failed sending packet to worker - "
+				  "Workers are overloaded, and packet priority is too low");
+		return -1;
+	}
+
+	/*
+	 *	Every worker has a saturated backend, so low priority
+	 *	packets would only wait in a backlog until they time
+	 *	out.  Drop them here, where it's cheap.
+	 */
+	if ((nr->num_saturated == nr->num_workers) && (nr->num_workers > 0) && (cd->priority < PRIORITY_NORMAL)) {
+		nr->admit.shed++;
+		RATE_LIMIT_GLOBAL(ERROR, "Failed sending packet to worker - "
+				  "Backends are saturated, and packet priority is too low");
+		return -1;
+	}
+
 retry:
-	if (nr->num_workers == 1) {
-		worker = nr->workers[0];
+	if (nr->num_live_workers == 1) {
+		worker = nr->live_workers[0];
 		if (worker->blocked) {
 			RATE_LIMIT_GLOBAL(ERROR, "Failed sending packet to worker - "
 					  "In single-threaded mode and worker is blocked");
@@ -616,35 +1034,31 @@ retry:
 			return -1;
 		}
 
-	} else if (nr->num_blocked == 0) {
-		int64_t cmp;
-		uint32_t one, two;
-
-		one = fr_rand() % nr->num_workers;
-		do {
-			two = fr_rand() % nr->num_workers;
-		} while (two == one);
+	} else if ((nr->config.dispatch == FR_NETWORK_DISPATCH_FLOW) &&
+		   ((worker = network_worker_flow(nr, cd)) != NULL)) {
+		/*
+		 *	Sent to the worker which handles this flow.
+		 */
 
+	} else if (nr->num_blocked == 0) {
 		/*
-		 *	Choose a worker based on minimizing the amount
-		 *	of future work it's being asked to do.
-		 *
-		 *	If both workers have the same number of
-		 *	outstanding requests, then choose the worker
-		 *	which has used the least total CPU time.
+		 *	Prefer workers on our NUMA node, so that the
+		 *	message buffers stay node-local.  But if the
+		 *	local workers are much busier than a remote
+		 *	one, spill over to the remote worker.
 		 */
-		cmp = (OUTSTANDING(nr->workers[one]) - OUTSTANDING(nr->workers[two]));
-		if (cmp < 0) {
-			worker = nr->workers[one];
+		if ((nr->num_local_workers >= 2) && (nr->num_local_workers < nr->num_live_workers)) {
+			fr_network_worker_t *remote;
 
-		} else if (cmp > 0) {
-			worker = nr->workers[two];
+			worker = network_worker_two_choices(nr->local_workers, nr->num_local_workers);
 
-		} else if (fr_time_delta_lt(nr->workers[one]->cpu_time, nr->workers[two]->cpu_time)) {
-			worker = nr->workers[one];
+			remote = nr->live_workers[fr_rand() % nr->num_live_workers];
+			if (!remote->local && (OUTSTANDING(worker) > ((2 * OUTSTANDING(remote)) + 1))) {
+				worker = remote;
+			}
 
 		} else {
-			worker = nr->workers[two];
+			worker = network_worker_two_choices(nr->live_workers, nr->num_live_workers);
 		}
 	} else {
 		int i;
@@ -655,10 +1069,10 @@ retry:
 		 *	Some workers are blocked.  Pick the worker
 		 *	with the least amount of future work to do.
 		 */
-		for (i = 0; i < nr->num_workers; i++) {
+		for (i = 0; i < nr->num_live_workers; i++) {
 			uint64_t outstanding;
 
-			worker = nr->workers[i];
+			worker = nr->live_workers[i];
 			if (worker->blocked) continue;
 
 			outstanding = OUTSTANDING(worker);
@@ -709,6 +1123,7 @@ retry:
 		goto drop;
 	}
 
+send:
 	/*
 	 *	Send the message to the channel.  If we fail, drop the
 	 *	packet.  The only reason for failure is that the
@@ -728,6 +1143,11 @@ retry:
 			fr_network_suspend(nr);
 			return -1;
 		}
+
+		/*
+		 *	Background requests never go to the live workers.
+		 */
+		if (worker->background) return -1;
 		goto retry;
 	}
 
@@ -779,6 +1199,7 @@ int fr_network_listen_send_packet(fr_network_t *nr, fr_listen_t *parent, fr_list
 	cd->priority = PRIORITY_NORMAL;
 	cd->packet_ctx = packet_ctx;
 	cd->request.recv_time = recv_time;
+	cd->request.decoded = NULL;
 	memcpy(cd->m.data, buffer, buflen);
 	cd->m.when = fr_time();
 
@@ -873,6 +1294,7 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	DEBUG3("Reading data from FD %u", sockfd);
 
 	if (!s->cd) {
+	reserve:
 		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
 		if (!cd) {
 			ERROR("Failed allocating message size %zd! - Closing socket",
@@ -890,8 +1312,12 @@ next_message:
 	/*
 	 *	Poll this socket, but not too often.  We have to go
 	 *	service other sockets, too.
+	 *
+	 *	Packets which the app_io has already taken from the
+	 *	socket are always read.  The FD won't become readable
+	 *	for them again.
 	 */
-	if (num_messages > 16) {
+	if ((num_messages > 16) && !s->listen->read_pending) {
 		s->cd = cd;
 		return;
 	}
@@ -911,6 +1337,16 @@ next_message:
 	data_size = s->listen->app_io->read(s->listen, &cd->packet_ctx, &cd->request.recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover);
 	if (data_size == 0) {
+		/*
+		 *	The packet was discarded, but there are more
+		 *	in the app_io.  Re-use the same buffer for
+		 *	the next one.
+		 */
+		if (s->listen->read_pending) {
+			num_messages++;
+			goto next_message;
+		}
+
 		/*
 		 *	Cache the message for later.  This is
 		 *	important for stream sockets, which can do
@@ -954,6 +1390,7 @@ next_message:
 	 */
 	cd->m.when = fr_time();
 	cd->listen = s->listen;
+	cd->request.decoded = NULL;
 
 	/*
 	 *	Nothing in the buffer yet.  Allocate room for one
@@ -998,8 +1435,19 @@ next_message:
 		cd->priority = priority;
 	}
 
+	/*
+	 *	Decode the packet here, so that the worker only has
+	 *	to run it.  If that fails, the worker decodes the
+	 *	packet again, and logs the error in the request.
+	 */
+	if (s->listen->predecode) {
+		cd->request.decoded = s->listen->app->predecode(s->listen->app_instance, cd->packet_ctx,
+								 cd->m.data, data_size);
+	}
+
 	if (fr_network_send_request(nr, cd) < 0) {
 	discard:
+		talloc_free(cd->request.decoded);
 		talloc_free(cd->packet_ctx); /* not sure what else to do here */
 		fr_message_done(&cd->m);
 		nr->stats.dropped++;
@@ -1025,6 +1473,15 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	Datagram sockets which read a batch of packets at a
+	 *	time.  Get a new buffer, and go read the next packet.
+	 */
+	if (s->listen->read_pending) {
+		num_messages++;
+		goto reserve;
+	}
 }
 
 int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx, uint8_t const *data, size_t data_len, fr_time_t recv_time)
@@ -1045,6 +1502,7 @@ int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx
 	cd->m.when = recv_time;
 	cd->listen = li;
 	cd->packet_ctx = packet_ctx;
+	cd->request.decoded = NULL;
 
 	memcpy(cd->m.data, data, data_len);
 
@@ -1235,6 +1693,14 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 		s->written = 0;
 
+		/*
+		 *	The app_io may have queued the packet.  If so,
+		 *	it will be sent in fr_network_post_event().
+		 */
+		if (li->app_io->flush && !fr_dlist_entry_in_list(&s->flush_entry)) {
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 		/*
 		 *	Reset for the next message.
 		 */
@@ -1270,6 +1736,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
 
+	if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
+
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	if (s->listen->app_io->close) {
@@ -1296,6 +1764,21 @@ static int _network_socket_free(fr_network_socket_t *s)
 	return 0;
 }
 
+/** Create the message set for a socket
+ *
+ *  The ring buffer is at least as large as the configured size, so
+ *  that it doesn't have to grow during a burst of packets.
+ */
+static fr_message_set_t *network_message_set_create(fr_network_t *nr, TALLOC_CTX *ctx, int num_messages, size_t size)
+{
+	if (size < nr->config.ring_buffer_size) size = nr->config.ring_buffer_size;
+
+	if (nr->config.hugepages) {
+		return fr_message_set_create_hugepage(ctx, num_messages, sizeof(fr_channel_data_t), size);
+	}
+
+	return fr_message_set_create(ctx, num_messages, sizeof(fr_channel_data_t), size);
+}
 
 /** Handle a network control message callback for a new listener
  *
@@ -1354,6 +1837,7 @@ static int fr_network_listen_add_self(fr_network_t *nr, fr_listen_t *li)
 	s->nr = nr;
 	s->listen = li;
 	s->number = nr->num_sockets++;
+	fr_dlist_entry_init(&s->flush_entry);
 
 	MEM(s->waiting = fr_heap_alloc(s, waiting_cmp, fr_channel_data_t, channel.heap_id, 0));
 
@@ -1374,9 +1858,7 @@ static int fr_network_listen_add_self(fr_network_t *nr, fr_listen_t *li)
 	/*
 	 *	Allocate the ring buffer for messages and packets.
 	 */
-	s->ms = fr_message_set_create(s, num_messages,
-				      sizeof(fr_channel_data_t),
-				      size);
+	s->ms = network_message_set_create(nr, s, num_messages, size);
 	if (!s->ms) {
 		PERROR("Failed creating message buffers for network IO");
 		talloc_free(s);
@@ -1451,6 +1933,7 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
 	s->nr = nr;
 	s->listen = li;
 	s->number = nr->num_sockets++;
+	fr_dlist_entry_init(&s->flush_entry);
 
 	MEM(s->waiting = fr_heap_alloc(s, waiting_cmp, fr_channel_data_t, channel.heap_id, 0));
 
@@ -1462,9 +1945,8 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
 	num_messages = s->listen->num_messages;
 	if (num_messages < 8) num_messages = 8;
 
-	s->ms = fr_message_set_create(s, num_messages,
-				      sizeof(fr_channel_data_t),
-				      s->listen->default_message_size * s->listen->num_messages);
+	s->ms = network_message_set_create(nr, s, num_messages,
+					   s->listen->default_message_size * s->listen->num_messages);
 	if (!s->ms) {
 		PERROR("Failed creating message buffers for directory IO");
 		talloc_free(s);
@@ -1518,6 +2000,23 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	w->predicted = fr_time_delta_from_msec(10);
 	fr_fatal_assert_msg(w->channel, "Failed creating new channel");
 
+	/*
+	 *	Background workers are kept out of the arrays used
+	 *	to dispatch normal requests.
+	 */
+	if (fr_worker_background(worker)) {
+		w->background = true;
+		nr->background_workers[nr->num_background_workers++] = w;
+
+	} else {
+		nr->live_workers[nr->num_live_workers++] = w;
+
+		if ((nr->numa_node >= 0) && (fr_worker_numa_node(worker) == nr->numa_node)) {
+			w->local = true;
+			nr->local_workers[nr->num_local_workers++] = w;
+		}
+	}
+
 	fr_channel_requestor_uctx_add(w->channel, w);
 	fr_channel_set_recv_reply(w->channel, nr, fr_network_recv_reply);
 
@@ -1545,6 +2044,44 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	fr_assert(0 == 1);
 }
 
+static void fr_network_worker_remove_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	int				i;
+	fr_network_t			*nr = ctx;
+	fr_network_worker_t		*w = NULL;
+	fr_network_worker_remove_t	remove;
+
+	fr_assert(data_size == sizeof(remove));
+
+	memcpy(&remove, data, data_size);
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (nr->workers[i]->worker != remove.worker) continue;
+
+		w = nr->workers[i];
+		break;
+	}
+	if (!w) return;
+
+	network_worker_array_remove(nr, w);
+
+	w->retiring = true;
+	fr_dlist_insert_tail(&nr->retiring, w);
+
+	if (OUTSTANDING(w) == 0) {
+		network_worker_close(nr, w);
+		return;
+	}
+
+	/*
+	 *	The channel is closed when the last reply arrives.
+	 */
+	w->retire_timeout = remove.timeout;
+	if (fr_event_timer_in(w, nr->el, &w->ev, remove.timeout, network_worker_retire_timeout, w) < 0) {
+		PERROR("Failed inserting timer for retiring worker");
+	}
+}
+
 /** Handle a network control message callback for a packet sent to a socket
  *
  * @param[in] ctx the network
@@ -1606,6 +2143,7 @@ static int fr_network_pre_event(UNUSED fr_time_t now, UNUSED fr_time_delta_t wak
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	/*
@@ -1614,7 +2152,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 	 */
 	while ((cd = fr_heap_pop(&nr->replies)) != NULL) {
 		fr_listen_t *li;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1664,14 +2201,27 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		 *	No pending message, let's try writing it.
 		 *
 		 *	If there is a pending message, then we're
-		 *	waiting for IO write to become ready.
+		 *	waiting for IO write to become ready.  The
+		 *	reply will be written after the pending one.
 		 */
+		(void) fr_heap_insert(&s->waiting, cd);
 		if (!s->pending) {
 			fr_assert(!s->blocked);
-			(void) fr_heap_insert(&s->waiting, cd);
 			fr_network_write(nr->el, s->listen->fd, 0, s);
 		}
 	}
+
+	/*
+	 *	Send any packets which the app_io queued, instead of
+	 *	writing them immediately.
+	 */
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		if (s->dead) continue;
+
+		if (s->listen->app_io->flush(s->listen) < 0) {
+			PERROR("Failed flushing socket %s", s->listen->name);
+		}
+	}
 }
 
 /** Stop a network thread in an orderly way
@@ -1742,12 +2292,17 @@ int fr_network_destroy(fr_network_t *nr)
 	 */
 	{
 		int i;
+		fr_network_worker_t *w;
 
 		for (i = 0; i < nr->num_workers; i++) {
 			fr_network_worker_t *worker = nr->workers[i];
 
 			fr_channel_signal_responder_close(worker->channel);
 		}
+
+		for (w = fr_dlist_head(&nr->retiring); w != NULL; w = fr_dlist_next(&nr->retiring, w)) {
+			network_worker_close(nr, w);
+		}
 	}
 
 	(void) fr_event_pre_delete(nr->el, fr_network_pre_event, nr);
@@ -1791,6 +2346,55 @@ static void _signal_pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int fla
  *
  * @param[in] nr the network data structure to run.
  */
+/** Poll the worker channels for a while, instead of sleeping
+ *
+ *  While we're polling, the workers don't signal us when they send us
+ *  a reply.
+ *
+ * @param[in] nr	the network
+ * @return
+ *	- true if we received any replies.
+ *	- false if we should sleep.
+ */
+static bool network_poll(fr_network_t *nr)
+{
+	int		i;
+	bool		received = false;
+	fr_time_t	end;
+	fr_time_delta_t	budget;
+
+	budget = fr_channel_poll_budget(&nr->poll);
+	if (!fr_time_delta_ispos(budget)) return false;
+
+	end = fr_time_add(fr_time(), budget);
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		if (fr_channel_requestor_poll(nr->workers[i]->channel, true)) received = true;
+	}
+
+	while (!received && fr_time_lt(fr_time(), end)) {
+		for (i = 0; i < nr->num_workers; i++) {
+			if (!nr->workers[i]) continue;
+
+			while (fr_channel_recv_reply(nr->workers[i]->channel)) received = true;
+		}
+	}
+
+	/*
+	 *	Replies may have arrived after we last looked, and
+	 *	before the worker saw that we had stopped polling.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		if (fr_channel_requestor_poll(nr->workers[i]->channel, false)) received = true;
+	}
+
+	return received;
+}
+
 void fr_network(fr_network_t *nr)
 {
 	/*
@@ -1805,23 +2409,43 @@ void fr_network(fr_network_t *nr)
 	 *	nr->num_workers is decremented, so when
 	 *	nr->num_workers == 0, all workers have ACKd
 	 *	our close and are no longer using the channel.
+	 *	Retiring workers are removed from nr->retiring
+	 *	when they ACK.
+	 */
+
+	/*
+	 *	Let shared read-mostly structures, e.g. client
+	 *	lists, know when we're done with old versions.
 	 */
-	while (likely(!(nr->exiting && (nr->num_workers == 0)))) {
+	if (fr_qsbr_thread_register() < 0) PERROR("Failed registering for memory reclamation");
+
+	while (likely(!(nr->exiting && (nr->num_workers == 0) && (fr_dlist_num_elements(&nr->retiring) == 0)))) {
 		bool wait_for_event;
 		int num_events;
 
+		fr_qsbr_quiescent();
+
 		/*
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
 		 */
 		wait_for_event = (fr_heap_num_elements(nr->replies) == 0);
 
+		/*
+		 *	Replies are arriving quickly.  Poll for the next
+		 *	one, instead of going to sleep and waiting for a
+		 *	worker to wake us up.
+		 */
+		if (wait_for_event && !nr->exiting && network_poll(nr)) wait_for_event = false;
+
 		/*
 		 *	Check the event list.  If there's an error
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		DEBUG4("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
+		if (wait_for_event) fr_qsbr_offline();
 		num_events = fr_event_corral(nr->el, fr_time(), wait_for_event);
+		if (wait_for_event) fr_qsbr_online();
 		DEBUG4("%u event(s) pending%s",
 		       num_events == -1 ? 0 : num_events, num_events == -1 ? " - event loop exiting" : "");
 		if (num_events < 0) break;
@@ -1834,6 +2458,8 @@ void fr_network(fr_network_t *nr)
 			fr_event_service(nr->el);
 		}
 	}
+
+	fr_qsbr_thread_unregister();
 	return;
 }
 
@@ -1867,6 +2493,21 @@ static int _fr_network_free(fr_network_t *nr)
 	return 0;
 }
 
+/** Set the NUMA node the network thread is running on
+ *
+ * Must be called before any workers are added.  Workers on the same
+ * node are then preferred when dispatching requests.
+ *
+ * @param[in] nr	the network.
+ * @param[in] node	NUMA node, or -1 if unknown.
+ */
+void fr_network_numa_node_set(fr_network_t *nr, int node)
+{
+	fr_assert(nr->num_workers == 0);
+
+	nr->numa_node = node;
+}
+
 /** Create a network
  *
  * @param[in] ctx 	The talloc ctx
@@ -1903,8 +2544,20 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 	nr->num_workers = 0;
 	nr->signal_pipe[0] = -1;
 	nr->signal_pipe[1] = -1;
+	nr->numa_node = -1;
 	if (config) nr->config = *config;
 
+	if (nr->config.ring_buffer_size > (100 * 1024 * 1024)) nr->config.ring_buffer_size = (100 * 1024 * 1024);
+
+	if (fr_time_delta_gt(nr->config.max_poll_time, fr_time_delta_from_msec(1))) {
+		nr->config.max_poll_time = fr_time_delta_from_msec(1);
+	}
+	nr->poll.max = nr->config.max_poll_time;
+
+	if (fr_time_delta_ispos(nr->config.target_latency) && !fr_time_delta_ispos(nr->config.latency_interval)) {
+		nr->config.latency_interval = fr_time_delta_from_msec(100);
+	}
+
 	nr->aq_control = fr_atomic_queue_alloc(nr, 1024);
 	if (!nr->aq_control) {
 		talloc_free(nr);
@@ -1958,6 +2611,11 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_WORKER_REMOVE, nr, fr_network_worker_remove_callback) < 0) {
+		fr_strerror_const_push("Failed adding worker removal callback");
+		goto fail2;
+	}
+
 	/*
 	 *	Create the various heaps.
 	 */
@@ -1979,6 +2637,9 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+	fr_dlist_init(&nr->retiring, fr_network_worker_t, entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -2042,6 +2703,7 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.out\t%" PRIu64 "\n", nr->stats.out);
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
+	fprintf(fp, "count.shed\t%" PRIu64 "\n", nr->admit.shed);
 	fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
 
 	return 0;
@@ -37,13 +37,35 @@ typedef struct fr_network_s fr_network_t;
 
 #include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/table.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** How the network picks a worker for each packet
+ *
+ */
+typedef enum {
+	FR_NETWORK_DISPATCH_LOAD = 0,			//!< The less loaded of two random workers.
+	FR_NETWORK_DISPATCH_FLOW			//!< The same worker for every packet in a flow.
+} fr_network_dispatch_t;
+
+extern fr_table_num_sorted_t const fr_network_dispatch_table[];
+extern size_t fr_network_dispatch_table_len;
+
 typedef struct {
-	uint32_t	max_outstanding;
+	uint32_t		max_outstanding;
+	fr_network_dispatch_t	dispatch;		//!< How packets are sent to workers.
+	fr_time_delta_t		max_poll_time;		//!< maximum time to poll channels before sleeping
+
+	size_t			ring_buffer_size;	//!< minimum start size for the ring buffers
+	bool			hugepages;		//!< back the ring buffers with huge pages
+
+	fr_time_delta_t		target_latency;		//!< shed low priority packets when the latency
+							///< of replies stays above this.  0 is disabled.
+	fr_time_delta_t		latency_interval;	//!< how long the latency has to stay above
+							///< the target before we shed more packets.
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
@@ -54,8 +76,12 @@ int		fr_network_directory_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull
 
 int		fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 
+int		fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker, fr_time_delta_t timeout) CC_HINT(nonnull);
+
 void		fr_network_worker_add_self(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 
+void		fr_network_numa_node_set(fr_network_t *nr, int node) CC_HINT(nonnull);
+
 void		fr_network_listen_read(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 
 void		fr_network_listen_write(fr_network_t *nr, fr_listen_t *li, uint8_t const *packet, size_t packet_len,
@@ -221,8 +221,7 @@ done:
  */
 int fr_queue_localize_atomic(fr_queue_t *fq, fr_atomic_queue_t *aq)
 {
-	void *data;
-	int i, room;
+	int room, moved = 0;
 
 	(void) talloc_get_type_abort(fq, fr_queue_t);
 
@@ -233,20 +232,30 @@ int fr_queue_localize_atomic(fr_queue_t *fq, fr_atomic_queue_t *aq)
 	if (!room) return 0;
 
 	/*
-	 *	Pop as many entries as we have room for.
+	 *	Pop as many entries as we have room for.  The free
+	 *	space may wrap around the end of the array, so we pop
+	 *	directly into it in at most two batches.
 	 */
-	for (i = 0; i < room; i++) {
-		if (!fr_atomic_queue_pop(aq, &data)) {
-			return i;
-		}
+	while (room > 0) {
+		int chunk, popped;
 
-		fq->entry[fq->head++] = data;
+		chunk = fq->size - fq->head;
+		if (chunk > room) chunk = room;
+
+		popped = fr_atomic_queue_pop_n(aq, &fq->entry[fq->head], chunk);
+
+		fq->head += popped;
 		if (fq->head >= fq->size) fq->head = 0;
-		fq->num++;
+		fq->num += popped;
 		fr_assert(fq->num <= fq->size);
+
+		moved += popped;
+		room -= popped;
+
+		if (popped < chunk) break;
 	}
 
-	return room;
+	return moved;
 }
 
 #ifndef NDEBUG
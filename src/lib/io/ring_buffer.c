@@ -27,7 +27,9 @@ RCSID("$Id$")
 #include <freeradius-devel/io/ring_buffer.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
 #include <string.h>
+#include <sys/mman.h>
 
 /*
  *	Ring buffers are allocated in a block.
@@ -45,29 +47,26 @@ struct fr_ring_buffer_s {
 	bool		closed;		//!< whether allocations are closed
 };
 
-/** Create a ring buffer.
- *
- *  The size provided will be rounded up to the next highest power of
- *  2, if it's not already a power of 2.
- *
- *  The ring buffer manages how much room is reserved (i.e. available
- *  to write to), and used.  The application is responsible for
- *  tracking the start of the reservation, *and* it's write offset
- *  within that reservation.
+/*
+ *	Huge pages are only used for ring buffers which are at least
+ *	this large.  Smaller ones would waste most of the page.
+ */
+#define HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/** Allocate the ring buffer header, and check and round up the size
  *
- * @param[in] ctx	a talloc context
- * @param[in] size	of the raw ring buffer array to allocate.
- * @return
- *	- A new ring buffer on success.
- *	- NULL on failure.
  */
-fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
+static fr_ring_buffer_t *ring_buffer_alloc(TALLOC_CTX *ctx, size_t *p_size)
 {
 	fr_ring_buffer_t	*rb;
+	size_t			size = *p_size;
 
 	rb = talloc_zero(ctx, fr_ring_buffer_t);
 	if (!rb) {
-	fail:
 		fr_strerror_const("Failed allocating memory.");
 		return NULL;
 	}
@@ -91,12 +90,105 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 	size |= size >> 16;
 	size++;
 
+	*p_size = size;
+	return rb;
+}
+
+/** Create a ring buffer.
+ *
+ *  The size provided will be rounded up to the next highest power of
+ *  2, if it's not already a power of 2.
+ *
+ *  The ring buffer manages how much room is reserved (i.e. available
+ *  to write to), and used.  The application is responsible for
+ *  tracking the start of the reservation, *and* it's write offset
+ *  within that reservation.
+ *
+ * @param[in] ctx	a talloc context
+ * @param[in] size	of the raw ring buffer array to allocate.
+ * @return
+ *	- A new ring buffer on success.
+ *	- NULL on failure.
+ */
+fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
+{
+	fr_ring_buffer_t	*rb;
+
+	rb = ring_buffer_alloc(ctx, &size);
+	if (!rb) return NULL;
+
 	rb->buffer = talloc_array(rb, uint8_t, size);
 	if (!rb->buffer) {
 		talloc_free(rb);
-		goto fail;
+		fr_strerror_const("Failed allocating memory.");
+		return NULL;
+	}
+	rb->size = size;
+
+	return rb;
+}
+
+static int _ring_buffer_unmap(fr_ring_buffer_t *rb)
+{
+	if (munmap(rb->buffer, rb->size) < 0) {
+		fr_strerror_printf("Failed unmapping ring buffer: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Create a ring buffer backed by huge pages
+ *
+ *  This is the same as #fr_ring_buffer_create, except that the
+ *  buffer is mapped directly, and uses huge pages where the system
+ *  allows it.  Large ring buffers then need far fewer TLB entries.
+ *
+ *  If explicit huge pages aren't available, we fall back to normal
+ *  pages, and ask the kernel to use transparent huge pages.
+ *
+ *  All of the pages are touched before returning.  They are then
+ *  allocated on the NUMA node of the calling thread, and we don't
+ *  take page faults when the buffer is first used.
+ *
+ * @param[in] ctx	a talloc context
+ * @param[in] size	of the raw ring buffer array to allocate.
+ * @return
+ *	- A new ring buffer on success.
+ *	- NULL on failure.
+ */
+fr_ring_buffer_t *fr_ring_buffer_create_hugepage(TALLOC_CTX *ctx, size_t size)
+{
+	fr_ring_buffer_t	*rb;
+	void			*buffer = MAP_FAILED;
+
+	rb = ring_buffer_alloc(ctx, &size);
+	if (!rb) return NULL;
+
+#ifdef MAP_HUGETLB
+	if (size >= HUGE_PAGE_SIZE) {
+		buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+
+	if (buffer == MAP_FAILED) {
+		buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buffer == MAP_FAILED) {
+			fr_strerror_printf("Failed mapping ring buffer: %s", fr_syserror(errno));
+			talloc_free(rb);
+			return NULL;
+		}
+
+#ifdef MADV_HUGEPAGE
+		if (size >= HUGE_PAGE_SIZE) (void) madvise(buffer, size, MADV_HUGEPAGE);
+#endif
 	}
+
+	rb->buffer = buffer;
 	rb->size = size;
+	talloc_set_destructor(rb, _ring_buffer_unmap);
+
+	memset(rb->buffer, 0, size);
 
 	return rb;
 }
@@ -38,6 +38,8 @@ typedef struct fr_ring_buffer_s fr_ring_buffer_t;
 
 fr_ring_buffer_t	*fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size);
 
+fr_ring_buffer_t	*fr_ring_buffer_create_hugepage(TALLOC_CTX *ctx, size_t size);
+
 uint8_t			*fr_ring_buffer_reserve(fr_ring_buffer_t *rb, size_t size) CC_HINT(nonnull);
 
 uint8_t			*fr_ring_buffer_alloc(fr_ring_buffer_t *rb, size_t size);
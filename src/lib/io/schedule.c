@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#include <freeradius-devel/io/atomic_queue.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rb.h>
@@ -35,6 +36,17 @@ RCSID("$Id$")
 #include <freeradius-devel/server/trigger.h>
 
 #include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <sched.h>
+#  include <dirent.h>
+#endif
+
+#ifndef CPU_SETSIZE
+#  define CPU_SETSIZE (1024)
+#endif
 
 /*
  *	Other OS's have sem_init, OS X doesn't.
@@ -64,6 +76,23 @@ RCSID("$Id$")
 
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
+/*
+ *	When min_workers is set, we check the workers every
+ *	SCALE_INTERVAL.  We add a worker when they've been busy for
+ *	SCALE_UP_INTERVALS in a row, and remove one when they've been
+ *	idle for SCALE_DOWN_INTERVALS in a row.
+ */
+#define SCALE_INTERVAL		(1)	//!< seconds
+#define SCALE_UP_INTERVALS	(3)
+#define SCALE_UP_CPU		(80)	//!< percent of one CPU, averaged over the workers
+#define SCALE_UP_RUNNABLE	(2)	//!< runnable requests per worker
+#define SCALE_DOWN_INTERVALS	(60)
+#define SCALE_DOWN_CPU		(25)	//!< percent of one CPU, averaged over the workers
+
+#if defined(_POSIX_THREAD_CPUTIME) && (_POSIX_THREAD_CPUTIME >= 0)
+#  define HAVE_THREAD_CPUTIME (1)
+#endif
+
 /**
  *  Track the child thread status.
  */
@@ -87,7 +116,13 @@ typedef struct {
 
 	unsigned int	id;			//!< a unique ID
 	int		uses;			//!< how many network threads are using it
-	fr_time_t	cpu_time;		//!< how much CPU time this worker has used
+	fr_time_delta_t	cpu_time;		//!< how much CPU time this worker had used, when
+						///< the scheduler last checked.
+
+	sem_t		*start_sem;		//!< posted when the thread has started, or failed.
+	bool		background;		//!< only runs background requests.
+	bool		retiring;		//!< the networks have been told to remove it.
+	atomic_bool	exited;			//!< the thread is about to exit.
 
 	fr_dlist_t	entry;			//!< our entry into the linked list of workers
 
@@ -146,6 +181,25 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	int		*network_cpus;		//!< CPUs to pin network threads to.
+	int		num_network_cpus;	//!< number of entries in network_cpus.
+	int		*worker_cpus;		//!< CPUs to pin worker threads to.
+	int		num_worker_cpus;	//!< number of entries in worker_cpus.
+	int		*background_cpus;	//!< CPUs to pin background workers to.
+	int		num_background_cpus;	//!< number of entries in background_cpus.
+
+	fr_worker_steal_t *steal;		//!< Work stealing state shared by all workers.
+
+	pthread_t	scale_id;		//!< thread which adds and removes workers.
+	pthread_mutex_t	scale_mutex;		//!< protects the fields below, and the list of workers
+						///< while the scale thread is running.
+	pthread_cond_t	scale_cond;		//!< to wake up the scale thread.
+	bool		scaling;		//!< whether the scale thread should add and remove workers.
+	bool		scale_exit;		//!< whether the scale thread should exit.
+	sem_t		scale_sem;		//!< for the scale thread to wait for new workers.
+	unsigned int	scale_busy;		//!< intervals in a row where the workers were busy.
+	unsigned int	scale_idle;		//!< intervals in a row where the workers were idle.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -159,6 +213,139 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Parse a list of CPUs, e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] out	array of CPU numbers.
+ * @param[in] list	to parse.
+ * @return
+ *	- >0 the number of CPUs in the list.
+ *	- -1 on error.
+ */
+static int schedule_cpu_list_parse(TALLOC_CTX *ctx, int **out, char const *list)
+{
+	int		*cpus = NULL;
+	int		num = 0;
+	char const	*p = list;
+
+	while (*p) {
+		char	*end;
+		long	first, last;
+
+		first = strtol(p, &end, 10);
+		if ((end == p) || (first < 0) || (first >= CPU_SETSIZE)) goto invalid;
+
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if ((end == p) || (last < first) || (last >= CPU_SETSIZE)) goto invalid;
+		}
+
+		while (first <= last) {
+			MEM(cpus = talloc_realloc(ctx, cpus, int, num + 1));
+			cpus[num++] = first++;
+		}
+
+		p = end;
+		if (*p == ',') {
+			p++;
+		} else if (*p) {
+			goto invalid;
+		}
+	}
+
+	if (!num) {
+	invalid:
+		fr_strerror_printf("Invalid CPU list \"%s\"", list);
+		talloc_free(cpus);
+		return -1;
+	}
+
+	*out = cpus;
+	return num;
+}
+
+/** Pin the current thread to one CPU
+ *
+ * @param[in] cpu	to pin the thread to.
+ * @return
+ *	- The NUMA node of the CPU, or -1 if it's unknown.
+ *	- -2 on error.
+ */
+#ifdef __linux__
+static int schedule_thread_pin(int cpu)
+{
+	cpu_set_t	set;
+	int		ret;
+	char		path[64];
+	DIR		*dir;
+	struct dirent	*dp;
+	int		node = -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		fr_strerror_printf("Failed pinning thread to CPU %d: %s", cpu, fr_syserror(ret));
+		return -2;
+	}
+
+	/*
+	 *	The CPU directory contains a "nodeN" link for the
+	 *	NUMA node it belongs to.
+	 */
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir) return -1;
+
+	while ((dp = readdir(dir)) != NULL) {
+		if ((strncmp(dp->d_name, "node", 4) != 0) || !isdigit((uint8_t) dp->d_name[4])) continue;
+
+		node = atoi(dp->d_name + 4);
+		break;
+	}
+	closedir(dir);
+
+	return node;
+}
+#else
+static int schedule_thread_pin(int cpu)
+{
+	fr_strerror_printf("Failed pinning thread to CPU %d: Not supported on this platform", cpu);
+	return -2;
+}
+#endif
+
+/** Only run the current thread when the CPU isn't needed by other threads
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+#ifdef SCHED_IDLE
+static int schedule_thread_background(void)
+{
+	struct sched_param	param = { .sched_priority = 0 };
+	int			ret;
+
+	ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+	if (ret != 0) {
+		fr_strerror_printf("Failed setting idle scheduling policy: %s", fr_syserror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+static int schedule_thread_background(void)
+{
+	fr_strerror_const("Failed setting idle scheduling policy: Not supported on this platform");
+	return -1;
+}
+#endif
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -172,6 +359,7 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_schedule_network_t		*sn;
 	char				worker_name[32];
+	int				numa_node = -1;
 
 #ifndef __APPLE__
 	/*
@@ -202,7 +390,7 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	worker_id = sw->id;		/* Store the current worker ID */
 
-	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
+	snprintf(worker_name, sizeof(worker_name), "%s %d", sw->background ? "Background worker" : "Worker", sw->id);
 
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
@@ -212,6 +400,38 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	INFO("%s - Starting", worker_name);
 
+	/*
+	 *	Pin before allocating anything, so that our memory
+	 *	is allocated on the local NUMA node.
+	 */
+	if (sw->background) {
+		if (sc->num_background_cpus) {
+			int cpu = sc->background_cpus[(sw->id - sc->config->max_workers) % sc->num_background_cpus];
+
+			numa_node = schedule_thread_pin(cpu);
+			if (numa_node < -1) {
+				PERROR("%s - Failed setting CPU affinity", worker_name);
+				goto fail;
+			}
+			DEBUG2("%s - Pinned to CPU %d (NUMA node %d)", worker_name, cpu, numa_node);
+		}
+
+		/*
+		 *	Live traffic always comes first.
+		 */
+		if (schedule_thread_background() < 0) PWARN("%s - Running at normal priority", worker_name);
+
+	} else if (sc->num_worker_cpus) {
+		int cpu = sc->worker_cpus[sw->id % sc->num_worker_cpus];
+
+		numa_node = schedule_thread_pin(cpu);
+		if (numa_node < -1) {
+			PERROR("%s - Failed setting CPU affinity", worker_name);
+			goto fail;
+		}
+		DEBUG2("%s - Pinned to CPU %d (NUMA node %d)", worker_name, cpu, numa_node);
+	}
+
 	sw->el = fr_event_list_alloc(ctx, NULL, NULL);
 	if (!sw->el) {
 		PERROR("%s - Failed creating event list", worker_name);
@@ -224,6 +444,13 @@ static void *fr_schedule_worker_thread(void *arg)
 		PERROR("%s - Failed creating worker", worker_name);
 		goto fail;
 	}
+	fr_worker_numa_node_set(sw->worker, numa_node);
+	fr_worker_background_set(sw->worker, sw->background);
+
+	if (sc->steal && !sw->background && (fr_worker_steal_join(sw->worker, sc->steal, sw->id) < 0)) {
+		PERROR("%s - Failed enabling work stealing", worker_name);
+		goto fail;
+	}
 
 	/*
 	 *	@todo make this a registry
@@ -259,7 +486,7 @@ static void *fr_schedule_worker_thread(void *arg)
 	/*
 	 *	Tell the originator that the thread has started.
 	 */
-	sem_post(&sc->worker_sem);
+	sem_post(sw->start_sem);
 
 	/*
 	 *	Do all of the work.
@@ -288,9 +515,11 @@ fail:
 	if (sw->el) fr_event_loop_exit(sw->el, 1);
 
 	/*
-	 *	Tell the scheduler we're done.
+	 *	Tell the scheduler we're done.  If we failed to
+	 *	start, whoever started us is still waiting.
 	 */
-	sem_post(&sc->worker_sem);
+	atomic_store(&sw->exited, true);
+	sem_post((status == FR_CHILD_FAIL) ? sw->start_sem : &sc->worker_sem);
 
 	talloc_free(ctx);
 
@@ -320,6 +549,7 @@ static void *fr_schedule_network_thread(void *arg)
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_event_list_t			*el;
 	char				network_name[32];
+	int				numa_node = -1;
 
 #ifndef __APPLE__
 	/*
@@ -358,6 +588,17 @@ static void *fr_schedule_network_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->num_network_cpus) {
+		int cpu = sc->network_cpus[sn->id % sc->num_network_cpus];
+
+		numa_node = schedule_thread_pin(cpu);
+		if (numa_node < -1) {
+			PERROR("%s - Failed setting CPU affinity", network_name);
+			goto fail;
+		}
+		DEBUG2("%s - Pinned to CPU %d (NUMA node %d)", network_name, cpu, numa_node);
+	}
+
 	el = fr_event_list_alloc(ctx, NULL, NULL);
 	if (!el) {
 		PERROR("%s - Failed creating event list", network_name);
@@ -369,6 +610,7 @@ static void *fr_schedule_network_thread(void *arg)
 		PERROR("%s - Failed creating network", network_name);
 		goto fail;
 	}
+	fr_network_numa_node_set(sn->nr, numa_node);
 
 	sn->status = FR_CHILD_RUNNING;
 
@@ -446,6 +688,240 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
 	return 0;
 }
 
+/** Get the CPU time used by a worker thread
+ *
+ * @param[in] sw	the worker.
+ * @param[out] out	the CPU time used by the thread.
+ * @return
+ *	- true on success.
+ *	- false if the CPU time isn't available.
+ */
+static bool schedule_worker_cpu_time(fr_schedule_worker_t *sw, fr_time_delta_t *out)
+{
+#ifdef HAVE_THREAD_CPUTIME
+	clockid_t	cid;
+	struct timespec	ts;
+
+	if (pthread_getcpuclockid(sw->pthread_id, &cid) != 0) return false;
+	if (clock_gettime(cid, &ts) < 0) return false;
+
+	*out = fr_time_delta_from_timespec(&ts);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/** Start a new worker while the server is running
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] id	of the new worker.
+ */
+static void schedule_worker_spawn(fr_schedule_t *sc, unsigned int id)
+{
+	fr_schedule_worker_t *sw;
+
+	/*
+	 *	Not parented, as other threads may be using the
+	 *	scheduler's context.
+	 */
+	sw = talloc_zero(NULL, fr_schedule_worker_t);
+	if (!sw) {
+		ERROR("Worker %u - Failed allocating memory", id);
+		return;
+	}
+
+	sw->id = id;
+	sw->sc = sc;
+	sw->status = FR_CHILD_INITIALIZING;
+	sw->start_sem = &sc->scale_sem;
+
+	if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
+		PERROR("Failed creating worker %u", id);
+		talloc_free(sw);
+		return;
+	}
+
+	SEM_WAIT_INTR(&sc->scale_sem);
+
+	if (sw->status != FR_CHILD_RUNNING) {
+		(void) pthread_join(sw->pthread_id, NULL);
+		talloc_free(sw);
+		return;
+	}
+
+	(void) schedule_worker_cpu_time(sw, &sw->cpu_time);
+	fr_dlist_insert_tail(&sc->workers, sw);
+
+	INFO("Scheduler - Added worker %u, there are now %u workers", id,
+	     (unsigned int) fr_dlist_num_elements(&sc->workers));
+}
+
+/** Tell the networks to stop using a worker
+ *
+ * The worker exits once all of the networks have closed their
+ * channels to it.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] sw	the worker to remove.
+ */
+static void schedule_worker_retire(fr_schedule_t *sc, fr_schedule_worker_t *sw)
+{
+	fr_schedule_network_t	*sn;
+
+	INFO("Scheduler - Removing worker %u", sw->id);
+
+	sw->retiring = true;
+
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		if (fr_network_worker_remove(sn->nr, sw->worker, sc->config->worker.max_request_time) < 0) {
+			PERROR("Failed removing worker %u from network %u", sw->id, sn->id);
+		}
+	}
+}
+
+/** Check whether the workers are busy or idle, and add or remove one
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] elapsed	time since the last check.
+ */
+static void schedule_scale(fr_schedule_t *sc, fr_time_delta_t elapsed)
+{
+	fr_schedule_worker_t	*sw, *next, *last = NULL;
+	unsigned int		num = 0, total = 0, id;
+	uint64_t		runnable = 0;
+	int64_t			cpu = 0;
+	int			percent = -1;
+	bool			have_cpu = true;
+	bool			busy, idle;
+	uint64_t		ids = 0;
+
+	for (sw = fr_dlist_head(&sc->workers); sw != NULL; sw = next) {
+		fr_time_delta_t used;
+
+		next = fr_dlist_next(&sc->workers, sw);
+
+		/*
+		 *	Background workers are always running, and
+		 *	their load doesn't say anything about live
+		 *	traffic.
+		 */
+		if (sw->background) continue;
+
+		/*
+		 *	Clean up workers which have exited.  Each one
+		 *	has posted the worker semaphore.
+		 */
+		if (sw->retiring) {
+			if (!atomic_load(&sw->exited)) {
+				ids |= ((uint64_t) 1) << sw->id;
+				total++;
+				continue;
+			}
+
+			(void) pthread_join(sw->pthread_id, NULL);
+			SEM_WAIT_INTR(&sc->worker_sem);
+
+			DEBUG2("Worker %u joined (cleaned up)", sw->id);
+			fr_dlist_remove(&sc->workers, sw);
+			talloc_free(sw);
+			continue;
+		}
+
+		ids |= ((uint64_t) 1) << sw->id;
+		total++;
+		num++;
+
+		/*
+		 *	Only remove the workers we added, and the
+		 *	newest first.
+		 */
+		if ((sw->id >= sc->config->min_workers) && (!last || (sw->id > last->id))) last = sw;
+
+		runnable += fr_worker_num_runnable(sw->worker);
+
+		if (!schedule_worker_cpu_time(sw, &used)) {
+			have_cpu = false;
+			continue;
+		}
+
+		cpu += fr_time_delta_unwrap(used) - fr_time_delta_unwrap(sw->cpu_time);
+		sw->cpu_time = used;
+	}
+
+	if (!num || !fr_time_delta_ispos(elapsed)) return;
+
+	if (have_cpu) percent = (cpu * 100) / (fr_time_delta_unwrap(elapsed) * num);
+
+	busy = (percent >= SCALE_UP_CPU) || (runnable >= (num * SCALE_UP_RUNNABLE));
+	idle = (percent < SCALE_DOWN_CPU) && (runnable == 0);
+
+	if (busy) {
+		sc->scale_idle = 0;
+		if (++sc->scale_busy < SCALE_UP_INTERVALS) return;
+		sc->scale_busy = 0;
+
+		if (total >= sc->config->max_workers) return;
+
+		for (id = 0; id < sc->config->max_workers; id++) {
+			if (!(ids & (((uint64_t) 1) << id))) break;
+		}
+
+		DEBUG2("Scheduler - Workers are busy (%d%% CPU, %" PRIu64 " runnable requests)", percent, runnable);
+		schedule_worker_spawn(sc, id);
+		return;
+	}
+	sc->scale_busy = 0;
+
+	if (idle) {
+		if (++sc->scale_idle < SCALE_DOWN_INTERVALS) return;
+		sc->scale_idle = 0;
+
+		if (!last) return;
+
+		DEBUG2("Scheduler - Workers are idle (%d%% CPU)", percent);
+		schedule_worker_retire(sc, last);
+		return;
+	}
+	sc->scale_idle = 0;
+}
+
+/** Entry point for the thread which adds and removes workers
+ *
+ * @param[in] arg	the scheduler.
+ * @return NULL
+ */
+static void *fr_schedule_scale_thread(void *arg)
+{
+	fr_schedule_t	*sc = talloc_get_type_abort(arg, fr_schedule_t);
+	fr_time_t	last = fr_time();
+	sigset_t	sigset;
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&sc->scale_mutex);
+	while (!sc->scale_exit) {
+		struct timespec	ts;
+		fr_time_t	now;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += SCALE_INTERVAL;
+
+		(void) pthread_cond_timedwait(&sc->scale_cond, &sc->scale_mutex, &ts);
+		if (!sc->scaling) continue;
+
+		now = fr_time();
+		schedule_scale(sc, fr_time_sub(now, last));
+		last = now;
+	}
+	pthread_mutex_unlock(&sc->scale_mutex);
+
+	return NULL;
+}
+
 /** Create a scheduler and spawn the child threads.
  *
  * @param[in] ctx				talloc context.
@@ -466,7 +942,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 				  fr_schedule_thread_detach_t worker_thread_detach,
 				  fr_schedule_config_t *config)
 {
-	unsigned int i;
+	unsigned int i, num_workers, num_live;
 	fr_schedule_worker_t *sw, *next_sw;
 	fr_schedule_network_t *sn, *next_sn;
 	fr_schedule_t *sc;
@@ -572,6 +1048,55 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		if (sc->config->max_networks > 64) sc->config->max_networks = 64;
 		if (sc->config->max_workers < 1) sc->config->max_workers = 1;
 		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
+		if (sc->config->min_workers >= sc->config->max_workers) sc->config->min_workers = 0;
+		if (sc->config->background_workers > (64 - sc->config->max_workers)) {
+			sc->config->background_workers = 64 - sc->config->max_workers;
+		}
+
+		/*
+		 *	Threads are pinned round-robin to the CPUs
+		 *	in each list.
+		 */
+		if (sc->config->network_cpus) {
+			sc->num_network_cpus = schedule_cpu_list_parse(sc, &sc->network_cpus, sc->config->network_cpus);
+			if (sc->num_network_cpus < 0) {
+				PERROR("Failed parsing 'network_cpus'");
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+
+		if (sc->config->worker_cpus) {
+			sc->num_worker_cpus = schedule_cpu_list_parse(sc, &sc->worker_cpus, sc->config->worker_cpus);
+			if (sc->num_worker_cpus < 0) {
+				PERROR("Failed parsing 'worker_cpus'");
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+
+		if (sc->config->background_cpus) {
+			sc->num_background_cpus = schedule_cpu_list_parse(sc, &sc->background_cpus,
+									  sc->config->background_cpus);
+			if (sc->num_background_cpus < 0) {
+				PERROR("Failed parsing 'background_cpus'");
+				talloc_free(sc);
+				return NULL;
+			}
+		}
+	}
+
+	/*
+	 *	Allocated here, so that it outlives all of the
+	 *	workers which use it.
+	 */
+	if (sc->config->work_stealing && (sc->config->max_workers > 1)) {
+		sc->steal = fr_worker_steal_alloc(sc, sc->config->max_workers);
+		if (!sc->steal) {
+			PERROR("Failed allocating work stealing state");
+			talloc_free(sc);
+			return NULL;
+		}
 	}
 
 	/*
@@ -654,10 +1179,19 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	}
 
 	/*
-	 *	Create all of the workers.
+	 *	Create all of the workers.  If we add workers as
+	 *	needed, start with the minimum.
+	 *
+	 *	The background workers come last.  Their IDs start
+	 *	after the largest ID a normal worker can have.
 	 */
-	for (i = 0; i < sc->config->max_workers; i++) {
-		DEBUG3("Creating %u/%u workers", i + 1, sc->config->max_workers);
+	num_live = sc->config->min_workers ? sc->config->min_workers : sc->config->max_workers;
+	num_workers = num_live + sc->config->background_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		bool background = (i >= num_live);
+
+		DEBUG3("Creating %u/%u workers", i + 1, num_workers);
 
 		/*
 		 *	Create a worker "glue" structure
@@ -668,9 +1202,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			break;
 		}
 
-		sw->id = i;
+		sw->id = background ? sc->config->max_workers + (i - num_live) : i;
+		sw->background = background;
 		sw->sc = sc;
 		sw->status = FR_CHILD_INITIALIZING;
+		sw->start_sem = &sc->worker_sem;
 		fr_dlist_insert_head(&sc->workers, sw);
 
 		if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
@@ -708,7 +1244,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	/*
 	 *	Failed to start some workers, refuse to do anything!
 	 */
-	if ((unsigned int)fr_dlist_num_elements(&sc->workers) < sc->config->max_workers) {
+	if ((unsigned int)fr_dlist_num_elements(&sc->workers) < num_workers) {
 		fr_schedule_destroy(&sc);
 		return NULL;
 	}
@@ -741,6 +1277,33 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
+	/*
+	 *	Workers added later don't get commands, as the
+	 *	command tree isn't thread-safe.  They're also the
+	 *	only ones which are removed.
+	 */
+	if (sc->config->min_workers) {
+		if (sem_init(&sc->scale_sem, 0, SEMAPHORE_LOCKED) != 0) {
+			ERROR("Failed creating semaphore: %s", fr_syserror(errno));
+			fr_schedule_destroy(&sc);
+			return NULL;
+		}
+
+		pthread_mutex_init(&sc->scale_mutex, NULL);
+		pthread_cond_init(&sc->scale_cond, NULL);
+		sc->scaling = true;
+
+		if (fr_schedule_pthread_create(&sc->scale_id, fr_schedule_scale_thread, sc) < 0) {
+			PERROR("Failed creating scheduler thread");
+			sc->scaling = false;
+			pthread_cond_destroy(&sc->scale_cond);
+			pthread_mutex_destroy(&sc->scale_mutex);
+			sem_destroy(&sc->scale_sem);
+			fr_schedule_destroy(&sc);
+			return NULL;
+		}
+	}
+
 	if (sc) INFO("Scheduler created successfully with %u networks and %u workers",
 		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers));
 
@@ -765,6 +1328,7 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 	fr_schedule_worker_t	*sw;
 	fr_schedule_network_t	*sn;
 	int			ret;
+	bool			scaled = false;
 
 	if (!sc) return 0;
 
@@ -783,6 +1347,18 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 		goto done;
 	}
 
+	/*
+	 *	Stop adding and removing workers.  The scale thread
+	 *	may have sent messages to the networks, so it has
+	 *	to keep running until they've exited.
+	 */
+	if (sc->scaling) {
+		pthread_mutex_lock(&sc->scale_mutex);
+		sc->scaling = false;
+		pthread_mutex_unlock(&sc->scale_mutex);
+		scaled = true;
+	}
+
 	/*
 	 *	Signal each network thread to exit.
 	 */
@@ -824,6 +1400,21 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 		}
 	}
 
+	if (scaled) {
+		pthread_mutex_lock(&sc->scale_mutex);
+		sc->scale_exit = true;
+		pthread_cond_signal(&sc->scale_cond);
+		pthread_mutex_unlock(&sc->scale_mutex);
+
+		if ((ret = pthread_join(sc->scale_id, NULL)) != 0) {
+			ERROR("Failed joining scheduler thread: %s", fr_syserror(ret));
+		}
+
+		pthread_cond_destroy(&sc->scale_cond);
+		pthread_mutex_destroy(&sc->scale_mutex);
+		sem_destroy(&sc->scale_sem);
+	}
+
 	/*
 	 *	Wait for all worker threads to finish.  THEN clean up
 	 *	modules.  Otherwise, the modules will be removed from
@@ -855,6 +1446,12 @@ int fr_schedule_destroy(fr_schedule_t **sc_to_free)
 		} else {
 			DEBUG2("Worker %i joined (cleaned up)", sw->id);
 		}
+
+		/*
+		 *	Workers added by the scale thread aren't
+		 *	parented.
+		 */
+		if (talloc_parent(sw) != sc) talloc_free(sw);
 	}
 
 	sem_destroy(&sc->network_sem);
@@ -902,6 +1499,102 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	return nr;
 }
 
+/** Add one shard of a sharded fr_listen_t to a scheduler
+ *
+ * Shards are spread across the network threads, so that shard N
+ * is read by network thread (N % num_networks).  This lets
+ * multiple sockets bound to the same address and port (via
+ * SO_REUSEPORT) be read in parallel.
+ *
+ * @param[in] sc	the scheduler
+ * @param[in] li	the ctx and callbacks for the transport.
+ * @param[in] shard	index of this shard.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_shard_add(fr_schedule_t *sc, fr_listen_t *li, unsigned int shard)
+{
+	fr_network_t		*nr;
+	fr_schedule_network_t	*sn;
+	unsigned int		i;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) return fr_schedule_listen_add(sc, li);
+
+	shard %= (unsigned int) fr_dlist_num_elements(&sc->networks);
+
+	for (sn = fr_dlist_head(&sc->networks), i = 0;
+	     i < shard;
+	     sn = fr_dlist_next(&sc->networks, sn), i++);
+
+	nr = sn->nr;
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
+/** Return the number of network threads in a scheduler
+ *
+ * @param[in] sc	the scheduler
+ * @return the number of network threads.
+ */
+unsigned int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return (unsigned int) fr_dlist_num_elements(&sc->networks);
+}
+
+/** Call functions with each running worker and network
+ *
+ * Used to read statistics from another thread.  The workers and
+ * networks aren't locked, so the callbacks should only read counters,
+ * and may see values which are slightly out of date.
+ *
+ * Workers which are being removed are skipped.  When workers are being
+ * added and removed, the scale thread is blocked until the walk
+ * completes.
+ *
+ * @param[in] sc		the scheduler.
+ * @param[in] worker_walk	called for each worker.
+ * @param[in] network_walk	called for each network.
+ * @param[in] uctx		passed to the callbacks.
+ */
+void fr_schedule_stats_walk(fr_schedule_t *sc, fr_schedule_worker_walk_t worker_walk,
+			    fr_schedule_network_walk_t network_walk, void *uctx)
+{
+	fr_schedule_worker_t	*sw;
+	fr_schedule_network_t	*sn;
+	bool			scaling = sc->scaling;
+
+	if (sc->el) {
+		if (sc->single_worker) worker_walk(uctx, 0, sc->single_worker);
+		if (sc->single_network) network_walk(uctx, 0, sc->single_network);
+		return;
+	}
+
+	if (scaling) pthread_mutex_lock(&sc->scale_mutex);
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if ((sw->status != FR_CHILD_RUNNING) || sw->retiring || !sw->worker) continue;
+
+		worker_walk(uctx, sw->id, sw->worker);
+	}
+	if (scaling) pthread_mutex_unlock(&sc->scale_mutex);
+
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		if ((sn->status != FR_CHILD_RUNNING) || !sn->nr) continue;
+
+		network_walk(uctx, sn->id, sn->nr);
+	}
+}
+
 /** Add a directory NOTE_EXTEND to a scheduler.
  *
  * @param[in] sc the scheduler
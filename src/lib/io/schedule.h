@@ -60,14 +60,40 @@ typedef int (*fr_schedule_thread_instantiate_t)(TALLOC_CTX *ctx, fr_event_list_t
  */
 typedef void (*fr_schedule_thread_detach_t)(void *uctx);
 
+/** Called for each worker by #fr_schedule_stats_walk
+ *
+ * @param[in] uctx	passed to fr_schedule_stats_walk().
+ * @param[in] id	of the worker.
+ * @param[in] worker	to read statistics from.
+ */
+typedef void (*fr_schedule_worker_walk_t)(void *uctx, unsigned int id, fr_worker_t const *worker);
+
+/** Called for each network by #fr_schedule_stats_walk
+ *
+ * @param[in] uctx	passed to fr_schedule_stats_walk().
+ * @param[in] id	of the network.
+ * @param[in] nr	to read statistics from.
+ */
+typedef void (*fr_schedule_network_walk_t)(void *uctx, unsigned int id, fr_network_t const *nr);
+
 typedef struct {
 	uint32_t	max_networks;		//!< number of network threads
 	uint32_t	max_workers;		//!< number of network threads
+	uint32_t	min_workers;		//!< start this many workers, and add more, up to
+						///< max_workers, when they're busy.  0 is max_workers.
 
 	fr_worker_config_t worker;		//!< configuration for each worker
 	fr_network_config_t network;		//!< configuration for each network;
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	char const	*network_cpus;		//!< CPUs to pin network threads to, e.g. "0-3".
+	char const	*worker_cpus;		//!< CPUs to pin worker threads to.
+
+	bool		work_stealing;		//!< Let idle workers run requests from busy ones.
+
+	uint32_t	background_workers;	//!< number of workers which only run background requests.
+	char const	*background_cpus;	//!< CPUs to pin background workers to.
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -81,7 +107,12 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
+fr_network_t		*fr_schedule_listen_shard_add(fr_schedule_t *sc, fr_listen_t *li, unsigned int shard) CC_HINT(nonnull);
+unsigned int		fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
+
+void			fr_schedule_stats_walk(fr_schedule_t *sc, fr_schedule_worker_walk_t worker_walk,
+					       fr_schedule_network_walk_t network_walk, void *uctx) CC_HINT(nonnull(1,2,3));
 #ifdef __cplusplus
 }
 #endif
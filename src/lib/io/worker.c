@@ -44,6 +44,13 @@
  *  If a request is yielded, it is placed onto the yielded list in
  *  the worker "tracking" data structure.
  *
+ *  When work stealing is enabled, packets which arrive while the worker
+ *  already has runnable requests are put into a lock-free backlog
+ *  instead of being decoded.  Idle workers take packets from the
+ *  backlogs of busy workers, and run them.  The replies are handed back
+ *  to the busy worker, as only it can write to the channel the packet
+ *  arrived on.
+ *
  * @copyright 2016 Alan DeKok (aland@freeradius.org)
  */
 
@@ -61,10 +68,15 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/time_tracking.h>
+#include <freeradius-devel/server/trace.h>
+#include <freeradius-devel/server/trunk.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/minmax_heap.h>
+#include <freeradius-devel/util/qsbr.h>
 
+#include <sched.h>
 #include <stdalign.h>
+#include <unistd.h>
 
 #ifdef WITH_VERIFY_PTR
 static void worker_verify(fr_worker_t *worker);
@@ -74,6 +86,9 @@ static void worker_verify(fr_worker_t *worker);
 #endif
 
 #define CACHE_LINE_SIZE	64
+
+#define WORKER_STEAL_WAIT_SPINS		100	//!< Times we yield before sleeping, when exiting.
+#define WORKER_STEAL_WAIT_MAX_USEC	10000	//!< Longest we sleep for, when exiting.
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
 static _Thread_local fr_ring_buffer_t *fr_worker_rb;
@@ -88,6 +103,56 @@ typedef struct {
 	fr_dlist_head_t		dlist;
 } fr_worker_channel_t;
 
+/** Work stealing state for one worker
+ *
+ *  Slots are allocated by the scheduler, and not by the worker.  Other
+ *  workers can then look at a slot without worrying whether or not the
+ *  worker which owns it is still running.
+ */
+typedef struct {
+	fr_atomic_queue_t	*backlog;	//!< Messages we've received, but haven't started.
+						///< Any worker may pop these.
+	fr_atomic_queue_t	*replies;	//!< Requests other workers took from our backlog,
+						///< and which are done.  We send these to the network.
+
+	fr_event_list_t		*el;		//!< Event list of the owner.
+	fr_event_user_t		*ev;		//!< Wakes up the owner.
+
+	atomic_uint32_t		refs;		//!< Other workers using this slot, or running
+						///< requests taken from it.
+	atomic_bool		active;		//!< The owner is running, and accepts wakeups.
+	atomic_bool		idle;		//!< The owner is waiting for events.
+} fr_worker_steal_slot_t;
+
+/** Work stealing state for all workers
+ *
+ */
+struct fr_worker_steal_s {
+	unsigned int		num_slots;	//!< One for each worker.
+	uint32_t		size;		//!< Size of the backlog and reply queues.
+	fr_worker_steal_slot_t	*slot;		//!< Array of slots.
+};
+
+/** A stolen request which is done, and is being handed back to its owner
+ *
+ *  All replies have to go back to the network via the channel the
+ *  request arrived on.  Only the owner of that channel can write to it.
+ */
+typedef struct {
+	fr_worker_steal_slot_t	*from;		//!< Slot of the worker we took the request from.
+	fr_channel_t		*ch;		//!< the request arrived on.
+	fr_channel_data_t	*cd;		//!< The original message, if it has to be NAK'd.
+
+	fr_listen_t		*listen;	//!< How we'll send the reply.
+	void			*packet_ctx;	//!< Copied from the original message.
+	fr_time_t		request_time;	//!< When the request was received.
+	fr_time_delta_t		processing_time; //!< How long the request took.
+
+	bool			send_reply;	//!< Whether data contains an encoded reply.
+	uint8_t			*data;		//!< The encoded reply.
+	size_t			data_len;	//!< Length of the encoded reply.
+} fr_worker_stolen_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -134,6 +199,23 @@ struct fr_worker_s {
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_worker_channel_t	*channel;	//!< list of channels
+	fr_channel_poll_t	poll;		//!< how long we poll channels before sleeping
+
+	int			numa_node;	//!< NUMA node this worker is pinned to, or -1.
+	bool			background;	//!< only runs background requests.
+
+	fr_worker_steal_t	*steal;		//!< Work stealing state shared with other workers.
+	fr_worker_steal_slot_t	*steal_slot;	//!< Our slot in the shared state.
+	unsigned int		steal_next;	//!< Next slot we try to steal from.
+	uint64_t		num_stolen;	//!< number of requests we took from other workers.
+
+	atomic_uint32_t		num_runnable;	//!< Copy of the number of runnable requests,
+						///< which the scheduler reads from another thread.
+
+	fr_log_rec_t		**flight;	//!< Flight recorders which aren't in use.
+	unsigned int		num_flight;	//!< Number of entries in the flight array.
+	unsigned int		max_flight;	//!< Size of the flight array.
+	uint64_t		num_slow;	//!< number of requests whose flight recorder was dumped.
 };
 
 typedef struct {
@@ -193,7 +275,10 @@ static inline bool is_worker_thread(fr_worker_t const *worker)
 	return (pthread_equal(pthread_self(), worker->thread_id) != 0);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+				     fr_worker_steal_slot_t *from);
+static void worker_steal_wake_idle(fr_worker_t *worker);
+static void worker_steal_backlog_cancel(fr_worker_t *worker, fr_channel_t *ch);
 static void worker_send_reply(fr_worker_t *worker, request_t *request, bool do_not_respond, fr_time_t now);
 static void worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t when, void *uctx);
 static void worker_max_request_timer(fr_worker_t *worker);
@@ -211,7 +296,22 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+
+	fr_channel_poll_arrival(&worker->poll, cd->m.when);
+
+	/*
+	 *	We already have requests waiting to run.  Put this
+	 *	one into the backlog, where an idle worker can take
+	 *	it.  Requests from connected sockets stay with us, so
+	 *	that they're processed in order.
+	 */
+	if (worker->steal && (fr_heap_num_elements(worker->runnable) > 0) && !cd->listen->connected &&
+	    fr_atomic_queue_push(worker->steal_slot->backlog, cd)) {
+		worker_steal_wake_idle(worker);
+		return;
+	}
+
+	worker_request_bootstrap(worker, cd, fr_time(), NULL);
 }
 
 static void worker_requests_cancel(fr_worker_channel_t *ch)
@@ -227,6 +327,12 @@ static void worker_exit(fr_worker_t *worker)
 {
 	worker->exiting = true;
 
+	/*
+	 *	Stop other workers from taking requests from our
+	 *	backlog.  We'll run the rest ourselves.
+	 */
+	if (worker->steal) atomic_store(&worker->steal_slot->active, false);
+
 	/*
 	 *	Don't allow the post event to run
 	 *	any more requests.  They'll be
@@ -301,9 +407,15 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 
 			DEBUG3("Received channel %p into array entry %d", ch, i);
 
-			ms = fr_message_set_create(worker, worker->config.message_set_size,
-						   sizeof(fr_channel_data_t),
-						   worker->config.ring_buffer_size);
+			if (worker->config.hugepages) {
+				ms = fr_message_set_create_hugepage(worker, worker->config.message_set_size,
+								    sizeof(fr_channel_data_t),
+								    worker->config.ring_buffer_size);
+			} else {
+				ms = fr_message_set_create(worker, worker->config.message_set_size,
+							   sizeof(fr_channel_data_t),
+							   worker->config.ring_buffer_size);
+			}
 			fr_assert(ms != NULL);
 			fr_channel_responder_uctx_add(ch, ms);
 
@@ -330,6 +442,7 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 			if (worker->channel[i].ch != ch) continue;
 
 			worker_requests_cancel(&worker->channel[i]);
+			if (worker->steal) worker_steal_backlog_cancel(worker, ch);
 
 			ms = fr_channel_responder_uctx_get(ch);
 
@@ -421,6 +534,11 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 
 	worker->num_naks++;
 
+	/*
+	 *	The pairs decoded by the network thread aren't needed.
+	 */
+	TALLOC_FREE(cd->request.decoded);
+
 	/*
 	 *	Cache the outbound channel.  We'll need it later.
 	 */
@@ -470,6 +588,7 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	reply->reply.cpu_time = worker->tracking.running_total;
 	reply->reply.processing_time = fr_time_delta_from_sec(10); /* @todo - set to something better? */
 	reply->reply.request_time = cd->request.recv_time;
+	reply->reply.saturated = (trunk_thread_num_saturated() > 0);
 
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
@@ -489,6 +608,353 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	worker->stats.out++;
 }
 
+/** Hand a stolen request back to the worker it was taken from
+ *
+ * @param[in] sr	the stolen request.
+ */
+static void worker_steal_return(fr_worker_stolen_t *sr)
+{
+	fr_worker_steal_slot_t *from = sr->from;
+
+	/*
+	 *	The number of requests we can take from a worker
+	 *	is limited to the size of its reply queue, so this
+	 *	can't fail.
+	 */
+	if (!fr_cond_assert_msg(fr_atomic_queue_push(from->replies, sr), "Steal reply queue is full")) {
+		talloc_free(sr);
+	} else {
+		(void) fr_event_user_trigger(from->el, from->ev);
+	}
+
+	/*
+	 *	Our reference keeps the other worker running until
+	 *	it's seen the reply.
+	 */
+	atomic_fetch_sub(&from->refs, 1);
+}
+
+/** Start tracking a stolen request
+ *
+ * @param[in] from	slot of the worker we took the request from.
+ * @param[in] cd	the message we took.
+ * @return the tracking structure.
+ */
+static fr_worker_stolen_t *worker_steal_track(fr_worker_steal_slot_t *from, fr_channel_data_t const *cd)
+{
+	fr_worker_stolen_t *sr;
+
+	/*
+	 *	Not parented, as it's freed by the other worker.
+	 */
+	MEM(sr = talloc_zero(NULL, fr_worker_stolen_t));
+	sr->from = from;
+	sr->ch = cd->channel.ch;
+
+	return sr;
+}
+
+/** Ask the owner of a stolen message to NAK it
+ *
+ * @param[in] from	slot of the worker we took the message from.
+ * @param[in] cd	the message to NAK.
+ */
+static void worker_steal_nak(fr_worker_steal_slot_t *from, fr_channel_data_t *cd)
+{
+	fr_worker_stolen_t *sr;
+
+	sr = worker_steal_track(from, cd);
+	sr->cd = cd;
+
+	worker_steal_return(sr);
+}
+
+/** Encode the reply to a stolen request, and hand it back to its owner
+ *
+ * @param[in] worker	the worker which ran the request.
+ * @param[in] request	the request.
+ * @param[in] send_reply whether we should encode a reply.
+ * @param[in] size	of the reply buffer.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_reply(fr_worker_t *worker, request_t *request, bool send_reply, size_t size, fr_time_t now)
+{
+	fr_worker_stolen_t	*sr = talloc_get_type_abort(request->async->stolen, fr_worker_stolen_t);
+
+	if (send_reply) {
+		ssize_t slen = 0;
+		fr_listen_t const *listen = request->async->listen;
+
+		MEM(sr->data = talloc_array(sr, uint8_t, size));
+
+		if (listen->app_io->encode) {
+			slen = listen->app_io->encode(listen->app_io_instance, request, sr->data, size);
+		} else if (listen->app->encode) {
+			slen = listen->app->encode(listen->app_instance, request, sr->data, size);
+		}
+		if (slen < 0) {
+			RPERROR("Failed encoding request");
+			*sr->data = 0;
+			slen = 1;
+		}
+
+		sr->data_len = slen;
+	}
+
+	sr->send_reply = send_reply;
+	sr->listen = request->async->listen;
+	sr->packet_ctx = request->async->packet_ctx;
+	sr->request_time = request->async->recv_time;
+	sr->processing_time = request->async->tracking.running_total;
+
+	fr_time_elapsed_update(&worker->cpu_time, now, fr_time_add(now, sr->processing_time));
+	fr_time_elapsed_update(&worker->wall_clock, sr->request_time, now);
+
+	RDEBUG("Finished request");
+
+	request->async->stolen = NULL;
+	worker_steal_return(sr);
+}
+
+/** Check whether a channel is still open
+ *
+ * @param[in] worker	the worker.
+ * @param[in] ch	to look for.
+ * @return true if we still own the channel.
+ */
+static bool worker_channel_open(fr_worker_t *worker, fr_channel_t *ch)
+{
+	int i;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (worker->channel[i].ch == ch) return fr_channel_active(ch);
+	}
+
+	return false;
+}
+
+/** Send the reply for a request which another worker took from us
+ *
+ * @param[in] worker	the worker.
+ * @param[in] sr	the stolen request.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_reply_send(fr_worker_t *worker, fr_worker_stolen_t *sr, fr_time_t now)
+{
+	fr_channel_data_t	*reply;
+	fr_message_set_t	*ms;
+
+	ms = fr_channel_responder_uctx_get(sr->ch);
+	fr_assert(ms != NULL);
+
+	reply = (fr_channel_data_t *) fr_message_reserve(ms, sr->send_reply ? sr->data_len : 1);
+	fr_assert(reply != NULL);
+
+	if (sr->send_reply) {
+		memcpy(reply->m.data, sr->data, sr->data_len);
+		(void) fr_message_alloc(ms, &reply->m, sr->data_len);
+	}
+
+	reply->m.when = now;
+	reply->reply.cpu_time = worker->tracking.running_total;
+	reply->reply.processing_time = sr->processing_time;
+	reply->reply.request_time = sr->request_time;
+	reply->reply.saturated = (trunk_thread_num_saturated() > 0);
+
+	reply->listen = sr->listen;
+	reply->packet_ctx = sr->packet_ctx;
+
+	if (fr_channel_send_reply(sr->ch, reply) < 0) {
+		PERROR("Failed sending reply to network thread");
+	}
+
+	worker->stats.out++;
+}
+
+/** Send replies for requests which other workers took from us
+ *
+ * @param[in] worker	the worker.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_replies(fr_worker_t *worker, fr_time_t now)
+{
+	fr_worker_stolen_t *sr;
+
+	while (fr_atomic_queue_pop(worker->steal_slot->replies, (void **) &sr)) {
+		/*
+		 *	The network closed the channel while the
+		 *	request was running.  There's nowhere to send
+		 *	the reply.
+		 */
+		if (!worker_channel_open(worker, sr->ch)) {
+			DEBUG3("Discarding reply to stolen request - channel has been closed");
+
+		} else if (sr->cd) {
+			worker_nak(worker, sr->cd, now);
+
+		} else {
+			worker_steal_reply_send(worker, sr, now);
+		}
+
+		talloc_free(sr);
+	}
+}
+
+/** Wake up one idle worker, so that it can take requests from our backlog
+ *
+ * @param[in] worker	the worker.
+ */
+static void worker_steal_wake_idle(fr_worker_t *worker)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	unsigned int		i;
+
+	for (i = 0; i < steal->num_slots; i++) {
+		fr_worker_steal_slot_t *slot = &steal->slot[(worker->steal_next + i) % steal->num_slots];
+
+		if (slot == worker->steal_slot) continue;
+
+		/*
+		 *	Clear the flag, so that each idle worker is
+		 *	only woken up once.
+		 */
+		if (!atomic_load(&slot->idle) || !atomic_exchange(&slot->idle, false)) continue;
+
+		atomic_fetch_add(&slot->refs, 1);
+		if (atomic_load(&slot->active)) (void) fr_event_user_trigger(slot->el, slot->ev);
+		atomic_fetch_sub(&slot->refs, 1);
+		return;
+	}
+}
+
+/** Drop messages from our backlog which arrived on a channel that's closing
+ *
+ * @param[in] worker	the worker.
+ * @param[in] ch	the channel which is closing.
+ */
+static void worker_steal_backlog_cancel(fr_worker_t *worker, fr_channel_t *ch)
+{
+	fr_channel_data_t	*cd;
+	uint32_t		i;
+
+	for (i = 0; i < worker->steal->size; i++) {
+		if (!fr_atomic_queue_pop(worker->steal_slot->backlog, (void **) &cd)) break;
+
+		if (cd->channel.ch == ch) {
+			TALLOC_FREE(cd->request.decoded);
+			fr_message_done(&cd->m);
+			continue;
+		}
+
+		if (!fr_atomic_queue_push(worker->steal_slot->backlog, cd)) {
+			worker_request_bootstrap(worker, cd, fr_time(), NULL);
+		}
+	}
+}
+
+/** Send stolen replies, and look for requests to run
+ *
+ *  We start requests from our own backlog first.  If there are none,
+ *  we take requests from the backlogs of other workers.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_service(fr_worker_t *worker, fr_time_t now)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	fr_channel_data_t	*cd;
+	unsigned int		i;
+
+	worker_steal_replies(worker, now);
+
+	while (fr_heap_num_elements(worker->runnable) == 0) {
+		if (!fr_atomic_queue_pop(worker->steal_slot->backlog, (void **) &cd)) break;
+
+		worker_request_bootstrap(worker, cd, now, NULL);
+	}
+
+	if ((fr_heap_num_elements(worker->runnable) > 0) || worker->exiting) return;
+
+	for (i = 0; i < steal->num_slots; i++) {
+		fr_worker_steal_slot_t *slot = &steal->slot[worker->steal_next];
+
+		worker->steal_next = (worker->steal_next + 1) % steal->num_slots;
+		if (slot == worker->steal_slot) continue;
+
+		/*
+		 *	We hold a reference for as long as the request
+		 *	is running.  This keeps the other worker
+		 *	around, and bounds the size of its reply queue.
+		 */
+		if ((atomic_fetch_add(&slot->refs, 1) >= steal->size) || !atomic_load(&slot->active) ||
+		    !fr_atomic_queue_pop(slot->backlog, (void **) &cd)) {
+			atomic_fetch_sub(&slot->refs, 1);
+			continue;
+		}
+
+		worker->num_stolen++;
+		DEBUG3("Took request from the backlog of another worker");
+
+		worker_request_bootstrap(worker, cd, now, slot);
+		if (fr_heap_num_elements(worker->runnable) > 0) return;
+	}
+}
+
+/** Check whether other workers still have requests they took from us
+ *
+ * @param[in] worker	the worker.
+ * @return true if we can exit.
+ */
+static bool worker_steal_done(fr_worker_t *worker)
+{
+	if (atomic_load(&worker->steal_slot->refs) > 0) return false;
+
+	worker_steal_replies(worker, fr_time());
+	return true;
+}
+
+/** Wait for other workers to hand back the requests they took from us
+ *
+ * They push the replies to our slot, and wake up our event list, so we
+ * can't exit until they're done.  We yield for a while, then back off
+ * to sleeping, so that an exiting worker doesn't spin on a CPU.
+ *
+ * @param[in] worker	the worker.
+ */
+static void worker_steal_wait(fr_worker_t *worker)
+{
+	unsigned int	i;
+	useconds_t	delay = 10;
+	fr_time_t	warn = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	for (i = 0; !worker_steal_done(worker); i++) {
+		if (i < WORKER_STEAL_WAIT_SPINS) {
+			sched_yield();
+			continue;
+		}
+
+		if (fr_time_gt(fr_time(), warn)) {
+			WARN("Worker is exiting - Still waiting for %u requests taken by other workers",
+			     atomic_load(&worker->steal_slot->refs));
+			warn = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+		}
+
+		usleep(delay);
+		if (delay < WORKER_STEAL_WAIT_MAX_USEC) delay *= 2;
+	}
+}
+
+/** Another worker has sent us a stolen reply, or has work for us
+ *
+ */
+static void worker_steal_wakeup(UNUSED fr_event_list_t *el, void *uctx)
+{
+	fr_worker_t *worker = talloc_get_type_abort(uctx, fr_worker_t);
+
+	worker_steal_replies(worker, fr_time());
+}
+
 /** Signal the unlang interpreter that it needs to stop running the request
  *
  * Signalling is a synchronous operation.  Whatever I/O requests the request
@@ -645,6 +1111,15 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 		if (!size) size = request->async->listen->app_io->default_message_size;
 	}
 
+	/*
+	 *	We took this request from another worker.  It sends
+	 *	the reply.
+	 */
+	if (request->async->stolen) {
+		worker_steal_reply(worker, request, send_reply, size, now);
+		goto done;
+	}
+
 	/*
 	 *	Allocate and send the reply.
 	 */
@@ -706,6 +1181,7 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 	reply->reply.cpu_time = worker->tracking.running_total;
 	reply->reply.processing_time = request->async->tracking.running_total;
 	reply->reply.request_time = request->async->recv_time;
+	reply->reply.saturated = (trunk_thread_num_saturated() > 0);
 
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
@@ -734,6 +1210,7 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 
 	worker->stats.out++;
 
+done:
 	fr_assert(!fr_minmax_heap_entry_inserted(request->time_order_id));
 	fr_assert(!fr_heap_entry_inserted(request->runnable_id));
 
@@ -798,7 +1275,67 @@ void worker_request_name_number(request_t *request)
 	request->name = itoa_internal(request, request->number);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+/** Attach a flight recorder to a request
+ *
+ * The recorder keeps the request's messages in binary form, so they're
+ * only formatted if the request turns out to be slow.  Recorders are
+ * reused, so this doesn't normally allocate anything.
+ */
+static void worker_flight_start(fr_worker_t *worker, request_t *request)
+{
+	fr_log_rec_t *rec;
+
+	if (!worker->config.flight_recorder_size) return;
+
+	if (worker->num_flight > 0) {
+		rec = worker->flight[--worker->num_flight];
+	} else {
+		rec = fr_log_rec_alloc(worker, worker->config.flight_recorder_size, worker->config.suppress_secrets);
+		if (!rec) return;
+	}
+
+	if (request_log_rec_prepend(request, rec, worker->config.flight_recorder_lvl) < 0) {
+		talloc_free(rec);
+		return;
+	}
+
+	request->async->flight = rec;
+}
+
+/** Dump the request's flight recorder if it was slow, and keep the recorder for reuse
+ *
+ */
+static void worker_flight_end(fr_worker_t *worker, request_t *request, fr_time_t now)
+{
+	fr_log_rec_t *rec = request->async->flight;
+
+	if (!rec) return;
+	request->async->flight = NULL;
+
+	if (fr_time_delta_gt(fr_time_sub(now, request->async->recv_time), worker->config.flight_recorder_threshold)) {
+		log_request_rec_dump(worker->log, request->name, request->async->recv_time, rec);
+		worker->num_slow++;
+	}
+
+	if (worker->num_flight == worker->max_flight) {
+		fr_log_rec_t **flight;
+		unsigned int max = worker->max_flight ? worker->max_flight * 2 : 64;
+
+		flight = talloc_realloc(worker, worker->flight, fr_log_rec_t *, max);
+		if (!flight) {
+			talloc_free(rec);
+			return;
+		}
+		worker->flight = flight;
+		worker->max_flight = max;
+	}
+
+	fr_log_rec_reset(rec);
+	worker->flight[worker->num_flight++] = rec;
+}
+
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+				     fr_worker_steal_slot_t *from)
 {
 	int			ret = -1;
 	request_t		*request;
@@ -828,14 +1365,20 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	/*
 	 *	Update the transport-specific fields.
+	 *
+	 *	Stolen requests don't get a channel, as we can't write
+	 *	to it.  The reply goes back via the worker which owns
+	 *	the channel.
 	 */
-	request->async->channel = cd->channel.ch;
+	if (!from) request->async->channel = cd->channel.ch;
 
 	request->async->recv_time = cd->request.recv_time;
 
 	request->async->listen = cd->listen;
 	request->async->packet_ctx = cd->packet_ctx;
 	request->async->priority = cd->priority;
+	request->async->decoded = cd->request.decoded;
+	cd->request.decoded = NULL;
 	listen = request->async->listen;
 
 	/*
@@ -849,9 +1392,19 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 		ret = listen->app_io->decode(listen->app_io_instance, request, cd->m.data, cd->m.data_size);
 	}
 
+	/*
+	 *	Free the pre-decoded pairs, if the decode() routine
+	 *	didn't use them.
+	 */
+	TALLOC_FREE(request->async->decoded);
+
 	if (ret < 0) {
 		talloc_free(ctx);
 nak:
+		if (from) {
+			worker_steal_nak(from, cd);
+			return;
+		}
 		worker_nak(worker, cd, now);
 		return;
 	}
@@ -861,10 +1414,16 @@ nak:
 	 */
 	if (unlang_call_push(request, cd->listen->server_cs, UNLANG_TOP_FRAME) < 0) {
 		RERROR("Protocol failed to set 'process' function");
+		if (from) {
+			worker_steal_nak(from, cd);
+			return;
+		}
 		worker_nak(worker, cd, now);
 		return;
 	}
 
+	if (from) request->async->stolen = worker_steal_track(from, cd);
+
 	/*
 	 *	We're done with this message.
 	 */
@@ -873,8 +1432,13 @@ nak:
 	/*
 	 *	Look for conflicting / duplicate packets, but only if
 	 *	requested to do so.
+	 *
+	 *	Stolen requests aren't tracked.  Exact duplicates
+	 *	are suppressed by the network side, and it discards
+	 *	replies to requests which have been replaced by a
+	 *	conflicting packet.
 	 */
-	if (request->async->listen->track_duplicates) {
+	if (!from && request->async->listen->track_duplicates) {
 		request_t *old;
 
 		old = fr_rb_find(worker->dedup, request);
@@ -939,6 +1503,13 @@ nak:
 
 	worker_request_time_tracking_start(worker, request, now);
 
+	worker_flight_start(worker, request);
+
+	/*
+	 *	Include the time the packet spent waiting for us.
+	 */
+	fr_trace_request_start(request, listen->name ? listen->name : "request", request->async->recv_time);
+
 	{
 		fr_worker_listen_t *wl;
 
@@ -1021,6 +1592,15 @@ void fr_worker_destroy(fr_worker_t *worker)
 	 */
 	unlang_interpret_set_thread_default(NULL);
 
+	/*
+	 *	Wait for other workers to hand back any requests they
+	 *	took from us.  They use our event list to wake us up.
+	 */
+	if (worker->steal) {
+		atomic_store(&worker->steal_slot->active, false);
+		worker_steal_wait(worker);
+	}
+
 	/*
 	 *	Destroy all of the active requests.  These are ones
 	 *	which are still waiting for timers or file descriptor
@@ -1096,7 +1676,7 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 	 *	Only real packets are in the dedup tree.  And even
 	 *	then, only some of the time.
 	 */
-	if (request->async->listen->track_duplicates) {
+	if (!request->async->stolen && request->async->listen->track_duplicates) {
 		(void) fr_rb_delete(worker->dedup, request);
 	}
 
@@ -1124,6 +1704,8 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 	 */
 	worker_request_time_tracking_end(worker, request, now);
 
+	worker_flight_end(worker, request, now);
+
 	/*
 	 *	Remove it from the list of requests associated with this channel.
 	 */
@@ -1137,7 +1719,7 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 	 *
 	 *	This should never happen otherwise.
 	 */
-	if (unlikely((request->master_state == REQUEST_STOP_PROCESSING) &&
+	if (unlikely((request->master_state == REQUEST_STOP_PROCESSING) && !request->async->stolen &&
 		     !fr_channel_active(request->async->channel))) {
 		talloc_free(request);
 		return;
@@ -1341,6 +1923,144 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 	}
 }
 
+/** Set the NUMA node the worker thread is running on
+ *
+ * @param[in] worker	the worker.
+ * @param[in] node	NUMA node, or -1 if unknown.
+ */
+void fr_worker_numa_node_set(fr_worker_t *worker, int node)
+{
+	worker->numa_node = node;
+}
+
+/** Return the NUMA node the worker thread is running on
+ *
+ * @param[in] worker	the worker.
+ * @return the NUMA node, or -1 if unknown.
+ */
+int fr_worker_numa_node(fr_worker_t const *worker)
+{
+	return worker->numa_node;
+}
+
+/** Mark the worker as only running background requests
+ *
+ * Networks send requests with #PRIORITY_BACKGROUND to these workers,
+ * and never send them any other requests.
+ *
+ * @param[in] worker		the worker.
+ * @param[in] background	whether the worker is a background worker.
+ */
+void fr_worker_background_set(fr_worker_t *worker, bool background)
+{
+	worker->background = background;
+}
+
+/** Return whether the worker only runs background requests
+ *
+ * @param[in] worker	the worker.
+ * @return true for background workers.
+ */
+bool fr_worker_background(fr_worker_t const *worker)
+{
+	return worker->background;
+}
+
+/** Return the number of requests which are waiting to run
+ *
+ * This may be called from any thread.  The value is updated each
+ * time the worker goes through its event loop.
+ *
+ * @param[in] worker	the worker.
+ * @return the number of runnable requests.
+ */
+uint32_t fr_worker_num_runnable(fr_worker_t *worker)
+{
+	return atomic_load_explicit(&worker->num_runnable, memory_order_relaxed);
+}
+
+/** Allocate the work stealing state for a group of workers
+ *
+ *  This should be allocated in a context which outlives all of the
+ *  workers in the group.
+ *
+ * @param[in] ctx		to allocate the state in.
+ * @param[in] num_workers	the maximum number of workers in the group.
+ * @return
+ *	- NULL on error.
+ *	- fr_worker_steal_t on success.
+ */
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, unsigned int num_workers)
+{
+	fr_worker_steal_t	*steal;
+	unsigned int		i;
+
+	steal = talloc_zero(ctx, fr_worker_steal_t);
+	if (!steal) {
+	nomem:
+		fr_strerror_const("Failed allocating memory");
+		return NULL;
+	}
+
+	steal->num_slots = num_workers;
+	steal->size = 1024;
+
+	steal->slot = talloc_zero_array(steal, fr_worker_steal_slot_t, num_workers);
+	if (!steal->slot) {
+		talloc_free(steal);
+		goto nomem;
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		steal->slot[i].backlog = fr_atomic_queue_alloc(steal, steal->size);
+		steal->slot[i].replies = fr_atomic_queue_alloc(steal, steal->size);
+		if (!steal->slot[i].backlog || !steal->slot[i].replies) {
+			fr_strerror_const("Failed creating atomic queue");
+			talloc_free(steal);
+			return NULL;
+		}
+	}
+
+	return steal;
+}
+
+/** Allow a worker to take requests from, and give requests to, other workers
+ *
+ *  Must be called from the worker thread, before it starts processing
+ *  requests.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] steal	work stealing state for the group.
+ * @param[in] id	of the worker in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *steal, unsigned int id)
+{
+	fr_worker_steal_slot_t *slot;
+
+	if (id >= steal->num_slots) {
+		fr_strerror_printf("Worker ID %u is larger than the maximum %u", id, steal->num_slots);
+		return -1;
+	}
+
+	slot = &steal->slot[id];
+	if (fr_event_user_insert(worker, worker->el, &slot->ev, false, worker_steal_wakeup, worker) < 0) {
+		fr_strerror_const_push("Failed adding work stealing event");
+		return -1;
+	}
+	slot->el = worker->el;
+
+	worker->steal = steal;
+	worker->steal_slot = slot;
+	worker->steal_next = (id + 1) % steal->num_slots;
+
+	atomic_store(&slot->active, true);
+
+	return 0;
+}
+
 /** Create a worker
  *
  * @param[in] ctx the talloc context
@@ -1366,6 +2086,7 @@ nomem:
 	}
 
 	worker->name = talloc_strdup(worker, name); /* thread locality */
+	worker->numa_node = -1;
 
 	unlang_thread_instantiate(worker);
 
@@ -1384,10 +2105,23 @@ nomem:
 
 	CHECK_CONFIG(max_requests,1024,(1 << 30));
 	CHECK_CONFIG(max_channels, 64, 1024);
-	CHECK_CONFIG(talloc_pool_size, 4096, 65536);
+	CHECK_CONFIG(talloc_pool_size, 2048, (1 << 20));
 	CHECK_CONFIG(message_set_size, 1024, 8192);
-	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
+	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 28));
 	CHECK_CONFIG_TIME_DELTA(max_request_time, fr_time_delta_from_sec(5), fr_time_delta_from_sec(120));
+	CHECK_CONFIG_TIME_DELTA(max_poll_time, fr_time_delta_wrap(0), fr_time_delta_from_msec(1));
+
+	if (!worker->config.max_free_requests) worker->config.max_free_requests = 256;
+	if (worker->config.max_free_requests > 65536) worker->config.max_free_requests = 65536;
+
+	worker->poll.max = worker->config.max_poll_time;
+
+	/*
+	 *	The worker is created in the thread which runs it,
+	 *	so the thread local request free list is ours.
+	 */
+	request_free_list_max_set(worker->config.max_free_requests);
+	request_talloc_pool_size_set(worker->config.talloc_pool_size);
 
 	worker->channel = talloc_zero_array(worker, fr_worker_channel_t, worker->config.max_channels);
 	if (!worker->channel) {
@@ -1490,33 +2224,135 @@ nomem:
  *
  * @param[in] worker the worker data structure to manage
  */
+/** Poll our channels for a while, instead of sleeping
+ *
+ *  While we're polling, the network threads don't signal us when they
+ *  send us a request.  That saves a pipe write and a wakeup for each
+ *  request, which matters at high packet rates.
+ *
+ * @param[in] worker	the worker
+ * @return
+ *	- true if we received any requests.
+ *	- false if we should sleep.
+ */
+static bool worker_poll(fr_worker_t *worker)
+{
+	int		i;
+	bool		received = false;
+	fr_time_t	end;
+	fr_time_delta_t	budget;
+
+	budget = fr_channel_poll_budget(&worker->poll);
+	if (!fr_time_delta_ispos(budget)) return false;
+
+	end = fr_time_add(fr_time(), budget);
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i].ch) continue;
+
+		if (fr_channel_responder_poll(worker->channel[i].ch, true)) received = true;
+	}
+
+	while (!received && fr_time_lt(fr_time(), end)) {
+		for (i = 0; i < worker->config.max_channels; i++) {
+			if (!worker->channel[i].ch) continue;
+
+			while (fr_channel_recv_request(worker->channel[i].ch)) received = true;
+		}
+	}
+
+	/*
+	 *	Requests may have arrived after we last looked, and
+	 *	before the network saw that we had stopped polling.
+	 */
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i].ch) continue;
+
+		if (fr_channel_responder_poll(worker->channel[i].ch, false)) received = true;
+	}
+
+	return received;
+}
+
 void fr_worker(fr_worker_t *worker)
 {
 	WORKER_VERIFY;
 
+	/*
+	 *	Let shared read-mostly structures know when we're
+	 *	done with any old versions of them.
+	 */
+	if (fr_qsbr_thread_register() < 0) PERROR("Failed registering for memory reclamation");
+
 	while (true) {
 		bool wait_for_event;
 		int num_events;
 
 		WORKER_VERIFY;
 
+		/*
+		 *	We don't hold references to shared data
+		 *	between passes of the event loop.
+		 */
+		fr_qsbr_quiescent();
+
+		/*
+		 *	Send replies for requests which other workers
+		 *	took from us, and look for more work.
+		 */
+		if (worker->steal) worker_steal_service(worker, fr_time());
+
 		/*
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
 		 */
+		atomic_store_explicit(&worker->num_runnable, fr_heap_num_elements(worker->runnable),
+				      memory_order_relaxed);
+
 		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
 		if (wait_for_event) {
-			if (worker->exiting && (fr_minmax_heap_num_elements(worker->time_order) == 0)) break;
+			if (worker->exiting && (fr_minmax_heap_num_elements(worker->time_order) == 0)) {
+				if (!worker->steal || worker_steal_done(worker)) break;
+
+				/*
+				 *	Other workers are still running
+				 *	requests they took from us.  Poll
+				 *	until they've handed them back.
+				 */
+				wait_for_event = false;
+			}
 
 			DEBUG4("Ready to process requests");
 		}
 
+		/*
+		 *	Requests are arriving quickly.  Poll for the
+		 *	next one, instead of going to sleep and waiting
+		 *	for the network to wake us up.
+		 */
+		if (wait_for_event && !worker->exiting && worker_poll(worker)) wait_for_event = false;
+
+		/*
+		 *	Tell busy workers that they can wake us up.  A
+		 *	request may have been added to a backlog after
+		 *	we looked, so look again.
+		 */
+		if (worker->steal && wait_for_event) {
+			atomic_store(&worker->steal_slot->idle, true);
+
+			worker_steal_service(worker, fr_time());
+			if (fr_heap_num_elements(worker->runnable) > 0) wait_for_event = false;
+		}
+
 		/*
 		 *	Check the event list.  If there's an error
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		DEBUG4("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
+		if (wait_for_event) fr_qsbr_offline();
 		num_events = fr_event_corral(worker->el, fr_time(), wait_for_event);
+		if (wait_for_event) fr_qsbr_online();
+		if (worker->steal) atomic_store(&worker->steal_slot->idle, false);
 		if (num_events < 0) {
 			PERROR("Failed retrieving events");
 			break;
@@ -1538,6 +2374,8 @@ void fr_worker(fr_worker_t *worker)
 		 */
 		worker_run_request(worker, fr_time());
 	}
+
+	fr_qsbr_thread_unregister();
 }
 
 /** Pre-event handler
@@ -1583,6 +2421,7 @@ void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 
 	fprintf(fp, "\tnum_channels = %d\n", worker->num_channels);
 	fprintf(fp, "\tstats.in = %" PRIu64 "\n", worker->stats.in);
+	fprintf(fp, "\tnum_stolen = %" PRIu64 "\n", worker->num_stolen);
 
 	fprintf(fp, "\tcalculated (predicted) total CPU time = %" PRIu64 "\n",
 		fr_time_delta_unwrap(worker->predicted) * worker->stats.in);
@@ -1689,10 +2528,12 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	if (num >= 4) stats[3] = worker->stats.dropped;
 	if (num >= 5) stats[4] = worker->num_naks;
 	if (num >= 6) stats[5] = worker->num_active;
+	if (num >= 7) stats[6] = fr_time_delta_unwrap(worker->tracking.running_total);
+	if (num >= 8) stats[7] = atomic_load_explicit(&worker->num_runnable, memory_order_relaxed);
 
-	if (num <= 6) return num;
+	if (num <= 8) return num;
 
-	return 6;
+	return 8;
 }
 
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
@@ -1708,6 +2549,7 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		fprintf(fp, "count.slow\t\t\t%" PRIu64 "\n", worker->num_slow);
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
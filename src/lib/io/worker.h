@@ -37,6 +37,11 @@ extern "C" {
  */
 typedef struct fr_worker_s fr_worker_t;
 
+/** Work stealing state shared by a group of workers
+ *
+ */
+typedef struct fr_worker_steal_s fr_worker_steal_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -62,10 +67,20 @@ typedef struct {
 
 	int             message_set_size;	//!< default start number of messages
 	int             ring_buffer_size;	//!< default start size for the ring buffers
+	bool		hugepages;		//!< back the ring buffers with huge pages
 
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
+	fr_time_delta_t	max_poll_time;		//!< maximum time to poll channels before sleeping
+
 	size_t		talloc_pool_size;	//!< for each request
+
+	uint32_t	max_free_requests;	//!< max finished requests to keep for reuse
+
+	size_t		flight_recorder_size;	//!< of each request's flight recorder, 0 disables it.
+	fr_time_delta_t	flight_recorder_threshold; //!< dump the recorder of requests slower than this.
+	fr_log_lvl_t	flight_recorder_lvl;	//!< debug level messages are recorded at.
+	bool		suppress_secrets;	//!< don't record secret values.
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -87,6 +102,20 @@ int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HIN
 
 int		fr_worker_listen_cancel(fr_worker_t *worker, fr_listen_t const *li);
 
+void		fr_worker_numa_node_set(fr_worker_t *worker, int node) CC_HINT(nonnull);
+
+int		fr_worker_numa_node(fr_worker_t const *worker) CC_HINT(nonnull);
+
+void		fr_worker_background_set(fr_worker_t *worker, bool background) CC_HINT(nonnull);
+
+bool		fr_worker_background(fr_worker_t const *worker) CC_HINT(nonnull);
+
+uint32_t	fr_worker_num_runnable(fr_worker_t *worker) CC_HINT(nonnull);
+
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, unsigned int num_workers);
+
+int		fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *steal, unsigned int id) CC_HINT(nonnull);
+
 #include <freeradius-devel/server/module.h>
 
 int		fr_worker_subrequest_add(request_t *request) CC_HINT(nonnull);
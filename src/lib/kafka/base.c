@@ -63,13 +63,24 @@ static int _kafka_conf_free(fr_kafka_conf_t *kc)
 	return 0;
 }
 
+/** Find or allocate the kafka configuration handle for a section
+ *
+ * Options in subsections like "tls" and "connection" are set in the
+ * handle of the closest parent which has one, so the whole client
+ * configuration ends up in a single rd_kafka_conf_t.
+ */
 static inline CC_HINT(always_inline)
 fr_kafka_conf_t *kafka_conf_from_cs(CONF_SECTION *cs)
 {
-	CONF_DATA const	*cd;
+	CONF_DATA const	*cd = NULL;
+	CONF_SECTION	*parent;
 	fr_kafka_conf_t	*kc;
 
-	cd = cf_data_find(cs, fr_kafka_conf_t, "conf");
+	for (parent = cs; parent; parent = cf_item_to_section(cf_parent(parent))) {
+		cd = cf_data_find(parent, fr_kafka_conf_t, "conf");
+		if (cd) break;
+	}
+
 	if (cd) {
 		kc = cf_data_value(cd);
 	} else {
@@ -112,6 +123,46 @@ fr_kafka_topic_conf_t *kafka_topic_conf_from_cs(CONF_SECTION *cs)
 	return ktc;
 }
 
+/** Return a copy of the client configuration built from a section
+ *
+ * @param[in] cs	the producer or consumer configuration was parsed from.
+ *			Usually a module's configuration section.
+ * @return
+ *	- A new rd_kafka_conf_t.  Ownership passes to rd_kafka_new(),
+ *	  or it must be freed with rd_kafka_conf_destroy().
+ *	- NULL on error.
+ */
+rd_kafka_conf_t *fr_kafka_conf_dup(CONF_SECTION *cs)
+{
+	CONF_DATA const	*cd;
+
+	cd = cf_data_find(cs, fr_kafka_conf_t, "conf");
+	if (!cd) {
+		fr_strerror_const("No kafka configuration found");
+		return NULL;
+	}
+
+	return rd_kafka_conf_dup(((fr_kafka_conf_t *)cf_data_value(cd))->conf);
+}
+
+/** Return a copy of the topic configuration built from a section
+ *
+ * @param[in] cs	a "topic { <name> { ... } }" section.
+ * @return
+ *	- A new rd_kafka_topic_conf_t.  Ownership passes to rd_kafka_topic_new(),
+ *	  or it must be freed with rd_kafka_topic_conf_destroy().
+ *	  If no options were set in the section, the librdkafka defaults are used.
+ */
+rd_kafka_topic_conf_t *fr_kafka_topic_conf_dup(CONF_SECTION *cs)
+{
+	CONF_DATA const	*cd;
+
+	cd = cf_data_find(cs, fr_kafka_topic_conf_t, "conf");
+	if (!cd) return rd_kafka_topic_conf_new();
+
+	return rd_kafka_topic_conf_dup(((fr_kafka_topic_conf_t *)cf_data_value(cd))->conf);
+}
+
 /** Perform any conversions necessary to map kafka defaults to our values
  *
  * @param[out] out	Where to write the pair.
@@ -310,6 +310,9 @@ int fr_ldap_map_expand(TALLOC_CTX *ctx, fr_ldap_map_exp_t *expanded, request_t *
  * Use the attribute map built earlier to convert LDAP values into valuepairs and insert them into whichever
  * list they need to go into.
  *
+ * The entry is decoded in a single pass, with values referencing the BER encoded entry directly, rather
+ * than searching and copying the values of each mapped attribute in turn.
+ *
  * This is *NOT* atomic, but there's no condition for which we should error out...
  *
  * @param[in] request		Current request.
@@ -324,33 +327,89 @@ int fr_ldap_map_do(request_t *request,
 		   char const *valuepair_attr, fr_ldap_map_exp_t const *expanded, LDAPMessage *entry)
 {
 	map_t const		*map = NULL;
-	unsigned int		total = 0;
+	unsigned int		total = 0, num_maps, owned_count = 0, i;
 	int			applied = 0;	/* How many maps have been applied to the current request */
 
 	fr_ldap_result_t	result;
 	char const		*name;
 	LDAP			*handle = fr_ldap_handle_thread_local();
 
+	BerElement		*ber = NULL;
+	struct berval		dn, attr;
+	BerVarray		vals;
+	BerVarray		found[LDAP_MAX_ATTRMAP + 1] = { NULL };		/* Values of each map's attribute */
+	BerVarray		owned[LDAP_MAX_ATTRMAP + 1];			/* Value arrays we need to free */
+	struct berval		*ptrs_buff[LDAP_MAX_ATTRMAP + 1], **ptrs;
+
+	num_maps = map_list_num_elements(expanded->maps);
+	fr_assert(num_maps <= LDAP_MAX_ATTRMAP);
+
+	/*
+	 *	Walk the attributes in the entry once, matching
+	 *	them against the attributes the maps reference.
+	 *
+	 *	The value arrays point into the entry's BER
+	 *	encoding, so nothing is copied until the
+	 *	values are converted to pairs.
+	 */
+	if (ldap_get_dn_ber(handle, entry, &ber, &dn) != LDAP_SUCCESS) {
+		REDEBUG("Failed decoding LDAP object");
+		return -1;
+	}
+
+	while ((ldap_get_attribute_ber(handle, entry, ber, &attr, &vals) == LDAP_SUCCESS) && attr.bv_val) {
+		bool used = false;
+
+		for (i = 0; i < num_maps; i++) {
+			if (found[i]) continue;
+
+			name = expanded->attrs[i];
+			if ((strlen(name) != attr.bv_len) || (strncasecmp(name, attr.bv_val, attr.bv_len) != 0)) continue;
+
+			found[i] = vals;
+			used = true;
+		}
+
+		if (!vals) continue;
+
+		if (!used) {
+			ber_memfree(vals);
+			continue;
+		}
+
+		owned[owned_count++] = vals;
+	}
+	ber_free(ber, 0);
+
 	while ((map = map_list_next(expanded->maps, map))) {
 		int ret;
+		unsigned int count = 0;
 
-		name = expanded->attrs[total++];
+		name = expanded->attrs[total];
+		vals = found[total++];
 
 		/*
 		 *	Binary safe
 		 */
-		result.values = ldap_get_values_len(handle, entry, name);
-		if (!result.values) {
+		if (!vals || !vals[0].bv_val) {
 			RDEBUG3("Attribute \"%s\" not found in LDAP object", name);
-
-			goto next;
+			continue;
 		}
 
 		/*
 		 *	Find out how many values there are for the
 		 *	attribute and extract all of them.
 		 */
-		result.count = ldap_count_values_len(result.values);
+		while (vals[count].bv_val) count++;
+
+		ptrs = ptrs_buff;
+		if (count >= NUM_ELEMENTS(ptrs_buff)) MEM(ptrs = talloc_array(NULL, struct berval *, count + 1));
+
+		for (i = 0; i < count; i++) ptrs[i] = &vals[i];
+		ptrs[count] = NULL;
+
+		result.values = ptrs;
+		result.count = count;
 
 		/*
 		 *	If something bad happened, just skip, this is probably
@@ -358,15 +417,16 @@ int fr_ldap_map_do(request_t *request,
 		 *	request context
 		 */
 		ret = map_to_request(request, map, fr_ldap_map_getvalue, &result);
-		if (ret == -1) return -1;	/* Fail */
+		if (ptrs != ptrs_buff) talloc_free(ptrs);
+		if (ret == -1) {
+			applied = -1;	/* Fail */
+			goto finish;
+		}
 
 		/*
 		 *	How many maps we've processed
 		 */
 		applied++;
-
-	next:
-		ldap_value_free_len(result.values);
 	}
 
 
@@ -417,5 +477,8 @@ int fr_ldap_map_do(request_t *request,
 		ldap_value_free_len(values);
 	}
 
+finish:
+	for (i = 0; i < owned_count; i++) ber_memfree(owned[i]);
+
 	return applied;
 }
@@ -112,6 +112,7 @@ typedef struct {
 	uint32_t		database;	//!< number on Redis server.
 	bool			use_tls;	//!< use TLS.
 	bool			use_cluster_map;//!< use cluster map.
+	bool			read_replicas;	//!< Send read only commands to replicas.
 
 	char const		*username;	//!< for acls.
 	char const		*password;	//!< to authenticate to Redis.
@@ -136,6 +137,7 @@ typedef struct {
 	{ FR_CONF_OFFSET("database", fr_redis_conf_t, database), .dflt = "0" }, \
 	{ FR_CONF_OFFSET("use_tls", fr_redis_conf_t, use_tls), .dflt = "no" }, \
 	{ FR_CONF_OFFSET("use_cluster_map", fr_redis_conf_t, use_cluster_map), .dflt = "yes" }, \
+	{ FR_CONF_OFFSET("read_replicas", fr_redis_conf_t, read_replicas), .dflt = "no" }, \
 	{ FR_CONF_OFFSET("username", fr_redis_conf_t, username) }, \
 	{ FR_CONF_OFFSET_FLAGS("password", CONF_FLAG_SECRET, fr_redis_conf_t, password) }, \
 	{ FR_CONF_OFFSET("max_nodes", fr_redis_conf_t, max_nodes), .dflt = "20" }, \
@@ -85,9 +85,12 @@
  *   indexes in the fr_redis_cluster_t.node array.  We use 8bit unsigned integers instead of
  *   pointers to save space.  Using pointers, the node[] array would need 784K, using IDs
  *   it uses 112K.  Still not light on memory, but a bit more acceptable.
- *   Currently the key_slot array is shadowed by key_slot_pending, used to stage new key_slot
- *   mappings.  This doubles the memory used.  We may want to consider allocating key_slot_pending
- *   only during remappings and freeing it after.
+ *
+ *   The key_slot array lives in a cluster_map_t.  Each remap builds a new map which is
+ *   swapped in atomically, so workers resolving keys never take the cluster mutex, and
+ *   never see a partially applied map.  Replaced maps are retired with QSBR, and freed
+ *   once every worker has passed through a quiescent state, so none can still be holding
+ *   a key slot pointer into them.
  *
  * Mapping/Remapping the cluster
  * -----------------------------
@@ -95,24 +98,31 @@
  *   On startup, and during cluster operation, a remap may be performed.  A remap involves
  *   the following steps:
  *
- *     1. Executing the Redis 'cluster slots' command.
- *     2. Validating the result of this command.  We need to do extensive validation to
+ *     1. Executing the Redis 'cluster info' command to learn the current config epoch, and
+ *        'cluster shards' (or 'cluster slots' for Redis < 7.0) to learn the layout.
+ *     2. Validating the result of these commands.  We need to do extensive validation to
  *        avoid SEGV on invalid data, due to the way libhiredis presents the result.
- *     3. Determining the intersection between nodes described in the result, and those already
+ *     3. Comparing the epoch and a digest of the layout with the current map.  Layouts from
+ *        nodes with an older epoch are ignored, and identical layouts aren't reapplied.
+ *     4. Determining the intersection between nodes described in the result, and those already
  *        in our #fr_rb_tree_t.
- *     4. Connecting to nodes that were in the result, but not in the tree.
+ *     5. Connecting to nodes that were in the result, but not in the tree.
  *        Note: If we can't connect to any of the masters, we count the map as invalid, roll
  *        back any newly connected nodes, and error out. Slave failure is OK.
- *     5. Mapping keyslot ranges to nodes in the key_slot_pending array.
- *     6. Verifying there are no holes in the ranges (if there are, we roll back and error out).
- *     7. Applying the new keyslot ranges.
- *     8. Removing nodes no longer used by the key slots, and adding them back to the free
+ *     6. Mapping keyslot ranges to nodes in a new map.
+ *     7. Verifying there are no holes in the ranges (if there are, we roll back and error out).
+ *     8. Swapping in the new map.
+ *     9. Removing nodes no longer used by the key slots, and adding them back to the free
  *        nodes queue.
  *
  *   #cluster_map_get and #cluster_map_apply, perform the operations described
- *   above. The get function, issues the 'cluster slots' command and performs validation, the
+ *   above. The get function, issues the commands and performs validation, the
  *   apply function processes and applies the map.
  *
+ *   At runtime remaps are performed by a dedicated refresh thread, so workers are never
+ *   blocked waiting on a remap.  Workers request a remap with #fr_redis_cluster_refresh
+ *   and carry on using the current map, following redirects until the new map is applied.
+ *
  *   Failing to apply a map is not a fatal error at runtime, and is only fatal on startup if
  *   pool.start > 0.
  *
@@ -130,7 +140,7 @@
  *   similarly.  If the node is known, then a connection is reserved from its pool, if the node
  *   is not known, a new pool is established, and a connection reserved.
  *
- *   The difference between '-ASK' and '-MOVE' is that '-MOVE' attempts a cluster remap before
+ *   The difference between '-ASK' and '-MOVE' is that '-MOVE' requests a cluster remap before
  *   following the redirect.
  *
  *   The data from '-MOVE' responses, is not used to alter the cluster map.  That is only done
@@ -144,16 +154,36 @@
  *   should attempt the operation again.  The cluster spec says we should attempt the operation
  *   after some time.  This time is configurable.
  *
+ *
+ * Reading from replicas
+ * ---------------------
+ *
+ *   If read_replicas is enabled, read only commands may be sent to a replica of the master
+ *   responsible for the key slot.  A smoothed round trip time is kept for each node, and the
+ *   replica with the lowest round trip time is selected.  Replicas we've not yet heard from
+ *   are preferred, so that we learn their latency.
+ *
  */
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/server/cf_parse.h>
 
 #include <freeradius-devel/util/fifo.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/qsbr.h>
 #include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/time.h>
 
+#include <signal.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #include "config.h"
 #include "base.h"
 #include "cluster.h"
@@ -194,6 +224,15 @@
 
 #define RELEASED_MIN_WEIGHT	1000			//!< Minimum weight to assign to node.
 
+/*
+ *	Map refresh and replica selection
+ */
+#define CLUSTER_REFRESH_POLL	100			//!< How often (in ms) the refresh thread checks
+							//!< whether a pending remap can be performed.
+
+#define RTT_FAILED		1000			//!< Round trip time (in ms) to record for a node
+							//!< we failed to get a response from.
+
 /** Live nodes data, used to perform weighted random selection of alternative nodes
  */
 typedef struct {
@@ -230,6 +269,9 @@ struct fr_redis_cluster_node_s {
 	bool			is_master;		//!< Whether this node is a master.
 							//!< This is needed for commands like 'KEYS', which
 							//!< we need to issue to every master in the cluster.
+
+	_Atomic(uint64_t)	rtt;			//!< Smoothed round trip time in nanoseconds.
+							//!< 0 if we've not heard from the node yet.
 };
 
 /** Indexes in the fr_redis_cluster_node_t array for a single key slot
@@ -244,6 +286,39 @@ struct fr_redis_cluster_key_slot_s {
 	uint8_t			master;			//!< R/W node (master) for this key slot.
 };
 
+typedef struct cluster_map_s cluster_map_t;
+
+/** A complete mapping of key slots to nodes
+ *
+ * Maps are never modified once they've been swapped in.  A remap builds
+ * a new map, and replaces the old one atomically.
+ */
+struct cluster_map_s {
+	uint64_t			epoch;			//!< Cluster epoch the map was built from.
+	uint32_t			digest;			//!< Hash of the key slot ranges and node addresses.
+	cluster_map_t			*next;			//!< Next map in the retired list.
+
+	fr_redis_cluster_key_slot_t	key_slot[KEY_SLOTS];	//!< Lookup table of slots to pools.
+};
+
+/** A range of key slots, and the nodes responsible for them
+ */
+typedef struct {
+	uint16_t		start;			//!< First key slot in the range.
+	uint16_t		end;			//!< Last key slot in the range (inclusive).
+	fr_socket_t		master;			//!< Address of the master.
+	fr_socket_t		slave[MAX_SLAVES];	//!< Addresses of the slaves.
+	uint8_t			slave_num;		//!< Number of slaves.
+} cluster_range_t;
+
+/** The cluster layout as reported by one of its nodes
+ */
+typedef struct {
+	uint64_t		epoch;			//!< Value of cluster_current_epoch.
+	uint32_t		digest;			//!< Hash of the key slot ranges and node addresses.
+	cluster_range_t		*range;			//!< Array of key slot ranges, sorted by start.
+} cluster_layout_t;
+
 /** A redis cluster
  *
  * Holds all the structures and collections of nodes, to represent a Redis cluster.
@@ -272,10 +347,22 @@ struct fr_redis_cluster {
 	fr_fifo_t		*free_nodes;		//!< Queue of free nodes (or nodes waiting to be reused).
 	fr_rb_tree_t		*used_nodes;		//!< Tree of used nodes.
 
-	fr_redis_cluster_key_slot_t	key_slot[KEY_SLOTS];		//!< Lookup table of slots to pools.
-	fr_redis_cluster_key_slot_t	key_slot_pending[KEY_SLOTS];	//!< Pending key slot table.
+	_Atomic(cluster_map_t *)	map;		//!< Current key slot map.
+	cluster_map_t		*retired;		//!< Maps which have been replaced, but couldn't
+							//!< be passed to QSBR.  Freed with the cluster.
 
 	pthread_mutex_t		mutex;			//!< Mutex to synchronise cluster operations.
+
+	/** @name Background refresh
+	 * @{
+ 	 */
+	pthread_t		refresh_thread;		//!< Thread which performs remaps.
+	bool			refresh_running;	//!< Whether the refresh thread was started.
+	pthread_mutex_t		refresh_mutex;		//!< Protects refresh_cond.
+	pthread_cond_t		refresh_cond;		//!< Signalled to wake the refresh thread.
+	_Atomic(bool)		refresh_pending;	//!< A remap has been requested.
+	_Atomic(bool)		refresh_stop;		//!< Tells the refresh thread to exit.
+	/** @} */
 };
 
 fr_table_num_sorted_t const fr_redis_cluster_rcodes_table[] = {
@@ -382,6 +469,12 @@ static fr_redis_cluster_rcode_t cluster_node_connect(fr_redis_cluster_t *cluster
 		      node->name, sizeof(node->name));
 	if (!fr_cond_assert(p)) return FR_REDIS_CLUSTER_RCODE_FAILED;
 
+	/*
+	 *	Whatever we learned about the latency of the
+	 *	previous node doesn't apply to this one.
+	 */
+	atomic_store_explicit(&node->rtt, 0, memory_order_relaxed);
+
 	/*
 	 *	Node has never been used before, needs a pool allocated for it.
 	 */
@@ -444,8 +537,8 @@ static fr_redis_cluster_rcode_t cluster_node_connect(fr_redis_cluster_t *cluster
  *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
  *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT if the server returned an invalid redirect.
  */
-static fr_redis_cluster_rcode_t cluster_node_conf_from_redirect(uint16_t *key_slot, fr_socket_t *node_addr,
-						       redisReply *redirect)
+fr_redis_cluster_rcode_t fr_redis_cluster_node_addr_from_redirect(uint16_t *key_slot, fr_socket_t *node_addr,
+								   redisReply *redirect)
 {
 	char		*p, *q;
 	unsigned long	key;
@@ -497,69 +590,33 @@ static fr_redis_cluster_rcode_t cluster_node_conf_from_redirect(uint16_t *key_sl
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
-/** Apply a cluster map received from a cluster node
+/** Apply a cluster layout received from a cluster node
+ *
+ * Builds a new key slot map from the layout, and swaps it in.
  *
  * @note Errors may be retrieved with fr_strerror().
  * @note Must be called with the cluster mutex held.
  *
- * Key slot range structure
- @verbatim
-   [0] -> key slot range 0
-       [0] -> key_slot_start
-       [1] -> key_slot_end
-       [2] -> master_node
-           [0] -> master 0 ip (string)
-           [1] -> master 0 port (number)
-       [3..n] -> slave_node(s)
-   [1] -> key slot range 1)
-       [0]  -> key_slot_start
-       [1] -> key_slot_end
-       [2] -> master_node
-           [0] -> master 1 ip (string)
-           [1] -> master 1 port (number)
-       [3..n] -> slave_node(s)
-   [n] -> key slot range n
-       [0] -> key_slot_start
-       [1] -> key_slot_end
-       [2] -> master_node
-           [0] -> master n ip (string)
-           [1] -> master n port (number)
-       [3..n] -> slave_node(s)
- @endverbatim
- *
  * @param[in,out] cluster to apply map to.
- * @param[in] reply from #cluster_map_get.
+ * @param[in] layout from #cluster_map_get.
  * @return
  *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
  *	- FR_REDIS_CLUSTER_RCODE_FAILED on failure.
   *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION connection failure.
  *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT if the map didn't provide nodes for all keyslots.
  */
-static fr_redis_cluster_rcode_t cluster_map_apply(fr_redis_cluster_t *cluster, redisReply *reply)
+static fr_redis_cluster_rcode_t cluster_map_apply(fr_redis_cluster_t *cluster, cluster_layout_t const *layout)
 {
 	size_t		i;
 	uint8_t		r = 0;
+	fr_time_t	now;
 
 	fr_redis_cluster_rcode_t	rcode;
+	cluster_map_t	*map, *old;
 
 	uint8_t		rollback[UINT8_MAX];		// Set of nodes to re-add to the queue on failure.
 	bool		active[UINT8_MAX];		// Set of nodes active in the new cluster map.
 	bool		master[UINT8_MAX];		// Master nodes.
-#ifndef NDEBUG
-#  define SET_ADDR(_addr, _map) \
-do { \
-	int _ret; \
-	_ret = fr_inet_pton(&_addr.inet.dst_ipaddr, _map->element[0]->str, _map->element[0]->len, AF_UNSPEC, true, true);\
-	fr_assert(_ret == 0);\
-	_addr.inet.dst_port = _map->element[1]->integer; \
-} while (0)
-#else
-#  define SET_ADDR(_addr, _map) \
-do { \
-	fr_inet_pton(&_addr.inet.dst_ipaddr, _map->element[0]->str, _map->element[0]->len, AF_UNSPEC, true, true);\
-	_addr.inet.dst_port = _map->element[1]->integer; \
-} while (0)
-#endif
 
 #define SET_INACTIVE(_node) \
 do { \
@@ -578,41 +635,32 @@ do { \
 	rollback[r++] = (_node)->id; \
 } while (0)
 
-	fr_assert(reply->type == REDIS_REPLY_ARRAY);
-
 	memset(&rollback, 0, sizeof(rollback));
 	memset(active, 0, sizeof(active));
 	memset(master, 0, sizeof(master));
 
 	cluster->remapping = true;
 
-	/*
-	 *	Must be cleared with the mutex held
-	 */
-	memset(&cluster->key_slot_pending, 0, sizeof(cluster->key_slot_pending));
+	MEM(map = talloc_zero(NULL, cluster_map_t));
+	map->epoch = layout->epoch;
+	map->digest = layout->digest;
 
 	/*
 	 *	Insert new nodes and markup the keyslot indexes
-	 *	in our temporary keyslot_array.
-	 *
-	 *	A map consists of an array with the following indexes:
-	 *	  [0]    -> key_slot_start
-	 *	  [1]    -> key_slot_end
-	 *	  [2]    -> master_node
-	 *	  [3..n] -> slave_node(s)
+	 *	in the new map.
 	 */
-	for (i = 0; i < reply->elements; i++) {
-		size_t			j;
-		long long int		k;
+	for (i = 0; i < talloc_array_length(layout->range); i++) {
+		uint8_t			j;
+		unsigned int		k;
 		int			slaves = 0;
 		fr_redis_cluster_node_t		*found, *spare;
 		fr_redis_cluster_node_t		find = {}; /* Initialise unused fields to stop Coverity complaints */
 		fr_redis_cluster_key_slot_t	tmpl_slot;
-		redisReply		*map = reply->element[i];
+		cluster_range_t const	*range = &layout->range[i];
 
 		memset(&tmpl_slot, 0, sizeof(tmpl_slot));
 
-		SET_ADDR(find.addr, map->element[2]);
+		find.addr = range->master;
 		found = fr_rb_find(cluster->used_nodes, &find);
 		if (found) {
 			active[found->id] = true;
@@ -621,10 +669,6 @@ do { \
 
 		/*
 		 *	Process the master
-		 *
-		 *      A master node consists of any array with the following indexes:
-		 *	  [0] -> node ip (as string)
-		 *	  [1] -> node port
 		 */
 		spare = fr_fifo_peek(cluster->free_nodes);
 		if (!spare) {
@@ -636,6 +680,7 @@ do { \
 			cluster->last_updated = fr_time();
 			/* Re-insert new nodes back into the free_nodes queue */
 			for (i = 0; i < r; i++) SET_INACTIVE(&cluster->node[rollback[i]]);
+			talloc_free(map);
 			return rcode;
 		}
 
@@ -658,13 +703,9 @@ do { \
 
 		/*
 		 *	Process the slaves
-		 *
-		 *      A slave node consists of any array with the following indexes:
-		 *	  [0] -> node ip (as string)
-		 *	  [1] -> node port
 		 */
-		for (j = 3; (j < map->elements); j++) {
-			SET_ADDR(find.addr, map->element[j]);
+		for (j = 0; j < range->slave_num; j++) {
+			find.addr = range->slave[j];
 			found = fr_rb_find(cluster->used_nodes, &find);
 			if (found) {
 				active[found->id] = true;
@@ -682,35 +723,29 @@ do { \
 
 		next:
 			tmpl_slot.slave[slaves++] = found->id;
-
-			/* Hit the maximum number of slaves we allow */
-			if (slaves >= MAX_SLAVES) break;
 		}
 		tmpl_slot.slave_num = slaves;
 
 		/*
 		 *	Copy our tmpl key slot to each of the key slots
-		 *	specified by the range for this map.
+		 *	specified by the range.
 		 */
-		for (k = map->element[0]->integer; k <= map->element[1]->integer; k++) {
-			memcpy(&cluster->key_slot_pending[k], &tmpl_slot,
-			       sizeof(*(cluster->key_slot_pending)));
-		}
+		for (k = range->start; k <= range->end; k++) map->key_slot[k] = tmpl_slot;
 	}
 
 	/*
-	 *	Check for holes in the pending_addr key_slot array
+	 *	Check for holes in the new key_slot array
 	 *
 	 *	The cluster specification says that upon
 	 *	detecting a 'NULL' key_slot we should
 	 *	check again to see if the cluster error has
 	 *	been resolved, but seeing as we're in the
 	 *	middle of updating the cluster from very
-	 *	recent output of 'cluster slots' it's best to
+	 *	recent output of 'cluster shards' it's best to
 	 *	error out.
 	 */
 	for (i = 0; i < KEY_SLOTS; i++) {
-		if (cluster->key_slot_pending[i].master == 0) {
+		if (map->key_slot[i].master == 0) {
 			fr_strerror_printf("Cluster is misconfigured, no node assigned for key %zu", i);
 			rcode = FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 			goto error;
@@ -719,14 +754,22 @@ do { \
 
 	/*
 	 *	We have connections/pools for all the nodes in
-	 *	the new map, apply it to the live cluster.
+	 *	the new map, swap it in.
 	 *
-	 *	Other workers may be using the key slot table,
-	 *	but that's ok. Nodes and pools are never freed,
-	 *	so the worst that will happen, is they'll hit
-	 *	the wrong node for the key, and get redirected.
+	 *	Workers load the map with acquire semantics, so
+	 *	they always see a fully populated map.  Workers
+	 *	still using the old map may hit the wrong node
+	 *	for the key, and get redirected.  Nodes and pools
+	 *	are never freed, and the old map is only freed
+	 *	once every worker has been quiescent, so that's
+	 *	safe.
 	 */
-	memcpy(&cluster->key_slot, &cluster->key_slot_pending, sizeof(cluster->key_slot));
+	now = fr_time();
+	old = atomic_exchange_explicit(&cluster->map, map, memory_order_acq_rel);
+	if (fr_qsbr_retire(old, NULL) < 0) {
+		old->next = cluster->retired;
+		cluster->retired = old;
+	}
 
 	/*
 	 *	Anything not in the active set of nodes gets
@@ -760,7 +803,7 @@ do { \
 	}
 
 	cluster->remapping = false;
-	cluster->last_updated = fr_time();
+	cluster->last_updated = now;
 
 	/*
 	 *	Sanity checks
@@ -845,43 +888,34 @@ static int cluster_map_node_validate(redisReply *node, int map_idx, int node_idx
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
-/** Learn a new cluster layout by querying the node that issued the -MOVE
- *
- * Also validates the response from the Redis cluster, so we can be sure that
- * it's well formed, before doing more expensive operations.
+/** Convert the result of a command used to learn the cluster layout into a cluster rcode
  *
  * @note Errors may be retrieved with fr_strerror().
  *
- * @param[out] out Where to write cluster map.
- * @param[in] conn to use for learning the new cluster map.
+ * @param[in] conn		the command was issued on.
+ * @param[in,out] reply		to check.  Freed if the command wasn't successful.
  * @return
- *	- FR_REDIS_CLUSTER_RCODE_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
+ *	- FR_REDIS_CLUSTER_RCODE_IGNORED if the command returned an error (indicating clustering not supported).
  *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
  *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the command resulted in an error.
  *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION connection failure.
- *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
  */
-static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_t *conn)
+static fr_redis_cluster_rcode_t cluster_command_status(fr_redis_conn_t *conn, redisReply **reply)
 {
-	redisReply	*reply;
-	size_t		i = 0;
-
-	*out = NULL;
-
-	reply = redisCommand(conn->handle, "cluster slots");
-	switch (fr_redis_command_status(conn, reply)) {
+	switch (fr_redis_command_status(conn, *reply)) {
 	case REDIS_RCODE_RECONNECT:
-		fr_redis_reply_free(&reply);
+		fr_redis_reply_free(reply);
 		fr_strerror_const("No connections available");
 		return FR_REDIS_CLUSTER_RCODE_NO_CONNECTION;
 
 	case REDIS_RCODE_ERROR:
 	default:
-		if (reply && reply->type == REDIS_REPLY_ERROR) {
-			fr_strerror_printf("%.*s", (int)reply->len, reply->str);
-			fr_redis_reply_free(&reply);
+		if (*reply && ((*reply)->type == REDIS_REPLY_ERROR)) {
+			fr_strerror_printf("%.*s", (int)(*reply)->len, (*reply)->str);
+			fr_redis_reply_free(reply);
 			return FR_REDIS_CLUSTER_RCODE_IGNORED;
 		}
+		fr_redis_reply_free(reply);
 		fr_strerror_const("Unknown client error");
 		return FR_REDIS_CLUSTER_RCODE_FAILED;
 
@@ -889,6 +923,117 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 		break;
 	}
 
+	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+}
+
+/** Set a node address from the ip string and port returned by Redis
+ *
+ * @param[out] out	Where to write the address.
+ * @param[in] ip	string to parse.
+ * @param[in] port	the node is listening on.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT if the ip string was invalid.
+ */
+static fr_redis_cluster_rcode_t cluster_range_node_set(fr_socket_t *out, redisReply const *ip, long long port)
+{
+	if (fr_inet_pton(&out->inet.dst_ipaddr, ip->str, ip->len, AF_UNSPEC, true, true) < 0) {
+		return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+	}
+	out->inet.dst_port = port;
+
+	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+}
+
+static int _cluster_range_cmp(void const *one, void const *two)
+{
+	cluster_range_t const *a = one;
+	cluster_range_t const *b = two;
+
+	return CMP(a->start, b->start);
+}
+
+static uint32_t cluster_socket_hash(fr_socket_t const *sock, uint32_t hash)
+{
+	hash = fr_hash_update(&sock->inet.dst_ipaddr.addr,
+			      (sock->inet.dst_ipaddr.af == AF_INET) ?
+			      sizeof(sock->inet.dst_ipaddr.addr.v4) : sizeof(sock->inet.dst_ipaddr.addr.v6), hash);
+	return fr_hash_update(&sock->inet.dst_port, sizeof(sock->inet.dst_port), hash);
+}
+
+/** Sort the key slot ranges in a layout, and calculate its digest
+ *
+ * Nodes may return shards in any order, so the ranges are sorted before
+ * hashing, to allow layouts from different nodes to be compared.
+ *
+ * @param[in,out] layout to finalise.
+ */
+static void cluster_layout_digest(cluster_layout_t *layout)
+{
+	size_t		i, num = talloc_array_length(layout->range);
+	uint8_t		j;
+	uint32_t	hash;
+
+	qsort(layout->range, num, sizeof(*layout->range), _cluster_range_cmp);
+
+	hash = fr_hash(&num, sizeof(num));
+	for (i = 0; i < num; i++) {
+		cluster_range_t const *range = &layout->range[i];
+
+		hash = fr_hash_update(&range->start, sizeof(range->start), hash);
+		hash = fr_hash_update(&range->end, sizeof(range->end), hash);
+		hash = cluster_socket_hash(&range->master, hash);
+		for (j = 0; j < range->slave_num; j++) hash = cluster_socket_hash(&range->slave[j], hash);
+	}
+	layout->digest = hash;
+}
+
+/** Print a cluster layout
+ *
+ * @param[in] request	The current request.  May be NULL.
+ * @param[in] cluster	the layout was retrieved for.
+ * @param[in] layout	to print.
+ */
+static void cluster_layout_print(request_t *request, fr_redis_cluster_t *cluster, cluster_layout_t const *layout)
+{
+	size_t	i, num = talloc_array_length(layout->range);
+	uint8_t	j;
+	char	buffer[FR_IPADDR_STRLEN];
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "%s - Cluster map (epoch %" PRIu64 ") consists of %zu key ranges",
+		  cluster->log_prefix, layout->epoch, num);
+	for (i = 0; i < num; i++) {
+		cluster_range_t const *range = &layout->range[i];
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "%s - %zu - keys %u-%u", cluster->log_prefix, i, range->start, range->end);
+		ROPTIONAL(RDEBUG2, DEBUG2, "%s -  master: %s:%u", cluster->log_prefix,
+			  fr_inet_ntop(buffer, sizeof(buffer), &range->master.inet.dst_ipaddr),
+			  range->master.inet.dst_port);
+		for (j = 0; j < range->slave_num; j++) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "%s -  slave%u: %s:%u", cluster->log_prefix, j,
+				  fr_inet_ntop(buffer, sizeof(buffer), &range->slave[j].inet.dst_ipaddr),
+				  range->slave[j].inet.dst_port);
+		}
+	}
+}
+
+/** Validate the result of 'cluster slots' and convert it to a layout
+ *
+ * 'cluster slots' is deprecated, and is only used with Redis < 7.0, which doesn't
+ * support 'cluster shards'.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[in,out] layout	to populate.
+ * @param[in] reply		to 'cluster slots'.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
+ */
+static fr_redis_cluster_rcode_t cluster_layout_from_slots(cluster_layout_t *layout, redisReply *reply)
+{
+	size_t		i = 0;
+
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		fr_strerror_printf("Bad response to \"cluster slots\" command, expected array got %s",
 				   fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -904,7 +1049,7 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 	}
 
 	/*
-	 *	Validate the complete map set before returning.
+	 *	Validate the complete map set before converting it.
 	 */
 	for (i = 0; i < reply->elements; i++) {
 		size_t		j;
@@ -914,15 +1059,13 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 		if (map->type != REDIS_REPLY_ARRAY) {
 			fr_strerror_printf("Cluster map %zu is wrong type, expected array got %s",
 				   	   i, fr_table_str_by_value(redis_reply_types, map->type, "<UNKNOWN>"));
-		error:
-			fr_redis_reply_free(&reply);
 			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		if (map->elements < 3) {
 			fr_strerror_printf("Cluster map %zu has too few elements, expected at least 3, got %zu",
 					   i, map->elements);
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		/*
@@ -931,19 +1074,19 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 		if (map->element[0]->type != REDIS_REPLY_INTEGER) {
 			fr_strerror_printf("Cluster map %zu key slot start is wrong type, expected integer got %s",
 					   i, fr_table_str_by_value(redis_reply_types, map->element[0]->type, "<UNKNOWN>"));
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		if (map->element[0]->integer < 0) {
 			fr_strerror_printf("Cluster map %zu key slot start is too low, expected >= 0 got %lli",
 					   i, map->element[0]->integer);
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
-		if (map->element[0]->integer > KEY_SLOTS) {
-			fr_strerror_printf("Cluster map %zu key slot start is too high, expected <= "
+		if (map->element[0]->integer >= KEY_SLOTS) {
+			fr_strerror_printf("Cluster map %zu key slot start is too high, expected < "
 					   STRINGIFY(KEY_SLOTS) " got %lli", i, map->element[0]->integer);
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		/*
@@ -952,66 +1095,367 @@ static fr_redis_cluster_rcode_t cluster_map_get(redisReply **out, fr_redis_conn_
 		if (map->element[1]->type != REDIS_REPLY_INTEGER) {
 			fr_strerror_printf("Cluster map %zu key slot end is wrong type, expected integer got %s",
 					   i, fr_table_str_by_value(redis_reply_types, map->element[1]->type, "<UNKNOWN>"));
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		if (map->element[1]->integer < 0) {
 			fr_strerror_printf("Cluster map %zu key slot end is too low, expected >= 0 got %lli",
 					   i, map->element[1]->integer);
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
-		if (map->element[1]->integer > KEY_SLOTS) {
-			fr_strerror_printf("Cluster map %zu key slot end is too high, expected <= "
+		if (map->element[1]->integer >= KEY_SLOTS) {
+			fr_strerror_printf("Cluster map %zu key slot end is too high, expected < "
 					   STRINGIFY(KEY_SLOTS) " got %lli", i, map->element[1]->integer);
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		if (map->element[1]->integer < map->element[0]->integer) {
 			fr_strerror_printf("Cluster map %zu key slot start/end out of order.  "
 					   "Start was %lli, end was %lli", i, map->element[0]->integer,
 					   map->element[1]->integer);
-			goto error;
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 		}
 
 		/*
 		 *	Master node
 		 */
-		if (cluster_map_node_validate(map->element[2], i, 0) < 0) goto error;
+		if (cluster_map_node_validate(map->element[2], i, 0) < 0) return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
 
 		/*
 		 *	Slave nodes
 		 */
 		for (j = 3; j < map->elements; j++) {
-			if (cluster_map_node_validate(map->element[j], i, j - 2) < 0) goto error;
+			if (cluster_map_node_validate(map->element[j], i, j - 2) < 0) return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+		}
+	}
+
+	/*
+	 *	A map consists of an array with the following indexes:
+	 *	  [0]    -> key_slot_start
+	 *	  [1]    -> key_slot_end
+	 *	  [2]    -> master_node
+	 *	  [3..n] -> slave_node(s)
+	 *
+	 *	A node consists of an array with the following indexes:
+	 *	  [0] -> node ip (as string)
+	 *	  [1] -> node port
+	 */
+	MEM(layout->range = talloc_zero_array(layout, cluster_range_t, reply->elements));
+	for (i = 0; i < reply->elements; i++) {
+		size_t		j;
+		redisReply	*map = reply->element[i];
+		cluster_range_t	*range = &layout->range[i];
+
+		range->start = map->element[0]->integer;
+		range->end = map->element[1]->integer;
+		(void) cluster_range_node_set(&range->master, map->element[2]->element[0],
+					      map->element[2]->element[1]->integer);
+
+		for (j = 3; (j < map->elements) && (range->slave_num < MAX_SLAVES); j++) {
+			(void) cluster_range_node_set(&range->slave[range->slave_num++], map->element[j]->element[0],
+						      map->element[j]->element[1]->integer);
 		}
 	}
-	*out = reply;
 
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
-/** Perform a runtime remap of the cluster
+/** Find the value of a field in a flattened key/value array
+ *
+ * 'cluster shards' describes shards and nodes as arrays of alternating
+ * field names and values.
+ *
+ * @param[in] obj	to search in.
+ * @param[in] name	of the field to find.
+ * @return
+ *	- The value of the field.
+ *	- NULL if obj isn't an array, or the field wasn't found.
+ */
+static redisReply *cluster_reply_field(redisReply const *obj, char const *name)
+{
+	size_t i, len = strlen(name);
+
+	if (obj->type != REDIS_REPLY_ARRAY) return NULL;
+
+	for (i = 0; (i + 1) < obj->elements; i += 2) {
+		redisReply const *field = obj->element[i];
+
+		if (field->type != REDIS_REPLY_STRING) continue;
+		if ((field->len == len) && (memcmp(field->str, name, len) == 0)) return obj->element[i + 1];
+	}
+
+	return NULL;
+}
+
+/** Validate the result of 'cluster shards' and convert it to a layout
+ *
+ * Shard structure
+ @verbatim
+   [0] -> shard 0
+       "slots" -> [ key_slot_start, key_slot_end, ... ]
+       "nodes" -> [
+           [0] -> node 0
+               "ip" -> ip (string)
+               "port" -> port (number)
+               "tls-port" -> port (number, if TLS is enabled)
+               "role" -> "master" | "replica"
+               "health" -> "online" | "failed" | "loading"
+           ...
+       ]
+   [n] -> shard n
+ @endverbatim
+ *
+ * Replicas which aren't online are excluded from the layout, as they
+ * can't serve reads.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[in,out] layout	to populate.
+ * @param[in] reply		to 'cluster shards'.
+ * @param[in] use_tls		Use the TLS port of each node.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
+ */
+static fr_redis_cluster_rcode_t cluster_layout_from_shards(cluster_layout_t *layout, redisReply *reply, bool use_tls)
+{
+	size_t		i, j, k, num = 0;
+
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		fr_strerror_printf("Bad response to \"cluster shards\" command, expected array got %s",
+				   fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+	}
+
+	/*
+	 *	Count the ranges first, a shard may own
+	 *	more than one.
+	 */
+	for (i = 0; i < reply->elements; i++) {
+		redisReply *slots = cluster_reply_field(reply->element[i], "slots");
+
+		if (!slots || (slots->type != REDIS_REPLY_ARRAY) || (slots->elements % 2)) {
+			fr_strerror_printf("Cluster shard %zu has missing or malformed slots", i);
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+		}
+		num += slots->elements / 2;
+	}
+
+	/*
+	 *	Clustering configured but no slots set
+	 */
+	if (num == 0) {
+		fr_strerror_const("No key slots assigned in response to \"cluster shards\" command");
+		return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+	}
+
+	MEM(layout->range = talloc_zero_array(layout, cluster_range_t, num));
+
+	for (i = 0, k = 0; i < reply->elements; i++) {
+		redisReply	*slots = cluster_reply_field(reply->element[i], "slots");
+		redisReply	*nodes = cluster_reply_field(reply->element[i], "nodes");
+		cluster_range_t	tmpl = {};
+		bool		have_master = false, master_online = false;
+
+		if (slots->elements == 0) continue;	/* Shard doesn't own any key slots */
+
+		if (!nodes || (nodes->type != REDIS_REPLY_ARRAY)) {
+			fr_strerror_printf("Cluster shard %zu has missing or malformed nodes", i);
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+		}
+
+		for (j = 0; j < nodes->elements; j++) {
+			redisReply	*node = nodes->element[j];
+			redisReply	*ip, *port = NULL, *role, *health;
+			fr_socket_t	addr = {};
+			bool		online;
+
+			ip = cluster_reply_field(node, "ip");
+			if (use_tls) port = cluster_reply_field(node, "tls-port");
+			if (!port) port = cluster_reply_field(node, "port");
+			role = cluster_reply_field(node, "role");
+			health = cluster_reply_field(node, "health");
+
+			if (!ip || (ip->type != REDIS_REPLY_STRING) ||
+			    !port || (port->type != REDIS_REPLY_INTEGER) ||
+			    !role || (role->type != REDIS_REPLY_STRING)) {
+				fr_strerror_printf("Cluster shard %zu node %zu is missing ip, port or role", i, j);
+				return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+			}
+
+			if ((port->integer <= 0) || (port->integer > UINT16_MAX)) {
+				fr_strerror_printf("Cluster shard %zu node %zu port is out of range, got %lli",
+						   i, j, port->integer);
+				return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+			}
+
+			if (cluster_range_node_set(&addr, ip, port->integer) < 0) return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+
+			online = !health || ((health->type == REDIS_REPLY_STRING) && (strcmp(health->str, "online") == 0));
+
+			if (strcmp(role->str, "master") == 0) {
+				/*
+				 *	A failed master may still be listed
+				 *	alongside its replacement, prefer the
+				 *	one that's online.
+				 */
+				if (have_master && (master_online || !online)) continue;
+
+				tmpl.master = addr;
+				have_master = true;
+				master_online = online;
+				continue;
+			}
+
+			if (!online || (tmpl.slave_num >= MAX_SLAVES)) continue;
+
+			tmpl.slave[tmpl.slave_num++] = addr;
+		}
+
+		if (!have_master) {
+			fr_strerror_printf("Cluster shard %zu owns key slots, but has no master", i);
+			return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+		}
+
+		for (j = 0; j < slots->elements; j += 2) {
+			redisReply *start = slots->element[j], *end = slots->element[j + 1];
+
+			if ((start->type != REDIS_REPLY_INTEGER) || (end->type != REDIS_REPLY_INTEGER) ||
+			    (start->integer < 0) || (end->integer >= KEY_SLOTS) || (end->integer < start->integer)) {
+				fr_strerror_printf("Cluster shard %zu has an invalid key slot range", i);
+				return FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+			}
+
+			layout->range[k] = tmpl;
+			layout->range[k].start = start->integer;
+			layout->range[k].end = end->integer;
+			k++;
+		}
+	}
+
+	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+}
+
+/** Learn the current cluster layout by querying a node
+ *
+ * Also validates the response from the Redis cluster, so we can be sure that
+ * it's well formed, before doing more expensive operations.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ *
+ * @param[in] ctx	to allocate the layout in.
+ * @param[out] out	Where to write the cluster layout.
+ * @param[in] cluster	the node belongs to.
+ * @param[in] conn	to use for learning the new cluster layout.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_IGNORED if 'cluster info' returned an error (indicating clustering not supported).
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the command resulted in an error.
+ *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION connection failure.
+ *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
+ */
+static fr_redis_cluster_rcode_t cluster_map_get(TALLOC_CTX *ctx, cluster_layout_t **out,
+						fr_redis_cluster_t *cluster, fr_redis_conn_t *conn)
+{
+	redisReply		*reply;
+	cluster_layout_t	*layout;
+	fr_redis_cluster_rcode_t rcode;
+	char const		*p;
+
+	*out = NULL;
+
+	MEM(layout = talloc_zero(ctx, cluster_layout_t));
+
+	/*
+	 *	The config epoch increases every time a failover
+	 *	occurs or key slots are migrated, so it tells us
+	 *	whether this node's view of the cluster is older
+	 *	than the one we already have.
+	 */
+	reply = redisCommand(conn->handle, "cluster info");
+	rcode = cluster_command_status(conn, &reply);
+	if (rcode != FR_REDIS_CLUSTER_RCODE_SUCCESS) goto error;
+
+	if ((reply->type != REDIS_REPLY_STRING)
+#if HIREDIS_MAJOR >= 1
+	    && (reply->type != REDIS_REPLY_VERB)
+#endif
+	    ) {
+		fr_strerror_printf("Bad response to \"cluster info\" command, expected string got %s",
+				   fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		rcode = FR_REDIS_CLUSTER_RCODE_BAD_INPUT;
+		goto error;
+	}
+
+	p = strstr(reply->str, "cluster_current_epoch:");
+	if (p) layout->epoch = strtoull(p + sizeof("cluster_current_epoch:") - 1, NULL, 10);
+	fr_redis_reply_free(&reply);
+
+	reply = redisCommand(conn->handle, "cluster shards");
+	rcode = cluster_command_status(conn, &reply);
+	switch (rcode) {
+	case FR_REDIS_CLUSTER_RCODE_SUCCESS:
+		rcode = cluster_layout_from_shards(layout, reply, cluster->conf->use_tls);
+		break;
+
+	/*
+	 *	Redis < 7.0, fall back to the deprecated command
+	 */
+	case FR_REDIS_CLUSTER_RCODE_IGNORED:
+		reply = redisCommand(conn->handle, "cluster slots");
+		rcode = cluster_command_status(conn, &reply);
+		if (rcode != FR_REDIS_CLUSTER_RCODE_SUCCESS) goto error;
+
+		rcode = cluster_layout_from_slots(layout, reply);
+		break;
+
+	default:
+		goto error;
+	}
+	fr_redis_reply_free(&reply);
+
+	if (rcode != FR_REDIS_CLUSTER_RCODE_SUCCESS) {
+	error:
+		fr_redis_reply_free(&reply);
+		talloc_free(layout);
+		return rcode;
+	}
+
+	cluster_layout_digest(layout);
+	*out = layout;
+
+	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+}
+
+/** Perform a remap of the cluster
+ *
+ * Retrieves the current layout from the node conn is connected to.  Layouts from
+ * nodes with an older cluster epoch than the current map are ignored, and layouts
+ * identical to the current map aren't reapplied.
  *
  * @note Errors may be retrieved with fr_strerror().
  * @note Must be called with the cluster mutex free.
+ * @note At runtime this is usually called from the refresh thread.  Workers should call
+ *	#fr_redis_cluster_refresh instead.
  *
- * @param[in] request The current request.
+ * @param[in] request The current request.  May be NULL.
  * @param[in,out] cluster to remap.
  * @param[in] conn to use to query the cluster.
  * @return
- *	- FR_REDIS_CLUSTER_RCODE_IGNORED if 'cluster slots' returned an error (indicating clustering not supported).
+ *	- FR_REDIS_CLUSTER_RCODE_IGNORED if 'cluster info' returned an error (indicating clustering not supported),
+ *	  or the node's view of the cluster is older than ours.
  *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
- *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the 'cluster slots' command resulted in a protocol error.
+ *	- FR_REDIS_CLUSTER_RCODE_FAILED if issuing the commands resulted in a protocol error.
  *	- FR_REDIS_CLUSTER_RCODE_NO_CONNECTION connection failure.
  *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT on validation failure (bad data returned from Redis).
  */
 fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_cluster_t *cluster, fr_redis_conn_t *conn)
 {
-	fr_time_t	now;
-	redisReply	*map;
+	fr_time_t		now;
+	cluster_layout_t	*layout;
+	cluster_map_t		*current;
 	fr_redis_cluster_rcode_t	ret;
-	size_t		i, j;
 
 	/*
 	 *	If the cluster was remapped very recently, or is being
@@ -1033,12 +1477,12 @@ fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_clu
 		return FR_REDIS_CLUSTER_RCODE_IGNORED;
 	}
 
-	ROPTIONAL(RINFO, INFO, "Initiating cluster remap");
+	ROPTIONAL(RDEBUG2, DEBUG2, "%s - Retrieving cluster map", cluster->log_prefix);
 
 	/*
 	 *	Get new cluster information
 	 */
-	ret = cluster_map_get(&map, conn);
+	ret = cluster_map_get(NULL, &layout, cluster, conn);
 	switch (ret) {
 	case FR_REDIS_CLUSTER_RCODE_BAD_INPUT:		/* Validation error */
 	case FR_REDIS_CLUSTER_RCODE_NO_CONNECTION:		/* Connection error */
@@ -1053,28 +1497,7 @@ fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_clu
 		break;
 	}
 
-	/*
-	 *	Print the mapping we received
-	 */
-	ROPTIONAL(RINFO, INFO, "Cluster map consists of %zu key ranges", map->elements);
-	for (i = 0; i < map->elements; i++) {
-		redisReply *map_node = map->element[i];
-
-		ROPTIONAL(RINFO, INFO, "%zu - keys %lli-%lli", i,
-			  map_node->element[0]->integer,
-			  map_node->element[1]->integer);
-
-		if (request) RINDENT();
-		ROPTIONAL(RINFO, INFO, "master: %s:%lli",
-			  map_node->element[2]->element[0]->str,
-			  map_node->element[2]->element[1]->integer);
-		for (j = 3; j < map_node->elements; j++) {
-			ROPTIONAL(RINFO, INFO, "slave%zu: %s:%lli", j - 3,
-				  map_node->element[j]->element[0]->str,
-				  map_node->element[j]->element[1]->integer);
-		}
-		if (request) REXDENT();
-	}
+	cluster_layout_print(request, cluster, layout);
 
 	/*
 	 *	Check again that the cluster isn't being
@@ -1085,24 +1508,214 @@ fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_clu
 	pthread_mutex_lock(&cluster->mutex);
 	if (cluster->remapping) {
 		pthread_mutex_unlock(&cluster->mutex);
-		fr_redis_reply_free(&map);	/* Free the map */
+		talloc_free(layout);
 		goto in_progress;
 	}
 	if (fr_time_to_sec(now) == fr_time_to_sec(cluster->last_updated)) {
 		pthread_mutex_unlock(&cluster->mutex);
-		fr_redis_reply_free(&map);	/* Free the map */
+		talloc_free(layout);
 		goto too_soon;
 	}
-	ret = cluster_map_apply(cluster, map);
+
+	/*
+	 *	A node which hasn't yet learned about the latest
+	 *	failover or slot migration reports an older epoch.
+	 *	Don't let it roll the map back.
+	 */
+	current = atomic_load_explicit(&cluster->map, memory_order_acquire);
+	if (layout->epoch < current->epoch) {
+		pthread_mutex_unlock(&cluster->mutex);
+		ROPTIONAL(RWARN, WARN, "%s - Node reported cluster epoch %" PRIu64 ", older than current epoch %" PRIu64
+			  ", ignoring its map", cluster->log_prefix, layout->epoch, current->epoch);
+		talloc_free(layout);
+		return FR_REDIS_CLUSTER_RCODE_IGNORED;
+	}
+
+	/*
+	 *	Nothing has changed, don't churn the nodes.
+	 */
+	if ((layout->epoch == current->epoch) && (layout->digest == current->digest)) {
+		cluster->remap_needed = false;
+		cluster->last_updated = now;
+		pthread_mutex_unlock(&cluster->mutex);
+		ROPTIONAL(RDEBUG2, DEBUG2, "%s - Cluster map unchanged", cluster->log_prefix);
+		talloc_free(layout);
+		return FR_REDIS_CLUSTER_RCODE_SUCCESS;
+	}
+
+	ROPTIONAL(RINFO, INFO, "%s - Applying cluster map (epoch %" PRIu64 ")", cluster->log_prefix, layout->epoch);
+
+	ret = cluster_map_apply(cluster, layout);
 	if (ret == FR_REDIS_CLUSTER_RCODE_SUCCESS) cluster->remap_needed = false;	/* Change on successful remap */
 	pthread_mutex_unlock(&cluster->mutex);
 
-	fr_redis_reply_free(&map);	/* Free the map */
+	talloc_free(layout);
 	if (ret < 0) return FR_REDIS_CLUSTER_RCODE_FAILED;
 
 	return FR_REDIS_CLUSTER_RCODE_SUCCESS;
 }
 
+/** Remap the cluster using a connection to any live node
+ *
+ * @param[in] cluster	to remap.
+ */
+static void cluster_refresh(fr_redis_cluster_t *cluster)
+{
+	uint8_t				ids[UINT8_MAX];
+	unsigned int			num = 0, first, i;
+	fr_redis_cluster_node_t		*node;
+	fr_rb_iter_inorder_t		iter;
+
+	pthread_mutex_lock(&cluster->mutex);
+	for (node = fr_rb_iter_init_inorder(&iter, cluster->used_nodes);
+	     node;
+	     node = fr_rb_iter_next_inorder(&iter)) ids[num++] = node->id;
+	pthread_mutex_unlock(&cluster->mutex);
+
+	if (num == 0) return;
+
+	/*
+	 *	Start at a random node so we don't always
+	 *	query the same one.
+	 */
+	first = fr_rand() % num;
+	for (i = 0; i < num; i++) {
+		fr_redis_conn_t *conn;
+
+		node = &cluster->node[ids[(first + i) % num]];
+		conn = fr_pool_connection_get(node->pool, NULL);
+		if (!conn) continue;
+
+		switch (fr_redis_cluster_remap(NULL, cluster, conn)) {
+		case FR_REDIS_CLUSTER_RCODE_NO_CONNECTION:
+			fr_pool_connection_close(node->pool, NULL, conn);
+			continue;
+
+		case FR_REDIS_CLUSTER_RCODE_BAD_INPUT:
+		case FR_REDIS_CLUSTER_RCODE_FAILED:
+			PWARN("%s - Remapping cluster using %s:%i failed", cluster->log_prefix,
+			      node->name, node->addr.inet.dst_port);
+			fr_pool_connection_release(node->pool, NULL, conn);
+			continue;
+
+		case FR_REDIS_CLUSTER_RCODE_IGNORED:
+		case FR_REDIS_CLUSTER_RCODE_SUCCESS:
+			fr_pool_connection_release(node->pool, NULL, conn);
+			return;
+		}
+	}
+}
+
+/** Perform remaps requested by workers, or needed because nodes are unreachable
+ *
+ */
+static void *cluster_refresh_thread(void *arg)
+{
+	fr_redis_cluster_t	*cluster = arg;
+	fr_time_t		last = fr_time_wrap(0);
+
+	while (!atomic_load(&cluster->refresh_stop)) {
+		struct timespec	ts;
+		fr_time_t	now = fr_time();
+		bool		pending = atomic_load(&cluster->refresh_pending) || cluster->remap_needed;
+
+		/*
+		 *	Remaps are limited to one per second, and we don't
+		 *	want to hammer the cluster if none of the nodes
+		 *	are responding.
+		 */
+		if (pending &&
+		    (fr_time_to_sec(now) != fr_time_to_sec(cluster->last_updated)) &&
+		    fr_time_delta_gteq(fr_time_sub(now, last), fr_time_delta_from_sec(1))) {
+			atomic_store(&cluster->refresh_pending, false);
+			cluster_refresh(cluster);
+			last = now;
+			continue;
+		}
+
+		/*
+		 *	If a remap is pending, poll until we're allowed
+		 *	to perform it.  Otherwise sleep until a worker
+		 *	requests one, checking remap_needed occasionally.
+		 */
+		pthread_mutex_lock(&cluster->refresh_mutex);
+		if (!atomic_load(&cluster->refresh_stop) && (pending || !atomic_load(&cluster->refresh_pending))) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			if (pending) {
+				ts.tv_nsec += CLUSTER_REFRESH_POLL * 1000 * 1000;
+				if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000 * 1000 * 1000;
+				}
+			} else {
+				ts.tv_sec++;
+			}
+			pthread_cond_timedwait(&cluster->refresh_cond, &cluster->refresh_mutex, &ts);
+		}
+		pthread_mutex_unlock(&cluster->refresh_mutex);
+	}
+
+	return NULL;
+}
+
+/** Start the thread which performs remaps in the background
+ *
+ * @param[in] cluster	to start the refresh thread for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int cluster_refresh_start(fr_redis_cluster_t *cluster)
+{
+	sigset_t	set, old;
+	int		ret;
+
+	pthread_mutex_init(&cluster->refresh_mutex, NULL);
+	pthread_cond_init(&cluster->refresh_cond, NULL);
+
+	/*
+	 *	Signals should be handled by the main thread.
+	 */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	ret = pthread_create(&cluster->refresh_thread, NULL, cluster_refresh_thread, cluster);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		fr_strerror_printf("Failed creating cluster refresh thread: %s", fr_syserror(ret));
+		pthread_cond_destroy(&cluster->refresh_cond);
+		pthread_mutex_destroy(&cluster->refresh_mutex);
+		return -1;
+	}
+	cluster->refresh_running = true;
+
+	return 0;
+}
+
+/** Request a remap of the cluster in the background
+ *
+ * Returns immediately.  The caller should continue using the current map, and
+ * following redirects, until the refresh thread applies the new map.
+ *
+ * @param[in] cluster	to remap.
+ * @return
+ *	- true if the remap was queued.
+ *	- false if there's no refresh thread, and the caller should call
+ *	  #fr_redis_cluster_remap itself.
+ */
+bool fr_redis_cluster_refresh(fr_redis_cluster_t *cluster)
+{
+	if (!cluster->refresh_running) return false;
+
+	if (atomic_exchange(&cluster->refresh_pending, true)) return true;	/* Already queued */
+
+	pthread_mutex_lock(&cluster->refresh_mutex);
+	pthread_cond_signal(&cluster->refresh_cond);
+	pthread_mutex_unlock(&cluster->refresh_mutex);
+
+	return true;
+}
+
 /** Retrieve or associate a node with the server indicated in the redirect
  *
  * @note Errors may be retrieved with fr_strerror().
@@ -1127,7 +1740,7 @@ static fr_redis_cluster_rcode_t cluster_redirect(fr_redis_cluster_node_t **out,
 
 	*out = NULL;
 
-	if (cluster_node_conf_from_redirect(&key, &find.addr, reply) < 0) return FR_REDIS_CLUSTER_RCODE_FAILED;
+	if (fr_redis_cluster_node_addr_from_redirect(&key, &find.addr, reply) < 0) return FR_REDIS_CLUSTER_RCODE_FAILED;
 
 	pthread_mutex_lock(&cluster->mutex);
 	/*
@@ -1603,13 +2216,14 @@ void *fr_redis_cluster_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delt
 fr_redis_cluster_key_slot_t const *fr_redis_cluster_slot_by_key(fr_redis_cluster_t *cluster, request_t *request,
 								uint8_t const *key, size_t key_len)
 {
-	fr_redis_cluster_key_slot_t *key_slot;
+	cluster_map_t	*map = atomic_load_explicit(&cluster->map, memory_order_acquire);
+	uint16_t	slot;
 
 	if (!key || (key_len == 0)) {
-		key_slot = &cluster->key_slot[(uint16_t)(fr_rand() & (KEY_SLOTS - 1))];
-		ROPTIONAL(RDEBUG2, DEBUG2, "Key rand() -> slot %zu", key_slot - cluster->key_slot);
+		slot = fr_rand() & (KEY_SLOTS - 1);
+		ROPTIONAL(RDEBUG2, DEBUG2, "Key rand() -> slot %u", slot);
 
-		return key_slot;
+		return &map->key_slot[slot];
 	}
 
 	/*
@@ -1617,15 +2231,15 @@ fr_redis_cluster_key_slot_t const *fr_redis_cluster_slot_by_key(fr_redis_cluster
 	 *	without clustering.
 	 */
 	if (fr_rb_num_elements(cluster->used_nodes) > 1) {
-		key_slot = &cluster->key_slot[cluster_key_hash(key, key_len)];
-		ROPTIONAL(RDEBUG2, DEBUG2, "Key \"%pV\" -> slot %zu",
-			  fr_box_strvalue_len((char const *)key, key_len), key_slot - cluster->key_slot);
+		slot = cluster_key_hash(key, key_len);
+		ROPTIONAL(RDEBUG2, DEBUG2, "Key \"%pV\" -> slot %u",
+			  fr_box_strvalue_len((char const *)key, key_len), slot);
 
-		return key_slot;
+		return &map->key_slot[slot];
 	}
 	ROPTIONAL(RDEBUG3, DEBUG3, "Single node available, skipping key selection");
 
-	return &cluster->key_slot[0];
+	return &map->key_slot[0];
 }
 
 /** Return the master node that would be used for a particular key
@@ -1661,6 +2275,87 @@ fr_redis_cluster_node_t const *fr_redis_cluster_slave(fr_redis_cluster_t *cluste
 	return &cluster->node[key_slot->slave[slave_num]];
 }
 
+/** Find the slave with the lowest round trip time for a key slot
+ *
+ * Slaves we've not heard from yet have a round trip time of 0, so they're
+ * preferred, and we learn their latency.
+ *
+ * @param[in] cluster		To resolve key in.
+ * @param[in] key_slot		To select a slave for.
+ * @return
+ *	- Index of the slave in the key slot.
+ *	- -1 if the key slot has no slaves.
+ */
+static int cluster_replica_select(fr_redis_cluster_t *cluster, fr_redis_cluster_key_slot_t const *key_slot)
+{
+	uint64_t	best_rtt = UINT64_MAX;
+	uint8_t		first, i;
+	int		best = -1;
+
+	if (key_slot->slave_num == 0) return -1;
+
+	/*
+	 *	Start at a random offset so slaves
+	 *	with equal latencies share the load.
+	 */
+	first = fr_rand() % key_slot->slave_num;
+	for (i = 0; i < key_slot->slave_num; i++) {
+		uint8_t		idx = (first + i) % key_slot->slave_num;
+		uint64_t	rtt = atomic_load_explicit(&cluster->node[key_slot->slave[idx]].rtt, memory_order_relaxed);
+
+		if (rtt < best_rtt) {
+			best_rtt = rtt;
+			best = idx;
+		}
+	}
+
+	return best;
+}
+
+/** Return the replica that a read only command for a particular key should be sent to
+ *
+ * @param[in] cluster		To resolve key in.
+ * @param[in] key_slot		To resolve to node.
+ * @return
+ *	- The slave with the lowest round trip time.
+ *	- NULL if read_replicas is disabled, or no slaves are assigned to the key slot.
+ */
+fr_redis_cluster_node_t const *fr_redis_cluster_replica_select(fr_redis_cluster_t *cluster,
+							       fr_redis_cluster_key_slot_t const *key_slot)
+{
+	int idx;
+
+	if (!cluster->conf->read_replicas) return NULL;
+
+	idx = cluster_replica_select(cluster, key_slot);
+	if (idx < 0) return NULL;
+
+	return &cluster->node[key_slot->slave[idx]];
+}
+
+/** Record how long a node took to respond to a command
+ *
+ * Maintains an exponentially weighted moving average of the round trip time,
+ * which is used to select replicas.
+ *
+ * @param[in] node	that responded.
+ * @param[in] rtt	time between sending the command and receiving the reply.
+ */
+void fr_redis_cluster_node_rtt_update(fr_redis_cluster_node_t const *node, fr_time_delta_t rtt)
+{
+	fr_redis_cluster_node_t	*n = UNCONST(fr_redis_cluster_node_t *, node);
+	uint64_t		sample, old, new;
+
+	sample = fr_time_delta_ispos(rtt) ? (uint64_t)fr_time_delta_unwrap(rtt) : 1;
+
+	old = atomic_load_explicit(&n->rtt, memory_order_relaxed);
+	do {
+		new = old ? (old - (old >> 3) + (sample >> 3)) : sample;	/* 1/8 weight, as TCP uses */
+		if (new == 0) new = 1;						/* 0 means unmeasured */
+	} while (!atomic_compare_exchange_weak_explicit(&n->rtt, &old, new,
+							memory_order_relaxed, memory_order_relaxed));
+}
+
 /** Return the ipaddr of a particular node
  *
  * @param[out] out	Ipaddr of the node.
@@ -1732,8 +2427,8 @@ int fr_redis_cluster_port(uint16_t *out, fr_redis_cluster_node_t const *node)
  * @param[in] key to resolve to a cluster node/pool. If no key is NULL or key_len is 0 a random
  *	slot will be chosen.
  * @param[in] key_len Length of the key.
- * @param[in] read_only If true, will use random slave pool in preference to the master, falling
- *	back to the master if no slaves are available.
+ * @param[in] read_only If true, will use the slave with the lowest round trip time in preference
+ *	to the master, falling back to other slaves, then the master.
  * @return
  *	- REDIS_RCODE_TRY_AGAIN - try your command with this connection (provided via command).
  *	- REDIS_RCODE_RECONNECT - when no additional connections available.
@@ -1744,7 +2439,8 @@ fr_redis_rcode_t fr_redis_cluster_state_init(fr_redis_cluster_state_t *state, fr
 {
 	fr_redis_cluster_node_t			*node;
 	fr_redis_cluster_key_slot_t const	*key_slot;
-	uint8_t					first, i;
+	int					first;
+	uint8_t					i;
 	uint64_t				used_nodes;
 
 	fr_assert(cluster);
@@ -1767,8 +2463,7 @@ again:
 	 *	1. Try each of the slaves for the key slot
 	 *	2. Fall through to trying the master, and a single alternate node.
 	 */
-	if (read_only) {
-		first = fr_rand() & key_slot->slave_num;
+	if (read_only && ((first = cluster_replica_select(cluster, key_slot)) >= 0)) {
 		for (i = 0; i < key_slot->slave_num; i++) {
 			uint8_t node_id;
 
@@ -1776,8 +2471,9 @@ again:
 			node = &cluster->node[node_id];
 			*conn = fr_pool_connection_get(node->pool, request);
 			if (!*conn) {
-				ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (key slot %zu slave %i)",
-					  node->id, key_slot - cluster->key_slot, (first + i) % key_slot->slave_num);
+				ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (slave %i)",
+					  node->id, (first + i) % key_slot->slave_num);
+				fr_redis_cluster_node_rtt_update(node, fr_time_delta_from_msec(RTT_FAILED));
 				cluster->remap_needed = true;
 				continue;	/* Continue until we find a live pool */
 			}
@@ -1796,8 +2492,7 @@ again:
 	node = &cluster->node[key_slot->master];
 	*conn = fr_pool_connection_get(node->pool, request);
 	if (!*conn) {
-		ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (key slot %zu master)",
-			  node->id, key_slot - cluster->key_slot);
+		ROPTIONAL(RDEBUG2, DEBUG2, "[%i] No connections available (master)", node->id);
 		cluster->remap_needed = true;
 
 		if (cluster_node_find_live(&node, conn, request, cluster, node) < 0) return REDIS_RCODE_RECONNECT;
@@ -1805,9 +2500,11 @@ again:
 
 finish:
 	/*
-	 *	Something set the remap_needed flag, and we have a live connection
+	 *	Something set the remap_needed flag.  If the refresh
+	 *	thread is running it'll deal with it, otherwise
+	 *	remap now we have a live connection.
 	 */
-	if (cluster->remap_needed) {
+	if (cluster->remap_needed && !fr_redis_cluster_refresh(cluster)) {
 		if (fr_redis_cluster_remap(request, cluster, *conn) == FR_REDIS_CLUSTER_RCODE_SUCCESS) {
 			fr_pool_connection_release(node->pool, request, *conn);
 			goto again;	/* New map, try again */
@@ -1818,6 +2515,7 @@ finish:
 	state->node = node;
 	state->key = key;
 	state->key_len = key_len;
+	state->sent = fr_time();
 
 	ROPTIONAL(RDEBUG2, DEBUG2, "[%i] >>> Sending command(s) to %s:%i",
 		  state->node->id, state->node->name, state->node->addr.inet.dst_port);
@@ -1829,12 +2527,12 @@ finish:
  *
  * Will process reconnect and redirect states performing the actions necessary.
  *
- * - May trigger a cluster remap on receiving a #REDIS_RCODE_MOVE status.
+ * - May request a cluster remap on receiving a #REDIS_RCODE_MOVE status.
  * - May perform a temporary redirect on receiving a #REDIS_RCODE_ASK status.
  * - May reserve a new connection on receiving a #REDIS_RCODE_RECONNECT status.
  *
- * If a remap is in progress, has occurred within the last second, has recently failed,
- * or fails, the '-MOVE' will be treated as a temporary redirect (-ASK).
+ * Remaps are performed in the background, so the '-MOVE' will be treated as a temporary
+ * redirect (-ASK) until the new map is applied.
  *
  * This allows the server to be more responsive during remaps, as unless the worker has been
  * redirected to a node we don't currently have a pool for, it can grab a connection for the
@@ -1872,6 +2570,14 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
  	ROPTIONAL(RDEBUG2, DEBUG2, "[%i] <<< Returned: %s",
  		  state->node->id, fr_table_str_by_value(redis_rcodes, status, "<UNKNOWN>"));
 
+	/*
+	 *	Dead connections tell us nothing about
+	 *	the node's latency.
+	 */
+	if (status != REDIS_RCODE_RECONNECT) {
+		fr_redis_cluster_node_rtt_update(state->node, fr_time_sub(fr_time(), state->sent));
+	}
+
 	/*
 	 *	Caller indicated we should close the connection
 	 */
@@ -1887,7 +2593,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 	 *	has set the remap_needed flag, do that now before
 	 *	releasing the connection.
 	 */
-	if (cluster->remap_needed && *conn) switch(status) {
+	if (cluster->remap_needed && *conn && !fr_redis_cluster_refresh(cluster)) switch(status) {
 	case REDIS_RCODE_MOVE:		/* We're going to remap anyway */
 	case REDIS_RCODE_RECONNECT:	/* The connection's dead */
 		break;
@@ -1980,13 +2686,14 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 		goto try_again;
 
 	/*
-	 *	-MOVE is treated identically to -ASK, except it may
-	 *	trigger a cluster remap.
+	 *	-MOVE is treated identically to -ASK, except it
+	 *	requests a cluster remap.
 	 */
 	case REDIS_RCODE_MOVE:
 		fr_assert(*reply);
 
-		if (*conn && (fr_redis_cluster_remap(request, cluster, *conn) != FR_REDIS_CLUSTER_RCODE_SUCCESS)) {
+		if (!fr_redis_cluster_refresh(cluster) && *conn &&
+		    (fr_redis_cluster_remap(request, cluster, *conn) != FR_REDIS_CLUSTER_RCODE_SUCCESS)) {
 			ROPTIONAL(RPDEBUG2, PDEBUG2, "%s", "");
 		}
 		FALL_THROUGH;
@@ -2046,6 +2753,7 @@ fr_redis_rcode_t fr_redis_cluster_state_next(fr_redis_cluster_state_t *state, fr
 try_again:
 	ROPTIONAL(RDEBUG2, DEBUG2, "[%i] >>> Sending command(s) to %s:%i",
 		  state->node->id, state->node->name, state->node->addr.inet.dst_port);
+	state->sent = fr_time();
 
 	fr_redis_reply_free(&*reply);
 	*reply = NULL;
@@ -2177,15 +2885,35 @@ ssize_t fr_redis_cluster_node_addr_by_role(TALLOC_CTX *ctx, fr_socket_t *out[],
 	return count;
 }
 
-/** Destroy mutex associated with cluster slots structure
+/** Stop the refresh thread, and destroy mutex and maps associated with cluster slots structure
  *
  * @param cluster being freed.
  * @return 0
  */
 static int _fr_redis_cluster_free(fr_redis_cluster_t *cluster)
 {
+	cluster_map_t *map, *next;
+
+	if (cluster->refresh_running) {
+		pthread_mutex_lock(&cluster->refresh_mutex);
+		atomic_store(&cluster->refresh_stop, true);
+		pthread_cond_signal(&cluster->refresh_cond);
+		pthread_mutex_unlock(&cluster->refresh_mutex);
+
+		pthread_join(cluster->refresh_thread, NULL);
+
+		pthread_cond_destroy(&cluster->refresh_cond);
+		pthread_mutex_destroy(&cluster->refresh_mutex);
+	}
+
 	pthread_mutex_destroy(&cluster->mutex);
 
+	talloc_free(atomic_load(&cluster->map));
+	for (map = cluster->retired; map; map = next) {
+		next = map->next;
+		talloc_free(map);
+	}
+
 	return 0;
 }
 
@@ -2276,6 +3004,7 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 
 	uint64_t		num_nodes;
 	fr_redis_cluster_t	*cluster;
+	cluster_map_t		*map;
 
 	fr_assert(triggers_enabled || !trigger_prefix);
 	fr_assert(triggers_enabled || (!trigger_args || fr_pair_list_empty(trigger_args)));
@@ -2387,6 +3116,15 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 
 	cluster->conf = conf;
 
+	/*
+	 *	Maps aren't parented by the cluster, as they're
+	 *	freed by the refresh thread.
+	 */
+	MEM(map = talloc_zero(NULL, cluster_map_t));
+	atomic_init(&cluster->map, map);
+	atomic_init(&cluster->refresh_pending, false);
+	atomic_init(&cluster->refresh_stop, false);
+
 	pthread_mutex_init(&cluster->mutex, NULL);
 	talloc_set_destructor(cluster, _fr_redis_cluster_free);
 
@@ -2423,8 +3161,7 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 		char const	*server;
 		fr_redis_cluster_node_t	*node;
 		fr_redis_conn_t	*conn;
-		redisReply	*map;
-		size_t		j, k;
+		cluster_layout_t *layout;
 
 		node = fr_fifo_peek(cluster->free_nodes);
 		if (!node) {
@@ -2482,38 +3219,23 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 			continue;
 		}
 
-		switch (cluster_map_get(&map, conn)) {
+		switch (cluster_map_get(NULL, &layout, cluster, conn)) {
 		/*
 		 *	We got a valid map! See if we can apply it...
 		 */
 		case FR_REDIS_CLUSTER_RCODE_SUCCESS:
 			fr_pool_connection_release(node->pool, NULL, conn);
 
-			DEBUG("%s - Cluster map consists of %zu key ranges", cluster->log_prefix, map->elements);
-			for (j = 0; j < map->elements; j++) {
-				redisReply *map_node = map->element[j];
-
-				DEBUG("%s - %zu - keys %lli-%lli", cluster->log_prefix, j,
-				      map_node->element[0]->integer,
-				      map_node->element[1]->integer);
-				DEBUG("%s -  master: %s:%lli", cluster->log_prefix,
-				      map_node->element[2]->element[0]->str,
-				      map_node->element[2]->element[1]->integer);
-				for (k = 3; k < map_node->elements; k++) {
-					DEBUG("%s -  slave%zu: %s:%lli", cluster->log_prefix, k - 3,
-					      map_node->element[k]->element[0]->str,
-					      map_node->element[k]->element[1]->integer);
-				}
-			}
+			cluster_layout_print(NULL, cluster, layout);
 
-			if (cluster_map_apply(cluster, map) < 0) {
+			if (cluster_map_apply(cluster, layout) < 0) {
 				PWARN("%s: Applying cluster map failed", cluster->log_prefix);
-				fr_redis_reply_free(&map);
+				talloc_free(layout);
 				continue;
 			}
-			fr_redis_reply_free(&map);
+			talloc_free(layout);
 
-			return cluster;
+			goto done;
 
 		/*
 		 *	Unusable bootstrap node
@@ -2554,8 +3276,19 @@ fr_redis_cluster_t *fr_redis_cluster_alloc(TALLOC_CTX *ctx,
 	 *	Distribute the node(s) throughout the key_slots,
 	 *	hopefully we'll get one when we start processing
 	 *	requests.
+	 *
+	 *	Nothing else can be using the map yet, so it's
+	 *	safe to modify it in place.
+	 */
+	for (s = 0; s < KEY_SLOTS; s++) map->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+
+done:
+	/*
+	 *	Remaps at runtime are performed in the background,
+	 *	if we can't start the thread, workers perform them
+	 *	inline, which is slower, but works.
 	 */
-	for (s = 0; s < KEY_SLOTS; s++) cluster->key_slot[s].master = (s % (uint16_t) num_nodes) + 1;
+	if (cluster_refresh_start(cluster) < 0) PWARN("%s - Remaps will be performed by workers", cluster->log_prefix);
 
 	return cluster;
 }
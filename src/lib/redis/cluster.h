@@ -55,6 +55,8 @@ typedef struct {
 	size_t			key_len;	//!< Length of the key.
 
 	fr_redis_cluster_node_t	*node;		//!< Node we're communicating with.
+	fr_time_t		sent;		//!< When we handed out the connection to the node.
+						//!< Used to measure the node's round trip time.
 	uint32_t		redirects;	//!< How many redirects have we followed.
 
 	uint32_t		retries;	//!< How many times we've received TRYAGAIN
@@ -78,6 +80,11 @@ extern size_t fr_redis_cluster_rcodes_table_len;
 
 fr_redis_cluster_rcode_t fr_redis_cluster_remap(request_t *request, fr_redis_cluster_t *cluster, fr_redis_conn_t *conn);
 
+bool fr_redis_cluster_refresh(fr_redis_cluster_t *cluster);
+
+fr_redis_cluster_rcode_t fr_redis_cluster_node_addr_from_redirect(uint16_t *key_slot, fr_socket_t *node_addr,
+								   redisReply *redirect);
+
 /*
  *	Callback for the connection pool to create a new connection
  */
@@ -96,6 +103,11 @@ fr_redis_cluster_node_t const	*fr_redis_cluster_slave(fr_redis_cluster_t *cluste
 							fr_redis_cluster_key_slot_t const *key_slot,
 							uint8_t slave_num);
 
+fr_redis_cluster_node_t const	*fr_redis_cluster_replica_select(fr_redis_cluster_t *cluster,
+								 fr_redis_cluster_key_slot_t const *key_slot);
+
+void fr_redis_cluster_node_rtt_update(fr_redis_cluster_node_t const *node, fr_time_delta_t rtt);
+
 int fr_redis_cluster_ipaddr(fr_ipaddr_t *out, fr_redis_cluster_node_t const *node);
 
 int fr_redis_cluster_port(uint16_t *out, fr_redis_cluster_node_t const *node);
@@ -331,6 +331,14 @@ static connection_state_t _redis_io_connection_init(void **h_out, connection_t *
 		return CONNECTION_STATE_FAILED;
 	}
 
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	/*
+	 *	Replies are stored with the commands that
+	 *	produced them, and freed with those commands.
+	 */
+	h->ac->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+#endif
+
 	/*
 	 *	Store the connection in private data,
 	 *	so we can use it for signalling.
@@ -377,6 +385,29 @@ static connection_state_t _redis_io_connection_init(void **h_out, connection_t *
 
 	fr_dlist_talloc_init(&h->ignore, fr_redis_sqn_ignore_t, entry);
 
+	/*
+	 *	These are buffered until the connection is
+	 *	established, and are sent ahead of any other
+	 *	commands.  They have no callback, so don't
+	 *	consume sequence numbers.  If they fail,
+	 *	the commands that follow will fail too.
+	 */
+	if (conf->password) {
+		if (conf->username) {
+			redisAsyncCommand(h->ac, NULL, NULL, "AUTH %s %s", conf->username, conf->password);
+		} else {
+			redisAsyncCommand(h->ac, NULL, NULL, "AUTH %s", conf->password);
+		}
+	}
+	if (conf->database) redisAsyncCommand(h->ac, NULL, NULL, "SELECT %u", conf->database);
+
+	/*
+	 *	Allow reads from replicas.  Masters ignore
+	 *	this, and replicas redirect writes to
+	 *	their master.
+	 */
+	if (conf->read_only) redisAsyncCommand(h->ac, NULL, NULL, "READONLY");
+
 	return CONNECTION_STATE_CONNECTING;
 }
 
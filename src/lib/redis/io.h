@@ -43,9 +43,11 @@ typedef struct {
 	uint16_t		port;
 	uint32_t		database;	//!< number on Redis server.
 
+	char const		*username;	//!< for acls.
 	char const		*password;	//!< to authenticate to Redis.
 	fr_time_delta_t		connection_timeout;
 	fr_time_delta_t		reconnection_delay;
+	bool			read_only;	//!< Send READONLY so replicas serve reads.
 	char const		*log_prefix;
 } fr_redis_io_conf_t;
 
@@ -27,14 +27,13 @@
 
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/util/rb.h>
 
 #include "pipeline.h"
 #include "io.h"
 
-
 /** Thread local state for a cluster
  *
- * MOVE ME TO NEW ASYNC CLUSTER CODE
  */
 struct fr_redis_cluster_thread_s {
 	fr_event_list_t			*el;
@@ -42,8 +41,19 @@ struct fr_redis_cluster_thread_s {
 	char				*log_prefix;	//!< Common log prefix to use for all cluster related
 							///< messages.
 	bool				delay_start;	//!< Prevent connections from spawning immediately.
+
+	fr_redis_cluster_t		*cluster;	//!< Shared cluster state.  Used to map keys to nodes.
+	fr_redis_conf_t const		*conf;		//!< Connection parameters common to all nodes.
+	fr_rb_tree_t			*trunks;	//!< Trunks to each of the cluster nodes, keyed
+							///< by node address.
 };
 
+/** Sent ahead of commands following an -ASK redirect
+ *
+ * Replies to this command are never passed back to the API client.
+ */
+static char const redis_asking[] = "ASKING";
+
 /** The thread local free list
  *
  * Any entries remaining in the list will be freed when the thread is joined
@@ -96,6 +106,9 @@ struct fr_redis_command_set_s {
 	/** @} */
 
 	uint8_t				redirected;	//!< How many times this command set was redirected.
+	bool				redirecting;	//!< Command set is being moved to another trunk.
+							///< Prevents the complete and free callbacks
+							///< running for the trunk request being released.
 
 	/** @name Request state
 	 *
@@ -106,10 +119,19 @@ struct fr_redis_command_set_s {
 	 * @{
  	 */
 	trunk_request_t		*treq;		//!< Trunk request this command set is associated with.
+	fr_redis_trunk_t		*rtrunk;	//!< Trunk the command set is currently enqueued on.
 	request_t			*request;	//!< Request this commands set is associated with (if any).
 	void				*rctx;		//!< Resume context to write results to.
 	/** @} */
 
+	/** @name Latency tracking
+	 * @{
+ 	 */
+	fr_redis_cluster_node_t const	*node;		//!< Cluster node the command set was sent to.
+							///< NULL if not enqueued by key, or redirected.
+	fr_time_t			sent_time;	//!< When the command set was written to the connection.
+	/** @} */
+
 	/** @name Callback functions
 	 * @{
  	 */
@@ -142,6 +164,10 @@ struct fr_redis_command_set_s {
 };
 
 struct fr_redis_trunk_s {
+	fr_rb_node_t			node;		//!< Entry in the cluster's tree of trunks.
+	fr_ipaddr_t			ipaddr;		//!< Address of the node this trunk connects to.
+	uint16_t			port;		//!< Port of the node this trunk connects to.
+
 	fr_redis_io_conf_t const	*io_conf;	//!< Redis I/O configuration.  Specifies how to connect
 							///< to the host this trunk is used to communicate with.
 	trunk_t			*trunk;		//!< Trunk containing all the connections to a specific
@@ -169,8 +195,6 @@ static int _command_set_free_list_free_on_exit(void *arg)
  */
 static int _redis_command_set_free(fr_redis_command_set_t *cmds)
 {
-	if (fr_dlist_num_elements(command_set_free_list) >= 1024) return 0;	/* Keep a buffer of 1024 */
-
 	/*
 	 *	Freed from the free list....
 	 */
@@ -179,8 +203,10 @@ static int _redis_command_set_free(fr_redis_command_set_t *cmds)
 		return 0;
 	}
 
+	if (fr_dlist_num_elements(command_set_free_list) >= 1024) return 0;	/* Keep a buffer of 1024 */
+
 	talloc_free_children(cmds);
-	memset(&cmds, 0, sizeof(cmds));
+	memset(cmds, 0, sizeof(*cmds));
 
 	fr_dlist_insert_head(command_set_free_list, cmds);
 
@@ -262,20 +288,132 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
  */
 static int _redis_command_free(fr_redis_command_t *cmd)
 {
-	//if (cmd->result) fr_redis_reply_free(&cmd->result);
+	if (cmd->result) fr_redis_reply_free(&cmd->result);
 
 	return 0;
 }
 
+/** Return the reply associated with a command
+ *
+ * The reply remains owned by the command, and is freed with it.
+ *
+ * @param[in] cmd	to retrieve the reply for.
+ * @return The reply, or NULL if no reply has been received.
+ */
 redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 {
 	return cmd->result;
 }
 
+/** Take ownership of the reply associated with a command
+ *
+ * @param[in] cmd	to retrieve the reply for.
+ * @return The reply, which the caller must free with #fr_redis_reply_free.
+ */
+redisReply *fr_redis_command_steal_result(fr_redis_command_t *cmd)
+{
+	redisReply *reply = cmd->result;
+
+	cmd->result = NULL;
+
+	return reply;
+}
+
+/** Find the name of a command, skipping any wire protocol framing
+ *
+ * @param[in] cmd_str	Inline or wire protocol formatted command.
+ * @param[in] cmd_len	Length of the command.
+ * @return The start of the command name.
+ */
+static char const *redis_command_name(char const *cmd_str, size_t cmd_len)
+{
+	char const *p, *end = cmd_str + cmd_len;
+
+	if ((cmd_len == 0) || (cmd_str[0] != '*')) return cmd_str;	/* Inline command */
+
+	/*
+	 *	*<argc>\r\n$<len>\r\n<name>\r\n...
+	 */
+	p = memchr(cmd_str, '\n', end - cmd_str);
+	if (!p) return cmd_str;
+	p = memchr(p + 1, '\n', end - (p + 1));
+	if (!p) return cmd_str;
+
+	return p + 1;
+}
+
+/** Format a command using the Redis wire protocol
+ *
+ * The output is suitable for passing to #fr_redis_command_preformatted_add.
+ *
+ * @param[in] ctx	to allocate the command in.  Usually the command set.
+ * @param[out] len	Length of the formatted command.
+ * @param[in] fmt	hiredis format string, i.e. "SET %b %s".
+ * @param[in] ...	Arguments for the format string.
+ * @return
+ *	- The formatted command.
+ *	- NULL on error.
+ */
+char *fr_redis_command_format(TALLOC_CTX *ctx, size_t *len, char const *fmt, ...)
+{
+	va_list	ap;
+	char	*cmd, *out;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = redisvFormatCommand(&cmd, fmt, ap);
+	va_end(ap);
+	if (ret < 0) {
+		fr_strerror_printf("Failed formatting command \"%s\"", fmt);
+		return NULL;
+	}
+
+	MEM(out = talloc_bstrndup(ctx, cmd, (size_t)ret));
+	redisFreeCommand(cmd);
+	*len = (size_t)ret;
+
+	return out;
+}
+
+/** Format an argument vector using the Redis wire protocol
+ *
+ * The output is suitable for passing to #fr_redis_command_preformatted_add.
+ *
+ * @param[in] ctx	to allocate the command in.  Usually the command set.
+ * @param[out] len	Length of the formatted command.
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Arguments, the first being the command name.
+ * @param[in] arg_len	Length of each argument.  If NULL, arguments are
+ *			assumed to be \0 terminated.
+ * @return
+ *	- The formatted command.
+ *	- NULL on error.
+ */
+char *fr_redis_command_format_argv(TALLOC_CTX *ctx, size_t *len, int argc, char const **argv, size_t const *arg_len)
+{
+	char		*cmd, *out;
+	long long	ret;
+
+	ret = redisFormatCommandArgv(&cmd, argc, argv, arg_len);
+	if (ret < 0) {
+		fr_strerror_const("Failed formatting command");
+		return NULL;
+	}
+
+	MEM(out = talloc_bstrndup(ctx, cmd, (size_t)ret));
+	redisFreeCommand(cmd);
+	*len = (size_t)ret;
+
+	return out;
+}
+
 /** Add a preformatted/expanded command to the command set
  *
  * The command must either be entirely static, or parented by the command set.
  *
+ * Commands are either a single word, i.e. "PING", or have been formatted
+ * with #fr_redis_command_format.
+ *
  * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
  * 	 As subscribing to a stream where we're not expecting it would break
  * 	 things, badly.
@@ -295,6 +433,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	request_t			*request = cmds->request;
 	fr_redis_command_t	*cmd;
 	fr_redis_command_type_t	type = FR_REDIS_COMMAND_NORMAL;
+	char const		*name = redis_command_name(cmd_str, cmd_len);
 
 	/*
 	 *	Transaction sanity checks.
@@ -306,10 +445,10 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	 *	We try very hard to do this without incurring a performance penalty
 	 *      for non-transactional commands.
 	 */
-	switch (tolower(cmd_str[0])) {
+	switch (tolower(name[0])) {
 	case 'm':
-		if (tolower(cmd_str[1] != 'u')) break;
-		if (strncasecmp(cmd_str, "multi", sizeof("multi") - 1) != 0) break;
+		if (tolower(name[1]) != 'u') break;
+		if (strncasecmp(name, "multi", sizeof("multi") - 1) != 0) break;
 		/*
 		 *	There should only ever be a difference of
 		 *	1 between txn starts and txn ends.
@@ -328,8 +467,8 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		break;
 
 	case 'e':
-		if (tolower(cmd_str[1] != 'e')) break;
-		if (strncasecmp(cmd_str, "exec", sizeof("exec") - 1) != 0) break;
+		if (tolower(name[1]) != 'x') break;
+		if (strncasecmp(name, "exec", sizeof("exec") - 1) != 0) break;
 		goto txn_end;
 
 	/*
@@ -338,8 +477,8 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	 *	executing the commands.
 	 */
 	case 'd':
-		if (tolower(cmd_str[1] != 'i')) break;
-		if (strncasecmp(cmd_str, "discard", sizeof("discard") - 1) != 0) break;
+		if (tolower(name[1]) != 'i') break;
+		if (strncasecmp(name, "discard", sizeof("discard") - 1) != 0) break;
 	txn_end:
 		if (cmds->txn_start <= cmds->txn_end) {
 			ROPTIONAL(ERROR, REDEBUG, "Transaction not started, missing \"MULTI\" command");
@@ -350,8 +489,8 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		break;
 
 	case 'w':
-		if (tolower(cmd_str[1] != 'a')) break;
-		if (strncasecmp(cmd_str, "watch", sizeof("watch") - 1) != 0) break;
+		if (tolower(name[1]) != 'a') break;
+		if (strncasecmp(name, "watch", sizeof("watch") - 1) != 0) break;
 		if (cmds->txn_watch) {
 			ROPTIONAL(ERROR, REDEBUG, "Too many consecutive \"WATCH\" commands");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
@@ -389,13 +528,15 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
  *	- FR_REDIS_PIPELINE_DST_UNAVAILABLE if the REDIS host is unreachable.
  *	- FR_REDIS_PIPELINE_FAIL any other general error.
  */
-fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds)
+fr_redis_pipeline_status_t fr_redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds)
 {
 	if (cmds->txn_start != cmds->txn_end) {
 		ERROR("Refusing to enqueue - Unbalanced transaction start/stop commands");
 		return FR_REDIS_PIPELINE_BAD_CMDS;
 	}
 
+	cmds->rtrunk = rtrunk;
+
 	switch (trunk_request_enqueue(&cmds->treq, rtrunk->trunk, cmds->request, cmds, cmds->rctx)) {
 	case TRUNK_ENQUEUE_OK:
 	case TRUNK_ENQUEUE_IN_BACKLOG:
@@ -409,6 +550,188 @@ fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, f
 	}
 }
 
+/** Enqueue a command set on the trunk for the cluster node responsible for a key
+ *
+ * If read_only is true, and read_replicas is enabled, the command set is sent to
+ * the replica with the lowest round trip time, falling back to the master if the
+ * key slot has no replicas.
+ *
+ * @param[in] cluster_thread	to resolve the key in.
+ * @param[in] cmds		Command set to enqueue.  All keys the commands operate
+ *				on must map to the same key slot.
+ * @param[in] key		used to determine the cluster node.
+ * @param[in] key_len		length of the key.
+ * @param[in] read_only		true if none of the commands modify data.
+ * @return
+ *	- FR_REDIS_PIPELINE_OK if commands were immediately enqueued or placed in the backlog.
+ *	- FR_REDIS_PIPELINE_DST_UNAVAILABLE if no node is responsible for the key,
+ *	  or the node is unreachable.
+ *	- FR_REDIS_PIPELINE_FAIL any other general error.
+ */
+fr_redis_pipeline_status_t fr_redis_command_set_enqueue_by_key(fr_redis_cluster_thread_t *cluster_thread,
+							       fr_redis_command_set_t *cmds,
+							       uint8_t const *key, size_t key_len, bool read_only)
+{
+	request_t			*request = cmds->request;
+	fr_redis_cluster_key_slot_t const *key_slot;
+	fr_redis_cluster_node_t const	*node = NULL;
+	fr_redis_trunk_t		*rtrunk;
+	fr_ipaddr_t			ipaddr;
+	uint16_t			port;
+
+	if (!cluster_thread->cluster) {
+		ROPTIONAL(REDEBUG, ERROR, "No cluster available to resolve key");
+		return FR_REDIS_PIPELINE_FAIL;
+	}
+
+	key_slot = fr_redis_cluster_slot_by_key(cluster_thread->cluster, request, key, key_len);
+	if (read_only) node = fr_redis_cluster_replica_select(cluster_thread->cluster, key_slot);
+	if (!node) node = fr_redis_cluster_master(cluster_thread->cluster, key_slot);
+	if ((fr_redis_cluster_ipaddr(&ipaddr, node) < 0) || (fr_redis_cluster_port(&port, node) < 0) ||
+	    (ipaddr.af == AF_UNSPEC)) {
+		ROPTIONAL(REDEBUG, ERROR, "No cluster node available for key");
+		return FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+	}
+
+	rtrunk = fr_redis_trunk_by_addr(cluster_thread, &ipaddr, port);
+	if (!rtrunk) return FR_REDIS_PIPELINE_FAIL;
+
+	cmds->node = node;
+
+	return fr_redis_command_set_enqueue(rtrunk, cmds);
+}
+
+/** Cancel a command set
+ *
+ * Should be called if the request the command set was created for is cancelled.
+ * The command set will be freed by the trunk, and neither the complete or fail
+ * callbacks will be called.
+ *
+ * @param[in] cmds	to cancel.
+ */
+void fr_redis_command_set_cancel(fr_redis_command_set_t *cmds)
+{
+	if (!cmds->treq) return;
+
+	trunk_request_signal_cancel(cmds->treq);
+}
+
+/** Return all commands to the pending list so the command set can be sent again
+ *
+ * Any replies already received are freed.
+ *
+ * @param[in] cmds	to reset.
+ */
+static void redis_command_set_reset(fr_redis_command_set_t *cmds)
+{
+	fr_redis_command_t	*cmd;
+
+	while ((cmd = fr_dlist_tail(&cmds->sent))) {
+		fr_dlist_remove(&cmds->sent, cmd);
+		fr_dlist_insert_head(&cmds->pending, cmd);
+	}
+
+	while ((cmd = fr_dlist_tail(&cmds->completed))) {
+		fr_dlist_remove(&cmds->completed, cmd);
+		fr_redis_reply_free(&cmd->result);
+		fr_dlist_insert_head(&cmds->pending, cmd);
+	}
+}
+
+/** Follow a -MOVED or -ASK redirect returned for any of the commands in a command set
+ *
+ * The command set is released from its current trunk and enqueued in its entirety
+ * on the trunk for the node indicated by the redirect.  Following an -ASK redirect
+ * the commands are preceded by an "ASKING" command.
+ *
+ * @note Following a -MOVED redirect a remap of the shared cluster map is requested.
+ *	 Other command sets for the same key slot will continue to be redirected until
+ *	 the refresh thread applies the new map.
+ *
+ * @param[in] cmds	to check for redirects.
+ * @return
+ *	- 0 if the command set was redirected (or failed whilst being redirected).
+ *	- -1 if the command set should be completed as normal.
+ */
+static int redis_command_set_redirect(fr_redis_command_set_t *cmds)
+{
+	request_t			*request = cmds->request;
+	fr_redis_cluster_thread_t	*cluster_thread = cmds->rtrunk->cluster;
+	fr_redis_command_t		*cmd;
+	fr_redis_trunk_t		*rtrunk;
+	trunk_request_t			*treq;
+	fr_socket_t			node_addr;
+	bool				ask = false;
+
+	for (cmd = fr_dlist_head(&cmds->completed);
+	     cmd;
+	     cmd = fr_dlist_next(&cmds->completed, cmd)) {
+		redisReply *reply = cmd->result;
+
+		if (!reply || (reply->type != REDIS_REPLY_ERROR)) continue;
+
+		if (strncmp(REDIS_ERROR_MOVED_STR, reply->str, sizeof(REDIS_ERROR_MOVED_STR) - 1) == 0) break;
+		if (strncmp(REDIS_ERROR_ASK_STR, reply->str, sizeof(REDIS_ERROR_ASK_STR) - 1) == 0) {
+			ask = true;
+			break;
+		}
+	}
+	if (!cmd) return -1;
+
+	if (!cluster_thread->conf || (cmds->redirected >= cluster_thread->conf->max_redirects)) {
+		ROPTIONAL(REDEBUG, ERROR, "Too many redirects (%u)", cmds->redirected);
+		return -1;
+	}
+	cmds->redirected++;
+
+	if (fr_redis_cluster_node_addr_from_redirect(NULL, &node_addr, cmd->result) < 0) {
+		ROPTIONAL(RPERROR, PERROR, "Failed parsing redirect");
+		return -1;
+	}
+
+	rtrunk = fr_redis_trunk_by_addr(cluster_thread, &node_addr.inet.dst_ipaddr, node_addr.inet.dst_port);
+	if (!rtrunk) return -1;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Following %s redirect to %pV:%u", ask ? "-ASK" : "-MOVED",
+		  fr_box_ipaddr(node_addr.inet.dst_ipaddr), node_addr.inet.dst_port);
+
+	/*
+	 *	Workers never remap inline here, if there's no
+	 *	refresh thread we just keep following redirects.
+	 */
+	if (!ask && cluster_thread->cluster) (void) fr_redis_cluster_refresh(cluster_thread->cluster);
+
+	redis_command_set_reset(cmds);
+	cmds->node = NULL;	/* The redirect target may not be a cluster node we know about */
+	if (ask) {
+		MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
+		talloc_set_destructor(cmd, _redis_command_free);
+		cmd->cmds = cmds;
+		cmd->str = redis_asking;
+		cmd->len = sizeof(redis_asking) - 1;
+		fr_dlist_insert_head(&cmds->pending, cmd);
+	}
+
+	/*
+	 *	Release the request from the old trunk
+	 *	without notifying the API client, or
+	 *	freeing the command set.
+	 */
+	treq = cmds->treq;
+	cmds->treq = NULL;
+	cmds->redirecting = true;
+	trunk_request_signal_complete(treq);
+	cmds->redirecting = false;
+
+	if (fr_redis_command_set_enqueue(rtrunk, cmds) != FR_REDIS_PIPELINE_OK) {
+		ROPTIONAL(REDEBUG, ERROR, "Failed enqueueing redirected commands");
+		if (cmds->fail) cmds->fail(cmds->request, &cmds->completed, cmds->rctx);
+		talloc_free(cmds);
+	}
+
+	return 0;
+}
+
 /** Callback for for receiving Redis replies
  *
  * This is called by hiredis for each response is receives.  privData is set to the
@@ -431,6 +754,15 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	connection_t		*conn = talloc_get_type_abort(ac->ev.data, connection_t);
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
 	redisReply		*reply = vreply;
+
+	/*
+	 *	hiredis calls the callbacks for any outstanding
+	 *	commands with a NULL reply when the connection
+	 *	is being torn down.  The trunk will already
+	 *	have moved or failed the command sets.
+	 */
+	if (!reply) return;
+
 	/*
 	 *	First check if we should ignore the response
 	 */
@@ -440,25 +772,35 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 		return;
 	}
 
-	/*
-	 *	FIXME - Need to check TRYAGAIN, MOVED etc...
-	 *	I guess we might want to wait for the end of
-	 *	the command set to do that.
-	 */
 	cmd = talloc_get_type_abort(privdata, fr_redis_command_t);
 	cmds = cmd->cmds;
 	cmd->result = reply;
 
 	fr_dlist_remove(&cmds->sent, cmd);
-	fr_dlist_insert_tail(&cmds->completed, cmd);
+	if (cmd->str == redis_asking) {
+		talloc_free(cmd);	/* API client doesn't know about this command */
+	} else {
+		fr_dlist_insert_tail(&cmds->completed, cmd);
+	}
 
 	/*
 	 *	Check is the command set is complete,
 	 *	and if it is, tell the trunk the treq
 	 *	is complete.
 	 */
-	if ((fr_dlist_num_elements(&cmds->pending) == 0) &&
-	    (fr_dlist_num_elements(&cmds->sent) == 0)) trunk_request_signal_complete(cmds->treq);
+	if ((fr_dlist_num_elements(&cmds->pending) != 0) ||
+	    (fr_dlist_num_elements(&cmds->sent) != 0)) return;
+
+	if (cmds->node) fr_redis_cluster_node_rtt_update(cmds->node, fr_time_sub(fr_time(), cmds->sent_time));
+
+	/*
+	 *	Redirects are only checked once we have
+	 *	replies for the entire command set, as all
+	 *	the commands need to be resent.
+	 */
+	if (redis_command_set_redirect(cmds) == 0) return;
+
+	trunk_request_signal_complete(cmds->treq);
 }
 
 static connection_t *_redis_pipeline_connection_alloc(trunk_connection_t *tconn, fr_event_list_t *el,
@@ -473,44 +815,58 @@ static connection_t *_redis_pipeline_connection_alloc(trunk_connection_t *tconn,
 /** Enqueue one or more command sets onto a redis handle
  *
  * Because the trunk is in always writable mode, _redis_pipeline_mux
- * will be called any time trunk_request_enqueue is called, so there'll only
- * ever be one command to dequeue.
+ * will usually be called any time trunk_request_enqueue is called, but
+ * requests may also accumulate whilst the connection is being established.
  *
+ * @param[in] el		Event list.  Unused.
  * @param[in] tconn		Trunk connection holding the commands to enqueue.
  * @param[in] conn		Connection handle containing the fr_redis_handle_t.
- * @param[in] uctx		fr_redis_cluster_t.  Unused.
+ * @param[in] uctx		fr_redis_trunk_t.  Unused.
  */
-static void _redis_pipeline_mux(trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
+static void _redis_pipeline_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn, connection_t *conn,
+				UNUSED void *uctx)
 {
-	trunk_request_t	*treq;
+	trunk_request_t		*treq;
 	fr_redis_command_set_t 	*cmds;
 	fr_redis_command_t	*cmd;
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
-	request_t			*request;
-
-	treq = trunk_connection_pop_request(&request, (void *)&cmds, NULL, tconn);
-	while ((cmd = fr_dlist_head(&cmds->pending))) {
-		/*
-		 *	If this fails it probably means the connection
-		 *	is disconnecting, but if that's happening then
-		 *	we shouldn't be enqueueing new requests?
-		 */
-		if (unlikely(redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str) != REDIS_OK)) {
-			ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
-
-			while ((cmd = fr_dlist_head(&cmds->sent))) {
-				fr_redis_connection_ignore_response(h, cmd->sqn);
-				fr_dlist_remove(&cmds->sent, cmd);
-				fr_dlist_insert_tail(&cmds->pending, cmd);
+	request_t		*request;
+
+	while ((trunk_connection_pop_request(&treq, tconn) == 0) && treq) {
+		cmds = talloc_get_type_abort(treq->preq, fr_redis_command_set_t);
+		request = cmds->request;
+
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			int ret;
+
+			/*
+			 *	If this fails it probably means the connection
+			 *	is disconnecting, but if that's happening then
+			 *	we shouldn't be enqueueing new requests?
+			 */
+			if (cmd->str[0] == '*') {
+				ret = redisAsyncFormattedCommand(h->ac, _redis_pipeline_demux, cmd, cmd->str, cmd->len);
+			} else {
+				ret = redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str);
+			}
+			if (unlikely(ret != REDIS_OK)) {
+				ROPTIONAL(REDEBUG, ERROR, "Unexpected error queueing REDIS command");
+
+				while ((cmd = fr_dlist_tail(&cmds->sent))) {
+					fr_redis_connection_ignore_response(h, cmd->sqn);
+					fr_dlist_remove(&cmds->sent, cmd);
+					fr_dlist_insert_head(&cmds->pending, cmd);
+				}
+				trunk_request_signal_fail(treq);
+				return;
 			}
-			trunk_request_signal_fail(treq);
-			return;
+			cmd->sqn = fr_redis_connection_sent_request(h);
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&cmds->sent, cmd);
 		}
-		cmd->sqn = fr_redis_connection_sent_request(h);
-		fr_dlist_remove(&cmds->pending, cmd);
-		fr_dlist_insert_tail(&cmds->sent, cmd);
+		if (cmds->node) cmds->sent_time = fr_time();
+		trunk_request_signal_sent(treq);
 	}
-	trunk_request_signal_sent(treq);
 }
 
 /** Deal with cancellation of sent requests
@@ -519,7 +875,7 @@ static void _redis_pipeline_mux(trunk_connection_t *tconn, connection_t *conn, U
  * on why the commands were cancelled, we either tell the handle to ignore
  * them, or move them back into the pending list.
  */
-static void _redis_pipeline_command_set_cancel(connection_t *conn, UNUSED trunk_request_t *treq, void *preq,
+static void _redis_pipeline_command_set_cancel(connection_t *conn, void *preq,
 					       trunk_cancel_reason_t reason, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
@@ -541,7 +897,7 @@ static void _redis_pipeline_command_set_cancel(connection_t *conn, UNUSED trunk_
 	 *	execution by another handle.
 	 */
 	case TRUNK_CANCEL_REASON_MOVE:
-		fr_dlist_move(&cmds->pending, &cmds->sent);
+		redis_command_set_reset(cmds);
 		return;
 
 	/*
@@ -564,6 +920,7 @@ static void _redis_pipeline_command_set_cancel(connection_t *conn, UNUSED trunk_
 			fr_redis_connection_ignore_response(h, cmd->sqn);
 		}
 	}
+		return;
 
 	case TRUNK_CANCEL_REASON_NONE:
 		fr_assert(0);
@@ -579,6 +936,8 @@ static void _redis_pipeline_command_set_complete(UNUSED request_t *request, void
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	if (cmds->redirecting) return;
+
 	if (cmds->complete) cmds->complete(cmds->request, &cmds->completed, cmds->rctx);
 }
 
@@ -586,10 +945,15 @@ static void _redis_pipeline_command_set_complete(UNUSED request_t *request, void
  *
  */
 static void _redis_pipeline_command_set_fail(UNUSED request_t *request, void *preq,
-					     UNUSED void *rctx, UNUSED void *uctx)
+					     UNUSED void *rctx, UNUSED trunk_request_state_t state, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	/*
+	 *	Make the node less attractive for reads
+	 */
+	if (cmds->node) fr_redis_cluster_node_rtt_update(cmds->node, fr_time_delta_from_sec(1));
+
 	if (cmds->fail) cmds->fail(cmds->request, &cmds->completed, cmds->rctx);
 }
 
@@ -601,6 +965,8 @@ static void _redis_pipeline_command_set_free(UNUSED request_t *request, void *pr
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
+	if (cmds->redirecting) return;
+
 	talloc_free(cmds);
 }
 
@@ -627,6 +993,7 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 
 	MEM(rtrunk = talloc_zero(cluster_thread, fr_redis_trunk_t));
 	rtrunk->io_conf = io_conf;
+	rtrunk->cluster = cluster_thread;
 	rtrunk->trunk = trunk_alloc(rtrunk, cluster_thread->el,
 				       &io_funcs, cluster_thread->tconf, cluster_thread->log_prefix, rtrunk,
 				       cluster_thread->delay_start);
@@ -638,23 +1005,116 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 	return rtrunk;
 }
 
+static int8_t _redis_trunk_cmp(void const *one, void const *two)
+{
+	fr_redis_trunk_t const *a = one;
+	fr_redis_trunk_t const *b = two;
+	int ret;
+
+	ret = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	if (ret != 0) return ret;
+
+	return CMP(a->port, b->port);
+}
+
+/** Retrieve or allocate the trunk for a specific cluster node
+ *
+ * @param[in] cluster_thread	the node belongs to.
+ * @param[in] ipaddr		of the node.
+ * @param[in] port		of the node.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL if a new trunk could not be allocated.
+ */
+fr_redis_trunk_t *fr_redis_trunk_by_addr(fr_redis_cluster_thread_t *cluster_thread,
+					 fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	fr_redis_trunk_t	find, *rtrunk;
+	fr_redis_io_conf_t	*io_conf;
+	char			buffer[FR_IPADDR_STRLEN];
+
+	find.ipaddr = *ipaddr;
+	find.port = port;
+
+	rtrunk = fr_rb_find(cluster_thread->trunks, &find);
+	if (rtrunk) return rtrunk;
+
+	MEM(io_conf = talloc_zero(cluster_thread, fr_redis_io_conf_t));
+	fr_inet_ntop(buffer, sizeof(buffer), ipaddr);
+	MEM(io_conf->hostname = talloc_typed_strdup(io_conf, buffer));
+	io_conf->port = port;
+	if (cluster_thread->conf) {
+		io_conf->database = cluster_thread->conf->database;
+		io_conf->username = cluster_thread->conf->username;
+		io_conf->password = cluster_thread->conf->password;
+		io_conf->connection_timeout = cluster_thread->conf->connection_timeout;
+		io_conf->reconnection_delay = cluster_thread->conf->reconnection_delay;
+		io_conf->read_only = cluster_thread->conf->read_replicas;
+	}
+	io_conf->log_prefix = cluster_thread->log_prefix;
+
+	rtrunk = fr_redis_trunk_alloc(cluster_thread, io_conf);
+	if (!rtrunk) {
+		talloc_free(io_conf);
+		return NULL;
+	}
+	talloc_steal(rtrunk, io_conf);
+
+	rtrunk->ipaddr = *ipaddr;
+	rtrunk->port = port;
+	fr_rb_insert(cluster_thread->trunks, rtrunk);
+
+	return rtrunk;
+}
+
 /** Allocate per-thread, per-cluster instance
  *
  * This structure represents all the connections for a given thread for a given cluster.
  * The structures holds the trunk connections to talk to each cluster member.
  *
+ * Trunks are allocated lazily, the first time a command set needs to be sent to
+ * a particular node.
+ *
+ * @param[in] ctx	to allocate the cluster thread in.
+ * @param[in] el	to use for I/O.
+ * @param[in] tconf	Configuration for the trunks to each node.
+ * @param[in] cluster	Shared cluster state used to map keys to nodes.  May be NULL
+ *			if trunks will only be allocated with #fr_redis_trunk_alloc.
+ * @param[in] conf	Connection parameters common to all nodes.  May be NULL.
+ * @param[in] log_prefix	to use for all trunk and connection related messages.
+ * @return
+ *	- A new cluster thread.
+ *	- NULL if asynchronous I/O is not supported by the version of hiredis
+ *	  we were built against.
  */
-fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, trunk_conf_t const *tconf)
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+							 trunk_conf_t const *tconf,
+							 fr_redis_cluster_t *cluster, fr_redis_conf_t const *conf,
+							 char const *log_prefix)
 {
 	fr_redis_cluster_thread_t *cluster_thread;
 	trunk_conf_t *our_tconf;
 
+#ifndef REDIS_NO_AUTO_FREE_REPLIES
+	/*
+	 *	Older versions of hiredis free replies as soon
+	 *	as the callback returns, which means they can't
+	 *	be gathered up and passed to the API client.
+	 */
+	fr_strerror_const("Asynchronous Redis I/O requires hiredis >= 1.0.0");
+	return NULL;
+#endif
+
 	MEM(cluster_thread = talloc_zero(ctx, fr_redis_cluster_thread_t));
 	MEM(our_tconf = talloc_memdup(cluster_thread, tconf, sizeof(*tconf)));
 	our_tconf->always_writable = true;
 
 	cluster_thread->el = el;
 	cluster_thread->tconf = our_tconf;
+	cluster_thread->cluster = cluster;
+	cluster_thread->conf = conf;
+	MEM(cluster_thread->log_prefix = talloc_typed_strdup(cluster_thread, log_prefix ? log_prefix : "redis"));
+	MEM(cluster_thread->trunks = fr_rb_inline_alloc(cluster_thread, fr_redis_trunk_t, node, _redis_trunk_cmp, NULL));
 
 	return cluster_thread;
 }
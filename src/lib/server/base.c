@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/trigger.h>
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/server/packet.h>
+#include <freeradius-devel/unlang/compile.h>
 #include <freeradius-devel/unlang/xlat.h>
 #include <freeradius-devel/util/dict.h>
 
@@ -122,6 +123,13 @@ int server_init(CONF_SECTION *cs, char const *dict_dir, fr_dict_t *dict)
 	 */
 	if (xlat_instantiate() < 0) return -1;
 
+	/*
+	 *	Now that the xlats can be called, evaluate any
+	 *	conditions which only depend on config items or
+	 *	constants.
+	 */
+	unlang_compile_fold_conditions();
+
 	/*
 	 *	load the 'Net.' packet attributes.
 	 */
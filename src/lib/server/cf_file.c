@@ -3476,6 +3476,117 @@ void cf_file_free(CONF_SECTION *cs)
 	talloc_free(cs);
 }
 
+/** Check whether any of the files read into a configuration have changed
+ *
+ * Files are compared by inode, size and modification time against what
+ * they were when they were read.  Files added to a wildcard $INCLUDE
+ * directory since then are not detected.
+ *
+ * @param[in] cs	Root of the configuration read by cf_file_read().
+ * @return
+ *	- 1 if one or more files have changed, or been removed.
+ *	- 0 if no files have changed.
+ *	- -1 if the configuration wasn't read from files.
+ */
+int cf_file_changed(CONF_SECTION *cs)
+{
+	fr_rb_tree_t	*tree;
+	int		ret = 0;
+
+	tree = cf_data_value(cf_data_find(cf_root(cs), fr_rb_tree_t, "filename"));
+	if (!tree) {
+		fr_strerror_const("Configuration was not read from a file");
+		return -1;
+	}
+
+	fr_rb_inorder_foreach(tree, cf_file_t, file) {
+		struct stat buf;
+
+		if (stat(file->filename, &buf) < 0) {
+			DEBUG2("Configuration file %s has been removed", file->filename);
+			ret = 1;
+			continue;
+		}
+
+		if ((buf.st_dev != file->buf.st_dev) || (buf.st_ino != file->buf.st_ino) ||
+		    (buf.st_size != file->buf.st_size) || (buf.st_mtime != file->buf.st_mtime)) {
+			DEBUG2("Configuration file %s has changed", file->filename);
+			ret = 1;
+		}
+	}}
+
+	return ret;
+}
+
+/** Return the next pair or section, skipping any data attached to the section
+ *
+ */
+static CONF_ITEM const *cf_item_next_config(CONF_SECTION const *cs, CONF_ITEM const *ci)
+{
+	while ((ci = cf_item_next(cs, ci)) && (ci->type == CONF_ITEM_DATA));
+
+	return ci;
+}
+
+/** Compare two configuration sections, and all of their children
+ *
+ * Only the names, operators, values and quoting of items are compared.
+ * Where an item was read from, and any data attached to it, are ignored.
+ *
+ * @param[in] a		First section to compare.
+ * @param[in] b		Second section to compare.
+ * @return
+ *	- true if the sections are the same.
+ *	- false if they differ.
+ */
+bool cf_section_equal(CONF_SECTION const *a, CONF_SECTION const *b)
+{
+	CONF_ITEM const	*ci_a, *ci_b;
+	int		i;
+
+	if ((strcmp(a->name1, b->name1) != 0) ||
+	    (!a->name2 != !b->name2) ||
+	    (a->name2 && (strcmp(a->name2, b->name2) != 0)) ||
+	    (a->argc != b->argc)) return false;
+
+	for (i = 0; i < a->argc; i++) {
+		if (strcmp(a->argv[i], b->argv[i]) != 0) return false;
+	}
+
+	for (ci_a = cf_item_next_config(a, NULL), ci_b = cf_item_next_config(b, NULL);
+	     ci_a && ci_b;
+	     ci_a = cf_item_next_config(a, ci_a), ci_b = cf_item_next_config(b, ci_b)) {
+		CONF_PAIR const *cp_a, *cp_b;
+
+		if (ci_a->type != ci_b->type) return false;
+
+		switch (ci_a->type) {
+		case CONF_ITEM_SECTION:
+			if (!cf_section_equal(cf_item_to_section(ci_a), cf_item_to_section(ci_b))) return false;
+			break;
+
+		case CONF_ITEM_PAIR:
+			cp_a = cf_item_to_pair(ci_a);
+			cp_b = cf_item_to_pair(ci_b);
+
+			if ((strcmp(cp_a->attr, cp_b->attr) != 0) ||
+			    (cp_a->op != cp_b->op) ||
+			    (cp_a->rhs_quote != cp_b->rhs_quote) ||
+			    (!cp_a->value != !cp_b->value) ||
+			    (cp_a->value && (strcmp(cp_a->value, cp_b->value) != 0))) return false;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	/*
+	 *	One has more children than the other.
+	 */
+	return (ci_a == NULL) && (ci_b == NULL);
+}
+
 /** Set the euid/egid used when performing file checks
  *
  * Sets the euid, and egid used when cf_file_check is called to check
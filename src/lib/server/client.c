@@ -37,7 +37,9 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/base16.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/qsbr.h>
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/value.h>
 #include <freeradius-devel/util/trie.h>
@@ -45,8 +47,15 @@ RCSID("$Id$")
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 //#define WITH_TRIE (1)
 
 /** Group of clients
@@ -61,11 +70,47 @@ struct fr_client_list_s {
 	fr_trie_t	*v6_tcp;
 #else
 	fr_rb_tree_t	*tree[129];
+
+	pthread_mutex_t	mutex;			//!< Serialises changes to the trees.
+	_Atomic(struct client_snapshot_s *) snapshot;	//!< Read-only copy of the trees used for lookups.
+						///< NULL if the trees have changed since it was built.
 #endif
 };
 
 static fr_client_list_t	*root_clients = NULL;	//!< Global client list.
 
+#ifndef WITH_TRIE
+/** A slot in the snapshot's hash table
+ *
+ */
+typedef struct {
+	uint32_t		hash;			//!< Of the client's address and prefix.
+	fr_client_t		*client;		//!< NULL if the slot is empty.
+} client_slot_t;
+
+/** Immutable copy of a client list, optimised for lookups
+ *
+ * All clients, of any prefix length, are in a single open addressing
+ * hash table keyed by masked address and prefix length.  Longest
+ * prefix match is done by probing the table once for each prefix
+ * length which has clients, longest first.  Exact matches on /32 and
+ * /128 clients, the common case, need a single probe.
+ *
+ * Snapshots are never modified.  When clients are added or removed
+ * the snapshot is discarded, and the next lookup builds and publishes
+ * a new one.  The old snapshot is freed once no thread can still be
+ * reading it.
+ */
+typedef struct client_snapshot_s {
+	uint8_t			v4_prefix[33];		//!< IPv4 prefix lengths with clients, longest first.
+	uint8_t			v4_num;			//!< Number of IPv4 prefix lengths with clients.
+	uint8_t			v6_prefix[129];		//!< IPv6 prefix lengths with clients, longest first.
+	uint8_t			v6_num;			//!< Number of IPv6 prefix lengths with clients.
+	uint32_t		mask;			//!< Number of slots - 1.
+	client_slot_t		slot[];			//!< Hash table.
+} client_snapshot_t;
+#endif
+
 #ifndef WITH_TRIE
 static int8_t client_cmp(void const *one, void const *two)
 {
@@ -84,6 +129,158 @@ static int8_t client_cmp(void const *one, void const *two)
 	return CMP(a->proto, b->proto);
 }
 
+/** Hash a masked address and its prefix length
+ *
+ */
+static inline uint32_t client_snapshot_hash(fr_ipaddr_t const *ipaddr)
+{
+	uint32_t hash;
+
+	hash = fr_hash(&ipaddr->addr, ((ipaddr->prefix + 7) & -8) >> 3);
+	hash = fr_hash_update(&ipaddr->af, sizeof(ipaddr->af), hash);
+
+	return fr_hash_update(&ipaddr->prefix, sizeof(ipaddr->prefix), hash);
+}
+
+/** Build a snapshot of a client list
+ *
+ * @note Must be called with the client list mutex held.
+ */
+static client_snapshot_t *client_snapshot_alloc(fr_client_list_t *clients)
+{
+	client_snapshot_t	*snap;
+	uint32_t		num = 0, size = 16;
+	bool			v4[129] = { false }, v6[129] = { false };
+	int			i;
+
+	for (i = 0; i <= 128; i++) {
+		if (clients->tree[i]) num += fr_rb_num_elements(clients->tree[i]);
+	}
+
+	/*
+	 *	Keep the load factor under 50%, so
+	 *	probe sequences stay short.
+	 */
+	while (size < (num * 2)) size <<= 1;
+
+	snap = talloc_zero_size(NULL, sizeof(*snap) + (sizeof(snap->slot[0]) * size));
+	if (!snap) return NULL;
+	talloc_set_name_const(snap, "client_snapshot_t");
+
+	snap->mask = size - 1;
+
+	for (i = 0; i <= 128; i++) {
+		if (!clients->tree[i]) continue;
+
+		fr_rb_inorder_foreach(clients->tree[i], fr_client_t, client) {
+			uint32_t hash = client_snapshot_hash(&client->ipaddr);
+			uint32_t j;
+
+			for (j = hash & snap->mask; snap->slot[j].client; j = (j + 1) & snap->mask);
+
+			snap->slot[j].hash = hash;
+			snap->slot[j].client = client;
+
+			if (client->ipaddr.af == AF_INET) {
+				v4[client->ipaddr.prefix] = true;
+			} else {
+				v6[client->ipaddr.prefix] = true;
+			}
+		}}
+	}
+
+	for (i = 128; i >= 0; i--) {
+		if (v4[i] && (i <= 32)) snap->v4_prefix[snap->v4_num++] = i;
+		if (v6[i]) snap->v6_prefix[snap->v6_num++] = i;
+	}
+
+	return snap;
+}
+
+/** Discard a client list's snapshot after it's been modified
+ *
+ * @note Must be called with the client list mutex held.
+ */
+static void client_snapshot_discard(fr_client_list_t *clients)
+{
+	client_snapshot_t *old;
+
+	old = atomic_exchange_explicit(&clients->snapshot, NULL, memory_order_acq_rel);
+	if (!old) return;
+
+	/*
+	 *	Other threads may still be looking up clients
+	 *	in the old snapshot.  If we can't defer freeing
+	 *	it, leave it until the client list is freed.
+	 */
+	if (fr_qsbr_retire(old, NULL) < 0) talloc_steal(clients, old);
+}
+
+/** Return the current snapshot of a client list, building one if needed
+ *
+ */
+static client_snapshot_t *client_snapshot(fr_client_list_t *clients)
+{
+	client_snapshot_t *snap;
+
+	snap = atomic_load_explicit(&clients->snapshot, memory_order_acquire);
+	if (likely(snap != NULL)) return snap;
+
+	pthread_mutex_lock(&clients->mutex);
+	snap = atomic_load_explicit(&clients->snapshot, memory_order_acquire);
+	if (!snap) {
+		snap = client_snapshot_alloc(clients);
+		if (snap) atomic_store_explicit(&clients->snapshot, snap, memory_order_release);
+	}
+	pthread_mutex_unlock(&clients->mutex);
+
+	return snap;
+}
+
+/** Find the client with the longest prefix matching an address
+ *
+ */
+static fr_client_t *client_snapshot_find(client_snapshot_t const *snap, fr_ipaddr_t const *ipaddr, int proto)
+{
+	fr_client_t	my_client;
+	uint8_t const	*prefix;
+	uint8_t		num, i;
+
+	if (ipaddr->af == AF_INET) {
+		prefix = snap->v4_prefix;
+		num = snap->v4_num;
+	} else {
+		prefix = snap->v6_prefix;
+		num = snap->v6_num;
+	}
+
+	my_client.proto = proto;
+	for (i = 0; i < num; i++) {
+		uint32_t hash, j;
+
+		if (prefix[i] > ipaddr->prefix) continue;
+
+		my_client.ipaddr = *ipaddr;
+		fr_ipaddr_mask(&my_client.ipaddr, prefix[i]);
+		hash = client_snapshot_hash(&my_client.ipaddr);
+
+		for (j = hash & snap->mask; snap->slot[j].client; j = (j + 1) & snap->mask) {
+			if (snap->slot[j].hash != hash) continue;
+
+			if (client_cmp(&my_client, snap->slot[j].client) == 0) return snap->slot[j].client;
+		}
+	}
+
+	return NULL;
+}
+
+static int _client_list_free(fr_client_list_t *clients)
+{
+	talloc_free(atomic_load(&clients->snapshot));
+	pthread_mutex_destroy(&clients->mutex);
+
+	return 0;
+}
 #endif
 
 void client_list_free(void)
@@ -118,6 +315,15 @@ fr_client_list_t *client_list_init(CONF_SECTION *cs)
 
 	clients->name = talloc_strdup(clients, cs ? cf_section_name1(cs) : "root");
 
+#ifndef WITH_TRIE
+	if (pthread_mutex_init(&clients->mutex, NULL) != 0) {
+		talloc_free(clients);
+		return NULL;
+	}
+	atomic_init(&clients->snapshot, NULL);
+	talloc_set_destructor(clients, _client_list_free);
+#endif
+
 #ifdef WITH_TRIE
 	clients->v4_udp = fr_trie_alloc(clients, NULL, NULL);
 	if (!clients->v4_udp) {
@@ -284,11 +490,13 @@ bool client_add(fr_client_list_t *clients, fr_client_t *client)
 	old = fr_trie_match_by_key(trie, &client->ipaddr.addr, client->ipaddr.prefix);
 
 #else  /* WITH_TRIE */
+	pthread_mutex_lock(&clients->mutex);
 
 	if (!clients->tree[client->ipaddr.prefix]) {
 		clients->tree[client->ipaddr.prefix] = fr_rb_inline_talloc_alloc(clients, fr_client_t, node, client_cmp,
 										 NULL);
 		if (!clients->tree[client->ipaddr.prefix]) {
+			pthread_mutex_unlock(&clients->mutex);
 			return false;
 		}
 	}
@@ -296,6 +504,10 @@ bool client_add(fr_client_list_t *clients, fr_client_t *client)
 	old = fr_rb_find(clients->tree[client->ipaddr.prefix], client);
 #endif
 	if (old) {
+#ifndef WITH_TRIE
+		pthread_mutex_unlock(&clients->mutex);
+#endif
+
 		/*
 		 *	If it's a complete duplicate, then free the new
 		 *	one, and return "OK".
@@ -325,9 +537,17 @@ bool client_add(fr_client_list_t *clients, fr_client_t *client)
 	}
 #else
 	if (!fr_rb_insert(clients->tree[client->ipaddr.prefix], client)) {
+		pthread_mutex_unlock(&clients->mutex);
 		client_free(client);
 		return false;
 	}
+
+	/*
+	 *	The next lookup will publish a
+	 *	snapshot including the new client.
+	 */
+	client_snapshot_discard(clients);
+	pthread_mutex_unlock(&clients->mutex);
 #endif
 
 	/*
@@ -359,10 +579,10 @@ void client_delete(fr_client_list_t *clients, fr_client_t *client)
 	 */
 	(void) fr_trie_remove_by_key(trie, &client->ipaddr.addr, client->ipaddr.prefix);
 #else
-
-	if (!clients->tree[client->ipaddr.prefix]) return;
-
-	(void) fr_rb_delete(clients->tree[client->ipaddr.prefix], client);
+	pthread_mutex_lock(&clients->mutex);
+	if (clients->tree[client->ipaddr.prefix] &&
+	    fr_rb_delete(clients->tree[client->ipaddr.prefix], client)) client_snapshot_discard(clients);
+	pthread_mutex_unlock(&clients->mutex);
 #endif
 }
 
@@ -381,7 +601,8 @@ fr_client_t *client_find(fr_client_list_t const *clients, fr_ipaddr_t const *ipa
 	fr_trie_t *trie;
 #else
 	int i, max;
-	fr_client_t my_client, *client;
+	fr_client_t my_client, *client = NULL;
+	client_snapshot_t *snap;
 #endif
 
 	if (!clients) clients = root_clients;
@@ -393,7 +614,12 @@ fr_client_t *client_find(fr_client_list_t const *clients, fr_ipaddr_t const *ipa
 
 	return fr_trie_lookup_by_key(trie, &ipaddr->addr, ipaddr->prefix);
 #else
+	snap = client_snapshot(UNCONST(fr_client_list_t *, clients));
+	if (likely(snap != NULL)) return client_snapshot_find(snap, ipaddr, proto);
 
+	/*
+	 *	Couldn't build a snapshot, search the trees directly.
+	 */
 	if (proto == AF_INET) {
 		max = 32;
 	} else {
@@ -402,6 +628,7 @@ fr_client_t *client_find(fr_client_list_t const *clients, fr_ipaddr_t const *ipa
 
 	if (max > ipaddr->prefix) max = ipaddr->prefix;
 
+	pthread_mutex_lock(&UNCONST(fr_client_list_t *, clients)->mutex);
 	my_client.proto = proto;
 	for (i = max; i >= 0; i--) {
 		if (!clients->tree[i]) continue;
@@ -409,12 +636,11 @@ fr_client_t *client_find(fr_client_list_t const *clients, fr_ipaddr_t const *ipa
 		my_client.ipaddr = *ipaddr;
 		fr_ipaddr_mask(&my_client.ipaddr, i);
 		client = fr_rb_find(clients->tree[i], &my_client);
-		if (client) {
-			return client;
-		}
+		if (client) break;
 	}
+	pthread_mutex_unlock(&UNCONST(fr_client_list_t *, clients)->mutex);
 
-	return NULL;
+	return client;
 #endif
 }
 
@@ -0,0 +1,229 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file detail.c
+ * @brief Encode and decode binary detail file records.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/detail.h>
+
+#include <freeradius-devel/util/cbor.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <unistd.h>
+
+/** Calculate the check over everything in the header except the flags
+ *
+ */
+static uint32_t detail_binary_hdr_check(uint8_t const *hdr)
+{
+	uint32_t hash;
+
+	hash = fr_hash(hdr, FR_DETAIL_BINARY_FLAGS_OFFSET);
+	return fr_hash_update(hdr + FR_DETAIL_BINARY_FLAGS_OFFSET + 1, 12, hash);
+}
+
+/** Write a record header
+ *
+ * @param[out] out		Where to write the header.
+ * @param[in] timestamp		When the packet was received.
+ * @param[in] length		of the body which follows the header.
+ */
+void fr_detail_binary_hdr_encode(uint8_t out[static FR_DETAIL_BINARY_HDR_LEN],
+				 fr_unix_time_t timestamp, uint32_t length)
+{
+	out[0] = 0xfe;
+	out[1] = 'D';
+	out[2] = FR_DETAIL_BINARY_VERSION;
+	out[3] = 0;
+	fr_nbo_from_uint32(out + 4, length);
+	fr_nbo_from_uint64(out + 8, fr_unix_time_unwrap(timestamp));
+	fr_nbo_from_uint32(out + 16, detail_binary_hdr_check(out));
+}
+
+/** Decode and validate a record header
+ *
+ * @param[out] hdr		The decoded header.
+ * @param[in] data		to decode.
+ * @param[in] data_len		Length of the data.
+ * @return
+ *	- FR_DETAIL_BINARY_HDR_LEN on success.
+ *	- 0 if more data is needed.
+ *	- -1 if the data isn't a valid header.
+ */
+ssize_t fr_detail_binary_hdr_decode(fr_detail_binary_hdr_t *hdr, uint8_t const *data, size_t data_len)
+{
+	if (data_len < FR_DETAIL_BINARY_HDR_LEN) {
+		if (data_len && (data[0] != 0xfe)) goto invalid;
+		return 0;
+	}
+
+	if (!fr_detail_binary_is_record(data, data_len)) {
+	invalid:
+		fr_strerror_const("Invalid binary detail record header");
+		return -1;
+	}
+
+	if (data[2] != FR_DETAIL_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported binary detail record version %u", data[2]);
+		return -1;
+	}
+
+	if (fr_nbo_to_uint32(data + 16) != detail_binary_hdr_check(data)) {
+		fr_strerror_const("Binary detail record header failed check");
+		return -1;
+	}
+
+	hdr->flags = data[FR_DETAIL_BINARY_FLAGS_OFFSET];
+	hdr->length = fr_nbo_to_uint32(data + 4);
+	hdr->timestamp = fr_unix_time_wrap(fr_nbo_to_uint64(data + 8));
+
+	return FR_DETAIL_BINARY_HDR_LEN;
+}
+
+/** Encode one pair into the body of a record
+ *
+ * @param[out] dbuff		to write the pair to.
+ * @param[in] dict		protocol dictionary of the request.
+ * @param[in] vp		to encode.
+ * @return
+ *	- >0 the number of bytes written.
+ *	- 0 if the pair isn't from the protocol or internal dictionaries, and was skipped.
+ *	- <0 on error.
+ */
+ssize_t fr_detail_binary_pair_encode(fr_dbuff_t *dbuff, fr_dict_t const *dict, fr_pair_t *vp)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(dbuff);
+	fr_dict_t const	*vp_dict = fr_dict_by_da(vp->da);
+	ssize_t		slen;
+
+	if (vp_dict == dict) {
+		FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t) FR_DETAIL_BINARY_DICT_PROTOCOL);
+
+	} else if (vp_dict == fr_dict_internal()) {
+		FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t) FR_DETAIL_BINARY_DICT_INTERNAL);
+
+	} else {
+		return 0;
+	}
+
+	slen = fr_cbor_encode_pair(&work_dbuff, vp);
+	if (slen <= 0) return slen - 1;
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+/** Decode the body of a record
+ *
+ * @param[in] ctx		to allocate pairs in.
+ * @param[out] out		where to add the decoded pairs.
+ * @param[in] dict		protocol dictionary to decode protocol pairs with.
+ * @param[in] data		body of the record.
+ * @param[in] data_len		Length of the body.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Any pairs which were decoded are left in out.
+ */
+int fr_detail_binary_decode(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dict_t const *dict,
+			    uint8_t const *data, size_t data_len)
+{
+	fr_dbuff_t		dbuff = FR_DBUFF_TMP(data, data_len);
+	fr_dict_attr_t const	*parent;
+	uint8_t			which;
+	ssize_t			slen;
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		FR_DBUFF_OUT_RETURN(&which, &dbuff);
+
+		switch (which) {
+		case FR_DETAIL_BINARY_DICT_PROTOCOL:
+			parent = fr_dict_root(dict);
+			break;
+
+		case FR_DETAIL_BINARY_DICT_INTERNAL:
+			parent = fr_dict_root(fr_dict_internal());
+			break;
+
+		default:
+			fr_strerror_printf("Invalid dictionary %u in binary detail record", which);
+			return -1;
+		}
+
+		slen = fr_cbor_decode_pair(ctx, out, &dbuff, parent, true);
+		if (slen <= 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Find the start of the first record at or after an offset
+ *
+ * A header with a valid check is followed by either another valid
+ * header, or the end of the file.  Requiring both makes it very
+ * unlikely that CBOR data is mistaken for a record.
+ *
+ * @param[in] fd		to read from.
+ * @param[in] offset		to start searching from.
+ * @param[in] size		of the file.
+ * @return
+ *	- the offset of the record.
+ *	- -1 if there are no more records in the file.
+ */
+off_t fr_detail_binary_sync(int fd, off_t offset, off_t size)
+{
+	uint8_t			buffer[4096];
+	fr_detail_binary_hdr_t	hdr;
+	off_t			pos = offset;
+	ssize_t			len, i;
+
+	while (pos < size) {
+		len = pread(fd, buffer, sizeof(buffer), pos);
+		if (len < FR_DETAIL_BINARY_HDR_LEN) return -1;
+
+		for (i = 0; i <= (len - FR_DETAIL_BINARY_HDR_LEN); i++) {
+			uint8_t	next[FR_DETAIL_BINARY_HDR_LEN];
+			off_t	next_offset;
+			ssize_t	next_len;
+
+			if (buffer[i] != 0xfe) continue;
+
+			if (fr_detail_binary_hdr_decode(&hdr, buffer + i, len - i) <= 0) continue;
+
+			next_offset = pos + i + FR_DETAIL_BINARY_HDR_LEN + hdr.length;
+			if (next_offset == size) return pos + i;
+			if (next_offset > size) continue;
+
+			next_len = pread(fd, next, sizeof(next), next_offset);
+			if (next_len < 0) return -1;
+
+			if (fr_detail_binary_hdr_decode(&hdr, next, next_len) > 0) return pos + i;
+		}
+
+		/*
+		 *	Re-check the bytes which might be the start of
+		 *	a header that spans the end of the buffer.
+		 */
+		pos += len - FR_DETAIL_BINARY_HDR_LEN + 1;
+	}
+
+	return -1;
+}
@@ -0,0 +1,103 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/detail.h
+ * @brief Binary detail file records, shared by rlm_detail and proto_detail.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(detail_h, "$Id$")
+
+#include <freeradius-devel/util/dbuff.h>
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/time.h>
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *	Each record is a fixed size header, followed by the encoded
+ *	pairs.
+ *
+ *	 0                   1                   2                   3
+ *	 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|     0xfe      |      'D'      |    Version    |     Flags     |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                          Body Length                          |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                   Timestamp (ns since epoch)                  |
+ *	|                                                               |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                         Header Check                          |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *	The check covers everything except the flags, so that readers
+ *	can mark records as done by overwriting a single byte.  It also
+ *	lets readers find the start of a record from an arbitrary
+ *	offset in the file.
+ *
+ *	The body is a sequence of pairs, each one a byte saying which
+ *	dictionary it's from, followed by the CBOR encoded pair.
+ */
+#define FR_DETAIL_BINARY_HDR_LEN	(20)
+#define FR_DETAIL_BINARY_VERSION	(1)
+#define FR_DETAIL_BINARY_FLAGS_OFFSET	(3)
+
+#define FR_DETAIL_BINARY_FLAG_DONE	(0x01)		//!< Record has been processed by a reader.
+
+#define FR_DETAIL_BINARY_DICT_PROTOCOL	(0)		//!< Pair is from the protocol dictionary.
+#define FR_DETAIL_BINARY_DICT_INTERNAL	(1)		//!< Pair is from the internal dictionary.
+
+typedef struct {
+	uint8_t			flags;		//!< FR_DETAIL_BINARY_FLAG_*
+	uint32_t		length;		//!< Length of the body.
+	fr_unix_time_t		timestamp;	//!< When the packet was received.
+} fr_detail_binary_hdr_t;
+
+/** Whether data looks like the start of a binary record
+ *
+ * Text records start with a printable header, so this is enough to
+ * tell the formats apart.
+ */
+static inline bool fr_detail_binary_is_record(uint8_t const *data, size_t data_len)
+{
+	return (data_len >= 2) && (data[0] == 0xfe) && (data[1] == 'D');
+}
+
+void		fr_detail_binary_hdr_encode(uint8_t out[static FR_DETAIL_BINARY_HDR_LEN],
+					    fr_unix_time_t timestamp, uint32_t length);
+
+ssize_t		fr_detail_binary_hdr_decode(fr_detail_binary_hdr_t *hdr, uint8_t const *data, size_t data_len);
+
+ssize_t		fr_detail_binary_pair_encode(fr_dbuff_t *dbuff, fr_dict_t const *dict, fr_pair_t *vp);
+
+int		fr_detail_binary_decode(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dict_t const *dict,
+					uint8_t const *data, size_t data_len);
+
+off_t		fr_detail_binary_sync(int fd, off_t offset, off_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -34,6 +34,17 @@ RCSID("$Id$")
 #include <freeradius-devel/server/util.h>
 #include <freeradius-devel/util/debug.h>
 
+/*
+ *	posix_spawn() lets libc use vfork() or clone(CLONE_VM), so
+ *	the page tables of a large server don't have to be copied
+ *	for every program we run.  We can only use it if we can
+ *	also close the server's file descriptors in the child.
+ */
+#if defined(HAVE_SPAWN_H) && defined(HAVE_POSIX_SPAWN) && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#  define EXEC_USE_SPAWN
+#  include <spawn.h>
+#endif
+
 #define MAX_ENVP 1024
 
 static _Thread_local char *env_exec_arr[MAX_ENVP];	/* Avoid allocing 8k on the stack */
@@ -268,6 +279,7 @@ char **fr_exec_pair_to_env(request_t *request, fr_pair_list_t *env_pairs, bool e
 	return env_arr;
 }
 
+#ifndef EXEC_USE_SPAWN
 /** Start a child process
  *
  * We try to be fail-safe here. So if ANYTHING goes wrong, we exit with status 1.
@@ -390,6 +402,98 @@ static NEVER_RETURNS void exec_child(char **argv, char **envp,
 	 */
 	exit(2);
 }
+#endif
+
+#ifdef EXEC_USE_SPAWN
+/** Point one of the standard descriptors of the child at a pipe, or at /dev/null
+ *
+ */
+static inline CC_HINT(always_inline) int exec_spawn_dup(posix_spawn_file_actions_t *fa, int fd, int target)
+{
+	if (fd < 0) return posix_spawn_file_actions_addopen(fa, target, "/dev/null", O_RDWR, 0);
+
+	return posix_spawn_file_actions_adddup2(fa, fd, target);
+}
+
+/** Start a program with posix_spawn()
+ *
+ * Sets up the child's descriptors the same way as #exec_child,
+ * but without copying the address space of the server.
+ *
+ * @param[out] pid_p		The PID of the child.
+ * @param[in] argv		arg[0] is the path to the program, arg[...] are arguments
+ *				to pass to the program.
+ * @param[in] envp		Environmental variables to pass to the program.
+ * @param[in] exec_wait		if true, redirect the child's stdin, stdout, stderr to
+ *				the pipes passed in.
+ * @param[in] debug		If true, and exec_wait is false, STDERR will be left open
+ *				and pointing to the stderr descriptor of the parent.
+ * @param[in] stdin_pipe	the pipe used to write data to the process.
+ * @param[in] stdout_pipe	the pipe used to read data from the process.
+ * @param[in] stderr_pipe	the pipe used to read error text from the process.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Error retrievable fr_strerror().
+ */
+static int exec_spawn(pid_t *pid_p, char **argv, char **envp,
+		      bool exec_wait, bool debug,
+		      int stdin_pipe[static 2], int stdout_pipe[static 2], int stderr_pipe[static 2])
+{
+	posix_spawn_file_actions_t	fa;
+	posix_spawnattr_t		attr;
+	int				ret;
+
+	ret = posix_spawn_file_actions_init(&fa);
+	if (ret != 0) {
+		fr_strerror_printf("Failed initialising spawn actions: %s", fr_syserror(ret));
+		return -1;
+	}
+
+	ret = posix_spawnattr_init(&attr);
+	if (ret != 0) {
+		fr_strerror_printf("Failed initialising spawn attributes: %s", fr_syserror(ret));
+		posix_spawn_file_actions_destroy(&fa);
+		return -1;
+	}
+
+#ifdef POSIX_SPAWN_USEVFORK
+	/*
+	 *	Only needed for older versions of glibc, newer
+	 *	versions always use clone(CLONE_VM | CLONE_VFORK).
+	 */
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+#endif
+
+	if (exec_wait) {
+		ret = exec_spawn_dup(&fa, (stdin_pipe[1] >= 0) ? stdin_pipe[0] : -1, STDIN_FILENO);
+		if (ret == 0) ret = exec_spawn_dup(&fa, stdout_pipe[1], STDOUT_FILENO);
+		if (ret == 0) ret = exec_spawn_dup(&fa, stderr_pipe[1], STDERR_FILENO);
+	} else {
+		ret = exec_spawn_dup(&fa, -1, STDIN_FILENO);
+		if (ret == 0) ret = exec_spawn_dup(&fa, -1, STDOUT_FILENO);
+		if ((ret == 0) && !debug) ret = exec_spawn_dup(&fa, -1, STDERR_FILENO);
+	}
+
+	/*
+	 *	Close everything else, including the other
+	 *	ends of the pipes.
+	 */
+	if (ret == 0) ret = posix_spawn_file_actions_addclosefrom_np(&fa, STDERR_FILENO + 1);
+	if (ret != 0) {
+		fr_strerror_printf("Failed setting up descriptors for \"%s\": %s", argv[0], fr_syserror(ret));
+		goto done;
+	}
+
+	ret = posix_spawn(pid_p, argv[0], &fa, &attr, argv, envp);
+	if (ret != 0) fr_strerror_printf("Failed to execute \"%s\": %s", argv[0], fr_syserror(ret));
+
+done:
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+
+	return (ret == 0) ? 0 : -1;
+}
+#endif
 
 /** Merge extra environmental variables and potentially the inherited environment
  *
@@ -464,6 +568,16 @@ int fr_exec_fork_nowait(fr_event_list_t *el, char **argv_in, char **env_in, bool
 	pid_t		pid;
 
 	env = exec_build_env(env_in, env_inherit);
+#ifdef EXEC_USE_SPAWN
+	{
+		int unused[2] = { -1, -1 };
+
+		if (exec_spawn(&pid, argv_in, env, false, debug, unused, unused, unused) < 0) {
+		error:
+			return -1;
+		}
+	}
+#else
 	pid = fork();
 	/*
 	 *	The child never returns from calling exec_child();
@@ -479,6 +593,7 @@ int fr_exec_fork_nowait(fr_event_list_t *el, char **argv_in, char **env_in, bool
 	error:
 		return -1;
 	}
+#endif
 
 	/*
 	 *	Ensure that we can clean up any child processes.  We
@@ -570,6 +685,9 @@ int fr_exec_fork_wait(pid_t *pid_p,
 	}
 
 	env = exec_build_env(env_in, env_inherit);
+#ifdef EXEC_USE_SPAWN
+	if (exec_spawn(&pid, argv_in, env, true, debug, stdin_pipe, stdout_pipe, stderr_pipe) < 0) goto error4;
+#else
 	pid = fork();
 
 	/*
@@ -578,9 +696,9 @@ int fr_exec_fork_wait(pid_t *pid_p,
 	if (pid == 0) exec_child(argv_in, env, true, debug, stdin_pipe, stdout_pipe, stderr_pipe);
 	if (pid < 0) {
 		fr_strerror_printf("Couldn't fork %s", argv_in[0]);
-		*pid_p = -1;	/* Ensure the PID is set even if the caller didn't check the return code */
-		goto error3;
+		goto error4;
 	}
+#endif
 
 	/*
 	 *	Tell the caller the childs PID, and the FD to read from.
@@ -603,6 +721,12 @@ int fr_exec_fork_wait(pid_t *pid_p,
 	}
 
 	return 0;
+
+error4:
+	*pid_p = -1;	/* Ensure the PID is set even if the caller didn't check the return code */
+	close(stderr_pipe[0]);
+	close(stderr_pipe[1]);
+	goto error3;
 }
 
 /** Similar to fr_exec_oneshot, but does not attempt to parse output
@@ -27,7 +27,9 @@
 #include <freeradius-devel/server/exfile.h>
 #include <freeradius-devel/server/trigger.h>
 
+#include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/file.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/perm.h>
@@ -36,6 +38,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 typedef struct {
 	int			fd;			//!< File descriptor associated with an entry.
 	uint32_t		hash;			//!< Hash for cheap comparison.
@@ -46,6 +54,15 @@ typedef struct {
 } exfile_entry_t;
 
 
+/** Shared between a per-thread exfile_t, and each thread's descriptor cache for it
+ *
+ * Outlives the exfile_t until every thread has freed its cache.
+ */
+typedef struct {
+	_Atomic(uint32_t)	refs;			//!< The exfile_t, and each thread cache.
+	_Atomic(bool)		freed;			//!< The exfile_t has been freed.
+} exfile_shared_t;
+
 struct exfile_s {
 	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
 	fr_time_delta_t		max_idle;		//!< Maximum idle time for a descriptor.
@@ -53,11 +70,32 @@ struct exfile_s {
 	pthread_mutex_t		mutex;
 	exfile_entry_t		*entries;
 	bool			locking;
+	bool			per_thread;		//!< Each thread has its own descriptors, opened with
+							///< O_APPEND, and files are never locked.
+	uint64_t		id;			//!< Used to find this handle's per-thread descriptors.
+	exfile_shared_t		*shared;		//!< Tells threads when this handle has been freed.
 	CONF_SECTION		*conf;			//!< Conf section to search for triggers.
 	char const		*trigger_prefix;	//!< Trigger path in the global trigger section.
 	fr_pair_list_t		trigger_args;		//!< Arguments to pass to trigger.
 };
 
+/** Descriptors one thread has open for one exfile_t in per-thread mode
+ *
+ */
+typedef struct {
+	uint64_t		id;			//!< Of the exfile_t these descriptors belong to.
+	exfile_shared_t		*shared;		//!< Of the exfile_t these descriptors belong to.
+	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
+	fr_time_t		last_cleaned;		//!< Last time idle descriptors were closed.
+	exfile_entry_t		*entries;		//!< Open descriptors.
+	fr_dlist_t		entry;			//!< Entry in the thread's list of caches.
+} exfile_thread_t;
+
+static _Atomic(uint64_t)		exfile_id;		//!< Next per-thread handle id.
+static _Atomic(uint64_t)		exfile_generation;	//!< Incremented when a per-thread handle is freed.
+static _Thread_local fr_dlist_head_t	*exfile_thread_caches;	//!< This thread's descriptor caches.
+static _Thread_local uint64_t		exfile_thread_generation;	//!< Last generation this thread checked.
+
 #define MAX_TRY_LOCK 4			//!< How many times we attempt to acquire a lock
 					//!< before giving up.
 
@@ -117,10 +155,25 @@ static void exfile_cleanup_entry(exfile_t *ef, exfile_entry_t *entry)
 }
 
 
+static void exfile_shared_release(exfile_shared_t *shared)
+{
+	if (atomic_fetch_sub(&shared->refs, 1) == 1) talloc_free(shared);
+}
+
 static int _exfile_free(exfile_t *ef)
 {
 	uint32_t i;
 
+	/*
+	 *	Threads close their descriptors for this
+	 *	handle the next time they open a file.
+	 */
+	if (ef->shared) {
+		atomic_store(&ef->shared->freed, true);
+		atomic_fetch_add(&exfile_generation, 1);
+		exfile_shared_release(ef->shared);
+	}
+
 	pthread_mutex_lock(&ef->mutex);
 
 	for (i = 0; i < ef->max_entries; i++) {
@@ -207,16 +260,55 @@ void exfile_enable_triggers(exfile_t *ef, CONF_SECTION *conf, char const *trigge
 	(void) fr_pair_list_copy(ef, &ef->trigger_args, trigger_args);
 }
 
+/** Give each thread its own file descriptors, and append to files without locking them
+ *
+ * Files are opened with O_APPEND, so each write() or writev() is
+ * appended to the end of the file as a single unit, even when
+ * multiple threads are writing to the same file.  Callers must
+ * write each record with a single call, and should keep records
+ * under PIPE_BUF bytes, as some filesystems (e.g. NFS) don't
+ * guarantee atomicity for larger writes.
+ *
+ * Rotation is detected by comparing the inode of the named file
+ * with the inode of the open descriptor each time the file is opened.
+ *
+ * As files are never locked, this mode must not be used where another
+ * process coordinates with the server using locks, e.g. the detail
+ * file reader.
+ *
+ * Must be called before the first call to exfile_open().
+ *
+ * @param[in] ef to switch to per-thread mode.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_enable_per_thread(exfile_t *ef)
+{
+	ef->shared = talloc_zero(NULL, exfile_shared_t);
+	if (!ef->shared) {
+		fr_strerror_const("Failed allocating per-thread state");
+		return -1;
+	}
+	atomic_init(&ef->shared->refs, 1);
+	atomic_init(&ef->shared->freed, false);
+
+	ef->per_thread = true;
+	ef->id = atomic_fetch_add(&exfile_id, 1) + 1;
+
+	return 0;
+}
+
 
 /*
  *	Try to open the file. It it doesn't exist, try to
  *	create it's parent directories.
  */
-static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissions)
+static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissions, int flags)
 {
 	int fd;
 
-	fd = open(filename, O_RDWR | O_CREAT, permissions);
+	fd = open(filename, flags | O_CREAT, permissions);
 	if (fd < 0) {
 		mode_t dirperm;
 		char *p, *dir;
@@ -251,7 +343,7 @@ static int exfile_open_mkdir(exfile_t *ef, char const *filename, mode_t permissi
 		}
 		talloc_free(dir);
 
-		fd = open(filename, O_RDWR | O_CREAT, permissions);
+		fd = open(filename, flags | O_CREAT, permissions);
 		if (fd < 0) {
 			fr_strerror_printf("Failed to open file %s: %s", filename, fr_syserror(errno));
 			return -1;
@@ -379,7 +471,7 @@ static int exfile_open_lock(exfile_t *ef, char const *filename, mode_t permissio
 	ef->entries[i].fd = -1;
 
 reopen:
-	ef->entries[i].fd = exfile_open_mkdir(ef, filename, permissions);
+	ef->entries[i].fd = exfile_open_mkdir(ef, filename, permissions, O_RDWR);
 	if (ef->entries[i].fd < 0) goto error;
 
 	exfile_trigger_exec(ef, &ef->entries[i], "open");
@@ -490,6 +582,198 @@ try_lock:
 	return ef->entries[i].fd;
 }
 
+static int _exfile_thread_free(exfile_thread_t *t)
+{
+	uint32_t i;
+
+	/*
+	 *	The exfile_t may already have been freed, so
+	 *	we can't run triggers.
+	 */
+	for (i = 0; i < t->max_entries; i++) {
+		if (t->entries[i].fd >= 0) close(t->entries[i].fd);
+	}
+
+	exfile_shared_release(t->shared);
+
+	return 0;
+}
+
+static int _exfile_thread_caches_free(void *uctx)
+{
+	fr_dlist_head_t	*list = talloc_get_type_abort(uctx, fr_dlist_head_t);
+	exfile_thread_t	*t;
+
+	while ((t = fr_dlist_pop_head(list))) talloc_free(t);
+
+	return talloc_free(list);
+}
+
+/** Find or allocate the calling thread's descriptor cache for an exfile_t
+ *
+ */
+static exfile_thread_t *exfile_thread_cache(exfile_t *ef)
+{
+	fr_dlist_head_t	*list = exfile_thread_caches;
+	exfile_thread_t	*t = NULL;
+	uint32_t	i;
+
+	if (unlikely(!list)) {
+		list = talloc_zero(NULL, fr_dlist_head_t);
+		if (!list) return NULL;
+
+		fr_dlist_talloc_init(list, exfile_thread_t, entry);
+		fr_atexit_thread_local(exfile_thread_caches, _exfile_thread_caches_free, list);
+	}
+
+	/*
+	 *	A handle has been freed since we last looked,
+	 *	so close the descriptors of any of ours which
+	 *	have gone.
+	 */
+	if (unlikely(atomic_load_explicit(&exfile_generation, memory_order_relaxed) != exfile_thread_generation)) {
+		exfile_thread_generation = atomic_load(&exfile_generation);
+
+		while ((t = fr_dlist_next(list, t))) {
+			exfile_thread_t *dead;
+
+			if (!atomic_load(&t->shared->freed)) continue;
+
+			dead = t;
+			t = fr_dlist_remove(list, t);
+			talloc_free(dead);
+		}
+	}
+
+	while ((t = fr_dlist_next(list, t))) {
+		if (t->id == ef->id) return t;
+	}
+
+	t = talloc_zero(list, exfile_thread_t);
+	if (!t) return NULL;
+
+	t->entries = talloc_zero_array(t, exfile_entry_t, ef->max_entries);
+	if (!t->entries) {
+		talloc_free(t);
+		return NULL;
+	}
+	for (i = 0; i < ef->max_entries; i++) t->entries[i].fd = -1;
+
+	t->id = ef->id;
+	t->shared = ef->shared;
+	atomic_fetch_add(&t->shared->refs, 1);
+	t->max_entries = ef->max_entries;
+	talloc_set_destructor(t, _exfile_thread_free);
+
+	fr_dlist_insert_head(list, t);
+
+	return t;
+}
+
+/** Open a file using the calling thread's descriptor cache
+ *
+ * No mutexes, and no file locks.  @see exfile_enable_per_thread.
+ */
+static int exfile_open_per_thread(exfile_t *ef, char const *filename, mode_t permissions, off_t *offset)
+{
+	exfile_thread_t	*t;
+	exfile_entry_t	*entry = NULL, *unused = NULL, *oldest = NULL;
+	uint32_t	i, hash;
+	fr_time_t	now;
+	bool		do_cleanup = false;
+	struct stat	st;
+
+	t = exfile_thread_cache(ef);
+	if (!t) {
+		fr_strerror_const("Failed allocating thread file descriptor cache");
+		return -1;
+	}
+
+	hash = fr_hash_string(filename);
+	now = fr_time();
+
+	if (fr_time_gt(now, fr_time_add(t->last_cleaned, fr_time_delta_from_sec(1)))) {
+		do_cleanup = true;
+		t->last_cleaned = now;
+	}
+
+	for (i = 0; i < t->max_entries; i++) {
+		exfile_entry_t *e = &t->entries[i];
+
+		if (!e->filename) {
+			if (!unused) unused = e;
+			continue;
+		}
+
+		if (!entry && (e->hash == hash) && (strcmp(e->filename, filename) == 0)) {
+			entry = e;
+			if (!do_cleanup) break;
+			continue;
+		}
+
+		if (do_cleanup && fr_time_lt(fr_time_add(e->last_used, ef->max_idle), now)) {
+			exfile_cleanup_entry(ef, e);
+			if (!unused) unused = e;
+			continue;
+		}
+
+		if (!oldest || fr_time_lt(e->last_used, oldest->last_used)) oldest = e;
+	}
+
+	if (entry) {
+		/*
+		 *	If the file has been moved or deleted,
+		 *	e.g. by log rotation, open the new one.
+		 */
+		if ((stat(filename, &st) == 0) && (st.st_dev == entry->st_dev) && (st.st_ino == entry->st_ino)) {
+			goto done;
+		}
+
+		close(entry->fd);
+		entry->fd = -1;
+		goto reopen;
+	}
+
+	if (!unused) {
+		exfile_cleanup_entry(ef, oldest);
+		unused = oldest;
+	}
+
+	entry = unused;
+	entry->hash = hash;
+	entry->filename = talloc_typed_strdup(t->entries, filename);
+	entry->fd = -1;
+
+reopen:
+	entry->fd = exfile_open_mkdir(ef, filename, permissions, O_WRONLY | O_APPEND);
+	if (entry->fd < 0) {
+	error:
+		exfile_cleanup_entry(ef, entry);
+		return -1;
+	}
+
+	if (fstat(entry->fd, &st) < 0) {
+		fr_strerror_printf("Failed to stat file %s: %s", filename, fr_syserror(errno));
+		goto error;
+	}
+	entry->st_dev = st.st_dev;
+	entry->st_ino = st.st_ino;
+
+	exfile_trigger_exec(ef, entry, "open");
+
+done:
+	entry->last_used = now;
+
+	/*
+	 *	Other threads may be appending too, so the
+	 *	offset is only a hint, e.g. that the file is
+	 *	new and needs a header.
+	 */
+	if (offset) *offset = lseek(entry->fd, 0, SEEK_END);
+
+	return entry->fd;
+}
+
 /** Open a new log file, or maybe an existing one.
  *
  * When multithreaded, the FD is locked via a mutex.  This way we're
@@ -507,8 +791,10 @@ int exfile_open(exfile_t *ef, char const *filename, mode_t permissions, off_t *o
 {
 	if (!ef || !filename) return -1;
 
+	if (ef->per_thread) return exfile_open_per_thread(ef, filename, permissions, offset);
+
 	if (!ef->locking) {
-		int found = exfile_open_mkdir(ef, filename, permissions);
+		int found = exfile_open_mkdir(ef, filename, permissions, O_RDWR);
 		off_t real_offset;
 
 		if (found < 0) return -1;
@@ -561,6 +847,12 @@ static int exfile_close_lock(exfile_t *ef, int fd)
  */
 int exfile_close(exfile_t *ef, int fd)
 {
+	/*
+	 *	Descriptors stay open in the thread's
+	 *	cache, and there's nothing to unlock.
+	 */
+	if (ef->per_thread) return 0;
+
 	if (!ef->locking) {
 		/*
 		 *	No locking: just close the file.
@@ -40,6 +40,8 @@ exfile_t	*exfile_init(TALLOC_CTX *ctx, uint32_t entries, fr_time_delta_t idle, b
 void		exfile_enable_triggers(exfile_t *ef, CONF_SECTION *cs, char const *trigger_prefix,
 				       fr_pair_list_t *trigger_args);
 
+int		exfile_enable_per_thread(exfile_t *ef);
+
 CC_ACQUIRE_HANDLE("exfile_fd")
 int		exfile_open(exfile_t *lf, char const *filename, mode_t permissions, off_t *offset);
 
@@ -10,6 +10,7 @@ SOURCES	:= \
 	command.c \
 	connection.c \
 	dependency.c \
+	detail.c \
 	dl_module.c \
 	exec.c \
 	exec_legacy.c \
@@ -21,6 +22,7 @@ SOURCES	:= \
 	map.c \
 	map_async.c \
 	map_proc.c \
+	metrics.c \
 	module.c \
 	module_method.c \
 	module_rlm.c \
@@ -41,6 +43,7 @@ SOURCES	:= \
 	tmpl_eval.c \
 	tmpl_tokenize.c \
 	time_tracking.c \
+	trace.c \
 	trigger.c \
 	trunk.c \
 	users_file.c \
@@ -597,6 +597,111 @@ static void vlog_module_failure_msg(request_t *request, char const *fmt, va_list
 	}
 }
 
+/** Record a log message in binary form, to be formatted later if needed
+ *
+ * Used as a #log_func_t to keep a "flight recorder" of a request's
+ * debug output, without paying the cost of formatting every message.
+ *
+ * @param[in] type	of log message, #L_ERR, #L_WARN, #L_INFO, #L_DBG.
+ * @param[in] lvl	Minimum required server or request level to output this message.
+ * @param[in] request	The current request.
+ * @param[in] file	src file the log message was generated in.
+ * @param[in] line	number the log message was generated on.
+ * @param[in] fmt	with printf style substitution tokens.
+ * @param[in] ap	Substitution arguments.
+ * @param[in] uctx	The #fr_log_rec_t to record the message in.
+ */
+void vlog_request_rec(fr_log_type_t type, fr_log_lvl_t lvl, request_t *request,
+		      char const *file, int line,
+		      char const *fmt, va_list ap, void *uctx)
+{
+	fr_log_rec_t	*rec = uctx;
+	uint8_t		indent;
+
+	indent = request->log.indent.unlang > sizeof(spaces) - 1 ?
+		 sizeof(spaces) - 1 :
+		 request->log.indent.unlang;
+
+	(void)fr_log_rec_vadd(rec, type, lvl, file, line, indent, fmt, ap);
+}
+
+typedef struct {
+	fr_log_t const	*log;
+	char const	*name;
+} log_request_rec_replay_t;
+
+static void _log_request_rec_replay(fr_log_type_t type, UNUSED fr_log_lvl_t lvl, UNUSED fr_time_t when,
+				    char const *file, int line, uint8_t indent, char const *msg, void *uctx)
+{
+	log_request_rec_replay_t *ctx = uctx;
+
+	fr_log(ctx->log, type, file, line, "(%s)  %.*s%s", ctx->name, indent, spaces, msg);
+}
+
+/** Write out messages recorded by #vlog_request_rec
+ *
+ * @param[in] log	destination to write the messages to.
+ * @param[in] name	of the request the messages were recorded for.
+ * @param[in] rec	to replay.
+ */
+void log_request_rec_replay(fr_log_t const *log, char const *name, fr_log_rec_t *rec)
+{
+	log_request_rec_replay_t ctx = { .log = log, .name = name ? name : "" };
+	uint64_t dropped = fr_log_rec_dropped(rec);
+
+	if (dropped > 0) fr_log(log, L_DBG, __FILE__, __LINE__, "(%s)  ... %" PRIu64 " earlier messages dropped ...",
+				 ctx.name, dropped);
+
+	fr_log_rec_replay(rec, _log_request_rec_replay, &ctx);
+}
+
+typedef struct {
+	fr_log_t const	*log;
+	char const	*name;
+	fr_time_t	start;
+} log_request_rec_dump_t;
+
+static void _log_request_rec_dump(fr_log_type_t type, UNUSED fr_log_lvl_t lvl, fr_time_t when,
+				  char const *file, int line, uint8_t indent, char const *msg, void *uctx)
+{
+	log_request_rec_dump_t *ctx = uctx;
+
+	/*
+	 *	Debug messages would be discarded when the server
+	 *	isn't running in debug mode, which is the whole
+	 *	point of the recorder.
+	 */
+	if ((type & L_DBG) != 0) type = L_INFO;
+
+	fr_log(ctx->log, type, file, line, "(%s)  +%" PRId64 "us  %.*s%s", ctx->name,
+	       fr_time_delta_to_usec(fr_time_sub(when, ctx->start)), indent, spaces, msg);
+}
+
+/** Write out the messages recorded for a slow request
+ *
+ * Unlike #log_request_rec_replay, messages are written whatever the
+ * debug level, and each one is prefixed with the time it was recorded
+ * at, relative to when the request was received.
+ *
+ * @param[in] log	destination to write the messages to.
+ * @param[in] name	of the request the messages were recorded for.
+ * @param[in] start	when the request was received.
+ * @param[in] rec	to dump.
+ */
+void log_request_rec_dump(fr_log_t const *log, char const *name, fr_time_t start, fr_log_rec_t *rec)
+{
+	log_request_rec_dump_t ctx = { .log = log, .name = name ? name : "", .start = start };
+	uint64_t dropped = fr_log_rec_dropped(rec);
+
+	fr_log(log, L_WARN, __FILE__, __LINE__, "(%s)  Slow request - took %" PRId64 "us, dumping flight recorder",
+	       ctx.name, fr_time_delta_to_usec(fr_time_sub(fr_time(), start)));
+
+	if (dropped > 0) fr_log(log, L_INFO, __FILE__, __LINE__, "(%s)  ... %" PRIu64 " earlier messages dropped ...",
+				 ctx.name, dropped);
+
+	fr_log_rec_replay(rec, _log_request_rec_dump, &ctx);
+}
+
 /** Marshal variadic log arguments into a va_list and pass to normal logging functions
  *
  * @see log_request_error for more details.
@@ -830,9 +935,13 @@ void log_request_pair(fr_log_lvl_t lvl, request_t *request,
 void log_request_pair_list(fr_log_lvl_t lvl, request_t *request,
 			   fr_pair_t const *parent, fr_pair_list_t const *vps, char const *prefix)
 {
-	if (fr_pair_list_empty(vps) || !request->log.dst) return;
+	/*
+	 *	Check the log level first, as looking at the list
+	 *	may mean decoding the whole thing.
+	 */
+	if (!request->log.dst || !log_rdebug_enabled(lvl, request)) return;
 
-	if (!log_rdebug_enabled(lvl, request)) return;
+	if (fr_pair_list_empty(vps)) return;
 
 	RINDENT();
 	fr_pair_list_foreach(vps, vp) {
@@ -854,9 +963,9 @@ void log_request_pair_list(fr_log_lvl_t lvl, request_t *request,
 void log_request_proto_pair_list(fr_log_lvl_t lvl, request_t *request,
 				 fr_pair_t const *parent, fr_pair_list_t const *vps, char const *prefix)
 {
-	if (fr_pair_list_empty(vps) || !request->log.dst) return;
+	if (!request->log.dst || !log_rdebug_enabled(lvl, request)) return;
 
-	if (!log_rdebug_enabled(lvl, request)) return;
+	if (fr_pair_list_empty(vps)) return;
 
 	RINDENT();
 	fr_pair_list_foreach(vps, vp) {
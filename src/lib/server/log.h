@@ -45,6 +45,7 @@ typedef struct rindent_s {
 
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/log_rec.h>
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/pair.h>
 
@@ -110,6 +111,17 @@ void	vlog_request(fr_log_type_t type, fr_log_lvl_t lvl, request_t *request,
 		     char const *fmt, va_list ap, void *uctx)
 	CC_HINT(format (printf, 6, 0)) CC_HINT(nonnull (3, 4));
 
+void	vlog_request_rec(fr_log_type_t type, fr_log_lvl_t lvl, request_t *request,
+			 char const *file, int line,
+			 char const *fmt, va_list ap, void *uctx)
+	CC_HINT(format (printf, 6, 0)) CC_HINT(nonnull (3, 6, 8));
+
+void	log_request_rec_replay(fr_log_t const *log, char const *name, fr_log_rec_t *rec)
+	CC_HINT(nonnull (1, 3));
+
+void	log_request_rec_dump(fr_log_t const *log, char const *name, fr_time_t start, fr_log_rec_t *rec)
+	CC_HINT(nonnull (1, 4));
+
 void	log_request(fr_log_type_t type, fr_log_lvl_t lvl, request_t *request,
 		    char const *file, int line,
 		    char const *fmt, ...)
@@ -34,9 +34,12 @@ RCSID("$Id$")
 #include <freeradius-devel/server/map_proc.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/util.h>
 #include <freeradius-devel/server/virtual_servers.h>
 
+#include <freeradius-devel/io/network.h>
+
 #include <freeradius-devel/unlang/xlat.h>
 
 #include <freeradius-devel/util/conf.h>
@@ -96,6 +99,7 @@ static int lib_dir_on_read(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 static int talloc_pool_size_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 
 static int max_request_time_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
+static int poll_time_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 
 static int name_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 
@@ -153,6 +157,12 @@ static const conf_parser_t log_config[] = {
 	{ FR_CONF_OFFSET("line_number", main_config_t, log_line_number) },
 	{ FR_CONF_OFFSET("timestamp", main_config_t, log_timestamp) },
 	{ FR_CONF_OFFSET("use_utc", main_config_t, log_dates_utc) },
+	{ FR_CONF_OFFSET("async", main_config_t, log_async) },
+	{ FR_CONF_OFFSET("async_ring_size", main_config_t, log_async_ring_size), .dflt = "4096" },
+	{ FR_CONF_OFFSET("async_drop", main_config_t, log_async_drop) },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("flight_recorder_size", FR_TYPE_SIZE, 0, main_config_t, log_flight_recorder_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("flight_recorder_threshold", main_config_t, log_flight_recorder_threshold), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("flight_recorder_level", main_config_t, log_flight_recorder_lvl), .dflt = "2" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -173,9 +183,34 @@ static const conf_parser_t thread_config[] = {
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", main_config_t, max_workers), .dflt = STRINGIFY(0),
 	  .func = num_workers_parse, .dflt_func = num_workers_dflt },
+	{ FR_CONF_OFFSET("min_workers", main_config_t, min_workers), .dflt = "0" },
 
 	{ FR_CONF_OFFSET_TYPE_FLAGS("stats_interval", FR_TYPE_TIME_DELTA, CONF_FLAG_HIDDEN, main_config_t, stats_interval) },
 
+	{ FR_CONF_OFFSET("network_cpus", main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", main_config_t, worker_cpus) },
+	{ FR_CONF_OFFSET("work_stealing", main_config_t, work_stealing), .dflt = "no" },
+	{ FR_CONF_OFFSET("background_workers", main_config_t, background_workers), .dflt = "0" },
+	{ FR_CONF_OFFSET("background_cpus", main_config_t, background_cpus) },
+	{ FR_CONF_OFFSET("poll_time", main_config_t, poll_time), .dflt = "0", .func = poll_time_parse },
+
+	{ FR_CONF_OFFSET_TYPE_FLAGS("ring_buffer_size", FR_TYPE_SIZE, 0, main_config_t, ring_buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("hugepages", main_config_t, hugepages), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_free_requests", main_config_t, max_free_requests), .dflt = "0" },
+
+	{ FR_CONF_OFFSET("dispatch", main_config_t, network_dispatch),
+	  .func = cf_table_parse_int,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_network_dispatch_table, .len = &fr_network_dispatch_table_len },
+	  .dflt = "load" },
+
+	{ FR_CONF_OFFSET("target_latency", main_config_t, target_latency), .dflt = "0" },
+	{ FR_CONF_OFFSET("latency_interval", main_config_t, latency_interval), .dflt = "0.1" },
+
+	{ FR_CONF_OFFSET("event_backend", main_config_t, event_backend),
+	  .func = cf_table_parse_int,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_event_backend_table, .len = &fr_event_backend_table_len },
+	  .dflt = "kqueue" },
+
 #ifdef WITH_TLS
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_init", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_max", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_max), .dflt = "1024" },
@@ -184,6 +219,31 @@ static const conf_parser_t thread_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const conf_parser_t metrics_config[] = {
+	{ FR_CONF_OFFSET_TYPE_FLAGS("ipaddr", FR_TYPE_COMBO_IP_ADDR, 0, main_config_t, metrics_ipaddr), .dflt = "127.0.0.1" },
+	{ FR_CONF_OFFSET("port", main_config_t, metrics_port), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static const conf_parser_t trace_config[] = {
+	{ FR_CONF_OFFSET_TYPE_FLAGS("ipaddr", FR_TYPE_COMBO_IP_ADDR, 0, main_config_t, trace_ipaddr), .dflt = "127.0.0.1" },
+	{ FR_CONF_OFFSET("port", main_config_t, trace_port), .dflt = "0" },
+	{ FR_CONF_OFFSET("path", main_config_t, trace_path), .dflt = "/v1/traces" },
+	{ FR_CONF_OFFSET("service_name", main_config_t, trace_service_name), .dflt = "freeradius" },
+	{ FR_CONF_OFFSET("sample_rate", main_config_t, trace_sample_rate), .dflt = "0.01" },
+	{ FR_CONF_OFFSET("batch_size", main_config_t, trace_batch_size), .dflt = "512" },
+	{ FR_CONF_OFFSET("queue_size", main_config_t, trace_queue_size), .dflt = "16384" },
+	{ FR_CONF_OFFSET("flush_interval", main_config_t, trace_flush_interval), .dflt = "1.0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static const conf_parser_t profile_config[] = {
+	{ FR_CONF_OFFSET("modules", main_config_t, profile_modules), .dflt = "no" },
+	{ FR_CONF_OFFSET("slow_calls", main_config_t, profile_slow_calls), .dflt = "0" },
+	{ FR_CONF_OFFSET("interval", main_config_t, profile_interval), .dflt = "60" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Migration configuration.
  */
@@ -225,6 +285,9 @@ static const conf_parser_t server_config[] = {
 	{ FR_CONF_OFFSET("panic_action", main_config_t, panic_action) },
 	{ FR_CONF_OFFSET("reverse_lookups", main_config_t, reverse_lookups), .dflt = "no", .func = reverse_lookups_parse },
 	{ FR_CONF_OFFSET("hostname_lookups", main_config_t, hostname_lookups), .dflt = "yes", .func = hostname_lookups_parse },
+	{ FR_CONF_OFFSET("hostname_prefetch_threads", main_config_t, hostname_prefetch_threads), .dflt = "16" },
+	{ FR_CONF_OFFSET("hostname_prefetch_lifetime", main_config_t, hostname_prefetch_lifetime), .dflt = "300" },
+	{ FR_CONF_OFFSET("module_instantiate_threads", main_config_t, module_instantiate_threads), .dflt = "8" },
 	{ FR_CONF_OFFSET("max_request_time", main_config_t, max_request_time), .dflt = STRINGIFY(MAX_REQUEST_TIME), .func = max_request_time_parse },
 	{ FR_CONF_OFFSET("pidfile", main_config_t, pid_file), .dflt = "${run_dir}/radiusd.pid"},
 
@@ -237,6 +300,12 @@ static const conf_parser_t server_config[] = {
 
 	{ FR_CONF_POINTER("thread", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) thread_config, .name2 = CF_IDENT_ANY },
 
+	{ FR_CONF_POINTER("metrics", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) metrics_config },
+
+	{ FR_CONF_POINTER("profile", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) profile_config },
+
+	{ FR_CONF_POINTER("trace", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) trace_config },
+
 	{ FR_CONF_POINTER("migrate", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) migrate_config, .name2 = CF_IDENT_ANY },
 
 #ifndef NDEBUG
@@ -362,6 +431,23 @@ static int max_request_time_parse(TALLOC_CTX *ctx, void *out, void *parent,
 	return 0;
 }
 
+static int poll_time_parse(TALLOC_CTX *ctx, void *out, void *parent,
+			   CONF_ITEM *ci, conf_parser_t const *rule)
+{
+	int		ret;
+	fr_time_delta_t	value;
+
+	if ((ret = cf_pair_parse_value(ctx, out, parent, ci, rule)) < 0) return ret;
+
+	memcpy(&value, out, sizeof(value));
+
+	FR_TIME_DELTA_BOUND_CHECK("poll_time", value, <=, fr_time_delta_from_msec(1));
+
+	memcpy(out, &value, sizeof(value));
+
+	return 0;
+}
+
 static int lib_dir_on_read(UNUSED TALLOC_CTX *ctx, UNUSED void *out, UNUSED void *parent,
 			 CONF_ITEM *ci, UNUSED conf_parser_t const *rule)
 {
@@ -1033,6 +1119,73 @@ static int _dlhandle_free(void **dl_handle)
  *
  *	This function can ONLY be called from the main server process.
  */
+/** Find the hostnames in the configuration
+ *
+ */
+static void main_config_hostname_find(TALLOC_CTX *ctx, char const ***hostnames, CONF_SECTION *cs)
+{
+	CONF_ITEM *ci;
+
+	for (ci = cf_item_next(cs, NULL);
+	     ci != NULL;
+	     ci = cf_item_next(cs, ci)) {
+		CONF_PAIR	*cp;
+		char const	*attr, *value;
+
+		if (cf_item_is_section(ci)) {
+			main_config_hostname_find(ctx, hostnames, cf_item_to_section(ci));
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		cp = cf_item_to_pair(ci);
+		attr = cf_pair_attr(cp);
+		value = cf_pair_value(cp);
+
+		if (!value || (cf_pair_value_quote(cp) == T_BACK_QUOTED_STRING)) continue;
+
+		if ((strcmp(attr, "ipaddr") != 0) &&
+		    (strcmp(attr, "ipv4addr") != 0) &&
+		    (strcmp(attr, "ipv6addr") != 0)) continue;
+
+		MEM(*hostnames = talloc_realloc(ctx, *hostnames, char const *, talloc_array_length(*hostnames) + 1));
+		(*hostnames)[talloc_array_length(*hostnames) - 1] = value;
+	}
+}
+
+/** Resolve all of the hostnames in the configuration, in parallel
+ *
+ * Clients and home servers are parsed one at a time, and each hostname
+ * is resolved as it's parsed.  With many hostnames, that can take a
+ * long time.  So we find them all first, and resolve them at the same
+ * time.  The parsers then get the cached answers.
+ */
+static void main_config_hostname_prefetch(main_config_t const *config, CONF_SECTION *cs)
+{
+	char const	**hostnames = NULL;
+	int		ret;
+	fr_time_t	start;
+
+	if (!config->hostname_prefetch_threads || !fr_hostname_lookups) return;
+
+	main_config_hostname_find(NULL, &hostnames, cs);
+	if (!hostnames) return;
+
+	start = fr_time();
+	ret = fr_inet_hton_prefetch(hostnames, talloc_array_length(hostnames),
+				    config->hostname_prefetch_threads, config->hostname_prefetch_lifetime);
+	talloc_free(hostnames);
+
+	if (ret < 0) {
+		PWARN("Failed resolving hostnames in advance");
+		return;
+	}
+
+	if (ret) DEBUG("Resolved %d hostname(s) in %pVs", ret,
+		       fr_box_time_delta(fr_time_sub(fr_time(), start)));
+}
+
 int main_config_init(main_config_t *config)
 {
 	char const	*p = NULL;
@@ -1338,6 +1491,13 @@ int main_config_init(main_config_t *config)
 	DEBUG("Parsing main configuration");
 	if (cf_section_parse(config, config, cs) < 0) goto failure;
 
+	/*
+	 *	Resolve the hostnames used in the configuration in
+	 *	parallel, instead of one at a time as each section is
+	 *	parsed.
+	 */
+	main_config_hostname_prefetch(config, cs);
+
 	/*
 	 *	Reset the colourisation state.  The configuration
 	 *	files can disable colourisation if the terminal
@@ -1433,6 +1593,7 @@ int main_config_free(main_config_t **config)
 	 *	structures.
 	 */
 	client_list_free();
+	fr_inet_hton_cache_free();
 
 	/*
 	 *	Frees current config and any previous configs.
@@ -1466,6 +1627,94 @@ void hup_logfile(main_config_t *config)
 	}
 }
 
+/** Read the configuration files again, without acting on them
+ *
+ * The new configuration is only used to find out what has changed.
+ */
+static CONF_SECTION *main_config_reread(main_config_t const *config)
+{
+	CONF_SECTION	*cs, *subcs;
+	char		buffer[1024];
+
+	MEM(cs = cf_section_alloc(NULL, NULL, "main", NULL));
+	MEM(subcs = cf_section_alloc(cs, cs, "feature", NULL));
+	dependency_features_init(subcs);
+	MEM(subcs = cf_section_alloc(cs, cs, "version", NULL));
+	dependency_version_numbers_init(subcs);
+
+	snprintf(buffer, sizeof(buffer), "%.200s/%.50s.conf", config->raddb_dir, config->name);
+	if (cf_file_read(cs, buffer) < 0) {
+		ERROR("HUP - Error reading or parsing %s", buffer);
+	error:
+		talloc_free(cs);
+		return NULL;
+	}
+
+	if (config->name && !cf_pair_find(cs, "name")) {
+		MEM(cf_pair_alloc(cs, "name", config->name, T_OP_EQ, T_BARE_WORD, T_DOUBLE_QUOTED_STRING));
+	}
+
+	if (cf_section_pass2(cs) < 0) goto error;
+
+	return cs;
+}
+
+/** Reload the parts of the configuration which have changed
+ *
+ * Modules which support it are re-instantiated with their new
+ * configuration.  Anything else which has changed is logged, as it
+ * needs a restart.
+ */
+static void main_config_reload(main_config_t *config)
+{
+	CONF_SECTION	*cs;
+	int		ret;
+
+	switch (cf_file_changed(config->root_cs)) {
+	case 0:
+		INFO("HUP - No configuration files have changed");
+		return;
+
+	case 1:
+		break;
+
+	default:
+		PERROR("HUP - Failed checking configuration files");
+		return;
+	}
+
+	cs = main_config_reread(config);
+	if (!cs) return;
+
+	/*
+	 *	Virtual servers have their unlang compiled, and
+	 *	their listeners open, so they can't be swapped out.
+	 */
+	cf_section_foreach(cs, server_cs) {
+		CONF_SECTION *old;
+
+		if (strcmp(cf_section_name1(server_cs), "server") != 0) continue;
+
+		old = cf_section_find(config->root_cs, "server", cf_section_name2(server_cs));
+		if (old && cf_section_equal(old, server_cs)) continue;
+
+		cf_log_warn(server_cs, "HUP - Virtual server \"%s\" has %s, the server must be restarted to use it",
+			    cf_section_name2(server_cs), old ? "changed" : "been added");
+	}
+
+	ret = modules_rlm_hup(cs, config->max_request_time);
+
+	/*
+	 *	Reloaded modules hold references to the new
+	 *	configuration, so this frees it only if nothing
+	 *	uses it.  Otherwise it's freed along with the last
+	 *	instance data which refers to it.
+	 */
+	talloc_unlink(NULL, cs);
+
+	if (ret > 0) INFO("HUP - Reloaded %d module(s)", ret);
+}
+
 void main_config_hup(main_config_t *config)
 {
 	fr_time_t		when;
@@ -1491,7 +1740,16 @@ void main_config_hup(main_config_t *config)
 	}
 	last_hup = when;
 
-	INFO("HUP - NYI in version 4");	/* Not yet implemented in v4 */
+	/*
+	 *	Re-resolve any hostnames whose cached addresses have
+	 *	expired, so that new connections use the current ones.
+	 */
+	if (config->hostname_prefetch_threads &&
+	    (fr_inet_hton_cache_refresh(config->hostname_prefetch_threads, config->hostname_prefetch_lifetime) < 0)) {
+		PERROR("HUP - Failed refreshing hostnames");
+	}
+
+	main_config_reload(config);
 }
 
 static fr_table_num_ordered_t config_arg_table[] = {
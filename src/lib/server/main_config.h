@@ -42,6 +42,7 @@ extern main_config_t const *main_config;		//!< Global configuration singleton.
 #include <freeradius-devel/server/tmpl.h>
 
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/event.h>
 
 
 /** Main server configuration
@@ -70,6 +71,10 @@ struct main_config_s {
 
 	bool		reverse_lookups;
 	bool		hostname_lookups;
+	uint32_t	hostname_prefetch_threads;	//!< How many hostnames to resolve at the same time.
+	fr_time_delta_t	hostname_prefetch_lifetime;	//!< How long to use resolved hostnames for.
+
+	uint32_t	module_instantiate_threads;	//!< How many modules to instantiate at the same time.
 
 	char const	*radacct_dir;
 	char const	*lib_dir;
@@ -89,6 +94,15 @@ struct main_config_s {
 	bool		log_timestamp;
 	bool		log_timestamp_is_set;
 
+	bool		log_async;			//!< Write log messages from a dedicated thread.
+	uint32_t	log_async_ring_size;		//!< Messages each thread can queue for the log thread.
+	bool		log_async_drop;			//!< Drop messages when a thread's queue is full.
+
+	size_t		log_flight_recorder_size;	//!< Bytes of each request's flight recorder, 0 disables it.
+	fr_time_delta_t	log_flight_recorder_threshold;	//!< Requests taking longer than this have their
+							///< flight recorder written to the log.
+	uint32_t	log_flight_recorder_lvl;	//!< Debug level messages are recorded at.
+
 	int32_t		syslog_facility;
 
 	char const	*dict_dir;			//!< Where to load dictionaries from.
@@ -149,7 +163,37 @@ struct main_config_s {
 
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
+	uint32_t	min_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	fr_event_backend_t event_backend;		//!< for the scheduler's event lists
+	char const	*network_cpus;			//!< for the scheduler
+	char const	*worker_cpus;			//!< for the scheduler
+	bool		work_stealing;			//!< for the scheduler
+	uint32_t	background_workers;		//!< for the scheduler
+	char const	*background_cpus;		//!< for the scheduler
+	fr_time_delta_t	poll_time;			//!< for the scheduler
+	size_t		ring_buffer_size;		//!< for the scheduler
+	bool		hugepages;			//!< for the scheduler
+	uint32_t	max_free_requests;		//!< for the scheduler
+	int		network_dispatch;		//!< for the scheduler, an fr_network_dispatch_t.
+	fr_time_delta_t	target_latency;			//!< for the scheduler
+	fr_time_delta_t	latency_interval;		//!< for the scheduler
+
+	fr_ipaddr_t	metrics_ipaddr;			//!< Address to serve metrics on.
+	uint16_t	metrics_port;			//!< Port to serve metrics on.  0 disables them.
+
+	bool		profile_modules;		//!< Record CPU time, yields and waits for module calls.
+	uint32_t	profile_slow_calls;		//!< How many of the slowest module calls to keep.
+	fr_time_delta_t	profile_interval;		//!< How often to start a new set of slow calls.
+
+	fr_ipaddr_t	trace_ipaddr;			//!< Address of the OpenTelemetry collector.
+	uint16_t	trace_port;			//!< Port of the collector.  0 disables tracing.
+	char const	*trace_path;			//!< Path to POST spans to.
+	char const	*trace_service_name;		//!< Identifies this server in the traces.
+	double		trace_sample_rate;		//!< Fraction of requests to trace.
+	uint32_t	trace_batch_size;		//!< Maximum spans to export at once.
+	uint32_t	trace_queue_size;		//!< Spans waiting to be exported.  More are dropped.
+	fr_time_delta_t	trace_flush_interval;		//!< How long spans wait for a batch to fill.
 
 #ifndef NDEBUG
 	uint32_t	ins_max;			//!< max instruction count
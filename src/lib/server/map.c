@@ -1761,29 +1761,17 @@ do {\
 	} \
 } while (0)
 
-/** Convert #map_t to #fr_pair_t (s) and add them to a #request_t.
+/** Apply one map, using tmp_ctx for scratch allocations
  *
- * Takes a single #map_t, resolves request and list identifiers
- * to pointers in the current request, then attempts to retrieve module
- * specific value(s) using callback, and adds the resulting values to the
- * correct request/list.
- *
- * @param request The current request.
- * @param map specifying destination attribute and location and src identifier.
- * @param func to retrieve module specific values and convert them to
- *	#fr_pair_t.
- * @param ctx to be passed to func.
- * @return
- *	- -1 if the operation failed.
- *	- -2 in the source attribute wasn't valid.
- *	- 0 on success.
+ * Everything allocated in tmp_ctx is freed before returning.
  */
-int map_to_request(request_t *request, map_t const *map, radius_map_getvalue_t func, void *ctx)
+static int map_to_request_internal(request_t *request, TALLOC_CTX *tmp_ctx,
+				   map_t const *map, radius_map_getvalue_t func, void *ctx)
 {
 	int			rcode = 0;
 	fr_pair_t		*dst;
 	fr_pair_list_t		*list, src_list;
-	request_t		*context, *tmp_ctx = NULL;
+	request_t		*context;
 	TALLOC_CTX		*parent;
 	fr_dcursor_t		dst_list;
 
@@ -1800,8 +1788,6 @@ int map_to_request(request_t *request, map_t const *map, radius_map_getvalue_t f
 	fr_assert(map->lhs != NULL);
 	fr_assert(map->rhs != NULL);
 
-	tmp_ctx = talloc_pool(request, 1024);
-
 	/*
 	 *	Preprocessing of the LHS of the map.
 	 */
@@ -2220,7 +2206,17 @@ int map_to_request(request_t *request, map_t const *map, radius_map_getvalue_t f
 			fr_pair_list_free(&src_list);
 		} else {
 			extent = fr_dlist_head(&leaf);
-			(void) fr_pair_list_copy(extent->list_ctx, extent->list, &src_list);
+
+			/*
+			 *	The source pairs were allocated in the
+			 *	context of the list, so if that's where
+			 *	they're going, they can be moved.
+			 */
+			if (extent->list == list) {
+				fr_pair_list_append(list, &src_list);
+			} else {
+				(void) fr_pair_list_copy(extent->list_ctx, extent->list, &src_list);
+			}
 			fr_dlist_talloc_free_head(&leaf);
 		}
 
@@ -2280,7 +2276,79 @@ update:
 
 finish:
 	tmpl_dcursor_clear(&cc);
+	talloc_free_children(tmp_ctx);
+	return rcode;
+}
+
+/** Convert #map_t to #fr_pair_t (s) and add them to a #request_t.
+ *
+ * Takes a single #map_t, resolves request and list identifiers
+ * to pointers in the current request, then attempts to retrieve module
+ * specific value(s) using callback, and adds the resulting values to the
+ * correct request/list.
+ *
+ * @param request The current request.
+ * @param map specifying destination attribute and location and src identifier.
+ * @param func to retrieve module specific values and convert them to
+ *	#fr_pair_t.
+ * @param ctx to be passed to func.
+ * @return
+ *	- -1 if the operation failed.
+ *	- -2 in the source attribute wasn't valid.
+ *	- 0 on success.
+ */
+int map_to_request(request_t *request, map_t const *map, radius_map_getvalue_t func, void *ctx)
+{
+	TALLOC_CTX	*tmp_ctx;
+	int		rcode;
+
+	MEM(tmp_ctx = talloc_pool(request, 1024));
+	rcode = map_to_request_internal(request, tmp_ctx, map, func, ctx);
 	talloc_free(tmp_ctx);
+
+	return rcode;
+}
+
+/** Apply a set of maps to a request
+ *
+ * This is equivalent to calling #map_to_request for each map, but the
+ * scratch memory used to resolve the destination of each map is shared
+ * between all of them.  It's intended for map procs which apply many
+ * maps for each row or entry in a result set.
+ *
+ * @param request	The current request.
+ * @param maps		to apply.  NULL entries are skipped.
+ * @param uctx		to pass to func for each map.
+ * @param num		Number of entries in maps and uctx.
+ * @param func		to retrieve module specific values and convert them to
+ *			#fr_pair_t.
+ * @return
+ *	- The first error returned by #map_to_request, if any map failed.
+ *	  Maps after the one which failed are not applied.
+ *	- 0 on success.
+ */
+int map_list_to_request(request_t *request, map_t const * const *maps, void * const *uctx, size_t num,
+			radius_map_getvalue_t func)
+{
+	TALLOC_CTX	*tmp_ctx;
+	size_t		i;
+	int		rcode = 0;
+
+	/*
+	 *	The pool is emptied after each map, so it only
+	 *	needs to be large enough for one of them.
+	 */
+	MEM(tmp_ctx = talloc_pool(request, 1024));
+
+	for (i = 0; i < num; i++) {
+		if (!maps[i]) continue;
+
+		rcode = map_to_request_internal(request, tmp_ctx, maps[i], func, uctx[i]);
+		if (rcode < 0) break;
+	}
+
+	talloc_free(tmp_ctx);
+
 	return rcode;
 }
 
@@ -165,6 +165,9 @@ int		map_to_list_mod(TALLOC_CTX *ctx, vp_list_mod_t **out,
 int		map_to_request(request_t *request, map_t const *map,
 			       radius_map_getvalue_t func, void *ctx);
 
+int		map_list_to_request(request_t *request, map_t const * const *maps, void * const *uctx, size_t num,
+				    radius_map_getvalue_t func);
+
 ssize_t		map_print(fr_sbuff_t *out, map_t const *map);
 
 void		map_debug_log(request_t *request, map_t const *map,
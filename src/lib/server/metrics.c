@@ -0,0 +1,794 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/metrics.c
+ * @brief Export server statistics over HTTP, in the Prometheus text format.
+ *
+ * The metrics are served from a dedicated thread, so scrapes don't
+ * add requests to the workers.  Nothing the workers use is locked.
+ * Their counters are read directly, and may be slightly out of date.
+ *
+ * The same text is available from the control socket, with
+ * "stats metrics".  That's what "radmin top" reads.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/metrics.h>
+#include <freeradius-devel/server/trace.h>
+#include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/server/virtual_servers.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/sbuff.h>
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <poll.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define METRICS_WORKER_STATS	(8)
+#define METRICS_NETWORK_STATS	(5)
+
+typedef struct {
+	unsigned int		id;
+	uint64_t		stats[METRICS_WORKER_STATS];
+} metrics_worker_t;
+
+typedef struct {
+	unsigned int		id;
+	uint64_t		stats[METRICS_NETWORK_STATS];
+} metrics_network_t;
+
+/** Totals for all trunks with the same name
+ *
+ * Each thread has its own trunk for a module, all with the same name.
+ */
+typedef struct {
+	char const		*name;
+	uint64_t		req_alloc;
+	uint64_t		req_alloc_new;
+	uint64_t		req_alloc_reused;
+	uint64_t		req_coalesced;
+	uint64_t		connections;
+	uint64_t		connecting;
+	uint64_t		active;
+	uint64_t		full;
+	uint64_t		inactive;
+	uint64_t		draining;
+} metrics_trunk_t;
+
+typedef struct {
+	char const		*module;
+	char const		*method;
+	unlang_module_profile_t	p;
+} metrics_module_t;
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	metrics_worker_t	*workers;
+	metrics_network_t	*networks;
+	metrics_trunk_t		*trunks;
+	metrics_module_t	*modules;
+} metrics_snapshot_t;
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_sbuff_t		*out;
+	char const		*server;
+	char const		*path[16];		//!< Names of the enclosing entries.
+	char const		**seen;			//!< Paths already written, for this server.
+} metrics_latency_ctx_t;
+
+static fr_schedule_t		*metrics_sc;
+static int			metrics_fd = -1;
+static pthread_t		metrics_pthread_id;
+static bool			metrics_started;
+static atomic_bool		metrics_stop;
+static CONF_SECTION		*metrics_root_cs;
+static bool			metrics_slow_calls;
+static bool			metrics_trace;
+
+static fr_sbuff_escape_rules_t const metrics_label_escape = {
+	.name = "metrics label",
+	.chr = '\\',
+	.subs = {
+		['\\'] = '\\',
+		['"'] = '"',
+		['\n'] = 'n'
+	}
+};
+
+static void metrics_worker_walk(void *uctx, unsigned int id, fr_worker_t const *worker)
+{
+	metrics_snapshot_t	*snap = uctx;
+	size_t			len = talloc_array_length(snap->workers);
+
+	MEM(snap->workers = talloc_realloc(snap->ctx, snap->workers, metrics_worker_t, len + 1));
+	snap->workers[len] = (metrics_worker_t){ .id = id };
+	(void) fr_worker_stats(worker, METRICS_WORKER_STATS, snap->workers[len].stats);
+}
+
+static void metrics_network_walk(void *uctx, unsigned int id, fr_network_t const *nr)
+{
+	metrics_snapshot_t	*snap = uctx;
+	size_t			len = talloc_array_length(snap->networks);
+
+	MEM(snap->networks = talloc_realloc(snap->ctx, snap->networks, metrics_network_t, len + 1));
+	snap->networks[len] = (metrics_network_t){ .id = id };
+	(void) fr_network_stats(nr, METRICS_NETWORK_STATS, snap->networks[len].stats);
+}
+
+static void metrics_trunk_walk(void *uctx, char const *name, trunk_t *trunk)
+{
+	metrics_snapshot_t	*snap = uctx;
+	metrics_trunk_t		*mt = NULL;
+	size_t			i, len = talloc_array_length(snap->trunks);
+
+	if (!name) name = "";
+
+	for (i = 0; i < len; i++) {
+		if (strcmp(snap->trunks[i].name, name) == 0) {
+			mt = &snap->trunks[i];
+			break;
+		}
+	}
+
+	if (!mt) {
+		MEM(snap->trunks = talloc_realloc(snap->ctx, snap->trunks, metrics_trunk_t, len + 1));
+		mt = &snap->trunks[len];
+		*mt = (metrics_trunk_t){ .name = talloc_strdup(snap->ctx, name) };
+	}
+
+	mt->req_alloc += trunk->req_alloc;
+	mt->req_alloc_new += trunk->req_alloc_new;
+	mt->req_alloc_reused += trunk->req_alloc_reused;
+	mt->req_coalesced += trunk->req_coalesced;
+	mt->connections += trunk_connection_count_by_state(trunk, TRUNK_CONN_ALL);
+	mt->connecting += trunk_connection_count_by_state(trunk, TRUNK_CONN_INIT | TRUNK_CONN_CONNECTING);
+	mt->active += trunk_connection_count_by_state(trunk, TRUNK_CONN_ACTIVE);
+	mt->full += trunk_connection_count_by_state(trunk, TRUNK_CONN_FULL);
+	mt->inactive += trunk_connection_count_by_state(trunk, TRUNK_CONN_INACTIVE | TRUNK_CONN_INACTIVE_DRAINING);
+	mt->draining += trunk_connection_count_by_state(trunk, TRUNK_CONN_DRAINING | TRUNK_CONN_DRAINING_TO_FREE);
+}
+
+static void metrics_header(fr_sbuff_t *out, char const *name, char const *type, char const *help)
+{
+	(void) fr_sbuff_in_sprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_label(fr_sbuff_t *out, char const *label, char const *value, bool last)
+{
+	(void) fr_sbuff_in_sprintf(out, "%s=\"", label);
+	(void) fr_sbuff_in_escape(out, value, strlen(value), &metrics_label_escape);
+	(void) fr_sbuff_in_strcpy(out, last ? "\"" : "\",");
+}
+
+static void metrics_latency_sample(fr_sbuff_t *out, metrics_latency_ctx_t *lctx, char const *path,
+				   char const *suffix, char const *quantile, double value)
+{
+	(void) fr_sbuff_in_sprintf(out, "freeradius_unlang_latency_seconds%s{", suffix);
+	metrics_label(out, "server", lctx->server, false);
+	metrics_label(out, "path", path, !quantile);
+	if (quantile) metrics_label(out, "quantile", quantile, true);
+	(void) fr_sbuff_in_sprintf(out, "} %.9g\n", value);
+}
+
+static void metrics_latency_walk(void *uctx, char const *name, int depth, fr_histogram_t const *h)
+{
+	metrics_latency_ctx_t	*lctx = uctx;
+	fr_sbuff_t		*out = lctx->out;
+	char			*path;
+	size_t			i, len;
+	int			j;
+	unsigned int		dup = 1;
+
+	if (depth >= (int) NUM_ELEMENTS(lctx->path)) return;
+	lctx->path[depth] = name;
+
+	/*
+	 *	Don't write module calls which haven't been run.
+	 */
+	if (depth && !h->count) return;
+
+	path = talloc_strdup(lctx->ctx, lctx->path[0]);
+	for (j = 1; j <= depth; j++) path = talloc_asprintf_append(path, ".%s", lctx->path[j]);
+
+	/*
+	 *	The same module may be called more than once in a
+	 *	section.  Label sets have to be unique.
+	 */
+	len = talloc_array_length(lctx->seen);
+	for (i = 0; i < len; i++) {
+		if (strcmp(lctx->seen[i], path) == 0) dup++;
+	}
+	MEM(lctx->seen = talloc_realloc(lctx->ctx, lctx->seen, char const *, len + 1));
+	lctx->seen[len] = path;
+	if (dup > 1) path = talloc_asprintf(lctx->ctx, "%s#%u", path, dup);
+
+	metrics_latency_sample(out, lctx, path, "", "0.5", fr_histogram_percentile(h, 50) / (double) NSEC);
+	metrics_latency_sample(out, lctx, path, "", "0.9", fr_histogram_percentile(h, 90) / (double) NSEC);
+	metrics_latency_sample(out, lctx, path, "", "0.99", fr_histogram_percentile(h, 99) / (double) NSEC);
+	metrics_latency_sample(out, lctx, path, "", "0.999", fr_histogram_percentile(h, 99.9) / (double) NSEC);
+	metrics_latency_sample(out, lctx, path, "_sum", NULL, h->sum / (double) NSEC);
+	metrics_latency_sample(out, lctx, path, "_count", NULL, h->count);
+}
+
+/** Write the counters for each worker
+ *
+ */
+static void metrics_workers(fr_sbuff_t *out, metrics_snapshot_t const *snap)
+{
+	static struct {
+		char const	*name;
+		char const	*type;
+		char const	*help;
+		bool		seconds;
+	} const worker_metrics[METRICS_WORKER_STATS] = {
+		{ "freeradius_worker_requests_total", "counter", "Requests received by the worker." },
+		{ "freeradius_worker_replies_total", "counter", "Replies sent by the worker." },
+		{ "freeradius_worker_duplicates_total", "counter", "Duplicate requests received by the worker." },
+		{ "freeradius_worker_dropped_total", "counter", "Requests the worker dropped." },
+		{ "freeradius_worker_naks_total", "counter", "Requests the worker refused." },
+		{ "freeradius_worker_active_requests", "gauge", "Requests the worker is processing." },
+		{ "freeradius_worker_busy_seconds_total", "counter", "Time the worker spent running requests.", true },
+		{ "freeradius_worker_runnable_requests", "gauge", "Requests waiting for the worker to run them." },
+	};
+	size_t i, j;
+
+	for (i = 0; i < METRICS_WORKER_STATS; i++) {
+		metrics_header(out, worker_metrics[i].name, worker_metrics[i].type, worker_metrics[i].help);
+
+		for (j = 0; j < talloc_array_length(snap->workers); j++) {
+			if (worker_metrics[i].seconds) {
+				(void) fr_sbuff_in_sprintf(out, "%s{worker=\"%u\"} %.9g\n",
+							   worker_metrics[i].name, snap->workers[j].id,
+							   snap->workers[j].stats[i] / (double) NSEC);
+				continue;
+			}
+
+			(void) fr_sbuff_in_sprintf(out, "%s{worker=\"%u\"} %" PRIu64 "\n",
+						   worker_metrics[i].name, snap->workers[j].id, snap->workers[j].stats[i]);
+		}
+	}
+}
+
+/** Write the counters for each network
+ *
+ */
+static void metrics_networks(fr_sbuff_t *out, metrics_snapshot_t const *snap)
+{
+	static struct {
+		char const	*name;
+		char const	*type;
+		char const	*help;
+	} const network_metrics[METRICS_NETWORK_STATS] = {
+		{ "freeradius_network_packets_received_total", "counter", "Packets read by the network thread." },
+		{ "freeradius_network_packets_sent_total", "counter", "Packets written by the network thread." },
+		{ "freeradius_network_duplicates_total", "counter", "Duplicate packets read by the network thread." },
+		{ "freeradius_network_dropped_total", "counter", "Packets the network thread dropped." },
+		{ "freeradius_network_workers", "gauge", "Workers the network thread sends packets to." },
+	};
+	size_t i, j;
+
+	for (i = 0; i < METRICS_NETWORK_STATS; i++) {
+		metrics_header(out, network_metrics[i].name, network_metrics[i].type, network_metrics[i].help);
+
+		for (j = 0; j < talloc_array_length(snap->networks); j++) {
+			(void) fr_sbuff_in_sprintf(out, "%s{network=\"%u\"} %" PRIu64 "\n",
+						   network_metrics[i].name, snap->networks[j].id, snap->networks[j].stats[i]);
+		}
+	}
+}
+
+/** Write the counters for each trunk, summed across threads
+ *
+ */
+static void metrics_trunks(fr_sbuff_t *out, metrics_snapshot_t const *snap)
+{
+	static struct {
+		char const	*name;
+		char const	*type;
+		char const	*help;
+		size_t		offset;
+	} const trunk_metrics[] = {
+		{ "freeradius_trunk_requests_allocated", "gauge", "Trunk requests currently allocated.",
+		  offsetof(metrics_trunk_t, req_alloc) },
+		{ "freeradius_trunk_requests_new_total", "counter", "Trunk requests allocated from the heap.",
+		  offsetof(metrics_trunk_t, req_alloc_new) },
+		{ "freeradius_trunk_requests_reused_total", "counter", "Trunk requests reused from the free list.",
+		  offsetof(metrics_trunk_t, req_alloc_reused) },
+		{ "freeradius_trunk_requests_coalesced_total", "counter", "Trunk requests which waited on an identical request.",
+		  offsetof(metrics_trunk_t, req_coalesced) },
+		{ "freeradius_trunk_connections", "gauge", "Trunk connections, in any state.",
+		  offsetof(metrics_trunk_t, connections) },
+		{ "freeradius_trunk_connections_connecting", "gauge", "Trunk connections which are being opened.",
+		  offsetof(metrics_trunk_t, connecting) },
+		{ "freeradius_trunk_connections_active", "gauge", "Trunk connections which can accept requests.",
+		  offsetof(metrics_trunk_t, active) },
+		{ "freeradius_trunk_connections_full", "gauge", "Trunk connections which have as many requests as they can take.",
+		  offsetof(metrics_trunk_t, full) },
+		{ "freeradius_trunk_connections_inactive", "gauge", "Trunk connections which the API client marked as inactive.",
+		  offsetof(metrics_trunk_t, inactive) },
+		{ "freeradius_trunk_connections_draining", "gauge", "Trunk connections which are being closed.",
+		  offsetof(metrics_trunk_t, draining) },
+	};
+	size_t i, j;
+
+	for (i = 0; i < NUM_ELEMENTS(trunk_metrics); i++) {
+		metrics_header(out, trunk_metrics[i].name, trunk_metrics[i].type, trunk_metrics[i].help);
+
+		for (j = 0; j < talloc_array_length(snap->trunks); j++) {
+			uint64_t const *value = (uint64_t const *)(((uint8_t const *) &snap->trunks[j]) + trunk_metrics[i].offset);
+
+			(void) fr_sbuff_in_sprintf(out, "%s{", trunk_metrics[i].name);
+			metrics_label(out, "trunk", snap->trunks[j].name, true);
+			(void) fr_sbuff_in_sprintf(out, "} %" PRIu64 "\n", *value);
+		}
+	}
+}
+
+/** Write the latency summaries for every virtual server
+ *
+ */
+static void metrics_latency(TALLOC_CTX *ctx, fr_sbuff_t *out)
+{
+	CONF_SECTION	*cs = NULL;
+
+	metrics_header(out, "freeradius_unlang_latency_seconds", "summary",
+		       "Time spent in processing sections, policies and module calls.");
+
+	while ((cs = cf_section_find_next(metrics_root_cs, cs, "server", CF_IDENT_ANY))) {
+		metrics_latency_ctx_t lctx = {
+			.ctx = ctx,
+			.out = out,
+			.server = cf_section_name2(cs)
+		};
+
+		if (!lctx.server) continue;
+
+		(void) unlang_latency_walk(lctx.server, metrics_latency_walk, &lctx);
+	}
+}
+
+static void metrics_module_walk(void *uctx, char const *module, char const *method, unlang_module_profile_t const *p)
+{
+	metrics_snapshot_t	*snap = uctx;
+	size_t			len = talloc_array_length(snap->modules);
+
+	MEM(snap->modules = talloc_realloc(snap->ctx, snap->modules, metrics_module_t, len + 1));
+	snap->modules[len] = (metrics_module_t){
+		.module = talloc_strdup(snap->ctx, module),
+		.method = talloc_strdup(snap->ctx, method),
+		.p = *p
+	};
+}
+
+/** Write the resources used by each module method
+ *
+ * Only present if module profiling is enabled.
+ */
+static void metrics_modules(fr_sbuff_t *out, metrics_snapshot_t const *snap)
+{
+	static struct {
+		char const	*name;
+		char const	*help;
+		size_t		offset;
+		bool		seconds;
+	} const module_metrics[] = {
+		{ "freeradius_module_calls_total", "Calls to the module method.",
+		  offsetof(unlang_module_profile_t, calls), false },
+		{ "freeradius_module_cpu_seconds_total", "Thread CPU time used by the module method.",
+		  offsetof(unlang_module_profile_t, cpu), true },
+		{ "freeradius_module_yields_total", "Times the module method yielded.",
+		  offsetof(unlang_module_profile_t, yields), false },
+		{ "freeradius_module_wait_seconds_total", "Time the module method spent yielded, waiting for I/O.",
+		  offsetof(unlang_module_profile_t, wait), true },
+	};
+	size_t i, j;
+
+	if (!talloc_array_length(snap->modules)) return;
+
+	for (i = 0; i < NUM_ELEMENTS(module_metrics); i++) {
+		metrics_header(out, module_metrics[i].name, "counter", module_metrics[i].help);
+
+		for (j = 0; j < talloc_array_length(snap->modules); j++) {
+			uint64_t const *value = (uint64_t const *)(((uint8_t const *) &snap->modules[j].p) + module_metrics[i].offset);
+
+			(void) fr_sbuff_in_sprintf(out, "%s{", module_metrics[i].name);
+			metrics_label(out, "module", snap->modules[j].module, false);
+			metrics_label(out, "method", snap->modules[j].method, true);
+			if (module_metrics[i].seconds) {
+				(void) fr_sbuff_in_sprintf(out, "} %.9g\n", *value / (double) NSEC);
+			} else {
+				(void) fr_sbuff_in_sprintf(out, "} %" PRIu64 "\n", *value);
+			}
+		}
+	}
+}
+
+typedef struct {
+	fr_sbuff_t		*out;
+	unsigned int		rank;			//!< Keeps the label sets unique.
+} metrics_slow_ctx_t;
+
+static void metrics_slow_walk(void *uctx, unlang_module_slow_t const *slow)
+{
+	metrics_slow_ctx_t	*sctx = uctx;
+	fr_sbuff_t		*out = sctx->out;
+
+	(void) fr_sbuff_in_sprintf(out, "freeradius_module_slow_call_seconds{rank=\"%u\",", ++sctx->rank);
+	metrics_label(out, "module", slow->module, false);
+	metrics_label(out, "stack", slow->stack, true);
+	(void) fr_sbuff_in_sprintf(out, "} %.9g\n", fr_time_delta_unwrap(slow->elapsed) / (double) NSEC);
+}
+
+/** Write the slowest module calls, and the unlang stacks which made them
+ *
+ * Only present if slow call sampling is enabled.
+ */
+static void metrics_slow(fr_sbuff_t *out)
+{
+	metrics_slow_ctx_t sctx = { .out = out };
+
+	if (!metrics_slow_calls) return;
+
+	metrics_header(out, "freeradius_module_slow_call_seconds", "gauge",
+		       "The slowest module calls in the last interval.");
+	unlang_module_slow_walk(metrics_slow_walk, &sctx);
+}
+
+/** Write the span export counters
+ *
+ * Only present if tracing is enabled.
+ */
+static void metrics_traces(fr_sbuff_t *out)
+{
+	uint64_t exported, dropped, failed;
+
+	if (!metrics_trace) return;
+
+	fr_trace_stats(&exported, &dropped, &failed);
+
+	metrics_header(out, "freeradius_trace_spans_exported_total", "counter", "Spans sent to the collector.");
+	(void) fr_sbuff_in_sprintf(out, "freeradius_trace_spans_exported_total %" PRIu64 "\n", exported);
+	metrics_header(out, "freeradius_trace_spans_dropped_total", "counter", "Spans dropped because the export queue was full.");
+	(void) fr_sbuff_in_sprintf(out, "freeradius_trace_spans_dropped_total %" PRIu64 "\n", dropped);
+	metrics_header(out, "freeradius_trace_spans_failed_total", "counter", "Spans the collector didn't accept.");
+	(void) fr_sbuff_in_sprintf(out, "freeradius_trace_spans_failed_total %" PRIu64 "\n", failed);
+}
+
+static int metrics_memory_used_walk(char const *subsystem, char const *instance,
+				    size_t used, UNUSED size_t budget, void *uctx)
+{
+	fr_sbuff_t *out = uctx;
+
+	(void) fr_sbuff_in_strcpy(out, "freeradius_memory_bytes{");
+	metrics_label(out, "subsystem", subsystem, !instance);
+	if (instance) metrics_label(out, "instance", instance, true);
+	(void) fr_sbuff_in_sprintf(out, "} %zu\n", used);
+
+	return 0;
+}
+
+static int metrics_memory_budget_walk(char const *subsystem, char const *instance,
+				      UNUSED size_t used, size_t budget, void *uctx)
+{
+	fr_sbuff_t *out = uctx;
+
+	if (!budget) return 0;
+
+	(void) fr_sbuff_in_strcpy(out, "freeradius_memory_budget_bytes{");
+	metrics_label(out, "subsystem", subsystem, !instance);
+	if (instance) metrics_label(out, "instance", instance, true);
+	(void) fr_sbuff_in_sprintf(out, "} %zu\n", budget);
+
+	return 0;
+}
+
+/** Write the memory used by each subsystem, and its budget
+ *
+ * These come from the talloc accounts the subsystems keep, as we can't
+ * walk the talloc trees of other threads.
+ */
+static void metrics_memory(fr_sbuff_t *out)
+{
+	metrics_header(out, "freeradius_memory_bytes", "gauge", "Memory used by each subsystem.");
+	(void) talloc_account_walk(metrics_memory_used_walk, out);
+
+	metrics_header(out, "freeradius_memory_budget_bytes", "gauge",
+		       "Memory subsystems try to stay under, by evicting entries.");
+	(void) talloc_account_walk(metrics_memory_budget_walk, out);
+}
+
+/** Produce the body of a scrape
+ *
+ */
+static char *metrics_render(TALLOC_CTX *ctx)
+{
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+	metrics_snapshot_t	snap = { .ctx = ctx };
+
+	if (!metrics_sc) return NULL;
+
+	if (!fr_sbuff_init_talloc(ctx, &sbuff, &tctx, 16384, SIZE_MAX)) return NULL;
+
+	fr_schedule_stats_walk(metrics_sc, metrics_worker_walk, metrics_network_walk, &snap);
+	trunk_stats_walk(metrics_trunk_walk, &snap);
+	unlang_module_profile_walk(metrics_module_walk, &snap);
+
+	metrics_workers(&sbuff, &snap);
+	metrics_networks(&sbuff, &snap);
+	metrics_trunks(&sbuff, &snap);
+	metrics_latency(ctx, &sbuff);
+	metrics_modules(&sbuff, &snap);
+	metrics_slow(&sbuff);
+	metrics_traces(&sbuff);
+	metrics_memory(&sbuff);
+
+	return fr_sbuff_buff(&sbuff);
+}
+
+static int metrics_write(int fd, char const *buffer, size_t len)
+{
+	while (len > 0) {
+		ssize_t slen;
+
+		slen = write(fd, buffer, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		buffer += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/** Read an HTTP request, and write the response
+ *
+ * Only "GET /metrics" is supported.  The connection is closed after
+ * each response.
+ */
+static void metrics_serve(int fd)
+{
+	char		buffer[4096];
+	size_t		used = 0;
+	char const	*status = "404 Not Found";
+	char		*body = NULL;
+	char		*hdr;
+	TALLOC_CTX	*ctx;
+	struct timeval	tv = { .tv_sec = 1 };
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/*
+	 *	Read until the end of the headers.  We don't care
+	 *	what's in them.
+	 */
+	while (used < (sizeof(buffer) - 1)) {
+		ssize_t slen;
+
+		slen = read(fd, buffer + used, sizeof(buffer) - 1 - used);
+		if (slen <= 0) {
+			if ((slen < 0) && (errno == EINTR)) continue;
+			return;
+		}
+		used += slen;
+		buffer[used] = '\0';
+
+		if (strstr(buffer, "\r\n\r\n") || strstr(buffer, "\n\n")) break;
+	}
+
+	ctx = talloc_init_const("metrics");
+	if (!ctx) return;
+
+	if ((strncmp(buffer, "GET /metrics ", 13) == 0) || (strncmp(buffer, "GET /metrics?", 13) == 0)) {
+		body = metrics_render(ctx);
+		if (body) {
+			status = "200 OK";
+		} else {
+			status = "500 Internal Server Error";
+		}
+	}
+	if (!body) body = talloc_typed_asprintf(ctx, "%s\n", status);
+
+	hdr = talloc_typed_asprintf(ctx, "HTTP/1.1 %s\r\n"
+				    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+				    "Content-Length: %zu\r\n"
+				    "Connection: close\r\n"
+				    "\r\n", status, strlen(body));
+
+	if (metrics_write(fd, hdr, strlen(hdr)) == 0) (void) metrics_write(fd, body, strlen(body));
+
+	talloc_free(ctx);
+}
+
+static int cmd_stats_metrics(FILE *fp, FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	TALLOC_CTX	*render_ctx;
+	char		*body;
+
+	render_ctx = talloc_init_const("metrics");
+	if (!render_ctx) return -1;
+
+	body = metrics_render(render_ctx);
+	if (!body) {
+		fprintf(fp_err, "Metrics are not available\n");
+		talloc_free(render_ctx);
+		return -1;
+	}
+
+	fputs(body, fp);
+	talloc_free(render_ctx);
+
+	return 0;
+}
+
+static int cmd_stats_memory_walk(char const *subsystem, char const *instance,
+				 size_t used, size_t budget, void *uctx)
+{
+	FILE *fp = uctx;
+
+	fprintf(fp, "%-10s %-32s %14zu", subsystem, instance ? instance : "-", used);
+	if (budget) {
+		fprintf(fp, " %14zu%s\n", budget, (used > budget) ? " over" : "");
+	} else {
+		fprintf(fp, " %14s\n", "-");
+	}
+
+	return 0;
+}
+
+static int cmd_stats_memory(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fprintf(fp, "%-10s %-32s %14s %14s\n", "subsystem", "instance", "used", "budget");
+	(void) talloc_account_walk(cmd_stats_memory_walk, fp);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_metrics_table[] = {
+	{
+		.parent = "stats",
+		.name = "memory",
+		.func = cmd_stats_memory,
+		.help = "Show the memory used by each subsystem, in bytes, and its budget.",
+		.read_only = true,
+	},
+
+	{
+		.parent = "stats",
+		.name = "metrics",
+		.func = cmd_stats_metrics,
+		.help = "Show all statistics, in the Prometheus text format.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
+static void *metrics_thread(UNUSED void *arg)
+{
+	sigset_t	sigset;
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	while (!atomic_load(&metrics_stop)) {
+		struct pollfd	pfd = { .fd = metrics_fd, .events = POLLIN };
+		int		fd;
+
+		if (poll(&pfd, 1, 1000) <= 0) continue;
+
+		fd = accept(metrics_fd, NULL, NULL);
+		if (fd < 0) continue;
+
+		metrics_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/** Start the metrics thread, if it's been configured
+ *
+ * @param[in] config	Main server configuration.
+ * @param[in] sc	the scheduler, to read worker and network statistics from.
+ * The "stats metrics" and "stats memory" commands are registered even
+ * if no port was configured.
+ *
+ * @return
+ *	- 0 on success, or if no port was configured.
+ *	- -1 on failure.
+ */
+int fr_metrics_start(main_config_t const *config, fr_schedule_t *sc)
+{
+	fr_ipaddr_t	ipaddr = config->metrics_ipaddr;
+	uint16_t	port = config->metrics_port;
+
+	metrics_sc = sc;
+	metrics_root_cs = config->root_cs;
+	metrics_slow_calls = (config->profile_slow_calls > 0);
+	metrics_trace = (config->trace_port > 0);
+
+	if (fr_command_register_hook(NULL, NULL, NULL, cmd_metrics_table) < 0) {
+		PERROR("Failed registering radmin commands for metrics");
+		return -1;
+	}
+
+	if (!port) return 0;
+
+	metrics_fd = fr_socket_server_tcp(&ipaddr, &port, NULL, false);
+	if (metrics_fd < 0) {
+	error:
+		PERROR("Failed opening metrics socket");
+		return -1;
+	}
+
+	if (fr_socket_bind(metrics_fd, NULL, &ipaddr, &port) < 0) {
+	close_error:
+		close(metrics_fd);
+		metrics_fd = -1;
+		goto error;
+	}
+
+	if (listen(metrics_fd, 8) < 0) {
+		fr_strerror_printf("Failed listening on socket: %s", fr_syserror(errno));
+		goto close_error;
+	}
+
+	atomic_store(&metrics_stop, false);
+	if (fr_schedule_pthread_create(&metrics_pthread_id, metrics_thread, NULL) < 0) goto close_error;
+	metrics_started = true;
+
+	INFO("Serving metrics on %pV port %u", fr_box_ipaddr(ipaddr), port);
+
+	return 0;
+}
+
+/** Stop the metrics thread
+ *
+ * Must be called before the scheduler is destroyed.
+ */
+void fr_metrics_stop(void)
+{
+	if (metrics_started) {
+		atomic_store(&metrics_stop, true);
+		(void) pthread_join(metrics_pthread_id, NULL);
+		metrics_started = false;
+
+		close(metrics_fd);
+		metrics_fd = -1;
+	}
+
+	metrics_sc = NULL;
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/metrics.h
+ * @brief Export server statistics over HTTP, in the Prometheus text format.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(metrics_h, "$Id$")
+
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/main_config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int	fr_metrics_start(main_config_t const *config, fr_schedule_t *sc) CC_HINT(nonnull);
+void	fr_metrics_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
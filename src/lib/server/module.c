@@ -38,9 +38,11 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 
 #include <talloc.h>
+#include <stdatomic.h>
 #include <sys/mman.h>
 
 static void module_thread_detach(module_thread_instance_t *ti);
@@ -62,6 +64,8 @@ static int module_name_tab_expand(UNUSED TALLOC_CTX *talloc_ctx, UNUSED void *uc
 static int cmd_show_module_list(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info);
 static int cmd_show_module_status(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info);
 static int cmd_set_module_status(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info);
+static int cmd_stats_module_profile(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info);
+static int cmd_stats_module_slow(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info);
 
 fr_cmd_table_t module_cmd_table[] = {
 	{
@@ -122,6 +126,28 @@ fr_cmd_table_t module_cmd_list_table[] = {
 		.read_only = false,
 	},
 
+	{
+		.parent = "stats",
+		.name = "module",
+		.help = "Statistics for modules.",
+		.read_only = true,
+	},
+
+	{
+		.parent = "stats module",
+		.name = "profile",
+		.func = cmd_stats_module_profile,
+		.help = "Show the CPU time, yields and I/O waits for each module method.",
+		.read_only = true,
+	},
+
+	{
+		.parent = "stats module",
+		.name = "slow",
+		.func = cmd_stats_module_slow,
+		.help = "Show the slowest module calls, and the unlang stacks which made them.",
+		.read_only = true,
+	},
 
 	CMD_TABLE_END
 };
@@ -188,6 +214,38 @@ static int cmd_show_module_status(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUS
 	return 0;
 }
 
+static void cmd_stats_module_profile_print(void *uctx, char const *module, char const *method,
+					   unlang_module_profile_t const *p)
+{
+	FILE *fp = uctx;
+
+	fprintf(fp, "%s.%s\tcalls=%" PRIu64 "\tcpu=%" PRIu64 "us\tcpu_per_call=%" PRIu64 "ns"
+		"\tyields=%" PRIu64 "\twait=%" PRIu64 "us\n",
+		module, method, p->calls, p->cpu / 1000, p->cpu / p->calls, p->yields, p->wait / 1000);
+}
+
+static int cmd_stats_module_profile(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info)
+{
+	unlang_module_profile_walk(cmd_stats_module_profile_print, fp);
+
+	return 0;
+}
+
+static void cmd_stats_module_slow_print(void *uctx, unlang_module_slow_t const *slow)
+{
+	FILE *fp = uctx;
+
+	fprintf(fp, "%" PRId64 "us\t(%" PRIu64 ")\t%s\t%s\n",
+		fr_time_delta_to_usec(slow->elapsed), slow->number, slow->module, slow->stack);
+}
+
+static int cmd_stats_module_slow(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info)
+{
+	unlang_module_slow_walk(cmd_stats_module_slow_print, fp);
+
+	return 0;
+}
+
 static int cmd_set_module_status(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	module_instance_t *mi = ctx;
@@ -1185,18 +1243,18 @@ int modules_thread_instantiate(TALLOC_CTX *ctx, module_list_t const *ml, fr_even
 	return 0;
 }
 
-/** Manually complete module setup by calling its instantiate function
+/** Do the parts of instantiation which touch global resources
  *
- * @param[in] instance	of module to complete instantiation for.
+ * These must always be done from the main thread, and in order.
+ *
+ * @param[in] mi	of module to prepare.
  * @return
- *	- 0 on success.
+ *	- 1 if the module should now be instantiated.
+ *	- 0 if the module should be skipped.
  *	- -1 on failure.
  */
-int module_instantiate(module_instance_t *instance)
+static int module_instantiate_prepare(module_instance_t *mi)
 {
-	module_instance_t *mi = talloc_get_type_abort(instance, module_instance_t);
-	CONF_SECTION *cs = mi->conf;
-
 	/*
 	 *	If we're instantiating, then nothing should be able to
 	 *	modify the boot data for this module.
@@ -1235,6 +1293,23 @@ int module_instantiate(module_instance_t *instance)
 	if (mi->exported->config && (cf_section_parse_pass2(mi->data,
 							    mi->conf) < 0)) return -1;
 
+	return 1;
+}
+
+/** Call the module's instantiate function, and protect its instance data
+ *
+ * If the module is marked with #MODULE_TYPE_INSTANTIATE_PARALLEL, this may
+ * be called from a thread other than the main thread.
+ *
+ * @param[in] mi	of module to instantiate.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int module_instantiate_call(module_instance_t *mi)
+{
+	CONF_SECTION *cs = mi->conf;
+
 	/*
 	 *	Call the instantiate method, if any.
 	 */
@@ -1268,11 +1343,230 @@ int module_instantiate(module_instance_t *instance)
 	return 0;
 }
 
+/** Manually complete module setup by calling its instantiate function
+ *
+ * @param[in] instance	of module to complete instantiation for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int module_instantiate(module_instance_t *instance)
+{
+	module_instance_t	*mi = talloc_get_type_abort(instance, module_instance_t);
+	int			ret;
+
+	ret = module_instantiate_prepare(mi);
+	if (ret <= 0) return ret;
+
+	return module_instantiate_call(mi);
+}
+
+/** A module waiting to be instantiated by modules_instantiate_parallel()
+ *
+ */
+typedef struct {
+	module_instance_t	*mi;		//!< To instantiate.
+	size_t			*deps;		//!< Indexes of the jobs this one must wait for.
+	bool			started;	//!< Whether we've started instantiating the module.
+	bool			done;		//!< Whether the module has been instantiated.
+	int			ret;		//!< Result of module_instantiate_call().
+} module_instantiate_job_t;
+
+typedef struct {
+	pthread_mutex_t			mutex;		//!< Protects "next".
+	module_instantiate_job_t	**todo;		//!< Jobs to run in this pass.
+	size_t				num;		//!< Number of jobs to run in this pass.
+	size_t				next;		//!< Next job to run.
+} module_instantiate_pool_t;
+
+static void *module_instantiate_thread(void *arg)
+{
+	module_instantiate_pool_t	*p = arg;
+	size_t				i;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mutex);
+		i = p->next++;
+		pthread_mutex_unlock(&p->mutex);
+
+		if (i >= p->num) break;
+
+		p->todo[i]->ret = module_instantiate_call(p->todo[i]->mi);
+	}
+
+	return NULL;
+}
+
+/** Check whether a module's configuration refers to another module by name
+ *
+ * e.g. `sql_module_instance = sql` in an rlm_sqlippool instance.
+ */
+static bool module_conf_references(CONF_SECTION const *cs, char const *name)
+{
+	CONF_ITEM *ci = NULL;
+
+	while ((ci = cf_item_next(cs, ci))) {
+		if (cf_item_is_section(ci)) {
+			if (module_conf_references(cf_item_to_section(ci), name)) return true;
+			continue;
+		}
+
+		if (cf_item_is_pair(ci)) {
+			char const *value = cf_pair_value(cf_item_to_pair(ci));
+
+			if (value && (strcmp(value, name) == 0)) return true;
+		}
+	}
+
+	return false;
+}
+
+/** Instantiate modules from a pool of threads
+ *
+ * Modules are instantiated in passes.  In each pass, every module whose
+ * dependencies have all been instantiated is started.  Modules marked with
+ * #MODULE_TYPE_INSTANTIATE_PARALLEL are instantiated concurrently, the rest
+ * are instantiated one at a time, in name order, by this thread.
+ *
+ * A module depends on another if any of its configuration items have the
+ * other module's name as a value.  If the dependencies form a loop, the
+ * remaining modules are instantiated in name order, as they would be by
+ * modules_instantiate().
+ */
+static int modules_instantiate_parallel(module_list_t const *ml)
+{
+	module_instantiate_job_t	*jobs = NULL;
+	module_instantiate_pool_t	p = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+	pthread_t			*tid;
+	size_t				i, j, num = 0, remaining;
+	int				ret = 0;
+	TALLOC_CTX			*ctx;
+
+	MEM(ctx = talloc_new(NULL));
+	MEM(jobs = talloc_zero_array(ctx, module_instantiate_job_t, fr_rb_num_elements(ml->name_tree)));
+
+	/*
+	 *	The parts which touch global resources are
+	 *	done first, in the same order as before.
+	 */
+	fr_rb_inorder_foreach(ml->name_tree, module_instance_t, mi) {
+		switch (module_instantiate_prepare(mi)) {
+		case 0:
+			continue;
+
+		case 1:
+			jobs[num++].mi = mi;
+			continue;
+
+		default:
+			talloc_free(ctx);
+			return -1;
+		}
+	}}
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < num; j++) {
+			if ((i == j) || !module_conf_references(jobs[i].mi->conf, jobs[j].mi->name)) continue;
+
+			MEM(jobs[i].deps = talloc_realloc(ctx, jobs[i].deps, size_t, talloc_array_length(jobs[i].deps) + 1));
+			jobs[i].deps[talloc_array_length(jobs[i].deps) - 1] = j;
+
+			DEBUG3("%s - Module \"%s\" will be instantiated after \"%s\"",
+			       ml->name, jobs[i].mi->name, jobs[j].mi->name);
+		}
+	}
+
+	MEM(p.todo = talloc_array(ctx, module_instantiate_job_t *, num ? num : 1));
+	MEM(tid = talloc_array(ctx, pthread_t, ml->instantiate_threads));
+
+	for (remaining = num; remaining > 0; ) {
+		unsigned int	num_threads = 0;
+		size_t		ready = 0;
+
+		p.num = 0;
+		p.next = 0;
+
+		for (i = 0; i < num; i++) {
+			if (jobs[i].started) continue;
+
+			for (j = 0; j < talloc_array_length(jobs[i].deps); j++) {
+				if (!jobs[jobs[i].deps[j]].done) break;
+			}
+			if (j < talloc_array_length(jobs[i].deps)) continue;
+
+			jobs[i].started = true;
+			ready++;
+			if (jobs[i].mi->exported->flags & MODULE_TYPE_INSTANTIATE_PARALLEL) p.todo[p.num++] = &jobs[i];
+		}
+
+		/*
+		 *	Dependency loop.  Run whatever is left in
+		 *	name order.
+		 */
+		if (!ready) {
+			WARN("%s - Modules reference each other, instantiating the rest in name order", ml->name);
+			for (i = 0; i < num; i++) {
+				if (jobs[i].started) continue;
+
+				jobs[i].started = jobs[i].done = true;
+				remaining--;
+				if (module_instantiate_call(jobs[i].mi) < 0) ret = -1;
+				if (ret < 0) break;
+			}
+			break;
+		}
+
+		/*
+		 *	Start the threads for the parallel modules.
+		 *	If we can't start a thread, then the ones we
+		 *	did start, or this thread, do the work.
+		 */
+		if (p.num > 1) {
+			for (i = 0; (i < ml->instantiate_threads) && (i < p.num); i++) {
+				if (pthread_create(&tid[i], NULL, module_instantiate_thread, &p) != 0) break;
+				num_threads++;
+			}
+		}
+
+		/*
+		 *	Meanwhile, the serial ones are run by this
+		 *	thread, in name order.
+		 */
+		for (i = 0; i < num; i++) {
+			if (!jobs[i].started || jobs[i].done ||
+			    (jobs[i].mi->exported->flags & MODULE_TYPE_INSTANTIATE_PARALLEL)) continue;
+
+			jobs[i].done = true;
+			remaining--;
+			if ((ret == 0) && (module_instantiate_call(jobs[i].mi) < 0)) ret = -1;
+		}
+
+		if (!num_threads) (void) module_instantiate_thread(&p);
+
+		for (i = 0; i < num_threads; i++) pthread_join(tid[i], NULL);
+
+		for (i = 0; i < p.num; i++) {
+			p.todo[i]->done = true;
+			remaining--;
+			if (p.todo[i]->ret < 0) ret = -1;
+		}
+
+		if (ret < 0) break;
+	}
+
+	talloc_free(ctx);
+
+	return ret;
+}
+
 /** Completes instantiation of modules
  *
  * Allows the module to initialise connection pools, and complete any registrations that depend on
  * attributes created during the bootstrap phase.
  *
+ * If the list allows more than one instantiation thread, independent modules
+ * marked with #MODULE_TYPE_INSTANTIATE_PARALLEL are instantiated concurrently.
+ *
  * @param[in] ml containing modules to instantiate.
  * @return
  *	- 0 on success.
@@ -1285,11 +1579,36 @@ int modules_instantiate(module_list_t const *ml)
 
 	DEBUG2("#### Instantiating %s modules ####", ml->name);
 
+	if (ml->instantiate_threads > 1) {
+		if (modules_instantiate_parallel(ml) < 0) return -1;
+	} else {
+		for (inst = fr_rb_iter_init_inorder(&iter, ml->name_tree);
+		     inst;
+		     inst = fr_rb_iter_next_inorder(&iter)) {
+			module_instance_t *mi = talloc_get_type_abort(inst, module_instance_t);
+			if (module_instantiate(mi) < 0) return -1;
+		}
+	}
+
+	/*
+	 *	Record how much memory each module's instance data
+	 *	uses, now we're back to one thread.  Thread-local
+	 *	lists are skipped, as there's one per thread.
+	 */
+	if (ml->type != &module_list_type_global) return 0;
+
 	for (inst = fr_rb_iter_init_inorder(&iter, ml->name_tree);
 	     inst;
 	     inst = fr_rb_iter_next_inorder(&iter)) {
-	     	module_instance_t *mi = talloc_get_type_abort(inst, module_instance_t);
-		if (module_instantiate(mi) < 0) return -1;
+		module_instance_t	*mi = talloc_get_type_abort(inst, module_instance_t);
+		talloc_account_t	*acct;
+		char			name[MODULE_INSTANCE_LEN_MAX + 32];
+
+		if (!mi->data) continue;
+
+		snprintf(name, sizeof(name), "%s.%s", ml->name, mi->name);
+		acct = talloc_account("module", name);
+		if (acct) talloc_account_set(acct, talloc_total_size(mi->data));
 	}
 
 	return 0;
@@ -1578,6 +1897,163 @@ void module_instance_data_alloc(TALLOC_CTX *ctx, module_data_pool_t *pool_out, v
 	*out = data;
 }
 
+/** Instance data replaced by module_hup(), which may still be in use
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of old instance data.
+	module_instance_t	*mi;		//!< The data belonged to.
+	void			*data;		//!< Old instance data.
+	module_data_pool_t	pool;		//!< Old instance data pool.
+	CONF_SECTION		*conf;		//!< Old configuration.
+	fr_time_t		free_after;	//!< When no request can still be using the data.
+} module_hup_data_t;
+
+static fr_dlist_head_t	module_hup_data = FR_DLIST_HEAD_INITIALISER(module_hup_data);	/* entry is first, so offset is 0 */
+
+static int _module_hup_data_free(module_hup_data_t *old)
+{
+	module_instance_t tmp = *old->mi;
+
+	fr_dlist_remove(&module_hup_data, old);
+
+	tmp.data = old->data;
+	tmp.conf = old->conf;
+	tmp.inst_pool = old->pool;
+
+	if (unlikely(module_data_unprotect(&tmp, &old->pool) < 0)) {
+		cf_log_perr(old->conf, "\"%s\"", tmp.name);
+		return -1;
+	}
+
+	if (tmp.exported->detach) tmp.exported->detach(MODULE_DETACH_CTX(&tmp));
+
+	talloc_free(old->pool.ctx);
+
+	return 0;
+}
+
+/** Re-read a module's configuration, and replace its instance data
+ *
+ * The new instance data is parsed and instantiated alongside the old
+ * data.  Only when that succeeds is the module switched over to the new
+ * data.  Requests which are already using the old data keep doing so, and
+ * the old data is freed on a later HUP, once it has been unused for longer
+ * than the maximum request time.
+ *
+ * Only modules marked with #MODULE_TYPE_HUP_SAFE can be reloaded.  These
+ * must not keep pointers to their instance data anywhere else, e.g. in
+ * thread instance data, or in call_env data.
+ *
+ * @param[in] mi	to reload.
+ * @param[in] cs	New configuration for the module.  Must remain valid
+ *			for as long as the module uses it.
+ * @param[in] keep	How long to keep the old instance data for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The module continues to use its old configuration.
+ */
+int module_hup(module_instance_t *mi, CONF_SECTION *cs, fr_time_delta_t keep)
+{
+	module_instance_t	tmp;
+	module_hup_data_t	*old;
+	fr_time_t		now = fr_time();
+
+	if (!(mi->exported->flags & MODULE_TYPE_HUP_SAFE)) {
+		fr_strerror_printf("Module \"%s\" cannot be reloaded", mi->name);
+		return -1;
+	}
+
+	if (!(mi->state & MODULE_INSTANCE_INSTANTIATED)) {
+		fr_strerror_printf("Module \"%s\" has not been instantiated", mi->name);
+		return -1;
+	}
+
+	/*
+	 *	Free data from previous HUPs which nothing
+	 *	can still be using.
+	 */
+	fr_dlist_foreach_safe(&module_hup_data, module_hup_data_t, prev) {
+		if (fr_time_lteq(prev->free_after, now)) talloc_free(prev);
+	}}
+
+	/*
+	 *	Build the new instance data in a copy of the
+	 *	module instance, so that nothing running in
+	 *	another thread sees it half initialised.
+	 */
+	tmp = *mi;
+	module_instance_data_alloc(mi, &tmp.inst_pool, &tmp.data,
+				   mi, mi->exported->inst_size, mi->exported->inst_type);
+	tmp.conf = cs;
+
+	cf_data_add(cs, mi, mi->module->dl->name, false);
+
+	if (mi->exported->config) {
+		if ((cf_section_rules_push(cs, mi->exported->config) < 0) ||
+		    (cf_section_parse(tmp.data, tmp.data, cs) < 0) ||
+		    (cf_section_parse_pass2(tmp.data, cs) < 0)) {
+			cf_log_err(cs, "Failed evaluating configuration for module \"%s\"", mi->name);
+		error:
+			talloc_free(tmp.inst_pool.ctx);
+			return -1;
+		}
+	}
+
+	if (mi->exported->instantiate) {
+		cf_log_debug(cs, "Re-instantiating %s_%s \"%s\"",
+			     module_instance_root_prefix_str(mi),
+			     mi->module->exported->name,
+			     mi->name);
+
+		if (mi->exported->instantiate(MODULE_INST_CTX(&tmp)) < 0) {
+			cf_log_err(cs, "Re-instantiation failed for module \"%s\"", mi->name);
+			goto error;
+		}
+	}
+
+	if (unlikely(module_data_protect(&tmp, &tmp.inst_pool) < 0)) {
+		cf_log_perr(cs, "\"%s\"", mi->name);
+		if (mi->exported->detach) mi->exported->detach(MODULE_DETACH_CTX(&tmp));
+		goto error;
+	}
+
+	MEM(old = talloc_zero(mi, module_hup_data_t));
+	old->mi = mi;
+	old->data = mi->data;
+	old->pool = mi->inst_pool;
+	old->conf = mi->conf;
+	old->free_after = fr_time_add(now, keep);
+	fr_dlist_insert_tail(&module_hup_data, old);
+	talloc_set_destructor(old, _module_hup_data_free);
+
+	/*
+	 *	Configuration re-read on HUP is kept only whilst
+	 *	the current or old data of an instance refers to it.
+	 *	The reference is moved from the instance to the old
+	 *	data, which is freed after "keep".
+	 */
+	MEM(talloc_reference(old, cf_root(old->conf)));
+	(void) talloc_unlink(mi, cf_root(old->conf));
+	MEM(talloc_reference(mi, cf_root(cs)));
+
+	/*
+	 *	Switch over.  The data tree is keyed by the
+	 *	instance data, so the module has to be
+	 *	re-inserted.
+	 */
+	if (fr_rb_node_inline_in_tree(&mi->data_node)) (void) fr_rb_remove(mi->ml->data_tree, mi);
+
+	mi->inst_pool = tmp.inst_pool;
+	mi->conf = cs;
+	atomic_thread_fence(memory_order_release);
+	mi->data = tmp.data;
+
+	fr_rb_insert(mi->ml->data_tree, mi);
+
+	return 0;
+}
+
 /** Check to see if a module instance name is valid
  *
  * @note On failure the error message may be retrieved with fr_strerror().
@@ -1837,6 +2313,17 @@ void module_list_mask_set(module_list_t *ml, module_instance_state_t mask)
 	ml->mask = mask;
 }
 
+/** Set how many modules in a list may be instantiated at the same time
+ *
+ * @param[in] ml		To set the number of threads for.
+ * @param[in] num		Maximum number of instantiation threads.
+ *				0 or 1 instantiates modules one at a time.
+ */
+void module_list_instantiate_threads_set(module_list_t *ml, uint32_t num)
+{
+	ml->instantiate_threads = num;
+}
+
 /** Allocate a new module list
  *
  * This is used to instantiate and destroy modules in distinct phases
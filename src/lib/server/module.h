@@ -49,8 +49,17 @@ typedef enum CC_HINT(flag_enum) {
 							//!< Server will protect calls with mutex.
 	MODULE_TYPE_RETRY		= (1 << 2), 	//!< can handle retries
 
-	MODULE_TYPE_DYNAMIC_UNSAFE	= (1 << 3)	//!< Instances of this module cannot be
+	MODULE_TYPE_DYNAMIC_UNSAFE	= (1 << 3),	//!< Instances of this module cannot be
 							///< created at runtime.
+
+	MODULE_TYPE_INSTANTIATE_PARALLEL = (1 << 4),	//!< The instantiate callback doesn't touch
+							///< global resources, and may be run in a
+							///< separate thread, alongside other modules.
+
+	MODULE_TYPE_HUP_SAFE		= (1 << 5)	//!< Module instances can be re-instantiated with
+							///< new configuration on HUP.  Only instance data
+							///< is replaced, so the module must not keep pointers
+							///< to it in thread instance data or call_env data.
 } module_flags_t;
 DIAG_ON(attributes)
 
@@ -396,6 +405,10 @@ struct module_list_s
 								///< bootstrapping and instantiation is complete,
 								///< to prevent accidental modification.
 
+	uint32_t			instantiate_threads;	//!< Maximum number of modules marked with
+								///< #MODULE_TYPE_INSTANTIATE_PARALLEL to
+								///< instantiate at the same time.
+
 	/** @name Callbacks to manage thread-specific data
 	 *
 	 * In "child" lists, which are only operating in a single thread, we don't need
@@ -500,6 +513,8 @@ int			modules_thread_instantiate(TALLOC_CTX *ctx, module_list_t const *ml, fr_ev
 
 int			module_instantiate(module_instance_t *mi) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
+int			module_hup(module_instance_t *mi, CONF_SECTION *cs, fr_time_delta_t keep) CC_HINT(nonnull) CC_HINT(warn_unused_result);
+
 int			modules_instantiate(module_list_t const *ml) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
 int			module_bootstrap(module_instance_t *mi) CC_HINT(nonnull) CC_HINT(warn_unused_result);
@@ -547,6 +562,8 @@ bool			module_instance_skip_instantiate(module_instance_t *mi);
 bool			module_instance_skip_thread_instantiate(module_instance_t *mi);
 
 void			module_list_mask_set(module_list_t *ml, module_instance_state_t mask);
+
+void			module_list_instantiate_threads_set(module_list_t *ml, uint32_t num);
 /** @} */
 
 module_list_t 		*module_list_alloc(TALLOC_CTX *ctx, module_list_type_t const *type,
@@ -32,6 +32,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/cf_util.h>
 
 #include <freeradius-devel/server/global_lib.h>
+#include <freeradius-devel/server/main_config.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/module_rlm.h>
@@ -986,9 +987,65 @@ int modules_rlm_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
  */
 int modules_rlm_instantiate(void)
 {
+	if (main_config) module_list_instantiate_threads_set(rlm_modules_static, main_config->module_instantiate_threads);
+
 	return modules_instantiate(rlm_modules_static);
 }
 
+/** Reload any modules whose configuration has changed
+ *
+ * Compares the module configuration in a newly read configuration tree with
+ * the configuration the static modules are currently using.  Modules whose
+ * configuration differs are reloaded with module_hup() if they support it.
+ * Modules which don't, or which have been added, need a restart.
+ *
+ * @param[in] root	of the newly read configuration.  Must remain valid
+ *			for as long as any reloaded module is in use.
+ * @param[in] keep	How long to keep old module instance data for.
+ * @return The number of modules which were reloaded.
+ */
+int modules_rlm_hup(CONF_SECTION *root, fr_time_delta_t keep)
+{
+	CONF_SECTION	*modules, *static_cs;
+	int		reloaded = 0;
+
+	modules = cf_section_find(root, "modules", NULL);
+	if (!modules) return 0;
+
+	static_cs = cf_section_find(modules, "static", NULL);
+	if (!static_cs) static_cs = modules;
+
+	cf_section_foreach(static_cs, mod_conf) {
+		module_instance_t	*mi;
+		char const		*name;
+
+		if ((static_cs == modules) &&
+		    (strcmp(cf_section_name1(mod_conf), "dynamic") == 0) && !cf_section_name2(mod_conf)) continue;
+
+		if (module_instance_name_from_conf(&name, mod_conf) < 0) continue;
+
+		mi = module_instance_by_name(rlm_modules_static, NULL, name);
+		if (!mi) {
+			cf_log_warn(mod_conf, "Module \"%s\" has been added, the server must be restarted to load it",
+				    name);
+			continue;
+		}
+
+		if (cf_section_equal(mi->conf, mod_conf)) continue;
+
+		if (module_hup(mi, mod_conf, keep) < 0) {
+			cf_log_pwarn(mod_conf, "Configuration of module \"%s\" has changed, "
+				    "the server must be restarted to use it", name);
+			continue;
+		}
+
+		cf_log_info(mod_conf, "Reloaded module \"%s\"", name);
+		reloaded++;
+	}
+
+	return reloaded;
+}
+
 /** Compare the section names of two module_method_binding_t structures
  */
 static int8_t binding_name_cmp(void const *one, void const *two)
@@ -35,9 +35,24 @@ typedef struct module_rlm_instance_s module_rlm_instance_t;
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/virtual_servers.h>
 
+/** Report how busy a module instance is
+ *
+ * Used by "load-balance" and "redundant-load-balance" to prefer
+ * instances which are responding quickly, and have few requests
+ * outstanding.  The value is only compared against the values
+ * returned by other instances, so its units are up to the module.
+ *
+ * @param[in] mi	Module instance to check.
+ * @return
+ *	- UINT64_MAX if the instance should not be used.
+ *	- The relative cost of sending it another request.
+ */
+typedef uint64_t (*module_rlm_load_t)(module_instance_t const *mi);
+
 struct module_rlm_s {
 	module_t			common;			//!< Common fields presented by all modules.
 	module_method_group_t		method_group;		//!< named methods
+	module_rlm_load_t		load;			//!< Optional, how busy an instance is.
 };
 
 struct module_rlm_instance_s {
@@ -148,6 +163,8 @@ int			modules_rlm_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el) CC_HI
 
 int			modules_rlm_instantiate(void);
 
+int			modules_rlm_hup(CONF_SECTION *root, fr_time_delta_t keep) CC_HINT(nonnull);
+
 int			modules_rlm_bootstrap(CONF_SECTION *root) CC_HINT(nonnull);
 /** @} */
 
@@ -26,6 +26,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/request_data.h>
+#include <freeradius-devel/server/trace.h>
 #include <freeradius-devel/unlang/interpret.h>
 
 #include <freeradius-devel/util/debug.h>
@@ -65,6 +66,18 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
  */
 static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
 
+/** The maximum number of requests to keep in the thread local free list
+ *
+ */
+static _Thread_local uint32_t request_free_list_max = 256;
+
+/** Extra memory to add to each request's pool for pairs and values
+ *
+ * Zero outside of workers, which keeps requests allocated by other
+ * threads small.
+ */
+static _Thread_local size_t request_talloc_pool_size;
+
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
 {
@@ -120,7 +133,7 @@ void request_log_prepend(request_t *request, fr_log_t *log_dst, fr_log_lvl_t lvl
 		last = &request->log.dst;
 		while (*last) {
 			dst = *last;
-			if (((fr_log_t *)dst->uctx)->parent == log_dst) {
+			if ((dst->func == vlog_request) && (((fr_log_t *)dst->uctx)->parent == log_dst)) {
 				*last = dst->next;
 				talloc_free(dst);
 				if (!request->log.dst) request->log.lvl = L_DBG_LVL_OFF;
@@ -137,7 +150,7 @@ void request_log_prepend(request_t *request, fr_log_t *log_dst, fr_log_lvl_t lvl
 	 *	Change the debug level of an existing destination.
 	 */
 	for (dst = request->log.dst; dst != NULL; dst = dst->next) {
-		if (((fr_log_t *)dst->uctx)->parent == log_dst) {
+		if ((dst->func == vlog_request) && (((fr_log_t *)dst->uctx)->parent == log_dst)) {
 			dst->lvl = lvl;
 			if (lvl > request->log.lvl) request->log.lvl = lvl;
 			return;
@@ -159,6 +172,40 @@ void request_log_prepend(request_t *request, fr_log_t *log_dst, fr_log_lvl_t lvl
 	request->log.dst = dst;
 }
 
+/** Record the request's log messages in binary form
+ *
+ * Messages are only formatted if the recorder is replayed with
+ * #log_request_rec_replay, so this is cheap enough to leave enabled
+ * for every request.
+ *
+ * @param[in] request	to record messages for.
+ * @param[in] rec	to record messages in.  Must not be freed
+ *			before the request.
+ * @param[in] lvl	Messages with a level up to and including
+ *			this one are recorded.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int request_log_rec_prepend(request_t *request, fr_log_rec_t *rec, fr_log_lvl_t lvl)
+{
+	log_dst_t *dst;
+
+	dst = talloc_zero(request, log_dst_t);
+	if (unlikely(!dst)) return -1;
+
+	dst->func = vlog_request_rec;
+	dst->uctx = rec;
+
+	dst->lvl = lvl;
+	if (lvl > request->log.lvl) request->log.lvl = lvl;
+	dst->next = request->log.dst;
+
+	request->log.dst = dst;
+
+	return 0;
+}
+
 static inline void CC_HINT(always_inline) request_log_init_child(request_t *child, request_t const *parent)
 {
 	/*
@@ -238,10 +285,11 @@ static inline CC_HINT(always_inline) int request_child_init(request_t *child, re
  * @param[in] request		to (re)-initialise.
  * @param[in] type		of request to initialise.
  * @param[in] args		Other optional arguments.
+ * @param[in] stack		to reuse.  If NULL, a new stack is allocated in the request.
  */
 static inline CC_HINT(always_inline) int request_init(char const *file, int line,
 						      request_t *request, request_type_t type,
-						      request_init_args_t const *args)
+						      request_init_args_t const *args, void *stack)
 {
 
 	/*
@@ -280,7 +328,11 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 	/*
 	 *	Initialise the stack
 	 */
-	MEM(request->stack = unlang_interpret_stack_alloc(request));
+	if (stack) {
+		request->stack = stack;
+	} else {
+		MEM(request->stack = unlang_interpret_stack_alloc(request));
+	}
 
 	/*
 	 *	Initialise the request data list
@@ -330,6 +382,15 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 			talloc_set_destructor(request->pair_list.state, _state_ctx_free);
 #endif
 		}
+
+		/*
+		 *	Policies search these lists many times per
+		 *	request, so let them build an index if they
+		 *	get large.
+		 */
+		fr_pair_list_index_enable(&request->request_pairs);
+		fr_pair_list_index_enable(&request->reply_pairs);
+		fr_pair_list_index_enable(&request->control_pairs);
 	}
 
 	/*
@@ -374,6 +435,8 @@ static int _request_free(request_t *request)
 
 	RDEBUG3("Request freed (%p)", request);
 
+	if (unlikely(request->trace != NULL)) fr_trace_request_end(request);
+
 	/*
 	 *	Reinsert into the free list if it's not already
 	 *	in the free list.
@@ -389,8 +452,9 @@ static int _request_free(request_t *request)
 	 *	We keep a buffer of <active> + N requests per
 	 *	thread, to avoid spurious allocations.
 	 */
-	if (fr_dlist_num_elements(request_free_list) <= 256) {
+	if (fr_dlist_num_elements(request_free_list) < request_free_list_max) {
 		fr_dlist_head_t		*free_list;
+		void			*stack = request->stack;
 
 		if (request->session_state_ctx) {
 			fr_assert(talloc_parent(request->session_state_ctx) != request);	/* Should never be directly parented */
@@ -403,7 +467,14 @@ static int _request_free(request_t *request)
 		 */
 		talloc_free_children(request);
 
+		/*
+		 *	The stack isn't in the request's pool, so
+		 *	we keep it for the next request.
+		 */
+		unlang_interpret_stack_reset(stack);
+
 		memset(request, 0, sizeof(*request));
+		request->stack = stack;
 		request->component = "free_list";
 #ifndef NDEBUG
 		/*
@@ -433,9 +504,10 @@ static int _request_free(request_t *request)
 
 really_free:
 	/*
-	 *	state_ctx is parented separately.
+	 *	state_ctx and the stack are parented separately.
 	 */
 	if (request->session_state_ctx) TALLOC_FREE(request->session_state_ctx);
+	TALLOC_FREE(request->stack);
 
 #ifndef NDEBUG
 	request->magic = 0x01020304;	/* set the request to be nonsense */
@@ -459,7 +531,21 @@ static int _request_free_list_free_on_exit(void *arg)
 	return talloc_free(list);
 }
 
-static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx)
+/** Number of talloc chunks to reserve headers for in the pair arena
+ *
+ * Most pairs are a single chunk, with strings and octets adding a
+ * second one for their buffer.
+ */
+#define REQUEST_POOL_PAIRS	(request_talloc_pool_size / (sizeof(fr_pair_t) + 32))
+
+/** Allocate a request as a talloc pool
+ *
+ * The pool is the arena for the request's pairs and their values.  Anything
+ * allocated in the pair lists is bump allocated from it, and the whole lot
+ * is reset in one go by talloc_free_children() when the request goes back
+ * to the free list.  Allocations which don't fit fall back to malloc.
+ */
+static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx, bool with_stack)
 {
 	request_t *request;
 
@@ -472,14 +558,29 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 	 *	cannot be returned to a free list
 	 *	and would have to be freed.
 	 */
+	if (!with_stack) {
+		MEM(request = talloc_pooled_object(ctx, request_t,
+						   2 + 				/* packets */
+						   REQUEST_POOL_PAIRS +		/* pairs and values */
+						   10,				/* extra */
+						   (sizeof(fr_pair_t) * 5) +	/* pair lists and root*/
+						   (sizeof(fr_packet_t) * 2) +	/* packets */
+						   request_talloc_pool_size +	/* pairs and values */
+						   128				/* extra */
+						   ));
+		return request;
+	}
+
 	MEM(request = talloc_pooled_object(ctx, request_t,
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
+					   REQUEST_POOL_PAIRS +			/* pairs and values */
 					   10,					/* extra */
 					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
 					   (sizeof(fr_packet_t) * 2) +	/* packets */
+					   request_talloc_pool_size +		/* pairs and values */
 					   128					/* extra */
 					   ));
 	fr_assert(ctx != request);
@@ -503,6 +604,7 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 {
 	request_t		*request;
 	fr_dlist_head_t		*free_list;
+	void			*stack;
 
 	if (!args) args = &default_args;
 
@@ -524,7 +626,14 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 		 *	Must be allocated with in the NULL ctx
 		 *	as chunk is returned to the free list.
 		 */
-		request = request_alloc_pool(NULL);
+		request = request_alloc_pool(NULL, false);
+
+		/*
+		 *	The stack is allocated outside of the
+		 *	request, so that it can be reset and
+		 *	reused along with the request.
+		 */
+		request->stack = stack = unlang_interpret_stack_alloc(NULL);
 		talloc_set_destructor(request, _request_free);
 	} else {
 		/*
@@ -532,9 +641,10 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 		 *	about to use it!
 		 */
 		fr_dlist_remove(free_list, request);
+		stack = request->stack;
 	}
 
-	if (request_init(file, line, request, type, args) < 0) {
+	if (request_init(file, line, request, type, args, stack) < 0) {
 		talloc_free(request);
 		return NULL;
 	}
@@ -612,14 +722,38 @@ request_t *_request_local_alloc(char const *file, int line, TALLOC_CTX *ctx,
 
 	if (!args) args = &default_args;
 
-	request = request_alloc_pool(ctx);
-	if (request_init(file, line, request, type, args) < 0) return NULL;
+	request = request_alloc_pool(ctx, true);
+	if (request_init(file, line, request, type, args, NULL) < 0) return NULL;
 
 	talloc_set_destructor(request, _request_local_free);
 
 	return request;
 }
 
+/** Set the maximum number of requests kept in this thread's free list
+ *
+ * Requests above this number are freed when they're done, instead of
+ * being kept for reuse.
+ *
+ * @param[in] max	number of free requests.  0 disables the free list.
+ */
+void request_free_list_max_set(uint32_t max)
+{
+	request_free_list_max = max;
+}
+
+/** Set how much memory this thread's requests reserve for pairs and values
+ *
+ * Only affects requests which are allocated after the call.  Requests
+ * already in the free list keep the pool they were allocated with.
+ *
+ * @param[in] size	of the arena, in bytes.
+ */
+void request_talloc_pool_size_set(size_t size)
+{
+	request_talloc_pool_size = size;
+}
+
 /** Replace the session_state_ctx with a new one.
  *
  *  NOTHING should rewrite request->session_state_ctx.
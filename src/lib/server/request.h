@@ -37,6 +37,8 @@ typedef struct request_s request_t;
 
 typedef struct fr_client_s fr_client_t;
 
+typedef struct fr_trace_span_s fr_trace_span_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -181,6 +183,8 @@ struct request_s {
 	uint64_t		child_number; 	//!< Monotonically increasing number for children of this request
 	char const		*name;		//!< for debug printing, as (%d) is no longer sufficient
 
+	fr_trace_span_t		*trace;		//!< Current span, if the request is being traced.
+
 	uint64_t		seq_start;	//!< State sequence ID.  Stable identifier for a sequence of requests
 						//!< and responses.
 	fr_dict_t const		*dict;		//!< Dictionary of the protocol that this request belongs to.
@@ -327,6 +331,10 @@ request_t	*_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 request_t	*_request_local_alloc(char const *file, int line, TALLOC_CTX *ctx,
 				      request_type_t type, request_init_args_t const *args);
 
+void		request_free_list_max_set(uint32_t max);
+
+void		request_talloc_pool_size_set(size_t size);
+
 fr_pair_t	*request_state_replace(request_t *request, fr_pair_t *state) CC_HINT(nonnull(1));
 
 int		request_detach(request_t *child);
@@ -336,6 +344,8 @@ void		request_global_free(void);
 
 void		request_log_prepend(request_t *request, fr_log_t *log, fr_log_lvl_t lvl);
 
+int		request_log_rec_prepend(request_t *request, fr_log_rec_t *rec, fr_log_lvl_t lvl);
+
 #ifdef WITH_VERIFY_PTR
 void		request_verify(char const *file, int line, request_t const *request);	/* only for special debug builds */
 #endif
@@ -52,12 +52,31 @@ RCSID("$Id$")
 
 #include <freeradius-devel/io/listen.h>
 
+#include <freeradius-devel/util/cbor.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Number of independently locked partitions in a thread safe state tree
+ *
+ * Must be a power of two.
+ */
+#define STATE_TREE_SHARDS	32
+
+/** Maximum number of entries we examine when looking for ones to spill to the backend
+ *
+ */
+#define STATE_SPILL_SCAN	8
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -121,8 +140,27 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 
 	fr_state_tree_t		*state_tree;			//!< Tree this entry belongs to.
+
+	size_t			size;				//!< Memory recorded in the tree's account.
+
+	bool			spilling;			//!< A copy is being written to the backend.
 } fr_state_entry_t;
 
+/** A copy of a state entry, which is being written to the backend
+ *
+ * The entry stays in its shard until the write has completed, so
+ * requests for the session can still find it.
+ */
+typedef struct {
+	fr_dlist_t		entry;				//!< Entry in the list of copies to write.
+	uint64_t		id;				//!< Of the state entry the copy was made from.
+	uint8_t			state[sizeof(struct state_comp)];	//!< State value in binary.
+	uint64_t		seq_start;			//!< Number of first request in this sequence.
+	fr_time_t		cleanup;			//!< When the state entry should be cleaned up.
+	int			tries;
+	fr_pair_list_t		pairs;				//!< Copy of the session-state pairs.
+} state_spill_copy_t;
+
 /** A child of a fr_state_entry_t
  *
  * Children are tracked using the request data of parents.
@@ -142,19 +180,41 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
-	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
+/** A partition of the state tree
+ *
+ * State entries are assigned to a shard by a hash of their state value,
+ * so requests for different sessions rarely contend for the same mutex.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
 	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
 	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	uint64_t		timed_out;			//!< Number of states in this shard that were
+								//!< cleaned up due to timeout.
+	uint32_t		spilling;			//!< Number of entries being written to the backend.
+} fr_state_shard_t;
+
+struct fr_state_tree_s {
+	_Atomic(uint64_t)	id;				//!< Next ID to assign.
+	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+	_Atomic(uint32_t)	used_sessions;			//!< How many sessions are currently in progress.
+
+	fr_state_shard_t	*shards;			//!< Partitions of the tree.
+	uint32_t		num_shards;			//!< How many partitions there are.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entries.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
+
+	fr_state_backend_t const *backend;			//!< Where to spill cold entries to.
+	void			*backend_uctx;			//!< Passed to backend callbacks.
+	uint32_t		shard_max_hot;			//!< Entries to keep in memory per shard before
+								///< spilling the coldest to the backend.
+	_Atomic(uint64_t)	spilled;			//!< Number of entries spilled to the backend.
+
+	talloc_account_t	*account;			//!< Memory used by entries.  May be NULL.
+	_Atomic(uint64_t)	evicted;			//!< Number of entries evicted, or spilled early,
+								///< because the account was over budget.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -166,7 +226,18 @@ struct fr_state_tree_s {
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
+
+/** Return the shard an entry belongs in
+ *
+ * @param[in] state	tree to find the shard in.
+ * @param[in] entry	whose state value has already been xor'd with the context ID.
+ */
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & (state->num_shards - 1)];
+}
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -185,22 +256,33 @@ static int8_t state_entry_cmp(void const *one, void const *two)
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		/*
+		 *	Shard initialisation failed part way
+		 *	through.
+		 */
+		if (!shard->tree) break;
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -209,7 +291,9 @@ static int _state_tree_free(fr_state_tree_t *state)
  *
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
- * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] thread_safe	Whether we should mutex protect the state tree.
+ *				If true, the tree is split into #STATE_TREE_SHARDS
+ *				independently locked partitions.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
@@ -224,12 +308,18 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->used_sessions, 0);
+	atomic_init(&state->spilled, 0);
+	atomic_init(&state->evicted, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -240,47 +330,238 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
-
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
-
 	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	There's no contention if we're single
+	 *	threaded, so don't bother sharding.
 	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
+	state->num_shards = thread_safe ? STATE_TREE_SHARDS : 1;
+	state->shards = talloc_zero_array(state, fr_state_shard_t, state->num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
 	talloc_set_destructor(state, _state_tree_free);
 
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) goto error;
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			goto error;
+		}
+	}
+
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
-	state->thread_safe = thread_safe;
 
 	return state;
+
+error:
+	talloc_free(state);
+	return NULL;
+}
+
+/** Spill cold state entries to an external store
+ *
+ * Once set, each shard holds at most max_sessions / shards entries in memory.
+ * When a shard grows past that, its least recently created entries are written
+ * to the backend and freed, and they're read back in if a request for the
+ * session arrives.  max_sessions then limits memory use, rather than the number
+ * of ongoing sessions.
+ *
+ * Only entries whose state consists solely of &session-state pairs can be
+ * spilled.  Entries holding persistable request data (such as EAP sessions)
+ * reference memory which can't be serialised, and always stay in memory.
+ *
+ * @note Must be called before the state tree is used.
+ *
+ * @param[in] state	tree to set the backend for.
+ * @param[in] backend	to use.  Must remain valid for the lifetime of the tree.
+ * @param[in] uctx	passed to backend callbacks.
+ */
+void fr_state_tree_backend_set(fr_state_tree_t *state, fr_state_backend_t const *backend, void *uctx)
+{
+	fr_assert(backend->store && backend->fetch && backend->discard);
+
+	state->backend = backend;
+	state->backend_uctx = uctx;
+	state->shard_max_hot = state->max_sessions / state->num_shards;
+	if (state->shard_max_hot == 0) state->shard_max_hot = 1;
+}
+
+/** Record the memory used by entries, and optionally limit it
+ *
+ * Each entry is sized when it's inserted, so the memory used can be reported
+ * without walking the talloc trees of the entries, which may belong to other
+ * threads.
+ *
+ * If max_memory is set, and inserting an entry takes the tree over it, the
+ * oldest entries in the entry's shard are evicted until it's back under.  If
+ * there's a backend, entries which can be spilled are spilled instead.
+ *
+ * @note Must be called before the state tree is used.
+ *
+ * @param[in] state		tree to record the memory of.
+ * @param[in] name		to report the memory under, usually the virtual server.
+ * @param[in] max_memory	soft limit on the memory used by entries.  0 for no limit.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_state_tree_account_set(fr_state_tree_t *state, char const *name, size_t max_memory)
+{
+	state->account = talloc_account("state", name);
+	if (!state->account) return -1;
+
+	talloc_account_budget_set(state->account, max_memory);
+
+	return 0;
+}
+
+#define return_slen return slen - fr_dbuff_used(&work_dbuff)
+
+/** Encode spilled session state as a sequence of CBOR items
+ *
+ * The items are the key, the number of the first request in the session,
+ * the number of rounds, the time remaining until the state expires, the
+ * number of pairs, and then the pairs.  As #fr_time_t is local to a process,
+ * the time remaining is sent instead of the expiry time, so the result can
+ * be passed between servers, and read back with #fr_state_spill_decode.
+ *
+ * @param[out] dbuff	to write the encoded state to.
+ * @param[in] spill	to encode.
+ * @param[in] root	of the dictionary the &session-state pairs are from.
+ *			Only pairs which are direct children of root can be
+ *			encoded.
+ * @return
+ *	- > 0 the number of bytes written.
+ *	- <= 0 on error.
+ */
+ssize_t fr_state_spill_encode(fr_dbuff_t *dbuff, fr_state_spill_t const *spill, fr_dict_attr_t const *root)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(dbuff);
+	ssize_t		slen;
+	fr_time_delta_t	remaining;
+
+	fr_pair_list_foreach(spill->pairs, vp) {
+		if (vp->da->parent == root) continue;
+
+		fr_strerror_printf("Can't encode &session-state.%s, it is not a child of %s",
+				   vp->da->name, root->name);
+		return -1;
+	}
+
+	remaining = fr_time_sub(spill->expires, fr_time());
+	if (fr_time_delta_isneg(remaining)) remaining = fr_time_delta_wrap(0);
+
+	slen = fr_cbor_encode_value_box(&work_dbuff, fr_box_octets(spill->key, spill->key_len));
+	if (slen <= 0) return_slen;
+
+	slen = fr_cbor_encode_value_box(&work_dbuff, fr_box_uint64(spill->seq_start));
+	if (slen <= 0) return_slen;
+
+	slen = fr_cbor_encode_value_box(&work_dbuff, fr_box_uint32((uint32_t) spill->tries));
+	if (slen <= 0) return_slen;
+
+	slen = fr_cbor_encode_value_box(&work_dbuff, fr_box_time_delta_with_res(remaining, FR_TIME_RES_NSEC));
+	if (slen <= 0) return_slen;
+
+	slen = fr_cbor_encode_value_box(&work_dbuff, fr_box_uint32(fr_pair_list_num_elements(spill->pairs)));
+	if (slen <= 0) return_slen;
+
+	fr_pair_list_foreach(spill->pairs, vp) {
+		slen = fr_cbor_encode_pair(&work_dbuff, vp);
+		if (slen <= 0) return_slen;
+	}
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+/** Decode session state which was encoded with #fr_state_spill_encode
+ *
+ * @param[in,out] spill	ctx and pairs must be set.  If key is set, the
+ *			decoded key must match it, otherwise key is set to
+ *			the decoded key, allocated in ctx.  The remaining
+ *			fields are set from the decoded state.  On error,
+ *			some pairs may have been added to the list.
+ * @param[in] dbuff	to read the encoded state from.
+ * @param[in] root	of the dictionary the &session-state pairs are from.
+ * @return
+ *	- > 0 the number of bytes read.
+ *	- <= 0 on error.
+ */
+ssize_t fr_state_spill_decode(fr_state_spill_t *spill, fr_dbuff_t *dbuff, fr_dict_attr_t const *root)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(dbuff);
+	ssize_t		slen;
+	fr_value_box_t	vb;
+	uint32_t	i, count;
+
+	slen = fr_cbor_decode_value_box(spill->ctx, &vb, &work_dbuff, FR_TYPE_OCTETS, NULL, true);
+	if (slen <= 0) return_slen;
+
+	if (spill->key) {
+		bool match = (vb.vb_length == spill->key_len) && (memcmp(vb.vb_octets, spill->key, spill->key_len) == 0);
+
+		fr_value_box_clear(&vb);
+		if (!match) {
+			fr_strerror_const("Session state key does not match");
+			return -fr_dbuff_used(&work_dbuff);
+		}
+	} else {
+		spill->key = vb.vb_octets;
+		spill->key_len = vb.vb_length;
+	}
+
+	slen = fr_cbor_decode_value_box(spill->ctx, &vb, &work_dbuff, FR_TYPE_UINT64, NULL, true);
+	if (slen <= 0) return_slen;
+	spill->seq_start = vb.vb_uint64;
+
+	slen = fr_cbor_decode_value_box(spill->ctx, &vb, &work_dbuff, FR_TYPE_UINT32, NULL, true);
+	if (slen <= 0) return_slen;
+	spill->tries = (int) vb.vb_uint32;
+
+	slen = fr_cbor_decode_value_box(spill->ctx, &vb, &work_dbuff, FR_TYPE_TIME_DELTA, NULL, true);
+	if (slen <= 0) return_slen;
+	spill->expires = fr_time_add(fr_time(), vb.vb_time_delta);
+
+	slen = fr_cbor_decode_value_box(spill->ctx, &vb, &work_dbuff, FR_TYPE_UINT32, NULL, true);
+	if (slen <= 0) return_slen;
+	count = vb.vb_uint32;
+
+	for (i = 0; i < count; i++) {
+		slen = fr_cbor_decode_pair(spill->ctx, spill->pairs, &work_dbuff, root, true);
+		if (slen <= 0) return_slen;
+	}
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
 }
 
 /** Unlink an entry and remove if from the tree
  *
  */
 static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
+	fr_rb_delete(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -320,47 +601,38 @@ static int _state_entry_free(fr_state_entry_t *entry)
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	if (entry->size) {
+		talloc_account_sub(entry->state_tree->account, entry->size);
+		entry->size = 0;
+	}
+
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
-/** Create a new state entry
+/** Unlink any expired entries from a shard
+ *
+ * @note Called with the shard's mutex held.
  *
- * @note Called with the mutex held.
+ * @param[in] shard	to clean up.
+ * @param[in] now	The current time.
+ * @param[in] old	Entry being reused, which must not be unlinked.
+ * @param[out] to_free	Where to add the unlinked entries.  These should be
+ *			freed after the mutex is released.
+ * @return The number of entries unlinked.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
-					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_time_t now,
+				   fr_state_entry_t *old, fr_dlist_head_t *to_free)
 {
-	size_t			i;
-	uint32_t		x;
-	fr_time_t		now = fr_time();
-	fr_pair_t		*vp;
 	fr_state_entry_t	*entry, *next;
-
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
 	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
 
-	/*
-	 *	Shouldn't be in any lists if it's being reused
-	 */
-	fr_assert(!old ||
-		  (!fr_dlist_entry_in_list(&old->expire_entry) &&
-		   !fr_rb_node_inline_in_tree(&old->node)));
-
-	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
-
-	/*
-	 *	Clean up expired entries
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
+	for (entry = fr_dlist_head(&shard->to_expire);
 	     entry != NULL;
 	     entry = next) {
  		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
 
 		if (entry == old) continue;
 
@@ -368,8 +640,8 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		 *	Too old, we can delete it.
 		 */
 		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
+			state_entry_unlink(shard, entry);
+			fr_dlist_insert_tail(to_free, entry);
 			timed_out++;
 			continue;
 		}
@@ -377,51 +649,332 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		break;
 	}
 
-	state->timed_out += timed_out;
+	shard->timed_out += timed_out;
 
-	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
-	} else {
-		old_tries = old->tries;
-		memcpy(old_state, old->state, sizeof(old_state));
-	}
+	return timed_out;
+}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+/** Free entries unlinked by state_shard_expire
+ *
+ * We do it outside of the mutex as freeing may involve significantly more
+ * work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static inline CC_HINT(always_inline) void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
 
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	while ((entry = fr_dlist_pop_head(to_free)) != NULL) talloc_free(entry);
+}
+
+/** Reserve a session slot, cleaning up expired entries in all shards if we're at the limit
+ *
+ * @param[in] state	to reserve a slot in.
+ * @param[in] request	the entry is being created for.
+ * @param[in] old	Entry being reused, which must not be unlinked.
+ * @return
+ *	- true if a slot was reserved.
+ *	- false if we're at max_sessions.
+ */
+static bool state_session_reserve(fr_state_tree_t *state, request_t *request, fr_state_entry_t *old)
+{
+	fr_time_t		now;
+	fr_dlist_head_t		to_free;
+	uint64_t		timed_out = 0;
+	uint32_t		i;
+
+	if (atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed) < state->max_sessions) return true;
+	atomic_fetch_sub_explicit(&state->used_sessions, 1, memory_order_relaxed);
 
 	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
+	 *	Expired entries are normally cleaned up as
+	 *	new entries are inserted into their shard,
+	 *	which may leave some lingering in quiet shards.
 	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
+	now = fr_time();
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += state_shard_expire(shard, now, old, &to_free);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 	}
 
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entries_free(&to_free);
+
+	if (atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed) < state->max_sessions) return true;
+	atomic_fetch_sub_explicit(&state->used_sessions, 1, memory_order_relaxed);
+
+	return false;
+}
+
+/** Copy an entry, so that it can be written to the backend
+ *
+ * The entry itself is left in the shard.
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] shard	the entry is in.
+ * @param[in] entry	to copy.
+ * @param[out] to_spill	Where to add the copy.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the entry couldn't be copied.
+ */
+static int state_entry_spill_copy(fr_state_shard_t *shard, fr_state_entry_t *entry, fr_dlist_head_t *to_spill)
+{
+	state_spill_copy_t	*copy;
+
+	copy = talloc_zero(NULL, state_spill_copy_t);
+	if (!copy) return -1;
+
+	fr_pair_list_init(&copy->pairs);
+	if (fr_pair_list_copy(copy, &copy->pairs, &entry->ctx->children) < 0) {
+		talloc_free(copy);
+		return -1;
+	}
+
+	copy->id = entry->id;
+	memcpy(copy->state, entry->state, sizeof(copy->state));
+	copy->seq_start = entry->seq_start;
+	copy->cleanup = entry->cleanup;
+	copy->tries = entry->tries;
+
+	entry->spilling = true;
+	shard->spilling++;
+	fr_dlist_insert_tail(to_spill, copy);
+
+	return 0;
+}
+
+/** Copy the coldest entries from a shard which has grown too large
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] state	tree the shard belongs to.
+ * @param[in] shard	to copy entries from.
+ * @param[in] keep	Entry just inserted, which must not be spilled.
+ * @param[out] to_spill	Where to add the copies.  These should be
+ *			spilled after the mutex is released.
+ */
+static void state_shard_spill(fr_state_tree_t *state, fr_state_shard_t *shard,
+			      fr_state_entry_t *keep, fr_dlist_head_t *to_spill)
+{
+	fr_state_entry_t	*entry, *next;
+	uint32_t		count = fr_rb_num_elements(shard->tree) - shard->spilling;
+	unsigned int		i;
+
+	for (entry = fr_dlist_head(&shard->to_expire), i = 0;
+	     entry && (count > state->shard_max_hot) && (i < STATE_SPILL_SCAN);
+	     entry = next, i++) {
+		next = fr_dlist_next(&shard->to_expire, entry);
+
+		if ((entry == keep) || entry->spilling || !entry->ctx || !fr_dlist_empty(&entry->data)) continue;
+
+		if (state_entry_spill_copy(shard, entry, to_spill) < 0) break;
+		count--;
+	}
+}
+
+/** Unlink the oldest entries from a shard, when the tree is over its memory budget
+ *
+ * Entries which can be spilled are, if there's a backend.  They stay in the
+ * shard until the write has completed.  The rest are freed, which ends their
+ * sessions.
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] state	tree the shard belongs to.
+ * @param[in] shard	to unlink entries from.
+ * @param[in] keep	Entry just inserted, which must not be unlinked.
+ * @param[out] to_free	Where to add the entries to free.
+ * @param[out] to_spill	Where to add copies of the entries to spill.
+ * @return The number of entries unlinked, or being spilled.
+ */
+static uint64_t state_shard_evict(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *keep,
+				  fr_dlist_head_t *to_free, fr_dlist_head_t *to_spill)
+{
+	fr_state_entry_t	*entry, *next;
+	size_t			used = talloc_account_used(state->account);
+	size_t			budget = talloc_account_budget(state->account);
+	uint64_t		evicted = 0;
+	unsigned int		i;
+
+	for (entry = fr_dlist_head(&shard->to_expire), i = 0;
+	     entry && (used > budget) && (i < STATE_SPILL_SCAN);
+	     entry = next, i++) {
+		next = fr_dlist_next(&shard->to_expire, entry);
+
+		if ((entry == keep) || entry->spilling) continue;
+
+		if (!state->backend || !entry->ctx || !fr_dlist_empty(&entry->data) ||
+		    (state_entry_spill_copy(shard, entry, to_spill) < 0)) {
+			state_entry_unlink(shard, entry);
+			fr_dlist_insert_tail(to_free, entry);
+		}
+		used -= (entry->size < used) ? entry->size : used;
+		evicted++;
+	}
+
+	return evicted;
+}
+
+/** Write copies of entries to the backend, and free the entries they were made from
+ *
+ * If a request has taken the entry whilst the copy was being written,
+ * the copy is stale, and is deleted from the backend.  Entries which
+ * can't be written stay in memory.
+ */
+static void state_entries_spill(fr_state_tree_t *state, fr_state_shard_t *shard, fr_dlist_head_t *to_spill)
+{
+	state_spill_copy_t	*copy;
+
+	while ((copy = fr_dlist_pop_head(to_spill)) != NULL) {
+		fr_state_spill_t spill = {
+			.key = copy->state,
+			.key_len = sizeof(copy->state),
+			.pairs = &copy->pairs,
+			.seq_start = copy->seq_start,
+			.tries = copy->tries,
+			.expires = copy->cleanup
+		};
+		fr_state_entry_t	find, *entry;
+		int			ret;
+
+		ret = state->backend->store(&spill, state->backend_uctx);
+
+		memcpy(find.state, copy->state, sizeof(find.state));
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		shard->spilling--;
+		entry = fr_rb_find(shard->tree, &find);
+		if (entry && (entry->id == copy->id)) {
+			entry->spilling = false;
+			if (ret == 0) state_entry_unlink(shard, entry);
+		} else {
+			entry = NULL;
+		}
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+		if (ret < 0) {
+			WARN("Failed spilling state ID %" PRIu64 " to %s, keeping it in memory",
+			     copy->id, state->backend->name);
+
+		} else if (!entry) {
+			DEBUG4("State ID %" PRIu64 " was used whilst being spilled to %s, deleting the copy",
+			       copy->id, state->backend->name);
+			if (state->backend->discard(&spill, state->backend_uctx) < 0) {
+				WARN("Failed deleting state ID %" PRIu64 " from %s", copy->id, state->backend->name);
+			}
+
+		} else {
+			DEBUG4("State ID %" PRIu64 " spilled to %s", copy->id, state->backend->name);
+			atomic_fetch_add_explicit(&state->spilled, 1, memory_order_relaxed);
+			talloc_free(entry);
+		}
+
+		talloc_free(copy);
+	}
+}
+
+/** Read a state entry back in from the backend
+ *
+ * @param[in] state	tree the entry belonged to.
+ * @param[in] find	Entry containing the state value to look for.
+ * @return
+ *	- A new entry, which is not in the tree.
+ *	- NULL if no entry was found, or it has expired.
+ */
+static fr_state_entry_t *state_entry_fetch(fr_state_tree_t *state, fr_state_entry_t const *find)
+{
+	fr_state_entry_t	*entry;
+	fr_pair_t		*ctx;
+	fr_state_spill_t	spill;
+
+	MEM(ctx = fr_pair_afrom_da(NULL, request_attr_state));
+
+	spill = (fr_state_spill_t){
+		.key = find->state,
+		.key_len = sizeof(find->state),
+		.ctx = ctx,
+		.pairs = &ctx->children
+	};
+
+	if (state->backend->fetch(&spill, state->backend_uctx) != 0) {
+	error:
+		talloc_free(ctx);
 		return NULL;
 	}
 
+	if (fr_time_lt(spill.expires, fr_time())) {
+		DEBUG4("State entry fetched from %s has expired", state->backend->name);
+		goto error;
+	}
+
+	MEM(entry = talloc_zero(NULL, fr_state_entry_t));
+	talloc_set_destructor(entry, _state_entry_free);
+	atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed);
+
+	entry->state_tree = state;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
+	memcpy(entry->state, find->state, sizeof(entry->state));
+	entry->seq_start = spill.seq_start;
+	entry->tries = spill.tries;
+	entry->cleanup = spill.expires;
+	entry->ctx = ctx;
+	request_data_list_init(&entry->data);
+
+	if (state->account) {
+		entry->size = sizeof(*entry) + talloc_total_size(ctx);
+		talloc_account_add(state->account, entry->size);
+	}
+
+	DEBUG4("State ID %" PRIu64 " fetched from %s", entry->id, state->backend->name);
+
+	return entry;
+}
+
+/** Create a new state entry
+ *
+ * The entry is not inserted into the tree.  That's done by #state_entry_insert
+ * once the caller has finished populating it.
+ *
+ * @note Called with no mutexes held.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
+					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+{
+	size_t			i;
+	uint32_t		x;
+	fr_time_t		now = fr_time();
+	fr_pair_t		*vp;
+	fr_state_entry_t	*entry;
+
+	uint8_t			old_state[sizeof(old->state)];
+	int			old_tries = 0;
+
 	/*
-	 *	Allocation doesn't need to occur inside the critical region
-	 *	and would add significantly to contention.
+	 *	Shouldn't be in any lists if it's being reused
 	 */
+	fr_assert(!old ||
+		  (!fr_dlist_entry_in_list(&old->expire_entry) &&
+		   !fr_rb_node_inline_in_tree(&old->node)));
+
+	if (!old) {
+		if (!state_session_reserve(state, request, old)) {
+			RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+			       state->max_sessions);
+			return NULL;
+		}
+	} else {
+		old_tries = old->tries;
+		memcpy(old_state, old->state, sizeof(old_state));
+	}
+
 	if (!old) {
 		MEM(entry = talloc_zero(NULL, fr_state_entry_t));
 		talloc_set_destructor(entry, _state_entry_free);
@@ -432,6 +985,12 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	} else {
 		_state_entry_free(old);
+
+		/*
+		 *	The session continues, so take back the
+		 *	slot _state_entry_free released.
+		 */
+		atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed);
 		talloc_free_children(old);
 		memset(old, 0, sizeof(*old));
 		entry = old;
@@ -441,7 +1000,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -531,8 +1090,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -541,61 +1098,119 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
 
-	if (!fr_rb_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
-		fr_pair_delete_by_da(reply_list, state->da);
-		talloc_free(entry);
-		return NULL;
-	}
+	return entry;
+}
+
+/** Insert a state entry into its shard, cleaning up any expired entries in the shard
+ *
+ * @param[in] state	tree to insert the entry into.
+ * @param[in] request	the entry was created for.
+ * @param[in] entry	to insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 if an entry with the same state value already exists.
+ */
+static int state_entry_insert(fr_state_tree_t *state, request_t *request, fr_state_entry_t *entry)
+{
+	fr_state_shard_t	*shard = state_shard(state, entry);
+	fr_dlist_head_t		to_free, to_spill;
+	uint64_t		timed_out, evicted = 0;
+	bool			inserted;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+	fr_dlist_init(&to_spill, state_spill_copy_t, entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	timed_out = state_shard_expire(shard, fr_time(), entry, &to_free);
+
+	inserted = fr_rb_insert(shard->tree, entry);
 
 	/*
 	 *	Link it to the end of the list, which is implicitly
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	if (inserted) {
+		fr_dlist_insert_tail(&shard->to_expire, entry);
+		if (state->backend) state_shard_spill(state, shard, entry, &to_spill);
+		if (state->account && talloc_account_over_budget(state->account)) {
+			evicted = state_shard_evict(state, shard, entry, &to_free, &to_spill);
+		}
+	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
-	return entry;
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	if (evicted > 0) {
+		RWDEBUG("Evicting %"PRIu64" state entries - Over memory budget (%zu bytes)",
+			evicted, talloc_account_budget(state->account));
+		atomic_fetch_add_explicit(&state->evicted, evicted, memory_order_relaxed);
+	}
+	state_entries_free(&to_free);
+	if (state->backend) state_entries_spill(state, shard, &to_spill);
+
+	if (!inserted) {
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		return -1;
+	}
+
+	return 0;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
  *
+ * If fetch is true, and the entry isn't in memory, the backend is checked.
+ *
+ * @param[in] state	tree to search in.
+ * @param[out] my_entry	Where to write the state value to look for.
+ * @param[in] vb	State attribute value.
+ * @param[in] fetch	Whether to check the backend.
  */
-static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
+static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_state_entry_t *my_entry,
+						     fr_value_box_t const *vb, bool fetch)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 
 	/*
 	 *	Assume our own State first.
 	 */
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
+	if (vb->vb_length == sizeof(my_entry->state)) {
+		memcpy(my_entry->state, vb->vb_octets, sizeof(my_entry->state));
 
 		/*
 		 *	Too big?  Get the MD5 hash, in order
 		 *	to depend on the entire contents of State.
 		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
+	} else if (vb->vb_length > sizeof(my_entry->state)) {
+		fr_md5_calc(my_entry->state, vb->vb_octets, vb->vb_length);
 
 		/*
 		 *	Too small?  Use the whole thing, and
-		 *	set the rest of my_entry.state to zero.
+		 *	set the rest of my_entry->state to zero.
 		 */
 	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
+		memcpy(my_entry->state, vb->vb_octets, vb->vb_length);
+		memset(&my_entry->state[vb->vb_length], 0, sizeof(my_entry->state) - vb->vb_length);
 	}
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
-	my_entry.state_comp.context_id ^= state->context_id;
+	my_entry->state_comp.context_id ^= state->context_id;
+
+	shard = state_shard(state, my_entry);
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = fr_rb_remove(shard->tree, my_entry);
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		fr_dlist_remove(&shard->to_expire, entry);
 	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	/*
+	 *	May have been spilled
+	 */
+	if (!entry && fetch && state->backend) entry = state_entry_fetch(state, my_entry);
 
 	return entry;
 }
@@ -605,19 +1220,28 @@ static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_
  */
 void fr_state_discard(fr_state_tree_t *state, request_t *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, my_entry;
 	fr_pair_t		*vp;
 
 	vp = fr_pair_find_by_da(&request->request_pairs, NULL, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find_and_unlink(state, &vp->data);
+	entry = state_entry_find_and_unlink(state, &my_entry, &vp->data, false);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		fr_state_spill_t spill = {
+			.key = my_entry.state,
+			.key_len = sizeof(my_entry.state)
+		};
+
+		/*
+		 *	May have been spilled, in which case the
+		 *	session must end there, too.
+		 */
+		if (state->backend && (state->backend->discard(&spill, state->backend_uctx) < 0)) {
+			RWARN("Failed discarding %s from %s", state->da->name, state->backend->name);
+		}
 		return;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -659,7 +1283,7 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
  */
 int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, my_entry;
 	fr_pair_t		*vp;
 
 	/*
@@ -672,14 +1296,11 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find_and_unlink(state, &vp->data);
+	entry = state_entry_find_and_unlink(state, &my_entry, &vp->data, true);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching &request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
@@ -761,14 +1382,13 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	}
 
 	MEM(state_ctx = request_state_replace(request, NULL));
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 
 	/*
 	 *	Reuses old if possible
 	 */
 	entry = state_entry_create(state, request, &request->reply_pairs, old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	error:
 		RERROR("Creating state entry failed");
 
 		talloc_free(request_state_replace(request, state_ctx));
@@ -779,10 +1399,31 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	fr_assert(entry->ctx == NULL);
 	fr_assert(request->session_state_ctx);
 
+	/*
+	 *	Must be fully populated before it's inserted,
+	 *	as it may be found by another thread as soon
+	 *	as it is.
+	 */
 	entry->seq_start = request->seq_start;
 	entry->ctx = state_ctx;
 	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+
+	/*
+	 *	The persisted request data is parented by
+	 *	state_ctx, so this includes it.
+	 */
+	if (state->account) {
+		entry->size = sizeof(*entry) + talloc_total_size(state_ctx);
+		talloc_account_add(state->account, entry->size);
+	}
+
+	if (state_entry_insert(state, request, entry) < 0) {
+		fr_dlist_move(&data, &entry->data);
+		entry->ctx = NULL;
+		fr_pair_delete_by_da(&request->reply_pairs, state->da);
+		talloc_free(entry);
+		goto error;
+	}
 
 	RDEBUG3("%s - saved", state->da->name);
 	REQUEST_VERIFY(request);
@@ -924,7 +1565,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -932,7 +1573,18 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += shard->timed_out;
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -940,5 +1592,32 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	tracked = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		tracked += fr_rb_num_elements(shard->tree);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return tracked;
+}
+
+/** Return number of entries spilled to the backend
+ *
+ */
+uint64_t fr_state_entries_spilled(fr_state_tree_t *state)
+{
+	return atomic_load_explicit(&state->spilled, memory_order_relaxed);
+}
+
+/** Return number of entries evicted because the tree was over its memory budget
+ *
+ */
+uint64_t fr_state_entries_evicted(fr_state_tree_t *state)
+{
+	return atomic_load_explicit(&state->evicted, memory_order_relaxed);
 }
@@ -30,15 +30,90 @@ RCSIDH(state_h, "$Id$")
 extern "C" {
 #endif
 
+#include <freeradius-devel/util/dbuff.h>
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/server/request.h>
 
 typedef struct fr_state_tree_s fr_state_tree_t;
 
+/** Session state which has been, or is being, moved out of memory
+ *
+ */
+typedef struct {
+	uint8_t const		*key;			//!< Identifies the session.  Only unique within
+							///< a single state tree.
+	size_t			key_len;		//!< Length of the key.
+
+	TALLOC_CTX		*ctx;			//!< To allocate pairs in, when fetching.
+	fr_pair_list_t		*pairs;			//!< &session-state pairs.
+
+	uint64_t		seq_start;		//!< Number of the first request in the session.
+	int			tries;			//!< Number of rounds so far.
+	fr_time_t		expires;		//!< When the session state should be discarded.
+							///< fr_time_t values are local to a process, so
+							///< backends shared between servers should store
+							///< the time remaining instead.
+} fr_state_spill_t;
+
+/** Write session state to an external store
+ *
+ * @param[in] spill	to write.  Must be copied.
+ * @param[in] uctx	passed to #fr_state_tree_backend_set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The state is kept in memory.
+ */
+typedef int (*fr_state_backend_store_t)(fr_state_spill_t const *spill, void *uctx);
+
+/** Retrieve, and remove, session state from an external store
+ *
+ * @param[in,out] spill	key and key_len identify the session.  pairs should be
+ *			populated with pairs allocated in ctx, and the remaining
+ *			fields set from what was stored.
+ * @param[in] uctx	passed to #fr_state_tree_backend_set.
+ * @return
+ *	- 1 if no state was found.
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+typedef int (*fr_state_backend_fetch_t)(fr_state_spill_t *spill, void *uctx);
+
+/** Remove session state from an external store
+ *
+ * Called when a session ends, or when a stored copy has become stale.
+ *
+ * @param[in] spill	key and key_len identify the session.  The other
+ *			fields aren't used.
+ * @param[in] uctx	passed to #fr_state_tree_backend_set.
+ * @return
+ *	- 0 on success, or if no state was found.
+ *	- -1 on failure.
+ */
+typedef int (*fr_state_backend_discard_t)(fr_state_spill_t const *spill, void *uctx);
+
+/** Somewhere to put the state of sessions which haven't been active recently
+ *
+ * Callbacks may be called from multiple threads at once, and must block
+ * until they're complete.
+ */
+typedef struct {
+	char const			*name;		//!< Of the backend, for debug messages.
+	fr_state_backend_store_t	store;		//!< Write session state out.
+	fr_state_backend_fetch_t	fetch;		//!< Read session state back in.
+	fr_state_backend_discard_t	discard;	//!< Remove session state.
+} fr_state_backend_t;
+
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
 				    uint32_t max_sessions, fr_time_delta_t timeout,
 				    uint8_t server_id, uint32_t context_id);
 
+void	fr_state_tree_backend_set(fr_state_tree_t *state, fr_state_backend_t const *backend, void *uctx);
+
+int	fr_state_tree_account_set(fr_state_tree_t *state, char const *name, size_t max_memory);
+
+ssize_t	fr_state_spill_encode(fr_dbuff_t *dbuff, fr_state_spill_t const *spill, fr_dict_attr_t const *root) CC_HINT(nonnull);
+ssize_t	fr_state_spill_decode(fr_state_spill_t *spill, fr_dbuff_t *dbuff, fr_dict_attr_t const *root) CC_HINT(nonnull);
+
 void	fr_state_discard(fr_state_tree_t *state, request_t *request);
 
 int	fr_state_to_request(fr_state_tree_t *state, request_t *request);
@@ -54,6 +129,8 @@ void	fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
 uint64_t fr_state_entries_created(fr_state_tree_t *state);
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state);
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state);
+uint64_t fr_state_entries_spilled(fr_state_tree_t *state);
+uint64_t fr_state_entries_evicted(fr_state_tree_t *state);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,346 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for spilling session state to an external store
+ *
+ * @file src/lib/server/state_tests.c
+ * @copyright 2026 Network RADIUS SAS (legal@networkradius.com)
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <freeradius-devel/io/listen.h>
+
+#include <freeradius-devel/server/pair.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/server/state.h>
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("state_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+/** A backend which holds a single session, and counts calls
+ *
+ */
+typedef struct {
+	TALLOC_CTX		*ctx;			//!< Holds the stored copy.
+	uint8_t			*key;			//!< NULL if nothing is stored.
+	size_t			key_len;
+	fr_pair_list_t		pairs;
+	uint64_t		seq_start;
+	int			tries;
+	fr_time_t		expires;
+
+	int			stores;
+	int			fetches;
+	int			discards;
+
+	bool			fail;			//!< Fail stores.
+	fr_state_tree_t		*tree;			//!< Take the session whilst it's being stored.
+	request_t		*thief;			//!< Request to take it with.
+} test_backend_t;
+
+static int test_store(fr_state_spill_t const *spill, void *uctx)
+{
+	test_backend_t *tb = uctx;
+
+	tb->stores++;
+
+	if (tb->fail) return -1;
+
+	/*
+	 *	Should be findable until we return.
+	 */
+	if (tb->thief) {
+		TEST_CHECK(fr_state_to_request(tb->tree, tb->thief) == 0);
+		TEST_MSG("Expected entry being stored to still be in memory");
+	}
+
+	TALLOC_FREE(tb->ctx);
+	tb->ctx = talloc_new(NULL);
+	tb->key = talloc_memdup(tb->ctx, spill->key, spill->key_len);
+	tb->key_len = spill->key_len;
+	fr_pair_list_init(&tb->pairs);
+	if (fr_pair_list_copy(tb->ctx, &tb->pairs, spill->pairs) < 0) return -1;
+	tb->seq_start = spill->seq_start;
+	tb->tries = spill->tries;
+	tb->expires = spill->expires;
+
+	return 0;
+}
+
+static bool test_match(test_backend_t *tb, fr_state_spill_t const *spill)
+{
+	return tb->key && (tb->key_len == spill->key_len) && (memcmp(tb->key, spill->key, spill->key_len) == 0);
+}
+
+static int test_fetch(fr_state_spill_t *spill, void *uctx)
+{
+	test_backend_t *tb = uctx;
+
+	tb->fetches++;
+
+	if (!test_match(tb, spill)) return 1;
+
+	if (fr_pair_list_copy(spill->ctx, spill->pairs, &tb->pairs) < 0) return -1;
+	spill->seq_start = tb->seq_start;
+	spill->tries = tb->tries;
+	spill->expires = tb->expires;
+
+	TALLOC_FREE(tb->ctx);
+	tb->key = NULL;
+
+	return 0;
+}
+
+static int test_discard(fr_state_spill_t const *spill, void *uctx)
+{
+	test_backend_t *tb = uctx;
+
+	tb->discards++;
+
+	if (!test_match(tb, spill)) return 0;
+
+	TALLOC_FREE(tb->ctx);
+	tb->key = NULL;
+
+	return 0;
+}
+
+static fr_state_backend_t const test_backend_funcs = {
+	.name = "test",
+	.store = test_store,
+	.fetch = test_fetch,
+	.discard = test_discard
+};
+
+static request_t *request_fake_alloc(void)
+{
+	request_t	*request;
+
+	request = request_local_alloc_external(autofree, NULL);
+
+	request->packet = fr_packet_alloc(request, false);
+	TEST_CHECK(request->packet != NULL);
+
+	request->reply = fr_packet_alloc(request, false);
+	TEST_CHECK(request->reply != NULL);
+
+	request->async = talloc_zero(request, fr_async_t);
+	TEST_CHECK(request->async != NULL);
+
+	return request;
+}
+
+/** Allocate a state tree which spills every entry but the newest
+ *
+ * The memory budget is tiny, so each insertion evicts the older entries,
+ * which spills them to the backend.
+ */
+static fr_state_tree_t *test_tree_alloc(test_backend_t *tb)
+{
+	fr_state_tree_t *tree;
+
+	tree = fr_state_tree_init(autofree, fr_dict_attr_test_octets, false, 100,
+				  fr_time_delta_from_sec(60), 0, 0);
+	TEST_CHECK(tree != NULL);
+
+	TEST_CHECK(fr_state_tree_account_set(tree, "state_tests", 1) == 0);
+	fr_state_tree_backend_set(tree, &test_backend_funcs, tb);
+	tb->tree = tree;
+
+	return tree;
+}
+
+/** Start a session, returning the request which holds the State value sent to the client
+ *
+ */
+static request_t *test_session_start(fr_state_tree_t *tree, uint32_t value)
+{
+	request_t	*request = request_fake_alloc();
+	fr_pair_t	*vp;
+
+	TEST_CHECK(pair_append_session_state(&vp, fr_dict_attr_test_uint32) == 0);
+	vp->vp_uint32 = value;
+
+	TEST_CHECK(fr_request_to_state(tree, request) == 0);
+	TEST_CHECK(fr_pair_find_by_da(&request->reply_pairs, NULL, fr_dict_attr_test_octets) != NULL);
+
+	return request;
+}
+
+/** Allocate a request which continues a session
+ *
+ */
+static request_t *test_session_continue(request_t *first)
+{
+	request_t	*request = request_fake_alloc();
+	fr_pair_t	*state, *vp;
+
+	state = fr_pair_find_by_da(&first->reply_pairs, NULL, fr_dict_attr_test_octets);
+	TEST_CHECK(state != NULL);
+
+	MEM(vp = fr_pair_copy(request->request_ctx, state));
+	fr_pair_append(&request->request_pairs, vp);
+
+	return request;
+}
+
+static void test_spill_and_restore(void)
+{
+	test_backend_t		tb = { 0 };
+	fr_state_tree_t		*tree = test_tree_alloc(&tb);
+	request_t		*a, *b, *next;
+	fr_pair_t		*vp;
+
+	TEST_CASE("Older session is spilled when a newer one is inserted");
+	a = test_session_start(tree, 1);
+	b = test_session_start(tree, 2);
+	TEST_CHECK_RET(tb.stores, 1);
+	TEST_CHECK(tb.key != NULL);
+	TEST_CHECK_RET((int)fr_state_entries_spilled(tree), 1);
+
+	TEST_CASE("Spilled session is fetched back from the backend");
+	next = test_session_continue(a);
+	TEST_CHECK_RET(fr_state_to_request(tree, next), 0);
+	TEST_CHECK_RET(tb.fetches, 1);
+	TEST_CHECK(tb.key == NULL);
+
+	vp = fr_pair_find_by_da(&next->session_state_pairs, NULL, fr_dict_attr_test_uint32);
+	TEST_CHECK(vp != NULL);
+	if (vp) TEST_CHECK_RET(vp->vp_uint32, 1);
+
+	talloc_free(next);
+	talloc_free(b);
+	talloc_free(a);
+	talloc_free(tree);
+}
+
+static void test_spill_discard(void)
+{
+	test_backend_t		tb = { 0 };
+	fr_state_tree_t		*tree = test_tree_alloc(&tb);
+	request_t		*a, *b, *next;
+
+	a = test_session_start(tree, 1);
+	b = test_session_start(tree, 2);
+	TEST_CHECK(tb.key != NULL);
+
+	TEST_CASE("Discarding a spilled session removes it from the backend");
+	next = test_session_continue(a);
+	fr_state_discard(tree, next);
+	TEST_CHECK_RET(tb.discards, 1);
+	TEST_CHECK(tb.key == NULL);
+
+	TEST_CASE("Discarded session can't be restored");
+	TEST_CHECK_RET(fr_state_to_request(tree, next), 2);
+
+	talloc_free(next);
+	talloc_free(b);
+	talloc_free(a);
+	talloc_free(tree);
+}
+
+static void test_spill_in_use(void)
+{
+	test_backend_t		tb = { 0 };
+	fr_state_tree_t		*tree = test_tree_alloc(&tb);
+	request_t		*a, *b;
+	fr_pair_t		*vp;
+
+	a = test_session_start(tree, 1);
+	tb.thief = test_session_continue(a);
+
+	TEST_CASE("Session taken whilst being spilled is restored from memory");
+	b = test_session_start(tree, 2);
+	TEST_CHECK_RET(tb.stores, 1);
+	TEST_CHECK_RET(tb.fetches, 0);
+
+	vp = fr_pair_find_by_da(&tb.thief->session_state_pairs, NULL, fr_dict_attr_test_uint32);
+	TEST_CHECK(vp != NULL);
+	if (vp) TEST_CHECK_RET(vp->vp_uint32, 1);
+
+	TEST_CASE("Stale copy is removed from the backend");
+	TEST_CHECK_RET(tb.discards, 1);
+	TEST_CHECK(tb.key == NULL);
+	TEST_CHECK_RET((int)fr_state_entries_spilled(tree), 0);
+
+	talloc_free(tb.thief);
+	talloc_free(b);
+	talloc_free(a);
+	talloc_free(tree);
+}
+
+static void test_spill_fail(void)
+{
+	test_backend_t		tb = { .fail = true };
+	fr_state_tree_t		*tree = test_tree_alloc(&tb);
+	request_t		*a, *b, *next;
+
+	a = test_session_start(tree, 1);
+
+	TEST_CASE("Session which can't be spilled stays in memory");
+	b = test_session_start(tree, 2);
+	TEST_CHECK_RET(tb.stores, 1);
+	TEST_CHECK_RET((int)fr_state_entries_spilled(tree), 0);
+
+	next = test_session_continue(a);
+	TEST_CHECK_RET(fr_state_to_request(tree, next), 0);
+	TEST_CHECK_RET(tb.fetches, 0);
+
+	talloc_free(next);
+	talloc_free(b);
+	talloc_free(a);
+	talloc_free(tree);
+}
+
+TEST_LIST = {
+	{ "spill_and_restore",	test_spill_and_restore },
+	{ "spill_discard",	test_spill_discard },
+	{ "spill_in_use",	test_spill_in_use },
+	{ "spill_fail",		test_spill_fail },
+
+	{ NULL }
+};
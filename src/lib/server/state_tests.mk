@@ -0,0 +1,8 @@
+TARGET      	:= state_tests$(E)
+SOURCES     	:= state_tests.c
+
+TGT_LDLIBS  	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS 	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS 	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L)
+
+TGT_INSTALLDIR	:=
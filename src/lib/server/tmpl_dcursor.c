@@ -100,7 +100,7 @@ void _tmpl_cursor_pair_init(TALLOC_CTX *list_ctx, fr_pair_list_t *list, tmpl_att
 	 *	Iterates over attributes of a specific type
 	 */
 	if (ar_is_normal(ar)) {
-		fr_pair_dcursor_iter_init(&ns->cursor, list, _tmpl_cursor_child_next, ns);
+		fr_pair_dcursor_iter_by_da_init(&ns->cursor, list, _tmpl_cursor_child_next, ns, ar->ar_da);
 	/*
 	 *	Iterates over all attributes at this level
 	 */
@@ -388,6 +388,7 @@ fr_pair_t *tmpl_dcursor_init_relative(int *err, TALLOC_CTX *ctx, tmpl_dcursor_ct
 				      tmpl_dcursor_build_t build, void *uctx)
 {
 	fr_pair_t		*vp = NULL;
+	tmpl_attr_t const	*ar = NULL;
 
 	TMPL_VERIFY(vpt);
 
@@ -409,7 +410,8 @@ fr_pair_t *tmpl_dcursor_init_relative(int *err, TALLOC_CTX *ctx, tmpl_dcursor_ct
 	 */
 	switch (vpt->type) {
 	case TMPL_TYPE_ATTR:
-		_tmpl_cursor_pair_init(list, cc->list, tmpl_attr_list_head(&vpt->data.attribute.ar), cc);
+		ar = tmpl_attr_list_head(&vpt->data.attribute.ar);
+		_tmpl_cursor_pair_init(list, cc->list, ar, cc);
 		break;
 
 	default:
@@ -419,9 +421,15 @@ fr_pair_t *tmpl_dcursor_init_relative(int *err, TALLOC_CTX *ctx, tmpl_dcursor_ct
 
 	/*
 	 *	Get the first entry from the tmpl
+	 *
+	 *	_tmpl_cursor_next only looks at the list through
+	 *	the nested cursors, so if the first reference is
+	 *	for a specific attribute, that's all that needs to
+	 *	be decoded from the list.
 	 */
 #ifndef TMPL_DCURSOR_MOD
-	vp = fr_pair_dcursor_iter_init(cursor, cc->list, _tmpl_cursor_next, cc);
+	vp = fr_pair_dcursor_iter_by_da_init(cursor, cc->list, _tmpl_cursor_next, cc,
+					     (ar && ar_is_normal(ar)) ? ar->ar_da : NULL);
 #else
 	vp = fr_dcursor_iter_mod_init(cursor, fr_pair_list_to_dlist(cc->list), _tmpl_cursor_next, NULL, cc, tmpl_dcursor_insert, tmpl_dcursor_remove, cc);
 #endif
@@ -873,6 +873,51 @@ done:
 }
 
 
+/** Find the first pair for a simple attribute reference, without building a cursor
+ *
+ * Handles references where every component is a normal attribute, with
+ * no filter or an index of 0.  Each component is then the first pair with
+ * that da in its parent.  #fr_pair_find_by_da uses the index of lists
+ * which have one, so repeated lookups of the same reference are O(1).
+ *
+ * @param[out] out	the pair found, or NULL if there isn't one.
+ * @param[in] request	to search, after following the request references.
+ * @param[in] vpt	attribute reference.
+ * @return
+ *	- true if the reference was resolved, *out is authoritative.
+ *	- false if the full cursor is needed.
+ */
+static inline CC_HINT(always_inline) bool tmpl_find_vp_simple(fr_pair_t **out, request_t *request, tmpl_t const *vpt)
+{
+	tmpl_attr_t const	*ar = NULL;
+	fr_pair_t		*parent = request->pair_root;
+	fr_pair_t		*vp = NULL;
+
+	while ((ar = tmpl_attr_list_next(tmpl_attr(vpt), ar))) {
+		if (!ar_is_normal(ar) || !fr_type_is_structural(parent->vp_type)) return false;
+
+		if (!ar_filter_is_none(ar) && !(ar_filter_is_num(ar) && (ar->ar_num == 0))) return false;
+
+		vp = fr_pair_find_by_da(&parent->vp_group, NULL, ar->ar_da);
+		if (!vp) {
+			/*
+			 *	A later instance of the parent may
+			 *	contain a match.  The cursor checks
+			 *	all of them.
+			 */
+			if ((parent != request->pair_root) &&
+			    fr_pair_find_by_da(fr_pair_parent_list(parent), parent, parent->da)) return false;
+
+			*out = NULL;
+			return true;
+		}
+		parent = vp;
+	}
+
+	*out = vp;
+	return true;
+}
+
 /** Returns the first VP matching a #tmpl_t
  *
  * @param[out] out where to write the retrieved vp.
@@ -895,6 +940,27 @@ int tmpl_find_vp(fr_pair_t **out, request_t *request, tmpl_t const *vpt)
 
 	TMPL_VERIFY(vpt);
 
+	if (tmpl_is_attr(vpt)) {
+		request_t *ref = request;
+
+		if (tmpl_request_ptr(&ref, tmpl_request(vpt)) < 0) {
+			if (out) *out = NULL;
+			return -3;
+		}
+
+		if (tmpl_find_vp_simple(&vp, ref, vpt)) {
+			if (out) *out = vp;
+			if (vp) return 0;
+
+			if (tmpl_is_list(vpt)) {
+				fr_strerror_printf("List \"%s\" is empty", vpt->name);
+			} else {
+				fr_strerror_printf("No matching \"%s\" pairs found", tmpl_attr_tail_da(vpt)->name);
+			}
+			return -1;
+		}
+	}
+
 	vp = tmpl_dcursor_init(&err, request, &cc, &cursor, request, vpt);
 	tmpl_dcursor_clear(&cc);
 
@@ -0,0 +1,534 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/trace.c
+ * @brief Trace requests, and export the spans to an OpenTelemetry collector.
+ *
+ * A sampled request gets a root span when the worker starts it.  Each
+ * processing section, policy and module call it runs is a child of
+ * the span which was current when it started, as are the requests it
+ * sends through connection trunks, and any subrequests.
+ *
+ * Finished spans are pushed onto a queue, and a dedicated thread
+ * sends them to the collector in batches, as OTLP/HTTP with JSON
+ * encoding.  If the queue is full, spans are dropped, rather than
+ * slowing the workers down.
+ *
+ * Spans are allocated with malloc(), as they're freed by the export
+ * thread, and talloc isn't thread safe.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/trace.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/sbuff.h>
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <poll.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/*
+ *	Span kinds, from the OpenTelemetry specification.
+ */
+#define TRACE_KIND_INTERNAL	(1)
+#define TRACE_KIND_SERVER	(2)
+#define TRACE_KIND_CLIENT	(3)
+
+struct fr_trace_span_s {
+	uint8_t			trace_id[16];
+	uint8_t			span_id[8];
+	uint8_t			parent_id[8];		//!< All zeros for root spans.
+
+	fr_trace_span_t		*parent;		//!< Made current again when this span ends.
+	request_t		*request;		//!< Set if this span is the request's current span.
+
+	fr_time_t		start;
+	fr_time_t		end;
+	uint64_t		number;			//!< Of the request which created the span.
+	int			kind;
+	bool			error;
+	char			name[64];
+};
+
+/** Sample requests if fr_rand() is less than this
+ *
+ * 0 disables tracing, and UINT32_MAX traces every request.
+ */
+uint32_t			fr_trace_threshold;
+
+static fr_atomic_queue_t	*trace_queue;
+static pthread_t		trace_pthread_id;
+static bool			trace_started;
+static atomic_bool		trace_stop;
+
+static atomic_uint_fast64_t	trace_exported;
+static atomic_uint_fast64_t	trace_dropped;
+static atomic_uint_fast64_t	trace_failed;
+
+static fr_ipaddr_t		trace_ipaddr;
+static uint16_t			trace_port;
+static char const		*trace_path;
+static char const		*trace_service_name;
+static uint32_t			trace_batch_size;
+static fr_time_delta_t		trace_flush_interval;
+
+static fr_sbuff_escape_rules_t const trace_json_escape = {
+	.name = "json",
+	.chr = '\\',
+	.subs = {
+		['\\'] = '\\',
+		['"'] = '"',
+		['\b'] = 'b',
+		['\f'] = 'f',
+		['\n'] = 'n',
+		['\r'] = 'r',
+		['\t'] = 't'
+	}
+};
+
+static bool trace_id_is_zero(uint8_t const *id, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) if (id[i]) return false;
+
+	return true;
+}
+
+static void trace_id_fill(uint8_t *id, size_t len)
+{
+	size_t i;
+
+	do {
+		for (i = 0; i < len; i += sizeof(uint32_t)) {
+			uint32_t r = fr_rand();
+
+			memcpy(id + i, &r, sizeof(r));
+		}
+	} while (trace_id_is_zero(id, len));	/* All zeros is invalid */
+}
+
+static fr_trace_span_t *trace_span_alloc(fr_trace_span_t const *parent, char const *name, int kind, fr_time_t start)
+{
+	fr_trace_span_t *span;
+
+	span = calloc(1, sizeof(*span));
+	if (!span) return NULL;
+
+	if (parent) {
+		memcpy(span->trace_id, parent->trace_id, sizeof(span->trace_id));
+		memcpy(span->parent_id, parent->span_id, sizeof(span->parent_id));
+	} else {
+		trace_id_fill(span->trace_id, sizeof(span->trace_id));
+	}
+	trace_id_fill(span->span_id, sizeof(span->span_id));
+
+	span->start = start;
+	span->kind = kind;
+	strlcpy(span->name, name, sizeof(span->name));
+
+	return span;
+}
+
+/** Start tracing a request which has been sampled
+ *
+ * Use fr_trace_request_start(), which does the sampling.
+ */
+void _fr_trace_request_start(request_t *request, char const *name, fr_time_t start)
+{
+	fr_trace_span_t *span;
+
+	if (request->trace) return;
+
+	span = trace_span_alloc(NULL, name, TRACE_KIND_SERVER, start);
+	if (!span) return;
+
+	span->number = request->number;
+	span->request = request;
+	request->trace = span;
+}
+
+/** Trace a subrequest, if its parent is being traced
+ *
+ * @param[in] child	the subrequest.
+ * @param[in] parent	which created it.
+ * @param[in] name	of the child's root span.
+ */
+void fr_trace_child_start(request_t *child, request_t const *parent, char const *name)
+{
+	fr_trace_span_t *span;
+
+	if (!parent->trace || child->trace) return;
+
+	span = trace_span_alloc(parent->trace, name, TRACE_KIND_INTERNAL, fr_time());
+	if (!span) return;
+
+	span->number = child->number;
+	span->request = child;
+	child->trace = span;
+}
+
+/** End all of the spans a request has open
+ *
+ * Called when the request is freed.
+ */
+void fr_trace_request_end(request_t *request)
+{
+	while (request->trace) fr_trace_span_end(request->trace, (request->rcode == RLM_MODULE_FAIL));
+}
+
+/** Start a span for a traced request
+ *
+ * @param[in] request	being traced.
+ * @param[in] name	of the span.
+ * @param[in] current	if true, the span becomes the request's current span,
+ *			and spans started before it ends are its children.
+ *			Current spans must be ended in the reverse order to
+ *			which they were started.  If false, the span is for
+ *			work done outside of the request, e.g. a query to a
+ *			database, and may be ended at any time.
+ * @return
+ *	- The new span.
+ *	- NULL if the request isn't being traced.
+ */
+fr_trace_span_t *fr_trace_span_start(request_t *request, char const *name, bool current)
+{
+	fr_trace_span_t *span;
+
+	if (!request->trace) return NULL;
+
+	span = trace_span_alloc(request->trace, name, current ? TRACE_KIND_INTERNAL : TRACE_KIND_CLIENT, fr_time());
+	if (!span) return NULL;
+
+	span->number = request->number;
+
+	if (current) {
+		span->parent = request->trace;
+		span->request = request;
+		request->trace = span;
+	}
+
+	return span;
+}
+
+/** End a span, and queue it for export
+ *
+ * @param[in] span	to end.  Must not be used afterwards.
+ * @param[in] error	whether the work the span represents failed.
+ */
+void fr_trace_span_end(fr_trace_span_t *span, bool error)
+{
+	span->end = fr_time();
+	span->error = error;
+
+	if (span->request) {
+		fr_assert(span->request->trace == span);
+		span->request->trace = span->parent;
+		span->request = NULL;
+	}
+	span->parent = NULL;
+
+	if (!trace_queue || !fr_atomic_queue_push(trace_queue, span)) {
+		atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+		free(span);
+	}
+}
+
+/** Return the number of spans exported, dropped, and which failed to export
+ *
+ */
+void fr_trace_stats(uint64_t *exported, uint64_t *dropped, uint64_t *failed)
+{
+	*exported = atomic_load_explicit(&trace_exported, memory_order_relaxed);
+	*dropped = atomic_load_explicit(&trace_dropped, memory_order_relaxed);
+	*failed = atomic_load_explicit(&trace_failed, memory_order_relaxed);
+}
+
+static void trace_hex(fr_sbuff_t *out, uint8_t const *id, size_t len)
+{
+	static char const hex[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		(void) fr_sbuff_in_char(out, hex[id[i] >> 4], hex[id[i] & 0x0f]);
+	}
+}
+
+static void trace_span_json(fr_sbuff_t *out, fr_trace_span_t const *span)
+{
+	(void) fr_sbuff_in_strcpy(out, "{\"traceId\":\"");
+	trace_hex(out, span->trace_id, sizeof(span->trace_id));
+	(void) fr_sbuff_in_strcpy(out, "\",\"spanId\":\"");
+	trace_hex(out, span->span_id, sizeof(span->span_id));
+	(void) fr_sbuff_in_strcpy(out, "\"");
+
+	if (!trace_id_is_zero(span->parent_id, sizeof(span->parent_id))) {
+		(void) fr_sbuff_in_strcpy(out, ",\"parentSpanId\":\"");
+		trace_hex(out, span->parent_id, sizeof(span->parent_id));
+		(void) fr_sbuff_in_strcpy(out, "\"");
+	}
+
+	(void) fr_sbuff_in_strcpy(out, ",\"name\":\"");
+	(void) fr_sbuff_in_escape(out, span->name, strlen(span->name), &trace_json_escape);
+
+	/*
+	 *	64-bit integers are strings in the JSON encoding.
+	 */
+	(void) fr_sbuff_in_sprintf(out, "\",\"kind\":%d,\"startTimeUnixNano\":\"%" PRIu64 "\""
+				   ",\"endTimeUnixNano\":\"%" PRIu64 "\""
+				   ",\"attributes\":[{\"key\":\"freeradius.request.number\""
+				   ",\"value\":{\"intValue\":\"%" PRIu64 "\"}}]"
+				   ",\"status\":{\"code\":%d}}",
+				   span->kind,
+				   fr_unix_time_unwrap(fr_time_to_unix_time(span->start)),
+				   fr_unix_time_unwrap(fr_time_to_unix_time(span->end)),
+				   span->number,
+				   span->error ? 2 : 0);
+}
+
+static int trace_write(int fd, char const *buffer, size_t len)
+{
+	while (len > 0) {
+		ssize_t slen;
+
+		slen = write(fd, buffer, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		buffer += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/** POST a batch of spans to the collector
+ *
+ */
+static int trace_post(TALLOC_CTX *ctx, char const *body)
+{
+	int		fd;
+	char		*hdr;
+	char		buffer[64];
+	ssize_t		slen;
+	size_t		len = strlen(body);
+	struct timeval	tv = { .tv_sec = 5 };
+
+	fd = fr_socket_client_tcp(NULL, NULL, &trace_ipaddr, trace_port, false);
+	if (fd < 0) return -1;
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	hdr = talloc_typed_asprintf(ctx, "POST %s HTTP/1.1\r\n"
+				    "Host: %pV:%u\r\n"
+				    "Content-Type: application/json\r\n"
+				    "Content-Length: %zu\r\n"
+				    "Connection: close\r\n"
+				    "\r\n", trace_path, fr_box_ipaddr(trace_ipaddr), trace_port, len);
+
+	if ((trace_write(fd, hdr, strlen(hdr)) < 0) || (trace_write(fd, body, len) < 0)) {
+		fr_strerror_printf("Failed writing to collector: %s", fr_syserror(errno));
+	error:
+		close(fd);
+		return -1;
+	}
+
+	/*
+	 *	We only care about the status code.
+	 */
+	slen = read(fd, buffer, sizeof(buffer) - 1);
+	if (slen <= 0) {
+		fr_strerror_const("No response from collector");
+		goto error;
+	}
+	buffer[slen] = '\0';
+
+	if ((strncmp(buffer, "HTTP/1.", 7) != 0) || (slen < 12) || (buffer[9] != '2')) {
+		fr_strerror_printf("Collector returned \"%.12s\"", buffer);
+		goto error;
+	}
+
+	close(fd);
+	return 0;
+}
+
+/** Export a batch of spans, and free them
+ *
+ */
+static void trace_export(fr_trace_span_t **spans, size_t num)
+{
+	TALLOC_CTX		*ctx;
+	fr_sbuff_t		sbuff;
+	fr_sbuff_uctx_talloc_t	tctx;
+	size_t			i;
+
+	ctx = talloc_init_const("trace");
+	if (!ctx || !fr_sbuff_init_talloc(ctx, &sbuff, &tctx, 512 * num, SIZE_MAX)) {
+		atomic_fetch_add_explicit(&trace_failed, num, memory_order_relaxed);
+		goto done;
+	}
+
+	(void) fr_sbuff_in_strcpy(&sbuff, "{\"resourceSpans\":[{\"resource\":{\"attributes\":"
+				  "[{\"key\":\"service.name\",\"value\":{\"stringValue\":\"");
+	(void) fr_sbuff_in_escape(&sbuff, trace_service_name, strlen(trace_service_name), &trace_json_escape);
+	(void) fr_sbuff_in_strcpy(&sbuff, "\"}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"freeradius\"},\"spans\":[");
+
+	for (i = 0; i < num; i++) {
+		if (i > 0) (void) fr_sbuff_in_char(&sbuff, ',');
+		trace_span_json(&sbuff, spans[i]);
+	}
+	(void) fr_sbuff_in_strcpy(&sbuff, "]}]}]}");
+
+	if (trace_post(ctx, fr_sbuff_buff(&sbuff)) < 0) {
+		RATE_LIMIT_GLOBAL(PERROR, "Failed exporting spans");
+		atomic_fetch_add_explicit(&trace_failed, num, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&trace_exported, num, memory_order_relaxed);
+	}
+
+done:
+	talloc_free(ctx);
+	for (i = 0; i < num; i++) free(spans[i]);
+}
+
+static void *trace_thread(UNUSED void *arg)
+{
+	sigset_t		sigset;
+	fr_trace_span_t		**batch;
+	size_t			num = 0;
+	fr_time_t		flush = fr_time_wrap(0);
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	batch = calloc(trace_batch_size, sizeof(*batch));
+	if (!batch) return NULL;
+
+	for (;;) {
+		bool	stop = atomic_load(&trace_stop);
+		size_t	popped;
+
+		popped = fr_atomic_queue_pop_n(trace_queue, (void **) (batch + num), trace_batch_size - num);
+		if (popped && !num) flush = fr_time_add(fr_time(), trace_flush_interval);
+		num += popped;
+
+		/*
+		 *	Send full batches immediately, and partial
+		 *	ones when they've waited long enough, or
+		 *	we're exiting.
+		 */
+		if ((num == trace_batch_size) ||
+		    (num && (stop || fr_time_gteq(fr_time(), flush)))) {
+			trace_export(batch, num);
+			num = 0;
+			continue;
+		}
+
+		if (stop) break;
+
+		if (!popped) (void) poll(NULL, 0, 10);
+	}
+
+	free(batch);
+
+	return NULL;
+}
+
+/** Start the span export thread, if tracing has been configured
+ *
+ * Must be called before the workers are started.
+ *
+ * @param[in] config	Main server configuration.
+ * @return
+ *	- 0 on success, or if no collector was configured.
+ *	- -1 on failure.
+ */
+int fr_trace_start(main_config_t const *config)
+{
+	if (!config->trace_port || (config->trace_sample_rate <= 0)) return 0;
+
+	trace_ipaddr = config->trace_ipaddr;
+	trace_port = config->trace_port;
+	trace_path = config->trace_path;
+	trace_service_name = config->trace_service_name;
+	trace_batch_size = config->trace_batch_size ? config->trace_batch_size : 1;
+	trace_flush_interval = config->trace_flush_interval;
+
+	trace_queue = fr_atomic_queue_alloc(NULL, config->trace_queue_size);
+	if (!trace_queue) {
+		PERROR("Failed allocating trace queue");
+		return -1;
+	}
+
+	atomic_store(&trace_stop, false);
+	if (fr_schedule_pthread_create(&trace_pthread_id, trace_thread, NULL) < 0) {
+		PERROR("Failed starting trace thread");
+		fr_atomic_queue_free(&trace_queue);
+		return -1;
+	}
+	trace_started = true;
+
+	if (config->trace_sample_rate >= 1) {
+		fr_trace_threshold = UINT32_MAX;
+	} else {
+		fr_trace_threshold = config->trace_sample_rate * UINT32_MAX;
+		if (!fr_trace_threshold) fr_trace_threshold = 1;
+	}
+
+	INFO("Exporting traces to %pV port %u, sampling %g%% of requests",
+	     fr_box_ipaddr(trace_ipaddr), trace_port,
+	     (config->trace_sample_rate >= 1) ? 100 : config->trace_sample_rate * 100);
+
+	return 0;
+}
+
+/** Stop the span export thread
+ *
+ * Must be called after the workers have exited.  Any spans which
+ * are still queued are exported first.
+ */
+void fr_trace_stop(void)
+{
+	void *span;
+
+	fr_trace_threshold = 0;
+
+	if (!trace_started) return;
+
+	atomic_store(&trace_stop, true);
+	(void) pthread_join(trace_pthread_id, NULL);
+	trace_started = false;
+
+	while (fr_atomic_queue_pop(trace_queue, &span)) free(span);
+	fr_atomic_queue_free(&trace_queue);
+}
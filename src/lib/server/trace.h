@@ -0,0 +1,73 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/trace.h
+ * @brief Trace requests, and export the spans to an OpenTelemetry collector.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(trace_h, "$Id$")
+
+#include <freeradius-devel/server/main_config.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/rand.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uint32_t		fr_trace_threshold;
+
+void	_fr_trace_request_start(request_t *request, char const *name, fr_time_t start) CC_HINT(nonnull);
+
+/** Decide whether to trace a request, and if so, start its root span
+ *
+ * When tracing is disabled, or the request isn't sampled, this costs
+ * one comparison, or one comparison and a call to fr_rand().
+ *
+ * @param[in] request	to trace.
+ * @param[in] name	of the root span, usually the listener.
+ * @param[in] start	when the packet was received.
+ */
+static inline CC_HINT(nonnull) void fr_trace_request_start(request_t *request, char const *name, fr_time_t start)
+{
+	if (likely(!fr_trace_threshold)) return;
+	if ((fr_trace_threshold != UINT32_MAX) && (fr_rand() >= fr_trace_threshold)) return;
+
+	_fr_trace_request_start(request, name, start);
+}
+
+void		fr_trace_child_start(request_t *child, request_t const *parent, char const *name) CC_HINT(nonnull);
+
+void		fr_trace_request_end(request_t *request) CC_HINT(nonnull);
+
+fr_trace_span_t	*fr_trace_span_start(request_t *request, char const *name, bool current) CC_HINT(nonnull);
+
+void		fr_trace_span_end(fr_trace_span_t *span, bool error) CC_HINT(nonnull);
+
+void		fr_trace_stats(uint64_t *exported, uint64_t *dropped, uint64_t *failed) CC_HINT(nonnull);
+
+int		fr_trace_start(main_config_t const *config) CC_HINT(nonnull);
+
+void		fr_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
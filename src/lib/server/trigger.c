@@ -42,6 +42,12 @@ RCSID("$Id$")
 
 #include <sys/wait.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /** Whether triggers are enabled globally
  *
  */
@@ -50,6 +56,10 @@ static CONF_SECTION const	*trigger_exec_main, *trigger_exec_subcs;
 static fr_rb_tree_t		*trigger_last_fired_tree;
 static pthread_mutex_t		*trigger_mutex;
 
+static fr_time_delta_t		trigger_window;		//!< Rate limited triggers fire at most once per window.
+static uint32_t			trigger_max_running;	//!< Maximum number of triggers running at once.
+static _Atomic(uint32_t)	trigger_running;	//!< Number of triggers currently running.
+
 #define REQUEST_INDEX_TRIGGER_NAME	1
 #define REQUEST_INDEX_TRIGGER_ARGS	2
 
@@ -60,6 +70,7 @@ typedef struct {
 	fr_rb_node_t	node;		//!< Entry in the trigger last fired tree.
 	CONF_ITEM	*ci;		//!< Config item this rate limit counter is associated with.
 	fr_time_t	last_fired;	//!< When this trigger last fired.
+	uint32_t	suppressed;	//!< Times the trigger was suppressed since it last fired.
 } trigger_last_fired_t;
 
 xlat_arg_parser_t const trigger_xlat_args[] = {
@@ -144,8 +155,16 @@ typedef struct {
 
 	fr_exec_state_t		exec;		//!< Used for asynchronous execution.
 	fr_time_delta_t		timeout;	//!< How long the trigger has to run.
+	bool			in_process;	//!< Only expand the trigger, don't run a program.
 } fr_trigger_t;
 
+static int _trigger_free(UNUSED fr_trigger_t *trigger)
+{
+	atomic_fetch_sub_explicit(&trigger_running, 1, memory_order_relaxed);
+
+	return 0;
+}
+
 static unlang_action_t trigger_done(rlm_rcode_t *p_result, UNUSED int *priority,
 				    request_t *request, void *rctx)
 {
@@ -166,6 +185,15 @@ static unlang_action_t trigger_resume(rlm_rcode_t *p_result, UNUSED int *priorit
 {
 	fr_trigger_t	*trigger = talloc_get_type_abort(rctx, fr_trigger_t);
 
+	/*
+	 *	The trigger is an xlat call, e.g. to a linelog
+	 *	instance.  Expanding it did all the work.
+	 */
+	if (trigger->in_process) {
+		RDEBUG2("Trigger \"%s\" done", trigger->command);
+		RETURN_MODULE_OK;
+	}
+
 	if (fr_value_box_list_empty(&trigger->args)) {
 		RERROR("Failed trigger \"%s\" - did not expand to anything", trigger->command);
 		RETURN_MODULE_FAIL;
@@ -224,7 +252,9 @@ static unlang_action_t trigger_run(rlm_rcode_t *p_result, UNUSED int *priority,
  *				section.
  * @param[in] name		the path relative to the global trigger section ending in the trigger name
  *				e.g. module.ldap.pool.start.
- * @param[in] rate_limit	whether to rate limit triggers.
+ * @param[in] rate_limit	whether to rate limit triggers.  Rate limited triggers fire at most
+ *				once per window.  The number of times a trigger was suppressed is
+ *				passed to the next one to fire as Trigger-Suppressed.
  * @param[in] args		to make available via the @verbatim %trigger(<arg>) @endverbatim xlat.
  * @return
  *	- 0 on success.
@@ -244,6 +274,9 @@ int trigger_exec(unlang_interpret_t *intp,
 	request_t		*request;
 	fr_trigger_t		*trigger;
 	ssize_t			slen;
+	uint32_t		suppressed = 0;
+	fr_pair_list_t		*local_args = NULL;
+	bool			in_process = false;
 
 	/*
 	 *	noop if trigger_exec_init was never called
@@ -286,13 +319,43 @@ int trigger_exec(unlang_interpret_t *intp,
 		return -1;
 	}
 
-	if (!cf_item_is_pair(ci)) {
+	/*
+	 *	Triggers can be a section, which says how the
+	 *	trigger should be run, as well as what to run.
+	 */
+	if (cf_item_is_section(ci)) {
+		CONF_SECTION	*tcs = cf_item_to_section(ci);
+		CONF_PAIR	*in_process_cp;
+
+		cp = cf_pair_find(tcs, "command");
+		if (!cp) {
+			ERROR("Trigger has no \"command\": %s", name);
+			return -1;
+		}
+
+		in_process_cp = cf_pair_find(tcs, "in_process");
+		if (in_process_cp) {
+			fr_value_box_t	box;
+
+			fr_value_box_init(&box, FR_TYPE_BOOL, NULL, false);
+			if (!cf_pair_value(in_process_cp) ||
+			    (fr_value_box_from_str(NULL, &box, FR_TYPE_BOOL, NULL,
+						   cf_pair_value(in_process_cp), strlen(cf_pair_value(in_process_cp)),
+						   NULL, false) < 0)) {
+				cf_log_err(in_process_cp, "Invalid value for \"in_process\"");
+				return -1;
+			}
+			in_process = box.vb_bool;
+		}
+
+	} else if (!cf_item_is_pair(ci)) {
 		ERROR("Trigger is not a configuration variable: %s", attr);
 		return -1;
-	}
 
-	cp = cf_item_to_pair(ci);
-	if (!cp) return -1;
+	} else {
+		cp = cf_item_to_pair(ci);
+		if (!cp) return -1;
+	}
 
 	value = cf_pair_value(cp);
 	if (!value) {
@@ -308,7 +371,10 @@ int trigger_exec(unlang_interpret_t *intp,
 	if (check_config) return 0;
 
 	/*
-	 *	Perform periodic rate_limiting.
+	 *	Perform periodic rate_limiting, and limit the
+	 *	number of triggers running at once.  Suppressed
+	 *	triggers are counted, and the count is passed to
+	 *	the next one that fires.
 	 */
 	if (rate_limit) {
 		trigger_last_fired_t	find, *found;
@@ -320,24 +386,35 @@ int trigger_exec(unlang_interpret_t *intp,
 
 		found = fr_rb_find(trigger_last_fired_tree, &find);
 		if (!found) {
-			MEM(found = talloc(NULL, trigger_last_fired_t));
+			MEM(found = talloc_zero(NULL, trigger_last_fired_t));
 			found->ci = ci;
 			/*
-			 *	Initialise last_fired to 2 seconds ago so
-			 *	the trigger fires on the first occurrence
+			 *	Initialise last_fired to one window ago
+			 *	so the trigger fires on the first occurrence
 			 */
-			found->last_fired = fr_time_wrap(NSEC * -2);
+			found->last_fired = fr_time_sub(now, trigger_window);
 
 			fr_rb_insert(trigger_last_fired_tree, found);
 		}
 
-		pthread_mutex_unlock(trigger_mutex);
+		if (fr_time_lt(now, fr_time_add(found->last_fired, trigger_window)) ||
+		    (trigger_max_running && (atomic_load_explicit(&trigger_running, memory_order_relaxed) >= trigger_max_running))) {
+			found->suppressed++;
+			pthread_mutex_unlock(trigger_mutex);
+			return -1;
+		}
 
-		/*
-		 *	Send the rate_limited traps at most once per second.
-		 */
-		if (fr_time_to_sec(found->last_fired) == fr_time_to_sec(now)) return -1;
 		found->last_fired = now;
+		suppressed = found->suppressed;
+		found->suppressed = 0;
+
+		pthread_mutex_unlock(trigger_mutex);
+
+	} else if (trigger_max_running &&
+		   (atomic_load_explicit(&trigger_running, memory_order_relaxed) >= trigger_max_running)) {
+		RATE_LIMIT_GLOBAL(WARN, "Not running trigger \"%s\" - %u triggers already running",
+				  name, trigger_max_running);
+		return -1;
 	}
 
 	/*
@@ -350,8 +427,6 @@ int trigger_exec(unlang_interpret_t *intp,
 	 *	trigger_xlat function.
 	 */
 	if (args) {
-		fr_pair_list_t *local_args;
-
 		MEM(local_args = talloc_zero(request, fr_pair_list_t));
 		fr_pair_list_init(local_args);
 		if (fr_pair_list_copy(local_args, local_args, args) < 0) {
@@ -360,11 +435,27 @@ int trigger_exec(unlang_interpret_t *intp,
 			talloc_free(request);
 			return -1;
 		}
+	}
 
-		if (request_data_add(request, &trigger_exec_main, REQUEST_INDEX_TRIGGER_ARGS, local_args,
-				      false, false, false) < 0) goto args_error;
+	if (suppressed > 0) {
+		fr_dict_attr_t const	*da;
+		fr_pair_t		*vp;
+
+		da = fr_dict_attr_child_by_num(fr_dict_root(fr_dict_internal()), FR_TRIGGER_SUPPRESSED);
+		if (da) {
+			if (!local_args) {
+				MEM(local_args = talloc_zero(request, fr_pair_list_t));
+				fr_pair_list_init(local_args);
+			}
+			MEM(vp = fr_pair_afrom_da(local_args, da));
+			vp->vp_uint32 = suppressed;
+			fr_pair_append(local_args, vp);
+		}
 	}
 
+	if (local_args && (request_data_add(request, &trigger_exec_main, REQUEST_INDEX_TRIGGER_ARGS, local_args,
+					    false, false, false) < 0)) goto args_error;
+
 	{
 		void *name_tmp;
 
@@ -382,6 +473,8 @@ int trigger_exec(unlang_interpret_t *intp,
 	trigger->command = talloc_strdup(trigger, value);
 	trigger->timeout = fr_time_delta_from_sec(5);	/* FIXME - Should be configurable? */
 
+	trigger->in_process = in_process;
+
 	slen = xlat_tokenize_argv(trigger, &trigger->xlat,
 				  &FR_SBUFF_IN(trigger->command, talloc_array_length(trigger->command) - 1),
 				  NULL, NULL, NULL, false, false);
@@ -423,6 +516,13 @@ int trigger_exec(unlang_interpret_t *intp,
 	if (unlang_function_push(request, trigger_run, trigger_resume,
 				 NULL, 0, UNLANG_TOP_FRAME, trigger) < 0) goto error;
 
+	/*
+	 *	Counted until the request running the
+	 *	trigger is freed.
+	 */
+	atomic_fetch_add_explicit(&trigger_running, 1, memory_order_relaxed);
+	talloc_set_destructor(trigger, _trigger_free);
+
 	if (!intp) {
 		/*
 		 *	Wait for the exec to finish too,
@@ -512,6 +612,8 @@ static int _trigger_exec_free(UNUSED void *uctx)
 static int _trigger_exec_init(void *cs_arg)
 {
 	CONF_SECTION *cs = talloc_get_type_abort(cs_arg, CONF_SECTION);
+	CONF_SECTION *limit;
+
 	if (!cs) {
 		ERROR("%s - Pointer to main_config was NULL", __FUNCTION__);
 		return -1;
@@ -532,6 +634,21 @@ static int _trigger_exec_init(void *cs_arg)
 	trigger_mutex = talloc(talloc_null_ctx(), pthread_mutex_t);
 	pthread_mutex_init(trigger_mutex, 0);
 	talloc_set_destructor(trigger_mutex, _mutex_free);
+
+	/*
+	 *	Limits on how often triggers run.
+	 */
+	trigger_window = fr_time_delta_from_sec(1);
+	trigger_max_running = 0;
+
+	limit = cf_section_find(trigger_exec_subcs, "limit", NULL);
+	if (limit) {
+		if ((cf_pair_parse(NULL, limit, "window", FR_TYPE_TIME_DELTA,
+				   &trigger_window, "1", T_BARE_WORD) < 0) ||
+		    (cf_pair_parse(NULL, limit, "max_running", FR_TYPE_UINT32,
+				   &trigger_max_running, "0", T_BARE_WORD) < 0)) return -1;
+	}
+
 	triggers_init = true;
 
 	return 0;
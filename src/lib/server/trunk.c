@@ -37,12 +37,16 @@ typedef struct trunk_s trunk_t;
 #include <freeradius-devel/server/trunk.h>
 
 #include <freeradius-devel/server/connection.h>
+#include <freeradius-devel/server/trace.h>
 #include <freeradius-devel/server/trigger.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/minmax_heap.h>
 
+#include <pthread.h>
+
 #ifdef HAVE_STDATOMIC_H
 #  include <stdatomic.h>
 #  ifndef ATOMIC_VAR_INIT
@@ -116,10 +120,24 @@ struct trunk_request_s {
 	bool			bound_to_conn;		//!< Fail the request if there's an attempt to
 							///< re-enqueue it.
 
+	fr_time_t		last_sent;		//!< Last time this request entered the sent state.
+
+	uint8_t const		*coalesce_key;		//!< Identifies the query this request is making.
+							///< Set if identical requests may wait on this one.
+	size_t			coalesce_key_len;	//!< Length of the coalescing key.
+
+	fr_dlist_head_t		followers;		//!< Identical requests waiting on the result of
+							///< this one.
+
+	trunk_request_t		*leader;		//!< In flight request we're waiting on the result of.
+
 	bool			sent;			//!< Trunk request has been sent at least once.
 							///< Used so that re-queueing doesn't increase trunk
 							///< `sent` count.
 
+	fr_trace_span_t		*span;			//!< From being enqueued to being freed, if the
+							///< request is being traced.
+
 #ifndef NDEBUG
 	fr_dlist_head_t		log;			//!< State change log.
 #endif
@@ -142,6 +160,8 @@ struct trunk_connection_s {
 	fr_dlist_t		entry;			//!< Used to track the connection in the connecting,
 							///< full and failed lists.
 
+	fr_dlist_t		mux_entry;		//!< Entry in the list of connections with deferred writes.
+
 	/** @name State
 	 * @{
  	 */
@@ -171,6 +191,9 @@ struct trunk_connection_s {
  	 */
  	uint64_t		sent_count;		//!< The number of requests that have been sent using
  							///< this connection.
+
+	fr_time_delta_t		latency;		//!< Moving average of the time between a request being
+							///< sent and its response being received.
  	/** @} */
 
 	/** @name Timers
@@ -192,6 +215,19 @@ typedef struct trunk_watch_entry_s {
 	void			*uctx;			//!< User data to pass to the function.
 } trunk_watch_entry_t;
 
+/** Connections allocated by all of the trunks using the same configuration
+ *
+ * Each thread has its own trunk, but they're all allocated from the same
+ * #trunk_conf_t, so that's used to find the trunks which share a limit.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the list of totals.
+	trunk_conf_t const	*conf;			//!< The trunks were allocated with.
+	unsigned int		refs;			//!< How many trunks use this entry.
+							///< Protected by trunk_stats_mutex.
+	_Atomic(uint32_t)	count;			//!< Connections allocated across all threads.
+} trunk_total_t;
+
 /** Main trunk management handle
  *
  */
@@ -271,8 +307,24 @@ struct trunk_s {
 	 * @{
  	 */
  	fr_event_timer_t const	*manage_ev;		//!< Periodic connection management event.
+
+	fr_event_timer_t const	*mux_ev;		//!< Writes requests on connections in mux_deferred.
 	/** @} */
 
+	fr_hash_table_t		*inflight;		//!< Requests enqueued with a coalescing key, which
+							///< identical requests may wait on.
+
+	fr_dlist_head_t		mux_deferred;		//!< Connections with requests enqueued since mux_ev
+							///< was armed.
+
+	fr_dlist_t		stats_entry;		//!< Entry in the list of all trunks.
+
+	trunk_total_t		*total;			//!< Shared count of connections, if conf.max_total
+							///< is set.
+
+	bool			saturated;		//!< Requests are waiting in the backlog, and we
+							///< can't open any more connections.
+
 	/** @name Log rate limiting entries
 	 * @{
  	 */
@@ -296,10 +348,36 @@ struct trunk_s {
 	/** @} */
 };
 
+/*
+ *	All trunks, in every thread, so their statistics can be read.
+ *	Only locked when trunks are allocated and freed, and by
+ *	trunk_stats_walk().
+ */
+static pthread_mutex_t	trunk_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t	trunk_stats_list = {
+	.entry = FR_DLIST_ENTRY_INITIALISER(trunk_stats_list.entry),
+	.offset = offsetof(trunk_t, stats_entry)
+};
+
+/*
+ *	Number of trunks in this thread which are saturated.
+ */
+static _Thread_local unsigned int trunk_num_saturated;
+
+/*
+ *	Shared connection counts, for trunks with max_total set.
+ *	Also protected by trunk_stats_mutex.
+ */
+static fr_dlist_head_t	trunk_total_list = {
+	.entry = FR_DLIST_ENTRY_INITIALISER(trunk_total_list.entry),
+	.offset = offsetof(trunk_total_t, entry)
+};
+
 static conf_parser_t const trunk_config_request[] = {
 	{ FR_CONF_OFFSET("per_connection_max", trunk_conf_t, max_req_per_conn), .dflt = "2000" },
 	{ FR_CONF_OFFSET("per_connection_target", trunk_conf_t, target_req_per_conn), .dflt = "1000" },
 	{ FR_CONF_OFFSET("free_delay", trunk_conf_t, req_cleanup_delay), .dflt = "10.0" },
+	{ FR_CONF_OFFSET("coalesce", trunk_conf_t, coalesce), .dflt = "no" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -317,6 +395,7 @@ conf_parser_t const trunk_config[] = {
 	{ FR_CONF_OFFSET("min", trunk_conf_t, min), .dflt = "1" },
 	{ FR_CONF_OFFSET("max", trunk_conf_t, max), .dflt = "5" },
 	{ FR_CONF_OFFSET("connecting", trunk_conf_t, connecting), .dflt = "2" },
+	{ FR_CONF_OFFSET("max_total", trunk_conf_t, max_total), .dflt = "0" },
 	{ FR_CONF_OFFSET("uses", trunk_conf_t, max_uses), .dflt = "0" },
 	{ FR_CONF_OFFSET("lifetime", trunk_conf_t, lifetime), .dflt = "0" },
 
@@ -327,6 +406,8 @@ conf_parser_t const trunk_config[] = {
 
 	{ FR_CONF_OFFSET("max_backlog", trunk_conf_t, max_backlog), .dflt = "1000" },
 
+	{ FR_CONF_OFFSET("latency_aware", trunk_conf_t, latency_aware), .dflt = "no" },
+
 	{ FR_CONF_OFFSET_SUBSECTION("connection", 0, trunk_conf_t, conn_conf, trunk_config_connection), .subcs_size = sizeof(trunk_config_connection) },
 	{ FR_CONF_POINTER("request", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) trunk_config_request },
 
@@ -677,6 +758,7 @@ do { \
 	(_tconn)->pub.trunk->in_handler = _prev; \
 	if (!(_tconn)->pub.conn) { \
 		ERROR("Failed creating new connection"); \
+		if (trunk->total) atomic_fetch_sub_explicit(&trunk->total->count, 1, memory_order_relaxed); \
 		talloc_free(tconn); \
 		return -1; \
 	} \
@@ -908,6 +990,11 @@ static int trunk_connection_spawn(trunk_t *trunk, fr_time_t now);
 static inline void trunk_connection_auto_full(trunk_connection_t *tconn);
 static inline void trunk_connection_auto_unfull(trunk_connection_t *tconn);
 static inline void trunk_connection_readable(trunk_connection_t *tconn);
+static inline void trunk_connection_latency_update(trunk_connection_t *tconn, trunk_request_t *treq);
+
+static void trunk_request_coalesce_remove(trunk_request_t *treq);
+static void trunk_request_coalesce_complete(trunk_request_t *treq);
+static void trunk_request_coalesce_fail(trunk_request_t *treq, trunk_request_state_t prev);
 static inline void trunk_connection_writable(trunk_connection_t *tconn);
 static void trunk_connection_event_update(trunk_connection_t *tconn);
 static void trunk_connection_enter_full(trunk_connection_t *tconn);
@@ -921,6 +1008,7 @@ static void trunk_rebalance(trunk_t *trunk);
 static void trunk_manage(trunk_t *trunk, fr_time_t now);
 static void _trunk_timer(fr_event_list_t *el, fr_time_t now, void *uctx);
 static void trunk_backlog_drain(trunk_t *trunk);
+static void trunk_connection_mux_defer(trunk_connection_t *tconn);
 
 /** Compare two protocol requests
  *
@@ -1273,6 +1361,7 @@ static void trunk_request_enter_sent(trunk_request_t *treq)
 
 	REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_SENT);
 	fr_dlist_insert_tail(&tconn->sent, treq);
+	treq->last_sent = fr_time();
 
 	/*
 	 *	Update the connection's sent stats if this is the
@@ -1537,6 +1626,14 @@ static void trunk_request_enter_complete(trunk_request_t *treq)
 
 	switch (treq->pub.state) {
 	case TRUNK_REQUEST_STATE_SENT:
+		/*
+		 *	Must be done before the request is removed,
+		 *	so the connection is reordered with its new
+		 *	latency.
+		 */
+		if (tconn && trunk->conf.latency_aware) trunk_connection_latency_update(tconn, treq);
+		FALL_THROUGH;
+
 	case TRUNK_REQUEST_STATE_PENDING:
 	case TRUNK_REQUEST_STATE_REAPABLE:
 		trunk_request_remove_from_conn(treq);
@@ -1548,9 +1645,160 @@ static void trunk_request_enter_complete(trunk_request_t *treq)
 
 	REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_COMPLETE);
 	DO_REQUEST_COMPLETE(treq);
+	trunk_request_coalesce_complete(treq);
 	trunk_request_free(&treq);	/* Free the request */
 }
 
+/** Fold the response time of a request into its connection's moving average
+ *
+ * Uses the same 1/8 gain as the TCP smoothed RTT estimator, so a single
+ * slow response doesn't send all new requests elsewhere.
+ *
+ * @param[in] tconn	the request was sent on.
+ * @param[in] treq	which just received a response.
+ */
+static inline void trunk_connection_latency_update(trunk_connection_t *tconn, trunk_request_t *treq)
+{
+	fr_time_delta_t sample;
+
+	if (!fr_time_ispos(treq->last_sent)) return;
+
+	sample = fr_time_sub(fr_time(), treq->last_sent);
+	if (fr_time_delta_lt(sample, fr_time_delta_wrap(0))) return;
+
+	if (!fr_time_delta_ispos(tconn->latency)) {
+		tconn->latency = sample;
+		return;
+	}
+
+	tconn->latency = fr_time_delta_add(tconn->latency,
+					   fr_time_delta_wrap((fr_time_delta_unwrap(sample) -
+							       fr_time_delta_unwrap(tconn->latency)) / 8));
+}
+
+static uint32_t _trunk_request_coalesce_hash(void const *data)
+{
+	trunk_request_t const *treq = data;
+
+	return fr_hash(treq->coalesce_key, treq->coalesce_key_len);
+}
+
+static int8_t _trunk_request_coalesce_cmp(void const *one, void const *two)
+{
+	trunk_request_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->coalesce_key_len, b->coalesce_key_len);
+	if (ret != 0) return ret;
+
+	return CMP(memcmp(a->coalesce_key, b->coalesce_key, a->coalesce_key_len), 0);
+}
+
+/** Stop identical requests from being attached to this one
+ *
+ * Requests already waiting on this one are unaffected.
+ *
+ * @param[in] treq	to remove from the in flight table.
+ */
+static void trunk_request_coalesce_remove(trunk_request_t *treq)
+{
+	if (!treq->coalesce_key) return;
+
+	(void)fr_hash_table_remove(treq->pub.trunk->inflight, treq);
+	treq->coalesce_key = NULL;	/* Freed with the treq's children */
+	treq->coalesce_key_len = 0;
+}
+
+/** Pass the result of a request to the requests waiting on it
+ *
+ * The request_complete callback is called once per waiting request, with the
+ * waiting request's request and rctx, and the preq of the request which was
+ * actually sent.
+ *
+ * @param[in] treq	which just completed.
+ */
+static void trunk_request_coalesce_complete(trunk_request_t *treq)
+{
+	trunk_t		*trunk = treq->pub.trunk;
+	trunk_request_t	*follower;
+
+	trunk_request_coalesce_remove(treq);
+
+	while ((follower = fr_dlist_pop_head(&treq->followers))) {
+		follower->leader = NULL;
+
+		if (trunk->funcs.request_complete) {
+			void *prev = trunk->in_handler;
+
+			trunk->in_handler = (void *)trunk->funcs.request_complete;
+			trunk->funcs.request_complete(follower->pub.request, treq->pub.preq,
+						      follower->pub.rctx, trunk->uctx);
+			trunk->in_handler = prev;
+		}
+		trunk_request_free(&follower);
+	}
+}
+
+/** Fail the requests waiting on a request
+ *
+ * @param[in] treq	which just failed.
+ * @param[in] prev	state treq was in when it failed.
+ */
+static void trunk_request_coalesce_fail(trunk_request_t *treq, trunk_request_state_t prev)
+{
+	trunk_request_t	*follower;
+
+	trunk_request_coalesce_remove(treq);
+
+	while ((follower = fr_dlist_pop_head(&treq->followers))) {
+		follower->leader = NULL;
+
+		DO_REQUEST_FAIL(follower, prev);
+		trunk_request_free(&follower);
+	}
+}
+
+/** Make one of the requests waiting on a cancelled request send its own query
+ *
+ * The rest of the waiting requests then wait on that one.
+ *
+ * @param[in] treq	being cancelled.
+ */
+static void trunk_request_coalesce_promote(trunk_request_t *treq)
+{
+	trunk_request_t	*next, *follower;
+
+	/*
+	 *	Key memory remains valid until the
+	 *	treq is freed.
+	 */
+	uint8_t const	*key = treq->coalesce_key;
+	size_t		key_len = treq->coalesce_key_len;
+
+	trunk_request_coalesce_remove(treq);
+
+	next = fr_dlist_pop_head(&treq->followers);
+	if (!next) return;
+	next->leader = NULL;
+
+	switch (trunk_request_enqueue_coalesce(&next, treq->pub.trunk, next->pub.request,
+					       next->pub.preq, next->pub.rctx, key, key_len)) {
+	case TRUNK_ENQUEUE_OK:
+	case TRUNK_ENQUEUE_IN_BACKLOG:
+		while ((follower = fr_dlist_pop_head(&treq->followers))) {
+			follower->leader = next;
+			fr_dlist_insert_tail(&next->followers, follower);
+		}
+		break;
+
+	default:
+		DO_REQUEST_FAIL(next, TRUNK_REQUEST_STATE_INIT);
+		trunk_request_free(&next);
+		trunk_request_coalesce_fail(treq, TRUNK_REQUEST_STATE_INIT);
+		break;
+	}
+}
+
 /** Request failed, inform the API client and free the request
  *
  * @note treq will be inviable after a call to this function.
@@ -1579,6 +1827,7 @@ static void trunk_request_enter_failed(trunk_request_t *treq)
 
 	REQUEST_STATE_TRANSITION(TRUNK_REQUEST_STATE_FAILED);
 	DO_REQUEST_FAIL(treq, prev);
+	trunk_request_coalesce_fail(treq, prev);
 	trunk_request_free(&treq);	/* Free the request */
 }
 
@@ -1662,6 +1911,49 @@ static trunk_enqueue_t trunk_request_check_enqueue(trunk_connection_t **tconn_ou
 	return TRUNK_ENQUEUE_IN_BACKLOG;
 }
 
+/** Write requests on connections which had requests enqueued since the timer was armed
+ *
+ */
+static void _trunk_mux_deferred(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	trunk_t			*trunk = talloc_get_type_abort(uctx, trunk_t);
+	trunk_connection_t	*tconn;
+
+	while ((tconn = fr_dlist_pop_head(&trunk->mux_deferred))) {
+		if (!IS_SERVICEABLE(tconn)) continue;
+
+		connection_signals_pause(tconn->pub.conn);
+		trunk_connection_writable(tconn);
+		connection_signals_resume(tconn->pub.conn);
+	}
+}
+
+/** Defer writing requests on an always writable connection
+ *
+ * The timer fires on the next pass of the event loop, after any
+ * runnable requests have run, so all the requests they enqueue
+ * on this connection are passed to the muxer together.
+ */
+static void trunk_connection_mux_defer(trunk_connection_t *tconn)
+{
+	trunk_t *trunk = tconn->pub.trunk;
+
+	if (fr_dlist_entry_in_list(&tconn->mux_entry)) return;
+
+	if (!trunk->mux_ev &&
+	    (fr_event_timer_in(trunk, trunk->el, &trunk->mux_ev, fr_time_delta_wrap(0),
+			       _trunk_mux_deferred, trunk) < 0)) {
+		PERROR("Failed inserting mux event, writing requests immediately");
+
+		connection_signals_pause(tconn->pub.conn);
+		trunk_connection_writable(tconn);
+		connection_signals_resume(tconn->pub.conn);
+		return;
+	}
+
+	fr_dlist_insert_tail(&trunk->mux_deferred, tconn);
+}
+
 /** Enqueue a request which has never been assigned to a connection or was previously cancelled
  *
  * @param[in] treq	to re enqueue.  Must have been removed
@@ -2156,6 +2448,21 @@ void trunk_request_signal_cancel(trunk_request_t *treq)
 
  	trunk = treq->pub.trunk;
 
+	/*
+	 *	Waiting on another request.  Stop waiting.
+	 */
+	if (treq->leader) {
+		trunk_request_free(&treq);
+		return;
+	}
+
+	/*
+	 *	Other requests are waiting on this one.  Hand
+	 *	over to one of them, so they're not failed
+	 *	along with us.
+	 */
+	if (treq->coalesce_key) trunk_request_coalesce_promote(treq);
+
 	switch (treq->pub.state) {
 	/*
 	 *	We don't call the complete or failed callbacks
@@ -2338,6 +2645,22 @@ void trunk_request_free(trunk_request_t **treq_to_free)
 	 */
 	*treq_to_free = NULL;
 
+	if (unlikely(treq->span != NULL)) {
+		fr_trace_span_end(treq->span, (treq->pub.state != TRUNK_REQUEST_STATE_COMPLETE));
+		treq->span = NULL;
+	}
+
+	/*
+	 *	Stop identical requests from waiting on us,
+	 *	or stop waiting ourselves.
+	 */
+	trunk_request_coalesce_remove(treq);
+	if (treq->leader) {
+		fr_dlist_remove(&treq->leader->followers, treq);
+		treq->leader = NULL;
+	}
+	fr_assert(fr_dlist_num_elements(&treq->followers) == 0);
+
 	/*
 	 *	Call the API client callback to free
 	 *	any associated memory.
@@ -2509,6 +2832,7 @@ trunk_request_t *trunk_request_alloc(trunk_t *trunk, request_t *request)
 			},
 			.cancel_reason = TRUNK_CANCEL_REASON_NONE
 		};
+		fr_dlist_init(&treq->followers, trunk_request_t, entry);
 		trunk->pub.req_alloc_new++;
 #ifndef NDEBUG
 		fr_dlist_init(&treq->log, trunk_request_state_log_t, entry);
@@ -2575,6 +2899,19 @@ trunk_request_t *trunk_request_alloc(trunk_t *trunk, request_t *request)
  *	- TRUNK_ENQUEUE_DST_UNAVAILABLE
  *	- TRUNK_ENQUEUE_FAIL
  */
+/** Start a span for a trunk request, if its request is being traced
+ *
+ * The span is ended when the trunk request is freed.
+ */
+static inline CC_HINT(always_inline) void trunk_request_trace_start(trunk_request_t *treq, request_t *request)
+{
+	trunk_t *trunk = treq->pub.trunk;
+
+	if (likely(!request || !request->trace) || treq->span) return;
+
+	treq->span = fr_trace_span_start(request, trunk->log_prefix ? trunk->log_prefix : "trunk", false);
+}
+
 trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq_out, trunk_t *trunk,
 					    request_t *request, void *preq, void *rctx)
 {
@@ -2607,7 +2944,11 @@ trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq_out, trunk_t *trunk
 		}
 		treq->pub.preq = preq;
 		treq->pub.rctx = rctx;
-		if (trunk->conf.always_writable) {
+		trunk_request_trace_start(treq, request);
+		if (trunk->conf.always_writable && trunk->conf.coalesce) {
+			trunk_request_enter_pending(treq, tconn, true);
+			trunk_connection_mux_defer(tconn);
+		} else if (trunk->conf.always_writable) {
 			connection_signals_pause(tconn->pub.conn);
 			trunk_request_enter_pending(treq, tconn, true);
 			trunk_connection_writable(tconn);
@@ -2626,6 +2967,7 @@ trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq_out, trunk_t *trunk
 		}
 		treq->pub.preq = preq;
 		treq->pub.rctx = rctx;
+		trunk_request_trace_start(treq, request);
 		trunk_request_enter_backlog(treq, true);
 		break;
 
@@ -2648,6 +2990,124 @@ trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq_out, trunk_t *trunk
 	return ret;
 }
 
+/** Enqueue a request, or wait on an identical request which is already in flight
+ *
+ * Identical requests are ones with the same coalescing key.  The key should
+ * uniquely identify the query the request is making, e.g. the search base,
+ * scope and filter of an LDAP search, and must only be shared by requests
+ * whose queries are safe to share the result of.
+ *
+ * If there's no identical request in flight, this is equivalent to
+ * #trunk_request_enqueue, and later requests with the same key will wait
+ * on this one.
+ *
+ * If there is, the treq waits on the existing request, and its preq is
+ * never sent.  When the existing request completes, the #trunk_request_complete_t
+ * callback is called with the waiting request's request and rctx, but the preq of
+ * the request which was actually sent.  The callback must therefore copy results
+ * out of the preq, and not move or consume them.  If the existing request fails,
+ * the #trunk_request_fail_t callback is called with the waiting request's own preq.
+ * In either case, the #trunk_request_free_t callback is then called with the
+ * waiting request's own preq.
+ *
+ * If the existing request is cancelled, one of the requests waiting on it is
+ * enqueued in its place.
+ *
+ * Waiting requests may be cancelled with #trunk_request_signal_cancel as normal.
+ *
+ * @note Unlike #trunk_request_enqueue, a treq is allocated before the request is
+ *	 enqueued, and if enqueueing fails, it's left in treq_out.  It should be
+ *	 freed with #trunk_request_free, which will call the #trunk_request_free_t
+ *	 callback.
+ *
+ * @param[in,out] treq_out	A trunk request handle.  If the memory pointed to
+ *				is NULL, a new treq will be allocated.
+ *				Otherwise treq should point to memory allocated
+ *				with trunk_request_alloc.
+ * @param[in] trunk		to enqueue request on.
+ * @param[in] request		to enqueue.
+ * @param[in] preq		Protocol request to write out.
+ * @param[in] rctx		The resume context to write any result to.
+ * @param[in] key		Identifying the query.  Copied.
+ * @param[in] key_len		Length of key.
+ * @return
+ *	- TRUNK_ENQUEUE_OK.
+ *	- TRUNK_ENQUEUE_IN_BACKLOG.
+ *	- TRUNK_ENQUEUE_NO_CAPACITY.
+ *	- TRUNK_ENQUEUE_DST_UNAVAILABLE
+ *	- TRUNK_ENQUEUE_FAIL
+ */
+trunk_enqueue_t trunk_request_enqueue_coalesce(trunk_request_t **treq_out, trunk_t *trunk,
+					       request_t *request, void *preq, void *rctx,
+					       uint8_t const *key, size_t key_len)
+{
+	trunk_request_t	*treq, *leader;
+	trunk_request_t	find = { .coalesce_key = key, .coalesce_key_len = key_len };
+	trunk_enqueue_t	ret;
+
+	if (!fr_cond_assert_msg(!IN_HANDLER(trunk),
+				"%s cannot be called within a handler", __FUNCTION__)) return TRUNK_ENQUEUE_FAIL;
+
+	if (!fr_cond_assert_msg(!*treq_out || ((*treq_out)->pub.state == TRUNK_REQUEST_STATE_INIT),
+				"%s requests must be in \"init\" state", __FUNCTION__)) return TRUNK_ENQUEUE_FAIL;
+
+	if (unlikely(!trunk->inflight)) {
+		MEM(trunk->inflight = fr_hash_table_alloc(trunk, _trunk_request_coalesce_hash,
+							  _trunk_request_coalesce_cmp, NULL));
+	}
+
+	if (*treq_out) {
+		treq = *treq_out;
+	} else {
+		treq = trunk_request_alloc(trunk, request);
+		if (!treq) return TRUNK_ENQUEUE_FAIL;
+	}
+	treq->pub.preq = preq;
+	treq->pub.rctx = rctx;
+
+	/*
+	 *	Identical request already in flight, wait
+	 *	for its result.
+	 */
+	leader = fr_hash_table_find(trunk->inflight, &find);
+	if (leader) {
+		treq->leader = leader;
+		fr_dlist_insert_tail(&leader->followers, treq);
+		trunk->pub.req_coalesced++;
+
+		ROPTIONAL(RDEBUG3, DEBUG3, "Trunk request %" PRIu64 " waiting on identical request %" PRIu64,
+			  treq->id, leader->id);
+
+		*treq_out = treq;
+		return TRUNK_ENQUEUE_OK;
+	}
+
+	/*
+	 *	Add to the table before enqueueing, as the
+	 *	request may be muxed (and fail) immediately.
+	 */
+	MEM(treq->coalesce_key = talloc_memdup(treq, key, key_len));
+	treq->coalesce_key_len = key_len;
+	if (!fr_cond_assert(fr_hash_table_insert(trunk->inflight, treq))) {
+		treq->coalesce_key = NULL;
+		treq->coalesce_key_len = 0;
+	}
+
+	*treq_out = treq;
+	ret = trunk_request_enqueue(treq_out, trunk, request, preq, rctx);
+	switch (ret) {
+	case TRUNK_ENQUEUE_OK:
+	case TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		trunk_request_coalesce_remove(treq);
+		break;
+	}
+
+	return ret;
+}
+
 /** Re-enqueue a request on the same connection
  *
  * If the treq has been sent, we assume that we're being signalled to requeue
@@ -2860,6 +3320,36 @@ uint16_t trunk_connection_count_by_state(trunk_t *trunk, int conn_state)
 	return count;
 }
 
+/** Call a function with every trunk, in every thread
+ *
+ * The trunks aren't locked, so the callback should only read the
+ * statistics in the public trunk structure, and connection counts.
+ * It must not call any other trunk functions.  Trunks can't be freed
+ * while they're being walked.
+ *
+ * @param[in] walk	called for each trunk.
+ * @param[in] uctx	passed to walk.
+ */
+void trunk_stats_walk(trunk_stats_walk_t walk, void *uctx)
+{
+	pthread_mutex_lock(&trunk_stats_mutex);
+	fr_dlist_foreach(&trunk_stats_list, trunk_t, trunk) {
+		walk(uctx, trunk->log_prefix, trunk);
+	}
+	pthread_mutex_unlock(&trunk_stats_mutex);
+}
+
+/** Return the number of trunks in this thread which are saturated
+ *
+ * A trunk is saturated when requests are waiting in its backlog, and
+ * it can't open any more connections.  This is updated each time the
+ * trunk is managed.
+ */
+unsigned int trunk_thread_num_saturated(void)
+{
+	return trunk_num_saturated;
+}
+
 /** Return the count number of requests associated with a trunk connection
  *
  * @param[in] tconn		to return request count for.
@@ -3641,6 +4131,8 @@ static void _trunk_connection_on_halted(UNUSED connection_t *conn,
 	 */
 	fr_assert(trunk_request_count_by_connection(tconn, TRUNK_REQUEST_STATE_ALL) == 0);
 
+	if (trunk->total) atomic_fetch_sub_explicit(&trunk->total->count, 1, memory_order_relaxed);
+
 	/*
 	 *	And free the connection...
 	 */
@@ -3663,6 +4155,8 @@ static int _trunk_connection_free(trunk_connection_t *tconn)
 	fr_assert(tconn->pub.state == TRUNK_CONN_HALTED);
 	fr_assert(!fr_dlist_entry_in_list(&tconn->entry));	/* Should not be in a list */
 
+	if (fr_dlist_entry_in_list(&tconn->mux_entry)) fr_dlist_remove(&tconn->pub.trunk->mux_deferred, tconn);
+
 	/*
 	 *	Loop over all the requests we gathered
 	 *	and transition them to the failed state,
@@ -3723,13 +4217,33 @@ static int _trunk_connection_free(trunk_connection_t *tconn)
  * Calls the API client's alloc() callback to create a new connection_t,
  * then inserts the connection into the 'connecting' list.
  *
+ * If max_total is set, and it's been reached by the trunks in all threads,
+ * no connection is spawned.  Each trunk may always have one connection,
+ * so that no thread is left without a connection.
+ *
  * @param[in] trunk	to spawn connection in.
  * @param[in] now	The current time.
+ * @return
+ *	- 1 if max_total has been reached.
+ *	- 0 on success.
+ *	- -1 on failure.
  */
 static int trunk_connection_spawn(trunk_t *trunk, fr_time_t now)
 {
 	trunk_connection_t	*tconn;
 
+	if (trunk->total) {
+		uint32_t count;
+
+		count = atomic_fetch_add_explicit(&trunk->total->count, 1, memory_order_relaxed);
+		if ((count >= trunk->conf.max_total) &&
+		    (trunk_connection_count_by_state(trunk, TRUNK_CONN_ALL) > 0)) {
+			atomic_fetch_sub_explicit(&trunk->total->count, 1, memory_order_relaxed);
+			DEBUG4("Not opening connection - Have %u connections across all threads, need %u or below",
+			       count, trunk->conf.max_total);
+			return 1;
+		}
+	}
 
 	/*
 	 *	Call the API client's callback to create
@@ -4193,6 +4707,33 @@ static void trunk_manage(trunk_t *trunk, fr_time_t now)
 
 	if (new_state != trunk->pub.state) TRUNK_STATE_TRANSITION(new_state);
 
+	/*
+	 *	Track whether requests are backing up because
+	 *	we've hit the limit on connections.  The worker
+	 *	passes this on, so that the network thread can
+	 *	send packets elsewhere.
+	 */
+	{
+		bool saturated = false;
+
+		if (fr_heap_num_elements(trunk->backlog) > 0) {
+			saturated = ((trunk->conf.max > 0) &&
+				     (trunk_connection_count_by_state(trunk, TRUNK_CONN_ALL) >= trunk->conf.max)) ||
+				    (trunk->total &&
+				     (atomic_load_explicit(&trunk->total->count, memory_order_relaxed) >= trunk->conf.max_total));
+		}
+
+		if (saturated != trunk->saturated) {
+			DEBUG3("Trunk is %s", saturated ? "saturated" : "no longer saturated");
+			if (saturated) {
+				trunk_num_saturated++;
+			} else {
+				trunk_num_saturated--;
+			}
+			trunk->saturated = saturated;
+		}
+	}
+
 	/*
 	 *	A trunk can be signalled to not proactively
 	 *	manage connections if a destination is known
@@ -4724,8 +5265,15 @@ int trunk_start(trunk_t *trunk)
 	 *	Spawn the initial set of connections
 	 */
 	for (i = 0; i < trunk->conf.start; i++) {
+		int ret;
+
 		DEBUG("[%i] Starting initial connection", i);
-		if (trunk_connection_spawn(trunk, fr_time()) != 0) return -1;
+		ret = trunk_connection_spawn(trunk, fr_time());
+		if (ret < 0) return -1;
+		if (ret > 0) {
+			DEBUG("Not starting more connections - max_total (%u) reached", trunk->conf.max_total);
+			break;
+		}
 	}
 
 	if (fr_time_delta_ispos(trunk->conf.manage_interval)) {
@@ -4798,6 +5346,23 @@ static int8_t _trunk_connection_order_by_shortest_queue(void const *one, void co
 	return ((a_count > b_count) && ((a_count - b_count) > 1)) - ((b_count > a_count) && ((b_count - a_count) > 1));
 }
 
+/** Order connections by queue depth, then by how quickly they've been responding
+ *
+ * Connections with no response time samples sort first among equally
+ * loaded connections, so new connections get a chance to prove themselves.
+ */
+static int8_t _trunk_connection_order_by_latency(void const *one, void const *two)
+{
+	trunk_connection_t const	*a = talloc_get_type_abort_const(one, trunk_connection_t);
+	trunk_connection_t const	*b = talloc_get_type_abort_const(two, trunk_connection_t);
+	int8_t				ret;
+
+	ret = _trunk_connection_order_by_shortest_queue(one, two);
+	if (ret != 0) return ret;
+
+	return fr_time_delta_cmp(a->latency, b->latency);
+}
+
 /** Free a trunk, gracefully closing all connections.
  *
  */
@@ -4810,6 +5375,12 @@ static int _trunk_free(trunk_t *trunk)
 
 	DEBUG4("Trunk free %p", trunk);
 
+	pthread_mutex_lock(&trunk_stats_mutex);
+	fr_dlist_remove(&trunk_stats_list, trunk);
+	pthread_mutex_unlock(&trunk_stats_mutex);
+
+	if (trunk->saturated) trunk_num_saturated--;
+
 	trunk->freeing = true;	/* Prevent re-enqueuing */
 
 	/*
@@ -4817,6 +5388,7 @@ static int _trunk_free(trunk_t *trunk)
 	 *	we've freed everything.
 	 */
 	fr_event_timer_delete(&trunk->manage_ev);
+	fr_event_timer_delete(&trunk->mux_ev);
 
 	/*
 	 *	Now free the connections in each of the lists.
@@ -4839,6 +5411,20 @@ static int _trunk_free(trunk_t *trunk)
 	 */
 	while ((tconn = fr_dlist_head(&trunk->to_free))) talloc_free(fr_dlist_remove(&trunk->to_free, tconn));
 
+	/*
+	 *	All of our connections have been halted, so we no
+	 *	longer count towards max_total.
+	 */
+	if (trunk->total) {
+		pthread_mutex_lock(&trunk_stats_mutex);
+		if (--trunk->total->refs == 0) {
+			fr_dlist_remove(&trunk_total_list, trunk->total);
+			talloc_free(trunk->total);
+		}
+		pthread_mutex_unlock(&trunk_stats_mutex);
+		trunk->total = NULL;
+	}
+
 	/*
 	 *	Free any requests left in the backlog
 	 */
@@ -4903,13 +5489,39 @@ trunk_t *trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 
 	memcpy(&trunk->funcs, funcs, sizeof(trunk->funcs));
 	if (!trunk->funcs.connection_prioritise) {
-		trunk->funcs.connection_prioritise = _trunk_connection_order_by_shortest_queue;
+		trunk->funcs.connection_prioritise = conf->latency_aware ? _trunk_connection_order_by_latency :
+									   _trunk_connection_order_by_shortest_queue;
 	}
 	if (!trunk->funcs.request_prioritise) trunk->funcs.request_prioritise = fr_pointer_cmp;
 
 	memcpy(&trunk->conf, conf, sizeof(trunk->conf));
 
 	memcpy(&trunk->uctx, &uctx, sizeof(trunk->uctx));
+
+	pthread_mutex_lock(&trunk_stats_mutex);
+	fr_dlist_insert_tail(&trunk_stats_list, trunk);
+
+	/*
+	 *	Trunks in other threads allocated from the same
+	 *	configuration share a connection count.
+	 */
+	if (conf->max_total) {
+		trunk_total_t *total = NULL;
+
+		while ((total = fr_dlist_next(&trunk_total_list, total))) {
+			if (total->conf == conf) break;
+		}
+
+		if (!total) {
+			MEM(total = talloc_zero(NULL, trunk_total_t));
+			total->conf = conf;
+			atomic_init(&total->count, 0);
+			fr_dlist_insert_tail(&trunk_total_list, total);
+		}
+		total->refs++;
+		trunk->total = total;
+	}
+	pthread_mutex_unlock(&trunk_stats_mutex);
 	talloc_set_destructor(trunk, _trunk_free);
 
 	/*
@@ -4937,6 +5549,7 @@ trunk_t *trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 	fr_dlist_talloc_init(&trunk->draining, trunk_connection_t, entry);
 	fr_dlist_talloc_init(&trunk->draining_to_free, trunk_connection_t, entry);
 	fr_dlist_talloc_init(&trunk->to_free, trunk_connection_t, entry);
+	fr_dlist_talloc_init(&trunk->mux_deferred, trunk_connection_t, mux_entry);
 
 	/*
 	 *	Watch lists
@@ -233,6 +233,10 @@ typedef struct {
 	uint16_t		connecting;		//!< Maximum number of connections that can be in the
 							///< connecting state.  Used to throttle connection spawning.
 
+	uint16_t		max_total;		//!< Maximum number of connections across all the trunks
+							///< allocated from this configuration, i.e. across all
+							///< threads.  Each trunk may always have one connection.
+
 	uint32_t		target_req_per_conn;	//!< How many pending requests should ideally be
 							///< running on each connection.  Averaged across
 							///< the 'active' set of connections.
@@ -276,6 +280,16 @@ typedef struct {
 							///< does not need to be called, and requests will be
 							///< enqueued as soon as they're received.
 
+	bool			coalesce;		//!< If always_writable is true, defer writing newly
+							///< enqueued requests until the requests currently
+							///< being processed have yielded, so that requests
+							///< enqueued at the same time are written together.
+
+	bool			latency_aware;		//!< Of the connections with the fewest outstanding
+							///< requests, prefer the one which has been responding
+							///< fastest.  Ignored if the API client provides its own
+							///< connection_prioritise function.
+
 	bool			backlog_on_failed_conn;	//!< Assign requests to the backlog when there are no
 							//!< available connections and the last connection event
 							//!< was a failure, instead of failing them immediately.
@@ -322,6 +336,9 @@ struct trunk_pub_s {
 	uint64_t _CONST		req_alloc_new;		//!< How many requests we've allocated.
 
 	uint64_t _CONST		req_alloc_reused;	//!< How many requests were reused.
+
+	uint64_t _CONST		req_coalesced;		//!< How many requests waited on an identical
+							///< request instead of being sent.
 	/** @} */
 
 	bool _CONST		triggers;		//!< do we run the triggers?
@@ -755,11 +772,23 @@ typedef struct {
 								///< provide a chance to mark the request as runnable.
 } trunk_io_funcs_t;
 
+/** Called for each trunk by #trunk_stats_walk
+ *
+ * @param[in] uctx	passed to trunk_stats_walk().
+ * @param[in] name	log prefix of the trunk.
+ * @param[in] trunk	to read statistics from.
+ */
+typedef void (*trunk_stats_walk_t)(void *uctx, char const *name, trunk_t *trunk);
+
 /** @name Statistics
  * @{
  */
+void		trunk_stats_walk(trunk_stats_walk_t walk, void *uctx) CC_HINT(nonnull(1));
+
 uint16_t	trunk_connection_count_by_state(trunk_t *trunk, int conn_state) CC_HINT(nonnull);
 
+unsigned int	trunk_thread_num_saturated(void);
+
 uint32_t	trunk_request_count_by_connection(trunk_connection_t const *tconn, int req_state) CC_HINT(nonnull);
 
 uint64_t	trunk_request_count_by_state(trunk_t *trunk, int conn_state, int req_state) CC_HINT(nonnull);
@@ -800,6 +829,10 @@ trunk_request_t *trunk_request_alloc(trunk_t *trunk, request_t *request) CC_HINT
 trunk_enqueue_t trunk_request_enqueue(trunk_request_t **treq, trunk_t *trunk, request_t *request,
 					    void *preq, void *rctx) CC_HINT(nonnull(2));
 
+trunk_enqueue_t trunk_request_enqueue_coalesce(trunk_request_t **treq_out, trunk_t *trunk,
+					       request_t *request, void *preq, void *rctx,
+					       uint8_t const *key, size_t key_len) CC_HINT(nonnull(1,2,6));
+
 trunk_enqueue_t trunk_request_requeue(trunk_request_t *treq) CC_HINT(nonnull);
 
 trunk_enqueue_t trunk_request_enqueue_on_conn(trunk_request_t **treq_out, trunk_connection_t *tconn,
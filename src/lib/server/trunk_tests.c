@@ -1003,6 +1003,209 @@ static void test_enqueue_cancellation_points(void)
 	talloc_free(ctx);
 }
 
+/*
+ *	Test writes being deferred on always writable trunks
+ */
+static void test_enqueue_coalesce_writes(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	trunk_t			*trunk;
+	fr_event_list_t		*el;
+	trunk_conf_t		conf = {
+					.start = 1,
+					.min = 1,
+					.manage_interval = fr_time_delta_from_nsec(NSEC * 0.5),
+					.always_writable = true
+				};
+	test_proto_request_t	*preq_a, *preq_b;
+	trunk_request_t		*treq_a = NULL, *treq_b = NULL;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	TEST_CASE("coalesce off - Requests are written as they're enqueued");
+	trunk = test_setup_trunk(ctx, el, &conf, false, NULL);
+
+	fr_event_corral(el, test_time_base, false);	/* Connect the connection */
+	fr_event_service(el);
+	TEST_CHECK(trunk_connection_count_by_state(trunk, TRUNK_CONN_ACTIVE) == 1);
+
+	preq_a = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue(&treq_a, trunk, NULL, preq_a, NULL) == TRUNK_ENQUEUE_OK);
+	preq_a->treq = treq_a;
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_SENT) == 1);
+
+	talloc_free(trunk);
+	talloc_free(preq_a);
+
+	TEST_CASE("coalesce on - Requests are written together once the event loop runs");
+	conf.coalesce = true;
+	trunk = test_setup_trunk(ctx, el, &conf, false, NULL);
+
+	fr_event_corral(el, test_time_base, false);	/* Connect the connection */
+	fr_event_service(el);
+	TEST_CHECK(trunk_connection_count_by_state(trunk, TRUNK_CONN_ACTIVE) == 1);
+
+	treq_a = NULL;
+	preq_a = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue(&treq_a, trunk, NULL, preq_a, NULL) == TRUNK_ENQUEUE_OK);
+	preq_a->treq = treq_a;
+
+	preq_b = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue(&treq_b, trunk, NULL, preq_b, NULL) == TRUNK_ENQUEUE_OK);
+	preq_b->treq = treq_b;
+
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_PENDING) == 2);
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_SENT) == 0);
+
+	fr_event_corral(el, test_time_base, false);	/* Run the deferred mux */
+	fr_event_service(el);
+
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_PENDING) == 0);
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_SENT) == 2);
+
+	talloc_free(trunk);
+	talloc_free(preq_a);
+	talloc_free(preq_b);
+
+	talloc_free(ctx);
+}
+
+/*
+ *	Test identical requests sharing the result of one request
+ */
+static void test_enqueue_coalesce_requests(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	trunk_t			*trunk;
+	fr_event_list_t		*el;
+	trunk_conf_t		conf = {
+					.start = 1,
+					.min = 1,
+					.manage_interval = fr_time_delta_from_nsec(NSEC * 0.5)
+				};
+	test_proto_request_t	*leader, *follower;
+	trunk_request_t		*treq_leader = NULL, *treq_follower = NULL;
+	test_proto_stats_t	stats;
+	static uint8_t const	key[] = "ou=people?sub?(uid=bob)";
+	int			i;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	TEST_CASE("Follower is completed with the result of the leader");
+	memset(&stats, 0, sizeof(stats));
+	trunk = test_setup_trunk(ctx, el, &conf, false, &stats);
+
+	leader = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue_coalesce(&treq_leader, trunk, NULL, leader, NULL,
+						  key, sizeof(key)) == TRUNK_ENQUEUE_IN_BACKLOG);
+	leader->treq = treq_leader;
+
+	follower = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue_coalesce(&treq_follower, trunk, NULL, follower, NULL,
+						  key, sizeof(key)) == TRUNK_ENQUEUE_OK);
+	follower->treq = treq_follower;
+
+	TEST_CHECK(treq_follower->leader == treq_leader);
+	TEST_CHECK(trunk->pub.req_coalesced == 1);
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_BACKLOG) == 1);
+
+	for (i = 0; i < 4; i++) {	/* Connect, send, loop back, read */
+		fr_event_corral(el, test_time_base, false);
+		fr_event_service(el);
+	}
+
+	TEST_CHECK(leader->completed == true);
+	TEST_CHECK(leader->freed == true);
+	TEST_CHECK(follower->completed == false);	/* Complete callback gets the leader's preq */
+	TEST_CHECK(follower->failed == false);
+	TEST_CHECK(follower->freed == true);
+	TEST_CHECK_LEN(stats.completed, 2);
+	TEST_CHECK_LEN(stats.failed, 0);
+	TEST_CHECK_LEN(stats.freed, 2);
+
+	talloc_free(trunk);
+	talloc_free(leader);
+	talloc_free(follower);
+
+	TEST_CASE("Follower is sent in place of a cancelled leader");
+	memset(&stats, 0, sizeof(stats));
+	trunk = test_setup_trunk(ctx, el, &conf, false, &stats);
+	treq_leader = treq_follower = NULL;
+
+	leader = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue_coalesce(&treq_leader, trunk, NULL, leader, NULL,
+						  key, sizeof(key)) == TRUNK_ENQUEUE_IN_BACKLOG);
+	leader->treq = treq_leader;
+
+	follower = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue_coalesce(&treq_follower, trunk, NULL, follower, NULL,
+						  key, sizeof(key)) == TRUNK_ENQUEUE_OK);
+	follower->treq = treq_follower;
+
+	trunk_request_signal_cancel(treq_leader);
+	TEST_CHECK(leader->freed == true);
+	TEST_CHECK(treq_follower->leader == NULL);
+	TEST_CHECK(trunk_request_count_by_state(trunk, TRUNK_CONN_ALL, TRUNK_REQUEST_STATE_BACKLOG) == 1);
+
+	for (i = 0; i < 4; i++) {	/* Connect, send, loop back, read */
+		fr_event_corral(el, test_time_base, false);
+		fr_event_service(el);
+	}
+
+	TEST_CHECK(leader->completed == false);
+	TEST_CHECK(follower->completed == true);	/* Sent with its own preq */
+	TEST_CHECK(follower->failed == false);
+	TEST_CHECK(follower->freed == true);
+	TEST_CHECK_LEN(stats.completed, 1);
+	TEST_CHECK_LEN(stats.failed, 0);
+	TEST_CHECK_LEN(stats.freed, 2);
+
+	talloc_free(trunk);
+	talloc_free(leader);
+	talloc_free(follower);
+
+	TEST_CASE("Cancelled follower doesn't affect the leader");
+	memset(&stats, 0, sizeof(stats));
+	trunk = test_setup_trunk(ctx, el, &conf, false, &stats);
+	treq_leader = treq_follower = NULL;
+
+	leader = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue_coalesce(&treq_leader, trunk, NULL, leader, NULL,
+						  key, sizeof(key)) == TRUNK_ENQUEUE_IN_BACKLOG);
+	leader->treq = treq_leader;
+
+	follower = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(trunk_request_enqueue_coalesce(&treq_follower, trunk, NULL, follower, NULL,
+						  key, sizeof(key)) == TRUNK_ENQUEUE_OK);
+	follower->treq = treq_follower;
+
+	trunk_request_signal_cancel(treq_follower);
+	TEST_CHECK(follower->freed == true);
+	TEST_CHECK(fr_dlist_num_elements(&treq_leader->followers) == 0);
+
+	for (i = 0; i < 4; i++) {	/* Connect, send, loop back, read */
+		fr_event_corral(el, test_time_base, false);
+		fr_event_service(el);
+	}
+
+	TEST_CHECK(leader->completed == true);
+	TEST_CHECK(follower->completed == false);
+	TEST_CHECK_LEN(stats.completed, 1);
+	TEST_CHECK_LEN(stats.freed, 2);
+
+	talloc_free(trunk);
+	talloc_free(leader);
+	talloc_free(follower);
+
+	talloc_free(ctx);
+}
+
 /*
  *	Test PARTIAL -> SENT and CANCEL-PARTIAL -> CANCEL-SENT
  */
@@ -1491,6 +1694,98 @@ static void test_connection_rebalance_requests(void)
 	talloc_free(preq);
 }
 
+static void test_connection_latency_average(void)
+{
+	trunk_connection_t	tconn = { 0 };
+	trunk_request_t		treq = { 0 };
+	fr_time_t		base = test_time_base;
+
+	TEST_CASE("Request which was never sent - No sample");
+	trunk_connection_latency_update(&tconn, &treq);
+	TEST_CHECK(fr_time_delta_eq(tconn.latency, fr_time_delta_wrap(0)));
+
+	TEST_CASE("First sample - Used as is");
+	treq.last_sent = test_time_base;
+	test_time_base = fr_time_add(test_time_base, fr_time_delta_from_msec(800));
+	trunk_connection_latency_update(&tconn, &treq);
+	TEST_CHECK(fr_time_delta_eq(tconn.latency, fr_time_delta_from_msec(800)));
+
+	TEST_CASE("Fast response - Moves the average 1/8th of the way down");
+	treq.last_sent = test_time_base;
+	trunk_connection_latency_update(&tconn, &treq);
+	TEST_CHECK(fr_time_delta_eq(tconn.latency, fr_time_delta_from_msec(700)));
+
+	TEST_CASE("Slow response - Moves the average 1/8th of the way up");
+	treq.last_sent = test_time_base;
+	test_time_base = fr_time_add(test_time_base, fr_time_delta_from_msec(1500));
+	trunk_connection_latency_update(&tconn, &treq);
+	TEST_CHECK(fr_time_delta_eq(tconn.latency, fr_time_delta_from_msec(800)));
+
+	test_time_base = base;
+}
+
+static void test_connection_latency_aware(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	trunk_t			*trunk;
+	fr_event_list_t		*el;
+	trunk_conf_t		conf = {
+					.start = 2,
+					.min = 2,
+					.latency_aware = true,
+					.manage_interval = fr_time_delta_from_nsec(NSEC * 0.5)
+				};
+	test_proto_request_t	*preq;
+	trunk_connection_t	*fast, *slow;
+	trunk_request_t		*treq_a = NULL, *treq_b = NULL, *treq_c = NULL;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	trunk = test_setup_trunk(ctx, el, &conf, true, NULL);
+	preq = talloc_zero(NULL, test_proto_request_t);
+
+	/*
+	 *	Allow the connections to open
+	 */
+	fr_event_corral(el, test_time_base, false);
+	fr_event_service(el);
+
+	TEST_CHECK(fr_minmax_heap_num_elements(trunk->active) == 2);
+
+	/*
+	 *	Give the connection at the head of the heap the
+	 *	higher latency, so it's the one which has to move.
+	 */
+	slow = fr_minmax_heap_min_peek(trunk->active);
+	fast = fr_minmax_heap_max_peek(trunk->active);
+
+	slow->latency = fr_time_delta_from_msec(10);
+	CONN_REORDER(slow);
+	fast->latency = fr_time_delta_from_msec(1);
+	CONN_REORDER(fast);
+
+	TEST_CASE("C2 connected, R1 - Equally loaded, lowest latency wins");
+	trunk_request_enqueue(&treq_a, trunk, NULL, preq, NULL);
+	TEST_CHECK(trunk_request_count_by_connection(fast, TRUNK_REQUEST_STATE_ALL) == 1);
+	TEST_CHECK(trunk_request_count_by_connection(slow, TRUNK_REQUEST_STATE_ALL) == 0);
+
+	TEST_CASE("C2 connected, R2 - Within the fudge factor, lowest latency wins");
+	trunk_request_enqueue(&treq_b, trunk, NULL, preq, NULL);
+	TEST_CHECK(trunk_request_count_by_connection(fast, TRUNK_REQUEST_STATE_ALL) == 2);
+	TEST_CHECK(trunk_request_count_by_connection(slow, TRUNK_REQUEST_STATE_ALL) == 0);
+
+	TEST_CASE("C2 connected, R3 - Queue depth takes priority over latency");
+	trunk_request_enqueue(&treq_c, trunk, NULL, preq, NULL);
+	TEST_CHECK(trunk_request_count_by_connection(fast, TRUNK_REQUEST_STATE_ALL) == 2);
+	TEST_CHECK(trunk_request_count_by_connection(slow, TRUNK_REQUEST_STATE_ALL) == 1);
+
+	talloc_free(ctx);
+	talloc_free(preq);
+}
+
 #define ALLOC_REQ(_id) \
 do { \
 	treq_##_id = trunk_request_alloc(trunk, NULL); \
@@ -1951,6 +2246,8 @@ TEST_LIST = {
 	{ "Enqueue - Basic",				test_enqueue_basic },
 	{ "Enqueue - Cancellation points",		test_enqueue_cancellation_points },
 	{ "Enqueue - Partial state transitions",	test_partial_to_complete_states },
+	{ "Enqueue - Coalesce writes",			test_enqueue_coalesce_writes },
+	{ "Enqueue - Coalesce requests",		test_enqueue_coalesce_requests },
 	{ "Requeue - On reconnect",			test_requeue_on_reconnect },
 
 	/*
@@ -1958,6 +2255,12 @@ TEST_LIST = {
 	 */
 	{ "Rebalance - Connection rebalance",		test_connection_rebalance_requests },
 
+	/*
+	 *	Latency aware connection selection
+	 */
+	{ "Latency - Moving average",			test_connection_latency_average },
+	{ "Latency - Connection selection",		test_connection_latency_aware },
+
 	/*
 	 *	Connection spawning tests
 	 */
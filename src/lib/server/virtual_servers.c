@@ -39,6 +39,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/section.h>
 #include <freeradius-devel/server/virtual_servers.h>
 
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/unlang/compile.h>
 #include <freeradius-devel/unlang/function.h>
 
@@ -762,7 +763,53 @@ static int cmd_show_server_list(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx,
 	return 0;
 }
 
+static void cmd_stats_server_latency_print(void *uctx, char const *name, int depth, fr_histogram_t const *h)
+{
+	FILE *fp = uctx;
+
+	/*
+	 *	Don't print module calls which haven't been run.
+	 */
+	if (depth && !h->count) return;
+
+	fprintf(fp, "%*s%s\tcount=%" PRIu64 "\tmean=%" PRIu64 "us\tp50=%" PRIu64 "us\tp90=%" PRIu64 "us"
+		"\tp99=%" PRIu64 "us\tp99.9=%" PRIu64 "us\tmax=%" PRIu64 "us\n",
+		depth * 2, "", name, h->count,
+		fr_histogram_mean(h) / 1000,
+		fr_histogram_percentile(h, 50) / 1000,
+		fr_histogram_percentile(h, 90) / 1000,
+		fr_histogram_percentile(h, 99) / 1000,
+		fr_histogram_percentile(h, 99.9) / 1000,
+		h->max / 1000);
+}
+
+static int cmd_stats_server_latency(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	if (unlang_latency_walk(info->box[0]->vb_strvalue, cmd_stats_server_latency_print, fp) < 0) {
+		fprintf(fp_err, "%s\n", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
 static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "server",
+		.help = "Statistics for virtual servers.",
+		.read_only = true,
+	},
+
+	{
+		.parent = "stats server",
+		.name = "latency",
+		.syntax = "STRING",
+		.func = cmd_stats_server_latency,
+		.help = "Show latency percentiles for the sections, policies and modules in a virtual server.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "show",
 		.name = "server",
@@ -1549,6 +1596,7 @@ int virtual_servers_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
 int virtual_servers_instantiate(void)
 {
 	size_t	i, server_cnt;
+	fr_time_t	start = fr_time();
 
 	/*
 	 *	User didn't specify any "server" sections
@@ -1613,12 +1661,16 @@ int virtual_servers_instantiate(void)
 					.list_def = request_attr_request,
 				},
 			};
+			fr_time_t		compile_start = fr_time();
 
 			fr_assert(parse_rules.attr.dict_def != NULL);
 
 			if (virtual_server_compile_sections(virtual_servers[i], &parse_rules) < 0) {
 				return -1;
 			}
+
+			DEBUG2("Compiled server %s { ... } in %pVs", cf_section_name2(server_cs),
+			       fr_box_time_delta(fr_time_sub(fr_time(), compile_start)));
 		}
 
 		/*
@@ -1666,6 +1718,9 @@ int virtual_servers_instantiate(void)
 		return -1;
 	}
 
+	DEBUG2("Instantiated %zu virtual servers in %pVs", server_cnt,
+	       fr_box_time_delta(fr_time_sub(fr_time(), start)));
+
 	return 0;
 }
 
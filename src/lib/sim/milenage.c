@@ -21,6 +21,8 @@
 #include <string.h>
 
 #include <freeradius-devel/tls/strerror.h>
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/proto.h>
 #include <openssl/evp.h>
 #include "common.h"
@@ -29,14 +31,39 @@
 #define MILENAGE_MAC_A_SIZE	8
 #define MILENAGE_MAC_S_SIZE	8
 
-static inline int aes_128_encrypt_block(EVP_CIPHER_CTX *evp_ctx,
-					uint8_t const key[16], uint8_t const in[16], uint8_t out[16])
+/** Used for every Milenage operation in this thread
+ *
+ * Avoids allocating and freeing a ctx for each vector.
+ */
+static _Thread_local EVP_CIPHER_CTX *milenage_evp_ctx;
+
+static int _milenage_evp_ctx_free_on_exit(void *arg)
 {
-	size_t len = 0;
+	EVP_CIPHER_CTX_free(arg);
+	return 0;
+}
 
-	if (unlikely(EVP_EncryptInit_ex(evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL) != 1)) {
+/** Return this thread's AES-128-ECB context, initialised with the specified key
+ *
+ * The key schedule is only computed once per Milenage operation, all the
+ * blocks for that operation are then encrypted with the same context.
+ */
+static EVP_CIPHER_CTX *aes_128_ctx(uint8_t const key[16])
+{
+	if (unlikely(!milenage_evp_ctx)) {
+		EVP_CIPHER_CTX *ctx;
+
+		ctx = EVP_CIPHER_CTX_new();
+		if (!ctx) {
+			fr_tls_strerror_printf("Failed allocating EVP context");
+			return NULL;
+		}
+		fr_atexit_thread_local(milenage_evp_ctx, _milenage_evp_ctx_free_on_exit, ctx);
+	}
+
+	if (unlikely(EVP_EncryptInit_ex(milenage_evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL) != 1)) {
 		fr_tls_strerror_printf("Failed initialising AES-128-ECB context");
-		return -1;
+		return NULL;
 	}
 
 	/*
@@ -49,14 +76,137 @@ static inline int aes_128_encrypt_block(EVP_CIPHER_CTX *evp_ctx,
 	 *	OpenSSL not to pad here, and not to expected padding
 	 *	when decrypting.
 	 */
-	EVP_CIPHER_CTX_set_padding(evp_ctx, 0);
-	if (unlikely(EVP_EncryptUpdate(evp_ctx, out, (int *)&len, in, 16) != 1) ||
-	    unlikely(EVP_EncryptFinal_ex(evp_ctx, out + len, (int *)&len) != 1)) {
+	EVP_CIPHER_CTX_set_padding(milenage_evp_ctx, 0);
+
+	return milenage_evp_ctx;
+}
+
+/** Encrypt one or more consecutive 16 byte blocks
+ *
+ * Passing multiple blocks in a single call lets OpenSSL interleave them
+ * (AES-NI processes up to eight ECB blocks in parallel).
+ */
+static inline int aes_128_encrypt_blocks(EVP_CIPHER_CTX *evp_ctx, uint8_t const *in, uint8_t *out, size_t blocks)
+{
+	int len = 0;
+
+	if (unlikely(EVP_EncryptUpdate(evp_ctx, out, &len, in, blocks * 16) != 1)) {
 		fr_tls_strerror_printf("Failed encrypting data");
 		return -1;
 	}
 
-	EVP_CIPHER_CTX_reset(evp_ctx);
+	return 0;
+}
+
+/** milenage_f12345 - All Milenage functions, computed in a single pass
+ *
+ * Any output may be NULL, in which case the block for it isn't encrypted.
+ *
+ * @param[out] mac_a		Buffer for MAC-A = 64-bit network authentication code (f1), or NULL
+ * @param[out] mac_s		Buffer for MAC-S = 64-bit resync authentication code (f1*), or NULL
+ * @param[out] res		Buffer for RES = 64-bit signed response (f2), or NULL
+ * @param[out] ik		Buffer for IK = 128-bit integrity key (f4), or NULL
+ * @param[out] ck		Buffer for CK = 128-bit confidentiality key (f3), or NULL
+ * @param[out] ak		Buffer for AK = 48-bit anonymity key (f5), or NULL
+ * @param[out] ak_resync	Buffer for AK = 48-bit anonymity key (f5*), or NULL
+ * @param[in] opc		128-bit value derived from OP and K.
+ * @param[in] k			128-bit subscriber key.
+ * @param[in] rand		128-bit random challenge.
+ * @param[in] sqn		48-bit sequence number.  Only needed for f1 and f1*.
+ * @param[in] amf		16-bit authentication management field.  Only needed for f1 and f1*.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int milenage_f12345(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
+			   uint8_t mac_s[MILENAGE_MAC_S_SIZE],
+			   uint8_t res[MILENAGE_RES_SIZE],
+			   uint8_t ik[MILENAGE_IK_SIZE],
+			   uint8_t ck[MILENAGE_CK_SIZE],
+			   uint8_t ak[MILENAGE_AK_SIZE],
+			   uint8_t ak_resync[MILENAGE_AK_SIZE],
+			   uint8_t const opc[MILENAGE_OPC_SIZE],
+			   uint8_t const k[MILENAGE_KI_SIZE],
+			   uint8_t const rand[MILENAGE_RAND_SIZE],
+			   uint8_t const sqn[MILENAGE_SQN_SIZE],
+			   uint8_t const amf[MILENAGE_AMF_SIZE])
+{
+	uint8_t		temp[16], in1[16];
+	uint8_t		out[5][16];
+	int		f1 = -1, f25 = -1, f3 = -1, f4 = -1, f5s = -1;
+	int		n = 0, i, j;
+	EVP_CIPHER_CTX	*evp_ctx;
+
+	evp_ctx = aes_128_ctx(k);
+	if (!evp_ctx) return -1;
+
+	/* TEMP = E_K(RAND XOR OP_C) */
+	for (i = 0; i < 16; i++) temp[i] = rand[i] ^ opc[i];
+	if (aes_128_encrypt_blocks(evp_ctx, temp, temp, 1) < 0) return -1;
+
+	/*
+	 *	Build the input block for each function we need,
+	 *	then encrypt them all at once.
+	 */
+	if (mac_a || mac_s) {
+		fr_assert(sqn && amf);
+
+		/* IN1 = SQN || AMF || SQN || AMF */
+		memcpy(in1, sqn, 6);
+		memcpy(in1 + 6, amf, 2);
+		memcpy(in1 + 8, in1, 8);
+
+		/*
+		 *	TEMP XOR rot(IN1 XOR OP_C, r1) XOR c1
+		 *
+		 *	r1 = 0x40 = 8 bytes, c1 = ..00, i.e., NOP
+		 */
+		for (i = 0; i < 16; i++) out[n][(i + 8) % 16] = in1[i] ^ opc[i];
+		for (i = 0; i < 16; i++) out[n][i] ^= temp[i];
+		f1 = n++;
+	}
+
+	/* rot(TEMP XOR OP_C, r2) XOR c2, r2 = 0 (NOP), c2 = ..01 */
+	if (res || ak) {
+		for (i = 0; i < 16; i++) out[n][i] = temp[i] ^ opc[i];
+		out[n][15] ^= 1;
+		f25 = n++;
+	}
+
+	/* rot(TEMP XOR OP_C, r3) XOR c3, r3 = 0x20 = 4 bytes, c3 = ..02 */
+	if (ck) {
+		for (i = 0; i < 16; i++) out[n][(i + 12) % 16] = temp[i] ^ opc[i];
+		out[n][15] ^= 2;
+		f3 = n++;
+	}
+
+	/* rot(TEMP XOR OP_C, r4) XOR c4, r4 = 0x40 = 8 bytes, c4 = ..04 */
+	if (ik) {
+		for (i = 0; i < 16; i++) out[n][(i + 8) % 16] = temp[i] ^ opc[i];
+		out[n][15] ^= 4;
+		f4 = n++;
+	}
+
+	/* rot(TEMP XOR OP_C, r5) XOR c5, r5 = 0x60 = 12 bytes, c5 = ..08 */
+	if (ak_resync) {
+		for (i = 0; i < 16; i++) out[n][(i + 4) % 16] = temp[i] ^ opc[i];
+		out[n][15] ^= 8;
+		f5s = n++;
+	}
+
+	if (n == 0) return 0;
+
+	/* OUTx = E_K(...) XOR OP_C */
+	if (aes_128_encrypt_blocks(evp_ctx, out[0], out[0], n) < 0) return -1;
+	for (j = 0; j < n; j++) for (i = 0; i < 16; i++) out[j][i] ^= opc[i];
+
+	if (mac_a) memcpy(mac_a, out[f1], 8);		/* f1 */
+	if (mac_s) memcpy(mac_s, out[f1] + 8, 8);	/* f1* */
+	if (res) memcpy(res, out[f25] + 8, 8);		/* f2 */
+	if (ak) memcpy(ak, out[f25], 6);		/* f5 */
+	if (ck) memcpy(ck, out[f3], 16);		/* f3 */
+	if (ik) memcpy(ik, out[f4], 16);		/* f4 */
+	if (ak_resync) memcpy(ak_resync, out[f5s], 6);	/* f5* */
 
 	return 0;
 }
@@ -82,56 +232,7 @@ static int milenage_f1(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
 		       uint8_t const sqn[MILENAGE_SQN_SIZE],
 		       uint8_t const amf[MILENAGE_AMF_SIZE])
 {
-	uint8_t		tmp1[16], tmp2[16], tmp3[16];
-	int		i;
-	EVP_CIPHER_CTX	*evp_ctx;
-
-	/* tmp1 = TEMP = E_K(RAND XOR OP_C) */
-	for (i = 0; i < 16; i++) tmp1[i] = rand[i] ^ opc[i];
-
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		fr_tls_strerror_printf("Failed allocating EVP context");
-		return -1;
-	}
-
- 	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp1) < 0) {
- 	error:
-		EVP_CIPHER_CTX_free(evp_ctx);
-		return -1;
- 	}
-
-	/* tmp2 = IN1 = SQN || AMF || SQN || AMF */
-	memcpy(tmp2, sqn, 6);
-	memcpy(tmp2 + 6, amf, 2);
-	memcpy(tmp2 + 8, tmp2, 8);
-
-	/* OUT1 = E_K(TEMP XOR rot(IN1 XOR OP_C, r1) XOR c1) XOR OP_C */
-
-	/*
-	 *  rotate (tmp2 XOR OP_C) by r1 (= 0x40 = 8 bytes)
-	 */
-	for (i = 0; i < 16; i++) tmp3[(i + 8) % 16] = tmp2[i] ^ opc[i];
-
-	/*
-	 *  XOR with TEMP = E_K(RAND XOR OP_C)
-	 */
-	for (i = 0; i < 16; i++) tmp3[i] ^= tmp1[i];
-	/* XOR with c1 (= ..00, i.e., NOP) */
-
-	/*
-	 *	f1 || f1* = E_K(tmp3) XOR OP_c
-	 */
- 	if (aes_128_encrypt_block(evp_ctx, k, tmp3, tmp1) < 0) goto error; /* Reuses existing key */
-
-	for (i = 0; i < 16; i++) tmp1[i] ^= opc[i];
-
-	if (mac_a) memcpy(mac_a, tmp1, 8);	/* f1 */
-	if (mac_s) memcpy(mac_s, tmp1 + 8, 8);	/* f1* */
-
-	EVP_CIPHER_CTX_free(evp_ctx);
-
-	return 0;
+	return milenage_f12345(mac_a, mac_s, NULL, NULL, NULL, NULL, NULL, opc, k, rand, sqn, amf);
 }
 
 /** milenage_f2345 - Milenage f2, f3, f4, f5, f5* algorithms
@@ -157,77 +258,7 @@ static int milenage_f2345(uint8_t res[MILENAGE_RES_SIZE],
 			  uint8_t const k[MILENAGE_KI_SIZE],
 			  uint8_t const rand[MILENAGE_RAND_SIZE])
 {
-	uint8_t			tmp1[16], tmp2[16], tmp3[16];
-	int			i;
-	EVP_CIPHER_CTX		*evp_ctx;
-
-	/* tmp2 = TEMP = E_K(RAND XOR OP_C) */
-	for (i = 0; i < 16; i++) tmp1[i] = rand[i] ^ opc[i];
-
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		fr_tls_strerror_printf("Failed allocating EVP context");
-		return -1;
-	}
-
-	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp2) < 0) {
-	error:
-		EVP_CIPHER_CTX_free(evp_ctx);
-		return -1;
-	}
-
-	/* OUT2 = E_K(rot(TEMP XOR OP_C, r2) XOR c2) XOR OP_C */
-	/* OUT3 = E_K(rot(TEMP XOR OP_C, r3) XOR c3) XOR OP_C */
-	/* OUT4 = E_K(rot(TEMP XOR OP_C, r4) XOR c4) XOR OP_C */
-	/* OUT5 = E_K(rot(TEMP XOR OP_C, r5) XOR c5) XOR OP_C */
-
-	/* f2 and f5 */
-	/* rotate by r2 (= 0, i.e., NOP) */
-	for (i = 0; i < 16; i++) tmp1[i] = tmp2[i] ^ opc[i];
-	tmp1[15] ^= 1; /* XOR c2 (= ..01) */
-	/* f5 || f2 = E_K(tmp1) XOR OP_c */
-
-	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp3) < 0) goto error;
-
-	for (i = 0; i < 16; i++) tmp3[i] ^= opc[i];
-	if (res) memcpy(res, tmp3 + 8, 8); /* f2 */
-	if (ak) memcpy(ak, tmp3, 6); /* f5 */
-
-	/* f3 */
-	if (ck) {
-		/* rotate by r3 = 0x20 = 4 bytes */
-		for (i = 0; i < 16; i++) tmp1[(i + 12) % 16] = tmp2[i] ^ opc[i];
-		tmp1[15] ^= 2; /* XOR c3 (= ..02) */
-
-		if (aes_128_encrypt_block(evp_ctx, k, tmp1, ck) < 0) goto error;
-
-		for (i = 0; i < 16; i++) ck[i] ^= opc[i];
-	}
-
-	/* f4 */
-	if (ik) {
-		/* rotate by r4 = 0x40 = 8 bytes */
-		for (i = 0; i < 16; i++) tmp1[(i + 8) % 16] = tmp2[i] ^ opc[i];
-		tmp1[15] ^= 4; /* XOR c4 (= ..04) */
-
-		if (aes_128_encrypt_block(evp_ctx, k, tmp1, ik) < 0) goto error;
-
-		for (i = 0; i < 16; i++) ik[i] ^= opc[i];
-	}
-
-	/* f5* */
-	if (ak_resync) {
-		/* rotate by r5 = 0x60 = 12 bytes */
-		for (i = 0; i < 16; i++) tmp1[(i + 4) % 16] = tmp2[i] ^ opc[i];
-		tmp1[15] ^= 8; /* XOR c5 (= ..08) */
-
-		if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp1) < 0) goto error;
-
-		for (i = 0; i < 6; i++) ak_resync[i] = tmp1[i] ^ opc[i];
-	}
-	EVP_CIPHER_CTX_free(evp_ctx);
-
-	return 0;
+	return milenage_f12345(NULL, NULL, res, ik, ck, ak, ak_resync, opc, k, rand, NULL, NULL);
 }
 
 /** Derive OPc from OP and Ki
@@ -244,19 +275,13 @@ int milenage_opc_generate(uint8_t opc[MILENAGE_OPC_SIZE],
 			  uint8_t const op[MILENAGE_OP_SIZE],
 			  uint8_t const ki[MILENAGE_KI_SIZE])
 {
-	int		ret;
 	uint8_t		tmp[MILENAGE_OPC_SIZE];
 	EVP_CIPHER_CTX	*evp_ctx;
 	size_t		i;
 
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		fr_tls_strerror_printf("Failed allocating EVP context");
-		return -1;
-	}
- 	ret = aes_128_encrypt_block(evp_ctx, ki, op, tmp);
- 	EVP_CIPHER_CTX_free(evp_ctx);
-	if (ret < 0) return ret;
+	evp_ctx = aes_128_ctx(ki);
+	if (!evp_ctx) return -1;
+	if (aes_128_encrypt_blocks(evp_ctx, op, tmp, 1) < 0) return -1;
 
  	for (i = 0; i < sizeof(tmp); i++) opc[i] = op[i] ^ tmp[i];
 
@@ -295,9 +320,8 @@ int milenage_umts_generate(uint8_t autn[MILENAGE_AUTN_SIZE],
 	uint8_t		*p = autn;
 	size_t		i;
 
-	if ((milenage_f1(mac_a, NULL, opc, ki, rand,
-			 uint48_to_buff(sqn_buff, sqn), amf) < 0) ||
-	    (milenage_f2345(res, ik, ck, ak_buff, NULL, opc, ki, rand) < 0)) return -1;
+	if (milenage_f12345(mac_a, NULL, res, ik, ck, ak_buff, NULL, opc, ki, rand,
+			    uint48_to_buff(sqn_buff, sqn), amf) < 0) return -1;
 
 	/*
 	 *	AUTN = (SQN ^ AK) || AMF || MAC_A
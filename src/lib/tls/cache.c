@@ -36,6 +36,8 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/unlang/subrequest.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/nbo.h>
 
 #include "attrs.h"
 #include "base.h"
@@ -46,6 +48,10 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #include <openssl/ssl.h>
 #include <openssl/kdf.h>
+#include <openssl/core_names.h>
+#include <openssl/rand.h>
+
+#include <pthread.h>
 
 /** Retrieve session ID (in binary form) from the session
  *
@@ -160,6 +166,223 @@ void _tls_cache_clear_state_reset(request_t *request, fr_tls_cache_t *cache, cha
 }
 #define tls_cache_clear_state_reset(_request, _cache) _tls_cache_clear_state_reset(_request, _cache, __FUNCTION__)
 
+/** When a session can no longer be resumed
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_time_t tls_cache_expires(SSL_SESSION *sess)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30400000L
+	return fr_time_from_sec((time_t)(SSL_SESSION_get_time_ex(sess) + SSL_get_timeout(sess)));
+#else
+	return fr_time_from_sec((time_t)(SSL_SESSION_get_time(sess) + SSL_get_timeout(sess)));
+#endif
+}
+
+/*
+ *	Local session cache
+ *
+ *	Serialised sessions are kept in memory, and shared between all
+ *	the threads of the process.  Loads which hit the local cache
+ *	don't need a subrequest, and the virtual server (which may
+ *	share sessions between servers) is only called on a miss.
+ *
+ *	The cache is split into shards, each with its own lock and
+ *	LRU list, so that threads resuming different sessions rarely
+ *	contend.
+ */
+#define TLS_CACHE_LOCAL_SHARDS	16
+
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the shard's LRU list.
+	fr_time_t		expires;		//!< When the session can no longer be resumed.
+	uint8_t const		*id;			//!< Session ID.
+	size_t			id_len;			//!< Length of the session ID.
+	uint8_t			*data;			//!< Serialised session.
+} tls_cache_local_entry_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the table and the LRU list.
+	fr_hash_table_t		*ht;			//!< Entries by session ID.
+	fr_dlist_head_t		lru;			//!< Most recently used entries at the head.
+	uint32_t		max_entries;		//!< Before the least recently used entries are evicted.
+} tls_cache_local_shard_t;
+
+struct fr_tls_cache_local_s {
+	tls_cache_local_shard_t	shard[TLS_CACHE_LOCAL_SHARDS];
+};
+
+static uint32_t tls_cache_local_hash(void const *data)
+{
+	tls_cache_local_entry_t const *e = data;
+
+	return fr_hash(e->id, e->id_len);
+}
+
+static int8_t tls_cache_local_cmp(void const *one, void const *two)
+{
+	tls_cache_local_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->id_len, b->id_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->id, b->id, a->id_len);
+	return CMP(ret, 0);
+}
+
+static inline CC_HINT(always_inline)
+tls_cache_local_shard_t *tls_cache_local_shard(fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len)
+{
+	return &local->shard[fr_hash(id, id_len) % TLS_CACHE_LOCAL_SHARDS];
+}
+
+/** Remove and free an entry
+ *
+ * @note Must be called with the shard locked.
+ */
+static inline CC_HINT(always_inline)
+void tls_cache_local_entry_remove(tls_cache_local_shard_t *shard, tls_cache_local_entry_t *e)
+{
+	fr_dlist_remove(&shard->lru, e);
+	fr_hash_table_delete(shard->ht, e);	/* Frees e */
+}
+
+static void tls_cache_local_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static int _tls_cache_local_free(fr_tls_cache_local_t *local)
+{
+	size_t i;
+
+	for (i = 0; i < TLS_CACHE_LOCAL_SHARDS; i++) {
+		talloc_free(local->shard[i].ht);
+		pthread_mutex_destroy(&local->shard[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate a local session cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	the cache can hold.
+ * @return A new local session cache.
+ */
+fr_tls_cache_local_t *fr_tls_cache_local_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	fr_tls_cache_local_t	*local;
+	size_t			i;
+
+	MEM(local = talloc_zero(ctx, fr_tls_cache_local_t));
+	for (i = 0; i < TLS_CACHE_LOCAL_SHARDS; i++) {
+		tls_cache_local_shard_t *shard = &local->shard[i];
+
+		pthread_mutex_init(&shard->mutex, NULL);
+		fr_dlist_talloc_init(&shard->lru, tls_cache_local_entry_t, entry);
+
+		/*
+		 *	Not parented by the cache, as entries are
+		 *	added and removed by any thread.
+		 */
+		MEM(shard->ht = fr_hash_table_alloc(NULL, tls_cache_local_hash, tls_cache_local_cmp,
+						    tls_cache_local_entry_free));
+		shard->max_entries = (max_entries + TLS_CACHE_LOCAL_SHARDS - 1) / TLS_CACHE_LOCAL_SHARDS;
+	}
+	talloc_set_destructor(local, _tls_cache_local_free);
+
+	return local;
+}
+
+/** Retrieve a copy of a serialised session from the local cache
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] local	cache to search.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ * @return
+ *	- A copy of the serialised session.
+ *	- NULL if there's no unexpired session with that ID.
+ */
+static uint8_t *tls_cache_local_load(TALLOC_CTX *ctx, fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len)
+{
+	tls_cache_local_shard_t	*shard = tls_cache_local_shard(local, id, id_len);
+	tls_cache_local_entry_t	*e;
+	uint8_t			*data = NULL;
+
+	pthread_mutex_lock(&shard->mutex);
+	e = fr_hash_table_find(shard->ht, &(tls_cache_local_entry_t){ .id = id, .id_len = id_len });
+	if (e) {
+		if (fr_time_lteq(e->expires, fr_time())) {
+			tls_cache_local_entry_remove(shard, e);
+		} else {
+			fr_dlist_remove(&shard->lru, e);
+			fr_dlist_insert_head(&shard->lru, e);
+			MEM(data = talloc_typed_memdup(ctx, e->data, talloc_array_length(e->data)));
+		}
+	}
+	pthread_mutex_unlock(&shard->mutex);
+
+	return data;
+}
+
+/** Add a serialised session to the local cache, replacing any existing entry
+ *
+ * @param[in] local	cache to add the session to.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ * @param[in] data	Serialised session.
+ * @param[in] data_len	Length of the serialised session.
+ * @param[in] expires	When the session can no longer be resumed.
+ */
+static void tls_cache_local_store(fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len,
+				  uint8_t const *data, size_t data_len, fr_time_t expires)
+{
+	tls_cache_local_shard_t	*shard = tls_cache_local_shard(local, id, id_len);
+	tls_cache_local_entry_t	*e, *old;
+
+	MEM(e = talloc_zero(NULL, tls_cache_local_entry_t));
+	MEM(e->id = talloc_typed_memdup(e, id, id_len));
+	e->id_len = id_len;
+	MEM(e->data = talloc_typed_memdup(e, data, data_len));
+	e->expires = expires;
+
+	pthread_mutex_lock(&shard->mutex);
+	old = fr_hash_table_find(shard->ht, e);
+	if (old) tls_cache_local_entry_remove(shard, old);
+
+	if (!fr_hash_table_insert(shard->ht, e)) {
+		pthread_mutex_unlock(&shard->mutex);
+		talloc_free(e);
+		return;
+	}
+	fr_dlist_insert_head(&shard->lru, e);
+
+	while (fr_dlist_num_elements(&shard->lru) > shard->max_entries) {
+		tls_cache_local_entry_remove(shard, fr_dlist_tail(&shard->lru));
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Remove a session from the local cache
+ *
+ * @param[in] local	cache to remove the session from.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ */
+static void tls_cache_local_clear(fr_tls_cache_local_t *local, uint8_t const *id, size_t id_len)
+{
+	tls_cache_local_shard_t	*shard = tls_cache_local_shard(local, id, id_len);
+	tls_cache_local_entry_t	*e;
+
+	pthread_mutex_lock(&shard->mutex);
+	e = fr_hash_table_find(shard->ht, &(tls_cache_local_entry_t){ .id = id, .id_len = id_len });
+	if (e) tls_cache_local_entry_remove(shard, e);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
 /** Serialize the session-state list and store it in the SSL_SESSION *
  *
  */
@@ -338,45 +561,37 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 	if (tls_session->can_pause) ASYNC_pause_job();
 }
 
-/** Process the result of `load session { ... }`
+/** Deserialise session data, and make it available to #tls_cache_load_cb
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The current TLS session.
+ * @param[in] data		Serialised session.
+ * @param[in] data_len		Length of the serialised session.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the session couldn't be deserialised.
  */
-static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
-					     request_t *request, void *uctx)
+static int tls_cache_session_deserialise(request_t *request, fr_tls_session_t *tls_session,
+					 uint8_t const *data, size_t data_len)
 {
-	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
 	fr_tls_cache_t		*tls_cache = tls_session->cache;
-	fr_pair_t		*vp;
 	uint8_t const		*q, **p;
 	SSL_SESSION		*sess;
 
-	vp = fr_pair_find_by_da(&request->reply_pairs, NULL, attr_tls_packet_type);
-	if (!vp || (vp->vp_uint32 != enum_tls_packet_type_success->vb_uint32)) {
-		RWDEBUG("Failed acquiring session data");
-	error:
-		tls_cache->load.state = FR_TLS_CACHE_LOAD_FAILED;
-		return UNLANG_ACTION_CALCULATE_RESULT;
-	}
-
-	vp = fr_pair_find_by_da(&request->reply_pairs, NULL, attr_tls_session_data);
-	if (!vp) {
-		RWDEBUG("No cached session found");
-		goto error;
-	}
-
-	q = vp->vp_octets;	/* openssl will mutate q, so we can't use vp_octets directly */
+	q = data;	/* openssl will mutate q, so we can't use data directly */
 	p = (unsigned char const **)&q;
 
-	sess = d2i_SSL_SESSION(NULL, p, vp->vp_length);
+	sess = d2i_SSL_SESSION(NULL, p, data_len);
 	if (!sess) {
 		fr_tls_log(request, "Failed loading persisted session");
-		goto error;
+		return -1;
 	}
 
 	if (RDEBUG_ENABLED3) {
 		SESSION_ID(sess_id, sess);
 
 		RDEBUG3("Session ID %pV - Read %zu bytes of data.  "
-			"Session de-serialized successfully", &sess_id, vp->vp_length);
+			"Session de-serialized successfully", &sess_id, data_len);
 		SSL_SESSION_print(fr_tls_request_log_bio(request, L_DBG, L_DBG_LVL_3), sess);
 	}
 
@@ -394,9 +609,86 @@ static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSE
 	tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
 	tls_cache->load.sess = sess;	/* This is consumed in tls_cache_load_cb */
 
+	return 0;
+}
+
+/** Process the result of `load session { ... }`
+ */
+static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					     request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	fr_tls_cache_t		*tls_cache = tls_session->cache;
+	fr_tls_conf_t		*conf = fr_tls_session_conf(tls_session->ssl);
+	fr_pair_t		*vp;
+
+	vp = fr_pair_find_by_da(&request->reply_pairs, NULL, attr_tls_packet_type);
+	if (!vp || (vp->vp_uint32 != enum_tls_packet_type_success->vb_uint32)) {
+		RWDEBUG("Failed acquiring session data");
+	error:
+		tls_cache->load.state = FR_TLS_CACHE_LOAD_FAILED;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	vp = fr_pair_find_by_da(&request->reply_pairs, NULL, attr_tls_session_data);
+	if (!vp) {
+		RWDEBUG("No cached session found");
+		goto error;
+	}
+
+	if (tls_cache_session_deserialise(request, tls_session, vp->vp_octets, vp->vp_length) < 0) goto error;
+
+	/*
+	 *	Keep a copy locally, so the next resumption
+	 *	doesn't need to call the virtual server.
+	 */
+	if (conf->cache.local) {
+		unsigned int	id_len;
+		uint8_t const	*id = SSL_SESSION_get_id(tls_cache->load.sess, &id_len);
+
+		tls_cache_local_store(conf->cache.local, id, id_len, vp->vp_octets, vp->vp_length,
+				      tls_cache_expires(tls_cache->load.sess));
+	}
+
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** Load session data from the local cache
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The current TLS session.
+ * @return
+ *	- 0 if the session was found.
+ *	- -1 if it wasn't, or couldn't be deserialised.
+ */
+static int tls_cache_local_session_load(request_t *request, fr_tls_session_t *tls_session)
+{
+	fr_tls_cache_t		*tls_cache = tls_session->cache;
+	fr_tls_conf_t		*conf = fr_tls_session_conf(tls_session->ssl);
+	uint8_t			*data;
+	int			ret;
+
+	data = tls_cache_local_load(request, conf->cache.local,
+				    tls_cache->load.id, talloc_array_length(tls_cache->load.id));
+	if (!data) {
+		RDEBUG3("Session ID %pV - Not found in local cache", fr_box_octets_buffer(tls_cache->load.id));
+		return -1;
+	}
+
+	RDEBUG2("Session ID %pV - Found in local cache", fr_box_octets_buffer(tls_cache->load.id));
+
+	ret = tls_cache_session_deserialise(request, tls_session, data, talloc_array_length(data));
+	talloc_free(data);
+
+	/*
+	 *	Don't try and load it again.
+	 */
+	if (ret < 0) tls_cache_local_clear(conf->cache.local,
+					   tls_cache->load.id, talloc_array_length(tls_cache->load.id));
+
+	return ret;
+}
+
 /** Push a `load session { ... }` call into the current request, using a subrequest
  *
  * @param[in] request		The current request.
@@ -492,11 +784,7 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	fr_pair_t		*vp;
 	SSL_SESSION		*sess = tls_session->cache->store.sess;
 	unlang_action_t		ua;
-#if OPENSSL_VERSION_NUMBER >= 0x30400000L
-	fr_time_t		expires = fr_time_from_sec((time_t)(SSL_SESSION_get_time_ex(sess) + SSL_get_timeout(sess)));
-#else
-	fr_time_t		expires = fr_time_from_sec((time_t)(SSL_SESSION_get_time(sess) + SSL_get_timeout(sess)));
-#endif
+	fr_time_t		expires = tls_cache_expires(sess);
 	fr_time_t		now = fr_time();
 
 	fr_assert(tls_cache->store.sess);
@@ -516,29 +804,6 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	 */
 	if (tls_cache_app_data_set(request, sess) < 0) return UNLANG_ACTION_FAIL;
 
-	MEM(child = unlang_subrequest_alloc(request, dict_tls));
-	request = child;
-
-	/*
-	 *	Setup the child request for storing
-	 *	session resumption data.
-	 */
-	MEM(pair_prepend_request(&vp, attr_tls_packet_type) >= 0);
-	vp->vp_uint32 = enum_tls_packet_type_store_session->vb_uint32;
-
-	/*
-	 *	Add the session identifier we're trying
-	 *	to store.
-	 */
-	MEM(pair_update_request(&vp, attr_tls_session_id) >= 0);
-	fr_pair_value_memdup_buffer_shallow(vp, fr_tls_cache_id(vp, sess), true);
-
-	/*
-	 *	How long the session has to live
-	 */
-	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
-	vp->vp_time_delta = fr_time_sub(expires, now);
-
 	/*
 	 *	Serialize the session
 	 */
@@ -553,12 +818,10 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 			 "required buffer length", &id);
 	error:
 		tls_cache_store_state_reset(request, tls_cache);
-		talloc_free(child);
 		return UNLANG_ACTION_FAIL;
 	}
 
-	MEM(pair_update_request(&vp, attr_tls_session_data) >= 0);
-	MEM(data = talloc_array(vp, uint8_t, len));
+	MEM(data = talloc_array(request, uint8_t, len));
 
 	/* openssl mutates &p */
 	p = data;
@@ -572,14 +835,62 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 		talloc_free(data);
 		goto error;
 	}
-	fr_pair_value_memdup_buffer_shallow(vp, data, true);
+
+	if (conf->cache.local) {
+		unsigned int	id_len;
+		uint8_t const	*id = SSL_SESSION_get_id(sess, &id_len);
+
+		tls_cache_local_store(conf->cache.local, id, id_len, data, len, expires);
+
+		/*
+		 *	Nothing else to do if the sessions
+		 *	are only held locally.
+		 */
+		if (!conf->cache.virtual_server_cache) {
+			RDEBUG2("Session ID %pV - Stored in local cache", fr_box_octets(id, id_len));
+			talloc_free(data);
+			tls_cache_store_state_reset(request, tls_cache);
+			tls_cache->store.state = FR_TLS_CACHE_STORE_PERSISTED;	/* Avoid spurious clear calls */
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+	}
+
+	MEM(child = unlang_subrequest_alloc(request, dict_tls));
+	request = child;
+
+	/*
+	 *	Setup the child request for storing
+	 *	session resumption data.
+	 */
+	MEM(pair_prepend_request(&vp, attr_tls_packet_type) >= 0);
+	vp->vp_uint32 = enum_tls_packet_type_store_session->vb_uint32;
+
+	/*
+	 *	Add the session identifier we're trying
+	 *	to store.
+	 */
+	MEM(pair_update_request(&vp, attr_tls_session_id) >= 0);
+	fr_pair_value_memdup_buffer_shallow(vp, fr_tls_cache_id(vp, sess), true);
+
+	/*
+	 *	How long the session has to live
+	 */
+	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
+	vp->vp_time_delta = fr_time_sub(expires, now);
+
+	MEM(pair_update_request(&vp, attr_tls_session_data) >= 0);
+	fr_pair_value_memdup_buffer_shallow(vp, talloc_steal(vp, data), true);
 
 	/*
 	 *	Allocate a child, and set it up to call
 	 *      the TLS virtual server.
 	 */
 	ua = fr_tls_call_push(child, tls_cache_store_result, conf, tls_session);
-	if (ua < 0) goto error;
+	if (ua < 0) {
+		tls_cache_store_state_reset(request, tls_cache);
+		talloc_free(child);
+		return UNLANG_ACTION_FAIL;
+	}
 
 	return ua;
 }
@@ -676,6 +987,15 @@ unlang_action_t fr_tls_cache_pending_push(request_t *request, fr_tls_session_t *
 	 *	Load stateful session data
 	 */
 	if (tls_cache->load.state == FR_TLS_CACHE_LOAD_REQUESTED) {
+		if (conf->cache.local && (tls_cache_local_session_load(request, tls_session) == 0)) {
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
+		if (!conf->cache.virtual_server_cache) {
+			tls_cache->load.state = FR_TLS_CACHE_LOAD_FAILED;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
 		return tls_cache_load_push(request, tls_session);
 	}
 
@@ -700,7 +1020,14 @@ unlang_action_t fr_tls_cache_pending_push(request_t *request, fr_tls_session_t *
 			}
 		}
 
-		return tls_cache_clear_push(request, conf, tls_session);
+		if (conf->cache.local) {
+			tls_cache_local_clear(conf->cache.local,
+					      tls_cache->clear.id, talloc_array_length(tls_cache->clear.id));
+		}
+
+		if (conf->cache.virtual_server_cache) return tls_cache_clear_push(request, conf, tls_session);
+
+		tls_cache_clear_state_reset(request, tls_cache);
 	}
 
 	if (tls_cache->store.state == FR_TLS_CACHE_STORE_REQUESTED) {
@@ -1356,6 +1683,155 @@ static SSL_TICKET_RETURN tls_cache_session_ticket_app_data_get(SSL *ssl, SSL_SES
 	return (status == SSL_TICKET_SUCCESS_RENEW) ? SSL_TICKET_RETURN_USE_RENEW : SSL_TICKET_RETURN_USE;
 }
 
+#define TICKET_KEY_LABEL "freeradius-session-ticket"
+
+/** Session ticket keys used when keys are rotated
+ *
+ */
+typedef struct {
+	uint8_t			name[16];		//!< Identifies the key the ticket was encrypted with.
+	uint8_t			aes_key[32];		//!< Encrypts the ticket.
+	uint8_t			hmac_key[32];		//!< Authenticates the ticket.
+} tls_cache_ticket_key_t;
+
+/** Derive session ticket key material from session_ticket_key
+ *
+ * @param[out] out		Where to write the key material.
+ * @param[in] outlen		How much key material to derive.
+ * @param[in] cache_conf	containing the session_ticket_key.
+ * @param[in] info		HKDF label.
+ * @param[in] info_len		Length of the label.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_ticket_key_derive(uint8_t *out, size_t outlen, fr_tls_cache_conf_t const *cache_conf,
+				       uint8_t const *info, size_t info_len)
+{
+	EVP_PKEY_CTX *pkey_ctx = NULL;
+
+	if (unlikely((pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising KDF");
+	error:
+		if (pkey_ctx) EVP_PKEY_CTX_free(pkey_ctx);
+		return -1;
+	}
+	if (unlikely(EVP_PKEY_derive_init(pkey_ctx) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising KDF derivation ctx");
+		goto error;
+	}
+	if (unlikely(EVP_PKEY_CTX_set_hkdf_md(pkey_ctx, UNCONST(struct evp_md_st *, EVP_sha256())) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF MD");
+		goto error;
+	}
+	if (unlikely(EVP_PKEY_CTX_set1_hkdf_key(pkey_ctx,
+						UNCONST(unsigned char *, cache_conf->session_ticket_key),
+						talloc_array_length(cache_conf->session_ticket_key)) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF key");
+		goto error;
+	}
+	if (unlikely(EVP_PKEY_CTX_add1_hkdf_info(pkey_ctx, UNCONST(unsigned char *, info), info_len) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF label");
+		goto error;
+	}
+	if (unlikely(EVP_PKEY_derive(pkey_ctx, out, &outlen) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed deriving session ticket key");
+		goto error;
+	}
+	EVP_PKEY_CTX_free(pkey_ctx);
+
+	return 0;
+}
+
+/** Derive the session ticket key for a rotation period
+ *
+ * @param[out] key		Where to write the key.
+ * @param[in] cache_conf	containing the session_ticket_key.
+ * @param[in] epoch		Number of rotation periods since the unix epoch.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_ticket_key_epoch(tls_cache_ticket_key_t *key, fr_tls_cache_conf_t const *cache_conf, uint64_t epoch)
+{
+	uint8_t info[sizeof(TICKET_KEY_LABEL) - 1 + sizeof(uint64_t)];
+
+	memcpy(info, TICKET_KEY_LABEL, sizeof(TICKET_KEY_LABEL) - 1);
+	fr_nbo_from_uint64(info + sizeof(TICKET_KEY_LABEL) - 1, epoch);
+
+	return tls_cache_ticket_key_derive((uint8_t *)key, sizeof(*key), cache_conf, info, sizeof(info));
+}
+
+/** Select the key to encrypt or decrypt a session ticket with
+ *
+ * A new key is used every session_ticket_key_rotation.  Tickets
+ * encrypted with the previous key are still accepted, and are
+ * replaced with a ticket using the current key.  Tickets using
+ * the next key are accepted too, in case another server's clock
+ * is slightly ahead of ours.
+ *
+ * @return
+ *	- -1 on error.
+ *	- 0 if the ticket's key is unknown, and a full handshake is needed.
+ *	- 1 if the ticket was encrypted, or can be decrypted.
+ *	- 2 if the ticket can be decrypted, and should be renewed.
+ */
+static int tls_cache_session_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+					   EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc)
+{
+	fr_tls_conf_t		*conf = fr_tls_session_conf(ssl);
+	fr_tls_cache_conf_t const *cache_conf = &conf->cache;
+	uint64_t		epoch;
+	tls_cache_ticket_key_t	key;
+	OSSL_PARAM		params[3];
+	int			ret = 1;
+
+	epoch = (uint64_t)fr_time_to_sec(fr_time()) / (uint64_t)fr_time_delta_to_sec(cache_conf->session_ticket_key_rotation);
+
+	if (enc) {
+		if (tls_cache_ticket_key_epoch(&key, cache_conf, epoch) < 0) return -1;
+
+		if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1) goto error;
+		if (EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) goto error;
+		memcpy(key_name, key.name, sizeof(key.name));
+	} else {
+		static int8_t const	offsets[] = { 0, -1, 1 };
+		size_t			i;
+
+		for (i = 0; i < NUM_ELEMENTS(offsets); i++) {
+			if (tls_cache_ticket_key_epoch(&key, cache_conf, epoch + offsets[i]) < 0) return -1;
+			if (memcmp(key_name, key.name, sizeof(key.name)) == 0) break;
+		}
+		if (i == NUM_ELEMENTS(offsets)) {
+			memset_explicit(&key, 0, sizeof(key));
+			return 0;
+		}
+		if (offsets[i] < 0) ret = 2;
+
+		if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) goto error;
+	}
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, UNCONST(char *, "SHA256"), 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (EVP_MAC_CTX_set_params(hctx, params) != 1) {
+	error:
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising session ticket encryption");
+		memset_explicit(&key, 0, sizeof(key));
+		return -1;
+	}
+	memset_explicit(&key, 0, sizeof(key));
+
+	return ret;
+}
+
 /** Sets callbacks and flags on a SSL_CTX to enable/disable session resumption
  *
  * @param[in] ctx			to modify.
@@ -1405,84 +1881,66 @@ int fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf)
 		FALL_THROUGH;
 
 	case FR_TLS_CACHE_STATELESS:
-	{
-		size_t key_len;
-		uint8_t *key_buff;
-		EVP_PKEY_CTX *pkey_ctx = NULL;
-
 		if (!(cache_conf->mode & FR_TLS_CACHE_STATEFUL)) tls_cache_disable_statefull_resumption(ctx);
 
 		/*
-		 *	If keys is NULL, then OpenSSL returns the expected
-		 *	key length, which may be different across different
-		 *	flavours/versions of OpenSSL.
-		 *
-		 *	We could calculate this in conf.c, but, if in future
-		 *	OpenSSL decides to use different key lengths based
-		 *	on other parameters in the ctx, that'd break.
+		 *	Keys are derived from session_ticket_key as
+		 *	tickets are issued and decrypted, so all
+		 *	servers with the same session_ticket_key
+		 *	rotate to the same key at the same time.
 		 */
-		key_len = SSL_CTX_set_tlsext_ticket_keys(ctx, NULL, 0);
+		if (fr_time_delta_ispos(cache_conf->session_ticket_key_rotation)) {
+			if (fr_time_delta_lt(cache_conf->session_ticket_key_rotation, fr_time_delta_from_sec(1))) {
+				ERROR("session_ticket_key_rotation must be at least 1s");
+				return -1;
+			}
 
-		if (unlikely((pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed initialising KDF");
-		kdf_error:
-			if (pkey_ctx) EVP_PKEY_CTX_free(pkey_ctx);
-			return -1;
-		}
-		if (unlikely(EVP_PKEY_derive_init(pkey_ctx) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed initialising KDF derivation ctx");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_set_hkdf_md(pkey_ctx, UNCONST(struct evp_md_st *, EVP_sha256())) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF MD");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_set1_hkdf_key(pkey_ctx,
-							UNCONST(unsigned char *, cache_conf->session_ticket_key),
-							talloc_array_length(cache_conf->session_ticket_key)) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF key");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_add1_hkdf_info(pkey_ctx,
-							 UNCONST(unsigned char *, "freeradius-session-ticket"),
-							 sizeof("freeradius-session-ticket") - 1) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF label");
-			goto kdf_error;
-		}
+			if (unlikely(SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tls_cache_session_ticket_key_cb) != 1)) {
+				fr_tls_strerror_printf(NULL);
+				PERROR("Failed setting session ticket key callback");
+				return -1;
+			}
+		} else {
+			size_t key_len;
+			uint8_t *key_buff;
 
-		/*
-		 *	SSL_CTX_set_tlsext_ticket_keys memcpys its
-		 *	inputs so this is just a temporary buffer.
-		 */
-		MEM(key_buff = talloc_array(NULL, uint8_t, key_len));
-		if (EVP_PKEY_derive(pkey_ctx, key_buff, &key_len) != 1) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed deriving session ticket key");
+			/*
+			 *	If keys is NULL, then OpenSSL returns the expected
+			 *	key length, which may be different across different
+			 *	flavours/versions of OpenSSL.
+			 *
+			 *	We could calculate this in conf.c, but, if in future
+			 *	OpenSSL decides to use different key lengths based
+			 *	on other parameters in the ctx, that'd break.
+			 */
+			key_len = SSL_CTX_set_tlsext_ticket_keys(ctx, NULL, 0);
 
-			talloc_free(key_buff);
-			goto kdf_error;
-		}
-		EVP_PKEY_CTX_free(pkey_ctx);
+			/*
+			 *	SSL_CTX_set_tlsext_ticket_keys memcpys its
+			 *	inputs so this is just a temporary buffer.
+			 */
+			MEM(key_buff = talloc_array(NULL, uint8_t, key_len));
+			if (tls_cache_ticket_key_derive(key_buff, key_len, cache_conf,
+							(uint8_t const *)TICKET_KEY_LABEL, sizeof(TICKET_KEY_LABEL) - 1) < 0) {
+				talloc_free(key_buff);
+				return -1;
+			}
 
-		fr_assert(talloc_array_length(key_buff) == key_len);
-		/*
-		 *	Ensure the same keys are used across all threads
-		 */
-		if (SSL_CTX_set_tlsext_ticket_keys(ctx,
-						   key_buff, key_len) != 1) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting session ticket keys");
-			return -1;
-		}
+			/*
+			 *	Ensure the same keys are used across all threads
+			 */
+			if (SSL_CTX_set_tlsext_ticket_keys(ctx,
+							   key_buff, key_len) != 1) {
+				fr_tls_strerror_printf(NULL);
+				PERROR("Failed setting session ticket keys");
+				talloc_free(key_buff);
+				return -1;
+			}
 
-		DEBUG3("Derived session-ticket-key:");
-		HEXDUMP3(key_buff, key_len, NULL);
-		talloc_free(key_buff);
+			DEBUG3("Derived session-ticket-key:");
+			HEXDUMP3(key_buff, key_len, NULL);
+			talloc_free(key_buff);
+		}
 
 		/*
 		 *	These callbacks embed and extract the
@@ -1504,7 +1962,6 @@ int fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf)
 		 *      need one.
 		 */
 		SSL_CTX_set_num_tickets(ctx, 1);
-	}
 		break;
 	}
 
@@ -82,6 +82,11 @@ static fr_table_num_sorted_t const verify_mode_table[] = {
 static size_t verify_mode_table_len = NUM_ELEMENTS(verify_mode_table);
 
 static conf_parser_t tls_cache_config[] = {
+	/*
+	 *	Must be before "mode", which checks it.
+	 */
+	{ FR_CONF_OFFSET("max_entries", fr_tls_cache_conf_t, max_entries), .dflt = "0" },
+
 	{ FR_CONF_OFFSET("mode", fr_tls_cache_conf_t, mode),
 			 .func = tls_conf_parse_cache_mode,
 			 .uctx = &(cf_table_parse_ctx_t){
@@ -97,12 +102,12 @@ static conf_parser_t tls_cache_config[] = {
 	{ FR_CONF_OFFSET("require_perfect_forward_secrecy", fr_tls_cache_conf_t, require_pfs), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("session_ticket_key", fr_tls_cache_conf_t, session_ticket_key) },
+	{ FR_CONF_OFFSET("session_ticket_key_rotation", fr_tls_cache_conf_t, session_ticket_key_rotation), .dflt = "0" },
 
 	/*
 	 *	Deprecated
 	 */
 	{ FR_CONF_DEPRECATED("enable", fr_tls_cache_conf_t, NULL) },
-	{ FR_CONF_DEPRECATED("max_entries", fr_tls_cache_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("persist_dir", fr_tls_cache_conf_t, NULL) },
 
 	CONF_PARSER_TERMINATOR
@@ -229,6 +234,9 @@ conf_parser_t fr_tls_client_config[] = {
 	{ FR_CONF_OFFSET("fragment_size",  fr_tls_conf_t, fragment_size), .dflt = "1024" },
 
 	{ FR_CONF_OFFSET("cipher_list", fr_tls_conf_t, cipher_list) },
+#ifdef SSL_OP_ENABLE_KTLS
+	{ FR_CONF_OFFSET("ktls", fr_tls_conf_t, ktls), .dflt = "no" },
+#endif
 
 #ifndef OPENSSL_NO_ECDH
 	{ FR_CONF_OFFSET("ecdh_curve", fr_tls_conf_t, ecdh_curve), .dflt = "prime256v1" },
@@ -255,47 +263,58 @@ static int tls_virtual_server_cf_parse(TALLOC_CTX *ctx, void *out, void *parent,
 	return 0;
 }
 
+/** Return the first session cache section missing from a virtual server
+ *
+ * @param[in] vs	to check.  May be NULL.
+ * @return
+ *	- NULL if all the sections are present.
+ *	- The name of the first missing section.
+ */
+static char const *tls_conf_cache_section_missing(CONF_SECTION *vs)
+{
+	if (!vs) return "";
+	if (!cf_section_find(vs, "load", "session")) return "load session";
+	if (!cf_section_find(vs, "store", "session")) return "store session";
+	if (!cf_section_find(vs, "clear", "session")) return "clear session";
+
+	return NULL;
+}
+
 static int tls_conf_parse_cache_mode(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule)
 {
 	fr_tls_conf_t	*conf = talloc_get_type_abort((uint8_t *)parent - offsetof(fr_tls_conf_t, cache), fr_tls_conf_t);
 	int		cache_mode;
+	bool		local = (conf->cache.max_entries > 0);
+	char const	*missing;
 
 	if (cf_table_parse_int(ctx, &cache_mode, parent, ci, rule) < 0) return -1;
 
 	/*
 	 *	Ensure our virtual server contains the
 	 *      correct sections for the specified
-	 *      cache mode.
+	 *      cache mode.  If there's a local cache
+	 *	the sections are optional, and are only
+	 *	used if they're all present.
 	 */
+	missing = tls_conf_cache_section_missing(conf->virtual_server);
+
 	switch (cache_mode) {
 	case FR_TLS_CACHE_DISABLED:
 	case FR_TLS_CACHE_STATELESS:
 		break;
 
 	case FR_TLS_CACHE_STATEFUL:
-		if (!conf->virtual_server) {
-			cf_log_err(ci, "A virtual_server must be set when cache.mode = \"stateful\"");
+		if (missing && !local) {
+			if (!conf->virtual_server) {
+				cf_log_err(ci, "A virtual_server or max_entries must be set when cache.mode = \"stateful\"");
+			} else {
+				cf_log_err(ci, "Specified virtual_server must contain a \"%s { ... }\" section "
+					   "when cache.mode = \"stateful\"", missing);
+			}
 		error:
 			return -1;
 		}
-
-		if (!cf_section_find(conf->virtual_server, "load", "session")) {
-			cf_log_err(ci, "Specified virtual_server must contain a \"load session { ... }\" section "
-				   "when cache.mode = \"stateful\"");
-			goto error;
-		}
-
-		if (!cf_section_find(conf->virtual_server, "store", "session")) {
-			cf_log_err(ci, "Specified virtual_server must contain a \"store session { ... }\" section "
-				   "when cache.mode = \"stateful\"");
-			goto error;
-		}
-
-		if (!cf_section_find(conf->virtual_server, "clear", "session")) {
-			cf_log_err(ci, "Specified virtual_server must contain a \"clear session { ... }\" section "
-			           "when cache.mode = \"stateful\"");
-			goto error;
-		}
+		conf->cache.virtual_server_cache = !missing;
 
 		if (conf->tls_min_version >= (float)1.3) {
 			cf_log_err(ci, "cache.mode = \"stateful\" is not supported with tls_min_version >= 1.3");
@@ -304,31 +323,18 @@ static int tls_conf_parse_cache_mode(TALLOC_CTX *ctx, void *out, void *parent, C
 		break;
 
 	case FR_TLS_CACHE_AUTO:
-		if (!conf->virtual_server) {
-			WARN("A virtual_server must be provided for stateful caching. "
-			     "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
-		cache_stateless:
+		if (missing && !local) {
+			if (!conf->virtual_server) {
+				WARN("A virtual_server or max_entries must be provided for stateful caching. "
+				     "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
+			} else {
+				cf_log_warn(ci, "Specified virtual_server missing \"%s { ... }\" section. "
+					    "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"", missing);
+			}
 			cache_mode = FR_TLS_CACHE_STATELESS;
 			break;
 		}
-
-		if (!cf_section_find(conf->virtual_server, "load", "session")) {
-			cf_log_warn(ci, "Specified virtual_server missing \"load session { ... }\" section. "
-			            "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
-			goto cache_stateless;
-		}
-
-		if (!cf_section_find(conf->virtual_server, "store", "session")) {
-			cf_log_warn(ci, "Specified virtual_server missing \"store session { ... }\" section. "
-			            "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
-			goto cache_stateless;
-		}
-
-		if (!cf_section_find(conf->virtual_server, "clear", "session")) {
-			cf_log_warn(ci, "Specified virtual_server missing \"clear cache { ... }\" section. "
-				    "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
-			goto cache_stateless;
-		}
+		conf->cache.virtual_server_cache = !missing;
 
 		if (conf->tls_min_version >= (float)1.3) {
 			cf_log_err(ci, "stateful session-resumption is not supported with tls_min_version >= 1.3. "
@@ -338,6 +344,10 @@ static int tls_conf_parse_cache_mode(TALLOC_CTX *ctx, void *out, void *parent, C
 		break;
 	}
 
+	if ((cache_mode & FR_TLS_CACHE_STATEFUL) && local) {
+		conf->cache.local = fr_tls_cache_local_alloc(conf, conf->cache.max_entries);
+	}
+
 	/*
 	 *	Generate random, ephemeral, session-ticket keys.
 	 */
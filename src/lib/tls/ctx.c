@@ -855,6 +855,18 @@ post_ca:
 	 */
 	if (conf->cipher_server_preference) ctx_options |= SSL_OP_CIPHER_SERVER_PREFERENCE;
 
+#ifdef SSL_OP_ENABLE_KTLS
+	/*
+	 *	Once the handshake is done, have the kernel do the
+	 *	symmetric crypto.  OpenSSL only does this when the
+	 *	SSL is reading from / writing to a socket, and the
+	 *	kernel supports the negotiated cipher.  Otherwise it
+	 *	silently stays in user space.  Sessions which use
+	 *	memory BIOs, e.g. EAP, are never offloaded.
+	 */
+	if (conf->ktls) ctx_options |= SSL_OP_ENABLE_KTLS;
+#endif
+
 	SSL_CTX_set_options(ctx, ctx_options);
 
 	/*
@@ -38,6 +38,8 @@
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
 #include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/syserror.h>
 
 #include <sys/stat.h>
 #include <ctype.h>
@@ -1290,6 +1292,11 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, UNUSED
 	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
 	int			ret;
 
+	/*
+	 *	Stop waiting for any offloaded crypto operation.
+	 */
+	TALLOC_FREE(tls_session->async_wait);
+
 	/*
 	 *	We might want to set can_pause = false here
 	 *	but that would trigger asserts in the
@@ -1319,6 +1326,82 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, UNUSED
 	fr_tls_session_request_unbind(tls_session->ssl);
 }
 
+/** An offloaded crypto operation has completed
+ *
+ * The job can now be resumed by calling SSL_read() again.
+ */
+static void tls_session_async_wait_done(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+
+	TALLOC_FREE(tls_session->async_wait);
+	unlang_interpret_mark_runnable(fr_tls_session_request(tls_session->ssl));
+}
+
+/** An fd for an offloaded crypto operation errored
+ *
+ * Resume the job anyway, and let OpenSSL report the error.
+ */
+static void tls_session_async_wait_error(fr_event_list_t *el, int fd, int flags, int fd_errno, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	request_t		*request = fr_tls_session_request(tls_session->ssl);
+
+	RERROR("Error waiting for async crypto operation: %s", fr_syserror(fd_errno));
+	tls_session_async_wait_done(el, fd, flags, uctx);
+}
+
+/** Yield until an async engine completes an operation
+ *
+ * Engines which support the OpenSSL async API (e.g. QAT) pause the
+ * job after submitting a crypto operation, and make one or more fds
+ * readable when it's complete.  We insert those fds into the request's
+ * event list and yield, so the worker can process other requests in
+ * the meantime.
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	whose job was paused.
+ * @return
+ *	- UNLANG_ACTION_CALCULATE_RESULT if the job wasn't paused by an engine.
+ *	- UNLANG_ACTION_YIELD if we're waiting on the engine.
+ *	- UNLANG_ACTION_FAIL on error.
+ */
+static unlang_action_t tls_session_async_wait(request_t *request, fr_tls_session_t *tls_session)
+{
+	fr_event_list_t		*el = unlang_interpret_event_list(request);
+	OSSL_ASYNC_FD		*fds;
+	size_t			numfds = 0, i;
+
+	if ((SSL_get_all_async_fds(tls_session->ssl, NULL, &numfds) != 1) || (numfds == 0)) {
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	MEM(fds = talloc_array(NULL, OSSL_ASYNC_FD, numfds));
+	if (SSL_get_all_async_fds(tls_session->ssl, fds, &numfds) != 1) {
+		talloc_free(fds);
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	fr_assert(!tls_session->async_wait);
+	MEM(tls_session->async_wait = talloc_new(tls_session));
+
+	for (i = 0; i < numfds; i++) {
+		if (fr_event_fd_insert(tls_session->async_wait, NULL, el, fds[i],
+				       tls_session_async_wait_done, NULL,
+				       tls_session_async_wait_error, tls_session) < 0) {
+			RPERROR("Failed inserting async crypto fd");
+			talloc_free(fds);
+			TALLOC_FREE(tls_session->async_wait);
+			return UNLANG_ACTION_FAIL;
+		}
+	}
+	talloc_free(fds);
+
+	RDEBUG3("Waiting for async crypto operation");
+
+	return UNLANG_ACTION_YIELD;
+}
+
 /** Call SSL_read() to continue the TLS state machine
  *
  * This function may be called multiple times, once after every asynchronous request.
@@ -1465,9 +1548,24 @@ DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 			IGNORE(unlang_function_clear(request), int);
 			goto error;
 
+		case UNLANG_ACTION_CALCULATE_RESULT:
+			break;
+
 		default:
 			return ua;
 		}
+
+		/*
+		 *	None of our callbacks paused the job, so
+		 *	it was an async engine performing a crypto
+		 *	operation.  Wait for it to complete.
+		 */
+		ua = tls_session_async_wait(request, tls_session);
+		if (ua == UNLANG_ACTION_FAIL) {
+			IGNORE(unlang_function_clear(request), int);
+			goto error;
+		}
+		return ua;
 	}
 
 	case SSL_ERROR_WANT_ASYNC_JOB:
@@ -138,6 +138,8 @@ struct fr_tls_session_s {
 	bool			client_cert_ok;			//!< whether or not the client certificate was validated
 	bool			can_pause;			//!< If true, it's ok to pause the request
 								///< using the OpenSSL async API.
+	TALLOC_CTX		*async_wait;			//!< Events for the fds of an async crypto operation
+								///< we're waiting on.  Freeing it removes them.
 
 	uint8_t			alerts_sent;
 	bool			pending_alert;
@@ -29,17 +29,74 @@
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/module.h>
 #include <freeradius-devel/unlang/subrequest.h>
+#include <freeradius-devel/util/histogram.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** Called for each latency histogram in a virtual server
+ *
+ * @param[in] uctx	passed to unlang_latency_walk().
+ * @param[in] name	of the section, policy, or module call.
+ * @param[in] depth	of the entry, with 0 for processing sections.
+ * @param[in] h		the merged histogram, in nanoseconds.
+ */
+typedef void (*unlang_latency_walk_t)(void *uctx, char const *name, int depth, fr_histogram_t const *h);
+
+/** Resources used by calls to one method of a module instance
+ *
+ * Only recorded if profiling has been enabled with unlang_module_profile_init().
+ */
+typedef struct {
+	uint64_t		calls;		//!< Number of times the method was called.
+	uint64_t		cpu;		//!< Thread CPU time used by the method, in nanoseconds.
+	uint64_t		yields;		//!< Number of times the method yielded.
+	uint64_t		wait;		//!< Time spent yielded, waiting for I/O, in nanoseconds.
+} unlang_module_profile_t;
+
+/** Called for each method of a module instance which has been profiled
+ *
+ * @param[in] uctx	passed to unlang_module_profile_walk().
+ * @param[in] module	name of the module instance.
+ * @param[in] method	name of the method, e.g. "recv.Access-Request".
+ * @param[in] p		the counters, summed across all threads.
+ */
+typedef void (*unlang_module_profile_walk_t)(void *uctx, char const *module, char const *method,
+					     unlang_module_profile_t const *p);
+
+/** One of the slowest module calls in an interval
+ *
+ */
+typedef struct {
+	uint64_t		number;		//!< Of the request which made the call.
+	fr_time_t		when;		//!< The call finished.
+	fr_time_delta_t		elapsed;	//!< From the call starting, to it finishing.
+	char			module[64];	//!< Name of the module instance.
+	char			stack[512];	//!< The unlang stack of the request, outermost first.
+} unlang_module_slow_t;
+
+/** Called for each of the slowest module calls, slowest first
+ *
+ * @param[in] uctx	passed to unlang_module_slow_walk().
+ * @param[in] slow	the sampled call.
+ */
+typedef void (*unlang_module_slow_walk_t)(void *uctx, unlang_module_slow_t const *slow);
+
 bool			unlang_section(CONF_SECTION *cs);
 
 int			unlang_global_init(void);
 
 int			unlang_thread_instantiate(TALLOC_CTX *ctx) CC_HINT(nonnull);
 
+int			unlang_latency_walk(char const *server, unlang_latency_walk_t walk, void *uctx) CC_HINT(nonnull(1,2));
+
+void			unlang_module_profile_init(bool enable, uint32_t slow_num, fr_time_delta_t slow_interval);
+
+void			unlang_module_profile_walk(unlang_module_profile_walk_t walk, void *uctx) CC_HINT(nonnull(1));
+
+void			unlang_module_slow_walk(unlang_module_slow_walk_t walk, void *uctx) CC_HINT(nonnull(1));
+
 #ifdef WITH_PERF
 void			unlang_perf_virtual_server(fr_log_t *log, char const *name);
 #endif
@@ -36,9 +36,12 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/tmpl.h>
 #include <freeradius-devel/server/cf_util.h>
+#include <freeradius-devel/unlang/xlat_priv.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/dict.h>
 
+#include <pthread.h>
+
 #include "catch_priv.h"
 #include "call_priv.h"
 #include "caller_priv.h"
@@ -70,6 +73,22 @@ static unsigned int unlang_number = 1;
  */
 static _Thread_local unlang_thread_t *unlang_thread_array;
 
+/*
+ *	The instruction arrays for all threads, so that we can merge
+ *	their latency histograms.  The threads update their own
+ *	histograms without locking.  The mutex only protects the list,
+ *	and the histograms of threads which have exited.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the list of threads.
+	unlang_thread_t		*array;			//!< The thread's instruction array.
+} unlang_thread_list_t;
+
+static pthread_mutex_t	unlang_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t	unlang_thread_list;
+static fr_histogram_t	**unlang_latency_exited;	//!< Latency of threads which have exited.
+static unlang_module_profile_t *unlang_profile_exited;	//!< Module profiles of threads which have exited.
+
 /*
  *	Until we know how many instructions there are, we can't
  *	allocate an array.  So we have to put the instructions into an
@@ -77,6 +96,12 @@ static _Thread_local unlang_thread_t *unlang_thread_array;
  */
 static fr_rb_tree_t *unlang_instruction_tree = NULL;
 
+/*
+ *	Conditions which call pure functions, and which can only be
+ *	evaluated once the xlats have been instantiated.
+ */
+static fr_dlist_head_t	unlang_cond_fold_list;
+
 /* Here's where we recognize all of our keywords: first the rcodes, then the
  * actions */
 fr_table_num_sorted_t const mod_rcode_table[] = {
@@ -1361,6 +1386,65 @@ static int unlang_fixup_edit(map_t *map, void *ctx)
 	return 0;
 }
 
+/** Check if assigning a literal to a leaf attribute can fail
+ *
+ */
+static bool edit_leaf_is_infallible(map_t const *map, fr_token_t op)
+{
+	fr_dict_attr_t const *da;
+
+	if (map->op != op) return false;
+	if (map_list_num_elements(&map->child) > 0) return false;
+	if (!tmpl_is_attr(map->lhs) || !map->rhs || !tmpl_is_data(map->rhs)) return false;
+	if (tmpl_attr_tail_num(map->lhs) != NUM_UNSPEC) return false;
+
+	da = tmpl_attr_tail_da(map->lhs);
+	if (!fr_type_is_leaf(da->type)) return false;
+
+	/*
+	 *	The value has already been cast to the right type, so
+	 *	nothing is parsed at run time.
+	 */
+	return (tmpl_value_type(map->rhs) == da->type);
+}
+
+/** Check if an edit can fail after it has started changing the request
+ *
+ * Edits which can't are run without recording how to undo them.
+ *
+ * Only the simplest cases are recognised: setting a leaf attribute to a
+ * literal value, and appending or assigning a list of literal leaf
+ * values to a list.  Anything else, or anything which might need to be
+ * undone by an enclosing transaction, uses the edit list.
+ */
+static bool edit_is_infallible(map_t const *map)
+{
+	fr_dict_attr_t const	*parent_da;
+	map_t const		*child;
+
+	if (!tmpl_is_attr(map->lhs) || (tmpl_attr_tail_num(map->lhs) != NUM_UNSPEC)) return false;
+
+	parent_da = tmpl_attr_tail_da(map->lhs);
+	if (!fr_type_is_structural(parent_da->type)) {
+		return edit_leaf_is_infallible(map, T_OP_SET) || edit_leaf_is_infallible(map, T_OP_EQ);
+	}
+
+	if ((map->op != T_OP_ADD_EQ) && (map->op != T_OP_SET)) return false;
+	if (map->rhs) return false;
+
+	for (child = map_list_head(&map->child); child != NULL; child = map_list_next(&map->child, child)) {
+		if (!edit_leaf_is_infallible(child, T_OP_EQ)) return false;
+
+		/*
+		 *	The same check is done at run time, before the
+		 *	list is changed.  But it's nicer to know.
+		 */
+		if (!fr_dict_attr_can_contain(parent_da, tmpl_attr_tail_da(child->lhs))) return false;
+	}
+
+	return true;
+}
+
 /** Compile one edit section.
  */
 static unlang_t *compile_edit_section(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs)
@@ -1520,6 +1604,7 @@ static unlang_t *compile_edit_section(unlang_t *parent, unlang_compile_t *unlang
 	 */
 //	if (unlang_fixup_update(map, NULL) < 0) goto fail;
 
+	edit->no_journal = edit_is_infallible(map);
 	map_list_insert_tail(&edit->maps, map);
 
 	return out;
@@ -1607,6 +1692,7 @@ static unlang_t *compile_edit_pair(unlang_t *parent, unlang_compile_t *unlang_ct
 	 */
 	if (unlang_fixup_update(map, c) < 0) goto fail;
 
+	edit->no_journal = edit_is_infallible(map);
 	map_list_insert_tail(&edit->maps, map);
 
 	return out;
@@ -2619,6 +2705,57 @@ static int case_to_key(uint8_t **out, size_t *outlen, void const *data)
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_ITEM const *ci);
 
+/** Build a jump table for switches over integer attributes with a dense set of case values
+ *
+ * Packet-Type and Service-Type style dispatch then costs an array
+ * index instead of a htrie lookup.  Sparse or non-integer switches
+ * continue to use the htrie.
+ */
+static void compile_switch_jump(unlang_group_t *g, unlang_switch_t *gext)
+{
+	unlang_t	*c;
+	int64_t		key, min = INT64_MAX, max = INT64_MIN;
+	size_t		i;
+	bool		found = false;
+
+	if (!tmpl_is_attr(gext->vpt) || tmpl_rules_cast(gext->vpt)) return;
+
+	for (c = g->children; c; c = c->next) {
+		unlang_case_t *case_gext = unlang_group_to_case(unlang_generic_to_group(c));
+
+		if (!case_gext->vpt) continue;
+
+		if (unlang_switch_jump_key(&key, tmpl_value(case_gext->vpt)) < 0) return;
+
+		if (key < min) min = key;
+		if (key > max) max = key;
+		found = true;
+	}
+
+	if (!found) return;
+
+	/*
+	 *	Unsigned, so the range can't overflow.
+	 */
+	if (((uint64_t)max - (uint64_t)min) >= UNLANG_SWITCH_JUMP_MAX) return;
+
+	gext->jump_len = (size_t)((uint64_t)max - (uint64_t)min) + 1;
+	gext->jump_min = min;
+	gext->jump = talloc_array(gext, unlang_t *, gext->jump_len);
+	if (!gext->jump) return;
+
+	for (i = 0; i < gext->jump_len; i++) gext->jump[i] = gext->default_case;
+
+	for (c = g->children; c; c = c->next) {
+		unlang_case_t *case_gext = unlang_group_to_case(unlang_generic_to_group(c));
+
+		if (!case_gext->vpt) continue;
+
+		(void) unlang_switch_jump_key(&key, tmpl_value(case_gext->vpt));
+		gext->jump[key - min] = c;
+	}
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_ITEM const *ci)
 {
 	CONF_SECTION		*cs = cf_item_to_section(ci);
@@ -2834,6 +2971,8 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		g->num_children++;
 	}
 
+	compile_switch_jump(g, gext);
+
 	compile_action_defaults(c, unlang_ctx);
 
 	return c;
@@ -3546,6 +3685,13 @@ static const fr_sbuff_term_t if_terminals = FR_SBUFF_TERMS(
 	L("{"),
 );
 
+static int _unlang_cond_free(unlang_cond_t *gext)
+{
+	if (fr_dlist_entry_in_list(&gext->entry)) fr_dlist_remove(&unlang_cond_fold_list, gext);
+
+	return 0;
+}
+
 static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				       unlang_ext_t const *ext)
 {
@@ -3636,6 +3782,20 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 	gext->is_truthy = is_truthy;
 	gext->value = value;
 
+	if (!is_truthy) {
+		unlang_cond_ops_compile(gext);
+
+		/*
+		 *	The condition calls pure functions, e.g. %config(...),
+		 *	so it may be possible to evaluate some or all of it
+		 *	once the xlats have been instantiated.
+		 */
+		if (head->flags.can_purify) {
+			fr_dlist_insert_tail(&unlang_cond_fold_list, gext);
+			talloc_set_destructor(gext, _unlang_cond_free);
+		}
+	}
+
 	return c;
 }
 
@@ -3893,6 +4053,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 
 	bool				clone = true;
 	bool				detach = false;
+	unlang_parallel_merge_t		merge = UNLANG_PARALLEL_MERGE_NONE;
 
 	static unlang_ext_t const 	parallel_ext = {
 						.type = UNLANG_TYPE_PARALLEL,
@@ -3916,6 +4077,15 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 		} else if (strcmp(name2, "detach") == 0) {
 			detach = true;
 
+		} else if (strcmp(name2, "merge-first") == 0) {
+			merge = UNLANG_PARALLEL_MERGE_FIRST;
+
+		} else if (strcmp(name2, "merge-all") == 0) {
+			merge = UNLANG_PARALLEL_MERGE_ALL;
+
+		} else if (strcmp(name2, "merge-priority") == 0) {
+			merge = UNLANG_PARALLEL_MERGE_PRIORITY;
+
 		} else {
 			cf_log_err(cs, "Invalid argument '%s'", name2);
 			return NULL;
@@ -3938,6 +4108,7 @@ static unlang_t *compile_parallel(unlang_t *parent, unlang_compile_t *unlang_ctx
 	gext = unlang_group_to_parallel(g);
 	gext->clone = clone;
 	gext->detach = detach;
+	gext->merge = merge;
 
 	return c;
 }
@@ -4836,6 +5007,12 @@ static unlang_t *compile_item(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 
 			c->number = unlang_number++;
 
+			/*
+			 *	Record latency for the things which people
+			 *	usually want to know about.
+			 */
+			if ((c->type == UNLANG_TYPE_MODULE) || (c->type == UNLANG_TYPE_POLICY)) c->latency = true;
+
 			/*
 			 *	Only insert the per-thread allocation && instantiation if it's used.
 			 */
@@ -5068,6 +5245,9 @@ int unlang_compile(virtual_server_t const *vs,
 			    cs, &group_ext);
 	if (!c) return -1;
 
+	c->number = unlang_number++;
+	c->latency = true;
+
 	if (DEBUG_ENABLED4) unlang_dump(c, 2);
 
 	/*
@@ -5113,6 +5293,104 @@ static int8_t instruction_cmp(void const *one, void const *two)
 void unlang_compile_init(TALLOC_CTX *ctx)
 {
 	unlang_instruction_tree = fr_rb_alloc(ctx, instruction_cmp, NULL);
+	fr_dlist_talloc_init(&unlang_thread_list, unlang_thread_list_t, entry);
+	fr_dlist_talloc_init(&unlang_cond_fold_list, unlang_cond_t, entry);
+}
+
+/** Check whether a purified condition is now a constant
+ *
+ * Purified function calls are replaced by a group containing their
+ * output, so we look inside a single group, too.
+ */
+static bool unlang_cond_is_constant(xlat_exp_head_t const *head, bool *value)
+{
+	xlat_exp_t const *node;
+
+	if (xlat_is_truthy(head, value)) return true;
+
+	node = xlat_exp_head(head);
+	if (!node || xlat_exp_next(head, node) || (node->type != XLAT_GROUP)) return false;
+
+	return xlat_is_truthy(node->group, value);
+}
+
+/** Evaluate the pure parts of conditions, once all xlats have been instantiated
+ *
+ * Conditions which only use constants are folded as they're compiled.
+ * Conditions which call pure functions, such as %config(...), can't
+ * be, as the functions haven't been instantiated yet.  Here we
+ * evaluate those function calls once, instead of on every request.
+ *
+ * If the whole condition is now a constant, the "if" or "elsif" is
+ * marked as such, and the interpreter either runs its children
+ * without evaluating anything, or skips over it.
+ */
+void unlang_compile_fold_conditions(void)
+{
+	unlang_cond_t *gext;
+
+	while ((gext = fr_dlist_pop_head(&unlang_cond_fold_list))) {
+		unlang_t	*c = unlang_group_to_generic(unlang_cond_to_group(gext));
+		bool		value;
+
+		talloc_set_destructor(gext, NULL);
+
+		/*
+		 *	The flattened condition points into the
+		 *	expression we're about to modify.
+		 */
+		TALLOC_FREE(gext->ops);
+		gext->num_ops = 0;
+
+		if (xlat_purify(gext->head, NULL) < 0) {
+			cf_log_warn(c->ci, "Failed pre-evaluating condition - %s", fr_strerror());
+			goto recompile;
+		}
+
+		if (unlang_cond_is_constant(gext->head, &value)) {
+			cf_log_debug(c->ci, "'%s' is always '%s'", c->debug_name, value ? "true" : "false");
+			gext->is_truthy = true;
+			gext->value = value;
+			continue;
+		}
+
+	recompile:
+		unlang_cond_ops_compile(gext);
+	}
+}
+
+/** Remove a thread from the thread list, and remember its latency
+ *
+ * Otherwise the totals would go backwards when a worker exits.
+ */
+static int _unlang_thread_list_free(unlang_thread_list_t *tl)
+{
+	unsigned int i, num = talloc_array_length(unlang_latency_exited);
+
+	pthread_mutex_lock(&unlang_thread_mutex);
+	fr_dlist_remove(&unlang_thread_list, tl);
+
+	for (i = 0; i < talloc_array_length(tl->array); i++) {
+		if (!tl->array[i].latency || (i >= num)) continue;
+
+		if (!unlang_latency_exited[i]) MEM(unlang_latency_exited[i] = fr_histogram_alloc(unlang_latency_exited));
+
+		fr_histogram_merge(unlang_latency_exited[i], tl->array[i].latency);
+	}
+
+	for (i = 0; i < talloc_array_length(tl->array); i++) {
+		if (!tl->array[i].profile.calls || (i >= talloc_array_length(unlang_profile_exited))) continue;
+
+		unlang_profile_exited[i].calls += tl->array[i].profile.calls;
+		unlang_profile_exited[i].cpu += tl->array[i].profile.cpu;
+		unlang_profile_exited[i].yields += tl->array[i].profile.yields;
+		unlang_profile_exited[i].wait += tl->array[i].profile.wait;
+	}
+	pthread_mutex_unlock(&unlang_thread_mutex);
+
+	if (unlang_thread_array == tl->array) unlang_thread_array = NULL;
+
+	return 0;
 }
 
 
@@ -5123,14 +5401,28 @@ int unlang_thread_instantiate(TALLOC_CTX *ctx)
 {
 	fr_rb_iter_inorder_t	iter;
 	unlang_t		*instruction;
+	unlang_thread_list_t	*tl;
 
 	if (unlang_thread_array) {
 		fr_strerror_const("already initialized");
 		return -1;
 	}
 
-	MEM(unlang_thread_array = talloc_zero_array(ctx, unlang_thread_t, unlang_number + 1));
-//	talloc_set_destructor(unlang_thread_array, _unlang_thread_array_free);
+	MEM(tl = talloc_zero(ctx, unlang_thread_list_t));
+	MEM(unlang_thread_array = talloc_zero_array(tl, unlang_thread_t, unlang_number + 1));
+	tl->array = unlang_thread_array;
+
+	pthread_mutex_lock(&unlang_thread_mutex);
+	if (!unlang_latency_exited) {
+		MEM(unlang_latency_exited = talloc_zero_array(unlang_instruction_tree, fr_histogram_t *, unlang_number + 1));
+	}
+	if (!unlang_profile_exited) {
+		MEM(unlang_profile_exited = talloc_zero_array(unlang_instruction_tree, unlang_module_profile_t, unlang_number + 1));
+	}
+	fr_dlist_insert_tail(&unlang_thread_list, tl);
+	pthread_mutex_unlock(&unlang_thread_mutex);
+
+	talloc_set_destructor(tl, _unlang_thread_list_free);
 
 	/*
 	 *	Instantiate each instruction with thread-specific data.
@@ -5174,6 +5466,232 @@ void *unlang_thread_instance(unlang_t const *instruction)
 	return unlang_thread_array[instruction->number].thread_inst;
 }
 
+/** Add the time spent in an instruction to this thread's latency histogram
+ *
+ * @param[in] frame	which is being cleaned up.
+ */
+void unlang_frame_latency_end(unlang_stack_frame_t *frame)
+{
+	unlang_t const	*instruction = frame->instruction;
+	unlang_thread_t	*t;
+	fr_time_t	start = frame->latency_start;
+
+	frame->latency_start = fr_time_wrap(0);
+
+	/*
+	 *	Instructions compiled after the threads were started
+	 *	don't have an entry in the array.
+	 */
+	if (!unlang_thread_array || (instruction->number >= talloc_array_length(unlang_thread_array))) return;
+
+	t = &unlang_thread_array[instruction->number];
+	if (unlikely(!t->latency)) MEM(t->latency = fr_histogram_alloc(unlang_thread_array));
+
+	fr_histogram_add(t->latency, fr_time_delta_unwrap(fr_time_sub(fr_time(), start)));
+}
+
+/** Get this thread's module profile for an instruction
+ *
+ * @param[in] instruction	a module call.
+ * @return
+ *	- the counters for the instruction.
+ *	- NULL if the instruction was compiled after the threads were
+ *	  started, or wasn't compiled at all.
+ */
+unlang_module_profile_t *unlang_thread_profile(unlang_t const *instruction)
+{
+	if (!instruction->number || !unlang_thread_array ||
+	    (instruction->number >= talloc_array_length(unlang_thread_array))) return NULL;
+
+	return &unlang_thread_array[instruction->number].profile;
+}
+
+/** Merge the latency histograms of all threads for one instruction
+ *
+ */
+static void unlang_latency_merge(fr_histogram_t *out, unlang_t const *instruction)
+{
+	memset(out, 0, sizeof(*out));
+
+	pthread_mutex_lock(&unlang_thread_mutex);
+	fr_dlist_foreach(&unlang_thread_list, unlang_thread_list_t, tl) {
+		if (instruction->number >= talloc_array_length(tl->array)) continue;
+		if (!tl->array[instruction->number].latency) continue;
+
+		fr_histogram_merge(out, tl->array[instruction->number].latency);
+	}
+
+	if ((instruction->number < talloc_array_length(unlang_latency_exited)) &&
+	    unlang_latency_exited[instruction->number]) {
+		fr_histogram_merge(out, unlang_latency_exited[instruction->number]);
+	}
+	pthread_mutex_unlock(&unlang_thread_mutex);
+}
+
+static void unlang_latency_walk_instruction(unlang_t const *instruction, int depth, fr_histogram_t *h,
+					    unlang_latency_walk_t walk, void *uctx)
+{
+	unlang_group_t const	*g;
+	unlang_t const		*child;
+
+	if (instruction->latency) {
+		unlang_latency_merge(h, instruction);
+		walk(uctx, instruction->debug_name, depth, h);
+		depth++;
+	}
+
+	if ((instruction->type <= UNLANG_TYPE_MODULE) || (instruction->type > UNLANG_TYPE_POLICY)) return;
+
+	g = unlang_generic_to_group(instruction);
+
+	for (child = g->children; child != NULL; child = child->next) {
+		unlang_latency_walk_instruction(child, depth, h, walk, uctx);
+	}
+}
+
+/** Walk over the latency histograms for a virtual server
+ *
+ * The histograms of all threads are merged for each processing
+ * section, policy and module call in the virtual server.  They are
+ * walked in the order in which they appear in the configuration.
+ *
+ * @param[in] server	name of the virtual server.
+ * @param[in] walk	called for each histogram.  Module calls and
+ *			policies have a larger depth than the section which
+ *			contains them.
+ * @param[in] uctx	passed to walk.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there is no such virtual server.
+ */
+int unlang_latency_walk(char const *server, unlang_latency_walk_t walk, void *uctx)
+{
+	virtual_server_t const	*vs = virtual_server_find(server);
+	CONF_SECTION		*cs;
+	CONF_ITEM		*ci;
+	fr_histogram_t		h;
+
+	if (!vs) {
+		fr_strerror_printf("No such virtual server '%s'", server);
+		return -1;
+	}
+
+	cs = virtual_server_cs(vs);
+
+	for (ci = cf_item_next(cs, NULL);
+	     ci != NULL;
+	     ci = cf_item_next(cs, ci)) {
+		unlang_t const *instruction;
+
+		if (!cf_item_is_section(ci)) continue;
+
+		instruction = (unlang_t const *)cf_data_value(cf_data_find(ci, unlang_group_t, NULL));
+		if (!instruction) continue;
+
+		unlang_latency_walk_instruction(instruction, 0, &h, walk, uctx);
+	}
+
+	return 0;
+}
+
+typedef struct {
+	char const		*module;
+	char			*method;
+	unlang_module_profile_t	p;
+} unlang_module_profile_entry_t;
+
+/** Walk over the resources used by every module method
+ *
+ * The counters for all threads, and for all calls to the same method
+ * of a module instance, are summed.  Methods which haven't been called
+ * aren't walked.
+ *
+ * The counters are read without locking the threads which update
+ * them, so they may be slightly out of date.
+ *
+ * @param[in] walk	called for each method.
+ * @param[in] uctx	passed to walk.
+ */
+void unlang_module_profile_walk(unlang_module_profile_walk_t walk, void *uctx)
+{
+	fr_rb_iter_inorder_t		iter;
+	unlang_t			*instruction;
+	unlang_module_profile_entry_t	*entries = NULL;
+	size_t				i, num = 0;
+
+	if (!unlang_instruction_tree) return;
+
+	pthread_mutex_lock(&unlang_thread_mutex);
+	for (instruction = fr_rb_iter_init_inorder(&iter, unlang_instruction_tree);
+	     instruction;
+	     instruction = fr_rb_iter_next_inorder(&iter)) {
+		unlang_module_t			*m;
+		unlang_module_profile_t		p = {};
+		unlang_module_profile_entry_t	*e = NULL;
+		char				*method;
+
+		if (instruction->type != UNLANG_TYPE_MODULE) continue;
+
+		fr_dlist_foreach(&unlang_thread_list, unlang_thread_list_t, tl) {
+			unlang_module_profile_t const *tp;
+
+			if (instruction->number >= talloc_array_length(tl->array)) continue;
+
+			tp = &tl->array[instruction->number].profile;
+			p.calls += tp->calls;
+			p.cpu += tp->cpu;
+			p.yields += tp->yields;
+			p.wait += tp->wait;
+		}
+
+		if (instruction->number < talloc_array_length(unlang_profile_exited)) {
+			unlang_module_profile_t const *tp = &unlang_profile_exited[instruction->number];
+
+			p.calls += tp->calls;
+			p.cpu += tp->cpu;
+			p.yields += tp->yields;
+			p.wait += tp->wait;
+		}
+
+		if (!p.calls) continue;
+
+		m = unlang_generic_to_module(instruction);
+		if (m->mmc.asked.name2 && (m->mmc.asked.name2 != CF_IDENT_ANY)) {
+			method = talloc_typed_asprintf(NULL, "%s.%s", section_name_str(m->mmc.asked.name1),
+						       m->mmc.asked.name2);
+		} else {
+			method = talloc_typed_strdup(NULL, section_name_str(m->mmc.asked.name1));
+		}
+
+		for (i = 0; i < num; i++) {
+			if ((strcmp(entries[i].module, m->mmc.mi->name) == 0) &&
+			    (strcmp(entries[i].method, method) == 0)) {
+				e = &entries[i];
+				break;
+			}
+		}
+
+		if (!e) {
+			MEM(entries = talloc_realloc(NULL, entries, unlang_module_profile_entry_t, num + 1));
+			e = &entries[num++];
+			*e = (unlang_module_profile_entry_t){ .module = m->mmc.mi->name, .method = method };
+			talloc_steal(entries, method);
+		} else {
+			talloc_free(method);
+		}
+
+		e->p.calls += p.calls;
+		e->p.cpu += p.cpu;
+		e->p.yields += p.yields;
+		e->p.wait += p.wait;
+	}
+	pthread_mutex_unlock(&unlang_thread_mutex);
+
+	for (i = 0; i < num; i++) walk(uctx, entries[i].module, entries[i].method, &entries[i].p);
+
+	talloc_free(entries);
+}
+
 #ifdef WITH_PERF
 void unlang_frame_perf_init(unlang_stack_frame_t *frame)
 {
@@ -43,6 +43,8 @@ bool		unlang_compile_is_keyword(const char *name);
 
 bool		unlang_compile_actions(unlang_mod_actions_t *actions, CONF_SECTION *parent, bool module_retry);
 
+void		unlang_compile_fold_conditions(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,9 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/unlang/xlat_priv.h>
+#include <freeradius-devel/util/calc.h>
+
 #include "condition_priv.h"
 #include "group_priv.h"
 
@@ -34,27 +37,132 @@ typedef struct {
 								///< of the execution.
 } unlang_frame_state_cond_t;
 
-static unlang_action_t unlang_if_resume(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
+/** Evaluate a flattened condition
+ *
+ * @param[out] out	Result of the condition.
+ * @param[in] request	The current request.
+ * @param[in] ctx	to allocate temporary values in.
+ * @param[in] gext	containing the flattened condition.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The caller should evaluate the condition
+ *	  with the xlat interpreter instead.
+ */
+static int unlang_cond_ops_eval(bool *out, request_t *request, TALLOC_CTX *ctx, unlang_cond_t const *gext)
 {
-	unlang_frame_state_cond_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_cond_t);
-	fr_value_box_t			*box = fr_value_box_list_head(&state->out);
-	bool				value;
+	unsigned int		pc = 0;
+	bool			result = false;
+	fr_value_box_t const	*stack[UNLANG_COND_MAX_STACK];	//!< Values being operated on.
+	fr_value_box_t		tmp[UNLANG_COND_MAX_STACK];	//!< Storage for intermediate results.
+	unsigned int		sp = 0;
 
-	if (!box) {
-		value = false;
+	while (pc < gext->num_ops) {
+		unlang_cond_op_t const	*op = &gext->ops[pc];
+		fr_value_box_list_t	lhs, rhs;
+		fr_value_box_t		value, other, dst;
+		fr_pair_t		*vp;
+		int			ret;
 
-	} else if (fr_value_box_list_next(&state->out, box) != NULL) {
-		value = true;
+		switch (op->type) {
+		case UNLANG_COND_OP_PUSH_ATTR:
+			/*
+			 *	Missing attributes are treated as zero,
+			 *	of whatever type the other operand is.
+			 *	Leave that to the xlat code.
+			 */
+			if ((tmpl_find_vp(&vp, request, op->vpt) < 0) || !vp) return -1;
 
-	} else {
-		value = fr_value_box_is_truthy(box);
-	}
+			stack[sp++] = &vp->data;
+			pc++;
+			break;
 
-	if (!value) {
-		RDEBUG2("...");
-		return UNLANG_ACTION_EXECUTE_NEXT;
+		case UNLANG_COND_OP_PUSH_VALUE:
+			stack[sp++] = op->value;
+			pc++;
+			break;
+
+		case UNLANG_COND_OP_CALC:
+			fr_assert(sp >= 2);
+
+			/*
+			 *	Numeric calculations don't allocate
+			 *	memory, so the result can live on
+			 *	the stack.
+			 */
+			fr_value_box_init_null(&dst);
+			if (fr_value_calc_binary_op(ctx, &dst, FR_TYPE_NULL,
+						    stack[sp - 2], op->op, stack[sp - 1]) < 0) return -1;
+
+			tmp[sp - 2] = dst;
+			stack[sp - 2] = &tmp[sp - 2];
+			sp--;
+			pc++;
+			break;
+
+		case UNLANG_COND_OP_CMP_STACK:
+			fr_assert(sp >= 2);
+
+			fr_value_box_list_init(&lhs);
+			fr_value_box_list_init(&rhs);
+
+			/*
+			 *	fr_value_calc_list_cmp() takes lists,
+			 *	so shallow copy the values into single
+			 *	element ones.
+			 */
+			fr_value_box_copy_shallow(NULL, &value, stack[sp - 2]);
+			fr_value_box_list_insert_tail(&lhs, &value);
+			fr_value_box_copy_shallow(NULL, &other, stack[sp - 1]);
+			fr_value_box_list_insert_tail(&rhs, &other);
+
+			fr_value_box_init(&dst, FR_TYPE_BOOL, NULL, false);
+			ret = fr_value_calc_list_cmp(ctx, &dst, &lhs, op->op, &rhs);
+			if (ret < 0) return -1;
+
+			result = dst.vb_bool;
+			sp -= 2;
+			pc++;
+			break;
+
+		case UNLANG_COND_OP_CMP:
+			fr_value_box_list_init(&lhs);
+			fr_value_box_list_init(&rhs);
+
+			if (tmpl_eval_pair(ctx, &lhs, request, op->vpt) < 0) return -1;
+
+			fr_value_box_copy_shallow(NULL, &value, op->value);
+			fr_value_box_list_insert_tail(&rhs, &value);
+
+			fr_value_box_init(&dst, FR_TYPE_BOOL, NULL, false);
+			ret = fr_value_calc_list_cmp(ctx, &dst, &lhs, op->op, &rhs);
+
+			fr_value_box_list_remove(&rhs, &value);
+			fr_value_box_list_talloc_free(&lhs);
+			if (ret < 0) return -1;
+
+			result = dst.vb_bool;
+			pc++;
+			break;
+
+		case UNLANG_COND_OP_JUMP_IF_FALSE:
+			pc = !result ? op->target : pc + 1;
+			break;
+
+		case UNLANG_COND_OP_JUMP_IF_TRUE:
+			pc = result ? op->target : pc + 1;
+			break;
+		}
 	}
 
+	*out = result;
+	return 0;
+}
+
+/** Run the children of an "if" whose condition evaluated to true
+ *
+ */
+static unlang_action_t unlang_if_taken(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
+{
 	/*
 	 *	Tell the main interpreter to skip over the else /
 	 *	elsif blocks, as this "if" condition was taken.
@@ -71,6 +179,30 @@ static unlang_action_t unlang_if_resume(rlm_rcode_t *p_result, request_t *reques
 	return unlang_group(p_result, request, frame);
 }
 
+static unlang_action_t unlang_if_resume(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
+{
+	unlang_frame_state_cond_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_cond_t);
+	fr_value_box_t			*box = fr_value_box_list_head(&state->out);
+	bool				value;
+
+	if (!box) {
+		value = false;
+
+	} else if (fr_value_box_list_next(&state->out, box) != NULL) {
+		value = true;
+
+	} else {
+		value = fr_value_box_is_truthy(box);
+	}
+
+	if (!value) {
+		RDEBUG2("...");
+		return UNLANG_ACTION_EXECUTE_NEXT;
+	}
+
+	return unlang_if_taken(p_result, request, frame);
+}
+
 static unlang_action_t unlang_if(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
 	unlang_group_t			*g = unlang_generic_to_group(frame->instruction);
@@ -80,14 +212,37 @@ static unlang_action_t unlang_if(rlm_rcode_t *p_result, request_t *request, unla
 	fr_assert(gext->head != NULL);
 
 	/*
-	 *	If we always run this condition, then don't bother pushing anything onto the stack.
+	 *	If the condition is a constant, then don't bother pushing anything onto the stack.
 	 *
-	 *	We still run this condition, even for "false" values, due to things like
+	 *	Conditions which are always "false" at compile time have no children, but those
+	 *	which were folded after xlat instantiation do, so we skip them here.  We can't
+	 *	remove them from the tree, due to things like
 	 *
 	 *		if (0) { ... } elsif ....
 	 */
 	if (gext->is_truthy) {
-		return unlang_group(p_result, request, frame);
+		if (!gext->value) return UNLANG_ACTION_EXECUTE_NEXT;
+
+		return unlang_if_taken(p_result, request, frame);
+	}
+
+	/*
+	 *	Simple conditions are evaluated in place, without
+	 *	pushing an xlat frame.  We only print the result, not
+	 *	each step as the xlat evaluator does.  Flattened
+	 *	conditions have no side effects, so if anything goes
+	 *	wrong we just re-evaluate the condition the slow way.
+	 */
+	if (gext->ops) {
+		bool value;
+
+		if (unlang_cond_ops_eval(&value, request, state, gext) == 0) {
+			RDEBUG2("| --> %s", value ? "true" : "false");
+
+			if (!value) return UNLANG_ACTION_EXECUTE_NEXT;
+
+			return unlang_if_taken(p_result, request, frame);
+		}
 	}
 
 	frame_repeat(frame, unlang_if_resume);
@@ -100,6 +255,252 @@ static unlang_action_t unlang_if(rlm_rcode_t *p_result, request_t *request, unla
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Whether values of a given type can be operated on without allocating memory
+ *
+ */
+static inline bool unlang_cond_type_is_fixed(fr_type_t type)
+{
+	return fr_type_is_numeric(type) || (type == FR_TYPE_IPV4_ADDR) || (type == FR_TYPE_IPV4_PREFIX);
+}
+
+/** Flatten arithmetic on numeric attributes and literals into stack operations
+ *
+ * @param[in] ops	to write instructions to.
+ * @param[in,out] num_ops	number of instructions written so far.
+ * @param[in,out] sp	depth of the value stack when the instructions run.
+ * @param[in] head	expression to flatten.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the expression can't be flattened.
+ */
+static int unlang_cond_ops_compile_value(unlang_cond_op_t *ops, unsigned int *num_ops, unsigned int *sp,
+					 xlat_exp_head_t const *head)
+{
+	xlat_exp_t const	*node = xlat_exp_head(head);
+	xlat_exp_t const	*a, *b;
+	fr_dict_attr_t const	*da;
+	int			num;
+
+	if (!node || xlat_exp_next(head, node)) return -1;
+	if ((*num_ops >= UNLANG_COND_MAX_OPS) || (*sp >= UNLANG_COND_MAX_STACK)) return -1;
+
+	switch (node->type) {
+	case XLAT_BOX:
+		if (!unlang_cond_type_is_fixed(node->data.type)) return -1;
+
+		ops[(*num_ops)++] = (unlang_cond_op_t) {
+			.type = UNLANG_COND_OP_PUSH_VALUE,
+			.value = &node->data
+		};
+		(*sp)++;
+		return 0;
+
+	case XLAT_TMPL:
+		if (!tmpl_is_attr(node->vpt) || (tmpl_rules_cast(node->vpt) != FR_TYPE_NULL)) return -1;
+
+		da = tmpl_attr_tail_da(node->vpt);
+		if (!da || !unlang_cond_type_is_fixed(da->type)) return -1;
+
+		num = tmpl_attr_tail_num(node->vpt);
+		if ((num == NUM_ALL) || (num == NUM_COUNT)) return -1;
+
+		ops[(*num_ops)++] = (unlang_cond_op_t) {
+			.type = UNLANG_COND_OP_PUSH_ATTR,
+			.vpt = node->vpt
+		};
+		(*sp)++;
+		return 0;
+
+	case XLAT_FUNC:
+		break;
+
+	default:
+		return -1;
+	}
+
+	switch (node->call.func->token) {
+	case T_ADD:
+	case T_SUB:
+	case T_MUL:
+	case T_DIV:
+	case T_MOD:
+	case T_AND:
+	case T_OR:
+	case T_XOR:
+	case T_LSHIFT:
+	case T_RSHIFT:
+		break;
+
+	default:
+		return -1;
+	}
+
+	a = xlat_exp_head(node->call.args);
+	if (!a || (a->type != XLAT_GROUP)) return -1;
+
+	b = xlat_exp_next(node->call.args, a);
+	if (!b || (b->type != XLAT_GROUP) || xlat_exp_next(node->call.args, b)) return -1;
+
+	if (unlang_cond_ops_compile_value(ops, num_ops, sp, a->group) < 0) return -1;
+	if (unlang_cond_ops_compile_value(ops, num_ops, sp, b->group) < 0) return -1;
+
+	if (*num_ops >= UNLANG_COND_MAX_OPS) return -1;
+
+	ops[(*num_ops)++] = (unlang_cond_op_t) {
+		.type = UNLANG_COND_OP_CALC,
+		.op = node->call.func->token
+	};
+	(*sp)--;
+
+	return 0;
+}
+
+/** Flatten a comparison
+ *
+ * Comparisons of an attribute against a literal value use a single
+ * instruction.  Comparisons involving arithmetic are evaluated on the
+ * value stack.
+ */
+static int unlang_cond_ops_compile_cmp(unlang_cond_op_t *ops, unsigned int *num_ops, xlat_exp_t const *node)
+{
+	xlat_exp_t const	*a, *b, *lhs, *rhs;
+	unsigned int		start = *num_ops, sp = 0;
+
+	a = xlat_exp_head(node->call.args);
+	if (!a || (a->type != XLAT_GROUP)) return -1;
+
+	b = xlat_exp_next(node->call.args, a);
+	if (!b || (b->type != XLAT_GROUP) || xlat_exp_next(node->call.args, b)) return -1;
+
+	lhs = xlat_exp_head(a->group);
+	if (!lhs || xlat_exp_next(a->group, lhs)) return -1;
+
+	rhs = xlat_exp_head(b->group);
+	if (!rhs || xlat_exp_next(b->group, rhs)) return -1;
+
+	if ((lhs->type != XLAT_TMPL) || !tmpl_is_attr(lhs->vpt) || (rhs->type != XLAT_BOX)) {
+		if ((unlang_cond_ops_compile_value(ops, num_ops, &sp, a->group) < 0) ||
+		    (unlang_cond_ops_compile_value(ops, num_ops, &sp, b->group) < 0) ||
+		    (*num_ops >= UNLANG_COND_MAX_OPS)) {
+			*num_ops = start;
+			return -1;
+		}
+
+		ops[(*num_ops)++] = (unlang_cond_op_t) {
+			.type = UNLANG_COND_OP_CMP_STACK,
+			.op = node->call.func->token
+		};
+
+		return 0;
+	}
+
+	if (*num_ops >= UNLANG_COND_MAX_OPS) return -1;
+
+	ops[(*num_ops)++] = (unlang_cond_op_t) {
+		.type = UNLANG_COND_OP_CMP,
+		.op = node->call.func->token,
+		.vpt = lhs->vpt,
+		.value = &rhs->data
+	};
+
+	return 0;
+}
+
+/** Flatten an expression into a list of instructions
+ *
+ * && and || are turned into conditional jumps past the remaining
+ * arguments, which preserves short-circuit evaluation.
+ */
+static int unlang_cond_ops_compile_node(unlang_cond_op_t *ops, unsigned int *num_ops, xlat_exp_head_t const *head)
+{
+	xlat_exp_t const	*node = xlat_exp_head(head);
+	unsigned int		start, i;
+	fr_token_t		token;
+
+	if (!node || xlat_exp_next(head, node)) return -1;
+	if (node->type != XLAT_FUNC) return -1;
+
+	token = node->call.func->token;
+	switch (token) {
+	case T_OP_CMP_EQ:
+	case T_OP_NE:
+	case T_OP_LT:
+	case T_OP_LE:
+	case T_OP_GT:
+	case T_OP_GE:
+		return unlang_cond_ops_compile_cmp(ops, num_ops, node);
+
+	case T_LAND:
+	case T_LOR:
+		break;
+
+	default:
+		return -1;
+	}
+
+	/*
+	 *	Once instantiated, the arguments of && and || are
+	 *	moved into the instance data, and we can't get at them.
+	 */
+	if (!xlat_exp_head(node->call.args)) return -1;
+
+	start = *num_ops;
+	xlat_exp_foreach(node->call.args, arg) {
+		if (arg->type != XLAT_GROUP) return -1;
+
+		if (unlang_cond_ops_compile_node(ops, num_ops, arg->group) < 0) return -1;
+
+		if (!xlat_exp_next(node->call.args, arg)) break;
+
+		if (*num_ops >= UNLANG_COND_MAX_OPS) return -1;
+
+		ops[(*num_ops)++] = (unlang_cond_op_t) {
+			.type = (token == T_LAND) ? UNLANG_COND_OP_JUMP_IF_FALSE : UNLANG_COND_OP_JUMP_IF_TRUE
+		};
+	}
+
+	/*
+	 *	All of the jumps for this expression go to the
+	 *	instruction after it.  Nested expressions have
+	 *	already had their jumps patched.
+	 */
+	for (i = start; i < *num_ops; i++) {
+		switch (ops[i].type) {
+		case UNLANG_COND_OP_JUMP_IF_FALSE:
+		case UNLANG_COND_OP_JUMP_IF_TRUE:
+			if (!ops[i].target) ops[i].target = *num_ops;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/** Try to flatten the condition of an "if" or "elsif"
+ *
+ * If the condition contains anything other than comparisons of
+ * attributes against literal values, joined with && and ||, then
+ * nothing is done, and the condition is evaluated by the xlat
+ * interpreter as before.
+ *
+ * @param[in] gext	to flatten the condition of.
+ */
+void unlang_cond_ops_compile(unlang_cond_t *gext)
+{
+	unlang_cond_op_t	ops[UNLANG_COND_MAX_OPS];
+	unsigned int		num_ops = 0;
+
+	memset(ops, 0, sizeof(ops));
+
+	if (unlang_cond_ops_compile_node(ops, &num_ops, gext->head) < 0) return;
+
+	MEM(gext->ops = talloc_memdup(gext, ops, num_ops * sizeof(ops[0])));
+	gext->num_ops = num_ops;
+}
+
 void unlang_condition_init(void)
 {
 	unlang_register(UNLANG_TYPE_IF,
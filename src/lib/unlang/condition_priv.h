@@ -28,13 +28,64 @@ extern "C" {
 
 #include "unlang_priv.h"
 
+/** Maximum number of instructions in a flattened condition
+ *
+ */
+#define UNLANG_COND_MAX_OPS	32
+
+/** Maximum depth of the value stack used to evaluate arithmetic in a flattened condition
+ *
+ */
+#define UNLANG_COND_MAX_STACK	8
+
+typedef enum {
+	UNLANG_COND_OP_CMP = 0,				//!< Compare an attribute against a value.
+	UNLANG_COND_OP_JUMP_IF_FALSE,			//!< Jump to target if the last result was false.
+	UNLANG_COND_OP_JUMP_IF_TRUE,			//!< Jump to target if the last result was true.
+	UNLANG_COND_OP_PUSH_ATTR,			//!< Push the value of an attribute onto the value stack.
+	UNLANG_COND_OP_PUSH_VALUE,			//!< Push a literal value onto the value stack.
+	UNLANG_COND_OP_CALC,				//!< Replace the top two values on the stack with
+							///< the result of a binary operation.
+	UNLANG_COND_OP_CMP_STACK			//!< Compare the top two values on the stack, and
+							///< pop them.
+} unlang_cond_op_type_t;
+
+/** One instruction in a flattened condition
+ *
+ * Simple conditions, i.e. comparisons of an attribute against a literal
+ * value, joined with && and ||, are compiled into a linear list of these.
+ * The list is evaluated in place by unlang_if(), without pushing an xlat
+ * frame.
+ *
+ * Comparisons involving arithmetic on numeric attributes and literals
+ * are compiled into stack operations.  Intermediate values live on the
+ * C stack, rather than being allocated for each operation.
+ */
+typedef struct {
+	unlang_cond_op_type_t	type;
+	fr_token_t		op;			//!< Comparison or arithmetic operator.
+	tmpl_t const		*vpt;			//!< Attribute reference.
+	fr_value_box_t const	*value;			//!< Literal value.
+	unsigned int		target;			//!< Instruction to jump to.  Jumping to
+							///< num_ops ends evaluation.
+} unlang_cond_op_t;
+
 typedef struct {
-	unlang_group_t	group;
-	xlat_exp_head_t	*head;
-	bool		is_truthy;
-	bool		value;
+	unlang_group_t		group;
+	xlat_exp_head_t		*head;
+	bool			is_truthy;
+	bool			value;
+
+	unlang_cond_op_t	*ops;			//!< Flattened version of head.  NULL if
+							///< head couldn't be flattened.
+	unsigned int		num_ops;		//!< Number of entries in ops.
+
+	fr_dlist_t		entry;			//!< Entry in the list of conditions to fold
+							///< once xlats have been instantiated.
 } unlang_cond_t;
 
+void unlang_cond_ops_compile(unlang_cond_t *gext);
+
 /** Cast a group structure to the cond keyword extension
  *
  */
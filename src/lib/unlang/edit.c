@@ -482,8 +482,6 @@ apply_list:
 	}
 
 	if (map->op != T_OP_EQ) {
-		fr_assert(current->el != NULL);
-
 		rcode = fr_edit_list_apply_list_assignment(current->el, current->lhs.vp, map->op, children,
 							   (children != &current->rhs.pair_list));
 		if (rcode < 0) RPEDEBUG("Failed performing list '%s' operation", fr_tokens[map->op]);
@@ -1604,7 +1602,8 @@ static unlang_action_t process_edit(rlm_rcode_t *p_result, request_t *request, u
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
-static void edit_state_init_internal(request_t *request, unlang_frame_state_edit_t *state, fr_edit_list_t *el, map_list_t const *map_list)
+static void edit_state_init_internal(request_t *request, unlang_frame_state_edit_t *state, fr_edit_list_t *el,
+				     map_list_t const *map_list, bool no_journal)
 {
 	edit_map_t			*current = &state->first;
 
@@ -1615,8 +1614,15 @@ static void edit_state_init_internal(request_t *request, unlang_frame_state_edit
 	/*
 	 *	The edit list creates a local pool which should
 	 *	generally be large enough for most edits.
+	 *
+	 *	If the edit can't fail part way through, and we're
+	 *	not in a transaction, there's nothing to undo.
 	 */
-	if (!el) {
+	if (!el && no_journal) {
+		state->el = NULL;
+		state->ours = false;
+
+	} else if (!el) {
 		MEM(state->el = fr_edit_list_alloc(state, map_list_num_elements(map_list), NULL));
 		state->ours = true;
 	} else {
@@ -1657,7 +1663,7 @@ static unlang_action_t unlang_edit_state_init(rlm_rcode_t *p_result, request_t *
 	unlang_frame_state_edit_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_edit_t);
 	fr_edit_list_t			*el = unlang_interpret_edit_list(request);
 
-	edit_state_init_internal(request, state, el, &edit->maps);
+	edit_state_init_internal(request, state, el, &edit->maps, edit->no_journal);
 
 	/*
 	 *	Call process_edit to do all of the work.
@@ -1719,10 +1725,10 @@ int unlang_edit_push(request_t *request, bool *success, fr_edit_list_t *el, map_
 	if (unlang_interpret_push(request, unlang_edit_to_generic(edit),
 				  RLM_MODULE_NOT_SET, UNLANG_NEXT_STOP, false) < 0) return -1;
 
-	frame = &stack->frame[stack->depth];
+	frame = stack_frame_at(stack, stack->depth);
 	state = talloc_get_type_abort(frame->state, unlang_frame_state_edit_t);
 
-	edit_state_init_internal(request, state, el, map_list);
+	edit_state_init_internal(request, state, el, map_list, false);
 	state->success = success;
 
 	return 0;
@@ -31,6 +31,8 @@ extern "C" {
 typedef struct {
 	unlang_t		self;
 	map_list_t		maps;		//!< Head of the map list
+	bool			no_journal;	//!< The edit can't fail part way through, so there's
+						///< no need to record how to undo it.
 } unlang_edit_t;
 
 /** Cast a generic structure to the edit extension
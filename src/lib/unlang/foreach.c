@@ -582,7 +582,7 @@ static unlang_action_t unlang_foreach(rlm_rcode_t *p_result, request_t *request,
 	 */
 	if (stack->depth > 0) for (i = (stack->depth - 1); i >= 0; i--) {
 			unlang_t const *our_instruction;
-			our_instruction = stack->frame[i].instruction;
+			our_instruction = stack_frame_at(stack, i)->instruction;
 			if (!our_instruction || (our_instruction->type != UNLANG_TYPE_FOREACH)) continue;
 			depth++;
 		}
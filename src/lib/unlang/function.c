@@ -160,7 +160,7 @@ static unlang_action_t unlang_function_call(rlm_rcode_t *p_result, request_t *re
 int unlang_function_clear(request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_func_t	*state;
 
 	if (frame->instruction->type != UNLANG_TYPE_FUNCTION) {
@@ -194,7 +194,7 @@ int unlang_function_clear(request_t *request)
 int _unlang_function_signal_set(request_t *request, unlang_function_signal_t signal, fr_signal_t sigmask, char const *signal_name)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_func_t	*state;
 
 	if (frame->instruction->type != UNLANG_TYPE_FUNCTION) {
@@ -232,7 +232,7 @@ int _unlang_function_signal_set(request_t *request, unlang_function_signal_t sig
 int _unlang_function_repeat_set(request_t *request, unlang_function_t repeat, char const *repeat_name)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_func_t	*state;
 
 	if (frame->instruction->type != UNLANG_TYPE_FUNCTION) {
@@ -292,7 +292,7 @@ unlang_action_t _unlang_function_push(request_t *request,
 	if (unlang_interpret_push(request, &function_instruction,
 				  RLM_MODULE_NOOP, UNLANG_NEXT_STOP, top_frame) < 0) return UNLANG_ACTION_FAIL;
 
-	frame = &stack->frame[stack->depth];
+	frame = stack_frame_at(stack, stack->depth);
 
 	/*
 	 *	Tell the interpreter to call unlang_function_call
@@ -133,7 +133,7 @@ static void stack_dump(request_t *request)
 
 	RDEBUG2("----- Begin stack debug [depth %i, %s] -----", stack->depth, stack_unwind_flag_dump(stack->unwind));
 	for (i = stack->depth; i >= 0; i--) {
-		unlang_stack_frame_t *frame = &stack->frame[i];
+		unlang_stack_frame_t *frame = stack_frame_at(stack, i);
 
 		RDEBUG2("[%d] Frame contents", i);
 		frame_dump(request, frame);
@@ -185,10 +185,18 @@ int unlang_interpret_push(request_t *request, unlang_t const *instruction,
 
 	stack->depth++;
 
+	/*
+	 *	Grow the stack if we've moved into a new segment.
+	 */
+	if (unlikely(!stack->segment[stack->depth / UNLANG_STACK_SEGMENT])) {
+		MEM(stack->segment[stack->depth / UNLANG_STACK_SEGMENT] = talloc_array(stack, unlang_stack_frame_t,
+											  UNLANG_STACK_SEGMENT));
+	}
+
 	/*
 	 *	Initialize the next stack frame.
 	 */
-	frame = &stack->frame[stack->depth];
+	frame = stack_frame_at(stack, stack->depth);
 	memset(frame, 0, sizeof(*frame));
 
 	frame->instruction = instruction;
@@ -244,7 +252,7 @@ unlang_action_t unlang_interpret_push_children(rlm_rcode_t *p_result, request_t
 					      rlm_rcode_t default_rcode, bool do_next_sibling)
 {
 	unlang_stack_t		*stack = request->stack;
-	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];	/* Quiet static analysis */
+	unlang_stack_frame_t	*frame = stack_frame_at(stack, stack->depth);	/* Quiet static analysis */
 	unlang_group_t		*g;
 	unlang_variable_ref_t	*ref;
 
@@ -609,6 +617,14 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 */
 		repeatable_clear(frame);
 		unlang_frame_perf_resume(frame);
+
+		/*
+		 *	Trace the same things we record the latency of.
+		 */
+		if (unlikely(request->trace != NULL) && instruction->latency && !frame->span) {
+			frame->span = fr_trace_span_start(request, instruction->debug_name, true);
+		}
+
 		ua = frame->process(result, request, frame);
 
 		/*
@@ -649,7 +665,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 *	now continue at the deepest frame.
 		 */
 		case UNLANG_ACTION_PUSHED_CHILD:
-			fr_assert_msg(&stack->frame[stack->depth] > frame,
+			fr_assert_msg(stack_frame_at(stack, stack->depth) != frame,
 				      "Instruction %s returned UNLANG_ACTION_PUSHED_CHILD, "
 				      "but stack depth was not increased",
 				      instruction->name);
@@ -674,7 +690,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 *	called the interpreter.
 		 */
 		case UNLANG_ACTION_YIELD:
-			fr_assert_msg(&stack->frame[stack->depth] == frame,
+			fr_assert_msg(stack_frame_at(stack, stack->depth) == frame,
 				      "Instruction %s returned UNLANG_ACTION_YIELD, but pushed additional "
 				      "frames for evaluation.  Instruction should return UNLANG_ACTION_PUSHED_CHILD "
 				      "instead", instruction->name);
@@ -777,7 +793,7 @@ CC_HINT(hot) rlm_rcode_t unlang_interpret(request_t *request)
 	 */
 	unlang_stack_t		*stack = request->stack;
 	unlang_interpret_t	*intp = stack->intp;
-	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];	/* Quiet static analysis */
+	unlang_stack_frame_t	*frame = stack_frame_at(stack, stack->depth);	/* Quiet static analysis */
 
 	stack->priority = -1;	/* Reset */
 
@@ -802,7 +818,7 @@ CC_HINT(hot) rlm_rcode_t unlang_interpret(request_t *request)
 			fr_assert(stack->depth > 0);
 			fr_assert(stack->depth < UNLANG_STACK_MAX);
 
-			frame = &stack->frame[stack->depth];
+			frame = stack_frame_at(stack, stack->depth);
 			fa = frame_eval(request, frame, &stack->result, &stack->priority);
 
 			if (fa != UNLANG_FRAME_ACTION_POP) continue;
@@ -843,7 +859,7 @@ CC_HINT(hot) rlm_rcode_t unlang_interpret(request_t *request)
 			 *	Head on back up the stack
 			 */
 			frame_pop(request, stack);
-			frame = &stack->frame[stack->depth];
+			frame = stack_frame_at(stack, stack->depth);
 			DUMP_STACK;
 
 			/*
@@ -1050,22 +1066,48 @@ void *unlang_interpret_stack_alloc(TALLOC_CTX *ctx)
 	/*
 	 *	If we have talloc_pooled_object allocate the
 	 *	stack as a combined chunk/pool, with memory
-	 *	to hold at mutable data for at least a quarter
-	 *	of the maximum number of stack frames.
+	 *	to hold the mutable data for the first segment
+	 *	of stack frames.  The pool is a simple bump
+	 *	allocator, so frame state is cheap to allocate,
+	 *	and is only allocated for instructions which
+	 *	need it.
+	 *
+	 *	Only the first segment of frames is embedded in
+	 *	the stack.  Most requests never go deeper than
+	 *	that, and the remaining segments are allocated
+	 *	on demand.
 	 *
 	 *	Having a dedicated pool for mutable stack data
 	 *	means we don't have memory fragmentations issues
 	 *	as we would if request were used as the pool.
-	 *
-	 *	This number is pretty arbitrary, but it seems
-	 *	like too low level to make into a tuneable.
 	 */
-	MEM(stack = talloc_zero_pooled_object(ctx, unlang_stack_t, UNLANG_STACK_MAX, 128));	/* 128 bytes per state */
+	MEM(stack = talloc_zero_pooled_object(ctx, unlang_stack_t, UNLANG_STACK_SEGMENT * 2,
+					      UNLANG_STACK_SEGMENT * UNLANG_FRAME_PRE_ALLOC));
+	stack->segment[0] = stack->frame;
 	stack->result = RLM_MODULE_NOT_SET;
 
 	return stack;
 }
 
+/** Reset an unlang stack so that it can be used by another request
+ *
+ * Frees any state left over from the previous request, including
+ * any additional stack segments.  Frames are zeroed when they're
+ * pushed, so only the base of the stack needs to be reset.
+ *
+ * @param[in] ctx	the stack to reset.
+ */
+void unlang_interpret_stack_reset(void *ctx)
+{
+	unlang_stack_t *stack = talloc_get_type_abort(ctx, unlang_stack_t);
+
+	talloc_free_children(stack);
+
+	memset(stack, 0, offsetof(unlang_stack_t, frame[1]));
+	stack->segment[0] = stack->frame;
+	stack->result = RLM_MODULE_NOT_SET;
+}
+
 /** Indicate to the caller of the interpreter that this request is complete
  *
  */
@@ -1160,7 +1202,7 @@ void unlang_frame_signal(request_t *request, fr_signal_t action, int limit)
 	 */
 	if (action == FR_SIGNAL_CANCEL) {
 		for (i = depth; i > limit; i--) {
-			frame = &stack->frame[i];
+			frame = stack_frame_at(stack, i);
 			if (frame->signal) frame->signal(request, frame, action);
 			frame_cleanup(frame);
 		}
@@ -1178,7 +1220,7 @@ void unlang_frame_signal(request_t *request, fr_signal_t action, int limit)
 	 *	calls.
 	 */
 	for (i = depth; i > limit; i--) {
-		frame = &stack->frame[i];
+		frame = stack_frame_at(stack, i);
 		if (frame->signal) frame->signal(request, frame, action);
 	}
 }
@@ -1341,7 +1383,7 @@ bool unlang_request_is_done(request_t const *request)
 bool unlang_interpret_is_resumable(request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 
 	return is_yielded(frame);
 }
@@ -1360,7 +1402,7 @@ void unlang_interpret_mark_runnable(request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
 	unlang_interpret_t		*intp = stack->intp;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 
 	bool 				scheduled = unlang_request_is_scheduled(request);
 
@@ -1403,7 +1445,7 @@ void unlang_interpret_mark_runnable(request_t *request)
 TALLOC_CTX *unlang_interpret_frame_talloc_ctx(request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 
 	if (frame->state) return (TALLOC_CTX *)frame->state;
 
@@ -1575,7 +1617,7 @@ static xlat_action_t unlang_interpret_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	/*
 	 *	Get the current instruction.
 	 */
-	frame = &stack->frame[depth];
+	frame = stack_frame_at(stack, depth);
 	instruction = frame->instruction;
 
 	/*
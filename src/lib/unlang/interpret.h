@@ -36,6 +36,8 @@ extern "C" {
 #define UNLANG_SUB_FRAME (false)
 
 #define UNLANG_STACK_MAX (64)		//!< The maximum depth of the stack.
+#define UNLANG_STACK_SEGMENT (8)	//!< How many frames we allocate at a time.
+					///< UNLANG_STACK_MAX must be a multiple of this.
 #define UNLANG_FRAME_PRE_ALLOC (128)	//!< How much memory we pre-alloc for each frame.
 
 /** Interpreter handle
@@ -148,6 +150,8 @@ rlm_rcode_t		unlang_interpret_synchronous(fr_event_list_t *el, request_t *reques
 
 void			*unlang_interpret_stack_alloc(TALLOC_CTX *ctx);
 
+void			unlang_interpret_stack_reset(void *stack) CC_HINT(nonnull);
+
 bool			unlang_request_is_scheduled(request_t const *request);
 
 bool			unlang_request_is_cancelled(request_t const *request);
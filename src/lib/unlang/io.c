@@ -63,6 +63,8 @@ request_t *unlang_io_subrequest_alloc(request_t *parent, fr_dict_t const *namesp
 	 */
 	child->number = parent->number;
 
+	if (unlikely(parent->trace != NULL)) fr_trace_child_start(child, parent, "subrequest");
+
 	/*
 	 *	Initialize all of the async fields.
 	 */
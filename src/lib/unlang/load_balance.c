@@ -104,6 +104,87 @@ static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Get the load of a child, if it's a module which can report one
+ *
+ */
+static bool load_balance_child_load(uint64_t *out, unlang_t const *child)
+{
+	unlang_module_t const *m;
+
+	if (child->type != UNLANG_TYPE_MODULE) return false;
+
+	m = unlang_generic_to_module(child);
+	if (!m->mmc.mi || !m->mmc.rlm || !m->mmc.rlm->load) return false;
+
+	*out = m->mmc.rlm->load(m->mmc.mi);
+	return true;
+}
+
+/** Choose the less loaded of two random children
+ *
+ * This is the "power of two choices".  It avoids herding onto a
+ * single child when the load information is slightly out of date,
+ * which it always is, as other threads are sending requests too.
+ *
+ * @return
+ *	- The chosen child.
+ *	- NULL if any child can't report its load, or all of the
+ *	  children are unusable.
+ */
+static unlang_t *load_balance_by_load(request_t *request, unlang_group_t *g)
+{
+	unlang_t	*child, *a = NULL, *b = NULL;
+	uint64_t	load, load_a = UINT64_MAX, load_b = UINT64_MAX;
+	uint32_t	i, j, count = 0;
+
+	if (g->num_children < 2) return NULL;
+
+	for (child = g->children; child != NULL; child = child->next) {
+		if (!load_balance_child_load(&load, child)) return NULL;
+	}
+
+	i = fr_rand() % g->num_children;
+	j = fr_rand() % (g->num_children - 1);
+	if (j >= i) j++;
+
+	for (child = g->children; child != NULL; child = child->next, count++) {
+		if (count == i) {
+			a = child;
+			(void) load_balance_child_load(&load_a, a);
+		} else if (count == j) {
+			b = child;
+			(void) load_balance_child_load(&load_b, b);
+		}
+	}
+
+	/*
+	 *	Both are unusable.  Fall back to whichever child is
+	 *	usable, if any.
+	 */
+	if ((load_a == UINT64_MAX) && (load_b == UINT64_MAX)) {
+		a = NULL;
+		for (child = g->children; child != NULL; child = child->next) {
+			(void) load_balance_child_load(&load, child);
+			if (load < load_a) {
+				a = child;
+				load_a = load;
+			}
+		}
+		if (!a) return NULL;
+
+		RDEBUG3("load-balance choosing %s (load %" PRIu64 ")", a->debug_name, load_a);
+		return a;
+	}
+
+	if (load_b < load_a) {
+		a = b;
+		load_a = load_b;
+	}
+
+	RDEBUG3("load-balance choosing %s (load %" PRIu64 ")", a->debug_name, load_a);
+	return a;
+}
+
 static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
 	unlang_frame_state_redundant_t	*redundant;
@@ -198,18 +279,15 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 		count = 0;
 
 		/*
-		 *	Choose a child at random.
-		 *
-		 *	@todo - leverage the "power of 2", as per
-		 *      lib/io/network.c.  This is good enough for
-		 *      most purposes.  However, in order to do this,
-		 *      we need to track active callers across
-		 *      *either* multiple modules in one thread, *or*
-		 *      across multiple threads.
-		 *
-		 *	We don't have thread-specific instance data
-		 *	for this load-balance section.  So for now,
-		 *	just pick a random child.
+		 *	If the children are modules which track their
+		 *	own load across all threads, prefer the less
+		 *	loaded ones.
+		 */
+		redundant->found = load_balance_by_load(request, g);
+		if (redundant->found) goto chosen;
+
+		/*
+		 *	Otherwise choose a child at random.
 		 */
 		for (redundant->child = redundant->found = g->children;
 		     redundant->child != NULL;
@@ -222,6 +300,7 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 		}
 	}
 
+chosen:
 	/*
 	 *	Plain "load-balance".  Just do one child.
 	 */
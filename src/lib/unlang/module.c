@@ -35,6 +35,35 @@ RCSID("$Id$")
 
 #include "tmpl.h"
 
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/*
+ *	Profiling settings.  These are set before the workers are
+ *	started, and don't change.
+ */
+static bool			module_profile;			//!< Record CPU time, yields and waits.
+static uint32_t			module_slow_num;		//!< How many of the slowest calls to keep.
+static fr_time_delta_t		module_slow_interval;		//!< How often to start a new set of calls.
+
+/*
+ *	The slowest calls.  The workers only take the mutex for
+ *	calls which are slower than the fastest one we're keeping,
+ *	or when the interval has ended.
+ */
+static pthread_mutex_t		module_slow_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unlang_module_slow_t	*module_slow_current;		//!< Calls in this interval.
+static unlang_module_slow_t	*module_slow_previous;		//!< Calls in the last complete interval.
+static uint32_t			module_slow_current_num;
+static uint32_t			module_slow_previous_num;
+static atomic_int_fast64_t	module_slow_end;		//!< When the current interval ends.
+static atomic_int_fast64_t	module_slow_min;		//!< Calls this fast or faster aren't kept.
+
 static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame);
 static void unlang_module_event_retry_handler(UNUSED fr_event_list_t *el, fr_time_t now, void *ctx);
 
@@ -100,7 +129,7 @@ int unlang_module_push(rlm_rcode_t *p_result, request_t *request,
 		return -1;
 	}
 
-	frame = &stack->frame[stack->depth];
+	frame = stack_frame_at(stack, stack->depth);
 	state = frame->state;
 	*state = (unlang_frame_state_module_t){
 		.p_result = p_result,
@@ -132,7 +161,7 @@ int unlang_module_push(rlm_rcode_t *p_result, request_t *request,
 int unlang_module_set_resume(request_t *request, module_method_t resume)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_module_t	*state;
 
 	/*
@@ -253,7 +282,7 @@ unlang_action_t unlang_module_yield_to_section(rlm_rcode_t *p_result,
 {
 	if (!subcs) {
 		unlang_stack_t			*stack = request->stack;
-		unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+		unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 		unlang_module_t			*m;
 		unlang_frame_state_module_t	*state;
 
@@ -292,7 +321,7 @@ unlang_action_t unlang_module_yield_to_section(rlm_rcode_t *p_result,
 void unlang_module_retry_now(module_ctx_t const *mctx, request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 
 	if (!state->retry_cb) return;
@@ -323,7 +352,7 @@ void unlang_module_retry_now(module_ctx_t const *mctx, request_t *request)
 static unlang_action_t unlang_module_retry_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 
 	/*
@@ -363,7 +392,7 @@ unlang_action_t	unlang_module_yield_to_retry(request_t *request, module_method_t
 					     fr_retry_config_t const *retry_cfg)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_module_t			*m;
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 
@@ -420,7 +449,7 @@ unlang_action_t unlang_module_yield(request_t *request,
 				    module_method_t resume, unlang_module_signal_t signal, fr_signal_t sigmask, void *rctx)
 {
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 
 	REQUEST_VERIFY(request);	/* Check the yielded request is sane */
@@ -456,6 +485,225 @@ static inline CC_HINT(always_inline) void safe_unlock(module_instance_t *mi)
 	if ((mi->exported->flags & MODULE_TYPE_THREAD_UNSAFE) != 0) pthread_mutex_unlock(&mi->mutex);
 }
 
+/** Enable profiling of module calls
+ *
+ * Must be called before the workers are started.
+ *
+ * @param[in] enable		record the thread CPU time used by each module
+ *				method, how often it yields, and how long it waits
+ *				to be resumed.  Reading the thread CPU clock is a
+ *				system call on most platforms, so this isn't free.
+ * @param[in] slow_num		keep the unlang stack for this many of the slowest
+ *				module calls in each interval.  0 disables it.
+ * @param[in] slow_interval	how long each interval is.
+ */
+void unlang_module_profile_init(bool enable, uint32_t slow_num, fr_time_delta_t slow_interval)
+{
+	module_profile = enable;
+	module_slow_num = slow_num;
+	module_slow_interval = slow_interval;
+
+	TALLOC_FREE(module_slow_current);
+	TALLOC_FREE(module_slow_previous);
+	module_slow_current_num = module_slow_previous_num = 0;
+	atomic_store(&module_slow_end, 0);
+	atomic_store(&module_slow_min, 0);
+
+	if (!slow_num) return;
+
+	MEM(module_slow_current = talloc_zero_array(NULL, unlang_module_slow_t, slow_num));
+	MEM(module_slow_previous = talloc_zero_array(NULL, unlang_module_slow_t, slow_num));
+}
+
+static inline CC_HINT(always_inline) uint64_t module_cpu_time(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts));
+}
+
+/** Record the CPU time used by one call to a module method, or its resume function
+ *
+ */
+static void module_profile_call(unlang_stack_frame_t *frame, unlang_frame_state_module_t *state,
+				uint64_t cpu, unlang_action_t ua, bool first)
+{
+	unlang_module_profile_t *p = unlang_thread_profile(frame->instruction);
+
+	if (!p) return;
+
+	if (first) p->calls++;
+	p->cpu += module_cpu_time() - cpu;
+
+	if (ua == UNLANG_ACTION_YIELD) {
+		p->yields++;
+		state->yielded = fr_time();
+	}
+}
+
+/** Record how long the module waited to be resumed
+ *
+ */
+static void module_profile_resume(unlang_stack_frame_t *frame, unlang_frame_state_module_t *state)
+{
+	unlang_module_profile_t *p;
+
+	if (!fr_time_ispos(state->yielded)) return;
+
+	p = unlang_thread_profile(frame->instruction);
+	if (p) p->wait += fr_time_delta_unwrap(fr_time_sub(fr_time(), state->yielded));
+
+	state->yielded = fr_time_wrap(0);
+}
+
+/** Start a new interval, if the current one has ended
+ *
+ * Must be called with module_slow_mutex held.
+ */
+static void module_slow_rotate(fr_time_t now)
+{
+	fr_time_t end = fr_time_wrap(atomic_load(&module_slow_end));
+
+	if (fr_time_lt(now, end)) return;
+
+	/*
+	 *	If nothing finished during the last interval, then
+	 *	the current calls are too old to be interesting.
+	 */
+	if (fr_time_lt(now, fr_time_add(end, module_slow_interval))) {
+		unlang_module_slow_t *tmp = module_slow_previous;
+
+		module_slow_previous = module_slow_current;
+		module_slow_current = tmp;
+		module_slow_previous_num = module_slow_current_num;
+	} else {
+		module_slow_previous_num = 0;
+	}
+	module_slow_current_num = 0;
+
+	atomic_store(&module_slow_min, 0);
+	atomic_store(&module_slow_end, fr_time_unwrap(fr_time_add(now, module_slow_interval)));
+}
+
+/** Keep the module call if it's one of the slowest in this interval
+ *
+ */
+static void module_slow_sample(request_t *request, unlang_stack_frame_t *frame, unlang_frame_state_module_t *state)
+{
+	unlang_stack_t		*stack = request->stack;
+	unlang_module_t		*m = unlang_generic_to_module(frame->instruction);
+	fr_time_t		now = fr_time();
+	fr_time_delta_t		elapsed = fr_time_sub(now, state->started);
+	unlang_module_slow_t	slow, *s;
+	fr_sbuff_t		sbuff;
+	int			i;
+	uint32_t		j;
+
+	if ((fr_time_delta_unwrap(elapsed) <= atomic_load_explicit(&module_slow_min, memory_order_relaxed)) &&
+	    (fr_time_unwrap(now) < atomic_load_explicit(&module_slow_end, memory_order_relaxed))) return;
+
+	slow = (unlang_module_slow_t) {
+		.number = request->number,
+		.when = now,
+		.elapsed = elapsed
+	};
+	strlcpy(slow.module, m->mmc.mi->name, sizeof(slow.module));
+
+	/*
+	 *	If the stack is too deep to fit, the innermost
+	 *	entries are left out.
+	 */
+	sbuff = FR_SBUFF_OUT(slow.stack, sizeof(slow.stack));
+	for (i = 0; i <= stack->depth; i++) {
+		unlang_t const *instruction = stack_frame_at(stack, i)->instruction;
+
+		if (!instruction) continue;
+
+		if ((fr_sbuff_used(&sbuff) > 0) && (fr_sbuff_in_strcpy(&sbuff, " > ") < 0)) break;
+		if (fr_sbuff_in_strcpy(&sbuff, instruction->debug_name ? instruction->debug_name :
+					       unlang_ops[instruction->type].name) < 0) break;
+	}
+
+	pthread_mutex_lock(&module_slow_mutex);
+	module_slow_rotate(now);
+
+	if (module_slow_current_num < module_slow_num) {
+		s = &module_slow_current[module_slow_current_num++];
+	} else {
+		s = &module_slow_current[0];
+		for (j = 1; j < module_slow_current_num; j++) {
+			if (fr_time_delta_lt(module_slow_current[j].elapsed, s->elapsed)) s = &module_slow_current[j];
+		}
+
+		if (fr_time_delta_lteq(elapsed, s->elapsed)) goto done;
+	}
+	*s = slow;
+
+	/*
+	 *	Once we have enough calls, only faster ones than the
+	 *	fastest one we've kept are interesting.
+	 */
+	if (module_slow_current_num == module_slow_num) {
+		fr_time_delta_t min = module_slow_current[0].elapsed;
+
+		for (j = 1; j < module_slow_current_num; j++) {
+			if (fr_time_delta_lt(module_slow_current[j].elapsed, min)) min = module_slow_current[j].elapsed;
+		}
+		atomic_store(&module_slow_min, fr_time_delta_unwrap(min));
+	}
+
+done:
+	pthread_mutex_unlock(&module_slow_mutex);
+}
+
+/** Sort the slowest calls first
+ *
+ */
+static int module_slow_cmp(void const *one, void const *two)
+{
+	unlang_module_slow_t const *a = one, *b = two;
+
+	return CMP(fr_time_delta_unwrap(b->elapsed), fr_time_delta_unwrap(a->elapsed));
+}
+
+/** Walk over the slowest module calls, slowest first
+ *
+ * The calls from the last complete interval are walked.  If an
+ * interval hasn't completed yet, the calls from the current one are
+ * walked instead.
+ *
+ * @param[in] walk	called for each call.
+ * @param[in] uctx	passed to walk.
+ */
+void unlang_module_slow_walk(unlang_module_slow_walk_t walk, void *uctx)
+{
+	unlang_module_slow_t	*slow;
+	uint32_t		i, num;
+
+	if (!module_slow_num) return;
+
+	MEM(slow = talloc_array(NULL, unlang_module_slow_t, module_slow_num));
+
+	pthread_mutex_lock(&module_slow_mutex);
+	module_slow_rotate(fr_time());
+	if (module_slow_previous_num) {
+		num = module_slow_previous_num;
+		memcpy(slow, module_slow_previous, num * sizeof(*slow));
+	} else {
+		num = module_slow_current_num;
+		memcpy(slow, module_slow_current, num * sizeof(*slow));
+	}
+	pthread_mutex_unlock(&module_slow_mutex);
+
+	qsort(slow, num, sizeof(*slow), module_slow_cmp);
+
+	for (i = 0; i < num; i++) walk(uctx, &slow[i]);
+
+	talloc_free(slow);
+}
+
 /** Send a signal (usually stop) to a request
  *
  * This is typically called via an "async" action, i.e. an action
@@ -514,6 +762,9 @@ static unlang_action_t unlang_module_done(rlm_rcode_t *p_result, request_t *requ
 	RDEBUG("%s (%s)", frame->instruction->name ? frame->instruction->name : "",
 	       fr_table_str_by_value(mod_rcode_table, rcode, "<invalid>"));
 
+	if (module_profile) module_profile_resume(frame, state);
+	if (module_slow_num && fr_time_ispos(state->started)) module_slow_sample(request, frame, state);
+
 	if (state->p_result) *state->p_result = rcode;	/* Inform our caller if we have one */
 	*p_result = rcode;
 	request->module = state->previous_module;
@@ -544,6 +795,7 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	unlang_module_t			*m = unlang_generic_to_module(frame->instruction);
 	module_method_t			resume;
 	unlang_action_t			ua;
+	uint64_t			cpu = 0;
 
 	/*
 	 *	Update the rcode from any child calls that
@@ -566,6 +818,11 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	 */
 	state->resume = NULL;
 
+	if (module_profile) {
+		module_profile_resume(frame, state);
+		cpu = module_cpu_time();
+	}
+
 	/*
 	 *	Lock is noop unless instance->mutex is set.
 	 */
@@ -574,6 +831,8 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 					      state->env_data, state->rctx), request);
 	safe_unlock(m->mmc.mi);
 
+	if (module_profile) module_profile_call(frame, state, cpu, ua, false);
+
 	if (request->master_state == REQUEST_STOP_PROCESSING) ua = UNLANG_ACTION_STOP_PROCESSING;
 
 	switch (ua) {
@@ -667,7 +926,7 @@ static void unlang_module_event_retry_handler(UNUSED fr_event_list_t *el, fr_tim
 {
 	request_t			*request = talloc_get_type_abort(ctx, request_t);
 	unlang_stack_t			*stack = request->stack;
-	unlang_stack_frame_t		*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t		*frame = stack_frame_at(stack, stack->depth);
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 
 	switch (fr_retry_next(&state->retry, now)) {
@@ -743,6 +1002,7 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 	unlang_frame_state_module_t	*state = talloc_get_type_abort(frame->state, unlang_frame_state_module_t);
 	unlang_action_t			ua;
 	fr_time_t			now = fr_time_wrap(0);
+	uint64_t			cpu = 0;
 
 	*p_result = state->rcode = RLM_MODULE_NOOP;
 	state->rcode_set = true;
@@ -816,6 +1076,9 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 	 */
 	if (fr_time_delta_ispos(frame->instruction->actions.retry.irt)) now = fr_time();
 
+	if (module_slow_num) state->started = fr_time();
+	if (module_profile) cpu = module_cpu_time();
+
 	request->module = m->mmc.mi->name;
 	safe_lock(m->mmc.mi);	/* Noop unless instance->mutex set */
 	ua = m->mmc.mmb.method(&state->rcode,
@@ -823,6 +1086,8 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 			       request);
 	safe_unlock(m->mmc.mi);
 
+	if (module_profile) module_profile_call(frame, state, cpu, ua, true);
+
 	if (request->master_state == REQUEST_STOP_PROCESSING) ua = UNLANG_ACTION_STOP_PROCESSING;
 
 	switch (ua) {
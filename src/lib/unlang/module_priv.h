@@ -89,6 +89,13 @@ typedef struct {
 
 	/** @} */
 
+	/** @name Profiling
+	 * @{
+	 */
+	fr_time_t			started;		//!< When the module was first called.
+	fr_time_t			yielded;		//!< When the module last yielded.
+
+	/** @} */
 } unlang_frame_state_module_t;
 
 static inline unlang_module_t *unlang_generic_to_module(unlang_t const *p)
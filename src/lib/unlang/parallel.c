@@ -94,7 +94,7 @@ static inline CC_HINT(always_inline) void unlang_parallel_cancel_child(unlang_pa
 static void unlang_parallel_cancel_siblings(request_t *request)
 {
 	unlang_stack_t		*stack = request->parent->stack;
-	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
+	unlang_stack_frame_t	*frame = stack_frame_at(stack, stack->depth);
 	unlang_parallel_state_t	*state = talloc_get_type_abort(frame->state, unlang_parallel_state_t);
 	int i;
 
@@ -184,6 +184,50 @@ static unlang_action_t unlang_parallel_child_done(UNUSED rlm_rcode_t *p_result,
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** Move the pairs a child added to one of its lists into the parent
+ *
+ * @param[in] ctx		to steal the pairs into.
+ * @param[in] to		parent list.
+ * @param[in] from		child list.
+ * @param[in] first_wins	Don't add attributes which are already in the parent list.
+ */
+static void unlang_parallel_merge_list(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t *from, bool first_wins)
+{
+	fr_pair_t *vp;
+
+	/*
+	 *	Check against the parent before anything from
+	 *	this child is added, so a child can still supply
+	 *	multiple instances of an attribute.
+	 */
+	if (first_wins) {
+		fr_pair_list_foreach(from, child_vp) {
+			if (fr_pair_find_by_da(to, NULL, child_vp->da)) fr_pair_delete(from, child_vp);
+		}
+	}
+
+	while ((vp = fr_pair_list_head(from))) {
+		fr_pair_remove(from, vp);
+		(void) fr_pair_steal_append(ctx, to, vp);
+	}
+}
+
+/** Merge the reply and control lists of an exited child into the parent
+ *
+ */
+static void unlang_parallel_merge_child(request_t *request, unlang_parallel_state_t *state, int i)
+{
+	request_t	*child = state->children[i].request;
+	bool		first_wins = (state->merge == UNLANG_PARALLEL_MERGE_FIRST);
+
+	RDEBUG3("parallel - child %s (%d/%d) MERGED",
+		state->children[i].name,
+		i + 1, state->num_children);
+
+	unlang_parallel_merge_list(request->reply_ctx, &request->reply_pairs, &child->reply_pairs, first_wins);
+	unlang_parallel_merge_list(request->control_ctx, &request->control_pairs, &child->control_pairs, first_wins);
+}
+
 static unlang_action_t unlang_parallel_resume(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
 	unlang_parallel_state_t		*state = talloc_get_type_abort(frame->state, unlang_parallel_state_t);
@@ -225,6 +269,7 @@ static unlang_action_t unlang_parallel_resume(rlm_rcode_t *p_result, request_t *
 		if (priority > state->priority) {
 			state->result = result;
 			state->priority = priority;
+			state->winner = i;
 
 			RDEBUG4("** [%i] %s - over-riding result from higher priority to (%s %d)",
 				stack_depth_current(request), __FUNCTION__,
@@ -233,6 +278,29 @@ static unlang_action_t unlang_parallel_resume(rlm_rcode_t *p_result, request_t *
 		}
 	}
 
+	/*
+	 *	Merge the children's lists back into the parent.
+	 */
+	switch (state->merge) {
+	case UNLANG_PARALLEL_MERGE_NONE:
+		break;
+
+	case UNLANG_PARALLEL_MERGE_FIRST:
+	case UNLANG_PARALLEL_MERGE_ALL:
+		for (i = 0; i < state->num_children; i++) {
+			if (!state->children[i].request) continue;
+
+			unlang_parallel_merge_child(request, state, i);
+		}
+		break;
+
+	case UNLANG_PARALLEL_MERGE_PRIORITY:
+		if ((state->winner >= 0) && state->children[state->winner].request) {
+			unlang_parallel_merge_child(request, state, state->winner);
+		}
+		break;
+	}
+
 	/*
 	 *	Reap the children....
 	 */
@@ -282,22 +350,38 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 			child->name,
 			i + 1, state->num_children);
 
-		if (state->clone) {
+		if (state->merge != UNLANG_PARALLEL_MERGE_NONE) {
+			/*
+			 *	The reply and control lists start
+			 *	empty, and collect whatever the
+			 *	child adds, so they can be merged
+			 *	back into the parent.  The child
+			 *	can still read the parent's lists
+			 *	via &parent.
+			 */
+			if (fr_pair_list_copy_shared(child->request_ctx,
+						     &child->request_pairs,
+						     &request->request_pairs) < 0) {
+				REDEBUG("failed copying request list to child");
+				goto error;
+			}
+
+		} else if (state->clone) {
 			/*
 			 *	Note that we do NOT copy the
 			 *	Session-State list!  That
 			 *	contains state information for
 			 *	the parent.
 			 */
-			if ((fr_pair_list_copy(child->request_ctx,
-					       &child->request_pairs,
-					       &request->request_pairs) < 0) ||
-			    (fr_pair_list_copy(child->reply_ctx,
-					       &child->reply_pairs,
-					       &request->reply_pairs) < 0) ||
-			    (fr_pair_list_copy(child->control_ctx,
-					       &child->control_pairs,
-					       &request->control_pairs) < 0)) {
+			if ((fr_pair_list_copy_shared(child->request_ctx,
+						      &child->request_pairs,
+						      &request->request_pairs) < 0) ||
+			    (fr_pair_list_copy_shared(child->reply_ctx,
+						      &child->reply_pairs,
+						      &request->reply_pairs) < 0) ||
+			    (fr_pair_list_copy_shared(child->control_ctx,
+						      &child->control_pairs,
+						      &request->control_pairs) < 0)) {
 				REDEBUG("failed copying lists to clone");
 			error:
 				/*
@@ -476,6 +560,8 @@ static unlang_action_t unlang_parallel(rlm_rcode_t *p_result, request_t *request
 	state->priority = -1;				/* as-yet unset */
 	state->detach = gext->detach;
 	state->clone = gext->clone;
+	state->merge = gext->merge;
+	state->winner = -1;
 	state->num_children = g->num_children;
 
 	/*
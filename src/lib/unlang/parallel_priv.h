@@ -44,6 +44,17 @@ typedef enum {
 	CHILD_DONE					//!< The child has completed.
 } unlang_parallel_child_state_t;
 
+/** How the reply and control lists of children are merged into the parent
+ *
+ */
+typedef enum {
+	UNLANG_PARALLEL_MERGE_NONE = 0,			//!< Children are independent, their lists are discarded.
+	UNLANG_PARALLEL_MERGE_FIRST,			//!< Children are merged in order, attributes already
+							///< in the parent are not added again.
+	UNLANG_PARALLEL_MERGE_ALL,			//!< All attributes from all children are added.
+	UNLANG_PARALLEL_MERGE_PRIORITY			//!< Only the child which set the section's rcode is merged.
+} unlang_parallel_merge_t;
+
 /** Each parallel child has a state, and an associated request
  *
  */
@@ -65,6 +76,8 @@ typedef struct {
 
 	bool				detach;		//!< are we creating the child detached
 	bool				clone;		//!< are the children cloned
+	unlang_parallel_merge_t		merge;		//!< How to merge the children's lists back into the parent.
+	int				winner;		//!< Child which set the result.  -1 if none did.
 
 	unlang_parallel_child_t		children[];	//!< Array of children.
 } unlang_parallel_state_t;
@@ -73,6 +86,7 @@ typedef struct {
 	unlang_group_t			group;
 	bool				detach;		//!< are we creating the child detached
 	bool				clone;
+	unlang_parallel_merge_t		merge;		//!< How to merge the children's lists back into the parent.
 } unlang_parallel_t;
 
 /** Cast a group structure to the parallel keyword extension
@@ -134,7 +134,7 @@ static unlang_action_t unlang_subrequest_parent_resume(rlm_rcode_t *p_result, re
 			return UNLANG_ACTION_CALCULATE_RESULT;
 		}
 
-		MEM(fr_pair_list_copy(vp, &vp->vp_group, &child->reply_pairs) >= 0);
+		MEM(fr_pair_list_copy_shared(vp, &vp->vp_group, &child->reply_pairs) >= 0);
 
 		tmpl_dcursor_clear(&cc);
 	}
@@ -72,6 +72,21 @@ static unlang_action_t unlang_switch(rlm_rcode_t *p_result, request_t *request,
 			goto do_null_case;
 		} else {
 			box = &vp->data;
+
+			/*
+			 *	Dense integer cases, index directly
+			 *	into the jump table.
+			 */
+			if (switch_gext->jump) {
+				int64_t key;
+				uint64_t idx;
+
+				if (unlang_switch_jump_key(&key, box) < 0) goto find_null_case;
+
+				idx = (uint64_t)key - (uint64_t)switch_gext->jump_min;
+				found = (idx < switch_gext->jump_len) ? switch_gext->jump[idx] : switch_gext->default_case;
+				goto do_null_case;
+			}
 		}
 
 	/*
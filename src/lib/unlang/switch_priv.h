@@ -29,13 +29,70 @@ extern "C" {
 #include <freeradius-devel/server/tmpl.h>
 #include <freeradius-devel/util/htrie.h>
 
+/** Maximum range of integer case values we'll build a jump table for
+ *
+ */
+#define UNLANG_SWITCH_JUMP_MAX	1024
+
 typedef struct {
 	unlang_group_t	group;
 	unlang_t	*default_case;
 	tmpl_t		*vpt;
 	fr_htrie_t	*ht;
+
+	unlang_t	**jump;		//!< Cases indexed by (value - jump_min), or NULL.
+					///< Empty slots point to the default case.
+	int64_t		jump_min;	//!< Smallest case value.
+	size_t		jump_len;	//!< Number of entries in the jump table.
 } unlang_switch_t;
 
+/** Convert an integer box to a jump table key
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the box isn't an integer, or doesn't fit.
+ */
+static inline int unlang_switch_jump_key(int64_t *out, fr_value_box_t const *box)
+{
+	switch (box->type) {
+	case FR_TYPE_UINT8:
+		*out = box->vb_uint8;
+		return 0;
+
+	case FR_TYPE_UINT16:
+		*out = box->vb_uint16;
+		return 0;
+
+	case FR_TYPE_UINT32:
+		*out = box->vb_uint32;
+		return 0;
+
+	case FR_TYPE_UINT64:
+		if (box->vb_uint64 > INT64_MAX) return -1;
+		*out = box->vb_uint64;
+		return 0;
+
+	case FR_TYPE_INT8:
+		*out = box->vb_int8;
+		return 0;
+
+	case FR_TYPE_INT16:
+		*out = box->vb_int16;
+		return 0;
+
+	case FR_TYPE_INT32:
+		*out = box->vb_int32;
+		return 0;
+
+	case FR_TYPE_INT64:
+		*out = box->vb_int64;
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
 /** Cast a group structure to the switch keyword extension
  *
  */
@@ -304,7 +304,7 @@ int unlang_tmpl_push(TALLOC_CTX *ctx, fr_value_box_list_t *out, request_t *reque
 	if (unlang_interpret_push(request, unlang_tmpl_to_generic(ut),
 				  RLM_MODULE_NOT_SET, UNLANG_NEXT_STOP, false) < 0) return -1;
 
-	frame = &stack->frame[stack->depth];
+	frame = stack_frame_at(stack, stack->depth);
 	state = talloc_get_type_abort(frame->state, unlang_frame_state_tmpl_t);
 
 	*state = (unlang_frame_state_tmpl_t) {
@@ -108,7 +108,7 @@ fr_edit_list_t *unlang_interpret_edit_list(request_t *request)
 	for (i = depth - 1; i > 0; i--) {
 		unlang_frame_state_transaction_t *state;
 
-		frame = &stack->frame[i];
+		frame = stack_frame_at(stack, i);
 		if (frame->instruction->type != UNLANG_TYPE_TRANSACTION) continue;
 
 		state = talloc_get_type_abort(frame->state, unlang_frame_state_transaction_t);
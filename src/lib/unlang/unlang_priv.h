@@ -28,6 +28,7 @@
 #include <freeradius-devel/server/cf_util.h> /* Need CONF_* definitions */
 #include <freeradius-devel/server/map_proc.h>
 #include <freeradius-devel/server/modpriv.h>
+#include <freeradius-devel/server/trace.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/io/listen.h>
@@ -118,6 +119,7 @@ struct unlang_s {
 	bool			closed;		//!< whether or not this section is closed to new statements
 	CONF_ITEM		*ci;		//!< used to generate this item
 	unsigned int		number;		//!< unique node number
+	bool			latency;	//!< record how long requests spend in this node.
 	unlang_mod_actions_t	actions;	//!< Priorities, etc. for the various return codes.
 };
 
@@ -232,6 +234,8 @@ typedef struct {
 typedef struct {
 	unlang_t const		*instruction;			//!< instruction which we're executing
 	void			*thread_inst;			//!< thread-specific instance data
+	fr_histogram_t		*latency;			//!< how long requests spent in this instruction
+	unlang_module_profile_t	profile;			//!< resources used by module calls.
 #ifdef WITH_PERF
 	uint64_t		use_count;			//!< how many packets it has processed
 	uint64_t		running;			//!< currently running this instruction
@@ -242,6 +246,10 @@ typedef struct {
 
 void	*unlang_thread_instance(unlang_t const *instruction);
 
+void	unlang_frame_latency_end(unlang_stack_frame_t *frame);
+
+unlang_module_profile_t	*unlang_thread_profile(unlang_t const *instruction);
+
 #ifdef WITH_PERF
 void		unlang_frame_perf_init(unlang_stack_frame_t *frame);
 void		unlang_frame_perf_yield(unlang_stack_frame_t *frame);
@@ -303,6 +311,10 @@ struct unlang_stack_frame_s {
 								///< frame lower in the stack to determine if the
 								///< result stored in the lower stack frame should
 	uint8_t			uflags;				//!< Unwind markers
+	fr_time_t		latency_start;			//!< When we started executing an instruction
+								///< which records latency, including any retries.
+	fr_trace_span_t		*span;				//!< Span for an instruction which records latency,
+								///< if the request is being traced.
 #ifdef WITH_PERF
 	fr_time_tracking_t	tracking;			//!< track this instance of this instruction
 #endif
@@ -319,9 +331,25 @@ typedef struct {
 	int			depth;				//!< Current depth we're executing at.
 	uint8_t			unwind;				//!< Unwind to this frame if it exists.
 								///< This is used for break and return.
-	unlang_stack_frame_t	frame[UNLANG_STACK_MAX];	//!< The stack...
+	unlang_stack_frame_t	*segment[UNLANG_STACK_MAX / UNLANG_STACK_SEGMENT];	//!< Frames, allocated
+								///< UNLANG_STACK_SEGMENT at a time, as the
+								///< stack grows.  Segments are kept until the
+								///< stack is freed or reset.
+	unlang_stack_frame_t	frame[UNLANG_STACK_SEGMENT];	//!< The first segment of the stack.
 } unlang_stack_t;
 
+static_assert((UNLANG_STACK_MAX % UNLANG_STACK_SEGMENT) == 0, "UNLANG_STACK_MAX must be a multiple of UNLANG_STACK_SEGMENT");
+
+/** Return the frame at a given depth
+ *
+ * Frames never move once allocated, so pointers to them remain valid
+ * as the stack grows.
+ */
+static inline unlang_stack_frame_t *stack_frame_at(unlang_stack_t *stack, int depth)
+{
+	return &stack->segment[depth / UNLANG_STACK_SEGMENT][depth % UNLANG_STACK_SEGMENT];
+}
+
 /** Different operations the interpreter can execute
  */
 extern unlang_op_t unlang_ops[];
@@ -387,7 +415,7 @@ static inline unlang_stack_frame_t *frame_current(request_t *request)
 {
 	unlang_stack_t *stack = request->stack;
 
-	return &stack->frame[stack->depth];
+	return stack_frame_at(stack, stack->depth);
 }
 
 static inline int stack_depth_current(request_t *request)
@@ -405,6 +433,12 @@ static inline void frame_state_init(unlang_stack_t *stack, unlang_stack_frame_t
 
 	unlang_frame_perf_init(frame);
 
+	/*
+	 *	Retries re-initialise the frame, but they count
+	 *	towards the latency of the original call.
+	 */
+	if (instruction->latency && !fr_time_ispos(frame->latency_start)) frame->latency_start = fr_time();
+
 	op = &unlang_ops[instruction->type];
 	name = op->frame_state_type ? op->frame_state_type : __location__;
 
@@ -449,6 +483,13 @@ static inline void frame_cleanup(unlang_stack_frame_t *frame)
 {
 	unlang_frame_perf_cleanup(frame);
 
+	if (fr_time_ispos(frame->latency_start)) unlang_frame_latency_end(frame);
+
+	if (unlikely(frame->span != NULL)) {
+		fr_trace_span_end(frame->span, (frame->result == RLM_MODULE_FAIL));
+		frame->span = NULL;
+	}
+
 	/*
 	 *	Don't clear top_frame flag, bad things happen...
 	 */
@@ -485,7 +526,7 @@ static inline void frame_pop(request_t *request, unlang_stack_t *stack)
 
 	fr_assert(stack->depth > 1);
 
-	frame = &stack->frame[stack->depth];
+	frame = stack_frame_at(stack, stack->depth);
 
 	/*
 	 *	We clean up the retries when we pop the frame, not
@@ -498,7 +539,7 @@ static inline void frame_pop(request_t *request, unlang_stack_t *stack)
 
 	frame_cleanup(frame);
 
-	frame = &stack->frame[--stack->depth];
+	frame = stack_frame_at(stack, --stack->depth);
 
 	/*
 	 *	Signal the frame to get it back into a consistent state
@@ -29,7 +29,9 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/unlang/xlat.h>
 #include <freeradius-devel/unlang/xlat_priv.h>
+#include <freeradius-devel/util/dbuff.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/types.h>
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/value.h>
@@ -924,6 +926,165 @@ xlat_action_t xlat_frame_eval_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	return xa;
 }
 
+#ifndef XLAT_MEMO_SIZE
+#  define XLAT_MEMO_SIZE	64		//!< Number of memoised results per thread.  Must be a power of 2.
+#endif
+#define XLAT_MEMO_KEY_MAX	1024		//!< Calls with longer encoded arguments aren't memoised.
+
+/** The result of a call to a memoisable function
+ *
+ */
+typedef struct {
+	xlat_t const		*func;		//!< Function which was called.
+	void const		*inst;		//!< Instance data it was called with.
+	uint8_t			*key;		//!< Encoded arguments.  NULL if the slot is empty.
+						///< Also the ctx for the boxes in result.
+	size_t			key_len;	//!< Length of the key.
+	fr_value_box_list_t	result;		//!< Copy of the output of the function.
+} xlat_memo_t;
+
+static _Thread_local xlat_memo_t *xlat_memo;			//!< Direct mapped cache of results.
+static _Thread_local uint8_t xlat_memo_key_buff[XLAT_MEMO_KEY_MAX];	//!< Key of the current call.
+
+static int _xlat_memo_free(void *arg)
+{
+	return talloc_free(arg);
+}
+
+/** Encode function arguments, including the metadata which can change the output
+ *
+ * The key is the type and the raw value of each argument, not its
+ * printed form.  Printing would use enumeration names, and two
+ * different values can print the same way.
+ */
+static ssize_t xlat_memo_key(fr_dbuff_t *out, fr_value_box_list_t const *args)
+{
+	fr_dbuff_t our_out = FR_DBUFF(out);
+
+	fr_value_box_list_foreach(args, vb) {
+		FR_DBUFF_IN_RETURN(&our_out, (uint8_t)vb->type);
+		FR_DBUFF_IN_RETURN(&our_out, (uint8_t)vb->tainted);
+		FR_DBUFF_IN_RETURN(&our_out, (uint64_t)(uintptr_t)vb->safe_for);
+
+		switch (vb->type) {
+		case FR_TYPE_GROUP:
+			FR_DBUFF_IN_RETURN(&our_out, (uint32_t)fr_value_box_list_num_elements(&vb->vb_group));
+			FR_DBUFF_RETURN(xlat_memo_key, &our_out, &vb->vb_group);
+			break;
+
+		case FR_TYPE_STRING:
+		case FR_TYPE_OCTETS:
+			FR_DBUFF_IN_RETURN(&our_out, (uint32_t)vb->vb_length);
+			FR_DBUFF_IN_MEMCPY_RETURN(&our_out, vb->vb_octets, vb->vb_length);
+			break;
+
+		/*
+		 *	Everything else has a fixed length for its type.
+		 */
+		default:
+			FR_DBUFF_RETURN(fr_value_box_to_network, &our_out, vb);
+			break;
+		}
+	}
+
+	FR_DBUFF_SET_RETURN(out, &our_out);
+}
+
+/** Find the cache slot for a call to a memoisable function
+ *
+ * Leaves the key for the call in xlat_memo_key_buff.
+ *
+ * @param[out] hit	true if the slot holds the result of an identical call.
+ * @param[out] key_len	Length of the key for the call.
+ * @param[in] node	being evaluated.
+ * @param[in] args	processed arguments for the call.
+ * @return
+ *	- The slot to use for the call.
+ *	- NULL if the call can't be memoised.
+ */
+static xlat_memo_t *xlat_memo_find(bool *hit, size_t *key_len, xlat_exp_t const *node, fr_value_box_list_t const *args)
+{
+	xlat_t const	*func = node->call.func;
+	void const	*inst = func->inst_size ? node->call.inst->data : NULL;
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(xlat_memo_key_buff, sizeof(xlat_memo_key_buff));
+	ssize_t		slen;
+	uint32_t	hash;
+	xlat_memo_t	*memo;
+
+	if (unlikely(!xlat_memo)) {
+		xlat_memo = talloc_zero_array(NULL, xlat_memo_t, XLAT_MEMO_SIZE);
+		if (!xlat_memo) return NULL;
+		fr_atexit_thread_local(xlat_memo, _xlat_memo_free, xlat_memo);
+	}
+
+	slen = xlat_memo_key(&dbuff, args);
+	if (slen < 0) return NULL;	/* Too long, or can't be encoded */
+
+	hash = fr_hash(xlat_memo_key_buff, slen);
+	hash = fr_hash_update(&func, sizeof(func), hash);
+	hash = fr_hash_update(&inst, sizeof(inst), hash);
+
+	memo = &xlat_memo[hash & (XLAT_MEMO_SIZE - 1)];
+	*key_len = (size_t)slen;
+	*hit = memo->key && (memo->func == func) && (memo->inst == inst) && (memo->key_len == *key_len) &&
+	       (memcmp(memo->key, xlat_memo_key_buff, *key_len) == 0);
+
+	return memo;
+}
+
+/** Replace the contents of a slot with the output of a call
+ *
+ * @param[in] memo	slot to replace.
+ * @param[in] node	which was evaluated.
+ * @param[in] key_len	of the key in xlat_memo_key_buff.
+ * @param[in] list	the function wrote its output to.
+ * @param[in] first	box the function wrote.  May be NULL.
+ */
+static void xlat_memo_store(xlat_memo_t *memo, xlat_exp_t const *node, size_t key_len,
+			    fr_value_box_list_t const *list, fr_value_box_t const *first)
+{
+	fr_value_box_t const	*vb;
+
+	TALLOC_FREE(memo->key);
+
+	memo->key = talloc_memdup(xlat_memo, xlat_memo_key_buff, key_len);
+	if (!memo->key) return;
+	memo->key_len = key_len;
+	memo->func = node->call.func;
+	memo->inst = node->call.func->inst_size ? node->call.inst->data : NULL;
+	fr_value_box_list_init(&memo->result);
+
+	for (vb = first; vb; vb = fr_value_box_list_next(list, vb)) {
+		fr_value_box_t *copy;
+
+		copy = fr_value_box_alloc_null(memo->key);
+		if (!copy || (fr_value_box_copy(copy, copy, vb) < 0)) {
+			TALLOC_FREE(memo->key);
+			return;
+		}
+		fr_value_box_list_insert_tail(&memo->result, copy);
+	}
+}
+
+/** Copy a memoised result to the output of a call
+ *
+ */
+static xlat_action_t xlat_memo_copy(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat_memo_t const *memo)
+{
+	fr_value_box_list_foreach(&memo->result, vb) {
+		fr_value_box_t *copy;
+
+		MEM(copy = fr_value_box_alloc_null(ctx));
+		if (fr_value_box_copy(copy, copy, vb) < 0) {
+			talloc_free(copy);
+			return XLAT_ACTION_FAIL;
+		}
+		fr_dcursor_append(out, copy);
+	}
+
+	return XLAT_ACTION_DONE;
+}
+
 /** Process the result of a previous nested expansion
  *
  * @param[in] ctx		to allocate value boxes in.
@@ -956,6 +1117,10 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		xlat_action_t		xa;
 		xlat_thread_inst_t	*t;
 		fr_value_box_list_t	result_copy;
+		xlat_memo_t		*memo = NULL;
+		bool			hit = false;
+		size_t			key_len = 0;
+		fr_value_box_t		*prev;
 
 		t = xlat_thread_instance_find(node);
 		fr_assert(t);
@@ -985,9 +1150,32 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		}
 
 		VALUE_BOX_LIST_VERIFY(result);
-		xa = node->call.func->func(ctx, out,
-					   XLAT_CTX(node->call.inst->data, t->data, t->mctx, env_data, NULL),
-					   request, result);
+
+		/*
+		 *	The output of memoisable functions depends
+		 *	only on their arguments, so identical calls
+		 *	can reuse the output of a previous call.
+		 */
+		if (node->call.func->memoise && !node->call.func->call_env_method) {
+			memo = xlat_memo_find(&hit, &key_len, node, result);
+		}
+
+		if (hit) {
+			xa = xlat_memo_copy(ctx, out, memo);
+		} else {
+			prev = fr_dcursor_current(out);
+
+			xa = node->call.func->func(ctx, out,
+						   XLAT_CTX(node->call.inst->data, t->data, t->mctx, env_data, NULL),
+						   request, result);
+
+			if (memo && (xa == XLAT_ACTION_DONE)) {
+				fr_value_box_list_t *list = (fr_value_box_list_t *)out->dlist;
+
+				xlat_memo_store(memo, node, key_len, list,
+						prev ? fr_value_box_list_next(list, prev) : fr_value_box_list_head(list));
+			}
+		}
 		VALUE_BOX_LIST_VERIFY(result);
 
 		if (RDEBUG_ENABLED2) {
@@ -36,7 +36,10 @@ DIAG_OFF(attributes)
 typedef enum CC_HINT(flag_enum) {
 	XLAT_FUNC_FLAG_NONE = 0x00,
 	XLAT_FUNC_FLAG_PURE = 0x01,
-	XLAT_FUNC_FLAG_INTERNAL = 0x02
+	XLAT_FUNC_FLAG_INTERNAL = 0x02,
+	XLAT_FUNC_FLAG_MEMOISE = 0x04		//!< Output depends only on the arguments, and is
+						///< expensive enough to be worth caching.  Don't set
+						///< this for functions which are passed secrets.
 } xlat_func_flags_t;
 DIAG_ON(attributes)
 
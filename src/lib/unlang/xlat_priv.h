@@ -65,6 +65,7 @@ typedef struct xlat_s {
 	xlat_func_t		func;			//!< async xlat function (async unsafe).
 
 	bool			internal;		//!< If true, cannot be redefined.
+	bool			memoise;		//!< Results may be cached and reused for identical arguments.
 	fr_token_t		token;			//!< for expressions
 
 	module_inst_ctx_t	*mctx;			//!< Original module instantiation ctx if this
@@ -6,18 +6,24 @@ SUBMAKEFILES := \
 	dlist_tests.mk \
 	edit_tests.mk \
 	heap_tests.mk \
+	histogram_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
+	log_rec_tests.mk \
 	lst_tests.mk \
 	minmax_heap_tests.mk \
+	ohash_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
 	pair_nested_tests.mk \
 	pair_tests.mk \
+	qsbr_tests.mk \
 	rb_tests.mk \
 	sbuff_tests.mk \
 	size_tests.mk \
 	slab_tests.mk \
 	strerror_tests.mk \
-	time_tests.mk
+	time_tests.mk \
+	timer_wheel_tests.mk \
+	value_tests.mk
 
@@ -118,7 +118,37 @@ fr_slen_t fr_base16_encode_nstd(fr_sbuff_t *out, fr_dbuff_t *in, char const alph
 	fr_dbuff_t	our_in = FR_DBUFF(in);
 
 	while (fr_dbuff_extend(&our_in)) {
-		uint8_t a = *fr_dbuff_current(&our_in);
+		uint8_t const	*p;
+		char		*q;
+		size_t		len, room, i;
+		uint8_t		a;
+
+		/*
+		 *	Encode as much as we have input and output
+		 *	space for in one go, instead of going through
+		 *	the sbuff for each hexit pair.
+		 */
+		len = fr_dbuff_remaining(&our_in);
+		room = our_out.is_const ? 0 : (fr_sbuff_extend_lowat(NULL, &our_out, len << 1) >> 1);
+		if (len > room) len = room;
+		if (len > 0) {
+			p = fr_dbuff_current(&our_in);
+			q = fr_sbuff_current(&our_out);
+
+			for (i = 0; i < len; i++) {
+				q[i << 1] = alphabet[us(p[i] >> 4)];
+				q[(i << 1) + 1] = alphabet[us(p[i] & 0x0f)];
+			}
+
+			fr_sbuff_advance(&our_out, len << 1);
+			fr_dbuff_advance(&our_in, len);
+			continue;
+		}
+
+		/*
+		 *	Out of space, this returns how much we need.
+		 */
+		a = *fr_dbuff_current(&our_in);
 
 		FR_SBUFF_IN_CHAR_RETURN(&our_out, alphabet[us(a >> 4)], (alphabet[us(a & 0x0f)]));
 		fr_dbuff_advance(&our_in, 1);
@@ -150,6 +180,33 @@ fr_slen_t fr_base16_decode_nstd(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr
 	while (fr_sbuff_extend_lowat(NULL, &our_in, 2) >= 2) {
 		char	*p = fr_sbuff_current(&our_in);
 		bool	a, b;
+		uint8_t	*q;
+		size_t	len, room, i;
+
+		/*
+		 *	Decode as many pairs as we have input and
+		 *	output space for in one go.  Stop at the
+		 *	first pair with a non-hex char, and let the
+		 *	code below deal with it.
+		 */
+		len = fr_sbuff_remaining(&our_in) >> 1;
+		room = our_out.is_const ? 0 : fr_dbuff_extend_lowat(NULL, &our_out, len);
+		if (len > room) len = room;
+
+		q = fr_dbuff_current(&our_out);
+		for (i = 0; i < len; i++) {
+			uint8_t hi = alphabet[us(p[i << 1])];
+			uint8_t lo = alphabet[us(p[(i << 1) + 1])];
+
+			if ((hi | lo) >= 16) break;
+
+			q[i] = (hi << 4) | lo;
+		}
+		if (i > 0) {
+			fr_dbuff_advance(&our_out, i);
+			fr_sbuff_advance(&our_in, i << 1);
+			continue;
+		}
 
 		a = fr_is_base16_nstd(p[0], alphabet);
 		b = fr_is_base16_nstd(p[1], alphabet);
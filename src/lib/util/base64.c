@@ -339,6 +339,39 @@ ssize_t fr_base64_encode_nstd(fr_sbuff_t *out, fr_dbuff_t *in,
 		 *	Enough bytes for a 24bit quanta
 		 */
 		default:
+		{
+			uint8_t const	*p;
+			char		*q;
+			size_t		len, room, i;
+
+			/*
+			 *	Encode as many complete quanta as we
+			 *	have input and output space for in
+			 *	one go.
+			 */
+			len = fr_dbuff_remaining(&our_in) / 3;
+			room = our_out.is_const ? 0 : (fr_sbuff_extend_lowat(NULL, &our_out, len << 2) >> 2);
+			if (len > room) len = room;
+			if (len > 0) {
+				p = fr_dbuff_current(&our_in);
+				q = fr_sbuff_current(&our_out);
+
+				for (i = 0; i < len; i++, p += 3, q += 4) {
+					q[0] = alphabet[(p[0] >> 2) & 0x3f];
+					q[1] = alphabet[((p[0] << 4) | (p[1] >> 4)) & 0x3f];
+					q[2] = alphabet[((p[1] << 2) | (p[2] >> 6)) & 0x3f];
+					q[3] = alphabet[p[2] & 0x3f];
+				}
+
+				fr_sbuff_advance(&our_out, len << 2);
+				fr_dbuff_advance(&our_in, len * 3);
+				continue;
+			}
+		}
+
+			/*
+			 *	Out of space, this returns how much we need.
+			 */
 			a = *fr_dbuff_current(&our_in);
 			b = *(fr_dbuff_current(&our_in) + 1);
 			c = *(fr_dbuff_current(&our_in) + 2);
@@ -410,7 +443,39 @@ fr_slen_t fr_base64_decode_nstd(fr_sbuff_parse_error_t *err, fr_dbuff_t *out, fr
 	 *	Process complete 24bit quanta
 	 */
 	while (fr_sbuff_extend_lowat(NULL, &our_in, 4) >= 4) {
-		char *p = fr_sbuff_current(&our_in);
+		char	*p = fr_sbuff_current(&our_in);
+		uint8_t	*q;
+		size_t	len, room, i;
+
+		/*
+		 *	Decode as many complete quanta as we have
+		 *	input and output space for in one go.  Stop
+		 *	at the first quantum with a non-base64 char,
+		 *	and let the code below deal with it.
+		 */
+		len = fr_sbuff_remaining(&our_in) >> 2;
+		room = our_out.is_const ? 0 : (fr_dbuff_extend_lowat(NULL, &our_out, len * 3) / 3);
+		if (len > room) len = room;
+
+		q = fr_dbuff_current(&our_out);
+		for (i = 0; i < len; i++) {
+			uint8_t a = alphabet[us(p[(i << 2)])];
+			uint8_t b = alphabet[us(p[(i << 2) + 1])];
+			uint8_t c = alphabet[us(p[(i << 2) + 2])];
+			uint8_t d = alphabet[us(p[(i << 2) + 3])];
+
+			if ((a | b | c | d) >= 64) break;
+
+			q[0] = (a << 2) | (b >> 4);
+			q[1] = ((b << 4) & 0xf0) | (c >> 2);
+			q[2] = ((c << 6) & 0xc0) | d;
+			q += 3;
+		}
+		if (i > 0) {
+			fr_dbuff_advance(&our_out, i * 3);
+			fr_sbuff_advance(&our_in, i << 2);
+			continue;
+		}
 
 		if (!fr_is_base64_nstd(p[0], alphabet) ||
 		    !fr_is_base64_nstd(p[1], alphabet) ||
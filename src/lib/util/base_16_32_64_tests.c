@@ -243,9 +243,60 @@ static void test_base64_decode(void)
 	}
 }
 
+static void test_base16_long(void)
+{
+	uint8_t		in[256], decoded[256];
+	char		encoded[(sizeof(in) * 2) + 1];
+	char		small[16];
+	size_t		i;
+
+	for (i = 0; i < sizeof(in); i++) in[i] = i;
+
+	TEST_CASE("Encode every byte value");
+	TEST_CHECK_SLEN(fr_base16_encode(&FR_SBUFF_OUT(encoded, sizeof(encoded)), &FR_DBUFF_TMP(in, sizeof(in))),
+			(ssize_t)(sizeof(in) * 2));
+	TEST_CHECK(strncmp(encoded, "000102", 6) == 0);
+	TEST_CHECK(strcmp(encoded + 500, "fafbfcfdfeff") == 0);
+
+	TEST_CASE("Decode it back");
+	TEST_CHECK_SLEN(fr_base16_decode(NULL, &FR_DBUFF_TMP(decoded, sizeof(decoded)),
+					 &FR_SBUFF_IN(encoded, sizeof(in) * 2), true),
+			(ssize_t)sizeof(in));
+	TEST_CHECK(memcmp(in, decoded, sizeof(in)) == 0);
+
+	TEST_CASE("Encoding into a short buffer returns how much more we need");
+	TEST_CHECK(fr_base16_encode(&FR_SBUFF_OUT(small, sizeof(small)), &FR_DBUFF_TMP(in, sizeof(in))) < 0);
+}
+
+static void test_base64_long(void)
+{
+	uint8_t		in[256], decoded[256];
+	char		encoded[(((sizeof(in) + 2) / 3) * 4) + 1];
+	char		small[16];
+	size_t		i;
+
+	for (i = 0; i < sizeof(in); i++) in[i] = i;
+
+	TEST_CASE("Encode every byte value");
+	TEST_CHECK_SLEN(fr_base64_encode(&FR_SBUFF_OUT(encoded, sizeof(encoded)), &FR_DBUFF_TMP(in, sizeof(in)), true),
+			(ssize_t)(sizeof(encoded) - 1));
+	TEST_CHECK(strncmp(encoded, "AAECAwQF", 8) == 0);
+	TEST_CHECK(strcmp(encoded + sizeof(encoded) - 9, "7/P3+/w==") == 0);
+
+	TEST_CASE("Decode it back");
+	TEST_CHECK_SLEN(fr_base64_decode(&FR_DBUFF_TMP(decoded, sizeof(decoded)),
+					 &FR_SBUFF_IN(encoded, sizeof(encoded) - 1), true, true),
+			(ssize_t)sizeof(in));
+	TEST_CHECK(memcmp(in, decoded, sizeof(in)) == 0);
+
+	TEST_CASE("Encoding into a short buffer returns how much more we need");
+	TEST_CHECK(fr_base64_encode(&FR_SBUFF_OUT(small, sizeof(small)), &FR_DBUFF_TMP(in, sizeof(in)), true) < 0);
+}
+
 TEST_LIST = {
 	{ "base16_encode",		test_base16_encode },
 	{ "base16_decode",		test_base16_decode },
+	{ "base16_long",		test_base16_long },
 
 	{ "base32_encode",		test_base32_encode },
 	{ "base32_decode",		test_base32_decode },
@@ -254,5 +305,6 @@ TEST_LIST = {
 
 	{ "base64.encode",		test_base64_encode },
 	{ "base64.decode",		test_base64_decode },
+	{ "base64.long",		test_base64_long },
 	{ NULL }
 };
@@ -0,0 +1,326 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Microbenchmark harness
+ *
+ * Follows the conventions of acutest.h.  The benchmark program defines
+ * a list of cases, includes this file, and gets a main() which runs
+ * them:
+ *
+ * @code{.c}
+ *   static void bench_foo(bench_t *b, size_t n)
+ *   {
+ *	size_t i;
+ *
+ *	for (i = 0; i < n; i++) BENCH_KEEP(foo(b->ctx));
+ *   }
+ *
+ *   BENCH_LIST = {
+ *	{ "foo", bench_foo },
+ *	{ NULL }
+ *   };
+ * @endcode
+ *
+ * Each case is run with an increasing number of operations until a
+ * single run takes long enough to measure, and then repeatedly until
+ * the minimum time has passed.  The fastest run is reported, as it's
+ * the one with the least interference from the rest of the system.
+ *
+ * Memory which the case allocates from b->ctx, and doesn't free, is
+ * counted as talloc blocks per operation, and freed after each run.
+ *
+ * If BENCH_INIT is defined before this file is included, it is run
+ * once, after the arguments have been parsed.  bench_dict_dir is then
+ * set from "-D".
+ *
+ * Results can be written to a file with "-o", and compared with a
+ * previous results file with "-b".  The program exits with a failure
+ * if any case is slower than the baseline by more than the threshold,
+ * or allocates more.
+ *
+ * @file src/lib/util/bench.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(bench_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#define BENCH_MIN_RUN		(fr_time_delta_from_msec(10))	//!< Shortest run we trust the timing of.
+#define BENCH_MAX_BASELINE	(256)				//!< Cases read from a baseline file.
+
+typedef struct {
+	TALLOC_CTX		*ctx;		//!< For allocations made by the operations.  Freed after each run.
+} bench_t;
+
+/** Run "n" operations
+ *
+ */
+typedef void (*bench_func_t)(bench_t *b, size_t n);
+
+typedef struct {
+	char const		*name;
+	bench_func_t		func;
+} bench_case_t;
+
+#define BENCH_LIST		const bench_case_t bench_list_[]
+
+extern const bench_case_t bench_list_[];
+
+/** Stop the compiler from optimising away a result
+ *
+ */
+static void * volatile bench_sink_;
+#define BENCH_KEEP(_x)		(bench_sink_ = (void *) (uintptr_t) (_x))
+
+typedef struct {
+	char			name[64];
+	double			ns;
+	double			allocs;
+} bench_result_t;
+
+static bench_t bench_;
+static char const *bench_dict_dir;		//!< For cases which need protocol dictionaries.
+
+static int bench_baseline_read(char const *filename, bench_result_t *out, size_t *num)
+{
+	FILE	*fp;
+	char	buffer[256];
+
+	*num = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed opening %s - %s\n", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp) && (*num < BENCH_MAX_BASELINE)) {
+		if (buffer[0] == '#') continue;
+
+		if (sscanf(buffer, "%63s %lf %lf", out[*num].name, &out[*num].ns, &out[*num].allocs) != 3) continue;
+		(*num)++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static bench_result_t const *bench_baseline_find(bench_result_t const *baseline, size_t num, char const *name)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) if (strcmp(baseline[i].name, name) == 0) return &baseline[i];
+
+	return NULL;
+}
+
+/** Run one case, and return the fastest time per operation
+ *
+ */
+static void bench_run(bench_case_t const *c, fr_time_delta_t min_time, bench_result_t *out)
+{
+	size_t		n = 1;
+	fr_time_t	start, end, stop;
+	double		best = 0;
+	fr_time_delta_t	elapsed;
+
+	bench_.ctx = talloc_new(NULL);
+
+	/*
+	 *	Find a number of operations which takes long enough
+	 *	that the timer resolution doesn't matter.
+	 */
+	for (;;) {
+		start = fr_time();
+		c->func(&bench_, n);
+		elapsed = fr_time_sub(fr_time(), start);
+		talloc_free_children(bench_.ctx);
+
+		if (fr_time_delta_gteq(elapsed, BENCH_MIN_RUN) || (n >= ((size_t) 1 << 40))) break;
+
+		n *= 10;
+	}
+
+	stop = fr_time_add(fr_time(), min_time);
+	do {
+		double ns;
+		size_t blocks;
+
+		start = fr_time();
+		c->func(&bench_, n);
+		end = fr_time();
+
+		blocks = talloc_total_blocks(bench_.ctx) - 1;
+		talloc_free_children(bench_.ctx);
+
+		ns = fr_time_delta_unwrap(fr_time_sub(end, start)) / (double) n;
+		if ((best == 0) || (ns < best)) best = ns;
+
+		out->allocs = blocks / (double) n;
+	} while (fr_time_lt(end, stop));
+
+	talloc_free(bench_.ctx);
+	bench_.ctx = NULL;
+
+	strlcpy(out->name, c->name, sizeof(out->name));
+	out->ns = best;
+}
+
+static NEVER_RETURNS void bench_usage(char const *argv0)
+{
+	fprintf(stderr, "usage: %s [OPTS] [case ...]\n", argv0);
+	fprintf(stderr, "  -b <file>      Compare results with a baseline file written by -o.\n");
+	fprintf(stderr, "  -D <dir>       Dictionary directory.\n");
+	fprintf(stderr, "  -l             List the cases.\n");
+	fprintf(stderr, "  -o <file>      Write results to file.\n");
+	fprintf(stderr, "  -r <percent>   Slowdown from the baseline which fails (default 10).\n");
+	fprintf(stderr, "  -t <seconds>   Minimum time to run each case for (default 0.5).\n");
+
+	fr_exit_now(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, ret = EXIT_SUCCESS;
+	char const		*baseline_file = NULL, *out_file = NULL;
+	FILE			*out = NULL;
+	double			threshold = 10;
+	fr_time_delta_t		min_time = fr_time_delta_from_msec(500);
+	bench_case_t const	*bc;
+	bench_result_t		*baseline;
+	size_t			baseline_num = 0;
+
+	while ((c = getopt(argc, argv, "b:D:hlo:r:t:")) != -1) switch (c) {
+		case 'b':
+			baseline_file = optarg;
+			break;
+
+		case 'D':
+			bench_dict_dir = optarg;
+			break;
+
+		case 'l':
+			for (bc = bench_list_; bc->name; bc++) printf("%s\n", bc->name);
+			fr_exit_now(EXIT_SUCCESS);
+
+		case 'o':
+			out_file = optarg;
+			break;
+
+		case 'r':
+			threshold = atof(optarg);
+			break;
+
+		case 't':
+			min_time = fr_time_delta_from_msec(atof(optarg) * 1000);
+			break;
+
+		case 'h':
+		default:
+			bench_usage(argv[0]);
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (fr_time_start() < 0) {
+		fr_perror("bench");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	baseline = calloc(BENCH_MAX_BASELINE, sizeof(*baseline));
+	if (!baseline) fr_exit_now(EXIT_FAILURE);
+
+	if (baseline_file && (bench_baseline_read(baseline_file, baseline, &baseline_num) < 0)) {
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (out_file) {
+		out = fopen(out_file, "w");
+		if (!out) {
+			fprintf(stderr, "Failed opening %s - %s\n", out_file, fr_syserror(errno));
+			fr_exit_now(EXIT_FAILURE);
+		}
+		fprintf(out, "# name ns/op allocs/op\n");
+	}
+
+#ifdef BENCH_INIT
+	BENCH_INIT;
+#endif
+
+	printf("%-40s %12s %10s", "case", "ns/op", "allocs/op");
+	if (baseline_num) printf(" %10s", "change");
+	printf("\n");
+
+	for (bc = bench_list_; bc->name; bc++) {
+		bench_result_t		result = {};
+		bench_result_t const	*old;
+
+		/*
+		 *	Only run the cases named on the command line.
+		 */
+		if (argc > 0) {
+			int i;
+
+			for (i = 0; i < argc; i++) if (strcmp(argv[i], bc->name) == 0) break;
+			if (i == argc) continue;
+		}
+
+		bench_run(bc, min_time, &result);
+
+		printf("%-40s %12.1f %10.2f", result.name, result.ns, result.allocs);
+		if (out) fprintf(out, "%s %.1f %.2f\n", result.name, result.ns, result.allocs);
+
+		old = bench_baseline_find(baseline, baseline_num, result.name);
+		if (old && (old->ns > 0)) {
+			double change = ((result.ns - old->ns) * 100) / old->ns;
+
+			printf(" %+9.1f%%", change);
+
+			if ((change > threshold) || (result.allocs > (old->allocs + 0.005))) {
+				printf("  REGRESSION");
+				ret = EXIT_FAILURE;
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	if (out) fclose(out);
+	free(baseline);
+
+	return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -2678,6 +2678,40 @@ static bool fr_value_calc_list_empty(fr_value_box_list_t const *list)
 	return true;
 }
 
+/** Whether every value in both lists is a leaf of the same type
+ *
+ * fr_value_calc_binary_op() then compares them with fr_value_box_cmp_op(),
+ * without casting them first.
+ */
+static bool fr_value_calc_list_same_type(fr_value_box_list_t const *list1, fr_value_box_list_t const *list2,
+					 fr_token_t op)
+{
+	fr_value_box_t const *head = fr_value_box_list_head(list1);
+
+	switch (op) {
+	case T_OP_CMP_EQ:
+	case T_OP_GE:
+	case T_OP_GT:
+	case T_OP_LE:
+	case T_OP_LT:
+		break;
+
+	default:
+		return false;
+	}
+
+	if (!head || !fr_type_is_leaf(head->type)) return false;
+
+	fr_value_box_list_foreach(list1, a) {
+		if (a->type != head->type) return false;
+	}
+
+	fr_value_box_list_foreach(list2, b) {
+		if (b->type != head->type) return false;
+	}
+
+	return true;
+}
 
 /*
  *	Loop over input lists, calling fr_value_calc_binary_op()
@@ -2727,6 +2761,27 @@ int fr_value_calc_list_cmp(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_li
 		goto done;
 	}
 
+	/*
+	 *	All of the values have the same type, so none of them
+	 *	need to be cast.  Compare each value on the left with
+	 *	the whole of the right hand list at once.
+	 */
+	if (fr_value_calc_list_same_type(list1, list2, op)) {
+		fr_value_box_list_foreach(list1, a) {
+			rcode = fr_value_box_list_cmp_op(op, a, list2, false);
+			if (rcode < 0) return rcode;
+
+			if (rcode) {
+				fr_value_box_clear(dst);
+				fr_value_box_init(dst, FR_TYPE_BOOL, NULL, false);
+				dst->vb_bool = !invert;
+				return 0;
+			}
+		}
+
+		goto done;
+	}
+
 	/*
 	 *	Emulate v3.  :(
 	 */
@@ -1584,6 +1584,137 @@ static inline ssize_t _fr_dbuff_in_double(uint8_t **pos_p, fr_dbuff_t *out, doub
  */
 #define FR_DBUFF_IN_RETURN(_dbuff_or_marker, _in) FR_DBUFF_RETURN(fr_dbuff_in, _dbuff_or_marker, _in)
 
+/** Ensure at least _len bytes can be written at the current position of a dbuff or marker
+ *
+ * Extends the dbuff if there's insufficient space.  Once space has been reserved,
+ * the fr_dbuff_in_*_unchecked() functions can be used to write up to _len bytes
+ * without any further bounds checks or extension calls.
+ *
+ * @param[in] _dbuff_or_marker	to reserve space in.
+ * @param[in] _len		number of bytes to reserve.
+ * @return
+ *	- 0 if the space is available.
+ *	- <0 the number of additional bytes required.
+ */
+#define fr_dbuff_reserve(_dbuff_or_marker, _len) \
+	_fr_dbuff_reserve(fr_dbuff_ptr(_dbuff_or_marker), fr_dbuff_remaining(_dbuff_or_marker), _len)
+
+/** Internal function - do not call directly
+ * @private
+ */
+static inline ssize_t _fr_dbuff_reserve(fr_dbuff_t *dbuff, size_t remaining, size_t len)
+{
+	if (likely(remaining >= len)) return 0;
+
+	remaining = _fr_dbuff_extend_lowat(NULL, dbuff, remaining, len);
+	if (remaining < len) return -(len - remaining);
+
+	return 0;
+}
+
+/** Ensure at least _len bytes can be written at the current position of a dbuff or marker, returning if we can't
+ *
+ * @copydetails fr_dbuff_reserve
+ */
+#define FR_DBUFF_RESERVE_RETURN(_dbuff_or_marker, _len) FR_DBUFF_RETURN(fr_dbuff_reserve, _dbuff_or_marker, _len)
+
+/** Internal function - do not call directly
+ *
+ * Advance the position pointer without checking for space.  The caller must
+ * have used fr_dbuff_reserve() first.
+ *
+ * @private
+ */
+static inline size_t _fr_dbuff_advance_unchecked(uint8_t **pos_p, fr_dbuff_t *dbuff, size_t len)
+{
+	uint8_t *p = (*pos_p) + len;
+
+	fr_assert(p <= dbuff->end);
+
+	if (dbuff->adv_parent && dbuff->parent) _fr_dbuff_set_recurse(dbuff->parent, dbuff->adv_parent, p);
+	*pos_p = p;
+
+	return len;
+}
+
+/** Internal function - do not call directly
+ * @private
+ */
+static inline size_t _fr_dbuff_in_memcpy_unchecked(uint8_t **pos_p, fr_dbuff_t *out,
+						   uint8_t const *in, size_t inlen)
+{
+	fr_assert(!out->is_const);
+	fr_assert((size_t)(out->end - (*pos_p)) >= inlen);
+
+	memcpy((*pos_p), in, inlen);
+
+	return _fr_dbuff_advance_unchecked(pos_p, out, inlen);
+}
+
+/** Copy exactly _inlen bytes into a dbuff or marker, without checking for space
+ *
+ * The caller must have reserved the space with #fr_dbuff_reserve.
+ *
+ * @param[in] _dbuff_or_marker	to copy data to.
+ * @param[in] _in		data to copy.
+ * @param[in] _inlen		How much data to copy.
+ * @return The number of bytes copied.
+ */
+#define fr_dbuff_in_memcpy_unchecked(_dbuff_or_marker, _in, _inlen) \
+	_fr_dbuff_in_memcpy_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), \
+				      (uint8_t const *)(_in), _inlen)
+
+/** Copy a byte sequence into a dbuff or marker, without checking for space
+ *
+ * The length of the sequence is known at compile time, so the copy is
+ * usually reduced to a couple of stores.
+ *
+ * @copydetails fr_dbuff_in_memcpy_unchecked
+ */
+#define fr_dbuff_in_bytes_unchecked(_dbuff_or_marker, ...) \
+	fr_dbuff_in_memcpy_unchecked(_dbuff_or_marker, ((uint8_t []){ __VA_ARGS__ }), sizeof((uint8_t []){ __VA_ARGS__ }))
+
+/** @cond */
+/** Define unchecked integer encoding functions
+ * @private
+ */
+#define FR_DBUFF_IN_UNCHECKED_DEF(_type) \
+static inline size_t _fr_dbuff_in_##_type##_unchecked(uint8_t **pos_p, fr_dbuff_t *out, _type##_t num) \
+{ \
+	fr_assert(!out->is_const); \
+	fr_assert((size_t)(out->end - (*pos_p)) >= sizeof(_type##_t)); \
+	fr_nbo_from_##_type((*pos_p), num); \
+	return _fr_dbuff_advance_unchecked(pos_p, out, sizeof(_type##_t)); \
+}
+FR_DBUFF_IN_UNCHECKED_DEF(uint16)
+FR_DBUFF_IN_UNCHECKED_DEF(uint32)
+FR_DBUFF_IN_UNCHECKED_DEF(uint64)
+FR_DBUFF_IN_UNCHECKED_DEF(int16)
+FR_DBUFF_IN_UNCHECKED_DEF(int32)
+FR_DBUFF_IN_UNCHECKED_DEF(int64)
+/** @endcond */
+
+/** Copy data from a fixed sized integer type into a dbuff or marker, without checking for space
+ *
+ * The caller must have reserved the space with #fr_dbuff_reserve.
+ *
+ * @param[out] _dbuff_or_marker		to write to.  Integer types will be automatically
+					converted to big endian byte order.
+ * @param[in] _in			Value to copy.
+ * @return The number of bytes _dbuff_or_marker was advanced by.
+ */
+#define fr_dbuff_in_unchecked(_dbuff_or_marker, _in) \
+	_Generic((_in), \
+		int8_t		: fr_dbuff_in_bytes_unchecked(_dbuff_or_marker, (int8_t)_in), \
+		int16_t		: _fr_dbuff_in_int16_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (int16_t)_in), \
+		int32_t		: _fr_dbuff_in_int32_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (int32_t)_in), \
+		int64_t		: _fr_dbuff_in_int64_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (int64_t)_in), \
+		uint8_t		: fr_dbuff_in_bytes_unchecked(_dbuff_or_marker, (uint8_t)_in), \
+		uint16_t	: _fr_dbuff_in_uint16_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (uint16_t)_in), \
+		uint32_t	: _fr_dbuff_in_uint32_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (uint32_t)_in), \
+		uint64_t	: _fr_dbuff_in_uint64_unchecked(_fr_dbuff_current_ptr(_dbuff_or_marker), fr_dbuff_ptr(_dbuff_or_marker), (uint64_t)_in) \
+	)
+
 /** Internal function - do not call directly
  * @private
  */
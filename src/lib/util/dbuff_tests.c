@@ -327,6 +327,33 @@ static void test_dbuff_talloc_extend_multi_level(void)
 	talloc_free(dbuff1.buff);
 }
 
+static void test_dbuff_reserve(void)
+{
+	fr_dbuff_t		dbuff1, dbuff2;
+	fr_dbuff_uctx_talloc_t	tctx;
+	uint8_t const		value[] = { 0x1a, 0x00, 0x00, 0x00, 0x09, 0x01, 0x02, 0x12, 0x34 };
+
+	TEST_CASE("Reserve extends the buffer");
+	TEST_CHECK(fr_dbuff_init_talloc(NULL, &dbuff1, &tctx, 2, 16) == &dbuff1);
+	TEST_CHECK(fr_dbuff_reserve(&dbuff1, sizeof(value)) == 0);
+	TEST_CHECK(fr_dbuff_remaining(&dbuff1) >= sizeof(value));
+
+	TEST_CASE("Unchecked writes produce the same output as checked writes");
+	dbuff2 = FR_DBUFF(&dbuff1);
+	TEST_CHECK(fr_dbuff_in_bytes_unchecked(&dbuff2, 0x1a) == 1);
+	TEST_CHECK(fr_dbuff_in_unchecked(&dbuff2, (uint32_t) 9) == sizeof(uint32_t));
+	TEST_CHECK(fr_dbuff_in_memcpy_unchecked(&dbuff2, value + 5, 2) == 2);
+	TEST_CHECK(fr_dbuff_in_unchecked(&dbuff2, (uint16_t) 0x1234) == sizeof(uint16_t));
+	TEST_CASE("Writes advance the parent");
+	TEST_CHECK(fr_dbuff_used(&dbuff1) == sizeof(value));
+	TEST_CHECK(memcmp(fr_dbuff_start(&dbuff1), value, sizeof(value)) == 0);
+
+	TEST_CASE("Reserve fails past the maximum");
+	TEST_CHECK(fr_dbuff_reserve(&dbuff1, 8) == -1);
+
+	talloc_free(dbuff1.buff);
+}
+
 /*
  *	test_dbuff_fd_shell() puts setup and teardown of a fd flavored dbuff in one place
  *	so jscpd won't complain about copy/paste.
@@ -519,6 +546,7 @@ TEST_LIST = {
 	{ "fr_dbuff_move",				test_dbuff_move },
 	{ "fr_dbuff_talloc_extend",			test_dbuff_talloc_extend },
 	{ "fr_dbuff_talloc_extend_multi_level",		test_dbuff_talloc_extend_multi_level },
+	{ "fr_dbuff_reserve",				test_dbuff_reserve },
 	{ "fr_dbuff_fd",				test_dbuff_fd },
 	{ "fr_dbuff_fd_max",				test_dbuff_fd_max },
 	{ "fr_dbuff_out",				test_dbuff_out },
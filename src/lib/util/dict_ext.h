@@ -52,6 +52,8 @@ extern fr_ext_t const fr_dict_enum_ext_def;
 typedef struct {
 	fr_hash_table_t		*child_by_name;			//!< Namespace at this level in the hierarchy.
 	fr_dict_attr_t const	**children;			//!< Children of this attribute.
+	fr_dict_attr_t const	**child_by_num;			//!< Children indexed directly by number.  Only built
+								///< for dense number spaces which don't fit in 'children'.
 } fr_dict_attr_ext_children_t;
 
 DIAG_OFF(attributes)
@@ -892,6 +892,8 @@ static int _dict_attr_fixup_hash_tables(fr_dict_attr_t const *da, UNUSED void *u
 		if (hash) fr_hash_table_fill(hash);
 	}
 
+	dict_attr_child_by_num_finalise(da);
+
 	return 0;
 }
 
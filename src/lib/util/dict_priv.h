@@ -251,6 +251,8 @@ int 			dict_attr_alias_add(fr_dict_attr_t const *parent, char const *alias, fr_d
 
 int			dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child);
 
+void			dict_attr_child_by_num_finalise(fr_dict_attr_t const *parent);
+
 int			dict_protocol_add(fr_dict_t *dict);
 
 int			dict_vendor_add(fr_dict_t *dict, char const *name, unsigned int num);
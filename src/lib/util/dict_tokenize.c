@@ -36,7 +36,9 @@ RCSID("$Id$")
 #include <freeradius-devel/util/types.h>
 #include <freeradius-devel/util/value.h>
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 /** Maximum number of arguments
  *
@@ -2872,9 +2874,9 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 		{ L("VENDOR"),			{ .parse = dict_read_process_vendor } },
 	};
 
-	FILE			*fp;
+	int			fd;
 	char 			dir[256], fn[256];
-	char			buf[256];
+	char			*buf, *line_p, *next, *end;
 	char			*p;
 	int			line = 0;
 	bool			was_member = false;
@@ -2946,7 +2948,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 	}
 #endif
 
-	if ((fp = fopen(fn, "r")) == NULL) {
+	if ((fd = open(fn, O_RDONLY)) < 0) {
 		if (!src_file) {
 			fr_strerror_printf_push("Couldn't open dictionary %s: %s", fr_syserror(errno), fn);
 		} else {
@@ -2958,13 +2960,13 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 	}
 
 	/*
-	 *	If fopen works, this works.
+	 *	If open works, this works.
 	 */
-	if (fstat(fileno(fp), &statbuf) < 0) {
+	if (fstat(fd, &statbuf) < 0) {
 		fr_strerror_printf_push("Failed stating dictionary \"%s\" - %s", fn, fr_syserror(errno));
 
 	perm_error:
-		fclose(fp);
+		close(fd);
 		return -1;
 	}
 
@@ -2995,17 +2997,55 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 		goto perm_error;
 	}
 
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
+	/*
+	 *	Read the whole file in one go, and split it into
+	 *	lines in place.  This is much cheaper than going
+	 *	through stdio a line at a time, and there are a
+	 *	lot of dictionaries to load at startup.
+	 */
+	buf = talloc_array(NULL, char, statbuf.st_size + 1);
+	if (!buf) {
+		fr_strerror_const("Out of memory");
+		goto perm_error;
+	}
+	next = buf;
+	end = buf + statbuf.st_size;
+	while (next < end) {
+		ssize_t len;
+
+		len = read(fd, next, end - next);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf_push("Failed reading dictionary \"%s\" - %s", fn, fr_syserror(errno));
+			talloc_free(buf);
+			goto perm_error;
+		}
+		if (len == 0) break;	/* Truncated while we were reading it */
+
+		next += len;
+	}
+	close(fd);
+	end = next;
+	*end = '\0';
+
+	for (line_p = buf; line_p < end; line_p = next) {
 		bool do_begin = false;
 		fr_dict_keyword_parser_t const	*parser;
 		char **argv_p = argv;
 
+		next = memchr(line_p, '\n', end - line_p);
+		if (next) {
+			*next++ = '\0';
+		} else {
+			next = end;
+		}
+
 		dctx->stack[dctx->stack_depth].line = ++line;
 
-		switch (buf[0]) {
+		switch (line_p[0]) {
 		case '#':
 		case '\0':
-		case '\n':
 		case '\r':
 			continue;
 		}
@@ -3014,10 +3054,10 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 		 *  Comment characters should NOT be appearing anywhere but
 		 *  as start of a comment;
 		 */
-		p = strchr(buf, '#');
+		p = strchr(line_p, '#');
 		if (p) *p = '\0';
 
-		argc = fr_dict_str_to_argv(buf, argv, DICT_MAX_ARGV);
+		argc = fr_dict_str_to_argv(line_p, argv, DICT_MAX_ARGV);
 		if (argc == 0) continue;
 
 		if (argc == 1) {
@@ -3025,7 +3065,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 
 		error:
 			fr_strerror_printf_push("Failed parsing dictionary at %s[%d]", fr_cwd_strip(fn), line);
-			fclose(fp);
+			talloc_free(buf);
 			return -1;
 		}
 
@@ -3108,7 +3148,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *dctx,
 	 *	was copied from the parent, so there are guaranteed to
 	 *	be missing things.
 	 */
-	fclose(fp);
+	talloc_free(buf);
 
 
 	return 0;
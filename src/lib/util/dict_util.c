@@ -1464,6 +1464,16 @@ int dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t *child)
 		return 0;
 	}
 
+	/*
+	 *	The direct index is rebuilt when the dictionary
+	 *	is finalised.
+	 */
+	{
+		fr_dict_attr_ext_children_t *ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+
+		if (ext && ext->child_by_num) TALLOC_FREE(ext->child_by_num);
+	}
+
 	/*
 	 *	We only allocate the pointer array *if* the parent has children.
 	 */
@@ -3275,12 +3285,70 @@ fr_dict_attr_t const *fr_dict_attr_by_name(fr_dict_attr_err_t *err, fr_dict_attr
 	return da;
 }
 
+/** Maximum attribute number we'll build a direct index for
+ *
+ */
+#define DICT_CHILD_BY_NUM_MAX	UINT16_MAX
+
+/** Build a direct index of children for parents with dense number spaces above 255
+ *
+ * Children numbered 0-255 are already found with a single lookup in the
+ * 'children' array.  Above that they share bins, and lookups walk the
+ * chains.  Where at least a quarter of the numbers up to the highest
+ * child are in use, an array indexed by number is cheaper.
+ *
+ * Called when the dictionary is finalised, as the index must not change
+ * once lookups can come from multiple threads.
+ *
+ * @param[in] parent	to build the index for.
+ */
+void dict_attr_child_by_num_finalise(fr_dict_attr_t const *parent)
+{
+	fr_dict_attr_ext_children_t	*ext;
+	fr_dict_attr_t const		*bin;
+	fr_dict_attr_t const		**by_num;
+	unsigned int			max = 0, count = 0;
+	size_t				i, len;
+
+	ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+	if (!ext || !ext->children) return;
+
+	TALLOC_FREE(ext->child_by_num);
+
+	len = talloc_array_length(ext->children);
+	for (i = 0; i < len; i++) {
+		for (bin = ext->children[i]; bin; bin = bin->next) {
+			if (bin->attr > max) max = bin->attr;
+			count++;
+		}
+	}
+
+	if ((max <= UINT8_MAX) || (max > DICT_CHILD_BY_NUM_MAX) || ((count * 4) < max)) return;
+
+	by_num = talloc_zero_array(UNCONST(fr_dict_attr_t *, parent), fr_dict_attr_t const *, max + 1);
+	if (!by_num) return;	/* Lookups fall back to the bins */
+
+	/*
+	 *	Chains are in priority order, so the first
+	 *	attribute with a given number wins, the same
+	 *	as it does when walking the bins.
+	 */
+	for (i = 0; i < len; i++) {
+		for (bin = ext->children[i]; bin; bin = bin->next) {
+			if (!by_num[bin->attr]) by_num[bin->attr] = bin;
+		}
+	}
+
+	ext->child_by_num = by_num;
+}
+
 /** Internal version of fr_dict_attr_child_by_num
  *
  */
 fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned int attr)
 {
 	fr_dict_attr_t const *bin;
+	fr_dict_attr_ext_children_t *ext;
 	fr_dict_attr_t const **children;
 	fr_dict_attr_t const *ref;
 
@@ -3292,14 +3360,23 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	ref = fr_dict_attr_ref(parent);
 	if (ref) parent = ref;
 
-	children = dict_attr_children(parent);
+	ext = fr_dict_attr_ext(parent, FR_DICT_ATTR_EXT_CHILDREN);
+	if (!ext) return NULL;
+
+	if (ext->child_by_num) {
+		if (attr >= talloc_array_length(ext->child_by_num)) return NULL;
+
+		return UNCONST(fr_dict_attr_t *, ext->child_by_num[attr]);
+	}
+
+	children = ext->children;
 	if (!children) return NULL;
 
 	/*
 	 *	Child arrays may be trimmed back to save memory.
 	 *	Check that so we don't SEGV.
 	 */
-	if ((attr & 0xff) > talloc_array_length(children)) return NULL;
+	if ((attr & 0xff) >= talloc_array_length(children)) return NULL;
 
 	bin = children[attr & 0xff];
 	for (;;) {
@@ -4496,6 +4573,17 @@ char const *fr_dict_global_ctx_dir(void)
 	return dict_gctx->dict_dir_default;
 }
 
+/** Record the memory used by a dictionary
+ *
+ */
+static void dict_memory_account(fr_dict_t const *dict)
+{
+	talloc_account_t *acct;
+
+	acct = talloc_account("dict", dict->root->name);
+	if (acct) talloc_account_set(acct, talloc_total_size(dict));
+}
+
 /** Mark all dictionaries and the global dictionary ctx as read only
  *
  * Any attempts to add new attributes will now fail.
@@ -4508,18 +4596,22 @@ void fr_dict_global_ctx_read_only(void)
 	if (!dict_gctx) return;
 
 	/*
-	 *	Set everything to read only
+	 *	Set everything to read only, and record how
+	 *	much memory each dictionary uses, as they
+	 *	won't change now.
 	 */
 	for (dict = fr_hash_table_iter_init(dict_gctx->protocol_by_num, &iter);
 	     dict;
 	     dict = fr_hash_table_iter_next(dict_gctx->protocol_by_num, &iter)) {
 	     	dict_hash_tables_finalise(dict);
 		dict->read_only = true;
+		dict_memory_account(dict);
 	}
 
 	dict = dict_gctx->internal;
 	dict_hash_tables_finalise(dict);
 	dict->read_only = true;
+	dict_memory_account(dict);
 	dict_gctx->read_only = true;
 }
 
@@ -169,6 +169,160 @@ static bool labelcmp(uint8_t const *a, uint8_t const *b, size_t len)
 	return true;
 }
 
+/** Hash one label onto the hash of the name which follows it
+ *
+ *  Names are hashed from the last label to the first, so that the
+ *  hash of every suffix of a name is calculated along the way.
+ */
+static uint32_t dns_label_hash(uint32_t hash, uint8_t const *label)
+{
+	uint8_t const *p, *end = label + *label + 1;
+
+	hash = (hash ^ *label) * 16777619;
+
+	for (p = label + 1; p < end; p++) {
+		uint8_t c = *p;
+
+		if ((c >= 'A') && (c <= 'Z')) c |= 0x20;
+
+		hash = (hash ^ c) * 16777619;
+	}
+
+	return hash;
+}
+
+/** See if an uncompressed name matches a name in the packet
+ *
+ *  The name in the packet was written by us, so we can follow its
+ *  pointers.  They always point backwards.
+ */
+static bool dns_name_match(uint8_t const *packet, uint16_t offset, uint8_t const *label)
+{
+	uint8_t const *q = packet + offset;
+
+	while (true) {
+		while (*q >= 0xc0) {
+			uint8_t const *ptr = packet + (((q[0] & ~0xc0) << 8) | q[1]);
+
+			if (ptr >= q) return false;
+			q = ptr;
+		}
+
+		if (*q != *label) return false;
+
+		if (!*label) return true;
+
+		if (!labelcmp(q + 1, label + 1, *label)) return false;
+
+		q += *q + 1;
+		label += *label + 1;
+	}
+}
+
+/** Find a name in the packet which matches a suffix of the name being encoded
+ *
+ */
+static bool dns_suffix_find(fr_dns_labels_t *lb, uint32_t hash, uint8_t const *label, uint16_t *offset)
+{
+	unsigned int i, slot;
+
+	for (i = 0; i < FR_DNS_SUFFIX_PROBES; i++) {
+		fr_dns_suffix_t *suffix;
+
+		slot = (hash + i) & (FR_DNS_SUFFIX_MAX - 1);
+		suffix = &lb->suffixes[slot];
+
+		if (suffix->generation != lb->generation) return false;
+
+		if ((suffix->hash == hash) && dns_name_match(lb->start, suffix->offset, label)) {
+			*offset = suffix->offset;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Remember where a name starts in the packet
+ *
+ *  If the table is too full, the name just isn't used for compression.
+ */
+static void dns_suffix_add(fr_dns_labels_t *lb, uint32_t hash, uint16_t offset)
+{
+	unsigned int i, slot;
+
+	for (i = 0; i < FR_DNS_SUFFIX_PROBES; i++) {
+		fr_dns_suffix_t *suffix;
+
+		slot = (hash + i) & (FR_DNS_SUFFIX_MAX - 1);
+		suffix = &lb->suffixes[slot];
+
+		if (suffix->generation == lb->generation) continue;
+
+		*suffix = (fr_dns_suffix_t) {
+			.hash = hash,
+			.offset = offset,
+			.generation = lb->generation,
+		};
+		return;
+	}
+}
+
+/** Compress a name by looking up each of its suffixes in a hash of the names in the packet
+ *
+ *  This is O(N) in the number of labels in the name, instead of
+ *  O(N * B) in the size of the packet for dns_label_compress().  That
+ *  matters for large responses, where many records are under the same
+ *  zone.
+ *
+ *  The longest suffix which is already in the packet is replaced with a
+ *  pointer, and the labels before it are added to the hash, so that
+ *  later names can point to them.
+ *
+ * @param[in] lb		label tracking data structure.
+ * @param[in] where		the uncompressed name, which is in the packet.
+ * @param[in,out] label_end	end of the name, updated if it's compressed.
+ */
+static void dns_label_compress_hashed(fr_dns_labels_t *lb, uint8_t *where, uint8_t **label_end)
+{
+	uint8_t		*labels[128];
+	uint32_t	hashes[128];
+	uint32_t	hash = 2166136261;
+	uint16_t	offset;
+	int		i, num = 0, match;
+	uint8_t		*p;
+
+	for (p = where; *p; p += *p + 1) {
+		if ((size_t) num == NUM_ELEMENTS(labels)) return;
+		labels[num++] = p;
+	}
+
+	for (i = num - 1; i >= 0; i--) {
+		hash = dns_label_hash(hash, labels[i]);
+		hashes[i] = hash;
+	}
+
+	for (match = 0; match < num; match++) {
+		if (!dns_suffix_find(lb, hashes[match], labels[match], &offset)) continue;
+
+		FR_PROTO_TRACE("Compressed label at offset %zu to pointer %u",
+			       (size_t) (labels[match] - lb->start), offset);
+
+		labels[match][0] = (offset >> 8) | 0xc0;
+		labels[match][1] = offset & 0xff;
+		*label_end = labels[match] + 2;
+		break;
+	}
+
+	for (i = 0; i < match; i++) {
+		size_t label_offset = labels[i] - lb->start;
+
+		if (label_offset >= MAX_OFFSET) break;
+
+		dns_suffix_add(lb, hashes[i], label_offset);
+	}
+}
+
 /** Compress "label" by looking at the label recursively.
  *
  *  For "ftp.example.com", it searches the input buffer for a matching
@@ -804,7 +958,13 @@ ssize_t fr_dns_label_from_value_box(size_t *need, uint8_t *buf, size_t buf_len,
 	 *	then do it.
 	 */
 	if (compression && ((data - where) > 2)) {
-		if (lb) {
+		if (lb && lb->suffixes) {
+			fr_assert(where > lb->start);
+
+			dns_label_compress_hashed(lb, where, &data);
+			dns_label_add(lb, where, data);
+
+		} else if (lb) {
 			int i;
 
 			/*
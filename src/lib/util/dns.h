@@ -32,6 +32,18 @@ typedef struct {
 	uint16_t	end;
 } fr_dns_block_t;
 
+/** A name which has been written to the packet, for compression
+ *
+ */
+typedef struct {
+	uint32_t	hash;		//!< of the name, case insensitive.
+	uint16_t	offset;		//!< where the name starts in the packet.
+	uint16_t	generation;	//!< which packet the entry belongs to.
+} fr_dns_suffix_t;
+
+#define FR_DNS_SUFFIX_MAX	(1024)	//!< Size of the suffix hash, must be a power of 2.
+#define FR_DNS_SUFFIX_PROBES	(8)	//!< Maximum number of slots to check.
+
 typedef struct {
 	uint8_t const	*start;		//!< start of packet
 	uint8_t const	*end;		//!< end of the packet
@@ -39,6 +51,11 @@ typedef struct {
 	int		num;		//!< number of used labels
 	int		max;		//! maximum number of labels
 	fr_dns_block_t	*blocks;	//!< array holding "max" labels
+
+	fr_dns_suffix_t	*suffixes;	//!< hash of names in the packet, holding #FR_DNS_SUFFIX_MAX
+					///< entries.  If NULL, compression scans the blocks instead.
+	uint16_t	generation;	//!< of the current packet.  Entries from other packets
+					///< are ignored, so the hash doesn't need to be cleared.
 } fr_dns_labels_t;
 
 ssize_t		fr_dns_label_from_value_box(size_t *need, uint8_t *buf, size_t buflen, uint8_t *where, bool compression, fr_value_box_t const *value, fr_dns_labels_t *lb);
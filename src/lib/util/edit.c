@@ -893,9 +893,19 @@ int fr_edit_list_insert_list_after(fr_edit_list_t *el, fr_pair_list_t *list, fr_
 
 	if (!el) {
 		/*
-		 *	@todo - this should really be an O(1) dlist
-		 *	operation.
+		 *	Appending and prepending move the whole list at
+		 *	once.
 		 */
+		if (!pos) {
+			fr_pair_list_prepend(list, to_insert);
+			return 0;
+		}
+
+		if (pos == fr_pair_list_tail(list)) {
+			fr_pair_list_append(list, to_insert);
+			return 0;
+		}
+
 		while ((vp = fr_pair_list_head(to_insert)) != NULL) {
 			(void) fr_pair_remove(to_insert, vp);
 			(void) fr_pair_insert_after(list, prev, vp);
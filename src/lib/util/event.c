@@ -33,6 +33,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/lst.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/math.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
@@ -44,6 +45,20 @@ RCSID("$Id$")
 #include <sys/wait.h>
 #include <pthread.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <linux/io_uring.h>
+#  include <poll.h>
+#  include <sys/ioctl.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#endif
+
 #ifdef NDEBUG
 /*
  *	Turn off documentation warnings as file/line
@@ -56,6 +71,10 @@ DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 
 #define FR_EV_BATCH_FDS (256)
 
+#ifdef HAVE_LINUX_IO_URING_H
+#  define FR_EV_URING_ENTRIES (256)
+#endif
+
 DIAG_OFF(unused-macros)
 #define fr_time() static_assert(0, "Use el->time for event loop timing")
 DIAG_ON(unused-macros)
@@ -92,6 +111,18 @@ static fr_table_num_sorted_t const kevent_filter_table[] = {
 };
 static size_t kevent_filter_table_len = NUM_ELEMENTS(kevent_filter_table);
 
+fr_table_num_sorted_t const fr_event_backend_table[] = {
+	{ L("io_uring"),	FR_EVENT_BACKEND_IO_URING	},
+	{ L("kqueue"),		FR_EVENT_BACKEND_KQUEUE		}
+};
+size_t fr_event_backend_table_len = NUM_ELEMENTS(fr_event_backend_table);
+
+/** Backend used for new event lists
+ *
+ * Set once at startup, before any threads are created.
+ */
+static fr_event_backend_t event_backend = FR_EVENT_BACKEND_KQUEUE;
+
 #ifdef EVFILT_LIBKQUEUE
 static int log_conf_kq;
 #endif
@@ -288,6 +319,58 @@ static fr_table_num_sorted_t const fr_event_fd_type_table[] = {
 };
 static size_t fr_event_fd_type_table_len = NUM_ELEMENTS(fr_event_fd_type_table);
 
+#ifdef HAVE_LINUX_IO_URING_H
+/** An io_uring poll request for one filter of a file descriptor
+ *
+ * These are separate from the #fr_event_fd_t, because the kernel
+ * may still complete the request after the filter has been deleted.
+ * They're only freed once we've seen their final completion.
+ */
+typedef struct {
+	fr_event_fd_t		*ef;			//!< Event this poll is for.  NULL if the filter
+							///< was deleted while the poll was armed.
+	int			fd;			//!< File descriptor we're polling.
+	int16_t			filter;			//!< EVFILT_READ or EVFILT_WRITE.
+	bool			armed;			//!< Whether the kernel holds a poll request for us.
+	fr_dlist_t		entry;			//!< Entry in the list of polls to re-arm.
+} fr_event_uring_poll_t;
+
+/** io_uring state for an event list
+ *
+ * Readiness of sockets is delivered by one-shot poll requests, which
+ * are re-armed on the next call to #fr_event_corral.  This gives the
+ * same level-triggered behaviour as kqueue, and the re-arming is
+ * submitted in the same system call as the wait.
+ *
+ * Everything else (user events, PIDs, vnodes, files) stays with
+ * kqueue, and the kqueue descriptor itself is polled via io_uring.
+ */
+typedef struct {
+	int			fd;			//!< io_uring instance.
+
+	void			*ring;			//!< mmapped submission and completion rings.
+	size_t			ring_size;		//!< Size of the rings mapping.
+	struct io_uring_sqe	*sqes;			//!< mmapped submission queue entries.
+	size_t			sqes_size;		//!< Size of the SQE mapping.
+
+	unsigned int		sq_entries;		//!< Number of SQEs.
+	unsigned int		sq_mask;		//!< Mask to apply to SQ indexes.
+	atomic_uint		*sq_head;		//!< Updated by the kernel.
+	atomic_uint		*sq_tail;		//!< Updated by us.
+	unsigned int		*sq_array;		//!< Indirection array of SQEs.
+	unsigned int		tail;			//!< Our local copy of the SQ tail.
+	unsigned int		to_submit;		//!< SQEs queued, but not yet submitted.
+
+	unsigned int		cq_mask;		//!< Mask to apply to CQ indexes.
+	atomic_uint		*cq_head;		//!< Updated by us.
+	atomic_uint		*cq_tail;		//!< Updated by the kernel.
+	struct io_uring_cqe	*cqes;			//!< Completion queue entries.
+
+	fr_dlist_head_t		rearm;			//!< Polls which have fired, and need re-arming.
+	fr_event_uring_poll_t	kq_poll;		//!< Poll on the kqueue descriptor.
+} fr_event_uring_t;
+#endif
+
 /** A file descriptor/filter event
  *
  */
@@ -311,6 +394,10 @@ struct fr_event_fd {
 
 	fr_event_func_map_t const *map;			//!< Function map between #fr_event_funcs_t and kevent filters.
 
+#ifdef HAVE_LINUX_IO_URING_H
+	fr_event_uring_poll_t	*uring[2];		//!< io_uring poll requests for the read and write filters.
+#endif
+
 	bool			is_registered;		//!< Whether this fr_event_fd_t's FD has been registered with
 							///< kevent.  Mostly for debugging.
 
@@ -405,6 +492,50 @@ typedef struct {
 	void			*uctx;			//!< Context for the callback.
 } fr_event_post_t;
 
+/*
+ *	Each level of the timer wheel has 64 slots, so that the
+ *	bitmap of non-empty slots fits into a uint64_t.
+ */
+#define WHEEL_BITS		(6)
+#define WHEEL_SLOTS		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS		(4)
+#define WHEEL_SPAN(_level)	((uint64_t) 1 << (WHEEL_BITS * (_level)))
+
+/** Hierarchical timer wheel for coarse timers
+ *
+ * Level 0 has one slot per tick.  Each slot of level N covers all of
+ * level N-1.  When level N-1 wraps around, the next slot of level N
+ * is "cascaded", i.e. its timers are re-inserted at the lower levels.
+ *
+ * The whole wheel is driven by one normal timer event, set for the
+ * next tick which has work to do.  It's only moved when a timer is
+ * inserted which expires before that.
+ */
+typedef struct {
+	fr_event_list_t		*el;			//!< Event list the wheel is in.
+	fr_time_t		epoch;			//!< The time of tick 0.
+	uint64_t		tick;			//!< The next tick to process.
+	uint64_t		armed;			//!< The tick which "ev" will fire at.
+	uint64_t		num_timers;		//!< Number of timers in the wheel.
+	fr_event_timer_t const	*ev;			//!< Drives the wheel.
+
+	uint64_t		occupied[WHEEL_LEVELS];	//!< Bitmap of non-empty slots.
+	fr_dlist_head_t		slots[WHEEL_LEVELS][WHEEL_SLOTS];	//!< Lists of fr_event_wheel_timer_t.
+} fr_event_wheel_t;
+
+/** A callback posted to an event list from another thread
+ *
+ */
+typedef struct fr_event_inject_s fr_event_inject_t;
+struct fr_event_inject_s {
+	fr_event_inject_t	*next;			//!< Next entry in the queue.
+	fr_time_t		when;			//!< When to run the callback.  0 means as soon as possible.
+	fr_event_timer_cb_t	callback;		//!< To call in the thread which owns the event list.
+	void			*uctx;			//!< Passed to the callback.
+	fr_event_timer_t const	*ev;			//!< Timer for delayed callbacks.
+};
+
 /** Stores all information relating to an event list
  *
  */
@@ -424,6 +555,9 @@ struct fr_event_list {
 	int			num_fd_events;		//!< Number of events in this event list.
 
 	int			kq;			//!< instance associated with this event list.
+#ifdef HAVE_LINUX_IO_URING_H
+	fr_event_uring_t	*uring;			//!< io_uring state, if we're using it for socket events.
+#endif
 
 	fr_dlist_head_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_head_t		post_callbacks;		//!< post-processing callbacks
@@ -439,6 +573,10 @@ struct fr_event_list {
 	fr_dlist_head_t		fd_to_free;		//!< File descriptor events pending deletion.
 	fr_dlist_head_t		ev_to_add;		//!< dlist of events to add
 
+	fr_event_wheel_t	*wheel;			//!< For coarse timers.  Allocated on first use.
+
+	_Atomic(fr_event_inject_t *) inject;		//!< Callbacks posted by other threads, newest first.
+
 #ifdef WITH_EVENT_DEBUG
 	fr_event_timer_t const	*report;		//!< Report event.
 #endif
@@ -649,6 +787,452 @@ fr_time_t fr_event_list_time(fr_event_list_t *el)
 	}
 }
 
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ *	Completions for these SQEs are ignored.
+ */
+#define URING_UDATA_IGNORE	((uint64_t) 0)
+
+static inline CC_HINT(always_inline)
+int event_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+		      void *arg, size_t arg_len)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_len);
+}
+
+/** Unmap the rings, and close the io_uring
+ *
+ * Closing the io_uring cancels any outstanding poll requests.
+ */
+static int _event_uring_free(fr_event_uring_t *u)
+{
+	if (u->sqes) munmap(u->sqes, u->sqes_size);
+	if (u->ring) munmap(u->ring, u->ring_size);
+	if (u->fd >= 0) close(u->fd);
+
+	return 0;
+}
+
+/** Get the next free SQE
+ *
+ * If the submission queue is full, the pending SQEs are submitted first.
+ */
+static struct io_uring_sqe *event_uring_sqe(fr_event_uring_t *u)
+{
+	struct io_uring_sqe	*sqe;
+	unsigned int		idx;
+
+	if ((u->tail - atomic_load_explicit(u->sq_head, memory_order_acquire)) >= u->sq_entries) {
+		int ret;
+
+		atomic_store_explicit(u->sq_tail, u->tail, memory_order_release);
+		do {
+			ret = event_uring_enter(u->fd, u->to_submit, 0, 0, NULL, 0);
+		} while ((ret < 0) && (errno == EINTR));
+		if (ret < 0) {
+			fr_strerror_printf("Failed submitting to io_uring: %s", fr_syserror(errno));
+			return NULL;
+		}
+		u->to_submit -= ret;
+
+		if ((u->tail - atomic_load_explicit(u->sq_head, memory_order_acquire)) >= u->sq_entries) {
+			fr_strerror_const("io_uring submission queue is full");
+			return NULL;
+		}
+	}
+
+	idx = u->tail & u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	u->tail++;
+	u->to_submit++;
+
+	return sqe;
+}
+
+/** Queue a one-shot poll request
+ *
+ */
+static int event_uring_poll_arm(fr_event_uring_t *u, fr_event_uring_poll_t *p)
+{
+	struct io_uring_sqe	*sqe;
+	uint32_t		events;
+
+	sqe = event_uring_sqe(u);
+	if (!sqe) return -1;
+
+	if (p->filter == EVFILT_WRITE) {
+		events = POLLOUT;
+	} else {
+		events = POLLIN;
+#ifdef POLLRDHUP
+		events |= POLLRDHUP;
+#endif
+	}
+
+	/*
+	 *	The kernel reads poll32_events as two 16-bit halves.
+	 */
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = p->fd;
+	sqe->poll32_events = events;
+	sqe->user_data = (uint64_t) (uintptr_t) p;
+	p->armed = true;
+
+	return 0;
+}
+
+/** Stop polling for a filter
+ *
+ * If the poll is armed, we ask the kernel to remove it, and free it when
+ * its completion arrives.  Otherwise we can free it now.
+ */
+static void event_uring_poll_release(fr_event_uring_t *u, fr_event_uring_poll_t *p)
+{
+	struct io_uring_sqe *sqe;
+
+	p->ef = NULL;
+
+	if (!p->armed) {
+		if (fr_dlist_entry_in_list(&p->entry)) fr_dlist_remove(&u->rearm, p);
+		talloc_free(p);
+		return;
+	}
+
+	/*
+	 *	If there's no room to queue the removal, the poll
+	 *	is freed when the descriptor is next ready.
+	 */
+	sqe = event_uring_sqe(u);
+	if (!sqe) return;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = (uint64_t) (uintptr_t) p;
+	sqe->user_data = URING_UDATA_IGNORE;
+}
+
+/** Create the io_uring for an event list
+ *
+ * @param[in] el	to create the io_uring for.
+ * @return
+ *	- The io_uring state on success.
+ *	- NULL on error.  The event list should then continue using kqueue.
+ */
+static fr_event_uring_t *event_uring_alloc(fr_event_list_t *el)
+{
+	fr_event_uring_t	*u;
+	struct io_uring_params	params;
+	uint8_t			*ring;
+
+	u = talloc_zero(NULL, fr_event_uring_t);
+	if (unlikely(!u)) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	u->fd = -1;
+	talloc_set_destructor(u, _event_uring_free);
+
+	memset(&params, 0, sizeof(params));
+	u->fd = (int) syscall(__NR_io_uring_setup, FR_EV_URING_ENTRIES, &params);
+	if (u->fd < 0) {
+		fr_strerror_printf("Failed creating io_uring: %s", fr_syserror(errno));
+	error:
+		talloc_free(u);
+		return NULL;
+	}
+
+	/*
+	 *	We need a single mapping for both rings, completions
+	 *	which are never dropped, and timeouts for
+	 *	io_uring_enter().  These are all in 5.11 and later.
+	 */
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(params.features & IORING_FEAT_NODROP) ||
+	    !(params.features & IORING_FEAT_EXT_ARG)) {
+		fr_strerror_const("io_uring is missing required features");
+		goto error;
+	}
+
+	u->ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+	if ((params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe))) > u->ring_size) {
+		u->ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+	}
+
+	ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping io_uring rings: %s", fr_syserror(errno));
+		goto error;
+	}
+	u->ring = ring;
+
+	u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		fr_strerror_printf("Failed mapping io_uring SQEs: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	u->sq_entries = params.sq_entries;
+	u->sq_mask = *(unsigned int *)(ring + params.sq_off.ring_mask);
+	u->sq_head = (atomic_uint *)(ring + params.sq_off.head);
+	u->sq_tail = (atomic_uint *)(ring + params.sq_off.tail);
+	u->sq_array = (unsigned int *)(ring + params.sq_off.array);
+	u->tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+
+	u->cq_mask = *(unsigned int *)(ring + params.cq_off.ring_mask);
+	u->cq_head = (atomic_uint *)(ring + params.cq_off.head);
+	u->cq_tail = (atomic_uint *)(ring + params.cq_off.tail);
+	u->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+	fr_dlist_init(&u->rearm, fr_event_uring_poll_t, entry);
+
+	/*
+	 *	Everything io_uring doesn't handle is still delivered
+	 *	via kqueue, so we poll the kqueue descriptor too.
+	 */
+	u->kq_poll.fd = el->kq;
+	u->kq_poll.filter = EVFILT_READ;
+	fr_dlist_entry_init(&u->kq_poll.entry);
+	if (event_uring_poll_arm(u, &u->kq_poll) < 0) goto error;
+
+	return u;
+}
+
+/** Apply a set of filter changes with io_uring
+ *
+ * Read and write filters for sockets are handled by io_uring.  Anything
+ * else is passed through to kqueue.
+ */
+static int event_uring_changes(fr_event_list_t *el, struct kevent const evset[], int count)
+{
+	fr_event_uring_t	*u = el->uring;
+	struct kevent		kq_evset[10];
+	int			i, kq_count = 0;
+
+	fr_assert(count <= (int) NUM_ELEMENTS(kq_evset));
+
+	for (i = 0; i < count; i++) {
+		fr_event_fd_t		*ef = evset[i].udata;
+		fr_event_uring_poll_t	*p;
+		int			idx;
+
+		if (((evset[i].filter != EVFILT_READ) && (evset[i].filter != EVFILT_WRITE)) ||
+		    !(ef->type & (FR_EVENT_FD_SOCKET | FR_EVENT_FD_PCAP))) {
+			kq_evset[kq_count++] = evset[i];
+			continue;
+		}
+
+		idx = (evset[i].filter == EVFILT_WRITE);
+
+		if (evset[i].flags & EV_DELETE) {
+			if (ef->uring[idx]) {
+				event_uring_poll_release(u, ef->uring[idx]);
+				ef->uring[idx] = NULL;
+			}
+			continue;
+		}
+
+		if (ef->uring[idx]) continue;	/* Already polling */
+
+		p = talloc_zero(u, fr_event_uring_poll_t);
+		if (unlikely(!p)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		p->ef = ef;
+		p->fd = ef->fd;
+		p->filter = evset[i].filter;
+		fr_dlist_entry_init(&p->entry);
+
+		if (event_uring_poll_arm(u, p) < 0) {
+			talloc_free(p);
+			errno = EAGAIN;
+			return -1;
+		}
+		ef->uring[idx] = p;
+	}
+
+	if (!kq_count) return 0;
+
+	return kevent(el->kq, kq_evset, kq_count, NULL, 0, NULL);
+}
+
+/** Turn a poll completion into the kevent that kqueue would have given us
+ *
+ */
+static inline CC_HINT(always_inline)
+void event_uring_cqe_to_kevent(struct kevent *kev, fr_event_uring_poll_t *p, int res)
+{
+	fr_event_fd_t *ef = p->ef;
+
+	EV_SET(kev, p->fd, p->filter, 0, 0, 0, ef);
+
+	if (res < 0) {
+		kev->flags = EV_ERROR;
+		kev->data = -res;
+		return;
+	}
+
+	/*
+	 *	Errors on datagram sockets (e.g. ICMP unreachable)
+	 *	are returned by the next read, and don't mean the
+	 *	socket is dead.
+	 */
+	if ((res & POLLERR) && (ef->sock_type != SOCK_DGRAM)) {
+		int		fd_errno = 0;
+		socklen_t	len = sizeof(fd_errno);
+
+		(void) getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len);
+		kev->flags |= EV_EOF;
+		kev->fflags = fd_errno;
+	}
+
+#ifdef POLLRDHUP
+	if (res & (POLLHUP | POLLRDHUP)) kev->flags |= EV_EOF;
+#else
+	if (res & POLLHUP) kev->flags |= EV_EOF;
+#endif
+
+	/*
+	 *	kqueue tells us how much data is left to read at EOF.
+	 */
+	if ((kev->flags & EV_EOF) && (p->filter == EVFILT_READ)) {
+		int avail = 0;
+
+		(void) ioctl(p->fd, FIONREAD, &avail);
+		kev->data = avail;
+	}
+}
+
+/** Wait for events with io_uring
+ *
+ * Re-arms any polls which fired since the last call, waits for
+ * completions, and converts them into kevents in el->events.
+ *
+ * @param[in] el	to wait for events on.
+ * @param[in] ts_wake	how long to wait.  NULL means wait forever.
+ * @return
+ *	- The number of events written to el->events.
+ *	- <0 on error, with errno set.
+ */
+static int event_uring_wait(fr_event_list_t *el, struct timespec const *ts_wake)
+{
+	fr_event_uring_t		*u = el->uring;
+	fr_event_uring_poll_t		*p;
+	struct __kernel_timespec	ts;
+	struct io_uring_getevents_arg	arg = { 0 };
+	unsigned int			head, tail, min_complete = 1;
+	int				ret, wait_errno = 0, num = 0;
+
+	while ((p = fr_dlist_pop_head(&u->rearm))) {
+		if (event_uring_poll_arm(u, p) < 0) {
+			fr_dlist_insert_head(&u->rearm, p);
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	if (ts_wake) {
+		if (!ts_wake->tv_sec && !ts_wake->tv_nsec) min_complete = 0;
+
+		ts.tv_sec = ts_wake->tv_sec;
+		ts.tv_nsec = ts_wake->tv_nsec;
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+	}
+
+	atomic_store_explicit(u->sq_tail, u->tail, memory_order_release);
+	ret = event_uring_enter(u->fd, u->to_submit, min_complete,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (ret < 0) {
+		switch (errno) {
+		case ETIME:	/* Timed out */
+		case EBUSY:	/* Completions are backed up, reap them */
+			break;
+
+		case EINTR:
+			wait_errno = EINTR;
+			break;
+
+		default:
+			return -1;
+		}
+	} else {
+		u->to_submit -= ret;
+	}
+
+	head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+	tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+
+	while ((head != tail) && (num < FR_EV_BATCH_FDS)) {
+		struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+
+		head++;
+
+		if (cqe->user_data == URING_UDATA_IGNORE) continue;
+
+		p = (fr_event_uring_poll_t *) (uintptr_t) cqe->user_data;
+		p->armed = false;
+
+		/*
+		 *	Pull in whatever kqueue has for us.  If
+		 *	there's more than fits, the kqueue descriptor
+		 *	will still be readable when we re-arm.
+		 */
+		if (p == &u->kq_poll) {
+			ret = kevent(el->kq, NULL, 0, el->events + num, FR_EV_BATCH_FDS - num, &(struct timespec){ 0 });
+			if (ret > 0) num += ret;
+			fr_dlist_insert_tail(&u->rearm, p);
+			continue;
+		}
+
+		/*
+		 *	The filter was deleted, this is the final
+		 *	completion.
+		 */
+		if (!p->ef) {
+			talloc_free(p);
+			continue;
+		}
+
+		event_uring_cqe_to_kevent(&el->events[num++], p, cqe->res);
+
+		/*
+		 *	On error the event is freed when it's
+		 *	serviced, which releases the poll.
+		 */
+		if (cqe->res >= 0) fr_dlist_insert_tail(&u->rearm, p);
+	}
+
+	atomic_store_explicit(u->cq_head, head, memory_order_release);
+
+	if (!num && wait_errno) {
+		errno = wait_errno;
+		return -1;
+	}
+
+	return num;
+}
+#endif
+
+/** Apply a set of filter changes to the event list
+ *
+ */
+static inline CC_HINT(always_inline)
+int event_changes(fr_event_list_t *el, struct kevent const evset[], int count)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (el->uring) return event_uring_changes(el, evset, count);
+#endif
+
+	return kevent(el->kq, evset, count, NULL, 0, NULL);
+}
+
 /** Placeholder callback to avoid branches in service loop
  *
  * This is set in place of any NULL function pointers, so that the event loop doesn't
@@ -892,7 +1476,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = event_changes(el, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD %i was closed without being removed from the KQ: %s",
 						ef->fd, fr_syserror(errno))) {
@@ -1054,7 +1638,7 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (count && unlikely(event_changes(el, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -1161,7 +1745,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(event_changes(el, evset, count) < 0))) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -1193,7 +1777,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(event_changes(el, evset, count) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1635,6 +2219,328 @@ fr_time_t fr_event_timer_when(fr_event_timer_t const *ev)
 	return ev->when;
 }
 
+/** Convert a time to the first tick at or after it
+ *
+ * Timers fire late, never early.
+ */
+static inline CC_HINT(always_inline) uint64_t wheel_tick_ceil(fr_event_wheel_t const *w, fr_time_t when)
+{
+	int64_t res = fr_time_delta_unwrap(FR_EVENT_WHEEL_RESOLUTION);
+
+	if (fr_time_lteq(when, w->epoch)) return 0;
+
+	return (fr_time_delta_unwrap(fr_time_sub(when, w->epoch)) + res - 1) / res;
+}
+
+/** Convert a time to the last tick at or before it
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t wheel_tick_floor(fr_event_wheel_t const *w, fr_time_t when)
+{
+	if (fr_time_lteq(when, w->epoch)) return 0;
+
+	return fr_time_delta_unwrap(fr_time_sub(when, w->epoch)) / fr_time_delta_unwrap(FR_EVENT_WHEEL_RESOLUTION);
+}
+
+static inline CC_HINT(always_inline) fr_time_t wheel_tick_time(fr_event_wheel_t const *w, uint64_t tick)
+{
+	return fr_time_add(w->epoch, fr_time_delta_wrap(tick * fr_time_delta_unwrap(FR_EVENT_WHEEL_RESOLUTION)));
+}
+
+/** Put a timer into the correct slot, based on how far away it is
+ *
+ */
+static void wheel_insert(fr_event_wheel_t *w, fr_event_wheel_timer_t *t)
+{
+	uint64_t	expires, delta;
+	unsigned int	level;
+
+	expires = wheel_tick_ceil(w, t->when);
+	if (expires < w->tick) expires = w->tick;
+	delta = expires - w->tick;
+
+	for (level = 0; level < (WHEEL_LEVELS - 1); level++) {
+		if (delta < WHEEL_SPAN(level + 1)) break;
+	}
+
+	/*
+	 *	Too far in the future for the wheel.  Put the timer
+	 *	in the furthest slot, and it will be put back in the
+	 *	right place when that slot is cascaded.
+	 */
+	if (delta >= WHEEL_SPAN(WHEEL_LEVELS)) expires = w->tick + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+
+	t->level = level;
+	t->slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	fr_dlist_insert_tail(&w->slots[level][t->slot], t);
+	w->occupied[level] |= ((uint64_t) 1) << t->slot;
+}
+
+static void wheel_remove(fr_event_wheel_t *w, fr_event_wheel_timer_t *t)
+{
+	fr_dlist_head_t *head = &w->slots[t->level][t->slot];
+
+	(void) fr_dlist_remove(head, t);
+	if (fr_dlist_empty(head)) w->occupied[t->level] &= ~(((uint64_t) 1) << t->slot);
+}
+
+/** Re-insert all of the timers in one slot of a higher level
+ *
+ */
+static void wheel_cascade(fr_event_wheel_t *w, unsigned int level, unsigned int slot)
+{
+	fr_dlist_head_t		head;
+	fr_event_wheel_timer_t	*t;
+
+	fr_dlist_init(&head, fr_event_wheel_timer_t, entry);
+	fr_dlist_move(&head, &w->slots[level][slot]);
+	w->occupied[level] &= ~(((uint64_t) 1) << slot);
+
+	while ((t = fr_dlist_pop_head(&head))) wheel_insert(w, t);
+}
+
+/** Find the next tick which has work to do
+ *
+ * That's either a non-empty slot at level 0, or the cascade of a
+ * non-empty slot at a higher level.  The caller must ensure that the
+ * wheel isn't empty.
+ */
+static uint64_t wheel_next(fr_event_wheel_t const *w)
+{
+	uint64_t	next = UINT64_MAX;
+	unsigned int	level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		uint64_t	start, bits, when;
+		unsigned int	idx;
+
+		if (!w->occupied[level]) continue;
+
+		/*
+		 *	The first slot boundary of this level at or
+		 *	after the current tick.
+		 */
+		start = (w->tick + WHEEL_SPAN(level) - 1) >> (WHEEL_BITS * level);
+		idx = start & WHEEL_MASK;
+
+		bits = w->occupied[level] >> idx;
+		if (idx) bits |= w->occupied[level] << (WHEEL_SLOTS - idx);
+
+		when = (start + fr_low_bit_pos(bits) - 1) << (WHEEL_BITS * level);
+		if (when < next) next = when;
+	}
+
+	return next;
+}
+
+static void wheel_run(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Set the event which drives the wheel
+ *
+ */
+static int wheel_schedule(fr_event_wheel_t *w)
+{
+	uint64_t next;
+
+	if (!w->num_timers) {
+		if (w->ev) (void) fr_event_timer_delete(&w->ev);
+		return 0;
+	}
+
+	next = wheel_next(w);
+	if (w->ev && (next == w->armed)) return 0;
+
+	if (fr_event_timer_at(w, w->el, &w->ev, wheel_tick_time(w, next), wheel_run, w) < 0) return -1;
+	w->armed = next;
+
+	return 0;
+}
+
+/** Run all of the wheel timers which have expired
+ *
+ */
+static void wheel_run(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_event_wheel_t	*w = talloc_get_type_abort(uctx, fr_event_wheel_t);
+	uint64_t		next, target = wheel_tick_floor(w, now);
+	unsigned int		level;
+	fr_dlist_head_t		*head;
+	fr_event_wheel_timer_t	*t;
+
+	while (w->num_timers) {
+		next = wheel_next(w);
+		if (next > target) break;
+
+		w->tick = next;
+
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if (w->tick & (WHEEL_SPAN(level) - 1)) break;
+
+			wheel_cascade(w, level, (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+		}
+
+		/*
+		 *	The callbacks may insert or delete other
+		 *	timers, including ones in this slot.
+		 */
+		head = &w->slots[0][w->tick & WHEEL_MASK];
+		while ((t = fr_dlist_pop_head(head))) {
+			w->num_timers--;
+			t->el = NULL;
+
+			t->callback(el, now, t->uctx);
+		}
+		w->occupied[0] &= ~(((uint64_t) 1) << (w->tick & WHEEL_MASK));
+
+		w->tick++;
+	}
+
+	/*
+	 *	Nothing else needs to be done before "target".
+	 */
+	if (w->tick <= target) w->tick = target + 1;
+
+	/*
+	 *	This only fails if the event list is exiting, in
+	 *	which case the timers won't run anyway.
+	 */
+	(void) wheel_schedule(w);
+}
+
+static int _event_wheel_free(fr_event_wheel_t *w)
+{
+	fr_event_wheel_timer_t	*t;
+	unsigned int		i, j;
+
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) {
+			while ((t = fr_dlist_pop_head(&w->slots[i][j]))) t->el = NULL;
+		}
+	}
+
+	w->el->wheel = NULL;
+
+	return 0;
+}
+
+static fr_event_wheel_t *event_wheel_alloc(fr_event_list_t *el)
+{
+	fr_event_wheel_t	*w;
+	unsigned int		i, j;
+
+	w = talloc_zero(el, fr_event_wheel_t);
+	if (unlikely(!w)) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	w->el = el;
+	w->epoch = el->time();
+
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) fr_dlist_init(&w->slots[i][j], fr_event_wheel_timer_t, entry);
+	}
+
+	talloc_set_destructor(w, _event_wheel_free);
+
+	return w;
+}
+
+/** Insert a coarse timer into an event list
+ *
+ * This is cheaper than #fr_event_timer_at, but the timer may fire up
+ * to #FR_EVENT_WHEEL_RESOLUTION late.  It's intended for cleanup
+ * timers, which are set on every packet, and are usually deleted or
+ * moved before they fire.
+ *
+ * If the timer is already armed, it is moved.
+ *
+ * @param[in] el		to insert the timer into.
+ * @param[in] t			to insert.
+ * @param[in] when		we should run the callback.
+ * @param[in] callback		function to execute when the timer fires.
+ * @param[in] uctx		user data to pass to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_wheel_timer_at(fr_event_list_t *el, fr_event_wheel_timer_t *t,
+			    fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+{
+	fr_event_wheel_t *w;
+
+	if (unlikely(el->exit)) {
+		fr_strerror_const("Event loop exiting");
+		return -1;
+	}
+
+	if (!el->wheel) {
+		el->wheel = event_wheel_alloc(el);
+		if (!el->wheel) return -1;
+	}
+	w = el->wheel;
+
+	fr_event_wheel_timer_delete(t);
+
+	t->when = when;
+	t->callback = callback;
+	memcpy(&t->uctx, &uctx, sizeof(t->uctx));
+	t->el = el;
+
+	wheel_insert(w, t);
+	w->num_timers++;
+
+	/*
+	 *	Only touch the driving event if this timer expires
+	 *	before it.
+	 */
+	if (!w->ev || (wheel_tick_ceil(w, when) < w->armed)) {
+		if (wheel_schedule(w) < 0) {
+			fr_event_wheel_timer_delete(t);
+			fr_strerror_const_push("Failed inserting timer");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Insert a coarse timer into an event list
+ *
+ * @param[in] el		to insert the timer into.
+ * @param[in] t			to insert.
+ * @param[in] delta		how long to wait before running the callback.
+ * @param[in] callback		function to execute when the timer fires.
+ * @param[in] uctx		user data to pass to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_wheel_timer_in(fr_event_list_t *el, fr_event_wheel_timer_t *t,
+			    fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return fr_event_wheel_timer_at(el, t, fr_time_add(el->time(), delta), callback, uctx);
+}
+
+/** Delete a coarse timer
+ *
+ * Does nothing if the timer isn't armed.
+ *
+ * @param[in] t		to delete.
+ */
+void fr_event_wheel_timer_delete(fr_event_wheel_timer_t *t)
+{
+	fr_event_wheel_t *w;
+
+	if (!t->el) return;
+
+	w = t->el->wheel;
+	wheel_remove(w, t);
+	w->num_timers--;
+	t->el = NULL;
+}
+
 /** Remove PID wait event from kevent if the fr_event_pid_t is freed
  *
  * @param[in] ev	to free.
@@ -2244,6 +3150,149 @@ int fr_event_user_trigger(fr_event_list_t *el, fr_event_user_t *ev)
 	return 0;
 }
 
+/** Post a callback to an event list
+ *
+ * The queue is a lock-free stack.  Producers push with a CAS, and the
+ * owning thread takes the whole stack at once, so there's no ABA
+ * problem.  Only the producer which finds the stack empty wakes the
+ * owning thread, so a burst of callbacks costs one kevent() call.
+ */
+static int event_inject(fr_event_list_t *el, fr_time_t when, fr_event_timer_cb_t callback, void *uctx)
+{
+	fr_event_inject_t	*inject, *head;
+	struct kevent		kev;
+
+	inject = talloc(NULL, fr_event_inject_t);
+	if (unlikely(!inject)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	*inject = (fr_event_inject_t) {
+		.when = when,
+		.callback = callback,
+		.uctx = uctx
+	};
+
+	head = atomic_load_explicit(&el->inject, memory_order_relaxed);
+	do {
+		inject->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&el->inject, &head, inject,
+							memory_order_release, memory_order_relaxed));
+
+	if (head) return 0;
+
+	/*
+	 *	Trigger the "wakeup" event.  kevent() is safe
+	 *	to call from any thread.
+	 */
+	EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+	if (unlikely(kevent(el->kq, &kev, 1, NULL, 0, NULL) < 0)) {
+		fr_strerror_printf("Failed waking event list - kevent %s", fr_syserror(errno));
+
+		/*
+		 *	Take our entry back off the queue, so that the
+		 *	caller can free uctx.  If the CAS fails, then
+		 *	either the owning thread has already taken the
+		 *	queue, or another producer has pushed on top of
+		 *	us.  In both cases the callback will be run, so
+		 *	the caller must not see an error.
+		 */
+		head = inject;
+		if (!atomic_compare_exchange_strong_explicit(&el->inject, &head, NULL,
+							     memory_order_relaxed, memory_order_relaxed)) return 0;
+
+		talloc_free(inject);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Run a callback in the thread which owns an event list
+ *
+ * May be called from any thread, which is how external libraries with
+ * their own threads should hand results back to a worker.
+ *
+ * @note The event list must outlive any callbacks posted to it.
+ *
+ * @param[in] el	to run the callback in.
+ * @param[in] callback	to run.  It's passed the time the queue was serviced.
+ * @param[in] uctx	for the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_event_list_inject(fr_event_list_t *el, fr_event_timer_cb_t callback, void *uctx)
+{
+	return event_inject(el, fr_time_wrap(0), callback, uctx);
+}
+
+/** Run a callback at a given time, in the thread which owns an event list
+ *
+ * May be called from any thread.  There's no handle for the timer, as
+ * it's only created once the owning thread services the queue.
+ *
+ * @note The event list must outlive any callbacks posted to it.
+ *
+ * @param[in] el	to run the callback in.
+ * @param[in] when	to run the callback.
+ * @param[in] callback	to run.
+ * @param[in] uctx	for the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_event_list_inject_at(fr_event_list_t *el, fr_time_t when, fr_event_timer_cb_t callback, void *uctx)
+{
+	return event_inject(el, when, callback, uctx);
+}
+
+static void _event_inject_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_event_inject_t *inject = talloc_get_type_abort(uctx, fr_event_inject_t);
+
+	inject->callback(el, now, inject->uctx);
+	talloc_free(inject);
+}
+
+/** Run callbacks posted by other threads, in the order they were posted
+ *
+ */
+static void event_inject_drain(fr_event_list_t *el)
+{
+	fr_event_inject_t	*inject, *next, *fifo = NULL;
+
+	inject = atomic_exchange_explicit(&el->inject, NULL, memory_order_acquire);
+	if (!inject) return;
+
+	for (; inject; inject = next) {
+		next = inject->next;
+		inject->next = fifo;
+		fifo = inject;
+	}
+
+	for (inject = fifo; inject; inject = next) {
+		next = inject->next;
+
+		if (fr_time_gt(inject->when, el->now)) {
+			/*
+			 *	No other thread can see it now, so
+			 *	bind it to the event list.
+			 */
+			talloc_steal(el, inject);
+			if (fr_event_timer_at(inject, el, &inject->ev, inject->when,
+					      _event_inject_timer, inject) == 0) continue;
+
+			/*
+			 *	Better late than never.
+			 */
+		}
+
+		inject->callback(el, el->now, inject->uctx);
+		talloc_free(inject);
+	}
+}
+
 /** Add a pre-event callback to the event list.
  *
  *  Events are serviced in insert order.  i.e. insert A, B, we then
@@ -2496,7 +3545,14 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	that occurred since this function was last called
 	 *	or wait for the next timer event.
 	 */
-	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+#ifdef HAVE_LINUX_IO_URING_H
+	if (el->uring) {
+		num_fd_events = event_uring_wait(el, ts_wake);
+	} else
+#endif
+	{
+		num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+	}
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -2555,6 +3611,13 @@ void fr_event_service(fr_event_list_t *el)
 
 	if (unlikely(el->exit)) return;
 
+	/*
+	 *	Callbacks from other threads.  We check even if
+	 *	we weren't woken up, as they may have arrived
+	 *	after the wakeup event was read.
+	 */
+	if (atomic_load_explicit(&el->inject, memory_order_relaxed)) event_inject_drain(el);
+
 	EVENT_DEBUG("%p - %s - Servicing %u FD events", el, __FUNCTION__, el->num_fd_events);
 
 	/*
@@ -2794,13 +3857,29 @@ CC_HINT(flatten) int fr_event_loop(fr_event_list_t *el)
 static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
+	fr_event_inject_t *inject, *next;
 
 	while ((ev = fr_lst_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
 
+	/*
+	 *	Callbacks which were posted but never run.
+	 */
+	for (inject = atomic_exchange(&el->inject, NULL); inject; inject = next) {
+		next = inject->next;
+		talloc_free(inject);
+	}
+
 	fr_event_list_reap_signal(el, fr_time_delta_wrap(0), SIGKILL);
 
 	talloc_free_children(el);
 
+#ifdef HAVE_LINUX_IO_URING_H
+	/*
+	 *	Freed after the fd events, as their destructors
+	 *	release their poll requests.
+	 */
+	TALLOC_FREE(el->uring);
+#endif
 	if (el->kq >= 0) close(el->kq);
 
 	return 0;
@@ -2956,6 +4035,14 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef HAVE_LINUX_IO_URING_H
+	/*
+	 *	If io_uring isn't available (old kernel, seccomp
+	 *	etc.), we quietly carry on with kqueue.
+	 */
+	if (event_backend == FR_EVENT_BACKEND_IO_URING) el->uring = event_uring_alloc(el);
+#endif
+
 #ifdef WITH_EVENT_DEBUG
 	fr_event_timer_in(el, el, &el->report, fr_time_delta_from_sec(EVENT_REPORT_FREQ), fr_event_report, NULL);
 #endif
@@ -2963,6 +4050,51 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	return el;
 }
 
+/** Set the backend used by event lists allocated after this call
+ *
+ * @param[in] backend	to use.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the backend isn't supported by this build.
+ */
+int fr_event_list_backend_set(fr_event_backend_t backend)
+{
+	switch (backend) {
+	case FR_EVENT_BACKEND_KQUEUE:
+		break;
+
+	case FR_EVENT_BACKEND_IO_URING:
+#ifdef HAVE_LINUX_IO_URING_H
+		break;
+#else
+		fr_strerror_const("io_uring support was not enabled at build time");
+		return -1;
+#endif
+
+	default:
+		fr_strerror_printf("Invalid event backend %u", backend);
+		return -1;
+	}
+
+	event_backend = backend;
+
+	return 0;
+}
+
+/** Return the backend an event list is using
+ *
+ * @param[in] el	to check.
+ * @return the backend in use.
+ */
+fr_event_backend_t fr_event_list_backend(fr_event_list_t *el)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (el->uring) return FR_EVENT_BACKEND_IO_URING;
+#endif
+
+	return FR_EVENT_BACKEND_KQUEUE;
+}
+
 /** Override event list time source
  *
  * @param[in] el	to set new time function for.
@@ -30,12 +30,25 @@ extern "C" {
 
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
 #include <stdbool.h>
 #include <sys/event.h>
 
+/** Which kernel interface an event list uses to wait for events
+ */
+typedef enum {
+	FR_EVENT_BACKEND_KQUEUE = 0,			//!< kqueue (or libkqueue) for everything.
+	FR_EVENT_BACKEND_IO_URING			//!< io_uring for socket readiness, kqueue for
+							///< everything else.
+} fr_event_backend_t;
+
+extern fr_table_num_sorted_t const fr_event_backend_table[];
+extern size_t fr_event_backend_table_len;
+
 /** An opaque file descriptor handle
  */
 typedef struct fr_event_fd fr_event_fd_t;
@@ -117,6 +130,30 @@ typedef struct {
  */
 typedef	void (*fr_event_timer_cb_t)(fr_event_list_t *el, fr_time_t now, void *uctx);
 
+/** A coarse timer, stored in the event list's timer wheel
+ *
+ * Insertion and deletion are O(1), and don't allocate memory.  In
+ * exchange, the timer may fire up to #FR_EVENT_WHEEL_RESOLUTION
+ * after the requested time.
+ *
+ * The structure should be embedded in whatever owns the timer, and
+ * zeroed before first use.  It MUST be deleted with
+ * #fr_event_wheel_timer_delete before the memory is freed.
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in a slot of the timer wheel.
+	fr_time_t		when;		//!< When the timer should fire.
+	fr_event_timer_cb_t	callback;	//!< Called when the timer fires.
+	void			*uctx;		//!< Passed to the callback.
+	fr_event_list_t		*el;		//!< Event list the timer is in.  NULL if it isn't armed.
+	uint8_t			level;		//!< Which level of the wheel the timer is in.
+	uint8_t			slot;		//!< Which slot of that level the timer is in.
+} fr_event_wheel_timer_t;
+
+/** How coarse timer wheel timers are
+ */
+#define FR_EVENT_WHEEL_RESOLUTION	fr_time_delta_from_msec(4)
+
 /** Called after each event loop cycle
  *
  * Called before calling kqueue to put the thread in a sleeping state.
@@ -258,6 +295,24 @@ int		fr_event_timer_delete(fr_event_timer_t const **ev);
 
 fr_time_t	fr_event_timer_when(fr_event_timer_t const *ev) CC_HINT(nonnull);
 
+int		fr_event_wheel_timer_at(fr_event_list_t *el, fr_event_wheel_timer_t *t,
+					fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+					CC_HINT(nonnull(1,2,4));
+
+int		fr_event_wheel_timer_in(fr_event_list_t *el, fr_event_wheel_timer_t *t,
+					fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx)
+					CC_HINT(nonnull(1,2,4));
+
+void		fr_event_wheel_timer_delete(fr_event_wheel_timer_t *t) CC_HINT(nonnull);
+
+/** Return whether a timer wheel timer is armed
+ *
+ */
+static inline CC_HINT(nonnull) bool fr_event_wheel_timer_armed(fr_event_wheel_timer_t const *t)
+{
+	return (t->el != NULL);
+}
+
 int		_fr_event_pid_wait(NDEBUG_LOCATION_ARGS
 				   TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_pid_t const **ev_p,
 				   pid_t pid, fr_event_pid_cb_t wait_fn, void *uctx)
@@ -282,6 +337,11 @@ int 		_fr_event_user_insert(NDEBUG_LOCATION_ARGS
 
 int		fr_event_user_trigger(fr_event_list_t *el, fr_event_user_t *ev);
 
+int		fr_event_list_inject(fr_event_list_t *el, fr_event_timer_cb_t callback, void *uctx) CC_HINT(nonnull(1,2));
+
+int		fr_event_list_inject_at(fr_event_list_t *el, fr_time_t when,
+					fr_event_timer_cb_t callback, void *uctx) CC_HINT(nonnull(1,3));
+
 int		fr_event_user_delete(fr_event_list_t *el, fr_event_user_cb_t user, void *uctx) CC_HINT(nonnull(1,2));
 
 int		fr_event_pre_insert(fr_event_list_t *el, fr_event_status_cb_t callback, void *uctx) CC_HINT(nonnull(1,2));
@@ -298,6 +358,8 @@ bool		fr_event_loop_exiting(fr_event_list_t *el);
 int		fr_event_loop(fr_event_list_t *el);
 
 fr_event_list_t	*fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t status, void *status_ctx);
+int		fr_event_list_backend_set(fr_event_backend_t backend);
+fr_event_backend_t fr_event_list_backend(fr_event_list_t *el) CC_HINT(nonnull);
 void		fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t func);
 
 bool		fr_event_list_empty(fr_event_list_t *el);
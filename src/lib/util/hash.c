@@ -34,12 +34,19 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/hash.h>
 
+#include <pthread.h>
+
 /*
  *	A reasonable number of buckets to start off with.
  *	Should be a power of two.
  */
 #define FR_HASH_NUM_BUCKETS (64)
 
+/*
+ *	Default number of shards for a sharded hash table.
+ */
+#define FR_HASH_NUM_SHARDS (16)
+
 struct fr_hash_entry_s {
 	fr_hash_entry_t 	*next;
 	uint32_t		reversed;
@@ -916,6 +923,232 @@ void fr_hash_table_verify(fr_hash_table_t *ht)
 	}
 }
 
+/*
+ *	Sharded hash tables.
+ *
+ *	A set of independent hash tables, each protected by its own
+ *	mutex.  The shard is selected from the top byte of the hash,
+ *	which the split-ordered buckets of each shard only start
+ *	using once the shard holds millions of entries.
+ *
+ *	Lookups must take the shard mutex too.  A find can initialise
+ *	buckets (see fr_hash_table_fixup()), so it's not a pure read.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Serialises access to this shard.
+	fr_hash_table_t		*ht;		//!< Entries belonging to this shard.
+} CC_HINT(aligned(64)) fr_hash_shard_t;
+
+struct fr_hash_table_sharded_s {
+	fr_hash_t		hash;		//!< Hashing function, used to select the shard.
+	uint32_t		mask;		//!< num_shards - 1.
+	fr_hash_shard_t		*shards;	//!< Array of shards.
+};
+
+#define HASH_SHARD(_hts, _key) (&(_hts)->shards[((_key) >> 24) & (_hts)->mask])
+
+static int _fr_hash_table_sharded_free(fr_hash_table_sharded_t *hts)
+{
+	uint32_t i;
+
+	/*
+	 *	Free the shard tables explicitly so that the free
+	 *	callbacks run before the mutexes are destroyed.
+	 */
+	for (i = 0; i <= hts->mask; i++) {
+		TALLOC_FREE(hts->shards[i].ht);
+		pthread_mutex_destroy(&hts->shards[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate a hash table which can be shared between threads
+ *
+ * Writers on different shards don't contend with each other, neither do
+ * readers.  Any data returned by a find must be kept alive by the caller
+ * until it's done with it, as another thread may remove it as soon as the
+ * shard lock is released.
+ *
+ * @param[in] ctx		to allocate the table in.
+ * @param[in] type		Talloc type to check elements against.  May be NULL.
+ * @param[in] hash_func		Hashing function.
+ * @param[in] cmp_func		Comparison function.
+ * @param[in] free_func		Called on delete and replace.  May be NULL.
+ * @param[in] num_shards	Number of shards.  Rounded up to a power of 2,
+ *				and clamped to 256.  0 selects the default.
+ * @return
+ *	- A new sharded hash table.
+ *	- NULL on error.
+ */
+fr_hash_table_sharded_t *_fr_hash_table_sharded_alloc(TALLOC_CTX *ctx,
+						      char const *type,
+						      fr_hash_t hash_func,
+						      fr_cmp_t cmp_func,
+						      fr_free_t free_func,
+						      uint32_t num_shards)
+{
+	fr_hash_table_sharded_t	*hts;
+	uint32_t		i, shards = 1;
+
+	if (num_shards == 0) num_shards = FR_HASH_NUM_SHARDS;
+	if (num_shards > 256) num_shards = 256;
+	while (shards < num_shards) shards <<= 1;
+
+	hts = talloc_zero(ctx, fr_hash_table_sharded_t);
+	if (!hts) return NULL;
+
+	hts->hash = hash_func;
+	hts->mask = shards - 1;
+	hts->shards = talloc_zero_array(hts, fr_hash_shard_t, shards);
+	if (unlikely(!hts->shards)) {
+		talloc_free(hts);
+		return NULL;
+	}
+
+	for (i = 0; i < shards; i++) pthread_mutex_init(&hts->shards[i].mutex, NULL);
+	talloc_set_destructor(hts, _fr_hash_table_sharded_free);
+
+	for (i = 0; i < shards; i++) {
+		hts->shards[i].ht = _fr_hash_table_alloc(hts->shards, type, hash_func, cmp_func, free_func);
+		if (unlikely(!hts->shards[i].ht)) {
+			talloc_free(hts);
+			return NULL;
+		}
+	}
+
+	return hts;
+}
+
+/** Find data in a sharded hash table
+ *
+ * @param[in] hts	to find data in.
+ * @param[in] data 	to find.
+ * @return
+ *      - The user data we found.
+ *	- NULL if we couldn't find any matching data.
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - htrie call with first argument of void * trips --fsanitize=function */
+void *fr_hash_table_sharded_find(fr_hash_table_sharded_t *hts, void const *data)
+{
+	uint32_t	key = hts->hash(data);
+	fr_hash_shard_t	*shard = HASH_SHARD(hts, key);
+	void		*found;
+
+	pthread_mutex_lock(&shard->mutex);
+	found = fr_hash_table_find_by_key(shard->ht, key, data);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return found;
+}
+
+/** Insert data into a sharded hash table
+ *
+ * @param[in] hts	to insert data into.
+ * @param[in] data 	to insert.
+ * @return
+ *	- true if data was inserted.
+ *	- false if data already existed and was not inserted.
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - htrie call with first argument of void * trips --fsanitize=function */
+bool fr_hash_table_sharded_insert(fr_hash_table_sharded_t *hts, void const *data)
+{
+	fr_hash_shard_t	*shard = HASH_SHARD(hts, hts->hash(data));
+	bool		ret;
+
+	pthread_mutex_lock(&shard->mutex);
+	ret = fr_hash_table_insert(shard->ht, data);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/** Replace old data with new data, or insert if there is no old
+ *
+ * @param[out] old	data that was replaced.  If this argument
+ *			is not NULL, then the old data will not
+ *			be freed, even if a free function is
+ *			configured.
+ * @param[in] hts	to insert data into.
+ * @param[in] data 	to replace.
+ * @return
+ *	- 1 if data was replaced.
+ *	- 0 if data was inserted.
+ *	- -1 if we failed to replace data
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - htrie call with first argument of void * trips --fsanitize=function */
+int fr_hash_table_sharded_replace(void **old, fr_hash_table_sharded_t *hts, void const *data)
+{
+	fr_hash_shard_t	*shard = HASH_SHARD(hts, hts->hash(data));
+	int		ret;
+
+	pthread_mutex_lock(&shard->mutex);
+	ret = fr_hash_table_replace(old, shard->ht, data);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/** Remove an entry from a sharded hash table without freeing the data
+ *
+ * @param[in] hts	to remove data from.
+ * @param[in] data 	to remove.
+ * @return
+ *	- The user data we removed.
+ *	- NULL if we couldn't find any matching data.
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - htrie call with first argument of void * trips --fsanitize=function */
+void *fr_hash_table_sharded_remove(fr_hash_table_sharded_t *hts, void const *data)
+{
+	fr_hash_shard_t	*shard = HASH_SHARD(hts, hts->hash(data));
+	void		*removed;
+
+	pthread_mutex_lock(&shard->mutex);
+	removed = fr_hash_table_remove(shard->ht, data);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return removed;
+}
+
+/** Remove and free data (if a free function was specified)
+ *
+ * @param[in] hts	to remove data from.
+ * @param[in] data 	to remove/free.
+ * @return
+ *	- true if we removed data.
+ *      - false if we couldn't find any matching data.
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - htrie call with first argument of void * trips --fsanitize=function */
+bool fr_hash_table_sharded_delete(fr_hash_table_sharded_t *hts, void const *data)
+{
+	fr_hash_shard_t	*shard = HASH_SHARD(hts, hts->hash(data));
+	bool		ret;
+
+	pthread_mutex_lock(&shard->mutex);
+	ret = fr_hash_table_delete(shard->ht, data);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/** Count the number of elements across all shards
+ *
+ * @note The count is only a snapshot if other threads are modifying the table.
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - htrie call with first argument of void * trips --fsanitize=function */
+uint32_t fr_hash_table_sharded_num_elements(fr_hash_table_sharded_t *hts)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i <= hts->mask; i++) {
+		pthread_mutex_lock(&hts->shards[i].mutex);
+		count += fr_hash_table_num_elements(hts->shards[i].ht);
+		pthread_mutex_unlock(&hts->shards[i].mutex);
+	}
+
+	return count;
+}
+
 #ifdef TESTING
 /*
  *  cc -g -DTESTING -I ../include hash.c -o hash
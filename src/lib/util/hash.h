@@ -91,6 +91,33 @@ void		fr_hash_table_fill(fr_hash_table_t *ht) CC_HINT(nonnull);
 
 void		fr_hash_table_verify(fr_hash_table_t *ht);
 
+typedef struct fr_hash_table_sharded_s fr_hash_table_sharded_t;
+
+#define		fr_hash_table_sharded_alloc(_ctx, _hash_node, _cmp_node, _free_node, _num_shards) \
+		_fr_hash_table_sharded_alloc(_ctx, NULL, _hash_node, _cmp_node, _free_node, _num_shards)
+
+#define		fr_hash_table_sharded_talloc_alloc(_ctx, _type, _hash_node, _cmp_node, _free_node, _num_shards) \
+		_fr_hash_table_sharded_alloc(_ctx, #_type, _hash_node, _cmp_node, _free_node, _num_shards)
+
+fr_hash_table_sharded_t *_fr_hash_table_sharded_alloc(TALLOC_CTX *ctx,
+						      char const *type,
+						      fr_hash_t hash_node,
+						      fr_cmp_t cmp_node,
+						      fr_free_t free_node,
+						      uint32_t num_shards) CC_HINT(nonnull(3,4));
+
+void		*fr_hash_table_sharded_find(fr_hash_table_sharded_t *hts, void const *data) CC_HINT(nonnull);
+
+bool		fr_hash_table_sharded_insert(fr_hash_table_sharded_t *hts, void const *data) CC_HINT(nonnull);
+
+int		fr_hash_table_sharded_replace(void **old, fr_hash_table_sharded_t *hts, void const *data) CC_HINT(nonnull(2,3));
+
+void		*fr_hash_table_sharded_remove(fr_hash_table_sharded_t *hts, void const *data) CC_HINT(nonnull);
+
+bool		fr_hash_table_sharded_delete(fr_hash_table_sharded_t *hts, void const *data) CC_HINT(nonnull);
+
+uint32_t	fr_hash_table_sharded_num_elements(fr_hash_table_sharded_t *hts) CC_HINT(nonnull);
+
 #ifdef __cplusplus
 }
 #endif
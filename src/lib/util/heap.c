@@ -41,6 +41,7 @@ RCSID("$Id$")
 #define	HEAP_SWAP(_a, _b) do { void *_tmp = _a; _a = _b; _b = _tmp; } while (0)
 
 static void fr_heap_bubble(fr_heap_t *h, fr_heap_index_t child);
+static void fr_heap_sift(fr_heap_t *h, fr_heap_index_t parent);
 
 /** Return how many bytes need to be allocated to hold a heap of a given size
  *
@@ -226,6 +227,143 @@ static inline CC_HINT(always_inline) void fr_heap_bubble(fr_heap_t *h, fr_heap_i
 	OFFSET_SET(h, child);
 }
 
+/** Push an element down the heap until it's no larger than its children
+ *
+ */
+static inline CC_HINT(always_inline) void fr_heap_sift(fr_heap_t *h, fr_heap_index_t parent)
+{
+	fr_heap_index_t	child, max = h->num_elements;
+	void		*data = h->p[parent];
+
+	while ((child = HEAP_LEFT(parent)) <= max) {
+		/*
+		 *	Maybe take the right child.
+		 */
+		if ((child != max) &&
+		    (h->cmp(h->p[child + 1], h->p[child]) < 0)) {
+			child = child + 1;
+		}
+
+		if (h->cmp(data, h->p[child]) <= 0) break;
+
+		h->p[parent] = h->p[child];
+		OFFSET_SET(h, parent);
+		parent = child;
+	}
+	h->p[parent] = data;
+	OFFSET_SET(h, parent);
+}
+
+/** Insert multiple elements into the heap
+ *
+ * The heap is grown at most once.  If the batch is larger than the
+ * existing heap, the whole heap is rebuilt bottom up, which is O(n),
+ * instead of bubbling up each new element in turn.
+ *
+ * Either all the elements are inserted, or none of them are.
+ *
+ * @param[in,out] hp	The heap to insert elements into.
+ *			A new pointer value will be written to hp
+ *			if the heap is resized.
+ * @param[in] data	Array of elements to insert.
+ * @param[in] num	Number of elements in the array.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (heap full, malloc error, or an element was already inserted).
+ */
+int fr_heap_insert_bulk(fr_heap_t **hp, void *data[], unsigned int num)
+{
+	fr_heap_t	*h = *hp;
+	fr_heap_index_t	first, i;
+	unsigned int	old_num;
+
+	if (unlikely(h == NULL)) {
+		fr_strerror_const("Heap pointer was NULL");
+		return -1;
+	}
+
+	if (num == 0) return 0;
+
+	if (unlikely(num > (UINT_MAX - h->num_elements))) {
+		fr_strerror_const("Heap is full");
+		return -1;
+	}
+
+	/*
+	 *	Grow the heap once, to fit everything.
+	 */
+	if ((h->num_elements + num) > h->size) {
+		unsigned int	n_size = h->size;
+
+		while (n_size < (h->num_elements + num)) n_size = (n_size > (UINT_MAX / 2)) ? UINT_MAX : n_size * 2;
+
+		if (realloc_heap(&h, n_size) < 0) return -1;
+
+		*hp = h;
+	}
+
+	/*
+	 *	Append the new elements.  Setting their
+	 *	indexes as we go catches elements which
+	 *	appear in the batch more than once.
+	 */
+	old_num = h->num_elements;
+	first = old_num + 1;
+	for (i = 0; i < num; i++) {
+		if (fr_heap_entry_inserted(index_get(h, data[i]))) {
+			while (i > 0) index_set(h, data[--i], 0);
+			fr_strerror_const("Node is already in the heap");
+			return -1;
+		}
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+		if (h->type) (void)_talloc_get_type_abort(data[i], h->type, __location__);
+#endif
+
+		h->p[first + i] = data[i];
+		OFFSET_SET(h, first + i);
+	}
+	h->num_elements += num;
+
+	if (num > old_num) {
+		for (i = HEAP_PARENT(h->num_elements); i > 0; i--) fr_heap_sift(h, i);
+	} else {
+		for (i = first; i <= h->num_elements; i++) fr_heap_bubble(h, i);
+	}
+
+	return 0;
+}
+
+/** Restore the heap property after the key of an element has changed
+ *
+ * Cheaper than extracting and re-inserting the element, as it only
+ * moves the element up or down as far as it needs to go.
+ *
+ * @param[in] h		The heap containing the element.
+ * @param[in] data	whose key has changed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (data not in the heap).
+ */
+int fr_heap_update(fr_heap_t *h, void *data)
+{
+	fr_heap_index_t	idx;
+
+	idx = index_get(h, data);
+	if (unlikely((idx == 0) || (idx > h->num_elements) || (h->p[idx] != data))) {
+		fr_strerror_printf("Invalid heap index %u for data %p", idx, data);
+		return -1;
+	}
+
+	if ((idx > 1) && (h->cmp(data, h->p[HEAP_PARENT(idx)]) < 0)) {
+		fr_heap_bubble(h, idx);
+	} else {
+		fr_heap_sift(h, idx);
+	}
+
+	return 0;
+}
+
 /** Remove a node from the heap
  *
  * @param[in,out] hp	The heap to extract an element from.
@@ -337,6 +475,48 @@ void *fr_heap_pop(fr_heap_t **hp)
 	return data;
 }
 
+/** Remove up to num of the smallest elements from the heap
+ *
+ * Elements are written to out in order, smallest first.  The heap is
+ * shrunk at most once, after all the elements have been removed.
+ *
+ * @param[in,out] hp	The heap to pop elements from.
+ *			A new pointer value will be written to hp
+ *			if the heap is resized.
+ * @param[out] out	Where to write the popped elements.
+ * @param[in] num	Maximum number of elements to pop.
+ * @return The number of elements popped.
+ */
+unsigned int fr_heap_pop_n(fr_heap_t **hp, void *out[], unsigned int num)
+{
+	fr_heap_t	*h = *hp;
+	unsigned int	i, n_size;
+
+	if (unlikely(h == NULL)) {
+		fr_strerror_const("Heap pointer was NULL");
+		return 0;
+	}
+
+	for (i = 0; (i < num) && (h->num_elements > 0); i++) {
+		out[i] = h->p[1];
+		OFFSET_RESET(h, 1);
+
+		h->p[1] = h->p[h->num_elements];
+		h->num_elements--;
+		if (h->num_elements > 0) fr_heap_sift(h, 1);
+	}
+
+	/*
+	 *	Shrink once, by as much as we need to.
+	 */
+	n_size = h->size;
+	while (((h->num_elements * 2) < n_size) && (ROUND_UP_DIV(n_size, 2) > h->min)) n_size = ROUND_UP_DIV(n_size, 2);
+
+	if ((n_size != h->size) && (realloc_heap(&h, n_size) == 0)) *hp = h;
+
+	return i;
+}
+
 /** Iterate over entries in heap
  *
  * @note If the heap is modified the iterator should be considered invalidated.
@@ -185,6 +185,10 @@ int		fr_heap_insert(fr_heap_t **hp, void *data) CC_HINT(nonnull);
 int		fr_heap_extract(fr_heap_t **hp, void *data) CC_HINT(nonnull);
 void		*fr_heap_pop(fr_heap_t **hp) CC_HINT(nonnull);
 
+int		fr_heap_insert_bulk(fr_heap_t **hp, void *data[], unsigned int num) CC_HINT(nonnull);
+unsigned int	fr_heap_pop_n(fr_heap_t **hp, void *out[], unsigned int num) CC_HINT(nonnull);
+int		fr_heap_update(fr_heap_t *h, void *data) CC_HINT(nonnull);
+
 void		*fr_heap_iter_init(fr_heap_t *hp, fr_heap_iter_t *iter) CC_HINT(nonnull);
 void		*fr_heap_iter_next(fr_heap_t *hp, fr_heap_iter_t *iter) CC_HINT(nonnull);
 
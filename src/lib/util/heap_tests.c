@@ -302,6 +302,81 @@ static void heap_cycle(void)
 	free(array);
 }
 
+#define HEAP_BULK_BATCH	(64)
+
+static void heap_bulk(void)
+{
+	fr_heap_t	*hp;
+	int		i, j;
+	heap_thing	*array;
+	heap_thing	*batch[HEAP_BULK_BATCH];
+	int		data = 0;
+	unsigned int	count = 0, popped;
+	fr_time_t	start_single, start_bulk, end;
+	fr_fast_rand_t	rand_ctx;
+
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	hp = fr_heap_alloc(NULL, heap_cmp, heap_thing, heap, 0);
+	TEST_CHECK(hp != NULL);
+
+	array = calloc(HEAP_TEST_SIZE, sizeof(heap_thing));
+	for (i = 0; i < HEAP_TEST_SIZE; i++) array[i].data = fr_fast_rand(&rand_ctx) % 65537;
+
+	TEST_CASE("bulk insertions");
+	for (i = 0; i < HEAP_TEST_SIZE; i += HEAP_BULK_BATCH) {
+		for (j = 0; j < HEAP_BULK_BATCH; j++) batch[j] = &array[i + j];
+
+		TEST_CHECK(fr_heap_insert_bulk(&hp, (void **)batch, HEAP_BULK_BATCH) == 0);
+		TEST_MSG("bulk insert failed - %s", fr_strerror());
+	}
+	TEST_CHECK(fr_heap_num_elements(hp) == HEAP_TEST_SIZE);
+
+	TEST_CASE("duplicates are rejected, and leave the heap untouched");
+	TEST_CHECK(fr_heap_insert_bulk(&hp, (void **)batch, 1) < 0);
+	TEST_CHECK(fr_heap_num_elements(hp) == HEAP_TEST_SIZE);
+
+	TEST_CASE("update");
+	for (i = 0; i < HEAP_TEST_SIZE; i += 7) {
+		array[i].data = fr_fast_rand(&rand_ctx) % 65537;
+		TEST_CHECK(fr_heap_update(hp, &array[i]) == 0);
+	}
+
+	TEST_CASE("ordering");
+	while ((popped = fr_heap_pop_n(&hp, (void **)batch, HEAP_BULK_BATCH)) > 0) {
+		for (j = 0; j < (int)popped; j++) {
+			TEST_CHECK(batch[j]->data >= data);
+			TEST_MSG("Expected data >= %i, got %i", data, batch[j]->data);
+			TEST_CHECK(!fr_heap_entry_inserted(batch[j]->heap));
+			if (batch[j]->data >= data) data = batch[j]->data;
+			count++;
+		}
+	}
+	TEST_CHECK(count == HEAP_TEST_SIZE);
+
+	/*
+	 *	Compare bursts of single inserts against bulk inserts
+	 */
+	start_single = fr_time();
+	for (i = 0; i < HEAP_TEST_SIZE; i++) fr_heap_insert(&hp, &array[i]);
+	while (fr_heap_pop(&hp));
+
+	start_bulk = fr_time();
+	for (i = 0; i < HEAP_TEST_SIZE; i += HEAP_BULK_BATCH) {
+		for (j = 0; j < HEAP_BULK_BATCH; j++) batch[j] = &array[i + j];
+		fr_heap_insert_bulk(&hp, (void **)batch, HEAP_BULK_BATCH);
+	}
+	while (fr_heap_pop_n(&hp, (void **)batch, HEAP_BULK_BATCH));
+	end = fr_time();
+
+	TEST_MSG_ALWAYS("\nsingle: %.2fus\n", fr_time_delta_unwrap(fr_time_sub(start_bulk, start_single)) / 1000.0);
+	TEST_MSG_ALWAYS("bulk: %.2fus\n", fr_time_delta_unwrap(fr_time_sub(end, start_bulk)) / 1000.0);
+
+	talloc_free(hp);
+	free(array);
+}
+
 TEST_LIST = {
 	/*
 	 *	Basic tests
@@ -312,6 +387,7 @@ TEST_LIST = {
 	{ "heap_test_order",		heap_test_order		},
 	{ "heap_iter",			heap_iter		},
 	{ "heap_cycle",			heap_cycle		},
+	{ "heap_bulk",			heap_bulk		},
 	{ NULL }
 };
 
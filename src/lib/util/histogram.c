@@ -0,0 +1,131 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear histograms
+ *
+ * Small values get one bucket each.  Larger values share buckets,
+ * with a fixed number of buckets per power of two.  This keeps the
+ * relative error bounded, in the same way as HDR histograms, while
+ * using a fixed amount of memory.
+ *
+ * Adding a value is a few instructions, so histograms can be updated
+ * on every request.  Percentiles are only calculated when someone asks
+ * for them.
+ *
+ * @file src/lib/util/histogram.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/histogram.h>
+
+/** Return the largest value which is stored in a bucket
+ *
+ */
+static uint64_t histogram_bucket_max(unsigned int i)
+{
+	unsigned int shift;
+
+	if (i < (2 * FR_HISTOGRAM_SUB_COUNT)) return i;
+
+	shift = (i / FR_HISTOGRAM_SUB_COUNT) - 1;
+
+	return ((uint64_t) ((i - (shift * FR_HISTOGRAM_SUB_COUNT)) + 1) << shift) - 1;
+}
+
+/** Allocate an empty histogram
+ *
+ * @param[in] ctx	to allocate the histogram in.
+ * @return
+ *	- A new histogram on success.
+ *	- NULL on failure.
+ */
+fr_histogram_t *fr_histogram_alloc(TALLOC_CTX *ctx)
+{
+	return talloc_zero(ctx, fr_histogram_t);
+}
+
+/** Add all of the values in one histogram to another
+ *
+ * @param[in] dst	to add the values to.
+ * @param[in] src	to read the values from.
+ */
+void fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src)
+{
+	unsigned int i;
+	uint64_t count = src->count;
+
+	if (!count) return;
+
+	if (!dst->count || (src->min < dst->min)) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+
+	dst->count += count;
+	dst->sum += src->sum;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) dst->bucket[i] += src->bucket[i];
+}
+
+/** Return the value below which a percentage of the values fall
+ *
+ * The answer is the largest value in the matching bucket, so it may
+ * be up to one bucket width larger than the real value.
+ *
+ * @param[in] h			to look at.
+ * @param[in] percentile	0..100.
+ * @return
+ *	- The value at the given percentile.
+ *	- 0 if the histogram is empty.
+ */
+uint64_t fr_histogram_percentile(fr_histogram_t const *h, double percentile)
+{
+	unsigned int	i;
+	uint64_t	rank, seen = 0, value;
+
+	if (!h->count) return 0;
+
+	if (percentile >= 100) return h->max;
+
+	rank = (uint64_t) ((percentile * h->count) / 100);
+	if (rank < 1) rank = 1;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen < rank) continue;
+
+		value = histogram_bucket_max(i);
+		if (value > h->max) return h->max;
+		if (value < h->min) return h->min;
+
+		return value;
+	}
+
+	/*
+	 *	The histogram was being updated while we read it.
+	 */
+	return h->max;
+}
+
+/** Return the mean of the values in a histogram
+ *
+ */
+uint64_t fr_histogram_mean(fr_histogram_t const *h)
+{
+	if (!h->count) return 0;
+
+	return h->sum / h->count;
+}
@@ -0,0 +1,105 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for log-linear histograms
+ *
+ * @file src/lib/util/histogram.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(histogram_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdint.h>
+
+/*
+ *	Each power of two is split into 2^FR_HISTOGRAM_SUB_BITS
+ *	buckets, so a bucket is at most 1/8th (12.5%) wider than the
+ *	smallest value it holds.  Values are clamped to
+ *	2^FR_HISTOGRAM_MAX_BITS - 1, which is about 18 minutes when
+ *	counting nanoseconds.
+ */
+#define FR_HISTOGRAM_SUB_BITS	(3)
+#define FR_HISTOGRAM_SUB_COUNT	(1 << FR_HISTOGRAM_SUB_BITS)
+#define FR_HISTOGRAM_MAX_BITS	(40)
+#define FR_HISTOGRAM_BUCKETS	((FR_HISTOGRAM_MAX_BITS - FR_HISTOGRAM_SUB_BITS + 1) * FR_HISTOGRAM_SUB_COUNT)
+
+/** A histogram of unsigned values
+ *
+ * There is no locking.  Only one thread should add values, but other
+ * threads may read or merge the histogram, and will get an approximate
+ * answer.
+ */
+typedef struct {
+	uint64_t		count;		//!< Number of values added.
+	uint64_t		sum;		//!< Sum of all values added.
+	uint64_t		min;		//!< Smallest value added.
+	uint64_t		max;		//!< Largest value added.
+	uint64_t		bucket[FR_HISTOGRAM_BUCKETS];
+} fr_histogram_t;
+
+/** Return the bucket which holds a value
+ *
+ */
+static inline unsigned int fr_histogram_index(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < (2 * FR_HISTOGRAM_SUB_COUNT)) return value;
+
+	if (value >= ((uint64_t) 1 << FR_HISTOGRAM_MAX_BITS)) value = ((uint64_t) 1 << FR_HISTOGRAM_MAX_BITS) - 1;
+
+	/*
+	 *	Keep the top FR_HISTOGRAM_SUB_BITS + 1 bits of the value.
+	 */
+	shift = fr_high_bit_pos(value) - 1 - FR_HISTOGRAM_SUB_BITS;
+
+	return (shift * FR_HISTOGRAM_SUB_COUNT) + (value >> shift);
+}
+
+/** Add a value to a histogram
+ *
+ * @param[in] h		to add the value to.
+ * @param[in] value	to add.
+ */
+static inline void fr_histogram_add(fr_histogram_t *h, uint64_t value)
+{
+	if (!h->count || (value < h->min)) h->min = value;
+	if (value > h->max) h->max = value;
+
+	h->count++;
+	h->sum += value;
+	h->bucket[fr_histogram_index(value)]++;
+}
+
+fr_histogram_t	*fr_histogram_alloc(TALLOC_CTX *ctx);
+
+void		fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_percentile(fr_histogram_t const *h, double percentile) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_mean(fr_histogram_t const *h) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,110 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for log-linear histograms
+ *
+ * @file src/lib/util/histogram_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/histogram.h>
+
+/*
+ *	Every value must land in a bucket, buckets must not go
+ *	backwards, and the error must stay within one sub-bucket.
+ */
+static void test_fr_histogram_index(void)
+{
+	uint64_t	value;
+	unsigned int	i, prev = 0;
+
+	for (value = 0; value < (1 << 20); value++) {
+		i = fr_histogram_index(value);
+
+		TEST_MSG("Checking %" PRIu64, value);
+		TEST_CHECK(i < FR_HISTOGRAM_BUCKETS);
+		TEST_CHECK(i >= prev);
+		TEST_CHECK((i - prev) <= 1);
+		prev = i;
+	}
+
+	TEST_CHECK(fr_histogram_index(((uint64_t) 1 << FR_HISTOGRAM_MAX_BITS) - 1) == (FR_HISTOGRAM_BUCKETS - 1));
+	TEST_CHECK(fr_histogram_index(UINT64_MAX) == (FR_HISTOGRAM_BUCKETS - 1));
+}
+
+static void test_fr_histogram_percentile(void)
+{
+	fr_histogram_t	*h;
+	uint64_t	i, p50, p99;
+
+	h = fr_histogram_alloc(NULL);
+	TEST_CHECK(h != NULL);
+
+	TEST_CHECK(fr_histogram_percentile(h, 50) == 0);
+
+	for (i = 1; i <= 100000; i++) fr_histogram_add(h, i);
+
+	TEST_CHECK(h->count == 100000);
+	TEST_CHECK(h->min == 1);
+	TEST_CHECK(h->max == 100000);
+	TEST_CHECK(fr_histogram_mean(h) == 50000);
+
+	p50 = fr_histogram_percentile(h, 50);
+	TEST_MSG("p50 %" PRIu64, p50);
+	TEST_CHECK((p50 >= 50000) && (p50 <= 50000 + (50000 / FR_HISTOGRAM_SUB_COUNT)));
+
+	p99 = fr_histogram_percentile(h, 99);
+	TEST_MSG("p99 %" PRIu64, p99);
+	TEST_CHECK((p99 >= 99000) && (p99 <= 100000));
+
+	TEST_CHECK(fr_histogram_percentile(h, 0) == 1);
+	TEST_CHECK(fr_histogram_percentile(h, 100) == 100000);
+
+	talloc_free(h);
+}
+
+static void test_fr_histogram_merge(void)
+{
+	fr_histogram_t	*a, *b;
+	uint64_t	i;
+
+	a = fr_histogram_alloc(NULL);
+	b = fr_histogram_alloc(NULL);
+
+	for (i = 0; i < 1000; i++) fr_histogram_add(a, 10);
+	for (i = 0; i < 1000; i++) fr_histogram_add(b, 1000000);
+
+	fr_histogram_merge(a, b);
+
+	TEST_CHECK(a->count == 2000);
+	TEST_CHECK(a->min == 10);
+	TEST_CHECK(a->max == 1000000);
+	TEST_CHECK(fr_histogram_percentile(a, 25) == 10);
+	TEST_CHECK(fr_histogram_percentile(a, 75) == 1000000);
+
+	talloc_free(a);
+	talloc_free(b);
+}
+
+TEST_LIST = {
+	{ "fr_histogram_index",		test_fr_histogram_index },
+	{ "fr_histogram_percentile",	test_fr_histogram_percentile },
+	{ "fr_histogram_merge",		test_fr_histogram_merge },
+
+	{ NULL }
+};
@@ -205,12 +205,63 @@ static void test_hmac_sha1(void)
 			      sizeof(digest)), 0);
 }
 
+/*
+ *	The batch functions must give the same results as
+ *	the single message functions, for every length,
+ *	and however the messages are split into segments.
+ */
+static void test_md5_batch(void)
+{
+	uint8_t		data[200];
+	uint8_t		out[NUM_ELEMENTS(data)][MD5_DIGEST_LENGTH], expected[MD5_DIGEST_LENGTH];
+	struct iovec	iov[NUM_ELEMENTS(data)][2];
+	fr_md5_batch_t	batch[NUM_ELEMENTS(data)];
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(data); i++) data[i] = (uint8_t)(i * 7);
+
+	/*
+	 *	Message i is the first i bytes of data, split
+	 *	in two at i / 3.
+	 */
+	for (i = 0; i < NUM_ELEMENTS(data); i++) {
+		iov[i][0] = (struct iovec){ .iov_base = data, .iov_len = i / 3 };
+		iov[i][1] = (struct iovec){ .iov_base = data + (i / 3), .iov_len = i - (i / 3) };
+		batch[i] = (fr_md5_batch_t){ .iov = iov[i], .iovcnt = 2, .out = out[i] };
+	}
+
+	TEST_CASE("MD5");
+	fr_md5_calc_batch(batch, NUM_ELEMENTS(batch));
+	for (i = 0; i < NUM_ELEMENTS(data); i++) {
+		fr_md5_calc(expected, data, i);
+		TEST_CHECK(memcmp(out[i], expected, sizeof(expected)) == 0);
+		TEST_MSG("Digest mismatch for length %zu", i);
+	}
+
+	TEST_CASE("HMAC-MD5 with a short key");
+	fr_hmac_md5_batch(batch, NUM_ELEMENTS(batch), (uint8_t const *)"Jefe", 4);
+	for (i = 0; i < NUM_ELEMENTS(data); i++) {
+		fr_hmac_md5(expected, data, i, (uint8_t const *)"Jefe", 4);
+		TEST_CHECK(memcmp(out[i], expected, sizeof(expected)) == 0);
+		TEST_MSG("HMAC mismatch for length %zu", i);
+	}
+
+	TEST_CASE("HMAC-MD5 with a key longer than the block size");
+	fr_hmac_md5_batch(batch, NUM_ELEMENTS(batch), data, 100);
+	for (i = 0; i < NUM_ELEMENTS(data); i++) {
+		fr_hmac_md5(expected, data, i, data, 100);
+		TEST_CHECK(memcmp(out[i], expected, sizeof(expected)) == 0);
+		TEST_MSG("HMAC mismatch for length %zu", i);
+	}
+}
+
 TEST_LIST = {
 	/*
 	 *	Allocation and management
 	 */
 	{ "hmac-md5",			test_hmac_md5	},
 	{ "hmac-sha1",			test_hmac_sha1	},
+	{ "md5-batch",			test_md5_batch	},
 
 	{ NULL }
 };
@@ -31,6 +31,7 @@ RCSID("$Id$")
 fr_table_num_sorted_t const fr_htrie_type_table[] = {
 	{ L("auto"),		FR_HTRIE_AUTO },
 	{ L("hash"),		FR_HTRIE_HASH },
+	{ L("hash_sharded"),	FR_HTRIE_HASH_SHARDED },
 	{ L("rb"),		FR_HTRIE_RB },
 	{ L("trie"),		FR_HTRIE_TRIE },
 };
@@ -46,6 +47,15 @@ static fr_htrie_funcs_t const default_funcs[] = {
 		FUNC(hash_table, delete),
 		FUNC(hash_table, num_elements)
 	},
+	[FR_HTRIE_HASH_SHARDED] = {
+		.match = (fr_htrie_find_t) fr_hash_table_sharded_find,
+		FUNC(hash_table_sharded, find),
+		FUNC(hash_table_sharded, insert),
+		FUNC(hash_table_sharded, replace),
+		FUNC(hash_table_sharded, remove),
+		FUNC(hash_table_sharded, delete),
+		FUNC(hash_table_sharded, num_elements)
+	},
 	[FR_HTRIE_RB] = {
 		.match = (fr_htrie_find_t) fr_rb_find,
 		FUNC(rb, find),
@@ -75,9 +85,10 @@ static fr_htrie_funcs_t const default_funcs[] = {
  * @param[in] ctx		to bind the htrie's lifetime to.
  * @param[in] type		One of:
  *				- FR_HTRIE_HASH
+ *				- FR_HTRIE_HASH_SHARDED
  *				- FR_HTRIE_RB
  *				- FR_HTRIE_TRIE
- * @param[in] hash_data		Used by FR_HTRIE_HASH to convert the
+ * @param[in] hash_data		Used by FR_HTRIE_HASH and FR_HTRIE_HASH_SHARDED to convert the
  *				data into a 32bit integer used for binning.
  * @param[in] cmp_data		Used to determine exact matched.
  * @param[in] get_key		Used by the prefix trie to extract a key
@@ -121,6 +132,17 @@ fr_htrie_t *fr_htrie_alloc(TALLOC_CTX *ctx,
 		ht->funcs = default_funcs[type];
 		return ht;
 
+	case FR_HTRIE_HASH_SHARDED:
+		if (!hash_data || !cmp_data) {
+			fr_strerror_const("hash_data and cmp_data must not be NULL for FR_HTRIE_HASH_SHARDED");
+			return NULL;
+		}
+
+		ht->store = fr_hash_table_sharded_alloc(ht, hash_data, cmp_data, free_data, 0);
+		if (unlikely(!ht->store)) goto error;
+		ht->funcs = default_funcs[type];
+		return ht;
+
 	case FR_HTRIE_RB:
 		if (!cmp_data) {
 			fr_strerror_const("cmp_data must not be NULL for FR_HTRIE_RB");
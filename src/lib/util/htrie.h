@@ -49,6 +49,8 @@ typedef uint32_t (*fr_htrie_num_elements_t)(void *ht);
 typedef enum {
 	FR_HTRIE_INVALID = 0,
 	FR_HTRIE_HASH,		//!< Data is stored in a hash.
+	FR_HTRIE_HASH_SHARDED,	//!< Data is stored in a sharded hash, which is
+				///< safe to share between threads.
 	FR_HTRIE_RB,		//!< Data is stored in a rb tree.
 	FR_HTRIE_TRIE,		//!< Data is stored in a prefix trie.
 	FR_HTRIE_AUTO,		//!< Automatically choose the best type.
@@ -22,12 +22,14 @@
  */
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/value.h>
 
 #include <stdlib.h>
 #include <ifaddrs.h>
+#include <pthread.h>
 #include <net/if_arp.h>
 
 /*
@@ -232,6 +234,113 @@ void fr_ipaddr_mask(fr_ipaddr_t *addr, uint8_t prefix)
 	addr->prefix = prefix;
 }
 
+/** The result of resolving a hostname ahead of time
+ *
+ * We keep the first address of each family, so that lookups with any
+ * combination of "af" and "fallback" give the same answer as calling
+ * getaddrinfo() again.
+ */
+typedef struct {
+	fr_rb_node_t	node;		//!< Entry in the cache.
+	char const	*hostname;	//!< Which was resolved.
+	int		ret;		//!< Return code from getaddrinfo().
+	fr_ipaddr_t	first;		//!< First address returned, of any family.
+	fr_ipaddr_t	ipv4;		//!< First IPv4 address returned.
+	fr_ipaddr_t	ipv6;		//!< First IPv6 address returned.
+	fr_time_t	expires;	//!< When we stop using this entry.
+} fr_inet_hton_cache_t;
+
+static pthread_mutex_t	inet_hton_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_rb_tree_t	*inet_hton_cache;
+
+static int8_t inet_hton_cache_cmp(void const *one, void const *two)
+{
+	fr_inet_hton_cache_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->hostname, b->hostname);
+	return CMP(ret, 0);
+}
+
+static int inet_hton_error(int af, char const *hostname, int ret)
+{
+	switch (af) {
+	default:
+	case AF_UNSPEC:
+		fr_strerror_printf("Failed resolving \"%s\" to IP address: %s",
+				   hostname, gai_strerror(ret));
+		return -1;
+
+	case AF_INET:
+		fr_strerror_printf("Failed resolving \"%s\" to IPv4 address: %s",
+				   hostname, gai_strerror(ret));
+		return -1;
+
+	case AF_INET6:
+		fr_strerror_printf("Failed resolving \"%s\" to IPv6 address: %s",
+				   hostname, gai_strerror(ret));
+		return -1;
+	}
+}
+
+/** Look up a hostname which was resolved by fr_inet_hton_prefetch()
+ *
+ * @return
+ *	- 1 if the hostname was found, and out was written.
+ *	- 0 if the hostname isn't in the cache, or the entry has expired.
+ *	- -1 if the cached lookup failed.
+ */
+static int inet_hton_cached(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
+{
+	fr_inet_hton_cache_t	*c;
+	fr_ipaddr_t const	*ip = NULL;
+	int			ret = 1;
+
+	pthread_mutex_lock(&inet_hton_cache_mutex);
+	if (!inet_hton_cache) {
+	not_found:
+		pthread_mutex_unlock(&inet_hton_cache_mutex);
+		return 0;
+	}
+
+	c = fr_rb_find(inet_hton_cache, &(fr_inet_hton_cache_t){ .hostname = hostname });
+	if (!c || fr_time_lteq(c->expires, fr_time())) goto not_found;
+
+	if (c->ret != 0) {
+		ret = inet_hton_error(af, hostname, c->ret);
+		goto done;
+	}
+
+	switch (af) {
+	case AF_INET:
+		if (c->ipv4.af) ip = &c->ipv4;
+		else if (fallback && c->ipv6.af) ip = &c->ipv6;
+		break;
+
+	case AF_INET6:
+		if (c->ipv6.af) ip = &c->ipv6;
+		else if (fallback && c->ipv4.af) ip = &c->ipv4;
+		break;
+
+	default:
+		if (c->first.af) ip = &c->first;
+		break;
+	}
+
+	if (!ip) {
+		fr_strerror_printf("Failed resolving \"%s\": No records matching requested address family returned",
+				   hostname);
+		ret = -1;
+		goto done;
+	}
+
+	*out = *ip;
+
+done:
+	pthread_mutex_unlock(&inet_hton_cache_mutex);
+	return ret;
+}
+
 /** Wrappers for IPv4/IPv6 host to IP address lookup
  *
  * This function returns only one IP address, of the specified address family,
@@ -290,6 +399,12 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 		return 0;
 	}
 
+	/*
+	 *	Use the result of fr_inet_hton_prefetch(), if we have one.
+	 */
+	ret = inet_hton_cached(out, af, hostname, fallback);
+	if (ret != 0) return (ret < 0) ? -1 : 0;
+
 	memset(&hints, 0, sizeof(hints));
 
 	/*
@@ -301,25 +416,7 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 		hints.ai_family = af;
 	}
 
-	if ((ret = getaddrinfo(hostname, NULL, &hints, &res)) != 0) {
-		switch (af) {
-		default:
-		case AF_UNSPEC:
-			fr_strerror_printf("Failed resolving \"%s\" to IP address: %s",
-					   hostname, gai_strerror(ret));
-			return -1;
-
-		case AF_INET:
-			fr_strerror_printf("Failed resolving \"%s\" to IPv4 address: %s",
-					   hostname, gai_strerror(ret));
-			return -1;
-
-		case AF_INET6:
-			fr_strerror_printf("Failed resolving \"%s\" to IPv6 address: %s",
-					   hostname, gai_strerror(ret));
-			return -1;
-		}
-	}
+	if ((ret = getaddrinfo(hostname, NULL, &hints, &res)) != 0) return inet_hton_error(af, hostname, ret);
 
 	for (ai = res; ai; ai = ai->ai_next) {
 		if ((af == ai->ai_family) || (af == AF_UNSPEC)) break;
@@ -344,6 +441,246 @@ int fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback)
 	return 0;
 }
 
+/** Resolve one hostname into a cache entry
+ *
+ */
+static void inet_hton_cache_resolve(fr_inet_hton_cache_t *c)
+{
+	struct addrinfo	hints = { .ai_family = AF_UNSPEC }, *ai, *res = NULL;
+	fr_ipaddr_t	ip;
+
+	c->ret = getaddrinfo(c->hostname, NULL, &hints, &res);
+	if (c->ret != 0) return;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		if (fr_ipaddr_from_sockaddr(&ip, NULL, (struct sockaddr_storage *)ai->ai_addr, ai->ai_addrlen) < 0) continue;
+
+		if (!c->first.af) c->first = ip;
+		if ((ip.af == AF_INET) && !c->ipv4.af) c->ipv4 = ip;
+		if ((ip.af == AF_INET6) && !c->ipv6.af) c->ipv6 = ip;
+	}
+
+	freeaddrinfo(res);
+}
+
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects "next".
+	fr_inet_hton_cache_t	**todo;		//!< Entries to resolve.
+	size_t			num;		//!< Number of entries to resolve.
+	size_t			next;		//!< Next entry to resolve.
+} fr_inet_hton_prefetch_t;
+
+static void *inet_hton_prefetch_thread(void *arg)
+{
+	fr_inet_hton_prefetch_t	*p = arg;
+	size_t			i;
+
+	for (;;) {
+		pthread_mutex_lock(&p->mutex);
+		i = p->next++;
+		pthread_mutex_unlock(&p->mutex);
+
+		if (i >= p->num) break;
+
+		inet_hton_cache_resolve(p->todo[i]);
+	}
+
+	return NULL;
+}
+
+/** Resolve many hostnames in parallel, so that fr_inet_hton() can return them immediately
+ *
+ * getaddrinfo() blocks, so resolving hundreds of names one after the
+ * other can take a long time.  Instead, we resolve them from a pool of
+ * threads, and cache the results.  fr_inet_hton() then uses the cached
+ * results until they expire, after which it goes back to calling
+ * getaddrinfo().
+ *
+ * Entries which already exist and haven't expired are not resolved
+ * again.  Failures are cached, too.  IP addresses, and anything that
+ * looks like one, are ignored.
+ *
+ * @param[in] hostnames		to resolve.  Duplicates are allowed.
+ * @param[in] num		number of hostnames.
+ * @param[in] max_threads	the maximum number of lookups to run at
+ *				the same time.
+ * @param[in] lifetime		how long to use the results for.
+ * @return
+ *	- The number of hostnames which were resolved.
+ *	- -1 on error.
+ */
+int fr_inet_hton_prefetch(char const * const *hostnames, size_t num, unsigned int max_threads, fr_time_delta_t lifetime)
+{
+	fr_inet_hton_prefetch_t	p = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+	pthread_t		*tid;
+	unsigned int		i, num_threads = 0;
+	size_t			j;
+	fr_time_t		now = fr_time();
+	fr_rb_tree_t		*pending;
+	fr_inet_hton_cache_t	*c;
+
+	if (!fr_hostname_lookups || !num || !fr_time_delta_ispos(lifetime)) return 0;
+
+	pending = fr_rb_inline_talloc_alloc(NULL, fr_inet_hton_cache_t, node, inet_hton_cache_cmp, NULL);
+	if (!pending) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(pending);
+		return -1;
+	}
+
+	/*
+	 *	Figure out which names we need to look up.
+	 */
+	pthread_mutex_lock(&inet_hton_cache_mutex);
+	for (j = 0; j < num; j++) {
+		char const	*p_host = hostnames[j];
+		fr_ipaddr_t	ip;
+
+		if (!p_host || !*p_host || (strchr(p_host, '/') != NULL)) continue;
+		if ((inet_pton(AF_INET, p_host, &ip.addr.v4) == 1) || (inet_pton(AF_INET6, p_host, &ip.addr.v6) == 1)) continue;
+		if (strchr(p_host, ':') || (strcmp(p_host, "*") == 0)) continue;
+
+		if (inet_hton_cache) {
+			c = fr_rb_find(inet_hton_cache, &(fr_inet_hton_cache_t){ .hostname = p_host });
+			if (c && fr_time_gt(c->expires, now)) continue;
+		}
+
+		if (fr_rb_find(pending, &(fr_inet_hton_cache_t){ .hostname = p_host })) continue;
+
+		c = talloc_zero(pending, fr_inet_hton_cache_t);
+		if (!c) {
+			pthread_mutex_unlock(&inet_hton_cache_mutex);
+			goto oom;
+		}
+		c->hostname = talloc_typed_strdup(c, p_host);
+		if (!c->hostname) {
+			pthread_mutex_unlock(&inet_hton_cache_mutex);
+			goto oom;
+		}
+		fr_rb_insert(pending, c);
+	}
+	pthread_mutex_unlock(&inet_hton_cache_mutex);
+
+	p.num = fr_rb_num_elements(pending);
+	if (!p.num) {
+		talloc_free(pending);
+		return 0;
+	}
+
+	p.todo = talloc_array(pending, fr_inet_hton_cache_t *, p.num);
+	if (!p.todo) goto oom;
+
+	j = 0;
+	fr_rb_inorder_foreach(pending, fr_inet_hton_cache_t, entry) {
+		p.todo[j++] = entry;
+	}}
+
+	/*
+	 *	Resolve them.  If we can't start a thread, then the
+	 *	ones we did start, or this thread, do the work.
+	 */
+	if (max_threads > p.num) max_threads = p.num;
+
+	tid = talloc_array(pending, pthread_t, max_threads ? max_threads : 1);
+	if (!tid) goto oom;
+
+	for (i = 0; i < max_threads; i++) {
+		if (pthread_create(&tid[i], NULL, inet_hton_prefetch_thread, &p) != 0) break;
+		num_threads++;
+	}
+
+	if (!num_threads) (void) inet_hton_prefetch_thread(&p);
+
+	for (i = 0; i < num_threads; i++) pthread_join(tid[i], NULL);
+
+	/*
+	 *	Move the results into the cache.
+	 */
+	now = fr_time();
+
+	pthread_mutex_lock(&inet_hton_cache_mutex);
+	if (!inet_hton_cache) {
+		inet_hton_cache = fr_rb_inline_talloc_alloc(NULL, fr_inet_hton_cache_t, node, inet_hton_cache_cmp, NULL);
+		if (!inet_hton_cache) {
+			pthread_mutex_unlock(&inet_hton_cache_mutex);
+			goto oom;
+		}
+	}
+
+	for (j = 0; j < p.num; j++) {
+		fr_inet_hton_cache_t *old;
+
+		c = p.todo[j];
+		c->expires = fr_time_add(now, lifetime);
+
+		(void) fr_rb_remove(pending, c);
+
+		old = fr_rb_remove(inet_hton_cache, c);
+		talloc_free(old);
+
+		talloc_steal(inet_hton_cache, c);
+		fr_rb_insert(inet_hton_cache, c);
+	}
+	pthread_mutex_unlock(&inet_hton_cache_mutex);
+
+	talloc_free(pending);
+
+	return p.num;
+}
+
+/** Resolve all of the hostnames in the cache again
+ *
+ * Entries which haven't expired are left alone.
+ *
+ * @param[in] max_threads	the maximum number of lookups to run at
+ *				the same time.
+ * @param[in] lifetime		how long to use the results for.
+ * @return
+ *	- The number of hostnames which were resolved.
+ *	- -1 on error.
+ */
+int fr_inet_hton_cache_refresh(unsigned int max_threads, fr_time_delta_t lifetime)
+{
+	char const	**hostnames;
+	size_t		i = 0;
+	int		ret;
+
+	pthread_mutex_lock(&inet_hton_cache_mutex);
+	if (!inet_hton_cache) {
+		pthread_mutex_unlock(&inet_hton_cache_mutex);
+		return 0;
+	}
+
+	hostnames = talloc_array(NULL, char const *, fr_rb_num_elements(inet_hton_cache));
+	if (!hostnames) {
+		pthread_mutex_unlock(&inet_hton_cache_mutex);
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	fr_rb_inorder_foreach(inet_hton_cache, fr_inet_hton_cache_t, c) {
+		hostnames[i] = talloc_typed_strdup(hostnames, c->hostname);
+		i++;
+	}}
+	pthread_mutex_unlock(&inet_hton_cache_mutex);
+
+	ret = fr_inet_hton_prefetch(hostnames, i, max_threads, lifetime);
+	talloc_free(hostnames);
+
+	return ret;
+}
+
+/** Free the results of fr_inet_hton_prefetch()
+ *
+ */
+void fr_inet_hton_cache_free(void)
+{
+	pthread_mutex_lock(&inet_hton_cache_mutex);
+	TALLOC_FREE(inet_hton_cache);
+	pthread_mutex_unlock(&inet_hton_cache_mutex);
+}
+
 /** Perform reverse resolution of an IP address
  *
  * Attempt to resolve an IP address to a DNS record (if dns lookups are enabled).
@@ -27,6 +27,7 @@ RCSIDH(inet_h, "$Id$")
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
 
 #include <arpa/inet.h>
 #include <net/if.h>		/* SIOCGIFADDR et al */
@@ -112,6 +113,12 @@ void	fr_ipaddr_mask(fr_ipaddr_t *addr, uint8_t prefix);
  */
 int	fr_inet_hton(fr_ipaddr_t *out, int af, char const *hostname, bool fallback);
 
+int	fr_inet_hton_prefetch(char const * const *hostnames, size_t num, unsigned int max_threads, fr_time_delta_t lifetime);
+
+int	fr_inet_hton_cache_refresh(unsigned int max_threads, fr_time_delta_t lifetime);
+
+void	fr_inet_hton_cache_free(void);
+
 char const *fr_inet_ntoh(fr_ipaddr_t const *src, char *out, size_t outlen);
 
 int	fr_inet_pton4(fr_ipaddr_t *out, char const *value, ssize_t inlen, bool resolve, bool fallback, bool mask);
@@ -0,0 +1,182 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Process wide pool of immutable, deduplicated strings
+ *
+ * Many attribute values (NAS identifiers, realms, filter IDs, class
+ * values) repeat across thousands of requests.  Where those values are
+ * kept for a long time, e.g. in cache entries, holding a single copy of
+ * each distinct string saves memory, and lets comparisons between
+ * pooled strings short circuit on pointer equality.
+ *
+ * Pooled strings are never modified and never freed until the process
+ * exits, so they can be read from any thread without locking.  Lookups
+ * and insertions go through a sharded hash table to limit contention
+ * between workers.
+ *
+ * The pool is bounded both in the length of the strings it will accept
+ * and in the total number of entries.  Once full, callers simply keep
+ * their own copy.
+ *
+ * @file src/lib/util/intern.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/intern.h>
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct {
+	size_t			len;		//!< Of the string, excluding the terminating \0.
+	char const		*str;		//!< Pooled copy, or the caller's buffer when searching.
+} fr_intern_entry_t;
+
+static fr_hash_table_sharded_t	*intern_pool;
+static _Atomic(uint32_t)	intern_num_entries = 0;
+static _Atomic(uint32_t)	intern_max_entries = FR_INTERN_MAX_ENTRIES;
+
+static uint32_t intern_entry_hash(void const *data)
+{
+	fr_intern_entry_t const *e = data;
+
+	return fr_hash(e->str, e->len);
+}
+
+static int8_t intern_entry_cmp(void const *one, void const *two)
+{
+	fr_intern_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->len, b->len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->str, b->str, a->len);
+	return CMP(ret, 0);
+}
+
+static void intern_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static int _intern_free(UNUSED void *uctx)
+{
+	TALLOC_FREE(intern_pool);
+	atomic_store(&intern_num_entries, 0);
+
+	return 0;
+}
+
+static int _intern_init(UNUSED void *uctx)
+{
+	intern_pool = fr_hash_table_sharded_talloc_alloc(NULL, fr_intern_entry_t,
+							 intern_entry_hash, intern_entry_cmp, intern_entry_free, 0);
+	if (unlikely(!intern_pool)) return -1;
+
+	return 0;
+}
+
+/** Return a pooled copy of a string
+ *
+ * The returned string is a \0 terminated talloc'd char array, so
+ * talloc_array_length() behaves as it would for a normal copy.  It must
+ * not be modified, freed, or used as a talloc parent.
+ *
+ * @param[in] in	String to find or add.  Need not be \0 terminated.
+ * @param[in] len	Of in.
+ * @return
+ *	- The pooled copy of the string.
+ *	- NULL if the string is too long, the pool is full, or on
+ *	  allocation failure.  The caller should keep its own copy.
+ */
+char const *fr_intern_bstrndup(char const *in, size_t len)
+{
+	fr_intern_entry_t	find = { .len = len, .str = in }, *found;
+	int			ret;
+	char			*str;
+
+	if (len > FR_INTERN_MAX_LEN) return NULL;
+
+	fr_atexit_global_once_ret(&ret, _intern_init, _intern_free, NULL);
+	if (unlikely(ret < 0)) return NULL;
+
+	found = fr_hash_table_sharded_find(intern_pool, &find);
+	if (found) return found->str;
+
+	/*
+	 *	Racy, but only by a few entries per thread,
+	 *	which doesn't matter for a soft limit.
+	 */
+	if (atomic_load_explicit(&intern_num_entries, memory_order_relaxed) >=
+	    atomic_load_explicit(&intern_max_entries, memory_order_relaxed)) return NULL;
+
+	/*
+	 *	Entries have no parent, as talloc isn't
+	 *	thread safe, and any thread may be adding
+	 *	to the pool.
+	 */
+	found = talloc(NULL, fr_intern_entry_t);
+	if (unlikely(!found)) return NULL;
+
+	str = talloc_bstrndup(found, in, len);
+	if (unlikely(!str)) {
+		talloc_free(found);
+		return NULL;
+	}
+	*found = (fr_intern_entry_t){ .len = len, .str = str };
+
+	/*
+	 *	Another thread added the same string between
+	 *	our find and insert.  Use theirs.
+	 */
+	if (!fr_hash_table_sharded_insert(intern_pool, found)) {
+		talloc_free(found);
+
+		found = fr_hash_table_sharded_find(intern_pool, &find);
+		return found ? found->str : NULL;
+	}
+	atomic_fetch_add_explicit(&intern_num_entries, 1, memory_order_relaxed);
+
+	return str;
+}
+/** Set the maximum number of strings the pool will hold
+ *
+ * Lowering the limit doesn't remove existing entries, it only stops
+ * new ones being added.
+ *
+ * @param[in] max	number of entries.
+ */
+void fr_intern_max_entries_set(uint32_t max)
+{
+	atomic_store(&intern_max_entries, max);
+}
+
+/** Return the number of strings currently pooled
+ *
+ */
+uint32_t fr_intern_num_entries(void)
+{
+	return atomic_load_explicit(&intern_num_entries, memory_order_relaxed);
+}
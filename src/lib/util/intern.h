@@ -0,0 +1,47 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Process wide pool of immutable, deduplicated strings
+ *
+ * @file src/lib/util/intern.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(intern_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FR_INTERN_MAX_LEN	(256)		//!< Longer strings are never interned.
+#define FR_INTERN_MAX_ENTRIES	(1 << 16)	//!< Default limit on the number of pooled strings.
+
+char const	*fr_intern_bstrndup(char const *in, size_t len) CC_HINT(nonnull);
+
+void		fr_intern_max_entries_set(uint32_t max);
+
+uint32_t	fr_intern_num_entries(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -43,22 +43,28 @@ SOURCES		:= \
 		   getaddrinfo.c \
 		   hash.c \
 		   heap.c \
+		   histogram.c \
 		   hmac_md5.c \
 		   hmac_sha1.c \
 		   htrie.c \
 		   hw.c \
 		   inet.c \
+		   intern.c \
 		   iovec.c \
 		   isaac.c \
 		   log.c \
+		   log_async.c \
+		   log_rec.c \
 		   lst.c \
 		   machine.c \
 		   md4.c \
 		   md5.c \
+		   md5_batch.c \
 		   minmax_heap.c \
 		   misc.c \
 		   missing.c \
 		   net.c \
+		   ohash.c \
 		   packet.c \
 		   pair.c \
 		   pair_inline.c \
@@ -70,6 +76,7 @@ SOURCES		:= \
 		   perm.c \
 		   print.c \
 		   proto.c \
+		   qsbr.c \
 		   rand.c \
 		   rb.c \
 		   regex.c \
@@ -89,6 +96,7 @@ SOURCES		:= \
 		   table.c \
 		   talloc.c \
 		   time.c \
+		   timer_wheel.c \
 		   timeval.c \
 		   token.c \
 		   trie.c \
@@ -556,6 +556,11 @@ void fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line
 				 	 colourise ? VTC_RESET : "");
 
 		len = talloc_array_length(buffer) - 1;
+		if (log->async) {
+			(void)fr_log_async_write(log->async, log->fd, buffer, len);
+			break;
+		}
+
 		wrote = write(log->fd, buffer, len);
 		if (wrote < len) return;
 	}
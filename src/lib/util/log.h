@@ -30,6 +30,7 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/fopencookie.h>
+#include <freeradius-devel/util/log_async.h>
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
@@ -119,6 +120,9 @@ struct fr_log_s {
 	void			*uctx;		//!< User data associated with the fr_log_t.
 
 	fr_log_t		*parent;	//!< Log destination this was cloned from.
+
+	fr_log_async_t		*async;		//!< If set, messages for file descriptors are written
+						///< by a dedicated thread.
 };
 
 typedef struct {
@@ -0,0 +1,447 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Write formatted log messages from a dedicated thread
+ *
+ * Each thread which logs gets its own single producer, single consumer
+ * ring of formatted messages.  A dedicated log thread empties the rings,
+ * writing consecutive messages for the same file descriptor with a single
+ * writev() call.  This means a slow disk stalls the log thread, and not
+ * the threads processing requests.
+ *
+ * Messages from a single thread are written in the order they were logged.
+ * Messages from different threads may be interleaved differently than
+ * they'd be if written synchronously.
+ *
+ * If a ring is full, the calling thread either drops and counts the message,
+ * or waits for the log thread to make space, depending on how the
+ * fr_log_async_t was allocated.  Messages are never written by the calling
+ * thread once it has queued one, as they'd overtake the ones in its ring.
+ *
+ * @file src/lib/util/log_async.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/iovec.h>
+#include <freeradius-devel/util/log_async.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/time.h>
+
+#include <pthread.h>
+#include <signal.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Maximum number of messages written with a single call to writev()
+ *
+ */
+#define LOG_ASYNC_BATCH		64
+
+typedef struct fr_log_async_ring_s fr_log_async_ring_t;
+
+/** A formatted log message
+ *
+ */
+typedef struct {
+	int			fd;		//!< To write the message to.
+	size_t			len;		//!< Length of the message.
+	char			data[];		//!< The message.
+} fr_log_async_rec_t;
+
+/** Messages logged by a single thread
+ *
+ */
+struct fr_log_async_ring_s {
+	_Atomic(uint64_t)	head;		//!< Next slot the logging thread writes to.
+	_Atomic(uint64_t)	tail;		//!< Next slot the log thread reads from.
+	fr_log_async_ring_t	*next;		//!< Next ring.  Never changes once the
+						///< ring is visible to the log thread.
+	fr_log_async_rec_t	*recs[];	//!< Messages.
+};
+
+struct fr_log_async_s {
+	uint64_t		id;		//!< Distinguishes this instance from previous ones
+						///< which may have had the same address.
+	uint32_t		ring_size;	//!< Slots in each ring.  A power of two.
+	bool			drop;		//!< Drop messages if the ring is full, instead
+						///< of waiting for space.
+
+	_Atomic(uint64_t)	dropped;	//!< Messages dropped because a ring was full.
+
+	pthread_mutex_t		mutex;		//!< Protects rings, and used with cond.
+	pthread_cond_t		cond;		//!< Signalled to wake the log thread.
+	pthread_cond_t		space;		//!< Signalled by the log thread when it has emptied
+						///< rings which logging threads are waiting on.
+	_Atomic(uint32_t)	waiting;	//!< Logging threads waiting for space.
+	fr_log_async_ring_t	*rings;		//!< One per logging thread.
+
+	_Atomic(bool)		sleeping;	//!< The log thread is waiting on cond.
+	_Atomic(bool)		stop;		//!< The log thread should exit.
+
+	pthread_t		thread;		//!< The log thread.
+};
+
+static _Atomic(uint64_t)		log_async_next_id = 1;
+
+static _Thread_local fr_log_async_ring_t *log_async_ring;	//!< This thread's ring.
+static _Thread_local uint64_t		log_async_ring_id;	//!< The instance the ring belongs to.
+
+/** Write out and free a batch of messages for the same file descriptor
+ *
+ */
+static void log_async_flush(int fd, struct iovec iov[], fr_log_async_rec_t *batch[], int *count)
+{
+	int i;
+
+	if (*count == 0) return;
+
+	/*
+	 *	There's nowhere to report errors to.
+	 */
+	(void)fr_writev(fd, iov, *count, fr_time_delta_from_sec(1));
+
+	for (i = 0; i < *count; i++) talloc_free(batch[i]);
+	*count = 0;
+}
+
+/** Write out all the messages currently in the rings
+ *
+ * @return The number of messages written.
+ */
+static unsigned int log_async_drain(fr_log_async_t *la)
+{
+	fr_log_async_ring_t	*ring;
+	struct iovec		iov[LOG_ASYNC_BATCH];
+	fr_log_async_rec_t	*batch[LOG_ASYNC_BATCH];
+	int			count = 0, fd = -1;
+	unsigned int		written = 0;
+
+	pthread_mutex_lock(&la->mutex);
+	ring = la->rings;
+	pthread_mutex_unlock(&la->mutex);
+
+	for (; ring; ring = ring->next) {
+		uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+		while (tail < head) {
+			fr_log_async_rec_t *rec = ring->recs[tail & (la->ring_size - 1)];
+
+			if ((count == LOG_ASYNC_BATCH) || ((count > 0) && (rec->fd != fd))) {
+				log_async_flush(fd, iov, batch, &count);
+			}
+
+			fd = rec->fd;
+			iov[count] = (struct iovec){ .iov_base = rec->data, .iov_len = rec->len };
+			batch[count++] = rec;
+			tail++;
+			written++;
+		}
+
+		/*
+		 *	We have our own copies of the pointers,
+		 *	so the slots can be reused straight away.
+		 */
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	log_async_flush(fd, iov, batch, &count);
+
+	return written;
+}
+
+/** Whether there are messages waiting to be written
+ *
+ * @note Called with the mutex held.
+ */
+static bool log_async_pending(fr_log_async_t *la)
+{
+	fr_log_async_ring_t *ring;
+
+	for (ring = la->rings; ring; ring = ring->next) {
+		if (atomic_load_explicit(&ring->head, memory_order_acquire) !=
+		    atomic_load_explicit(&ring->tail, memory_order_relaxed)) return true;
+	}
+
+	return false;
+}
+
+static void *log_async_thread(void *arg)
+{
+	fr_log_async_t *la = arg;
+
+	for (;;) {
+		bool		stop = atomic_load(&la->stop);
+		struct timespec	ts;
+
+		if (log_async_drain(la) > 0) {
+			if (atomic_load(&la->waiting) > 0) {
+				pthread_mutex_lock(&la->mutex);
+				pthread_cond_broadcast(&la->space);
+				pthread_mutex_unlock(&la->mutex);
+			}
+			continue;
+		}
+		if (stop) break;
+
+		/*
+		 *	Loggers check sleeping after adding their
+		 *	message, and we check for messages after
+		 *	setting sleeping, so we can't miss a wakeup.
+		 *	The timeout is just belt and braces.
+		 */
+		pthread_mutex_lock(&la->mutex);
+
+		/*
+		 *	Catches waiters which checked their ring
+		 *	before we stored the new tail.
+		 */
+		if (atomic_load(&la->waiting) > 0) pthread_cond_broadcast(&la->space);
+
+		atomic_store(&la->sleeping, true);
+		if (!log_async_pending(la) && !atomic_load(&la->stop)) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100 * 1000 * 1000;
+			if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000 * 1000 * 1000;
+			}
+			pthread_cond_timedwait(&la->cond, &la->mutex, &ts);
+		}
+		atomic_store(&la->sleeping, false);
+		pthread_mutex_unlock(&la->mutex);
+	}
+
+	return NULL;
+}
+
+/** Allocate a ring for the calling thread
+ *
+ */
+static fr_log_async_ring_t *log_async_ring_register(fr_log_async_t *la)
+{
+	fr_log_async_ring_t *ring;
+
+	/*
+	 *	Parented by the NULL ctx, as talloc isn't
+	 *	thread safe, and the instance may be in use
+	 *	by other threads.
+	 */
+	ring = talloc_zero_size(NULL, sizeof(*ring) + (sizeof(ring->recs[0]) * la->ring_size));
+	if (unlikely(!ring)) return NULL;
+	talloc_set_name_const(ring, "fr_log_async_ring_t");
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+
+	pthread_mutex_lock(&la->mutex);
+	ring->next = la->rings;
+	la->rings = ring;
+	pthread_mutex_unlock(&la->mutex);
+
+	log_async_ring = ring;
+	log_async_ring_id = la->id;
+
+	return ring;
+}
+
+/** Wait for the log thread to make space in a ring
+ *
+ * The log thread checks waiting after emptying the rings, and we check the
+ * ring with the mutex held after incrementing waiting, so we can't miss
+ * the broadcast.
+ */
+static void log_async_ring_wait(fr_log_async_t *la, fr_log_async_ring_t *ring)
+{
+	atomic_fetch_add(&la->waiting, 1);
+
+	pthread_mutex_lock(&la->mutex);
+	pthread_cond_signal(&la->cond);
+	while ((atomic_load_explicit(&ring->head, memory_order_relaxed) -
+		atomic_load(&ring->tail)) >= la->ring_size) {
+		pthread_cond_wait(&la->space, &la->mutex);
+	}
+	pthread_mutex_unlock(&la->mutex);
+
+	atomic_fetch_sub(&la->waiting, 1);
+}
+
+/** Queue a formatted message to be written by the log thread
+ *
+ * @param[in] la	to queue the message with.
+ * @param[in] fd	to write the message to.
+ * @param[in] buffer	containing the message.  Copied.
+ * @param[in] len	of the message.
+ * @return
+ *	- 0 if the message was queued or written.
+ *	- -1 if the message was dropped, or couldn't be written.
+ *
+ * @note If the ring is full, and messages aren't being dropped, this
+ *	waits until the log thread has written out the calling thread's
+ *	earlier messages.
+ */
+int fr_log_async_write(fr_log_async_t *la, int fd, char const *buffer, size_t len)
+{
+	fr_log_async_ring_t	*ring = log_async_ring;
+	fr_log_async_rec_t	*rec;
+	uint64_t		head, tail;
+
+	/*
+	 *	Nothing from this thread has been queued, so
+	 *	writing the message directly can't reorder it.
+	 */
+	if (unlikely(!ring || (log_async_ring_id != la->id))) {
+		ring = log_async_ring_register(la);
+		if (unlikely(!ring)) return (write(fd, buffer, len) == (ssize_t)len) ? 0 : -1;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if ((head - tail) >= la->ring_size) {
+		if (la->drop) {
+		drop:
+			atomic_fetch_add_explicit(&la->dropped, 1, memory_order_relaxed);
+			return -1;
+		}
+		log_async_ring_wait(la, ring);
+	}
+
+	rec = talloc_size(NULL, sizeof(*rec) + len);
+	if (unlikely(!rec)) goto drop;
+	talloc_set_name_const(rec, "fr_log_async_rec_t");
+	rec->fd = fd;
+	rec->len = len;
+	memcpy(rec->data, buffer, len);
+
+	ring->recs[head & (la->ring_size - 1)] = rec;
+	atomic_store(&ring->head, head + 1);
+
+	if (atomic_load(&la->sleeping)) {
+		pthread_mutex_lock(&la->mutex);
+		pthread_cond_signal(&la->cond);
+		pthread_mutex_unlock(&la->mutex);
+	}
+
+	return 0;
+}
+
+/** Return the number of messages dropped because a ring was full
+ *
+ */
+uint64_t fr_log_async_dropped(fr_log_async_t const *la)
+{
+	return atomic_load_explicit(&la->dropped, memory_order_relaxed);
+}
+
+/** Stop the log thread, and write out any remaining messages
+ *
+ */
+static int _log_async_free(fr_log_async_t *la)
+{
+	fr_log_async_ring_t *ring, *next;
+
+	pthread_mutex_lock(&la->mutex);
+	atomic_store(&la->stop, true);
+	pthread_cond_signal(&la->cond);
+	pthread_mutex_unlock(&la->mutex);
+
+	pthread_join(la->thread, NULL);
+
+	(void)log_async_drain(la);
+
+	for (ring = la->rings; ring; ring = next) {
+		next = ring->next;
+		talloc_free(ring);
+	}
+
+	pthread_cond_destroy(&la->space);
+	pthread_cond_destroy(&la->cond);
+	pthread_mutex_destroy(&la->mutex);
+
+	return 0;
+}
+
+/** Start a log thread
+ *
+ * @param[in] ctx	to allocate the instance in.  Freeing the instance
+ *			stops the thread, after it's written any queued messages.
+ * @param[in] ring_size	Number of messages each logging thread can queue.
+ *			Rounded up to a power of two.
+ * @param[in] drop	If true, messages are dropped if the logging thread's
+ *			ring is full.  If false, the logging thread waits for
+ *			the log thread to make space.
+ * @return
+ *	- A new instance.
+ *	- NULL on failure.
+ */
+fr_log_async_t *fr_log_async_alloc(TALLOC_CTX *ctx, uint32_t ring_size, bool drop)
+{
+	fr_log_async_t	*la;
+	sigset_t	set, old;
+	uint32_t	pow;
+	int		ret;
+
+	la = talloc_zero(ctx, fr_log_async_t);
+	if (unlikely(!la)) {
+		fr_strerror_const("Failed allocating async log instance");
+		return NULL;
+	}
+
+	/*
+	 *	Find the nearest power of 2 (rounding up)
+	 */
+	for (pow = 0x00000002;
+	     pow < ring_size;
+	     pow <<= 1);
+	la->ring_size = pow;
+	la->drop = drop;
+	la->id = atomic_fetch_add(&log_async_next_id, 1);
+	atomic_init(&la->dropped, 0);
+	atomic_init(&la->waiting, 0);
+	atomic_init(&la->sleeping, false);
+	atomic_init(&la->stop, false);
+
+	pthread_mutex_init(&la->mutex, NULL);
+	pthread_cond_init(&la->cond, NULL);
+	pthread_cond_init(&la->space, NULL);
+
+	/*
+	 *	Signals should be handled by the main thread.
+	 */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	ret = pthread_create(&la->thread, NULL, log_async_thread, la);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		fr_strerror_printf("Failed creating log thread: %s", fr_syserror(ret));
+		pthread_cond_destroy(&la->space);
+		pthread_cond_destroy(&la->cond);
+		pthread_mutex_destroy(&la->mutex);
+		talloc_free(la);
+		return NULL;
+	}
+	talloc_set_destructor(la, _log_async_free);
+
+	return la;
+}
@@ -0,0 +1,47 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Write formatted log messages from a dedicated thread
+ *
+ * @file src/lib/util/log_async.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(log_async_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fr_log_async_s fr_log_async_t;
+
+fr_log_async_t	*fr_log_async_alloc(TALLOC_CTX *ctx, uint32_t ring_size, bool drop);
+
+int		fr_log_async_write(fr_log_async_t *la, int fd, char const *buffer, size_t len) CC_HINT(nonnull);
+
+uint64_t	fr_log_async_dropped(fr_log_async_t const *la) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1024 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Record log messages in binary form, and format them only when they're read
+ *
+ * Formatting a log message is by far the most expensive part of logging it.
+ * Where messages are captured "just in case", e.g. to be dumped if a request
+ * fails, almost all of that work is wasted.
+ *
+ * A recorder instead stores a pointer to the format string, and the raw
+ * values of its arguments, in a fixed size ring.  The oldest messages are
+ * overwritten when the ring is full.  Messages are only formatted when the
+ * recorder is replayed.
+ *
+ * Arguments are copied as follows:
+ *
+ * - Integers, characters and floating point numbers are copied by value.
+ * - Strings (%s) are copied into the ring, as the caller's buffer may not
+ *   outlive the message.
+ * - Value boxes (%pV, %pR, %pH) of leaf types are copied into the ring,
+ *   along with any string or octets data they point to.
+ * - Pairs (%pP), value box lists (%pM) and structural value boxes are
+ *   formatted immediately, as copying them would be more expensive than
+ *   printing them.
+ *
+ * The format string and file name are not copied, so must remain valid
+ * for the lifetime of the recorder.  In practice they're always literals.
+ *
+ * @file src/lib/util/log_rec.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/log_rec.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/print.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/value.h>
+
+#include <ctype.h>
+
+struct fr_log_rec_s {
+	uint8_t			*buff;		//!< Ring of encoded records.
+	size_t			size;		//!< Of the ring.
+	size_t			head;		//!< Offset of the oldest record.
+	size_t			used;		//!< Bytes of the ring in use.
+	unsigned int		count;		//!< Number of records in the ring.
+
+	uint64_t		dropped;	//!< Records overwritten, or too large to record.
+
+	bool			suppress_secrets;	//!< Record secret value boxes as "<<< secret >>>".
+
+	uint8_t			*scratch;	//!< Records are encoded here, then copied into the ring.
+						///< Records are copied back out here to be decoded.
+	size_t			scratch_used;	//!< Bytes of the scratch buffer in use.
+};
+
+/** Fixed portion of a record
+ *
+ * Followed by the encoded arguments.
+ */
+typedef struct {
+	uint32_t		len;		//!< Of the whole record, including this header.
+	uint8_t			type;		//!< fr_log_type_t.
+	int8_t			lvl;		//!< fr_log_lvl_t.
+	uint8_t			indent;		//!< Passed back to the replay function.
+	int			line;		//!< Line the message was generated on.
+	fr_time_t		when;		//!< When the message was recorded.
+	char const		*file;		//!< File the message was generated in.
+	char const		*fmt;		//!< Format string.
+} log_rec_hdr_t;
+
+/** How a value box argument was recorded
+ *
+ */
+typedef enum {
+	LOG_REC_BOX_NULL = 0,			//!< The box pointer was NULL.
+	LOG_REC_BOX_COPY,			//!< Copy of the box, followed by its data if variable length.
+	LOG_REC_BOX_STRING			//!< Formatted when recorded.
+} log_rec_box_t;
+
+/** A parsed conversion specification
+ *
+ */
+typedef struct {
+	char const		*flags;		//!< Start of the flags.
+	size_t			flags_len;	//!< Length of the flags.
+	bool			width_star;	//!< Width is an argument.
+	int			width;		//!< Literal width, or -1 if not specified.
+	bool			prec_star;	//!< Precision is an argument.
+	int			prec;		//!< Literal precision, or -1 if not specified.
+	char			len[2];		//!< Length modifier.
+	char			conv;		//!< Conversion character.
+	char			subst;		//!< FreeRADIUS %p extension, or '\0'.
+} log_rec_spec_t;
+
+#define LOG_REC_STR_NULL	UINT32_MAX
+
+/** Allocate a new recorder
+ *
+ * @param[in] ctx		to allocate the recorder in.
+ * @param[in] size		of the ring in bytes.  Also the maximum size
+ *				of a single record.
+ * @param[in] suppress_secrets	Don't record the values of secret value boxes.
+ * @return
+ *	- A new recorder.
+ *	- NULL on error.
+ */
+fr_log_rec_t *fr_log_rec_alloc(TALLOC_CTX *ctx, size_t size, bool suppress_secrets)
+{
+	fr_log_rec_t *rec;
+
+	if ((size < (sizeof(log_rec_hdr_t) * 4)) || (size > UINT32_MAX)) {
+		fr_strerror_printf("Recorder size must be between %zu and %u bytes",
+				   sizeof(log_rec_hdr_t) * 4, UINT32_MAX);
+		return NULL;
+	}
+
+	rec = talloc_zero(ctx, fr_log_rec_t);
+	if (unlikely(!rec)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(rec);
+		return NULL;
+	}
+
+	rec->buff = talloc_array(rec, uint8_t, size);
+	if (unlikely(!rec->buff)) goto oom;
+
+	rec->scratch = talloc_array(rec, uint8_t, size);
+	if (unlikely(!rec->scratch)) goto oom;
+
+	rec->size = size;
+	rec->suppress_secrets = suppress_secrets;
+
+	return rec;
+}
+
+/** Copy data out of the ring, dealing with wrap around
+ *
+ */
+static void log_rec_ring_read(fr_log_rec_t const *rec, size_t off, void *out, size_t len)
+{
+	size_t first = rec->size - off;
+
+	if (first > len) first = len;
+
+	memcpy(out, rec->buff + off, first);
+	if (len > first) memcpy((uint8_t *)out + first, rec->buff, len - first);
+}
+
+/** Copy data into the ring, dealing with wrap around
+ *
+ */
+static void log_rec_ring_write(fr_log_rec_t *rec, size_t off, void const *in, size_t len)
+{
+	size_t first = rec->size - off;
+
+	if (first > len) first = len;
+
+	memcpy(rec->buff + off, in, first);
+	if (len > first) memcpy(rec->buff, (uint8_t const *)in + first, len - first);
+}
+
+/** Copy the encoded record in the scratch buffer into the ring, overwriting old records if needed
+ *
+ */
+static void log_rec_push(fr_log_rec_t *rec)
+{
+	size_t len = rec->scratch_used;
+
+	while ((rec->size - rec->used) < len) {
+		uint32_t old;
+
+		log_rec_ring_read(rec, rec->head, &old, sizeof(old));
+		rec->head = (rec->head + old) % rec->size;
+		rec->used -= old;
+		rec->count--;
+		rec->dropped++;
+	}
+
+	log_rec_ring_write(rec, (rec->head + rec->used) % rec->size, rec->scratch, len);
+	rec->used += len;
+	rec->count++;
+}
+
+/** Append data to the record being encoded
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the record would be larger than the ring.
+ */
+static int log_rec_put(fr_log_rec_t *rec, void const *in, size_t len)
+{
+	if ((rec->size - rec->scratch_used) < len) return -1;
+
+	memcpy(rec->scratch + rec->scratch_used, in, len);
+	rec->scratch_used += len;
+
+	return 0;
+}
+
+/** Append a length prefixed, \0 terminated, string to the record being encoded
+ *
+ * @param[in] rec	being encoded.
+ * @param[in] in	string to append.  May be NULL.
+ * @param[in] len	of the string.
+ */
+static int log_rec_put_str(fr_log_rec_t *rec, char const *in, size_t len)
+{
+	uint32_t	slen;
+
+	if (!in) {
+		slen = LOG_REC_STR_NULL;
+		return log_rec_put(rec, &slen, sizeof(slen));
+	}
+
+	if (len >= (LOG_REC_STR_NULL - 1)) return -1;
+	slen = len;
+
+	if ((log_rec_put(rec, &slen, sizeof(slen)) < 0) ||
+	    (log_rec_put(rec, in, len) < 0) ||
+	    (log_rec_put(rec, "", 1) < 0)) return -1;
+
+	return 0;
+}
+
+/** Append a string to the record being encoded, then free it
+ *
+ */
+static int log_rec_put_astr(fr_log_rec_t *rec, char *in)
+{
+	int ret;
+
+	if (!in) return -1;
+
+	ret = log_rec_put_str(rec, in, talloc_array_length(in) - 1);
+	talloc_free(in);
+
+	return ret;
+}
+
+/** Read data from the record being decoded
+ *
+ */
+static int log_rec_get(fr_log_rec_t *rec, size_t *off, void *out, size_t len)
+{
+	if ((rec->scratch_used - *off) < len) return -1;
+
+	memcpy(out, rec->scratch + *off, len);
+	*off += len;
+
+	return 0;
+}
+
+/** Read a string from the record being decoded
+ *
+ * @param[in] rec	being decoded.
+ * @param[in,out] off	to read from.
+ * @param[out] out	Where to write a pointer to the string.
+ *			Points into the scratch buffer.  NULL if
+ *			a NULL string was recorded.
+ * @param[out] len	of the string.
+ */
+static int log_rec_get_str(fr_log_rec_t *rec, size_t *off, char const **out, size_t *len)
+{
+	uint32_t slen;
+
+	if (log_rec_get(rec, off, &slen, sizeof(slen)) < 0) return -1;
+
+	if (slen == LOG_REC_STR_NULL) {
+		*out = NULL;
+		*len = 0;
+		return 0;
+	}
+
+	if ((rec->scratch_used - *off) < ((size_t)slen + 1)) return -1;
+
+	*out = (char const *)(rec->scratch + *off);
+	*len = slen;
+	*off += slen + 1;
+
+	return 0;
+}
+
+/** Parse a conversion specification
+ *
+ * Accepts the same specifications as fr_vasprintf().
+ *
+ * @param[out] spec	The parsed specification.
+ * @param[in] p		Pointing to the character after the '%'.
+ * @return Pointer to the character after the specification.
+ */
+static char const *log_rec_spec_parse(log_rec_spec_t *spec, char const *p)
+{
+	char const *q;
+
+	*spec = (log_rec_spec_t) {
+		.width = -1,
+		.prec = -1
+	};
+
+	/*
+	 *	Parameter field, which we ignore
+	 *	in the same way as fr_vasprintf.
+	 */
+	for (q = p; isdigit((uint8_t) *q); q++);
+	if ((q != p) && (*q == '$')) p = q + 1;
+
+	spec->flags = p;
+	while ((*p == '-') || (*p == '+') || (*p == ' ') || (*p == '0') || (*p == '#')) p++;
+	spec->flags_len = p - spec->flags;
+
+	if (*p == '*') {
+		spec->width_star = true;
+		p++;
+	} else if (isdigit((uint8_t) *p)) {
+		spec->width = 0;
+		while (isdigit((uint8_t) *p)) spec->width = (spec->width * 10) + (*p++ - '0');
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->prec_star = true;
+			p++;
+		} else {
+			spec->prec = 0;
+			while (isdigit((uint8_t) *p)) spec->prec = (spec->prec * 10) + (*p++ - '0');
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+	case 'l':
+		spec->len[0] = *p++;
+		if (*p == spec->len[0]) spec->len[1] = *p++;
+		break;
+
+	case 'L':
+	case 'z':
+	case 'j':
+	case 't':
+		spec->len[0] = *p++;
+		break;
+
+	default:
+		break;
+	}
+
+	spec->conv = *p;
+	if (!*p) return p;
+	p++;
+
+	if (spec->conv == 'p') {
+		switch (*p) {
+		case 'V':
+		case 'R':
+		case 'H':
+		case 'M':
+		case 'P':
+			spec->subst = *p++;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return p;
+}
+
+DIAG_OFF(format-nonliteral)
+/** Record a value box argument
+ *
+ */
+static int log_rec_box_encode(fr_log_rec_t *rec, char subst, fr_value_box_t const *in)
+{
+	uint8_t		tag;
+	char		fmt[] = { '%', 'p', subst, '\0' };
+
+	if (!in) {
+		tag = LOG_REC_BOX_NULL;
+		return log_rec_put(rec, &tag, sizeof(tag));
+	}
+
+	if ((subst != 'H') && in->secret && rec->suppress_secrets) {
+		tag = LOG_REC_BOX_STRING;
+		if (log_rec_put(rec, &tag, sizeof(tag)) < 0) return -1;
+		return log_rec_put_str(rec, "<<< secret >>>", sizeof("<<< secret >>>") - 1);
+	}
+
+	/*
+	 *	Anything other than a leaf type may
+	 *	reference arbitrary amounts of memory
+	 *	that may be freed before the recorder
+	 *	is replayed, so format it now.
+	 */
+	if (!fr_type_is_leaf(in->type)) {
+		tag = LOG_REC_BOX_STRING;
+		if (log_rec_put(rec, &tag, sizeof(tag)) < 0) return -1;
+		return log_rec_put_astr(rec, fr_asprintf(NULL, fmt, in));
+	}
+
+	tag = LOG_REC_BOX_COPY;
+	if ((log_rec_put(rec, &tag, sizeof(tag)) < 0) ||
+	    (log_rec_put(rec, in, sizeof(*in)) < 0)) return -1;
+
+	switch (in->type) {
+	case FR_TYPE_STRING:
+		return log_rec_put_str(rec, in->vb_strvalue, in->vb_length);
+
+	case FR_TYPE_OCTETS:
+		return log_rec_put_str(rec, (char const *)in->vb_octets, in->vb_length);
+
+	default:
+		return 0;
+	}
+}
+
+/** Record one argument, and any width or precision arguments associated with it
+ *
+ * @param[in] rec	being encoded.
+ * @param[in] spec	describing the argument.
+ * @param[in] ap	to consume the argument from.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the record is too large.
+ */
+static int log_rec_arg_encode(fr_log_rec_t *rec, log_rec_spec_t const *spec, va_list *ap)
+{
+	int		prec = spec->prec;
+
+	if (spec->width_star) {
+		int width = va_arg(*ap, int);
+
+		if (log_rec_put(rec, &width, sizeof(width)) < 0) return -1;
+	}
+
+	if (spec->prec_star) {
+		prec = va_arg(*ap, int);
+
+		if (log_rec_put(rec, &prec, sizeof(prec)) < 0) return -1;
+	}
+
+	switch (spec->conv) {
+	case 'd':
+	case 'i':
+	{
+		int64_t v;
+
+		switch (spec->len[0]) {
+		case 'h':
+			v = (spec->len[1] == 'h') ? (signed char)va_arg(*ap, int) : (short)va_arg(*ap, int);
+			break;
+
+		case 'l':
+			v = (spec->len[1] == 'l') ? va_arg(*ap, long long) : va_arg(*ap, long);
+			break;
+
+		case 'z':
+			v = va_arg(*ap, ssize_t);
+			break;
+
+		case 'j':
+			v = va_arg(*ap, intmax_t);
+			break;
+
+		case 't':
+			v = va_arg(*ap, ptrdiff_t);
+			break;
+
+		default:
+			v = va_arg(*ap, int);
+			break;
+		}
+
+		return log_rec_put(rec, &v, sizeof(v));
+	}
+
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	{
+		uint64_t v;
+
+		switch (spec->len[0]) {
+		case 'h':
+			v = (spec->len[1] == 'h') ? (unsigned char)va_arg(*ap, unsigned int) :
+						    (unsigned short)va_arg(*ap, unsigned int);
+			break;
+
+		case 'l':
+			v = (spec->len[1] == 'l') ? va_arg(*ap, unsigned long long) : va_arg(*ap, unsigned long);
+			break;
+
+		case 'z':
+			v = va_arg(*ap, size_t);
+			break;
+
+		case 'j':
+			v = va_arg(*ap, uintmax_t);
+			break;
+
+		case 't':
+			v = (uint64_t)va_arg(*ap, ptrdiff_t);
+			break;
+
+		default:
+			v = va_arg(*ap, unsigned int);
+			break;
+		}
+
+		return log_rec_put(rec, &v, sizeof(v));
+	}
+
+	case 'c':
+	{
+		int v = va_arg(*ap, int);
+
+		return log_rec_put(rec, &v, sizeof(v));
+	}
+
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (spec->len[0] == 'L') {
+			long double v = va_arg(*ap, long double);
+
+			return log_rec_put(rec, &v, sizeof(v));
+		} else {
+			double v = va_arg(*ap, double);
+
+			return log_rec_put(rec, &v, sizeof(v));
+		}
+
+	case 's':
+	{
+		char const *v = va_arg(*ap, char const *);
+
+		if (!v) return log_rec_put_str(rec, NULL, 0);
+
+		return log_rec_put_str(rec, v, (prec >= 0) ? strnlen(v, prec) : strlen(v));
+	}
+
+	case 'p':
+		switch (spec->subst) {
+		case 'V':
+		case 'R':
+		case 'H':
+			return log_rec_box_encode(rec, spec->subst, va_arg(*ap, fr_value_box_t const *));
+
+		case 'M':
+		{
+			fr_value_box_list_t const *in = va_arg(*ap, fr_value_box_list_t const *);
+
+			if (!in) return log_rec_put_str(rec, NULL, 0);
+
+			if (rec->suppress_secrets) {
+				return log_rec_put_astr(rec, fr_value_box_list_aprint_secure(NULL, in, NULL,
+											    &fr_value_escape_double));
+			}
+			return log_rec_put_astr(rec, fr_value_box_list_aprint(NULL, in, NULL, &fr_value_escape_double));
+		}
+
+		case 'P':
+		{
+			fr_pair_t const *in = va_arg(*ap, fr_pair_t const *);
+			char		*str = NULL;
+
+			if (!in) return log_rec_put_str(rec, NULL, 0);
+
+			if (in->data.secret && rec->suppress_secrets) {
+				fr_pair_aprint_secure(NULL, &str, NULL, in);
+			} else {
+				fr_pair_aprint(NULL, &str, NULL, in);
+			}
+			return log_rec_put_astr(rec, str);
+		}
+
+		default:
+		{
+			void *v = va_arg(*ap, void *);
+
+			return log_rec_put(rec, &v, sizeof(v));
+		}
+		}
+
+	case 'n':
+		(void) va_arg(*ap, int *);
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+/** Record a log message
+ *
+ * @param[in] rec	to record the message in.
+ * @param[in] type	of message.
+ * @param[in] lvl	the message was logged at.
+ * @param[in] file	src file the message was generated in.
+ *			Must remain valid for the lifetime of the recorder.
+ * @param[in] line	number the message was generated on.
+ * @param[in] indent	Opaque value passed back to the replay function.
+ * @param[in] fmt	with printf style substitution tokens.
+ *			Must remain valid for the lifetime of the recorder.
+ * @param[in] ap	Substitution arguments.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the message was too large to record.
+ */
+int fr_log_rec_vadd(fr_log_rec_t *rec, fr_log_type_t type, fr_log_lvl_t lvl,
+		    char const *file, int line, uint8_t indent, char const *fmt, va_list ap)
+{
+	log_rec_hdr_t	hdr = {
+				.type = type,
+				.lvl = lvl,
+				.indent = indent,
+				.line = line,
+				.when = fr_time(),
+				.file = file,
+				.fmt = fmt
+			};
+	char const	*p;
+	va_list		aq;
+	int		ret = 0;
+
+	rec->scratch_used = sizeof(hdr);	/* Header is filled in at the end */
+
+	va_copy(aq, ap);
+	for (p = fmt; *p != '\0';) {
+		log_rec_spec_t spec;
+
+		if (*p++ != '%') continue;
+		if (*p == '%') {
+			p++;
+			continue;
+		}
+
+		p = log_rec_spec_parse(&spec, p);
+		ret = log_rec_arg_encode(rec, &spec, &aq);
+		if (ret < 0) break;
+	}
+	va_end(aq);
+
+	if (ret < 0) {
+		rec->dropped++;
+		return -1;
+	}
+
+	hdr.len = rec->scratch_used;
+	memcpy(rec->scratch, &hdr, sizeof(hdr));
+	log_rec_push(rec);
+
+	return 0;
+}
+
+/** Record a log message
+ *
+ * @copydetails fr_log_rec_vadd
+ */
+int fr_log_rec_add(fr_log_rec_t *rec, fr_log_type_t type, fr_log_lvl_t lvl,
+		   char const *file, int line, uint8_t indent, char const *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = fr_log_rec_vadd(rec, type, lvl, file, line, indent, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/** Write a printf conversion specification for a single, already decoded, argument
+ *
+ * @param[out] out	Where to write the specification.
+ * @param[in] outlen	Size of out.
+ * @param[in] spec	as parsed from the original format string.
+ * @param[in] width	to use if the original width was an argument.
+ * @param[in] prec	to use if the original precision was an argument.
+ * @param[in] len	Length modifier to use.
+ */
+static void log_rec_spec_print(char *out, size_t outlen, log_rec_spec_t const *spec,
+			       int width, int prec, char const *len)
+{
+	char	*p = out, *end = out + outlen;
+
+	p += snprintf(p, end - p, "%%%.*s", (int)spec->flags_len, spec->flags);
+
+	/*
+	 *	A negative width argument means left justify,
+	 *	which printing it as a literal preserves.
+	 */
+	if (spec->width_star) {
+		p += snprintf(p, end - p, "%d", width);
+	} else if (spec->width >= 0) {
+		p += snprintf(p, end - p, "%d", spec->width);
+	}
+
+	if (!spec->prec_star) prec = spec->prec;
+	if (prec >= 0) p += snprintf(p, end - p, ".%d", prec);
+
+	snprintf(p, end - p, "%s%c", len, spec->conv);
+}
+
+/** Format one recorded argument, appending it to out
+ *
+ * @param[in,out] out	Talloced buffer to append to.
+ * @param[in] rec	being decoded.
+ * @param[in,out] off	of the argument in the scratch buffer.
+ * @param[in] spec	describing the argument.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int log_rec_arg_print(char **out, fr_log_rec_t *rec, size_t *off, log_rec_spec_t const *spec)
+{
+	char	fmt[64];
+	int	width = -1, prec = -1;
+	char	*tmp = NULL;
+
+	if (spec->width_star && (log_rec_get(rec, off, &width, sizeof(width)) < 0)) return -1;
+	if (spec->prec_star && (log_rec_get(rec, off, &prec, sizeof(prec)) < 0)) return -1;
+
+	switch (spec->conv) {
+	case 'd':
+	case 'i':
+	{
+		int64_t v;
+
+		if (log_rec_get(rec, off, &v, sizeof(v)) < 0) return -1;
+		log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "ll");
+		tmp = talloc_asprintf_append_buffer(*out, fmt, (long long)v);
+	}
+		break;
+
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	{
+		uint64_t v;
+
+		if (log_rec_get(rec, off, &v, sizeof(v)) < 0) return -1;
+		log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "ll");
+		tmp = talloc_asprintf_append_buffer(*out, fmt, (unsigned long long)v);
+	}
+		break;
+
+	case 'c':
+	{
+		int v;
+
+		if (log_rec_get(rec, off, &v, sizeof(v)) < 0) return -1;
+		log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "");
+		tmp = talloc_asprintf_append_buffer(*out, fmt, v);
+	}
+		break;
+
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (spec->len[0] == 'L') {
+			long double v;
+
+			if (log_rec_get(rec, off, &v, sizeof(v)) < 0) return -1;
+			log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "L");
+			tmp = talloc_asprintf_append_buffer(*out, fmt, v);
+		} else {
+			double v;
+
+			if (log_rec_get(rec, off, &v, sizeof(v)) < 0) return -1;
+			log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "");
+			tmp = talloc_asprintf_append_buffer(*out, fmt, v);
+		}
+		break;
+
+	case 's':
+	{
+		char const	*v;
+		size_t		len;
+
+		if (log_rec_get_str(rec, off, &v, &len) < 0) return -1;
+		log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "");
+		tmp = talloc_asprintf_append_buffer(*out, fmt, v ? v : "(null)");
+	}
+		break;
+
+	case 'p':
+		switch (spec->subst) {
+		case 'V':
+		case 'R':
+		case 'H':
+		{
+			uint8_t		tag;
+			fr_value_box_t	box;
+			char const	*v;
+			size_t		len;
+			char		*subst;
+			char		box_fmt[] = { '%', 'p', spec->subst, '\0' };
+
+			if (log_rec_get(rec, off, &tag, sizeof(tag)) < 0) return -1;
+
+			switch (tag) {
+			case LOG_REC_BOX_NULL:
+				tmp = talloc_strdup_append_buffer(*out, "(null)");
+				break;
+
+			case LOG_REC_BOX_STRING:
+				if (log_rec_get_str(rec, off, &v, &len) < 0) return -1;
+				tmp = talloc_strndup_append_buffer(*out, v, len);
+				break;
+
+			case LOG_REC_BOX_COPY:
+				if (log_rec_get(rec, off, &box, sizeof(box)) < 0) return -1;
+
+				/*
+				 *	Point the copy at the data we recorded,
+				 *	which isn't talloced.
+				 */
+				box.talloced = 0;
+				switch (box.type) {
+				case FR_TYPE_STRING:
+					if (log_rec_get_str(rec, off, &v, &len) < 0) return -1;
+					box.vb_strvalue = v;
+					break;
+
+				case FR_TYPE_OCTETS:
+					if (log_rec_get_str(rec, off, &v, &len) < 0) return -1;
+					box.vb_octets = (uint8_t const *)v;
+					break;
+
+				default:
+					break;
+				}
+
+				subst = fr_asprintf(NULL, box_fmt, &box);
+				if (!subst) return -1;
+				tmp = talloc_strdup_append_buffer(*out, subst);
+				talloc_free(subst);
+				break;
+
+			default:
+				return -1;
+			}
+		}
+			break;
+
+		case 'M':
+		case 'P':
+		{
+			char const	*v;
+			size_t		len;
+
+			if (log_rec_get_str(rec, off, &v, &len) < 0) return -1;
+			tmp = v ? talloc_strndup_append_buffer(*out, v, len) : talloc_strdup_append_buffer(*out, "(null)");
+		}
+			break;
+
+		default:
+		{
+			void *v;
+
+			if (log_rec_get(rec, off, &v, sizeof(v)) < 0) return -1;
+			log_rec_spec_print(fmt, sizeof(fmt), spec, width, prec, "");
+			tmp = talloc_asprintf_append_buffer(*out, fmt, v);
+		}
+			break;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (!tmp) return -1;
+	*out = tmp;
+
+	return 0;
+}
+DIAG_ON(format-nonliteral)
+
+/** Format the record in the scratch buffer
+ *
+ */
+static char *log_rec_print(TALLOC_CTX *ctx, fr_log_rec_t *rec, log_rec_hdr_t const *hdr)
+{
+	char const	*p, *q;
+	size_t		off = sizeof(*hdr);
+	char		*out, *tmp;
+
+	out = talloc_strdup(ctx, "");
+	if (!out) return NULL;
+
+	for (p = q = hdr->fmt; *p != '\0';) {
+		log_rec_spec_t spec;
+
+		if (*p != '%') {
+			p++;
+			continue;
+		}
+
+		/*
+		 *	"%%", copy the literal text up to
+		 *	and including the first '%'.
+		 */
+		if (*(p + 1) == '%') {
+			tmp = talloc_strndup_append_buffer(out, q, (p + 1) - q);
+			if (!tmp) goto error;
+			out = tmp;
+
+			p += 2;
+			q = p;
+			continue;
+		}
+
+		tmp = talloc_strndup_append_buffer(out, q, p - q);
+		if (!tmp) goto error;
+		out = tmp;
+
+		p = log_rec_spec_parse(&spec, p + 1);
+		q = p;
+
+		if (log_rec_arg_print(&out, rec, &off, &spec) < 0) goto error;
+	}
+
+	tmp = talloc_strndup_append_buffer(out, q, p - q);
+	if (!tmp) goto error;
+
+	return tmp;
+
+error:
+	talloc_free(out);
+	return NULL;
+}
+
+/** Format and pass each recorded message, oldest first, to a function
+ *
+ * Messages remain in the recorder, so it may be replayed multiple times.
+ *
+ * @note func must not add messages to the recorder being replayed.
+ *
+ * @param[in] rec	to replay.
+ * @param[in] func	to call for each message.
+ * @param[in] uctx	to pass to func.
+ * @return The number of messages replayed.
+ */
+unsigned int fr_log_rec_replay(fr_log_rec_t *rec, fr_log_rec_func_t func, void *uctx)
+{
+	size_t		off = rec->head;
+	unsigned int	i;
+
+	for (i = 0; i < rec->count; i++) {
+		log_rec_hdr_t	hdr;
+		char		*msg;
+
+		log_rec_ring_read(rec, off, &hdr, sizeof(hdr));
+		log_rec_ring_read(rec, off, rec->scratch, hdr.len);
+		rec->scratch_used = hdr.len;
+		off = (off + hdr.len) % rec->size;
+
+		msg = log_rec_print(NULL, rec, &hdr);
+		func((fr_log_type_t)hdr.type, (fr_log_lvl_t)hdr.lvl, hdr.when, hdr.file, hdr.line, hdr.indent,
+		     msg ? msg : "<<< failed formatting recorded message >>>", uctx);
+		talloc_free(msg);
+	}
+
+	return i;
+}
+
+/** Discard all recorded messages
+ *
+ */
+void fr_log_rec_reset(fr_log_rec_t *rec)
+{
+	rec->head = 0;
+	rec->used = 0;
+	rec->count = 0;
+	rec->dropped = 0;
+}
+
+/** Return the number of messages in the recorder
+ *
+ */
+unsigned int fr_log_rec_count(fr_log_rec_t const *rec)
+{
+	return rec->count;
+}
+
+/** Return the number of messages overwritten, or not recorded because they were too large
+ *
+ */
+uint64_t fr_log_rec_dropped(fr_log_rec_t const *rec)
+{
+	return rec->dropped;
+}
@@ -0,0 +1,76 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Record log messages in binary form, and format them only when they're read
+ *
+ * @file src/lib/util/log_rec.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(log_rec_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fr_log_rec_s fr_log_rec_t;
+
+/** Called for each message when replaying a recorder
+ *
+ * @param[in] type	of the message.
+ * @param[in] lvl	the message was recorded at.
+ * @param[in] when	the message was recorded.
+ * @param[in] file	src file the message was generated in.
+ * @param[in] line	number the message was generated on.
+ * @param[in] indent	as passed to #fr_log_rec_vadd.
+ * @param[in] msg	the formatted message.
+ * @param[in] uctx	passed to #fr_log_rec_replay.
+ */
+typedef void (*fr_log_rec_func_t)(fr_log_type_t type, fr_log_lvl_t lvl, fr_time_t when,
+				  char const *file, int line, uint8_t indent, char const *msg, void *uctx);
+
+fr_log_rec_t	*fr_log_rec_alloc(TALLOC_CTX *ctx, size_t size, bool suppress_secrets);
+
+int		fr_log_rec_vadd(fr_log_rec_t *rec, fr_log_type_t type, fr_log_lvl_t lvl,
+				char const *file, int line, uint8_t indent, char const *fmt, va_list ap)
+				CC_HINT(format (printf, 7, 0)) CC_HINT(nonnull (1, 7));
+
+int		fr_log_rec_add(fr_log_rec_t *rec, fr_log_type_t type, fr_log_lvl_t lvl,
+			       char const *file, int line, uint8_t indent, char const *fmt, ...)
+			       CC_HINT(format (printf, 7, 8)) CC_HINT(nonnull (1, 7));
+
+unsigned int	fr_log_rec_replay(fr_log_rec_t *rec, fr_log_rec_func_t func, void *uctx) CC_HINT(nonnull(1, 2));
+
+void		fr_log_rec_reset(fr_log_rec_t *rec) CC_HINT(nonnull);
+
+unsigned int	fr_log_rec_count(fr_log_rec_t const *rec) CC_HINT(nonnull);
+
+uint64_t	fr_log_rec_dropped(fr_log_rec_t const *rec) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
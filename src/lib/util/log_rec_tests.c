@@ -0,0 +1,121 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the binary log recorder
+ *
+ * @file src/lib/util/log_rec_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/log_rec.h>
+#include <freeradius-devel/util/value.h>
+
+static char const	*replayed[8];
+static unsigned int	num_replayed;
+
+static void test_replay(UNUSED fr_log_type_t type, UNUSED fr_log_lvl_t lvl, UNUSED fr_time_t when,
+			UNUSED char const *file, UNUSED int line, UNUSED uint8_t indent, char const *msg, void *uctx)
+{
+	if (num_replayed >= NUM_ELEMENTS(replayed)) return;
+
+	replayed[num_replayed++] = talloc_strdup(uctx, msg);
+}
+
+static void test_log_rec_format(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	fr_log_rec_t	*rec;
+	char		buff[] = "transient";
+	fr_value_box_t	str, num;
+
+	rec = fr_log_rec_alloc(ctx, 4096, false);
+	TEST_ASSERT(rec != NULL);
+
+	fr_value_box_init(&str, FR_TYPE_STRING, NULL, false);
+	TEST_CHECK(fr_value_box_strdup(ctx, &str, NULL, "hello", false) == 0);
+	fr_value_box(&num, (uint32_t)42, false);
+
+	TEST_CHECK(fr_log_rec_add(rec, L_DBG, L_DBG_LVL_1, __FILE__, __LINE__, 0,
+				  "int %d %05u %hhx %zu, %s %.3s %-4s|, 100%%", -1, 7, 0x1ff, (size_t)9,
+				  buff, buff, "ab") == 0);
+	TEST_CHECK(fr_log_rec_add(rec, L_DBG, L_DBG_LVL_2, __FILE__, __LINE__, 2,
+				  "box %pV %pV %pV %*d", &str, &num, NULL, 3, 5) == 0);
+
+	/*
+	 *	Arguments must have been copied.
+	 */
+	strcpy(buff, "changed!!");
+	fr_value_box_clear(&str);
+
+	num_replayed = 0;
+	TEST_CHECK(fr_log_rec_replay(rec, test_replay, ctx) == 2);
+	TEST_CHECK(num_replayed == 2);
+
+	TEST_CHECK_STRCMP(replayed[0], "int -1 00007 ff 9, transient tra ab  |, 100%");
+	TEST_MSG("Got \"%s\"", replayed[0]);
+	TEST_CHECK_STRCMP(replayed[1], "box \"hello\" 42 (null)   5");
+	TEST_MSG("Got \"%s\"", replayed[1]);
+
+	talloc_free(ctx);
+}
+
+static void test_log_rec_overwrite(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	fr_log_rec_t	*rec;
+	unsigned int	i;
+	char		*big;
+
+	rec = fr_log_rec_alloc(ctx, 512, false);
+	TEST_ASSERT(rec != NULL);
+
+	for (i = 0; i < 100; i++) {
+		TEST_CHECK(fr_log_rec_add(rec, L_DBG, L_DBG_LVL_1, __FILE__, __LINE__, 0, "message %u", i) == 0);
+	}
+
+	/*
+	 *	Only the newest messages should remain.
+	 */
+	TEST_CHECK(fr_log_rec_count(rec) < 100);
+	TEST_CHECK(fr_log_rec_count(rec) + fr_log_rec_dropped(rec) == 100);
+
+	num_replayed = 0;
+	fr_log_rec_replay(rec, test_replay, ctx);
+	TEST_CHECK(num_replayed > 0);
+	TEST_CHECK_STRCMP(replayed[0], talloc_asprintf(ctx, "message %u", (unsigned int)(100 - fr_log_rec_count(rec))));
+
+	/*
+	 *	Messages larger than the ring are dropped.
+	 */
+	big = talloc_array(ctx, char, 1024);
+	memset(big, 'a', 1023);
+	big[1023] = '\0';
+	TEST_CHECK(fr_log_rec_add(rec, L_DBG, L_DBG_LVL_1, __FILE__, __LINE__, 0, "%s", big) < 0);
+
+	fr_log_rec_reset(rec);
+	TEST_CHECK(fr_log_rec_count(rec) == 0);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "fr_log_rec_format",		test_log_rec_format },
+	{ "fr_log_rec_overwrite",	test_log_rec_overwrite },
+
+	{ NULL }
+};
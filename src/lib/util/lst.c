@@ -747,6 +747,65 @@ int fr_lst_insert(fr_lst_t *lst, void *data)
 	return 0;
 }
 
+/** Insert multiple elements into an LST
+ *
+ * Capacity and preconditions are checked once, before any elements are
+ * inserted, so either all the elements are inserted or none of them are.
+ *
+ * @note data must not contain the same element more than once.
+ *
+ * @param[in] lst	to insert elements into.
+ * @param[in] data	Array of elements to insert.
+ * @param[in] num	Number of elements in the array.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (malloc error, or an element was already inserted).
+ */
+int fr_lst_insert_bulk(fr_lst_t *lst, void *data[], unsigned int num)
+{
+	unsigned int i;
+
+	if (unlikely(num > (UINT_MAX - lst->num_elements))) {
+		fr_strerror_const("LST is full");
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (unlikely(raw_item_index(lst, data[i]) > 0)) {
+			fr_strerror_const("Node is already in the LST");
+			return -1;
+		}
+	}
+
+	while ((lst->num_elements + num) > lst->capacity) {
+		if (unlikely(!lst_expand(lst))) return -1;
+	}
+
+	for (i = 0; i < num; i++) _fr_lst_insert(lst, 0, data[i]);
+
+	return 0;
+}
+
+/** Remove up to num of the smallest elements from an LST
+ *
+ * Elements are written to out in order, smallest first.  Successive pops
+ * reuse the partitioning done for the earlier ones, so this is cheap
+ * after the first element.
+ *
+ * @param[in] lst	to pop elements from.
+ * @param[out] out	Where to write the popped elements.
+ * @param[in] num	Maximum number of elements to pop.
+ * @return The number of elements popped.
+ */
+unsigned int fr_lst_pop_n(fr_lst_t *lst, void *out[], unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; (i < num) && (lst->num_elements > 0); i++) out[i] = _fr_lst_pop(lst, 0);
+
+	return i;
+}
+
 unsigned int fr_lst_num_elements(fr_lst_t *lst)
 {
 	return lst->num_elements;
@@ -107,6 +107,10 @@ int 	fr_lst_insert(fr_lst_t *lst, void *data) CC_HINT(nonnull);
 
 int	fr_lst_extract(fr_lst_t *lst, void *data) CC_HINT(nonnull);
 
+int	fr_lst_insert_bulk(fr_lst_t *lst, void *data[], unsigned int num) CC_HINT(nonnull);
+
+unsigned int	fr_lst_pop_n(fr_lst_t *lst, void *out[], unsigned int num) CC_HINT(nonnull);
+
 unsigned int	fr_lst_num_elements(fr_lst_t *lst) CC_HINT(nonnull);
 
 
@@ -88,6 +88,41 @@ static void lst_test_basic(void)
 	talloc_free(lst);
 }
 
+static void lst_test_bulk(void)
+{
+	fr_lst_t	*lst;
+	lst_thing	values[NVALUES];
+	lst_thing	*batch[NVALUES];
+	unsigned int	popped, count = 0;
+
+	lst = fr_lst_alloc(NULL, lst_cmp, lst_thing, idx, 4);
+	TEST_CHECK(lst != NULL);
+
+	populate_values(values, NUM_ELEMENTS(values));
+	for (unsigned int i = 0; i < NUM_ELEMENTS(values); i++) batch[i] = &values[i];
+
+	TEST_CASE("Bulk insert expands the LST");
+	TEST_CHECK(fr_lst_insert_bulk(lst, (void **)batch, NUM_ELEMENTS(batch)) == 0);
+	TEST_CHECK(fr_lst_num_elements(lst) == NVALUES);
+
+	TEST_CASE("Duplicates are rejected");
+	TEST_CHECK(fr_lst_insert_bulk(lst, (void **)batch, 1) < 0);
+	TEST_CHECK(fr_lst_num_elements(lst) == NVALUES);
+
+	TEST_CASE("Batches are popped in order");
+	while ((popped = fr_lst_pop_n(lst, (void **)batch, 3)) > 0) {
+		for (unsigned int i = 0; i < popped; i++) {
+			TEST_CHECK(batch[i]->data == count);
+			TEST_MSG("expected %u, popped %u", count, batch[i]->data);
+			TEST_CHECK(!fr_lst_entry_inserted(batch[i]->idx));
+			count++;
+		}
+	}
+	TEST_CHECK(count == NVALUES);
+
+	talloc_free(lst);
+}
+
 #define LST_TEST_SIZE (4096)
 
 static void lst_test(int skip)
@@ -567,6 +602,7 @@ TEST_LIST = {
 	 *	Basic tests
 	 */
 	{ "lst_test_basic",	lst_test_basic	},
+	{ "lst_test_bulk",	lst_test_bulk	},
 	{ "lst_test_skip_1",	lst_test_skip_1	},
 	{ "lst_test_skip_2",	lst_test_skip_2	},
 	{ "lst_test_skip_10",	lst_test_skip_10	},
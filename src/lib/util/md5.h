@@ -20,6 +20,7 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #ifndef MD5_DIGEST_LENGTH
 #  define MD5_DIGEST_LENGTH 16
@@ -96,6 +97,27 @@ void		fr_md5_ctx_free_from_list(fr_md5_ctx_t **ctx);
 /* hmac.c */
 int		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
+
+/* md5_batch.c */
+
+/** Number of messages digested in parallel by the batch functions
+ *
+ */
+#define FR_MD5_BATCH_LANES	(8)
+
+/** One message in a batch
+ *
+ */
+typedef struct {
+	struct iovec const	*iov;		//!< Segments of the message.
+	unsigned int		iovcnt;		//!< Number of segments.
+	uint8_t			*out;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_batch_t;
+
+void		fr_md5_calc_batch(fr_md5_batch_t const *batch, unsigned int num);
+
+void		fr_hmac_md5_batch(fr_md5_batch_t const *batch, unsigned int num,
+				  uint8_t const *key, size_t key_len);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,278 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables
+ *
+ * Entries are stored directly in one array, with linear probing.  A
+ * lookup usually touches one or two cache lines, instead of following
+ * a chain of pointers through a tree or a bucket list.
+ *
+ * Each slot also holds the full hash of its entry, so that we only
+ * call the comparison function when the hashes match.
+ *
+ * Deletions shift later entries in the same probe sequence back into
+ * the free slot.  There are no tombstones, so lookups don't get slower
+ * as entries are added and removed.
+ *
+ * @file src/lib/util/ohash.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/ohash.h>
+
+/*
+ *	The smallest table we create.  Must be a power of two.
+ */
+#define FR_OHASH_MIN_SIZE (16)
+
+typedef struct {
+	uint32_t		hash;		//!< Full hash of the data.
+	void			*data;		//!< NULL if the slot is free.
+} fr_ohash_slot_t;
+
+struct fr_ohash_s {
+	uint32_t		num_elements;	//!< Number of elements in the table.
+	uint32_t		num_slots;	//!< Length of the slot array - power of 2.
+	uint32_t		mask;		//!< num_slots - 1.
+	uint32_t		max_elements;	//!< Grow the table when we have more than this.
+
+	fr_hash_t		hash;		//!< Hashing function.
+	fr_cmp_t		cmp;		//!< Comparison function.
+
+	fr_ohash_slot_t		*slot;		//!< Array of slots.
+};
+
+static int ohash_slots_alloc(fr_ohash_t *oh, uint32_t num_slots)
+{
+	fr_ohash_slot_t *slot;
+
+	slot = talloc_zero_array(oh, fr_ohash_slot_t, num_slots);
+	if (!slot) return -1;
+
+	oh->slot = slot;
+	oh->num_slots = num_slots;
+	oh->mask = num_slots - 1;
+	oh->max_elements = (num_slots / 4) * 3;	/* Keep the load factor under 75% */
+
+	return 0;
+}
+
+/** Allocate an open addressing hash table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] hash_node	hashing function.
+ * @param[in] cmp_node	comparison function.  Entries which compare equal
+ *			MUST have the same hash.
+ * @param[in] size	expected number of entries.  The table grows if
+ *			there are more.  May be 0.
+ * @return
+ *	- A new hash table on success.
+ *	- NULL on failure.
+ */
+fr_ohash_t *fr_ohash_alloc(TALLOC_CTX *ctx, fr_hash_t hash_node, fr_cmp_t cmp_node, uint32_t size)
+{
+	fr_ohash_t	*oh;
+	uint32_t	num_slots = FR_OHASH_MIN_SIZE;
+
+	oh = talloc_zero(ctx, fr_ohash_t);
+	if (!oh) return NULL;
+
+	oh->hash = hash_node;
+	oh->cmp = cmp_node;
+
+	while (((num_slots / 4) * 3) < size) {
+		if (num_slots >= (1U << 31)) break;
+		num_slots <<= 1;
+	}
+
+	if (ohash_slots_alloc(oh, num_slots) < 0) {
+		talloc_free(oh);
+		return NULL;
+	}
+
+	return oh;
+}
+
+/** Find the slot for some data
+ *
+ * @return
+ *	- true if the data was found, and *p_index is its slot.
+ *	- false if the data wasn't found, and *p_index is the free slot
+ *	  where it should be inserted.
+ */
+static inline CC_HINT(always_inline) bool ohash_lookup(fr_ohash_t *oh, uint32_t hash, void const *data,
+							uint32_t *p_index)
+{
+	uint32_t i = hash & oh->mask;
+
+	while (oh->slot[i].data) {
+		if ((oh->slot[i].hash == hash) && (oh->cmp(oh->slot[i].data, data) == 0)) {
+			*p_index = i;
+			return true;
+		}
+
+		i = (i + 1) & oh->mask;
+	}
+
+	*p_index = i;
+	return false;
+}
+
+/** Double the size of the table
+ *
+ */
+static int ohash_grow(fr_ohash_t *oh)
+{
+	fr_ohash_slot_t	*old = oh->slot;
+	uint32_t	i, j, old_slots = oh->num_slots;
+
+	if (old_slots >= (1U << 31)) return -1;
+
+	if (ohash_slots_alloc(oh, old_slots << 1) < 0) {
+		oh->slot = old;
+		return -1;
+	}
+
+	/*
+	 *	All of the entries are unique, so we just need to find
+	 *	a free slot for each one.
+	 */
+	for (i = 0; i < old_slots; i++) {
+		if (!old[i].data) continue;
+
+		j = old[i].hash & oh->mask;
+		while (oh->slot[j].data) j = (j + 1) & oh->mask;
+
+		oh->slot[j] = old[i];
+	}
+
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Find data in a hash table
+ *
+ * @param[in] oh	to search in.
+ * @param[in] data	to find.
+ * @return
+ *	- The matching data.
+ *	- NULL if no data matched.
+ */
+void *fr_ohash_find(fr_ohash_t *oh, void const *data)
+{
+	uint32_t i;
+
+	if (!ohash_lookup(oh, oh->hash(data), data, &i)) return NULL;
+
+	return oh->slot[i].data;
+}
+
+/** Insert data into a hash table
+ *
+ * @param[in] oh	to insert into.
+ * @param[in] data	to insert.
+ * @return
+ *	- true if the data was inserted.
+ *	- false if matching data is already in the table, or on error.
+ */
+bool fr_ohash_insert(fr_ohash_t *oh, void const *data)
+{
+	uint32_t i, hash;
+
+	hash = oh->hash(data);
+
+	if (ohash_lookup(oh, hash, data, &i)) return false;
+
+	if (oh->num_elements >= oh->max_elements) {
+		if (ohash_grow(oh) < 0) return false;
+
+		(void) ohash_lookup(oh, hash, data, &i);
+	}
+
+	oh->slot[i].hash = hash;
+	memcpy(&oh->slot[i].data, &data, sizeof(oh->slot[i].data));
+	oh->num_elements++;
+
+	return true;
+}
+
+/** Remove data from a hash table
+ *
+ * The entries after the removed one are shifted back, so that every
+ * entry can still be reached from its home slot without passing over
+ * a free slot.
+ *
+ * @param[in] oh	to remove from.
+ * @param[in] data	to remove.
+ * @return
+ *	- The data which was removed.
+ *	- NULL if no data matched.
+ */
+void *fr_ohash_remove(fr_ohash_t *oh, void const *data)
+{
+	uint32_t	i, j, home;
+	void		*found;
+
+	if (!ohash_lookup(oh, oh->hash(data), data, &i)) return NULL;
+
+	found = oh->slot[i].data;
+	oh->slot[i].data = NULL;
+	oh->num_elements--;
+
+	for (j = (i + 1) & oh->mask; oh->slot[j].data; j = (j + 1) & oh->mask) {
+		home = oh->slot[j].hash & oh->mask;
+
+		/*
+		 *	The entry at "j" can stay where it is if its home
+		 *	slot is after the free slot "i", and at or before "j".
+		 */
+		if (i <= j) {
+			if ((i < home) && (home <= j)) continue;
+		} else {
+			if ((i < home) || (home <= j)) continue;
+		}
+
+		oh->slot[i] = oh->slot[j];
+		oh->slot[j].data = NULL;
+		i = j;
+	}
+
+	return found;
+}
+
+/** Remove data from a hash table
+ *
+ * @param[in] oh	to remove from.
+ * @param[in] data	to remove.
+ * @return
+ *	- true if the data was removed.
+ *	- false if no data matched.
+ */
+bool fr_ohash_delete(fr_ohash_t *oh, void const *data)
+{
+	return (fr_ohash_remove(oh, data) != NULL);
+}
+
+/** Return the number of elements in a hash table
+ *
+ */
+uint32_t fr_ohash_num_elements(fr_ohash_t *oh)
+{
+	return oh->num_elements;
+}
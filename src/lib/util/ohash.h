@@ -0,0 +1,53 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for open addressing hash tables
+ *
+ * @file src/lib/util/ohash.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(ohash_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fr_ohash_s fr_ohash_t;
+
+fr_ohash_t	*fr_ohash_alloc(TALLOC_CTX *ctx, fr_hash_t hash_node, fr_cmp_t cmp_node, uint32_t size) CC_HINT(nonnull(2,3));
+
+void		*fr_ohash_find(fr_ohash_t *oh, void const *data) CC_HINT(nonnull);
+
+bool		fr_ohash_insert(fr_ohash_t *oh, void const *data) CC_HINT(nonnull);
+
+void		*fr_ohash_remove(fr_ohash_t *oh, void const *data) CC_HINT(nonnull);
+
+bool		fr_ohash_delete(fr_ohash_t *oh, void const *data) CC_HINT(nonnull);
+
+uint32_t	fr_ohash_num_elements(fr_ohash_t *oh) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
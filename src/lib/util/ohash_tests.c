@@ -0,0 +1,171 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for open addressing hash tables
+ *
+ * @file src/lib/util/ohash_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/ohash.h>
+
+#define MAXSIZE 4096
+
+typedef struct {
+	uint32_t	num;
+} fr_ohash_test_node_t;
+
+static uint32_t fr_ohash_test_hash(void const *data)
+{
+	fr_ohash_test_node_t const *a = data;
+
+	return fr_hash(&a->num, sizeof(a->num));
+}
+
+/*
+ *	Puts every entry in the same probe sequence, so that removal
+ *	has to shift entries back.
+ */
+static uint32_t fr_ohash_test_hash_collide(void const *data)
+{
+	fr_ohash_test_node_t const *a = data;
+
+	return a->num & 0x03;
+}
+
+static int8_t fr_ohash_test_cmp(void const *one, void const *two)
+{
+	fr_ohash_test_node_t const *a = one, *b = two;
+	return CMP(a->num, b->num);
+}
+
+static void ohash_test_insert_remove(fr_hash_t hash)
+{
+	fr_ohash_t		*oh;
+	fr_ohash_test_node_t	nodes[MAXSIZE];
+	size_t			i;
+
+	oh = fr_ohash_alloc(NULL, hash, fr_ohash_test_cmp, 0);
+	TEST_CHECK(oh != NULL);
+
+	for (i = 0; i < MAXSIZE; i++) {
+		nodes[i].num = i;
+		TEST_CHECK(fr_ohash_insert(oh, &nodes[i]));
+	}
+	TEST_CHECK(fr_ohash_num_elements(oh) == MAXSIZE);
+
+	/*
+	 *	Duplicates are rejected.
+	 */
+	for (i = 0; i < MAXSIZE; i += 7) {
+		fr_ohash_test_node_t dup = { .num = i };
+
+		TEST_CHECK(!fr_ohash_insert(oh, &dup));
+		TEST_CHECK(fr_ohash_find(oh, &dup) == &nodes[i]);
+	}
+
+	/*
+	 *	Remove every other entry, and check that the rest
+	 *	can still be found.
+	 */
+	for (i = 0; i < MAXSIZE; i += 2) {
+		TEST_CHECK(fr_ohash_remove(oh, &nodes[i]) == &nodes[i]);
+	}
+	TEST_CHECK(fr_ohash_num_elements(oh) == (MAXSIZE / 2));
+
+	for (i = 0; i < MAXSIZE; i++) {
+		TEST_MSG("Checking %zu", i);
+		if (i & 0x01) {
+			TEST_CHECK(fr_ohash_find(oh, &nodes[i]) == &nodes[i]);
+		} else {
+			TEST_CHECK(fr_ohash_find(oh, &nodes[i]) == NULL);
+			TEST_CHECK(!fr_ohash_delete(oh, &nodes[i]));
+		}
+	}
+
+	for (i = 1; i < MAXSIZE; i += 2) TEST_CHECK(fr_ohash_delete(oh, &nodes[i]));
+	TEST_CHECK(fr_ohash_num_elements(oh) == 0);
+
+	talloc_free(oh);
+}
+
+static void test_fr_ohash_insert_remove(void)
+{
+	TEST_CASE("insert and remove");
+	ohash_test_insert_remove(fr_ohash_test_hash);
+}
+
+static void test_fr_ohash_collide(void)
+{
+	TEST_CASE("insert and remove with colliding hashes");
+	ohash_test_insert_remove(fr_ohash_test_hash_collide);
+}
+
+/*
+ *	Mix inserts and removes of random entries, checking against
+ *	a simple array of which entries should be present.
+ */
+static void test_fr_ohash_random(void)
+{
+	fr_ohash_t		*oh;
+	fr_ohash_test_node_t	nodes[MAXSIZE];
+	bool			present[MAXSIZE];
+	size_t			i, num = 0;
+
+	TEST_CASE("random insert and remove");
+
+	oh = fr_ohash_alloc(NULL, fr_ohash_test_hash, fr_ohash_test_cmp, 64);
+	TEST_CHECK(oh != NULL);
+
+	for (i = 0; i < MAXSIZE; i++) {
+		nodes[i].num = i;
+		present[i] = false;
+	}
+
+	for (i = 0; i < (MAXSIZE * 16); i++) {
+		uint32_t j = fr_rand() % MAXSIZE;
+
+		if (present[j]) {
+			TEST_CHECK(fr_ohash_delete(oh, &nodes[j]));
+			present[j] = false;
+			num--;
+		} else {
+			TEST_CHECK(fr_ohash_insert(oh, &nodes[j]));
+			present[j] = true;
+			num++;
+		}
+	}
+
+	TEST_CHECK(fr_ohash_num_elements(oh) == num);
+
+	for (i = 0; i < MAXSIZE; i++) {
+		TEST_MSG("Checking %zu", i);
+		TEST_CHECK((fr_ohash_find(oh, &nodes[i]) != NULL) == present[i]);
+	}
+
+	talloc_free(oh);
+}
+
+TEST_LIST = {
+	{ "fr_ohash_insert_remove",	test_fr_ohash_insert_remove },
+	{ "fr_ohash_collide",		test_fr_ohash_collide },
+	{ "fr_ohash_random",		test_fr_ohash_random },
+
+	{ NULL }
+};
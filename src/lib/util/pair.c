@@ -57,6 +57,220 @@ void fr_pair_list_init(fr_pair_list_t *list)
 	list->verified = true;
 #endif
 	list->is_child = false;
+	list->indexed = false;
+	list->index = NULL;
+	list->lazy = NULL;
+}
+
+/** Register a callback to add pairs to a list when they're first looked for
+ *
+ * Lets a decoder defer the work of creating pairs until something
+ * asks for them.  Lookups for a specific attribute only ask the
+ * callback for that attribute.  Anything which needs to see the
+ * whole list, e.g. iterating over it, asks for everything.
+ *
+ * @param[in] list	to add pairs to.
+ * @param[in] lazy	callback and its uctx.  Must remain valid until the
+ *			callback returns 1 or -1, or the list is freed.
+ *			NULL to remove a previously registered callback.
+ */
+void fr_pair_list_lazy_set(fr_pair_list_t *list, fr_pair_list_lazy_t *lazy)
+{
+	list->lazy = lazy;
+}
+
+/** Add pairs which haven't been materialised yet to a list
+ *
+ * The list is logically const.  The pairs are considered to have
+ * been in the list all along.
+ *
+ * @param[in] list	to add pairs to.
+ * @param[in] da	to add pairs for.  NULL to add all remaining pairs.
+ * @return
+ *	- 1 if all pairs have been added.
+ *	- 0 if there are pairs of other types still to add.
+ *	- -1 on error.  The remaining pairs are discarded.
+ */
+int fr_pair_list_lazy_resolve(fr_pair_list_t const *list, fr_dict_attr_t const *da)
+{
+	fr_pair_list_t		*mlist = UNCONST(fr_pair_list_t *, list);
+	fr_pair_list_lazy_t	*lazy = list->lazy;
+	int			ret;
+
+	if (!lazy) return 1;
+
+	/*
+	 *	Stop the callback recursing when it adds pairs
+	 */
+	mlist->lazy = NULL;
+	ret = lazy->func(mlist, da, lazy->uctx);
+	if (ret == 0) mlist->lazy = lazy;
+
+	return ret;
+}
+
+/** Minimum number of pairs in a list before we build an index for it
+ *
+ * Below this, a linear search is as fast as a hash lookup.
+ */
+#define PAIR_LIST_INDEX_MIN	16
+
+/** An entry in a pair list index
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< NULL if the slot is unused.
+	fr_pair_t		*vp;		//!< First pair in the list with this da.
+						///< NULL if there are no longer any.
+} fr_pair_list_index_slot_t;
+
+/** Open addressed hash table mapping attributes to the first pair in the list with that attribute
+ *
+ * The index is only ever a cache.  Any change to the list which we can't
+ * cheaply reflect in the index frees it, and it's rebuilt on the next lookup.
+ */
+struct fr_pair_list_index_s {
+	uint32_t			mask;		//!< Number of slots - 1.
+	uint32_t			used;		//!< Number of slots with a da.
+	fr_pair_list_index_slot_t	slot[];		//!< The slots.
+};
+
+static inline CC_HINT(always_inline) uint32_t pair_list_index_hash(fr_dict_attr_t const *da)
+{
+	uint64_t h = (uintptr_t)da;
+
+	h *= UINT64_C(0x9e3779b97f4a7c15);
+
+	return (uint32_t)(h >> 32);
+}
+
+/** Find the slot for a da, or the unused slot where it would go
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_pair_list_index_slot_t *pair_list_index_slot(fr_pair_list_index_t *index, fr_dict_attr_t const *da)
+{
+	uint32_t i = pair_list_index_hash(da) & index->mask;
+
+	while (index->slot[i].da && (index->slot[i].da != da)) i = (i + 1) & index->mask;
+
+	return &index->slot[i];
+}
+
+/** Allow an index to be built for a list of pairs
+ *
+ * The index is built the first time #fr_pair_find_by_da is called on the
+ * list, if the list is large enough.  It's then kept up to date by the
+ * functions which insert and remove pairs, or thrown away on bulk edits.
+ *
+ * The index is allocated in the context of the pair that owns the list,
+ * so only lists which are children of a pair can be indexed.  Lists which
+ * may be searched by multiple threads, or which live in read-only memory,
+ * must not be indexed.
+ *
+ * @param[in] list	to enable indexing for.
+ */
+void fr_pair_list_index_enable(fr_pair_list_t *list)
+{
+	if (!list->is_child) return;
+
+	list->indexed = true;
+}
+
+/** Throw away the index for a list
+ *
+ * @param[in] list	whose index is now out of date.
+ */
+void fr_pair_list_index_clear(fr_pair_list_t *list)
+{
+	TALLOC_FREE(list->index);
+}
+
+/** Update the index for a pair which is about to be removed from a list
+ *
+ * @param[in] list	the pair is being removed from.
+ * @param[in] vp	being removed.
+ */
+void fr_pair_list_index_remove(fr_pair_list_t *list, fr_pair_t const *vp)
+{
+	fr_pair_list_index_slot_t *slot;
+
+	if (!list->index || !vp->da) return;
+
+	/*
+	 *	Finding the next pair with the same da means
+	 *	scanning the list, so we leave that until
+	 *	someone looks for it.
+	 */
+	slot = pair_list_index_slot(list->index, vp->da);
+	if (slot->vp == vp) fr_pair_list_index_clear(list);
+}
+
+/** Update the index for a pair which has just been inserted into a list
+ *
+ * @param[in] list	the pair was inserted into.
+ * @param[in] vp	which was inserted.
+ * @param[in] at_tail	whether the pair was inserted at the end of the list.
+ */
+static void pair_list_index_insert(fr_pair_list_t *list, fr_pair_t *vp, bool at_tail)
+{
+	fr_pair_list_index_slot_t *slot;
+
+	if (!list->index) return;
+
+	slot = pair_list_index_slot(list->index, vp->da);
+	if (slot->vp) {
+		/*
+		 *	There's already a pair with this da.  If
+		 *	the new one went at the end, it's not the
+		 *	first.  Otherwise it may be.
+		 */
+		if (!at_tail) fr_pair_list_index_clear(list);
+		return;
+	}
+
+	if (!slot->da) {
+		/*
+		 *	Keep the table at most half full.
+		 */
+		if (((list->index->used + 1) * 2) > (list->index->mask + 1)) {
+			fr_pair_list_index_clear(list);
+			return;
+		}
+		slot->da = vp->da;
+		list->index->used++;
+	}
+	slot->vp = vp;
+}
+
+/** Build the index for a list
+ *
+ */
+static fr_pair_list_index_t *pair_list_index_build(fr_pair_list_t *list)
+{
+	fr_pair_list_index_t	*index;
+	size_t			num = fr_pair_list_num_elements(list);
+	uint32_t		size = 16;
+
+	while (size < (num * 4)) size <<= 1;
+
+	index = talloc_zero_size(fr_pair_list_parent(list),
+				 sizeof(fr_pair_list_index_t) + (sizeof(fr_pair_list_index_slot_t) * size));
+	if (!index) return NULL;
+	talloc_set_name_const(index, "fr_pair_list_index_t");
+	index->mask = size - 1;
+
+	fr_pair_list_foreach(list, vp) {
+		fr_pair_list_index_slot_t *slot = pair_list_index_slot(index, vp->da);
+
+		if (slot->da) continue;
+
+		slot->da = vp->da;
+		slot->vp = vp;
+		index->used++;
+	}
+
+	return list->index = index;
 }
 
 /** Free a fr_pair_t
@@ -180,6 +394,39 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 	return vp;
 }
 
+/** Allocate a pair with space reserved for a short string or octets value
+ *
+ * Value buffers of up to #FR_VALUE_BOX_INLINE_SIZE bytes which are
+ * parented by the pair are then carved from the pair's own chunk, so
+ * common short values like User-Name need no extra malloc, and sit
+ * next to the pair in memory.  Longer values fall back to a normal
+ * allocation.
+ *
+ * @param[in] ctx	to allocate the pair in.
+ * @param[in] type	the pair will hold.
+ * @return
+ *	- A new #fr_pair_t.
+ *	- NULL if an error occurred.
+ */
+static inline CC_HINT(always_inline) fr_pair_t *pair_alloc_by_type(TALLOC_CTX *ctx, fr_type_t type)
+{
+	fr_pair_t *vp;
+
+	if (!fr_type_is_variable_size(type)) return fr_pair_alloc_null(ctx);
+
+	vp = talloc_pooled_object(ctx, fr_pair_t, 1, FR_VALUE_BOX_INLINE_SIZE);
+	if (!vp) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	memset(vp, 0, sizeof(*vp));
+	talloc_set_destructor(vp, _fr_pair_free);
+
+	pair_init_null(vp);
+
+	return vp;
+}
+
 /** Continue initialising an fr_pair_t assigning a da
  *
  * @note Internal use by the pair allocation functions only.
@@ -284,11 +531,8 @@ fr_pair_t *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 {
 	fr_pair_t *vp;
 
-	vp = fr_pair_alloc_null(ctx);
-	if (!vp) {
-		fr_strerror_printf("Out of memory");
-		return NULL;
-	}
+	vp = pair_alloc_by_type(ctx, da->type);
+	if (!vp) return NULL;
 
 	/*
 	 *	If we get passed an unknown da, we need to ensure that
@@ -330,6 +574,11 @@ int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t c
 		fr_value_box_init(&vp->data, da->type, da, false);
 	}
 
+	/*
+	 *	The index entry for the old da may point to this pair.
+	 */
+	if (list && list->index) fr_pair_list_index_clear(list);
+
 	to_free = vp->da;
 	vp->da = da;
 
@@ -476,17 +725,15 @@ fr_pair_t *fr_pair_afrom_da_nested(TALLOC_CTX *ctx, fr_pair_list_t *list, fr_dic
 	return fr_pair_afrom_da_depth_nested(ctx, list, da, 0);
 }
 
-/** Copy a single valuepair
+/** Minimum length of a string or octets value before a shared copy references it
  *
- * Allocate a new valuepair and copy the da from the old vp.
- *
- * @param[in] ctx for talloc
- * @param[in] vp to copy.
- * @return
- *	- A copy of the input VP.
- *	- NULL on error.
+ * Below this, copying the value is cheaper than the talloc reference.
  */
-fr_pair_t *fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp)
+#define PAIR_COPY_SHARED_MIN	64
+
+static int pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from, bool shared);
+
+static fr_pair_t *pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp, bool shared)
 {
 	fr_pair_t *n;
 
@@ -501,11 +748,19 @@ fr_pair_t *fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp)
 	 *	Groups are special.
 	 */
 	if (fr_type_is_structural(n->vp_type)) {
-		if (fr_pair_list_copy(n, &n->vp_group, &vp->vp_group) < 0) {
+		if (pair_list_copy(n, &n->vp_group, &vp->vp_group, shared) < 0) {
 			talloc_free(n);
 			return NULL;
 		}
 
+	/*
+	 *	Secrets are never shared, as they're wiped
+	 *	when the pair holding them is freed.
+	 */
+	} else if (shared && fr_type_is_variable_size(vp->vp_type) && !vp->data.secret &&
+		   vp->vp_ptr && (vp->vp_length >= PAIR_COPY_SHARED_MIN)) {
+		fr_value_box_copy_shallow(n, &n->data, &vp->data);
+
 	} else {
 		fr_value_box_copy(n, &n->data, &vp->data);
 	}
@@ -513,6 +768,36 @@ fr_pair_t *fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp)
 	return n;
 }
 
+/** Copy a single valuepair
+ *
+ * Allocate a new valuepair and copy the da from the old vp.
+ *
+ * @param[in] ctx for talloc
+ * @param[in] vp to copy.
+ * @return
+ *	- A copy of the input VP.
+ *	- NULL on error.
+ */
+fr_pair_t *fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp)
+{
+	return pair_copy(ctx, vp, false);
+}
+
+/** Copy a single valuepair, sharing large value buffers with the original
+ *
+ * @note See #fr_pair_list_copy_shared for restrictions.
+ *
+ * @param[in] ctx for talloc
+ * @param[in] vp to copy.
+ * @return
+ *	- A copy of the input VP.
+ *	- NULL on error.
+ */
+fr_pair_t *fr_pair_copy_shared(TALLOC_CTX *ctx, fr_pair_t const *vp)
+{
+	return pair_copy(ctx, vp, true);
+}
+
 /** Steal one VP
  *
  * @param[in] ctx to move fr_pair_t into
@@ -672,9 +957,9 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
 	fr_pair_t	*vp = NULL;
 	unsigned int	count = 0;
 
-	if (fr_pair_list_empty(list)) return 0;
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_resolve(list, da);
 
-	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) count++;
+	while ((vp = fr_pair_order_list_next(&list->order, vp))) if (da == vp->da) count++;
 
 	return count;
 }
@@ -694,11 +979,46 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
 {
 	fr_pair_t *vp = UNCONST(fr_pair_t *, prev);
 
-	if (fr_pair_list_empty(list)) return NULL;
+	/*
+	 *	Only the pairs we're looking for need to be
+	 *	added, so we avoid the list functions which
+	 *	would add all of them.
+	 */
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_resolve(list, da);
+
+	if (fr_pair_order_list_empty(&list->order)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
-	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
+	/*
+	 *	The index is built from the whole list, so
+	 *	wait until all the pairs have been added.
+	 */
+	if (!prev && list->indexed && !list->lazy) {
+		fr_pair_list_t			*mlist = UNCONST(fr_pair_list_t *, list);
+		fr_pair_list_index_t		*index = list->index;
+		fr_pair_list_index_slot_t	*slot;
+
+		if (!index && (fr_pair_list_num_elements(list) >= PAIR_LIST_INDEX_MIN)) {
+			index = pair_list_index_build(mlist);
+		}
+
+		if (index) {
+			slot = pair_list_index_slot(index, da);
+			if (!slot->da) return NULL;
+
+			/*
+			 *	Check the entry is still valid, in case
+			 *	the list was changed behind our back.
+			 */
+			if (!slot->vp ||
+			    ((slot->vp->da == da) && (fr_pair_parent_list(slot->vp) == list))) return slot->vp;
+
+			fr_pair_list_index_clear(mlist);
+		}
+	}
+
+	while ((vp = fr_pair_order_list_next(&list->order, vp))) if (da == vp->da) return vp;
 
 	return NULL;
 }
@@ -742,11 +1062,13 @@ fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t con
 {
 	fr_pair_t *vp = NULL;
 
-	if (fr_pair_list_empty(list)) return NULL;
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_resolve(list, da);
+
+	if (fr_pair_order_list_empty(&list->order)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
-	while ((vp = fr_pair_list_next(list, vp))) {
+	while ((vp = fr_pair_order_list_next(&list->order, vp))) {
 		if (da != vp->da) continue;
 
 		if (idx == 0) return vp;
@@ -981,6 +1303,7 @@ static int _pair_list_dcursor_insert(fr_dlist_head_t *list, void *to_insert, UNU
 	 *	Mark the pair as inserted into the list.
 	 */
 	fr_pair_order_list_set_head(tlist, vp);
+	pair_list_index_insert(fr_pair_list_from_dlist(list), vp, false);
 
 	PAIR_VERIFY(vp);
 
@@ -1014,6 +1337,8 @@ static int _pair_list_dcursor_remove(NDEBUG_UNUSED fr_dlist_head_t *list, void *
 	parent = fr_pair_parent_list(vp);
 #endif
 
+	if (parent && parent->index) fr_pair_list_index_remove(parent, vp);
+
 	/*
 	 *	Mark the pair as removed from the list.
 	 */
@@ -1104,6 +1429,32 @@ fr_pair_t *_fr_pair_dcursor_iter_init(fr_dcursor_t *cursor, fr_pair_list_t const
 				      fr_dcursor_iter_t iter, void const *uctx,
 				      bool is_const)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
+	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
+				iter, NULL, uctx,
+				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
+}
+
+/** Initialises a special dcursor with an iterator which only returns pairs of a given type
+ *
+ * @param[out] cursor	to initialise.
+ * @param[in] list	to iterate over.
+ * @param[in] iter	Iterator to use when filtering pairs.
+ * @param[in] uctx	To pass to iterator.
+ * @param[in] da	the iterator filters on.  NULL if it may return pairs of any type.
+ * @param[in] is_const	whether the fr_pair_list_t is const.
+ * @return
+ *	- NULL if src does not point to any items.
+ *	- The first pair in the list.
+ */
+fr_pair_t *_fr_pair_dcursor_iter_by_da_init(fr_dcursor_t *cursor, fr_pair_list_t const *list,
+					    fr_dcursor_iter_t iter, void const *uctx,
+					    fr_dict_attr_t const *da,
+					    bool is_const)
+{
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_resolve(list, da);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				iter, NULL, uctx,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1125,6 +1476,8 @@ fr_pair_t *_fr_pair_dcursor_iter_init(fr_dcursor_t *cursor, fr_pair_list_t const
 fr_pair_t *_fr_pair_dcursor_init(fr_dcursor_t *cursor, fr_pair_list_t const *list,
 				 bool is_const)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				NULL, NULL, NULL,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1144,6 +1497,8 @@ fr_pair_t *_fr_pair_dcursor_by_da_init(fr_dcursor_t *cursor,
 				        fr_pair_list_t const *list, fr_dict_attr_t const *da,
 				        bool is_const)
 {
+	if (unlikely(list->lazy != NULL)) (void) fr_pair_list_lazy_resolve(list, da);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				fr_pair_iter_next_by_da, NULL, da,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1182,6 +1537,8 @@ fr_pair_t *_fr_pair_dcursor_by_ancestor_init(fr_dcursor_t *cursor,
 					_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
 	}
 
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return _fr_dcursor_init(cursor, fr_pair_order_list_dlist_head(&list->order),
 				fr_pair_iter_next_by_ancestor, NULL, da,
 				_pair_list_dcursor_insert, _pair_list_dcursor_remove, list, is_const);
@@ -1326,6 +1683,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_head(&list->order, to_add);
+	pair_list_index_insert(list, to_add, false);
 
 	return 0;
 }
@@ -1357,6 +1715,7 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_tail(&list->order, to_add);
+	pair_list_index_insert(list, to_add, true);
 
 	return 0;
 }
@@ -1390,6 +1749,7 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 	}
 
 	fr_pair_order_list_insert_after(&list->order, pos, to_add);
+	pair_list_index_insert(list, to_add, false);
 
 	return 0;
 }
@@ -1424,6 +1784,7 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 	}
 
 	fr_pair_order_list_insert_before(&list->order, pos, to_add);
+	pair_list_index_insert(list, to_add, false);
 
 	return 0;
 }
@@ -2317,6 +2678,36 @@ void fr_pair_list_steal(TALLOC_CTX *ctx, fr_pair_list_t *list)
  *	- -1 on error.
  */
 int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from)
+{
+	return pair_list_copy(ctx, to, from, false);
+}
+
+/** Duplicate a list of pairs, sharing large value buffers with the originals
+ *
+ * String and octets values of #PAIR_COPY_SHARED_MIN bytes or more are not
+ * copied.  The new pairs hold a talloc reference to the original buffer
+ * instead, and get their own copy of it only if the value is reallocated or
+ * appended to.  Assigning a new value to either pair leaves the other alone.
+ *
+ * @note talloc references are not thread safe, and add to the referenced
+ *	chunk.  Only use this when both lists belong to the same thread, and
+ *	'from' is not in protected memory, e.g. copying between a request and
+ *	its subrequests.  Use #fr_pair_list_copy otherwise.
+ *
+ * @param[in] ctx	for new #fr_pair_t (s) to be allocated in.
+ * @param[in] to	where to copy attributes to.
+ * @param[in] from	whence to copy #fr_pair_t (s).
+ * @return
+ *	- >0 the number of attributes copied.
+ *	- 0 if no attributes copied.
+ *	- -1 on error.
+ */
+int fr_pair_list_copy_shared(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from)
+{
+	return pair_list_copy(ctx, to, from, true);
+}
+
+static int pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from, bool shared)
 {
 	fr_pair_t	*new_vp, *first_added = NULL;
 	int		cnt = 0;
@@ -2325,8 +2716,9 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const
 		cnt++;
 		PAIR_VERIFY_WITH_LIST(from, vp);
 
-		new_vp = fr_pair_copy(ctx, vp);
+		new_vp = pair_copy(ctx, vp, shared);
 		if (!new_vp) {
+			if (to->index) fr_pair_list_index_clear(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -2426,6 +2818,7 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, fr_pair_list_t *to,
 		cnt++;
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			if (to->index) fr_pair_list_index_clear(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -3220,6 +3613,7 @@ void fr_pair_verify(char const *file, int line, fr_pair_list_t const *list, fr_p
 		TALLOC_CTX *parent;
 
 		if (!vp->vp_octets) break;	/* We might be in the middle of initialisation */
+		if (vp->data.borrowed) break;	/* Points into someone else's buffer */
 
 		if (!talloc_get_type(vp->vp_ptr, uint8_t)) {
 			fr_fatal_assert_fail("CONSISTENCY CHECK FAILED %s[%d]: fr_pair_t \"%s\" data buffer type should be "
@@ -3248,6 +3642,7 @@ void fr_pair_verify(char const *file, int line, fr_pair_list_t const *list, fr_p
 		TALLOC_CTX *parent;
 
 		if (!vp->vp_octets) break;	/* We might be in the middle of initialisation */
+		if (vp->data.borrowed) break;	/* Interned, or points into someone else's buffer */
 
 		if (!talloc_get_type(vp->vp_ptr, char)) {
 			fr_fatal_assert_fail("CONSISTENCY CHECK FAILED %s[%d]: fr_pair_t \"%s\" data buffer type should be "
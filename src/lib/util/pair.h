@@ -49,15 +49,48 @@ typedef struct value_pair_s fr_pair_t;
 
 FR_TLIST_TYPES(fr_pair_order_list)
 
-typedef struct pair_list_s {
+typedef struct fr_pair_list_index_s fr_pair_list_index_t;
+
+/** Materialise pairs which have not yet been added to a list
+ *
+ * Called with the lazy callbacks for the list disabled, so the callback
+ * may use the normal functions to add pairs to the list.
+ *
+ * @param[in] list	to add pairs to.
+ * @param[in] da	the caller is interested in.  Pairs of other types
+ *			may be left for later.  NULL means add all remaining pairs.
+ * @param[in] uctx	as passed to #fr_pair_list_lazy_set.
+ * @return
+ *	- 1 if there are no more pairs to add.
+ *	- 0 if there are pairs still to add.
+ *	- -1 on error.  No more pairs will be added.
+ */
+typedef int (*fr_pair_list_lazy_func_t)(fr_pair_list_t *list, fr_dict_attr_t const *da, void *uctx);
+
+/** Pairs which will be added to a list the first time they're looked for
+ *
+ */
+typedef struct {
+	fr_pair_list_lazy_func_t	func;		//!< To materialise pairs with.
+	void				*uctx;		//!< Passed to func.
+} fr_pair_list_lazy_t;
+
+struct pair_list_s {
         FR_TLIST_HEAD(fr_pair_order_list)	order;			//!< Maintains the relative order of pairs in a list.
 
+	fr_pair_list_index_t		* _CONST index;			//!< Maps a da to the first pair with that da.
+									///< Built on demand by #fr_pair_find_by_da.
+
+	fr_pair_list_lazy_t		* _CONST lazy;			//!< Pairs which haven't been added yet.
+									///< See #fr_pair_list_lazy_set.
+
 	bool				 _CONST is_child;		//!< is a child of a VP
+	bool				 _CONST indexed;		//!< May build an index, see #fr_pair_list_index_enable.
 
 #ifdef WITH_VERIFY_PTR
 	unsigned int		verified : 1;				//!< hack to avoid O(N^3) issues
 #endif
-} fr_pair_list_t;
+};
 
 /** Stores an attribute, a value and various bits of other data
  *
@@ -436,6 +469,26 @@ do { \
 /** @hidecallergraph */
 void fr_pair_list_init(fr_pair_list_t *head) CC_HINT(nonnull);
 
+void fr_pair_list_index_enable(fr_pair_list_t *list) CC_HINT(nonnull);
+
+/** @hidecallergraph */
+void fr_pair_list_index_clear(fr_pair_list_t *list) CC_HINT(nonnull);
+
+/** @hidecallergraph */
+void fr_pair_list_index_remove(fr_pair_list_t *list, fr_pair_t const *vp) CC_HINT(nonnull);
+
+void fr_pair_list_lazy_set(fr_pair_list_t *list, fr_pair_list_lazy_t *lazy) CC_HINT(nonnull(1));
+
+int fr_pair_list_lazy_resolve(fr_pair_list_t const *list, fr_dict_attr_t const *da) CC_HINT(nonnull(1));
+
+/** Add any pairs which haven't been materialised yet
+ *
+ * Used by functions which need to see the whole list.
+ */
+#define PAIR_LIST_LAZY_RESOLVE(_list) do { \
+	if (unlikely((_list)->lazy != NULL)) (void) fr_pair_list_lazy_resolve(_list, NULL); \
+} while (0)
+
 void fr_pair_init_null(fr_pair_t *vp) CC_HINT(nonnull);
 
 /* Allocation and management */
@@ -459,6 +512,8 @@ fr_pair_t	*fr_pair_afrom_da_depth_nested(TALLOC_CTX *ctx, fr_pair_list_t *list,
 
 fr_pair_t	*fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp) CC_HINT(nonnull(2)) CC_HINT(warn_unused_result);
 
+fr_pair_t	*fr_pair_copy_shared(TALLOC_CTX *ctx, fr_pair_t const *vp) CC_HINT(nonnull(2)) CC_HINT(warn_unused_result);
+
 int		fr_pair_steal(TALLOC_CTX *ctx, fr_pair_t *vp) CC_HINT(nonnull);
 
 int		fr_pair_steal_append(TALLOC_CTX *nctx, fr_pair_list_t *list, fr_pair_t *vp) CC_HINT(nonnull);
@@ -576,6 +631,32 @@ fr_pair_t	*_fr_pair_dcursor_iter_init(fr_dcursor_t *cursor, fr_pair_list_t const
 					    fr_dcursor_iter_t iter, void const *uctx,
 					    bool is_const) CC_HINT(nonnull);
 
+/** Initialises a special dcursor with an iterator which only returns pairs of a given type
+ *
+ * As #fr_pair_dcursor_iter_init, but if the list has pairs which haven't
+ * been materialised yet, only those matching _da are added to the list.
+ *
+ * @param[in] _cursor	to initialise.
+ * @param[in] _list	to iterate over.
+ * @param[in] _iter	Iterator to use when filtering pairs.
+ * @param[in] _uctx	To pass to iterator.
+ * @param[in] _da	the iterator filters on.  NULL if it may return pairs of any type.
+ * @return
+ *	- NULL if src does not point to any items.
+ *	- The first pair in the list.
+ */
+#define		fr_pair_dcursor_iter_by_da_init(_cursor, _list, _iter, _uctx, _da) \
+		_fr_pair_dcursor_iter_by_da_init(_cursor, \
+						 _list, \
+						 _iter, \
+						 _uctx, \
+						 _da, \
+						 IS_CONST(fr_pair_list_t *, _list))
+fr_pair_t	*_fr_pair_dcursor_iter_by_da_init(fr_dcursor_t *cursor, fr_pair_list_t const *list,
+						  fr_dcursor_iter_t iter, void const *uctx,
+						  fr_dict_attr_t const *da,
+						  bool is_const) CC_HINT(nonnull(1,2,3));
+
 /** Initialises a special dcursor with callbacks that will maintain the attr sublists correctly
  *
  * Filters can be applied later with fr_dcursor_filter_set.
@@ -700,6 +781,8 @@ void fr_pair_clear_immutable(fr_pair_t *vp)
 /* Lists */
 int		fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from);
 
+int		fr_pair_list_copy_shared(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from);
+
 void		fr_pair_list_steal(TALLOC_CTX *ctx, fr_pair_list_t *list);
 
 int		fr_pair_list_copy_to_box(fr_value_box_t *dst, fr_pair_list_t *from);
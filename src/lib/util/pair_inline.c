@@ -42,6 +42,8 @@ FR_TLIST_FUNCS(fr_pair_order_list, fr_pair_t, order_entry)
  */
 _INLINE fr_pair_t *fr_pair_list_head(fr_pair_list_t const *list)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_head(&list->order);
 }
 
@@ -55,6 +57,8 @@ _INLINE fr_pair_t *fr_pair_list_head(fr_pair_list_t const *list)
  */
 _INLINE fr_pair_t *fr_pair_list_tail(fr_pair_list_t const *list)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_tail(&list->order);
 }
 
@@ -69,6 +73,8 @@ _INLINE fr_pair_t *fr_pair_list_tail(fr_pair_list_t const *list)
  */
 _INLINE fr_pair_t *fr_pair_list_next(fr_pair_list_t const *list, fr_pair_t const *item)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_next(&list->order, item);
 }
 
@@ -82,6 +88,8 @@ _INLINE fr_pair_t *fr_pair_list_next(fr_pair_list_t const *list, fr_pair_t const
  */
 _INLINE fr_pair_t *fr_pair_list_prev(fr_pair_list_t const *list, fr_pair_t const *item)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_prev(&list->order, item);
 }
 
@@ -103,6 +111,8 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 	list->verified = false;
 #endif
 
+	if (list->index) fr_pair_list_index_remove(list, vp);
+
 	return fr_pair_order_list_remove(&list->order, vp);
 }
 
@@ -112,6 +122,9 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
  */
 _INLINE void fr_pair_list_free(fr_pair_list_t *list)
 {
+	if (list->index) fr_pair_list_index_clear(list);
+	list->lazy = NULL;
+
 	fr_pair_order_list_talloc_free(&list->order);
 }
 
@@ -124,6 +137,8 @@ _INLINE void fr_pair_list_free(fr_pair_list_t *list)
  */
 _INLINE bool fr_pair_list_empty(fr_pair_list_t const *list)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_empty(&list->order);
 }
 
@@ -139,6 +154,10 @@ _INLINE bool fr_pair_list_empty(fr_pair_list_t const *list)
  */
 _INLINE void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
+	if (list->index) fr_pair_list_index_clear(list);
+
 	fr_pair_order_list_sort(&list->order, cmp);
 }
 
@@ -150,6 +169,8 @@ _INLINE void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
  */
 _INLINE size_t fr_pair_list_num_elements(fr_pair_list_t const *list)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_num_elements(&list->order);
 }
 
@@ -161,6 +182,8 @@ _INLINE size_t fr_pair_list_num_elements(fr_pair_list_t const *list)
  */
 _INLINE fr_dlist_head_t *fr_pair_list_to_dlist(fr_pair_list_t const *list)
 {
+	PAIR_LIST_LAZY_RESOLVE(list);
+
 	return fr_pair_order_list_dlist_head(&list->order);
 }
 
@@ -184,6 +207,12 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 #ifdef WITH_VERIFY_POINTER
 	dst->verified = false;
 #endif
+	PAIR_LIST_LAZY_RESOLVE(dst);
+	PAIR_LIST_LAZY_RESOLVE(src);
+
+	if (dst->index) fr_pair_list_index_clear(dst);
+	if (src->index) fr_pair_list_index_clear(src);
+
 	fr_pair_order_list_move(&dst->order, &src->order);
 }
 
@@ -194,5 +223,11 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
  */
 _INLINE void fr_pair_list_prepend(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
+	PAIR_LIST_LAZY_RESOLVE(dst);
+	PAIR_LIST_LAZY_RESOLVE(src);
+
+	if (dst->index) fr_pair_list_index_clear(dst);
+	if (src->index) fr_pair_list_index_clear(src);
+
 	fr_pair_order_list_move_head(&dst->order, &src->order);
 }
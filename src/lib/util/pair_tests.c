@@ -45,6 +45,7 @@ static void test_init(void);
 
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/intern.h>
 
 #ifdef HAVE_GPERFTOOLS_PROFILER_H
 #  include <gperftools/profiler.h>
@@ -371,6 +372,121 @@ static void test_fr_pair_find_by_da_idx(void)
 	TEST_CHECK(vp && vp->da == fr_dict_attr_test_string);
 }
 
+static void test_fr_pair_find_by_da_indexed(void)
+{
+	fr_pair_t	*group, *vp, *first, *second;
+	fr_pair_list_t	*list;
+	int		i;
+
+	TEST_CASE("Build a large indexed list");
+	TEST_CHECK((group = fr_pair_afrom_da(autofree, fr_dict_attr_test_group)) != NULL);
+	if (!group) return;
+	list = &group->vp_group;
+	fr_pair_list_index_enable(list);
+
+	for (i = 0; i < 32; i++) {
+		TEST_CHECK(fr_pair_append_by_da(group, &vp, list, fr_dict_attr_test_uint32) == 0);
+		vp->vp_uint32 = i;
+	}
+
+	TEST_CASE("Attributes which are not in the list are not found");
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == NULL);
+	TEST_CHECK(list->index != NULL);
+
+	TEST_CASE("Appending a new attribute updates the index");
+	TEST_CHECK(fr_pair_append_by_da(group, &second, list, fr_dict_attr_test_string) == 0);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == second);
+
+	TEST_CASE("Prepending an attribute which is already present returns the new first pair");
+	TEST_CHECK((first = fr_pair_afrom_da(group, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK(fr_pair_prepend(list, first) == 0);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == first);
+
+	TEST_CASE("Removing the first pair returns the next one");
+	fr_pair_remove(list, first);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == second);
+
+	TEST_CASE("The first of many pairs with the same da is returned");
+	TEST_CHECK((vp = fr_pair_find_by_da(list, NULL, fr_dict_attr_test_uint32)) != NULL);
+	TEST_CHECK(vp && (vp->vp_uint32 == 0));
+
+	TEST_CASE("Removing all pairs with the da means it's not found");
+	fr_pair_delete_by_da(list, fr_dict_attr_test_string);
+	TEST_CHECK(fr_pair_find_by_da(list, NULL, fr_dict_attr_test_string) == NULL);
+
+	talloc_free(group);
+}
+
+typedef struct {
+	TALLOC_CTX	*ctx;
+	bool		string_done;
+	bool		uint32_done;
+	unsigned int	calls;
+} pair_lazy_test_t;
+
+static int _pair_lazy_test_func(fr_pair_list_t *list, fr_dict_attr_t const *da, void *uctx)
+{
+	pair_lazy_test_t	*t = uctx;
+	fr_pair_t		*vp;
+
+	t->calls++;
+
+	/*
+	 *	The list must look complete while we're adding to it
+	 */
+	if (list->lazy) return -1;
+
+	if ((!da || (da == fr_dict_attr_test_string)) && !t->string_done) {
+		if (fr_pair_append_by_da(t->ctx, &vp, list, fr_dict_attr_test_string) < 0) return -1;
+		t->string_done = true;
+	}
+
+	if ((!da || (da == fr_dict_attr_test_uint32)) && !t->uint32_done) {
+		if (fr_pair_append_by_da(t->ctx, &vp, list, fr_dict_attr_test_uint32) < 0) return -1;
+		vp->vp_uint32 = 42;
+		if (fr_pair_append_by_da(t->ctx, &vp, list, fr_dict_attr_test_uint32) < 0) return -1;
+		vp->vp_uint32 = 43;
+		t->uint32_done = true;
+	}
+
+	return (t->string_done && t->uint32_done) ? 1 : 0;
+}
+
+static void test_fr_pair_list_lazy(void)
+{
+	fr_pair_list_t		list;
+	fr_pair_list_lazy_t	lazy;
+	pair_lazy_test_t	t = { .ctx = autofree };
+	fr_pair_t		*vp;
+
+	fr_pair_list_init(&list);
+	lazy = (fr_pair_list_lazy_t){ .func = _pair_lazy_test_func, .uctx = &t };
+	fr_pair_list_lazy_set(&list, &lazy);
+
+	TEST_CASE("Looking for one attribute only adds that attribute");
+	TEST_CHECK((vp = fr_pair_find_by_da(&list, NULL, fr_dict_attr_test_uint32)) != NULL);
+	TEST_CHECK(vp && (vp->vp_uint32 == 42));
+	TEST_CHECK(t.uint32_done && !t.string_done);
+	TEST_CHECK(list.lazy == &lazy);
+
+	TEST_CASE("Attributes which have been added are not added again");
+	TEST_CHECK(fr_pair_count_by_da(&list, fr_dict_attr_test_uint32) == 2);
+	TEST_CHECK((vp = fr_pair_find_by_da_idx(&list, fr_dict_attr_test_uint32, 1)) != NULL);
+	TEST_CHECK(vp && (vp->vp_uint32 == 43));
+
+	TEST_CASE("Walking the list adds everything");
+	TEST_CHECK(fr_pair_list_num_elements(&list) == 3);
+	TEST_CHECK(t.string_done);
+	TEST_CHECK(list.lazy == NULL);
+
+	TEST_CASE("The callback isn't called once everything has been added");
+	t.calls = 0;
+	TEST_CHECK(fr_pair_find_by_da(&list, NULL, fr_dict_attr_test_string) != NULL);
+	TEST_CHECK(t.calls == 0);
+
+	fr_pair_list_free(&list);
+}
+
 static void test_fr_pair_find_by_child_num_idx(void)
 {
 	fr_pair_t *vp;
@@ -706,6 +822,42 @@ static void test_fr_pair_list_copy(void)
 	fr_pair_list_free(&local_pairs);
 }
 
+static void test_fr_pair_list_copy_shared(void)
+{
+	fr_pair_t	*group, *vp, *copy;
+	fr_pair_list_t	local_pairs;
+	uint8_t		buff[128];
+
+	memset(buff, 0x5a, sizeof(buff));
+	fr_pair_list_init(&local_pairs);
+
+	TEST_CASE("Build a list with a large octets value");
+	TEST_CHECK((group = fr_pair_afrom_da(autofree, fr_dict_attr_test_group)) != NULL);
+	if (!group) return;
+	TEST_CHECK(fr_pair_append_by_da(group, &vp, &group->vp_group, fr_dict_attr_test_octets) == 0);
+	TEST_CHECK(fr_pair_value_memdup(vp, buff, sizeof(buff), false) == 0);
+
+	TEST_CASE("The copy shares the value buffer");
+	TEST_CHECK(fr_pair_list_copy_shared(autofree, &local_pairs, &group->vp_group) == 1);
+	TEST_CHECK(fr_pair_list_cmp(&local_pairs, &group->vp_group) == 0);
+	copy = fr_pair_list_head(&local_pairs);
+	TEST_CHECK(copy && (copy->vp_octets == vp->vp_octets));
+
+	TEST_CASE("Appending to the copy gives it its own buffer");
+	TEST_CHECK(fr_pair_value_mem_append(copy, buff, 1, false) == 0);
+	TEST_CHECK(copy->vp_octets != vp->vp_octets);
+	TEST_CHECK(vp->vp_length == sizeof(buff));
+
+	TEST_CASE("Freeing the original leaves the copy intact");
+	fr_pair_list_free(&local_pairs);
+	TEST_CHECK(fr_pair_list_copy_shared(autofree, &local_pairs, &group->vp_group) == 1);
+	talloc_free(group);
+	copy = fr_pair_list_head(&local_pairs);
+	TEST_CHECK(copy && (copy->vp_length == sizeof(buff)) && (memcmp(copy->vp_octets, buff, sizeof(buff)) == 0));
+
+	fr_pair_list_free(&local_pairs);
+}
+
 static void test_fr_pair_list_copy_by_da(void)
 {
 	fr_dcursor_t   cursor;
@@ -1315,6 +1467,88 @@ static void test_fr_pair_value_memdup_buffer_shallow(void)
 	talloc_free(copy_test_octets);
 }
 
+static void test_fr_pair_value_mem_borrow(void)
+{
+	fr_pair_t	*vp, *copy;
+	uint8_t		*packet;
+
+	MEM(packet = talloc_array(autofree, uint8_t, 128));
+	memset(packet, 0x5a, talloc_array_length(packet));
+
+	TEST_CASE("Borrow a region of a buffer using fr_value_box_mem_borrow()");
+	MEM(vp = fr_pair_afrom_da(autofree, fr_dict_attr_test_octets));
+	TEST_CHECK(fr_value_box_mem_borrow(vp, &vp->data, vp->da, packet, packet + 16, 64, true) == 0);
+	TEST_CHECK((vp->vp_octets == packet + 16) && (vp->vp_length == 64) && vp->data.borrowed);
+
+	TEST_CASE("Validating PAIR_VERIFY()");
+	PAIR_VERIFY(vp);
+
+	TEST_CASE("Copies get their own buffer");
+	MEM(copy = fr_pair_copy(autofree, vp));
+	TEST_CHECK((copy->vp_octets != vp->vp_octets) && !copy->data.borrowed);
+	TEST_CHECK(fr_value_box_cmp(&copy->data, &vp->data) == 0);
+	talloc_free(copy);
+
+	TEST_CASE("Appending copies the value out of the buffer");
+	TEST_CHECK(fr_pair_value_mem_append(vp, test_octets, 1, false) == 0);
+	TEST_CHECK(!vp->data.borrowed && (vp->vp_octets != packet + 16) && (vp->vp_length == 65));
+	TEST_CHECK(packet[16 + 64] == 0x5a);
+
+	TEST_CASE("The buffer outlives the pair's reference");
+	TEST_CHECK(fr_value_box_mem_borrow(vp, &vp->data, vp->da, packet, packet, 128, true) == 0);
+	talloc_free(vp);
+	TEST_CHECK(talloc_reference_count(packet) == 0);
+
+	talloc_free(packet);
+}
+
+static void test_fr_pair_value_intern(void)
+{
+	fr_pair_t	*a, *b, *copy;
+	char const	*pooled;
+
+	MEM(a = fr_pair_afrom_da(autofree, fr_dict_attr_test_string));
+	MEM(b = fr_pair_afrom_da(autofree, fr_dict_attr_test_string));
+	TEST_CHECK(fr_pair_value_strdup(a, "example.org", false) == 0);
+	TEST_CHECK(fr_pair_value_strdup(b, "example.org", false) == 0);
+
+	TEST_CASE("Interning equal strings gives the same buffer");
+	TEST_CHECK(fr_value_box_intern(&a->data) == 1);
+	TEST_CHECK(fr_value_box_intern(&b->data) == 1);
+	TEST_CHECK((a->vp_strvalue == b->vp_strvalue) && a->data.interned && b->data.borrowed);
+	TEST_CHECK((a->vp_length == 11) && (strcmp(a->vp_strvalue, "example.org") == 0));
+	TEST_CHECK(fr_value_box_cmp(&a->data, &b->data) == 0);
+
+	TEST_CASE("Validating PAIR_VERIFY()");
+	PAIR_VERIFY(a);
+
+	TEST_CASE("Copies share the pooled buffer");
+	MEM(copy = fr_pair_copy(autofree, a));
+	TEST_CHECK((copy->vp_strvalue == a->vp_strvalue) && copy->data.interned);
+	talloc_free(copy);
+
+	TEST_CASE("Appending copies the value out of the pool");
+	pooled = a->vp_strvalue;
+	TEST_CHECK(fr_pair_value_bstrn_append(a, ".uk", 3, false) == 0);
+	TEST_CHECK(!a->data.interned && !a->data.borrowed && (a->vp_strvalue != pooled));
+	TEST_CHECK(strcmp(a->vp_strvalue, "example.org.uk") == 0);
+	TEST_CHECK(strcmp(pooled, "example.org") == 0);
+	PAIR_VERIFY(a);
+
+	TEST_CASE("Strings over the length limit aren't interned");
+	{
+		char big[FR_INTERN_MAX_LEN + 2];
+
+		memset(big, 'x', sizeof(big) - 1);
+		big[sizeof(big) - 1] = '\0';
+		TEST_CHECK(fr_pair_value_strdup(a, big, false) == 0);
+		TEST_CHECK((fr_value_box_intern(&a->data) == 0) && !a->data.interned);
+	}
+
+	talloc_free(a);
+	talloc_free(b);
+}
+
 static void test_fr_pair_value_mem_append(void)
 {
 	fr_pair_t *vp;
@@ -1430,6 +1664,8 @@ TEST_LIST = {
 	{ "fr_pair_dcursor_value_init",           test_fr_pair_dcursor_value_init },
 	{ "fr_pair_raw_afrom_pair",                test_fr_pair_raw_afrom_pair },
 	{ "fr_pair_find_by_da_idx",                   test_fr_pair_find_by_da_idx },
+	{ "fr_pair_find_by_da_indexed",               test_fr_pair_find_by_da_indexed },
+	{ "fr_pair_list_lazy",                        test_fr_pair_list_lazy },
 	{ "fr_pair_find_by_child_num_idx",            test_fr_pair_find_by_child_num_idx },
 	{ "fr_pair_find_by_da_nested",            test_fr_pair_find_by_da_nested },
 	{ "fr_pair_append",                       test_fr_pair_append },
@@ -1447,6 +1683,7 @@ TEST_LIST = {
 
 	/* Lists */
 	{ "fr_pair_list_copy",                    test_fr_pair_list_copy },
+	{ "fr_pair_list_copy_shared",             test_fr_pair_list_copy_shared },
 	{ "fr_pair_list_copy_by_da",              test_fr_pair_list_copy_by_da },
 	{ "fr_pair_list_copy_by_ancestor",        test_fr_pair_list_copy_by_ancestor },
 	{ "fr_pair_list_sort",                    test_fr_pair_list_sort },
@@ -1482,6 +1719,8 @@ TEST_LIST = {
 	{ "fr_pair_value_memdup_buffer",          test_fr_pair_value_memdup_buffer },
 	{ "fr_pair_value_memdup_shallow",         test_fr_pair_value_memdup_shallow },
 	{ "fr_pair_value_memdup_buffer_shallow",  test_fr_pair_value_memdup_buffer_shallow },
+	{ "fr_pair_value_mem_borrow",             test_fr_pair_value_mem_borrow },
+	{ "fr_pair_value_intern",                 test_fr_pair_value_intern },
 	{ "fr_pair_value_mem_append",             test_fr_pair_value_mem_append },
 	{ "fr_pair_value_mem_append_buffer",      test_fr_pair_value_mem_append_buffer },
 
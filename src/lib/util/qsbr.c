@@ -0,0 +1,323 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Quiescent state based reclamation of memory shared between threads
+ *
+ * Lets a writer publish a new version of a structure, and free the old
+ * version once no reader can still be looking at it, without readers
+ * taking any locks.
+ *
+ * Reader threads register themselves, and then announce a quiescent
+ * state (a point at which they hold no references to shared data) by
+ * calling fr_qsbr_quiescent().  For workers that's once per pass of the
+ * event loop.  A thread which is about to block calls fr_qsbr_offline(),
+ * so that it doesn't hold up reclamation while it sleeps, and
+ * fr_qsbr_online() when it wakes up.
+ *
+ * A writer unlinks the old version, then passes it to fr_qsbr_retire().
+ * Each retirement advances the global epoch.  The retired memory is
+ * freed once every online thread has passed through a quiescent state
+ * at or after that epoch.
+ *
+ * Reclamation is done opportunistically by the writer, and by readers
+ * at their quiescent points if there's anything waiting to be freed.
+ *
+ * @file src/lib/util/qsbr.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/qsbr.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct fr_qsbr_thread_s fr_qsbr_thread_t;
+typedef struct fr_qsbr_retired_s fr_qsbr_retired_t;
+
+/** Per-thread state
+ *
+ */
+struct fr_qsbr_thread_s {
+	_Atomic(uint64_t)	epoch;		//!< Last epoch this thread was quiescent in.
+						///< 0 if the thread is offline.
+	fr_qsbr_thread_t	*next;		//!< Next registered thread.
+};
+
+/** Memory waiting for readers to move on
+ *
+ */
+struct fr_qsbr_retired_s {
+	void			*ptr;		//!< To free.
+	fr_qsbr_free_t		func;		//!< To free it with.  NULL means talloc_free().
+	uint64_t		epoch;		//!< Epoch the memory was retired in.
+	fr_qsbr_retired_t	*next;		//!< Next (newer) retired entry.
+};
+
+static _Atomic(uint64_t)	qsbr_epoch = 1;		//!< Global epoch.  Advanced on every retire.
+static _Atomic(uint64_t)	qsbr_num_retired = 0;	//!< So readers can cheaply check if
+							///< there's anything to reclaim.
+
+static pthread_mutex_t		qsbr_mutex = PTHREAD_MUTEX_INITIALIZER;	//!< Protects the lists below.
+static fr_qsbr_thread_t		*qsbr_threads;		//!< Registered threads.
+static fr_qsbr_retired_t	*qsbr_retired_head;	//!< Oldest retired entry.
+static fr_qsbr_retired_t	*qsbr_retired_tail;	//!< Newest retired entry.
+
+static _Thread_local fr_qsbr_thread_t *qsbr_thread;	//!< This thread's state.
+
+static unsigned int qsbr_reclaim(bool wait);
+
+/** Register the calling thread as a reader
+ *
+ * The thread starts out online.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_qsbr_thread_register(void)
+{
+	fr_qsbr_thread_t *t;
+
+	if (qsbr_thread) return 0;
+
+	t = talloc_zero(NULL, fr_qsbr_thread_t);
+	if (unlikely(!t)) {
+		fr_strerror_const("Failed allocating QSBR thread state");
+		return -1;
+	}
+	atomic_init(&t->epoch, atomic_load(&qsbr_epoch));
+
+	pthread_mutex_lock(&qsbr_mutex);
+	t->next = qsbr_threads;
+	qsbr_threads = t;
+	pthread_mutex_unlock(&qsbr_mutex);
+
+	qsbr_thread = t;
+
+	return 0;
+}
+
+/** Stop tracking the calling thread
+ *
+ * The thread must not hold any references to shared data.
+ */
+void fr_qsbr_thread_unregister(void)
+{
+	fr_qsbr_thread_t **last, *t = qsbr_thread;
+
+	if (!t) return;
+
+	pthread_mutex_lock(&qsbr_mutex);
+	for (last = &qsbr_threads; *last; last = &(*last)->next) {
+		if (*last != t) continue;
+
+		*last = t->next;
+		break;
+	}
+	pthread_mutex_unlock(&qsbr_mutex);
+
+	qsbr_thread = NULL;
+	talloc_free(t);
+
+	/*
+	 *	We may have been the thread holding things up.
+	 */
+	if (atomic_load_explicit(&qsbr_num_retired, memory_order_relaxed) > 0) fr_qsbr_reclaim();
+}
+
+/** Announce that the calling thread holds no references to shared data
+ *
+ * Cheap enough to call once per pass of an event loop.  Does nothing
+ * if the thread isn't registered.
+ */
+void fr_qsbr_quiescent(void)
+{
+	if (!qsbr_thread) return;
+
+	atomic_store_explicit(&qsbr_thread->epoch,
+			      atomic_load_explicit(&qsbr_epoch, memory_order_acquire), memory_order_release);
+
+	/*
+	 *	Only contend for the mutex if there's work to do,
+	 *	and nobody else is already doing it.
+	 */
+	if (atomic_load_explicit(&qsbr_num_retired, memory_order_relaxed) > 0) qsbr_reclaim(false);
+}
+
+/** Mark the calling thread as offline, i.e. not holding references for an extended period
+ *
+ * Call before blocking, e.g. waiting for events.
+ */
+void fr_qsbr_offline(void)
+{
+	if (!qsbr_thread) return;
+
+	atomic_store_explicit(&qsbr_thread->epoch, 0, memory_order_release);
+}
+
+/** Mark the calling thread as online again
+ *
+ * Must be called before the thread reads any shared data.
+ */
+void fr_qsbr_online(void)
+{
+	if (!qsbr_thread) return;
+
+	atomic_store(&qsbr_thread->epoch, atomic_load(&qsbr_epoch));
+
+	/*
+	 *	Our epoch must be visible to writers before
+	 *	we load any shared pointers.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/** Free memory once no reader can still be using it
+ *
+ * The caller must already have unlinked ptr from any shared structure.
+ *
+ * @param[in] ptr	to free.  If func is NULL, must be a talloc chunk
+ *			with no parent shared with other threads.
+ * @param[in] func	to free ptr with.  May be NULL, in which case
+ *			talloc_free() is used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  ptr has not been freed.
+ */
+int fr_qsbr_retire(void *ptr, fr_qsbr_free_t func)
+{
+	fr_qsbr_retired_t *r;
+
+	r = talloc(NULL, fr_qsbr_retired_t);
+	if (unlikely(!r)) {
+		fr_strerror_const("Failed allocating QSBR retired entry");
+		return -1;
+	}
+
+	*r = (fr_qsbr_retired_t){
+		.ptr = ptr,
+		.func = func
+	};
+
+	/*
+	 *	Order the unlink of ptr (done by the caller) before
+	 *	the epoch advance.  Any reader which has seen the
+	 *	new epoch can no longer see ptr.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	pthread_mutex_lock(&qsbr_mutex);
+	r->epoch = atomic_fetch_add(&qsbr_epoch, 1) + 1;
+	if (qsbr_retired_tail) {
+		qsbr_retired_tail->next = r;
+	} else {
+		qsbr_retired_head = r;
+	}
+	qsbr_retired_tail = r;
+	atomic_fetch_add_explicit(&qsbr_num_retired, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&qsbr_mutex);
+
+	qsbr_reclaim(false);
+
+	return 0;
+}
+
+/** Free any retired memory which no reader can still be using
+ *
+ * @param[in] wait	for the mutex.  If false, and another thread
+ *			holds the mutex, return immediately.
+ * @return The number of entries freed.
+ */
+static unsigned int qsbr_reclaim(bool wait)
+{
+	fr_qsbr_thread_t	*t;
+	fr_qsbr_retired_t	*r, *next, *done;
+	uint64_t		min = UINT64_MAX;
+	unsigned int		i, count = 0;
+
+	if (wait) {
+		pthread_mutex_lock(&qsbr_mutex);
+	} else if (pthread_mutex_trylock(&qsbr_mutex) != 0) {
+		return 0;
+	}
+
+	/*
+	 *	Find the oldest epoch any online thread may
+	 *	still be reading in.
+	 */
+	for (t = qsbr_threads; t; t = t->next) {
+		uint64_t epoch = atomic_load_explicit(&t->epoch, memory_order_acquire);
+
+		if (epoch && (epoch < min)) min = epoch;
+	}
+
+	/*
+	 *	The list is ordered by epoch, so stop at the
+	 *	first entry which may still be in use.
+	 */
+	done = qsbr_retired_head;
+	for (r = qsbr_retired_head; r && (r->epoch <= min); r = r->next) count++;
+
+	if (count) {
+		qsbr_retired_head = r;
+		if (!r) qsbr_retired_tail = NULL;
+		atomic_fetch_sub_explicit(&qsbr_num_retired, count, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&qsbr_mutex);
+
+	/*
+	 *	Free outside of the mutex, as free functions
+	 *	may be arbitrarily expensive.
+	 */
+	for (i = 0, r = done; i < count; i++, r = next) {
+		next = r->next;
+
+		if (r->func) {
+			r->func(r->ptr);
+		} else {
+			talloc_free(r->ptr);
+		}
+		talloc_free(r);
+	}
+
+	return count;
+}
+
+/** Free any retired memory which no reader can still be using
+ *
+ * @return The number of entries freed.
+ */
+unsigned int fr_qsbr_reclaim(void)
+{
+	return qsbr_reclaim(true);
+}
+
+/** Return the number of retired entries which have not yet been freed
+ *
+ */
+uint64_t fr_qsbr_pending(void)
+{
+	return atomic_load_explicit(&qsbr_num_retired, memory_order_relaxed);
+}
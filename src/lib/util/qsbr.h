@@ -0,0 +1,61 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Quiescent state based reclamation of memory shared between threads
+ *
+ * @file src/lib/util/qsbr.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(qsbr_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Free a retired pointer
+ *
+ * Called from whichever thread performs reclamation, so must not touch
+ * thread local state.
+ */
+typedef void (*fr_qsbr_free_t)(void *ptr);
+
+int		fr_qsbr_thread_register(void);
+
+void		fr_qsbr_thread_unregister(void);
+
+void		fr_qsbr_quiescent(void);
+
+void		fr_qsbr_offline(void);
+
+void		fr_qsbr_online(void);
+
+int		fr_qsbr_retire(void *ptr, fr_qsbr_free_t func) CC_HINT(nonnull(1));
+
+unsigned int	fr_qsbr_reclaim(void);
+
+uint64_t	fr_qsbr_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for quiescent state based reclamation
+ *
+ * @file src/lib/util/qsbr_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/qsbr.h>
+
+static unsigned int num_freed;
+
+static void test_free(UNUSED void *ptr)
+{
+	num_freed++;
+}
+
+static void test_qsbr_unregistered(void)
+{
+	int dummy;
+
+	num_freed = 0;
+
+	/*
+	 *	No readers, so nothing can be holding a reference.
+	 */
+	TEST_CHECK(fr_qsbr_retire(&dummy, test_free) == 0);
+	TEST_CHECK(num_freed == 1);
+	TEST_CHECK(fr_qsbr_pending() == 0);
+}
+
+static void test_qsbr_quiescent(void)
+{
+	int dummy[2];
+
+	num_freed = 0;
+
+	TEST_CHECK(fr_qsbr_thread_register() == 0);
+
+	TEST_CHECK(fr_qsbr_retire(&dummy[0], test_free) == 0);
+	TEST_CHECK(fr_qsbr_retire(&dummy[1], test_free) == 0);
+	TEST_MSG("Expected nothing freed before the reader is quiescent, got %u", num_freed);
+	TEST_CHECK(num_freed == 0);
+	TEST_CHECK(fr_qsbr_pending() == 2);
+
+	fr_qsbr_quiescent();
+	TEST_CHECK(num_freed == 2);
+	TEST_CHECK(fr_qsbr_pending() == 0);
+
+	fr_qsbr_thread_unregister();
+}
+
+static void test_qsbr_offline(void)
+{
+	int dummy[2];
+
+	num_freed = 0;
+
+	TEST_CHECK(fr_qsbr_thread_register() == 0);
+
+	/*
+	 *	Offline readers don't hold up reclamation.
+	 */
+	fr_qsbr_offline();
+	TEST_CHECK(fr_qsbr_retire(&dummy[0], test_free) == 0);
+	TEST_CHECK(num_freed == 1);
+
+	/*
+	 *	...but online ones do.
+	 */
+	fr_qsbr_online();
+	TEST_CHECK(fr_qsbr_retire(&dummy[1], test_free) == 0);
+	TEST_CHECK(num_freed == 1);
+
+	/*
+	 *	Unregistering implies the thread is done.
+	 */
+	fr_qsbr_thread_unregister();
+	TEST_CHECK(num_freed == 2);
+	TEST_CHECK(fr_qsbr_pending() == 0);
+}
+
+TEST_LIST = {
+	{ "fr_qsbr_unregistered",	test_qsbr_unregistered },
+	{ "fr_qsbr_quiescent",		test_qsbr_quiescent },
+	{ "fr_qsbr_offline",		test_qsbr_offline },
+
+	{ NULL }
+};
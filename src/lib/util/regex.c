@@ -27,6 +27,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/regex.h>
 #include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/hash.h>
 
 #if defined(HAVE_REGEX_PCRE) || (defined(HAVE_REGEX_PCRE2) && defined(PCRE2_CONFIG_JIT))
 #ifndef FR_PCRE_JIT_STACK_MIN
@@ -49,6 +50,28 @@ RCSID("$Id$")
  *	libpcre2.
  */
 
+#ifndef FR_REGEX_CACHE_SIZE
+#  define FR_REGEX_CACHE_SIZE	256		//!< Maximum number of runtime expressions cached per thread.
+#endif
+
+/** A runtime expression, compiled once and shared by later compilations of the same pattern
+ *
+ */
+struct fr_regex_cache_entry_s {
+	char			*pattern;	//!< The uncompiled expression.
+	size_t			len;		//!< Length of pattern.
+	uint32_t		cflags;		//!< Flags the expression was compiled with.
+
+	pcre2_code		*compiled;	//!< Compiled regular expression.
+	bool			jitd;		//!< Whether JIT data is available.
+
+	uint64_t		hits;		//!< How many times the entry has been reused.
+	unsigned int		refs;		//!< Number of regex_t currently using compiled.
+	bool			evicted;	//!< No longer in the cache, free once refs reaches 0.
+
+	fr_dlist_t		entry;		//!< Entry in the LRU list.
+};
+
 /** Thread local storage for PCRE2
  *
  * Not all this storage is thread local, but it simplifies cleanup if
@@ -60,10 +83,16 @@ typedef struct {
 	pcre2_general_context	*gcontext;	//!< General context.
 	pcre2_compile_context	*ccontext;	//!< Compile context.
 	pcre2_match_context	*mcontext;	//!< Match context.
+	pcre2_match_data	*match_data;	//!< Reused when the caller doesn't want match data.
 #ifdef PCRE2_CONFIG_JIT
 	pcre2_jit_stack		*jit_stack;	//!< Jit stack for executing jit'd patterns.
 	bool			do_jit;		//!< Whether we have runtime JIT support.
 #endif
+
+	fr_hash_table_t		*cache;		//!< Compiled runtime expressions, by pattern and flags.
+	fr_dlist_head_t		cache_lru;	//!< Most recently used entries at the head.
+	uint64_t		cache_hits;	//!< Runtime compilations satisfied from the cache.
+	uint64_t		cache_misses;	//!< Runtime compilations which weren't.
 } fr_pcre2_tls_t;
 
 /** Thread local storage for pcre2
@@ -97,6 +126,7 @@ static void _pcre2_talloc_free(void *to_free, UNUSED void *uctx)
  */
 static int _pcre2_tls_free(fr_pcre2_tls_t *tls)
 {
+	if (tls->match_data) pcre2_match_data_free(tls->match_data);
 	if (tls->gcontext) pcre2_general_context_free(tls->gcontext);
 	if (tls->ccontext) pcre2_compile_context_free(tls->ccontext);
 	if (tls->mcontext) pcre2_match_context_free(tls->mcontext);
@@ -112,6 +142,144 @@ static int _pcre2_tls_free_on_exit(void *arg)
 	return talloc_free(arg);
 }
 
+static uint32_t _regex_cache_hash(void const *data)
+{
+	fr_regex_cache_entry_t const *e = data;
+
+	return fr_hash_update(&e->cflags, sizeof(e->cflags), fr_hash(e->pattern, e->len));
+}
+
+static int8_t _regex_cache_cmp(void const *one, void const *two)
+{
+	fr_regex_cache_entry_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->cflags, b->cflags);
+	if (ret != 0) return ret;
+
+	ret = CMP(a->len, b->len);
+	if (ret != 0) return ret;
+
+	return CMP(memcmp(a->pattern, b->pattern, a->len), 0);
+}
+
+static int _regex_cache_entry_free(fr_regex_cache_entry_t *e)
+{
+	if (e->compiled) pcre2_code_free(e->compiled);
+
+	return 0;
+}
+
+/** Drop a regex_t's reference to a cache entry
+ *
+ */
+static void regex_cache_entry_release(fr_regex_cache_entry_t *e)
+{
+	fr_assert(e->refs > 0);
+
+	if ((--e->refs == 0) && e->evicted) talloc_free(e);
+}
+
+/** Find a previously compiled runtime expression
+ *
+ */
+static fr_regex_cache_entry_t *regex_cache_find(char const *pattern, size_t len, uint32_t cflags)
+{
+	fr_regex_cache_entry_t *e;
+
+	e = fr_hash_table_find(fr_pcre2_tls->cache, &(fr_regex_cache_entry_t){
+					.pattern = UNCONST(char *, pattern),
+					.len = len,
+					.cflags = cflags
+				});
+	if (!e) {
+		fr_pcre2_tls->cache_misses++;
+		return NULL;
+	}
+
+	fr_pcre2_tls->cache_hits++;
+	e->hits++;
+
+	/*
+	 *	Move to the head of the LRU list.
+	 */
+	fr_dlist_remove(&fr_pcre2_tls->cache_lru, e);
+	fr_dlist_insert_head(&fr_pcre2_tls->cache_lru, e);
+
+#ifdef PCRE2_CONFIG_JIT
+	/*
+	 *	The expression is being reused, so it's now worth
+	 *	the cost of JIT compiling it.  If that fails we
+	 *	just carry on using the interpreter.
+	 */
+	if (fr_pcre2_tls->do_jit && !e->jitd && (e->hits == 1)) {
+		e->jitd = (pcre2_jit_compile(e->compiled, PCRE2_JIT_COMPLETE) == 0);
+	}
+#endif
+
+	return e;
+}
+
+/** Hand ownership of a newly compiled runtime expression to the cache
+ *
+ * If the cache is full, the least recently used entry is evicted.
+ * Evicted entries are freed once the last regex_t using them is freed.
+ */
+static void regex_cache_add(regex_t *preg, char const *pattern, size_t len, uint32_t cflags)
+{
+	fr_regex_cache_entry_t *e;
+
+	if (fr_hash_table_num_elements(fr_pcre2_tls->cache) >= FR_REGEX_CACHE_SIZE) {
+		fr_regex_cache_entry_t *old = fr_dlist_pop_tail(&fr_pcre2_tls->cache_lru);
+
+		fr_hash_table_remove(fr_pcre2_tls->cache, old);
+		old->evicted = true;
+		if (old->refs == 0) talloc_free(old);
+	}
+
+	e = talloc_zero(fr_pcre2_tls, fr_regex_cache_entry_t);
+	if (unlikely(!e)) return;	/* Just don't cache it */
+
+	e->pattern = talloc_memdup(e, pattern, len);
+	if (unlikely(!e->pattern)) {
+		talloc_free(e);
+		return;
+	}
+	e->len = len;
+	e->cflags = cflags;
+
+	if (unlikely(!fr_hash_table_insert(fr_pcre2_tls->cache, e))) {
+		talloc_free(e);
+		return;
+	}
+	fr_dlist_insert_head(&fr_pcre2_tls->cache_lru, e);
+
+	e->compiled = preg->compiled;
+	e->refs = 1;
+	talloc_set_destructor(e, _regex_cache_entry_free);
+
+	preg->cache_entry = e;
+}
+
+/** Return statistics for the calling thread's cache of runtime expressions
+ *
+ * @param[out] hits	Number of runtime compilations satisfied from the cache.
+ * @param[out] misses	Number of runtime compilations which weren't.
+ * @param[out] entries	Number of expressions currently cached.
+ */
+void regex_cache_stats(uint64_t *hits, uint64_t *misses, uint32_t *entries)
+{
+	if (!fr_pcre2_tls) {
+		*hits = *misses = 0;
+		*entries = 0;
+		return;
+	}
+
+	*hits = fr_pcre2_tls->cache_hits;
+	*misses = fr_pcre2_tls->cache_misses;
+	*entries = fr_hash_table_num_elements(fr_pcre2_tls->cache);
+}
+
 /** Thread local init for pcre2
  *
  */
@@ -146,6 +314,23 @@ static int fr_pcre2_tls_init(void)
 		goto error;
 	}
 
+	/*
+	 *	Only needs room for the overall match, as callers
+	 *	that want subcaptures pass in their own.
+	 */
+	tls->match_data = pcre2_match_data_create(1, tls->gcontext);
+	if (!tls->match_data) {
+		fr_strerror_const("Failed allocating match data");
+		goto error;
+	}
+
+	tls->cache = fr_hash_table_alloc(tls, _regex_cache_hash, _regex_cache_cmp, NULL);
+	if (!tls->cache) {
+		fr_strerror_const("Failed allocating regex cache");
+		goto error;
+	}
+	fr_dlist_talloc_init(&tls->cache_lru, fr_regex_cache_entry_t, entry);
+
 #ifdef PCRE2_CONFIG_JIT
 	pcre2_config(PCRE2_CONFIG_JIT, &tls->do_jit);
 	if (tls->do_jit) {
@@ -175,6 +360,11 @@ static int fr_pcre2_tls_init(void)
  */
 static int _regex_free(regex_t *preg)
 {
+	if (preg->cache_entry) {
+		regex_cache_entry_release(preg->cache_entry);
+		return 0;
+	}
+
 	if (preg->compiled) pcre2_code_free(preg->compiled);
 
 	return 0;
@@ -240,6 +430,26 @@ ssize_t regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_
 	preg = talloc_zero(ctx, regex_t);
 	talloc_set_destructor(preg, _regex_free);
 
+	/*
+	 *	Runtime expressions are usually built from a small
+	 *	set of inputs, so the same patterns are compiled
+	 *	over and over again.  Share the compiled form.
+	 */
+	if (runtime) {
+		fr_regex_cache_entry_t *e;
+
+		e = regex_cache_find(pattern, len, cflags);
+		if (e) {
+			e->refs++;
+			preg->cache_entry = e;
+			preg->compiled = e->compiled;
+			preg->jitd = e->jitd;
+
+			*out = preg;
+			return len;
+		}
+	}
+
 	preg->compiled = pcre2_compile((PCRE2_SPTR8)pattern, len,
 				       cflags, &ret, &offset, fr_pcre2_tls->ccontext);
 	if (!preg->compiled) {
@@ -275,6 +485,8 @@ ssize_t regex_compile(TALLOC_CTX *ctx, regex_t **out, char const *pattern, size_
 			preg->jitd = true;
 		}
 #endif
+	} else {
+		regex_cache_add(preg, pattern, len, cflags);
 	}
 
 	*out = preg;
@@ -355,15 +567,12 @@ int regex_exec(regex_t *preg, char const *subject, size_t len, fr_regmatch_t *re
 
 	/*
 	 *	If we weren't given match data we
-	 *	need to alloc it else pcre2_match
-	 *	fails when passed NULL match data.
+	 *	use the thread local match data, as
+	 *	pcre2_match fails when passed NULL
+	 *	match data.
 	 */
 	if (!regmatch) {
-		match_data = pcre2_match_data_create_from_pattern(preg->compiled, fr_pcre2_tls->gcontext);
-		if (!match_data) {
-			fr_strerror_const("Failed allocating temporary match data");
-			return -1;
-		}
+		match_data = fr_pcre2_tls->match_data;
 	} else {
 		match_data = regmatch->match_data;
 	}
@@ -378,7 +587,6 @@ int regex_exec(regex_t *preg, char const *subject, size_t len, fr_regmatch_t *re
 		ret = pcre2_match(preg->compiled, (PCRE2_SPTR8)subject, len, 0, options,
 				  match_data, fr_pcre2_tls->mcontext);
 	}
-	if (!regmatch) pcre2_match_data_free(match_data);
 	if (ret < 0) {
 		PCRE2_UCHAR	errbuff[128];
 
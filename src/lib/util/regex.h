@@ -62,6 +62,8 @@ typedef struct {
 #endif
 } fr_regmatch_t;
 
+typedef struct fr_regex_cache_entry_s fr_regex_cache_entry_t;
+
 typedef struct {
 	pcre2_code		*compiled;	//!< Compiled regular expression.
 	uint32_t		subcaptures;	//!< Number of subcaptures contained within the expression.
@@ -69,6 +71,9 @@ typedef struct {
 	bool			precompiled;	//!< Whether this regex was precompiled,
 						///< or compiled for one off evaluation.
 	bool			jitd;		//!< Whether JIT data is available.
+
+	fr_regex_cache_entry_t	*cache_entry;	//!< Thread local cache entry which owns compiled.
+						///< NULL if compiled is owned by this regex_t.
 } regex_t;
 /*
  *######################################
@@ -182,6 +187,8 @@ ssize_t		regex_flags_print(fr_sbuff_t *sbuff, fr_regex_flags_t const *flags);
 			      fr_regex_flags_t const *flags, bool subcaptures, bool runtime);
 int		regex_exec(regex_t *preg, char const *subject, size_t len, fr_regmatch_t *regmatch) CC_HINT(nonnull(1,2));
 #ifdef HAVE_REGEX_PCRE2
+void		regex_cache_stats(uint64_t *hits, uint64_t *misses, uint32_t *entries);
+
 int		regex_substitute(TALLOC_CTX *ctx, char **out, size_t max_out, regex_t *preg, fr_regex_flags_t const *flags,
 		     		 char const *subject, size_t subject_len,
 		     		 char const *replacement, size_t replacement_len,
@@ -50,6 +50,19 @@ typedef struct { \
 	fr_time_delta_t		interval;		//!< Interval between slab cleanup events being fired.
 } fr_slab_config_t;
 
+/** Counters for a slab list
+ */
+typedef struct {
+	uint64_t		reserved;		//!< Total number of elements reserved.
+	uint64_t		released;		//!< Total number of elements released back to slabs.
+	uint64_t		overflow;		//!< Elements allocated outside of slabs, because
+							///< max_elements had been reached.
+	uint64_t		slabs_allocated;	//!< Total number of slabs allocated.
+	uint64_t		slabs_freed;		//!< Total number of slabs freed by the cleanup timer.
+	unsigned int		in_use;			//!< Elements currently in use.
+	unsigned int		high_water_mark;	//!< Elements currently allocated in slabs.
+} fr_slab_stats_t;
+
 /** Define type specific wrapper structs for slabs and slab elements
  *
  * @note This macro should be used inside the header for the area of code
@@ -90,6 +103,7 @@ typedef struct { \
 		void					*uctx; \
 		bool					release_reset; \
 		bool					reserve_mru; \
+		fr_slab_stats_t				stats; \
 	} _name ## _slab_list_t; \
 \
 	typedef struct { \
@@ -147,6 +161,7 @@ DIAG_OFF(unused-function) \
 			to_clear -= _name ## _slab_element_num_elements(&slab->avail); \
 			_name ## _slab_element_talloc_free(&slab->avail); \
 			talloc_free(slab); \
+			slab_list->stats.slabs_freed++; \
 			if (to_clear < slab_list->config.elements_per_slab) break; \
 		next: \
 			slab = next_slab; \
@@ -282,6 +297,7 @@ DIAG_OFF(unused-function) \
 				} \
 			} \
 			slab_list->high_water_mark += _name ## _slab_element_num_elements(&slab->avail); \
+			slab_list->stats.slabs_allocated++; \
 		} \
 		if (!slab && slab_list->config.at_max_fail) return NULL; \
 		if (slab) element = slab_list->reserve_mru ? _name ## _slab_element_pop_tail(&slab->avail) : \
@@ -299,10 +315,31 @@ DIAG_OFF(unused-function) \
 			talloc_set_type(element, _type); \
 			talloc_set_destructor(element, _ ## _type ## _element_free); \
 			if (slab_list->alloc) slab_list->alloc((_type *)element, slab_list->uctx); \
+			slab_list->stats.overflow++; \
 		} \
+		slab_list->stats.reserved++; \
 		if (slab_list->reserve) slab_list->reserve((_type *)element, slab_list->uctx); \
 		return (_type *)element; \
 	} \
+\
+	/** Reserve multiple slab elements \
+	 * \
+	 * @param[in] slab_list		to reserve elements from. \
+	 * @param[out] out		where to write the elements. \
+	 * @param[in] num		number of elements to reserve. \
+	 * @return the number of elements reserved.  May be less than num \
+	 *	if at_max_fail is set. \
+	 */ \
+	static inline CC_HINT(nonnull) unsigned int _name ## _slab_reserve_bulk(_name ## _slab_list_t *slab_list, \
+										 _type *out[], unsigned int num) \
+	{ \
+		unsigned int i; \
+		for (i = 0; i < num; i++) { \
+			out[i] = _name ## _slab_reserve(slab_list); \
+			if (!out[i]) break; \
+		} \
+		return i; \
+	} \
 \
 	/** Set a function to be called when a slab element is released \
 	 * \
@@ -329,6 +366,7 @@ DIAG_OFF(unused-function) \
 		_name ## _slab_element_t *element = (_name ## _slab_element_t *)elem; \
 		_name ## _slab_t *slab = element->slab; \
 		if (element->free) element->free(elem, element->uctx); \
+		if (slab) slab->list->stats.released++; \
 		if (slab) { \
 			_name ## _slab_list_t	*slab_list; \
 			slab_list = slab->list; \
@@ -350,6 +388,17 @@ DIAG_OFF(unused-function) \
 		} \
 		talloc_free(element); \
 	} \
+\
+	/** Release multiple slab elements \
+	 * \
+	 * @param[in] elems	to release.  NULL entries are skipped. \
+	 * @param[in] num	number of entries in elems. \
+	 */ \
+	static inline CC_HINT(nonnull) void _name ## _slab_release_bulk(_type *elems[], unsigned int num) \
+	{ \
+		unsigned int i; \
+		for (i = 0; i < num; i++) if (elems[i]) _name ## _slab_release(elems[i]); \
+	} \
 \
 	static inline CC_HINT(nonnull) unsigned int _name ## _slab_num_elements_used(_name ## _slab_list_t *slab_list) \
 	{ \
@@ -361,6 +410,18 @@ DIAG_OFF(unused-function) \
 		return _name ## _slab_num_elements(&slab_list->reserved) + \
 		       _name ## _slab_num_elements(&slab_list->avail); \
 	} \
+\
+	/** Return the counters for a slab list \
+	 * \
+	 * @param[out] stats		where to write the counters. \
+	 * @param[in] slab_list		to get counters for. \
+	 */ \
+	static inline CC_HINT(nonnull) void _name ## _slab_stats(fr_slab_stats_t *stats, _name ## _slab_list_t *slab_list) \
+	{ \
+		*stats = slab_list->stats; \
+		stats->in_use = slab_list->in_use; \
+		stats->high_water_mark = slab_list->high_water_mark; \
+	} \
 DIAG_ON(unused-function)
 
 #ifdef __cplusplus
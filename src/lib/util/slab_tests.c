@@ -788,6 +788,88 @@ static void test_child_alloc(void)
 	talloc_free(test_slab_list);
 }
 
+/** Test bulk reservation and release, and the counters
+ *
+ */
+static void test_bulk(void)
+{
+	test_slab_list_t	*test_slab_list;
+	test_element_t		*test_elements[6];
+	fr_slab_stats_t		stats;
+	unsigned int		num;
+
+	test_slab_list = test_slab_list_alloc(NULL, NULL, &def_slab_config, NULL, NULL, NULL, true, false);
+	TEST_CHECK(test_slab_list != NULL);
+	if (!test_slab_list) return;
+
+	/*
+	 *	max_elements is 4, so 2 of these come from outside the slabs.
+	 */
+	num = test_slab_reserve_bulk(test_slab_list, test_elements, NUM_ELEMENTS(test_elements));
+	TEST_CHECK(num == 6);
+	TEST_MSG("Expected 6 elements, got %u", num);
+	TEST_CHECK(test_slab_num_elements_used(test_slab_list) == 4);
+
+	test_slab_stats(&stats, test_slab_list);
+	TEST_CHECK(stats.reserved == 6);
+	TEST_CHECK(stats.overflow == 2);
+	TEST_CHECK(stats.slabs_allocated == 2);
+	TEST_CHECK(stats.in_use == 4);
+	TEST_CHECK(stats.high_water_mark == 4);
+
+	test_slab_release(test_elements[0]);
+	test_elements[0] = NULL;
+	test_slab_release_bulk(test_elements + 2, NUM_ELEMENTS(test_elements) - 2);
+	TEST_CHECK(test_slab_num_elements_used(test_slab_list) == 1);
+
+	test_slab_stats(&stats, test_slab_list);
+	TEST_CHECK(stats.released == 3);
+	TEST_MSG("Expected 3 released, got %" PRIu64, stats.released);
+	TEST_CHECK(stats.in_use == 1);
+
+	talloc_free(test_slab_list);
+}
+
+/** Compare reserving and releasing from a slab with talloc
+ *
+ */
+static void test_perf(void)
+{
+	test_slab_list_t	*test_slab_list;
+	test_element_t		*test_elements[64];
+	fr_slab_config_t	slab_config = def_slab_config;
+	fr_time_t		start;
+	fr_time_delta_t		slab_used, talloc_used;
+	unsigned int		i, j, reps = 10000;
+
+	slab_config.elements_per_slab = NUM_ELEMENTS(test_elements);
+	slab_config.max_elements = NUM_ELEMENTS(test_elements);
+
+	test_slab_list = test_slab_list_alloc(NULL, NULL, &slab_config, NULL, NULL, NULL, false, true);
+	TEST_CHECK(test_slab_list != NULL);
+	if (!test_slab_list) return;
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		test_slab_reserve_bulk(test_slab_list, test_elements, NUM_ELEMENTS(test_elements));
+		test_slab_release_bulk(test_elements, NUM_ELEMENTS(test_elements));
+	}
+	slab_used = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < NUM_ELEMENTS(test_elements); j++) test_elements[j] = talloc_zero(NULL, test_element_t);
+		for (j = 0; j < NUM_ELEMENTS(test_elements); j++) talloc_free(test_elements[j]);
+	}
+	talloc_used = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("elements=%u", (unsigned int) (reps * NUM_ELEMENTS(test_elements)));
+	TEST_MSG_ALWAYS("slab_used=%"PRId64, fr_time_delta_unwrap(slab_used));
+	TEST_MSG_ALWAYS("talloc_used=%"PRId64, fr_time_delta_unwrap(talloc_used));
+
+	talloc_free(test_slab_list);
+}
+
 TEST_LIST = {
 	{ "test_alloc",		test_alloc },
 	{ "test_alloc_fail",	test_alloc_fail },
@@ -803,6 +885,8 @@ TEST_LIST = {
 	{ "test_clearup_3",	test_clearup_3 },
 	{ "test_realloc",	test_realloc },
 	{ "test_child_alloc",	test_child_alloc },
+	{ "test_bulk",		test_bulk },
+	{ "test_perf",		test_perf },
 
 	{ NULL }
 };
@@ -32,6 +32,7 @@ RCSID("$Id$")
 
 #include <talloc.h>
 #include <stdatomic.h>
+#include <pthread.h>
 
 static TALLOC_CTX *global_ctx;
 static _Thread_local TALLOC_CTX *thread_local_ctx;
@@ -1060,3 +1061,172 @@ TALLOC_CHILD_CTX *talloc_child_ctx_alloc(TALLOC_CHILD_CTX *parent)
 	parent->next = child;
 	return child;
 }
+
+struct talloc_account_s {
+	char const		*subsystem;	//!< the memory belongs to.
+	char const		*instance;	//!< of the subsystem.  May be NULL.
+	atomic_size_t		used;		//!< bytes of memory.
+	atomic_size_t		budget;		//!< soft limit on used.  0 means no limit.
+	talloc_account_t	*next;		//!< in the list of all accounts.
+};
+
+/** All accounts, in the order they were created
+ *
+ * Accounts are never freed until the process exits, so callers can keep
+ * pointers to them without worrying about what happens on the other threads.
+ */
+static talloc_account_t		*account_head;
+static talloc_account_t		**account_tail = &account_head;
+static TALLOC_CTX		*account_ctx;
+static pthread_mutex_t		account_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int _talloc_account_free(void *ctx)
+{
+	pthread_mutex_lock(&account_mutex);
+	account_head = NULL;
+	account_tail = &account_head;
+	account_ctx = NULL;
+	pthread_mutex_unlock(&account_mutex);
+
+	return talloc_free(ctx);
+}
+
+/** Find or create the account for a subsystem
+ *
+ * Asking for the same subsystem and instance again returns the same account,
+ * so the account survives the subsystem being freed and re-created.
+ *
+ * @param[in] subsystem		the memory belongs to.
+ * @param[in] instance		of the subsystem.  May be NULL.
+ * @return
+ *	- The account.
+ *	- NULL on allocation failure.
+ */
+talloc_account_t *talloc_account(char const *subsystem, char const *instance)
+{
+	talloc_account_t *acct;
+
+	pthread_mutex_lock(&account_mutex);
+	for (acct = account_head; acct; acct = acct->next) {
+		if (strcmp(acct->subsystem, subsystem) != 0) continue;
+		if (!acct->instance != !instance) continue;
+		if (instance && (strcmp(acct->instance, instance) != 0)) continue;
+		goto done;
+	}
+
+	/*
+	 *	Only this code touches account_ctx, and only with
+	 *	the mutex held, so it's safe to allocate in it from
+	 *	any thread.
+	 */
+	if (!account_ctx) {
+		account_ctx = talloc_init_const("memory_accounts");
+		if (unlikely(!account_ctx)) goto done;
+		fr_atexit_global(_talloc_account_free, account_ctx);
+	}
+
+	acct = talloc_zero(account_ctx, talloc_account_t);
+	if (unlikely(!acct)) goto done;
+
+	acct->subsystem = talloc_strdup(acct, subsystem);
+	if (instance) acct->instance = talloc_strdup(acct, instance);
+	atomic_init(&acct->used, 0);
+	atomic_init(&acct->budget, 0);
+
+	*account_tail = acct;
+	account_tail = &acct->next;
+
+done:
+	pthread_mutex_unlock(&account_mutex);
+
+	return acct;
+}
+
+/** Record memory allocated by the subsystem
+ *
+ */
+void talloc_account_add(talloc_account_t *acct, size_t size)
+{
+	atomic_fetch_add_explicit(&acct->used, size, memory_order_relaxed);
+}
+
+/** Record memory freed by the subsystem
+ *
+ */
+void talloc_account_sub(talloc_account_t *acct, size_t size)
+{
+	atomic_fetch_sub_explicit(&acct->used, size, memory_order_relaxed);
+}
+
+/** Record the total memory used by the subsystem
+ *
+ */
+void talloc_account_set(talloc_account_t *acct, size_t size)
+{
+	atomic_store_explicit(&acct->used, size, memory_order_relaxed);
+}
+
+/** Return the memory used by the subsystem
+ *
+ */
+size_t talloc_account_used(talloc_account_t const *acct)
+{
+	return atomic_load_explicit(&acct->used, memory_order_relaxed);
+}
+
+/** Set a soft limit on the memory used by the subsystem
+ *
+ * @param[in] acct	to set the budget for.
+ * @param[in] budget	in bytes.  0 means no limit.
+ */
+void talloc_account_budget_set(talloc_account_t *acct, size_t budget)
+{
+	atomic_store_explicit(&acct->budget, budget, memory_order_relaxed);
+}
+
+/** Return the soft limit on the memory used by the subsystem
+ *
+ */
+size_t talloc_account_budget(talloc_account_t const *acct)
+{
+	return atomic_load_explicit(&acct->budget, memory_order_relaxed);
+}
+
+/** Whether the subsystem is using more memory than its budget
+ *
+ */
+bool talloc_account_over_budget(talloc_account_t const *acct)
+{
+	size_t budget = atomic_load_explicit(&acct->budget, memory_order_relaxed);
+
+	return budget && (atomic_load_explicit(&acct->used, memory_order_relaxed) > budget);
+}
+
+/** Call a function for every account
+ *
+ * @note func is called with the account list locked, so it mustn't create accounts.
+ *
+ * @param[in] func	to call.
+ * @param[in] uctx	to pass to func.
+ * @return
+ *	- 0 if every account was walked.
+ *	- -1 if func stopped the walk.
+ */
+int talloc_account_walk(talloc_account_walk_t func, void *uctx)
+{
+	talloc_account_t	*acct;
+	int			ret = 0;
+
+	pthread_mutex_lock(&account_mutex);
+	for (acct = account_head; acct; acct = acct->next) {
+		if (func(acct->subsystem, acct->instance,
+			 atomic_load_explicit(&acct->used, memory_order_relaxed),
+			 atomic_load_explicit(&acct->budget, memory_order_relaxed), uctx) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&account_mutex);
+
+	return ret;
+}
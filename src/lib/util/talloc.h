@@ -300,6 +300,58 @@ typedef struct talloc_child_ctx_s TALLOC_CHILD_CTX;
 TALLOC_CHILD_CTX	*talloc_child_ctx_init(TALLOC_CTX *ctx);
 TALLOC_CHILD_CTX	*talloc_child_ctx_alloc(TALLOC_CHILD_CTX *parent) CC_HINT(nonnull);
 
+/** @name Memory accounting
+ *
+ * talloc isn't thread safe, so one thread can't walk the talloc tree of another
+ * to find out how much memory it's using.  Instead, each subsystem keeps a
+ * running count of the memory it owns in an account, which can be read from
+ * any thread.
+ *
+ * Subsystems which grow at runtime update the account as they allocate and free
+ * memory, usually by recording talloc_total_size() of each entry as it's added.
+ * Subsystems which don't grow set the account once, after they're initialised.
+ *
+ * An account may have a budget.  Budgets are soft, nothing stops the account
+ * going over.  It's up to the subsystem to check talloc_account_over_budget()
+ * and free memory, by evicting entries or similar.
+ *
+ * @{
+ */
+typedef struct talloc_account_s talloc_account_t;
+
+/** Called for each account by talloc_account_walk()
+ *
+ * @param[in] subsystem		the memory belongs to, e.g. "state" or "module".
+ * @param[in] instance		of the subsystem, e.g. the name of a module.
+ * @param[in] used		bytes of memory.
+ * @param[in] budget		for the account.  0 if there's no budget.
+ * @param[in] uctx		passed to talloc_account_walk().
+ * @return
+ *	- 0 to continue walking.
+ *	- -1 to stop.
+ */
+typedef int (*talloc_account_walk_t)(char const *subsystem, char const *instance,
+				     size_t used, size_t budget, void *uctx);
+
+talloc_account_t	*talloc_account(char const *subsystem, char const *instance) CC_HINT(nonnull(1));
+
+void			talloc_account_add(talloc_account_t *acct, size_t size) CC_HINT(nonnull);
+
+void			talloc_account_sub(talloc_account_t *acct, size_t size) CC_HINT(nonnull);
+
+void			talloc_account_set(talloc_account_t *acct, size_t size) CC_HINT(nonnull);
+
+size_t			talloc_account_used(talloc_account_t const *acct) CC_HINT(nonnull);
+
+void			talloc_account_budget_set(talloc_account_t *acct, size_t budget) CC_HINT(nonnull);
+
+size_t			talloc_account_budget(talloc_account_t const *acct) CC_HINT(nonnull);
+
+bool			talloc_account_over_budget(talloc_account_t const *acct) CC_HINT(nonnull);
+
+int			talloc_account_walk(talloc_account_walk_t func, void *uctx) CC_HINT(nonnull(1));
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
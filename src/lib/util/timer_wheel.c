@@ -0,0 +1,454 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hashed timer wheel
+ *
+ * Each bucket holds the entries which expire in a particular tick, in
+ * any rotation of the wheel.  A bitmap records which buckets have
+ * entries, so that finding the next tick to do something in is a scan
+ * of a few words, and not of every bucket.
+ *
+ * When the wheel is advanced, the entries which have expired are moved
+ * from their buckets to the "expired" list, and are returned from there.
+ * Entries for later rotations of the wheel stay in their buckets.
+ *
+ * @file src/lib/util/timer_wheel.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/timer_wheel.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/strerror.h>
+
+#define TW_MIN_BUCKETS	(64)
+
+struct fr_timer_wheel_s {
+	size_t			offset;		//!< of the #fr_timer_wheel_node_t in the entries.
+
+	int64_t			resolution;	//!< length of a tick, in nanoseconds.
+	int64_t			tick;		//!< the buckets for all ticks up to and including this one
+						///< have been moved to the expired list.
+
+	unsigned int		mask;		//!< number of buckets - 1.
+	unsigned int		num;		//!< number of entries in the wheel.
+
+	uint64_t		*bitmap;	//!< which buckets have entries.
+	fr_dlist_t		expired;	//!< entries which have expired, but haven't been removed.
+	fr_dlist_t		bucket[];	//!< entries, by the tick they expire in.
+};
+
+static inline fr_timer_wheel_node_t *tw_node(fr_timer_wheel_t const *tw, void *data)
+{
+	return (fr_timer_wheel_node_t *) (((uint8_t *) data) + tw->offset);
+}
+
+static inline void *tw_data(fr_timer_wheel_t const *tw, fr_dlist_t const *entry)
+{
+	return fr_dlist_entry_to_item(tw->offset, entry);
+}
+
+/** The tick an entry expires in
+ *
+ * Rounded up, so that an entry is never returned before it expires.
+ */
+static inline int64_t tw_tick(fr_timer_wheel_t const *tw, fr_time_t when)
+{
+	int64_t ns = fr_time_unwrap(when);
+
+	if (ns <= 0) return 0;
+
+	return (ns + tw->resolution - 1) / tw->resolution;
+}
+
+static inline bool tw_bucket_is_empty(fr_dlist_t const *bucket)
+{
+	return (bucket->next == bucket);
+}
+
+static inline void tw_bitmap_set(fr_timer_wheel_t *tw, unsigned int idx)
+{
+	tw->bitmap[idx / 64] |= ((uint64_t) 1) << (idx & 63);
+}
+
+static inline void tw_bitmap_clear(fr_timer_wheel_t *tw, unsigned int idx)
+{
+	tw->bitmap[idx / 64] &= ~(((uint64_t) 1) << (idx & 63));
+}
+
+/** Find the distance from a bucket to the next bucket with entries
+ *
+ * @return
+ *	- -1 if there are no buckets with entries.
+ *	- >=0 the number of buckets after "start" which has entries.
+ */
+static int64_t tw_bucket_next(fr_timer_wheel_t const *tw, int64_t start)
+{
+	unsigned int	num_words = (tw->mask + 1) / 64;
+	unsigned int	idx = start & tw->mask;
+	unsigned int	word = idx / 64;
+	unsigned int	i;
+	uint64_t	bits;
+
+	bits = tw->bitmap[word] & (~((uint64_t) 0) << (idx & 63));
+
+	/*
+	 *	Check the rest of the first word, all of the other words, and then the start of the first
+	 *	word.
+	 */
+	for (i = 0; i <= num_words; i++) {
+		if (bits) {
+			unsigned int found = (word * 64) + fr_low_bit_pos(bits) - 1;
+
+			return (found - idx) & tw->mask;
+		}
+
+		word = (word + 1) % num_words;
+		bits = tw->bitmap[word];
+	}
+
+	return -1;
+}
+
+/** Move the entries in a bucket which have expired to the expired list
+ *
+ */
+static void tw_bucket_expire(fr_timer_wheel_t *tw, unsigned int idx, int64_t now_tick)
+{
+	fr_dlist_t *bucket = &tw->bucket[idx];
+	fr_dlist_t *entry, *next;
+
+	for (entry = bucket->next; entry != bucket; entry = next) {
+		fr_timer_wheel_node_t *node = (fr_timer_wheel_node_t *) entry;
+
+		next = entry->next;
+
+		if (tw_tick(tw, node->when) > now_tick) continue;
+
+		fr_dlist_entry_unlink(entry);
+		fr_dlist_entry_link_before(&tw->expired, entry);
+	}
+
+	if (tw_bucket_is_empty(bucket)) tw_bitmap_clear(tw, idx);
+}
+
+/** Move everything which has expired to the expired list
+ *
+ */
+static void tw_advance(fr_timer_wheel_t *tw, fr_time_t now)
+{
+	int64_t now_tick = fr_time_unwrap(now) / tw->resolution;
+	int64_t tick;
+
+	if (now_tick <= tw->tick) return;
+
+	/*
+	 *	We haven't been called for more than a full rotation, so every bucket may have expired
+	 *	entries.
+	 */
+	if ((now_tick - tw->tick) > tw->mask) {
+		unsigned int i;
+
+		for (i = 0; i <= tw->mask; i++) {
+			if (!tw_bucket_is_empty(&tw->bucket[i])) tw_bucket_expire(tw, i, now_tick);
+		}
+
+		tw->tick = now_tick;
+		return;
+	}
+
+	/*
+	 *	Skip straight to the buckets which have entries.
+	 */
+	tick = tw->tick + 1;
+	while (tick <= now_tick) {
+		int64_t distance;
+
+		distance = tw_bucket_next(tw, tick);
+		if ((distance < 0) || ((tick + distance) > now_tick)) break;
+
+		tick += distance;
+		tw_bucket_expire(tw, tick & tw->mask, now_tick);
+		tick++;
+	}
+
+	tw->tick = now_tick;
+}
+
+/** Allocate a timer wheel
+ *
+ * Use fr_timer_wheel_alloc() instead of calling this function directly.
+ *
+ * @param[in] ctx		to allocate the wheel in.
+ * @param[in] offset		of the #fr_timer_wheel_node_t in the entries.
+ * @param[in] resolution	of the wheel, i.e. the length of a tick.
+ * @param[in] num_buckets	in the wheel.  Rounded up to a power of 2.
+ * @param[in] now		the current time.
+ * @return
+ *	- NULL on error.
+ *	- a new timer wheel on success.
+ */
+fr_timer_wheel_t *_fr_timer_wheel_alloc(TALLOC_CTX *ctx, size_t offset,
+					fr_time_delta_t resolution, unsigned int num_buckets, fr_time_t now)
+{
+	fr_timer_wheel_t	*tw;
+	unsigned int		i;
+
+	if (!fr_time_delta_ispos(resolution)) {
+		fr_strerror_const("Timer wheel resolution must be greater than zero");
+		return NULL;
+	}
+
+	if (num_buckets < TW_MIN_BUCKETS) num_buckets = TW_MIN_BUCKETS;
+	if (num_buckets > (1 << 20)) {
+		fr_strerror_const("Timer wheel has too many buckets");
+		return NULL;
+	}
+	num_buckets = ((unsigned int) 1) << (fr_high_bit_pos(num_buckets - 1));
+
+	tw = talloc_zero_size(ctx, sizeof(*tw) + (num_buckets * sizeof(tw->bucket[0])));
+	if (!tw) return NULL;
+	talloc_set_type(tw, fr_timer_wheel_t);
+
+	tw->bitmap = talloc_zero_array(tw, uint64_t, num_buckets / 64);
+	if (!tw->bitmap) {
+		talloc_free(tw);
+		return NULL;
+	}
+
+	tw->offset = offset;
+	tw->resolution = fr_time_delta_unwrap(resolution);
+	tw->tick = fr_time_unwrap(now) / tw->resolution;
+	tw->mask = num_buckets - 1;
+	tw->num = 0;
+
+	fr_dlist_entry_init(&tw->expired);
+	for (i = 0; i < num_buckets; i++) fr_dlist_entry_init(&tw->bucket[i]);
+
+	return tw;
+}
+
+/** Insert an entry into the wheel
+ *
+ * @param[in] tw	to insert the entry into.
+ * @param[in] data	to insert.  Must not already be in the wheel.
+ * @param[in] when	the entry expires.
+ */
+void fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data, fr_time_t when)
+{
+	fr_timer_wheel_node_t	*node = tw_node(tw, data);
+	int64_t			tick = tw_tick(tw, when);
+
+	fr_assert(!fr_dlist_entry_in_list(&node->entry));
+
+	node->when = when;
+	tw->num++;
+
+	if (tick <= tw->tick) {
+		fr_dlist_entry_link_before(&tw->expired, &node->entry);
+		return;
+	}
+
+	fr_dlist_entry_link_before(&tw->bucket[tick & tw->mask], &node->entry);
+	tw_bitmap_set(tw, tick & tw->mask);
+}
+
+/** Remove an entry from the wheel
+ *
+ * It's fine to remove an entry which isn't in the wheel.
+ *
+ * @param[in] tw	to remove the entry from.
+ * @param[in] data	to remove.
+ */
+void fr_timer_wheel_remove(fr_timer_wheel_t *tw, void *data)
+{
+	fr_timer_wheel_node_t	*node = tw_node(tw, data);
+	unsigned int		idx;
+
+	if (!fr_dlist_entry_in_list(&node->entry)) return;
+
+	fr_dlist_entry_unlink(&node->entry);
+
+	fr_assert(tw->num > 0);
+	tw->num--;
+
+	/*
+	 *	The entry may have been in the expired list, in which case this does nothing.
+	 */
+	idx = tw_tick(tw, node->when) & tw->mask;
+	if (tw_bucket_is_empty(&tw->bucket[idx])) tw_bitmap_clear(tw, idx);
+}
+
+/** Return an entry which has expired, without removing it
+ *
+ * The caller must remove or update the entry before calling this function again, otherwise it will get
+ * the same entry back.
+ *
+ * @param[in] tw	to check.
+ * @param[in] now	the current time.
+ * @return
+ *	- NULL if no entries have expired.
+ *	- an expired entry.
+ */
+void *fr_timer_wheel_peek(fr_timer_wheel_t *tw, fr_time_t now)
+{
+	if (tw_bucket_is_empty(&tw->expired)) {
+		if (!tw->num) return NULL;
+
+		tw_advance(tw, now);
+
+		if (tw_bucket_is_empty(&tw->expired)) return NULL;
+	}
+
+	return tw_data(tw, tw->expired.next);
+}
+
+/** Find when fr_timer_wheel_peek() should next be called
+ *
+ * The time returned may be earlier than any entry expires, but is never later.
+ *
+ * @param[in] tw	to check.
+ * @param[out] when	to call fr_timer_wheel_peek().
+ * @return
+ *	- false if the wheel is empty.
+ *	- true if "when" was set.
+ */
+bool fr_timer_wheel_next(fr_timer_wheel_t const *tw, fr_time_t *when)
+{
+	int64_t distance;
+
+	if (!tw->num) return false;
+
+	if (!tw_bucket_is_empty(&tw->expired)) {
+		*when = fr_time_wrap(tw->tick * tw->resolution);
+		return true;
+	}
+
+	distance = tw_bucket_next(tw, tw->tick + 1);
+	fr_assert(distance >= 0);
+
+	*when = fr_time_wrap((tw->tick + 1 + distance) * tw->resolution);
+	return true;
+}
+
+/** Find the entry which expires first
+ *
+ * This is slower than the other functions, as it may have to look at every bucket.
+ *
+ * @param[in] tw	to search.
+ * @return
+ *	- NULL if the wheel is empty.
+ *	- the entry which expires first.
+ */
+void *fr_timer_wheel_first(fr_timer_wheel_t const *tw)
+{
+	fr_dlist_t const		*entry;
+	fr_timer_wheel_node_t const	*best = NULL;
+	int64_t				tick;
+	unsigned int			i;
+
+	if (!tw->num) return NULL;
+
+#define BEST(_node) do { \
+		if (!best || fr_time_lt((_node)->when, best->when)) best = (_node); \
+	} while (0)
+
+	for (entry = tw->expired.next; entry != &tw->expired; entry = entry->next) {
+		BEST((fr_timer_wheel_node_t const *) entry);
+	}
+	if (best) return tw_data(tw, &best->entry);
+
+	/*
+	 *	Look for the first bucket which has entries in this rotation of the wheel.
+	 */
+	tick = tw->tick + 1;
+	while (tick <= (tw->tick + tw->mask + 1)) {
+		fr_dlist_t const	*bucket;
+		int64_t			distance;
+
+		distance = tw_bucket_next(tw, tick);
+		fr_assert(distance >= 0);
+
+		tick += distance;
+		if (tick > (tw->tick + tw->mask + 1)) break;
+
+		bucket = &tw->bucket[tick & tw->mask];
+		for (entry = bucket->next; entry != bucket; entry = entry->next) {
+			fr_timer_wheel_node_t const *node = (fr_timer_wheel_node_t const *) entry;
+
+			if (tw_tick(tw, node->when) == tick) BEST(node);
+		}
+		if (best) return tw_data(tw, &best->entry);
+
+		tick++;
+	}
+
+	/*
+	 *	Everything is in a later rotation, look at all of the entries.
+	 */
+	for (i = 0; i <= tw->mask; i++) {
+		fr_dlist_t const *bucket = &tw->bucket[i];
+
+		for (entry = bucket->next; entry != bucket; entry = entry->next) {
+			BEST((fr_timer_wheel_node_t const *) entry);
+		}
+	}
+#undef BEST
+
+	fr_assert(best != NULL);
+	return tw_data(tw, &best->entry);
+}
+
+/** Remove and return any entry in the wheel
+ *
+ * For freeing all of the entries.
+ *
+ * @param[in] tw	to remove the entry from.
+ * @return
+ *	- NULL if the wheel is empty.
+ *	- an entry, which has been removed from the wheel.
+ */
+void *fr_timer_wheel_pop_any(fr_timer_wheel_t *tw)
+{
+	fr_dlist_t	*entry;
+	int64_t		distance;
+	void		*data;
+
+	if (!tw->num) return NULL;
+
+	if (!tw_bucket_is_empty(&tw->expired)) {
+		entry = tw->expired.next;
+	} else {
+		distance = tw_bucket_next(tw, 0);
+		fr_assert(distance >= 0);
+
+		entry = tw->bucket[distance].next;
+	}
+
+	data = tw_data(tw, entry);
+	fr_timer_wheel_remove(tw, data);
+
+	return data;
+}
+
+/** Return the number of entries in the wheel
+ *
+ */
+unsigned int fr_timer_wheel_num_elements(fr_timer_wheel_t const *tw)
+{
+	return tw->num;
+}
@@ -0,0 +1,99 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hashed timer wheel
+ *
+ * Entries are placed into one of a fixed number of buckets by when they
+ * expire, so insertion and removal are O(1), no matter how many entries
+ * there are.  The price is that entries are only ordered to the
+ * resolution of the wheel, and that entries which expire in the same
+ * tick are returned in no particular order.
+ *
+ * Entries are never returned before they expire, but may be returned up
+ * to one tick late.
+ *
+ * @file src/lib/util/timer_wheel.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(timer_wheel_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+typedef struct fr_timer_wheel_s fr_timer_wheel_t;
+
+/** Must be embedded in the structures which are placed into the wheel
+ *
+ * A zeroed node is not in any wheel.
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< in a bucket, or in the list of expired entries.
+	fr_time_t		when;		//!< when the entry expires.
+} fr_timer_wheel_node_t;
+
+/** Allocate a timer wheel for structures of type _type, containing a node _field
+ *
+ * The structures don't need to be talloced.
+ *
+ * @param[in] _ctx		to allocate the wheel in.
+ * @param[in] _type		of the structures placed into the wheel.
+ * @param[in] _field		the #fr_timer_wheel_node_t in _type.
+ * @param[in] _resolution	of the wheel.
+ * @param[in] _num_buckets	in the wheel.  Rounded up to a power of 2.
+ * @param[in] _now		the current time.
+ */
+#define fr_timer_wheel_alloc(_ctx, _type, _field, _resolution, _num_buckets, _now) \
+	_Generic((((_type *)0)->_field), \
+		fr_timer_wheel_node_t: _fr_timer_wheel_alloc(_ctx, offsetof(_type, _field), _resolution, _num_buckets, _now) \
+	)
+
+fr_timer_wheel_t	*_fr_timer_wheel_alloc(TALLOC_CTX *ctx, size_t offset,
+					       fr_time_delta_t resolution, unsigned int num_buckets, fr_time_t now);
+
+void			fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data, fr_time_t when) CC_HINT(nonnull);
+
+void			fr_timer_wheel_remove(fr_timer_wheel_t *tw, void *data) CC_HINT(nonnull);
+
+/** Change when an entry expires
+ *
+ */
+static inline CC_HINT(nonnull) void fr_timer_wheel_update(fr_timer_wheel_t *tw, void *data, fr_time_t when)
+{
+	fr_timer_wheel_remove(tw, data);
+	fr_timer_wheel_insert(tw, data, when);
+}
+
+void			*fr_timer_wheel_peek(fr_timer_wheel_t *tw, fr_time_t now) CC_HINT(nonnull);
+
+bool			fr_timer_wheel_next(fr_timer_wheel_t const *tw, fr_time_t *when) CC_HINT(nonnull);
+
+void			*fr_timer_wheel_first(fr_timer_wheel_t const *tw) CC_HINT(nonnull);
+
+void			*fr_timer_wheel_pop_any(fr_timer_wheel_t *tw) CC_HINT(nonnull);
+
+unsigned int		fr_timer_wheel_num_elements(fr_timer_wheel_t const *tw) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,161 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the hashed timer wheel
+ *
+ * @file src/lib/util/timer_wheel_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/timer_wheel.h>
+
+typedef struct {
+	fr_timer_wheel_node_t	node;
+	fr_time_t		when;
+	bool			expired;
+} tw_thing_t;
+
+#define MSEC(_x)	fr_time_wrap((int64_t) (_x) * NSEC / 1000)
+
+#define NUM_THINGS	(1000)
+
+static void test_timer_wheel_order(void)
+{
+	fr_timer_wheel_t	*tw;
+	tw_thing_t		*things, *thing;
+	fr_time_t		now, when;
+	unsigned int		i, num = 0;
+
+	things = talloc_zero_array(NULL, tw_thing_t, NUM_THINGS);
+	tw = fr_timer_wheel_alloc(things, tw_thing_t, node, fr_time_delta_from_msec(1), 64, MSEC(1000));
+	TEST_ASSERT(tw != NULL);
+
+	/*
+	 *	Spread the entries over several rotations of the wheel.
+	 */
+	for (i = 0; i < NUM_THINGS; i++) {
+		things[i].when = MSEC(1000 + (fr_rand() % 500));
+		fr_timer_wheel_insert(tw, &things[i], things[i].when);
+	}
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == NUM_THINGS);
+
+	for (now = MSEC(1000); fr_time_lt(now, MSEC(1507)); now = fr_time_add(now, fr_time_delta_from_msec(7))) {
+		/*
+		 *	The next time to check must never be after the first entry expires.
+		 */
+		if (fr_timer_wheel_next(tw, &when)) {
+			thing = fr_timer_wheel_first(tw);
+			TEST_ASSERT(thing != NULL);
+			TEST_CHECK(fr_time_lteq(when, thing->when));
+		}
+
+		while ((thing = fr_timer_wheel_peek(tw, now)) != NULL) {
+			TEST_CHECK(fr_time_lteq(thing->when, now));
+			TEST_CHECK(!thing->expired);
+
+			thing->expired = true;
+			fr_timer_wheel_remove(tw, thing);
+			num++;
+		}
+
+		/*
+		 *	Everything which has expired has been returned.
+		 */
+		for (i = 0; i < NUM_THINGS; i++) {
+			if (fr_time_lteq(things[i].when, now)) TEST_CHECK(things[i].expired);
+		}
+	}
+
+	TEST_CHECK(num == NUM_THINGS);
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 0);
+	TEST_CHECK(!fr_timer_wheel_next(tw, &when));
+
+	talloc_free(things);
+}
+
+static void test_timer_wheel_remove(void)
+{
+	fr_timer_wheel_t	*tw;
+	tw_thing_t		*things, *thing;
+	unsigned int		i;
+
+	things = talloc_zero_array(NULL, tw_thing_t, NUM_THINGS);
+	tw = fr_timer_wheel_alloc(things, tw_thing_t, node, fr_time_delta_from_msec(1), 256, MSEC(0));
+	TEST_ASSERT(tw != NULL);
+
+	for (i = 0; i < NUM_THINGS; i++) fr_timer_wheel_insert(tw, &things[i], MSEC(i));
+
+	/*
+	 *	Remove every other entry, and removing twice is fine.
+	 */
+	for (i = 0; i < NUM_THINGS; i += 2) {
+		fr_timer_wheel_remove(tw, &things[i]);
+		fr_timer_wheel_remove(tw, &things[i]);
+	}
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == NUM_THINGS / 2);
+
+	thing = fr_timer_wheel_first(tw);
+	TEST_CHECK(thing == &things[1]);
+
+	/*
+	 *	Moving an entry to the front.
+	 */
+	fr_timer_wheel_update(tw, &things[NUM_THINGS - 1], MSEC(0));
+	thing = fr_timer_wheel_first(tw);
+	TEST_CHECK(thing == &things[NUM_THINGS - 1]);
+
+	thing = fr_timer_wheel_peek(tw, MSEC(0));
+	TEST_CHECK(thing == &things[NUM_THINGS - 1]);
+
+	/*
+	 *	A long time passes.  Everything expires at once.
+	 */
+	for (i = 0; (thing = fr_timer_wheel_peek(tw, MSEC(100000))) != NULL; i++) {
+		fr_timer_wheel_remove(tw, thing);
+	}
+	TEST_CHECK(i == NUM_THINGS / 2);
+
+	talloc_free(things);
+}
+
+static void test_timer_wheel_pop_any(void)
+{
+	fr_timer_wheel_t	*tw;
+	tw_thing_t		*things;
+	unsigned int		i;
+
+	things = talloc_zero_array(NULL, tw_thing_t, NUM_THINGS);
+	tw = fr_timer_wheel_alloc(things, tw_thing_t, node, fr_time_delta_from_msec(1), 128, MSEC(0));
+	TEST_ASSERT(tw != NULL);
+
+	for (i = 0; i < NUM_THINGS; i++) fr_timer_wheel_insert(tw, &things[i], MSEC(fr_rand() % 10000));
+
+	for (i = 0; fr_timer_wheel_pop_any(tw) != NULL; i++);
+	TEST_CHECK(i == NUM_THINGS);
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 0);
+
+	talloc_free(things);
+}
+
+TEST_LIST = {
+	{ "timer_wheel_order",		test_timer_wheel_order },
+	{ "timer_wheel_remove",		test_timer_wheel_remove },
+	{ "timer_wheel_pop_any",	test_timer_wheel_pop_any },
+	{ NULL }
+};
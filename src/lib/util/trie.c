@@ -723,12 +723,88 @@ static fr_trie_comp_t *fr_trie_comp_alloc(TALLOC_CTX *ctx, int bits)
 }
 #endif	/* WITH_NODE_COMPRESSION */
 
+/*
+ *	Compiled tries use 6 bit chunks, so that each node's
+ *	children can be described by a 64-bit bitmap.
+ */
+#define POP_BITS	(6)
+#define POP_MAX_KEY_BITS (128)
+
+/** A node in a compiled trie
+ *
+ *  Children and leaves of a node are stored contiguously, and
+ *  indexed by counting the set bits in the bitmaps below the chunk
+ *  we're looking up.  Runs of identical leaves are stored once.
+ */
+typedef struct {
+	uint64_t	vector;		//!< Bit N is set if chunk N leads to another node.
+	uint64_t	leafvec;	//!< Bit N is set if chunk N starts a new run of leaves.
+	uint32_t	base0;		//!< Index of this node's first leaf.
+	uint32_t	base1;		//!< Index of this node's first child.
+} fr_trie_pop_node_t;
+
+/** A read-only, compiled form of a trie used for longest prefix matches
+ *
+ */
+typedef struct {
+	fr_trie_pop_node_t	*nodes;		//!< nodes[0] is the root.
+	void			**leaves;	//!< User data, or NULL for no match.
+	int			max_bits;	//!< Longest key in the trie.  Shorter lookups
+						///< must use the trie itself.
+} fr_trie_pop_t;
+
 typedef struct {
 	uint8_t		buffer[16]; /* for get_key callbacks */
 	fr_trie_key_t	get_key;
 	fr_free_t	free_data;
+	fr_trie_pop_t	*pop;		//!< Compiled form, if any.  Freed whenever the trie changes.
 } fr_trie_ctx_t;
 
+/** Get POP_BITS of a key, starting at start_bit.  Bits past the end of the key are zero.
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int trie_pop_chunk(uint8_t const *key, int keylen, int start_bit)
+{
+	int		byte = BYTEOF(start_bit);
+	int		bytes = BYTES(keylen);
+	unsigned int	chunk = 0;
+
+	if (byte < bytes) chunk = key[byte] << 8;
+	if ((byte + 1) < bytes) chunk |= key[byte + 1];
+
+	return (chunk >> (16 - POP_BITS - (start_bit & 0x07))) & ((1 << POP_BITS) - 1);
+}
+
+/** Longest prefix match in a compiled trie
+ *
+ */
+static void *trie_pop_lookup(fr_trie_pop_t const *pop, uint8_t const *key, int keylen)
+{
+	fr_trie_pop_node_t const	*node = &pop->nodes[0];
+	int				start_bit = 0;
+
+	while (true) {
+		uint64_t mask = ((uint64_t) 2 << trie_pop_chunk(key, keylen, start_bit)) - 1;
+
+		if (!(node->vector & (mask ^ (mask >> 1)))) {
+			return pop->leaves[node->base0 + __builtin_popcountll(node->leafvec & mask) - 1];
+		}
+
+		node = &pop->nodes[node->base1 + __builtin_popcountll(node->vector & mask) - 1];
+		start_bit += POP_BITS;
+	}
+}
+
+/** Discard the compiled form of a trie, as it no longer matches the trie
+ *
+ */
+static inline void trie_pop_free(fr_trie_user_t *user)
+{
+	fr_trie_ctx_t *uctx = user->data;
+
+	if (uctx) TALLOC_FREE(uctx->pop);
+}
+
 /** Allocate a trie
  *
  * @param ctx		The talloc ctx.
@@ -1262,6 +1338,7 @@ static void *trie_key_match(fr_trie_t *trie, uint8_t const *key, int start_bit,
 void *fr_trie_lookup_by_key(fr_trie_t const *ft, void const *key, size_t keylen)
 {
 	fr_trie_user_t *user;
+	fr_trie_ctx_t const *uctx;
 
 	if (keylen > MAX_KEY_BITS) return NULL;
 
@@ -1269,6 +1346,13 @@ void *fr_trie_lookup_by_key(fr_trie_t const *ft, void const *key, size_t keylen)
 
 	user = UNCONST(fr_trie_user_t *, ft);
 
+	/*
+	 *	The compiled form can only be used if no key in
+	 *	the trie is longer than the one we're looking up.
+	 */
+	uctx = user->data;
+	if (uctx->pop && ((int) keylen >= uctx->pop->max_bits)) return trie_pop_lookup(uctx->pop, key, keylen);
+
 	return trie_key_match(user->trie, key, 0, keylen, false);
 }
 
@@ -1901,7 +1985,11 @@ int fr_trie_insert_by_key(fr_trie_t *ft, void const *key, size_t keylen, void co
 
 	MPRINT3("%.*srecurse STARTS at %d with %.*s=%s\n", 0, spaces, __LINE__,
 		(int) keylen, key, my_data);
-	return trie_key_insert(user->data, &user->trie, key, 0, keylen, my_data);
+	if (trie_key_insert(user->data, &user->trie, key, 0, keylen, my_data) < 0) return -1;
+
+	trie_pop_free(user);
+
+	return 0;
 }
 
 /* REMOVE FUNCTIONS */
@@ -2154,6 +2242,7 @@ static void *trie_key_remove(TALLOC_CTX *ctx, fr_trie_t **trie_p, uint8_t const
 void *fr_trie_remove_by_key(fr_trie_t *ft, void const *key, size_t keylen)
 {
 	fr_trie_user_t *user;
+	void *data;
 
 	if (keylen > MAX_KEY_BITS) return NULL;
 
@@ -2164,7 +2253,10 @@ void *fr_trie_remove_by_key(fr_trie_t *ft, void const *key, size_t keylen)
 	/*
 	 *	Remove the user trie, not ft->trie.
 	 */
-	return trie_key_remove(user->data, &user->trie, key, 0, (int) keylen);
+	data = trie_key_remove(user->data, &user->trie, key, 0, (int) keylen);
+	if (data) trie_pop_free(user);
+
+	return data;
 }
 
 /* WALK FUNCTIONS */
@@ -2624,6 +2716,243 @@ int fr_trie_walk(fr_trie_t *ft, void *ctx, fr_trie_walk_t callback)
 }
 
 
+/* COMPILE FUNCTIONS */
+
+typedef struct {
+	uint8_t		key[BYTES(POP_MAX_KEY_BITS)];	//!< Zero padded past the end of the key.
+	int		keylen;
+	void		*data;
+} fr_trie_pop_entry_t;
+
+typedef struct {
+	fr_trie_pop_t		*pop;
+	fr_trie_pop_entry_t	*entries;
+	size_t			num_entries;
+	uint32_t		num_nodes;
+	uint32_t		num_leaves;
+} fr_trie_pop_build_t;
+
+static int _trie_pop_collect(uint8_t const *key, size_t keylen, void *data, void *uctx)
+{
+	fr_trie_pop_build_t	*build = uctx;
+	fr_trie_pop_entry_t	*entry;
+
+	if (keylen > POP_MAX_KEY_BITS) {
+		fr_strerror_printf("Key too long to compile (%u > %d)", (unsigned int) keylen, POP_MAX_KEY_BITS);
+		return -1;
+	}
+
+	if (build->num_entries == talloc_array_length(build->entries)) {
+		fr_trie_pop_entry_t *entries;
+
+		entries = talloc_realloc(build->pop, build->entries, fr_trie_pop_entry_t, build->num_entries * 2);
+		if (!entries) {
+			fr_strerror_const("Failed growing compiled trie entries");
+			return -1;
+		}
+		build->entries = entries;
+	}
+
+	entry = &build->entries[build->num_entries++];
+	memset(entry->key, 0, sizeof(entry->key));
+	memcpy(entry->key, key, BYTES(keylen));
+	if (keylen & 0x07) entry->key[BYTEOF(keylen)] &= (uint8_t) (0xff << (8 - (keylen & 0x07)));
+	entry->keylen = keylen;
+	entry->data = data;
+
+	if ((int) keylen > build->pop->max_bits) build->pop->max_bits = keylen;
+
+	return 0;
+}
+
+/** Order entries by key, and then by length
+ *
+ *  Keys in the same chunk are then contiguous, and each key sorts
+ *  before any longer keys it is a prefix of.
+ */
+static int trie_pop_entry_cmp(void const *one, void const *two)
+{
+	fr_trie_pop_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = memcmp(a->key, b->key, sizeof(a->key));
+	if (ret != 0) return ret;
+
+	return CMP(a->keylen, b->keylen);
+}
+
+static int trie_pop_grow(fr_trie_pop_build_t *build, uint32_t nodes, uint32_t leaves)
+{
+	fr_trie_pop_t *pop = build->pop;
+
+	if ((build->num_nodes + nodes) > talloc_array_length(pop->nodes)) {
+		fr_trie_pop_node_t *n;
+
+		n = talloc_realloc(pop, pop->nodes, fr_trie_pop_node_t, (build->num_nodes + nodes) * 2);
+		if (!n) return -1;
+		pop->nodes = n;
+	}
+
+	if ((build->num_leaves + leaves) > talloc_array_length(pop->leaves)) {
+		void **l;
+
+		l = talloc_realloc(pop, pop->leaves, void *, (build->num_leaves + leaves) * 2);
+		if (!l) return -1;
+		pop->leaves = l;
+	}
+
+	return 0;
+}
+
+/** Build one node of a compiled trie, and then its children
+ *
+ * @param[in] build	state.
+ * @param[in] idx	of the node we're building.  Already allocated.
+ * @param[in] start	first entry with a key longer than start_bit, below this node.
+ * @param[in] end	one past the last such entry.
+ * @param[in] start_bit	the depth of this node.
+ * @param[in] match	the longest match of any key shorter than, or equal to, start_bit.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int trie_pop_build(fr_trie_pop_build_t *build, uint32_t idx, size_t start, size_t end,
+			  int start_bit, void *match)
+{
+	fr_trie_pop_entry_t	*entries = build->entries;
+	fr_trie_pop_node_t	node = {};
+	void			*best[1 << POP_BITS];
+	int			best_len[1 << POP_BITS];
+	size_t			child_start[1 << POP_BITS], child_end[1 << POP_BITS];
+	void			*last = NULL;
+	size_t			i;
+	unsigned int		chunk, j;
+	uint32_t		num_leaves = 0, child;
+
+	for (chunk = 0; chunk < (1 << POP_BITS); chunk++) {
+		best[chunk] = match;
+		best_len[chunk] = start_bit;
+	}
+
+	/*
+	 *	Keys which end in this node cover one or more chunks.
+	 *	Keys which are longer go into a child node.
+	 */
+	for (i = start; i < end; i++) {
+		int bits = entries[i].keylen - start_bit;
+
+		chunk = trie_pop_chunk(entries[i].key, entries[i].keylen, start_bit);
+
+		if (bits > POP_BITS) {
+			if (!(node.vector & ((uint64_t) 1 << chunk))) {
+				node.vector |= ((uint64_t) 1 << chunk);
+				child_start[chunk] = i;
+			}
+			child_end[chunk] = i + 1;
+			continue;
+		}
+
+		for (j = chunk; j < (chunk + (1 << (POP_BITS - bits))); j++) {
+			if (entries[i].keylen <= best_len[j]) continue;
+
+			best[j] = entries[i].data;
+			best_len[j] = entries[i].keylen;
+		}
+	}
+
+	/*
+	 *	Leaves for chunks without a child.  Consecutive
+	 *	identical leaves are stored once.
+	 */
+	for (chunk = 0; chunk < (1 << POP_BITS); chunk++) {
+		if (node.vector & ((uint64_t) 1 << chunk)) continue;
+		if (num_leaves && (best[chunk] == last)) continue;
+
+		node.leafvec |= ((uint64_t) 1 << chunk);
+		last = best[chunk];
+		num_leaves++;
+	}
+
+	if (trie_pop_grow(build, __builtin_popcountll(node.vector), num_leaves) < 0) {
+		fr_strerror_const("Failed growing compiled trie");
+		return -1;
+	}
+
+	node.base0 = build->num_leaves;
+	node.base1 = build->num_nodes;
+
+	for (chunk = 0; chunk < (1 << POP_BITS); chunk++) {
+		if (node.leafvec & ((uint64_t) 1 << chunk)) build->pop->leaves[build->num_leaves++] = best[chunk];
+	}
+	build->num_nodes += __builtin_popcountll(node.vector);
+
+	build->pop->nodes[idx] = node;
+
+	/*
+	 *	Children are allocated together, so that they're
+	 *	contiguous.  Now fill them in.
+	 */
+	for (chunk = 0, child = node.base1; chunk < (1 << POP_BITS); chunk++) {
+		if (!(node.vector & ((uint64_t) 1 << chunk))) continue;
+
+		if (trie_pop_build(build, child++, child_start[chunk], child_end[chunk],
+				   start_bit + POP_BITS, best[chunk]) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Compile a trie into a read-only form for faster longest prefix matches
+ *
+ *  fr_trie_lookup_by_key() then uses the compiled form, which takes a
+ *  few cache lines per lookup, and avoids following a pointer per node.
+ *  Lookups with keys shorter than the longest key in the trie still use
+ *  the trie itself.
+ *
+ *  Any change to the trie discards the compiled form.  Callers should
+ *  compile the trie again once they're done making changes.
+ *
+ * @param[in] ft	to compile.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, e.g. keys longer than 128 bits.  Lookups still work,
+ *	  but use the trie itself.
+ */
+int fr_trie_compile(fr_trie_t *ft)
+{
+	fr_trie_user_t		*user = (fr_trie_user_t *) ft;
+	fr_trie_ctx_t		*uctx = talloc_get_type_abort(user->data, fr_trie_ctx_t);
+	fr_trie_pop_build_t	build = {};
+
+	TALLOC_FREE(uctx->pop);
+
+	build.pop = talloc_zero(uctx, fr_trie_pop_t);
+	if (!build.pop) {
+	oom:
+		fr_strerror_const("Failed allocating compiled trie");
+	error:
+		talloc_free(build.pop);
+		return -1;
+	}
+
+	build.entries = talloc_array(build.pop, fr_trie_pop_entry_t, 64);
+	if (!build.entries) goto oom;
+
+	if (ft->trie && (fr_trie_walk(ft, &build, _trie_pop_collect) < 0)) goto error;
+
+	qsort(build.entries, build.num_entries, sizeof(build.entries[0]), trie_pop_entry_cmp);
+
+	if (trie_pop_grow(&build, 1, 1 << POP_BITS) < 0) goto oom;
+	build.num_nodes = 1;
+
+	if (trie_pop_build(&build, 0, 0, build.num_entries, 0, NULL) < 0) goto error;
+
+	TALLOC_FREE(build.entries);
+	uctx->pop = build.pop;
+
+	return 0;
+}
+
 /**********************************************************************/
 
 /*
@@ -3073,6 +3402,7 @@ static int command_clear(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNU
 {
 	if (!ft->trie) return 0;
 
+	trie_pop_free((fr_trie_user_t *) ft);
 	trie_free(ft->trie);
 	ft->trie = NULL;
 
@@ -3085,6 +3415,32 @@ static int command_clear(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNU
 	return 0;
 }
 
+/**  Compile the trie, so that lookups use the compiled form.
+ *
+ *  Any later insert or remove discards the compiled form.
+ */
+static int command_compile(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNUSED char *out, UNUSED size_t outlen)
+{
+	if (fr_trie_compile(ft) < 0) {
+		MPRINT("Failed compiling trie - %s\n", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+/**  Print whether or not the trie has a compiled form.
+ *
+ */
+static int command_compiled(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, char *out, size_t outlen)
+{
+	fr_trie_user_t *user = (fr_trie_user_t *) ft;
+	fr_trie_ctx_t *uctx = user->data;
+
+	strlcpy(out, (uctx && uctx->pop) ? "yes" : "no", outlen);
+	return 0;
+}
+
 
 /**  Turn on line number debugging.
  *
@@ -3429,6 +3785,8 @@ static fr_trie_command_t commands[] = {
 	{ "verify",	command_verify,	0, 0, false },
 	{ "lineno",	command_lineno, 1, 1, false },
 	{ "clear",	command_clear,	0, 0, false },
+	{ "compile",	command_compile, 0, 0, false },
+	{ "compiled",	command_compiled, 0, 0, true },
 	{ NULL, NULL, 0, 0}
 };
 
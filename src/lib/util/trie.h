@@ -67,6 +67,8 @@ void		*fr_trie_remove_by_key(fr_trie_t *ft, void const *key, size_t keylen) CC_H
 
 int		fr_trie_walk(fr_trie_t *ft, void *ctx, fr_trie_walk_t callback) CC_HINT(nonnull(1,3));
 
+int		fr_trie_compile(fr_trie_t *ft) CC_HINT(nonnull);
+
 /*
  *	Data oriented API.
  */
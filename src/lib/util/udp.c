@@ -26,10 +26,74 @@ RCSID("$Id$")
 #include <freeradius-devel/util/socket.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/udp.h>
 
 #define FR_DEBUG_STRERROR_PRINTF if (fr_debug_lvl) fr_strerror_printf
 
+#define UDP_BATCH_CBUF_SIZE	(256)
+
+/*
+ *	Where recvmmsg() or sendmmsg() are missing, we use a structure
+ *	with the same layout, and call recvmsg() or sendmsg() for each
+ *	packet.
+ */
+#ifdef HAVE_RECVMMSG
+typedef struct mmsghdr udp_recv_mmsg_t;
+#else
+typedef struct {
+	struct msghdr		msg_hdr;		//!< Message header.
+	unsigned int		msg_len;		//!< Number of bytes received.
+} udp_recv_mmsg_t;
+#endif
+
+#ifdef HAVE_SENDMMSG
+typedef struct mmsghdr udp_send_mmsg_t;
+#else
+typedef struct {
+	struct msghdr		msg_hdr;		//!< Message header.
+	unsigned int		msg_len;		//!< Number of bytes sent.
+} udp_send_mmsg_t;
+#endif
+
+/** A set of packets received with one call to recvmmsg()
+ *
+ */
+struct udp_batch_s {
+	int			sockfd;			//!< we're reading from.
+	unsigned int		num;			//!< Maximum number of packets per system call.
+	unsigned int		received;		//!< Number of packets received by the last system call.
+	unsigned int		next;			//!< Next packet to return to the caller.
+	size_t			max_packet_size;	//!< Size of each packet buffer.
+	fr_time_t		when;			//!< When the last system call returned.
+
+	struct sockaddr_storage	local;			//!< Address the socket is bound to.
+	socklen_t		local_len;		//!< Length of the local address.
+
+	udp_recv_mmsg_t		*mmsgvec;		//!< Vector of inbound packets.
+	struct iovec		*iov;			//!< One per packet, pointing into buffer.
+	struct sockaddr_storage	*from;			//!< Source address of each packet.
+	uint8_t			*cbuf;			//!< Auxiliary data for each packet.
+	uint8_t			*buffer;		//!< Packet data.
+};
+
+/** A set of packets to be sent with one call to sendmmsg()
+ *
+ */
+struct udp_send_batch_s {
+	int			sockfd;			//!< we're writing to.
+	unsigned int		num;			//!< Maximum number of packets per system call.
+	unsigned int		queued;			//!< Number of packets waiting to be sent.
+	size_t			max_packet_size;	//!< Size of each packet buffer.
+	bool			set_src;		//!< Whether we can set the source address.
+
+	udp_send_mmsg_t		*mmsgvec;		//!< Vector of outbound packets.
+	struct iovec		*iov;			//!< One per packet, pointing into buffer.
+	struct sockaddr_storage	*to;			//!< Destination address of each packet.
+	uint8_t			*cbuf;			//!< Auxiliary data for each packet.
+	uint8_t			*buffer;		//!< Packet data.
+};
+
 /** Send a packet via a UDP socket.
  *
  * @param[in] sock		we're reading from.
@@ -208,3 +272,438 @@ done:
 
 	return slen;
 }
+
+/** Allocate a structure for receiving batches of UDP packets
+ *
+ * The socket must already be bound, as the local address is cached
+ * here instead of being looked up for every packet.
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] sockfd		we're reading from.
+ * @param[in] num		maximum number of packets to read with one system call.
+ * @param[in] max_packet_size	the largest packet we will accept.  Larger
+ *				packets are discarded.
+ * @return
+ *	- NULL on error.
+ *	- The new batch structure.
+ */
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size)
+{
+	udp_batch_t	*batch;
+	unsigned int	i;
+
+	fr_assert(num > 0);
+	fr_assert(max_packet_size > 0);
+
+	batch = talloc_zero(ctx, udp_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(batch);
+		return NULL;
+	}
+
+	batch->sockfd = sockfd;
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+
+	/*
+	 *	recvmsg doesn't provide the destination port, so we
+	 *	get it (and the bound address) once, here.
+	 */
+	batch->local_len = sizeof(batch->local);
+	if (getsockname(sockfd, (struct sockaddr *) &batch->local, &batch->local_len) < 0) {
+		fr_strerror_printf("Failed getting socket address: %s", fr_syserror(errno));
+		talloc_free(batch);
+		return NULL;
+	}
+
+	batch->mmsgvec = talloc_zero_array(batch, udp_recv_mmsg_t, num);
+	batch->iov = talloc_zero_array(batch, struct iovec, num);
+	batch->from = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_BATCH_CBUF_SIZE);
+	batch->buffer = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->mmsgvec || !batch->iov || !batch->from || !batch->cbuf || !batch->buffer) goto oom;
+
+	for (i = 0; i < num; i++) {
+		batch->iov[i].iov_base = batch->buffer + (i * max_packet_size);
+		batch->iov[i].iov_len = max_packet_size;
+
+		batch->mmsgvec[i].msg_hdr.msg_iov = &batch->iov[i];
+		batch->mmsgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return batch;
+}
+
+/** Read as many packets as are available, up to the size of the batch
+ *
+ * @param[in] batch	to fill.
+ * @param[in] flags	for things.
+ * @return
+ *	- > 0 on success (number of packets read).
+ *	- 0 on no data.
+ *	- < 0 on failure.
+ */
+static int udp_batch_fill(udp_batch_t *batch, int flags)
+{
+	unsigned int	i;
+	int		ret;
+	bool		connected = ((flags & UDP_FLAGS_CONNECTED) != 0);
+
+	batch->next = batch->received = 0;
+
+	for (i = 0; i < batch->num; i++) {
+		struct msghdr *msgh = &batch->mmsgvec[i].msg_hdr;
+
+		/*
+		 *	Connected sockets already know src/dst IP/port
+		 */
+		if (connected) {
+			msgh->msg_name = NULL;
+			msgh->msg_namelen = 0;
+			msgh->msg_control = NULL;
+			msgh->msg_controllen = 0;
+		} else {
+			msgh->msg_name = &batch->from[i];
+			msgh->msg_namelen = sizeof(batch->from[i]);
+			msgh->msg_control = batch->cbuf + (i * UDP_BATCH_CBUF_SIZE);
+			msgh->msg_controllen = UDP_BATCH_CBUF_SIZE;
+		}
+		msgh->msg_flags = 0;
+	}
+
+#ifdef HAVE_RECVMMSG
+	ret = recvmmsg(batch->sockfd, batch->mmsgvec, batch->num, 0, NULL);
+#else
+	/*
+	 *	No recvmmsg(), do it the slow way.  An error is only
+	 *	returned if no packets could be read.
+	 */
+	for (i = 0; i < batch->num; i++) {
+		ssize_t slen;
+
+		slen = recvmsg(batch->sockfd, &batch->mmsgvec[i].msg_hdr, 0);
+		if (slen < 0) break;
+
+		batch->mmsgvec[i].msg_len = (unsigned int) slen;
+	}
+	ret = (i > 0) ? (int) i : -1;
+#endif
+	if (ret < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return ret;
+	}
+
+	batch->received = ret;
+	batch->when = fr_time();
+
+	return ret;
+}
+
+/** Read a UDP packet, using a batch to minimise system calls
+ *
+ * This function has the same semantics as udp_recv(), except
+ * that the kernel is only asked for more packets once all of the
+ * packets from the previous read have been returned to the caller.
+ *
+ * As the remaining packets have already been taken from the
+ * socket, the file descriptor will not become readable for them.
+ * The caller MUST keep calling this function until
+ * udp_batch_pending() returns false.
+ *
+ * @param[in] batch		to read from.
+ * @param[in] flags		for things.  #UDP_FLAGS_PEEK is not supported.
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 on no data.
+ *	- < 0 on failure.
+ */
+ssize_t udp_recv_batch(udp_batch_t *batch, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+	udp_recv_mmsg_t		*mmsg;
+	size_t			len;
+
+	fr_assert((flags & UDP_FLAGS_PEEK) == 0);
+
+	if (when) *when = fr_time_wrap(0);
+
+	/*
+	 *	Always initialise the output socket structure
+	 */
+	*socket_out = (fr_socket_t){
+		.fd = batch->sockfd,
+		.type = SOCK_DGRAM,
+	};
+
+	if (batch->next == batch->received) {
+		int ret;
+
+		ret = udp_batch_fill(batch, flags);
+		if (ret <= 0) return ret;
+	}
+
+	mmsg = &batch->mmsgvec[batch->next++];
+
+	/*
+	 *	The packet is bigger than the caller will accept.
+	 *	udp_recv() would silently truncate it, but we know
+	 *	that it's bad, so discard it.
+	 */
+	if ((mmsg->msg_hdr.msg_flags & MSG_TRUNC) != 0) {
+		FR_DEBUG_STRERROR_PRINTF("Discarding packet larger than %zu bytes", batch->max_packet_size);
+		return 0;
+	}
+
+	if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+		struct sockaddr_storage	dst;
+		socklen_t		sizeof_dst;
+
+		/*
+		 *	Initialize the 'to' address.  It may be
+		 *	INADDR_ANY here, with a more specific address
+		 *	given by the auxiliary data.
+		 */
+		dst = batch->local;
+		sizeof_dst = batch->local_len;
+
+		recvfromto_cmsg_parse(&mmsg->msg_hdr, &socket_out->inet.ifindex,
+				      (struct sockaddr *) &dst, &sizeof_dst, when);
+
+		if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+					    mmsg->msg_hdr.msg_name, mmsg->msg_hdr.msg_namelen) < 0) {
+			fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+			return -1;
+		}
+		if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+					    &dst, sizeof_dst) < 0) {
+			fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+			return -1;
+		}
+	}
+
+	len = mmsg->msg_len;
+	if (len > data_len) len = data_len;
+
+	memcpy(data, mmsg->msg_hdr.msg_iov->iov_base, len);
+
+	/*
+	 *	We didn't get it from the kernel, so use the time
+	 *	the batch was read.
+	 */
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = batch->when;
+
+	return len;
+}
+
+/** Whether there are packets in the batch which haven't been returned to the caller
+ *
+ * @param[in] batch	to check.
+ * @return
+ *	- true if udp_recv_batch() will return a packet without reading the socket.
+ *	- false if the batch is empty.
+ */
+bool udp_batch_pending(udp_batch_t const *batch)
+{
+	return (batch->next < batch->received);
+}
+
+/** Allocate a structure for sending batches of UDP packets
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] sockfd		we're writing to.
+ * @param[in] num		maximum number of packets to write with one system call.
+ * @param[in] max_packet_size	the largest packet which can be queued.  Larger
+ *				packets are sent immediately.
+ * @return
+ *	- NULL on error.
+ *	- The new batch structure.
+ */
+udp_send_batch_t *udp_send_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size)
+{
+	udp_send_batch_t	*batch;
+	unsigned int		i;
+
+	fr_assert(num > 0);
+	fr_assert(max_packet_size > 0);
+
+	batch = talloc_zero(ctx, udp_send_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(batch);
+		return NULL;
+	}
+
+	batch->sockfd = sockfd;
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+	batch->set_src = true;
+
+#ifdef __FreeBSD__
+	/*
+	 *	FreeBSD won't let us use IP_SENDSRCADDR on sockets
+	 *	which are bound to a specific address.  See
+	 *	sendfromto().  As the socket is already bound, we
+	 *	only need to check once.
+	 */
+	{
+		struct sockaddr_storage	bound;
+		socklen_t		bound_len = sizeof(bound);
+
+		if (getsockname(sockfd, (struct sockaddr *) &bound, &bound_len) < 0) {
+			fr_strerror_printf("Failed getting socket address: %s", fr_syserror(errno));
+			talloc_free(batch);
+			return NULL;
+		}
+
+		switch (bound.ss_family) {
+		case AF_INET:
+			if (((struct sockaddr_in *) &bound)->sin_addr.s_addr != INADDR_ANY) batch->set_src = false;
+			break;
+
+		case AF_INET6:
+			if (!IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) &bound)->sin6_addr)) batch->set_src = false;
+			break;
+		}
+	}
+#endif
+
+	batch->mmsgvec = talloc_zero_array(batch, udp_send_mmsg_t, num);
+	batch->iov = talloc_zero_array(batch, struct iovec, num);
+	batch->to = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_BATCH_CBUF_SIZE);
+	batch->buffer = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->mmsgvec || !batch->iov || !batch->to || !batch->cbuf || !batch->buffer) goto oom;
+
+	for (i = 0; i < num; i++) {
+		batch->iov[i].iov_base = batch->buffer + (i * max_packet_size);
+	}
+
+	return batch;
+}
+
+/** Queue a UDP packet for sending
+ *
+ * The packet data is copied, so the caller can re-use the buffer
+ * immediately.  If the batch is full, the queued packets are sent
+ * first.
+ *
+ * @param[in] batch	to add the packet to.
+ * @param[in] sock	src/dst address and interface of the packet.
+ * @param[in] flags	for things.
+ * @param[in] data	to send.
+ * @param[in] data_len	length of data to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int udp_send_batch_add(udp_send_batch_t *batch, fr_socket_t const *sock, int flags, void *data, size_t data_len)
+{
+	struct msghdr	*msgh;
+	unsigned int	i;
+
+	fr_assert(sock->type == SOCK_DGRAM);
+	fr_assert(sock->fd == batch->sockfd);
+
+	/*
+	 *	Too big to queue, just send it now.
+	 */
+	if (data_len > batch->max_packet_size) return udp_send(sock, flags, data, data_len);
+
+	if ((batch->queued == batch->num) && (udp_send_batch_flush(batch) < 0)) return -1;
+
+	i = batch->queued;
+	msgh = &batch->mmsgvec[i].msg_hdr;
+
+	memcpy(batch->iov[i].iov_base, data, data_len);
+	batch->iov[i].iov_len = data_len;
+
+	memset(msgh, 0, sizeof(*msgh));
+	msgh->msg_iov = &batch->iov[i];
+	msgh->msg_iovlen = 1;
+
+	if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+		struct sockaddr_storage	src;
+		socklen_t		sizeof_src, sizeof_dst;
+
+		if (fr_ipaddr_to_sockaddr(&batch->to[i], &sizeof_dst,
+					  &sock->inet.dst_ipaddr, sock->inet.dst_port) < 0) return -1;
+
+		msgh->msg_name = &batch->to[i];
+		msgh->msg_namelen = sizeof_dst;
+
+		if (batch->set_src) {
+			if (fr_ipaddr_to_sockaddr(&src, &sizeof_src,
+						  &sock->inet.src_ipaddr, sock->inet.src_port) < 0) return -1;
+
+			sendfromto_cmsg_set(msgh, batch->cbuf + (i * UDP_BATCH_CBUF_SIZE),
+					    sock->inet.ifindex, (struct sockaddr *) &src);
+		}
+	}
+
+	batch->queued++;
+
+	return 0;
+}
+
+/** Send all of the queued packets
+ *
+ * Packets which can't be sent are dropped.  We still try to send
+ * the rest of the batch.
+ *
+ * @param[in] batch	to flush.
+ * @return
+ *	- 0 on success.
+ *	- -1 if one or more packets could not be sent.
+ */
+int udp_send_batch_flush(udp_send_batch_t *batch)
+{
+	unsigned int	sent = 0, failed = 0;
+
+	while (sent < batch->queued) {
+		int ret;
+
+#ifdef HAVE_SENDMMSG
+		ret = sendmmsg(batch->sockfd, batch->mmsgvec + sent, batch->queued - sent, 0);
+#else
+		/*
+		 *	No sendmmsg(), do it the slow way.  As with
+		 *	sendmmsg(), an error is only returned if the
+		 *	first packet couldn't be sent.
+		 */
+		{
+			unsigned int i;
+
+			for (i = sent; i < batch->queued; i++) {
+				if (sendmsg(batch->sockfd, &batch->mmsgvec[i].msg_hdr, 0) < 0) break;
+			}
+			ret = (i > sent) ? (int) (i - sent) : -1;
+		}
+#endif
+		if (ret <= 0) {
+			/*
+			 *	sendmmsg only returns an error if the
+			 *	first packet couldn't be sent.  Skip it.
+			 */
+			if (ret < 0) fr_strerror_printf("udp_send failed: %s", fr_syserror(errno));
+			failed++;
+			sent++;
+			continue;
+		}
+
+		sent += ret;
+	}
+
+	batch->queued = 0;
+
+	return (failed > 0) ? -1 : 0;
+}
@@ -31,6 +31,7 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/udpfromto.h>
 
@@ -47,6 +48,23 @@ ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipa
 ssize_t udp_recv(int sockfd, int flags,
 		 fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
 
+typedef struct udp_batch_s udp_batch_t;
+
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size);
+
+ssize_t udp_recv_batch(udp_batch_t *batch, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
+
+bool udp_batch_pending(udp_batch_t const *batch);
+
+typedef struct udp_send_batch_s udp_send_batch_t;
+
+udp_send_batch_t *udp_send_batch_alloc(TALLOC_CTX *ctx, int sockfd, unsigned int num, size_t max_packet_size);
+
+int udp_send_batch_add(udp_send_batch_t *batch, fr_socket_t const *sock, int flags, void *data, size_t data_len);
+
+int udp_send_batch_flush(udp_send_batch_t *batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,6 +51,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/base16.h>
 #include <freeradius-devel/util/dcursor.h>
+#include <freeradius-devel/util/intern.h>
 #include <freeradius-devel/util/size.h>
 #include <freeradius-devel/util/time.h>
 
@@ -660,6 +661,8 @@ static inline void fr_value_box_copy_meta(fr_value_box_t *dst, fr_value_box_t co
 	dst->tainted = src->tainted;
 	dst->safe_for = src->safe_for;
 	dst->secret = src->secret;
+	dst->borrowed = false;
+	dst->interned = false;
 	fr_value_box_list_entry_init(dst);
 }
 
@@ -692,6 +695,12 @@ int8_t fr_value_box_cmp(fr_value_box_t const *a, fr_value_box_t const *b)
 	{
 		size_t length;
 
+		/*
+		 *	Same buffer, e.g. both interned, or both
+		 *	shallow copies of the same value.
+		 */
+		if ((a->datum.ptr == b->datum.ptr) && (a->vb_length == b->vb_length)) return 0;
+
 		if (a->vb_length < b->vb_length) {
 			length = a->vb_length;
 		} else {
@@ -916,6 +925,35 @@ static int fr_value_box_cidr_cmp_op(fr_token_t op, int bytes,
  */
 extern int fr_regex_cmp_op(fr_token_t op, fr_value_box_t const *a, fr_value_box_t const *b);
 
+/** Convert the result of a comparison to the result of an operator
+ *
+ */
+static inline CC_HINT(always_inline) int value_box_cmp_op_result(fr_token_t op, int compare)
+{
+	switch (op) {
+	case T_OP_CMP_EQ:
+		return (compare == 0);
+
+	case T_OP_NE:
+		return (compare != 0);
+
+	case T_OP_LT:
+		return (compare < 0);
+
+	case T_OP_GT:
+		return (compare > 0);
+
+	case T_OP_LE:
+		return (compare <= 0);
+
+	case T_OP_GE:
+		return (compare >= 0);
+
+	default:
+		return 0;
+	}
+}
+
 /** Compare two attributes using an operator
  *
  * @param[in] op to use in comparison.
@@ -1057,28 +1095,116 @@ int fr_value_box_cmp_op(fr_token_t op, fr_value_box_t const *a, fr_value_box_t c
 	/*
 	 *	Now do the operator comparison.
 	 */
+	return value_box_cmp_op_result(op, compare);
+}
+
+/** Compare a value with every value in a list using an operator
+ *
+ * The type of the value is examined once.  For integer types and IPv4
+ * addresses, list entries of the same type are then compared directly,
+ * without going through #fr_value_box_cmp_op.  Entries of other types
+ * fall back to #fr_value_box_cmp_op.
+ *
+ * @param[in] op	to use in comparison.
+ * @param[in] a		Value to compare.  It is on the left of the operator.
+ * @param[in] list	of values to compare.  Each is on the right of the operator.
+ * @param[in] all	If true, all of the comparisons must be true.  If false,
+ *			only one of them must be.
+ * @return
+ *	- 1 if true.  An empty list is true only if all is true.
+ *	- 0 if false.
+ *	- -1 on failure.
+ */
+int fr_value_box_list_cmp_op(fr_token_t op, fr_value_box_t const *a, fr_value_box_list_t const *list, bool all)
+{
+	int rcode;
+
+	if (!fr_cond_assert(a->type != FR_TYPE_NULL)) return -1;
+
+	/*
+	 *	Stop at the first comparison which decides the result.
+	 */
+#define CMP_LIST(_cmp) \
+	do { \
+		fr_value_box_list_foreach(list, b) { \
+			if (unlikely(b->type != a->type)) { \
+				rcode = fr_value_box_cmp_op(op, a, b); \
+				if (rcode < 0) return -1; \
+			} else { \
+				rcode = value_box_cmp_op_result(op, _cmp); \
+			} \
+			if (rcode != all) return rcode; \
+		} \
+		return all; \
+	} while (0)
+
+#define CMP_LIST_FIELD(_field) CMP_LIST(CMP(a->vb_ ## _field, b->vb_ ## _field))
+
 	switch (op) {
 	case T_OP_CMP_EQ:
-		return (compare == 0);
-
 	case T_OP_NE:
-		return (compare != 0);
-
 	case T_OP_LT:
-		return (compare < 0);
-
 	case T_OP_GT:
-		return (compare > 0);
-
 	case T_OP_LE:
-		return (compare <= 0);
-
 	case T_OP_GE:
-		return (compare >= 0);
+		break;
 
 	default:
-		return 0;
+		goto generic;
 	}
+
+	switch (a->type) {
+	case FR_TYPE_BOOL:
+		CMP_LIST_FIELD(bool);
+
+	case FR_TYPE_UINT8:
+		CMP_LIST_FIELD(uint8);
+
+	case FR_TYPE_UINT16:
+		CMP_LIST_FIELD(uint16);
+
+	case FR_TYPE_UINT32:
+		CMP_LIST_FIELD(uint32);
+
+	case FR_TYPE_UINT64:
+		CMP_LIST_FIELD(uint64);
+
+	case FR_TYPE_INT8:
+		CMP_LIST_FIELD(int8);
+
+	case FR_TYPE_INT16:
+		CMP_LIST_FIELD(int16);
+
+	case FR_TYPE_INT32:
+		CMP_LIST_FIELD(int32);
+
+	case FR_TYPE_INT64:
+		CMP_LIST_FIELD(int64);
+
+	case FR_TYPE_SIZE:
+		CMP_LIST_FIELD(size);
+
+	/*
+	 *	Addresses are in network byte order, and
+	 *	always have a /32 prefix.
+	 */
+	case FR_TYPE_IPV4_ADDR:
+		CMP_LIST(CMP(ntohl(a->vb_ip.addr.v4.s_addr), ntohl(b->vb_ip.addr.v4.s_addr)));
+
+	default:
+		break;
+	}
+#undef CMP_LIST_FIELD
+#undef CMP_LIST
+
+generic:
+	fr_value_box_list_foreach(list, b) {
+		rcode = fr_value_box_cmp_op(op, a, b);
+		if (rcode < 0) return -1;
+		if (rcode != all) return rcode;
+	}
+
+	return all;
 }
 
 /** Convert a string value with escape sequences into its binary form
@@ -3614,6 +3740,78 @@ int fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 	return 0;
 }
 
+/** Whether a type is an integer which needs no special handling when cast
+ *
+ * bool, date and time_delta have their own rules.
+ */
+static inline CC_HINT(always_inline) bool value_box_is_plain_integer(fr_type_t type)
+{
+	switch (type) {
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT8:
+	case FR_TYPE_INT16:
+	case FR_TYPE_INT32:
+	case FR_TYPE_INT64:
+	case FR_TYPE_SIZE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Cast every value in a list to the same type, in place
+ *
+ * Values which are already of the right type only have their enumv
+ * updated.  Casts between integer types don't allocate memory, and are
+ * done directly, without going through #fr_value_box_cast.  Everything
+ * else is cast with #fr_value_box_cast_in_place.
+ *
+ * @param ctx		to allocate buffers in.
+ * @param list		of values to cast.
+ * @param dst_type	to cast to.
+ * @param dst_enumv	Aliases for values contained within the boxes.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Values before the one which failed have been cast,
+ *	  and the rest are unchanged.
+ */
+int fr_value_box_list_cast_in_place(TALLOC_CTX *ctx, fr_value_box_list_t *list,
+				    fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
+{
+	bool	to_integer;
+
+	if (!fr_cond_assert(dst_type != FR_TYPE_NULL)) return -1;
+
+	to_integer = value_box_is_plain_integer(dst_type);
+
+	fr_value_box_list_foreach(list, vb) {
+		fr_value_box_t tmp;
+
+		if (vb->type == dst_type) {
+			vb->enumv = dst_enumv;
+			continue;
+		}
+
+		if (!to_integer || !value_box_is_plain_integer(vb->type)) {
+			if (fr_value_box_cast_in_place(ctx, vb, dst_type, dst_enumv) < 0) return -1;
+			continue;
+		}
+
+		fr_value_box_init(&tmp, dst_type, NULL, vb->tainted);
+		if (fr_value_box_cast_integer_to_integer(ctx, &tmp, dst_type, dst_enumv, vb) < 0) return -1;
+
+		vb->type = dst_type;
+		vb->enumv = dst_enumv;
+		vb->datum = tmp.datum;
+	}
+
+	return 0;
+}
+
 /** Assign a #fr_value_box_t value from an #fr_ipaddr_t
  *
  * Automatically determines the type of the value box from the ipaddr address family
@@ -3672,7 +3870,60 @@ int fr_value_unbox_ipaddr(fr_ipaddr_t *dst, fr_value_box_t *src)
 	return 0;
 }
 
+/** Give a box its own copy of a buffer it shares with other boxes
+ *
+ * Buffers are shared by #fr_value_box_copy_shallow and #fr_pair_list_copy_shared,
+ * or borrowed by #fr_value_box_mem_borrow.
+ * They must be unshared before they're written to or reallocated.  The reference
+ * held by the box is left in place, and is released when its ctx is freed.
+ *
+ * @param[in] ctx	to allocate the new buffer in.
+ * @param[in] vb	to unshare the buffer of.
+ * @return
+ *	- 0 on success (or if the buffer wasn't shared).
+ *	- -1 on failure.
+ */
+static int value_box_unshare(TALLOC_CTX *ctx, fr_value_box_t *vb)
+{
+	void	*ptr;
+
+	if (!vb->datum.ptr) return 0;
+
+	/*
+	 *	Borrowed buffers may not be talloc chunks, so
+	 *	copy exactly what the box covers.
+	 */
+	if (vb->borrowed) {
+		if (vb->type == FR_TYPE_STRING) {
+			ptr = talloc_bstrndup(ctx, vb->vb_strvalue, vb->vb_length);
+		} else {
+			ptr = talloc_memdup(ctx, vb->datum.ptr, vb->vb_length);
+		}
+	} else if (likely(talloc_reference_count(vb->datum.ptr) == 0)) {
+		return 0;
+	} else {
+		ptr = talloc_memdup(ctx, vb->datum.ptr, talloc_get_size(vb->datum.ptr));
+	}
+	if (!ptr) {
+		fr_strerror_const("Failed copying shared value box buffer");
+		return -1;
+	}
+	if (vb->type == FR_TYPE_STRING) {
+		talloc_set_type(ptr, char);
+	} else {
+		talloc_set_type(ptr, uint8_t);
+	}
+	vb->datum.ptr = ptr;
+	vb->borrowed = false;
+	vb->interned = false;
+
+	return 0;
+}
+
 /** Clear/free any existing value
+ *
+ * Buffers which are shared with other boxes, or borrowed, are not freed.  They are
+ * released when the ctx holding the reference, or the buffer's parent, is freed.
  *
  * @note Do not use on uninitialised memory.
  *
@@ -3683,6 +3934,12 @@ void fr_value_box_clear_value(fr_value_box_t *data)
 	switch (data->type) {
 	case FR_TYPE_OCTETS:
 	case FR_TYPE_STRING:
+		if (data->borrowed) {
+			data->borrowed = false;
+			data->interned = false;
+			break;
+		}
+		if (data->datum.ptr && (talloc_reference_count(data->datum.ptr) > 0)) break;
 		if (data->secret) memset_explicit(data->datum.ptr, 0, data->vb_length);
 		talloc_free(data->datum.ptr);
 		break;
@@ -3753,6 +4010,18 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
 	{
 		char *str = NULL;
 
+		/*
+		 *	Pooled strings are immutable, so can be
+		 *	shared without any reference.
+		 */
+		if (src->interned) {
+			dst->vb_strvalue = src->vb_strvalue;
+			fr_value_box_copy_meta(dst, src);
+			dst->borrowed = true;
+			dst->interned = true;
+			break;
+		}
+
 		/*
 		 *	Zero length strings still have a one uint8 buffer
 		 */
@@ -3827,6 +4096,8 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
  * For #FR_TYPE_STRING and #FR_TYPE_OCTETS adds a reference from ctx so that the
  * buffer cannot be freed until the ctx is freed.
  *
+ * Borrowed buffers can't be referenced, so if ctx is not NULL they're copied.
+ *
  * @param[in] ctx	to add reference from.  If NULL no reference will be added.
  * @param[in] dst	to copy value to.
  * @param[in] src	to copy value from.
@@ -3840,6 +4111,16 @@ void fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_bo
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		if (src->borrowed) {
+			if (ctx) {
+				fr_value_box_copy(ctx, dst, src);
+				break;
+			}
+			dst->datum.ptr = src->datum.ptr;
+			fr_value_box_copy_meta(dst, src);
+			dst->borrowed = true;
+			break;
+		}
 		dst->datum.ptr = ctx ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
 		fr_value_box_copy_meta(dst, src);
 		break;
@@ -3859,6 +4140,18 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t *src
 {
 	if (!fr_cond_assert(src->type != FR_TYPE_NULL)) return -1;
 
+	/*
+	 *	Shared buffers can't be moved without
+	 *	pulling them out from under the other
+	 *	boxes, so copy them instead.
+	 */
+	if (fr_type_is_variable_size(src->type) && src->datum.ptr &&
+	    (src->borrowed || (talloc_reference_count(src->datum.ptr) > 0))) {
+		if (fr_value_box_copy(ctx, dst, src) < 0) return -1;
+		fr_value_box_clear_value(src);
+		return 0;
+	}
+
 	switch (src->type) {
 	default:
 		return fr_value_box_copy(ctx, dst, src);
@@ -3956,6 +4249,7 @@ int fr_value_box_strtrim(TALLOC_CTX *ctx, fr_value_box_t *vb)
 	char	*str;
 
 	if (!fr_cond_assert(vb->type == FR_TYPE_STRING)) return -1;
+	if (value_box_unshare(ctx, vb) < 0) return -1;
 
 	len = strlen(vb->vb_strvalue);
 	str = talloc_realloc(ctx, UNCONST(char *, vb->vb_strvalue), char, len + 1);
@@ -4109,11 +4403,12 @@ int fr_value_box_bstr_realloc(TALLOC_CTX *ctx, char **out, fr_value_box_t *dst,
 
 	fr_assert(dst->type == FR_TYPE_STRING);
 
-	memcpy(&cstr, &dst->vb_strvalue, sizeof(cstr));
-
 	clen = talloc_array_length(dst->vb_strvalue) - 1;
 	if (clen == len) return 0;	/* No change */
 
+	if (value_box_unshare(ctx, dst) < 0) return -1;
+	memcpy(&cstr, &dst->vb_strvalue, sizeof(cstr));
+
 	str = talloc_realloc(ctx, cstr, char, len + 1);
 	if (!str) {
 		fr_strerror_printf("Failed reallocing value box buffer to %zu bytes", len + 1);
@@ -4295,13 +4590,9 @@ int fr_value_box_bstrn_append(TALLOC_CTX *ctx, fr_value_box_t *dst, char const *
 		return -1;
 	}
 
+	if (!fr_cond_assert(dst->datum.ptr)) return -1;
+	if (value_box_unshare(ctx, dst) < 0) return -1;
 	ptr = dst->datum.ptr;
-	if (!fr_cond_assert(ptr)) return -1;
-
-	if (talloc_reference_count(ptr) > 0) {
-		fr_strerror_printf("%s: Boxed value has too many references", __FUNCTION__);
-		return -1;
-	}
 
 	nlen = dst->vb_length + len + 1;
 	nptr = talloc_realloc(ctx, ptr, char, dst->vb_length + len + 1);
@@ -4409,11 +4700,12 @@ int fr_value_box_mem_realloc(TALLOC_CTX *ctx, uint8_t **out, fr_value_box_t *dst
 
 	fr_assert(dst->type == FR_TYPE_OCTETS);
 
-	memcpy(&cbin, &dst->vb_octets, sizeof(cbin));
-
-	clen = talloc_array_length(dst->vb_octets);
+	clen = dst->borrowed ? dst->vb_length : talloc_array_length(dst->vb_octets);
 	if (clen == len) return 0;	/* No change */
 
+	if (value_box_unshare(ctx, dst) < 0) return -1;
+	memcpy(&cbin, &dst->vb_octets, sizeof(cbin));
+
 	/*
 	 *	Realloc the buffer.  If the new length is 0, we
 	 *	need to call talloc_array() instead of talloc_realloc()
@@ -4573,6 +4865,87 @@ void fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr
 	dst->vb_length = talloc_array_length(src);
 }
 
+/** Point a box at a region of a talloced buffer, without copying it
+ *
+ * Used by decoders to avoid copying octets out of received packets.  A reference
+ * from ctx to the buffer is added, so it cannot be freed until ctx is freed.
+ *
+ * The box is marked as borrowed.  The region is never freed or reallocated through
+ * the box, and is copied the first time the box's value is modified.
+ *
+ * @param[in] ctx 	to add the reference from.  Usually the pair holding dst.
+ * @param[in] dst 	to assign the region to.
+ * @param[in] enumv	Aliases for values.
+ * @param[in] buffer	talloced buffer containing src.
+ * @param[in] src	start of the region.
+ * @param[in] len	of the region.
+ * @param[in] tainted	Whether the value came from a trusted source.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_mem_borrow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+			    uint8_t const *buffer, uint8_t const *src, size_t len, bool tainted)
+{
+	fr_assert((src >= buffer) && ((src + len) <= (buffer + talloc_array_length(buffer))));
+
+	if (unlikely(!talloc_reference(ctx, buffer))) {
+		fr_strerror_const("Failed adding reference to borrowed buffer");
+		return -1;
+	}
+
+	fr_value_box_init(dst, FR_TYPE_OCTETS, enumv, tainted);
+	dst->vb_octets = src;
+	dst->vb_length = len;
+	dst->borrowed = true;
+
+	return 0;
+}
+
+/** Replace a string box's buffer with a copy from the global intern pool
+ *
+ * Boxes holding the same interned string share a single buffer, and compare
+ * equal without looking at their contents.  Worthwhile for long lived values
+ * which are likely to repeat, e.g. in cache entries.
+ *
+ * Interned boxes are treated as borrowed.  Copying one shares the buffer, and
+ * modifying one gives it its own copy first.
+ *
+ * Secret values are never interned, as the pool is never zeroed.  Boxes which
+ * aren't strings, or which can't be interned (too long, pool full), are left
+ * as they are.
+ *
+ * @param[in] vb	to intern.
+ * @return
+ *	- 1 if the box now points to the pool.
+ *	- 0 if the box was left unchanged.
+ */
+int fr_value_box_intern(fr_value_box_t *vb)
+{
+	char const	*str;
+	size_t		len;
+
+	if ((vb->type != FR_TYPE_STRING) || vb->secret || vb->immutable) return 0;
+	if (vb->interned) return 1;
+
+	len = vb->vb_length;
+	str = fr_intern_bstrndup(vb->vb_strvalue, len);
+	if (!str) return 0;
+
+	/*
+	 *	Only frees the old buffer (if we own it),
+	 *	the rest of the metadata is kept.
+	 */
+	fr_value_box_clear_value(vb);
+
+	vb->vb_strvalue = str;
+	vb->vb_length = len;
+	vb->borrowed = true;
+	vb->interned = true;
+
+	return 1;
+}
+
 /** Append data to an existing fr_value_box_t
  *
  * @param[in] ctx	Where to allocate any talloc buffers required.
@@ -4599,11 +4972,7 @@ int fr_value_box_mem_append(TALLOC_CTX *ctx, fr_value_box_t *dst, uint8_t const
 	}
 
 	if (!fr_cond_assert(dst->datum.ptr)) return -1;
-
-	if (talloc_reference_count(dst->datum.ptr) > 0) {
-		fr_strerror_printf("%s: Boxed value has too many references", __FUNCTION__);
-		return -1;
-	}
+	if (value_box_unshare(ctx, dst) < 0) return -1;
 
 	nlen = dst->vb_length + len;
 	nptr = talloc_realloc(ctx, dst->datum.ptr, uint8_t, dst->vb_length + len);
@@ -29,6 +29,14 @@ extern "C" {
 
 #define FR_MAX_STRING_LEN	254	/* RFC2138: string 0-253 octets */
 
+/** Bytes reserved alongside a talloced string or octets box (or pair) for its value
+ *
+ * Enough for values of up to 24 bytes, plus the terminating '\0' and alignment.
+ * Buffers of this size, allocated with the box or pair as their talloc ctx, come
+ * from the same chunk as the box instead of a separate malloc.
+ */
+#define FR_VALUE_BOX_INLINE_SIZE	32
+
 typedef struct value_box_s fr_value_box_t;
 
 #ifdef __cplusplus
@@ -176,6 +184,11 @@ struct value_box_s {
 	unsigned int   				secret : 1;		//!< Same as #fr_dict_attr_flags_t secret
 	unsigned int				immutable : 1;		//!< once set, the value cannot be changed
 	unsigned int				talloced : 1;		//!< Talloced, not stack or text allocated.
+	unsigned int				borrowed : 1;		//!< Buffer points into memory owned by something
+									///< else, e.g. a received packet.  It's never freed
+									///< or reallocated, and is copied before being modified.
+	unsigned int				interned : 1;		//!< String lives in the global intern pool, see
+									///< #fr_intern_bstrndup.  Implies borrowed.
 
 	unsigned int				edit : 1;		//!< to control foreach / edits
 
@@ -597,7 +610,15 @@ fr_value_box_t *_fr_value_box_alloc(NDEBUG_LOCATION_ARGS TALLOC_CTX *ctx, fr_typ
 {
 	fr_value_box_t *vb;
 
-	vb = talloc(ctx, fr_value_box_t);
+	/*
+	 *	Reserve space for short strings and octets
+	 *	in the same chunk as the box.
+	 */
+	if (fr_type_is_variable_size(type)) {
+		vb = talloc_pooled_object(ctx, fr_value_box_t, 1, FR_VALUE_BOX_INLINE_SIZE);
+	} else {
+		vb = talloc(ctx, fr_value_box_t);
+	}
 	if (unlikely(!vb)) return NULL;
 
 	_fr_value_box_init(NDEBUG_LOCATION_VALS vb, type, enumv, false);
@@ -982,6 +1003,9 @@ int8_t		fr_value_box_cmp(fr_value_box_t const *a, fr_value_box_t const *b)
 int		fr_value_box_cmp_op(fr_token_t op, fr_value_box_t const *a, fr_value_box_t const *b)
 		CC_HINT(nonnull);
 
+int		fr_value_box_list_cmp_op(fr_token_t op, fr_value_box_t const *a, fr_value_box_list_t const *list, bool all)
+		CC_HINT(nonnull);
+
 /*
  *	Conversion
  */
@@ -1035,6 +1059,10 @@ int		fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 					   fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
 		CC_HINT(nonnull(1));
 
+int		fr_value_box_list_cast_in_place(TALLOC_CTX *ctx, fr_value_box_list_t *list,
+						fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
+		CC_HINT(nonnull(2));
+
 bool		fr_value_box_is_truthy(fr_value_box_t const *box)
 		CC_HINT(nonnull(1));
 
@@ -1178,6 +1206,13 @@ void		fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, f
 						   uint8_t const *src, bool tainted)
 		CC_HINT(nonnull(2,4));
 
+int		fr_value_box_mem_borrow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+					uint8_t const *buffer, uint8_t const *src, size_t len, bool tainted)
+		CC_HINT(nonnull(1,2,4,5));
+
+int		fr_value_box_intern(fr_value_box_t *vb)
+		CC_HINT(nonnull);
+
 int		fr_value_box_mem_append(TALLOC_CTX *ctx, fr_value_box_t *dst,
 				       uint8_t const *src, size_t len, bool tainted)
 		CC_HINT(nonnull(2,3));
@@ -0,0 +1,221 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for comparing and casting lists of value boxes
+ *
+ * @file src/lib/util/value_tests.c
+ * @copyright 2026 Network RADIUS SAS (legal@networkradius.com)
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/value.h>
+
+static fr_value_box_t *box_uint32(TALLOC_CTX *ctx, fr_value_box_list_t *list, uint32_t value)
+{
+	fr_value_box_t *vb;
+
+	vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL);
+	TEST_CHECK(vb != NULL);
+	vb->vb_uint32 = value;
+	if (list) fr_value_box_list_insert_tail(list, vb);
+
+	return vb;
+}
+
+static fr_value_box_t *box_uint64(TALLOC_CTX *ctx, fr_value_box_list_t *list, uint64_t value)
+{
+	fr_value_box_t *vb;
+
+	vb = fr_value_box_alloc(ctx, FR_TYPE_UINT64, NULL);
+	TEST_CHECK(vb != NULL);
+	vb->vb_uint64 = value;
+	if (list) fr_value_box_list_insert_tail(list, vb);
+
+	return vb;
+}
+
+static fr_value_box_t *box_ipv4(TALLOC_CTX *ctx, fr_value_box_list_t *list, fr_type_t type,
+				uint32_t addr, uint8_t prefix)
+{
+	fr_value_box_t *vb;
+
+	vb = fr_value_box_alloc(ctx, type, NULL);
+	TEST_CHECK(vb != NULL);
+	vb->vb_ip.af = AF_INET;
+	vb->vb_ip.prefix = prefix;
+	vb->vb_ip.addr.v4.s_addr = htonl(addr);
+	if (list) fr_value_box_list_insert_tail(list, vb);
+
+	return vb;
+}
+
+static void test_list_cmp_op_any_all(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_value_box_list_t	list;
+	fr_value_box_t		*a;
+
+	fr_value_box_list_init(&list);
+	a = box_uint32(ctx, NULL, 5);
+
+	TEST_CASE("Empty list is only true for all");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, false), 0);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, true), 1);
+
+	box_uint32(ctx, &list, 3);
+	box_uint32(ctx, &list, 5);
+	box_uint32(ctx, &list, 7);
+
+	TEST_CASE("== matches any, but not all");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, false), 1);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, true), 0);
+
+	TEST_CASE("!= matches any, but not all");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_NE, a, &list, false), 1);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_NE, a, &list, true), 0);
+
+	TEST_CASE("< and >= are the value on the left of the operator");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_LT, a, &list, false), 1);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_LT, a, &list, true), 0);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_GE, a, &list, true), 0);
+
+	a->vb_uint32 = 7;
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_GE, a, &list, true), 1);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_GT, a, &list, true), 0);
+
+	a->vb_uint32 = 1;
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_LT, a, &list, true), 1);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, false), 0);
+
+	talloc_free(ctx);
+}
+
+static void test_list_cmp_op_ipv4(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_value_box_list_t	list;
+	fr_value_box_t		*a;
+
+	fr_value_box_list_init(&list);
+	a = box_ipv4(ctx, NULL, FR_TYPE_IPV4_ADDR, 0x0a000001, 32);
+
+	box_ipv4(ctx, &list, FR_TYPE_IPV4_ADDR, 0x09000001, 32);
+	box_ipv4(ctx, &list, FR_TYPE_IPV4_ADDR, 0x0b000001, 32);
+
+	TEST_CASE("IPv4 addresses compare in host byte order");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, false), 0);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_GT, a, &list, false), 1);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_GT, a, &list, true), 0);
+
+	box_ipv4(ctx, &list, FR_TYPE_IPV4_ADDR, 0x0a000001, 32);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, false), 1);
+
+	talloc_free(ctx);
+}
+
+static void test_list_cmp_op_mismatch(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_value_box_list_t	list;
+	fr_value_box_t		*a;
+
+	fr_value_box_list_init(&list);
+	a = box_ipv4(ctx, NULL, FR_TYPE_IPV4_ADDR, 0x0a000001, 32);
+
+	TEST_CASE("Entries of other types use the generic comparison");
+	box_ipv4(ctx, &list, FR_TYPE_IPV4_PREFIX, 0x0a000000, 8);
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_LT, a, &list, true), 1);	/* 10.0.0.1 is within 10/8 */
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, true), 0);
+
+	fr_value_box_list_talloc_free(&list);
+
+	a = box_uint32(ctx, NULL, 5);
+	box_uint32(ctx, &list, 5);
+	box_uint64(ctx, &list, 5);
+
+	TEST_CASE("Comparison stops once the result is known");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, false), 1);
+
+	TEST_CASE("Values which can't be compared are an error");
+	TEST_CHECK_RET(fr_value_box_list_cmp_op(T_OP_CMP_EQ, a, &list, true), -1);
+
+	talloc_free(ctx);
+}
+
+static void test_list_cast_in_place(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_value_box_list_t	list;
+	fr_value_box_t		*one, *two;
+
+	fr_value_box_list_init(&list);
+	one = box_uint32(ctx, &list, 1);
+	two = box_uint64(ctx, &list, 2);
+
+	TEST_CASE("Integers are cast to the same type");
+	TEST_CHECK_RET(fr_value_box_list_cast_in_place(ctx, &list, FR_TYPE_UINT16, NULL), 0);
+	TEST_CHECK(one->type == FR_TYPE_UINT16);
+	TEST_CHECK(one->vb_uint16 == 1);
+	TEST_CHECK(two->type == FR_TYPE_UINT16);
+	TEST_CHECK(two->vb_uint16 == 2);
+	TEST_CHECK_LEN(fr_value_box_list_num_elements(&list), 2);
+
+	TEST_CASE("Other types are cast, too");
+	TEST_CHECK_RET(fr_value_box_list_cast_in_place(ctx, &list, FR_TYPE_STRING, NULL), 0);
+	TEST_CHECK(one->type == FR_TYPE_STRING);
+	TEST_CHECK_STRCMP(one->vb_strvalue, "1");
+	TEST_CHECK(two->type == FR_TYPE_STRING);
+	TEST_CHECK_STRCMP(two->vb_strvalue, "2");
+
+	talloc_free(ctx);
+}
+
+static void test_list_cast_in_place_overflow(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_value_box_list_t	list;
+	fr_value_box_t		*one, *big, *three;
+
+	fr_value_box_list_init(&list);
+	one = box_uint32(ctx, &list, 1);
+	big = box_uint32(ctx, &list, 300);
+	three = box_uint32(ctx, &list, 3);
+
+	TEST_CASE("Values which don't fit in the destination type fail");
+	TEST_CHECK_RET(fr_value_box_list_cast_in_place(ctx, &list, FR_TYPE_UINT8, NULL), -1);
+
+	TEST_CASE("Values before the failure are cast, the rest are unchanged");
+	TEST_CHECK(one->type == FR_TYPE_UINT8);
+	TEST_CHECK(one->vb_uint8 == 1);
+	TEST_CHECK(big->type == FR_TYPE_UINT32);
+	TEST_CHECK(big->vb_uint32 == 300);
+	TEST_CHECK(three->type == FR_TYPE_UINT32);
+	TEST_CHECK(three->vb_uint32 == 3);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "list_cmp_op_any_all",		test_list_cmp_op_any_all },
+	{ "list_cmp_op_ipv4",			test_list_cmp_op_ipv4 },
+	{ "list_cmp_op_mismatch",		test_list_cmp_op_mismatch },
+
+	{ "list_cast_in_place",			test_list_cast_in_place },
+	{ "list_cast_in_place_overflow",	test_list_cast_in_place_overflow },
+
+	{ NULL }
+};
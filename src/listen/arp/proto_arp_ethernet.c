@@ -24,6 +24,7 @@
  */
 #include <netdb.h>
 #include <freeradius-devel/server/protocol.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
@@ -33,15 +34,31 @@
 
 extern fr_app_io_t proto_arp_ethernet;
 
+/** How many requests answered from the static table are handled in one read
+ *
+ */
+#define PROTO_ARP_STATIC_BATCH	(64)
+
 typedef struct {
 	char const			*name;			//!< socket name
 	fr_pcap_t			*pcap;			//!< PCAP handler
 } proto_arp_ethernet_thread_t;
 
+/** An IP address we answer for without running policy
+ *
+ */
+typedef struct {
+	uint8_t				ipaddr[4];		//!< Target protocol address.
+	uint8_t				ether[ETHER_ADDR_LEN];	//!< Hardware address to reply with.
+} proto_arp_ethernet_static_t;
+
 typedef struct {
 	CONF_SECTION			*cs;			//!< our configuration
 	char const			*interface;		//!< Interface to bind to.
 	char const			*filter;		//!< Additional PCAP filter
+	uint32_t			buffer_packets;		//!< Size of the capture ring, in packets.
+
+	fr_hash_table_t			*static_table;		//!< Of proto_arp_ethernet_static_t, or NULL.
 } proto_arp_ethernet_t;
 
 
@@ -54,13 +71,119 @@ static conf_parser_t const arp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("filter", proto_arp_ethernet_t, filter) },
 
+	{ FR_CONF_OFFSET("buffer_packets", proto_arp_ethernet_t, buffer_packets) },
+
 	CONF_PARSER_TERMINATOR
 };
 
+static uint32_t static_hash(void const *data)
+{
+	proto_arp_ethernet_static_t const *entry = data;
+
+	return fr_hash(entry->ipaddr, sizeof(entry->ipaddr));
+}
+
+static int8_t static_cmp(void const *one, void const *two)
+{
+	proto_arp_ethernet_static_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, ipaddr, sizeof(a->ipaddr));
+	return 0;
+}
+
+/** Send an ARP packet, wrapped in an ethernet header
+ *
+ * The ethernet source is our MAC address, and the destination is the
+ * target hardware address from ARP.
+ */
+static int arp_ethernet_send(proto_arp_ethernet_thread_t *thread, uint8_t const *buffer, size_t buffer_len)
+{
+	int			ret;
+	uint8_t			arp_packet[64] = { 0 };
+	ethernet_header_t	*eth_hdr;
+	fr_arp_packet_t		*arp;
+	/* Pointer to the current position in the frame */
+	uint8_t			*end = arp_packet;
+
+	/* fill in Ethernet layer (L2) */
+	eth_hdr = (ethernet_header_t *)arp_packet;
+	eth_hdr->ether_type = htons(ETH_TYPE_ARP);
+	end += ETHER_ADDR_LEN + ETHER_ADDR_LEN + sizeof(eth_hdr->ether_type);
+
+	/*
+	 *	Just copy what FreeRADIUS has encoded for us.
+	 */
+	arp = (fr_arp_packet_t *) end;
+	memcpy(arp, buffer, buffer_len);
+
+	/*
+	 *	Set our MAC address as the ethernet source.
+	 *
+	 *	Set the destination MAC as the target address from
+	 *	ARP.
+	 */
+	memcpy(eth_hdr->src_addr, thread->pcap->ether_addr, ETHER_ADDR_LEN);
+	memcpy(eth_hdr->dst_addr, arp->tha, ETHER_ADDR_LEN);
+
+	ret = pcap_inject(thread->pcap->handle, arp_packet, (end - arp_packet + buffer_len));
+	if (ret < 0) {
+		fr_strerror_printf("Error sending packet with pcap: %d, %s", ret, pcap_geterr(thread->pcap->handle));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Answer an ARP request from the static table
+ *
+ * @return
+ *	- true if the request was answered.
+ *	- false if it has to go through policy.
+ */
+static bool arp_static_reply(proto_arp_ethernet_t const *inst, proto_arp_ethernet_thread_t *thread,
+			     fr_arp_packet_t const *request)
+{
+	proto_arp_ethernet_static_t const	*entry;
+	fr_arp_packet_t				reply;
+
+	/*
+	 *	Only ethernet / IPv4 requests.  Gratuitous ARPs
+	 *	announce the sender's address, and aren't answered.
+	 */
+	if ((fr_nbo_to_uint16(request->op) != FR_ARP_REQUEST) ||
+	    (fr_nbo_to_uint16(request->htype) != 1) || (fr_nbo_to_uint16(request->ptype) != 0x0800) ||
+	    (request->hlen != ETHER_ADDR_LEN) || (request->plen != 4) ||
+	    (memcmp(request->spa, request->tpa, sizeof(request->tpa)) == 0)) return false;
+
+	entry = fr_hash_table_find(inst->static_table, &(proto_arp_ethernet_static_t){
+			.ipaddr = { request->tpa[0], request->tpa[1], request->tpa[2], request->tpa[3] }
+		});
+	if (!entry) return false;
+
+	memcpy(&reply, request, sizeof(reply));
+	fr_nbo_from_uint16(reply.op, FR_ARP_REPLY);
+	memcpy(reply.sha, entry->ether, sizeof(reply.sha));
+	memcpy(reply.spa, request->tpa, sizeof(reply.spa));
+	memcpy(reply.tha, request->sha, sizeof(reply.tha));
+	memcpy(reply.tpa, request->spa, sizeof(reply.tpa));
+
+	/*
+	 *	Failing to send is the same as the request being
+	 *	lost, the client will ask again.
+	 */
+	if (arp_ethernet_send(thread, (uint8_t const *)&reply, sizeof(reply)) < 0) {
+		DEBUG("Failed sending static ARP reply: %s", fr_strerror());
+	}
+
+	return true;
+}
+
 static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
+	proto_arp_ethernet_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_arp_ethernet_t);
 	proto_arp_ethernet_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_arp_ethernet_thread_t);
-	int				ret;
+	proto_arp_t const		*parent = talloc_get_type_abort_const(li->app_instance, proto_arp_t);
+	int				ret, i = 0;
 	uint8_t const			*data;
 	struct pcap_pkthdr		*header;
 	uint8_t const			*p, *end;
@@ -68,6 +191,7 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 
 	*leftover = 0;		/* always for message oriented protocols */
 
+next:
 	ret = pcap_next_ex(thread->pcap->handle, &header, &data);
 	if (ret == 0) return 0;
 	if (ret < 0) {
@@ -90,6 +214,18 @@ static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *re
 		return 0;
 	}
 
+	/*
+	 *	Requests for addresses in the static table are
+	 *	answered here, without allocating a request.  Keep
+	 *	reading until we find one which needs policy, but not
+	 *	forever, other sockets need servicing too.
+	 */
+	if (inst->static_table && parent->active &&
+	    arp_static_reply(inst, thread, (fr_arp_packet_t const *) p)) {
+		if (++i < PROTO_ARP_STATIC_BATCH) goto next;
+		return 0;
+	}
+
 	/*
 	 *	Shouldn't happen.
 	 */
@@ -111,48 +247,17 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_tim
 {
 	proto_arp_ethernet_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_arp_ethernet_thread_t);
 
-	int			ret;
-	uint8_t			arp_packet[64] = { 0 };
-	ethernet_header_t	*eth_hdr;
-	fr_arp_packet_t		*arp;
-	/* Pointer to the current position in the frame */
-	uint8_t			*end = arp_packet;
-
 	/*
 	 *	Don't write anything.
 	 */
 	if (buffer_len == 1) return buffer_len;
 
-	/* fill in Ethernet layer (L2) */
-	eth_hdr = (ethernet_header_t *)arp_packet;
-	eth_hdr->ether_type = htons(ETH_TYPE_ARP);
-	end += ETHER_ADDR_LEN + ETHER_ADDR_LEN + sizeof(eth_hdr->ether_type);
-
-	/*
-	 *	Just copy what FreeRADIUS has encoded for us.
-	 */
-	arp = (fr_arp_packet_t *) end;
-	memcpy(arp, buffer, buffer_len);
-
-	/*
-	 *	Set our MAC address as the ethernet source.
-	 *
-	 *	Set the destination MAC as the target address from
-	 *	ARP.
-	 */
-	memcpy(eth_hdr->src_addr, thread->pcap->ether_addr, ETHER_ADDR_LEN);
-	memcpy(eth_hdr->dst_addr, arp->tha, ETHER_ADDR_LEN);
-
 	/*
 	 *	If we fail injecting the reply, just ignore it.
 	 *	Returning <0 means "close the socket", which is likely
 	 *	not what we want.
 	 */
-	ret = pcap_inject(thread->pcap->handle, arp_packet, (end - arp_packet + buffer_len));
-	if (ret < 0) {
-		fr_strerror_printf("Error sending packet with pcap: %d, %s", ret, pcap_geterr(thread->pcap->handle));
-		return 0;
-	}
+	if (arp_ethernet_send(thread, buffer, buffer_len) < 0) return 0;
 
 	/*
 	 *	@todo - mirror src/protocols/dhcpv4/pcap.c for ARP send / receive.
@@ -179,6 +284,13 @@ static int mod_open(fr_listen_t *li)
 		return -1;
 	}
 
+	/*
+	 *	libpcap captures into a memory mapped ring where the
+	 *	platform has one.  Make it big enough to absorb
+	 *	bursts of broadcast ARPs.
+	 */
+	thread->pcap->buffer_pkts = inst->buffer_packets;
+
 	if (fr_pcap_open(thread->pcap) < 0) {
 		PERROR("Failed opening interface %s", inst->interface);
 		return -1;
@@ -216,12 +328,65 @@ static char const *mod_name(fr_listen_t *li)
 }
 
 
+/** Parse the table of addresses to answer for without running policy
+ *
+ */
+static int static_table_parse(proto_arp_ethernet_t *inst, CONF_SECTION *cs)
+{
+	CONF_ITEM *ci = NULL;
+
+	inst->static_table = fr_hash_table_talloc_alloc(inst, proto_arp_ethernet_static_t,
+							static_hash, static_cmp, NULL);
+	if (!inst->static_table) return -1;
+
+	while ((ci = cf_item_next(cs, ci))) {
+		CONF_PAIR			*cp;
+		proto_arp_ethernet_static_t	*entry;
+		fr_value_box_t			ip, ether;
+		char const			*value;
+
+		if (!cf_item_is_pair(ci)) {
+			cf_log_err(ci, "Entries in 'static' must be of the form '<ipaddr> = <macaddr>'");
+			return -1;
+		}
+		cp = cf_item_to_pair(ci);
+		value = cf_pair_value(cp);
+
+		if (fr_value_box_from_str(NULL, &ip, FR_TYPE_IPV4_ADDR, NULL,
+					  cf_pair_attr(cp), strlen(cf_pair_attr(cp)), NULL, false) < 0) {
+			cf_log_perr(ci, "Invalid IPv4 address");
+			return -1;
+		}
+
+		if (!value || (fr_value_box_from_str(NULL, &ether, FR_TYPE_ETHERNET, NULL,
+						     value, strlen(value), NULL, false) < 0)) {
+			cf_log_perr(ci, "Invalid MAC address");
+			return -1;
+		}
+
+		MEM(entry = talloc_zero(inst->static_table, proto_arp_ethernet_static_t));
+		memcpy(entry->ipaddr, &ip.vb_ip.addr.v4.s_addr, sizeof(entry->ipaddr));
+		memcpy(entry->ether, ether.vb_ether, sizeof(entry->ether));
+
+		if (!fr_hash_table_insert(inst->static_table, entry)) {
+			cf_log_err(ci, "Duplicate entry for %s", cf_pair_attr(cp));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	proto_arp_ethernet_t 	*inst = talloc_get_type_abort(mctx->mi->data, proto_arp_ethernet_t);
+	CONF_SECTION		*cs;
 
 	inst->cs = mctx->mi->conf;
 
+	cs = cf_section_find(inst->cs, "static", NULL);
+	if (cs && (static_table_parse(inst, cs) < 0)) return -1;
+
 	return 0;
 }
 
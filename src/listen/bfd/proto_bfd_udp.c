@@ -22,6 +22,8 @@
  * @copyright 2023 Network RADIUS SAS (legal@networkradius.com)
  */
 #include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/util/udp.h>
 #include <freeradius-devel/util/trie.h>
@@ -34,6 +36,41 @@
 
 extern fr_app_io_t proto_bfd_udp;
 
+typedef struct proto_bfd_udp_s proto_bfd_udp_t;
+
+/** Runs the BFD sessions of a listener in their own thread
+ *
+ * The engine owns the BFD socket, and the timers of every session.
+ * Control packets are sent and received without going through the
+ * network thread, or the workers.  Only packets which change the
+ * state of a session are passed to the listener, through a
+ * socketpair.
+ */
+typedef struct {
+	proto_bfd_udp_t const		*inst;			//!< our instance
+	char const			*name;			//!< socket name
+
+	int				sockfd;			//!< BFD socket, only read by the engine.
+	int				notify_fd;		//!< engine side of the socketpair to the listener
+	int				exit_fd[2];		//!< written to tell the engine to exit
+
+	fr_event_list_t			*el;			//!< the engine's own event list
+	pthread_t			pthread_id;		//!< the engine thread
+	bool				running;		//!< whether the thread needs to be joined
+
+	fr_stats_t			stats;			//!< statistics for packets read by the engine
+} proto_bfd_udp_engine_t;
+
+/** A packet passed from the engine to the listener
+ *
+ */
+typedef struct {
+	uint8_t				data[sizeof(bfd_wrapper_t) + sizeof(bfd_packet_t)];	//!< bfd_wrapper_t and packet
+	size_t				data_len;		//!< length of the wrapper and packet
+	fr_socket_t			socket;			//!< the packet was received on
+	fr_time_t			recv_time;		//!< when the engine received the packet
+} proto_bfd_udp_notify_t;
+
 typedef struct {
 	char const			*name;			//!< socket name
 	int				sockfd;
@@ -42,9 +79,10 @@ typedef struct {
 
 	fr_stats_t			stats;			//!< statistics for this socket
 
+	proto_bfd_udp_engine_t		*engine;		//!< runs the sessions, if 'dedicated_thread = yes'
 } proto_bfd_udp_thread_t;
 
-typedef struct {
+struct proto_bfd_udp_s {
 	CONF_SECTION			*cs;			//!< our configuration
 	char const			*server_name;		//!< virtual server name
 
@@ -61,6 +99,7 @@ typedef struct {
 	uint8_t				ttl;			//!< default ttl
 
 	bool				only_state_changes;	//!< on read(), only send packets which signal a state change
+	bool				dedicated_thread;	//!< run the sessions in their own thread
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
 	bool				send_buff_is_set;	//!< Whether we were provided with a send_buff
@@ -71,7 +110,7 @@ typedef struct {
 	fr_trie_t			*trie;			//!< for parsed networks
 	fr_ipaddr_t			*allow;			//!< allowed networks for dynamic clients
 	fr_ipaddr_t			*deny;			//!< denied networks for dynamic clients
-} proto_bfd_udp_t;
+};
 
 
 static const conf_parser_t networks_config[] = {
@@ -95,6 +134,7 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_OFFSET("ttl", proto_bfd_udp_t, ttl), .dflt = "255" },
 
 	{ FR_CONF_OFFSET("only_state_changes", proto_bfd_udp_t, only_state_changes), .dflt = "yes" },
+	{ FR_CONF_OFFSET("dedicated_thread", proto_bfd_udp_t, dedicated_thread), .dflt = "no" },
 
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, 0, proto_bfd_udp_t, recv_buff) },
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, 0, proto_bfd_udp_t, send_buff) },
@@ -106,15 +146,18 @@ static const conf_parser_t udp_listen_config[] = {
 };
 
 
-static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len,
-			size_t *leftover)
+/** Read a BFD packet, and run it through the session state machine
+ *
+ * @return
+ *	- <0 on read error.
+ *	- 0 if the packet should be ignored.
+ *	- >0 the length of the bfd_wrapper_t and packet written to buffer.
+ */
+static ssize_t bfd_udp_recv(proto_bfd_udp_t const *inst, char const *name, fr_stats_t *stats,
+			    int sockfd, int flags, fr_socket_t *socket, fr_time_t *recv_time_p,
+			    uint8_t *buffer, size_t buffer_len)
 {
-	proto_bfd_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_bfd_udp_t);
-	proto_bfd_udp_thread_t		*thread = talloc_get_type_abort(li->thread_instance, proto_bfd_udp_thread_t);
-	fr_io_address_t			*address, **address_p;
 	fr_client_t			*client;
-
-	int				flags;
 	ssize_t				data_size;
 	size_t				packet_len;
 
@@ -123,21 +166,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	bfd_state_change_t		state_change;
 	bfd_wrapper_t			*wrapper = (bfd_wrapper_t *) buffer;
 
-	*leftover = 0;		/* always for UDP */
-
-	/*
-	 *	Where the addresses should go.  This is a special case
-	 *	for proto_bfd.
-	 */
-	address_p = (fr_io_address_t **)packet_ctx;
-	address = *address_p;
-
-	/*
-	 *      Tell udp_recv if we're connected or not.
-	 */
-	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
-
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, wrapper->packet, buffer_len - offsetof(bfd_wrapper_t, packet), recv_time_p);
+	data_size = udp_recv(sockfd, flags, socket, wrapper->packet, buffer_len - offsetof(bfd_wrapper_t, packet), recv_time_p);
 	if (data_size < 0) {
 		PDEBUG2("proto_bfd_udp got read error");
 		return data_size;
@@ -151,23 +180,23 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	/*
 	 *	Try to find the client before looking at any packet data.
 	 */
-	client =  fr_rb_find(inst->peers, &(fr_client_t) { .ipaddr = address->socket.inet.src_ipaddr, .proto = IPPROTO_UDP });
+	client =  fr_rb_find(inst->peers, &(fr_client_t) { .ipaddr = socket->inet.src_ipaddr, .proto = IPPROTO_UDP });
 	if (!client) {
-		DEBUG2("BFD %s - Received invalid packet on %s - unknown client %pV:%u", inst->server_name, thread->name,
-		       fr_box_ipaddr(address->socket.inet.src_ipaddr), address->socket.inet.src_port);
-		thread->stats.total_packets_dropped++;
+		DEBUG2("BFD %s - Received invalid packet on %s - unknown client %pV:%u", inst->server_name, name,
+		       fr_box_ipaddr(socket->inet.src_ipaddr), socket->inet.src_port);
+		stats->total_packets_dropped++;
 		return 0;
 	}
 
 	packet_len = data_size;
 
 	if (!fr_bfd_packet_ok(&err, wrapper->packet, packet_len)) {
-		DEBUG2("BFD %s - Received invalid packet on %s - %s", inst->server_name, thread->name, err);
-		thread->stats.total_malformed_requests++;
+		DEBUG2("BFD %s - Received invalid packet on %s - %s", inst->server_name, name, err);
+		stats->total_malformed_requests++;
 		return 0;
 	}
 
-	thread->stats.total_requests++;
+	stats->total_requests++;
 	packet = (bfd_packet_t *) wrapper->packet;
 
 	/*
@@ -188,7 +217,68 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	wrapper->type = BFD_WRAPPER_RECV_PACKET;
 	wrapper->state_change = state_change;
 
-	return sizeof(wrapper) + packet_len;
+	return offsetof(bfd_wrapper_t, packet) + packet_len;
+}
+
+/** Read a packet which the engine passed to us
+ *
+ */
+static ssize_t bfd_udp_notify_read(fr_listen_t *li, fr_io_address_t *address, fr_time_t *recv_time_p,
+				   uint8_t *buffer, size_t buffer_len)
+{
+	proto_bfd_udp_notify_t		msg;
+	ssize_t				data_size;
+
+	data_size = read(li->fd, &msg, sizeof(msg));
+	if (data_size < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+
+		PDEBUG2("proto_bfd_udp got read error from engine: %s", fr_syserror(errno));
+		return data_size;
+	}
+
+	if (((size_t) data_size != sizeof(msg)) || (msg.data_len > buffer_len)) {
+		DEBUG2("proto_bfd_udp got invalid message from engine: ignoring");
+		return 0;
+	}
+
+	address->socket = msg.socket;
+	*recv_time_p = msg.recv_time;
+	memcpy(buffer, msg.data, msg.data_len);
+
+	return msg.data_len;
+}
+
+static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len,
+			size_t *leftover)
+{
+	proto_bfd_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_bfd_udp_t);
+	proto_bfd_udp_thread_t		*thread = talloc_get_type_abort(li->thread_instance, proto_bfd_udp_thread_t);
+	fr_io_address_t			*address, **address_p;
+	int				flags;
+
+	*leftover = 0;		/* always for UDP */
+
+	/*
+	 *	Where the addresses should go.  This is a special case
+	 *	for proto_bfd.
+	 */
+	address_p = (fr_io_address_t **)packet_ctx;
+	address = *address_p;
+
+	/*
+	 *	The engine has already run the state machine, we just
+	 *	get told about state changes.
+	 */
+	if (thread->engine) return bfd_udp_notify_read(li, address, recv_time_p, buffer, buffer_len);
+
+	/*
+	 *      Tell udp_recv if we're connected or not.
+	 */
+	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
+
+	return bfd_udp_recv(inst, thread->name, &thread->stats, thread->sockfd, flags,
+			    &address->socket, recv_time_p, buffer, buffer_len);
 }
 
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
@@ -239,6 +329,135 @@ static void mod_network_get(int *ipproto, bool *dynamic_clients, fr_trie_t const
 	*trie = inst->trie;
 }
 
+/** Read a BFD packet in the engine, and tell the listener about state changes
+ *
+ */
+static void bfd_udp_engine_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	proto_bfd_udp_engine_t		*engine = talloc_get_type_abort(uctx, proto_bfd_udp_engine_t);
+	proto_bfd_udp_notify_t		msg = {};
+	ssize_t				slen;
+
+	slen = bfd_udp_recv(engine->inst, engine->name, &engine->stats, fd, 0,
+			    &msg.socket, &msg.recv_time, msg.data, sizeof(msg.data));
+	if (slen <= 0) return;
+
+	msg.data_len = slen;
+
+	if (write(engine->notify_fd, &msg, sizeof(msg)) < 0) {
+		ERROR("BFD %s - Failed passing state change to listener %s: %s",
+		      engine->inst->server_name, engine->name, fr_syserror(errno));
+	}
+}
+
+static void bfd_udp_engine_exit(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, UNUSED void *uctx)
+{
+	fr_event_loop_exit(el, 1);
+}
+
+static void *bfd_udp_engine_thread(void *arg)
+{
+	proto_bfd_udp_engine_t		*engine = talloc_get_type_abort(arg, proto_bfd_udp_engine_t);
+	fr_rb_iter_inorder_t		iter;
+	bfd_session_t			*peer;
+
+	/*
+	 *	Sessions are only started here, so that their timers
+	 *	are only ever touched by this thread.
+	 */
+	for (peer = fr_rb_iter_init_inorder(&iter, engine->inst->peers);
+	     peer != NULL;
+	     peer = fr_rb_iter_next_inorder(&iter)) {
+		if (peer->inst != engine->inst) continue;
+
+		bfd_session_start(peer);
+	}
+
+	(void) fr_event_loop(engine->el);
+
+	return NULL;
+}
+
+static int _bfd_udp_engine_free(proto_bfd_udp_engine_t *engine)
+{
+	if (engine->running) {
+		if (write(engine->exit_fd[1], "x", 1) < 0) {
+			ERROR("BFD %s - Failed stopping engine for %s: %s",
+			      engine->inst->server_name, engine->name, fr_syserror(errno));
+		} else {
+			(void) pthread_join(engine->pthread_id, NULL);
+		}
+	}
+
+	/*
+	 *	Remove the session timers, and the sockets, from the
+	 *	event list before the sockets are closed.
+	 */
+	TALLOC_FREE(engine->el);
+
+	if (engine->exit_fd[0] >= 0) close(engine->exit_fd[0]);
+	if (engine->exit_fd[1] >= 0) close(engine->exit_fd[1]);
+	close(engine->notify_fd);
+	close(engine->sockfd);
+
+	return 0;
+}
+
+/** Allocate the engine which runs the BFD sessions for a listener
+ *
+ * @param[in] li	the listener.
+ * @param[in] sockfd	the BFD socket, which the engine reads.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int bfd_udp_engine_alloc(fr_listen_t *li, int sockfd)
+{
+	proto_bfd_udp_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_bfd_udp_t);
+	proto_bfd_udp_thread_t		*thread = talloc_get_type_abort(li->thread_instance, proto_bfd_udp_thread_t);
+	proto_bfd_udp_engine_t		*engine;
+	int				notify[2];
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, notify) < 0) {
+		ERROR("Failed creating socketpair for BFD engine: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	MEM(engine = talloc_zero(thread, proto_bfd_udp_engine_t));
+	engine->inst = inst;
+	engine->sockfd = sockfd;
+	engine->notify_fd = notify[1];
+	engine->exit_fd[0] = engine->exit_fd[1] = -1;
+	talloc_set_destructor(engine, _bfd_udp_engine_free);
+
+	li->fd = notify[0];
+	thread->engine = engine;
+
+	if ((fr_nonblock(notify[0]) < 0) || (fr_nonblock(notify[1]) < 0)) {
+		PERROR("Failed setting socketpair for BFD engine non-blocking");
+		return -1;
+	}
+
+	if (pipe(engine->exit_fd) < 0) {
+		ERROR("Failed creating pipe for BFD engine: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	engine->el = fr_event_list_alloc(engine, NULL, NULL);
+	if (!engine->el) {
+		PERROR("Failed creating event list for BFD engine");
+		return -1;
+	}
+
+	if ((fr_event_fd_insert(engine, NULL, engine->el, sockfd, bfd_udp_engine_read, NULL, NULL, engine) < 0) ||
+	    (fr_event_fd_insert(engine, NULL, engine->el, engine->exit_fd[0], bfd_udp_engine_exit, NULL, NULL, engine) < 0)) {
+		PERROR("Failed adding sockets to BFD engine");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Open a UDP listener for RADIUS
  *
  */
@@ -324,6 +543,16 @@ static int mod_open(fr_listen_t *li)
 					     &inst->ipaddr, inst->port,
 					     inst->interface);
 
+	/*
+	 *	The network thread reads state changes from the
+	 *	engine, instead of reading the BFD socket.
+	 */
+	if (inst->dedicated_thread) {
+		if (bfd_udp_engine_alloc(li, sockfd) < 0) return -1;
+
+		thread->engine->name = thread->name;
+	}
+
 	return 0;
 }
 
@@ -385,6 +614,15 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 
 	FR_INTEGER_BOUND_CHECK("ttl", inst->ttl, >=, 64);
 
+	/*
+	 *	The engine can't send packets to the workers, only
+	 *	state changes.
+	 */
+	if (inst->dedicated_thread && !inst->only_state_changes) {
+		cf_log_err(conf, "'dedicated_thread = yes' requires 'only_state_changes = yes'");
+		return -1;
+	}
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -501,15 +739,27 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 	     peer = fr_rb_iter_next_inorder(&iter)) {
 		if (peer->inst != inst) continue;
 
-		peer->el = el;
+		peer->el = thread->engine ? thread->engine->el : el;
 		peer->listen = li;
 		peer->nr = (fr_network_t *) nr;
 		peer->sockfd = thread->sockfd;
 		peer->server_name = inst->server_name;
 		peer->only_state_changes = inst->only_state_changes;
 
-		bfd_session_start(peer);
+		if (!thread->engine) bfd_session_start(peer);
+	}
+
+	if (!thread->engine) return;
+
+	/*
+	 *	The engine starts the sessions, and from then on runs
+	 *	their timers.
+	 */
+	if (fr_schedule_pthread_create(&thread->engine->pthread_id, bfd_udp_engine_thread, thread->engine) < 0) {
+		PERROR("BFD %s - Failed starting engine for %s", inst->server_name, thread->name);
+		return;
 	}
+	thread->engine->running = true;
 }
 
 
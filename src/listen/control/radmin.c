@@ -146,6 +146,9 @@ static fr_log_t radmin_log = {
 static int sockfd = -1;
 static char io_buffer[65536];
 
+static bool capture = false;			//!< Collect output from the server, instead of printing it.
+static char *capture_buffer = NULL;		//!< Where the output is collected.
+
 #ifdef USE_READLINE
 #define CMD_MAX_EXPANSIONS (128)
 static int radmin_num_expansions = 0;
@@ -269,6 +272,10 @@ static ssize_t flush_conduits(int fd, char *buffer, size_t bufsize)
 
 		switch (conduit) {
 		case FR_CONDUIT_STDOUT:
+			if (capture) {
+				MEM(capture_buffer = talloc_strndup_append_buffer(capture_buffer, buffer, r));
+				break;
+			}
 			fprintf(stdout, "%s", buffer);
 			break;
 
@@ -774,6 +781,291 @@ static int cmd_test(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_c
 	return 0;
 }
 
+/** One line of "stats metrics" output
+ *
+ */
+typedef struct {
+	char const	*key;			//!< Metric name and labels.
+	double		value;
+} top_sample_t;
+
+typedef struct {
+	char		*text;			//!< Output of "stats metrics", which the samples point into.
+	top_sample_t	*sample;
+	size_t		num;
+	fr_time_t	when;
+} top_snapshot_t;
+
+typedef struct {
+	char const	*labels;		//!< module and method labels.
+	double		calls;
+	double		time;			//!< CPU time plus wait time.
+} top_module_t;
+
+static volatile sig_atomic_t top_stop;
+
+static void top_signal(UNUSED int sig)
+{
+	top_stop = 1;
+}
+
+/** Read all of the server's statistics
+ *
+ * Only the metrics we display are kept.
+ */
+static int top_snapshot(TALLOC_CTX *ctx, top_snapshot_t *snap)
+{
+	static char const *prefixes[] = {
+		"freeradius_worker_",
+		"freeradius_trunk_connections",
+		"freeradius_module_calls_total{",
+		"freeradius_module_cpu_seconds_total{",
+		"freeradius_module_wait_seconds_total{",
+	};
+	ssize_t	result;
+	char	*p, *eol;
+
+	MEM(capture_buffer = talloc_strdup(ctx, ""));
+	capture = true;
+	result = run_command(sockfd, "stats metrics", io_buffer, sizeof(io_buffer));
+	capture = false;
+
+	if (result != FR_CONDUIT_SUCCESS) {
+		TALLOC_FREE(capture_buffer);
+		return -1;
+	}
+
+	*snap = (top_snapshot_t) { .text = capture_buffer, .when = fr_time() };
+	capture_buffer = NULL;
+
+	for (p = snap->text; *p; p = eol + 1) {
+		char	*space;
+		size_t	i;
+
+		eol = strchr(p, '\n');
+		if (!eol) break;
+		*eol = '\0';
+
+		if (*p == '#') continue;
+
+		for (i = 0; i < NUM_ELEMENTS(prefixes); i++) {
+			if (strncmp(p, prefixes[i], strlen(prefixes[i])) == 0) break;
+		}
+		if (i == NUM_ELEMENTS(prefixes)) continue;
+
+		space = strrchr(p, ' ');
+		if (!space) continue;
+		*space = '\0';
+
+		MEM(snap->sample = talloc_realloc(ctx, snap->sample, top_sample_t, snap->num + 1));
+		snap->sample[snap->num++] = (top_sample_t) { .key = p, .value = strtod(space + 1, NULL) };
+	}
+
+	return 0;
+}
+
+static void top_snapshot_free(top_snapshot_t *snap)
+{
+	talloc_free(snap->text);
+	talloc_free(snap->sample);
+	*snap = (top_snapshot_t) {};
+}
+
+/** Find a sample, or return 0 if it doesn't exist
+ *
+ * Metrics come back in the same order every time, so we start
+ * searching where the caller expects the sample to be.
+ */
+static double top_value(top_snapshot_t const *snap, size_t hint, char const *fmt, ...)
+{
+	char	key[512];
+	va_list	ap;
+	size_t	i;
+
+	va_start(ap, fmt);
+	vsnprintf(key, sizeof(key), fmt, ap);
+	va_end(ap);
+
+	for (i = 0; i < snap->num; i++) {
+		size_t j = (hint + i) % snap->num;
+
+		if (strcmp(snap->sample[j].key, key) == 0) return snap->sample[j].value;
+	}
+
+	return 0;
+}
+
+/** Sort modules by the time spent in them, most first
+ *
+ */
+static int top_module_cmp(void const *one, void const *two)
+{
+	top_module_t const *a = one, *b = two;
+
+	return CMP(b->time, a->time);
+}
+
+/** Return the labels of a sample, if it's for the named metric
+ *
+ */
+#define TOP_LABELS(_sample, _name) \
+	((strncmp((_sample)->key, _name "{", sizeof(_name)) == 0) ? (_sample)->key + sizeof(_name) - 1 : NULL)
+
+/** Return the value of the first label in a set of labels
+ *
+ */
+#define TOP_LABEL_VALUE(_labels, _label) \
+	(int) strcspn((_labels) + sizeof("{" _label "=\"") - 1, "\""), (_labels) + sizeof("{" _label "=\"") - 1
+
+/** Print the difference between two snapshots
+ *
+ */
+static void top_print(TALLOC_CTX *ctx, top_snapshot_t const *old, top_snapshot_t const *new, unsigned int max_modules)
+{
+	double		dt = fr_time_delta_unwrap(fr_time_sub(new->when, old->when)) / (double) NSEC;
+	size_t		i, num_modules = 0;
+	top_module_t	*modules = NULL;
+	bool		header = false;
+
+	if (dt <= 0) return;
+
+	if (isatty(STDOUT_FILENO)) printf("\033[H\033[2J");
+
+	printf("%s - every %.1fs\n\n", progname, dt);
+
+	printf("%-8s %12s %12s %10s %10s %8s\n", "worker", "requests/s", "replies/s", "active", "runnable", "busy%");
+	for (i = 0; i < new->num; i++) {
+		char const	*labels = TOP_LABELS(&new->sample[i], "freeradius_worker_requests_total");
+
+		if (!labels) continue;
+
+		printf("%-8.*s %12.1f %12.1f %10.0f %10.0f %8.1f\n", TOP_LABEL_VALUE(labels, "worker"),
+		       (new->sample[i].value - top_value(old, i, "%s", new->sample[i].key)) / dt,
+		       (top_value(new, i, "freeradius_worker_replies_total%s", labels) -
+			top_value(old, i, "freeradius_worker_replies_total%s", labels)) / dt,
+		       top_value(new, i, "freeradius_worker_active_requests%s", labels),
+		       top_value(new, i, "freeradius_worker_runnable_requests%s", labels),
+		       (top_value(new, i, "freeradius_worker_busy_seconds_total%s", labels) -
+			top_value(old, i, "freeradius_worker_busy_seconds_total%s", labels)) * 100 / dt);
+	}
+
+	for (i = 0; i < new->num; i++) {
+		char const	*labels = TOP_LABELS(&new->sample[i], "freeradius_trunk_connections");
+
+		if (!labels) continue;
+
+		if (!header) {
+			printf("\n%-32s %8s %8s %10s %8s %8s %8s\n", "trunk", "total", "active", "connecting",
+			       "full", "inactive", "draining");
+			header = true;
+		}
+
+		printf("%-32.*s %8.0f %8.0f %10.0f %8.0f %8.0f %8.0f\n", TOP_LABEL_VALUE(labels, "trunk"),
+		       new->sample[i].value,
+		       top_value(new, i, "freeradius_trunk_connections_active%s", labels),
+		       top_value(new, i, "freeradius_trunk_connections_connecting%s", labels),
+		       top_value(new, i, "freeradius_trunk_connections_full%s", labels),
+		       top_value(new, i, "freeradius_trunk_connections_inactive%s", labels),
+		       top_value(new, i, "freeradius_trunk_connections_draining%s", labels));
+	}
+
+	/*
+	 *	Modules are only present if profiling is enabled.
+	 */
+	for (i = 0; i < new->num; i++) {
+		char const	*labels = TOP_LABELS(&new->sample[i], "freeradius_module_calls_total");
+
+		if (!labels) continue;
+
+		MEM(modules = talloc_realloc(ctx, modules, top_module_t, num_modules + 1));
+		modules[num_modules++] = (top_module_t) {
+			.labels = labels,
+			.calls = new->sample[i].value - top_value(old, i, "%s", new->sample[i].key),
+			.time = top_value(new, i, "freeradius_module_cpu_seconds_total%s", labels) -
+				top_value(old, i, "freeradius_module_cpu_seconds_total%s", labels) +
+				top_value(new, i, "freeradius_module_wait_seconds_total%s", labels) -
+				top_value(old, i, "freeradius_module_wait_seconds_total%s", labels)
+		};
+	}
+
+	if (num_modules > 0) {
+		qsort(modules, num_modules, sizeof(modules[0]), top_module_cmp);
+
+		printf("\n%-40s %12s %12s %8s\n", "module", "calls/s", "latency(ms)", "time%");
+		for (i = 0; (i < num_modules) && (i < max_modules); i++) {
+			char		name[256];
+			char const	*module, *method;
+
+			module = strstr(modules[i].labels, "module=\"");
+			method = strstr(modules[i].labels, "method=\"");
+			if (!module || !method) continue;
+
+			module += 8;
+			method += 8;
+			snprintf(name, sizeof(name), "%.*s.%.*s",
+				 (int) strcspn(module, "\""), module, (int) strcspn(method, "\""), method);
+
+			printf("%-40s %12.1f %12.3f %8.1f\n", name, modules[i].calls / dt,
+			       modules[i].calls > 0 ? (modules[i].time * 1000) / modules[i].calls : 0,
+			       (modules[i].time * 100) / dt);
+		}
+	}
+
+	talloc_free(modules);
+	fflush(stdout);
+}
+
+/** Show live statistics, updated every interval
+ *
+ * Runs until interrupted, or for a number of updates.
+ */
+static int cmd_top(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	unsigned long		interval = 1, count = 0, n;
+	top_snapshot_t		old, new;
+	TALLOC_CTX		*top_ctx;
+	void			(*old_handler)(int);
+
+	if (info->argc > 0) interval = strtoul(info->argv[0], NULL, 10);
+	if (info->argc > 1) count = strtoul(info->argv[1], NULL, 10);
+	if (!interval) interval = 1;
+
+	MEM(top_ctx = talloc_init_const("top"));
+
+	if (top_snapshot(top_ctx, &old) < 0) {
+		fprintf(fp_err, "Failed reading statistics from the server\n");
+		talloc_free(top_ctx);
+		return -1;
+	}
+
+	top_stop = 0;
+	old_handler = signal(SIGINT, top_signal);
+
+	for (n = 0; !top_stop && (!count || (n < count)); n++) {
+		struct timespec ts = { .tv_sec = interval };
+
+		if ((nanosleep(&ts, NULL) < 0) && top_stop) break;
+
+		if (top_snapshot(top_ctx, &new) < 0) {
+			fprintf(fp_err, "Failed reading statistics from the server\n");
+			break;
+		}
+
+		top_print(top_ctx, &old, &new, 10);
+
+		top_snapshot_free(&old);
+		old = new;
+	}
+
+	signal(SIGINT, old_handler);
+	top_snapshot_free(&old);
+	talloc_free(top_ctx);
+
+	fprintf(fp, "\n");
+
+	return 0;
+}
+
 /*
  *	Local radmin commands
  */
@@ -786,6 +1078,15 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "local",
+		.name = "top",
+		.func = cmd_top,
+		.syntax = "[INTEGER] [INTEGER]",
+		.help = "Show live statistics every INTEGER seconds (default 1), INTEGER times (default until interrupted).",
+		.read_only = true
+	},
+
 	CMD_TABLE_END
 };
 
@@ -1119,6 +1420,14 @@ int main(int argc, char **argv)
 		int i;
 
 		for (i = 0; i < num_commands; i++) {
+			if (strncmp(commands[i], "local ", 6) == 0) {
+				if (local_command(commands[i]) < 0) {
+					exit_status = EXIT_FAILURE;
+					goto exit;
+				}
+				continue;
+			}
+
 			result = run_command(sockfd, commands[i], io_buffer, sizeof(io_buffer));
 			if (result < 0) fr_exit_now(EXIT_FAILURE);
 
@@ -53,7 +53,8 @@ static conf_parser_t const proto_cron_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", proto_cron_t, max_packet_size) } ,
 	{ FR_CONF_OFFSET("num_messages", proto_cron_t, num_messages) } ,
 
-	{ FR_CONF_OFFSET("priority", proto_cron_t, priority) },
+	{ FR_CONF_OFFSET("priority", proto_cron_t, priority),
+	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = channel_packet_priority, .len = &channel_packet_priority_len }, .dflt = "normal" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -160,6 +161,16 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 	return 1;
 }
 
+/** Every job has the configured priority
+ *
+ */
+static int mod_priority_set(void const *instance, UNUSED uint8_t const *buffer, UNUSED size_t buflen)
+{
+	proto_cron_t const *inst = talloc_get_type_abort_const(instance, proto_cron_t);
+
+	return inst->priority;
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -265,4 +276,5 @@ fr_app_t proto_cron = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
+	.priority		= mod_priority_set
 };
@@ -28,6 +28,7 @@
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/util/pair_legacy.h>
 
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/dl_module.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/module_rlm.h>
@@ -211,6 +212,53 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 	return 0;
 }
 
+/** Decode a binary detail record
+ *
+ *  The pairs are already encoded, so there's no parsing to do.
+ */
+static int mod_decode_binary(proto_detail_t const *inst, request_t *request, uint8_t *const data, size_t data_len)
+{
+	fr_detail_binary_hdr_t	hdr;
+	fr_pair_list_t		tmp_list;
+	fr_pair_t		*vp;
+
+	if ((fr_detail_binary_hdr_decode(&hdr, data, data_len) <= 0) ||
+	    ((data_len - FR_DETAIL_BINARY_HDR_LEN) < hdr.length)) {
+		RPEDEBUG("Malformed binary detail record");
+		return -1;
+	}
+
+	fr_pair_list_init(&tmp_list);
+	if (fr_detail_binary_decode(request->request_ctx, &tmp_list, request->dict,
+				    data + FR_DETAIL_BINARY_HDR_LEN, hdr.length) < 0) {
+		RPEDEBUG("Failed decoding binary detail record");
+		fr_pair_list_free(&tmp_list);
+		return -1;
+	}
+	fr_pair_list_append(&request->request_pairs, &tmp_list);
+
+	/*
+	 *	Set the original src/dst ip/port
+	 */
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_src_ip_address);
+	if (vp) request->packet->socket.inet.src_ipaddr = vp->vp_ip;
+
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_dst_ip_address);
+	if (vp) request->packet->socket.inet.dst_ipaddr = vp->vp_ip;
+
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_src_port);
+	if (vp) request->packet->socket.inet.src_port = vp->vp_uint16;
+
+	vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_packet_dst_port);
+	if (vp) request->packet->socket.inet.dst_port = vp->vp_uint16;
+
+	MEM(vp = fr_pair_afrom_da(request->request_ctx, attr_packet_original_timestamp));
+	vp->vp_date = hdr.timestamp;
+	fr_pair_append(&request->request_pairs, vp);
+
+	return inst->app_io->decode(inst->app_io_instance, request, data, data_len);
+}
+
 /** Decode the packet, and set the request->process function
  *
  */
@@ -241,6 +289,8 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->reply->socket.inet.src_ipaddr = request->packet->socket.inet.src_ipaddr;
 	request->reply->socket.inet.dst_ipaddr = request->packet->socket.inet.src_ipaddr;
 
+	if (fr_detail_binary_is_record(data, data_len)) return mod_decode_binary(inst, request, data, data_len);
+
 	end = data + data_len;
 
 	MPRINT("HEADER %s", data);
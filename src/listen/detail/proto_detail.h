@@ -89,6 +89,7 @@ struct proto_detail_work_s {
 
 	fr_retry_config_t		retry_config;		//!< retry config with irt, mrt, etc.
 	uint16_t			max_outstanding;	//!< number of packets to run in parallel
+	uint32_t			shards;			//!< number of readers each work file is split between
 
 	bool				track_progress;		//!< do we track progress by writing?
 	bool				retransmit;		//!< are we retransmitting on error?
@@ -124,6 +125,7 @@ struct proto_detail_work_thread_s {
 	bool				eof;			//!< are we at EOF on reading?
 	bool				closing;		//!< we should be closing the file
 	bool				paused;			//!< Is reading paused?
+	bool				binary;			//!< file contains binary records.
 
 	int				count;			//!< number of packets we read from this file.
 
@@ -137,11 +139,13 @@ struct proto_detail_work_thread_s {
 	off_t				file_size;		//!< size of the file
 	off_t				header_offset;		//!< offset of the current header we're reading
 	off_t				read_offset;		//!< where we're reading from in filename_work
+	off_t				end_offset;		//!< where this reader's shard of the file ends, 0 for EOF.
 
 	fr_event_timer_t const		*ev;			//!< for detail file timers.
 
 	pthread_mutex_t			worker_mutex;		//!< for the workers
 	int				num_workers;		//!< number of workers
+	bool				shard_incomplete;	//!< a shard wasn't completely read, so keep the work file.
 };
 
 #include <pthread.h>
@@ -27,6 +27,7 @@
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/main_config.h>
 #include <freeradius-devel/server/protocol.h>
 
@@ -68,6 +69,11 @@ typedef struct proto_detail_work_s proto_detail_file_t;
  */
 typedef struct proto_detail_work_thread_s proto_detail_file_thread_t;
 
+/*
+ *	Don't split work files into shards smaller than this.
+ */
+#define DETAIL_SHARD_MIN_SIZE	(1 << 20)
+
 static void work_init(proto_detail_file_thread_t *thread, bool triggered_by_delete);
 static void mod_vnode_delete(fr_event_list_t *el, int fd, UNUSED int fflags, void *ctx);
 
@@ -80,6 +86,8 @@ static const conf_parser_t file_listen_config[] = {
 
 	{ FR_CONF_OFFSET("immediate", proto_detail_file_t, immediate) },
 
+	{ FR_CONF_OFFSET("shards", proto_detail_file_t, shards), .dflt = "1" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -238,76 +246,100 @@ static void work_retry_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, v
 	work_init(thread, false);
 }
 
-/*
- *	The "detail.work" file exists, and is open in the 'fd'.
+/** Find the start of the first record at or after an offset
+ *
+ *  Records end with a blank line, so the next record starts after the
+ *  first "\n\n" which ends at or after the offset.
+ *
+ * @return
+ *	- the offset of the record.
+ *	- -1 if there are no more records in the file.
  */
-static int work_exists(proto_detail_file_thread_t *thread, int fd)
+static off_t work_record_start(int fd, off_t offset, off_t size)
 {
-	proto_detail_file_t const *inst = thread->inst;
-	bool			opened = false;
-	proto_detail_work_thread_t     *work;
-	fr_listen_t		*li = NULL;
-	struct stat		st;
+	uint8_t		buffer[4096];
+	uint8_t		last = '\0';
+	off_t		pos = offset - 2;
+	ssize_t		len, i;
 
-	fr_event_vnode_func_t	funcs = { .delete = mod_vnode_delete };
+	fr_assert(offset >= 2);
 
-	DEBUG3("proto_detail (%s): Trying to lock %s", thread->name, inst->filename_work);
+	while (pos < size) {
+		len = pread(fd, buffer, sizeof(buffer), pos);
+		if (len <= 0) return -1;
 
-	/*
-	 *	"detail.work" exists, try to lock it.
-	 */
-	if (rad_lockfd_nonblock(fd, 0) < 0) {
-		fr_time_delta_t delay;
+		for (i = 0; i < len; i++) {
+			if ((buffer[i] == '\n') && (last == '\n')) {
+				if ((pos + i + 1) >= size) return -1;
+				return pos + i + 1;
+			}
+			last = buffer[i];
+		}
 
-		DEBUG3("proto_detail (%s): Failed locking %s: %s",
-		       thread->name, inst->filename_work, fr_syserror(errno));
+		pos += len;
+	}
 
-		close(fd);
+	return -1;
+}
 
-		delay = thread->lock_interval;
+/** Split the work file into shards, each starting on a record boundary
+ *
+ *  Small files aren't split, and records which span the boundary between
+ *  two shards go into the first one.
+ *
+ * @param[in] thread	the file reader.
+ * @param[in] fd	of the locked work file.
+ * @param[in] size	of the work file.
+ * @param[out] starts	offset of the start of each shard.  Must have room for inst->shards entries.
+ * @return the number of shards.
+ */
+static unsigned int work_shards(proto_detail_file_thread_t *thread, int fd, off_t size, off_t *starts)
+{
+	proto_detail_file_t const	*inst = thread->inst;
+	unsigned int			num_shards = inst->shards;
+	unsigned int			i, used = 1;
+	off_t				offset;
+	uint8_t				magic[2];
+	bool				binary;
 
-		/*
-		 *	Set the next interval, and ensure that we
-		 *	don't do massive busy-polling.
-		 */
-		thread->lock_interval = fr_time_delta_add(thread->lock_interval,
-							  fr_time_delta_div(thread->lock_interval,
-									    fr_time_delta_wrap(2)));
-		if (fr_time_delta_gt(thread->lock_interval, fr_time_delta_from_sec(30))) {
-			thread->lock_interval = fr_time_delta_from_sec(30);
-		}
+	if ((size / DETAIL_SHARD_MIN_SIZE) < num_shards) num_shards = size / DETAIL_SHARD_MIN_SIZE;
 
-		DEBUG3("proto_detail (%s): Waiting %.6fs for lock on file %s",
-		       thread->name, fr_time_delta_unwrap(delay) / (double)NSEC, inst->filename_work);
+	starts[0] = 0;
 
-		if (fr_event_timer_in(thread, thread->el, &thread->ev,
-				      delay, work_retry_timer, thread) < 0) {
-			ERROR("Failed inserting retry timer for %s", inst->filename_work);
+	binary = (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)) && fr_detail_binary_is_record(magic, sizeof(magic));
+
+	for (i = 1; i < num_shards; i++) {
+		if (binary) {
+			offset = fr_detail_binary_sync(fd, (size / num_shards) * i, size);
+		} else {
+			offset = work_record_start(fd, (size / num_shards) * i, size);
 		}
-		return 0;
-	}
+		if (offset < 0) break;
 
-	DEBUG3("proto_detail (%s): Obtained lock and starting to process file %s",
-	       thread->name, inst->filename_work);
+		if (offset <= starts[used - 1]) continue;
 
-	/*
-	 *	Ignore empty files.
-	 */
-	if (fstat(fd, &st) < 0) {
-		ERROR("Failed opening %s: %s", inst->filename_work,
-		      fr_syserror(errno));
-		unlink(inst->filename_work);
-		close(fd);
-		return 1;
+		starts[used++] = offset;
 	}
 
-	if (!st.st_size) {
-		DEBUG3("proto_detail (%s): %s file is empty, ignoring it.",
-		       thread->name, inst->filename_work);
-		unlink(inst->filename_work);
-		close(fd);
-		return 1;
-	}
+	return used;
+}
+
+/** Start a reader for one shard of the work file
+ *
+ * @param[in] thread	the file reader.
+ * @param[in] fd	of the locked work file.
+ * @param[in] start	offset of the first record in the shard.
+ * @param[in] end	offset of the first record after the shard, or 0 for EOF.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int work_shard_add(proto_detail_file_thread_t *thread, int fd, off_t start, off_t end)
+{
+	proto_detail_file_t const *inst = thread->inst;
+	bool			opened = false;
+	proto_detail_work_thread_t     *work;
+	fr_listen_t		*li = NULL;
 
 	/*
 	 *	This listener is allocated in a thread-specific
@@ -339,41 +371,32 @@ static int work_exists(proto_detail_file_thread_t *thread, int fd)
 	work->inst = li->app_io_instance;
 	work->file_parent = thread;
 	work->ev = NULL;
+	work->header_offset = work->read_offset = start;
+	work->end_offset = end;
 
-	li->fd = work->fd = dup(fd);
+	/*
+	 *	Readers for the other shards run in other threads, and
+	 *	need their own file offset.  So they can't share a
+	 *	dup()'d descriptor.
+	 */
+	if (start == 0) {
+		li->fd = work->fd = dup(fd);
+	} else {
+		li->fd = work->fd = open(inst->filename_work, inst->mode);
+	}
 	if (work->fd < 0) {
 		DEBUG("proto_detail (%s): Failed opening %s: %s",
 		      thread->name, inst->filename_work, fr_syserror(errno));
 
-		close(fd);
 		talloc_free(li);
 		return -1;
 	}
 
 	/*
-	 *	Don't do anything until the file has been deleted.
-	 *
-	 *	@todo - ensure that proto_detail_work is done the file...
-	 *	maybe by creating a new instance?
-	 */
-	if (fr_event_filter_insert(thread, NULL, thread->el, fd, FR_EVENT_FILTER_VNODE,
-				   &funcs, NULL, thread) < 0) {
-		PERROR("Failed adding work socket to event loop");
-		close(fd);
-		talloc_free(li);
-		return -1;
-	}
-
-	/*
-	 *	Remember this for later.
-	 */
-	thread->vnode_fd = fd;
-
-	/*
-	 *	For us, this is the worker listener.
+	 *	For us, this is the first worker listener.
 	 *	For the worker, this is it's own parent
 	 */
-	thread->listen = li;
+	if (start == 0) thread->listen = li;
 
 	work->filename_work = talloc_strdup(work, inst->filename_work);
 
@@ -401,16 +424,22 @@ static int work_exists(proto_detail_file_thread_t *thread, int fd)
 
 	if (!fr_schedule_listen_add(inst->parent->sc, li)) {
 	error:
-		if (fr_event_fd_delete(thread->el, thread->vnode_fd, FR_EVENT_FILTER_VNODE) < 0) {
-			PERROR("Failed removing DELETE callback when opening work file");
-		}
-		close(thread->vnode_fd);
-		thread->vnode_fd = -1;
+		/*
+		 *	Closing the listener would otherwise delete
+		 *	the file.
+		 */
+		pthread_mutex_lock(&thread->worker_mutex);
+		thread->shard_incomplete = true;
+		if (!opened) thread->num_workers--;
+		pthread_mutex_unlock(&thread->worker_mutex);
+
+		if (thread->listen == li) thread->listen = NULL;
 
 		if (opened) {
 			(void) li->app_io->close(li);
-			thread->listen = NULL;
 			li = NULL;
+		} else {
+			close(work->fd);
 		}
 
 		talloc_free(li);
@@ -424,6 +453,138 @@ static int work_exists(proto_detail_file_thread_t *thread, int fd)
 
 	return 0;
 }
+/*
+ *	The "detail.work" file exists, and is open in the 'fd'.
+ */
+static int work_exists(proto_detail_file_thread_t *thread, int fd)
+{
+	proto_detail_file_t const *inst = thread->inst;
+	struct stat		st;
+	off_t			*starts;
+	unsigned int		i, num_shards;
+
+	fr_event_vnode_func_t	funcs = { .delete = mod_vnode_delete };
+
+	DEBUG3("proto_detail (%s): Trying to lock %s", thread->name, inst->filename_work);
+
+	/*
+	 *	"detail.work" exists, try to lock it.
+	 */
+	if (rad_lockfd_nonblock(fd, 0) < 0) {
+		fr_time_delta_t delay;
+
+		DEBUG3("proto_detail (%s): Failed locking %s: %s",
+		       thread->name, inst->filename_work, fr_syserror(errno));
+
+		close(fd);
+
+		delay = thread->lock_interval;
+
+		/*
+		 *	Set the next interval, and ensure that we
+		 *	don't do massive busy-polling.
+		 */
+		thread->lock_interval = fr_time_delta_add(thread->lock_interval,
+							  fr_time_delta_div(thread->lock_interval,
+									    fr_time_delta_wrap(2)));
+		if (fr_time_delta_gt(thread->lock_interval, fr_time_delta_from_sec(30))) {
+			thread->lock_interval = fr_time_delta_from_sec(30);
+		}
+
+		DEBUG3("proto_detail (%s): Waiting %.6fs for lock on file %s",
+		       thread->name, fr_time_delta_unwrap(delay) / (double)NSEC, inst->filename_work);
+
+		if (fr_event_timer_in(thread, thread->el, &thread->ev,
+				      delay, work_retry_timer, thread) < 0) {
+			ERROR("Failed inserting retry timer for %s", inst->filename_work);
+		}
+		return 0;
+	}
+
+	DEBUG3("proto_detail (%s): Obtained lock and starting to process file %s",
+	       thread->name, inst->filename_work);
+
+	/*
+	 *	Ignore empty files.
+	 */
+	if (fstat(fd, &st) < 0) {
+		ERROR("Failed opening %s: %s", inst->filename_work,
+		      fr_syserror(errno));
+		unlink(inst->filename_work);
+		close(fd);
+		return 1;
+	}
+
+	if (!st.st_size) {
+		DEBUG3("proto_detail (%s): %s file is empty, ignoring it.",
+		       thread->name, inst->filename_work);
+		unlink(inst->filename_work);
+		close(fd);
+		return 1;
+	}
+
+	/*
+	 *	Split large files between multiple readers.
+	 */
+	MEM(starts = talloc_array(NULL, off_t, inst->shards));
+	num_shards = work_shards(thread, fd, st.st_size, starts);
+	if (num_shards > 1) {
+		DEBUG("proto_detail (%s): Reading %s with %u readers", thread->name, inst->filename_work, num_shards);
+	}
+
+	/*
+	 *	Don't do anything until the file has been deleted.
+	 *
+	 *	@todo - ensure that proto_detail_work is done the file...
+	 *	maybe by creating a new instance?
+	 */
+	if (fr_event_filter_insert(thread, NULL, thread->el, fd, FR_EVENT_FILTER_VNODE,
+				   &funcs, NULL, thread) < 0) {
+		PERROR("Failed adding work socket to event loop");
+		close(fd);
+		talloc_free(starts);
+		return -1;
+	}
+
+	/*
+	 *	Remember this for later.
+	 */
+	thread->vnode_fd = fd;
+
+	pthread_mutex_lock(&thread->worker_mutex);
+	thread->shard_incomplete = false;
+	pthread_mutex_unlock(&thread->worker_mutex);
+
+	for (i = 0; i < num_shards; i++) {
+		if (work_shard_add(thread, fd, starts[i], (i + 1) < num_shards ? starts[i + 1] : 0) == 0) continue;
+
+		if (i == 0) {
+			if (fr_event_fd_delete(thread->el, thread->vnode_fd, FR_EVENT_FILTER_VNODE) < 0) {
+				PERROR("Failed removing DELETE callback when opening work file");
+			}
+			close(thread->vnode_fd);
+			thread->vnode_fd = -1;
+
+			talloc_free(starts);
+			return -1;
+		}
+
+		/*
+		 *	The other readers have started, so we can't
+		 *	give up.  Keep the file once they're done, so
+		 *	that the records in this shard aren't lost.
+		 */
+		ERROR("proto_detail (%s): Failed starting reader for bytes %zu onwards of %s.  It will not be deleted",
+		      thread->name, (size_t) starts[i], inst->filename_work);
+
+		pthread_mutex_lock(&thread->worker_mutex);
+		thread->shard_incomplete = true;
+		pthread_mutex_unlock(&thread->worker_mutex);
+	}
+
+	talloc_free(starts);
+	return 0;
+}
 
 
 static void mod_vnode_delete(fr_event_list_t *el, int fd, UNUSED int fflags, void *ctx)
@@ -686,6 +847,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 #endif
 	FR_INTEGER_BOUND_CHECK("poll_interval", inst->poll_interval, <=, 3600);
 
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, <=, 64);
+
 	inst->parent = talloc_get_type_abort(mi->parent->data, proto_detail_t);
 	inst->cs = conf;
 
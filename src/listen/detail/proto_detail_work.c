@@ -23,6 +23,7 @@
  * @copyright 2017 Alan DeKok (aland@deployingradius.com)
  */
 #include <netdb.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/server/main_loop.h>
@@ -243,6 +244,14 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 
 		room = buffer_len - *leftover;
 
+		/*
+		 *	Don't read past the end of our shard.  The
+		 *	next record belongs to another reader.
+		 */
+		if (thread->end_offset && ((thread->end_offset - thread->read_offset) < (off_t) room)) {
+			room = thread->end_offset - thread->read_offset;
+		}
+
 		data_size = read(thread->fd, partial, room);
 		if (data_size < 0) {
 			ERROR("proto_detail (%s): Failed reading file %s: %s",
@@ -260,7 +269,8 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		/*
 		 *	Only set EOF if there's no more data in the buffer to manage.
 		 */
-		thread->eof = (data_size == 0) || (thread->read_offset == thread->file_size) || ((size_t) data_size < room);
+		thread->eof = (data_size == 0) || (thread->read_offset == thread->file_size) || ((size_t) data_size < room) ||
+			      (thread->end_offset && (thread->read_offset >= thread->end_offset));
 		if (thread->eof) {
 			MPRINT("Set EOF data_size %ld vs room %ld", data_size, room);
 			MPRINT("Set EOF read %ld vs file %ld", (long) thread->read_offset, (long) thread->file_size);
@@ -277,6 +287,96 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		end = buffer + *leftover;
 	}
 
+	/*
+	 *	Binary records say how long they are, so there's no
+	 *	need to search for the end of the record.
+	 */
+	if (thread->binary) {
+		fr_detail_binary_hdr_t	hdr;
+		ssize_t			slen;
+
+	binary_redo:
+		packet_len = 0;
+		slen = fr_detail_binary_hdr_decode(&hdr, buffer, end - buffer);
+		if (slen < 0) {
+			struct stat	st;
+			off_t		offset = -1;
+
+			PERROR("proto_detail (%s): Skipping invalid record at offset %zu of %s",
+			       thread->name, (size_t) thread->header_offset, thread->filename_work);
+
+			/*
+			 *	Skip to the next valid record.
+			 */
+			if (fstat(thread->fd, &st) == 0) {
+				offset = fr_detail_binary_sync(thread->fd, thread->header_offset + 1,
+							       thread->end_offset ? thread->end_offset : st.st_size);
+			}
+			if (offset < 0) goto binary_eof;
+
+			thread->header_offset = thread->read_offset = offset;
+			thread->eof = false;
+			*leftover = 0;
+			return 0;
+		}
+
+		if (slen > 0) {
+			packet_len = FR_DETAIL_BINARY_HDR_LEN + hdr.length;
+
+			/*
+			 *	Too big?  Skip it without reading it.
+			 */
+			if (packet_len > inst->parent->max_packet_size) {
+				DEBUG("Ignoring 'too large' entry at offset %zu of %s",
+				      (size_t) thread->header_offset, thread->filename_work);
+				DEBUG("Entry size %zu is greater than allowed maximum %u",
+				      packet_len, inst->parent->max_packet_size);
+
+				thread->header_offset = thread->read_offset = thread->header_offset + packet_len;
+				thread->eof = false;
+				*leftover = 0;
+				return 0;
+			}
+		}
+
+		if ((slen == 0) || ((size_t) (end - buffer) < packet_len)) {
+			if (!thread->eof) {
+				*leftover = end - buffer;
+				return 0;
+			}
+
+			if (end != buffer) {
+				WARN("proto_detail (%s): Ignoring truncated record at offset %zu of %s",
+				     thread->name, (size_t) thread->header_offset, thread->filename_work);
+			}
+
+		binary_eof:
+			/*
+			 *	Nothing more to read.  If there are no
+			 *	replies to wait for, tell the network
+			 *	side to close us.
+			 */
+			*leftover = 0;
+			thread->eof = true;
+			thread->closing = true;
+			return (thread->outstanding == 0) ? -1 : 0;
+		}
+
+		/*
+		 *	Skip entries which have already been processed.
+		 */
+		if (hdr.flags & FR_DETAIL_BINARY_FLAG_DONE) {
+			memmove(buffer, buffer + packet_len, end - (buffer + packet_len));
+			end -= packet_len;
+			thread->header_offset += packet_len;
+			goto binary_redo;
+		}
+
+		*leftover = end - (buffer + packet_len);
+		done_offset = thread->header_offset + FR_DETAIL_BINARY_FLAGS_OFFSET;
+		goto track_entry;
+	}
+
 redo:
 	next = NULL;
 	stopped_search = end;
@@ -484,6 +584,7 @@ redo:
 	/*
 	 *	Allocate the tracking entry.
 	 */
+track_entry:
 	MEM(track = talloc_zero(thread, fr_detail_entry_t));
 	track->parent = thread;
 	track->timestamp = fr_time();
@@ -625,6 +726,19 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
+		/*
+		 *	Binary entries are marked as done by setting
+		 *	a flag in the header.
+		 */
+		if (thread->binary) {
+			uint8_t flags = FR_DETAIL_BINARY_FLAG_DONE;
+
+			if (pwrite(thread->fd, &flags, sizeof(flags), track->done_offset) < 0) {
+				ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
+			}
+			goto free_track;
+		}
+
 		/*
 		 *	Seek to the entry, mark it as done, and then seek to
 		 *	the point in the file where we were reading from.
@@ -695,6 +809,17 @@ static int mod_open(fr_listen_t *li)
 		}
 	}
 
+	/*
+	 *	Binary files are written by rlm_detail with
+	 *	"format = binary".
+	 */
+	{
+		uint8_t magic[2];
+
+		thread->binary = (pread(thread->fd, magic, sizeof(magic), 0) == sizeof(magic)) &&
+				 fr_detail_binary_is_record(magic, sizeof(magic));
+	}
+
 	/*
 	 *	If we're tracking progress, learn where the EOF is.
 	 */
@@ -716,7 +841,15 @@ static int mod_open(fr_listen_t *li)
 
 	fr_assert(thread->name == NULL);
 	fr_assert(thread->filename_work != NULL);
-	thread->name = talloc_typed_asprintf(thread, "detail_work reading file %s", thread->filename_work);
+	if (thread->end_offset) {
+		thread->name = talloc_typed_asprintf(thread, "detail_work reading file %s bytes %zu-%zu", thread->filename_work,
+						     (size_t) thread->read_offset, (size_t) thread->end_offset);
+	} else if (thread->read_offset) {
+		thread->name = talloc_typed_asprintf(thread, "detail_work reading file %s from byte %zu", thread->filename_work,
+						     (size_t) thread->read_offset);
+	} else {
+		thread->name = talloc_typed_asprintf(thread, "detail_work reading file %s", thread->filename_work);
+	}
 
 	/*
 	 *	Linux doesn't like us adding write callbacks for FDs
@@ -737,31 +870,41 @@ static int mod_open(fr_listen_t *li)
 static int mod_close_internal(proto_detail_work_thread_t *thread)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(thread->inst, proto_detail_work_t);
+	bool				last = true;
+	bool				incomplete = (thread->outstanding != 0);
 
 	/*
 	 *	One less worker...  we check for "0" because of the
 	 *	hacks in proto_detail which let us start up with
 	 *	"transport = work" for debugging purposes.
+	 *
+	 *	When the file is split into shards, only the last
+	 *	reader to finish deletes it, and only if every shard
+	 *	was completely read.
 	 */
 	if (thread->file_parent) {
 		pthread_mutex_lock(&thread->file_parent->worker_mutex);
+		if (incomplete) thread->file_parent->shard_incomplete = true;
 		if (thread->file_parent->num_workers > 0) thread->file_parent->num_workers--;
+		last = (thread->file_parent->num_workers == 0);
+		incomplete = thread->file_parent->shard_incomplete;
 		pthread_mutex_unlock(&thread->file_parent->worker_mutex);
 	}
 
-	DEBUG("Closing %sdetail worker file %s", thread->outstanding == 0 ? "and deleting " : "", thread->name);
+	DEBUG("Closing %sdetail worker file %s after %d records", (last && !incomplete) ? "and deleting " : "",
+	      thread->name, thread->count);
 
 #ifdef NOTE_REVOKE
 	fr_event_fd_delete(thread->el, thread->fd, FR_EVENT_FILTER_VNODE);
 #endif
 	fr_event_fd_delete(thread->el, thread->fd, FR_EVENT_FILTER_IO);
 
-	if (thread->outstanding == 0) unlink(thread->filename_work);
+	if (last && !incomplete) unlink(thread->filename_work);
 
 	close(thread->fd);
 	thread->fd = -1;
 
-	if (inst->parent->exit_when_done) {
+	if (last && inst->parent->exit_when_done) {
 		INFO("Done reading detail files, process will now exit");
 
 		/*
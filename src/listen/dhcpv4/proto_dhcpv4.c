@@ -59,6 +59,7 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_connections", proto_dhcpv4_t, io.max_connections), .dflt = "1024" } ,
 	{ FR_CONF_OFFSET("max_clients", proto_dhcpv4_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", proto_dhcpv4_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("max_new_clients", proto_dhcpv4_t, io.max_new_clients), .dflt = "0" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
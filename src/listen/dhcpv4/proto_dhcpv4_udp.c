@@ -42,6 +42,10 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(PACKET_TX_RING)
+	fr_dhcpv4_raw_ring_t		*ring;			//!< for replies to clients without an address.
+#endif
+
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dhcpv4_udp_thread_t;
 
@@ -57,6 +61,8 @@ typedef struct {
 
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
+	uint32_t			raw_ring;		//!< Frames in the raw transmit ring, 0 to disable.
+
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
@@ -100,6 +106,7 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, 0, proto_dhcpv4_udp_t, recv_buff) },
 
 	{ FR_CONF_OFFSET("broadcast", proto_dhcpv4_udp_t, broadcast) } ,
+	{ FR_CONF_OFFSET("raw_ring", proto_dhcpv4_udp_t, raw_ring), .dflt = "0" } ,
 
 	{ FR_CONF_OFFSET("dynamic_clients", proto_dhcpv4_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
@@ -203,6 +210,42 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 }
 
 
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(PACKET_TX_RING)
+/** Queue a reply in the raw transmit ring, addressed to the client's hardware address
+ *
+ * This avoids both the ARP table update, and a syscall per packet.
+ *
+ * @return
+ *	- 0 if the reply was queued.
+ *	- -1 if it should be sent some other way.
+ */
+static int raw_ring_send(proto_dhcpv4_udp_thread_t *thread, fr_socket_t *socket, uint8_t code,
+			 dhcp_packet_t const *packet, uint8_t const *buffer, size_t buffer_len)
+{
+	if ((packet->htype != 1) || (packet->hlen != ETH_ADDR_LEN)) return -1;
+
+	/*
+	 *	We need a real address to send from.
+	 */
+	if ((socket->inet.src_ipaddr.addr.v4.s_addr == htonl(INADDR_ANY)) ||
+	    (socket->inet.src_ipaddr.addr.v4.s_addr == htonl(INADDR_BROADCAST))) return -1;
+
+	memcpy(&socket->inet.dst_ipaddr.addr.v4.s_addr, &packet->yiaddr, 4);
+
+	if (fr_dhcpv4_raw_ring_queue(thread->ring, packet->chaddr, socket, buffer, buffer_len) < 0) {
+		DEBUG2("Failed queueing reply in raw transmit ring: %s", fr_strerror());
+		return -1;
+	}
+
+	DEBUG("Reply will be unicast to YIADDR via the raw transmit ring.");
+	DEBUG("Sending %s XID %08x from %pV:%d to %pV:%d", dhcp_message_types[code], packet->xid,
+	      fr_box_ipaddr(socket->inet.src_ipaddr), socket->inet.src_port,
+	      fr_box_ipaddr(socket->inet.dst_ipaddr), socket->inet.dst_port);
+
+	return 0;
+}
+#endif
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
@@ -424,6 +467,11 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			if (memcmp(&socket.inet.dst_ipaddr.addr.v4.s_addr, &packet->yiaddr, 4) == 0) {
 				DEBUG("Reply will be unicast to YIADDR.");
 
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(PACKET_TX_RING)
+			} else if (thread->ring && (raw_ring_send(thread, &socket, code[2], packet, buffer, buffer_len) == 0)) {
+				return buffer_len;
+#endif
+
 #ifdef SIOCSARP
 			} else if (inst->broadcast && inst->interface) {
 				uint8_t macaddr[6];
@@ -461,6 +509,11 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			 *	ACKs are unicast to YIADDR
 			 */
 		case FR_DHCP_ACK:
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(PACKET_TX_RING)
+			if (thread->ring && (raw_ring_send(thread, &socket, code[2], packet, buffer, buffer_len) == 0)) {
+				return buffer_len;
+			}
+#endif
 			DEBUG("Reply will be unicast to YIADDR.");
 			memcpy(&socket.inet.dst_ipaddr.addr.v4.s_addr, &packet->yiaddr, 4);
 			break;
@@ -585,6 +638,26 @@ static int mod_open(fr_listen_t *li)
 }
 
 
+/** Create the raw transmit ring, now that we know which event list to flush it from
+ *
+ */
+static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, UNUSED void *nr)
+{
+#if defined(HAVE_LINUX_IF_PACKET_H) && defined(PACKET_TX_RING)
+	proto_dhcpv4_udp_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_dhcpv4_udp_t);
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	if (!inst->raw_ring || !inst->interface || thread->ring) return;
+
+	thread->ring = fr_dhcpv4_raw_ring_alloc(thread, el, inst->interface, inst->raw_ring);
+	if (!thread->ring) PWARN("Failed creating raw transmit ring, falling back to normal sockets");
+#else
+	(void) li;
+	(void) el;
+#endif
+}
+
+
 /** Set the file descriptor for this socket.
  *
  */
@@ -673,6 +746,21 @@ static int mod_track_compare(UNUSED void const *instance, UNUSED void *thread_in
 	return (a->message_type < b->message_type) - (a->message_type > b->message_type);
 }
 
+static uint32_t mod_track_hash(UNUSED void const *instance, UNUSED void *thread_instance, UNUSED fr_client_t *client,
+			       void const *packet)
+{
+	uint32_t hash;
+	proto_dhcpv4_track_t const *a = packet;
+
+	/*
+	 *	Hash the same fields as mod_track_compare().
+	 */
+	hash = fr_hash(&a->xid, sizeof(a->xid));
+	hash = fr_hash_update(&a->chaddr, sizeof(a->chaddr), hash);
+	hash = fr_hash_update(&a->giaddr, sizeof(a->giaddr), hash);
+	return fr_hash_update(&a->message_type, sizeof(a->message_type), hash);
+}
+
 static char const *mod_name(fr_listen_t *li)
 {
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
@@ -728,6 +816,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	}
 
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
+
+	if (inst->raw_ring) {
+		FR_INTEGER_BOUND_CHECK("raw_ring", inst->raw_ring, <=, 65536);
+
+		if (!inst->interface) {
+			cf_log_err(conf, "'raw_ring' requires 'interface' to be set");
+			return -1;
+		}
+#if !defined(HAVE_LINUX_IF_PACKET_H) || !defined(PACKET_TX_RING)
+		cf_log_warn(conf, "'raw_ring' is not supported on this platform, and will be ignored");
+#endif
+	}
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
 	if (!inst->port) {
@@ -845,8 +945,10 @@ fr_app_io_t proto_dhcpv4_udp = {
 	.read			= mod_read,
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
+	.event_list_set		= mod_event_list_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -60,6 +60,7 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_connections", proto_dhcpv6_t, io.max_connections), .dflt = "1024" } ,
 	{ FR_CONF_OFFSET("max_clients", proto_dhcpv6_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", proto_dhcpv6_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("max_new_clients", proto_dhcpv6_t, io.max_new_clients), .dflt = "0" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
@@ -194,6 +195,22 @@ static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *
 		return -1;
 	}
 
+	/*
+	 *	Remember where the relay layers are, so the reply
+	 *	can copy them instead of encoding them again.
+	 */
+	if (packet->code == FR_DHCPV6_RELAY_FORWARD) {
+		fr_dhcpv6_relay_index_t *idx;
+
+		MEM(idx = talloc(packet, fr_dhcpv6_relay_index_t));
+		if (fr_dhcpv6_relay_index(idx, packet->data, packet->data_len) < 0) {
+			RPDEBUG2("Not indexing relay layers");
+			talloc_free(idx);
+		} else {
+			packet->uctx = idx;
+		}
+	}
+
 	/*
 	 *	Set the rest of the fields.
 	 */
@@ -207,6 +224,34 @@ static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *
 	return 0;
 }
 
+/** ACK the client ID, if the reply doesn't contain one
+ *
+ * @param[in] reply		encoded reply.
+ * @param[in] reply_len		length of the encoded reply.
+ * @param[in] buffer_len	room for the reply.
+ * @param[in] original		packet the reply is to.
+ * @param[in] original_len	length of the original packet.
+ * @return the new length of the reply.
+ */
+static size_t client_id_ack(uint8_t *reply, size_t reply_len, size_t buffer_len,
+			    uint8_t const *original, size_t original_len)
+{
+	uint8_t const *client_id;
+
+	if (fr_dhcpv6_option_find(reply + 4, reply + reply_len, attr_client_id->attr)) return reply_len;
+
+	client_id = fr_dhcpv6_option_find(original + 4, original + original_len, attr_client_id->attr);
+	if (client_id) {
+		size_t len = fr_nbo_to_uint16(client_id + 2);
+		if (len <= (buffer_len - (reply_len + 4))) {
+			memcpy(reply + reply_len, client_id, 4 + len);
+			reply_len += 4 + len;
+		}
+	}
+
+	return reply_len;
+}
+
 static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8_t *buffer, size_t buffer_len)
 {
 	fr_io_track_t		*track = talloc_get_type_abort(request->async->packet_ctx, fr_io_track_t);
@@ -275,6 +320,38 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 	memset(buffer, 0, buffer_len);
 	memcpy(&reply->transaction_id, &original->transaction_id, sizeof(reply->transaction_id));
 
+	/*
+	 *	If the reply only echoes the relay layers of the
+	 *	request, encode just the reply to the client, and
+	 *	copy the relay layers from the request.
+	 */
+	if (request->packet->uctx && (request->reply->code == FR_DHCPV6_RELAY_REPLY)) {
+		fr_dhcpv6_relay_index_t const	*idx = talloc_get_type_abort_const(request->packet->uctx,
+										   fr_dhcpv6_relay_index_t);
+		fr_pair_list_t			*inner;
+		size_t				envelope_len = fr_dhcpv6_relay_envelope_len(idx);
+
+		inner = fr_dhcpv6_relay_reply_inner(idx, &request->reply_pairs);
+		if (inner && (envelope_len < buffer_len)) {
+			data_len = fr_dhcpv6_encode(&FR_DBUFF_TMP(buffer + envelope_len, buffer_len - envelope_len),
+						    NULL, 0, 0, inner);
+			if (data_len < 0) {
+				RPEDEBUG("Failed encoding DHCPv6 reply");
+				return -1;
+			}
+
+			data_len = client_id_ack(buffer + envelope_len, data_len, buffer_len - envelope_len,
+						 idx->inner, idx->inner_len);
+
+			data_len = fr_dhcpv6_relay_reply_wrap(buffer, buffer_len, idx, data_len);
+			if (data_len < 0) {
+				RPEDEBUG("Failed encoding DHCPv6 reply");
+				return -1;
+			}
+			goto done;
+		}
+	}
+
 	data_len = fr_dhcpv6_encode(&FR_DBUFF_TMP(buffer, buffer_len),
 				    request->packet->data, request->packet->data_len,
 				    request->reply->code, &request->reply_pairs);
@@ -283,22 +360,9 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 		return -1;
 	}
 
-	/*
-	 *	ACK the client ID.
-	 */
-	if (!fr_dhcpv6_option_find(buffer + 4, buffer + data_len, attr_client_id->attr)) {
-		uint8_t const *client_id;
-
-		client_id = fr_dhcpv6_option_find(request->packet->data + 4, request->packet->data + request->packet->data_len, attr_client_id->attr);
-		if (client_id) {
-			size_t len = fr_nbo_to_uint16(client_id + 2);
-			if (len <= (buffer_len - (data_len + 4))) {
-				memcpy(buffer + data_len, client_id, 4 + len);
-				data_len += 4 + len;
-			}
-		}
-	}
+	data_len = client_id_ack(buffer, data_len, buffer_len, request->packet->data, request->packet->data_len);
 
+done:
 	RHEXDUMP3(buffer, data_len, "proto_dhcpv6 encode packet");
 
 	request->reply->data_len = data_len;
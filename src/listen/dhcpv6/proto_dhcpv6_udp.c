@@ -458,6 +458,19 @@ static int mod_track_compare(UNUSED void const *instance, UNUSED void *thread_in
 	return memcmp(a->client_id, b->client_id, a->client_id_len);
 }
 
+static uint32_t mod_track_hash(UNUSED void const *instance, UNUSED void *thread_instance, UNUSED fr_client_t *client,
+			       void const *packet)
+{
+	uint32_t hash;
+	proto_dhcpv6_track_t const *a = packet;
+
+	/*
+	 *	Hash the same fields as mod_track_compare().
+	 */
+	hash = fr_hash(&a->header, sizeof(a->header));
+	return fr_hash_update(a->client_id, a->client_id_len, hash);
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -681,6 +694,7 @@ fr_app_io_t proto_dhcpv6_udp = {
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -28,6 +28,7 @@
 #include <freeradius-devel/util/udp.h>
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/trie.h>
+#include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
@@ -43,6 +44,12 @@ typedef struct {
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
 	fr_stats_t			stats;			//!< statistics for this socket
+
+	fr_rb_tree_t			*cache;			//!< Encoded responses, by query and client subnet.
+	fr_dlist_head_t			cache_lru;		//!< Cached responses, least recently used first.
+
+	fr_rb_tree_t			*pending;		//!< Queries which missed the cache.
+	fr_dlist_head_t			pending_list;		//!< Queries which missed the cache, oldest first.
 }  proto_dns_udp_thread_t;
 
 typedef struct {
@@ -68,6 +75,13 @@ typedef struct {
 	fr_trie_t			*trie;			//!< for parsed networks
 	fr_ipaddr_t			*allow;			//!< allowed networks for dynamic clients
 	fr_ipaddr_t			*deny;			//!< denied networks for dynamic clients
+
+	struct {
+		uint32_t			max_entries;		//!< Maximum number of cached responses.  0 disables the cache.
+		fr_time_delta_t			max_ttl;		//!< Longest time to cache a response for.
+		uint8_t				ipv4_prefix;		//!< Size of IPv4 client subnets.
+		uint8_t				ipv6_prefix;		//!< Size of IPv6 client subnets.
+	} cache;
 } proto_dns_udp_t;
 
 
@@ -78,6 +92,15 @@ static const conf_parser_t networks_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const conf_parser_t cache_config[] = {
+	{ FR_CONF_OFFSET("max_entries", proto_dns_udp_t, cache.max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_ttl", proto_dns_udp_t, cache.max_ttl), .dflt = "300" },
+	{ FR_CONF_OFFSET("ipv4_prefix", proto_dns_udp_t, cache.ipv4_prefix), .dflt = "24" },
+	{ FR_CONF_OFFSET("ipv6_prefix", proto_dns_udp_t, cache.ipv6_prefix), .dflt = "56" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 
 static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("ipaddr", FR_TYPE_COMBO_IP_ADDR, 0, proto_dns_udp_t, ipaddr) },
@@ -91,6 +114,8 @@ static const conf_parser_t udp_listen_config[] = {
 
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
+	{ FR_CONF_POINTER("cache", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) cache_config },
+
 	{ FR_CONF_OFFSET("max_packet_size", proto_dns_udp_t, max_packet_size), .dflt = "576" } ,
 	{ FR_CONF_OFFSET("max_attributes", proto_dns_udp_t, max_attributes), .dflt = STRINGIFY(DNS_MAX_ATTRIBUTES) } ,
 
@@ -114,10 +139,329 @@ fr_dict_attr_autoload_t proto_dns_udp_dict_attr[] = {
 	{ NULL }
 };
 
+/** An encoded response, which can be sent to any client in the same subnet
+ *
+ */
+typedef struct {
+	fr_rb_node_t			node;			//!< Entry in the cache tree.
+	fr_dlist_t			entry;			//!< Entry in the LRU list.
+
+	fr_ipaddr_t			subnet;			//!< Client subnet the response was built for.
+	uint8_t				*query;			//!< Query, less the ID.
+	size_t				query_len;		//!< Length of the query.
+
+	uint8_t				*reply;			//!< Encoded response.
+	size_t				reply_len;		//!< Length of the encoded response.
+	uint16_t			*ttl;			//!< Offsets of the TTLs in the response.
+
+	fr_time_t			created;		//!< When the response was cached.
+	fr_time_t			expires;		//!< When the lowest TTL runs out.
+} proto_dns_udp_cache_entry_t;
+
+/** A query which missed the cache, and is waiting for policy to build a response
+ *
+ */
+typedef struct {
+	fr_rb_node_t			node;			//!< Entry in the pending tree.
+	fr_dlist_t			entry;			//!< Entry in the list of pending queries, oldest first.
+
+	fr_ipaddr_t			src_ipaddr;		//!< Client address.
+	uint16_t			src_port;		//!< Client port.
+	uint16_t			id;			//!< DNS transaction ID.
+
+	proto_dns_udp_cache_entry_t	*cached;		//!< Key for the response, once it's sent.
+	fr_time_t			created;		//!< When the query was received.
+} proto_dns_udp_pending_t;
+
+/** How long to wait for policy to produce a response, before forgetting the query
+ *
+ */
+#define PROTO_DNS_UDP_PENDING_TIMEOUT	(30)
+
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	proto_dns_udp_cache_entry_t const *a = one, *b = two;
+	int8_t ret;
+	int cmp;
+
+	ret = CMP(a->query_len, b->query_len);
+	if (ret != 0) return ret;
+
+	cmp = memcmp(a->query, b->query, a->query_len);
+	if (cmp != 0) return CMP(cmp, 0);
+
+	return fr_ipaddr_cmp(&a->subnet, &b->subnet);
+}
+
+static int8_t pending_cmp(void const *one, void const *two)
+{
+	proto_dns_udp_pending_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->id, b->id);
+	if (ret != 0) return ret;
+
+	ret = CMP(a->src_port, b->src_port);
+	if (ret != 0) return ret;
+
+	return fr_ipaddr_cmp(&a->src_ipaddr, &b->src_ipaddr);
+}
+
+/** Figure out which subnet class a client belongs to
+ *
+ */
+static void cache_subnet(fr_ipaddr_t *subnet, proto_dns_udp_t const *inst, fr_ipaddr_t const *ipaddr)
+{
+	*subnet = *ipaddr;
+	subnet->scope_id = 0;
+	fr_ipaddr_mask(subnet, (subnet->af == AF_INET) ? inst->cache.ipv4_prefix : inst->cache.ipv6_prefix);
+}
+
+static void cache_entry_remove(proto_dns_udp_thread_t *thread, proto_dns_udp_cache_entry_t *cached)
+{
+	fr_rb_remove(thread->cache, cached);
+	fr_dlist_remove(&thread->cache_lru, cached);
+	talloc_free(cached);
+}
+
+static void pending_remove(proto_dns_udp_thread_t *thread, proto_dns_udp_pending_t *pending)
+{
+	fr_rb_remove(thread->pending, pending);
+	fr_dlist_remove(&thread->pending_list, pending);
+	talloc_free(pending);
+}
+
+/** Skip over an encoded DNS name
+ *
+ * @return
+ *	- pointer to the first byte after the name.
+ *	- NULL if the name runs off the end of the packet.
+ */
+static uint8_t const *dns_name_skip(uint8_t const *p, uint8_t const *end)
+{
+	while (p < end) {
+		if (*p == 0) return p + 1;
+
+		/*
+		 *	Compression pointers end the name.
+		 */
+		if ((*p & 0xc0) == 0xc0) {
+			if ((p + 2) > end) return NULL;
+			return p + 2;
+		}
+
+		if ((*p & 0xc0) != 0) return NULL;
+
+		p += *p + 1;
+	}
+
+	return NULL;
+}
+
+/** Find the TTLs in an encoded response
+ *
+ *  Only successful responses and NXDOMAIN are cached, and then only if
+ *  they have at least one resource record with a non-zero TTL.
+ *
+ * @param[in] ctx	to allocate the array of offsets in.
+ * @param[out] out	offsets of the TTLs.
+ * @param[out] min_ttl	lowest TTL in the response.
+ * @param[in] reply	Encoded response.
+ * @param[in] reply_len	Length of the response.
+ * @return
+ *	- 0 if the response can be cached.
+ *	- -1 if it can't.
+ */
+static int cache_ttl_find(TALLOC_CTX *ctx, uint16_t **out, uint32_t *min_ttl, uint8_t const *reply, size_t reply_len)
+{
+	uint8_t const	*p, *end = reply + reply_len;
+	uint16_t	ttl[64];
+	unsigned int	i, count, num_ttl = 0;
+	uint32_t	lowest = UINT32_MAX;
+
+	if (reply_len < DNS_HDR_LEN) return -1;
+
+	/*
+	 *	Don't cache truncated responses, or errors other
+	 *	than NXDOMAIN.
+	 */
+	if ((reply[2] & 0x02) != 0) return -1;
+	if (((reply[3] & 0x0f) != 0) && ((reply[3] & 0x0f) != 3)) return -1;
+
+	p = reply + DNS_HDR_LEN;
+
+	count = fr_nbo_to_uint16(reply + 4);
+	for (i = 0; i < count; i++) {
+		p = dns_name_skip(p, end);
+		if (!p || ((p + 4) > end)) return -1;
+		p += 4;
+	}
+
+	count = fr_nbo_to_uint16(reply + 6) + fr_nbo_to_uint16(reply + 8) + fr_nbo_to_uint16(reply + 10);
+	for (i = 0; i < count; i++) {
+		uint32_t rr_ttl;
+
+		p = dns_name_skip(p, end);
+		if (!p || ((p + 10) > end)) return -1;
+
+		/*
+		 *	The TTL of OPT is really flags.
+		 */
+		if (fr_nbo_to_uint16(p) != 41) {
+			if (num_ttl == NUM_ELEMENTS(ttl)) return -1;
+
+			rr_ttl = fr_nbo_to_uint32(p + 4);
+			if (rr_ttl < lowest) lowest = rr_ttl;
+			ttl[num_ttl++] = (p + 4) - reply;
+		}
+
+		p += 10 + fr_nbo_to_uint16(p + 8);
+		if (p > end) return -1;
+	}
+
+	if (!num_ttl || !lowest) return -1;
+
+	MEM(*out = talloc_memdup(ctx, ttl, num_ttl * sizeof(ttl[0])));
+	*min_ttl = lowest;
+
+	return 0;
+}
+
+/** Look for a cached response to a query
+ *
+ *  On a hit the response is written to the buffer the query was read
+ *  into, with the ID of the query, and the TTLs reduced by the time
+ *  it's been in the cache.
+ *
+ * @return
+ *	- >0 the length of the response.
+ *	- 0 if there's no usable cached response.
+ */
+static size_t cache_lookup(proto_dns_udp_t const *inst, proto_dns_udp_thread_t *thread,
+			   fr_io_address_t const *address, fr_time_t now,
+			   uint8_t *buffer, size_t buffer_len, size_t packet_len)
+{
+	proto_dns_udp_cache_entry_t	*cached, find;
+	proto_dns_udp_pending_t		*pending;
+	uint32_t			age;
+	size_t				i;
+
+	/*
+	 *	Forget about queries which policy never responded to.
+	 */
+	while ((pending = fr_dlist_head(&thread->pending_list)) &&
+	       fr_time_lt(fr_time_add(pending->created, fr_time_delta_from_sec(PROTO_DNS_UDP_PENDING_TIMEOUT)), now)) {
+		pending_remove(thread, pending);
+	}
+
+	find = (proto_dns_udp_cache_entry_t) {
+		.query = buffer + 2,
+		.query_len = packet_len - 2,
+	};
+	cache_subnet(&find.subnet, inst, &address->socket.inet.src_ipaddr);
+
+	cached = fr_rb_find(thread->cache, &find);
+	if (cached && fr_time_lteq(cached->expires, now)) {
+		cache_entry_remove(thread, cached);
+		cached = NULL;
+	}
+
+	if (!cached || (cached->reply_len > buffer_len)) {
+		if (fr_dlist_num_elements(&thread->pending_list) >= inst->cache.max_entries) {
+			pending_remove(thread, fr_dlist_head(&thread->pending_list));
+		}
+
+		MEM(pending = talloc_zero(thread->pending, proto_dns_udp_pending_t));
+		pending->src_ipaddr = address->socket.inet.src_ipaddr;
+		pending->src_port = address->socket.inet.src_port;
+		pending->id = fr_nbo_to_uint16(buffer);
+		pending->created = now;
+
+		MEM(pending->cached = talloc_zero(pending, proto_dns_udp_cache_entry_t));
+		pending->cached->subnet = find.subnet;
+		pending->cached->query_len = find.query_len;
+		MEM(pending->cached->query = talloc_memdup(pending->cached, find.query, find.query_len));
+
+		/*
+		 *	A retransmission with the same ID replaces
+		 *	the original.
+		 */
+		if (!fr_rb_insert(thread->pending, pending)) {
+			pending_remove(thread, fr_rb_find(thread->pending, pending));
+			fr_rb_insert(thread->pending, pending);
+		}
+		fr_dlist_insert_tail(&thread->pending_list, pending);
+
+		return 0;
+	}
+
+	fr_dlist_remove(&thread->cache_lru, cached);
+	fr_dlist_insert_tail(&thread->cache_lru, cached);
+
+	age = fr_time_delta_to_sec(fr_time_sub(now, cached->created));
+
+	memcpy(buffer + 2, cached->reply + 2, cached->reply_len - 2);
+	for (i = 0; i < talloc_array_length(cached->ttl); i++) {
+		fr_nbo_from_uint32(buffer + cached->ttl[i],
+				   fr_nbo_to_uint32(cached->reply + cached->ttl[i]) - age);
+	}
+
+	return cached->reply_len;
+}
+
+/** Cache the response to a query which missed the cache
+ *
+ */
+static void cache_insert(proto_dns_udp_t const *inst, proto_dns_udp_thread_t *thread,
+			 fr_io_address_t const *address, uint8_t const *reply, size_t reply_len)
+{
+	proto_dns_udp_pending_t		*pending;
+	proto_dns_udp_cache_entry_t	*cached, *old;
+	uint32_t			ttl;
+	fr_time_t			now;
+
+	if (reply_len < DNS_HDR_LEN) return;
+
+	pending = fr_rb_find(thread->pending, &(proto_dns_udp_pending_t) {
+					.src_ipaddr = address->socket.inet.src_ipaddr,
+					.src_port = address->socket.inet.src_port,
+					.id = fr_nbo_to_uint16(reply),
+				});
+	if (!pending) return;
+
+	cached = talloc_steal(thread->cache, pending->cached);
+	pending->cached = NULL;
+	pending_remove(thread, pending);
+
+	if (cache_ttl_find(cached, &cached->ttl, &ttl, reply, reply_len) < 0) {
+		talloc_free(cached);
+		return;
+	}
+
+	if (ttl > fr_time_delta_to_sec(inst->cache.max_ttl)) ttl = fr_time_delta_to_sec(inst->cache.max_ttl);
+
+	MEM(cached->reply = talloc_memdup(cached, reply, reply_len));
+	cached->reply_len = reply_len;
+
+	now = fr_time();
+	cached->created = now;
+	cached->expires = fr_time_add(now, fr_time_delta_from_sec(ttl));
+
+	old = fr_rb_find(thread->cache, cached);
+	if (old) cache_entry_remove(thread, old);
+
+	if (fr_rb_num_elements(thread->cache) >= inst->cache.max_entries) {
+		cache_entry_remove(thread, fr_dlist_head(&thread->cache_lru));
+	}
+
+	fr_rb_insert(thread->cache, cached);
+	fr_dlist_insert_tail(&thread->cache_lru, cached);
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len,
 			size_t *leftover)
 {
-//	proto_dns_udp_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_dns_udp_t);
+	proto_dns_udp_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_dns_udp_t);
 	proto_dns_udp_thread_t		*thread = talloc_get_type_abort(li->thread_instance, proto_dns_udp_thread_t);
 	fr_io_address_t			*address, **address_p;
 
@@ -183,13 +527,34 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	DEBUG2("Received %s ID %04x length %d %s", fr_dns_packet_names[packet->opcode], xid,
 	       (int) packet_len, thread->name);
 
+	/*
+	 *	Answer identical queries from the cache, without
+	 *	running policy.
+	 */
+	if (thread->cache && (packet->opcode == FR_DNS_QUERY)) {
+		size_t		reply_len;
+		fr_socket_t	socket;
+
+		reply_len = cache_lookup(inst, thread, address, *recv_time_p, buffer, buffer_len, packet_len);
+		if (reply_len > 0) {
+			DEBUG2("Sending cached response ID %04x length %zu %s", xid, reply_len, thread->name);
+
+			thread->stats.total_responses++;
+			fr_socket_addr_swap(&socket, &address->socket);
+			if (udp_send(&socket, flags, buffer, reply_len) < 0) {
+				RATE_LIMIT_GLOBAL(PERROR, "Failed sending cached response");
+			}
+			return 0;
+		}
+	}
+
 	return packet_len;
 }
 
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
-//	proto_dns_udp_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_dns_udp_t);
+	proto_dns_udp_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_dns_udp_t);
 	proto_dns_udp_thread_t		*thread = talloc_get_type_abort(li->thread_instance, proto_dns_udp_thread_t);
 
 	fr_io_track_t			*track = talloc_get_type_abort(packet_ctx, fr_io_track_t);
@@ -229,6 +594,8 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 */
 	if (data_size <= 0) return data_size;
 
+	if (thread->cache) cache_insert(inst, thread, track->address, buffer, buffer_len);
+
 	return data_size;
 }
 
@@ -301,6 +668,16 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	if (inst->cache.max_entries) {
+		MEM(thread->cache = fr_rb_inline_talloc_alloc(thread, proto_dns_udp_cache_entry_t, node,
+							      cache_entry_cmp, NULL));
+		fr_dlist_init(&thread->cache_lru, proto_dns_udp_cache_entry_t, entry);
+
+		MEM(thread->pending = fr_rb_inline_talloc_alloc(thread, proto_dns_udp_pending_t, node,
+								pending_cmp, NULL));
+		fr_dlist_init(&thread->pending_list, proto_dns_udp_pending_t, entry);
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dns_udp,
@@ -378,6 +755,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	if (inst->cache.max_entries) {
+		FR_TIME_DELTA_BOUND_CHECK("cache.max_ttl", inst->cache.max_ttl, >=, fr_time_delta_from_sec(1));
+		FR_INTEGER_BOUND_CHECK("cache.ipv4_prefix", inst->cache.ipv4_prefix, <=, 32);
+		FR_INTEGER_BOUND_CHECK("cache.ipv6_prefix", inst->cache.ipv6_prefix, <=, 128);
+	}
+
 	/*
 	 *	Parse and create the trie for dynamic clients, even if
 	 *	there's no dynamic clients.
@@ -144,6 +144,25 @@ int8_t sync_state_cmp(void const *one, void const *two)
 	return CMP(a->msgid, b->msgid);
 }
 
+/** Compare two sync packets on the entry they change
+ *
+ * @param[in] one first packet to compare.
+ * @param[in] two second packet to compare.
+ * @return CMP(one, two)
+ */
+static int8_t sync_packet_key_cmp(void const *one, void const *two)
+{
+	sync_packet_ctx_t const	*a = one, *b = two;
+	size_t			a_len = talloc_array_length(a->key), b_len = talloc_array_length(b->key);
+	int			ret;
+
+	ret = CMP(a_len, b_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->key, b->key, a_len);
+	return CMP(ret, 0);
+}
+
 /** Tell the remote server to stop the sync
  *
  * Terminates the search informing the remote server that we no longer want to receive results
@@ -199,6 +218,7 @@ sync_state_t *sync_state_alloc(TALLOC_CTX *ctx, fr_ldap_connection_t *conn, prot
 	sync->phase = SYNC_PHASE_INIT;
 
 	fr_dlist_talloc_init(&sync->pending, sync_packet_ctx_t, entry);
+	MEM(sync->entries = fr_rb_inline_talloc_alloc(sync, sync_packet_ctx_t, node, sync_packet_key_cmp, NULL));
 
 	/*
 	 *	Create arguments to pass to triggers
@@ -452,6 +472,8 @@ int ldap_sync_entry_send(sync_state_t *sync, uint8_t const uuid[SYNC_UUID_LENGTH
 		fr_pair_list_append_by_da_parent_len(sync_packet_ctx, vp, pairs, attr_ldap_sync_entry_uuid,
 						     uuid, SYNC_UUID_LENGTH, true);
 		if (!vp) goto error;
+
+		MEM(sync_packet_ctx->key = talloc_memdup(sync_packet_ctx, uuid, SYNC_UUID_LENGTH));
 	}
 
 	/*
@@ -474,7 +496,17 @@ int ldap_sync_entry_send(sync_state_t *sync, uint8_t const uuid[SYNC_UUID_LENGTH
 
 		fr_pair_list_append_by_da_parent_len(sync_packet_ctx, vp, pairs, attr_ldap_sync_entry_dn,
 						     entry_dn, strlen(entry_dn), true);
-		if (!vp) goto error;
+		if (!vp) {
+			ldap_memfree(entry_dn);
+			goto error;
+		}
+
+		/*
+		 *	Directories without entry UUIDs identify entries by DN
+		 */
+		if (!sync_packet_ctx->key) {
+			MEM(sync_packet_ctx->key = talloc_memdup(sync_packet_ctx, entry_dn, strlen(entry_dn)));
+		}
 
 		ldap_memfree(entry_dn);
 
@@ -509,6 +541,25 @@ int ldap_sync_entry_send(sync_state_t *sync, uint8_t const uuid[SYNC_UUID_LENGTH
 
 	ldap_msgfree(msg);
 
+	/*
+	 *	Changes are processed by whichever worker is free, so two
+	 *	changes to the same entry could otherwise be applied in the
+	 *	wrong order.  If an earlier change to this entry is still
+	 *	pending, this one is sent when the earlier one completes.
+	 */
+	if (sync_packet_ctx->key) {
+		sync_packet_ctx_t	*prev = fr_rb_find(sync->entries, sync_packet_ctx);
+
+		if (prev) {
+			fr_rb_remove_by_inline_node(sync->entries, &prev->node);
+			prev->next = sync_packet_ctx;
+			sync_packet_ctx->status = SYNC_PACKET_WAITING;
+		}
+		fr_rb_insert(sync->entries, sync_packet_ctx);
+
+		if (prev) return 0;
+	}
+
 	/*
 	 *	Send the packet and if it fails to send add a retry event
 	 */
@@ -521,6 +572,32 @@ int ldap_sync_entry_send(sync_state_t *sync, uint8_t const uuid[SYNC_UUID_LENGTH
 	return 0;
 }
 
+/** Send the next change to an entry once the current one has been processed
+ *
+ * @param[in] sync_packet_ctx	which has just been processed.
+ */
+static void ldap_sync_entry_next(sync_packet_ctx_t *sync_packet_ctx)
+{
+	sync_state_t		*sync = sync_packet_ctx->sync;
+	sync_packet_ctx_t	*next = sync_packet_ctx->next;
+
+	if (!next) {
+		if (fr_rb_node_inline_in_tree(&sync_packet_ctx->node)) {
+			fr_rb_remove_by_inline_node(sync->entries, &sync_packet_ctx->node);
+		}
+		return;
+	}
+
+	sync_packet_ctx->next = NULL;
+	next->status = SYNC_PACKET_PENDING;
+
+	if ((ldap_sync_entry_send_network(next) < 0) &&
+	    (fr_event_timer_in(sync, sync->conn->conn->el, &sync->retry_ev,
+			       sync->inst->retry_interval, ldap_sync_retry_event, sync) < 0)) {
+		PERROR("Inserting LDAP sync retry timer failed");
+	}
+}
+
 static void _proto_ldap_socket_init(connection_t *conn, UNUSED connection_state_t prev,
 				    UNUSED connection_state_t state, void *uctx);
 
@@ -607,7 +684,7 @@ static ssize_t proto_ldap_child_mod_read(fr_listen_t *li, UNUSED void **packet_c
 {
 	proto_ldap_sync_ldap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_ldap_sync_ldap_thread_t);
 	fr_ldap_connection_t		*conn = talloc_get_type_abort(thread->conn->h, fr_ldap_connection_t);
-	struct	timeval			poll = { 1, 0 };
+	struct	timeval			poll = { 0, 0 };
 	LDAPMessage			*msg = NULL;
 	int				ret = 0;
 	fr_ldap_rcode_t			rcode;
@@ -619,12 +696,17 @@ static ssize_t proto_ldap_child_mod_read(fr_listen_t *li, UNUSED void **packet_c
 
 	fr_assert(conn);
 
+	li->read_pending = false;
+
 	/*
 	 *	If there are already too many outstanding requests just return.
 	 *	This will (potentially) cause the TCP buffer to fill and push the
 	 *	backpressure back to the LDAP server.
 	 */
-	if (fr_network_listen_outstanding(thread->nr, li) >= thread->inst->max_outstanding) return 0;
+	if (fr_network_listen_outstanding(thread->nr, li) >= thread->inst->max_outstanding) {
+		thread->paused = true;
+		return 0;
+	}
 
 	tree = talloc_get_type_abort(conn->uctx, fr_rb_tree_t);
 
@@ -633,12 +715,19 @@ static ssize_t proto_ldap_child_mod_read(fr_listen_t *li, UNUSED void **packet_c
 	 *	We process one message at a time so that the message can be
 	 *	passed to the worker, and freed once the request has been
 	 *	handled.
+	 *
+	 *	The poll is zero so we never block the network thread,
+	 *	libldap returns messages it has already read, or reads
+	 *	whatever is available on the socket.
 	 */
 	ret = ldap_result(conn->handle, LDAP_RES_ANY, LDAP_MSG_ONE, &poll, &msg);
 
 	switch (ret) {
 	case 0:	/*
-		 *	Timeout - this has been observed if changes are being
+		 *	Nothing more to read.  Wait for the socket to become
+		 *	readable again.
+		 *
+		 *	This has also been observed if changes are being
 		 *	processed slowly, the TCP receive buffer fills and
 		 *	the LDAP directory pauses sending data for a period.
 		 *	Then all pending changes are processed and the receive buffer
@@ -662,6 +751,15 @@ static ssize_t proto_ldap_child_mod_read(fr_listen_t *li, UNUSED void **packet_c
 	 */
 	if (!msg) return 0;
 
+	/*
+	 *	A single read from the socket often contains many
+	 *	messages, during a refresh thousands of entries can
+	 *	arrive together.  Keep calling ldap_result() until it
+	 *	has nothing more for us, rather than waiting for the
+	 *	socket to become readable again for each message.
+	 */
+	li->read_pending = true;
+
 	msgid = ldap_msgid(msg);
 	type = ldap_msgtype(msg);
 
@@ -996,6 +1094,11 @@ static ssize_t proto_ldap_child_mod_write(fr_listen_t *li, void *packet_ctx, UNU
 		 */
 		if (sync_packet_ctx->type == SYNC_PACKET_TYPE_COOKIE) sync->changes_since_cookie = 0;
 
+		/*
+		 *	Release any later change to the same entry
+		 */
+		if (sync_packet_ctx->type == SYNC_PACKET_TYPE_CHANGE) ldap_sync_entry_next(sync_packet_ctx);
+
 		/*
 		 *	Pop any processed updates from the head of the list
 		 */
@@ -1032,6 +1135,18 @@ static ssize_t proto_ldap_child_mod_write(fr_listen_t *li, void *packet_ctx, UNU
 		    (sync->changes_since_cookie >= ldap_sync->cookie_changes)) ldap_sync_cookie_send(pc);
 	}
 
+	/*
+	 *	Reading was paused because too many changes were with the
+	 *	workers.  Once enough have been processed, go back to reading
+	 *	the messages libldap already has, as the socket may not
+	 *	become readable again until we do.
+	 */
+	if (thread->paused &&
+	    (fr_network_listen_outstanding(thread->nr, thread->li) <= (inst->max_outstanding / 2))) {
+		thread->paused = false;
+		fr_network_listen_read(thread->nr, thread->li);
+	}
+
 finish:
 	fr_pair_list_free(&tmp);
 	talloc_free(local);
@@ -64,6 +64,8 @@ struct sync_state_s {
 	proto_ldap_sync_t const		*inst;		//!< Module instance for this sync.
 
 	fr_dlist_head_t			pending;	//!< List of pending changes in progress.
+	fr_rb_tree_t			*entries;	//!< Latest pending change for each entry, so
+							///< changes to the same entry are processed in order.
 
 	uint32_t			pending_cookies;	//!< How many cookies are in the pending heap
 	uint32_t			changes_since_cookie;	//!< How many changes have been added since
@@ -121,6 +123,9 @@ typedef struct {
 	fr_event_timer_t const		*conn_retry_ev;		//!< When to retry re-establishing the conn.
 
 	connection_t			*conn;			//!< Our connection to the LDAP directory.
+
+	bool				paused;			//!< Stopped reading because max_outstanding
+								///< packets were with the workers.
 } proto_ldap_sync_ldap_thread_t;
 
 typedef enum {
@@ -128,6 +133,8 @@ typedef enum {
 	SYNC_PACKET_PREPARING,					//!< Packet being prepared.
 	SYNC_PACKET_PROCESSING,					//!< Packet sent to worker.
 	SYNC_PACKET_COMPLETE,					//!< Packet response received from worker.
+	SYNC_PACKET_WAITING,					//!< Waiting for an earlier change to the same
+								///< entry to be processed.
 } sync_packet_status_t;
 
 typedef enum {
@@ -148,6 +155,10 @@ struct sync_packet_ctx_s {
 	bool				refresh;		//!< Does the sync require a refresh.
 
 	fr_dlist_t			entry;			//!< Entry in list of pending packets.
+
+	uint8_t				*key;			//!< UUID or DN of the entry - NULL if unknown.
+	fr_rb_node_t			node;			//!< Entry in the tree of changes by entry.
+	struct sync_packet_ctx_s	*next;			//!< Next change to the same entry.
 };
 
 typedef struct sync_packet_ctx_s sync_packet_ctx_t;
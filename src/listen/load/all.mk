@@ -1,3 +1,4 @@
 SUBMAKEFILES := \
 	proto_load.mk \
 	proto_load_step.mk \
+	proto_load_pcap.mk
@@ -0,0 +1,739 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file proto_load_pcap.c
+ * @brief Replay RADIUS requests from a packet capture
+ *
+ * Requests are read from a pcap file, and fed to the server through the
+ * normal network -> worker path, with the same spacing as they were
+ * captured (optionally sped up).  Nothing goes through the kernel, so
+ * the results measure the server, and not the network stack.
+ *
+ * @copyright 2024 The FreeRADIUS server project.
+ */
+#include <fcntl.h>
+#include <freeradius-devel/server/protocol.h>
+#include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/histogram.h>
+#include <freeradius-devel/util/pcap.h>
+
+#include "proto_load.h"
+
+extern fr_app_io_t proto_load_pcap;
+
+typedef struct proto_load_pcap_s proto_load_pcap_t;
+
+typedef struct {
+	fr_event_list_t			*el;			//!< event list
+	fr_network_t			*nr;			//!< network handler
+
+	char const			*name;			//!< socket name
+	bool				done;
+	bool				running;		//!< replay has started.
+	bool				eof;			//!< no more packets in the capture.
+	bool				blocked;		//!< too many requests outstanding.
+
+	proto_load_pcap_t const		*inst;
+	fr_pcap_t			*pcap;			//!< capture we're replaying.
+
+	uint8_t				packet[MAX_RADIUS_LEN];	//!< next request to inject.
+	size_t				packet_len;
+	fr_socket_t			socket;			//!< addresses the request was captured with.
+	fr_time_t			captured;		//!< when the request was captured.
+	fr_time_t			due;			//!< when the request should be injected.
+
+	fr_time_t			first;			//!< capture time of the first request.
+	fr_time_t			start;			//!< when the replay started.
+
+	uint64_t			injected;		//!< requests passed to the server.
+	uint64_t			replies;		//!< replies from the server.
+	uint64_t			skipped;		//!< captured packets which weren't RADIUS requests.
+
+	fr_histogram_t			lag;			//!< how late each request was injected.
+	fr_histogram_t			latency;		//!< from injection, to the reply being written.
+
+	fr_event_timer_t const		*ev;			//!< for injecting the next request.
+
+	fr_listen_t			*parent;		//!< master IO handler
+} proto_load_pcap_thread_t;
+
+struct proto_load_pcap_s {
+	proto_load_t			*parent;
+
+	CONF_SECTION			*cs;			//!< our configuration
+
+	char const     			*filename;		//!< capture to replay.
+	char const			*filter;		//!< BPF filter for the capture.
+	char const			*secret;		//!< shared secret of the captured requests.
+	double				speed;			//!< replay speed multiplier.
+	uint32_t			max_backlog;		//!< maximum requests outstanding.
+	bool				repeat;			//!< replay the capture again when it's done.
+	char const			*json;			//!< where to write the JSON results.
+
+	fr_client_t			*client;		//!< static client
+};
+
+static const conf_parser_t pcap_listen_config[] = {
+	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_INPUT | CONF_FLAG_REQUIRED | CONF_FLAG_NOT_EMPTY, proto_load_pcap_t, filename) },
+	{ FR_CONF_OFFSET("filter", proto_load_pcap_t, filter), .dflt = "udp" },
+	{ FR_CONF_OFFSET_FLAGS("secret", CONF_FLAG_SECRET, proto_load_pcap_t, secret), .dflt = "testing123" },
+	{ FR_CONF_OFFSET("speed", proto_load_pcap_t, speed), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("max_backlog", proto_load_pcap_t, max_backlog), .dflt = "1000" },
+	{ FR_CONF_OFFSET("repeat", proto_load_pcap_t, repeat) },
+	{ FR_CONF_OFFSET("json", proto_load_pcap_t, json) },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t proto_load_pcap_dict[];
+fr_dict_autoload_t proto_load_pcap_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+/** Read the next RADIUS request from the capture
+ *
+ * Packets which aren't UDP, or aren't RADIUS requests are skipped.
+ *
+ * @return
+ *	- 1 if a request was read.
+ *	- 0 at the end of the capture.
+ *	- -1 on error.
+ */
+static int pcap_request_next(proto_load_pcap_thread_t *thread)
+{
+	struct pcap_pkthdr	*header;
+	uint8_t const		*data, *p, *end;
+	ip_header_t const	*ip;
+	ip_header6_t const	*ip6;
+	udp_header_t const	*udp;
+	ssize_t			len;
+	size_t			packet_len;
+	int			ret;
+
+next:
+	ret = pcap_next_ex(thread->pcap->handle, &header, &data);
+	if (ret == PCAP_ERROR_BREAK) return 0;
+	if (ret == 0) goto next;
+	if (ret < 0) {
+		ERROR("%s - Failed reading packet - %s", thread->name, pcap_geterr(thread->pcap->handle));
+		return -1;
+	}
+
+	p = data;
+	end = data + header->caplen;
+
+	len = fr_pcap_link_layer_offset(data, header->caplen, thread->pcap->link_layer);
+	if (len < 0) goto skip;
+	p += len;
+
+	memset(&thread->socket, 0, sizeof(thread->socket));
+	thread->socket.type = SOCK_DGRAM;
+	thread->socket.fd = -1;
+
+	if ((p + 1) > end) goto skip;
+
+	switch ((p[0] & 0xf0) >> 4) {
+	case 4:
+		ip = (ip_header_t const *) p;
+		if (((p + sizeof(*ip)) > end) || (ip->ip_p != IPPROTO_UDP)) goto skip;
+
+		thread->socket.af = AF_INET;
+		thread->socket.inet.src_ipaddr.af = AF_INET;
+		thread->socket.inet.src_ipaddr.prefix = 32;
+		thread->socket.inet.src_ipaddr.addr.v4.s_addr = ip->ip_src.s_addr;
+
+		thread->socket.inet.dst_ipaddr.af = AF_INET;
+		thread->socket.inet.dst_ipaddr.prefix = 32;
+		thread->socket.inet.dst_ipaddr.addr.v4.s_addr = ip->ip_dst.s_addr;
+		p += (0x0f & ip->ip_vhl) * 4;
+		break;
+
+	case 6:
+		ip6 = (ip_header6_t const *) p;
+		if (((p + sizeof(*ip6)) > end) || (ip6->ip_next != IPPROTO_UDP)) goto skip;
+
+		thread->socket.af = AF_INET6;
+		thread->socket.inet.src_ipaddr.af = AF_INET6;
+		thread->socket.inet.src_ipaddr.prefix = 128;
+		memcpy(thread->socket.inet.src_ipaddr.addr.v6.s6_addr, ip6->ip_src.s6_addr,
+		       sizeof(thread->socket.inet.src_ipaddr.addr.v6.s6_addr));
+
+		thread->socket.inet.dst_ipaddr.af = AF_INET6;
+		thread->socket.inet.dst_ipaddr.prefix = 128;
+		memcpy(thread->socket.inet.dst_ipaddr.addr.v6.s6_addr, ip6->ip_dst.s6_addr,
+		       sizeof(thread->socket.inet.dst_ipaddr.addr.v6.s6_addr));
+		p += sizeof(*ip6);
+		break;
+
+	default:
+		goto skip;
+	}
+
+	if ((p + sizeof(*udp) + RADIUS_HEADER_LENGTH) > end) goto skip;
+
+	udp = (udp_header_t const *) p;
+	thread->socket.inet.src_port = ntohs(udp->src);
+	thread->socket.inet.dst_port = ntohs(udp->dst);
+	p += sizeof(*udp);
+
+	/*
+	 *	Replies are handled by the server, and aren't
+	 *	replayed.
+	 */
+	switch (p[0]) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+		break;
+
+	default:
+		goto skip;
+	}
+
+	packet_len = fr_nbo_to_uint16(p + 2);
+	if ((packet_len < RADIUS_HEADER_LENGTH) || (packet_len > (size_t) (end - p)) ||
+	    (packet_len > sizeof(thread->packet))) goto skip;
+
+	memcpy(thread->packet, p, packet_len);
+	thread->packet_len = packet_len;
+	thread->captured = fr_time_from_timeval(&header->ts);
+
+	return 1;
+
+skip:
+	thread->skipped++;
+	goto next;
+}
+
+/** Work out when the current request should be injected
+ *
+ */
+static void pcap_request_due(proto_load_pcap_thread_t *thread)
+{
+	int64_t offset;
+
+	if (thread->inst->speed == 0) {
+		thread->due = thread->start;
+		return;
+	}
+
+	offset = fr_time_delta_unwrap(fr_time_sub(thread->captured, thread->first));
+	if (offset < 0) offset = 0;	/* captures aren't always in order */
+
+	thread->due = fr_time_add(thread->start, fr_time_delta_wrap((int64_t) (offset / thread->inst->speed)));
+}
+
+/** Open the capture, and read the first request
+ *
+ */
+static int pcap_replay_start(proto_load_pcap_thread_t *thread, fr_time_t now)
+{
+	proto_load_pcap_t const *inst = thread->inst;
+
+	TALLOC_FREE(thread->pcap);
+
+	thread->pcap = fr_pcap_init(thread, inst->filename, PCAP_FILE_IN);
+	if (!thread->pcap) {
+		PERROR("%s - Failed initialising capture", thread->name);
+		return -1;
+	}
+
+	if (fr_pcap_open(thread->pcap) < 0) {
+		PERROR("%s - Failed opening capture", thread->name);
+		return -1;
+	}
+
+	if (inst->filter && (fr_pcap_apply_filter(thread->pcap, inst->filter) < 0)) {
+		PERROR("%s - Failed applying filter", thread->name);
+		return -1;
+	}
+
+	thread->eof = false;
+	thread->blocked = false;
+	thread->injected = thread->replies = thread->skipped = 0;
+	memset(&thread->lag, 0, sizeof(thread->lag));
+	memset(&thread->latency, 0, sizeof(thread->latency));
+
+	switch (pcap_request_next(thread)) {
+	case 1:
+		break;
+
+	case 0:
+		ERROR("%s - No RADIUS requests in the capture", thread->name);
+		FALL_THROUGH;
+
+	default:
+		return -1;
+	}
+
+	thread->first = thread->captured;
+	thread->start = now;
+	pcap_request_due(thread);
+
+	return 0;
+}
+
+static void pcap_replay(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Arrange for the server to read the next request when it's due
+ *
+ */
+static void pcap_replay_schedule(fr_listen_t *li)
+{
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+
+	if (thread->eof || thread->blocked || thread->done) return;
+
+	if (fr_event_timer_at(thread, thread->el, &thread->ev, thread->due, pcap_replay, li) < 0) {
+		PERROR("%s - Failed scheduling next request", thread->name);
+	}
+}
+
+static void pcap_replay(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_listen_t			*li = uctx;
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+
+	/*
+	 *	Tell the network side to call our read routine.  It
+	 *	reads the requests which are due, up to a limit, and
+	 *	we go around again for the rest.
+	 */
+	fr_network_listen_read(thread->nr, thread->parent);
+
+	pcap_replay_schedule(li);
+}
+
+static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover)
+{
+	proto_load_pcap_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_pcap_t);
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+	fr_io_address_t			*address, **address_p;
+	fr_time_t			now;
+	ssize_t				len;
+
+	if (thread->done) return -1;
+
+	/*
+	 *	Suspend reading on the FD, and start the replay.  The
+	 *	timers take over from here.
+	 */
+	if (!thread->running) {
+		static fr_event_update_t pause[] = {
+			FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+			FR_EVENT_SUSPEND(fr_event_io_func_t, write),
+			{ 0 }
+		};
+
+		if (fr_event_filter_update(thread->el, li->fd, FR_EVENT_FILTER_IO, pause) < 0) {
+			fr_assert(0);
+		}
+
+		thread->running = true;
+
+		if (pcap_replay_start(thread, fr_time()) < 0) return -1;
+
+		pcap_replay_schedule(li);
+		return 0;
+	}
+
+	*leftover = 0;
+
+	if (thread->eof || thread->blocked) return 0;
+
+	now = fr_time();
+	if (fr_time_gt(thread->due, now)) return 0;
+
+	if ((thread->injected - thread->replies) >= inst->max_backlog) {
+		thread->blocked = true;
+		return 0;
+	}
+
+	if (buffer_len < thread->packet_len) {
+		DEBUG2("proto_load_pcap read buffer is too small for input packet");
+		return 0;
+	}
+
+	/*
+	 *	Where the addresses should go.  This is a special case
+	 *	for proto_radius.
+	 */
+	address_p = (fr_io_address_t **) packet_ctx;
+	address = *address_p;
+
+	memset(address, 0, sizeof(*address));
+	address->socket = thread->socket;
+	address->radclient = inst->client;
+
+	memcpy(buffer, thread->packet, thread->packet_len);
+	len = thread->packet_len;
+
+	*recv_time_p = now;
+	fr_histogram_add(&thread->lag, fr_time_delta_unwrap(fr_time_sub(now, thread->due)));
+	thread->injected++;
+
+	/*
+	 *	Get the next one ready.
+	 */
+	if (pcap_request_next(thread) == 1) {
+		pcap_request_due(thread);
+	} else {
+		thread->eof = true;
+	}
+
+	return len;
+}
+
+/** Print a histogram as a JSON object
+ *
+ */
+static void json_histogram_print(FILE *fp, char const *name, fr_histogram_t const *h)
+{
+	fprintf(fp, "\t\"%s\": { \"count\": %" PRIu64 ", \"mean_usec\": %.3f, \"p50_usec\": %.3f, "
+		"\"p90_usec\": %.3f, \"p99_usec\": %.3f, \"p99.9_usec\": %.3f, \"max_usec\": %.3f }",
+		name, h->count, fr_histogram_mean(h) / 1000.0,
+		fr_histogram_percentile(h, 50) / 1000.0,
+		fr_histogram_percentile(h, 90) / 1000.0,
+		fr_histogram_percentile(h, 99) / 1000.0,
+		fr_histogram_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+}
+
+static void json_string_print(FILE *fp, char const *str)
+{
+	char const *p;
+
+	fputc('"', fp);
+	for (p = str; *p; p++) {
+		if ((*p == '"') || (*p == '\\')) {
+			fputc('\\', fp);
+		} else if ((uint8_t) *p < 0x20) {
+			fprintf(fp, "\\u%04x", (uint8_t) *p);
+			continue;
+		}
+		fputc(*p, fp);
+	}
+	fputc('"', fp);
+}
+
+typedef struct {
+	FILE		*fp;
+	bool		first;
+} load_json_ctx_t;
+
+static void json_section_print(void *uctx, char const *name, int depth, fr_histogram_t const *h)
+{
+	load_json_ctx_t *json = uctx;
+
+	if (depth && !h->count) return;
+
+	fprintf(json->fp, "%s\n\t\t{ \"name\": ", json->first ? "" : ",");
+	json_string_print(json->fp, name);
+	fprintf(json->fp, ", \"depth\": %d, \"count\": %" PRIu64 ", \"mean_usec\": %.3f, \"p50_usec\": %.3f, "
+		"\"p90_usec\": %.3f, \"p99_usec\": %.3f, \"p99.9_usec\": %.3f, \"max_usec\": %.3f }",
+		depth, h->count, fr_histogram_mean(h) / 1000.0,
+		fr_histogram_percentile(h, 50) / 1000.0,
+		fr_histogram_percentile(h, 90) / 1000.0,
+		fr_histogram_percentile(h, 99) / 1000.0,
+		fr_histogram_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+
+	json->first = false;
+}
+
+/** Write the results of a replay
+ *
+ *  The time taken to inject each request, and the time from injection
+ *  to the reply, are followed by the latency of each section, policy
+ *  and module call in the virtual server.
+ */
+static void write_results(proto_load_pcap_thread_t *thread, fr_time_t now)
+{
+	proto_load_pcap_t const	*inst = thread->inst;
+	load_json_ctx_t		json = { .first = true };
+	double			elapsed;
+
+	elapsed = fr_time_delta_unwrap(fr_time_sub(now, thread->start)) / (double) NSEC;
+
+	INFO("%s - replayed %" PRIu64 " requests in %.3fs (%.1f packets/s), skipped %" PRIu64 " packets, "
+	     "latency p50 %.3fms p99 %.3fms max %.3fms", thread->name, thread->injected, elapsed,
+	     elapsed > 0 ? thread->injected / elapsed : 0, thread->skipped,
+	     fr_histogram_percentile(&thread->latency, 50) / 1000000.0,
+	     fr_histogram_percentile(&thread->latency, 99) / 1000000.0,
+	     thread->latency.max / 1000000.0);
+
+	if (!inst->json) return;
+
+	json.fp = fopen(inst->json, "w");
+	if (!json.fp) {
+		ERROR("Failed opening %s - %s", inst->json, fr_syserror(errno));
+		return;
+	}
+
+	fprintf(json.fp, "{\n\"replay\": {\n\t\"filename\": ");
+	json_string_print(json.fp, inst->filename);
+	fprintf(json.fp, ",\n\t\"speed\": %g,\n\t\"requests\": %" PRIu64 ",\n\t\"replies\": %" PRIu64 ",\n"
+		"\t\"skipped\": %" PRIu64 ",\n\t\"elapsed_sec\": %.6f,\n\t\"pps\": %.1f,\n",
+		inst->speed, thread->injected, thread->replies, thread->skipped, elapsed,
+		elapsed > 0 ? thread->injected / elapsed : 0);
+	json_histogram_print(json.fp, "inject_lag", &thread->lag);
+	fprintf(json.fp, ",\n");
+	json_histogram_print(json.fp, "latency", &thread->latency);
+	fprintf(json.fp, "\n},\n\"sections\": [");
+	if (unlang_latency_walk(cf_section_name2(inst->parent->server_cs), json_section_print, &json) < 0) {
+		ERROR("Failed getting section latency - %s", fr_strerror());
+	}
+	fprintf(json.fp, "%s]\n}\n", json.first ? "" : "\n\t");
+
+	if (fclose(json.fp) < 0) ERROR("Failed writing %s - %s", inst->json, fr_syserror(errno));
+}
+
+static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t request_time,
+			 UNUSED uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
+{
+	proto_load_pcap_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_pcap_t);
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+	fr_time_t			now = fr_time();
+
+	thread->replies++;
+	fr_histogram_add(&thread->latency, fr_time_delta_unwrap(fr_time_sub(now, request_time)));
+
+	/*
+	 *	Start injecting again once half of the backlog has
+	 *	been processed.
+	 */
+	if (thread->blocked && ((thread->injected - thread->replies) <= (inst->max_backlog / 2))) {
+		thread->blocked = false;
+		pcap_replay_schedule(li);
+	}
+
+	if (!thread->eof || (thread->replies < thread->injected)) return buffer_len;
+
+	write_results(thread, now);
+
+	if (!inst->repeat || (pcap_replay_start(thread, now) < 0)) {
+		thread->done = true;
+		return buffer_len;
+	}
+
+	pcap_replay_schedule(li);
+
+	return buffer_len;
+}
+
+/** Open a pcap listener
+ *
+ */
+static int mod_open(fr_listen_t *li)
+{
+	proto_load_pcap_t const		*inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_pcap_t);
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+
+	fr_ipaddr_t			ipaddr;
+
+	/*
+	 *	We read the capture through libpcap, but we need a
+	 *	readable FD in order to bootstrap the process.
+	 */
+	li->fd = open(inst->filename, O_RDONLY);
+
+	memset(&ipaddr, 0, sizeof(ipaddr));
+	ipaddr.af = AF_INET;
+	li->app_io_addr = fr_socket_addr_alloc_inet_src(li, IPPROTO_UDP, 0, &ipaddr, 0);
+
+	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
+
+	thread->name = talloc_typed_asprintf(thread, "load_pcap from filename %s", inst->filename);
+	thread->parent = talloc_parent(li);
+
+	return 0;
+}
+
+/** Decode the packet
+ *
+ */
+static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+{
+	proto_load_pcap_t const	*inst = talloc_get_type_abort_const(instance, proto_load_pcap_t);
+	fr_io_track_t const	*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
+	fr_io_address_t const  	*address = track->address;
+	fr_radius_ctx_t		common_ctx;
+	fr_radius_decode_ctx_t	decode_ctx;
+
+	request->dict = dict_radius;
+
+	request->packet->code = data[0];
+	request->packet->id = data[1];
+	request->reply->id = data[1];
+	memcpy(request->packet->vector, data + 4, sizeof(request->packet->vector));
+
+	request->packet->data = talloc_memdup(request->packet, data, data_len);
+	request->packet->data_len = data_len;
+
+	/*
+	 *	Captures can contain requests from many clients, with
+	 *	different secrets.  So we decode with the configured
+	 *	secret, and don't verify the packet.
+	 */
+	common_ctx = (fr_radius_ctx_t) {
+		.secret = inst->secret,
+		.secret_length = talloc_array_length(inst->secret) - 1,
+	};
+
+	decode_ctx = (fr_radius_decode_ctx_t) {
+		.common = &common_ctx,
+		.tmp_ctx = talloc(request, uint8_t),
+		.end = request->packet->data + data_len,
+		.packet_buffer = request->packet->data,
+	};
+
+	if (fr_radius_decode(request->request_ctx, &request->request_pairs,
+			     request->packet->data, request->packet->data_len, &decode_ctx) < 0) {
+		talloc_free(decode_ctx.tmp_ctx);
+		RPEDEBUG("Failed reading packet");
+		return -1;
+	}
+	talloc_free(decode_ctx.tmp_ctx);
+
+	/*
+	 *	Set the rest of the fields.
+	 */
+	request->client = UNCONST(fr_client_t *, address->radclient);
+
+	request->packet->socket = address->socket;
+	fr_socket_addr_swap(&request->reply->socket, &address->socket);
+
+	REQUEST_VERIFY(request);
+
+	return 0;
+}
+
+/** Set the event list for a new socket
+ *
+ * @param[in] li the listener
+ * @param[in] el the event list
+ * @param[in] nr context from the network side
+ */
+static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
+{
+	proto_load_pcap_t const       *inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_pcap_t);
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+
+	thread->el = el;
+	thread->nr = nr;
+	thread->inst = inst;
+}
+
+static char const *mod_name(fr_listen_t *li)
+{
+	proto_load_pcap_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_pcap_thread_t);
+
+	return thread->name;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	proto_load_pcap_t	*inst = talloc_get_type_abort(mctx->mi->data, proto_load_pcap_t);
+	CONF_SECTION		*conf = mctx->mi->conf;
+	fr_client_t		*client;
+	module_instance_t const	*mi = mctx->mi;
+
+	if (virtual_server_dict_by_child_ci(cf_section_to_item(conf)) != dict_radius) {
+		cf_log_err(conf, "The 'pcap' transport can only be used in a virtual server with 'namespace = radius'");
+		return -1;
+	}
+
+	inst->client = client = talloc_zero(inst, fr_client_t);
+	if (!inst->client) return 0;
+
+	client->ipaddr.af = AF_INET;
+	client->src_ipaddr = client->ipaddr;
+
+	client->longname = client->shortname = inst->filename;
+	client->secret = talloc_strdup(client, inst->secret);
+	client->nas_type = talloc_strdup(client, "load");
+	client->use_connected = false;
+
+	inst->parent = talloc_get_type_abort(mi->parent->data, proto_load_t);
+	inst->cs = conf;
+
+	if (inst->speed < 0) {
+		cf_log_err(conf, "Invalid value for 'speed' - must be 0 or more");
+		return -1;
+	}
+
+	FR_INTEGER_BOUND_CHECK("max_backlog", inst->max_backlog, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_backlog", inst->max_backlog, <, 100000);
+
+	return 0;
+}
+
+static fr_client_t *mod_client_find(fr_listen_t *li, UNUSED fr_ipaddr_t const *ipaddr, UNUSED int ipproto)
+{
+	proto_load_pcap_t const       *inst = talloc_get_type_abort_const(li->app_io_instance, proto_load_pcap_t);
+
+	return inst->client;
+}
+
+static int mod_load(void)
+{
+	if (fr_radius_global_init() < 0) {
+		PERROR("Failed initialising protocol library");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void mod_unload(void)
+{
+	fr_radius_global_free();
+}
+
+fr_app_io_t proto_load_pcap = {
+	.common = {
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "load_pcap",
+		.config			= pcap_listen_config,
+		.inst_size		= sizeof(proto_load_pcap_t),
+		.thread_inst_size	= sizeof(proto_load_pcap_thread_t),
+		.onload			= mod_load,
+		.unload			= mod_unload,
+		.instantiate		= mod_instantiate
+	},
+	.default_message_size	= MAX_RADIUS_LEN,
+	.track_duplicates	= false,
+
+	.open			= mod_open,
+	.read			= mod_read,
+	.write			= mod_write,
+	.event_list_set		= mod_event_list_set,
+	.client_find		= mod_client_find,
+	.get_name      		= mod_name,
+
+	.decode			= mod_decode,
+};
@@ -0,0 +1,15 @@
+ifneq ($(PCAP_LIBS),)
+TARGETNAME	:= proto_load_pcap
+else
+TARGETNAME	:=
+endif
+
+ifneq "$(TARGETNAME)" ""
+TARGET		:= $(TARGETNAME)$(L)
+endif
+
+SOURCES		:= proto_load_pcap.c
+
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L)
+TGT_LDLIBS	:= $(PCAP_LIBS)
+TGT_LDFLAGS	:= $(PCAP_LDFLAGS)
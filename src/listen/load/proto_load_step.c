@@ -29,6 +29,7 @@
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/io/load.h>
+#include <freeradius-devel/unlang/base.h>
 
 #include "proto_load.h"
 
@@ -73,6 +74,7 @@ struct proto_load_step_s {
 	fr_load_config_t		load;			//!< load configuration
 	bool				repeat;			//!, do we repeat the load generation
 	char const     			*csv;			//!< where to write CSV stats
+	char const			*json;			//!< where to write the JSON results
 
 	fr_dict_t const			*dict;			//!< Our namespace.
 };
@@ -81,6 +83,7 @@ struct proto_load_step_s {
 static const conf_parser_t load_listen_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_INPUT | CONF_FLAG_REQUIRED | CONF_FLAG_NOT_EMPTY, proto_load_step_t, filename) },
 	{ FR_CONF_OFFSET("csv", proto_load_step_t, csv) },
+	{ FR_CONF_OFFSET("json", proto_load_step_t, json) },
 
 	{ FR_CONF_OFFSET("max_attributes", proto_load_step_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
@@ -92,6 +95,9 @@ static const conf_parser_t load_listen_config[] = {
 	{ FR_CONF_OFFSET("parallel", proto_load_step_t, load.parallel) },
 	{ FR_CONF_OFFSET("repeat", proto_load_step_t, repeat) },
 
+	{ FR_CONF_OFFSET("slo_latency", proto_load_step_t, load.slo_latency) },
+	{ FR_CONF_OFFSET("slo_percentile", proto_load_step_t, load.slo_percentile), .dflt = "99" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -155,6 +161,84 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 }
 
 
+static void json_string_print(FILE *fp, char const *str)
+{
+	char const *p;
+
+	fputc('"', fp);
+	for (p = str; *p; p++) {
+		if ((*p == '"') || (*p == '\\')) {
+			fputc('\\', fp);
+		} else if ((uint8_t) *p < 0x20) {
+			fprintf(fp, "\\u%04x", (uint8_t) *p);
+			continue;
+		}
+		fputc(*p, fp);
+	}
+	fputc('"', fp);
+}
+
+typedef struct {
+	FILE		*fp;
+	bool		first;
+} load_json_ctx_t;
+
+static void json_section_print(void *uctx, char const *name, int depth, fr_histogram_t const *h)
+{
+	load_json_ctx_t *json = uctx;
+
+	if (depth && !h->count) return;
+
+	fprintf(json->fp, "%s\n\t\t{ \"name\": ", json->first ? "" : ",");
+	json_string_print(json->fp, name);
+	fprintf(json->fp, ", \"depth\": %d, \"count\": %" PRIu64 ", \"mean_usec\": %.3f, \"p50_usec\": %.3f, "
+		"\"p90_usec\": %.3f, \"p99_usec\": %.3f, \"p99.9_usec\": %.3f, \"max_usec\": %.3f }",
+		depth, h->count, fr_histogram_mean(h) / 1000.0,
+		fr_histogram_percentile(h, 50) / 1000.0,
+		fr_histogram_percentile(h, 90) / 1000.0,
+		fr_histogram_percentile(h, 99) / 1000.0,
+		fr_histogram_percentile(h, 99.9) / 1000.0,
+		h->max / 1000.0);
+
+	json->first = false;
+}
+
+/** Write the results of a load test as JSON
+ *
+ *  The load generator results are followed by the latency of each
+ *  section, policy and module call in the virtual server.
+ */
+static void write_json(proto_load_step_thread_t *thread)
+{
+	proto_load_step_t const	*inst = thread->inst;
+	fr_load_stats_t const	*stats = fr_load_generator_stats(thread->l);
+	load_json_ctx_t		json = { .first = true };
+
+	if (stats->slo_breached) {
+		INFO("%s - SLO breached, maximum sustainable rate is %d packets/s", thread->name, stats->slo_pps);
+	} else {
+		INFO("%s - finished, maximum rate is %d packets/s", thread->name, stats->slo_pps);
+	}
+
+	if (!inst->json) return;
+
+	json.fp = fopen(inst->json, "w");
+	if (!json.fp) {
+		ERROR("Failed opening %s - %s", inst->json, fr_syserror(errno));
+		return;
+	}
+
+	fprintf(json.fp, "{\n\"load\": ");
+	fr_load_generator_stats_json(thread->l, json.fp);
+	fprintf(json.fp, ",\n\"sections\": [");
+	if (unlang_latency_walk(cf_section_name2(inst->parent->server_cs), json_section_print, &json) < 0) {
+		ERROR("Failed getting section latency - %s", fr_strerror());
+	}
+	fprintf(json.fp, "%s]\n}\n", json.first ? "" : "\n\t");
+
+	if (fclose(json.fp) < 0) ERROR("Failed writing %s - %s", inst->json, fr_syserror(errno));
+}
+
 static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t request_time,
 			 UNUSED uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
@@ -175,6 +259,8 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t req
 	 */
 	state = fr_load_generator_have_reply(thread->l, request_time);
 	if (state == FR_LOAD_DONE) {
+		write_json(thread);
+
 		if (!thread->inst->repeat) {
 			thread->done = true;
 		} else {
@@ -408,6 +494,16 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, >=, 1);
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, <, 100000);
 
+	if (fr_time_delta_ispos(inst->load.slo_latency)) {
+		FR_TIME_DELTA_BOUND_CHECK("slo_latency", inst->load.slo_latency, >=, fr_time_delta_from_usec(1));
+		FR_TIME_DELTA_BOUND_CHECK("slo_latency", inst->load.slo_latency, <, fr_time_delta_from_sec(100));
+	}
+
+	if ((inst->load.slo_percentile <= 0) || (inst->load.slo_percentile > 100)) {
+		cf_log_err(conf, "Invalid value for 'slo_percentile' - must be between 0 and 100");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -42,6 +42,7 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_connections", proto_radius_t, io.max_connections), .dflt = "1024" } ,
 	{ FR_CONF_OFFSET("max_clients", proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
+	{ FR_CONF_OFFSET("max_new_clients", proto_radius_t, io.max_new_clients), .dflt = "0" } ,
 
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
@@ -49,6 +50,9 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", proto_radius_t, max_packet_size) } ,
 	{ FR_CONF_OFFSET("num_messages", proto_radius_t, num_messages) } ,
 
+	{ FR_CONF_OFFSET("shards", proto_radius_t, io.num_shards), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("shard_steering", proto_radius_t, io.shard_steering), .dflt = "no" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -94,6 +98,12 @@ static conf_parser_t const proto_radius_config[] = {
 	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_radius_limit_proxy_state_table, .len = &fr_radius_limit_proxy_state_table_len },
 	  .dflt = "auto" },
 
+	{ FR_CONF_OFFSET("flow_attribute", proto_radius_t, flow_attribute) },
+
+	{ FR_CONF_OFFSET("predecode", proto_radius_t, io.predecode) },
+
+	{ FR_CONF_OFFSET("lazy_decode", proto_radius_t, lazy_decode), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -174,17 +184,17 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 	return 0;
 }
 
-/** Decode the packet
+/** Set up the decode context for a packet
  *
+ * Called by both the network thread and the worker, so it must not
+ * change the client.  The "seen" flags of the client are written by
+ * workers, so they're passed in, and the network thread doesn't read them.
  */
-static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+static void proto_radius_decode_ctx_init(fr_radius_decode_ctx_t *decode_ctx, fr_radius_ctx_t *common_ctx,
+					 proto_radius_t const *inst, fr_client_t const *client,
+					 bool received_message_authenticator, bool first_packet_no_proxy_state,
+					 uint8_t const *data, size_t data_len)
 {
-	proto_radius_t const		*inst = talloc_get_type_abort_const(instance, proto_radius_t);
-	fr_io_track_t const		*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
-	fr_io_address_t const  		*address = track->address;
-	fr_client_t			*client = UNCONST(fr_client_t *, address->radclient);
-	fr_radius_ctx_t			common_ctx;
-	fr_radius_decode_ctx_t		decode_ctx;
 	fr_radius_require_ma_t		require_message_authenticator = client->require_message_authenticator_is_set ?
 									client->require_message_authenticator:
 									inst->require_message_authenticator;
@@ -192,45 +202,117 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 							    client->limit_proxy_state:
 							    inst->limit_proxy_state;
 
-	fr_assert(data[0] < FR_RADIUS_CODE_MAX);
-
-	/*
-	 *	Set the request dictionary so that we can do
-	 *	generic->protocol attribute conversions as
-	 *	the request runs through the server.
-	 */
-	request->dict = dict_radius;
-
-	common_ctx = (fr_radius_ctx_t) {
+	*common_ctx = (fr_radius_ctx_t) {
 		.secret = client->secret,
 		.secret_length = talloc_array_length(client->secret) - 1,
 	};
 
-	request->packet->code = data[0];
-
-	decode_ctx = (fr_radius_decode_ctx_t) {
-		.common = &common_ctx,
-		.tmp_ctx = talloc(request, uint8_t),
+	*decode_ctx = (fr_radius_decode_ctx_t) {
+		.common = common_ctx,
 		/* decode figures out request_authenticator */
 		.end = data + data_len,
 		.verify = client->active,
 	};
 
-	if (request->packet->code == FR_RADIUS_CODE_ACCESS_REQUEST) {
+	if (data[0] == FR_RADIUS_CODE_ACCESS_REQUEST) {
 		/*
 		 *	bit1 is set if we've seen a packet, and the auto bit in require_message_authenticator is set/
 		 *	bit2 is set if we always require a message_authenticator.
 		 *	If either bit is high we require a message authenticator in the packet.
 		 */
-		decode_ctx.require_message_authenticator = (
-				(client->received_message_authenticator & require_message_authenticator) |
+		decode_ctx->require_message_authenticator = (
+				(received_message_authenticator & require_message_authenticator) |
 				(require_message_authenticator & FR_RADIUS_REQUIRE_MA_YES)
 			) > 0;
-		decode_ctx.limit_proxy_state = (
-				(client->first_packet_no_proxy_state & limit_proxy_state) |
+		decode_ctx->limit_proxy_state = (
+				(first_packet_no_proxy_state & limit_proxy_state) |
 				(limit_proxy_state & FR_RADIUS_LIMIT_PROXY_STATE_YES)
 			) > 0;
 	}
+}
+
+/** Decode the packet on the network thread
+ *
+ */
+static fr_app_decoded_t *mod_predecode(void const *instance, void const *packet_ctx,
+				       uint8_t const *buffer, size_t buflen)
+{
+	proto_radius_t const		*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	fr_io_track_t const		*track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+	fr_client_t const		*client = track->address->radclient;
+	fr_radius_ctx_t			common_ctx;
+	fr_radius_decode_ctx_t		decode_ctx;
+	fr_app_decoded_t		*decoded;
+
+	/*
+	 *	Packets which define a dynamic client are rare, and
+	 *	can't be verified.  Leave them to the worker.
+	 */
+	if (!client->active) return NULL;
+
+	/*
+	 *	In "auto" mode, what we require of an Access-Request
+	 *	depends on the packets workers have already seen from
+	 *	the client, and workers update that without locking.
+	 *	Leave those packets to the worker, too.
+	 */
+	if (buffer[0] == FR_RADIUS_CODE_ACCESS_REQUEST) {
+		fr_radius_require_ma_t		require_message_authenticator = client->require_message_authenticator_is_set ?
+										client->require_message_authenticator:
+										inst->require_message_authenticator;
+		fr_radius_limit_proxy_state_t	limit_proxy_state = client->limit_proxy_state_is_set ?
+								    client->limit_proxy_state:
+								    inst->limit_proxy_state;
+
+		if ((require_message_authenticator == FR_RADIUS_REQUIRE_MA_AUTO) ||
+		    (limit_proxy_state == FR_RADIUS_LIMIT_PROXY_STATE_AUTO)) return NULL;
+	}
+
+	/*
+	 *	Not parented, as it's freed by the worker.
+	 */
+	decoded = talloc_zero(NULL, fr_app_decoded_t);
+	if (!decoded) return NULL;
+	fr_pair_list_init(&decoded->pairs);
+
+	proto_radius_decode_ctx_init(&decode_ctx, &common_ctx, inst, client, false, false, buffer, buflen);
+	decode_ctx.tmp_ctx = talloc(decoded, uint8_t);
+
+	if (fr_radius_decode(decoded, &decoded->pairs, UNCONST(uint8_t *, buffer), buflen, &decode_ctx) < 0) {
+		talloc_free(decoded);
+		return NULL;
+	}
+	talloc_free(decode_ctx.tmp_ctx);
+
+	return decoded;
+}
+
+/** Decode the packet
+ *
+ */
+static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+{
+	proto_radius_t const		*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	fr_io_track_t const		*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
+	fr_io_address_t const  		*address = track->address;
+	fr_client_t			*client = UNCONST(fr_client_t *, address->radclient);
+	fr_radius_require_ma_t		require_message_authenticator = client->require_message_authenticator_is_set ?
+									client->require_message_authenticator:
+									inst->require_message_authenticator;
+	fr_radius_limit_proxy_state_t	limit_proxy_state = client->limit_proxy_state_is_set ?
+							    client->limit_proxy_state:
+							    inst->limit_proxy_state;
+
+	fr_assert(data[0] < FR_RADIUS_CODE_MAX);
+
+	/*
+	 *	Set the request dictionary so that we can do
+	 *	generic->protocol attribute conversions as
+	 *	the request runs through the server.
+	 */
+	request->dict = dict_radius;
+
+	request->packet->code = data[0];
 
 	/*
 	 *	The verify() routine over-writes the request packet vector.
@@ -245,16 +327,49 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->packet->data_len = data_len;
 
 	/*
-	 *	!client->active means a fake packet defining a dynamic client - so there will
-	 *	be no secret defined yet - so can't verify.
+	 *	The network thread has already decoded the packet.
 	 */
-	if (fr_radius_decode(request->request_ctx, &request->request_pairs,
-			     data, data_len, &decode_ctx) < 0) {
+	if (request->async->decoded) {
+		fr_app_decoded_t *decoded = talloc_get_type_abort(request->async->decoded, fr_app_decoded_t);
+
+		fr_pair_list_steal(request->request_ctx, &decoded->pairs);
+		fr_pair_list_append(&request->request_pairs, &decoded->pairs);
+		TALLOC_FREE(request->async->decoded);
+
+	} else {
+		fr_radius_ctx_t		common_ctx;
+		fr_radius_decode_ctx_t	decode_ctx;
+		ssize_t			slen;
+
+		/*
+		 *	Decode from the copy owned by the request, so
+		 *	that large octets values can point into it.
+		 */
+		proto_radius_decode_ctx_init(&decode_ctx, &common_ctx, inst, client,
+					     client->received_message_authenticator,
+					     client->first_packet_no_proxy_state,
+					     request->packet->data, request->packet->data_len);
+		decode_ctx.tmp_ctx = talloc(request, uint8_t);
+		decode_ctx.packet_buffer = request->packet->data;
+
+		/*
+		 *	!client->active means a fake packet defining a dynamic client - so there will
+		 *	be no secret defined yet - so can't verify.
+		 */
+		if (inst->lazy_decode) {
+			slen = fr_radius_decode_lazy(request->request_ctx, &request->request_pairs,
+						     request->packet->data, request->packet->data_len, &decode_ctx);
+		} else {
+			slen = fr_radius_decode(request->request_ctx, &request->request_pairs,
+						request->packet->data, request->packet->data_len, &decode_ctx);
+		}
+		if (slen < 0) {
+			talloc_free(decode_ctx.tmp_ctx);
+			RPEDEBUG("Failed reading packet");
+			return -1;
+		}
 		talloc_free(decode_ctx.tmp_ctx);
-		RPEDEBUG("Failed reading packet");
-		return -1;
 	}
-	talloc_free(decode_ctx.tmp_ctx);
 
 	/*
 	 *	Set the rest of the fields.
@@ -533,6 +648,51 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/** Identify the flow a packet belongs to
+ *
+ * If a flow attribute is configured, and the packet contains it, the
+ * flow is identified by the value of the attribute.  Otherwise it's
+ * identified by the source IP address of the client.
+ */
+static uint32_t mod_flow_hash(void const *instance, void const *packet_ctx, uint8_t const *buffer, size_t buflen)
+{
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	fr_io_track_t const	*track = packet_ctx;
+	fr_ipaddr_t const	*ipaddr;
+	uint32_t		hash;
+
+	if (inst->flow_da && (buflen > RADIUS_HEADER_LENGTH)) {
+		uint8_t const *attr, *end;
+
+		/*
+		 *	The master IO handler has already checked that
+		 *	the packet is well formed.
+		 */
+		attr = buffer + RADIUS_HEADER_LENGTH;
+		end = buffer + buflen;
+
+		while ((attr + 2) <= end) {
+			if (attr[1] < 2) break;
+			if ((attr + attr[1]) > end) break;
+
+			if (attr[0] == inst->flow_da->attr) {
+				hash = fr_hash(attr + 2, attr[1] - 2);
+				goto done;
+			}
+
+			attr += attr[1];
+		}
+	}
+
+	if (!track || !track->address) return 0;
+
+	ipaddr = &track->address->socket.inet.src_ipaddr;
+	hash = fr_hash(&ipaddr->addr, (ipaddr->af == AF_INET) ? sizeof(ipaddr->addr.v4) : sizeof(ipaddr->addr.v6));
+
+done:
+	return hash ? hash : 1;
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -610,6 +770,27 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 1024);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	FR_INTEGER_BOUND_CHECK("shards", inst->io.num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->io.num_shards, <=, 64);
+
+	/*
+	 *	Only top-level attributes can be found without
+	 *	decoding the packet.
+	 */
+	if (inst->flow_attribute) {
+		inst->flow_da = fr_dict_attr_by_name(NULL, fr_dict_root(dict_radius), inst->flow_attribute);
+		if (!inst->flow_da) {
+			cf_log_err(mctx->mi->conf, "Unknown attribute '%s' for 'flow_attribute'", inst->flow_attribute);
+			return -1;
+		}
+
+		if ((inst->flow_da->parent != fr_dict_root(dict_radius)) || (inst->flow_da->attr > UINT8_MAX)) {
+			cf_log_err(mctx->mi->conf, "'flow_attribute' must be a standard RADIUS attribute, not '%s'",
+				   inst->flow_attribute);
+			return -1;
+		}
+	}
+
 	/*
 	 *	Tell the master handler about the main protocol instance.
 	 */
@@ -693,5 +874,7 @@ fr_app_t proto_radius = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.flow_hash		= mod_flow_hash,
+	.predecode		= mod_predecode
 };
@@ -45,4 +45,9 @@ typedef struct {
 	fr_radius_require_ma_t		require_message_authenticator;			//!< Require Message-Authenticator in all requests.
 	fr_radius_limit_proxy_state_t	limit_proxy_state;		//!< Limit Proxy-State to packets containing
 									///< Message-Authenticator.
+
+	char const			*flow_attribute;		//!< Name of the attribute which identifies a flow.
+	fr_dict_attr_t const		*flow_da;			//!< Resolved version of flow_attribute.
+
+	bool				lazy_decode;			//!< Only decode attributes when they're looked for.
 } proto_radius_t;
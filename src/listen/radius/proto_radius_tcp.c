@@ -23,6 +23,7 @@
  * @copyright 2016 Alan DeKok (aland@deployingradius.com)
  */
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/radius/tcp.h>
 #include <freeradius-devel/util/trie.h>
@@ -40,6 +41,10 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	fr_event_list_t			*el;			//!< for the flush timer.
+	fr_event_timer_t const		*flush_ev;		//!< when the corked socket will be flushed.
+	bool				corked;			//!< whether replies are being held by the kernel.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_tcp_thread_t;
 
@@ -62,6 +67,10 @@ typedef struct {
 	bool				dynamic_clients;	//!< whether we have dynamic clients
 	bool				dedup_authenticator;	//!< dedup using the request authenticator
 
+	bool				coalesce_writes;	//!< Cork the socket so replies are sent in
+								///< as few segments as possible.
+	fr_time_delta_t			flush_delay;		//!< How long replies may be held.
+
 	fr_client_list_t			*clients;		//!< local clients
 
 	fr_trie_t			*trie;			//!< for parsed networks
@@ -91,6 +100,9 @@ static const conf_parser_t tcp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("dynamic_clients", proto_radius_tcp_t, dynamic_clients) } ,
 	{ FR_CONF_OFFSET("accept_conflicting_packets", proto_radius_tcp_t, dedup_authenticator) } ,
+
+	{ FR_CONF_OFFSET("coalesce_writes", proto_radius_tcp_t, coalesce_writes), .dflt = "no" } ,
+	{ FR_CONF_OFFSET("flush_delay", proto_radius_tcp_t, flush_delay), .dflt = "0" } ,
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_radius_tcp_t, max_packet_size), .dflt = "4096" } ,
@@ -236,9 +248,49 @@ have_packet:
 }
 
 
+/** Set or clear TCP_CORK (or TCP_NOPUSH)
+ *
+ */
+static int tcp_cork(proto_radius_tcp_thread_t *thread, bool cork)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+	int on = cork;
+
+#  ifdef TCP_CORK
+	if (setsockopt(thread->sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) < 0) return -1;
+#  else
+	if (setsockopt(thread->sockfd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on)) < 0) return -1;
+
+	/*
+	 *	Clearing TCP_NOPUSH doesn't send pending data on
+	 *	all platforms, a zero length write does.
+	 */
+	if (!cork) (void) write(thread->sockfd, "", 0);
+#  endif
+
+	thread->corked = cork;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/** Send all of the replies which were written since the socket was corked
+ *
+ */
+static void tcp_flush(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(uctx, proto_radius_tcp_thread_t);
+
+	if (thread->corked && (tcp_cork(thread, false) < 0)) {
+		ERROR("Failed uncorking socket %s: %s", thread->name, fr_syserror(errno));
+	}
+}
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, size_t written)
 {
+	proto_radius_tcp_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_tcp_t);
 	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_tcp_thread_t);
 	fr_io_track_t			*track = talloc_get_type_abort(packet_ctx, fr_io_track_t);
 	ssize_t				data_size;
@@ -270,6 +322,16 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	fr_assert(buffer_len >= 20);
 	fr_assert(written < buffer_len);
 
+	/*
+	 *	Hold replies in the kernel until all of the replies
+	 *	in this pass through the event loop have been
+	 *	written, so they're sent as full segments.
+	 */
+	if (inst->coalesce_writes && thread->el && !thread->corked && (tcp_cork(thread, true) == 0) &&
+	    (fr_event_timer_in(thread, thread->el, &thread->flush_ev, inst->flush_delay, tcp_flush, thread) < 0)) {
+		(void) tcp_cork(thread, false);
+	}
+
 	/*
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
@@ -317,6 +379,14 @@ static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 }
 
 
+static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, UNUSED void *nr)
+{
+	proto_radius_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_tcp_thread_t);
+
+	thread->el = el;
+}
+
+
 static void mod_network_get(int *ipproto, bool *dynamic_clients, fr_trie_t const **trie, void *instance)
 {
 	proto_radius_tcp_t *inst = talloc_get_type_abort(instance, proto_radius_tcp_t);
@@ -456,6 +526,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	/*
+	 *	Linux sends corked data after 200ms regardless.
+	 */
+	FR_TIME_DELTA_BOUND_CHECK("flush_delay", inst->flush_delay, <=, fr_time_delta_from_msec(200));
+
+#if !defined(TCP_CORK) && !defined(TCP_NOPUSH)
+	if (inst->coalesce_writes) {
+		cf_log_warn(conf, "'coalesce_writes' is not supported on this platform, and will be ignored");
+		inst->coalesce_writes = false;
+	}
+#endif
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -676,6 +758,7 @@ fr_app_io_t proto_radius_tcp = {
 	.fd_set			= mod_fd_set,
 	.track_compare		= mod_track_compare,
 	.connection_set		= mod_connection_set,
+	.event_list_set		= mod_event_list_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
 	.get_name		= mod_name,
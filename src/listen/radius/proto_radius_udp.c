@@ -41,6 +41,9 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	udp_batch_t			*batch;			//!< for reading multiple packets at once.
+	udp_send_batch_t		*send_batch;		//!< for writing multiple packets at once.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 
 } proto_radius_udp_thread_t;
@@ -60,6 +63,9 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 	uint32_t			send_buff;		//!< How big the kernel's send buffer should be.
 
+	uint32_t			recv_batch;		//!< How many packets to read with one system call.
+	uint32_t			send_batch;		//!< How many packets to write with one system call.
+
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
@@ -101,6 +107,9 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, 0, proto_radius_udp_t, recv_buff) },
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, 0, proto_radius_udp_t, send_buff) },
 
+	{ FR_CONF_OFFSET("recv_batch", proto_radius_udp_t, recv_batch), .dflt = "1" },
+	{ FR_CONF_OFFSET("send_batch", proto_radius_udp_t, send_batch), .dflt = "1" },
+
 	{ FR_CONF_OFFSET("accept_conflicting_packets", proto_radius_udp_t, dedup_authenticator) } ,
 	{ FR_CONF_OFFSET("dynamic_clients", proto_radius_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
@@ -138,7 +147,17 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch) {
+		data_size = udp_recv_batch(thread->batch, flags, &address->socket, buffer, buffer_len, recv_time_p);
+
+		/*
+		 *	The network side has to come back for the
+		 *	rest of the batch.
+		 */
+		li->read_pending = udp_batch_pending(thread->batch);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		PDEBUG2("proto_radius_udp got read error");
 		return data_size;
@@ -245,6 +264,11 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
+			if (thread->send_batch) {
+				if (udp_send_batch_add(thread->send_batch, &socket, flags, packet, track->reply_len) < 0) return -1;
+				return buffer_len;
+			}
+
 			return udp_send(&socket, flags, packet, track->reply_len);
 		}
 
@@ -256,6 +280,15 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 */
 	fr_assert(buffer_len >= 20);
 
+	/*
+	 *	Queue the reply.  It will be sent when the network
+	 *	side calls mod_flush().
+	 */
+	if (thread->send_batch) {
+		if (udp_send_batch_add(thread->send_batch, &socket, flags, buffer, buffer_len) < 0) return -1;
+		return buffer_len;
+	}
+
 	/*
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
@@ -279,6 +312,18 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+/** Send any replies queued by mod_write()
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	if (!thread->send_batch) return 0;
+
+	return udp_send_batch_flush(thread->send_batch);
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
@@ -361,6 +406,27 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Only the main socket gets enough packets to make
+	 *	batching worthwhile.  Connected sockets are for one
+	 *	client.
+	 */
+	if ((inst->recv_batch > 1) && !thread->connection) {
+		thread->batch = udp_batch_alloc(thread, sockfd, inst->recv_batch, inst->max_packet_size);
+		if (!thread->batch) {
+			PERROR("Failed allocating receive batch");
+			goto error;
+		}
+	}
+
+	if ((inst->send_batch > 1) && !thread->connection) {
+		thread->send_batch = udp_send_batch_alloc(thread, sockfd, inst->send_batch, inst->max_packet_size);
+		if (!thread->send_batch) {
+			PERROR("Failed allocating send batch");
+			goto error;
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_udp,
@@ -425,6 +491,30 @@ static int mod_track_compare(void const *instance, UNUSED void *thread_instance,
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_track_hash(void const *instance, UNUSED void *thread_instance, fr_client_t *client,
+			       void const *packet)
+{
+	uint32_t hash;
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	uint8_t const *a = packet;
+
+	/*
+	 *	Code and ID are always compared.
+	 */
+	hash = fr_hash(a, 2);
+
+	/*
+	 *	The authenticator is only compared when we're doing
+	 *	better dedup.
+	 */
+	if (inst->dedup_authenticator || client->dedup_authenticator) {
+		hash = fr_hash_update(a + 4, RADIUS_AUTH_VECTOR_LENGTH, hash);
+	}
+
+	return hash;
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -465,6 +555,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 1024);
+
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 1024);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -555,9 +651,11 @@ fr_app_io_t proto_radius_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
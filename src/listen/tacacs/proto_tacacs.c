@@ -323,7 +323,7 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 	size_t			secretlen = 0;
 
 	/*
-	 *	@todo - RFC 8907 Section 4.4. says:
+	 *	RFC 8907 Section 4.4. says:
 	 *
 	 *	  When the session is complete, the TCP connection should be handled as follows, according to
 	 *	  whether Single Connection Mode was negotiated:
@@ -339,6 +339,8 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 	 *	   accepted on the connection. If there are any sessions that have already been established,
 	 *	   then they MAY be completed. Once all active sessions are completed, then the connection
 	 *	   MUST be closed.
+	 *
+	 *	The transport tracks the sessions on each connection, and does that.
 	 */
 
 	/*
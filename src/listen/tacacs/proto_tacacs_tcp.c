@@ -43,6 +43,11 @@ typedef struct {
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
 	fr_stats_t			stats;			//!< statistics for this socket
+
+	fr_rb_tree_t			*sessions;		//!< Active sessions on this connection.
+	bool				negotiated;		//!< Whether we've seen the first packet.
+	bool				single_connect;		//!< Single connection mode is in use.
+	bool				draining;		//!< Close once the active sessions complete.
 } proto_tacacs_tcp_thread_t;
 
 typedef struct {
@@ -62,6 +67,7 @@ typedef struct {
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				single_connect;		//!< Allow clients to run many sessions on a connection.
 
 	fr_client_list_t		*clients;		//!< local clients
 
@@ -89,6 +95,7 @@ static const conf_parser_t tcp_listen_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, 0, proto_tacacs_tcp_t, recv_buff) },
 
 	{ FR_CONF_OFFSET("dynamic_clients", proto_tacacs_tcp_t, dynamic_clients) } ,
+	{ FR_CONF_OFFSET("single_connect", proto_tacacs_tcp_t, single_connect), .dflt = "yes" } ,
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_tacacs_tcp_t, max_packet_size), .dflt = "4096" } ,
@@ -103,6 +110,109 @@ static const char *packet_name[] = {
 	[FR_TAC_PLUS_ACCT] = "Accounting",
 };
 
+/** A session on a connection
+ *
+ *  In single connection mode (RFC 8907 Section 4.3), clients can run
+ *  many sessions on one connection at the same time.  Packets are
+ *  matched to sessions by their session_id.
+ */
+typedef struct {
+	fr_rb_node_t			node;			//!< Entry in the tree of sessions.
+	uint32_t			session_id;		//!< In network byte order, as it's only compared.
+	uint8_t				seq_no;			//!< Of the last packet received for the session.
+} proto_tacacs_tcp_session_t;
+
+static int8_t session_cmp(void const *one, void const *two)
+{
+	proto_tacacs_tcp_session_t const *a = one, *b = two;
+
+	return CMP(a->session_id, b->session_id);
+}
+
+/** Check a packet against the sessions on its connection
+ *
+ *  Single connection mode is negotiated by the first packet on the
+ *  connection.  After that, packets with seq_no 1 start new sessions,
+ *  and other packets must continue an active session.
+ *
+ * @return
+ *	- 1 to process the packet.
+ *	- 0 to discard the packet.
+ */
+static int session_check(proto_tacacs_tcp_t const *inst, proto_tacacs_tcp_thread_t *thread, uint8_t const *buffer)
+{
+	fr_tacacs_packet_hdr_t const	*hdr = (fr_tacacs_packet_hdr_t const *) buffer;
+	proto_tacacs_tcp_session_t	*session;
+
+	if (!thread->sessions) return 1;	/* not a connected socket */
+
+	if (!thread->negotiated) {
+		thread->negotiated = true;
+		thread->single_connect = inst->single_connect && ((hdr->flags & FR_TAC_PLUS_SINGLE_CONNECT_FLAG) != 0);
+		if (thread->single_connect) DEBUG2("proto_tacacs_tcp - Using single connection mode %s", thread->name);
+	}
+
+	session = fr_rb_find(thread->sessions, &(proto_tacacs_tcp_session_t){ .session_id = hdr->session_id });
+
+	if (hdr->seq_no == 1) {
+		if (session) {
+			DEBUG("proto_tacacs_tcp - Ignoring packet which starts session %08x, it's already active",
+			      ntohl(hdr->session_id));
+			return 0;
+		}
+
+		/*
+		 *	RFC 8907 Section 4.4.  After an error, new
+		 *	sessions MUST NOT be accepted on the connection.
+		 */
+		if (thread->draining) {
+			DEBUG("proto_tacacs_tcp - Ignoring new session %08x, connection is closing",
+			      ntohl(hdr->session_id));
+			return 0;
+		}
+
+		MEM(session = talloc_zero(thread->sessions, proto_tacacs_tcp_session_t));
+		session->session_id = hdr->session_id;
+		session->seq_no = hdr->seq_no;
+		fr_rb_insert(thread->sessions, session);
+		return 1;
+	}
+
+	if (!session) {
+		DEBUG("proto_tacacs_tcp - Ignoring packet seq_no %u for unknown session %08x",
+		      hdr->seq_no, ntohl(hdr->session_id));
+		return 0;
+	}
+
+	if (hdr->seq_no != (uint8_t) (session->seq_no + 2)) {
+		DEBUG("proto_tacacs_tcp - Ignoring packet for session %08x, expected seq_no %u, got %u",
+		      ntohl(hdr->session_id), (uint8_t) (session->seq_no + 2), hdr->seq_no);
+		return 0;
+	}
+
+	session->seq_no = hdr->seq_no;
+	return 1;
+}
+
+/** Get the status of a reply, decrypting it if necessary
+ *
+ */
+static int reply_status(proto_tacacs_tcp_thread_t *thread, uint8_t const *buffer, size_t buffer_len, uint8_t *status)
+{
+	fr_tacacs_packet_t const	*pkt = (fr_tacacs_packet_t const *) buffer;
+	fr_client_t const		*client;
+
+	if (buffer_len <= FR_HEADER_LENGTH) return -1;
+
+	*status = buffer[FR_HEADER_LENGTH];
+	if (!packet_is_encrypted(pkt)) return 0;
+
+	client = thread->connection ? thread->connection->radclient : NULL;
+	if (!client || !client->secret) return -1;
+
+	return fr_tacacs_body_xor(pkt, status, 1, client->secret, talloc_array_length(client->secret) - 1);
+}
+
 /** Read TACACS data from a TCP connection
  *
  * @param[in] li		representing a client connection.
@@ -126,10 +236,12 @@ static const char *packet_name[] = {
 static ssize_t mod_read(fr_listen_t *li, UNUSED void **packet_ctx, fr_time_t *recv_time_p,
 			uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
+	proto_tacacs_tcp_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_tacacs_tcp_t);
 	proto_tacacs_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_tacacs_tcp_thread_t);
 	ssize_t				data_size, packet_len;
 	size_t				in_buffer;
 
+retry:
 	/*
 	 *	We may have read multiple packets in the previous read.  In which case the buffer may already
 	 *	have packets remaining.  In that case, we can return packets directly from the buffer, and
@@ -226,6 +338,15 @@ have_packet:
 	 */
 	*leftover = in_buffer - packet_len;
 
+	/*
+	 *	Discard packets which don't belong to a session we
+	 *	can accept, and look for another one in the buffer.
+	 */
+	if (!session_check(inst, thread, buffer)) {
+		memmove(buffer, buffer + packet_len, *leftover);
+		goto retry;
+	}
+
 	*recv_time_p = fr_time();
 	thread->stats.total_requests++;
 
@@ -277,6 +398,17 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_tim
 	 */
 	if (written == 0) {
 		thread->stats.total_responses++;
+
+		/*
+		 *	The first reply tells the client whether we
+		 *	agree to single connection mode.  The flags
+		 *	aren't obfuscated, so they can be changed here.
+		 */
+		if (thread->single_connect) {
+			buffer[3] |= FR_TAC_PLUS_SINGLE_CONNECT_FLAG;
+		} else {
+			buffer[3] &= ~FR_TAC_PLUS_SINGLE_CONNECT_FLAG;
+		}
 	}
 
 	/*
@@ -287,30 +419,75 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, UNUSED fr_tim
 	if (data_size <= 0) return data_size;
 
 	/*
-	 *	If we're supposed to close the socket, then go do that.
+	 *	The reply has been sent.  See if it ends the session,
+	 *	and if we're supposed to close the socket.
 	 */
-	if ((data_size + written) == buffer_len) {
-		fr_tacacs_packet_t const *pkt = (fr_tacacs_packet_t const *) buffer;
+	if (((data_size + written) == buffer_len) && thread->sessions) {
+		fr_tacacs_packet_hdr_t const	*hdr = (fr_tacacs_packet_hdr_t const *) buffer;
+		proto_tacacs_tcp_session_t	*session;
+		uint8_t				status;
+		bool				error = false;
+
+		if (reply_status(thread, buffer, buffer_len, &status) < 0) {
+			DEBUG("Closing connection, unable to determine status of reply");
+			return 0;
+		}
 
-		switch (pkt->hdr.type) {
+		switch (hdr->type) {
 		case FR_TAC_PLUS_AUTHEN:
-			if (pkt->authen_reply.status == FR_TAC_PLUS_AUTHEN_STATUS_ERROR) goto close_it;
+			switch (status) {
+			case FR_TAC_PLUS_AUTHEN_STATUS_GETDATA:
+			case FR_TAC_PLUS_AUTHEN_STATUS_GETUSER:
+			case FR_TAC_PLUS_AUTHEN_STATUS_GETPASS:
+				goto done;	/* the session continues */
+
+			default:
+				error = (status == FR_TAC_PLUS_AUTHEN_STATUS_ERROR);
+				break;
+			}
 			break;
 
-
 		case FR_TAC_PLUS_AUTHOR:
-			if (pkt->author_reply.status == FR_TAC_PLUS_AUTHOR_STATUS_ERROR) {
-			close_it:
-				DEBUG("Closing connection due to unrecoverable server error response");
-				return 0;
-			}
+			error = (status == FR_TAC_PLUS_AUTHOR_STATUS_ERROR);
+			break;
+
+		case FR_TAC_PLUS_ACCT:
+			error = (status == FR_TAC_PLUS_ACCT_STATUS_ERROR);
 			break;
 
 		default:
 			break;
 		}
+
+		session = fr_rb_find(thread->sessions, &(proto_tacacs_tcp_session_t){ .session_id = hdr->session_id });
+		if (session) {
+			fr_rb_remove(thread->sessions, session);
+			talloc_free(session);
+		}
+
+		/*
+		 *	RFC 8907 Section 4.4.  Without single connection
+		 *	mode, the connection is closed when the session
+		 *	completes.  With it, an error stops new sessions
+		 *	being accepted, and the connection is closed once
+		 *	the active sessions complete.
+		 */
+		if (error) thread->draining = true;
+
+		if ((!thread->single_connect || thread->draining) && (fr_rb_num_elements(thread->sessions) == 0)) {
+			if (error) {
+				DEBUG("Closing connection due to unrecoverable server error response");
+			} else {
+				DEBUG2("proto_tacacs_tcp - Session complete, closing connection %s", thread->name);
+			}
+			return 0;
+		}
+
+		if (error) DEBUG("Not accepting new sessions after unrecoverable server error response");
 	}
 
+done:
+
 	/*
 	 *	Return the packet we wrote, plus any bytes previously
 	 *	left over from previous packets.
@@ -324,6 +501,8 @@ static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 
 	thread->connection = connection;
 
+	MEM(thread->sessions = fr_rb_inline_talloc_alloc(thread, proto_tacacs_tcp_session_t, node, session_cmp, NULL));
+
 	return 0;
 }
 
@@ -388,6 +388,16 @@ static int mod_track_compare(UNUSED void const *instance, UNUSED void *thread_in
 	return (a->opcode < b->opcode) - (a->opcode > b->opcode);
 }
 
+static uint32_t mod_track_hash(UNUSED void const *instance, UNUSED void *thread_instance, UNUSED fr_client_t *client,
+			       void const *packet)
+{
+	proto_vmps_track_t const *a = talloc_get_type_abort_const(packet, proto_vmps_track_t);
+	uint32_t hash;
+
+	hash = fr_hash(&a->transaction_id, sizeof(a->transaction_id));
+	return fr_hash_update(&a->opcode, sizeof(a->opcode), hash);
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	proto_vmps_udp_t	*inst = talloc_get_type_abort(mctx->mi->data, proto_vmps_udp_t);
@@ -521,6 +531,7 @@ fr_app_io_t proto_vmps_udp = {
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -29,6 +29,8 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/regex.h>
 #include <freeradius-devel/server/users_file.h>
 
 #include <sys/stat.h>
@@ -36,15 +38,56 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <fcntl.h>
 
+/** One comparison against an attribute
+ *
+ */
+typedef struct {
+	fr_token_t		op;		//!< comparison operator.
+	fr_pair_t		*vp;		//!< value to compare against, already of the attribute's type.
+#ifdef HAVE_REGEX
+	regex_t			*preg;		//!< pre-compiled regular expression, for '=~' and '!~'.
+#endif
+} attr_filter_rule_t;
+
+/** All of the rules in an entry for one attribute
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< the attribute the rules apply to.
+	attr_filter_rule_t	*rules;		//!< talloced array of rules.
+} attr_filter_attr_t;
+
+/** One entry from the "attrs" file
+ *
+ */
+typedef struct {
+	char const		*name;		//!< realm, or "DEFAULT".
+	int			lineno;		//!< where the entry was defined.
+	bool			fall_through;	//!< continue with the next matching entry.
+	int			relax_filter;	//!< -1 for "use the module configuration".
+	uint32_t		vsa_any;	//!< number of "Vendor-Specific =* ANY" rules.
+	fr_hash_table_t		*attrs;		//!< attr_filter_attr_t, indexed by attribute.
+} attr_filter_entry_t;
+
+/** The entries which apply to one key, in the order they appear in the file
+ *
+ */
+typedef struct {
+	char const		*name;		//!< of the realm.
+	attr_filter_entry_t	**entries;	//!< talloced array of matching entries.
+} attr_filter_realm_t;
+
 /*
  *	Define a structure with the module configuration, so it can
  *	be used as the instance handle.
  */
 typedef struct {
-	char const	*filename;
-	tmpl_t		*key;
-	bool		relaxed;
-	PAIR_LIST_LIST	attrs;
+	char const		*filename;
+	tmpl_t			*key;
+	bool			relaxed;
+
+	fr_hash_table_t		*realms;	//!< attr_filter_realm_t, indexed by name.
+	attr_filter_entry_t	**defaults;	//!< entries for keys which don't have a realm.
 } rlm_attr_filter_t;
 
 static const conf_parser_t module_config[] = {
@@ -80,13 +123,53 @@ fr_dict_attr_autoload_t rlm_attr_filter_dict_attr[] = {
 	{ NULL }
 };
 
-static void check_pair(request_t *request, fr_pair_t *check_item, fr_pair_t *reply_item, int *pass, int *fail)
+static void check_pair(request_t *request, attr_filter_rule_t const *rule, fr_pair_t *reply_item, int *pass, int *fail)
 {
 	int compare;
 
-	if (check_item->op == T_OP_SET) return;
+	switch (rule->op) {
+	case T_OP_CMP_TRUE:
+		compare = 1;
+		break;
+
+	case T_OP_CMP_FALSE:
+		compare = 0;
+		break;
+
+	case T_OP_REG_EQ:
+	case T_OP_REG_NE:
+#ifdef HAVE_REGEX
+	{
+		char	*value;
+		int	slen;
+
+		fr_pair_aprint(NULL, &value, NULL, reply_item);
+		if (!value) {
+			compare = -1;
+			break;
+		}
+
+		slen = regex_exec(rule->preg, value, talloc_array_length(value) - 1, NULL);
+		talloc_free(value);
+
+		if (slen < 0) {
+			compare = -1;
+		} else if (rule->op == T_OP_REG_EQ) {
+			compare = slen;
+		} else {
+			compare = !slen;
+		}
+	}
+#else
+		compare = -1;
+#endif
+		break;
+
+	default:
+		compare = fr_pair_cmp_op(rule->op, reply_item, rule->vp);
+		break;
+	}
 
-	compare = fr_pair_cmp(check_item, reply_item);
 	if (compare < 0) RPEDEBUG("Comparison failed");
 
 	if (compare == 1) {
@@ -95,11 +178,201 @@ static void check_pair(request_t *request, fr_pair_t *check_item, fr_pair_t *rep
 		++*(fail);
 	}
 
-	RDEBUG3("%pP %s %pP", reply_item, compare == 1 ? "allowed by" : "disallowed by", check_item);
+	if (rule->vp) {
+		RDEBUG3("%pP %s %pP", reply_item, compare == 1 ? "allowed by" : "disallowed by", rule->vp);
+	} else {
+		RDEBUG3("%pP %s %s rule", reply_item, compare == 1 ? "allowed by" : "disallowed by", fr_tokens[rule->op]);
+	}
 
 	return;
 }
 
+static uint32_t attr_filter_attr_hash(void const *data)
+{
+	attr_filter_attr_t const *attr = data;
+
+	return fr_hash(&attr->da, sizeof(attr->da));
+}
+
+static int8_t attr_filter_attr_cmp(void const *one, void const *two)
+{
+	attr_filter_attr_t const *a = one, *b = two;
+
+	return CMP(a->da, b->da);
+}
+
+static uint32_t attr_filter_realm_hash(void const *data)
+{
+	attr_filter_realm_t const *realm = data;
+
+	return fr_hash_string(realm->name);
+}
+
+static int8_t attr_filter_realm_cmp(void const *one, void const *two)
+{
+	attr_filter_realm_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->name, b->name);
+	return CMP(ret, 0);
+}
+
+/** Turn one entry of the "attrs" file into a table of typed rules, indexed by attribute
+ *
+ *  Values are cast to the type of the attribute, and regular
+ *  expressions are compiled, so that none of that is done per packet.
+ */
+static attr_filter_entry_t *attr_filter_compile(TALLOC_CTX *ctx, module_inst_ctx_t const *mctx, PAIR_LIST *pl)
+{
+	attr_filter_entry_t	*entry;
+	map_t			*map = NULL;
+
+	MEM(entry = talloc_zero(ctx, attr_filter_entry_t));
+	entry->name = talloc_strdup(entry, pl->name);
+	entry->lineno = pl->lineno;
+	entry->relax_filter = -1;
+	MEM(entry->attrs = fr_hash_table_alloc(entry, attr_filter_attr_hash, attr_filter_attr_cmp, NULL));
+
+	while ((map = map_list_next(&pl->reply, map))) {
+		fr_dict_attr_t const	*da = tmpl_attr_tail_da(map->lhs);
+		fr_value_box_t const	*value = tmpl_value(map->rhs);
+		attr_filter_attr_t	*attr;
+		attr_filter_rule_t	*rule;
+		size_t			num;
+
+		if (da == attr_fall_through) {
+			if (fr_value_box_is_truthy(value)) entry->fall_through = true;
+			continue;
+		}
+
+		if (da == attr_relax_filter) {
+			entry->relax_filter = fr_value_box_is_truthy(value);
+			continue;
+		}
+
+		/*
+		 *	Vendor-Specific is special, and matches any VSA if the comparison is always true.
+		 */
+		if ((da == attr_vendor_specific) && (map->op == T_OP_CMP_TRUE)) {
+			entry->vsa_any++;
+			continue;
+		}
+
+		attr = fr_hash_table_find(entry->attrs, &(attr_filter_attr_t){ .da = da });
+		if (!attr) {
+			MEM(attr = talloc_zero(entry, attr_filter_attr_t));
+			attr->da = da;
+			MEM(attr->rules = talloc_array(attr, attr_filter_rule_t, 0));
+			if (!fr_hash_table_insert(entry->attrs, attr)) {
+				PERROR("%s[%d] Failed inserting filter for %s", pl->filename, pl->lineno, da->name);
+				goto error;
+			}
+		}
+
+		num = talloc_array_length(attr->rules);
+		MEM(attr->rules = talloc_realloc(attr, attr->rules, attr_filter_rule_t, num + 1));
+		rule = &attr->rules[num];
+		*rule = (attr_filter_rule_t) {
+			.op = map->op,
+		};
+
+		switch (map->op) {
+		case T_OP_CMP_TRUE:
+		case T_OP_CMP_FALSE:
+			break;
+
+		case T_OP_REG_EQ:
+		case T_OP_REG_NE:
+#ifdef HAVE_REGEX
+		{
+			fr_value_box_t	pattern;
+			ssize_t		slen;
+
+			if (fr_value_box_cast(entry, &pattern, FR_TYPE_STRING, NULL, value) < 0) {
+				PERROR("%s[%d] Invalid regular expression for %s", pl->filename, pl->lineno, da->name);
+				goto error;
+			}
+
+			slen = regex_compile(entry, &rule->preg, pattern.vb_strvalue, pattern.vb_length,
+					     NULL, false, false);
+			fr_value_box_clear(&pattern);
+			if (slen <= 0) {
+				PERROR("%s[%d] Error at offset %zd compiling regular expression for %s",
+				       pl->filename, pl->lineno, -slen, da->name);
+				goto error;
+			}
+		}
+			break;
+#else
+			ERROR("%s[%d] Regular expressions are not supported", pl->filename, pl->lineno);
+			goto error;
+#endif
+
+		default:
+			MEM(rule->vp = fr_pair_afrom_da(entry, da));
+			rule->vp->op = map->op;
+			if (fr_value_box_cast(rule->vp, &rule->vp->data, da->type, da, value) < 0) {
+				PERROR("%s[%d] Invalid value for %s", pl->filename, pl->lineno, da->name);
+				goto error;
+			}
+			break;
+		}
+	}
+
+	return entry;
+
+error:
+	talloc_free(entry);
+	return NULL;
+}
+
+/** Build the per-realm tables
+ *
+ *  Each realm gets the list of entries which match it, i.e. its own
+ *  entries and the DEFAULT ones, in file order.  Keys which have no
+ *  entry of their own get only the DEFAULT ones.
+ */
+static int attr_filter_index(rlm_attr_filter_t *inst, attr_filter_entry_t **compiled)
+{
+	size_t i, j, num = talloc_array_length(compiled);
+
+	MEM(inst->realms = fr_hash_table_alloc(inst, attr_filter_realm_hash, attr_filter_realm_cmp, NULL));
+	MEM(inst->defaults = talloc_array(inst, attr_filter_entry_t *, 0));
+
+	for (i = 0; i < num; i++) {
+		attr_filter_realm_t	*realm;
+
+		if (strcmp(compiled[i]->name, "DEFAULT") == 0) {
+			size_t len = talloc_array_length(inst->defaults);
+
+			MEM(inst->defaults = talloc_realloc(inst, inst->defaults, attr_filter_entry_t *, len + 1));
+			inst->defaults[len] = compiled[i];
+			continue;
+		}
+
+		if (fr_hash_table_find(inst->realms, &(attr_filter_realm_t){ .name = compiled[i]->name })) continue;
+
+		MEM(realm = talloc_zero(inst->realms, attr_filter_realm_t));
+		realm->name = compiled[i]->name;
+		MEM(realm->entries = talloc_array(realm, attr_filter_entry_t *, 0));
+
+		for (j = 0; j < num; j++) {
+			size_t len;
+
+			if ((strcmp(compiled[j]->name, "DEFAULT") != 0) &&
+			    (strcmp(compiled[j]->name, realm->name) != 0)) continue;
+
+			len = talloc_array_length(realm->entries);
+			MEM(realm->entries = talloc_realloc(realm, realm->entries, attr_filter_entry_t *, len + 1));
+			realm->entries[len] = compiled[j];
+		}
+
+		if (!fr_hash_table_insert(inst->realms, realm)) return -1;
+	}
+
+	return 0;
+}
+
 static int attr_filter_getfile(TALLOC_CTX *ctx, module_inst_ctx_t const *mctx, char const *filename, PAIR_LIST_LIST *pair_list)
 {
 	int rcode;
@@ -168,17 +441,36 @@ static int attr_filter_getfile(TALLOC_CTX *ctx, module_inst_ctx_t const *mctx, c
  */
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
-	rlm_attr_filter_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_attr_filter_t);
-	int rcode;
-	pairlist_list_init(&inst->attrs);
-
-	rcode = attr_filter_getfile(inst, mctx, inst->filename, &inst->attrs);
+	rlm_attr_filter_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_attr_filter_t);
+	TALLOC_CTX		*tmp_ctx;
+	PAIR_LIST_LIST		attrs;
+	PAIR_LIST		*pl = NULL;
+	attr_filter_entry_t	**compiled;
+	size_t			i = 0;
+	int			rcode;
+
+	MEM(tmp_ctx = talloc_new(NULL));
+	pairlist_list_init(&attrs);
+
+	rcode = attr_filter_getfile(tmp_ctx, mctx, inst->filename, &attrs);
 	if (rcode != 0) {
+	error:
 		ERROR("Errors reading %s", inst->filename);
-
+		talloc_free(tmp_ctx);
 		return -1;
 	}
 
+	MEM(compiled = talloc_array(tmp_ctx, attr_filter_entry_t *, fr_dlist_num_elements(&attrs.head)));
+	while ((pl = fr_dlist_next(&attrs.head, pl))) {
+		compiled[i] = attr_filter_compile(inst, mctx, pl);
+		if (!compiled[i]) goto error;
+		i++;
+	}
+
+	if (attr_filter_index(inst, compiled) < 0) goto error;
+
+	talloc_free(tmp_ctx);
+
 	return 0;
 }
 
@@ -186,18 +478,19 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 /*
  *	Common attr_filter checks
  */
-static unlang_action_t CC_HINT(nonnull) attr_filter_common(TALLOC_CTX *ctx, rlm_rcode_t *p_result,
+static unlang_action_t CC_HINT(nonnull) attr_filter_common(rlm_rcode_t *p_result,
 							   module_ctx_t const *mctx, request_t *request,
 							   fr_pair_list_t *list)
 {
 	rlm_attr_filter_t const *inst = talloc_get_type_abort_const(mctx->mi->data, rlm_attr_filter_t);
-	fr_pair_list_t	output;
-	PAIR_LIST	*pl = NULL;
-	int		found = 0;
-	int		pass, fail = 0;
-	char const	*keyname = NULL;
-	char		buffer[256];
-	ssize_t		slen;
+	fr_pair_list_t		output;
+	attr_filter_realm_t	*realm;
+	attr_filter_entry_t	**entries;
+	size_t			i, num;
+	int			pass, fail = 0;
+	char const		*keyname = NULL;
+	char			buffer[256];
+	ssize_t			slen;
 
 	slen = tmpl_expand(&keyname, buffer, sizeof(buffer), request, inst->key, NULL, NULL);
 	if (slen < 0) {
@@ -209,108 +502,51 @@ static unlang_action_t CC_HINT(nonnull) attr_filter_common(TALLOC_CTX *ctx, rlm_
 	}
 
 	/*
-	 *	Head of the output list
+	 *      Find the attr_filter entries for the key.
 	 */
-	fr_pair_list_init(&output);
+	realm = fr_hash_table_find(inst->realms, &(attr_filter_realm_t){ .name = keyname });
+	entries = realm ? realm->entries : inst->defaults;
 
 	/*
-	 *      Find the attr_filter profile entry for the entry.
+	 *	No entry matched.  We didn't do anything.
 	 */
-	while ((pl = fr_dlist_next(&inst->attrs.head, pl))) {
-		int fall_through = 0;
-		int relax_filter = inst->relaxed;
-		map_t *map = NULL;
-		fr_pair_list_t tmp_list;
-		fr_pair_t *check_item, *input_item;
-		fr_pair_list_t check_list;
-
-		fr_pair_list_init(&tmp_list);
-		/*
-		 *  If the current entry is NOT a default,
-		 *  AND the realm does NOT match the current entry,
-		 *  then skip to the next entry.
-		 */
-		if ((strcmp(pl->name, "DEFAULT") != 0) &&
-		    (strcmp(keyname, pl->name) != 0))  {
-			continue;
-		}
-
-		RDEBUG2("Matched entry %s at line %d", pl->name, pl->lineno);
-		found = 1;
-
-		fr_pair_list_init(&check_list);
-
-		while ((map = map_list_next(&pl->reply, map))) {
-			if (map_to_vp(ctx, &tmp_list, request, map, NULL) < 0) {
-				RPWARN("Failed parsing map %s for check item, skipping it", map->lhs->name);
-				continue;
-			}
+	num = talloc_array_length(entries);
+	if (!num) RETURN_MODULE_NOOP;
 
-			check_item = fr_pair_list_head(&tmp_list);
-		     	if (check_item->da == attr_fall_through) {
-				if (check_item->vp_uint32 == 1) {
-					fall_through = 1;
-					fr_pair_list_free(&tmp_list);
-					continue;
-				}
-		     	} else if (check_item->da == attr_relax_filter) {
-				relax_filter = check_item->vp_bool;
-		     	}
-
-			/*
-			 *	Remove pair from temporary list ready to
-			 *	add to the correct destination
-			 */
-			fr_pair_remove(&tmp_list, check_item);
+	/*
+	 *	Head of the output list
+	 */
+	fr_pair_list_init(&output);
 
-			/*
-			 *    If it is a SET operator, add the attribute to
-			 *    the output list without checking it.
-			 */
-			if (check_item->op == T_OP_SET ) {
-				fr_pair_append(&output, check_item);
-				continue;
-			}
+	for (i = 0; i < num; i++) {
+		attr_filter_entry_t	*entry = entries[i];
+		bool			relax_filter = (entry->relax_filter < 0) ? inst->relaxed : entry->relax_filter;
+		fr_pair_t		*input_item;
 
-			/*
-			 *	Append the realized VP to the check list.
-			 */
-			fr_pair_append(&check_list, check_item);
-		}
+		RDEBUG2("Matched entry %s at line %d", entry->name, entry->lineno);
 
 		/*
 		 *	Iterate through the input items, comparing
-		 *	each item to every rule, then moving it to the
-		 *	output list only if it matches all rules
-		 *	for that attribute.  IE, Idle-Timeout is moved
-		 *	only if it matches all rules that describe an
+		 *	each item to the rules for its attribute, then
+		 *	moving it to the output list only if it matches
+		 *	all of them.  IE, Idle-Timeout is moved only if
+		 *	it matches all rules that describe an
 		 *	Idle-Timeout.
 		 */
 		for (input_item = fr_pair_list_head(list);
 		     input_item;
 		     input_item = fr_pair_list_next(list, input_item)) {
+			attr_filter_attr_t	*attr;
+
 			pass = fail = 0; /* reset the pass,fail vars for each reply item */
 
-			/*
-			 *  Reset the check_item pointer to beginning of the list
-			 */
-			for (check_item = fr_pair_list_head(&check_list);
-			     check_item;
-			     check_item = fr_pair_list_next(&check_list, check_item)) {
-				/*
-				 *  Vendor-Specific is special, and matches any VSA if the
-				 *  comparison is always true.
-				 */
-				if ((check_item->da == attr_vendor_specific) &&
-				    (fr_dict_vendor_num_by_da(input_item->da) != 0) &&
-				    (check_item->op == T_OP_CMP_TRUE)) {
-					pass++;
-					continue;
-				}
+			if (entry->vsa_any && (fr_dict_vendor_num_by_da(input_item->da) != 0)) pass += entry->vsa_any;
 
-				if (input_item->da == check_item->da) {
-					check_pair(request, check_item, input_item, &pass, &fail);
-				}
+			attr = fr_hash_table_find(entry->attrs, &(attr_filter_attr_t){ .da = input_item->da });
+			if (attr) {
+				size_t j, num_rules = talloc_array_length(attr->rules);
+
+				for (j = 0; j < num_rules; j++) check_pair(request, &attr->rules[j], input_item, &pass, &fail);
 			}
 
 			RDEBUG3("Attribute \"%s\" allowed by %i rules, disallowed by %i rules",
@@ -333,19 +569,11 @@ static unlang_action_t CC_HINT(nonnull) attr_filter_common(TALLOC_CTX *ctx, rlm_
 		}
 
 		/* If we shouldn't fall through, break */
-		if (!fall_through) {
+		if (!entry->fall_through) {
 			break;
 		}
 	}
 
-	/*
-	 *	No entry matched.  We didn't do anything.
-	 */
-	if (!found) {
-		fr_assert(fr_pair_list_empty(&output));
-		RETURN_MODULE_NOOP;
-	}
-
 	/*
 	 *	Replace the existing request list with our filtered one
 	 */
@@ -357,7 +585,7 @@ static unlang_action_t CC_HINT(nonnull) attr_filter_common(TALLOC_CTX *ctx, rlm_
 
 #define RLM_AF_FUNC(_x, _y) static unlang_action_t CC_HINT(nonnull) mod_##_x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 	{ \
-		return attr_filter_common(request->_y##_ctx, p_result, mctx, request, &request->_y##_pairs); \
+		return attr_filter_common(p_result, mctx, request, &request->_y##_pairs); \
 	}
 
 RLM_AF_FUNC(request, request)
@@ -371,6 +599,7 @@ module_rlm_t rlm_attr_filter = {
 	.common = {
 		.magic		= MODULE_MAGIC_INIT,
 		.name		= "attr_filter",
+		.flags		= MODULE_TYPE_HUP_SAFE,
 		.inst_size	= sizeof(rlm_attr_filter_t),
 		.config		= module_config,
 		.instantiate	= mod_instantiate,
@@ -27,11 +27,24 @@ RCSID("$Id$")
 #define LOG_PREFIX mctx->mi->name
 
 #include <talloc.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <brotli/encode.h>
 #include <brotli/decode.h>
 
+/*
+ *	Custom dictionaries were added in brotli 1.1.0
+ */
+#if defined(__has_include)
+#  if __has_include(<brotli/shared_dictionary.h>)
+#    include <brotli/shared_dictionary.h>
+#    define HAVE_BROTLI_SHARED_DICTIONARY 1
+#  endif
+#endif
+
 #include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/value.h>
 
 #include <freeradius-devel/server/module_rlm.h>
@@ -40,6 +53,8 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/xlat.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 
+#include "rlm_brotli.h"
+
 static int quality_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 static int window_bits_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 static int block_bits_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
@@ -57,9 +72,16 @@ typedef struct {
 } rlm_brotli_decompress_t;
 
 typedef struct {
+	rlm_brotli_codec_t		codec;			//!< Used by other modules.  Must be first.
 	rlm_brotli_compress_t		compress;		//!< Compression settings
 	rlm_brotli_decompress_t		decompress;		//!< Decompression settings
 	bool				large_window;		//!< non-standard "large", window size.
+
+	char const			*dictionary_file;	//!< File containing a custom dictionary.
+	uint8_t				*dictionary;		//!< Contents of dictionary_file.
+#ifdef HAVE_BROTLI_SHARED_DICTIONARY
+	BrotliEncoderPreparedDictionary	*prepared;		//!< dictionary, prepared once for all the encoders.
+#endif
 } rlm_brotli_t;
 
 static fr_table_num_sorted_t const brotli_mode[] = {
@@ -87,6 +109,7 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_SUBSECTION("compress", 0, rlm_brotli_t, compress, module_compress_config) },
 	{ FR_CONF_OFFSET_SUBSECTION("decompress", 0, rlm_brotli_t, decompress, module_decompress_config) },
 	{ FR_CONF_OFFSET("large_window", rlm_brotli_t, large_window), .dflt = "no" },	/* For both compress and decompress */
+	{ FR_CONF_OFFSET_FLAGS("dictionary", CONF_FLAG_FILE_INPUT, rlm_brotli_t, dictionary_file) },	/* For both compress and decompress */
 
 	CONF_PARSER_TERMINATOR
 };
@@ -168,6 +191,206 @@ static int block_bits_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM
 	return 0;
 }
 
+/** Allocate an encoder with the instance's settings
+ *
+ * @param[in] inst	of rlm_brotli.
+ * @param[in] pool	to allocate the encoder's memory in.
+ * @param[in] size_hint	total amount of data to be compressed.
+ * @return
+ *	- A new encoder.
+ *	- NULL if the dictionary couldn't be attached.
+ */
+static BrotliEncoderState *brotli_encoder_alloc(rlm_brotli_t const *inst, TALLOC_CTX *pool, size_t size_hint)
+{
+	BrotliEncoderState		*state;
+
+	MEM(state = BrotliEncoderCreateInstance(brotli_talloc_alloc, brotli_talloc_free, pool));
+
+	BrotliEncoderSetParameter(state, BROTLI_PARAM_MODE, inst->compress.mode);
+	BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, inst->compress.quality);
+	BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, inst->compress.window_bits);
+	if (inst->compress.block_bits_is_set) BrotliEncoderSetParameter(state, BROTLI_PARAM_LGBLOCK, inst->compress.block_bits);
+	BrotliEncoderSetParameter(state, BROTLI_PARAM_LARGE_WINDOW, inst->large_window ? BROTLI_TRUE : BROTLI_FALSE);
+	BrotliEncoderSetParameter(state, BROTLI_PARAM_SIZE_HINT, size_hint);
+
+#ifdef HAVE_BROTLI_SHARED_DICTIONARY
+	if (inst->prepared && (BrotliEncoderAttachPreparedDictionary(state, inst->prepared) == BROTLI_FALSE)) {
+		fr_strerror_const("Failed attaching dictionary to encoder");
+		BrotliEncoderDestroyInstance(state);
+		return NULL;
+	}
+#endif
+
+	return state;
+}
+
+/** Allocate a decoder with the instance's settings
+ *
+ * @param[in] inst	of rlm_brotli.
+ * @param[in] pool	to allocate the decoder's memory in.
+ * @return
+ *	- A new decoder.
+ *	- NULL if the dictionary couldn't be attached.
+ */
+static BrotliDecoderState *brotli_decoder_alloc(rlm_brotli_t const *inst, TALLOC_CTX *pool)
+{
+	BrotliDecoderState		*state;
+
+	MEM(state = BrotliDecoderCreateInstance(brotli_talloc_alloc, brotli_talloc_free, pool));
+
+	BrotliDecoderSetParameter(state, BROTLI_DECODER_PARAM_LARGE_WINDOW, inst->large_window ? BROTLI_TRUE : BROTLI_FALSE);
+
+#ifdef HAVE_BROTLI_SHARED_DICTIONARY
+	if (inst->dictionary &&
+	    (BrotliDecoderAttachDictionary(state, BROTLI_SHARED_DICTIONARY_RAW,
+					   talloc_array_length(inst->dictionary), inst->dictionary) == BROTLI_FALSE)) {
+		fr_strerror_const("Failed attaching dictionary to decoder");
+		BrotliDecoderDestroyInstance(state);
+		return NULL;
+	}
+#endif
+
+	return state;
+}
+
+/** Compress a buffer
+ *
+ * @copydetails rlm_brotli_codec_func_t
+ */
+static ssize_t brotli_codec_compress(TALLOC_CTX *ctx, uint8_t **out, rlm_brotli_codec_t const *codec,
+				     uint8_t const *in, size_t inlen)
+{
+	rlm_brotli_t const		*inst = (rlm_brotli_t const *)codec;
+	BrotliEncoderState		*state;
+	TALLOC_CTX			*pool;
+
+	size_t				available_out, total_out = 0;
+	uint8_t				*buff, *next_out;
+	ssize_t				slen = -1;
+
+	/*
+	 *	The whole of the output fits in a buffer of this
+	 *	size, so one call to the encoder is enough.
+	 */
+	available_out = BrotliEncoderMaxCompressedSize(inlen);
+	if (available_out == 0) {
+		fr_strerror_printf("Input of %zu bytes is too large to compress", inlen);
+		return -1;
+	}
+
+	pool = brotli_pool_get();
+	state = brotli_encoder_alloc(inst, pool, inlen);
+	if (!state) goto finish;
+
+	MEM(buff = talloc_array(ctx, uint8_t, available_out));
+	next_out = buff;
+
+	if ((BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH,
+					 &inlen, &in, &available_out, &next_out, &total_out) == BROTLI_FALSE) ||
+	    (BrotliEncoderIsFinished(state) == BROTLI_FALSE)) {
+		fr_strerror_const("Compressing data failed");
+		talloc_free(buff);
+		goto finish;
+	}
+
+	MEM(*out = talloc_realloc(ctx, buff, uint8_t, total_out));
+	slen = total_out;
+
+finish:
+	if (state) BrotliEncoderDestroyInstance(state);
+	talloc_free_children(pool);
+
+	return slen;
+}
+
+/** Decompress a buffer
+ *
+ * @copydetails rlm_brotli_codec_func_t
+ */
+static ssize_t brotli_codec_decompress(TALLOC_CTX *ctx, uint8_t **out, rlm_brotli_codec_t const *codec,
+				       uint8_t const *in, size_t inlen)
+{
+	rlm_brotli_t const		*inst = (rlm_brotli_t const *)codec;
+	BrotliDecoderState		*state;
+	TALLOC_CTX			*pool;
+
+	size_t				buff_len, available_out, total_out = 0;
+	uint8_t				*buff, *next_out;
+	ssize_t				slen = -1;
+
+	pool = brotli_pool_get();
+	state = brotli_decoder_alloc(inst, pool);
+	if (!state) goto finish;
+
+	buff_len = available_out = (inlen > 32) ? inlen * 2 : 64;
+	if (buff_len > inst->decompress.max_size) buff_len = available_out = inst->decompress.max_size;
+
+	MEM(buff = talloc_array(ctx, uint8_t, buff_len));
+	next_out = buff;
+
+	for (;;) {
+		switch (BrotliDecoderDecompressStream(state, &inlen, &in, &available_out, &next_out, &total_out)) {
+		default:
+		case BROTLI_DECODER_RESULT_ERROR:
+			fr_strerror_printf("Decompressing brotli data failed - %s",
+					   BrotliDecoderErrorString(BrotliDecoderGetErrorCode(state)));
+		error:
+			talloc_free(buff);
+			goto finish;
+
+		case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+			fr_strerror_const("Incomplete or truncated brotli data");
+			goto error;
+
+		case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+		{
+			size_t extra = buff_len;
+
+			/*
+			 *	Stop runaway brotli decodings...
+			 */
+			if (buff_len >= inst->decompress.max_size) {
+				fr_strerror_printf("Decompressed data exceeds maximum size of %zu",
+						   inst->decompress.max_size);
+				goto error;
+			}
+			if ((buff_len + extra) > inst->decompress.max_size) extra = inst->decompress.max_size - buff_len;
+
+			MEM(buff = talloc_realloc(ctx, buff, uint8_t, buff_len + extra));
+			buff_len += extra;
+			available_out += extra;
+			next_out = buff + total_out;
+		}
+			continue;	/* Again! */
+
+		case BROTLI_DECODER_RESULT_SUCCESS:
+			break;
+		}
+		break;
+	}
+
+	if (inlen > 0) {
+		fr_strerror_printf("Found %zu bytes of trailing garbage after brotli data", inlen);
+		talloc_free(buff);
+		goto finish;
+	}
+
+	if (total_out == 0) {
+		talloc_free(buff);
+		MEM(buff = talloc_array(ctx, uint8_t, 0));
+	} else {
+		MEM(buff = talloc_realloc(ctx, buff, uint8_t, total_out));
+	}
+	*out = buff;
+	slen = total_out;
+
+finish:
+	if (state) BrotliDecoderDestroyInstance(state);
+	talloc_free_children(pool);
+
+	return slen;
+}
+
 static xlat_arg_parser_t const brotli_xlat_compress_args[] = {
 	{ .required = true, .type = FR_TYPE_OCTETS },			/* Input converted to raw binary data.  All inputs will be added to the same stream */
 	XLAT_ARG_PARSER_TERMINATOR
@@ -211,18 +434,17 @@ static xlat_action_t brotli_xlat_compress(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		available_out += BrotliEncoderMaxCompressedSize(vb->vb_length);
 	}
 
+	pool = brotli_pool_get();
+	state = brotli_encoder_alloc(inst, pool, total_in);
+	if (!state) {
+		RPERROR("Failed creating encoder");
+		talloc_free_children(pool);
+		return XLAT_ACTION_FAIL;
+	}
+
 	MEM(out_vb = fr_value_box_alloc(ctx, FR_TYPE_OCTETS, NULL));
 	MEM(fr_value_box_mem_alloc(out_vb, &out_buff, out_vb, NULL, available_out, false) == 0);
 
-	pool = brotli_pool_get();
-	MEM(state = BrotliEncoderCreateInstance(brotli_talloc_alloc, brotli_talloc_free, pool));
-
-	BrotliEncoderSetParameter(state, BROTLI_PARAM_MODE, inst->compress.mode);
-	BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, inst->compress.quality);
-	BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, inst->compress.window_bits);
-	if (inst->compress.block_bits_is_set) BrotliEncoderSetParameter(state, BROTLI_PARAM_LGBLOCK, inst->compress.block_bits);
-	BrotliEncoderSetParameter(state, BROTLI_PARAM_LARGE_WINDOW, inst->large_window ? BROTLI_TRUE : BROTLI_FALSE);
-	BrotliEncoderSetParameter(state, BROTLI_PARAM_SIZE_HINT, total_in);
 	/*
 	 *	Loop over all the input data and ingest it into brotli
 	 *	which will add it to an internal buffer (hopefully
@@ -250,6 +472,7 @@ static xlat_action_t brotli_xlat_compress(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				if (bret == BROTLI_FALSE) {
 					fr_assert_msg(0, "BrotliEncoderCompressStream returned false, this shouldn't happen");
 					RERROR("BrotliEncoderCompressStream failed");
+					talloc_free(out_vb);
 					ret = XLAT_ACTION_FAIL;
 					goto finish;
 				}
@@ -297,91 +520,113 @@ static xlat_action_t brotli_xlat_decompress(TALLOC_CTX *ctx, fr_dcursor_t *out,
 {
 	rlm_brotli_t const		*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_brotli_t);
 	fr_value_box_t const		*data_vb;
+	fr_value_box_t			*out_vb;
+	uint8_t				*out_buff;
 
-	BrotliDecoderState		*state;
-	TALLOC_CTX			*pool;
+	XLAT_ARGS(args, &data_vb);
 
-	fr_value_box_t			*out_vb;
+	MEM(out_vb = fr_value_box_alloc(ctx, FR_TYPE_OCTETS, NULL));
 
-	size_t				total_in;
-	size_t				available_out;
-	size_t				total_out = 0;
+	if (brotli_codec_decompress(out_vb, &out_buff, &inst->codec, data_vb->vb_octets, data_vb->vb_length) < 0) {
+		RPEDEBUG("Decompressing failed");
+		talloc_free(out_vb);
+		return XLAT_ACTION_FAIL;
+	}
+	fr_value_box_memdup_buffer_shallow(NULL, out_vb, NULL, out_buff, false);
 
-	uint8_t	const			*in_buff;
-	uint8_t				*out_buff;
+	fr_dcursor_insert(out, out_vb);
 
-	xlat_action_t			ret = XLAT_ACTION_DONE;
+	return XLAT_ACTION_DONE;
+}
 
-	XLAT_ARGS(args, &data_vb);
+/** Read the whole of the dictionary file
+ *
+ */
+static int brotli_dictionary_load(rlm_brotli_t *inst, CONF_SECTION *conf)
+{
+	int		fd;
+	struct stat	buf;
+	ssize_t		len;
 
-	pool = brotli_pool_get();
-	MEM(state = BrotliDecoderCreateInstance(brotli_talloc_alloc, brotli_talloc_free, pool));
+	fd = open(inst->dictionary_file, O_RDONLY);
+	if (fd < 0) {
+		cf_log_err(conf, "Failed opening dictionary \"%s\": %s", inst->dictionary_file, fr_syserror(errno));
+		return -1;
+	}
 
-	MEM(out_vb = fr_value_box_alloc(ctx, FR_TYPE_OCTETS, NULL));
-	total_in = data_vb->vb_length;
-	in_buff = data_vb->vb_octets;
-	available_out = (data_vb->vb_length * 2);
+	if (fstat(fd, &buf) < 0) {
+		cf_log_err(conf, "Failed reading dictionary \"%s\": %s", inst->dictionary_file, fr_syserror(errno));
+	error:
+		close(fd);
+		return -1;
+	}
 
-	MEM(fr_value_box_mem_alloc(out_vb, &out_buff, out_vb, NULL, available_out, false) == 0);
-	pool = brotli_pool_get();
-	MEM(state = BrotliDecoderCreateInstance(brotli_talloc_alloc, brotli_talloc_free, pool));
+	if (buf.st_size == 0) {
+		cf_log_err(conf, "Dictionary \"%s\" is empty", inst->dictionary_file);
+		goto error;
+	}
 
-	BrotliDecoderSetParameter(state, BROTLI_DECODER_PARAM_LARGE_WINDOW, inst->large_window ? BROTLI_TRUE : BROTLI_FALSE);
+	MEM(inst->dictionary = talloc_array(inst, uint8_t, buf.st_size));
+	len = read(fd, inst->dictionary, buf.st_size);
+	if (len != buf.st_size) {
+		cf_log_err(conf, "Failed reading dictionary \"%s\": %s", inst->dictionary_file,
+			   (len < 0) ? fr_syserror(errno) : "Short read");
+		goto error;
+	}
+	close(fd);
 
-	for (;;) {
-		switch (BrotliDecoderDecompressStream(state, &total_in, &in_buff, &available_out, &out_buff, &total_out)) {
-		default:
-		case BROTLI_DECODER_RESULT_ERROR:
-		{
-			BrotliDecoderErrorCode error = BrotliDecoderGetErrorCode(state);
-			REDEBUG("Decompressing brotli data failed - %s", BrotliDecoderErrorString(error));
-			ret = XLAT_ACTION_FAIL;
-			goto finish;
-		}
+	return 0;
+}
 
-		case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
-			REDEBUG("Incomplete or truncated brotli data provided.  Decompressor wants more input...");
-			ret = XLAT_ACTION_FAIL;
-			goto finish;
+#ifdef HAVE_BROTLI_SHARED_DICTIONARY
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_brotli_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_brotli_t);
 
-		case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
-		{
-			size_t extra = out_vb->vb_length;
+	if (inst->prepared) BrotliEncoderDestroyPreparedDictionary(inst->prepared);
 
-			/*
-			 *	Stop runaway brotli decodings...
-			 */
-			if ((out_vb->vb_length + extra) > inst->decompress.max_size) {
-				RERROR("Decompressed data exceeds maximum size of %zu", inst->decompress.max_size);
-				ret = XLAT_ACTION_FAIL;
-				goto finish;
-			}
+	return 0;
+}
+#endif
 
-			MEM(fr_value_box_mem_realloc(out_vb, &out_buff, out_vb, out_vb->vb_length + extra) == 0);
-			available_out += extra;
-		}
-			continue;	/* Again! */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_brotli_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_brotli_t);
+	CONF_SECTION	*conf = mctx->mi->conf;
 
-		case BROTLI_DECODER_RESULT_SUCCESS:
-			if (BrotliDecoderIsFinished(state) == BROTLI_TRUE) {
-				MEM(fr_value_box_mem_realloc(out_vb, &out_buff, out_vb, total_out) == 0);
-				fr_dcursor_insert(out, out_vb);
-				goto finish;
-			}
-			continue;	/* Again! */
-		}
-	}
+	if (!inst->dictionary_file) return 0;
 
-finish:
-	BrotliDecoderDestroyInstance(state);
-	talloc_free_children(pool);
+#ifndef HAVE_BROTLI_SHARED_DICTIONARY
+	cf_log_err(conf, "'dictionary' requires brotli >= 1.1.0");
+	return -1;
+#else
+	if (brotli_dictionary_load(inst, conf) < 0) return -1;
 
-	return ret;
+	/*
+	 *	Preparing the dictionary is expensive, so do it once
+	 *	here, instead of every time an encoder is created.
+	 */
+	inst->prepared = BrotliEncoderPrepareDictionary(BROTLI_SHARED_DICTIONARY_RAW,
+							talloc_array_length(inst->dictionary), inst->dictionary,
+							inst->compress.quality, NULL, NULL, NULL);
+	if (!inst->prepared) {
+		cf_log_err(conf, "Failed preparing dictionary \"%s\"", inst->dictionary_file);
+		return -1;
+	}
+
+	return 0;
+#endif
 }
 
 static int mod_bootstrap(module_inst_ctx_t const *mctx)
 {
-	xlat_t	*xlat;
+	rlm_brotli_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_brotli_t);
+	xlat_t		*xlat;
+
+	inst->codec = (rlm_brotli_codec_t){
+		.compress = brotli_codec_compress,
+		.decompress = brotli_codec_decompress
+	};
 
 	if (unlikely((xlat = module_rlm_xlat_register(mctx->mi->boot, mctx, "compress", brotli_xlat_compress,
 						       FR_TYPE_OCTETS)) == NULL)) return -1;
@@ -410,6 +655,10 @@ module_rlm_t rlm_brotli = {
 		.name			= "brotli",
 		.inst_size		= sizeof(rlm_brotli_t),
 		.bootstrap		= mod_bootstrap,
+		.instantiate		= mod_instantiate,
+#ifdef HAVE_BROTLI_SHARED_DICTIONARY
+		.detach			= mod_detach,
+#endif
 		.config			= module_config
 	}
 };
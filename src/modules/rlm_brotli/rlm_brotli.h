@@ -0,0 +1,58 @@
+#pragma once
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_brotli.h
+ * @brief Brotli compression for other modules.
+ *
+ * Other modules find an rlm_brotli instance with #module_rlm_static_by_name,
+ * check its data is an "rlm_brotli_t", and call the functions in the
+ * #rlm_brotli_codec_t at the start of it.  The instance's compression
+ * settings, and dictionary, are used for every call.
+ *
+ * This header doesn't need the brotli headers, so modules using it don't
+ * need to link against libbrotli.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(rlm_brotli_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+
+typedef struct rlm_brotli_codec_s rlm_brotli_codec_t;
+
+/** Compress or decompress a buffer
+ *
+ * @param[in] ctx	to allocate the output buffer in.
+ * @param[out] out	Where to write a pointer to the output buffer.
+ *			The buffer is exactly as long as the output.
+ * @param[in] codec	of the rlm_brotli instance.
+ * @param[in] in	data to compress or decompress.
+ * @param[in] inlen	Length of in.
+ * @return
+ *	- >= 0 the length of the output.
+ *	- < 0 on error, with an error in fr_strerror.
+ */
+typedef ssize_t (*rlm_brotli_codec_func_t)(TALLOC_CTX *ctx, uint8_t **out, rlm_brotli_codec_t const *codec,
+					   uint8_t const *in, size_t inlen);
+
+struct rlm_brotli_codec_s {
+	rlm_brotli_codec_func_t		compress;		//!< Compress a complete buffer.
+	rlm_brotli_codec_func_t		decompress;		//!< Decompress a complete buffer, no larger
+								///< than decompress.max_size.
+};
@@ -40,11 +40,27 @@ typedef struct {
 
 typedef struct {
 	char const 		*options;	//!< Connection options
+	cache_serialize_format_t format;	//!< How entries are serialized.
+	char const		*compress;	//!< Name of the rlm_brotli instance to compress entries with.
+	rlm_brotli_codec_t const *codec;	//!< of the compress instance.
+
+	fr_time_delta_t		io_timeout;	//!< Maximum time to wait for a server to respond.
+	uint32_t		failure_limit;	//!< Consecutive failures before a server is ejected.
+	fr_time_delta_t		retry_delay;	//!< How long an ejected server is left alone.
+
 	fr_pool_t	*pool;
 } rlm_cache_memcached_t;
 
 static const conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET("options", rlm_cache_memcached_t, options), .dflt = "--SERVER=localhost" },
+	{ FR_CONF_OFFSET("format", rlm_cache_memcached_t, format),
+	  .func = cf_table_parse_int,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = cache_serialize_format_table, .len = &cache_serialize_format_table_len },
+	  .dflt = "text" },
+	{ FR_CONF_OFFSET("compress", rlm_cache_memcached_t, compress) },
+	{ FR_CONF_OFFSET("io_timeout", rlm_cache_memcached_t, io_timeout), .dflt = "0.5" },
+	{ FR_CONF_OFFSET("failure_limit", rlm_cache_memcached_t, failure_limit), .dflt = "2" },
+	{ FR_CONF_OFFSET("retry_delay", rlm_cache_memcached_t, retry_delay), .dflt = "2" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -69,6 +85,30 @@ static void *mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t ti
 
 	memcached_st			*sandle;
 	memcached_return_t		ret;
+	size_t				i;
+
+	/*
+	 *	The cache API is synchronous, so every call the
+	 *	driver makes blocks the worker until the server
+	 *	responds.  Use non-blocking sockets, so that time is
+	 *	bounded by io_timeout, and eject servers which keep
+	 *	failing, so that a single dead or overloaded node
+	 *	doesn't stall every request which hashes onto it.
+	 */
+	struct {
+		memcached_behavior_t	behavior;
+		uint64_t		value;
+	} const behaviors[] = {
+		{ MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, fr_time_delta_to_msec(timeout) },
+		{ MEMCACHED_BEHAVIOR_NO_BLOCK, 1 },
+		{ MEMCACHED_BEHAVIOR_TCP_NODELAY, 1 },
+		{ MEMCACHED_BEHAVIOR_POLL_TIMEOUT, fr_time_delta_to_msec(driver->io_timeout) },
+		{ MEMCACHED_BEHAVIOR_SND_TIMEOUT, fr_time_delta_to_usec(driver->io_timeout) },
+		{ MEMCACHED_BEHAVIOR_RCV_TIMEOUT, fr_time_delta_to_usec(driver->io_timeout) },
+		{ MEMCACHED_BEHAVIOR_SERVER_FAILURE_LIMIT, driver->failure_limit },
+		{ MEMCACHED_BEHAVIOR_REMOVE_FAILED_SERVERS, driver->failure_limit > 0 },
+		{ MEMCACHED_BEHAVIOR_RETRY_TIMEOUT, fr_time_delta_to_sec(driver->retry_delay) }
+	};
 
 	sandle = memcached(driver->options, talloc_array_length(driver->options) -1);
 	if (!sandle) {
@@ -77,12 +117,14 @@ static void *mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t ti
 		return NULL;
 	}
 
-	ret = memcached_behavior_set(sandle, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, fr_time_delta_to_msec(timeout));
-	if (ret != MEMCACHED_SUCCESS) {
-		ERROR("%s: %s", memcached_strerror(sandle, ret), memcached_last_error_message(sandle));
-	error:
-		memcached_free(sandle);
-		return NULL;
+	for (i = 0; i < NUM_ELEMENTS(behaviors); i++) {
+		ret = memcached_behavior_set(sandle, behaviors[i].behavior, behaviors[i].value);
+		if (ret != MEMCACHED_SUCCESS) {
+			ERROR("%s: %s", memcached_strerror(sandle, ret), memcached_last_error_message(sandle));
+		error:
+			memcached_free(sandle);
+			return NULL;
+		}
 	}
 
 	ret = memcached_version(sandle);
@@ -124,6 +166,19 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (!fr_time_delta_ispos(driver->io_timeout)) {
+		cf_log_err(conf, "'io_timeout' must be greater than zero");
+		return -1;
+	}
+
+	if (driver->compress) {
+		if (driver->format != CACHE_SERIALIZE_BINARY) {
+			cf_log_err(conf, "'compress' requires 'format = binary'");
+			return -1;
+		}
+		if (cache_codec_find(&driver->codec, conf, driver->compress) < 0) return -1;
+	}
+
 	driver->pool = module_rlm_connection_pool_init(conf, driver, mod_conn_create, NULL,
 						   buffer, "modules.rlm_cache.pool", NULL);
 	if (!driver->pool) return -1;
@@ -157,9 +212,10 @@ static void cache_entry_free(rlm_cache_entry_t *c)
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
-				       UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
 				       request_t *request, void *handle, fr_value_box_t const *key)
 {
+	rlm_cache_memcached_t *driver = instance;
 	rlm_cache_memcached_handle_t *mandle = handle;
 
 	memcached_return_t	mret;
@@ -181,10 +237,15 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
+	if ((len > 0) && (from_store[0] != CACHE_SERIALIZE_BINARY_MAGIC) &&
+	    (from_store[0] != CACHE_SERIALIZE_COMPRESSED_MAGIC)) RDEBUG2("%s", from_store);
 
 	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
-	ret = cache_deserialize(c, request->dict, from_store, len);
+	if (driver->codec && (len > 0) && (from_store[0] == CACHE_SERIALIZE_COMPRESSED_MAGIC)) {
+		ret = cache_deserialize_compressed(c, request->dict, (uint8_t const *)from_store, len, driver->codec);
+	} else {
+		ret = cache_deserialize(c, request->dict, from_store, len);
+	}
 	free(from_store);
 	if (ret < 0) {
 		RPERROR("Invalid entry");
@@ -206,28 +267,45 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
 					 request_t *request, void *handle, const rlm_cache_entry_t *c)
 {
+	rlm_cache_memcached_t *driver = instance;
 	rlm_cache_memcached_handle_t *mandle = handle;
 
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
 	char *to_store;
+	size_t to_store_len;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
-		talloc_free(pool);
-
-		return CACHE_ERROR;
+	if (driver->format == CACHE_SERIALIZE_BINARY) {
+		ssize_t slen;
+
+		if (driver->codec) {
+			slen = cache_serialize_compressed(pool, (uint8_t **)&to_store, c, driver->codec);
+		} else {
+			slen = cache_serialize_binary(pool, (uint8_t **)&to_store, c);
+		}
+		if (slen < 0) {
+		error:
+			RPERROR("Failed serializing entry");
+			talloc_free(pool);
+
+			return CACHE_ERROR;
+		}
+		to_store_len = slen;
+	} else {
+		if (cache_serialize(pool, &to_store, c) < 0) goto error;
+		to_store_len = to_store ? talloc_array_length(to_store) - 1 : 0;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key.vb_strvalue, c->key.vb_length,
 		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, fr_unix_time_to_sec(c->expires), 0);
+		            to_store_len, fr_unix_time_to_sec(c->expires), 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
@@ -22,19 +22,32 @@
  * @copyright 2014 The FreeRADIUS server project
  */
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/dbuff.h>
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/nbo.h>
 #include <freeradius-devel/util/value.h>
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+#include <sys/mman.h>
 
 typedef struct {
 	fr_rb_tree_t			*cache;		//!< Tree for looking up cache keys.
 	fr_heap_t			*heap;		//!< For managing entry expiry.
 
+	bool				snapshot_loaded;	//!< Whether we've tried to load the snapshot.
+	fr_time_t			snapshot_last;	//!< When we last wrote the snapshot.
+
 	pthread_mutex_t			mutex;		//!< Protect the tree from multiple readers/writers.
 } rlm_cache_rbtree_mutable_t;
 
 typedef struct {
+	char const			*snapshot;	//!< File to save entries to, and restore them from.
+	fr_time_delta_t			snapshot_interval;	//!< How often to save entries.
+	size_t				max_memory;	//!< Soft limit on the memory used by entries.
+
+	talloc_account_t		*account;	//!< Memory used by entries.
 	rlm_cache_rbtree_mutable_t	*mutable;	//!< Mutable instance data.
 } rlm_cache_rbtree_t;
 
@@ -43,8 +56,22 @@ typedef struct {
 
 	fr_rb_node_t			node;		//!< Entry used for lookups.
 	fr_heap_index_t			heap_id;	//!< Offset used for expiry heap.
+	size_t				size;		//!< Memory recorded in the account.
 } rlm_cache_rb_entry_t;
 
+static conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET("snapshot", rlm_cache_rbtree_t, snapshot) },
+	{ FR_CONF_OFFSET("snapshot_interval", rlm_cache_rbtree_t, snapshot_interval), .dflt = "0" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_memory", FR_TYPE_SIZE, 0, rlm_cache_rbtree_t, max_memory), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Identifies a snapshot file, followed by a one byte version
+ *
+ */
+#define CACHE_SNAPSHOT_MAGIC	"FRCS"
+#define CACHE_SNAPSHOT_VERSION	0x01
+
 /** Compare two entries by key
  *
  * There may only be one entry with the same key.
@@ -68,6 +95,30 @@ static int8_t cache_heap_cmp(void const *one, void const *two)
 	return fr_unix_time_cmp(a->expires, b->expires);
 }
 
+/** Record the memory used by an entry which has just been added
+ *
+ * Entries are sized once, when they're added, as they're not modified
+ * after that.
+ */
+static inline CC_HINT(always_inline) void cache_entry_account(rlm_cache_rbtree_t const *driver, rlm_cache_rb_entry_t *c)
+{
+	c->size = talloc_total_size(c);
+	talloc_account_add(driver->account, c->size);
+}
+
+/** Remove an entry from the tree and heap, and free it
+ *
+ */
+static void cache_entry_free(rlm_cache_rbtree_t const *driver, rlm_cache_entry_t *c)
+{
+	rlm_cache_rb_entry_t *rb = (rlm_cache_rb_entry_t *)c;
+
+	fr_heap_extract(&driver->mutable->heap, c);
+	fr_rb_delete(driver->mutable->cache, c);
+	talloc_account_sub(driver->account, rb->size);
+	talloc_free(c);
+}
+
 /** Custom allocation function for the driver
  *
  * Allows allocation of cache entry structures with additional fields.
@@ -111,9 +162,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 	 */
 	c = fr_heap_peek(mutable->heap);
 	if (c && (fr_unix_time_lt(c->expires, fr_time_to_unix_time(request->packet->timestamp)))) {
-		fr_heap_extract(&mutable->heap, c);
-		fr_rb_delete(mutable->cache, c);
-		talloc_free(c);
+		cache_entry_free(driver, c);
 	}
 
 	fr_value_box_copy_shallow(NULL, &find.key, key);
@@ -152,9 +201,7 @@ static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config
 	c = fr_rb_find(driver->mutable->cache, &find);
 	if (!c) return CACHE_MISS;
 
-	fr_heap_extract(&driver->mutable->heap, c);
-	fr_rb_delete(driver->mutable->cache, c);
-	talloc_free(c);
+	cache_entry_free(driver, c);
 
 	return CACHE_OK;
 }
@@ -169,7 +216,9 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
 					 request_t *request, void *handle,
 					 rlm_cache_entry_t const *c)
 {
-	cache_status_t status;
+	cache_status_t		status;
+	rlm_cache_entry_t	*oldest;
+	unsigned int		evicted = 0;
 
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
 
@@ -197,6 +246,18 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
 
 		return CACHE_ERROR;
 	}
+	cache_entry_account(driver, UNCONST(rlm_cache_rb_entry_t *, c));
+
+	/*
+	 *	Over budget, evict the entries which would
+	 *	expire soonest, but never the one we just added.
+	 */
+	while (talloc_account_over_budget(driver->account) &&
+	       ((oldest = fr_heap_peek(driver->mutable->heap)) != NULL) && (oldest != c)) {
+		cache_entry_free(driver, oldest);
+		evicted++;
+	}
+	if (evicted > 0) RDEBUG2("Evicted %u entries - Over memory budget (%zu bytes)", evicted, driver->max_memory);
 
 	return CACHE_OK;
 }
@@ -224,6 +285,8 @@ static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *confi
 
 	if (fr_heap_insert(&driver->mutable->heap, c) < 0) {
 		fr_rb_delete(driver->mutable->cache, c);	/* make sure we don't leak entries... */
+		talloc_account_sub(driver->account, ((rlm_cache_rb_entry_t *)c)->size);
+		((rlm_cache_rb_entry_t *)c)->size = 0;
 		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
 		return CACHE_ERROR;
 	}
@@ -246,19 +309,214 @@ static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void
 	return fr_rb_num_elements(driver->mutable->cache);
 }
 
+/** Write all entries to the snapshot file
+ *
+ * The snapshot is written to a temporary file, which is then renamed over the
+ * old snapshot, so a crash never leaves a partial snapshot behind.
+ *
+ * Each entry is written as a 32bit key length, the key, a 32bit entry length,
+ * and the entry in the binary cache serialization format.
+ *
+ * @note Must be called with the mutex held.
+ */
+static int cache_snapshot_write(rlm_cache_rbtree_t const *driver)
+{
+	rlm_cache_rbtree_mutable_t	*mutable = driver->mutable;
+	fr_rb_iter_inorder_t		iter;
+	rlm_cache_entry_t		*c;
+	TALLOC_CTX			*pool;
+	char				*tmp;
+	FILE				*fp;
+	uint8_t				header[sizeof(CACHE_SNAPSHOT_MAGIC) - 1 + 1];
+	uint32_t			count = 0;
+
+	tmp = talloc_asprintf(NULL, "%s.tmp", driver->snapshot);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		ERROR("Failed opening snapshot \"%s\": %s", tmp, fr_syserror(errno));
+		talloc_free(tmp);
+		return -1;
+	}
+
+	memcpy(header, CACHE_SNAPSHOT_MAGIC, sizeof(CACHE_SNAPSHOT_MAGIC) - 1);
+	header[sizeof(header) - 1] = CACHE_SNAPSHOT_VERSION;
+	if (fwrite(header, sizeof(header), 1, fp) != 1) goto write_error;
+
+	pool = talloc_pool(NULL, 4096);
+	for (c = fr_rb_iter_init_inorder(&iter, mutable->cache);
+	     c;
+	     c = fr_rb_iter_next_inorder(&iter)) {
+		uint8_t		len[sizeof(uint32_t)];
+		uint8_t		*entry;
+		ssize_t		slen;
+
+		slen = cache_serialize_binary(pool, &entry, c);
+		if (slen < 0) {
+			PWARN("Not saving entry for \"%pV\"", &c->key);
+			talloc_free_children(pool);
+			continue;
+		}
+
+		fr_nbo_from_uint32(len, c->key.vb_length);
+		if ((fwrite(len, sizeof(len), 1, fp) != 1) ||
+		    (fwrite(c->key.vb_strvalue, c->key.vb_length, 1, fp) != 1)) {
+		write_pool_error:
+			talloc_free(pool);
+			goto write_error;
+		}
+
+		fr_nbo_from_uint32(len, (uint32_t)slen);
+		if ((fwrite(len, sizeof(len), 1, fp) != 1) ||
+		    (fwrite(entry, (size_t)slen, 1, fp) != 1)) goto write_pool_error;
+
+		talloc_free_children(pool);
+		count++;
+	}
+	talloc_free(pool);
+
+	if (fclose(fp) != 0) {
+		fp = NULL;
+	write_error:
+		ERROR("Failed writing snapshot \"%s\": %s", tmp, fr_syserror(errno));
+		if (fp) fclose(fp);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (rename(tmp, driver->snapshot) < 0) {
+		ERROR("Failed renaming \"%s\" to \"%s\": %s", tmp, driver->snapshot, fr_syserror(errno));
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+	talloc_free(tmp);
+
+	DEBUG2("Saved %u entries to \"%s\"", count, driver->snapshot);
+
+	return 0;
+}
+
+/** Restore entries from the snapshot file
+ *
+ * This is done when the cache is first used, rather than when the driver is
+ * instantiated, as we need the dictionary of the request to resolve the
+ * attributes in the entries.
+ *
+ * Entries which have expired, or were created before the current epoch, are
+ * skipped.
+ *
+ * @note Must be called with the mutex held.
+ */
+static void cache_snapshot_load(rlm_cache_rbtree_t const *driver, rlm_cache_config_t const *config,
+				request_t *request)
+{
+	rlm_cache_rbtree_mutable_t	*mutable = driver->mutable;
+	fr_unix_time_t			now = fr_time_to_unix_time(request->packet->timestamp);
+	struct stat			st;
+	uint8_t				*map;
+	fr_dbuff_t			dbuff;
+	uint8_t				magic[sizeof(CACHE_SNAPSHOT_MAGIC) - 1];
+	uint8_t				version;
+	uint32_t			loaded = 0, skipped = 0;
+	int				fd;
+
+	mutable->snapshot_loaded = true;
+	mutable->snapshot_last = fr_time();
+
+	fd = open(driver->snapshot, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) RWARN("Failed opening snapshot \"%s\": %s", driver->snapshot, fr_syserror(errno));
+		return;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		RWARN("Failed mapping snapshot \"%s\": %s", driver->snapshot, fr_syserror(errno));
+		return;
+	}
+
+	dbuff = FR_DBUFF_TMP(map, (size_t)st.st_size);
+
+	if ((fr_dbuff_out_memcpy(magic, &dbuff, sizeof(magic)) <= 0) ||
+	    (memcmp(magic, CACHE_SNAPSHOT_MAGIC, sizeof(magic)) != 0) ||
+	    (fr_dbuff_out(&version, &dbuff) <= 0) || (version != CACHE_SNAPSHOT_VERSION)) {
+		RWARN("Ignoring snapshot \"%s\", it is not a cache snapshot, or is from an "
+		      "incompatible version", driver->snapshot);
+		goto done;
+	}
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		rlm_cache_rb_entry_t	*c;
+		uint32_t		key_len, entry_len;
+		uint8_t const		*key, *entry;
+
+		if ((fr_dbuff_out(&key_len, &dbuff) <= 0) ||
+		    (fr_dbuff_remaining(&dbuff) < key_len)) {
+		truncated:
+			RWARN("Snapshot \"%s\" is truncated", driver->snapshot);
+			break;
+		}
+		key = fr_dbuff_current(&dbuff);
+		fr_dbuff_advance(&dbuff, key_len);
+
+		if ((fr_dbuff_out(&entry_len, &dbuff) <= 0) ||
+		    (fr_dbuff_remaining(&dbuff) < entry_len)) goto truncated;
+		entry = fr_dbuff_current(&dbuff);
+		fr_dbuff_advance(&dbuff, entry_len);
+
+		MEM(c = talloc_zero(NULL, rlm_cache_rb_entry_t));
+		map_list_init(&c->fields.maps);
+
+		if ((cache_deserialize_binary(&c->fields, request->dict, entry, entry_len) < 0) ||
+		    (fr_value_box_bstrndup(c, &c->fields.key, NULL, (char const *)key, key_len, false) < 0)) {
+			RPWARN("Skipping invalid entry");
+		skip:
+			talloc_free(c);
+			skipped++;
+			continue;
+		}
+
+		if (fr_unix_time_lt(c->fields.expires, now) ||
+		    fr_unix_time_lt(c->fields.created, fr_unix_time_from_sec(config->epoch))) goto skip;
+
+		if (!fr_rb_insert(mutable->cache, c)) goto skip;
+		if (fr_heap_insert(&mutable->heap, c) < 0) {
+			fr_rb_delete(mutable->cache, c);
+			goto skip;
+		}
+		cache_entry_account(driver, c);
+		loaded++;
+	}
+
+	RINFO("Restored %u entries from \"%s\", skipped %u expired or invalid entries",
+	      loaded, driver->snapshot, skipped);
+
+done:
+	munmap(map, st.st_size);
+}
+
 /** Lock the rbtree
  *
  * @note handle not used except for sanity checks.
  *
  * @copydetails cache_acquire_t
  */
-static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+static int cache_acquire(void **handle, rlm_cache_config_t const *config, void *instance,
 			 request_t *request)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
 
 	pthread_mutex_lock(&driver->mutable->mutex);
 
+	if (driver->snapshot && !driver->mutable->snapshot_loaded) cache_snapshot_load(driver, config, request);
+
 	*handle = request;		/* handle is unused, this is just for sanity checking */
 
 	RDEBUG3("Mutex acquired");
@@ -276,8 +534,18 @@ static void cache_release(UNUSED rlm_cache_config_t const *config, void *instanc
 			  UNUSED rlm_cache_handle_t *handle)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rbtree_mutable_t *mutable = driver->mutable;
 
-	pthread_mutex_unlock(&driver->mutable->mutex);
+	/*
+	 *	Save entries periodically, so they survive a crash.
+	 */
+	if (driver->snapshot && fr_time_delta_ispos(driver->snapshot_interval) &&
+	    fr_time_gteq(fr_time(), fr_time_add(mutable->snapshot_last, driver->snapshot_interval))) {
+		mutable->snapshot_last = fr_time();
+		(void) cache_snapshot_write(driver);
+	}
+
+	pthread_mutex_unlock(&mutable->mutex);
 
 	RDEBUG3("Mutex released");
 }
@@ -290,6 +558,12 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	rlm_cache_rbtree_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_rbtree_t);
 	rlm_cache_rbtree_mutable_t	*mutable = driver->mutable;
 
+	/*
+	 *	Don't overwrite the snapshot if we never
+	 *	got as far as loading it.
+	 */
+	if (driver->snapshot && mutable->snapshot_loaded) (void) cache_snapshot_write(driver);
+
 	if (mutable->cache) {
 		fr_rb_iter_inorder_t	iter;
 		void			*data;
@@ -305,6 +579,7 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	pthread_mutex_destroy(&mutable->mutex);
 
 	TALLOC_FREE(driver->mutable);
+	if (driver->account) talloc_account_set(driver->account, 0);
 
 	return 0;
 }
@@ -332,7 +607,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		ERROR("Failed to create cache");
 	error:
 		talloc_free(mutable);
-		goto error;
+		return -1;
 	}
 
 	/*
@@ -349,6 +624,14 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		goto error;
 	}
 
+	driver->account = talloc_account("cache", mctx->mi->parent->name);
+	if (!driver->account) {
+		ERROR("Failed allocating memory account");
+		pthread_mutex_destroy(&mutable->mutex);
+		goto error;
+	}
+	talloc_account_budget_set(driver->account, driver->max_memory);
+
 	driver->mutable = mutable;
 
 	return 0;
@@ -363,6 +646,7 @@ rlm_cache_driver_t rlm_cache_rbtree = {
 		.detach		= mod_detach,
 		.inst_size	= sizeof(rlm_cache_rbtree_t),
 		.inst_type	= "rlm_cache_rbtree_t",
+		.config		= driver_config,
 	},
 	.alloc		= cache_entry_alloc,
 
@@ -28,23 +28,34 @@
 #include <freeradius-devel/util/value.h>
 
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
-static conf_parser_t driver_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
 
 typedef struct {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
 						//!< Must be first field in this struct.
 
+	cache_serialize_format_t format;	//!< Store entries as lists of maps, or binary strings.
+	char const		*compress;	//!< Name of the rlm_brotli instance to compress entries with.
+	rlm_brotli_codec_t const *codec;	//!< of the compress instance.
+
 	tmpl_t		*created_attr;	//!< LHS of the Cache-Created map.
 	tmpl_t		*expires_attr;	//!< LHS of the Cache-Expires map.
 
 	fr_redis_cluster_t	*cluster;
 } rlm_cache_redis_t;
 
+static conf_parser_t driver_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("format", rlm_cache_redis_t, format),
+	  .func = cf_table_parse_int,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = cache_serialize_format_table, .len = &cache_serialize_format_table_len },
+	  .dflt = "text" },
+	{ FR_CONF_OFFSET("compress", rlm_cache_redis_t, compress) },
+	CONF_PARSER_TERMINATOR
+};
+
 static fr_dict_t const *dict_freeradius;
 
 extern fr_dict_autoload_t rlm_cache_redis_dict[];
@@ -102,6 +113,14 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (driver->compress) {
+		if (driver->format != CACHE_SERIALIZE_BINARY) {
+			cf_log_err(mctx->mi->conf, "'compress' requires 'format = binary'");
+			return -1;
+		}
+		if (cache_codec_find(&driver->codec, mctx->mi->conf, driver->compress) < 0) return -1;
+	}
+
 	return 0;
 }
 
@@ -116,6 +135,70 @@ static void cache_entry_free(rlm_cache_entry_t *c)
 	talloc_free(c);
 }
 
+/** Locate a binary serialized cache entry in redis
+ *
+ */
+static cache_status_t cache_entry_find_binary(rlm_cache_entry_t **out, rlm_cache_redis_t const *driver,
+					      request_t *request, fr_value_box_t const *key)
+{
+	fr_redis_cluster_state_t	state;
+	fr_redis_conn_t			*conn;
+	fr_redis_rcode_t		status;
+	redisReply			*reply = NULL;
+	int				s_ret;
+
+	rlm_cache_entry_t		*c;
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, (uint8_t const *)key->vb_strvalue, key->vb_length, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
+		RDEBUG3("GET %pV", key);
+		reply = redisCommand(conn->handle, "GET %b", key->vb_strvalue, key->vb_length);
+		status = fr_redis_command_status(conn, reply);
+	}
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		RERROR("Failed retrieving entry for key \"%pV\"", key);
+
+	error:
+		fr_redis_reply_free(&reply);
+		return CACHE_ERROR;
+	}
+
+	if (!fr_cond_assert(reply)) goto error;
+
+	if (reply->type == REDIS_REPLY_NIL) {
+		fr_redis_reply_free(&reply);
+		return CACHE_MISS;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		REDEBUG("Bad result type, expected string, got %s",
+			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		goto error;
+	}
+
+	RDEBUG3("Entry is %zu bytes", reply->len);
+
+	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+	map_list_init(&c->maps);
+
+	if ((driver->codec ?
+	     cache_deserialize_compressed(c, request->dict, (uint8_t const *)reply->str, reply->len, driver->codec) :
+	     cache_deserialize_binary(c, request->dict, (uint8_t const *)reply->str, reply->len)) < 0) {
+		RPERROR("Invalid entry");
+	error_free:
+		talloc_free(c);
+		goto error;
+	}
+
+	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) goto error_free;
+	fr_redis_reply_free(&reply);
+
+	*out = c;
+
+	return CACHE_OK;
+}
+
 /** Locate a cache entry in redis
  *
  * @copydetails cache_entry_find_t
@@ -139,6 +222,8 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 #endif
 	rlm_cache_entry_t		*c;
 
+	if (driver->format == CACHE_SERIALIZE_BINARY) return cache_entry_find_binary(out, driver, request, key);
+
 	map_list_init(&head);
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, (uint8_t const *)key->vb_strvalue, key->vb_length, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
@@ -246,6 +331,72 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 }
 
 
+/** Insert a binary serialized entry into redis
+ *
+ * The entry is stored as a single string, so it's written, and its
+ * expiry set, with one SET command.
+ */
+static cache_status_t cache_entry_insert_binary(rlm_cache_redis_t const *driver, request_t *request,
+						rlm_cache_entry_t const *c)
+{
+	fr_redis_cluster_state_t	state;
+	fr_redis_conn_t			*conn;
+	fr_redis_rcode_t		status;
+	redisReply			*reply = NULL;
+	int				s_ret;
+
+	uint8_t				*to_store;
+	ssize_t				slen;
+	int64_t				ttl_ms = 0;
+
+	if (driver->codec) {
+		slen = cache_serialize_compressed(request, &to_store, c, driver->codec);
+	} else {
+		slen = cache_serialize_binary(request, &to_store, c);
+	}
+	if (slen < 0) {
+		RPERROR("Failed serializing entry");
+		return CACHE_ERROR;
+	}
+
+	/*
+	 *	Redis objects expire on their own, we still
+	 *	store the expiry time in the entry, to ignore
+	 *	entries that were created before the last epoch.
+	 */
+	if (fr_unix_time_ispos(c->expires)) {
+		ttl_ms = fr_time_delta_to_msec(fr_unix_time_sub(c->expires,
+								fr_time_to_unix_time(request->packet->timestamp)));
+		if (ttl_ms <= 0) ttl_ms = 1;
+	}
+
+	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, (uint8_t const *)c->key.vb_strvalue, c->key.vb_length, false);
+	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
+	     s_ret = fr_redis_cluster_state_next(&state, &conn, driver->cluster, request, status, &reply)) {
+		if (ttl_ms > 0) {
+			RDEBUG3("SET \"%pV\" <%zd bytes> PX %" PRId64, &c->key, slen, ttl_ms);
+			reply = redisCommand(conn->handle, "SET %b %b PX %" PRId64,
+					     (uint8_t const *)c->key.vb_strvalue, (size_t)c->key.vb_length,
+					     to_store, (size_t)slen, ttl_ms);
+		} else {
+			RDEBUG3("SET \"%pV\" <%zd bytes>", &c->key, slen);
+			reply = redisCommand(conn->handle, "SET %b %b",
+					     (uint8_t const *)c->key.vb_strvalue, (size_t)c->key.vb_length,
+					     to_store, (size_t)slen);
+		}
+		status = fr_redis_command_status(conn, reply);
+	}
+	talloc_free(to_store);
+	fr_redis_reply_free(&reply);
+
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		RPERROR("Failed inserting entry");
+		return CACHE_ERROR;
+	}
+
+	return CACHE_OK;
+}
+
 /** Insert a new entry into the data store
  *
  * @copydetails cache_entry_insert_t
@@ -290,6 +441,8 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 					.rhs	= &created_value,
 				};
 
+	if (driver->format == CACHE_SERIALIZE_BINARY) return cache_entry_insert_binary(driver, request, c);
+
 	/*
 	 *	Encode the entry created date
 	 */
@@ -0,0 +1,503 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_sharded.c
+ * @brief In memory cache split into independently locked shards.
+ *
+ * Each key is hashed to one shard.  A shard has its own mutex, hash table,
+ * expiry heap, and CLOCK list, so workers using different keys rarely
+ * contend with each other.
+ *
+ * The cache handle remembers which shard it has locked.  The lock is taken
+ * by the first operation on a key, and is held until the handle is released,
+ * so entries returned by find stay valid while rlm_cache uses them.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/value.h>
+#include "../../rlm_cache.h"
+
+typedef struct {
+	pthread_mutex_t			mutex;		//!< Protect the shard from multiple readers/writers.
+	fr_hash_table_t			*cache;		//!< Hash table for looking up cache keys.
+	fr_heap_t			*heap;		//!< For managing entry expiry.
+	fr_dlist_head_t			clock;		//!< Entries in CLOCK order, for eviction.
+} CC_HINT(aligned(64)) rlm_cache_shard_t;
+
+typedef struct {
+	uint32_t			num_shards;	//!< How many shards to split the cache into.
+
+	uint32_t			mask;		//!< num_shards - 1.
+	rlm_cache_shard_t		*shards;	//!< Mutable shard data.
+} rlm_cache_sharded_t;
+
+typedef struct {
+	rlm_cache_entry_t		fields;		//!< Entry data.
+
+	fr_heap_index_t			heap_id;	//!< Offset used for expiry heap.
+	fr_dlist_t			clock_entry;	//!< Entry in the CLOCK list.
+	bool				referenced;	//!< Entry has been found since the CLOCK
+							///< hand last passed it.
+} rlm_cache_sharded_entry_t;
+
+/** The shard a handle currently has locked
+ *
+ */
+typedef struct {
+	rlm_cache_shard_t		*locked;	//!< Shard we hold the mutex for, or NULL.
+} rlm_cache_sharded_handle_t;
+
+static conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET("shards", rlm_cache_sharded_t, num_shards), .dflt = "16" },
+	CONF_PARSER_TERMINATOR
+};
+
+/*
+ *	Shards are selected with the top bits of the hash, as the
+ *	hash tables in each shard use the bottom bits.
+ */
+#define CACHE_SHARD(_driver, _hash) (&(_driver)->shards[((_hash) >> 24) & (_driver)->mask])
+
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_entry_t const *c = data;
+
+	return fr_value_box_hash(&c->key);
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return fr_value_box_cmp(&a->key, &b->key);
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return fr_unix_time_cmp(a->expires, b->expires);
+}
+
+/** Lock the shard a key belongs to
+ *
+ * If the handle already holds another shard's mutex, that mutex is released first,
+ * so a handle never holds more than one shard lock.
+ */
+static inline CC_HINT(always_inline)
+rlm_cache_shard_t *cache_shard_lock(rlm_cache_sharded_t const *driver, rlm_cache_sharded_handle_t *handle,
+				    uint32_t hash)
+{
+	rlm_cache_shard_t *shard = CACHE_SHARD(driver, hash);
+
+	if (handle->locked == shard) return shard;
+
+	if (handle->locked) pthread_mutex_unlock(&handle->locked->mutex);
+	pthread_mutex_lock(&shard->mutex);
+	handle->locked = shard;
+
+	return shard;
+}
+
+/** Remove an entry from all of the shard's structures, and free it
+ *
+ */
+static void cache_shard_delete(rlm_cache_shard_t *shard, rlm_cache_sharded_entry_t *c)
+{
+	fr_heap_extract(&shard->heap, c);
+	fr_hash_table_remove(shard->cache, c);
+	fr_dlist_remove(&shard->clock, c);
+	talloc_free(c);
+}
+
+/** Remove entries which have expired
+ *
+ */
+static void cache_shard_reap(rlm_cache_shard_t *shard, fr_unix_time_t now)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	while ((c = fr_heap_peek(shard->heap)) && fr_unix_time_lt(c->fields.expires, now)) {
+		cache_shard_delete(shard, c);
+	}
+}
+
+/** Evict one entry using the CLOCK algorithm
+ *
+ * Entries which have been found since the hand last passed them get a second
+ * chance, and are moved to the back of the list.
+ *
+ * @return
+ *	- true if an entry was evicted.
+ *	- false if the shard is empty.
+ */
+static bool cache_shard_evict(rlm_cache_shard_t *shard)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	while ((c = fr_dlist_head(&shard->clock))) {
+		if (!c->referenced) {
+			cache_shard_delete(shard, c);
+			return true;
+		}
+
+		c->referenced = false;
+		fr_dlist_remove(&shard->clock, c);
+		fr_dlist_insert_tail(&shard->clock, c);
+	}
+
+	return false;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       request_t *request, void *handle, fr_value_box_t const *key)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_shard_t		*shard;
+	rlm_cache_entry_t		find = {};
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			hash;
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+	hash = cache_entry_hash(&find);
+
+	shard = cache_shard_lock(driver, handle, hash);
+
+	/*
+	 *	Clear out old entries
+	 */
+	cache_shard_reap(shard, fr_time_to_unix_time(request->packet->timestamp));
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_hash_table_find_by_key(shard->cache, hash, &find);
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+	c->referenced = true;
+	*out = (rlm_cache_entry_t *)c;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 fr_value_box_t const *key)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_shard_t		*shard;
+	rlm_cache_entry_t		find = {};
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			hash;
+
+	if (!request) return CACHE_ERROR;
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+	hash = cache_entry_hash(&find);
+
+	shard = cache_shard_lock(driver, handle, hash);
+
+	c = fr_hash_table_find_by_key(shard->cache, hash, &find);
+	if (!c) return CACHE_MISS;
+
+	cache_shard_delete(shard, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * If the shard is full, expired entries are removed, then entries which haven't
+ * been used recently are evicted until there's room.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_shard_t		*shard;
+	rlm_cache_sharded_entry_t	*c = UNCONST(rlm_cache_sharded_entry_t *, entry);
+	rlm_cache_sharded_entry_t	*old;
+	uint32_t			hash;
+
+	if (!request) return CACHE_ERROR;
+
+	hash = cache_entry_hash(c);
+	shard = cache_shard_lock(driver, handle, hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_hash_table_find_by_key(shard->cache, hash, c);
+	if (old) cache_shard_delete(shard, old);
+
+	/*
+	 *	max_entries is split evenly between the shards.
+	 */
+	if (config->max_entries > 0) {
+		uint32_t max = (config->max_entries + driver->mask) / (driver->mask + 1);
+
+		if (fr_hash_table_num_elements(shard->cache) >= max) {
+			cache_shard_reap(shard, fr_time_to_unix_time(request->packet->timestamp));
+		}
+
+		while (fr_hash_table_num_elements(shard->cache) >= max) {
+			if (!cache_shard_evict(shard)) break;
+			RDEBUG3("Cache shard full, evicted least recently used entry");
+		}
+	}
+
+	if (!fr_hash_table_insert(shard->cache, c)) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(&shard->heap, c) < 0) {
+		fr_hash_table_remove(shard->cache, c);
+		RERROR("Failed adding entry to expiry heap");
+
+		return CACHE_ERROR;
+	}
+
+	c->referenced = false;
+	fr_dlist_insert_tail(&shard->clock, c);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  request_t *request, void *handle,
+					  rlm_cache_entry_t *entry)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_shard_t		*shard;
+	rlm_cache_sharded_entry_t	*c = (rlm_cache_sharded_entry_t *)entry;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = cache_shard_lock(driver, handle, cache_entry_hash(c));
+
+	if (!fr_cond_assert(fr_heap_extract(&shard->heap, c) == 0)) {
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(&shard->heap, c) < 0) {
+		/* make sure we don't leak entries... */
+		fr_hash_table_remove(shard->cache, c);
+		fr_dlist_remove(&shard->clock, c);
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+	return CACHE_OK;
+}
+
+/** Allocate a handle to track which shard we've locked
+ *
+ * No locks are taken here, the shard isn't known until we see the key.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			 request_t *request)
+{
+	rlm_cache_sharded_handle_t *h;
+
+	MEM(h = talloc_zero(request, rlm_cache_sharded_handle_t));
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the handle, unlocking the shard it holds
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_sharded_handle_t *h = talloc_get_type_abort(handle, rlm_cache_sharded_handle_t);
+
+	if (h->locked) {
+		pthread_mutex_unlock(&h->locked->mutex);
+		RDEBUG3("Shard mutex released");
+	}
+
+	talloc_free(h);
+}
+
+/** Cleanup a cache_sharded instance
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_sharded_t);
+	uint32_t			i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i <= driver->mask; i++) {
+		rlm_cache_shard_t		*shard = &driver->shards[i];
+		rlm_cache_sharded_entry_t	*c;
+
+		while ((c = fr_dlist_head(&shard->clock))) cache_shard_delete(shard, c);
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	TALLOC_FREE(driver->shards);
+
+	return 0;
+}
+
+/** Create a new cache_sharded instance
+ *
+ * @param[in] mctx		Data required for instantiation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_sharded_t);
+	rlm_cache_shard_t		*shards;
+	uint32_t			i, num = 1;
+	int				ret;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 256);
+	while (num < driver->num_shards) num <<= 1;
+
+	/*
+	 *	Shards are written to at runtime, so they're
+	 *	not allocated in the instance data.
+	 */
+	MEM(shards = talloc_zero_array(NULL, rlm_cache_shard_t, num));
+
+	for (i = 0; i < num; i++) {
+		rlm_cache_shard_t *shard = &shards[i];
+
+		shard->cache = fr_hash_table_talloc_alloc(shards, rlm_cache_sharded_entry_t,
+							  cache_entry_hash, cache_entry_cmp, NULL);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+		error:
+			while (i-- > 0) pthread_mutex_destroy(&shards[i].mutex);
+			talloc_free(shards);
+			return -1;
+		}
+
+		shard->heap = fr_heap_talloc_alloc(shards, cache_heap_cmp, rlm_cache_sharded_entry_t, heap_id, 0);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			goto error;
+		}
+
+		fr_dlist_talloc_init(&shard->clock, rlm_cache_sharded_entry_t, clock_entry);
+
+		if ((ret = pthread_mutex_init(&shard->mutex, NULL)) != 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(ret));
+			goto error;
+		}
+	}
+
+	driver->mask = num - 1;
+	driver->shards = shards;
+
+	return 0;
+}
+
+extern rlm_cache_driver_t rlm_cache_sharded;
+rlm_cache_driver_t rlm_cache_sharded = {
+	.common = {
+		.magic		= MODULE_MAGIC_INIT,
+		.name		= "cache_sharded",
+		.config		= driver_config,
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.inst_size	= sizeof(rlm_cache_sharded_t),
+		.inst_type	= "rlm_cache_sharded_t",
+	},
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+
+	/*
+	 *	No count callback.  We evict entries when
+	 *	max_entries is reached, instead of having
+	 *	rlm_cache refuse to insert new ones.
+	 */
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
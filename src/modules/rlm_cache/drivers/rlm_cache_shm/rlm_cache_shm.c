@@ -0,0 +1,546 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_shm.c
+ * @brief Cache which lives in a shared memory mapping, and so can be used
+ *	by multiple server processes at once.
+ *
+ * The mapping is a table of fixed size slots.  Each key hashes to a small
+ * window of slots, and may be stored in any slot in that window.  When the
+ * window is full, the entry which expires soonest is evicted.
+ *
+ * Slots are protected by a sequence counter, which is odd while the slot
+ * is being written.  Readers copy the slot, and retry if the counter changed
+ * while they were copying, so lookups never lock.  Writers claim a slot by
+ * making the counter odd, and record their PID so that a slot left half
+ * written by a process which crashed can be reclaimed.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+#define LOG_PREFIX "cache - shm"
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/value.h>
+
+#include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_SHM_MAGIC		0x46524348	//!< "FRCH"
+#define CACHE_SHM_VERSION	1
+
+/** How many slots a key may be stored in
+ *
+ */
+#define CACHE_SHM_WINDOW	8
+
+/** How many times a reader retries a slot which is being written
+ *
+ */
+#define CACHE_SHM_READ_TRIES	4
+
+/** Start of the mapping
+ *
+ * Written once, when the file is created, and never changed.
+ */
+typedef struct {
+	uint32_t		magic;		//!< #CACHE_SHM_MAGIC.
+	uint32_t		version;	//!< #CACHE_SHM_VERSION.
+	uint32_t		num_slots;	//!< How many slots follow the header.
+	uint32_t		slot_size;	//!< Size of each slot, including its header.
+} CC_HINT(aligned(64)) rlm_cache_shm_header_t;
+
+typedef struct {
+	_Atomic(uint32_t)	seq;		//!< Odd while the slot is being written.
+	_Atomic(uint32_t)	pid;		//!< Of the process writing the slot, or 0.
+
+	uint32_t		hash;		//!< Of the key.
+	uint32_t		key_len;	//!< Length of the key.  0 if the slot is empty.
+	uint32_t		data_len;	//!< Length of the serialized entry.
+	uint32_t		pad;
+
+	uint64_t		created;	//!< When the entry was created.
+	uint64_t		expires;	//!< When the entry expires.
+
+	uint8_t			data[];		//!< Key, followed by the serialized entry.
+} rlm_cache_shm_slot_t;
+
+/** A consistent copy of a slot's header
+ *
+ */
+typedef struct {
+	uint32_t		key_len;	//!< Length of the key.
+	uint32_t		data_len;	//!< Length of the serialized entry.
+	uint64_t		created;	//!< When the entry was created.
+	uint64_t		expires;	//!< When the entry expires.
+} rlm_cache_shm_copy_t;
+
+typedef struct {
+	char const		*filename;	//!< File backing the mapping.
+	uint32_t		num_slots;	//!< How many slots are in the mapping.
+	uint32_t		slot_size;	//!< Size of each slot.
+
+	int			fd;		//!< Of the file backing the mapping.
+	uint8_t			*map;		//!< The mapping.
+	size_t			map_len;	//!< Length of the mapping.
+	uint32_t		mask;		//!< num_slots - 1.
+	size_t			data_size;	//!< How many bytes of key and entry a slot holds.
+} rlm_cache_shm_t;
+
+static const conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_REQUIRED, rlm_cache_shm_t, filename) },
+	{ FR_CONF_OFFSET("slots", rlm_cache_shm_t, num_slots), .dflt = "65536" },
+	{ FR_CONF_OFFSET("slot_size", rlm_cache_shm_t, slot_size), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
+static inline CC_HINT(always_inline) rlm_cache_shm_slot_t *cache_shm_slot(rlm_cache_shm_t const *driver, uint32_t i)
+{
+	return (rlm_cache_shm_slot_t *)(driver->map + sizeof(rlm_cache_shm_header_t) +
+					((size_t)(i & driver->mask) * driver->slot_size));
+}
+
+/** Claim a slot for writing
+ *
+ * If the slot is being written by a process which no longer exists, the
+ * slot is taken over, and marked as empty.
+ *
+ * @param[in] slot	to claim.
+ * @param[out] seq	the odd sequence number we hold the slot with.
+ * @return
+ *	- true if the slot was claimed.
+ *	- false if another process is writing to the slot.
+ */
+static bool cache_shm_slot_claim(rlm_cache_shm_slot_t *slot, uint32_t *seq)
+{
+	uint32_t	s = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	uint32_t	next = s + 1;
+
+	if (s & 1) {
+		pid_t pid = (pid_t)atomic_load_explicit(&slot->pid, memory_order_relaxed);
+
+		if (!pid || (kill(pid, 0) == 0) || (errno != ESRCH)) return false;
+
+		/*
+		 *	Keep the sequence number odd, readers
+		 *	must still ignore the slot.
+		 */
+		next = s + 2;
+	}
+
+	if (!atomic_compare_exchange_strong_explicit(&slot->seq, &s, next,
+						     memory_order_acquire, memory_order_relaxed)) return false;
+	atomic_store_explicit(&slot->pid, (uint32_t)getpid(), memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	/*
+	 *	Whatever the dead writer left behind
+	 *	can't be trusted.
+	 */
+	if (next != (s + 1)) slot->key_len = 0;
+
+	*seq = next;
+	return true;
+}
+
+/** Release a slot claimed with #cache_shm_slot_claim
+ *
+ */
+static inline CC_HINT(always_inline) void cache_shm_slot_release(rlm_cache_shm_slot_t *slot, uint32_t seq)
+{
+	atomic_store_explicit(&slot->pid, 0, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+/** Copy a slot, if it holds the key we're looking for
+ *
+ * @param[out] out	Where to copy the slot header.
+ * @param[out] buff	Where to copy the key and serialized entry.
+ * @param[in] driver	instance.
+ * @param[in] slot	to copy.
+ * @param[in] hash	of the key.
+ * @param[in] key	to look for.
+ * @return
+ *	- 1 if the slot holds the key.
+ *	- 0 if it doesn't, or is being written.
+ */
+static int cache_shm_slot_read(rlm_cache_shm_copy_t *out, uint8_t *buff,
+			       rlm_cache_shm_t const *driver, rlm_cache_shm_slot_t *slot,
+			       uint32_t hash, fr_value_box_t const *key)
+{
+	int i;
+
+	for (i = 0; i < CACHE_SHM_READ_TRIES; i++) {
+		uint32_t s = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+		if (s & 1) continue;
+
+		if ((slot->hash != hash) || (slot->key_len != key->vb_length)) return 0;
+
+		out->key_len = slot->key_len;
+		out->data_len = slot->data_len;
+		out->created = slot->created;
+		out->expires = slot->expires;
+
+		/*
+		 *	Checked again below.  A torn read may
+		 *	produce any length.
+		 */
+		if ((out->key_len + (size_t)out->data_len) > driver->data_size) continue;
+
+		memcpy(buff, slot->data, out->key_len + out->data_len);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != s) continue;
+
+		return (memcmp(buff, key->vb_strvalue, key->vb_length) == 0);
+	}
+
+	return 0;
+}
+
+/** Free an entry returned by #cache_entry_find
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	talloc_free(c);
+}
+
+/** Locate a cache entry in the shared mapping
+ *
+ * If the key is in more than one slot, because two processes inserted it
+ * at once, the most recently created entry is used.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       request_t *request, UNUSED void *handle, fr_value_box_t const *key)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	rlm_cache_shm_copy_t	found = {}, copy;
+	uint8_t			*buff, *p;
+	uint64_t		now = fr_unix_time_unwrap(fr_time_to_unix_time(request->packet->timestamp));
+	uint32_t		hash, i;
+	rlm_cache_entry_t	*c;
+
+	*out = NULL;
+
+	hash = fr_hash(key->vb_strvalue, key->vb_length);
+
+	MEM(buff = talloc_array(NULL, uint8_t, driver->data_size * 2));
+	p = buff + driver->data_size;
+
+	for (i = 0; i < CACHE_SHM_WINDOW; i++) {
+		if (!cache_shm_slot_read(&copy, p, driver, cache_shm_slot(driver, hash + i), hash, key)) continue;
+		if (copy.expires <= now) continue;
+		if (found.key_len && (copy.created <= found.created)) continue;
+
+		found = copy;
+		memcpy(buff, p, copy.key_len + copy.data_len);
+	}
+
+	if (!found.key_len) {
+		talloc_free(buff);
+		return CACHE_MISS;
+	}
+	RDEBUG2("Retrieved %u bytes from shared memory", found.data_len);
+
+	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+	if (cache_deserialize_binary(c, request->dict, buff + found.key_len, found.data_len) < 0) {
+		RPERROR("Invalid entry");
+	error:
+		talloc_free(buff);
+		talloc_free(c);
+		return CACHE_ERROR;
+	}
+	TALLOC_FREE(buff);
+
+	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) {
+		RERROR("Failed copying key");
+		goto error;
+	}
+
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the shared mapping
+ *
+ * The entry replaces an existing entry with the same key, an empty or
+ * expired slot, or the entry which expires soonest, in that order of
+ * preference.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle, rlm_cache_entry_t const *c)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	rlm_cache_shm_slot_t	*slot, *victim = NULL, *free_slot = NULL;
+	uint64_t		now = fr_unix_time_unwrap(fr_time_to_unix_time(request->packet->timestamp));
+	uint8_t			*to_store;
+	ssize_t			slen;
+	uint32_t		hash, i, seq;
+
+	slen = cache_serialize_binary(NULL, &to_store, c);
+	if (slen < 0) {
+		RPERROR("Failed serializing entry");
+		return CACHE_ERROR;
+	}
+
+	if ((c->key.vb_length + (size_t)slen) > driver->data_size) {
+		RWARN("Entry is %zu bytes, but slots can only hold %zu bytes.  Not caching entry",
+		      c->key.vb_length + (size_t)slen, driver->data_size);
+		talloc_free(to_store);
+		return CACHE_ERROR;
+	}
+
+	hash = fr_hash(c->key.vb_strvalue, c->key.vb_length);
+
+	/*
+	 *	Unlocked reads, used only to pick a slot.
+	 */
+	for (i = 0; i < CACHE_SHM_WINDOW; i++) {
+		slot = cache_shm_slot(driver, hash + i);
+
+		if ((slot->key_len == c->key.vb_length) && (slot->hash == hash) &&
+		    (memcmp(slot->data, c->key.vb_strvalue, c->key.vb_length) == 0)) {
+			victim = slot;
+			break;
+		}
+
+		if (!slot->key_len || (slot->expires <= now)) {
+			if (!free_slot) free_slot = slot;
+			continue;
+		}
+
+		if (!victim || (slot->expires < victim->expires)) victim = slot;
+	}
+	if ((i == CACHE_SHM_WINDOW) && free_slot) victim = free_slot;
+
+	if (!cache_shm_slot_claim(victim, &seq)) {
+		RDEBUG2("Slot is being written by another process, not caching entry");
+		talloc_free(to_store);
+		return CACHE_OK;
+	}
+
+	victim->hash = hash;
+	victim->key_len = c->key.vb_length;
+	victim->data_len = slen;
+	victim->created = fr_unix_time_unwrap(c->created);
+	victim->expires = fr_unix_time_unwrap(c->expires);
+	memcpy(victim->data, c->key.vb_strvalue, c->key.vb_length);
+	memcpy(victim->data + c->key.vb_length, to_store, slen);
+
+	cache_shm_slot_release(victim, seq);
+	talloc_free(to_store);
+
+	RDEBUG2("Stored %zd bytes in shared memory", slen);
+
+	return CACHE_OK;
+}
+
+/** Remove every copy of an entry from the shared mapping
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle, fr_value_box_t const *key)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	uint32_t		hash, i, seq;
+	bool			found = false;
+
+	hash = fr_hash(key->vb_strvalue, key->vb_length);
+
+	for (i = 0; i < CACHE_SHM_WINDOW; i++) {
+		rlm_cache_shm_slot_t *slot = cache_shm_slot(driver, hash + i);
+
+		if ((slot->hash != hash) || (slot->key_len != key->vb_length)) continue;
+
+		if (!cache_shm_slot_claim(slot, &seq)) {
+			RWARN("Slot is being written by another process, entry may not be removed");
+			continue;
+		}
+
+		/*
+		 *	Check again now nothing else can
+		 *	change the slot.
+		 */
+		if ((slot->hash == hash) && (slot->key_len == key->vb_length) &&
+		    (memcmp(slot->data, key->vb_strvalue, key->vb_length) == 0)) {
+			slot->key_len = 0;
+			found = true;
+		}
+
+		cache_shm_slot_release(slot, seq);
+	}
+
+	return found ? CACHE_OK : CACHE_MISS;
+}
+
+/** Unmap the shared memory
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_cache_shm_t *driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_shm_t);
+
+	if (driver->map) munmap(driver->map, driver->map_len);
+	if (driver->fd >= 0) close(driver->fd);
+
+	return 0;
+}
+
+/** Create, or attach to, the shared mapping
+ *
+ * The file is locked while it's checked, so that two processes starting at
+ * the same time don't both initialise it.
+ *
+ * @param[in] mctx		Data required for instantiation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_shm_t			*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_shm_t);
+	CONF_SECTION			*conf = mctx->mi->conf;
+	rlm_cache_config_t const	*config = talloc_get_type_abort(mctx->mi->parent->data, rlm_cache_config_t);
+	rlm_cache_shm_header_t		*header;
+	struct stat			st;
+	uint32_t			num = 1;
+
+	driver->fd = -1;
+
+	if (config->max_entries > 0) {
+		cf_log_err(conf, "max_entries is not supported by this driver, set 'slots' instead");
+		return -1;
+	}
+
+	FR_INTEGER_BOUND_CHECK("slots", driver->num_slots, >=, CACHE_SHM_WINDOW);
+	FR_INTEGER_BOUND_CHECK("slots", driver->num_slots, <=, (1 << 24));
+	while (num < driver->num_slots) num <<= 1;
+	driver->num_slots = num;
+
+	FR_INTEGER_BOUND_CHECK("slot_size", driver->slot_size, >=, 128);
+	FR_INTEGER_BOUND_CHECK("slot_size", driver->slot_size, <=, 65536);
+	driver->slot_size = ROUND_UP(driver->slot_size, 64);
+
+	driver->mask = driver->num_slots - 1;
+	driver->data_size = driver->slot_size - sizeof(rlm_cache_shm_slot_t);
+	driver->map_len = sizeof(rlm_cache_shm_header_t) + ((size_t)driver->num_slots * driver->slot_size);
+
+	driver->fd = open(driver->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (driver->fd < 0) {
+		cf_log_err(conf, "Failed opening \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (flock(driver->fd, LOCK_EX) < 0) {
+		cf_log_err(conf, "Failed locking \"%s\": %s", driver->filename, fr_syserror(errno));
+	error:
+		if (driver->map) {
+			munmap(driver->map, driver->map_len);
+			driver->map = NULL;
+		}
+		close(driver->fd);
+		driver->fd = -1;
+		return -1;
+	}
+
+	if (fstat(driver->fd, &st) < 0) {
+		cf_log_err(conf, "Failed checking \"%s\": %s", driver->filename, fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	New file, size it.  The slots are
+	 *	zeroed, which means empty.
+	 */
+	if ((st.st_size == 0) && (ftruncate(driver->fd, driver->map_len) < 0)) {
+		cf_log_err(conf, "Failed sizing \"%s\": %s", driver->filename, fr_syserror(errno));
+		goto error;
+	}
+
+	if ((st.st_size != 0) && ((size_t)st.st_size != driver->map_len)) {
+	mismatch:
+		cf_log_err(conf, "\"%s\" was created with a different 'slots' or 'slot_size'.  "
+			   "Stop all servers using it, and delete it", driver->filename);
+		goto error;
+	}
+
+	driver->map = mmap(NULL, driver->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, driver->fd, 0);
+	if (driver->map == MAP_FAILED) {
+		driver->map = NULL;
+		cf_log_err(conf, "Failed mapping \"%s\": %s", driver->filename, fr_syserror(errno));
+		goto error;
+	}
+
+	header = (rlm_cache_shm_header_t *)driver->map;
+	if (st.st_size == 0) {
+		header->magic = CACHE_SHM_MAGIC;
+		header->version = CACHE_SHM_VERSION;
+		header->num_slots = driver->num_slots;
+		header->slot_size = driver->slot_size;
+	} else if ((header->magic != CACHE_SHM_MAGIC) || (header->version != CACHE_SHM_VERSION) ||
+		   (header->num_slots != driver->num_slots) || (header->slot_size != driver->slot_size)) {
+		goto mismatch;
+	} else {
+		DEBUG("Attached to existing cache in \"%s\"", driver->filename);
+	}
+
+	flock(driver->fd, LOCK_UN);
+
+	return 0;
+}
+
+extern rlm_cache_driver_t rlm_cache_shm;
+rlm_cache_driver_t rlm_cache_shm = {
+	.common = {
+		.magic		= MODULE_MAGIC_INIT,
+		.name		= "cache_shm",
+		.config		= driver_config,
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.inst_size	= sizeof(rlm_cache_shm_t),
+		.inst_type	= "rlm_cache_shm_t",
+	},
+
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire
+};
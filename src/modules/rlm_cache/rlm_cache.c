@@ -33,6 +33,8 @@ RCSID("$Id$")
 #include <freeradius-devel/server/rcode.h>
 #include <freeradius-devel/server/tmpl.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/types.h>
 #include <freeradius-devel/util/value.h>
 #include <freeradius-devel/unlang/xlat_func.h>
@@ -46,18 +48,46 @@ int submodule_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, con
 static int cache_key_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, call_env_ctx_t const *cec, call_env_parser_t const *rule);
 static int cache_update_section_parse(TALLOC_CTX *ctx, call_env_parsed_head_t *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, call_env_ctx_t const *cec, call_env_parser_t const *rule);
 
+static const conf_parser_t l1_config[] = {
+	{ FR_CONF_OFFSET("ttl", rlm_cache_l1_config_t, ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", rlm_cache_l1_config_t, max_entries), .dflt = "1024" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("driver", FR_TYPE_VOID, 0, rlm_cache_t, driver_submodule), .dflt = "rbtree",
 			 .func = submodule_parse },
 	{ FR_CONF_OFFSET("ttl", rlm_cache_config_t, ttl), .dflt = "500s" },
+	{ FR_CONF_OFFSET("stale_if_error", rlm_cache_config_t, stale_if_error), .dflt = "0" },
+	{ FR_CONF_OFFSET("refresh_ahead", rlm_cache_config_t, refresh_ahead), .dflt = "0" },
 	{ FR_CONF_OFFSET("max_entries", rlm_cache_config_t, max_entries), .dflt = "0" },
 
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", rlm_cache_config_t, stats), .dflt = "no" },
+	{ FR_CONF_OFFSET("intern_strings", rlm_cache_config_t, intern_strings), .dflt = "no" },
+
+	{ FR_CONF_OFFSET_SUBSECTION("l1", 0, rlm_cache_t, l1, l1_config) },
 	CONF_PARSER_TERMINATOR
 };
 
+/** A copy of an entry held in a thread's L1
+ *
+ */
+typedef struct {
+	rlm_cache_entry_t	c;			//!< Copy of the entry.  Must come first.
+
+	fr_time_t		l1_expires;		//!< When we must go back to the driver.
+	uint64_t		generation;		//!< Of the key's invalidation counter when the
+							///< entry was retrieved from the driver.
+	fr_dlist_t		entry;			//!< Entry in the thread's LRU list.
+} rlm_cache_l1_entry_t;
+
+typedef struct {
+	fr_hash_table_t		*l1;			//!< Entries this thread has recently retrieved.
+	fr_dlist_head_t		lru;			//!< L1 entries, most recently used first.
+} rlm_cache_thread_t;
+
 typedef struct {
 	fr_value_box_t		*key;			//!< To lookup the cache entry with.
 	map_list_t		*maps;			//!< Attribute map applied to cache entries.
@@ -233,6 +263,209 @@ static void cache_free(rlm_cache_t const *inst, rlm_cache_entry_t **c)
 	*c = NULL;
 }
 
+/** Calculate when a new entry, or an entry with an updated TTL, expires
+ *
+ * Entries are kept by the driver for an extra stale_if_error, so they're still
+ * available if they can't be refreshed.
+ */
+static inline CC_HINT(always_inline)
+fr_unix_time_t cache_expires(rlm_cache_t const *inst, request_t *request, fr_time_delta_t ttl)
+{
+	return fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp),
+				fr_time_delta_add(ttl, inst->config.stale_if_error));
+}
+
+/** Return when an entry stops being fresh
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_unix_time_t cache_fresh_until(rlm_cache_t const *inst, rlm_cache_entry_t const *c)
+{
+	return fr_unix_time_sub(c->expires, inst->config.stale_if_error);
+}
+
+/** Decide whether the current request should refresh an entry before it expires
+ *
+ * Once less than refresh_ahead percent of an entry's lifetime remains, the first
+ * request to find it takes a lease, and is told the entry doesn't exist, so that
+ * it refreshes the entry.  Every other request continues to be served the cached
+ * entry, until the lease runs out when the entry expires.
+ */
+static bool cache_refresh_ahead(rlm_cache_t const *inst, request_t *request,
+				rlm_cache_entry_t const *c, fr_unix_time_t fresh_until)
+{
+	fr_unix_time_t		now = fr_time_to_unix_time(request->packet->timestamp);
+	fr_time_delta_t		lifetime, remaining;
+	_Atomic(uint64_t)	*lease;
+	uint64_t		current;
+
+	if (!inst->config.refresh_ahead) return false;
+
+	lifetime = fr_unix_time_sub(fresh_until, c->created);
+	remaining = fr_unix_time_sub(fresh_until, now);
+	if (fr_time_delta_gt(remaining,
+			     fr_time_delta_wrap((fr_time_delta_unwrap(lifetime) / 100) * inst->config.refresh_ahead))) {
+		return false;
+	}
+
+	lease = &inst->mutable->refresh_lease[fr_value_box_hash(&c->key) & (CACHE_REFRESH_LEASES - 1)];
+	current = atomic_load_explicit(lease, memory_order_relaxed);
+	if (current > fr_unix_time_unwrap(now)) return false;
+
+	return atomic_compare_exchange_strong_explicit(lease, &current, fr_unix_time_unwrap(fresh_until),
+						       memory_order_relaxed, memory_order_relaxed);
+}
+
+static uint32_t cache_l1_hash(void const *data)
+{
+	rlm_cache_entry_t const *c = data;
+
+	return fr_value_box_hash(&c->key);
+}
+
+static int8_t cache_l1_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return fr_value_box_cmp(&a->key, &b->key);
+}
+
+/** Return the invalidation counter for a key
+ *
+ */
+static inline CC_HINT(always_inline)
+_Atomic(uint64_t) *cache_l1_generation(rlm_cache_t const *inst, fr_value_box_t const *key)
+{
+	return &inst->mutable->generation[fr_value_box_hash(key) & (CACHE_L1_GENERATIONS - 1)];
+}
+
+/** Remove an entry from a thread's L1, and free it
+ *
+ */
+static void cache_l1_delete(rlm_cache_thread_t *t, rlm_cache_l1_entry_t *l1)
+{
+	fr_hash_table_remove(t->l1, l1);
+	fr_dlist_remove(&t->lru, l1);
+	talloc_free(l1);
+}
+
+/** Invalidate copies of an entry held in the L1 of every thread
+ *
+ * This must be called after the entry has been altered in the driver, so that a
+ * thread which retrieved the old version concurrently doesn't keep it.
+ */
+static void cache_l1_invalidate(rlm_cache_t const *inst, fr_value_box_t const *key)
+{
+	if (!fr_time_delta_ispos(inst->l1.ttl)) return;
+
+	atomic_fetch_add_explicit(cache_l1_generation(inst, key), 1, memory_order_release);
+}
+
+/** Find an entry in this thread's L1
+ *
+ * No handle is needed, and the driver isn't called.  Entries returned by this function
+ * belong to the L1, and must not be passed to #cache_free, or modified.
+ *
+ * @param[out] generation	The key's invalidation counter.  Must be passed to
+ *				#cache_l1_insert if the entry is then retrieved from the driver.
+ * @param[in] inst		Module instance.
+ * @param[in] t			Thread instance.
+ * @param[in] request		The current request.
+ * @param[in] key		to find.
+ * @return
+ *	- The entry.
+ *	- NULL if the L1 is disabled, or the entry isn't in it.
+ */
+static rlm_cache_entry_t *cache_l1_find(uint64_t *generation, rlm_cache_t const *inst, rlm_cache_thread_t *t,
+					request_t *request, fr_value_box_t const *key)
+{
+	rlm_cache_entry_t	find = {};
+	rlm_cache_l1_entry_t	*l1;
+
+	if (!fr_time_delta_ispos(inst->l1.ttl)) return NULL;
+
+	*generation = atomic_load_explicit(cache_l1_generation(inst, key), memory_order_acquire);
+
+	fr_value_box_copy_shallow(NULL, &find.key, key);
+	l1 = fr_hash_table_find(t->l1, &find);
+	if (!l1) return NULL;
+
+	/*
+	 *	Another thread altered the entry, our copy has
+	 *	exceeded its L1 TTL, or the entry itself expired.
+	 */
+	if ((l1->generation != *generation) ||
+	    fr_time_lt(l1->l1_expires, request->packet->timestamp) ||
+	    fr_unix_time_lt(cache_fresh_until(inst, &l1->c), fr_time_to_unix_time(request->packet->timestamp)) ||
+	    fr_unix_time_lt(l1->c.created, fr_unix_time_from_sec(inst->config.epoch))) {
+		cache_l1_delete(t, l1);
+		return NULL;
+	}
+
+	RDEBUG2("Found entry for \"%pV\" in L1", key);
+
+	fr_dlist_remove(&t->lru, l1);
+	fr_dlist_insert_head(&t->lru, l1);
+	l1->c.hits++;
+
+	return &l1->c;
+}
+
+/** Copy an entry retrieved from the driver into this thread's L1
+ *
+ * @param[in] inst		Module instance.
+ * @param[in] t			Thread instance.
+ * @param[in] request		The current request.
+ * @param[in] c			Entry retrieved from the driver.
+ * @param[in] generation	As returned by #cache_l1_find, before the driver was called.
+ */
+static void cache_l1_insert(rlm_cache_t const *inst, rlm_cache_thread_t *t, request_t *request,
+			    rlm_cache_entry_t const *c, uint64_t generation)
+{
+	rlm_cache_l1_entry_t	*l1, *old;
+	map_t const		*map = NULL;
+	map_t			*c_map;
+
+	if (!fr_time_delta_ispos(inst->l1.ttl)) return;
+
+	old = fr_hash_table_find(t->l1, c);
+	if (old) cache_l1_delete(t, old);
+
+	if ((inst->l1.max_entries > 0) && (fr_hash_table_num_elements(t->l1) >= inst->l1.max_entries)) {
+		cache_l1_delete(t, fr_dlist_tail(&t->lru));
+	}
+
+	MEM(l1 = talloc_zero(t->l1, rlm_cache_l1_entry_t));
+	if (unlikely(fr_value_box_copy(l1, &l1->c.key, &c->key) < 0)) {
+	error:
+		talloc_free(l1);
+		return;
+	}
+	l1->c.hits = c->hits;
+	l1->c.created = c->created;
+	l1->c.expires = c->expires;
+	map_list_init(&l1->c.maps);
+
+	while ((map = map_list_next(&c->maps, map))) {
+		MEM(c_map = talloc_zero(l1, map_t));
+		c_map->op = map->op;
+		map_list_init(&c_map->child);
+
+		if (unlikely(!(c_map->lhs = tmpl_copy(c_map, map->lhs)))) goto error;
+
+		MEM(c_map->rhs = tmpl_alloc(c_map, TMPL_TYPE_DATA, map->rhs->quote, map->rhs->name, map->rhs->len));
+		if (unlikely(fr_value_box_copy(c_map->rhs, tmpl_value(c_map->rhs), tmpl_value(map->rhs)) < 0)) goto error;
+
+		map_list_insert_tail(&l1->c.maps, c_map);
+	}
+
+	l1->l1_expires = fr_time_add(request->packet->timestamp, inst->l1.ttl);
+	l1->generation = generation;
+
+	if (unlikely(!fr_hash_table_insert(t->l1, l1))) goto error;
+	fr_dlist_insert_head(&t->lru, l1);
+}
+
 /** Merge a cached entry into a #request_t
  *
  * @return
@@ -280,21 +513,28 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 }
 
 /** Find a cached entry.
+ *
+ * If the caller is going to refresh the entry on a cache miss, it should pass
+ * stale.  Entries which are stale, or which should be refreshed ahead of their
+ * expiry, are then reported as a cache miss, but written to stale, so they
+ * can be used if the entry can't be refreshed.
  *
  * @return
  *	- #RLM_MODULE_OK on cache hit.
  *	- #RLM_MODULE_FAIL on failure.
  *	- #RLM_MODULE_NOTFOUND on cache miss.
  */
-static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out,
+static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out, rlm_cache_entry_t **stale,
 				  rlm_cache_t const *inst, request_t *request,
 				  rlm_cache_handle_t **handle, fr_value_box_t const *key)
 {
 	cache_status_t ret;
 
 	rlm_cache_entry_t *c;
+	fr_unix_time_t fresh_until;
 
 	*out = NULL;
+	if (stale) *stale = NULL;
 
 	for (;;) {
 		ret = inst->driver->find(&c, &inst->config, inst->driver_submodule->data, request, *handle, key);
@@ -341,6 +581,32 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 			key);
 		goto expired;
 	}
+
+	/*
+	 *	Past its TTL, but kept around in case it can't
+	 *	be refreshed.
+	 */
+	fresh_until = cache_fresh_until(inst, c);
+	if (fr_unix_time_lt(fresh_until, fr_time_to_unix_time(request->packet->timestamp))) {
+		RDEBUG2("Found entry for \"%pV\", but it went stale %pV ago",
+			key,
+			fr_box_time_delta(fr_unix_time_sub(fr_time_to_unix_time(request->packet->timestamp), fresh_until)));
+
+	refresh:
+		if (stale) {
+			*stale = c;
+		} else {
+			cache_free(inst, &c);
+		}
+		RETURN_MODULE_NOTFOUND;
+	}
+
+	if (stale && cache_refresh_ahead(inst, request, c, fresh_until)) {
+		RDEBUG2("Found entry for \"%pV\", but it expires in %pV.  Refreshing it",
+			key,
+			fr_box_time_delta(fr_unix_time_sub(fresh_until, fr_time_to_unix_time(request->packet->timestamp))));
+		goto refresh;
+	}
 	RDEBUG2("Found entry for \"%pV\"", key);
 
 	c->hits++;
@@ -370,6 +636,7 @@ static unlang_action_t cache_expire(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 
 	case CACHE_OK:
+		cache_l1_invalidate(inst, key);
 		RETURN_MODULE_OK;
 
 	case CACHE_MISS:
@@ -417,8 +684,8 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 	/*
 	 *	All in NSEC resolution
 	 */
-	c->created = c->expires = fr_time_to_unix_time(request->packet->timestamp);
-	c->expires = fr_unix_time_add(c->expires, ttl);
+	c->created = fr_time_to_unix_time(request->packet->timestamp);
+	c->expires = cache_expires(inst, request, ttl);
 
 	RDEBUG2("Creating new cache entry");
 
@@ -511,6 +778,7 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 					talloc_free(c);
 					RETURN_MODULE_FAIL;
 				}
+				if (inst->config.intern_strings) fr_value_box_intern(tmpl_value(c_map->rhs));
 			}
 				break;
 
@@ -524,6 +792,17 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 	}
 	talloc_free(pool);
 
+	/*
+	 *	If nothing could be cached, the data source is probably
+	 *	unavailable.  Don't replace an entry we may want to
+	 *	serve stale.
+	 */
+	if (fr_time_delta_ispos(inst->config.stale_if_error) && map_list_empty(&c->maps)) {
+		RWDEBUG("No attributes could be cached, not creating entry");
+		talloc_free(c);
+		RETURN_MODULE_FAIL;
+	}
+
 skip_maps:
 
 	/*
@@ -545,6 +824,7 @@ skip_maps:
 
 		case CACHE_OK:
 			RDEBUG2("Committed entry, TTL %pV seconds", fr_box_time_delta(ttl));
+			cache_l1_invalidate(inst, key);
 			cache_free(inst, &c);
 			RETURN_MODULE_RCODE(merge ? RLM_MODULE_UPDATED : RLM_MODULE_OK);
 
@@ -579,6 +859,7 @@ static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
 
 		case CACHE_OK:
 			RDEBUG2("Updated entry TTL");
+			cache_l1_invalidate(inst, &c->key);
 			RETURN_MODULE_OK;
 
 		default:
@@ -601,6 +882,7 @@ static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
 
 		case CACHE_OK:
 			RDEBUG2("Updated entry TTL");
+			cache_l1_invalidate(inst, &c->key);
 			RETURN_MODULE_OK;
 
 		default:
@@ -619,11 +901,13 @@ static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
  */
 static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_cache_entry_t	*c = NULL;
+	rlm_cache_entry_t	*c = NULL, *stale = NULL;
 	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 
-	rlm_cache_handle_t	*handle;
+	rlm_cache_handle_t	*handle = NULL;
+	uint64_t		generation = 0;
 
 	fr_dcursor_t		cursor;
 	fr_pair_t		*vp;
@@ -650,11 +934,16 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		RDEBUG3("status-only: yes");
 		REXDENT();
 
+		if (cache_l1_find(&generation, inst, t, request, env->key)) {
+			rcode = RLM_MODULE_OK;
+			goto finish;
+		}
+
 		if (cache_acquire(&handle, inst, request) < 0) {
 			RETURN_MODULE_FAIL;
 		}
 
-		cache_find(&rcode, &c, inst, request, &handle, env->key);
+		cache_find(&rcode, &c, NULL, inst, request, &handle, env->key);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 		fr_assert(!inst->driver->acquire || handle);
 
@@ -692,6 +981,21 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	RDEBUG3("expire : %s", expire ? "yes" : "no");
 	RDEBUG3("ttl    : %pV", fr_box_time_delta(ttl));
 	REXDENT();
+
+	/*
+	 *	If we're only reading the entry, a copy in
+	 *	this thread's L1 will do.
+	 */
+	if (merge && !expire && !set_ttl) {
+		rlm_cache_entry_t *l1;
+
+		l1 = cache_l1_find(&generation, inst, t, request, env->key);
+		if (l1) {
+			rcode = cache_merge(inst, request, l1);
+			goto finish;
+		}
+	}
+
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_MODULE_FAIL;
 	}
@@ -701,13 +1005,19 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	 *	recording whether the entry existed.
 	 */
 	if (merge) {
-		cache_find(&rcode, &c, inst, request, &handle, env->key);
+		/*
+		 *	If we're going to insert on a miss, we can
+		 *	refresh stale entries.
+		 */
+		cache_find(&rcode, &c, (insert && !expire && !set_ttl) ? &stale : NULL,
+			   inst, request, &handle, env->key);
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 			goto finish;
 
 		case RLM_MODULE_OK:
 			rcode = cache_merge(inst, request, c);
+			if (!expire && !set_ttl) cache_l1_insert(inst, t, request, c, generation);
 			exists = 1;
 			break;
 
@@ -766,7 +1076,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	if ((exists < 0) && (insert || set_ttl)) {
 		rlm_rcode_t tmp;
 
-		cache_find(&tmp, &c, inst, request, &handle, env->key);
+		cache_find(&tmp, &c, NULL, inst, request, &handle, env->key);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -795,7 +1105,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 		fr_assert(c);
 
-		c->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
+		c->expires = cache_expires(inst, request, ttl);
 
 		cache_set_ttl(&tmp, inst, request, &handle, c);
 		switch (tmp) {
@@ -825,6 +1135,11 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		cache_insert(&tmp, inst, request, &handle, env->key, env->maps, ttl);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
+			if (stale) {
+				RWDEBUG("Failed refreshing entry, using the stale entry");
+				rcode = cache_merge(inst, request, stale);
+				goto finish;
+			}
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 
@@ -846,6 +1161,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 finish:
 	cache_free(inst, &c);
+	cache_free(inst, &stale);
 	cache_release(inst, request, &handle);
 
 	/*
@@ -891,8 +1207,11 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 {
 	rlm_cache_entry_t 		*c = NULL;
 	rlm_cache_t			*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t		*t = talloc_get_type_abort(xctx->mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t		*env = talloc_get_type_abort(xctx->env_data, cache_call_env_t);
 	rlm_cache_handle_t		*handle = NULL;
+	rlm_cache_entry_t		*l1;
+	uint64_t			generation = 0;
 
 	ssize_t				slen;
 
@@ -918,12 +1237,15 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
+	l1 = cache_l1_find(&generation, inst, t, request, env->key);
+	if (l1) goto found;
+
 	if (cache_acquire(&handle, inst, request) < 0) {
 		talloc_free(target);
 		return XLAT_ACTION_FAIL;
 	}
 
-	cache_find(&rcode, &c, inst, request, &handle, env->key);
+	cache_find(&rcode, &c, NULL, inst, request, &handle, env->key);
 	switch (rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -934,7 +1256,11 @@ xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
-	while ((map = map_list_next(&c->maps, map))) {
+	cache_l1_insert(inst, t, request, c, generation);
+	l1 = c;
+
+found:
+	while ((map = map_list_next(&l1->maps, map))) {
 		if ((tmpl_attr_tail_da(map->lhs) != tmpl_attr_tail_da(target)) ||
 		    (tmpl_list(map->lhs) != tmpl_list(target))) continue;
 
@@ -975,7 +1301,7 @@ static xlat_action_t cache_ttl_get_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
-	cache_find(&rcode, &c, inst, request, &handle, env->key);
+	cache_find(&rcode, &c, NULL, inst, request, &handle, env->key);
 	switch (rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -986,7 +1312,7 @@ static xlat_action_t cache_ttl_get_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	}
 
 	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_TIME_DELTA, NULL));
-	vb->vb_time_delta = fr_unix_time_sub(c->expires, fr_time_to_unix_time(request->packet->timestamp));
+	vb->vb_time_delta = fr_unix_time_sub(cache_fresh_until(inst, c), fr_time_to_unix_time(request->packet->timestamp));
 	fr_dcursor_append(out, vb);
 
 	cache_free(inst, &c);
@@ -1044,16 +1370,23 @@ static void cache_unref(request_t *request, rlm_cache_t const *inst, rlm_cache_e
 static unlang_action_t CC_HINT(nonnull) mod_method_status(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	rlm_cache_entry_t 	*entry = NULL;
 	rlm_cache_handle_t 	*handle = NULL;
+	uint64_t		generation = 0;
 
 	if (env->key->vb_length == 0) {
 		REDEBUG("Zero length key string is invalid");
 		RETURN_MODULE_FAIL;
 	}
 
+	if (cache_l1_find(&generation, inst, t, request, env->key)) {
+		rcode = RLM_MODULE_OK;
+		goto finish;
+	}
+
 	/* Good to go? */
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_MODULE_FAIL;
@@ -1061,7 +1394,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_status(rlm_rcode_t *p_result,
 
 	fr_assert(!inst->driver->acquire || handle);
 
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find(&rcode, &entry, NULL, inst, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	rcode = (entry) ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
@@ -1082,22 +1415,31 @@ finish:
 static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 	cache_call_env_t	*env = talloc_get_type_abort(mctx->env_data, cache_call_env_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 	rlm_cache_entry_t 	*entry = NULL;
+	rlm_cache_entry_t	*l1;
 	rlm_cache_handle_t 	*handle = NULL;
+	uint64_t		generation = 0;
 
 	if (env->key->vb_length == 0) {
 		REDEBUG("Zero length key string is invalid");
 		RETURN_MODULE_FAIL;
 	}
 
+	l1 = cache_l1_find(&generation, inst, t, request, env->key);
+	if (l1) {
+		rcode = cache_merge(inst, request, l1);
+		goto finish;
+	}
+
 	/* Good to go? */
 	if (cache_acquire(&handle, inst, request) < 0) {
 		RETURN_MODULE_FAIL;
 	}
 
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find(&rcode, &entry, NULL, inst, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (!entry) {
@@ -1107,6 +1449,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, m
 	}
 
 	rcode = cache_merge(inst, request, entry);
+	cache_l1_insert(inst, t, request, entry, generation);
 
 finish:
 	cache_unref(request, inst, entry, handle);
@@ -1161,7 +1504,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result,
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find(&rcode, &entry, NULL, inst, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (rcode == RLM_MODULE_OK) {
@@ -1169,7 +1512,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_update(rlm_rcode_t *p_result,
 
 		DEBUG3("Updating the TTL -> %pV", fr_box_time_delta(ttl));
 
-		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
+		entry->expires = cache_expires(inst, request, ttl);
 
 		cache_set_ttl(&rcode, inst, request, &handle, entry);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
@@ -1240,7 +1583,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find(&rcode, &entry, NULL, inst, request, &handle, env->key);
 	switch (rcode) {
 	default:
 	case RLM_MODULE_OK:
@@ -1296,7 +1639,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_clear(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find(&rcode, &entry, NULL, inst, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (!entry) {
@@ -1359,7 +1702,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, mo
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(&rcode, &entry, inst, request, &handle, env->key);
+	cache_find(&rcode, &entry, NULL, inst, request, &handle, env->key);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (rcode == RLM_MODULE_OK) {
@@ -1367,7 +1710,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, mo
 
 		DEBUG3("Updating the TTL -> %pV", fr_box_time_delta(ttl));
 
-		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
+		entry->expires = cache_expires(inst, request, ttl);
 
 		cache_set_ttl(&rcode, inst, request, &handle, entry);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
@@ -1388,6 +1731,8 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_cache_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_cache_t);
 
+	TALLOC_FREE(inst->mutable);
+
 	/*
 	 *	We need to explicitly free all children, so if the driver
 	 *	parented any memory off the instance, their destructors
@@ -1473,6 +1818,37 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (inst->config.refresh_ahead >= 100) {
+		cf_log_err(conf, "'refresh_ahead' must be less than 100");
+		return -1;
+	}
+
+	/*
+	 *	The counters are written by every thread, so they
+	 *	can't live in the (read only) instance data.
+	 */
+	MEM(inst->mutable = talloc_zero(NULL, rlm_cache_mutable_t));
+
+	return 0;
+}
+
+/** Allocate this thread's L1
+ *
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
+
+	if (!fr_time_delta_ispos(inst->l1.ttl)) return 0;
+
+	t->l1 = fr_hash_table_alloc(t, cache_l1_hash, cache_l1_cmp, NULL);
+	if (!t->l1) {
+		PERROR("Failed creating L1 cache");
+		return -1;
+	}
+	fr_dlist_talloc_init(&t->lru, rlm_cache_l1_entry_t, entry);
+
 	return 0;
 }
 
@@ -1513,7 +1889,10 @@ module_rlm_t rlm_cache = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+		.thread_inst_size	= sizeof(rlm_cache_thread_t),
+		.thread_inst_type	= "rlm_cache_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
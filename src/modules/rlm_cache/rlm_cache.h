@@ -30,6 +30,12 @@ RCSIDH(cache_h, "$Id$")
 #include <freeradius-devel/server/map.h>
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 typedef struct rlm_cache_driver_s rlm_cache_driver_t;
 
 typedef void rlm_cache_handle_t;
@@ -50,11 +56,47 @@ typedef enum {
  */
 typedef struct {
 	fr_time_delta_t		ttl;			//!< How long an entry is valid for.
+	fr_time_delta_t		stale_if_error;		//!< How long an entry is kept after it has expired,
+							///< to be used if it can't be refreshed.
+	uint32_t		refresh_ahead;		//!< Percentage of an entry's lifetime remaining
+							///< when it is refreshed.
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+	bool			intern_strings;		//!< Share string values between entries.
 } rlm_cache_config_t;
 
+/** Configuration for the per-thread L1 cache
+ *
+ */
+typedef struct {
+	fr_time_delta_t		ttl;			//!< How long a thread may serve an entry from its L1
+							///< without going back to the driver.  0 disables the L1.
+	uint32_t		max_entries;		//!< Maximum entries in each thread's L1.
+} rlm_cache_l1_config_t;
+
+/** Number of invalidation counters shared between the L1 caches
+ *
+ * Keys are hashed onto one of these.  Bumping a counter invalidates every L1 copy of
+ * every key which hashes onto it.
+ */
+#define CACHE_L1_GENERATIONS	1024
+
+/** Number of refresh leases
+ *
+ * Keys are hashed onto one of these.  Only one request at a time may refresh the
+ * entries for keys which hash onto a lease.
+ */
+#define CACHE_REFRESH_LEASES	1024
+
+/** Mutable instance data, shared by all threads
+ *
+ */
+typedef struct {
+	_Atomic(uint64_t)	generation[CACHE_L1_GENERATIONS];	//!< Bumped whenever an entry is altered.
+	_Atomic(uint64_t)	refresh_lease[CACHE_REFRESH_LEASES];	//!< When the current refresh lease expires.
+} rlm_cache_mutable_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -67,6 +109,9 @@ typedef struct {
 
 	module_instance_t	*driver_submodule;	//!< Driver's instance data.
 	rlm_cache_driver_t const *driver;		//!< Driver's exported interface.
+
+	rlm_cache_l1_config_t	l1;			//!< Per-thread L1 configuration.
+	rlm_cache_mutable_t	*mutable;		//!< L1 invalidation counters.
 } rlm_cache_t;
 
 typedef struct {
@@ -28,6 +28,15 @@ RCSID("$Id$")
 #include "rlm_cache.h"
 #include "serialize.h"
 
+#include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/util/dbuff.h>
+
+fr_table_num_sorted_t const cache_serialize_format_table[] = {
+	{ L("binary"),	CACHE_SERIALIZE_BINARY	},
+	{ L("text"),	CACHE_SERIALIZE_TEXT	}
+};
+size_t cache_serialize_format_table_len = NUM_ELEMENTS(cache_serialize_format_table);
+
 /** Serialize a cache entry as a humanly readable string
  *
  * @param ctx to alloc new string in. Should be a talloc pool a little bigger
@@ -89,7 +98,181 @@ finish:
 	return 0;
 }
 
+/** Serialize a cache entry in binary form
+ *
+ * The format is:
+ *
+ @verbatim
+   magic (1) | version (1) | created (8) | expires (8) | num maps (4)
+   { op (1) | name len (1) | attribute name | type (1) | value len (4) | value }...
+ @endverbatim
+ *
+ * All integers are in network order.  Values are in the same format as they
+ * are on the wire, so decoding them is a copy, not a parse.
+ *
+ * @param[in] ctx	to allocate the buffer in.
+ * @param[out] out	Where to write a pointer to the serialized entry.
+ * @param[in] c		Cache entry to serialize.
+ * @return
+ *	- The length of the serialized entry on success.
+ *	- -1 on failure.
+ */
+ssize_t cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	char			attr[256];	/* Attr name buffer */
+	map_t			*map = NULL;
+
+	if (!fr_dbuff_init_talloc(ctx, &dbuff, &tctx, 256, SIZE_MAX)) return -1;
+
+	if ((fr_dbuff_in_bytes(&dbuff, CACHE_SERIALIZE_BINARY_MAGIC, CACHE_SERIALIZE_BINARY_VERSION) <= 0) ||
+	    (fr_dbuff_in(&dbuff, fr_unix_time_unwrap(c->created)) <= 0) ||
+	    (fr_dbuff_in(&dbuff, fr_unix_time_unwrap(c->expires)) <= 0) ||
+	    (fr_dbuff_in(&dbuff, (uint32_t)map_list_num_elements(&c->maps)) <= 0)) {
+	oom:
+		fr_strerror_const("Out of memory");
+	error:
+		talloc_free(fr_dbuff_buff(&dbuff));
+		return -1;
+	}
+
+	while ((map = map_list_next(&c->maps, map))) {
+		fr_value_box_t const	*vb = tmpl_value(map->rhs);
+		ssize_t			slen;
+
+		slen = tmpl_print(&FR_SBUFF_OUT(attr, sizeof(attr)), map->lhs, TMPL_ATTR_REF_PREFIX_NO, NULL);
+		if (slen < 0) {
+			fr_strerror_printf("Serialized attribute too long.  Must be < " STRINGIFY(sizeof(attr)) " "
+					   "bytes, needed %zu additional bytes", (size_t)(slen * -1));
+			goto error;
+		}
+
+		if ((fr_dbuff_in(&dbuff, (uint8_t)map->op) <= 0) ||
+		    (fr_dbuff_in(&dbuff, (uint8_t)slen) <= 0) ||
+		    (fr_dbuff_in_memcpy(&dbuff, attr, slen) < 0) ||
+		    (fr_dbuff_in(&dbuff, (uint8_t)vb->type) <= 0) ||
+		    (fr_dbuff_in(&dbuff, (uint32_t)fr_value_box_network_length(vb)) <= 0)) goto oom;
+
+		if (fr_value_box_to_network(&dbuff, vb) < 0) {
+			fr_strerror_printf_push("Failed serializing value for %s", attr);
+			goto error;
+		}
+	}
+
+	*out = fr_dbuff_buff(&dbuff);
+
+	return fr_dbuff_used(&dbuff);
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param[in] c		Cache entry to populate (should already be allocated)
+ * @param[in] dict	to use for unqualified attributes.
+ * @param[in] in	Binary representation of cache entry.
+ * @param[in] inlen	Length of the binary data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(in, inlen);
+	uint8_t		magic, version;
+	uint64_t	created, expires;
+	uint32_t	num, i;
+	tmpl_rules_t	parse_rules = {
+				.attr = {
+					.dict_def = dict,
+					.list_def = request_attr_request,
+					.prefix = TMPL_ATTR_REF_PREFIX_NO
+				}
+			};
+
+	if ((fr_dbuff_out(&magic, &dbuff) <= 0) || (fr_dbuff_out(&version, &dbuff) <= 0)) goto truncated;
+
+	if (magic != CACHE_SERIALIZE_BINARY_MAGIC) {
+		fr_strerror_const("Entry is not in binary format");
+		return -1;
+	}
+
+	if (version != CACHE_SERIALIZE_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported binary format version %u", version);
+		return -1;
+	}
+
+	if ((fr_dbuff_out(&created, &dbuff) <= 0) ||
+	    (fr_dbuff_out(&expires, &dbuff) <= 0) ||
+	    (fr_dbuff_out(&num, &dbuff) <= 0)) {
+	truncated:
+		fr_strerror_const("Serialized entry is truncated");
+		return -1;
+	}
+
+	c->created = fr_unix_time_wrap(created);
+	c->expires = fr_unix_time_wrap(expires);
+
+	for (i = 0; i < num; i++) {
+		map_t			*map;
+		fr_dict_attr_t const	*da;
+		char			attr[256];
+		uint8_t			op, name_len, type;
+		uint32_t		value_len;
+
+		if ((fr_dbuff_out(&op, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&name_len, &dbuff) <= 0) ||
+		    (fr_dbuff_out_memcpy((uint8_t *)attr, &dbuff, name_len) < 0) ||
+		    (fr_dbuff_out(&type, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&value_len, &dbuff) <= 0) ||
+		    (fr_dbuff_remaining(&dbuff) < value_len)) goto truncated;
+		attr[name_len] = '\0';
+
+		MEM(map = talloc_zero(c, map_t));
+		map->op = op;
+		map_list_init(&map->child);
+
+		if (tmpl_afrom_attr_str(map, NULL, &map->lhs, attr, &parse_rules) <= 0) {
+			fr_strerror_printf_push("Failed parsing attribute \"%s\"", attr);
+		error:
+			talloc_free(map);
+			return -1;
+		}
+
+		if (!tmpl_is_attr(map->lhs)) {
+			fr_strerror_printf("Attribute \"%s\" parsed as %s, needed attribute.  "
+					   "Check local dictionaries", attr, tmpl_type_to_str(map->lhs->type));
+			goto error;
+		}
+
+		da = tmpl_attr_tail_da(map->lhs);
+		if (da->type != type) {
+			fr_strerror_printf("Attribute \"%s\" is type %s, but serialized value is type %s.  "
+					   "Check local dictionaries", attr, fr_type_to_str(da->type),
+					   fr_type_to_str(type));
+			goto error;
+		}
+
+		MEM(map->rhs = tmpl_alloc(map, TMPL_TYPE_DATA, T_BARE_WORD, "", 0));
+		if (fr_value_box_from_network(map->rhs, tmpl_value(map->rhs), da->type, da,
+					      &FR_DBUFF_TMP(fr_dbuff_current(&dbuff), value_len),
+					      value_len, false) < 0) {
+			fr_strerror_printf_push("Failed decoding value for \"%s\"", attr);
+			goto error;
+		}
+		fr_dbuff_advance(&dbuff, value_len);
+
+		MAP_VERIFY(map);
+
+		map_list_insert_tail(&c->maps, map);
+	}
+
+	return 0;
+}
+
 /** Converts a serialized cache entry back into a structure
+ *
+ * Entries in binary format are detected by their first byte, and
+ * passed to #cache_deserialize_binary.
  *
  * @param[in] c		Cache entry to populate (should already be allocated)
  * @param[in] dict	to use for unqualified attributes.
@@ -104,6 +287,15 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 {
 	char		*p, *q;
 
+	if ((inlen > 0) && (in[0] == CACHE_SERIALIZE_BINARY_MAGIC)) {
+		return cache_deserialize_binary(c, dict, (uint8_t const *)in, (size_t)inlen);
+	}
+
+	if ((inlen > 0) && (in[0] == CACHE_SERIALIZE_COMPRESSED_MAGIC)) {
+		fr_strerror_const("Entry is compressed, but no 'compress' module is configured");
+		return -1;
+	}
+
 	if (inlen < 0) inlen = strlen(in);
 
 	p = in;
@@ -178,3 +370,105 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 
 	return 0;
 }
+
+/** Find the rlm_brotli instance used to compress entries
+ *
+ * @param[out] out	Where to write the codec of the instance.
+ * @param[in] cs	to log errors against.
+ * @param[in] name	of the rlm_brotli instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the instance doesn't exist, or isn't an rlm_brotli instance.
+ */
+int cache_codec_find(rlm_brotli_codec_t const **out, CONF_SECTION *cs, char const *name)
+{
+	module_instance_t const	*mi;
+
+	mi = module_rlm_static_by_name(NULL, name);
+	if (!mi) {
+		cf_log_err(cs, "No module named \"%s\"", name);
+		return -1;
+	}
+
+	if (strcmp(talloc_get_name(mi->data), "rlm_brotli_t") != 0) {
+		cf_log_err(cs, "Module \"%s\" is not an instance of 'rlm_brotli'", name);
+		return -1;
+	}
+
+	*out = (rlm_brotli_codec_t const *)mi->data;
+
+	return 0;
+}
+
+/** Serialize a cache entry in binary form, and compress it
+ *
+ * The format is:
+ *
+ @verbatim
+   magic (1) | brotli compressed binary serialized entry
+ @endverbatim
+ *
+ * @param[in] ctx	to allocate the buffer in.
+ * @param[out] out	Where to write a pointer to the compressed entry.
+ * @param[in] c		Cache entry to serialize.
+ * @param[in] codec	to compress the entry with.
+ * @return
+ *	- The length of the compressed entry on success.
+ *	- -1 on failure.
+ */
+ssize_t cache_serialize_compressed(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c,
+				   rlm_brotli_codec_t const *codec)
+{
+	uint8_t		*binary, *compressed, *buff;
+	ssize_t		slen;
+
+	slen = cache_serialize_binary(ctx, &binary, c);
+	if (slen < 0) return -1;
+
+	slen = codec->compress(ctx, &compressed, codec, binary, slen);
+	talloc_free(binary);
+	if (slen < 0) return -1;
+
+	MEM(buff = talloc_array(ctx, uint8_t, slen + 1));
+	buff[0] = CACHE_SERIALIZE_COMPRESSED_MAGIC;
+	memcpy(buff + 1, compressed, slen);
+	talloc_free(compressed);
+
+	*out = buff;
+
+	return slen + 1;
+}
+
+/** Decompress and deserialize a cache entry
+ *
+ * Entries which aren't compressed are deserialized as they are, so
+ * entries written before compression was enabled can still be read.
+ *
+ * @param[in] c		Cache entry to populate (should already be allocated)
+ * @param[in] dict	to use for unqualified attributes.
+ * @param[in] in	Compressed cache entry.
+ * @param[in] inlen	Length of the compressed data.
+ * @param[in] codec	to decompress the entry with.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_compressed(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen,
+				 rlm_brotli_codec_t const *codec)
+{
+	uint8_t		*binary;
+	ssize_t		slen;
+	int		ret;
+
+	if ((inlen == 0) || (in[0] != CACHE_SERIALIZE_COMPRESSED_MAGIC)) {
+		return cache_deserialize_binary(c, dict, in, inlen);
+	}
+
+	slen = codec->decompress(NULL, &binary, codec, in + 1, inlen - 1);
+	if (slen < 0) return -1;
+
+	ret = cache_deserialize_binary(c, dict, binary, slen);
+	talloc_free(binary);
+
+	return ret;
+}
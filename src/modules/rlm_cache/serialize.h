@@ -26,5 +26,43 @@
  */
 RCSIDH(serialize_h, "$Id$")
 
+#include "../rlm_brotli/rlm_brotli.h"
+
+/** Formats cache entries can be serialized in
+ *
+ */
+typedef enum {
+	CACHE_SERIALIZE_TEXT = 0,			//!< One "attr op value" line per map.
+	CACHE_SERIALIZE_BINARY				//!< Versioned binary format.
+} cache_serialize_format_t;
+
+/** First byte of a binary serialized entry
+ *
+ * Can never be the first byte of a text serialized entry.
+ */
+#define CACHE_SERIALIZE_BINARY_MAGIC	0x00
+
+/** Version of the binary format we produce
+ *
+ */
+#define CACHE_SERIALIZE_BINARY_VERSION	0x01
+
+/** First byte of a compressed entry
+ *
+ * Followed by a brotli compressed binary serialized entry.
+ */
+#define CACHE_SERIALIZE_COMPRESSED_MAGIC	0x01
+
+extern fr_table_num_sorted_t const cache_serialize_format_table[];
+extern size_t cache_serialize_format_table_len;
+
 int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c);
+ssize_t cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c);
 int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssize_t inlen);
+int cache_deserialize_binary(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen);
+
+int cache_codec_find(rlm_brotli_codec_t const **out, CONF_SECTION *cs, char const *name);
+ssize_t cache_serialize_compressed(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c,
+				   rlm_brotli_codec_t const *codec);
+int cache_deserialize_compressed(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen,
+				 rlm_brotli_codec_t const *codec);
@@ -364,6 +364,65 @@ lcb_error_t couchbase_get_key(lcb_t instance, const void *cookie, const char *ke
 	return error;
 }
 
+/** Retrieve multiple documents by key from Couchbase
+ *
+ * Schedule a Couchbase get request for each key, and then wait for all of the
+ * results at once.  This takes one round trip instead of one per key.
+ *
+ * @param  instance Couchbase connection instance.
+ * @param  cookies  Array of cookies, one for each key.  The result for keys[i] is in cookies[i].
+ * @param  keys     Document keys to fetch.
+ * @param  num      Number of keys.
+ * @return          Couchbase error object.
+ */
+lcb_error_t couchbase_get_keys(lcb_t instance, cookie_t *cookies, char const * const *keys, size_t num)
+{
+	lcb_error_t error = LCB_SUCCESS;     /* couchbase command return */
+	lcb_get_cmd_t cmd;                   /* get command struct */
+	const lcb_get_cmd_t *commands[1];    /* get commands array */
+	size_t i, scheduled;                 /* key counters */
+
+	/* init commands */
+	commands[0] = &cmd;
+
+	for (i = 0; i < num; i++) {
+		/* clear cookie */
+		memset(&cookies[i], 0, sizeof(cookie_t));
+
+		/* init tokener error */
+		cookies[i].jerr = json_tokener_success;
+
+		/* create token */
+		cookies[i].jtok = json_tokener_new();
+	}
+
+	/* schedule the gets, each with its own cookie */
+	for (scheduled = 0; scheduled < num; scheduled++) {
+		memset(&cmd, 0, sizeof(cmd));
+
+		/* populate command struct */
+		cmd.v.v0.key = keys[scheduled];
+		cmd.v.v0.nkey = strlen(cmd.v.v0.key);
+
+		/* debugging */
+		DEBUG3("fetching document %s", keys[scheduled]);
+
+		if ((error = lcb_get(instance, &cookies[scheduled], 1, commands)) != LCB_SUCCESS) break;
+	}
+
+	/* enter event loop for everything which was scheduled, even on error */
+	if (scheduled > 0) lcb_wait(instance);
+
+	/* free tokens */
+	for (i = 0; i < num; i++) {
+		json_tokener_free(cookies[i].jtok);
+		cookies[i].jtok = NULL;
+	}
+
+	/* return error */
+	return error;
+}
+
 /** Query a Couchbase design document view
  *
  * Setup and execute a Couchbase view request and wait for the result.
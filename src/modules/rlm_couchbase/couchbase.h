@@ -103,5 +103,8 @@ lcb_error_t couchbase_set_key(lcb_t instance, const char *key, const char *docum
 /* pull document from couchbase by key */
 lcb_error_t couchbase_get_key(lcb_t instance, const void *cookie, const char *key);
 
+/* pull multiple documents from couchbase by key, with one wait */
+lcb_error_t couchbase_get_keys(lcb_t instance, cookie_t *cookies, char const * const *keys, size_t num);
+
 /* query a couchbase view via http */
 lcb_error_t couchbase_query_view(lcb_t instance, const void *cookie, const char *path, const char *post);
@@ -688,6 +688,11 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
 	return 0;
 }
 
+/** The maximum number of client documents to fetch at once
+ *
+ */
+#define CLIENT_BATCH_SIZE	(64)
+
 /** Load client entries from Couchbase client documents on startup
  *
  * This function executes the view defined in the module configuration and loops
@@ -696,6 +701,9 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
  * rebuild on this design document in Couchbase.  However, since this function is only
  * run once at server startup this should not be a concern.
  *
+ * The client documents are fetched in batches of #CLIENT_BATCH_SIZE, with one
+ * wait per batch, instead of one round trip per client.
+ *
  * @param  inst The module instance.
  * @param  tmpl Default values for new clients.
  * @param  map  The client attribute configuration list.
@@ -706,9 +714,13 @@ static int _get_client_value(char **out, CONF_PAIR const *cp, void *data)
 int mod_load_client_documents(rlm_couchbase_t *inst, CONF_SECTION *tmpl, CONF_SECTION *map)
 {
 	rlm_couchbase_handle_t *handle = NULL; /* connection pool handle */
-	char vpath[256], vid[MAX_KEY_SIZE], vkey[MAX_KEY_SIZE];  /* view path and fields */
+	char vpath[256];                                         /* view path */
+	char const *vids[CLIENT_BATCH_SIZE];                     /* document ids in the current batch */
+	char const *vkeys[CLIENT_BATCH_SIZE];                    /* client names in the current batch */
+	cookie_t docs[CLIENT_BATCH_SIZE] = {};                   /* documents in the current batch */
 	char error[512];                                         /* view error return */
 	int idx = 0;                                             /* row array index counter */
+	size_t i, num, num_rows;                                 /* batch and row counters */
 	int retval = 0;                                          /* return value */
 	lcb_error_t cb_error = LCB_SUCCESS;                      /* couchbase error holder */
 	json_object *json, *j_value;                                /* json object holders */
@@ -798,112 +810,130 @@ int mod_load_client_documents(rlm_couchbase_t *inst, CONF_SECTION *tmpl, CONF_SE
 		goto free_and_return;
 	}
 
-	/* loop across all row elements */
-	for (idx = 0; (size_t)idx < (size_t)json_object_array_length(jrows); idx++) {
-		/* fetch current index */
-		json = json_object_array_get_idx(jrows, idx);
-
-		/* get view id */
-		if (json_object_object_get_ex(json, "id", &j_value)) {
-			/* clear view id */
-			memset(vid, 0, sizeof(vid));
-			/* copy and check length */
-			if (strlcpy(vid, json_object_get_string(j_value), sizeof(vid)) >= sizeof(vid)) {
+	/* loop across all row elements, fetching the documents in batches */
+	num_rows = json_object_array_length(jrows);
+	idx = 0;
+	while ((size_t)idx < num_rows) {
+		/* gather the ids and keys for one batch */
+		for (num = 0; ((size_t)idx < num_rows) && (num < CLIENT_BATCH_SIZE); idx++) {
+			/* fetch current index */
+			json = json_object_array_get_idx(jrows, idx);
+
+			/* get view id */
+			if (!json_object_object_get_ex(json, "id", &j_value)) {
+				WARN("failed to fetch id from row - skipping");
+				continue;
+			}
+			vids[num] = json_object_get_string(j_value);
+			if (strlen(vids[num]) >= MAX_KEY_SIZE) {
 				ERROR("id from row longer than MAX_KEY_SIZE (%d)",
 				      MAX_KEY_SIZE);
 				continue;
 			}
-		} else {
-			WARN("failed to fetch id from row - skipping");
-			continue;
-		}
 
-		/* get view key */
-		if (json_object_object_get_ex(json, "key", &j_value)) {
-			/* clear view key */
-			memset(vkey, 0, sizeof(vkey));
-			/* copy and check length */
-			if (strlcpy(vkey, json_object_get_string(j_value), sizeof(vkey)) >= sizeof(vkey)) {
+			/* get view key */
+			if (!json_object_object_get_ex(json, "key", &j_value)) {
+				WARN("failed to fetch key from row - skipping");
+				continue;
+			}
+			vkeys[num] = json_object_get_string(j_value);
+			if (strlen(vkeys[num]) >= MAX_KEY_SIZE) {
 				ERROR("key from row longer than MAX_KEY_SIZE (%d)",
 				      MAX_KEY_SIZE);
 				continue;
 			}
-		} else {
-			WARN("failed to fetch key from row - skipping");
-			continue;
-		}
 
-		/* fetch document */
-		cb_error = couchbase_get_key(cb_inst, cookie, vid);
+			num++;
+		}
 
-		/* check error and object */
-		if (cb_error != LCB_SUCCESS || cookie->jerr != json_tokener_success || !cookie->jobj) {
+		/* fetch all of the documents in the batch with one wait */
+		cb_error = couchbase_get_keys(cb_inst, docs, vids, num);
+		if (cb_error != LCB_SUCCESS) {
 			/* log error */
-			ERROR("failed to execute get request or parse return");
+			ERROR("failed to execute get request");
 			/* set return */
 			retval = -1;
 			/* return */
 			goto free_and_return;
 		}
 
-		/* debugging */
-		DEBUG3("cookie->jobj == %s", json_object_to_json_string(cookie->jobj));
-
-		/* allocate conf list */
-		client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", vkey, true) :
-				cf_section_alloc(NULL, NULL, "client", vkey);
+		for (i = 0; i < num; i++) {
+			/* check error and object */
+			if (docs[i].jerr != json_tokener_success || !docs[i].jobj) {
+				/* log error */
+				ERROR("failed to execute get request or parse return for %s", vids[i]);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		if (client_map_section(client, map, _get_client_value, cookie->jobj) < 0) {
-			/* free config section */
-			talloc_free(client);
-			/* set return */
-			retval = -1;
-			/* return */
-			goto free_and_return;
-		}
+			/* debugging */
+			DEBUG3("docs[%zu].jobj == %s", i, json_object_to_json_string(docs[i].jobj));
+
+			/* allocate conf list */
+			client = tmpl ? cf_section_dup(NULL, NULL, tmpl, "client", vkeys[i], true) :
+					cf_section_alloc(NULL, NULL, "client", vkeys[i]);
+
+			if (client_map_section(client, map, _get_client_value, docs[i].jobj) < 0) {
+				/* free config section */
+				talloc_free(client);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		/*
-		 * @todo These should be parented from something.
-		 */
-		c = client_afrom_cs(NULL, client, false, 0);
-		if (!c) {
-			ERROR("failed to allocate client");
-			/* free config section */
-			talloc_free(client);
-			/* set return */
-			retval = -1;
-			/* return */
-			goto free_and_return;
-		}
+			/*
+			 * @todo These should be parented from something.
+			 */
+			c = client_afrom_cs(NULL, client, false, 0);
+			if (!c) {
+				ERROR("failed to allocate client");
+				/* free config section */
+				talloc_free(client);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		/*
-		 * Client parents the CONF_SECTION which defined it.
-		 */
-		talloc_steal(c, client);
+			/*
+			 * Client parents the CONF_SECTION which defined it.
+			 */
+			talloc_steal(c, client);
+
+			/* attempt to add client */
+			if (!client_add(NULL, c)) {
+				ERROR("failed to add client '%s' from '%s', possible duplicate?", vkeys[i], vids[i]);
+				/* free client */
+				client_free(c);
+				/* set return */
+				retval = -1;
+				/* return */
+				goto free_and_return;
+			}
 
-		/* attempt to add client */
-		if (!client_add(NULL, c)) {
-			ERROR("failed to add client '%s' from '%s', possible duplicate?", vkey, vid);
-			/* free client */
-			client_free(c);
-			/* set return */
-			retval = -1;
-			/* return */
-			goto free_and_return;
+			/* debugging */
+			DEBUG("client '%s' added", c->longname);
 		}
 
-		/* debugging */
-		DEBUG("client '%s' added", c->longname);
-
-		/* free json object */
-		if (cookie->jobj) {
-			json_object_put(cookie->jobj);
-			cookie->jobj = NULL;
+		/* free json objects */
+		for (i = 0; i < num; i++) {
+			if (docs[i].jobj) {
+				json_object_put(docs[i].jobj);
+				docs[i].jobj = NULL;
+			}
 		}
 	}
 
 	free_and_return:
 
+	/* free documents */
+	for (i = 0; i < CLIENT_BATCH_SIZE; i++) {
+		if (docs[i].jobj) json_object_put(docs[i].jobj);
+	}
+
 	/* free rows */
 	if (jrows) {
 		json_object_put(jrows);
@@ -33,6 +33,23 @@ RCSID("$Id$")
 
 static unlang_action_t mod_map_proc(rlm_rcode_t *p_result, void const *mod_inst, UNUSED void *proc_inst, request_t *request,
 				    fr_value_box_list_t *key, map_list_t const *maps);
+static unlang_action_t mod_map_index_proc(rlm_rcode_t *p_result, void const *mod_inst, UNUSED void *proc_inst, request_t *request,
+					  fr_value_box_list_t *key, map_list_t const *maps);
+
+typedef struct rlm_csv_s rlm_csv_t;
+
+/** A secondary index over one of the data fields
+ *
+ * Secondary indexes don't copy the rows.  They point to the same
+ * entries as the primary index, and use the field value in the row as
+ * the key.
+ */
+typedef struct {
+	rlm_csv_t const	*inst;
+	char const	*name;		//!< of the field being indexed.
+	int		offset;		//!< of the field in rlm_csv_entry_t->data.
+	fr_hash_table_t	*ht;
+} rlm_csv_index_t;
 
 /*
  *	Define a structure for our module configuration.
@@ -41,11 +58,12 @@ static unlang_action_t mod_map_proc(rlm_rcode_t *p_result, void const *mod_inst,
  *	a lot cleaner to do so, and a pointer to the structure can
  *	be used as the instance handle.
  */
-typedef struct {
+struct rlm_csv_s {
 	char const	*filename;
 	char const	*delimiter;
 	char const	*fields;
 	char const	*index_field_name;
+	char const	**secondary_index_names;
 
 	bool		header;
 	bool		allow_multiple_keys;
@@ -61,12 +79,19 @@ typedef struct {
 	fr_rb_tree_t	*tree;
 	fr_htrie_t	*trie;
 
+	int		num_indexes;
+	rlm_csv_index_t	*indexes;	//!< secondary indexes.
+
 	tmpl_t		*key;
 	fr_type_t	key_data_type;
 
 	map_list_t	map;		//!< if there is an "update" section in the configuration.
-} rlm_csv_t;
+};
 
+/*
+ *	The "data" fields all point into one copy of the line from the
+ *	file.  They're only parsed to attributes when they're used.
+ */
 typedef struct rlm_csv_entry_s rlm_csv_entry_t;
 struct rlm_csv_entry_s {
 	fr_rb_node_t node;
@@ -75,6 +100,16 @@ struct rlm_csv_entry_s {
 	char *data[];
 };
 
+/*
+ *	One entry in a secondary index.
+ */
+typedef struct rlm_csv_index_node_s rlm_csv_index_node_t;
+struct rlm_csv_index_node_s {
+	char const		*key;		//!< points to the field in the entry.
+	rlm_csv_entry_t		*entry;
+	rlm_csv_index_node_t	*next;		//!< entries with the same key.
+};
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
@@ -85,6 +120,7 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("header", rlm_csv_t, header) },
 	{ FR_CONF_OFFSET("allow_multiple_keys", rlm_csv_t, allow_multiple_keys) },
 	{ FR_CONF_OFFSET_FLAGS("index_field", CONF_FLAG_REQUIRED | CONF_FLAG_NOT_EMPTY, rlm_csv_t, index_field_name) },
+	{ FR_CONF_OFFSET_FLAGS("secondary_index", CONF_FLAG_MULTI | CONF_FLAG_NOT_EMPTY, rlm_csv_t, secondary_index_names) },
 	{ FR_CONF_OFFSET("key", rlm_csv_t, key) },
 	CONF_PARSER_TERMINATOR
 };
@@ -184,6 +220,62 @@ static int csv_to_key(uint8_t **out, size_t *outlen, void const *data)
 
 }
 
+static int8_t csv_index_cmp(void const *one, void const *two)
+{
+	rlm_csv_index_node_t const *a = one; /* may not be talloc'd! */
+	rlm_csv_index_node_t const *b = two; /* may not be talloc'd! */
+	int ret;
+
+	ret = strcmp(a->key, b->key);
+	return CMP(ret, 0);
+}
+
+static uint32_t csv_index_hash(void const *data)
+{
+	rlm_csv_index_node_t const *a = data; /* may not be talloc'd! */
+
+	return fr_hash_string(a->key);
+}
+
+/*
+ *	Add a row to the secondary indexes.  Rows with an empty value
+ *	for the field aren't indexed.
+ */
+static bool insert_index_entries(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e, int lineno)
+{
+	int			i;
+	rlm_csv_index_node_t	*nodes;
+
+	if (!inst->num_indexes) return true;
+
+	MEM(nodes = talloc_zero_array(e, rlm_csv_index_node_t, inst->num_indexes));
+
+	for (i = 0; i < inst->num_indexes; i++) {
+		rlm_csv_index_t		*idx = &inst->indexes[i];
+		rlm_csv_index_node_t	*n = &nodes[i], *old;
+
+		n->key = e->data[idx->offset];
+		if (!n->key || !*n->key) continue;
+
+		n->entry = e;
+
+		old = fr_hash_table_find(idx->ht, n);
+		if (old) {
+			while (old->next) old = old->next;
+			old->next = n;
+			continue;
+		}
+
+		if (!fr_hash_table_insert(idx->ht, n)) {
+			cf_log_err(conf, "Failed inserting entry for file %s line %d into index '%s': %s",
+				   inst->filename, lineno, idx->name, fr_strerror());
+			return false;
+		}
+	}
+
+	return true;
+}
+
 
 static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e, int lineno)
 {
@@ -257,13 +349,19 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 {
 	rlm_csv_entry_t *e;
 	int i;
-	char *p, *q;
+	char *p, *q, *line;
 
 	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
-	for (p = buffer, i = 0; p != NULL; p = q, i++) {
+	/*
+	 *	All of the fields are parsed in place, and point into
+	 *	this copy of the line.
+	 */
+	MEM(line = talloc_typed_strdup(e, buffer));
+
+	for (p = line, i = 0; p != NULL; p = q, i++) {
 		if (!buf2entry(inst, p, &q)) {
 			cf_log_err(conf, "Malformed entry in file %s line %d", inst->filename, lineno);
 			return false;
@@ -351,7 +449,7 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 			fr_value_box_clear(&box);
 		}
 
-		MEM(e->data[inst->field_offsets[i]] = talloc_typed_strdup(e, p));
+		e->data[inst->field_offsets[i]] = p;
 	}
 
 	if (i < inst->num_fields) {
@@ -359,7 +457,12 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 		goto fail;
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	/*
+	 *	insert_entry() frees 'e' on failure.
+	 */
+	if (!insert_entry(conf, inst, e, lineno)) return false;
+
+	return insert_index_entries(conf, inst, e, lineno);
 }
 
 
@@ -502,6 +605,17 @@ static int csv_maps_verify(CONF_SECTION *cs, void const *mod_inst, UNUSED void *
 	return 0;
 }
 
+/*
+ *	Verify the result of a map using a secondary index.
+ */
+static int csv_index_maps_verify(CONF_SECTION *cs, void const *mod_inst, void *proc_inst,
+				 tmpl_t const *src, map_list_t const *maps)
+{
+	rlm_csv_index_t const *idx = mod_inst;
+
+	return csv_maps_verify(cs, idx->inst, proc_inst, src, maps);
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -739,6 +853,47 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	 */
 	map_proc_register(inst, inst, mctx->mi->name, mod_map_proc, csv_maps_verify, 0, 0);
 
+	/*
+	 *	Secondary indexes are over data fields, and share the
+	 *	rows with the main index.  Each one gets its own map
+	 *	function, `map csv.<field> <key> { ... }`.
+	 */
+	inst->num_indexes = talloc_array_length(inst->secondary_index_names);
+	if (!inst->num_indexes) return 0;
+
+	MEM(inst->indexes = talloc_zero_array(inst, rlm_csv_index_t, inst->num_indexes));
+
+	for (i = 0; i < inst->num_indexes; i++) {
+		rlm_csv_index_t	*idx = &inst->indexes[i];
+		char		*name;
+		int		j;
+
+		idx->inst = inst;
+		idx->name = inst->secondary_index_names[i];
+		idx->offset = fieldname2offset(inst, idx->name, NULL);
+		if (idx->offset < 0) {
+			cf_log_err(conf, "secondary_index '%s' must be the name of a data field", idx->name);
+			return -1;
+		}
+
+		for (j = 0; j < i; j++) {
+			if (inst->indexes[j].offset != idx->offset) continue;
+
+			cf_log_err(conf, "secondary_index '%s' is listed more than once", idx->name);
+			return -1;
+		}
+
+		idx->ht = fr_hash_table_alloc(inst, csv_index_hash, csv_index_cmp, NULL);
+		if (!idx->ht) {
+			cf_log_err(conf, "Failed creating secondary index: %s", fr_strerror());
+			return -1;
+		}
+
+		MEM(name = talloc_asprintf(NULL, "%s.%s", mctx->mi->name, idx->name));
+		map_proc_register(inst, idx, name, mod_map_index_proc, csv_index_maps_verify, 0, 0);
+		talloc_free(name);
+	}
+
 	return 0;
 }
 
@@ -870,7 +1025,7 @@ static int csv_map_getvalue(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *req
 	vp = fr_pair_afrom_da(ctx, da);
 	fr_assert(vp);
 
-	if (fr_pair_value_from_str(vp, str, talloc_array_length(str) - 1, NULL, true) < 0) {
+	if (fr_pair_value_from_str(vp, str, strlen(str), NULL, true) < 0) {
 		RPWDEBUG("Failed parsing value \"%pV\" for attribute %s", fr_box_strvalue_buffer(str),
 			tmpl_attr_tail_da(map->lhs)->name);
 		talloc_free(vp);
@@ -884,31 +1039,21 @@ static int csv_map_getvalue(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *req
 }
 
 
-/** Perform a search and map the result of the search to server attributes
+/** Map one row to server attributes
  *
  * @param[in] inst	#rlm_csv_t.
  * @param[in,out]	request The current request.
- * @param[in] key	key to look for
+ * @param[in] e		the row to map.
  * @param[in] maps	Head of the map list.
  * @return
- *	- #RLM_MODULE_NOOP no rows were returned.
- *	- #RLM_MODULE_UPDATED if one or more #fr_pair_t were added to the #request_t.
- *	- #RLM_MODULE_FAIL if an error occurred.
+ *	- 0 on success.
+ *	- -1 on failure.
  */
-static rlm_rcode_t mod_map_apply(rlm_csv_t const *inst, request_t *request,
-				fr_value_box_t const *key, map_list_t const *maps)
+static int csv_map_entry(rlm_csv_t const *inst, request_t *request,
+			 rlm_csv_entry_t const *e, map_list_t const *maps)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_UPDATED;
-	rlm_csv_entry_t		*e;
 	map_t const		*map = NULL;
 
-	e = fr_htrie_find(inst->trie, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
-	if (!e) {
-		rcode = RLM_MODULE_NOOP;
-		goto finish;
-	}
-
-redo:
 	RINDENT();
 	while ((map = map_list_next(maps, map))) {
 		int field;
@@ -921,8 +1066,7 @@ redo:
 			if (tmpl_aexpand(request, &field_name, request, map->rhs, NULL, NULL) < 0) {
 				REXDENT();
 				REDEBUG("Failed expanding RHS at %s", map->lhs->name);
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
+				return -1;
 			}
 		} else {
 			field_name = UNCONST(char *, map->rhs->name);
@@ -935,8 +1079,7 @@ redo:
 		if (field < 0) {
 			REXDENT();
 			REDEBUG("No such field name %s", map->rhs->name);
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+			return -1;
 		}
 
 		/*
@@ -945,20 +1088,65 @@ redo:
 		 */
 		if (map_to_request(request, map, csv_map_getvalue, e->data[field]) < 0) {
 			REXDENT();
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+			return -1;
 		}
 	}
 
 	REXDENT();
 
-	if (e->next) {
-		e = e->next;
-		goto redo;
-	}
+	return 0;
+}
+
+/** Perform a search and map the result of the search to server attributes
+ *
+ * @param[in] inst	#rlm_csv_t.
+ * @param[in,out]	request The current request.
+ * @param[in] key	key to look for
+ * @param[in] maps	Head of the map list.
+ * @return
+ *	- #RLM_MODULE_NOOP no rows were returned.
+ *	- #RLM_MODULE_UPDATED if one or more #fr_pair_t were added to the #request_t.
+ *	- #RLM_MODULE_FAIL if an error occurred.
+ */
+static rlm_rcode_t mod_map_apply(rlm_csv_t const *inst, request_t *request,
+				fr_value_box_t const *key, map_list_t const *maps)
+{
+	rlm_csv_entry_t		*e;
+
+	e = fr_htrie_find(inst->trie, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
+	if (!e) return RLM_MODULE_NOOP;
 
-finish:
-	return rcode;
+	do {
+		if (csv_map_entry(inst, request, e, maps) < 0) return RLM_MODULE_FAIL;
+	} while ((e = e->next) != NULL);
+
+	return RLM_MODULE_UPDATED;
+}
+
+/** Perform a search of a secondary index, and map the result of the search to server attributes
+ *
+ * @param[in] idx	the secondary index to search.
+ * @param[in,out]	request The current request.
+ * @param[in] key	key to look for.
+ * @param[in] maps	Head of the map list.
+ * @return
+ *	- #RLM_MODULE_NOOP no rows were returned.
+ *	- #RLM_MODULE_UPDATED if one or more #fr_pair_t were added to the #request_t.
+ *	- #RLM_MODULE_FAIL if an error occurred.
+ */
+static rlm_rcode_t mod_map_index_apply(rlm_csv_index_t const *idx, request_t *request,
+				       char const *key, map_list_t const *maps)
+{
+	rlm_csv_index_node_t	*n;
+
+	n = fr_hash_table_find(idx->ht, &(rlm_csv_index_node_t) { .key = key });
+	if (!n) return RLM_MODULE_NOOP;
+
+	do {
+		if (csv_map_entry(idx->inst, request, n->entry, maps) < 0) return RLM_MODULE_FAIL;
+	} while ((n = n->next) != NULL);
+
+	return RLM_MODULE_UPDATED;
 }
 
 
@@ -999,6 +1187,41 @@ static unlang_action_t mod_map_proc(rlm_rcode_t *p_result, void const *mod_inst,
 	RETURN_MODULE_RCODE(mod_map_apply(inst, request, key_head, maps));
 }
 
+/** Search a secondary index, and map the result of the search to server attributes
+ *
+ * The values in a secondary index are always strings, so the key is
+ * always converted to a string.
+ *
+ * @param[out] p_result	Result of applying map, as with mod_map_proc().
+ * @param[in] mod_inst	#rlm_csv_index_t.
+ * @param[in] proc_inst	unused.
+ * @param[in,out]	request The current request.
+ * @param[in] key	key to look for
+ * @param[in] maps	Head of the map list.
+ * @return UNLANG_ACTION_CALCULATE_RESULT
+ */
+static unlang_action_t mod_map_index_proc(rlm_rcode_t *p_result, void const *mod_inst, UNUSED void *proc_inst, request_t *request,
+					  fr_value_box_list_t *key, map_list_t const *maps)
+{
+	rlm_csv_index_t const	*idx = mod_inst;
+	fr_value_box_t		*key_head = fr_value_box_list_head(key);
+
+	if (!key_head) {
+		REDEBUG("CSV key cannot be (null)");
+		RETURN_MODULE_FAIL;
+	}
+
+	if (fr_value_box_list_concat_in_place(request,
+					      key_head, key, FR_TYPE_STRING,
+					      FR_VALUE_BOX_LIST_FREE, true,
+					      SIZE_MAX) < 0) {
+		REDEBUG("Failed parsing key");
+		RETURN_MODULE_FAIL;
+	}
+
+	RETURN_MODULE_RCODE(mod_map_index_apply(idx, request, key_head->vb_strvalue, maps));
+}
+
 
 static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
@@ -25,6 +25,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_util.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/exfile.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
@@ -57,6 +58,8 @@ typedef struct {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	int		format;		//!< DETAIL_FORMAT_TEXT or DETAIL_FORMAT_BINARY.
+
 	exfile_t    	*ef;		//!< Log file handler
 } rlm_detail_t;
 
@@ -67,6 +70,17 @@ typedef struct {
 	fr_hash_table_t	*ht;		//!< Holds suppressed attributes.
 } rlm_detail_env_t;
 
+typedef enum {
+	DETAIL_FORMAT_TEXT = 0,
+	DETAIL_FORMAT_BINARY
+} detail_format_t;
+
+static fr_table_num_sorted_t const detail_format[] = {
+	{ L("binary"),	DETAIL_FORMAT_BINARY	},
+	{ L("text"),	DETAIL_FORMAT_TEXT	},
+};
+static size_t detail_format_len = NUM_ELEMENTS(detail_format);
+
 /*
  *	@todo - put this into common function in cf_parse.c ?
  */
@@ -77,6 +91,8 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("locking", rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("format", rlm_detail_t, format), .dflt = "text",
+			 .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = detail_format, .len = &detail_format_len } },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -292,6 +308,123 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	return 0;
 }
 
+/** Remove suppressed attributes from a copy of a structural pair
+ *
+ */
+static void detail_binary_prune(fr_pair_t *vp, fr_hash_table_t *ht)
+{
+	fr_pair_list_foreach(&vp->vp_group, child) {
+		if (fr_hash_table_find(ht, child->da)) {
+			fr_pair_delete(&vp->vp_group, child);
+			continue;
+		}
+
+		if (fr_type_is_structural(child->vp_type)) detail_binary_prune(child, ht);
+	}
+}
+
+/** Write a single binary detail entry to file pointer
+ *
+ * The same attributes are written as for text entries.  Nested
+ * attributes are written as one pair, instead of being flattened.
+ *
+ * @param[in] out Where to write entry.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply...).
+ * @param[in] list of pairs to write.
+ * @param[in] compat Write out entry in compatibility mode.
+ * @param[in] ht Hash table containing attributes to be suppressed in the output.
+ */
+static int detail_write_binary(FILE *out, rlm_detail_t const *inst, request_t *request,
+			       fr_packet_t *packet, fr_pair_list_t *list, bool compat, fr_hash_table_t *ht)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	uint8_t			*hdr;
+	fr_pair_t		*vp;
+	int			ret = -1;
+
+	if (fr_pair_list_empty(list)) {
+		RWDEBUG("Skipping empty packet");
+		return 0;
+	}
+
+	if (!fr_dbuff_init_talloc(request, &dbuff, &tctx, 1024, SIZE_MAX)) {
+		RERROR("Out of memory");
+		return -1;
+	}
+
+#define ENCODE(_vp) do { \
+	if (fr_detail_binary_pair_encode(&dbuff, request->dict, _vp) < 0) { \
+		RPERROR("Failed encoding %s", (_vp)->da->name); \
+		goto done; \
+	} \
+} while (0)
+
+	/*
+	 *	Leave room for the header, which needs the length of
+	 *	the body.
+	 */
+	if (fr_dbuff_memset(&dbuff, 0, FR_DETAIL_BINARY_HDR_LEN) < 0) {
+		RERROR("Out of memory");
+		goto done;
+	}
+
+	if (!compat) {
+		fr_dict_attr_t const *da;
+
+		da = fr_dict_attr_by_name(NULL, fr_dict_root(request->dict), "Packet-Type");
+		if (da && (da->type == FR_TYPE_UINT32)) {
+			MEM(vp = fr_pair_afrom_da(request, da));
+			vp->vp_uint32 = packet->code;
+			ENCODE(vp);
+			talloc_free(vp);
+		}
+	}
+
+	if (inst->log_srcdst) {
+		vp = fr_pair_find_by_da(&request->control_pairs, NULL, attr_net);
+		if (vp) ENCODE(vp);
+	}
+
+	fr_pair_list_foreach(list, stacked) {
+		if (ht && fr_hash_table_find(ht, stacked->da)) continue;
+
+		if (!inst->log_srcdst && (stacked->da == attr_net)) continue;
+
+		if (compat && (stacked->da == attr_user_password)) continue;
+
+		if (!ht || !fr_type_is_structural(stacked->vp_type)) {
+			ENCODE(stacked);
+			continue;
+		}
+
+		MEM(vp = fr_pair_copy(request, stacked));
+		detail_binary_prune(vp, ht);
+		if (fr_detail_binary_pair_encode(&dbuff, request->dict, vp) < 0) {
+			RPERROR("Failed encoding %s", vp->da->name);
+			talloc_free(vp);
+			goto done;
+		}
+		talloc_free(vp);
+	}
+
+	hdr = fr_dbuff_start(&dbuff);
+	fr_detail_binary_hdr_encode(hdr, fr_time_to_unix_time(request->packet->timestamp),
+				    fr_dbuff_used(&dbuff) - FR_DETAIL_BINARY_HDR_LEN);
+
+	if (fwrite(hdr, fr_dbuff_used(&dbuff), 1, out) != 1) {
+		RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+		goto done;
+	}
+	ret = 0;
+
+done:
+	talloc_free(fr_dbuff_buff(&dbuff));
+	return ret;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -339,7 +472,11 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 		RETURN_MODULE_FAIL;
 	}
 
-	if (detail_write(outfp, inst, request, &env->header, packet, list, compat, env->ht) < 0) goto fail;
+	if (inst->format == DETAIL_FORMAT_BINARY) {
+		if (detail_write_binary(outfp, inst, request, packet, list, compat, env->ht) < 0) goto fail;
+	} else {
+		if (detail_write(outfp, inst, request, &env->header, packet, list, compat, env->ht) < 0) goto fail;
+	}
 
 	/*
 	 *	Flush everything
@@ -579,8 +579,13 @@ unlang_action_t eap_peap_process(rlm_rcode_t *p_result, request_t *request,
 		RDEBUG2("No tunnel username (SSL resumption?)");
 	}
 
+	/*
+	 *	The child is allocated afresh for each round trip, so
+	 *	its session-state is keyed by the tunnel, which lives as
+	 *	long as the TLS session does.
+	 */
 	if (unlang_subrequest_child_push(&eap_session->submodule_rcode, child,
-					 &(unlang_subrequest_session_t){ .enable = true, .unique_ptr = child },
+					 &(unlang_subrequest_session_t){ .enable = true, .unique_ptr = t },
 					 false, UNLANG_SUB_FRAME) < 0) goto finish;
 	if (unlang_function_push(child, NULL, process_reply, NULL, 0,
 				 UNLANG_SUB_FRAME, eap_session) != UNLANG_ACTION_PUSHED_CHILD) goto finish;
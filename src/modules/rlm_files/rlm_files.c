@@ -40,12 +40,40 @@ typedef struct {
 	char const	*filename;
 } rlm_files_t;
 
+/** DEFAULT entries which can only match if an attribute has a particular value
+ */
+typedef struct {
+	fr_value_box_t const	*value;		//!< From the entry's first "==" check item.
+	PAIR_LIST const		**entries;	//!< In file order.
+} files_default_bucket_t;
+
+/** DEFAULT entries grouped by the value of one request attribute
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< Attribute the entries are indexed by.
+	fr_hash_table_t		*buckets;	//!< files_default_bucket_t, keyed by value.
+} files_default_index_t;
+
+/** DEFAULT entries, indexed so that most of them don't need to be checked
+ *
+ * Entries which have a check item of the form &request.Attr == <value>
+ * are only candidates when the request contains that value.  Every
+ * check item of a candidate is still evaluated, the index only avoids
+ * evaluating entries which can't match.
+ */
+typedef struct {
+	PAIR_LIST const		**always;	//!< Entries which are always candidates.
+	files_default_index_t	*indexes;	//!< One per indexed attribute.
+	size_t			num_entries;	//!< Total number of DEFAULT entries.
+} files_default_t;
+
 /**  Structure produced by custom call_env parser
  */
 typedef struct {
 	tmpl_t		*key_tmpl;	//!< tmpl used to evaluate lookup key.
 	fr_htrie_t	*htrie;		//!< parsed files "user" data.
 	PAIR_LIST_LIST	*def;		//!< parsed files DEFAULT data.
+	files_default_t	*def_index;	//!< DEFAULT entries, indexed by check item.
 } rlm_files_data_t;
 
 /**  Call_env structure
@@ -100,7 +128,234 @@ static int pairlist_to_key(uint8_t **out, size_t *outlen, void const *a)
 	return fr_value_box_to_key(out, outlen, ((PAIR_LIST_LIST const *)a)->box);
 }
 
+static uint32_t default_bucket_hash(void const *a)
+{
+	return fr_value_box_hash(((files_default_bucket_t const *)a)->value);
+}
+
+static int8_t default_bucket_cmp(void const *a, void const *b)
+{
+	int ret;
+
+	ret = fr_value_box_cmp(((files_default_bucket_t const *)a)->value, ((files_default_bucket_t const *)b)->value);
+	return CMP(ret, 0);
+}
+
+static int default_order_cmp(void const *a, void const *b)
+{
+	PAIR_LIST const *one = *(PAIR_LIST const * const *)a;
+	PAIR_LIST const *two = *(PAIR_LIST const * const *)b;
+
+	return CMP(one->order, two->order);
+}
+
+/** Return the check item an entry can be indexed by, if any
+ *
+ * The check item must compare a top level attribute in the request
+ * list with a value of the same type, so that the comparison is the
+ * same as comparing value-boxes.  The attribute must also not be
+ * modified by any entry, otherwise an earlier match could change
+ * which later entries are candidates.
+ */
+static map_t const *default_index_map(PAIR_LIST const *entry, fr_dict_attr_t const **modified)
+{
+	map_t const		*map = NULL;
+	fr_dict_attr_t const	*da;
+	size_t			i;
+
+	while ((map = map_list_next(&entry->check, map))) {
+		if (map->op != T_OP_CMP_EQ) continue;
+		if (!tmpl_is_attr(map->lhs) || !tmpl_is_data(map->rhs)) continue;
+		if (tmpl_list(map->lhs) != request_attr_request) continue;
+		if (tmpl_attr_num_elements(map->lhs) != 2) continue;
+
+		da = tmpl_attr_tail_da(map->lhs);
+		if (!fr_dict_attr_is_top_level(da) || !fr_type_is_leaf(da->type)) continue;
+		if (tmpl_value_type(map->rhs) != da->type) continue;
+
+		for (i = 0; i < talloc_array_length(modified); i++) {
+			if (modified[i] == da) break;
+		}
+		if (i < talloc_array_length(modified)) continue;
+
+		return map;
+	}
+
+	return NULL;
+}
+
+/** Group DEFAULT entries by the value of one of their check items
+ *
+ * @param[in] ctx		to allocate the index in.
+ * @param[in] default_list	DEFAULT entries in file order.
+ * @param[in] modified		Attributes which are modified by the reply items of any entry,
+ *				or NULL if they aren't known.  In which case no entries are indexed.
+ * @return the index.
+ */
+static files_default_t *default_index_alloc(TALLOC_CTX *ctx, PAIR_LIST_LIST *default_list,
+					    fr_dict_attr_t const **modified)
+{
+	files_default_t		*def;
+	PAIR_LIST		*entry = NULL;
+	size_t			num_always = 0;
+
+	MEM(def = talloc_zero(ctx, files_default_t));
+	MEM(def->always = talloc_array(def, PAIR_LIST const *, fr_dlist_num_elements(&default_list->head)));
+	MEM(def->indexes = talloc_array(def, files_default_index_t, 0));
+
+	while ((entry = fr_dlist_next(&default_list->head, entry))) {
+		map_t const		*map;
+		files_default_index_t	*index = NULL;
+		files_default_bucket_t	*bucket, find;
+		size_t			i, num;
+
+		def->num_entries++;
+
+		map = modified ? default_index_map(entry, modified) : NULL;
+		if (!map) {
+			def->always[num_always++] = entry;
+			continue;
+		}
+
+		for (i = 0; i < talloc_array_length(def->indexes); i++) {
+			if (def->indexes[i].da == tmpl_attr_tail_da(map->lhs)) {
+				index = &def->indexes[i];
+				break;
+			}
+		}
+
+		if (!index) {
+			i = talloc_array_length(def->indexes);
+			MEM(def->indexes = talloc_realloc(def, def->indexes, files_default_index_t, i + 1));
+			index = &def->indexes[i];
+			index->da = tmpl_attr_tail_da(map->lhs);
+			MEM(index->buckets = fr_hash_table_talloc_alloc(def, files_default_bucket_t,
+									default_bucket_hash, default_bucket_cmp, NULL));
+		}
+
+		find.value = tmpl_value(map->rhs);
+		bucket = fr_hash_table_find(index->buckets, &find);
+		if (!bucket) {
+			MEM(bucket = talloc_zero(index->buckets, files_default_bucket_t));
+			bucket->value = find.value;
+			MEM(bucket->entries = talloc_array(bucket, PAIR_LIST const *, 0));
+			if (!fr_hash_table_insert(index->buckets, bucket)) {
+				talloc_free(bucket);
+				def->always[num_always++] = entry;
+				continue;
+			}
+		}
+
+		num = talloc_array_length(bucket->entries);
+		MEM(bucket->entries = talloc_realloc(bucket, bucket->entries, PAIR_LIST const *, num + 1));
+		bucket->entries[num] = entry;
+	}
+
+	MEM(def->always = talloc_realloc(def, def->always, PAIR_LIST const *, num_always));
+
+	DEBUG2("DEFAULT entries: %zu indexed on %zu attributes, %zu always checked",
+	       def->num_entries - num_always, talloc_array_length(def->indexes), num_always);
+
+	return def;
+}
+
+/** Find the DEFAULT entries which might match a request
+ *
+ * @param[in] ctx	to allocate the result in.
+ * @param[in] request	to get the attribute values from.
+ * @param[in] def	DEFAULT entry index.
+ * @return the candidate entries, in file order.
+ */
+static PAIR_LIST const **default_candidates(TALLOC_CTX *ctx, request_t *request, files_default_t const *def)
+{
+	PAIR_LIST const		**out;
+	size_t			i, j, num;
+
+	MEM(out = talloc_array(ctx, PAIR_LIST const *, def->num_entries));
+
+	num = talloc_array_length(def->always);
+	memcpy(out, def->always, num * sizeof(out[0]));
+
+	for (i = 0; i < talloc_array_length(def->indexes); i++) {
+		files_default_index_t const	*index = &def->indexes[i];
+		fr_pair_t			*vp = NULL;
+
+		while ((vp = fr_pair_find_by_da(&request->request_pairs, vp, index->da))) {
+			files_default_bucket_t const	*bucket;
+
+			bucket = fr_hash_table_find(index->buckets, &(files_default_bucket_t){ .value = &vp->data });
+			if (!bucket) continue;
+
+			/*
+			 *	Multiple instances of the attribute
+			 *	with the same value.
+			 */
+			for (j = 0; j < num; j++) {
+				if (out[j] == bucket->entries[0]) break;
+			}
+			if (j < num) continue;
+
+			memcpy(out + num, bucket->entries, talloc_array_length(bucket->entries) * sizeof(out[0]));
+			num += talloc_array_length(bucket->entries);
+		}
+	}
+
+	qsort(out, num, sizeof(out[0]), default_order_cmp);
+
+	RDEBUG3("Checking %zu of %zu DEFAULT entries", num, def->num_entries);
+
+	return talloc_realloc(ctx, out, PAIR_LIST const *, num);
+}
+
+/** Add the attributes an edit can modify to the modified set
+ *
+ * Edits of structural attributes are walked, so that the attributes
+ * they create are also added.
+ *
+ * @param[in] ctx		to allocate the modified set in.
+ * @param[in,out] modified	Attributes which are modified.
+ * @param[in] map		Reply item to check.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the attributes the edit modifies can't be determined,
+ *	  e.g. a structural attribute being copied from another list.
+ */
+static int default_modified_add(TALLOC_CTX *ctx, fr_dict_attr_t const ***modified, map_t const *map)
+{
+	fr_dict_attr_t const	*da;
+	map_t const		*child = NULL;
+	size_t			i, num;
+
+	if (!tmpl_is_attr(map->lhs)) return -1;
+
+	da = tmpl_attr_tail_da(map->lhs);
+	if (!da) return -1;
+
+	if (!fr_type_is_leaf(da->type)) {
+		/*
+		 *	The contents come from somewhere else, so
+		 *	we don't know what they are.
+		 */
+		if (map->rhs) return -1;
+
+		while ((child = map_list_next(&map->child, child))) {
+			if (default_modified_add(ctx, modified, child) < 0) return -1;
+		}
+	}
+
+	num = talloc_array_length(*modified);
+	for (i = 0; i < num; i++) {
+		if ((*modified)[i] == da) return 0;
+	}
+
+	MEM(*modified = talloc_realloc(ctx, *modified, fr_dict_attr_t const *, num + 1));
+	(*modified)[num] = da;
+
+	return 0;
+}
+
 static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptree, PAIR_LIST_LIST **pdefault,
+			    files_default_t **pdefault_index,
 			    fr_type_t data_type, fr_dict_attr_t const *key_enum, fr_dict_t const *dict)
 {
 	int			rcode;
@@ -112,6 +367,7 @@ static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **
 	fr_htrie_type_t		htype;
 	fr_value_box_t		*box;
 	map_t			*reply_head;
+	fr_dict_attr_t const	**modified;
 
 	if (!filename) {
 		*ptree = NULL;
@@ -126,6 +382,8 @@ static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **
 
 	htype = fr_htrie_hint(data_type);
 
+	MEM(modified = talloc_array(ctx, fr_dict_attr_t const *, 0));
+
 	/*
 	 *	Walk through the 'users' file list
 	 */
@@ -277,6 +535,19 @@ static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **
 				continue;
 			}
 		}
+
+		/*
+		 *	Remember which attributes are modified, so
+		 *	that DEFAULT entries aren't indexed by them.
+		 *	If we can't tell, then don't index anything.
+		 */
+		for (map = map_list_head(&entry->reply); modified && map; map = map_list_next(&entry->reply, map)) {
+			if (default_modified_add(ctx, &modified, map) < 0) {
+				DEBUG2("%s[%d]: Can't determine which attributes are modified, not indexing DEFAULT entries",
+				       entry->filename, entry->lineno);
+				TALLOC_FREE(modified);
+			}
+		}
 	}
 
 	tree = fr_htrie_alloc(ctx, htype, pairlist_hash, pairlist_cmp, pairlist_to_key, NULL);
@@ -388,6 +659,9 @@ static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **
 		fr_dlist_insert_tail(&user_list->head, entry);
 	}
 
+	if (default_list) *pdefault_index = default_index_alloc(ctx, default_list, modified);
+	talloc_free(modified);
+
 	*ptree = tree;
 
 	return 0;
@@ -408,6 +682,8 @@ static unlang_action_t CC_HINT(nonnull) mod_files_resume(rlm_rcode_t *p_result,
 	fr_edit_list_t		*el, *child;
 	fr_htrie_t		*tree = env->data->htrie;
 	PAIR_LIST_LIST		*default_list = env->data->def;
+	PAIR_LIST const		**defaults = NULL;
+	size_t			num_defaults = 0, default_idx;
 	fr_value_box_t		*key_vb = fr_value_box_list_head(&env->values);
 
 	if (!key_vb) {
@@ -451,8 +727,14 @@ static unlang_action_t CC_HINT(nonnull) mod_files_resume(rlm_rcode_t *p_result,
 		user_list = NULL;
 	}
 
+	if (default_list) {
+		defaults = default_candidates(child, request, env->data->def_index);
+		num_defaults = talloc_array_length(defaults);
+	}
+
 redo:
-	default_pl = default_list ? fr_dlist_head(&default_list->head) : NULL;
+	default_idx = 0;
+	default_pl = num_defaults ? defaults[0] : NULL;
 
 	/*
 	 *	Find the entry for the user.
@@ -474,7 +756,7 @@ redo:
 		} else if (!user_pl && default_pl) {
 			pl = default_pl;
 			RDEBUG3("DEFAULT[%d]= USER[]=", default_pl->lineno);
-			default_pl = fr_dlist_next(&default_list->head, default_pl);
+			default_pl = (++default_idx < num_defaults) ? defaults[default_idx] : NULL;
 
 		} else if (user_pl->order < default_pl->order) {
 			pl = user_pl;
@@ -485,7 +767,7 @@ redo:
 		} else {
 			pl = default_pl;
 			RDEBUG3("DEFAULT[%d]= USER[%d]=%s (choosing default)", default_pl->lineno, user_pl->lineno, user_pl->name);
-			default_pl = fr_dlist_next(&default_list->head, default_pl);
+			default_pl = (++default_idx < num_defaults) ? defaults[default_idx] : NULL;
 		}
 
 		/*
@@ -677,7 +959,7 @@ static int call_env_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rule
 		key_enum = tmpl_attr_tail_da(files_data->key_tmpl);
 	}
 
-	if (getrecv_filename(files_data, inst->filename, &files_data->htrie, &files_data->def,
+	if (getrecv_filename(files_data, inst->filename, &files_data->htrie, &files_data->def, &files_data->def_index,
 			     keytype, key_enum, t_rules->attr.dict_def) < 0) goto error;
 
 	*(void **)out = files_data;
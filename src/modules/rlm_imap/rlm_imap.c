@@ -93,6 +93,7 @@ static void imap_io_module_signal(module_ctx_t const *mctx, request_t *request,
 		RERROR("Failed removing curl handle from multi-handle: %s (%i)", curl_multi_strerror(ret), ret);
 		/* Not much we can do */
 	}
+	fr_curl_io_request_unshare(randle);
 	t->mhandle->transfers--;
 	imap_slab_release(randle);
 }
@@ -46,6 +46,7 @@ static fr_dict_attr_t const *attr_server_name;
 static fr_dict_attr_t const *attr_boot_filename;
 static fr_dict_attr_t const *attr_server_ip_address;
 static fr_dict_attr_t const *attr_server_identifier;
+static fr_dict_attr_t const *attr_requested_ip_address;
 
 extern fr_dict_attr_autoload_t rlm_isc_dhcp_dict_attr[];
 fr_dict_attr_autoload_t rlm_isc_dhcp_dict_attr[] = {
@@ -56,6 +57,7 @@ fr_dict_attr_autoload_t rlm_isc_dhcp_dict_attr[] = {
 	{ .out = &attr_boot_filename, .name = "Boot-Filename", .type = FR_TYPE_STRING, .dict = &dict_dhcpv4},
 	{ .out = &attr_server_ip_address, .name = "Server-IP-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
 	{ .out = &attr_server_identifier, .name = "Server-Identifier", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
+	{ .out = &attr_requested_ip_address, .name = "Requested-IP-Address", .type = FR_TYPE_IPV4_ADDR, .dict = &dict_dhcpv4},
 
 	{ NULL }
 };
@@ -89,6 +91,7 @@ typedef struct {
 	 */
 	fr_hash_table_t		*hosts_by_ether;       	//!< by MAC address
 	fr_hash_table_t		*hosts_by_uid;		//!< by client identifier
+	fr_hash_table_t		*hosts_by_addr;		//!< by fixed address
 } rlm_isc_dhcp_t;
 
 /*
@@ -801,6 +804,26 @@ static int8_t host_uid_cmp(void const *one, void const *two)
 	return 0;
 }
 
+typedef struct {
+	uint32_t		addr;		//!< in network byte order.
+	rlm_isc_dhcp_info_t	*host;
+} isc_host_addr_t;
+
+static uint32_t host_addr_hash(void const *data)
+{
+	isc_host_addr_t const *self = data;
+
+	return fr_hash(&self->addr, sizeof(self->addr));
+}
+
+static int8_t host_addr_cmp(void const *one, void const *two)
+{
+	isc_host_addr_t const *a = one;
+	isc_host_addr_t const *b = two;
+
+	return CMP(a->addr, b->addr);
+}
+
 
 /**	option space name [ [ code width number ] [ length width number ] [ hash size number ] ] ;
  *
@@ -1366,10 +1389,65 @@ static int match_keyword(rlm_isc_dhcp_info_t *parent, rlm_isc_dhcp_tokenizer_t *
 	return 1;
 }
 
+/** Index the "fixed-address" entries of a host
+ *
+ *	The "fixed-address" statement is remembered in the host's
+ *	data, so that it doesn't need to be found when applying the
+ *	host.  The addresses are indexed globally, so that we can tell
+ *	when a client asks for an address reserved for another host.
+ */
+static int parse_host_fixed_address(rlm_isc_dhcp_tokenizer_t *state, rlm_isc_dhcp_info_t *info)
+{
+	rlm_isc_dhcp_info_t *child;
+	int i;
+
+	for (child = info->child; child != NULL; child = child->next) {
+		if (child->cmd->type != ISC_FIXED_ADDRESS) continue;
+
+		if (info->data) {
+			fr_strerror_printf("host %s cannot have two 'fixed-address' entries",
+					   info->argv[0]->vb_strvalue);
+			return -1;
+		}
+		info->data = child;
+
+		for (i = 0; i < child->argc; i++) {
+			isc_host_addr_t *my_addr, *old_addr;
+
+			my_addr = talloc_zero(info, isc_host_addr_t);
+			my_addr->addr = child->argv[i]->vb_ip.addr.v4.s_addr;
+			my_addr->host = info;
+
+			old_addr = fr_hash_table_find(state->inst->hosts_by_addr, my_addr);
+			if (old_addr) {
+				if (old_addr->host == info) {
+					talloc_free(my_addr);
+					continue;
+				}
+
+				fr_strerror_printf("'host %s' and 'host %s' contain duplicate 'fixed-address' %pV",
+						   info->argv[0]->vb_strvalue, old_addr->host->argv[0]->vb_strvalue,
+						   child->argv[i]);
+				talloc_free(my_addr);
+				return -1;
+			}
+
+			if (!fr_hash_table_insert(state->inst->hosts_by_addr, my_addr)) {
+				fr_strerror_printf("Failed inserting 'host %s' into hash table",
+						   info->argv[0]->vb_strvalue);
+				talloc_free(my_addr);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
 /** host NAME { ... }
  *
- *	Hosts are global, and are keyed by MAC `hardware ethernet`, and by
- *	`client-identifier`.
+ *	Hosts are global, and are keyed by MAC `hardware ethernet`, by
+ *	`client-identifier`, and by `fixed-address`.
  */
 static int parse_host(rlm_isc_dhcp_tokenizer_t *state, rlm_isc_dhcp_info_t *info)
 {
@@ -1439,6 +1517,12 @@ static int parse_host(rlm_isc_dhcp_tokenizer_t *state, rlm_isc_dhcp_info_t *info
 		}
 	}
 
+	if (parse_host_fixed_address(state, info) < 0) {
+		talloc_free(my_ether);
+		if (my_uid) talloc_free(my_uid);
+		return -1;
+	}
+
 	/*
 	 *	Insert into the ether hashes.
 	 */
@@ -1736,6 +1820,29 @@ static int parse_next_server(UNUSED rlm_isc_dhcp_tokenizer_t *state, rlm_isc_dhc
  *  declaration.
  */
 
+/** Check that the client isn't asking for an address reserved for another host
+ *
+ * @return
+ *	- 0 if the address isn't reserved, or is reserved for this host.
+ *	- -2 if it's reserved for another host.
+ */
+static int check_reserved(rlm_isc_dhcp_t const *inst, request_t *request, rlm_isc_dhcp_info_t const *host)
+{
+	fr_pair_t *vp;
+	isc_host_addr_t *addr, my_addr;
+
+	vp = fr_pair_find_by_da(&request->request_pairs, NULL, attr_requested_ip_address);
+	if (!vp) return 0;
+
+	my_addr.addr = vp->vp_ipv4addr;
+	addr = fr_hash_table_find(inst->hosts_by_addr, &my_addr);
+	if (!addr || (addr->host == host)) return 0;
+
+	REDEBUG("%s %pV is reserved by 'host %s'", vp->da->name, &vp->data, addr->host->argv[0]->vb_strvalue);
+
+	return -2;
+}
+
 /** Apply fixed IPs
  *
  */
@@ -1753,37 +1860,28 @@ static int apply_fixed_ip(rlm_isc_dhcp_t const *inst, request_t *request)
 	if (yiaddr) return 0;
 
 	host = get_host(request, inst->hosts_by_ether, inst->hosts_by_uid);
-	if (!host) return 0;
+	if (!host) return check_reserved(inst, request, NULL);
 
 	/*
-	 *	Find a "fixed-address" sub-statement.
+	 *	The "fixed-address" sub-statement was found
+	 *	when the host was parsed.
 	 */
-	for (info = host->child; info != NULL; info = info->next) {
-		if (!info->cmd) return -1; /* internal error */
-
-		/*
-		 *	Skip complex statements
-		 */
-		if (info->child) continue;
-
-		if (info->cmd->type != ISC_FIXED_ADDRESS) continue;
-
-		MEM(vp = fr_pair_afrom_da(request->reply_ctx, attr_your_ip_address));
+	info = host->data;
+	if (!info) return check_reserved(inst, request, host);
 
-		ret = fr_value_box_copy(vp, &(vp->data), info->argv[0]);
-		if (ret < 0) return ret;
+	MEM(vp = fr_pair_afrom_da(request->reply_ctx, attr_your_ip_address));
 
-		fr_pair_append(&request->reply_pairs, vp);
+	ret = fr_value_box_copy(vp, &(vp->data), info->argv[0]);
+	if (ret < 0) return ret;
 
-		/*
-		 *	If we've found a fixed IP, then tell
-		 *	the parent to stop iterating over
-		 *	children.
-		 */
-		return 2;
-	}
+	fr_pair_append(&request->reply_pairs, vp);
 
-	return 0;
+	/*
+	 *	If we've found a fixed IP, then tell
+	 *	the parent to stop iterating over
+	 *	children.
+	 */
+	return 2;
 }
 
 /** Apply all rules *except* fixed IP
@@ -2189,6 +2287,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->hosts_by_uid = fr_hash_table_alloc(inst, host_uid_hash, host_uid_cmp, NULL);
 	if (!inst->hosts_by_uid) return -1;
 
+	inst->hosts_by_addr = fr_hash_table_alloc(inst, host_addr_hash, host_addr_cmp, NULL);
+	if (!inst->hosts_by_addr) return -1;
+
 	ret = read_file(inst, info, inst->filename);
 	if (ret < 0) {
 		cf_log_err(conf, "%s", fr_strerror());
@@ -2209,6 +2310,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	int			ret;
 
 	ret = apply_fixed_ip(inst, request);
+	if (ret == -2) RETURN_MODULE_REJECT;
 	if (ret < 0) RETURN_MODULE_FAIL;
 	if (ret == 0) RETURN_MODULE_NOOP;
 
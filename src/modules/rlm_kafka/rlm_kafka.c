@@ -19,18 +19,478 @@
  * @file rlm_kafka.c
  * @brief Kafka producer module
  *
+ * Each worker thread has its own producer handle.  librdkafka batches,
+ * compresses and sends messages from its own threads, and signals the
+ * worker through a pipe when delivery reports are available, so they're
+ * processed from the worker's event loop.
+ *
  * @copyright 2022 Arran Cudbard-Bell (a.cudbardb@freeradius.org)
  */
 RCSID("$Id$")
 USES_APPLE_DEPRECATED_API
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/kafka/base.h>
+#include <freeradius-devel/unlang/call_env.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+/** How long to wait for outstanding messages to be delivered when a worker exits
+ *
+ */
+#define KAFKA_FLUSH_TIMEOUT_MS	5000
 
 typedef struct {
-	char const *foo;
+	CONF_SECTION		*topic_cs;		//!< "topic" section containing per-topic configuration.
 } rlm_kafka_t;
 
+/** A topic handle, owned by a single producer
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of topics.
+	char const		*name;			//!< Name of the topic.
+	rd_kafka_topic_t	*rkt;			//!< librdkafka topic handle.
+} rlm_kafka_topic_t;
+
+typedef struct {
+	char const		*name;			//!< Module instance name, for logging.
+	rd_kafka_t		*rk;			//!< Producer handle for this worker.
+	fr_rb_tree_t		*topics;		//!< Topic handles, by name.
+	fr_event_list_t		*el;			//!< Event list delivery reports are processed in.
+	int			fd[2];			//!< librdkafka writes to fd[1] when there are
+							///< events on the main queue.
+} rlm_kafka_thread_t;
+
+/** Tracks a message whose delivery report a request is waiting for
+ *
+ */
+typedef struct {
+	request_t		*request;		//!< Request to resume.  NULL if the request was cancelled.
+	rd_kafka_resp_err_t	err;			//!< Result of delivering the message.
+} rlm_kafka_msg_ctx_t;
+
+typedef struct {
+	fr_value_box_t		*topic;			//!< Topic to produce the message to.
+	fr_value_box_t		*key;			//!< Message key, used for partitioning.
+	tmpl_t			*value;			//!< Attributes, or an expansion, to produce the
+							///< message body from.
+	fr_value_box_t		*wait;			//!< Whether to wait for the delivery report.
+} kafka_call_env_t;
+
+typedef struct {
+	fr_value_box_list_t	expanded;		//!< The result of expanding the value tmpl.
+} rlm_kafka_rctx_t;
+
+static const call_env_method_t kafka_method_env = {
+	FR_CALL_ENV_METHOD_OUT(kafka_call_env_t),
+	.env = (call_env_parser_t[]) {
+		{ FR_CALL_ENV_SUBSECTION("message", NULL, CALL_ENV_FLAG_REQUIRED,
+			((call_env_parser_t[]) {
+				{ FR_CALL_ENV_OFFSET("topic", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT,
+						     kafka_call_env_t, topic) },
+				{ FR_CALL_ENV_OFFSET("key", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE,
+						     kafka_call_env_t, key) },
+				{ FR_CALL_ENV_PARSE_ONLY_OFFSET("value", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT,
+								kafka_call_env_t, value) },
+				{ FR_CALL_ENV_OFFSET("wait", FR_TYPE_BOOL, CALL_ENV_FLAG_SINGLE,
+						     kafka_call_env_t, wait), .pair.dflt = "no", .pair.dflt_quote = T_BARE_WORD },
+				CALL_ENV_TERMINATOR
+			})) },
+		CALL_ENV_TERMINATOR
+	}
+};
+
+static int8_t kafka_topic_cmp(void const *one, void const *two)
+{
+	rlm_kafka_topic_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->name, b->name);
+	return CMP(ret, 0);
+}
+
+/** Called by rd_kafka_poll() for each message which has been delivered, or has failed
+ *
+ * Messages which no request is waiting for have no opaque data.
+ */
+static void _kafka_delivery_report(UNUSED rd_kafka_t *rk, rd_kafka_message_t const *msg, void *uctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+	rlm_kafka_msg_ctx_t	*msg_ctx = msg->_private;
+
+	if (!msg_ctx) {
+		if (msg->err) ERROR("%s - Failed delivering message to \"%s\": %s",
+				    t->name, rd_kafka_topic_name(msg->rkt), rd_kafka_err2str(msg->err));
+		return;
+	}
+
+	/*
+	 *	The request went away while we were waiting
+	 */
+	if (!msg_ctx->request) {
+		talloc_free(msg_ctx);
+		return;
+	}
+
+	msg_ctx->err = msg->err;
+	unlang_interpret_mark_runnable(msg_ctx->request);
+}
+
+/** Called by rd_kafka_poll() for client level errors
+ *
+ * Most of these are informational, librdkafka will retry.
+ */
+static void _kafka_error(UNUSED rd_kafka_t *rk, int err, char const *reason, void *uctx)
+{
+	rlm_kafka_thread_t *t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+
+	ERROR("%s - %s: %s", t->name, rd_kafka_err2name(err), reason);
+}
+
+/** Process events on the producer's main queue
+ *
+ * librdkafka only writes to the pipe when the queue goes from empty to
+ * non-empty, so drain the pipe, and serve every event that's queued.
+ */
+static void _kafka_io_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+	uint8_t			buff[64];
+
+	while (read(fd, buff, sizeof(buff)) > 0);
+
+	rd_kafka_poll(t->rk, 0);
+}
+
+static void _kafka_io_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_kafka_thread_t *t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+
+	ERROR("%s - Error on delivery report pipe: %s", t->name, fr_syserror(fd_errno));
+}
+
+/** Find or create a handle for a topic
+ *
+ * Topics without a "topic { <name> { ... } }" section use the default
+ * topic configuration, and are added to the tree the first time they're
+ * used.
+ */
+static rlm_kafka_topic_t *kafka_topic_find(rlm_kafka_thread_t *t, char const *name)
+{
+	rlm_kafka_topic_t	*topic;
+
+	topic = fr_rb_find(t->topics, &(rlm_kafka_topic_t){ .name = name });
+	if (topic) return topic;
+
+	MEM(topic = talloc_zero(t->topics, rlm_kafka_topic_t));
+	topic->name = talloc_strdup(topic, name);
+	topic->rkt = rd_kafka_topic_new(t->rk, name, NULL);
+	if (!topic->rkt) {
+		fr_strerror_printf("%s", rd_kafka_err2str(rd_kafka_last_error()));
+		talloc_free(topic);
+		return NULL;
+	}
+	fr_rb_insert(t->topics, topic);
+
+	return topic;
+}
+
+/** Queue a message with librdkafka
+ *
+ * The message is copied into librdkafka's queue, so the caller can reuse
+ * the buffer as soon as this returns.
+ */
+static rlm_rcode_t kafka_produce(rlm_kafka_thread_t *t, request_t *request, kafka_call_env_t const *env,
+				 void const *value, size_t value_len, rlm_kafka_msg_ctx_t *msg_ctx)
+{
+	rlm_kafka_topic_t	*topic;
+
+	topic = kafka_topic_find(t, env->topic->vb_strvalue);
+	if (!topic) {
+		RPERROR("Failed creating handle for topic \"%pV\"", env->topic);
+		return RLM_MODULE_FAIL;
+	}
+
+	RDEBUG2("Producing %zu byte message to \"%s\"", value_len, topic->name);
+
+	if (rd_kafka_produce(topic->rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
+			     UNCONST(void *, value), value_len,
+			     env->key ? env->key->vb_strvalue : NULL, env->key ? env->key->vb_length : 0,
+			     msg_ctx) < 0) {
+		REDEBUG("Failed producing message to \"%s\": %s", topic->name, rd_kafka_err2str(rd_kafka_last_error()));
+		return RLM_MODULE_FAIL;
+	}
+
+	return RLM_MODULE_OK;
+}
+
+static unlang_action_t mod_delivered(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_kafka_msg_ctx_t	*msg_ctx = talloc_get_type_abort(mctx->rctx, rlm_kafka_msg_ctx_t);
+	rd_kafka_resp_err_t	err = msg_ctx->err;
+
+	talloc_free(msg_ctx);
+
+	if (err) {
+		REDEBUG("Message delivery failed: %s", rd_kafka_err2str(err));
+		RETURN_MODULE_FAIL;
+	}
+
+	RDEBUG2("Message delivered");
+	RETURN_MODULE_OK;
+}
+
+static void mod_delivered_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	rlm_kafka_msg_ctx_t *msg_ctx = talloc_get_type_abort(mctx->rctx, rlm_kafka_msg_ctx_t);
+
+	/*
+	 *	librdkafka still has a pointer to this, so
+	 *	the delivery report callback frees it.
+	 */
+	msg_ctx->request = NULL;
+}
+
+/** Produce a message, and optionally wait for it to be delivered
+ *
+ */
+static unlang_action_t kafka_send(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				  void const *value, size_t value_len)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	kafka_call_env_t const	*env = talloc_get_type_abort_const(mctx->env_data, kafka_call_env_t);
+	rlm_kafka_msg_ctx_t	*msg_ctx = NULL;
+	rlm_rcode_t		rcode;
+
+	/*
+	 *	Parented by the thread, as it must outlive the
+	 *	request if it's cancelled.
+	 */
+	if (env->wait->vb_bool) {
+		MEM(msg_ctx = talloc_zero(t, rlm_kafka_msg_ctx_t));
+		msg_ctx->request = request;
+	}
+
+	rcode = kafka_produce(t, request, env, value, value_len, msg_ctx);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(msg_ctx);
+		RETURN_MODULE_RCODE(rcode);
+	}
+
+	if (!msg_ctx) RETURN_MODULE_OK;
+
+	return unlang_module_yield(request, mod_delivered, mod_delivered_signal, ~FR_SIGNAL_CANCEL, msg_ctx);
+}
+
+static unlang_action_t mod_produce_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_kafka_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, rlm_kafka_rctx_t);
+	fr_value_box_t		*vb = fr_value_box_list_head(&rctx->expanded);
+
+	if (!vb) {
+	empty:
+		RDEBUG2("Message value is empty, not producing message");
+		RETURN_MODULE_NOOP;
+	}
+
+	if (fr_value_box_list_concat_in_place(rctx, vb, &rctx->expanded,
+					      FR_TYPE_OCTETS, FR_VALUE_BOX_LIST_FREE, true, SIZE_MAX) < 0) {
+		RPEDEBUG("Failed concatenating message value");
+		RETURN_MODULE_FAIL;
+	}
+	if (vb->vb_length == 0) goto empty;
+
+	return kafka_send(p_result, mctx, request, vb->vb_octets, vb->vb_length);
+}
+
+/** Produce a message to a kafka topic
+ *
+ * If the value is an attribute reference, the attributes are printed
+ * directly into a buffer, one per line.  Otherwise the value is expanded.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_produce(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	kafka_call_env_t const	*env = talloc_get_type_abort_const(mctx->env_data, kafka_call_env_t);
+	rlm_kafka_rctx_t	*rctx;
+
+	if (tmpl_is_attr(env->value)) {
+		fr_sbuff_t		*sbuff;
+		fr_dcursor_t		cursor;
+		tmpl_dcursor_ctx_t	cc;
+		fr_pair_t		*vp;
+
+		FR_SBUFF_TALLOC_THREAD_LOCAL(&sbuff, 1024, SIZE_MAX);
+
+		for (vp = tmpl_dcursor_init(NULL, NULL, &cc, &cursor, request, env->value);
+		     vp;
+		     vp = fr_dcursor_next(&cursor)) {
+			if ((fr_pair_print_secure(sbuff, NULL, vp) < 0) || (fr_sbuff_in_char(sbuff, '\n') <= 0)) {
+				tmpl_dcursor_clear(&cc);
+				REDEBUG("Failed printing attributes to message");
+				RETURN_MODULE_FAIL;
+			}
+		}
+		tmpl_dcursor_clear(&cc);
+
+		if (fr_sbuff_used(sbuff) == 0) {
+			RDEBUG2("No attributes found, not producing message");
+			RETURN_MODULE_NOOP;
+		}
+
+		return kafka_send(p_result, mctx, request, fr_sbuff_start(sbuff), fr_sbuff_used(sbuff));
+	}
+
+	MEM(rctx = talloc(unlang_interpret_frame_talloc_ctx(request), rlm_kafka_rctx_t));
+	fr_value_box_list_init(&rctx->expanded);
+
+	return unlang_module_yield_to_tmpl(rctx, &rctx->expanded, request, env->value, NULL, mod_produce_resume, NULL, 0, rctx);
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_kafka_t);
+	rd_kafka_conf_t	*conf;
+
+	/*
+	 *	Check there's a usable configuration, so we
+	 *	fail here, not when the workers start.
+	 */
+	conf = fr_kafka_conf_dup(mctx->mi->conf);
+	if (!conf) {
+		cf_log_perr(mctx->mi->conf, "Failed creating kafka configuration");
+		return -1;
+	}
+	rd_kafka_conf_destroy(conf);
+
+	inst->topic_cs = cf_section_find(mctx->mi->conf, "topic", NULL);
+
+	return 0;
+}
+
+/** Destroy the producer, waiting for outstanding messages to be delivered
+ *
+ */
+static void kafka_thread_free(rlm_kafka_thread_t *t)
+{
+	if (t->fd[0] >= 0) {
+		(void) fr_event_fd_delete(t->el, t->fd[0], FR_EVENT_FILTER_IO);
+		close(t->fd[0]);
+		t->fd[0] = -1;
+	}
+
+	if (t->rk) {
+		if (rd_kafka_flush(t->rk, KAFKA_FLUSH_TIMEOUT_MS) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+			WARN("%s - %i messages were not delivered", t->name, rd_kafka_outq_len(t->rk));
+		}
+
+		/*
+		 *	Topic handles must be released before
+		 *	the producer.
+		 */
+		if (t->topics) {
+			fr_rb_inorder_foreach(t->topics, rlm_kafka_topic_t, topic) {
+				rd_kafka_topic_destroy(topic->rkt);
+			}}
+			TALLOC_FREE(t->topics);
+		}
+
+		rd_kafka_destroy(t->rk);
+		t->rk = NULL;
+	}
+
+	if (t->fd[1] >= 0) {
+		close(t->fd[1]);
+		t->fd[1] = -1;
+	}
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_kafka_t);
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	rd_kafka_conf_t		*conf;
+	rd_kafka_queue_t	*queue;
+	char			errstr[512];
+
+	t->name = mctx->mi->name;
+	t->el = mctx->el;
+	t->fd[0] = t->fd[1] = -1;
+
+	conf = fr_kafka_conf_dup(mctx->mi->conf);
+	if (!conf) {
+		PERROR("%s - Failed creating kafka configuration", t->name);
+		return -1;
+	}
+	rd_kafka_conf_set_dr_msg_cb(conf, _kafka_delivery_report);
+	rd_kafka_conf_set_error_cb(conf, _kafka_error);
+	rd_kafka_conf_set_opaque(conf, t);
+
+	t->rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+	if (!t->rk) {
+		ERROR("%s - Failed creating producer: %s", t->name, errstr);
+		rd_kafka_conf_destroy(conf);
+		return -1;
+	}
+
+	MEM(t->topics = fr_rb_inline_talloc_alloc(t, rlm_kafka_topic_t, node, kafka_topic_cmp, NULL));
+	if (inst->topic_cs) {
+		CONF_SECTION *subcs = NULL;
+
+		while ((subcs = cf_section_next(inst->topic_cs, subcs))) {
+			rlm_kafka_topic_t *topic;
+
+			MEM(topic = talloc_zero(t->topics, rlm_kafka_topic_t));
+			topic->name = cf_section_name1(subcs);
+			topic->rkt = rd_kafka_topic_new(t->rk, topic->name, fr_kafka_topic_conf_dup(subcs));
+			if (!topic->rkt) {
+				ERROR("%s - Failed creating topic \"%s\": %s", t->name, topic->name,
+				      rd_kafka_err2str(rd_kafka_last_error()));
+				talloc_free(topic);
+			error:
+				kafka_thread_free(t);
+				return -1;
+			}
+			fr_rb_insert(t->topics, topic);
+		}
+	}
+
+	/*
+	 *	Have librdkafka tell us when there are delivery
+	 *	reports, so we don't need to poll.
+	 */
+	if (pipe(t->fd) < 0) {
+		ERROR("%s - Failed creating pipe: %s", t->name, fr_syserror(errno));
+		t->fd[0] = t->fd[1] = -1;
+		goto error;
+	}
+	if ((fr_nonblock(t->fd[0]) < 0) || (fr_nonblock(t->fd[1]) < 0)) {
+		PERROR("%s - Failed setting pipe to non-blocking", t->name);
+		goto error;
+	}
+
+	queue = rd_kafka_queue_get_main(t->rk);
+	rd_kafka_queue_io_event_enable(queue, t->fd[1], "1", 1);
+	rd_kafka_queue_destroy(queue);
+
+	if (fr_event_fd_insert(t, NULL, t->el, t->fd[0], _kafka_io_read, NULL, _kafka_io_error, t) < 0) {
+		PERROR("%s - Failed inserting event for delivery reports", t->name);
+		goto error;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_kafka_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+
+	kafka_thread_free(t);
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -43,9 +503,19 @@ typedef struct {
 extern module_rlm_t rlm_kafka;
 module_rlm_t rlm_kafka = {
 	.common = {
-		.magic		= MODULE_MAGIC_INIT,
-		.name		= "kafka",
-		.inst_size	= sizeof(rlm_kafka_t),
-		.config		= kafka_base_producer_config,
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "kafka",
+		.inst_size		= sizeof(rlm_kafka_t),
+		.config			= kafka_base_producer_config,
+		.instantiate		= mod_instantiate,
+		.thread_inst_size	= sizeof(rlm_kafka_thread_t),
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
+	},
+	.method_group = {
+		.bindings = (module_method_binding_t[]){
+			{ .section = SECTION_NAME(CF_IDENT_ANY, CF_IDENT_ANY), .method = mod_produce, .method_env = &kafka_method_env },
+			MODULE_BINDING_TERMINATOR
+		}
 	}
 };
@@ -34,6 +34,8 @@ USES_APPLE_DEPRECATED_API
 
 #include "rlm_ldap.h"
 
+#include <pthread.h>
+
 static char const *null_attrs[] = { NULL };
 
 /** Context to use when resolving group membership from the user object.
@@ -1182,3 +1184,149 @@ unlang_action_t rlm_ldap_check_cached(rlm_rcode_t *p_result,
 
 	RETURN_MODULE_NOTFOUND;
 }
+
+/** A previous membership check result
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of results.
+	fr_dlist_t		entry;			//!< Entry in the insertion ordered list of results.
+	char const		*user_dn;		//!< DN of the user that was checked.
+	char const		*group;			//!< Group name or DN the user was checked against.
+	bool			member;			//!< Whether the user was a member.
+	fr_time_t		expires;		//!< When the result should no longer be used.
+} ldap_group_cache_entry_t;
+
+struct rlm_ldap_group_cache_s {
+	pthread_mutex_t		mutex;			//!< Results are shared between all workers.
+	fr_rb_tree_t		*tree;			//!< Results indexed by user DN and group.
+	fr_dlist_head_t		order;			//!< Results in insertion order, oldest first.
+	uint32_t		max_entries;		//!< Maximum number of results to keep.
+};
+
+static int8_t group_cache_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->user_dn, b->user_dn);
+	if (ret != 0) return CMP(ret, 0);
+
+	ret = strcmp(a->group, b->group);
+	return CMP(ret, 0);
+}
+
+static int _group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+	return 0;
+}
+
+/** Allocate a membership cache
+ *
+ * @note Not parented by the module instance, as the instance data is
+ *	read only once instantiation is complete.
+ *
+ * @param[in] max_entries	Maximum number of results to keep.
+ */
+rlm_ldap_group_cache_t *rlm_ldap_group_cache_alloc(uint32_t max_entries)
+{
+	rlm_ldap_group_cache_t *cache;
+
+	MEM(cache = talloc_zero(NULL, rlm_ldap_group_cache_t));
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _group_cache_free);
+
+	MEM(cache->tree = fr_rb_inline_talloc_alloc(cache, ldap_group_cache_entry_t, node, group_cache_cmp, NULL));
+	fr_dlist_talloc_init(&cache->order, ldap_group_cache_entry_t, entry);
+	cache->max_entries = max_entries;
+
+	return cache;
+}
+
+/** Remove a result from the cache and free it
+ *
+ * @note Must be called with the mutex held.
+ */
+static void group_cache_entry_remove(rlm_ldap_group_cache_t *cache, ldap_group_cache_entry_t *entry)
+{
+	fr_rb_remove(cache->tree, entry);
+	fr_dlist_remove(&cache->order, entry);
+	talloc_free(entry);
+}
+
+/** Look for a previous result of checking whether a user is a member of a group
+ *
+ * @param[out] member	Whether the user was a member.
+ * @param[in] cache	to search.
+ * @param[in] request	Current request.
+ * @param[in] user_dn	DN of the user.
+ * @param[in] group	name or DN.
+ * @return
+ *	- 0 if a result was found.
+ *	- -1 if there's no result, or it's expired.
+ */
+int rlm_ldap_group_cache_find(bool *member, rlm_ldap_group_cache_t *cache, request_t *request,
+			      char const *user_dn, char const *group)
+{
+	ldap_group_cache_entry_t	*entry;
+	int				ret = -1;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(ldap_group_cache_entry_t){ .user_dn = user_dn, .group = group });
+	if (entry) {
+		if (fr_time_lt(entry->expires, fr_time())) {
+			group_cache_entry_remove(cache, entry);
+		} else {
+			*member = entry->member;
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (ret == 0) RDEBUG2("User %s a member of \"%s\" (cached result)", *member ? "is" : "is not", group);
+
+	return ret;
+}
+
+/** Record the result of checking whether a user is a member of a group
+ *
+ * Expired results, and the oldest results if the cache is full, are
+ * removed to make room.
+ *
+ * @param[in] cache	to add the result to.
+ * @param[in] user_dn	DN of the user.
+ * @param[in] group	name or DN.
+ * @param[in] member	Whether the user was a member.
+ * @param[in] lifetime	How long the result should be used for.
+ */
+void rlm_ldap_group_cache_insert(rlm_ldap_group_cache_t *cache, char const *user_dn, char const *group,
+				 bool member, fr_time_delta_t lifetime)
+{
+	ldap_group_cache_entry_t	*entry, *old;
+	fr_time_t			now = fr_time();
+
+	if (!fr_time_delta_ispos(lifetime)) return;
+
+	MEM(entry = talloc_zero(NULL, ldap_group_cache_entry_t));
+	entry->user_dn = talloc_strdup(entry, user_dn);
+	entry->group = talloc_strdup(entry, group);
+	entry->member = member;
+	entry->expires = fr_time_add(now, lifetime);
+
+	pthread_mutex_lock(&cache->mutex);
+
+	old = fr_rb_find(cache->tree, entry);
+	if (old) group_cache_entry_remove(cache, old);
+
+	while ((old = fr_dlist_head(&cache->order)) &&
+	       ((fr_dlist_num_elements(&cache->order) >= cache->max_entries) || fr_time_lt(old->expires, now))) {
+		group_cache_entry_remove(cache, old);
+	}
+
+	talloc_steal(cache, entry);
+	fr_rb_insert(cache->tree, entry);
+	fr_dlist_insert_tail(&cache->order, entry);
+
+	pthread_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,296 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file replica.c
+ * @brief Local copy of user objects, populated by proto_ldap_sync.
+ *
+ * Entries are added, updated and removed by calling the module from the
+ * "recv" sections of an ldap_sync virtual server.  Authorization can then
+ * retrieve the user's DN, group memberships, and any attributes the sync
+ * server mapped, without searching the directory.
+ *
+ * @copyright 2024 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/util/debug.h>
+
+#include "rlm_ldap.h"
+
+#include <pthread.h>
+
+/** A user object in the replica
+ *
+ */
+typedef struct {
+	fr_rb_node_t		key_node;		//!< Entry in the tree of entries, by key.
+	fr_rb_node_t		id_node;		//!< Entry in the tree of entries, by id.
+
+	char const		*key;			//!< What authorization looks the entry up by.
+	uint8_t const		*id;			//!< Entry UUID, or if not available, the entry DN.
+	size_t			id_len;			//!< Length of the id.
+
+	char const		*dn;			//!< DN of the user object.
+	char const		**groups;		//!< Groups the user is a member of.
+	fr_pair_list_t		pairs;			//!< Attributes to add to the control list.
+} ldap_replica_entry_t;
+
+struct rlm_ldap_replica_s {
+	pthread_rwlock_t	lock;			//!< Writers are the sync server, readers are everything else.
+	fr_rb_tree_t		*by_key;		//!< Entries indexed by key.
+	fr_rb_tree_t		*by_id;			//!< Entries indexed by id.
+};
+
+static int8_t replica_key_cmp(void const *one, void const *two)
+{
+	ldap_replica_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->key, b->key);
+	return CMP(ret, 0);
+}
+
+static int8_t replica_id_cmp(void const *one, void const *two)
+{
+	ldap_replica_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->id_len, b->id_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->id, b->id, a->id_len);
+	return CMP(ret, 0);
+}
+
+static int _replica_free(rlm_ldap_replica_t *replica)
+{
+	pthread_rwlock_destroy(&replica->lock);
+	return 0;
+}
+
+/** Allocate an empty replica
+ *
+ * @note Not parented by the module instance, as the instance data is
+ *	read only once instantiation is complete.
+ */
+rlm_ldap_replica_t *rlm_ldap_replica_alloc(void)
+{
+	rlm_ldap_replica_t *replica;
+
+	MEM(replica = talloc_zero(NULL, rlm_ldap_replica_t));
+	pthread_rwlock_init(&replica->lock, NULL);
+	talloc_set_destructor(replica, _replica_free);
+
+	MEM(replica->by_key = fr_rb_inline_talloc_alloc(replica, ldap_replica_entry_t, key_node, replica_key_cmp, NULL));
+	MEM(replica->by_id = fr_rb_inline_talloc_alloc(replica, ldap_replica_entry_t, id_node, replica_id_cmp, NULL));
+
+	return replica;
+}
+
+/** Remove an entry from both indexes and free it
+ *
+ * @note Must be called with the write lock held.
+ */
+static void replica_entry_remove(rlm_ldap_replica_t *replica, ldap_replica_entry_t *entry)
+{
+	fr_rb_remove(replica->by_key, entry);
+	fr_rb_remove(replica->by_id, entry);
+	talloc_free(entry);
+}
+
+/** Find an entry by its id
+ *
+ * @note Must be called with the lock held.
+ */
+static ldap_replica_entry_t *replica_find_by_id(rlm_ldap_replica_t *replica, uint8_t const *id, size_t id_len)
+{
+	return fr_rb_find(replica->by_id, &(ldap_replica_entry_t){ .id = id, .id_len = id_len });
+}
+
+/** Add or replace a user object in the replica
+ *
+ * Top level attributes from the internal dictionary in the sync request
+ * (e.g. &Password.With-Header) are copied to the entry, along with the
+ * contents of &Proto.<protocol>.  Those are added to the control list
+ * when the entry is found.
+ *
+ * @param[in] replica	to update.
+ * @param[in] request	Sync request containing the entry.
+ * @param[in] id	Entry UUID, or DN if no UUID is available.
+ * @param[in] id_len	Length of the id.
+ * @param[in] orig_dn	Previous DN of the entry if it's been renamed.  May be NULL.
+ * @param[in] key	Value the entry should be found by.
+ * @param[in] dn	DN of the entry.
+ * @param[in] groups	Groups the entry is a member of.
+ */
+void rlm_ldap_replica_update(rlm_ldap_replica_t *replica, request_t *request,
+			     uint8_t const *id, size_t id_len, fr_value_box_t const *orig_dn,
+			     fr_value_box_t const *key, fr_value_box_t const *dn, fr_value_box_list_t *groups)
+{
+	ldap_replica_entry_t	*entry, *old;
+	unsigned int		count = 0, i = 0;
+
+	MEM(entry = talloc_zero(NULL, ldap_replica_entry_t));
+	entry->key = talloc_bstrndup(entry, key->vb_strvalue, key->vb_length);
+	entry->dn = talloc_bstrndup(entry, dn->vb_strvalue, dn->vb_length);
+	MEM(entry->id = talloc_memdup(entry, id, id_len));
+	entry->id_len = id_len;
+
+	fr_value_box_list_foreach(groups, vb) if (vb->type == FR_TYPE_STRING) count++;
+	MEM(entry->groups = talloc_array(entry, char const *, count));
+	fr_value_box_list_foreach(groups, vb) {
+		if (vb->type != FR_TYPE_STRING) continue;
+		entry->groups[i++] = talloc_bstrndup(entry->groups, vb->vb_strvalue, vb->vb_length);
+	}
+
+	fr_pair_list_init(&entry->pairs);
+	fr_pair_list_foreach(&request->request_pairs, vp) {
+		fr_pair_t *copy;
+
+		if (fr_dict_by_da(vp->da) != fr_dict_internal()) continue;
+
+		MEM(copy = fr_pair_copy(entry, vp));
+		fr_pair_append(&entry->pairs, copy);
+	}
+
+	pthread_rwlock_wrlock(&replica->lock);
+
+	/*
+	 *	Renamed entries are found by their old DN
+	 */
+	if (orig_dn && (orig_dn->type == FR_TYPE_STRING) && (orig_dn->vb_length > 0)) {
+		old = replica_find_by_id(replica, (uint8_t const *)orig_dn->vb_strvalue, orig_dn->vb_length);
+		if (old) replica_entry_remove(replica, old);
+	}
+
+	old = replica_find_by_id(replica, entry->id, entry->id_len);
+	if (old) replica_entry_remove(replica, old);
+
+	/*
+	 *	A different object claiming the same key
+	 *	replaces the original.
+	 */
+	old = fr_rb_find(replica->by_key, entry);
+	if (old) {
+		RWDEBUG("Replacing replica entry \"%s\" with \"%s\", both have key \"%s\"", old->dn, entry->dn, entry->key);
+		replica_entry_remove(replica, old);
+	}
+
+	talloc_steal(replica, entry);
+	fr_rb_insert(replica->by_key, entry);
+	fr_rb_insert(replica->by_id, entry);
+
+	RDEBUG2("Replica entry \"%s\" (%s) updated, %u entries", entry->key, entry->dn,
+		fr_rb_num_elements(replica->by_key));
+
+	pthread_rwlock_unlock(&replica->lock);
+}
+
+/** Remove a user object from the replica
+ *
+ * @param[in] replica	to update.
+ * @param[in] request	Sync request containing the entry.
+ * @param[in] id	Entry UUID, or DN if no UUID is available.
+ * @param[in] id_len	Length of the id.
+ */
+void rlm_ldap_replica_delete(rlm_ldap_replica_t *replica, request_t *request, uint8_t const *id, size_t id_len)
+{
+	ldap_replica_entry_t	*entry;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	entry = replica_find_by_id(replica, id, id_len);
+	if (entry) {
+		RDEBUG2("Replica entry \"%s\" (%s) removed", entry->key, entry->dn);
+		replica_entry_remove(replica, entry);
+	}
+	pthread_rwlock_unlock(&replica->lock);
+}
+
+/** Populate the control list from the replica
+ *
+ * Adds &control.LDAP-UserDN, so later operations don't need to search
+ * for the user, the group cache attribute, and any attributes stored
+ * with the entry.
+ *
+ * @param[out] p_result	NOTFOUND if there's no entry, else UPDATED.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] request	Current request.
+ * @param[in] key	to look the entry up by.
+ */
+unlang_action_t rlm_ldap_replica_apply(rlm_rcode_t *p_result, rlm_ldap_t const *inst, request_t *request,
+				       fr_value_box_t const *key)
+{
+	rlm_ldap_replica_t	*replica = inst->replica;
+	ldap_replica_entry_t	*entry;
+	fr_pair_t		*vp;
+	size_t			i;
+
+	pthread_rwlock_rdlock(&replica->lock);
+	entry = fr_rb_find(replica->by_key, &(ldap_replica_entry_t){ .key = key->vb_strvalue });
+	if (!entry) {
+		pthread_rwlock_unlock(&replica->lock);
+		RDEBUG2("No replica entry for \"%pV\"", key);
+		RETURN_MODULE_NOTFOUND;
+	}
+
+	RDEBUG2("Using replica entry \"%s\"", entry->dn);
+	RINDENT();
+
+	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
+	fr_pair_value_strdup(vp, entry->dn, false);
+	RDEBUG2("&control.%pP", vp);
+
+	if (inst->group.cacheable_name || inst->group.cacheable_dn) {
+		for (i = 0; i < talloc_array_length(entry->groups); i++) {
+			MEM(pair_append_control(&vp, inst->group.cache_da) == 0);
+			fr_pair_value_strdup(vp, entry->groups[i], false);
+			RDEBUG2("&control.%pP", vp);
+		}
+	}
+
+	fr_pair_list_foreach(&entry->pairs, stored) {
+		/*
+		 *	Protocol attributes are stored under
+		 *	&Proto.<protocol>, only add the ones which
+		 *	match this request.
+		 */
+		if (stored->da == attr_proto) {
+			fr_pair_list_foreach(&stored->vp_group, proto) {
+				fr_pair_list_foreach(&proto->vp_group, child) {
+					if (fr_dict_by_da(child->da) != request->dict) continue;
+
+					MEM(vp = fr_pair_copy(request->control_ctx, child));
+					fr_pair_append(&request->control_pairs, vp);
+					RDEBUG2("&control.%pP", vp);
+				}
+			}
+			continue;
+		}
+
+		MEM(vp = fr_pair_copy(request->control_ctx, stored));
+		fr_pair_append(&request->control_pairs, vp);
+		RDEBUG2("&control.%pP", vp);
+	}
+
+	REXDENT();
+	pthread_rwlock_unlock(&replica->lock);
+
+	RETURN_MODULE_UPDATED;
+}
@@ -113,6 +113,16 @@ static conf_parser_t user_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Group membership cache configuration
+ */
+static conf_parser_t group_membership_cache_config[] = {
+	{ FR_CONF_OFFSET("lifetime", rlm_ldap_t, group.membership_cache_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("negative_lifetime", rlm_ldap_t, group.membership_cache_negative_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", rlm_ldap_t, group.membership_cache_max_entries), .dflt = "16384" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Group configuration
  */
@@ -130,6 +140,15 @@ static conf_parser_t group_config[] = {
 	{ FR_CONF_OFFSET("group_attribute", rlm_ldap_t, group.attribute) },
 	{ FR_CONF_OFFSET("allow_dangling_group_ref", rlm_ldap_t, group.allow_dangling_refs), .dflt = "no" },
 	{ FR_CONF_OFFSET("skip_on_suspend", rlm_ldap_t, group.skip_on_suspend), .dflt = "yes"},
+	{ FR_CONF_POINTER("membership_cache", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) group_membership_cache_config },
+	CONF_PARSER_TERMINATOR
+};
+
+/*
+ *	Replica configuration
+ */
+static conf_parser_t replica_config[] = {
+	{ FR_CONF_OFFSET("enable", rlm_ldap_t, replica_enable), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -175,6 +194,8 @@ static const conf_parser_t module_config[] = {
 
 	{ FR_CONF_POINTER("profile", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) profile_config },
 
+	{ FR_CONF_POINTER("replica", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) replica_config },
+
 	{ FR_CONF_OFFSET_SUBSECTION("pool", 0, rlm_ldap_t, trunk_conf, trunk_config ) },
 
 	{ FR_CONF_OFFSET_SUBSECTION("bind_pool", 0, rlm_ldap_t, bind_trunk_conf, trunk_config ) },
@@ -244,6 +265,37 @@ static const call_env_method_t authorize_method_env = {
 								.pair.dflt = "(&)", .pair.dflt_quote = T_SINGLE_QUOTED_STRING },	//!< Correct filter for when the DN is known.
 						CALL_ENV_TERMINATOR
 					 } )) },
+		{ FR_CALL_ENV_SUBSECTION("replica", NULL, CALL_ENV_FLAG_NONE,
+					 ((call_env_parser_t[]) {
+						{ FR_CALL_ENV_OFFSET("key", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE,
+								     ldap_autz_call_env_t, replica_key),
+								.pair.dflt = "&User-Name", .pair.dflt_quote = T_BARE_WORD },
+						CALL_ENV_TERMINATOR
+					 } )) },
+		CALL_ENV_TERMINATOR
+	}
+};
+
+static const call_env_method_t replica_method_env = {
+	FR_CALL_ENV_METHOD_OUT(ldap_replica_call_env_t),
+	.env = (call_env_parser_t[]) {
+		{ FR_CALL_ENV_SUBSECTION("replica", NULL, CALL_ENV_FLAG_NONE,
+					 ((call_env_parser_t[]) {
+						{ FR_CALL_ENV_OFFSET("entry_key", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE,
+								     ldap_replica_call_env_t, key) },
+						{ FR_CALL_ENV_OFFSET("entry_dn", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE,
+								     ldap_replica_call_env_t, dn),
+								.pair.dflt = "&LDAP-Sync.Entry-DN", .pair.dflt_quote = T_BARE_WORD },
+						{ FR_CALL_ENV_OFFSET("entry_uuid", FR_TYPE_OCTETS, CALL_ENV_FLAG_NULLABLE,
+								     ldap_replica_call_env_t, uuid),
+								.pair.dflt = "&LDAP-Sync.Entry-UUID", .pair.dflt_quote = T_BARE_WORD },
+						{ FR_CALL_ENV_OFFSET("entry_original_dn", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE,
+								     ldap_replica_call_env_t, original_dn),
+								.pair.dflt = "&LDAP-Sync.Original-DN", .pair.dflt_quote = T_BARE_WORD },
+						{ FR_CALL_ENV_OFFSET("entry_groups", FR_TYPE_STRING, CALL_ENV_FLAG_NULLABLE,
+								     ldap_replica_call_env_t, groups) },
+						CALL_ENV_TERMINATOR
+					 } )) },
 		CALL_ENV_TERMINATOR
 	}
 };
@@ -319,6 +371,7 @@ fr_dict_attr_t const *attr_crypt_password;
 fr_dict_attr_t const *attr_ldap_userdn;
 fr_dict_attr_t const *attr_nt_password;
 fr_dict_attr_t const *attr_password_with_header;
+fr_dict_attr_t const *attr_proto;
 static fr_dict_attr_t const *attr_expr_bool_enum;
 
 extern fr_dict_attr_autoload_t rlm_ldap_dict_attr[];
@@ -329,6 +382,7 @@ fr_dict_attr_autoload_t rlm_ldap_dict_attr[] = {
 	{ .out = &attr_ldap_userdn, .name = "LDAP-UserDN", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
 	{ .out = &attr_nt_password, .name = "Password.NT", .type = FR_TYPE_OCTETS, .dict = &dict_freeradius },
 	{ .out = &attr_password_with_header, .name = "Password.With-Header", .type = FR_TYPE_STRING, .dict = &dict_freeradius },
+	{ .out = &attr_proto, .name = "Proto", .type = FR_TYPE_TLV, .dict = &dict_freeradius },
 	{ .out = &attr_expr_bool_enum, .name = "Expr-Bool-Enum", .type = FR_TYPE_BOOL, .dict = &dict_freeradius },
 
 	{ NULL }
@@ -875,6 +929,12 @@ static unlang_action_t ldap_group_xlat_results(rlm_rcode_t *p_result, UNUSED int
 		if (!xlat_ctx->dn) xlat_ctx->dn = rlm_find_user_dn_cached(request);
 		if (!xlat_ctx->dn) RETURN_MODULE_FAIL;
 
+		if (inst->group_cache &&
+		    (rlm_ldap_group_cache_find(&xlat_ctx->found, inst->group_cache, request,
+					       xlat_ctx->dn, xlat_ctx->group->vb_strvalue) == 0)) {
+			RETURN_MODULE_RCODE(xlat_ctx->found ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND);
+		}
+
 		if (inst->group.obj_membership_filter) {
 			REPEAT_LDAP_MEMBEROF_XLAT_RESULTS;
 			if (rlm_ldap_check_groupobj_dynamic(&rcode, request, xlat_ctx) == UNLANG_ACTION_PUSHED_CHILD) {
@@ -905,6 +965,13 @@ static unlang_action_t ldap_group_xlat_results(rlm_rcode_t *p_result, UNUSED int
 	}
 
 finish:
+	if (inst->group_cache && ((rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_NOTFOUND))) {
+		rlm_ldap_group_cache_insert(inst->group_cache, xlat_ctx->dn, xlat_ctx->group->vb_strvalue,
+					    xlat_ctx->found,
+					    xlat_ctx->found ? inst->group.membership_cache_lifetime :
+							      inst->group.membership_cache_negative_lifetime);
+	}
+
 	RETURN_MODULE_RCODE(rcode);
 }
 
@@ -992,6 +1059,22 @@ static xlat_action_t ldap_group_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat_ct
 		}
 	}
 
+	/*
+	 *	If the user's DN is already known, a previous check
+	 *	may let us avoid going to the directory at all.
+	 */
+	if (inst->group_cache) {
+		char const	*dn = rlm_find_user_dn_cached(request);
+		bool		member;
+
+		if (dn && (rlm_ldap_group_cache_find(&member, inst->group_cache, request, dn, group_vb->vb_strvalue) == 0)) {
+			MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_BOOL, attr_expr_bool_enum));
+			vb->vb_bool = member;
+			fr_dcursor_append(out, vb);
+			return XLAT_ACTION_DONE;
+		}
+	}
+
 	MEM(xlat_ctx = talloc(unlang_interpret_frame_talloc_ctx(request), ldap_group_xlat_ctx_t));
 
 	*xlat_ctx = (ldap_group_xlat_ctx_t){
@@ -1854,6 +1937,17 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	fr_ldap_map_exp_t	*expanded;
 	ldap_autz_call_env_t	*call_env = talloc_get_type_abort(mctx->env_data, ldap_autz_call_env_t);
 
+	/*
+	 *	If the user's in the replica there's no need
+	 *	to go to the directory.
+	 */
+	if (inst->replica && (call_env->replica_key.type == FR_TYPE_STRING)) {
+		rlm_rcode_t	rcode;
+
+		rlm_ldap_replica_apply(&rcode, inst, request, &call_env->replica_key);
+		if (rcode != RLM_MODULE_NOTFOUND) RETURN_MODULE_RCODE(rcode);
+	}
+
 	MEM(autz_ctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), ldap_autz_ctx_t));
 	talloc_set_destructor(autz_ctx, autz_ctx_free);
 	expanded = &autz_ctx->expanded;
@@ -2217,6 +2311,80 @@ static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, mod
 	RETURN_MODULE_NOOP;
 }
 
+/** Pick the value identifying a replica entry
+ *
+ * The entry UUID is preferred, as it remains constant if the entry is renamed.
+ */
+static int replica_entry_id(uint8_t const **id, size_t *id_len, ldap_replica_call_env_t const *call_env)
+{
+	if ((call_env->uuid.type == FR_TYPE_OCTETS) && (call_env->uuid.vb_length > 0)) {
+		*id = call_env->uuid.vb_octets;
+		*id_len = call_env->uuid.vb_length;
+		return 0;
+	}
+
+	if ((call_env->dn.type == FR_TYPE_STRING) && (call_env->dn.vb_length > 0)) {
+		*id = (uint8_t const *)call_env->dn.vb_strvalue;
+		*id_len = call_env->dn.vb_length;
+		return 0;
+	}
+
+	return -1;
+}
+
+/** Add or update a user object in the replica
+ *
+ * Called from the "recv Add" and "recv Modify" sections of an ldap_sync server.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_replica_update(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_ldap_t);
+	ldap_replica_call_env_t	*call_env = talloc_get_type_abort(mctx->env_data, ldap_replica_call_env_t);
+	uint8_t const		*id;
+	size_t			id_len;
+
+	if (!inst->replica) RETURN_MODULE_NOOP;
+
+	if ((call_env->key.type != FR_TYPE_STRING) || (call_env->key.vb_length == 0)) {
+		RDEBUG2("No replica key, ignoring entry");
+		RETURN_MODULE_NOOP;
+	}
+
+	if (call_env->dn.type != FR_TYPE_STRING) {
+		REDEBUG("Entry has no DN, can't add it to the replica");
+		RETURN_MODULE_INVALID;
+	}
+
+	if (replica_entry_id(&id, &id_len, call_env) < 0) RETURN_MODULE_INVALID;
+
+	rlm_ldap_replica_update(inst->replica, request, id, id_len, &call_env->original_dn,
+				&call_env->key, &call_env->dn, &call_env->groups);
+
+	RETURN_MODULE_UPDATED;
+}
+
+/** Remove a user object from the replica
+ *
+ * Called from the "recv Delete" section of an ldap_sync server.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_replica_delete(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_ldap_t);
+	ldap_replica_call_env_t	*call_env = talloc_get_type_abort(mctx->env_data, ldap_replica_call_env_t);
+	uint8_t const		*id;
+	size_t			id_len;
+
+	if (!inst->replica) RETURN_MODULE_NOOP;
+
+	if (replica_entry_id(&id, &id_len, call_env) < 0) {
+		REDEBUG("Entry has neither a UUID nor a DN, can't remove it from the replica");
+		RETURN_MODULE_INVALID;
+	}
+
+	rlm_ldap_replica_delete(inst->replica, request, id, id_len);
+
+	RETURN_MODULE_UPDATED;
+}
 
 /** Detach from the LDAP server and cleanup internal state.
  *
@@ -2226,6 +2394,8 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	rlm_ldap_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_ldap_t);
 
 	if (inst->user.obj_sort_ctrl) ldap_control_free(inst->user.obj_sort_ctrl);
+	TALLOC_FREE(inst->replica);
+	TALLOC_FREE(inst->group_cache);
 
 	return 0;
 }
@@ -2634,6 +2804,19 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		}
 	}
 
+	if (fr_time_delta_ispos(inst->group.membership_cache_lifetime) ||
+	    fr_time_delta_ispos(inst->group.membership_cache_negative_lifetime)) {
+		FR_INTEGER_BOUND_CHECK("group.membership_cache.max_entries", inst->group.membership_cache_max_entries, >=, 1);
+		inst->group_cache = rlm_ldap_group_cache_alloc(inst->group.membership_cache_max_entries);
+	}
+
+	if (inst->replica_enable) {
+		if (inst->user.obj_access_attr || inst->profile_attr || inst->profile_attr_suspend) {
+			cf_log_warn(conf, "Users found in the replica bypass 'user.access_attribute' and profile checks");
+		}
+		inst->replica = rlm_ldap_replica_alloc();
+	}
+
 	return 0;
 
 error:
@@ -2752,7 +2935,7 @@ module_rlm_t rlm_ldap = {
 	.common = {
 		.magic			= MODULE_MAGIC_INIT,
 		.name			= "ldap",
-		.flags			= 0,
+		.flags			= MODULE_TYPE_INSTANTIATE_PARALLEL,
 		.boot_size		= sizeof(rlm_ldap_boot_t),
 		.boot_type		= "rlm_ldap_boot_t",
 		.inst_size		= sizeof(rlm_ldap_t),
@@ -2776,6 +2959,9 @@ module_rlm_t rlm_ldap = {
 			{ .section = SECTION_NAME("authenticate", CF_IDENT_ANY), .method = mod_authenticate, .method_env = &authenticate_method_env },
 			{ .section = SECTION_NAME("authorize", CF_IDENT_ANY), .method = mod_authorize, .method_env = &authorize_method_env },
 
+			{ .section = SECTION_NAME("recv", "Add"), .method = mod_replica_update, .method_env = &replica_method_env },
+			{ .section = SECTION_NAME("recv", "Modify"), .method = mod_replica_update, .method_env = &replica_method_env },
+			{ .section = SECTION_NAME("recv", "Delete"), .method = mod_replica_delete, .method_env = &replica_method_env },
 			{ .section = SECTION_NAME("recv", CF_IDENT_ANY), .method = mod_authorize, .method_env = &authorize_method_env },
 			{ .section = SECTION_NAME("send", CF_IDENT_ANY), .method = mod_post_auth, .method_env = &usermod_method_env },
 			MODULE_BINDING_TERMINATOR
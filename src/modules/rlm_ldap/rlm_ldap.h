@@ -17,6 +17,9 @@
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/ldap/base.h>
 
+typedef struct rlm_ldap_replica_s rlm_ldap_replica_t;
+typedef struct rlm_ldap_group_cache_s rlm_ldap_group_cache_t;
+
 typedef struct {
 	CONF_SECTION	*cs;				//!< Section configuration.
 
@@ -94,8 +97,16 @@ typedef struct {
 								///< from a user object.
 
 		bool		skip_on_suspend;		//!< Don't process groups if the user is suspended.
+
+		fr_time_delta_t	membership_cache_lifetime;	//!< How long positive membership check results are kept.
+		fr_time_delta_t	membership_cache_negative_lifetime;	//!< How long negative membership check results
+								///< are kept.
+		uint32_t	membership_cache_max_entries;	//!< Maximum number of membership check results to keep.
 	} group;
 
+	rlm_ldap_group_cache_t *group_cache;		//!< Results of previous membership checks.  Allocated outside
+							//!< of the instance data, as it's modified at runtime.
+
 	char const	*valuepair_attr;		//!< Generic dynamic mapping attribute, contains a RADIUS
 							//!< attribute and value.
 
@@ -128,6 +139,13 @@ typedef struct {
 	trunk_conf_t	trunk_conf;			//!< Trunk configuration
 	trunk_conf_t	bind_trunk_conf;		//!< Trunk configuration for trunk used for bind auths
 
+	/*
+	 *	Replica
+	 */
+	bool		replica_enable;			//!< Maintain a local copy of user objects from ldap_sync.
+	rlm_ldap_replica_t *replica;			//!< Local copy of user objects.  Allocated outside of
+							//!< the instance data, as it's modified at runtime.
+
 	module_instance_t const *mi;			//!< Module instance data for thread lookups.
 } rlm_ldap_t;
 
@@ -149,8 +167,21 @@ typedef struct {
 
 	fr_value_box_t 	const *expect_password;		//!< True if the user_map included a mapping between an LDAP
 							//!< attribute and one of our password reference attributes.
+
+	fr_value_box_t	replica_key;			//!< Key to look the user up by in the replica.
 } ldap_autz_call_env_t;
 
+/** Call environment used when updating the replica from ldap_sync
+ *
+ */
+typedef struct {
+	fr_value_box_t	key;				//!< Key the entry will be found by.
+	fr_value_box_t	dn;				//!< DN of the entry.
+	fr_value_box_t	uuid;				//!< Entry UUID, if the server provides one.
+	fr_value_box_t	original_dn;			//!< Previous DN of a renamed entry.
+	fr_value_box_list_t groups;			//!< Groups the entry is a member of.
+} ldap_replica_call_env_t;
+
 /** Call environment used in group membership xlat
  *
  */
@@ -238,6 +269,7 @@ extern HIDDEN fr_dict_attr_t const *attr_crypt_password;
 extern HIDDEN fr_dict_attr_t const *attr_ldap_userdn;
 extern HIDDEN fr_dict_attr_t const *attr_nt_password;
 extern HIDDEN fr_dict_attr_t const *attr_password_with_header;
+extern HIDDEN fr_dict_attr_t const *attr_proto;
 
 extern HIDDEN fr_dict_attr_t const *attr_user_password;
 extern HIDDEN fr_dict_attr_t const *attr_user_name;
@@ -282,6 +314,28 @@ unlang_action_t rlm_ldap_check_userobj_dynamic(rlm_rcode_t *p_result, request_t
 unlang_action_t rlm_ldap_check_cached(rlm_rcode_t *p_result,
 				      rlm_ldap_t const *inst, request_t *request, fr_value_box_t const *check);
 
+rlm_ldap_group_cache_t *rlm_ldap_group_cache_alloc(uint32_t max_entries);
+
+int rlm_ldap_group_cache_find(bool *member, rlm_ldap_group_cache_t *cache, request_t *request,
+			      char const *user_dn, char const *group);
+
+void rlm_ldap_group_cache_insert(rlm_ldap_group_cache_t *cache, char const *user_dn, char const *group,
+				 bool member, fr_time_delta_t lifetime);
+
 unlang_action_t rlm_ldap_map_profile(fr_ldap_result_code_t *ret,
 				     rlm_ldap_t const *inst, request_t *request, fr_ldap_thread_trunk_t *ttrunk,
 				     char const *dn, int scope, char const *filter, fr_ldap_map_exp_t const *expanded);
+
+/*
+ *	replica.c - Local copy of user objects.
+ */
+rlm_ldap_replica_t *rlm_ldap_replica_alloc(void);
+
+void rlm_ldap_replica_update(rlm_ldap_replica_t *replica, request_t *request,
+			     uint8_t const *id, size_t id_len, fr_value_box_t const *orig_dn,
+			     fr_value_box_t const *key, fr_value_box_t const *dn, fr_value_box_list_t *groups);
+
+void rlm_ldap_replica_delete(rlm_ldap_replica_t *replica, request_t *request, uint8_t const *id, size_t id_len);
+
+unlang_action_t rlm_ldap_replica_apply(rlm_rcode_t *p_result, rlm_ldap_t const *inst, request_t *request,
+				       fr_value_box_t const *key);
@@ -122,6 +122,7 @@ typedef struct {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		bool			fsync;			//!< fsync after each write.
+		bool			atomic_append;		//!< Per-thread descriptors, O_APPEND, no locking.
 	} file;
 
 	struct {
@@ -132,9 +133,31 @@ typedef struct {
 	linelog_net_t		tcp;			//!< TCP server.
 	linelog_net_t		udp;			//!< UDP server.
 
+	struct {
+		uint32_t		size;			//!< Maximum bytes buffered per destination.
+							///< 0 disables batching.
+		fr_time_delta_t		delay;			//!< Maximum time lines are buffered for.
+		bool			wait;			//!< Don't return until the lines have been written.
+		bool			fsync;			//!< Sync files after writing a batch.
+		fr_time_delta_t		sync_interval;		//!< Minimum time between syncs.
+	} batch;
+
 	CONF_SECTION		*cs;			//!< #CONF_SECTION to use as the root for #log_ref lookups.
 } rlm_linelog_t;
 
+typedef struct linelog_batch_s linelog_batch_t;
+
+/** linelog thread instance
+ */
+typedef struct {
+	char const		*name;			//!< Module instance name, for logging.
+	rlm_linelog_t const	*inst;			//!< Module instance.
+	fr_event_list_t		*el;			//!< For batch timers.
+	fr_rb_tree_t		*batches;		//!< Batches for file destinations, by filename.
+							///< NULL if batching is disabled.
+	linelog_batch_t		*sock_batch;		//!< Batch for socket destinations.
+} rlm_linelog_thread_t;
+
 typedef struct {
 	int			sockfd;			//!< File descriptor associated with socket
 } linelog_conn_t;
@@ -145,6 +168,7 @@ static const conf_parser_t file_config[] = {
 	{ FR_CONF_OFFSET("group", rlm_linelog_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", rlm_linelog_t, file.escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("fsync", rlm_linelog_t, file.fsync), .dflt = "no" },
+	{ FR_CONF_OFFSET("atomic_append", rlm_linelog_t, file.atomic_append), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -173,6 +197,15 @@ static const conf_parser_t tcp_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const conf_parser_t batch_config[] = {
+	{ FR_CONF_OFFSET("size", rlm_linelog_t, batch.size), .dflt = "0" },
+	{ FR_CONF_OFFSET("delay", rlm_linelog_t, batch.delay), .dflt = "0.01" },
+	{ FR_CONF_OFFSET("wait", rlm_linelog_t, batch.wait), .dflt = "no" },
+	{ FR_CONF_OFFSET("fsync", rlm_linelog_t, batch.fsync), .dflt = "no" },
+	{ FR_CONF_OFFSET("sync_interval", rlm_linelog_t, batch.sync_interval), .dflt = "1" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("destination", CONF_FLAG_REQUIRED, rlm_linelog_t, log_dst_str) },
 
@@ -186,6 +219,7 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_POINTER("unix", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) unix_config },
 	{ FR_CONF_OFFSET_SUBSECTION("tcp", 0, rlm_linelog_t, tcp, tcp_config) },
 	{ FR_CONF_OFFSET_SUBSECTION("udp", 0, rlm_linelog_t, udp, udp_config) },
+	{ FR_CONF_POINTER("batch", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) batch_config },
 
 	/*
 	 *	Deprecated config items
@@ -573,12 +607,338 @@ static int linelog_write(rlm_linelog_t const *inst, linelog_call_env_t const *ca
 	return ret;
 }
 
+/** Lines waiting to be written to one destination
+ *
+ * Each worker thread has its own batches, so appending doesn't need
+ * any locks.
+ */
+struct linelog_batch_s {
+	fr_rb_node_t		node;			//!< Entry in the thread's tree of batches.
+	rlm_linelog_thread_t	*t;			//!< Thread this batch belongs to.
+
+	char const		*filename;		//!< File to write to.  NULL for socket destinations.
+	char const		*dir;			//!< Directory containing the file.
+	char const		*header;		//!< Header to write if the file is new.
+
+	uint8_t			*buff;			//!< Lines waiting to be written.
+	size_t			used;			//!< How much of the buffer is in use.
+
+	fr_dlist_head_t		waiting;		//!< Requests waiting for the batch to be written.
+	fr_event_timer_t const	*ev;			//!< When to write the batch.
+	fr_time_t		last_sync;		//!< When the file was last synced.
+};
+
+/** A request waiting for the batch containing its lines to be written
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the batch's list of waiting requests.
+	request_t		*request;		//!< Request to resume.
+	linelog_batch_t		*batch;			//!< Batch the request is waiting for.  NULL once written.
+	bool			failed;			//!< Whether writing the batch failed.
+} linelog_batch_wait_t;
+
+static int8_t linelog_batch_cmp(void const *one, void const *two)
+{
+	linelog_batch_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->filename, b->filename);
+	return CMP(ret, 0);
+}
+
+/** Write a batch of lines out to the destination
+ *
+ * Requests waiting for the batch are resumed, whether or not the write
+ * succeeded.
+ */
+static int linelog_batch_flush(linelog_batch_t *batch)
+{
+	rlm_linelog_thread_t const	*t = batch->t;
+	rlm_linelog_t const		*inst = t->inst;
+	linelog_batch_wait_t		*wait;
+	struct iovec			vector;
+	int				ret = 0;
+
+	if (batch->ev) fr_event_timer_delete(&batch->ev);
+
+	if (!batch->used) goto done;
+
+	vector.iov_base = batch->buff;
+	vector.iov_len = batch->used;
+
+	if (batch->filename) {
+		int	fd;
+		off_t	offset;
+
+		if (batch->dir && (fr_mkdir(NULL, batch->dir, -1, 0700, NULL, NULL) < 0)) {
+			ERROR("%s - Failed to create directory %s: %s", t->name, batch->dir, fr_syserror(errno));
+			ret = -1;
+			goto done;
+		}
+
+		fd = exfile_open(inst->file.ef, batch->filename, inst->file.permissions, &offset);
+		if (fd < 0) {
+			ERROR("%s - Failed to open %s: %s", t->name, batch->filename, fr_syserror(errno));
+			ret = -1;
+			goto done;
+		}
+
+		if (batch->header && (offset == 0) &&
+		    ((write(fd, batch->header, talloc_array_length(batch->header) - 1) < 0) ||
+		     (write(fd, inst->delimiter, inst->delimiter_len) < 0))) {
+		write_fail:
+			ERROR("%s - Failed writing to %s: %s", t->name, batch->filename, fr_syserror(errno));
+			exfile_close(inst->file.ef, fd);
+			ret = -1;
+			goto done;
+		}
+
+		if (fr_writev(fd, &vector, 1, fr_time_delta_wrap(0)) < 0) goto write_fail;
+
+		/*
+		 *	Sync at most once per sync_interval, so that a
+		 *	busy server isn't limited by the storage.
+		 */
+		if (inst->batch.fsync &&
+		    fr_time_gteq(fr_time(), fr_time_add(batch->last_sync, inst->batch.sync_interval))) {
+			if (fsync(fd) < 0) {
+				ERROR("%s - Failed syncing %s to persistent storage: %s",
+				      t->name, batch->filename, fr_syserror(errno));
+				exfile_close(inst->file.ef, fd);
+				ret = -1;
+				goto done;
+			}
+			batch->last_sync = fr_time();
+		}
+
+		exfile_close(inst->file.ef, fd);
+
+	} else {
+		linelog_conn_t	*conn;
+		fr_time_delta_t	timeout;
+		int		i, num;
+
+		switch (inst->log_dst) {
+		case LINELOG_DST_UNIX:
+			timeout = inst->unix_sock.timeout;
+			break;
+
+		case LINELOG_DST_UDP:
+			timeout = inst->udp.timeout;
+			break;
+
+		default:
+			timeout = inst->tcp.timeout;
+			break;
+		}
+		if (!fr_time_delta_ispos(timeout)) timeout = fr_time_delta_wrap(0);
+
+		num = fr_pool_state(inst->pool)->num;
+		conn = fr_pool_connection_get(inst->pool, NULL);
+		if (!conn) {
+			ret = -1;
+			goto done;
+		}
+
+		for (i = num; i >= 0; i--) {
+			char discard[64];
+
+			if (fr_writev(conn->sockfd, &vector, 1, timeout) < 0) {
+				WARN("%s - Failed writing to socket: %s.  Will reconnect and try again...",
+				     t->name, fr_syserror(errno));
+				conn = fr_pool_connection_reconnect(inst->pool, NULL, conn);
+				if (!conn) break;
+				continue;
+			}
+
+			/* Drain the receive buffer */
+			while (read(conn->sockfd, discard, sizeof(discard)) > 0);
+			break;
+		}
+
+		if (!conn || (i < 0)) {
+			ERROR("%s - Failed writing batch of %zu bytes", t->name, batch->used);
+			ret = -1;
+		}
+
+		if (conn) fr_pool_connection_release(inst->pool, NULL, conn);
+	}
+
+done:
+	batch->used = 0;
+
+	while ((wait = fr_dlist_pop_head(&batch->waiting))) {
+		wait->batch = NULL;
+		wait->failed = (ret < 0);
+		unlang_interpret_mark_runnable(wait->request);
+	}
+
+	return ret;
+}
+
+static void linelog_batch_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	linelog_batch_t	*batch = talloc_get_type_abort(uctx, linelog_batch_t);
+
+	(void) linelog_batch_flush(batch);
+}
+
+/** Find or create the batch for the destination of a request
+ *
+ */
+static linelog_batch_t *linelog_batch_find(rlm_linelog_thread_t *t, linelog_call_env_t const *call_env)
+{
+	linelog_batch_t	*batch;
+	char const	*filename = NULL;
+	char const	*p;
+
+	if (t->inst->log_dst == LINELOG_DST_FILE) {
+		if (!call_env->filename) return NULL;
+
+		filename = call_env->filename->vb_strvalue;
+		batch = fr_rb_find(t->batches, &(linelog_batch_t){ .filename = filename });
+	} else {
+		batch = t->sock_batch;
+	}
+	if (batch) return batch;
+
+	MEM(batch = talloc_zero(t, linelog_batch_t));
+	batch->t = t;
+	MEM(batch->buff = talloc_array(batch, uint8_t, t->inst->batch.size));
+	fr_dlist_talloc_init(&batch->waiting, linelog_batch_wait_t, entry);
+
+	if (!filename) {
+		t->sock_batch = batch;
+		return batch;
+	}
+
+	batch->filename = talloc_strdup(batch, filename);
+	p = strrchr(filename, '/');
+	if (p) batch->dir = talloc_bstrndup(batch, filename, p - filename);
+	if (call_env->log_head) batch->header = talloc_bstrndup(batch, call_env->log_head->vb_strvalue,
+								 call_env->log_head->vb_length);
+	fr_rb_insert(t->batches, batch);
+
+	return batch;
+}
+
+/** Add lines to a batch
+ *
+ * The batch is written first if the lines don't fit, and the lines are
+ * written directly if they don't fit in an empty batch.
+ *
+ * @return
+ *	- 1 if the lines were added to the batch.
+ *	- 0 if the lines are too large for a batch, and should be written directly.
+ *	- -1 on error.
+ */
+static int linelog_batch_add(linelog_batch_t *batch, request_t *request,
+			     struct iovec *vector_p, size_t vector_len)
+{
+	rlm_linelog_t const	*inst = batch->t->inst;
+	size_t			len = 0, i;
+
+	for (i = 0; i < vector_len; i++) len += vector_p[i].iov_len;
+
+	if ((batch->used + len) > inst->batch.size) {
+		if (linelog_batch_flush(batch) < 0) {
+			REDEBUG("Failed writing batch");
+			return -1;
+		}
+
+		/*
+		 *	Too large for a batch.  Write it the normal
+		 *	way, so that the lines aren't split.
+		 */
+		if (len > inst->batch.size) return 0;
+	}
+
+	if (RDEBUG_ENABLED3) linelog_hexdump(request, vector_p, vector_len, "linelog data");
+
+	for (i = 0; i < vector_len; i++) {
+		memcpy(batch->buff + batch->used, vector_p[i].iov_base, vector_p[i].iov_len);
+		batch->used += vector_p[i].iov_len;
+	}
+
+	if (!batch->ev && (fr_event_timer_in(batch, batch->t->el, &batch->ev, inst->batch.delay,
+					     linelog_batch_timeout, batch) < 0)) {
+		RPERROR("Failed inserting batch timer");
+		return (linelog_batch_flush(batch) < 0) ? -1 : 1;
+	}
+
+	return 1;
+}
+
+static unlang_action_t mod_batch_written(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	linelog_batch_wait_t *wait = talloc_get_type_abort(mctx->rctx, linelog_batch_wait_t);
+
+	if (wait->failed) {
+		REDEBUG("Failed writing batch");
+		RETURN_MODULE_FAIL;
+	}
+
+	RETURN_MODULE_OK;
+}
+
+static void mod_batch_written_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	linelog_batch_wait_t *wait = talloc_get_type_abort(mctx->rctx, linelog_batch_wait_t);
+
+	if (wait->batch) fr_dlist_remove(&wait->batch->waiting, wait);
+}
+
+/** Write lines, batching them if configured to
+ *
+ */
+static unlang_action_t linelog_send(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				    struct iovec *vector_p, size_t vector_len, bool with_delim)
+{
+	rlm_linelog_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
+	linelog_call_env_t const	*call_env = talloc_get_type_abort(mctx->env_data, linelog_call_env_t);
+	linelog_batch_t			*batch;
+	linelog_batch_wait_t		*wait;
+
+	if (!t->batches) {
+	write:
+		RETURN_MODULE_RCODE(linelog_write(inst, call_env, request, vector_p, vector_len, with_delim) < 0 ?
+				    RLM_MODULE_FAIL : RLM_MODULE_OK);
+	}
+
+	batch = linelog_batch_find(t, call_env);
+	if (!batch) goto write;
+
+	switch (linelog_batch_add(batch, request, vector_p, vector_len)) {
+	case 0:
+		goto write;
+
+	case 1:
+		break;
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+
+	if (!inst->batch.wait || !batch->used) RETURN_MODULE_OK;
+
+	MEM(wait = talloc_zero(unlang_interpret_frame_talloc_ctx(request), linelog_batch_wait_t));
+	wait->request = request;
+	wait->batch = batch;
+	fr_dlist_insert_tail(&batch->waiting, wait);
+
+	return unlang_module_yield(request, mod_batch_written, mod_batch_written_signal, ~FR_SIGNAL_CANCEL, wait);
+}
+
 static xlat_action_t linelog_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				  xlat_ctx_t const *xctx, request_t *request,
 				  fr_value_box_list_t *args)
 {
 	rlm_linelog_t const		*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t		*t = talloc_get_type_abort(xctx->mctx->thread, rlm_linelog_thread_t);
 	linelog_call_env_t const	*call_env = talloc_get_type_abort(xctx->env_data, linelog_call_env_t);
+	linelog_batch_t			*batch;
 
 	struct iovec			vector[2];
 	size_t				i = 0;
@@ -598,9 +958,29 @@ static xlat_action_t linelog_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		vector[i].iov_len = inst->delimiter_len;
 		i++;
 	}
+
+	/*
+	 *	The expansion can't wait for the batch to be
+	 *	written, so "batch.wait" doesn't apply here.
+	 */
+	if (t->batches && (batch = linelog_batch_find(t, call_env))) {
+		switch (linelog_batch_add(batch, request, vector, i)) {
+		case 1:
+			slen = vector[0].iov_len + (with_delim ? inst->delimiter_len : 0);
+			goto done;
+
+		case 0:
+			break;
+
+		default:
+			return XLAT_ACTION_FAIL;
+		}
+	}
+
 	slen = linelog_write(inst, call_env, request, vector, i, with_delim);
 	if (slen < 0) return XLAT_ACTION_FAIL;
 
+done:
 	MEM(wrote = fr_value_box_alloc(ctx, FR_TYPE_SIZE, NULL));
 	wrote->vb_size = (size_t)slen;
 
@@ -667,7 +1047,7 @@ static unlang_action_t CC_HINT(nonnull) mod_do_linelog_resume(rlm_rcode_t *p_res
 		}
 	}
 
-	RETURN_MODULE_RCODE(linelog_write(inst, call_env, request, vector, vector_len, rctx->with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK);
+	return linelog_send(p_result, mctx, request, vector, vector_len, rctx->with_delim);
 }
 
 /** Write a linelog message
@@ -810,7 +1190,7 @@ build_vector:
 		int			alloced = VECTOR_INCREMENT, i;
 		struct iovec		*vector = NULL, *vector_p;
 		size_t			vector_len;
-		rlm_rcode_t		rcode = RLM_MODULE_OK;
+		unlang_action_t		ua;
 
 		MEM(vector = talloc_array(frame_ctx, struct iovec, alloced));
 		for (vp = tmpl_dcursor_init(NULL, NULL, &cc, &cursor, request, vpt_p), i = 0;
@@ -851,15 +1231,16 @@ build_vector:
 
 		if (vector_len == 0) {
 			RDEBUG2("No data to write");
-			rcode = RLM_MODULE_NOOP;
+			*p_result = RLM_MODULE_NOOP;
+			ua = UNLANG_ACTION_CALCULATE_RESULT;
 		} else {
-			rcode = linelog_write(inst, call_env, request, vector_p, vector_len, with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
+			ua = linelog_send(p_result, mctx, request, vector_p, vector_len, with_delim);
 		}
 
 		talloc_free(vpt);
 		talloc_free(vector);
 
-		RETURN_MODULE_RCODE(rcode);
+		return ua;
 	}
 
 	/*
@@ -910,6 +1291,40 @@ static int call_env_filename_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t cons
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_linelog_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
+
+	t->name = mctx->mi->name;
+	t->inst = inst;
+	t->el = mctx->el;
+
+	if (!inst->batch.size) return 0;
+
+	MEM(t->batches = fr_rb_inline_talloc_alloc(t, linelog_batch_t, node, linelog_batch_cmp, NULL));
+
+	return 0;
+}
+
+/** Write out anything which is still buffered
+ *
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
+
+	if (!t->batches) return 0;
+
+	fr_rb_inorder_foreach(t->batches, linelog_batch_t, batch) {
+		(void) linelog_batch_flush(batch);
+	}}
+
+	if (t->sock_batch) (void) linelog_batch_flush(t->sock_batch);
+
+	return 0;
+}
+
 static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_linelog_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_linelog_t);
@@ -955,6 +1370,10 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 			cf_log_err(conf, "Failed creating log file context");
 			return -1;
 		}
+		if (inst->file.atomic_append && (exfile_enable_per_thread(inst->file.ef) < 0)) {
+			cf_log_perr(conf, "Failed enabling per-thread file descriptors");
+			return -1;
+		}
 
 		if (inst->file.group_str) {
 			char *endptr;
@@ -1031,6 +1450,24 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		break;
 	}
 
+	/*
+	 *	Only files and sockets are worth batching.
+	 */
+	if (inst->batch.size) switch (inst->log_dst) {
+	case LINELOG_DST_FILE:
+	case LINELOG_DST_UNIX:
+	case LINELOG_DST_UDP:
+	case LINELOG_DST_TCP:
+		FR_TIME_DELTA_BOUND_CHECK("batch.delay", inst->batch.delay, >=, fr_time_delta_from_usec(100));
+		FR_TIME_DELTA_BOUND_CHECK("batch.delay", inst->batch.delay, <=, fr_time_delta_from_sec(10));
+		break;
+
+	default:
+		cf_log_warn(conf, "Ignoring 'batch' configuration for destination \"%s\"", inst->log_dst_str);
+		inst->batch.size = 0;
+		break;
+	}
+
 	inst->delimiter_len = talloc_array_length(inst->delimiter) - 1;
 	inst->cs = conf;
 
@@ -1065,7 +1502,11 @@ module_rlm_t rlm_linelog = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+
+		.thread_inst_size	= sizeof(rlm_linelog_thread_t),
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
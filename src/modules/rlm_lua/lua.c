@@ -458,9 +458,9 @@ static int _lua_pair_iterator_init(lua_State *L)
 	 *	This function should only be called as a closure.
 	 *	As we control the upvalues, we should assert on errors.
 	 */
-	fr_assert(lua_isuserdata(L, lua_upvalueindex(2)));
+	fr_assert(lua_isuserdata(L, lua_upvalueindex(1)));
 
-	da = lua_touserdata(L, lua_upvalueindex(2));
+	da = lua_touserdata(L, lua_upvalueindex(1));
 	fr_assert(da);
 
 	cursor = (fr_dcursor_t*) lua_newuserdata(L, sizeof(fr_dcursor_t));
@@ -559,9 +559,8 @@ static int _lua_pair_accessor_init(lua_State *L)
 	 *	for v in request[User-Name].pairs() do
 	 */
 	lua_newtable(L);
-	lua_pushlightuserdata(L, &request->request_pairs);
 	lua_pushlightuserdata(L, up);
-	lua_pushcclosure(L, _lua_pair_iterator_init, 2);
+	lua_pushcclosure(L, _lua_pair_iterator_init, 1);
 	lua_setfield(L, -2, "pairs");
 
 	/*
@@ -718,8 +717,26 @@ static int fr_lua_get_field(lua_State *L, request_t *request, char const *field)
 	return 0;
 }
 
+/** Setup "fr.request.{}"
+ *
+ * The table, and the accessors cached in it, are kept between calls.
+ * Accessors find the current request with fr_lua_util_get_request()
+ * when they're called, so they only need to be rebuilt if the
+ * dictionary attributes are resolved in changes.
+ */
 static void _lua_fr_request_register(lua_State *L, request_t *request)
 {
+	fr_dict_t const	*dict = request ? request->dict : NULL;
+	bool		cached;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "fr_request_dict");
+	cached = !lua_isnil(L, -1) && (lua_touserdata(L, -1) == dict);
+	lua_pop(L, 1);
+	if (cached) return;
+
+	lua_pushlightuserdata(L, UNCONST(fr_dict_t *, dict));
+	lua_setfield(L, LUA_REGISTRYINDEX, "fr_request_dict");
+
 	/* fr = {} */
 	lua_getglobal(L, "fr");
 	luaL_checktype(L, -1, LUA_TTABLE);
@@ -728,17 +745,10 @@ static void _lua_fr_request_register(lua_State *L, request_t *request)
 	lua_newtable(L);
 
 	if (request) {
-		fr_dcursor_t 	cursor;
-
-		/* Attribute list table */
-		fr_pair_list_sort(&request->request_pairs, fr_pair_cmp_by_da);
-		fr_pair_dcursor_init(&cursor, &request->request_pairs);
-
 		/*
 		 *	Setup the environment
 		 */
-		lua_pushlightuserdata(L, &cursor);
-		lua_pushcclosure(L, _lua_list_iterator_init, 1);
+		lua_pushcclosure(L, _lua_list_iterator_init, 0);
 		lua_setfield(L, -2, "pairs");
 
 		lua_newtable(L);		/* Attribute list meta-table */
@@ -749,6 +759,7 @@ static void _lua_fr_request_register(lua_State *L, request_t *request)
 	}
 
 	lua_setfield(L, -2, "request");
+	lua_pop(L, 1);
 }
 
 unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, char const *funcname)
@@ -757,6 +768,8 @@ unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, requ
 	lua_State		*L = thread->interpreter;
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
 
+	RLM_LUA_STACK_SET();
+
 	fr_lua_util_set_mctx(mctx);
 	fr_lua_util_set_request(request);
 
@@ -771,6 +784,7 @@ unlang_action_t fr_lua_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, requ
 error:
 		fr_lua_util_set_mctx(NULL);
 		fr_lua_util_set_request(NULL);
+		RLM_LUA_STACK_RESET();
 
 		RETURN_MODULE_FAIL;
 	}
@@ -816,6 +830,7 @@ error:
 done:
 	fr_lua_util_set_mctx(NULL);
 	fr_lua_util_set_request(NULL);
+	RLM_LUA_STACK_RESET();
 
 	RETURN_MODULE_RCODE(rcode);
 }
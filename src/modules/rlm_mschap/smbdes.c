@@ -26,8 +26,9 @@
 
 /* NOTES:
 
-   This code makes no attempt to be fast! In fact, it is a very
-   slow implementation
+   The permutations and S-boxes are turned into lookup tables the
+   first time they're used, so each DES block is about 100 table
+   lookups.
 
    This code is NOT a complete DES implementation. It implements only
    the minimum necessary for SMB authentication, as used by all SMB
@@ -51,6 +52,7 @@ RCSID("$Id$")
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "smbdes.h"
 
 
@@ -155,118 +157,131 @@ static const uchar sbox[8][4][16] = {
 	 {7, 11,  4,  1,  9, 12, 14,  2,  0,  6, 10, 13, 15,  3,  5,  8},
 	 {2,  1, 14,  7,  4, 10,  8, 13, 15, 12,  9,  0,  3,  5,  6, 11}}};
 
-static void permute(char *out, char const *in, uchar const *p, int n)
+/*
+ *	Each permutation is done with one table lookup per input byte.
+ *	The entry for a byte value is the output with only the bits
+ *	from that byte set.  The S-boxes are combined with the P
+ *	permutation, so each round is 8 lookups.
+ *
+ *	The tables are built from the ones above, the first time
+ *	they're needed.
+ */
+typedef struct {
+	uint64_t	ip[8][256];		//!< perm3, initial permutation.
+	uint64_t	fp[8][256];		//!< perm6, final permutation.
+	uint64_t	pc1[8][256];		//!< perm1, key bits to C and D.
+	uint64_t	pc2[7][256];		//!< perm2, C and D to the round key.
+	uint64_t	e[4][256];		//!< perm4, expansion of R.
+	uint32_t	sp[8][64];		//!< sbox then perm5.
+} smbdes_tables_t;
+
+static smbdes_tables_t	tables;
+static pthread_once_t	tables_once = PTHREAD_ONCE_INIT;
+
+/*
+ *	Bit 1 of the input is the most significant of in_bits, and
+ *	bit 1 of the output is the most significant of n.
+ */
+static void table_build(uint64_t table[][256], uchar const *p, int n, int in_bits)
 {
-	int i;
-	for (i=0;i<n;i++)
-		out[i] = in[p[i]-1];
+	int i, v;
+
+	memset(table, 0, sizeof(uint64_t) * 256 * (in_bits / 8));
+
+	for (i = 0; i < n; i++) {
+		int in = p[i] - 1;
+
+		for (v = 0; v < 256; v++) {
+			if (v & (0x80 >> (in % 8))) table[in / 8][v] |= ((uint64_t) 1) << (n - 1 - i);
+		}
+	}
 }
 
-static void lshift(char *d, int count, int n)
+static inline uint64_t table_permute(uint64_t const table[][256], uint64_t in, int in_bits)
 {
-	char out[64];
-	int i;
-	for (i=0;i<n;i++)
-		out[i] = d[(i+count)%n];
-	for (i=0;i<n;i++)
-		d[i] = out[i];
+	uint64_t	out = 0;
+	int		i;
+
+	for (i = 0; i < in_bits / 8; i++) out |= table[i][(in >> (in_bits - 8 - (i * 8))) & 0xff];
+
+	return out;
 }
 
-static void concat(char *out, char *in1, char *in2, int l1, int l2)
+static void tables_init(void)
 {
-	while (l1--)
-		*out++ = *in1++;
-	while (l2--)
-		*out++ = *in2++;
+	int i, j;
+
+	table_build(tables.ip, perm3, 64, 64);
+	table_build(tables.fp, perm6, 64, 64);
+	table_build(tables.pc1, perm1, 56, 64);
+	table_build(tables.pc2, perm2, 48, 56);
+	table_build(tables.e, perm4, 48, 32);
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 64; j++) {
+			int		row = ((j >> 4) & 0x02) | (j & 0x01);
+			int		col = (j >> 1) & 0x0f;
+			uint32_t	cb = ((uint32_t) sbox[i][row][col]) << (28 - (i * 4));
+			uint32_t	out = 0;
+			int		k;
+
+			for (k = 0; k < 32; k++) {
+				if (cb & (((uint32_t) 1) << (32 - perm5[k]))) out |= ((uint32_t) 1) << (31 - k);
+			}
+			tables.sp[i][j] = out;
+		}
+	}
 }
 
-static void xor(char *out, char *in1, char *in2, int n)
+static inline uint32_t rotl28(uint32_t v, int count)
 {
-	int i;
-	for (i=0;i<n;i++)
-		out[i] = in1[i] ^ in2[i];
+	return ((v << count) | (v >> (28 - count))) & 0x0fffffff;
 }
 
-static void dohash(char *out, char *in, char *key)
+static void dohash(uint8_t out[8], uint8_t const in[8], uint8_t const key[8])
 {
-	int i, j, k;
-	char pk1[56];
-	char c[28];
-	char d[28];
-	char cd[56];
-	char ki[16][48];
-	char pd1[64];
-	char l[32], r[32];
-	char rl[64];
-
-	permute(pk1, key, perm1, 56);
-
-	for (i=0;i<28;i++)
-		c[i] = pk1[i];
-	for (i=0;i<28;i++)
-		d[i] = pk1[i+28];
-
-	for (i=0;i<16;i++) {
-		lshift(c, sc[i], 28);
-		lshift(d, sc[i], 28);
-
-		concat(cd, c, d, 28, 28);
-		permute(ki[i], cd, perm2, 48);
-	}
-
-	permute(pd1, in, perm3, 64);
+	uint64_t	k = 0, block = 0, cd;
+	uint32_t	c, d, l, r;
+	int		i, j;
 
-	for (j=0;j<32;j++) {
-		l[j] = pd1[j];
-		r[j] = pd1[j+32];
+	for (i = 0; i < 8; i++) {
+		k = (k << 8) | key[i];
+		block = (block << 8) | in[i];
 	}
 
-	for (i=0;i<16;i++) {
-		char er[48];
-		char erk[48];
-		char b[8][6];
-		char cb[32];
-		char pcb[32];
-		char r2[32];
-
-		permute(er, r, perm4, 48);
+	cd = table_permute(tables.pc1, k, 64);
+	c = cd >> 28;
+	d = cd & 0x0fffffff;
 
-		xor(erk, er, ki[i], 48);
+	block = table_permute(tables.ip, block, 64);
+	l = block >> 32;
+	r = block & 0xffffffff;
 
-		for (j=0;j<8;j++)
-			for (k=0;k<6;k++)
-				b[j][k] = erk[j*6 + k];
+	for (i = 0; i < 16; i++) {
+		uint64_t	ki, er;
+		uint32_t	f = 0, tmp;
 
-		for (j=0;j<8;j++) {
-			int m, n;
-			m = (b[j][0]<<1) | b[j][5];
+		c = rotl28(c, sc[i]);
+		d = rotl28(d, sc[i]);
+		ki = table_permute(tables.pc2, (((uint64_t) c) << 28) | d, 56);
 
-			n = (b[j][1]<<3) | (b[j][2]<<2) | (b[j][3]<<1) | b[j][4];
-
-			for (k=0;k<4;k++)
-				b[j][k] = (sbox[j][m][n] & (1<<(3-k)))?1:0;
-		}
+		er = table_permute(tables.e, r, 32) ^ ki;
+		for (j = 0; j < 8; j++) f |= tables.sp[j][(er >> (42 - (j * 6))) & 0x3f];
 
-		for (j=0;j<8;j++)
-			for (k=0;k<4;k++)
-				cb[j*4+k] = b[j][k];
-		permute(pcb, cb, perm5, 32);
-
-		xor(r2, l, pcb, 32);
-
-		for (j=0;j<32;j++)
-			l[j] = r[j];
-
-		for (j=0;j<32;j++)
-			r[j] = r2[j];
+		tmp = l ^ f;
+		l = r;
+		r = tmp;
 	}
 
-	concat(rl, r, l, 32, 32);
+	block = table_permute(tables.fp, (((uint64_t) r) << 32) | l, 64);
 
-	permute(out, rl, perm6, 64);
+	for (i = 7; i >= 0; i--) {
+		out[i] = block & 0xff;
+		block >>= 8;
+	}
 }
 
-static void str_to_key(unsigned char *str,unsigned char *key)
+static void str_to_key(unsigned char const *str, unsigned char *key)
 {
 	int i;
 
@@ -286,30 +301,13 @@ static void str_to_key(unsigned char *str,unsigned char *key)
 
 void smbhash(unsigned char *out, unsigned char const *in, unsigned char *key)
 {
-	int i;
-	char outb[64];
-	char inb[64];
-	char keyb[64];
 	unsigned char key2[8];
 
-	str_to_key(key, key2);
-
-	for (i=0;i<64;i++) {
-		inb[i] = (in[i/8] & (1<<(7-(i%8)))) ? 1 : 0;
-		keyb[i] = (key2[i/8] & (1<<(7-(i%8)))) ? 1 : 0;
-		outb[i] = 0;
-	}
-
-	dohash(outb, inb, keyb);
+	pthread_once(&tables_once, tables_init);
 
-	for (i=0;i<8;i++) {
-		out[i] = 0;
-	}
+	str_to_key(key, key2);
 
-	for (i=0;i<64;i++) {
-		if (outb[i])
-			out[i/8] |= (1<<(7-(i%8)));
-	}
+	dohash(out, in, key2);
 }
 
 /*
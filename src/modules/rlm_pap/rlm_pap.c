@@ -38,7 +38,11 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/sha1.h>
 
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/util/syserror.h>
+
 #include <freeradius-devel/unlang/call_env.h>
+#include <freeradius-devel/unlang/interpret.h>
 
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.password.h>
 
@@ -54,15 +58,26 @@ USES_APPLE_DEPRECATED_API
 #  include <openssl/evp.h>
 #endif
 
+#include <pthread.h>
+#include <signal.h>
+
 /*
  *	We don't have threadsafe crypt, so we have to wrap
  *	calls in a mutex
  */
 #ifndef HAVE_CRYPT_R
-#  include <pthread.h>
 static pthread_mutex_t fr_crypt_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+typedef struct pap_pool_s pap_pool_t;
+typedef struct pap_cache_s pap_cache_t;
+typedef struct pap_job_s pap_job_t;
+
+/*
+ *	Request data marking the password as verified by the cache
+ */
+#define PAP_CACHE_HIT	0
+
 /*
  *      Define a structure for our module configuration.
  *
@@ -73,18 +88,41 @@ static pthread_mutex_t fr_crypt_mutex = PTHREAD_MUTEX_INITIALIZER;
 typedef struct {
 	fr_dict_enum_value_t	*auth_type;
 	bool			normify;
+
+	uint32_t		threads;		//!< Number of threads to verify slow hashes in.
+	fr_time_delta_t		cache_lifetime;		//!< How long successful verifications are remembered.
+	uint32_t		cache_max_entries;	//!< Maximum number of verifications to remember.
+
+	pap_pool_t		*pool;			//!< Threads verifying slow hashes, NULL if threads = 0.
+	pap_cache_t		*cache;			//!< Recently verified passwords, NULL if disabled.
 } rlm_pap_t;
 
+typedef struct {
+	rlm_pap_t const		*inst;			//!< Instance of rlm_pap.
+	fr_event_list_t		*el;			//!< Event list the pipe is registered with.
+	int			pipe[2];		//!< Completed jobs are returned through this.
+	uint32_t		outstanding;		//!< Jobs submitted to the pool, which haven't been returned.
+} rlm_pap_thread_t;
+
 typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, rlm_pap_t const *inst, request_t *request, fr_pair_t const *, fr_value_box_t const *);
 
+static const conf_parser_t cache_config[] = {
+	{ FR_CONF_OFFSET("lifetime", rlm_pap_t, cache_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", rlm_pap_t, cache_max_entries), .dflt = "16384" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("normalise", rlm_pap_t, normify), .dflt = "yes" },
+	{ FR_CONF_OFFSET("threads", rlm_pap_t, threads), .dflt = "0" },
+	{ FR_CONF_POINTER("cache", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
 typedef struct {
 	fr_value_box_t	password;
 	tmpl_t		*password_tmpl;
+	fr_value_box_t	user_name;
 } pap_call_env_t;
 
 static const call_env_method_t pap_method_env = {
@@ -94,6 +132,9 @@ static const call_env_method_t pap_method_env = {
 		{ FR_CALL_ENV_PARSE_OFFSET("password_attribute", FR_TYPE_STRING,
 					  CALL_ENV_FLAG_ATTRIBUTE | CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_NULLABLE | CALL_ENV_FLAG_CONCAT,
 					  pap_call_env_t, password, password_tmpl), .pair.dflt = "&User-Password", .pair.dflt_quote = T_BARE_WORD },
+		{ FR_CALL_ENV_OFFSET("user_name", FR_TYPE_STRING,
+				     CALL_ENV_FLAG_ATTRIBUTE | CALL_ENV_FLAG_NULLABLE | CALL_ENV_FLAG_CONCAT,
+				     pap_call_env_t, user_name), .pair.dflt = "&User-Name", .pair.dflt_quote = T_BARE_WORD },
 		CALL_ENV_TERMINATOR
 	}
 };
@@ -139,6 +180,127 @@ static size_t pbkdf2_passlib_names_len = NUM_ELEMENTS(pbkdf2_passlib_names);
 
 static fr_dict_attr_t const **pap_alloweds;
 
+/** A password which was verified recently
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of entries.
+	fr_dlist_t		entry;			//!< Entry in the expiry list.
+	fr_time_t		expires;		//!< When the entry can no longer be used.
+	uint8_t			key[SHA1_DIGEST_LENGTH];
+} pap_cache_entry_t;
+
+struct pap_cache_s {
+	pthread_mutex_t		mutex;
+	fr_rb_tree_t		*tree;			//!< Entries, by key.
+	fr_dlist_head_t		expiry;			//!< Entries, oldest first.
+	uint8_t			secret[32];		//!< Random key for the HMAC.
+};
+
+static int8_t pap_cache_cmp(void const *one, void const *two)
+{
+	pap_cache_entry_t const *a = one, *b = two;
+
+	return CMP(memcmp(a->key, b->key, sizeof(a->key)), 0);
+}
+
+static int _pap_cache_free(pap_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+	return 0;
+}
+
+/** Calculate the key for the verified-credential cache
+ *
+ * An HMAC of the user name and the password supplied, keyed with a
+ * random secret, so the cache holds nothing which can be used to
+ * recover the password.
+ */
+static void pap_cache_key(uint8_t key[static SHA1_DIGEST_LENGTH], pap_cache_t const *cache, request_t *request,
+			  fr_value_box_t const *user_name, fr_value_box_t const *password)
+{
+	uint8_t		*buff, *p;
+	uint32_t	len = user_name->vb_length;
+
+	MEM(buff = p = talloc_array(request, uint8_t, sizeof(len) + len + password->vb_length));
+	memcpy(p, &len, sizeof(len));
+	p += sizeof(len);
+	memcpy(p, user_name->vb_octets, len);
+	p += len;
+	memcpy(p, password->vb_octets, password->vb_length);
+
+	fr_hmac_sha1(key, buff, talloc_array_length(buff), cache->secret, sizeof(cache->secret));
+	talloc_free(buff);
+}
+
+/** Remove expired entries
+ *
+ * @note Must be called with the mutex held.
+ */
+static void pap_cache_expire(pap_cache_t *cache, fr_time_t now)
+{
+	pap_cache_entry_t *c;
+
+	while ((c = fr_dlist_head(&cache->expiry)) && fr_time_lteq(c->expires, now)) {
+		fr_dlist_remove(&cache->expiry, c);
+		fr_rb_remove(cache->tree, c);
+		talloc_free(c);
+	}
+}
+
+/** See if the password was verified recently
+ *
+ */
+static bool pap_cache_find(pap_cache_t *cache, uint8_t const key[static SHA1_DIGEST_LENGTH])
+{
+	pap_cache_entry_t	find;
+	bool			found;
+
+	memcpy(find.key, key, sizeof(find.key));
+
+	pthread_mutex_lock(&cache->mutex);
+	pap_cache_expire(cache, fr_time());
+	found = (fr_rb_find(cache->tree, &find) != NULL);
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+/** Record a successful verification
+ *
+ * Only successes are cached, so a wrong password is always checked.
+ */
+static void pap_cache_insert(rlm_pap_t const *inst, uint8_t const key[static SHA1_DIGEST_LENGTH])
+{
+	pap_cache_t		*cache = inst->cache;
+	pap_cache_entry_t	*c;
+	fr_time_t		now = fr_time();
+
+	pthread_mutex_lock(&cache->mutex);
+	pap_cache_expire(cache, now);
+
+	/*
+	 *	Entries all have the same lifetime, so the oldest
+	 *	entry is the first to expire.
+	 */
+	if (fr_rb_num_elements(cache->tree) >= inst->cache_max_entries) {
+		c = fr_dlist_head(&cache->expiry);
+		fr_dlist_remove(&cache->expiry, c);
+		fr_rb_remove(cache->tree, c);
+		talloc_free(c);
+	}
+
+	MEM(c = talloc_zero(cache, pap_cache_entry_t));
+	memcpy(c->key, key, sizeof(c->key));
+	c->expires = fr_time_add(now, inst->cache_lifetime);
+	if (!fr_rb_insert(cache->tree, c)) {
+		talloc_free(c);		/* Raced with another thread */
+	} else {
+		fr_dlist_insert_tail(&cache->expiry, c);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
 /*
  *	Authorize the user for PAP authentication.
  *
@@ -168,6 +330,23 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 
 	if (!module_rlm_section_type_set(request, attr_auth_type, inst->auth_type)) RETURN_MODULE_NOOP;
 
+	/*
+	 *	If the password was verified recently, there's no
+	 *	need for the known good password, so policy can skip
+	 *	fetching it.
+	 */
+	if (inst->cache && (env_data->user_name.type == FR_TYPE_STRING)) {
+		uint8_t key[SHA1_DIGEST_LENGTH];
+
+		pap_cache_key(key, inst->cache, request, &env_data->user_name, &env_data->password);
+		if (pap_cache_find(inst->cache, key)) {
+			RDEBUG2("Password was verified recently");
+			(void) request_data_add(request, inst, PAP_CACHE_HIT, UNCONST(rlm_pap_t *, inst),
+						false, false, false);
+			RETURN_MODULE_OK;
+		}
+	}
+
 	RETURN_MODULE_UPDATED;
 }
 
@@ -190,9 +369,15 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
 }
 
 #ifdef HAVE_CRYPT
-static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
-						       fr_pair_t const *known_good, fr_value_box_t const *password)
+/** Check a password against a crypt hash
+ *
+ * Doesn't log, or touch the request, so may be called from any thread.
+ *
+ * @param[in] password		to check.
+ * @param[in] known_good	crypt hash.
+ * @return true if the password matches.
+ */
+static bool pap_crypt_match(char const *password, char const *known_good)
 {
 	char	*crypt_out;
 	int	cmp = 0;
@@ -200,28 +385,35 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
 #ifdef HAVE_CRYPT_R
 	struct crypt_data crypt_data = { .initialized = 0 };
 
-	crypt_out = crypt_r(password->vb_strvalue, known_good->vp_strvalue, &crypt_data);
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	crypt_out = crypt_r(password, known_good, &crypt_data);
+	if (crypt_out) cmp = strcmp(known_good, crypt_out);
 #else
 	/*
 	 *	Ensure we're thread-safe, as crypt() isn't.
 	 */
 	pthread_mutex_lock(&fr_crypt_mutex);
-	crypt_out = crypt(password->vb_strvalue, known_good->vp_strvalue);
+	crypt_out = crypt(password, known_good);
 
 	/*
 	 *	Got something, check it within the lock.  This is
 	 *	faster than copying it to a local buffer, and the
 	 *	time spent within the lock is critical.
 	 */
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	if (crypt_out) cmp = strcmp(known_good, crypt_out);
 	pthread_mutex_unlock(&fr_crypt_mutex);
 #endif
 
+	return crypt_out && (cmp == 0);
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
+						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       fr_pair_t const *known_good, fr_value_box_t const *password)
+{
 	/*
 	 *	Error.
 	 */
-	if (!crypt_out || (cmp != 0)) {
+	if (!pap_crypt_match(password->vb_strvalue, known_good->vp_strvalue)) {
 		REDEBUG("Crypt digest does not match \"known good\" digest");
 		RETURN_MODULE_REJECT;
 	}
@@ -438,9 +630,23 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_256, "SSHA3-256", EVP_sha
 PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_384, "SSHA3-384", EVP_sha3_384())
 PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha3_512())
 
-/** Validates Crypt::PBKDF2 LDAP format strings
+/** Parameters and expected digest from a Password.PBKDF2 value
+ *
+ */
+typedef struct {
+	EVP_MD const		*evp_md;
+	int			digest_type;
+	size_t			digest_len;
+	uint32_t		iterations;
+	uint8_t			*salt;
+	size_t			salt_len;
+	uint8_t			hash[EVP_MAX_MD_SIZE];
+} pap_pbkdf2_t;
+
+/** Parses Crypt::PBKDF2 LDAP format strings
  *
- * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[out] out		Where to write the parameters.
+ * @param[in] ctx		to allocate the salt in.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -450,18 +656,17 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
  * @param[in] iter_sep		Separation character between the iterations and the next component.
  * @param[in] salt_sep		Separation character between the salt and the next component.
  * @param[in] iter_is_base64	Whether the iterations is are encoded as base64.
- * @param[in] password		to validate.
  * @return
- *	- RLM_MODULE_REJECT
- *	- RLM_MODULE_OK
+ *	- 0 on success.
+ *	- -1 if the string is invalid.
  */
-static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t *p_result,
-								     request_t *request, const uint8_t *str, size_t len,
-								     fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
-								     char scheme_sep, char iter_sep, char salt_sep,
-								     bool iter_is_base64, fr_value_box_t const *password)
+static inline CC_HINT(nonnull) int pap_pbkdf2_parse(pap_pbkdf2_t *out, TALLOC_CTX *ctx,
+						    request_t *request, const uint8_t *str, size_t len,
+						    fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
+						    char scheme_sep, char iter_sep, char salt_sep,
+						    bool iter_is_base64)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
+	int			ret = -1;
 
 	uint8_t const		*p, *q, *end;
 	ssize_t			slen;
@@ -474,8 +679,6 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 
 	uint8_t			*salt = NULL;
 	size_t			salt_len;
-	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
 
 	RDEBUG2("Comparing with \"known-good\" Password.PBKDF2");
 
@@ -622,7 +825,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		goto finish;
 	}
 
-	MEM(salt = talloc_array(request, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
+	MEM(salt = talloc_array(ctx, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
 	slen = fr_base64_decode(&FR_DBUFF_TMP(salt, talloc_array_length(salt)),
 				&FR_SBUFF_IN((char const *) p, (char const *)q), false, false);
 	if (slen <= 0) {
@@ -638,7 +841,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		goto finish;
 	}
 
-	slen = fr_base64_decode(&FR_DBUFF_TMP(hash, sizeof(hash)),
+	slen = fr_base64_decode(&FR_DBUFF_TMP(out->hash, sizeof(out->hash)),
 				&FR_SBUFF_IN((char const *)p, (char const *)end), false, false);
 	if (slen <= 0) {
 		RPEDEBUG("Failed decoding Password.PBKDF2 hash component");
@@ -649,7 +852,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		REDEBUG("Password.PBKDF2 hash component length is incorrect for hash type, expected %zu, got %zd",
 			digest_len, slen);
 
-		RHEXDUMP2(hash, slen, "hash component");
+		RHEXDUMP2(out->hash, slen, "hash component");
 
 		goto finish;
 	}
@@ -658,44 +861,38 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 		fr_table_str_by_value(pbkdf2_crypt_names, digest_type, "<UNKNOWN>"),
 		iterations, salt_len, slen);
 
-	/*
-	 *	Hash and compare
-	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vb_octets, (int)password->vb_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		fr_tls_log(request, "PBKDF2 digest failure");
-		goto finish;
-	}
-
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		REDEBUG3("Salt       : %pH", fr_box_octets(salt, salt_len));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(hash, slen));
-		rcode = RLM_MODULE_REJECT;
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
+	out->evp_md = evp_md;
+	out->digest_type = digest_type;
+	out->digest_len = digest_len;
+	out->iterations = iterations;
+	out->salt = salt;
+	out->salt_len = salt_len;
+	ret = 0;
 
 finish:
-	talloc_free(salt);
+	if (ret < 0) talloc_free(salt);
 
-	RETURN_MODULE_RCODE(rcode);
+	return ret;
 }
 
-static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst,
-							       request_t *request,
-							       fr_pair_t const *known_good, fr_value_box_t const *password)
+/** Parse any of the Password.PBKDF2 formats
+ *
+ * @param[out] out		Where to write the parameters.
+ * @param[in] ctx		to allocate the salt in.
+ * @param[in] request		The current request.
+ * @param[in] known_good	Password.PBKDF2 attribute.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the value is invalid.
+ */
+static int pap_pbkdf2_known_good_parse(pap_pbkdf2_t *out, TALLOC_CTX *ctx, request_t *request,
+				       fr_pair_t const *known_good)
 {
 	uint8_t const *p = known_good->vp_octets, *q, *end = p + known_good->vp_length;
 
 	if (end - p < 2) {
 		REDEBUG("Password.PBKDF2 too short");
-		RETURN_MODULE_INVALID;
+		return -1;
 	}
 
 	/*
@@ -712,9 +909,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 			q = memchr(p, '}', end - p);
 			p = q + 1;
 		}
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
-					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
-					     ':', ':', ':', true, password);
+		return pap_pbkdf2_parse(out, ctx, request, p, end - p,
+					pbkdf2_crypt_names, pbkdf2_crypt_names_len,
+					':', ':', ':', true);
 	}
 
 	/*
@@ -724,9 +921,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
-					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
-					     ':', ':', '$', false, password);
+		return pap_pbkdf2_parse(out, ctx, request, p, end - p,
+					pbkdf2_crypt_names, pbkdf2_crypt_names_len,
+					':', ':', '$', false);
 	}
 
 	/*
@@ -738,14 +935,76 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
-					     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
-					     '$', '$', '$', false, password);
+		return pap_pbkdf2_parse(out, ctx, request, p, end - p,
+					pbkdf2_passlib_names, pbkdf2_passlib_names_len,
+					'$', '$', '$', false);
 	}
 
 	REDEBUG("Can't determine format of Password.PBKDF2");
 
-	RETURN_MODULE_INVALID;
+	return -1;
+}
+
+/** Calculate the PBKDF2 digest of a password
+ *
+ * Doesn't log, or touch the request, so may be called from any thread.
+ *
+ * @param[out] digest	Where to write the digest.  Must be params->digest_len bytes.
+ * @param[in] params	from #pap_pbkdf2_known_good_parse.
+ * @param[in] password	to hash.
+ * @param[in] len	of the password.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int pap_pbkdf2_calc(uint8_t *digest, pap_pbkdf2_t const *params, uint8_t const *password, size_t len)
+{
+	if (PKCS5_PBKDF2_HMAC((char const *)password, (int)len,
+			      (unsigned char const *)params->salt, (int)params->salt_len,
+			      (int)params->iterations,
+			      params->evp_md,
+			      (int)params->digest_len, (unsigned char *)digest) == 0) return -1;
+
+	return 0;
+}
+
+/** Compare a calculated PBKDF2 digest with the expected one
+ *
+ */
+static rlm_rcode_t pap_pbkdf2_cmp(request_t *request, pap_pbkdf2_t const *params, uint8_t const *digest)
+{
+	if (fr_digest_cmp(digest, params->hash, params->digest_len) != 0) {
+		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
+		REDEBUG3("Salt       : %pH", fr_box_octets(params->salt, params->salt_len));
+		REDEBUG3("Calculated : %pH", fr_box_octets(digest, params->digest_len));
+		REDEBUG3("Expected   : %pH", fr_box_octets(params->hash, params->digest_len));
+		return RLM_MODULE_REJECT;
+	}
+
+	return RLM_MODULE_OK;
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_result,
+							UNUSED rlm_pap_t const *inst,
+							request_t *request,
+							fr_pair_t const *known_good, fr_value_box_t const *password)
+{
+	pap_pbkdf2_t	params;
+	uint8_t		digest[EVP_MAX_MD_SIZE];
+	rlm_rcode_t	rcode;
+
+	if (pap_pbkdf2_known_good_parse(&params, request, request, known_good) < 0) RETURN_MODULE_INVALID;
+
+	if (pap_pbkdf2_calc(digest, &params, password->vb_octets, password->vb_length) < 0) {
+		fr_tls_log(request, "PBKDF2 digest failure");
+		talloc_free(params.salt);
+		RETURN_MODULE_INVALID;
+	}
+
+	rcode = pap_pbkdf2_cmp(request, &params, digest);
+	talloc_free(params.salt);
+
+	RETURN_MODULE_RCODE(rcode);
 }
 #endif
 
@@ -895,16 +1154,290 @@ static const pap_auth_func_t auth_func_table[] = {
 #endif	/* HAVE_OPENSSL_EVP_H */
 };
 
+/** A verification which may be run by one of the pool threads
+ *
+ * Everything the pool thread uses is copied into the job, so the
+ * request can be freed while the job is still running.
+ */
+struct pap_job_s {
+	fr_dlist_t		entry;			//!< Entry in the pool's queue.
+	rlm_pap_thread_t	*t;			//!< Thread which submitted the job.
+	request_t		*request;		//!< To resume.  NULL if the request was cancelled.
+
+	unsigned int		type;			//!< Password type, FR_CRYPT or FR_PBKDF2.
+	uint8_t			*password;		//!< Copy of the password, \0 terminated.
+	size_t			password_len;		//!< Length of the password.
+
+	char			*crypt;			//!< Crypt hash to check against.
+#ifdef HAVE_OPENSSL_EVP_H
+	pap_pbkdf2_t		pbkdf2;			//!< PBKDF2 parameters.
+	uint8_t			digest[EVP_MAX_MD_SIZE];	//!< Calculated PBKDF2 digest.
+#endif
+
+	bool			failed;			//!< Written by the pool thread.
+	bool			match;			//!< Written by the pool thread.
+
+	bool			cacheable;		//!< Whether cache_key is set.
+	uint8_t			cache_key[SHA1_DIGEST_LENGTH];
+};
+
+struct pap_pool_s {
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	fr_dlist_head_t		queue;			//!< Jobs waiting for a thread.
+	bool			stop;			//!< Tell the threads to exit.
+	pthread_t		*threads;
+	uint32_t		num_threads;		//!< How many threads were started.
+};
+
+static void *pap_pool_thread(void *arg)
+{
+	pap_pool_t	*pool = arg;
+	pap_job_t	*job;
+	sigset_t	sigset;
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		job = fr_dlist_pop_head(&pool->queue);
+		if (!job) {
+			if (pool->stop) break;
+
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		switch (job->type) {
+#ifdef HAVE_CRYPT
+		case FR_CRYPT:
+			job->match = pap_crypt_match((char const *)job->password, job->crypt);
+			break;
+#endif
+
+#ifdef HAVE_OPENSSL_EVP_H
+		case FR_PBKDF2:
+			if (pap_pbkdf2_calc(job->digest, &job->pbkdf2, job->password, job->password_len) < 0) {
+				ERR_clear_error();
+				job->failed = true;
+			}
+			break;
+#endif
+
+		default:
+			fr_assert(0);
+			job->failed = true;
+			break;
+		}
+
+		/*
+		 *	Hand the job back to the thread which submitted
+		 *	it.  Writes of a pointer to a pipe are atomic.
+		 */
+		while ((write(job->t->pipe[1], &job, sizeof(job)) < 0) && (errno == EINTR));
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static int _pap_pool_free(pap_pool_t *pool)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) (void) pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+/** Read completed jobs from the pool threads
+ *
+ */
+static void pap_pool_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(uctx, rlm_pap_thread_t);
+	pap_job_t		*job;
+
+	while (read(fd, &job, sizeof(job)) == sizeof(job)) {
+		t->outstanding--;
+
+		/*
+		 *	The request went away while the job was
+		 *	running, so no one is waiting for the result.
+		 */
+		if (!job->request) {
+			talloc_free(job);
+			continue;
+		}
+
+		unlang_interpret_mark_runnable(job->request);
+	}
+}
+
+/** Whether verifying this type of password is slow enough to be offloaded
+ *
+ */
+static inline bool pap_auth_is_expensive(fr_dict_attr_t const *da)
+{
+	switch (da->attr) {
+#ifdef HAVE_CRYPT
+	case FR_CRYPT:
+#endif
+#ifdef HAVE_OPENSSL_EVP_H
+	case FR_PBKDF2:
+#endif
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Copy everything the pool thread needs into a job
+ *
+ * @return
+ *	- The job on success.
+ *	- NULL if the "known good" password is invalid.
+ */
+static pap_job_t *pap_job_alloc(rlm_pap_thread_t *t, request_t *request,
+				fr_pair_t const *known_good, fr_value_box_t const *password)
+{
+	pap_job_t	*job;
+
+	/*
+	 *	Not parented by the request, as the job may outlive it.
+	 */
+	MEM(job = talloc_zero(NULL, pap_job_t));
+	job->t = t;
+	job->request = request;
+	job->type = known_good->da->attr;
+	MEM(job->password = talloc_memdup(job, password->vb_octets, password->vb_length + 1));
+	job->password_len = password->vb_length;
+
+	switch (job->type) {
+#ifdef HAVE_CRYPT
+	case FR_CRYPT:
+		MEM(job->crypt = talloc_bstrndup(job, known_good->vp_strvalue, known_good->vp_length));
+		break;
+#endif
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case FR_PBKDF2:
+		if (pap_pbkdf2_known_good_parse(&job->pbkdf2, job, request, known_good) < 0) {
+			talloc_free(job);
+			return NULL;
+		}
+		break;
+#endif
+
+	default:
+		fr_assert(0);
+		talloc_free(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+/** Log the result of authentication
+ *
+ */
+static void pap_auth_log(request_t *request, rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Password incorrect");
+		break;
+
+	case RLM_MODULE_OK:
+		RDEBUG2("User authenticated successfully");
+		break;
+
+	default:
+		break;
+	}
+}
+
+/** Get the result of a verification run by the pool
+ *
+ */
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_pap_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_pap_t);
+	pap_job_t	*job = talloc_get_type_abort(mctx->rctx, pap_job_t);
+	rlm_rcode_t	rcode = RLM_MODULE_INVALID;
+
+	switch (job->type) {
+#ifdef HAVE_CRYPT
+	case FR_CRYPT:
+		if (!job->match) {
+			REDEBUG("Crypt digest does not match \"known good\" digest");
+			rcode = RLM_MODULE_REJECT;
+			break;
+		}
+		rcode = RLM_MODULE_OK;
+		break;
+#endif
+
+#ifdef HAVE_OPENSSL_EVP_H
+	case FR_PBKDF2:
+		if (job->failed) {
+			REDEBUG("PBKDF2 digest failure");
+			break;
+		}
+		rcode = pap_pbkdf2_cmp(request, &job->pbkdf2, job->digest);
+		break;
+#endif
+
+	default:
+		break;
+	}
+
+	if ((rcode == RLM_MODULE_OK) && job->cacheable) pap_cache_insert(inst, job->cache_key);
+	talloc_free(job);
+
+	pap_auth_log(request, rcode);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** The request was cancelled while the pool was verifying the password
+ *
+ * The job is freed when the pool thread returns it.
+ */
+static void mod_authenticate_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	pap_job_t *job = talloc_get_type_abort(mctx->rctx, pap_job_t);
+
+	job->request = NULL;
+}
+
 /*
  *	Authenticate the user via one of any well-known password.
  */
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_pap_t const 	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_pap_t);
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
 	fr_pair_t		*known_good;
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 	pap_auth_func_t		auth_func;
 	bool			ephemeral;
+	bool			cacheable = false;
+	uint8_t			cache_key[SHA1_DIGEST_LENGTH];
+	pap_job_t		*job;
 	pap_call_env_t		*env_data = talloc_get_type_abort(mctx->env_data, pap_call_env_t);
 
 	if (env_data->password.type != FR_TYPE_STRING) {
@@ -928,6 +1461,21 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Login attempt with password");
 	}
 
+	if (inst->cache && (env_data->user_name.type == FR_TYPE_STRING)) {
+		pap_cache_key(cache_key, inst->cache, request, &env_data->user_name, &env_data->password);
+
+		/*
+		 *	Either found when authorizing, so there may
+		 *	be no known good password, or found now.
+		 */
+		if (request_data_get(request, inst, PAP_CACHE_HIT) || pap_cache_find(inst->cache, cache_key)) {
+			RDEBUG2("Password was verified recently, not checking it again");
+			pap_auth_log(request, RLM_MODULE_OK);
+			RETURN_MODULE_OK;
+		}
+		cacheable = true;
+	}
+
 	/*
 	 *	Retrieve the normalised version of
 	 *	the known_good password, without
@@ -953,23 +1501,38 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Comparing with \"known-good\" %s (%zu)", known_good->da->name, known_good->vp_length);
 	}
 
+	/*
+	 *	Verify slow hashes in one of the pool threads, and
+	 *	carry on with other requests until it's done.
+	 */
+	if (inst->pool && pap_auth_is_expensive(known_good->da)) {
+		job = pap_job_alloc(t, request, known_good, &env_data->password);
+		if (ephemeral) TALLOC_FREE(known_good);
+		if (!job) RETURN_MODULE_INVALID;
+
+		if (cacheable) {
+			job->cacheable = true;
+			memcpy(job->cache_key, cache_key, sizeof(job->cache_key));
+		}
+
+		pthread_mutex_lock(&inst->pool->mutex);
+		fr_dlist_insert_tail(&inst->pool->queue, job);
+		pthread_cond_signal(&inst->pool->cond);
+		pthread_mutex_unlock(&inst->pool->mutex);
+		t->outstanding++;
+
+		return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal,
+					   ~FR_SIGNAL_CANCEL, job);
+	}
+
 	/*
 	 *	Authenticate, and return.
 	 */
 	auth_func(&rcode, inst, request, known_good, &env_data->password);
 	if (ephemeral) TALLOC_FREE(known_good);
-	switch (rcode) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Password incorrect");
-		break;
+	if ((rcode == RLM_MODULE_OK) && cacheable) pap_cache_insert(inst, cache_key);
 
-	case RLM_MODULE_OK:
-		RDEBUG2("User authenticated successfully");
-		break;
-
-	default:
-		break;
-	}
+	pap_auth_log(request, rcode);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -984,6 +1547,117 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		     mctx->mi->name);
 	}
 
+	FR_INTEGER_BOUND_CHECK("threads", inst->threads, <=, 256);
+
+	/*
+	 *	Neither are parented by the module instance, as the
+	 *	instance data is read only once instantiation is
+	 *	complete.
+	 */
+	if (inst->threads > 0) {
+		pap_pool_t *pool;
+
+		MEM(pool = talloc_zero(NULL, pap_pool_t));
+		pthread_mutex_init(&pool->mutex, NULL);
+		pthread_cond_init(&pool->cond, NULL);
+		fr_dlist_init(&pool->queue, pap_job_t, entry);
+		MEM(pool->threads = talloc_array(pool, pthread_t, inst->threads));
+		talloc_set_destructor(pool, _pap_pool_free);
+		inst->pool = pool;
+
+		while (pool->num_threads < inst->threads) {
+			if (fr_schedule_pthread_create(&pool->threads[pool->num_threads], pap_pool_thread, pool) < 0) {
+				PERROR("Failed starting password verification thread");
+				TALLOC_FREE(inst->pool);
+				return -1;
+			}
+			pool->num_threads++;
+		}
+	}
+
+	if (fr_time_delta_ispos(inst->cache_lifetime)) {
+		pap_cache_t *cache;
+
+		FR_INTEGER_BOUND_CHECK("cache.max_entries", inst->cache_max_entries, >=, 1);
+
+		MEM(cache = talloc_zero(NULL, pap_cache_t));
+		pthread_mutex_init(&cache->mutex, NULL);
+		talloc_set_destructor(cache, _pap_cache_free);
+		MEM(cache->tree = fr_rb_inline_talloc_alloc(cache, pap_cache_entry_t, node, pap_cache_cmp, NULL));
+		fr_dlist_talloc_init(&cache->expiry, pap_cache_entry_t, entry);
+		fr_rand_buffer(cache->secret, sizeof(cache->secret));
+		inst->cache = cache;
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_pap_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_pap_t);
+
+	TALLOC_FREE(inst->pool);
+	TALLOC_FREE(inst->cache);
+
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_pap_t const		*inst = talloc_get_type_abort(mctx->mi->data, rlm_pap_t);
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	t->inst = inst;
+	t->pipe[0] = t->pipe[1] = -1;
+
+	if (!inst->pool) return 0;
+
+	if (pipe(t->pipe) < 0) {
+		ERROR("Failed creating pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	(void) fr_nonblock(t->pipe[0]);
+
+	if (fr_event_fd_insert(t, NULL, mctx->el, t->pipe[0], pap_pool_read, NULL, NULL, t) < 0) {
+		PERROR("Failed inserting pipe");
+		close(t->pipe[0]);
+		close(t->pipe[1]);
+		t->pipe[0] = t->pipe[1] = -1;
+		return -1;
+	}
+	t->el = mctx->el;
+
+	return 0;
+}
+
+/** Wait for jobs from this thread to complete, and close the pipe
+ *
+ * Jobs from requests which were cancelled may still be running.
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_pap_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_pap_thread_t);
+
+	if (t->pipe[0] < 0) return 0;
+
+	(void) fr_event_fd_delete(t->el, t->pipe[0], FR_EVENT_FILTER_IO);
+	(void) fr_blocking(t->pipe[0]);
+
+	while (t->outstanding > 0) {
+		pap_job_t *job;
+
+		if (read(t->pipe[0], &job, sizeof(job)) != sizeof(job)) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		t->outstanding--;
+		talloc_free(job);
+	}
+
+	close(t->pipe[0]);
+	close(t->pipe[1]);
+
 	return 0;
 }
 
@@ -1062,7 +1736,12 @@ module_rlm_t rlm_pap = {
 		.onload		= mod_load,
 		.unload		= mod_unload,
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.thread_inst_size	= sizeof(rlm_pap_thread_t),
+		.thread_inst_type	= "rlm_pap_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
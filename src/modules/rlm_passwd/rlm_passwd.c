@@ -29,6 +29,11 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 struct mypasswd {
 	struct mypasswd *next;
 	char *listflag;
@@ -46,8 +51,42 @@ struct hashtable {
 	char buffer[1024];
 	FILE *fp;
 	char delimiter;
+
+	uint8_t const *map;		//!< mmapped index file, used instead of "table".
+	size_t map_len;
 };
 
+/** Header of a compiled index file
+ *
+ * The header is followed by the bucket array, the record array,
+ * and then NUL terminated strings.  All offsets are from the start
+ * of the file, in host byte order.  The file is only used on the
+ * machine which wrote it.
+ */
+typedef struct {
+	char		magic[8];		//!< INDEX_MAGIC.
+	uint32_t	num_fields;
+	uint32_t	key_field;
+	uint32_t	islist;
+	uint32_t	ignorenis;
+	uint32_t	delimiter;
+	uint32_t	num_buckets;
+	uint32_t	num_records;
+	uint32_t	pad;
+	uint64_t	src_size;		//!< Size of the text file the index was compiled from.
+	int64_t		src_mtime;		//!< Modification time of the text file.
+} passwd_index_hdr_t;
+
+#define INDEX_MAGIC	"FRPWIDX1"
+#define INDEX_NONE	UINT32_MAX
+
+/*
+ *	Each record is "next" followed by one string offset per field.
+ */
+#define INDEX_BUCKETS(_hdr)		((uint32_t const *)((uint8_t const *)(_hdr) + sizeof(passwd_index_hdr_t)))
+#define INDEX_RECORDS(_hdr)		(INDEX_BUCKETS(_hdr) + (_hdr)->num_buckets)
+#define INDEX_RECORD(_hdr, _n)		(INDEX_RECORDS(_hdr) + ((size_t)(_n) * ((_hdr)->num_fields + 1)))
+
 static fr_dict_t const *dict_freeradius;
 
 extern fr_dict_autoload_t rlm_passwd_dict[];
@@ -140,7 +179,7 @@ static void release_hash_table(struct hashtable * ht){
 	int i;
 
 	if (!ht) return;
-	for (i = 0; i < ht->tablesize; i++)
+	for (i = 0; ht->table && (i < ht->tablesize); i++)
 		if (ht->table[i])
 			destroy_password(ht->table[i]);
 	if (ht->fp) {
@@ -320,6 +359,221 @@ static struct mypasswd * get_pw_nam(char * name, struct hashtable* ht,
 	return get_next(name, ht, last_found);
 }
 
+/** Write a hash table to an index file
+ *
+ * The file is written to a temporary name, and renamed into place, so
+ * that other processes never see a partial index.
+ */
+static int index_write(struct hashtable *ht, char const *file, struct stat const *src)
+{
+	passwd_index_hdr_t	hdr;
+	uint32_t		*buckets, *records;
+	uint32_t		num_records = 0, n, str_off;
+	size_t			rec_size, total_str = 0;
+	struct mypasswd		*pw;
+	char			*tmp;
+	FILE			*fp;
+	int			i, j;
+
+	for (i = 0; i < ht->tablesize; i++) {
+		for (pw = ht->table[i]; pw; pw = pw->next) {
+			num_records++;
+			for (j = 0; j < ht->num_fields; j++) if (pw->field[j]) total_str += strlen(pw->field[j]) + 1;
+		}
+	}
+
+	rec_size = (size_t)ht->num_fields + 1;
+	if ((sizeof(hdr) + ((ht->tablesize + (num_records * rec_size)) * sizeof(uint32_t)) + total_str) > UINT32_MAX) {
+		fr_strerror_const("passwd file is too large to index");
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.num_fields = ht->num_fields;
+	hdr.key_field = ht->key_field;
+	hdr.islist = ht->islist;
+	hdr.ignorenis = ht->ignorenis;
+	hdr.delimiter = (uint8_t) ht->delimiter;
+	hdr.num_buckets = ht->tablesize;
+	hdr.num_records = num_records;
+	hdr.src_size = src->st_size;
+	hdr.src_mtime = src->st_mtime;
+
+	MEM(buckets = talloc_array(NULL, uint32_t, ht->tablesize));
+	MEM(records = talloc_array(buckets, uint32_t, num_records * rec_size));
+
+	/*
+	 *	Records are written in chain order, so "next" is
+	 *	always the following record, or INDEX_NONE.
+	 */
+	n = 0;
+	str_off = sizeof(hdr) + ((ht->tablesize + (num_records * rec_size)) * sizeof(uint32_t));
+	for (i = 0; i < ht->tablesize; i++) {
+		buckets[i] = ht->table[i] ? n : INDEX_NONE;
+
+		for (pw = ht->table[i]; pw; pw = pw->next, n++) {
+			uint32_t *rec = records + (n * rec_size);
+
+			rec[0] = pw->next ? n + 1 : INDEX_NONE;
+			for (j = 0; j < ht->num_fields; j++) {
+				if (!pw->field[j]) {
+					rec[j + 1] = INDEX_NONE;
+					continue;
+				}
+				rec[j + 1] = str_off;
+				str_off += strlen(pw->field[j]) + 1;
+			}
+		}
+	}
+
+	MEM(tmp = talloc_asprintf(buckets, "%s.%u", file, (unsigned int) getpid()));
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		fr_strerror_printf("Failed opening %s: %s", tmp, fr_syserror(errno));
+	error:
+		talloc_free(buckets);
+		return -1;
+	}
+
+	if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    (fwrite(buckets, sizeof(uint32_t), ht->tablesize, fp) != (size_t)ht->tablesize) ||
+	    (fwrite(records, sizeof(uint32_t), num_records * rec_size, fp) != (num_records * rec_size))) {
+	write_error:
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+		fclose(fp);
+		unlink(tmp);
+		goto error;
+	}
+
+	for (i = 0; i < ht->tablesize; i++) {
+		for (pw = ht->table[i]; pw; pw = pw->next) {
+			for (j = 0; j < ht->num_fields; j++) {
+				if (pw->field[j] && (fwrite(pw->field[j], strlen(pw->field[j]) + 1, 1, fp) != 1)) goto write_error;
+			}
+		}
+	}
+
+	if (fclose(fp) != 0) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+		unlink(tmp);
+		goto error;
+	}
+
+	if (rename(tmp, file) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", tmp, file, fr_syserror(errno));
+		unlink(tmp);
+		goto error;
+	}
+
+	talloc_free(buckets);
+	return 0;
+}
+
+static int _index_unmap(struct hashtable *ht)
+{
+	if (ht->map) munmap(UNCONST(uint8_t *, ht->map), ht->map_len);
+	return 0;
+}
+
+/** Map an index file, if it's current and matches the configuration
+ *
+ * @return
+ *	- A hashtable using the index.
+ *	- NULL if the index can't be used.
+ */
+static struct hashtable *index_open(char const *file, struct stat const *src, int num_fields,
+				    int key_field, int islist, int tablesize, int ignorenis, char delimiter)
+{
+	struct hashtable		*ht;
+	passwd_index_hdr_t const	*hdr;
+	struct stat			st;
+	size_t				min_len;
+	void				*map;
+	int				fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	if ((fstat(fd, &st) < 0) || ((size_t)st.st_size < sizeof(passwd_index_hdr_t))) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+
+	hdr = map;
+	min_len = sizeof(*hdr) + (((size_t)hdr->num_buckets + ((size_t)hdr->num_records * (num_fields + 1))) * sizeof(uint32_t));
+
+	if ((memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) != 0) ||
+	    (hdr->num_fields != (uint32_t)num_fields) || (hdr->key_field != (uint32_t)key_field) ||
+	    (hdr->islist != (uint32_t)islist) || (hdr->ignorenis != (uint32_t)ignorenis) ||
+	    (hdr->delimiter != (uint8_t)delimiter) || (hdr->num_buckets != (uint32_t)tablesize) ||
+	    (hdr->src_size != (uint64_t)src->st_size) || (hdr->src_mtime != (int64_t)src->st_mtime) ||
+	    ((size_t)st.st_size < min_len) ||
+	    ((st.st_size > (off_t)min_len) && (((uint8_t const *)map)[st.st_size - 1] != '\0'))) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	MEM(ht = talloc_zero(NULL, struct hashtable));
+	ht->tablesize = tablesize;
+	ht->num_fields = num_fields;
+	ht->key_field = key_field;
+	ht->islist = islist;
+	ht->ignorenis = ignorenis;
+	ht->delimiter = delimiter;
+	ht->map = map;
+	ht->map_len = st.st_size;
+	talloc_set_destructor(ht, _index_unmap);
+
+	return ht;
+}
+
+/** Find the next record in an index with a matching key
+ *
+ * @param[in] ht	using an index.
+ * @param[in] name	to find.
+ * @param[in] rec	to start from, or INDEX_NONE to start at the top of the bucket.
+ * @return the matching record, or INDEX_NONE.
+ */
+static uint32_t index_find(struct hashtable const *ht, char const *name, uint32_t rec)
+{
+	passwd_index_hdr_t const *hdr = (passwd_index_hdr_t const *)ht->map;
+
+	if (rec == INDEX_NONE) {
+		rec = INDEX_BUCKETS(hdr)[hash(name, hdr->num_buckets)];
+	}
+
+	while ((rec != INDEX_NONE) && (rec < hdr->num_records)) {
+		uint32_t const *r = INDEX_RECORD(hdr, rec);
+		uint32_t key = r[ht->key_field + 1];
+
+		if ((key != INDEX_NONE) && (key < ht->map_len) &&
+		    (strcmp((char const *)ht->map + key, name) == 0)) return rec;
+
+		rec = r[0];
+	}
+
+	return INDEX_NONE;
+}
+
+/** Point the fields of a mypasswd at an index record
+ *
+ */
+static void index_record_to_pw(struct hashtable const *ht, uint32_t rec, struct mypasswd *pw)
+{
+	uint32_t const	*r = INDEX_RECORD((passwd_index_hdr_t const *)ht->map, rec);
+	int		i;
+
+	for (i = 0; i < ht->num_fields; i++) {
+		pw->field[i] = ((r[i + 1] == INDEX_NONE) || (r[i + 1] >= ht->map_len)) ?
+			       NULL : UNCONST(char *, (char const *)ht->map + r[i + 1]);
+	}
+}
+
 #ifdef TEST
 
 #define MALLOC_CHECK_ 1
@@ -354,15 +608,37 @@ int main(void){
 }
 
 #else  /* TEST */
+
+/** Table which is replaced when the passwd file changes
+ *
+ * Not parented by the module instance, as the instance data is
+ * read only once instantiation is complete.
+ */
+typedef struct {
+	pthread_rwlock_t	lock;			//!< Held for reading by lookups, and for writing by swaps.
+	struct hashtable	*ht;			//!< Current table.
+
+	pthread_t		thread;			//!< Which checks for changes, and rebuilds the table.
+	pthread_mutex_t		mutex;			//!< Protects stop.
+	pthread_cond_t		cond;			//!< Signalled to stop the thread.
+	bool			stop;			//!< Tells the thread to exit.
+	bool			running;		//!< Whether the thread was started.
+
+	struct stat		src;			//!< of the file the current table was built from.
+} passwd_reload_t;
+
 typedef struct {
 	struct hashtable	*ht;
+	passwd_reload_t		*reload;
 	struct mypasswd		*pwd_fmt;
 	char const		*filename;
+	char const		*index_file;
 	char const		*format;
 	char const		*delimiter;
 	bool			allow_multiple;
 	bool			ignore_nislike;
 	uint32_t		hash_size;
+	fr_time_delta_t		reload_interval;
 	uint32_t		num_fields;
 	uint32_t		key_field;
 	uint32_t		listable;
@@ -372,6 +648,7 @@ typedef struct {
 
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_INPUT | CONF_FLAG_REQUIRED, rlm_passwd_t, filename) },
+	{ FR_CONF_OFFSET("index_file", rlm_passwd_t, index_file) },
 	{ FR_CONF_OFFSET_FLAGS("format", CONF_FLAG_REQUIRED, rlm_passwd_t, format) },
 	{ FR_CONF_OFFSET("delimiter", rlm_passwd_t, delimiter), .dflt = ":" },
 
@@ -382,9 +659,131 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("allow_multiple_keys", rlm_passwd_t, allow_multiple), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("hash_size", rlm_passwd_t, hash_size), .dflt = "100" },
+
+	{ FR_CONF_OFFSET("reload_interval", rlm_passwd_t, reload_interval), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
+/** Build a table from the passwd file, using or writing the index if one is configured
+ *
+ * @param[in] inst	rlm_passwd configuration.
+ * @param[in] num_fields	in each line.
+ * @param[in] key_field	to index lines by.
+ * @param[in] listable	whether the key field may contain a list of keys.
+ * @param[in] src	stat() of the passwd file.
+ * @return
+ *	- A new table.
+ *	- NULL on error.
+ */
+static struct hashtable *passwd_load(rlm_passwd_t const *inst, int num_fields, int key_field, int listable,
+				     struct stat const *src)
+{
+	struct hashtable *ht;
+
+	if (inst->index_file) {
+		ht = index_open(inst->index_file, src, num_fields, key_field, listable,
+				inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+		if (ht) {
+			DEBUG2("Using index %s", inst->index_file);
+			return ht;
+		}
+
+		/*
+		 *	Compile the index, and then use it, so
+		 *	that the memory is shared with any other
+		 *	process using the same index.
+		 */
+		ht = build_hash_table(inst->filename, num_fields, key_field, listable,
+				      inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+		if (!ht) return NULL;
+
+		if (index_write(ht, inst->index_file, src) < 0) {
+			PWARN("Failed writing index, using the passwd file");
+			return ht;
+		}
+
+		release_ht(ht);
+		DEBUG2("Wrote index %s", inst->index_file);
+		ht = index_open(inst->index_file, src, num_fields, key_field, listable,
+				inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+		if (ht) return ht;
+	}
+
+	return build_hash_table(inst->filename, num_fields, key_field, listable,
+				inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+}
+
+/** Check the passwd file for changes, and replace the table if it has changed
+ *
+ * Tables are built without holding the lock, so lookups are only
+ * blocked for the time it takes to swap the pointer.  If the new
+ * file can't be read, the current table is kept.
+ */
+static void *passwd_reload_thread(void *arg)
+{
+	rlm_passwd_t const	*inst = arg;
+	passwd_reload_t		*reload = inst->reload;
+
+	pthread_mutex_lock(&reload->mutex);
+	while (!reload->stop) {
+		struct timespec		ts;
+		struct stat		src;
+		struct hashtable	*ht, *old;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += fr_time_delta_to_sec(inst->reload_interval);
+		pthread_cond_timedwait(&reload->cond, &reload->mutex, &ts);
+		if (reload->stop) break;
+		pthread_mutex_unlock(&reload->mutex);
+
+		if (stat(inst->filename, &src) < 0) {
+			ERROR("Failed reading %s: %s", inst->filename, fr_syserror(errno));
+			goto next;
+		}
+
+		if ((src.st_mtime == reload->src.st_mtime) && (src.st_size == reload->src.st_size) &&
+		    (src.st_ino == reload->src.st_ino)) goto next;
+
+		ht = passwd_load(inst, inst->num_fields, inst->key_field, inst->listable, &src);
+		if (!ht) {
+			ERROR("Can't build hashtable from %s, continuing to use the previous contents", inst->filename);
+			goto next;
+		}
+
+		pthread_rwlock_wrlock(&reload->lock);
+		old = reload->ht;
+		reload->ht = ht;
+		pthread_rwlock_unlock(&reload->lock);
+
+		release_ht(old);
+		reload->src = src;
+		INFO("Reloaded %s", inst->filename);
+
+	next:
+		pthread_mutex_lock(&reload->mutex);
+	}
+	pthread_mutex_unlock(&reload->mutex);
+
+	return NULL;
+}
+
+static int _passwd_reload_free(passwd_reload_t *reload)
+{
+	if (reload->running) {
+		pthread_mutex_lock(&reload->mutex);
+		reload->stop = true;
+		pthread_cond_signal(&reload->cond);
+		pthread_mutex_unlock(&reload->mutex);
+		pthread_join(reload->thread, NULL);
+	}
+
+	release_ht(reload->ht);
+	pthread_cond_destroy(&reload->cond);
+	pthread_mutex_destroy(&reload->mutex);
+	pthread_rwlock_destroy(&reload->lock);
+	return 0;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	int			num_fields = 0, key_field = -1, listable = 0;
@@ -395,6 +794,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	fr_dict_attr_t const	*da;
 	rlm_passwd_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_passwd_t);
 	CONF_SECTION		*conf = mctx->mi->conf;
+	struct stat		src;
 
 	fr_assert(inst->filename && *inst->filename);
 	fr_assert(inst->format && *inst->format);
@@ -404,6 +804,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (fr_time_delta_ispos(inst->reload_interval) && fr_time_delta_lt(inst->reload_interval, fr_time_delta_from_sec(1))) {
+		cf_log_err(conf, "reload_interval must be at least 1s");
+		return -1;
+	}
+
 	lf = talloc_typed_strdup(inst, inst->format);
 	if (!lf) {
 		ERROR("Memory allocation failed for lf");
@@ -441,8 +846,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
-	inst->ht = build_hash_table(inst->filename, num_fields, key_field, listable,
-				    inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (stat(inst->filename, &src) < 0) {
+		cf_log_err(conf, "Failed reading %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	inst->ht = passwd_load(inst, num_fields, key_field, listable, &src);
 	if (!inst->ht){
 		ERROR("Can't build hashtable from passwd file");
 		return -1;
@@ -495,6 +904,37 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	DEBUG3("num_fields: %d key_field %d(%s) listable: %s", num_fields, key_field,
 	       inst->pwd_fmt->field[key_field], listable ? "yes" : "no");
 
+	if (fr_time_delta_ispos(inst->reload_interval)) {
+		passwd_reload_t	*reload;
+		sigset_t	set, old;
+		int		ret;
+
+		MEM(reload = talloc_zero(NULL, passwd_reload_t));
+		pthread_rwlock_init(&reload->lock, NULL);
+		pthread_mutex_init(&reload->mutex, NULL);
+		pthread_cond_init(&reload->cond, NULL);
+		talloc_set_destructor(reload, _passwd_reload_free);
+
+		reload->ht = inst->ht;
+		reload->src = src;
+		inst->ht = NULL;
+		inst->reload = reload;
+
+		/*
+		 *	Signals are for the main thread.
+		 */
+		sigfillset(&set);
+		pthread_sigmask(SIG_BLOCK, &set, &old);
+		ret = pthread_create(&reload->thread, NULL, passwd_reload_thread, inst);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		if (ret != 0) {
+			cf_log_err(conf, "Failed creating reload thread: %s", fr_syserror(ret));
+			TALLOC_FREE(inst->reload);
+			return -1;
+		}
+		reload->running = true;
+	}
+
 	return 0;
 
 #undef inst
@@ -503,6 +943,8 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_passwd_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_passwd_t);
+
+	TALLOC_FREE(inst->reload);
 	if (inst->ht) {
 		release_ht(inst->ht);
 		inst->ht = NULL;
@@ -569,10 +1011,26 @@ static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, mo
 	struct mypasswd		*pw, *last_found;
 	fr_dcursor_t		cursor;
 	int			found = 0;
+	struct hashtable	*ht = inst->ht;
 
 	key = fr_pair_find_by_da(&request->request_pairs, NULL, inst->keyattr);
 	if (!key) RETURN_MODULE_NOTFOUND;
 
+	/*
+	 *	The table may be replaced by the reload thread,
+	 *	so hold on to it until we're done.
+	 */
+	if (inst->reload) {
+		pthread_rwlock_rdlock(&inst->reload->lock);
+		ht = inst->reload->ht;
+	}
+
+	if (ht->map) {
+		MEM(pw = talloc_zero_size(request, sizeof(struct mypasswd) + (inst->num_fields * sizeof(char *))));
+	} else {
+		pw = NULL;
+	}
+
 	for (i = fr_pair_dcursor_by_da_init(&cursor, &request->request_pairs, inst->keyattr);
 	     i;
 	     i = fr_dcursor_next(&cursor)) {
@@ -587,20 +1045,44 @@ static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, mo
 		buffer[0] = '\0';
 #endif
 		fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), i, T_BARE_WORD);
-		pw = get_pw_nam(buffer, inst->ht, &last_found);
+
+		if (ht->map) {
+			uint32_t rec = index_find(ht, buffer, INDEX_NONE);
+
+			if (rec == INDEX_NONE) continue;
+
+			do {
+				index_record_to_pw(ht, rec, pw);
+				result_add(request->control_ctx, inst, request, &request->control_pairs, pw, 0, "config");
+				result_add(request->reply_ctx, inst, request, &request->reply_pairs, pw, 1, "reply_items");
+				result_add(request->request_ctx, inst, request, &request->request_pairs, pw, 2, "request_items");
+				rec = INDEX_RECORD((passwd_index_hdr_t const *)ht->map, rec)[0];
+			} while ((rec != INDEX_NONE) && ((rec = index_find(ht, buffer, rec)) != INDEX_NONE));
+
+			found++;
+
+			if (!inst->allow_multiple) break;
+			continue;
+		}
+
+		pw = get_pw_nam(buffer, ht, &last_found);
 		if (!pw) continue;
 
 		do {
 			result_add(request->control_ctx, inst, request, &request->control_pairs, pw, 0, "config");
 			result_add(request->reply_ctx, inst, request, &request->reply_pairs, pw, 1, "reply_items");
 			result_add(request->request_ctx, inst, request, &request->request_pairs, pw, 2, "request_items");
-		} while ((pw = get_next(buffer, inst->ht, &last_found)));
+		} while ((pw = get_next(buffer, ht, &last_found)));
 
 		found++;
 
 		if (!inst->allow_multiple) break;
 	}
 
+	if (ht->map) talloc_free(pw);
+
+	if (inst->reload) pthread_rwlock_unlock(&inst->reload->lock);
+
 	if (!found) RETURN_MODULE_NOTFOUND;
 
 	RETURN_MODULE_OK;
@@ -89,8 +89,41 @@ typedef struct {
 
 typedef struct {
 	PerlInterpreter		*perl;	//!< Thread specific perl interpreter.
+
+	/*
+	 *	Subroutines for each module method, looked up once
+	 *	in the thread's interpreter instead of on every call.
+	 */
+	CV			*func_authorize;
+	CV			*func_authenticate;
+	CV			*func_accounting;
+	CV			*func_preacct;
+	CV			*func_post_auth;
 } rlm_perl_thread_t;
 
+/** A pair list tied to one of the %RAD_* hashes
+ *
+ * Values are only converted when the script reads them, and only the keys
+ * the script modifies are written back to the list.
+ */
+typedef struct {
+	char const		*hash_name;	//!< Name of the hash, e.g. RAD_REQUEST.
+	char const		*list_name;	//!< Name of the list, for debug messages.
+	fr_pair_list_t		*list;		//!< The list the hash represents.
+	TALLOC_CTX		*ctx;		//!< To allocate new pairs in.
+	bool			replace;	//!< Write modifications back to the list.
+
+	request_t		*request;	//!< The current request.
+	HV			*hv;		//!< The hash we're tied to.
+	SV			*obj;		//!< The object the hash is tied to.
+
+	HV			*values;	//!< Values which have been read or written.
+	HV			*modified;	//!< Keys which have been written or deleted, or whose values
+						//!< may have been modified through a reference.
+	HV			*keys;		//!< Keys being iterated over.
+	bool			cleared;	//!< The whole hash was emptied.
+} rlm_perl_pairs_t;
+
 static void *perl_dlhandle;		//!< To allow us to load perl's symbols into the global symbol table.
 
 static const conf_parser_t replace_config[] = {
@@ -249,6 +282,14 @@ static XS(XS_radiusd_xlat)
 	XSRETURN(1);
 }
 
+static XS(XS_pairs_FETCH);
+static XS(XS_pairs_STORE);
+static XS(XS_pairs_EXISTS);
+static XS(XS_pairs_DELETE);
+static XS(XS_pairs_CLEAR);
+static XS(XS_pairs_FIRSTKEY);
+static XS(XS_pairs_NEXTKEY);
+
 static void xs_init(pTHX)
 {
 	char const *file = __FILE__;
@@ -258,6 +299,17 @@ static void xs_init(pTHX)
 
 	newXS("radiusd::log",XS_radiusd_log, "rlm_perl");
 	newXS("radiusd::xlat",XS_radiusd_xlat, "rlm_perl");
+
+	/*
+	 *	The class the %RAD_* hashes are tied to
+	 */
+	newXS("radiusd::Pairs::FETCH", XS_pairs_FETCH, "rlm_perl");
+	newXS("radiusd::Pairs::STORE", XS_pairs_STORE, "rlm_perl");
+	newXS("radiusd::Pairs::EXISTS", XS_pairs_EXISTS, "rlm_perl");
+	newXS("radiusd::Pairs::DELETE", XS_pairs_DELETE, "rlm_perl");
+	newXS("radiusd::Pairs::CLEAR", XS_pairs_CLEAR, "rlm_perl");
+	newXS("radiusd::Pairs::FIRSTKEY", XS_pairs_FIRSTKEY, "rlm_perl");
+	newXS("radiusd::Pairs::NEXTKEY", XS_pairs_NEXTKEY, "rlm_perl");
 }
 
 /** Convert a list of value boxes to a Perl array for passing to subroutines
@@ -599,33 +651,28 @@ static void perl_parse_config(CONF_SECTION *cs, int lvl, HV *rad_hv)
 	DEBUG("%*s}", indent_section, " ");
 }
 
-static void perl_store_vps(request_t *request, fr_pair_list_t *vps, HV *rad_hv,
-			   const char *hash_name, bool dbg_print);
+static void perl_store_vps(request_t *request, fr_pair_list_t *vps, HV *rad_hv);
 
-static void perl_vp_to_svpvn_element(request_t *request, AV *av, fr_pair_t *vp,
-				     int *i, const char *hash_name, bool dbg_print)
+/** Convert a pair to a Perl value
+ *
+ * Structural pairs are converted to hash refs.
+ */
+static SV *perl_vp_to_sv(request_t *request, fr_pair_t *vp)
 {
-
-	SV *sv;
-
-	if (dbg_print) RDEBUG2("$%s{'%s'}[%i] = %pP", hash_name, vp->da->name, *i, vp);
 	switch (vp->vp_type) {
 	case FR_TYPE_STRING:
-		sv = newSVpvn(vp->vp_strvalue, vp->vp_length);
-		break;
+		return newSVpvn(vp->vp_strvalue, vp->vp_length);
 
 	case FR_TYPE_OCTETS:
-		sv = newSVpvn((char const *)vp->vp_octets, vp->vp_length);
-		break;
+		return newSVpvn((char const *)vp->vp_octets, vp->vp_length);
 
 	case FR_TYPE_STRUCTURAL:
 	{
 		HV		*hv;
 		hv = newHV();
-		perl_store_vps(request, &vp->vp_group, hv, vp->da->name, false);
-		sv = newRV_noinc((SV *)hv);
+		perl_store_vps(request, &vp->vp_group, hv);
+		return newRV_noinc((SV *)hv);
 	}
-		break;
 
 	default:
 	{
@@ -633,97 +680,71 @@ static void perl_vp_to_svpvn_element(request_t *request, AV *av, fr_pair_t *vp,
 		ssize_t	slen;
 
 		slen = fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), vp, T_BARE_WORD);
-		if (slen < 0) return;
+		if (slen < 0) return NULL;
 
-		sv = newSVpvn(buffer, (size_t)slen);
+		return newSVpvn(buffer, (size_t)slen);
 	}
-		break;
+	}
+}
+
+/** Add a value to those already found for an attribute
+ *
+ * Attributes with multiple instances are represented as an array ref,
+ * e.g. $RAD_REQUEST{'Vendor-Specific'}{'Cisco'}{'AVPair'}.
+ *
+ * @param[in] current	Value(s) found so far, or NULL.  Ownership passes to the new value.
+ * @param[in] sv	Value to add.
+ * @return The value for the attribute.
+ */
+static SV *perl_sv_merge(SV *current, SV *sv)
+{
+	AV *av;
+
+	if (!current) return sv;
+
+	if (SvROK(current) && (SvTYPE(SvRV(current)) == SVt_PVAV)) {
+		av = (AV *)SvRV(current);
+	} else {
+		av = newAV();
+		SvTAINT(current);
+		av_push(av, current);
+		current = newRV_noinc((SV *)av);
 	}
 
-	if (!sv) return;
 	SvTAINT(sv);
 	av_push(av, sv);
-	(*i)++;
+
+	return current;
 }
 
 /*
  *  	get the vps and put them in perl hash
  *  	If one VP have multiple values it is added as array_ref
- *  	Example for this is Vendor-Specific.Cisco.AVPair that holds multiple values.
- *  	Which will be available as array_ref in $RAD_REQUEST{'Vendor-Specific.Cisco.AVPair'}
  */
-static void perl_store_vps(request_t *request, fr_pair_list_t *vps, HV *rad_hv,
-			   const char *hash_name, bool dbg_print)
+static void perl_store_vps(request_t *request, fr_pair_list_t *vps, HV *rad_hv)
 {
-	fr_pair_t *vp;
-	fr_dcursor_t cursor;
-
 	hv_undef(rad_hv);
 
-	RINDENT();
-	fr_pair_list_sort(vps, fr_pair_cmp_by_da);
-	for (vp = fr_pair_dcursor_init(&cursor, vps);
-	     vp;
-	     vp = fr_dcursor_next(&cursor)) {
-		fr_pair_t *next;
-		char const *name;
-		name = vp->da->name;
+	fr_pair_list_foreach(vps, vp) {
+		char const	*name = vp->da->name;
+		I32		name_len = strlen(name);
+		SV		**svp, *sv;
 
-		/*
-		 *	We've sorted by type, then tag, so attributes of the
-		 *	same type/tag should follow on from each other.
-		 */
-		if ((next = fr_dcursor_next_peek(&cursor)) && ATTRIBUTE_EQ(vp, next)) {
-			int i = 0;
-			AV *av;
-
-			av = newAV();
-			perl_vp_to_svpvn_element(request, av, vp, &i, hash_name, dbg_print);
-			do {
-				perl_vp_to_svpvn_element(request, av, next, &i, hash_name, dbg_print);
-				fr_dcursor_next(&cursor);
-			} while ((next = fr_dcursor_next_peek(&cursor)) && ATTRIBUTE_EQ(vp, next));
-			(void)hv_store(rad_hv, name, strlen(name), newRV_noinc((SV *)av), 0);
+		sv = perl_vp_to_sv(request, vp);
+		if (!sv) continue;
 
+		svp = hv_fetch(rad_hv, name, name_len, 0);
+		if (!svp) {
+			(void)hv_store(rad_hv, name, name_len, sv, 0);
 			continue;
 		}
 
 		/*
-		 *	It's a normal single valued attribute
+		 *	The hash releases its reference to the old value.
 		 */
-		if (dbg_print) RDEBUG2("$%s{'%s'} = %pP'", hash_name, vp->da->name, vp);
-		switch (vp->vp_type) {
-		case FR_TYPE_STRING:
-			(void)hv_store(rad_hv, name, strlen(name), newSVpvn(vp->vp_strvalue, vp->vp_length), 0);
-			break;
-
-		case FR_TYPE_OCTETS:
-			(void)hv_store(rad_hv, name, strlen(name),
-				       newSVpvn((char const *)vp->vp_octets, vp->vp_length), 0);
-			break;
-
-		case FR_TYPE_STRUCTURAL:
-		{
-			HV *hv;
-			hv = newHV();
-			perl_store_vps(request, &vp->vp_group, hv, vp->da->name, false);
-			(void)hv_store(rad_hv, name, strlen(name), newRV_noinc((SV *)hv), 0);
-		}
-			break;
-
-		default:
-		{
-			char buffer[1024];
-			ssize_t slen;
-
-			slen = fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), vp, T_BARE_WORD);
-			(void)hv_store(rad_hv, name, strlen(name),
-				       newSVpvn(buffer, (size_t)(slen)), 0);
-		}
-			break;
-		}
+		SvREFCNT_inc_simple_void_NN(*svp);
+		(void)hv_store(rad_hv, name, name_len, perl_sv_merge(*svp, sv), 0);
 	}
-	REXDENT();
 }
 
 static int get_hv_content(TALLOC_CTX *ctx, request_t *request, HV *my_hv, fr_pair_list_t *vps, const char *list_name,
@@ -795,32 +816,48 @@ static int pairadd_sv(TALLOC_CTX *ctx, request_t *request, fr_pair_list_t *vps,
 	return 0;
 }
 
+/** Convert a hash entry, which may be an array ref of values, to pairs
+ *
+ * @return the number of pairs added.
+ */
+static int perl_hv_entry_to_pairs(TALLOC_CTX *ctx, request_t *request, fr_pair_list_t *vps, char *key, SV *sv,
+				  const char *list_name, fr_dict_attr_t const *parent, bool dbg_print)
+{
+	SV		**av_sv;
+	AV		*av;
+	I32		len, j;
+	int		ret = 0;
+
+	if (!SvROK(sv) || (SvTYPE(SvRV(sv)) != SVt_PVAV)) {
+		return (pairadd_sv(ctx, request, vps, key, sv, list_name, parent, dbg_print) < 0) ? 0 : 1;
+	}
+
+	av = (AV*)SvRV(sv);
+	len = av_len(av);
+	for (j = 0; j <= len; j++) {
+		av_sv = av_fetch(av, j, 0);
+		if (!av_sv) continue;
+		if (pairadd_sv(ctx, request, vps, key, *av_sv, list_name, parent, dbg_print) < 0) continue;
+		ret++;
+	}
+
+	return ret;
+}
+
 /*
  *     Gets the content from hashes
  */
 static int get_hv_content(TALLOC_CTX *ctx, request_t *request, HV *my_hv, fr_pair_list_t *vps,
 			  const char *list_name, fr_dict_attr_t const *parent, bool dbg_print)
 {
-	SV		*res_sv, **av_sv;
-	AV		*av;
+	SV		*res_sv;
 	char		*key;
-	I32		key_len, len, i, j;
+	I32		key_len, i;
 	int		ret = 0;
 
 	for (i = hv_iterinit(my_hv); i > 0; i--) {
 		res_sv = hv_iternextsv(my_hv,&key,&key_len);
-		if (SvROK(res_sv) && (SvTYPE(SvRV(res_sv)) == SVt_PVAV)) {
-			av = (AV*)SvRV(res_sv);
-			len = av_len(av);
-			for (j = 0; j <= len; j++) {
-				av_sv = av_fetch(av, j, 0);
-				if (pairadd_sv(ctx, request, vps, key, *av_sv, list_name, parent, dbg_print) < 0) continue;
-				ret++;
-			}
-		} else {
-			if (pairadd_sv(ctx, request, vps, key, res_sv, list_name, parent, dbg_print) < 0) continue;
-			ret++;
-		}
+		ret += perl_hv_entry_to_pairs(ctx, request, vps, key, res_sv, list_name, parent, dbg_print);
 	}
 
 	if (!fr_pair_list_empty(vps)) PAIR_LIST_VERIFY(vps);
@@ -828,24 +865,338 @@ static int get_hv_content(TALLOC_CTX *ctx, request_t *request, HV *my_hv, fr_pai
 	return ret;
 }
 
+/** Get the tied list from a radiusd::Pairs object
+ *
+ * Croaks if the object has outlived the call it was created for.
+ */
+static rlm_perl_pairs_t *perl_pairs_from_sv(SV *self)
+{
+	rlm_perl_pairs_t *pairs;
+
+	if (!SvROK(self)) croak("Not a radiusd::Pairs object");
+
+	pairs = INT2PTR(rlm_perl_pairs_t *, SvIV(SvRV(self)));
+	if (!pairs) croak("Attribute hashes can only be used during the call they were populated for");
+
+	return pairs;
+}
+
+/** Whether a key which isn't in the values hash has been deleted
+ *
+ */
+static inline bool perl_pairs_removed(rlm_perl_pairs_t *pairs, char const *key, STRLEN key_len)
+{
+	return pairs->cleared || hv_exists(pairs->modified, key, key_len);
+}
+
+/** Convert all the pairs with a given name to a Perl value
+ *
+ * @return the value, or NULL if there are no matching pairs.
+ */
+static SV *perl_pairs_fetch(rlm_perl_pairs_t *pairs, char const *key)
+{
+	request_t	*request = pairs->request;
+	SV		*out = NULL, *sv;
+
+	fr_pair_list_foreach(pairs->list, vp) {
+		if (strcmp(vp->da->name, key) != 0) continue;
+
+		sv = perl_vp_to_sv(request, vp);
+		if (!sv) continue;
+
+		RDEBUG2("$%s{'%s'} = %pP", pairs->hash_name, key, vp);
+		out = perl_sv_merge(out, sv);
+	}
+
+	return out;
+}
+
+static XS(XS_pairs_FETCH)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	char const		*key;
+	STRLEN			key_len;
+	SV			**svp, *sv;
+
+	if (items != 2) croak("Usage: radiusd::Pairs::FETCH(self, key)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+	key = SvPV(ST(1), key_len);
+
+	svp = hv_fetch(pairs->values, key, key_len, 0);
+	if (svp) {
+		ST(0) = *svp;
+		XSRETURN(1);
+	}
+
+	if (perl_pairs_removed(pairs, key, key_len)) XSRETURN_UNDEF;
+
+	sv = perl_pairs_fetch(pairs, key);
+	if (!sv) XSRETURN_UNDEF;
+
+	(void)hv_store(pairs->values, key, key_len, sv, 0);
+
+	/*
+	 *	Arrays and hashes can be modified through
+	 *	the reference, without calling STORE.
+	 */
+	if (SvROK(sv)) (void)hv_store(pairs->modified, key, key_len, newSViv(1), 0);
+
+	ST(0) = sv;
+	XSRETURN(1);
+}
+
+static XS(XS_pairs_STORE)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	char const		*key;
+	STRLEN			key_len;
+
+	if (items != 3) croak("Usage: radiusd::Pairs::STORE(self, key, value)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+	key = SvPV(ST(1), key_len);
+
+	(void)hv_store(pairs->values, key, key_len, newSVsv(ST(2)), 0);
+	(void)hv_store(pairs->modified, key, key_len, newSViv(1), 0);
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_pairs_EXISTS)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	char const		*key;
+	STRLEN			key_len;
+
+	if (items != 2) croak("Usage: radiusd::Pairs::EXISTS(self, key)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+	key = SvPV(ST(1), key_len);
+
+	if (hv_exists(pairs->values, key, key_len)) XSRETURN_YES;
+	if (perl_pairs_removed(pairs, key, key_len)) XSRETURN_NO;
+
+	fr_pair_list_foreach(pairs->list, vp) {
+		if (strcmp(vp->da->name, key) == 0) XSRETURN_YES;
+	}
+
+	XSRETURN_NO;
+}
+
+static XS(XS_pairs_DELETE)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	char const		*key;
+	STRLEN			key_len;
+	SV			*sv;
+
+	if (items != 2) croak("Usage: radiusd::Pairs::DELETE(self, key)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+	key = SvPV(ST(1), key_len);
+
+	sv = hv_delete(pairs->values, key, key_len, 0);		/* Returns a mortal */
+	if (!sv && !perl_pairs_removed(pairs, key, key_len)) {
+		sv = perl_pairs_fetch(pairs, key);
+		if (sv) sv_2mortal(sv);
+	}
+	(void)hv_store(pairs->modified, key, key_len, newSViv(1), 0);
+
+	if (!sv) XSRETURN_UNDEF;
+
+	ST(0) = sv;
+	XSRETURN(1);
+}
+
+static XS(XS_pairs_CLEAR)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+
+	if (items != 1) croak("Usage: radiusd::Pairs::CLEAR(self)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+
+	hv_clear(pairs->values);
+	hv_clear(pairs->modified);
+	pairs->cleared = true;
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_pairs_FIRSTKEY)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	HE			*he;
+	char			*key;
+	STRLEN			key_len;
+
+	if (items != 1) croak("Usage: radiusd::Pairs::FIRSTKEY(self)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+
+	/*
+	 *	Only the names are collected here, values
+	 *	are still converted when they're fetched.
+	 */
+	if (pairs->keys) {
+		hv_clear(pairs->keys);
+	} else {
+		pairs->keys = newHV();
+	}
+
+	if (!pairs->cleared) fr_pair_list_foreach(pairs->list, vp) {
+		char const	*name = vp->da->name;
+		I32		name_len = strlen(name);
+
+		if (hv_exists(pairs->modified, name, name_len) && !hv_exists(pairs->values, name, name_len)) continue;
+
+		(void)hv_store(pairs->keys, name, name_len, newSViv(1), 0);
+	}
+
+	hv_iterinit(pairs->values);
+	while ((he = hv_iternext(pairs->values))) {
+		key = HePV(he, key_len);
+		(void)hv_store(pairs->keys, key, key_len, newSViv(1), 0);
+	}
+
+	hv_iterinit(pairs->keys);
+	he = hv_iternext(pairs->keys);
+	if (!he) XSRETURN_UNDEF;
+
+	ST(0) = hv_iterkeysv(he);
+	XSRETURN(1);
+}
+
+static XS(XS_pairs_NEXTKEY)
+{
+	dXSARGS;
+	rlm_perl_pairs_t	*pairs;
+	HE			*he;
+
+	if (items != 2) croak("Usage: radiusd::Pairs::NEXTKEY(self, lastkey)");
+
+	pairs = perl_pairs_from_sv(ST(0));
+	if (!pairs->keys) XSRETURN_UNDEF;
+
+	he = hv_iternext(pairs->keys);
+	if (!he) XSRETURN_UNDEF;
+
+	ST(0) = hv_iterkeysv(he);
+	XSRETURN(1);
+}
+
+/** Tie one of the %RAD_* hashes to its pair list
+ *
+ */
+static void perl_pairs_tie(request_t *request, rlm_perl_pairs_t *pairs)
+{
+	pairs->request = request;
+	pairs->values = newHV();
+	pairs->modified = newHV();
+	pairs->keys = NULL;
+	pairs->cleared = false;
+
+	pairs->hv = get_hv(pairs->hash_name, 1);
+	sv_unmagic((SV *)pairs->hv, PERL_MAGIC_tied);
+	hv_undef(pairs->hv);
+
+	pairs->obj = newSV(0);
+	sv_setref_pv(pairs->obj, "radiusd::Pairs", pairs);
+	sv_magic((SV *)pairs->hv, pairs->obj, PERL_MAGIC_tied, NULL, 0);
+}
+
+/** Write the keys the script modified back to the pair list
+ *
+ */
+static void perl_pairs_write_back(rlm_perl_pairs_t *pairs)
+{
+	request_t	*request = pairs->request;
+	fr_pair_list_t	vps;
+	HE		*he;
+
+	fr_pair_list_init(&vps);
+
+	/*
+	 *	The hash was emptied (and probably repopulated),
+	 *	so replace the whole list.
+	 */
+	if (pairs->cleared) {
+		if (get_hv_content(pairs->ctx, request, pairs->values, &vps, pairs->list_name,
+				   fr_dict_root(request->dict), true) > 0) {
+			fr_pair_list_free(pairs->list);
+			fr_pair_list_append(pairs->list, &vps);
+		}
+		return;
+	}
+
+	hv_iterinit(pairs->modified);
+	while ((he = hv_iternext(pairs->modified))) {
+		STRLEN	key_len;
+		char	*key = HePV(he, key_len);
+		SV	**svp;
+
+		fr_pair_list_foreach(pairs->list, vp) {
+			if (strcmp(vp->da->name, key) == 0) fr_pair_delete(pairs->list, vp);
+		}
+
+		svp = hv_fetch(pairs->values, key, key_len, 0);
+		if (!svp) {
+			RDEBUG2("%s.%s deleted", pairs->list_name, key);
+			continue;
+		}
+
+		(void)perl_hv_entry_to_pairs(pairs->ctx, request, &vps, key, *svp, pairs->list_name,
+					     fr_dict_root(request->dict), true);
+	}
+
+	fr_pair_list_append(pairs->list, &vps);
+}
+
+/** Untie a hash, and stop any references to the object from accessing the list
+ *
+ */
+static void perl_pairs_untie(rlm_perl_pairs_t *pairs)
+{
+	sv_setiv(SvRV(pairs->obj), 0);
+	sv_unmagic((SV *)pairs->hv, PERL_MAGIC_tied);
+	SvREFCNT_dec(pairs->obj);
+
+	SvREFCNT_dec(pairs->values);
+	SvREFCNT_dec(pairs->modified);
+	SvREFCNT_dec(pairs->keys);
+}
+
 /*
  * 	Call the function_name inside the module
- * 	Store all vps in hashes %RAD_CONFIG %RAD_REPLY %RAD_REQUEST
+ * 	Tie the vps to hashes %RAD_CONFIG %RAD_REPLY %RAD_REQUEST %RAD_STATE
  *
  */
 static unlang_action_t do_perl(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
-			       PerlInterpreter *interp, char const *function_name)
+			       PerlInterpreter *interp, char const *function_name, CV *cv)
 {
 
 	rlm_perl_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_perl_t);
-	fr_pair_list_t		vps;
 	int			ret=0, count;
 	STRLEN			n_a;
-
-	HV			*rad_reply_hv;
-	HV			*rad_config_hv;
-	HV			*rad_request_hv;
-	HV			*rad_state_hv;
+	size_t			i;
+
+	rlm_perl_pairs_t	lists[] = {
+		{ .hash_name = "RAD_REQUEST", .list_name = "request", .list = &request->request_pairs,
+		  .ctx = request->request_ctx, .replace = inst->replace.request },
+		{ .hash_name = "RAD_REPLY", .list_name = "reply", .list = &request->reply_pairs,
+		  .ctx = request->reply_ctx, .replace = inst->replace.reply },
+		{ .hash_name = "RAD_CONFIG", .list_name = "control", .list = &request->control_pairs,
+		  .ctx = request->control_ctx, .replace = inst->replace.control },
+		{ .hash_name = "RAD_STATE", .list_name = "session-state", .list = &request->session_state_pairs,
+		  .ctx = request->session_state_ctx, .replace = inst->replace.session },
+	};
 
 	/*
 	 *	Radius has told us to call this function, but none
@@ -864,15 +1215,7 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, module_ctx_t const *mctx,
 		ENTER;
 		SAVETMPS;
 
-		rad_reply_hv = get_hv("RAD_REPLY", 1);
-		rad_config_hv = get_hv("RAD_CONFIG", 1);
-		rad_request_hv = get_hv("RAD_REQUEST", 1);
-		rad_state_hv = get_hv("RAD_STATE", 1);
-
-		perl_store_vps(request, &request->request_pairs, rad_request_hv, "RAD_REQUEST", true);
-		perl_store_vps(request, &request->reply_pairs, rad_reply_hv, "RAD_REPLY", true);
-		perl_store_vps(request, &request->control_pairs, rad_config_hv, "RAD_CONFIG", true);
-		perl_store_vps(request, &request->session_state_pairs, rad_state_hv, "RAD_STATE", true);
+		for (i = 0; i < NUM_ELEMENTS(lists); i++) perl_pairs_tie(request, &lists[i]);
 
 		/*
 		 * Store pointer to request structure globally so radiusd::xlat works
@@ -888,7 +1231,11 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, module_ctx_t const *mctx,
 		 * PUTBACK;
 		 */
 
-		count = call_pv(function_name, G_SCALAR | G_EVAL | G_NOARGS);
+		if (cv) {
+			count = call_sv((SV *)cv, G_SCALAR | G_EVAL | G_NOARGS);
+		} else {
+			count = call_pv(function_name, G_SCALAR | G_EVAL | G_NOARGS);
+		}
 
 		rlm_perl_request = NULL;
 
@@ -911,33 +1258,9 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, module_ctx_t const *mctx,
 		FREETMPS;
 		LEAVE;
 
-		fr_pair_list_init(&vps);
-		if (inst->replace.request &&
-		    (get_hv_content(request->request_ctx, request, rad_request_hv, &vps, "request",
-		    		    fr_dict_root(request->dict), true)) > 0) {
-			fr_pair_list_free(&request->request_pairs);
-			fr_pair_list_append(&request->request_pairs, &vps);
-		}
-
-		if (inst->replace.reply &&
-		    (get_hv_content(request->reply_ctx, request, rad_reply_hv, &vps, "reply",
-		    		    fr_dict_root(request->dict), true)) > 0) {
-			fr_pair_list_free(&request->reply_pairs);
-			fr_pair_list_append(&request->reply_pairs, &vps);
-		}
-
-		if (inst->replace.control &&
-		    (get_hv_content(request->control_ctx, request, rad_config_hv, &vps, "control",
-		    		    fr_dict_root(request->dict), true)) > 0) {
-			fr_pair_list_free(&request->control_pairs);
-			fr_pair_list_append(&request->control_pairs, &vps);
-		}
-
-		if (inst->replace.session &&
-		    (get_hv_content(request->session_state_ctx, request, rad_state_hv, &vps, "session-state",
-		    		    fr_dict_root(request->dict), true)) > 0) {
-			fr_pair_list_free(&request->session_state_pairs);
-			fr_pair_list_append(&request->session_state_pairs, &vps);
+		for (i = 0; i < NUM_ELEMENTS(lists); i++) {
+			if (lists[i].replace) perl_pairs_write_back(&lists[i]);
+			perl_pairs_untie(&lists[i]);
 		}
 	}
 
@@ -948,9 +1271,8 @@ static unlang_action_t do_perl(rlm_rcode_t *p_result, module_ctx_t const *mctx,
 static unlang_action_t CC_HINT(nonnull) mod_##_x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 { \
 	rlm_perl_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_perl_t); \
-	return do_perl(p_result, mctx, request, \
-		       ((rlm_perl_thread_t *)talloc_get_type_abort(mctx->thread, rlm_perl_thread_t))->perl, \
-		       inst->func_##_x); \
+	rlm_perl_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_perl_thread_t); \
+	return do_perl(p_result, mctx, request, t->perl, inst->func_##_x, t->func_##_x); \
 }
 
 RLM_PERL_FUNC(authorize)
@@ -1013,6 +1335,20 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 
 	t->perl = interp;			/* Store perl interp for easy freeing later */
 
+	/*
+	 *	Resolve the subroutines now, so calls don't have
+	 *	to look them up by name.  Ones which don't exist yet
+	 *	are still looked up by name when they're called.
+	 */
+#define RLM_PERL_CV(_x) \
+	if (inst->func_##_x && (t->func_##_x = get_cv(inst->func_##_x, 0))) SvREFCNT_inc_simple_void_NN(t->func_##_x)
+
+	RLM_PERL_CV(authorize);
+	RLM_PERL_CV(authenticate);
+	RLM_PERL_CV(post_auth);
+	RLM_PERL_CV(preacct);
+	RLM_PERL_CV(accounting);
+
 	return 0;
 }
 
@@ -1020,6 +1356,17 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_perl_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_perl_thread_t);
 
+	{
+		dTHXa(t->perl);
+		PERL_SET_CONTEXT(t->perl);
+	}
+
+	SvREFCNT_dec(t->func_authorize);
+	SvREFCNT_dec(t->func_authenticate);
+	SvREFCNT_dec(t->func_post_auth);
+	SvREFCNT_dec(t->func_preacct);
+	SvREFCNT_dec(t->func_accounting);
+
 	rlm_perl_interp_free(t->perl);
 
 	return 0;
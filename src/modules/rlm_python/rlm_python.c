@@ -51,13 +51,13 @@ typedef struct {
 	char const	*function_name;		//!< String name of function in module.
 } python_func_def_t;
 
-/** An instance of the rlm_python module
+/** An interpreter, and the objects we've loaded into it
  *
  */
 typedef struct {
-	char const	*name;			//!< Name of the module instance
-	PyThreadState	*interpreter;		//!< The interpreter used for this instance of rlm_python.
+	PyThreadState	*interpreter;		//!< The interpreter's initial thread state.
 	PyObject	*module;		//!< Local, interpreter specific module.
+	PyTypeObject	*pair_list_type;	//!< Type of the attribute lists passed to functions.
 
 	python_func_def_t
 	instantiate,
@@ -70,6 +70,16 @@ typedef struct {
 
 	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
 						//!< made available to the python script.
+} rlm_python_interp_t;
+
+/** An instance of the rlm_python module
+ *
+ */
+typedef struct {
+	char const		*name;			//!< Name of the module instance
+	bool			thread_interpreter;	//!< Give each thread its own interpreter and GIL.
+
+	rlm_python_interp_t	interp;			//!< Used by all threads, unless thread_interpreter is set.
 } rlm_python_t;
 
 /** Global config for python library
@@ -84,17 +94,36 @@ typedef struct {
  *
  * Multiple instances of python create multiple interpreters and each
  * thread must have a PyThreadState per interpreter, to track execution.
+ *
+ * If thread_interpreter is set, the thread has an interpreter of its
+ * own instead, which doesn't share a GIL with any other thread.
  */
 typedef struct {
-	PyThreadState	*state;			//!< Module instance/thread specific state.
+	PyThreadState		*state;		//!< Module instance/thread specific state.
+	rlm_python_interp_t	*interp;	//!< Interpreter the functions are called in.
+	PyThreadState		*main_state;	//!< Thread state in the main interpreter, used to create
+						//!< and destroy the thread's own interpreter.
 } rlm_python_thread_t;
 
+/** A view of a pair list, passed to python functions
+ *
+ * Behaves like the tuple of (name, value) tuples previous versions passed,
+ * and can also be indexed by attribute name.  Values are only converted
+ * when they're accessed.
+ */
+typedef struct {
+	PyObject_HEAD
+	module_ctx_t const	*mctx;		//!< Used to log conversion errors.
+	request_t		*request;	//!< Request the list belongs to.  NULL once the function returns.
+	fr_pair_list_t		*list;		//!< List being accessed.
+
+	fr_pair_t		*last;		//!< Last pair accessed by position, so iteration is O(n).
+	Py_ssize_t		last_idx;	//!< Position of last.
+} python_pair_list_t;
+
 static void			*python_dlhandle;
 static PyThreadState		*global_interpreter;	//!< Our first interpreter.
 
-static module_ctx_t const	*current_mctx;		//!< Used for communication with inittab functions.
-static CONF_SECTION		*current_conf;		//!< Used for communication with inittab functions.
-
 static libpython_global_config_t libpython_global_config = {
 	.path = NULL,
 	.path_include_default = true
@@ -146,8 +175,8 @@ global_lib_autoinst_t const * const rlm_python_lib[] = {
  */
 static conf_parser_t module_config[] = {
 
-#define A(x) { FR_CONF_OFFSET("mod_" #x, rlm_python_t, x.module_name), .dflt = "${.module}" }, \
-	{ FR_CONF_OFFSET("func_" #x, rlm_python_t, x.function_name) },
+#define A(x) { FR_CONF_OFFSET("mod_" #x, rlm_python_t, interp.x.module_name), .dflt = "${.module}" }, \
+	{ FR_CONF_OFFSET("func_" #x, rlm_python_t, interp.x.function_name) },
 
 	A(instantiate)
 	A(authorize)
@@ -159,6 +188,8 @@ static conf_parser_t module_config[] = {
 
 #undef A
 
+	{ FR_CONF_OFFSET("thread_interpreter", rlm_python_t, thread_interpreter), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -366,18 +397,16 @@ static void mod_vptuple(TALLOC_CTX *ctx, module_ctx_t const *mctx, request_t *re
 }
 
 
-/*
- *	This is the core Python function that the others wrap around.
- *	Pass the value-pair print strings in a tuple.
+/** Convert the value of a pair to a python object
+ *
+ * @return
+ *	- The value.  Structural pairs are converted to None.
+ *	- NULL on error, which has been logged and cleared.
  */
-static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, PyObject *pp, fr_pair_t *vp)
+static PyObject *python_value_from_pair(module_ctx_t const *mctx, request_t *request, fr_pair_t const *vp)
 {
-	PyObject *attribute = NULL;
 	PyObject *value = NULL;
 
-	attribute = PyUnicode_FromString(vp->da->name);
-	if (!attribute) return -1;
-
 	switch (vp->vp_type) {
 	case FR_TYPE_STRING:
 		value = PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
@@ -450,81 +479,294 @@ static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, Py
 		char buffer[256];
 
 		slen = fr_value_box_print(&FR_SBUFF_OUT(buffer, sizeof(buffer)), &vp->data, NULL);
-		if (slen < 0) {
-		error:
-			ROPTIONAL(REDEBUG, ERROR, "Failed marshalling %pP to Python value", vp);
-			python_error_log(mctx, request);
-			Py_XDECREF(attribute);
-			return -1;
-		}
+		if (slen < 0) goto error;
 		value = PyUnicode_FromStringAndSize(buffer, (size_t)slen);
 	}
 		break;
 
 	case FR_TYPE_NON_LEAF:
-		return 0;
+		Py_RETURN_NONE;
+	}
+
+	if (value == NULL) {
+	error:
+		ROPTIONAL(REDEBUG, ERROR, "Failed marshalling %pP to Python value", vp);
+		python_error_log(mctx, request);
+		return NULL;
 	}
 
-	if (value == NULL) goto error;
+	return value;
+}
 
-	PyTuple_SET_ITEM(pp, 0, attribute);
-	PyTuple_SET_ITEM(pp, 1, value);
+/** Check a pair list view is still usable
+ *
+ */
+static inline CC_HINT(always_inline) int python_pair_list_valid(python_pair_list_t *self)
+{
+	if (likely(self->request != NULL)) return 0;
 
-	return 0;
+	PyErr_SetString(PyExc_RuntimeError, "Attribute list can only be used during the call it was passed to");
+	return -1;
 }
 
+/** Find the first pair with the given attribute name
+ *
+ * @return
+ *	- The pair.
+ *	- NULL if there's no such pair, or on error (with an exception set).
+ */
+static fr_pair_t *python_pair_list_find(python_pair_list_t *self, PyObject *key)
+{
+	char const		*name;
+	fr_dict_attr_t const	*da;
+
+	name = PyUnicode_AsUTF8(key);
+	if (!name) return NULL;
+
+	da = fr_dict_attr_by_name(NULL, fr_dict_root(self->request->dict), name);
+	if (!da) return NULL;
+
+	return fr_pair_find_by_da(self->list, NULL, da);
+}
+
+static Py_ssize_t python_pair_list_len(PyObject *obj)
+{
+	python_pair_list_t *self = (python_pair_list_t *)obj;
+
+	if (python_pair_list_valid(self) < 0) return -1;
+
+	return fr_pair_list_num_elements(self->list);
+}
+
+/** Return a (name, value) tuple for the pair at a given position
+ *
+ * If the value can't be converted, None is returned, as it was when
+ * the whole list was converted.
+ */
+static PyObject *python_pair_list_item(PyObject *obj, Py_ssize_t idx)
+{
+	python_pair_list_t	*self = (python_pair_list_t *)obj;
+	fr_pair_t		*vp;
+	Py_ssize_t		i;
+	PyObject		*attribute, *value, *pp;
+
+	if (python_pair_list_valid(self) < 0) return NULL;
+
+	if ((idx < 0) || ((size_t)idx >= fr_pair_list_num_elements(self->list))) {
+		PyErr_SetString(PyExc_IndexError, "Attribute list index out of range");
+		return NULL;
+	}
+
+	/*
+	 *	Sequential access (i.e. iteration) carries on
+	 *	from where the last call left off.
+	 */
+	if (self->last && (idx >= self->last_idx)) {
+		vp = self->last;
+		i = self->last_idx;
+	} else {
+		vp = fr_pair_list_head(self->list);
+		i = 0;
+	}
+	while (i < idx) {
+		vp = fr_pair_list_next(self->list, vp);
+		i++;
+	}
+	self->last = vp;
+	self->last_idx = idx;
+
+	value = python_value_from_pair(self->mctx, self->request, vp);
+	if (!value) Py_RETURN_NONE;
+
+	attribute = PyUnicode_FromString(vp->da->name);
+	if (!attribute) {
+		Py_DECREF(value);
+		return NULL;
+	}
+
+	pp = PyTuple_Pack(2, attribute, value);
+	Py_DECREF(attribute);
+	Py_DECREF(value);
+
+	return pp;
+}
+
+/** Index the list by position, slice, or attribute name
+ *
+ * Indexing by name returns the value of the first matching pair.
+ */
+static PyObject *python_pair_list_subscript(PyObject *obj, PyObject *key)
+{
+	python_pair_list_t	*self = (python_pair_list_t *)obj;
+	fr_pair_t		*vp;
+	PyObject		*tuple, *ret;
+
+	if (python_pair_list_valid(self) < 0) return NULL;
+
+	if (PyUnicode_Check(key)) {
+		vp = python_pair_list_find(self, key);
+		if (!vp) {
+			if (!PyErr_Occurred()) PyErr_SetObject(PyExc_KeyError, key);
+			return NULL;
+		}
+
+		ret = python_value_from_pair(self->mctx, self->request, vp);
+		if (!ret) Py_RETURN_NONE;
+		return ret;
+	}
+
+	if (PyIndex_Check(key)) {
+		Py_ssize_t idx = PyNumber_AsSsize_t(key, PyExc_IndexError);
+
+		if ((idx == -1) && PyErr_Occurred()) return NULL;
+		if (idx < 0) idx += fr_pair_list_num_elements(self->list);
+
+		return python_pair_list_item(obj, idx);
+	}
+
+	if (PySlice_Check(key)) {
+		tuple = PySequence_Tuple(obj);
+		if (!tuple) return NULL;
+
+		ret = PyObject_GetItem(tuple, key);
+		Py_DECREF(tuple);
+		return ret;
+	}
+
+	PyErr_SetString(PyExc_TypeError, "Attribute lists are indexed by position or attribute name");
+	return NULL;
+}
+
+/** Check for an attribute name, or a (name, value) tuple
+ *
+ */
+static int python_pair_list_contains(PyObject *obj, PyObject *key)
+{
+	python_pair_list_t	*self = (python_pair_list_t *)obj;
+	PyObject		*tuple;
+	int			ret;
+
+	if (python_pair_list_valid(self) < 0) return -1;
+
+	if (PyUnicode_Check(key)) {
+		if (python_pair_list_find(self, key)) return 1;
+		return PyErr_Occurred() ? -1 : 0;
+	}
+
+	tuple = PySequence_Tuple(obj);
+	if (!tuple) return -1;
+
+	ret = PySequence_Contains(tuple, key);
+	Py_DECREF(tuple);
+
+	return ret;
+}
+
+/** Return the value of the first pair with a given name, or a default
+ *
+ */
+static PyObject *python_pair_list_get(PyObject *obj, PyObject *args)
+{
+	python_pair_list_t	*self = (python_pair_list_t *)obj;
+	PyObject		*key, *dflt = Py_None, *ret;
+	fr_pair_t		*vp;
+
+	if (python_pair_list_valid(self) < 0) return NULL;
+
+	if (!PyArg_ParseTuple(args, "U|O", &key, &dflt)) return NULL;
+
+	vp = python_pair_list_find(self, key);
+	if (!vp) {
+		if (PyErr_Occurred()) return NULL;
+
+		Py_INCREF(dflt);
+		return dflt;
+	}
+
+	ret = python_value_from_pair(self->mctx, self->request, vp);
+	if (!ret) Py_RETURN_NONE;
+	return ret;
+}
+
+/** Print the list as the equivalent tuple
+ *
+ */
+static PyObject *python_pair_list_repr(PyObject *obj)
+{
+	PyObject	*tuple, *ret;
+
+	if (python_pair_list_valid((python_pair_list_t *)obj) < 0) return NULL;
+
+	tuple = PySequence_Tuple(obj);
+	if (!tuple) return NULL;
+
+	ret = PyObject_Repr(tuple);
+	Py_DECREF(tuple);
+
+	return ret;
+}
+
+static PyMethodDef python_pair_list_methods[] = {
+	{ "get", &python_pair_list_get, METH_VARARGS,
+	  "get(name[, default])\n\n" \
+	  "Return the value of the first attribute called name, or default if there isn't one.\n"
+	},
+	{ NULL, NULL, 0, NULL },
+};
+
+static PyType_Slot python_pair_list_slots[] = {
+	{ Py_sq_length, python_pair_list_len },
+	{ Py_sq_item, python_pair_list_item },
+	{ Py_sq_contains, python_pair_list_contains },
+	{ Py_mp_length, python_pair_list_len },
+	{ Py_mp_subscript, python_pair_list_subscript },
+	{ Py_tp_methods, python_pair_list_methods },
+	{ Py_tp_repr, python_pair_list_repr },
+	{ Py_tp_doc, (void *)"Attributes of the current request.  Only valid during the call." },
+	{ 0, NULL }
+};
+
+/** Created in each interpreter, as static types can't be shared between interpreters with their own GIL
+ *
+ */
+static PyType_Spec python_pair_list_spec = {
+	.name = "freeradius.PairList",
+	.basicsize = sizeof(python_pair_list_t),
+	.flags = Py_TPFLAGS_DEFAULT,
+	.slots = python_pair_list_slots
+};
+
 static unlang_action_t do_python_single(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					rlm_python_interp_t const *interp,
 					request_t *request, PyObject *p_func, char const *funcname)
 {
-	fr_pair_t	*vp;
-	PyObject	*p_ret = NULL;
-	PyObject	*p_arg = NULL;
-	int		tuple_len;
-	rlm_rcode_t	rcode = RLM_MODULE_OK;
+	python_pair_list_t	*pair_list = NULL;
+	PyObject		*p_ret = NULL;
+	PyObject		*p_arg = NULL;
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
 
 	/*
-	 *	We will pass a tuple containing (name, value) tuples
-	 *	We can safely use the Python function to build up a
-	 *	tuple, since the tuple is not used elsewhere.
+	 *	Pass a view of the request list, which converts
+	 *	values as the function accesses them.
 	 *
-	 *	Determine the size of our tuple by walking through the packet.
-	 *	If request is NULL, pass None.
+	 *	If request is NULL, or the list is empty, pass None.
 	 */
-	tuple_len = 0;
-	if (request != NULL) {
-		tuple_len = fr_pair_list_num_elements(&request->request_pairs);
-	}
-
-	if (tuple_len == 0) {
+	if (!request || (fr_pair_list_num_elements(&request->request_pairs) == 0)) {
 		Py_INCREF(Py_None);
 		p_arg = Py_None;
 	} else {
-		int i = 0;
-		if ((p_arg = PyTuple_New(tuple_len)) == NULL) {
+		pair_list = PyObject_New(python_pair_list_t, interp->pair_list_type);
+		if (!pair_list) {
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
+		pair_list->mctx = mctx;
+		pair_list->request = request;
+		pair_list->list = &request->request_pairs;
+		pair_list->last = NULL;
+		pair_list->last_idx = 0;
 
-		for (vp = fr_pair_list_head(&request->request_pairs);
-		     vp;
-		     vp = fr_pair_list_next(&request->request_pairs, vp), i++) {
-			PyObject *pp;
-
-			/* The inside tuple has two only: */
-			if ((pp = PyTuple_New(2)) == NULL) {
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-
-			if (mod_populate_vptuple(mctx, request, pp, vp) == 0) {
-				/* Put the tuple inside the container */
-				PyTuple_SET_ITEM(p_arg, i, pp);
-			} else {
-				Py_INCREF(Py_None);
-				PyTuple_SET_ITEM(p_arg, i, Py_None);
-				Py_DECREF(pp);
-			}
-		}
+		p_arg = (PyObject *)pair_list;
 	}
 
 	/* Call Python function. */
@@ -594,6 +836,11 @@ static unlang_action_t do_python_single(rlm_rcode_t *p_result, module_ctx_t cons
 
 finish:
 	if (rcode == RLM_MODULE_FAIL) python_error_log(mctx, request);
+
+	/*
+	 *	The function may have kept a reference to the view.
+	 */
+	if (pair_list) pair_list->request = NULL;
 	Py_XDECREF(p_arg);
 	Py_XDECREF(p_ret);
 
@@ -618,7 +865,7 @@ static unlang_action_t do_python(rlm_rcode_t *p_result, module_ctx_t const *mctx
 	RDEBUG3("Using thread state %p/%p", mctx->mi->data, t->state);
 
 	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
-	do_python_single(&rcode, mctx, request, p_func, funcname);
+	do_python_single(&rcode, mctx, t->interp, request, p_func, funcname);
 	(void)fr_cond_assert(PyEval_SaveThread() == t->state);
 
 	RETURN_MODULE_RCODE(rcode);
@@ -627,8 +874,8 @@ static unlang_action_t do_python(rlm_rcode_t *p_result, module_ctx_t const *mctx
 #define MOD_FUNC(x) \
 static unlang_action_t CC_HINT(nonnull) mod_##x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 { \
-	rlm_python_t const *inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t); \
-	return do_python(p_result, mctx, request, inst->x.function, #x);\
+	rlm_python_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t); \
+	return do_python(p_result, mctx, request, t->interp->x.function, #x);\
 }
 
 MOD_FUNC(authenticate)
@@ -775,21 +1022,21 @@ static int python_parse_config(module_inst_ctx_t const *mctx, CONF_SECTION *cs,
 /** Make the current instance's config available within the module we're initialising
  *
  */
-static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTION *conf, PyObject *module)
+static int python_module_import_config(module_inst_ctx_t const *mctx, rlm_python_interp_t *interp,
+				       CONF_SECTION *conf, PyObject *module)
 {
-	rlm_python_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
 	CONF_SECTION *cs;
 
 	/*
 	 *	Convert a FreeRADIUS config structure into a python
 	 *	dictionary.
 	 */
-	inst->pythonconf_dict = PyDict_New();
-	if (!inst->pythonconf_dict) {
+	interp->pythonconf_dict = PyDict_New();
+	if (!interp->pythonconf_dict) {
 		ERROR("Unable to create python dict for config");
 	error:
-		Py_XDECREF(inst->pythonconf_dict);
-		inst->pythonconf_dict = NULL;
+		Py_XDECREF(interp->pythonconf_dict);
+		interp->pythonconf_dict = NULL;
 		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
 		return -1;
 	}
@@ -797,13 +1044,13 @@ static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTI
 	cs = cf_section_find(conf, "config", NULL);
 	if (cs) {
 		DEBUG("Inserting \"config\" section into python environment as radiusd.config");
-		if (python_parse_config(mctx, cs, 0, inst->pythonconf_dict) < 0) goto error;
+		if (python_parse_config(mctx, cs, 0, interp->pythonconf_dict) < 0) goto error;
 	}
 
 	/*
 	 *	Add module configuration as a dict
 	 */
-	if (PyModule_AddObject(module, "config", inst->pythonconf_dict) < 0) goto error;
+	if (PyModule_AddObject(module, "config", interp->pythonconf_dict) < 0) goto error;
 
 	return 0;
 }
@@ -829,54 +1076,58 @@ static int python_module_import_constants(module_inst_ctx_t const *mctx, PyObjec
 /*
  *	Python 3 interpreter initialisation and destruction
  */
-static PyObject *python_module_init(void)
-{
-	PyObject		*module;
 
-	static struct PyModuleDef py_module_def = {
-		PyModuleDef_HEAD_INIT,
-		.m_name = "freeradius",
-		.m_doc = "freeRADIUS python module",
-		.m_size = -1,
-		.m_methods = module_methods
-	};
+/** Add types to the "freeradius" module, each time it's imported into an interpreter
+ *
+ */
+static int python_module_exec(PyObject *module)
+{
+	PyObject *type;
 
-	fr_assert(current_mctx);
+	type = PyType_FromSpec(&python_pair_list_spec);
+	if (!type) return -1;
 
-	module = PyModule_Create(&py_module_def);
-	if (!module) {
-		python_error_log(current_mctx, NULL);
-		Py_RETURN_NONE;
+	if (PyModule_AddObject(module, "PairList", type) < 0) {
+		Py_DECREF(type);
+		return -1;
 	}
 
-	return module;
+	return 0;
 }
 
-static int python_interpreter_init(module_inst_ctx_t const *mctx)
-{
-	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
-	CONF_SECTION	*conf = mctx->mi->conf;
-	PyObject	*module;
+static PyModuleDef_Slot python_module_slots[] = {
+	{ Py_mod_exec, python_module_exec },
+#if PY_VERSION_HEX >= 0x030C0000
+	{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+	{ 0, NULL }
+};
 
-	/*
-	 *	python_module_init takes no args, so we need
-	 *	to set these globals so that when it's
-	 *	called during interpreter initialisation
-	 *	it can get at the current instance config.
-	 */
-	current_mctx = MODULE_CTX_FROM_INST(mctx);
-	current_conf = conf;
+static struct PyModuleDef python_module_def = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "freeradius",
+	.m_doc = "freeRADIUS python module",
+	.m_size = 0,
+	.m_methods = module_methods,
+	.m_slots = python_module_slots
+};
 
-	PyEval_RestoreThread(global_interpreter);
-	LSAN_DISABLE(inst->interpreter = Py_NewInterpreter());
-	if (!inst->interpreter) {
-		ERROR("Failed creating new interpreter");
-		return -1;
-	}
-	DEBUG3("Created new interpreter %p", inst->interpreter);
-	PyEval_SaveThread();		/* Unlock GIL */
+/** Uses multi-phase initialisation, so each interpreter gets its own copy of the module
+ *
+ */
+static PyObject *python_module_init(void)
+{
+	return PyModuleDef_Init(&python_module_def);
+}
 
-	PyEval_RestoreThread(inst->interpreter);
+/** Import the "freeradius" module and the user's functions, then call the instantiate function
+ *
+ * Must be called with the interpreter's thread state current.  On error,
+ * the caller should free the interpreter with python_interpreter_free().
+ */
+static int python_interpreter_load(module_inst_ctx_t const *mctx, rlm_python_interp_t *interp)
+{
+	PyObject	*module;
 
 	/*
 	 *	Import the radiusd module into this python
@@ -884,62 +1135,27 @@ static int python_interpreter_init(module_inst_ctx_t const *mctx)
 	 *	own copy which it can mutate as much as
 	 *      it wants.
 	 */
- 	module = PyImport_ImportModule("freeradius");
- 	if (!module) {
- 		ERROR("Failed importing \"freeradius\" module into interpreter %p", inst->interpreter);
- 		return -1;
- 	}
-	if ((python_module_import_config(mctx, conf, module) < 0) ||
-	    (python_module_import_constants(mctx, module) < 0)) {
-		Py_DECREF(module);
+	module = PyImport_ImportModule("freeradius");
+	if (!module) {
+		ERROR("Failed importing \"freeradius\" module into interpreter %p", interp->interpreter);
+		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
 		return -1;
 	}
-	inst->module = module;
-	PyEval_SaveThread();
-
-	return 0;
-}
-
-static void python_interpreter_free(rlm_python_t *inst, PyThreadState *interp)
-{
-	/*
-	 *	We incremented the reference count earlier
-	 *	during module initialisation.
-	 */
-	Py_XDECREF(inst->module);
-
-	PyEval_RestoreThread(interp);	/* Switches thread state and locks GIL */
-	Py_EndInterpreter(interp);	/* Destroys interpreter (GIL still locked) - sets thread state to NULL */
-	PyThreadState_Swap(global_interpreter);	/* Get a none-null thread state */
-	PyEval_SaveThread();		/* Unlock GIL */
-}
+	interp->module = module;
 
-/*
- *	Do any per-module initialization that is separate to each
- *	configured instance of the module.  e.g. set up connections
- *	to external databases, read configuration files, set up
- *	dictionary entries, etc.
- *
- *	If configuration information is given in the config section
- *	that must be referenced in later calls, store a handle to it
- *	in *instance otherwise put a null pointer there.
- *
- */
-static int mod_instantiate(module_inst_ctx_t const *mctx)
-{
-	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
-
-	if (python_interpreter_init(mctx) < 0) return -1;
+	if ((python_module_import_config(mctx, interp, mctx->mi->conf, module) < 0) ||
+	    (python_module_import_constants(mctx, module) < 0)) return -1;
 
-	/*
-	 *	Switch to our module specific interpreter
-	 */
-	PyEval_RestoreThread(inst->interpreter);
+	interp->pair_list_type = (PyTypeObject *)PyObject_GetAttrString(module, "PairList");
+	if (!interp->pair_list_type) {
+		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
+		return -1;
+	}
 
 	/*
 	 *	Process the various sections
 	 */
-#define PYTHON_FUNC_LOAD(_x) if (python_function_load(mctx, &inst->_x) < 0) goto error
+#define PYTHON_FUNC_LOAD(_x) if (python_function_load(mctx, &interp->_x) < 0) return -1
 	PYTHON_FUNC_LOAD(instantiate);
 	PYTHON_FUNC_LOAD(authenticate);
 	PYTHON_FUNC_LOAD(authorize);
@@ -951,16 +1167,14 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	/*
 	 *	Call the instantiate function.
 	 */
-	if (inst->instantiate.function) {
+	if (interp->instantiate.function) {
 		rlm_rcode_t rcode;
 
-		do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), NULL, inst->instantiate.function, "instantiate");
+		do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), interp, NULL,
+				 interp->instantiate.function, "instantiate");
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 		case RLM_MODULE_REJECT:
-		error:
-			fr_cond_assert(PyEval_SaveThread() == inst->interpreter);
-			python_interpreter_free(inst, inst->interpreter);
 			return -1;
 
 		default:
@@ -968,41 +1182,27 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		}
 	}
 
-	/*
-	 *	Switch back to the global interpreter
-	 */
-	if (!fr_cond_assert(PyEval_SaveThread() == inst->interpreter)) goto error;
-
 	return 0;
 }
 
-static int mod_detach(module_detach_ctx_t const *mctx)
+/** Call the detach function, release everything we loaded, and destroy the interpreter
+ *
+ * Must be called with the interpreter's thread state current.  Leaves
+ * no thread state set.
+ */
+static void python_interpreter_free(module_inst_ctx_t const *mctx, rlm_python_interp_t *interp, bool call_detach)
 {
-	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
-
-	/*
-	 *	If we don't have a interpreter
-	 *	we didn't get far enough into
-	 *	instantiation to generate things
-	 *	we need to clean up...
-	 */
-	if (!inst->interpreter) return 0;
-
-	/*
-	 *	Call module destructor
-	 */
-	PyEval_RestoreThread(inst->interpreter);
-
 	/*
 	 *	We don't care if this fails.
 	 */
-	if (inst->detach.function) {
+	if (call_detach && interp->detach.function) {
 		rlm_rcode_t rcode;
 
-		(void)do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), NULL, inst->detach.function, "detach");
+		(void)do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), interp, NULL,
+				       interp->detach.function, "detach");
 	}
 
-#define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&inst->_x)
+#define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&interp->_x)
 	PYTHON_FUNC_DESTROY(instantiate);
 	PYTHON_FUNC_DESTROY(authorize);
 	PYTHON_FUNC_DESTROY(authenticate);
@@ -1011,13 +1211,178 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	PYTHON_FUNC_DESTROY(post_auth);
 	PYTHON_FUNC_DESTROY(detach);
 
-	Py_XDECREF(inst->pythonconf_dict);
+	/*
+	 *	The config dict is owned by the module.
+	 */
+	interp->pythonconf_dict = NULL;
+	Py_XDECREF(interp->pair_list_type);
+	interp->pair_list_type = NULL;
+	python_obj_destroy(&interp->module);
+
+	Py_EndInterpreter(interp->interpreter);	/* Destroys interpreter (GIL still locked) - sets thread state to NULL */
+	interp->interpreter = NULL;
+}
+
+/** Create the interpreter shared by all of an instance's threads
+ *
+ */
+static int python_interpreter_init(module_inst_ctx_t const *mctx)
+{
+	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+
+	PyEval_RestoreThread(global_interpreter);
+	LSAN_DISABLE(inst->interp.interpreter = Py_NewInterpreter());
+	if (!inst->interp.interpreter) {
+		ERROR("Failed creating new interpreter");
+		PyEval_SaveThread();
+		return -1;
+	}
+	DEBUG3("Created new interpreter %p", inst->interp.interpreter);
+
+	if (python_interpreter_load(mctx, &inst->interp) < 0) {
+		python_interpreter_free(mctx, &inst->interp, false);
+		PyThreadState_Swap(global_interpreter);	/* Get a none-null thread state */
+		PyEval_SaveThread();			/* Unlock GIL */
+		return -1;
+	}
+
+	/*
+	 *	Switch back to the global interpreter
+	 */
+	if (!fr_cond_assert(PyEval_SaveThread() == inst->interp.interpreter)) return -1;
+
+	return 0;
+}
+
+#if PY_VERSION_HEX >= 0x030C0000
+/** Create an interpreter for the current thread, with its own GIL
+ *
+ * Functions called from this thread then don't contend with any
+ * other thread for the GIL.
+ *
+ * Extension modules the user's script imports must support being loaded
+ * into multiple interpreters with their own GIL.
+ */
+static int python_thread_interpreter_init(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
+	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	rlm_python_interp_t	*interp;
+	PyInterpreterConfig	config = {
+					.use_main_obmalloc = 0,
+					.allow_fork = 0,
+					.allow_exec = 0,
+					.allow_threads = 1,
+					.allow_daemon_threads = 0,
+					.check_multi_interp_extensions = 1,
+					.gil = PyInterpreterConfig_OWN_GIL,
+				};
+	PyStatus		status;
+
+	MEM(interp = talloc_zero(t, rlm_python_interp_t));
+#define PYTHON_FUNC_COPY(_x) interp->_x = (python_func_def_t){ \
+		.module_name = inst->interp._x.module_name, \
+		.function_name = inst->interp._x.function_name \
+	}
+	PYTHON_FUNC_COPY(instantiate);
+	PYTHON_FUNC_COPY(authorize);
+	PYTHON_FUNC_COPY(authenticate);
+	PYTHON_FUNC_COPY(preacct);
+	PYTHON_FUNC_COPY(accounting);
+	PYTHON_FUNC_COPY(post_auth);
+	PYTHON_FUNC_COPY(detach);
+
+	/*
+	 *	Creating an interpreter requires a thread
+	 *	state in an existing one.
+	 */
+	t->main_state = PyThreadState_New(global_interpreter->interp);
+	if (!t->main_state) {
+		ERROR("Failed initialising local PyThreadState");
+		return -1;
+	}
+
+	PyEval_RestoreThread(t->main_state);
+	LSAN_DISABLE(status = Py_NewInterpreterFromConfig(&interp->interpreter, &config));
+	if (PyStatus_Exception(status)) {
+		ERROR("Failed creating thread interpreter: %s", status.err_msg);
+	error:
+		PyThreadState_Clear(t->main_state);
+		PyThreadState_DeleteCurrent();		/* Unlocks the main GIL */
+		t->main_state = NULL;
+		return -1;
+	}
+	DEBUG3("Created thread interpreter %p", interp->interpreter);
+
+	/*
+	 *	The main interpreter's GIL has been released,
+	 *	and the new interpreter's GIL is held.
+	 */
+	if (python_interpreter_load(MODULE_INST_CTX(mctx->mi), interp) < 0) {
+		python_interpreter_free(MODULE_INST_CTX(mctx->mi), interp, false);
+		PyEval_RestoreThread(t->main_state);
+		goto error;
+	}
+
+	t->interp = interp;
+	t->state = interp->interpreter;
 	PyEval_SaveThread();
 
+	return 0;
+}
+#endif
+
+/*
+ *	Do any per-module initialization that is separate to each
+ *	configured instance of the module.  e.g. set up connections
+ *	to external databases, read configuration files, set up
+ *	dictionary entries, etc.
+ *
+ *	If configuration information is given in the config section
+ *	that must be referenced in later calls, store a handle to it
+ *	in *instance otherwise put a null pointer there.
+ *
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+
+	/*
+	 *	Each thread creates and loads its own
+	 *	interpreter.
+	 */
+	if (inst->thread_interpreter) {
+#if PY_VERSION_HEX >= 0x030C0000
+		return 0;
+#else
+		cf_log_err(mctx->mi->conf, "'thread_interpreter' requires Python 3.12 or later");
+		return -1;
+#endif
+	}
+
+	return python_interpreter_init(mctx);
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+
+	/*
+	 *	If we don't have a interpreter
+	 *	we didn't get far enough into
+	 *	instantiation to generate things
+	 *	we need to clean up...
+	 */
+	if (!inst->interp.interpreter) return 0;
+
 	/*
-	 *	Free the module specific interpreter
+	 *	Call module destructor, and free the module
+	 *	specific interpreter
 	 */
-	python_interpreter_free(inst, inst->interpreter);
+	PyEval_RestoreThread(inst->interp.interpreter);
+	python_interpreter_free(MODULE_INST_CTX(mctx->mi), &inst->interp, true);
+	PyThreadState_Swap(global_interpreter);	/* Get a none-null thread state */
+	PyEval_SaveThread();			/* Unlock GIL */
 
 	return 0;
 }
@@ -1028,7 +1393,11 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	rlm_python_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 
-	state = PyThreadState_New(inst->interpreter->interp);
+#if PY_VERSION_HEX >= 0x030C0000
+	if (inst->thread_interpreter) return python_thread_interpreter_init(mctx);
+#endif
+
+	state = PyThreadState_New(inst->interp.interpreter->interp);
 	if (!state) {
 		ERROR("Failed initialising local PyThreadState");
 		return -1;
@@ -1036,6 +1405,7 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 
 	DEBUG3("Initialised new thread state %p", state);
 	t->state = state;
+	t->interp = &inst->interp;
 
 	return 0;
 }
@@ -1044,7 +1414,24 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 
+	if (!t->state) return 0;
+
 	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
+
+	/*
+	 *	The thread has its own interpreter, which
+	 *	is destroyed along with its thread state.
+	 */
+	if (t->main_state) {
+		python_interpreter_free(MODULE_INST_CTX(mctx->mi), t->interp, true);
+
+		PyEval_RestoreThread(t->main_state);
+		PyThreadState_Clear(t->main_state);
+		PyThreadState_DeleteCurrent();	/* Unlocks the main GIL */
+
+		return 0;
+	}
+
 	PyThreadState_Clear(t->state);
 	PyEval_SaveThread();
 
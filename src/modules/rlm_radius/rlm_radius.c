@@ -111,6 +111,8 @@ static conf_parser_t const module_config[] = {
 
 	{ FR_CONF_OFFSET("originate", rlm_radius_t, originate) },
 
+	{ FR_CONF_OFFSET("passthrough", rlm_radius_t, passthrough), .dflt = "no" },
+
 	{ FR_CONF_POINTER("status_check", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) status_check_config },
 
 	{ FR_CONF_OFFSET("max_attributes", rlm_radius_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) },
@@ -438,12 +440,13 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->io = (rlm_radius_io_t const *)inst->io_submodule->exported;	/* Public symbol exported by the module */
 	inst->name = mctx->mi->name;
 	inst->received_message_authenticator = talloc_zero(NULL, bool);		/* Allocated outside of inst to default protection */
+	MEM(inst->health = talloc_zero(NULL, rlm_radius_health_t));
 
 	/*
 	 *	These limits are specific to RADIUS, and cannot be over-ridden
 	 */
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, >=, 2);
-	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255);
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 65535);
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", inst->trunk_conf.target_req_per_conn, <=, inst->trunk_conf.max_req_per_conn / 2);
 
 	FR_TIME_DELTA_BOUND_CHECK("response_window", inst->zombie_period, >=, fr_time_delta_from_sec(1));
@@ -610,9 +613,31 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	rlm_radius_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_radius_t);
 
 	talloc_free(inst->received_message_authenticator);
+	talloc_free(inst->health);
 	return 0;
 }
 
+/** Report how busy the home server is, for load-balance
+ *
+ * The cost is the average response time multiplied by the number of
+ * requests which are waiting for a reply.  Home servers which haven't
+ * replied yet are cheap, so that they're tried.
+ */
+static uint64_t mod_home_server_load(module_instance_t const *mi)
+{
+	rlm_radius_t const	*inst = talloc_get_type_abort_const(mi->data, rlm_radius_t);
+	uint64_t		rtt;
+
+	if (!inst->health) return 0;
+
+	if (atomic_load_explicit(&inst->health->circuit_open, memory_order_relaxed)) return UINT64_MAX;
+
+	rtt = atomic_load_explicit(&inst->health->rtt, memory_order_relaxed);
+	if (!rtt) rtt = 1;
+
+	return rtt * ((uint64_t)atomic_load_explicit(&inst->health->outstanding, memory_order_relaxed) + 1);
+}
+
 static int mod_load(void)
 {
 	if (fr_radius_global_init() < 0) {
@@ -655,5 +680,6 @@ module_rlm_t rlm_radius = {
 			{ .section = SECTION_NAME(CF_IDENT_ANY, CF_IDENT_ANY), .method = mod_process },
 			MODULE_BINDING_TERMINATOR
 		},
-	}
+	},
+	.load = mod_home_server_load
 };
@@ -36,6 +36,18 @@
 typedef struct rlm_radius_s rlm_radius_t;
 typedef struct rlm_radius_io_s rlm_radius_io_t;
 
+/** Health of the home server, shared by all threads
+ *
+ * Allocated outside of the instance data, as it's updated after
+ * instantiation.
+ */
+typedef struct {
+	atomic_uint64_t		rtt;			//!< Moving average of the response time, in microseconds.
+	atomic_uint32_t		outstanding;		//!< Requests waiting for a reply, across all threads.
+	atomic_uint32_t		circuit_open;		//!< Non-zero if the home server failed its status checks,
+							///< or stopped responding.
+} rlm_radius_health_t;
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -53,12 +65,16 @@ struct rlm_radius_s {
 	bool			originate;  		//!< Originating packets, instead of proxying existing ones.
 							///< Controls whether Proxy-State is added to the outbound
 							///< request.
+	bool			passthrough;		//!< Copy attributes which haven't been decoded
+							///< from the original packet.
 
 	uint32_t		max_attributes;   	//!< Maximum number of attributes to decode in response.
 
 	fr_radius_require_ma_t	require_message_authenticator;	//!< Require Message-Authenticator in responses.
 	bool			*received_message_authenticator;	//!< Received Message-Authenticator in responses.
 
+	rlm_radius_health_t	*health;		//!< Used by load-balance to choose between home servers.
+
 	uint32_t		proxy_state;  		//!< Unique ID (mostly) of this module.
 	uint32_t		*types;			//!< array of allowed packet types
 	uint32_t		status_check;  		//!< code of status-check type
@@ -75,6 +91,21 @@ struct rlm_radius_s {
 /** Enqueue a request_t to an IO submodule
  *
  */
+/** Update the response time moving average with a new sample
+ *
+ * Races between threads lose a sample, which doesn't matter for an
+ * average.
+ */
+static inline void rlm_radius_health_rtt(rlm_radius_health_t *health, fr_time_delta_t rtt)
+{
+	uint64_t	sample = fr_time_delta_to_usec(rtt);
+	uint64_t	old = atomic_load_explicit(&health->rtt, memory_order_relaxed);
+
+	if (!sample) sample = 1;
+
+	atomic_store_explicit(&health->rtt, old ? (old - (old >> 3) + (sample >> 3)) : sample, memory_order_relaxed);
+}
+
 typedef unlang_action_t (*rlm_radius_io_enqueue_t)(rlm_rcode_t *p_result, void *instance, void *thread, request_t *request);
 
 /** Public structure describing an I/O path for an outgoing socket.
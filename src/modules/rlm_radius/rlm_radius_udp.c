@@ -67,6 +67,8 @@ typedef struct {
 	uint32_t		max_packet_size;	//!< Maximum packet size.
 	uint16_t		max_send_coalesce;	//!< Maximum number of packets to coalesce into one mmsg call.
 
+	bool			extended_id;		//!< Negotiate Extended-ID with the home server.
+
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
 	bool			replicate;		//!< Copied from parent->replicate
@@ -97,6 +99,7 @@ typedef struct udp_request_s udp_request_t;
 typedef struct {
 	struct iovec		out;			//!< Describes buffer to send.
 	trunk_request_t	*treq;				//!< Used for signalling.
+	bool			sign;			//!< Newly encoded, and still needs signing.
 } udp_coalesced_t;
 
 /** Track the handle, which is tightly correlated with the FD
@@ -110,6 +113,7 @@ typedef struct {
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
+	fr_radius_sign_batch_t	*sign;			//!< Coalesced requests which need signing.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -133,6 +137,8 @@ typedef struct {
 	size_t			buflen;			//!< Receive buffer length.
 
 	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
+	bool			ids_exhausted;		//!< All 256 IDs are in use, and the connection
+							///< has been marked inactive.
 
 	fr_time_t		mrs_time;		//!< Most recent sent time which had a reply.
 	fr_time_t		last_reply;		//!< When we last received a reply.
@@ -161,6 +167,7 @@ struct udp_request_s {
 	bool			synchronous;		//!< cached from inst->parent->synchronous
 	bool			require_message_authenticator;		//!< saved from the original packet.
 	bool			status_check;		//!< is this packet a status check?
+	bool			outstanding;		//!< counted in the home server's outstanding requests.
 
 	fr_pair_list_t		extra;			//!< VPs for debugging, like Proxy-State.
 
@@ -191,6 +198,8 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 	{ FR_CONF_OFFSET("max_send_coalesce", rlm_radius_udp_t, max_send_coalesce), .dflt = "1024" },
 
+	{ FR_CONF_OFFSET("extended_id", rlm_radius_udp_t, extended_id), .dflt = "no" },
+
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, 0, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipv4addr", FR_TYPE_IPV4_ADDR, 0, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipv6addr", FR_TYPE_IPV6_ADDR, 0, rlm_radius_udp_t, src_ipaddr) },
@@ -209,10 +218,12 @@ fr_dict_autoload_t rlm_radius_udp_dict[] = {
 static fr_dict_attr_t const *attr_error_cause;
 static fr_dict_attr_t const *attr_event_timestamp;
 static fr_dict_attr_t const *attr_extended_attribute_1;
+static fr_dict_attr_t const *attr_extended_id;
 static fr_dict_attr_t const *attr_message_authenticator;
 static fr_dict_attr_t const *attr_eap_message;
 static fr_dict_attr_t const *attr_nas_identifier;
 static fr_dict_attr_t const *attr_original_packet_code;
+static fr_dict_attr_t const *attr_original_request_authenticator;
 static fr_dict_attr_t const *attr_proxy_state;
 static fr_dict_attr_t const *attr_response_length;
 static fr_dict_attr_t const *attr_user_password;
@@ -223,10 +234,12 @@ fr_dict_attr_autoload_t rlm_radius_udp_dict_attr[] = {
 	{ .out = &attr_error_cause, .name = "Error-Cause", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius},
 	{ .out = &attr_extended_attribute_1, .name = "Extended-Attribute-1", .type = FR_TYPE_TLV, .dict = &dict_radius},
+	{ .out = &attr_extended_id, .name = "Vendor-Specific.FreeRADIUS.Extended-ID", .type = FR_TYPE_UINT32, .dict = &dict_radius},
 	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_eap_message, .name = "EAP-Message", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_nas_identifier, .name = "NAS-Identifier", .type = FR_TYPE_STRING, .dict = &dict_radius},
 	{ .out = &attr_original_packet_code, .name = "Extended-Attribute-1.Original-Packet-Code", .type = FR_TYPE_UINT32, .dict = &dict_radius},
+	{ .out = &attr_original_request_authenticator, .name = "Vendor-Specific.FreeRADIUS.Original-Request-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_response_length, .name = "Extended-Attribute-1.Response-Length", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_user_password, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius},
@@ -256,7 +269,7 @@ static rlm_rcode_t radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
 static void		conn_writable_status_check(UNUSED fr_event_list_t *el, UNUSED int fd,
 						   UNUSED int flags, void *uctx);
 
-static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id);
+static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id, bool sign);
 
 static decode_fail_t	decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			       udp_handle_t *h, request_t *request, udp_request_t *u,
@@ -413,6 +426,17 @@ static void CC_HINT(nonnull) status_check_alloc(udp_handle_t *h)
 		MEM(pair_append_request(NULL, attr_event_timestamp) >= 0);
 	}
 
+	/*
+	 *	Ask the home server if it can echo the Request
+	 *	Authenticator back to us.
+	 */
+	if (inst->extended_id && !fr_pair_find_by_da(&request->request_pairs, NULL, attr_extended_id)) {
+		fr_pair_t *vp;
+
+		MEM(pair_append_request(&vp, attr_extended_id) >= 0);
+		vp->vp_uint32 = 1;
+	}
+
 	/*
 	 *	Initialize the request IO ctx.  Note that we don't set
 	 *	destructors.
@@ -489,6 +513,7 @@ static void conn_status_check_timeout(fr_event_list_t *el, fr_time_t now, void *
 		DEBUG("%s - Reached maximum_retransmit_count (%u > %u), failing status checks",
 		      h->module_name, u->retry.count, u->retry.config->mrc);
 	fail:
+		atomic_store_explicit(&h->inst->parent->health->circuit_open, 1, memory_order_relaxed);
 		connection_signal_reconnect(conn, CONNECTION_FAILED);
 		return;
 
@@ -583,6 +608,20 @@ static void conn_readable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 		   h, h->status_request, h->status_u, u->packet + RADIUS_AUTH_VECTOR_OFFSET,
 		   h->buffer, slen) != DECODE_FAIL_NONE) return;
 
+	/*
+	 *	The home server will echo the Request Authenticator
+	 *	in all of its replies, so we can have more than 256
+	 *	packets outstanding on this connection.
+	 *
+	 *	There are no other packets outstanding at this point,
+	 *	so it's safe to change how replies are matched.
+	 */
+	if (h->inst->extended_id && !h->tt->use_authenticator &&
+	    fr_pair_find_by_da(&reply, NULL, attr_extended_id)) {
+		DEBUG("%s - Home server supports Extended-ID on connection %s", h->module_name, h->name);
+		radius_track_use_authenticator(h->tt, true);
+	}
+
 	fr_pair_list_free(&reply);	/* FIXME - Do something with these... */
 
 	/*
@@ -621,6 +660,7 @@ static void conn_readable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	 *	It's alive!
 	 */
 	status_check_reset(h, u);
+	atomic_store_explicit(&inst->health->circuit_open, 0, memory_order_relaxed);
 
 	DEBUG("%s - Connection open - %s", h->module_name, h->name);
 
@@ -654,7 +694,7 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	DEBUG("%s - Sending %s ID %d over connection %s",
 	      h->module_name, fr_radius_packet_name[u->code], u->id, h->name);
 
-	if (encode(h->inst, h->status_request, u, u->id) < 0) {
+	if (encode(h->inst, h->status_request, u, u->id, true) < 0) {
 	fail:
 		connection_signal_reconnect(conn, CONNECTION_FAILED);
 		return;
@@ -748,6 +788,7 @@ static connection_state_t conn_init(void **h_out, connection_t *conn, void *uctx
 	 */
 	h->mmsgvec = talloc_zero_array(h, struct mmsghdr, h->inst->max_send_coalesce);
 	h->coalesced = talloc_zero_array(h, udp_coalesced_t, h->inst->max_send_coalesce);
+	h->sign = talloc_zero_array(h, fr_radius_sign_batch_t, h->inst->max_send_coalesce);
 	for (i = 0; i < h->inst->max_send_coalesce; i++) {
 		h->mmsgvec[i].msg_hdr.msg_iov = &h->coalesced[i].out;
 		h->mmsgvec[i].msg_hdr.msg_iovlen = 1;
@@ -1182,7 +1223,18 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	return DECODE_FAIL_NONE;
 }
 
-static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id)
+/** Encode a packet
+ *
+ * @param[in] inst	of the module.
+ * @param[in] request	the packet is being sent for.
+ * @param[in] u		to encode the packet into.
+ * @param[in] id	to give the packet.
+ * @param[in] sign	the packet.  If false, the caller must sign it before sending.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id, bool sign)
 {
 	ssize_t			packet_len;
 	fr_radius_encode_ctx_t	encode_ctx;
@@ -1212,6 +1264,7 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 		.code = u->code,
 		.id = id,
 		.add_proxy_state = !inst->parent->originate,
+		.passthrough = inst->parent->passthrough && !inst->parent->originate,
 	};
 
 	/*
@@ -1226,6 +1279,7 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 		if (vp) vp->vp_date = fr_time_to_unix_time(u->retry.updated);
 
 		encode_ctx.add_proxy_state = false;
+		encode_ctx.passthrough = false;
 	}
 
 	/*
@@ -1286,7 +1340,7 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	/*
 	 *	Now that we're done mangling the packet, sign it.
 	 */
-	if (fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
+	if (sign && fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
 			   talloc_array_length(inst->secret) - 1) < 0) {
 		RERROR("Failed signing packet");
 		goto error;
@@ -1318,6 +1372,12 @@ static void zombie_timeout(fr_event_list_t *el, fr_time_t now, void *uctx)
 
 	INFO("%s - No replies during 'zombie_period', marking connection %s as dead", h->module_name, h->name);
 
+	/*
+	 *	Tell load-balance to stop choosing this home server
+	 *	until it replies again.
+	 */
+	atomic_store_explicit(&h->inst->parent->health->circuit_open, 1, memory_order_relaxed);
+
 	/*
 	 *	Don't use this connection, and re-queue all of its
 	 *	requests onto other connections.
@@ -1508,7 +1568,7 @@ static void request_mux(UNUSED fr_event_list_t *el,
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	rlm_radius_udp_t const	*inst = h->inst;
 	int			sent;
-	uint16_t		i, queued;
+	uint16_t		i, queued, to_sign = 0;
 	size_t			total_len = 0;
 
 	/*
@@ -1519,6 +1579,18 @@ static void request_mux(UNUSED fr_event_list_t *el,
 		trunk_request_t		*treq;
 		udp_request_t		*u;
 		request_t		*request;
+		bool			sign = false;
+
+		/*
+		 *	Without Extended-ID, the packet ID is all we
+		 *	have to match replies, so stop using the
+		 *	connection until some IDs are freed.
+		 */
+		if (!h->tt->use_authenticator && (h->tt->num_requests > UINT8_MAX)) {
+			h->ids_exhausted = true;
+			trunk_connection_signal_inactive(tconn);
+			break;
+		}
 
  		if (unlikely(trunk_connection_pop_request(&treq, tconn) < 0)) return;
 
@@ -1562,7 +1634,11 @@ static void request_mux(UNUSED fr_event_list_t *el,
 			RDEBUG("Sending %s ID %d length %ld over connection %s",
 			       fr_radius_packet_name[u->code], u->id, u->packet_len, h->name);
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			/*
+			 *	Signed below, along with all the other
+			 *	new packets.
+			 */
+			if (encode(h->inst, request, u, u->id, false) < 0) {
 				/*
 				 *	Need to do this because request_conn_release
 				 *	may not be called.
@@ -1572,13 +1648,8 @@ static void request_mux(UNUSED fr_event_list_t *el,
 				trunk_request_signal_fail(treq);
 				continue;
 			}
-			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
-
-			/*
-			 *	Remember the authentication vector, which now has the
-			 *	packet signature.
-			 */
-			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			sign = true;
+			to_sign++;
 		} else {
 			RDEBUG("Retransmitting %s ID %d length %ld over connection %s",
 			       fr_radius_packet_name[u->code], u->id, u->packet_len, h->name);
@@ -1595,6 +1666,7 @@ static void request_mux(UNUSED fr_event_list_t *el,
 		h->coalesced[queued].treq = treq;
 		h->coalesced[queued].out.iov_base = u->packet;
 		h->coalesced[queued].out.iov_len = u->packet_len;
+		h->coalesced[queued].sign = sign;
 
 		/*
 		 *	Record how much data we have in total.
@@ -1617,6 +1689,56 @@ static void request_mux(UNUSED fr_event_list_t *el,
 	}
 	if (queued == 0) return;	/* No work */
 
+	/*
+	 *	Sign all the newly encoded packets in one go, so
+	 *	the MD5 and HMAC-MD5 operations can be done in
+	 *	parallel.
+	 */
+	if (to_sign > 0) {
+		uint16_t	j, k;
+
+		for (i = 0, k = 0; i < queued; i++) {
+			if (!h->coalesced[i].sign) continue;
+
+			h->sign[k++] = (fr_radius_sign_batch_t){ .packet = h->coalesced[i].out.iov_base };
+		}
+		fr_assert(k == to_sign);
+
+		(void) fr_radius_sign_batch(h->sign, to_sign, (uint8_t const *) inst->secret,
+					    talloc_array_length(inst->secret) - 1);
+
+		for (i = 0, j = 0, k = 0; i < queued; i++) {
+			trunk_request_t	*treq = h->coalesced[i].treq;
+
+			if (h->coalesced[i].sign) {
+				request_t	*request = treq->request;
+				udp_request_t	*u = talloc_get_type_abort(treq->preq, udp_request_t);
+
+				/*
+				 *	request_conn_release() frees the
+				 *	packet and the tracking entry.
+				 */
+				if (h->sign[k++].ret < 0) {
+					RPERROR("Failed signing packet");
+					trunk_request_signal_fail(treq);
+					continue;
+				}
+				RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+				/*
+				 *	Remember the authentication vector, which now has the
+				 *	packet signature.
+				 */
+				(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			}
+
+			if (j != i) h->coalesced[j] = h->coalesced[i];
+			j++;
+		}
+		queued = j;
+		if (queued == 0) return;
+	}
+
 	/*
 	 *	Verify nothing accidentally freed the connection handle
 	 */
@@ -1921,6 +2043,46 @@ static void status_check_reply(trunk_request_t *treq, fr_time_t now)
 	trunk_connection_signal_active(treq->tconn);
 }
 
+/** Find the Original-Request-Authenticator in a reply
+ *
+ * The reply hasn't been checked yet, so we stop at the first malformed
+ * attribute.  If the reply is forged, it will fail verification later.
+ *
+ * @param[in] h		Handle containing the reply.
+ * @param[in] len	of the reply.
+ * @return
+ *	- The Request Authenticator of the original packet.
+ *	- NULL if the reply doesn't contain one.
+ */
+static uint8_t const *reply_original_vector(udp_handle_t *h, size_t len)
+{
+	fr_dict_attr_t const	*vendor = attr_original_request_authenticator->parent;
+	uint8_t const		*attr, *end;
+
+	end = h->buffer + len;
+
+	for (attr = h->buffer + RADIUS_HEADER_LENGTH;
+	     (attr + 2) <= end;
+	     attr += attr[1]) {
+		if ((attr[1] < 2) || ((attr + attr[1]) > end)) return NULL;
+
+		/*
+		 *	Vendor-Specific + vendor + VSA header + vector
+		 */
+		if ((attr[0] != vendor->parent->attr) ||
+		    (attr[1] != (2 + 4 + 2 + RADIUS_AUTH_VECTOR_LENGTH))) continue;
+
+		if (fr_nbo_to_uint32(attr + 2) != vendor->attr) continue;
+
+		if ((attr[6] != attr_original_request_authenticator->attr) ||
+		    (attr[7] != (2 + RADIUS_AUTH_VECTOR_LENGTH))) continue;
+
+		return attr + 8;
+	}
+
+	return NULL;
+}
+
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void request_demux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn, connection_t *conn, UNUSED void *uctx)
 {
@@ -1970,7 +2132,8 @@ static void request_demux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 		 *	Note that we don't care about packet codes.  All
 		 *	packet codes share the same ID space.
 		 */
-		rr = radius_track_entry_find(h->tt, h->buffer[1], NULL);
+		rr = radius_track_entry_find(h->tt, h->buffer[1],
+					     h->tt->use_authenticator ? reply_original_vector(h, (size_t)slen) : NULL);
 		if (!rr) {
 			WARN("%s - Ignoring reply with ID %i that arrived too late",
 			     h->module_name, h->buffer[1]);
@@ -2004,6 +2167,8 @@ static void request_demux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 		 */
 		h->last_reply = now = fr_time();
 
+		atomic_store_explicit(&h->inst->parent->health->circuit_open, 0, memory_order_relaxed);
+
 		/*
 		 *	Status-Server can have any reply code, we don't care
 		 *	what it is.  So long as it's signed properly, we
@@ -2018,6 +2183,8 @@ static void request_demux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 			continue;
 		}
 
+		rlm_radius_health_rtt(h->inst->parent->health, fr_time_sub(now, u->retry.start));
+
 		/*
 		 *	Handle any state changes, etc. needed by receiving a
 		 *	Protocol-Error reply packet.
@@ -2080,6 +2247,15 @@ static void request_demux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 		r->rcode = radius_code_to_rcode[code];
 		fr_pair_list_append(&request->reply_pairs, &reply);
 		trunk_request_signal_complete(treq);
+
+		/*
+		 *	The reply freed an ID, so we can use the
+		 *	connection again.
+		 */
+		if (h->ids_exhausted && (h->tt->num_requests <= UINT8_MAX)) {
+			h->ids_exhausted = false;
+			trunk_connection_signal_active(tconn);
+		}
 	}
 }
 
@@ -2179,9 +2355,10 @@ static void request_complete(request_t *request, void *preq, void *rctx, UNUSED
 /** Explicitly free resources associated with the protocol request
  *
  */
-static void request_free(UNUSED request_t *request, void *preq_to_free, UNUSED void *uctx)
+static void request_free(UNUSED request_t *request, void *preq_to_free, void *uctx)
 {
 	udp_request_t		*u = talloc_get_type_abort(preq_to_free, udp_request_t);
+	udp_thread_t		*t = talloc_get_type_abort(uctx, udp_thread_t);
 
 	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
 
@@ -2190,6 +2367,11 @@ static void request_free(UNUSED request_t *request, void *preq_to_free, UNUSED v
 	 */
 	if (u->status_check) return;
 
+	if (u->outstanding) {
+		atomic_fetch_sub_explicit(&t->inst->parent->health->outstanding, 1, memory_order_relaxed);
+		u->outstanding = false;
+	}
+
 	talloc_free(u);
 }
 
@@ -2383,6 +2565,9 @@ static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void *instance, void *
 	r->treq = treq;	/* Remember for signalling purposes */
 	fr_assert(treq->rctx == r);
 
+	atomic_fetch_add_explicit(&inst->parent->health->outstanding, 1, memory_order_relaxed);
+	u->outstanding = true;
+
 	talloc_set_destructor(u, _udp_request_free);
 
 
@@ -2532,6 +2717,21 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	}
 
 	memcpy(&inst->trunk_conf, &inst->parent->trunk_conf, sizeof(inst->trunk_conf));
+
+	/*
+	 *	Only Extended-ID lets us have more than 256 packets
+	 *	outstanding on one connection.  And it can only be
+	 *	negotiated via the status checks.
+	 */
+	if (inst->extended_id && !inst->parent->status_check) {
+		cf_log_err(conf, "'extended_id' requires a 'status_check' section");
+		return -1;
+	}
+
+	if (!inst->extended_id) {
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255);
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", inst->trunk_conf.target_req_per_conn, <=, 255);
+	}
 	inst->trunk_conf.req_pool_headers = 4;	/* One for the request, one for the buffer, one for the tracking binding, one for Proxy-State VP */
 	inst->trunk_conf.req_pool_size = sizeof(udp_request_t) + inst->max_packet_size + sizeof(radius_track_entry_t ***) + sizeof(fr_pair_t) + 20;
 
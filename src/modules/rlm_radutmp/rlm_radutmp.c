@@ -27,9 +27,11 @@ RCSID("$Id$")
 #include <freeradius-devel/server/radutmp.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/radius/radius.h>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include "config.h"
 
@@ -38,18 +40,26 @@ RCSID("$Id$")
 static char const porttypes[] = "ASITX";
 
 /*
- *	used for caching radutmp lookups in the accounting component.
+ *	Where each NAS / port is in the radutmp file.
  */
-typedef struct nas_port_s NAS_PORT;
-struct nas_port_s {
+typedef struct {
 	uint32_t		nasaddr;
-	uint16_t		port;
+	uint32_t		port;
 	off_t			offset;
-	NAS_PORT 		*next;
-};
+} NAS_PORT;
 
+/*
+ *	Records in the radutmp file are never moved or deleted.
+ *	Logouts and zaps rewrite them in place, and new NAS / port
+ *	combinations are appended.  So an index of where each
+ *	NAS / port is only needs to be extended when the file grows.
+ */
 typedef struct {
-	NAS_PORT		*nas_port_list;
+	char			*filename;	//!< the file which is indexed.
+	dev_t			dev;		//!< device of the indexed file.
+	ino_t			ino;		//!< inode of the indexed file.
+	off_t			indexed;	//!< how much of the file has been indexed.
+	fr_hash_table_t		*nas_ports;	//!< NAS_PORT, by NAS address and port.
 } rlm_radutmp_mutable_t;
 
 typedef struct {
@@ -171,20 +181,89 @@ static unlang_action_t radutmp_zap(rlm_rcode_t *p_result, request_t *request, ch
 	RETURN_MODULE_OK;
 }
 
+static uint32_t nas_port_hash(void const *data)
+{
+	NAS_PORT const *np = data;
+
+	return fr_hash_update(&np->port, sizeof(np->port), fr_hash(&np->nasaddr, sizeof(np->nasaddr)));
+}
+
+static int8_t nas_port_cmp(void const *one, void const *two)
+{
+	NAS_PORT const *a = one, *b = two;
+
+	CMP_RETURN(a, b, nasaddr);
+	return CMP(a->port, b->port);
+}
+
 /*
- *	Lookup a NAS_PORT in the nas_port_list
+ *	Lookup a NAS_PORT in the index
  */
-static NAS_PORT *nas_port_find(NAS_PORT *nas_port_list, uint32_t nasaddr, uint16_t port)
+static NAS_PORT *nas_port_find(rlm_radutmp_mutable_t *mutable, uint32_t nasaddr, uint32_t port)
 {
-	NAS_PORT	*cl;
+	return fr_hash_table_find(mutable->nas_ports, &(NAS_PORT){ .nasaddr = nasaddr, .port = port });
+}
 
-	for(cl = nas_port_list; cl; cl = cl->next) {
-		if (nasaddr == cl->nasaddr &&
-			port == cl->port)
-			break;
+/*
+ *	Bring the index up to date with the (locked) radutmp file.
+ *
+ *	If the file is a different one, or it has been truncated, the
+ *	index is rebuilt.  Otherwise only the records which were added
+ *	since the last call are read.
+ */
+static int radutmp_index(rlm_radutmp_mutable_t *mutable, request_t *request, int fd, char const *filename)
+{
+	struct stat	st;
+	struct radutmp	u;
+	NAS_PORT	*np;
+	off_t		off;
+
+	if (fstat(fd, &st) < 0) {
+		REDEBUG("Failed reading status of %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!mutable->nas_ports || (strcmp(mutable->filename, filename) != 0) ||
+	    (st.st_dev != mutable->dev) || (st.st_ino != mutable->ino) || (st.st_size < mutable->indexed)) {
+		TALLOC_FREE(mutable->nas_ports);
+		TALLOC_FREE(mutable->filename);
+
+		MEM(mutable->nas_ports = fr_hash_table_alloc(mutable, nas_port_hash, nas_port_cmp, NULL));
+		MEM(mutable->filename = talloc_strdup(mutable, filename));
+		mutable->dev = st.st_dev;
+		mutable->ino = st.st_ino;
+		mutable->indexed = 0;
 	}
 
-	return cl;
+	if (st.st_size == mutable->indexed) return 0;
+
+	if (lseek(fd, mutable->indexed, SEEK_SET) < 0) {
+		REDEBUG("Failed seeking in %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	for (off = mutable->indexed; read(fd, &u, sizeof(u)) == sizeof(u); off += sizeof(u)) {
+		if (nas_port_find(mutable, u.nas_address, u.nas_port)) continue;
+
+		MEM(np = talloc(mutable->nas_ports, NAS_PORT));
+		*np = (NAS_PORT) {
+			.nasaddr = u.nas_address,
+			.port = u.nas_port,
+			.offset = off
+		};
+		if (!fr_hash_table_insert(mutable->nas_ports, np)) {
+			talloc_free(np);
+			return -1;
+		}
+	}
+
+	/*
+	 *	A partial record at the end is overwritten by the next
+	 *	one we append.
+	 */
+	mutable->indexed = off;
+
+	return 0;
 }
 
 
@@ -203,11 +282,12 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	time_t			t;
 	int			fd = -1;
 	bool			port_seen = false;
-	int			off;
+	int			skip;
 	char			ip_name[INET_ADDRSTRLEN]; /* 255.255.255.255 */
 	char const		*nas;
 	NAS_PORT		*cache;
 	int			r;
+	off_t			off;
 	fr_client_t		*client;
 
 	if (request->dict != dict_radius) RETURN_MODULE_NOOP;
@@ -286,15 +366,15 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 			 *	If length > 8, only store the
 			 *	last 8 bytes.
 			 */
-			off = vp->vp_length - sizeof(ut.session_id);
+			skip = vp->vp_length - sizeof(ut.session_id);
 			/*
 			 * 	Ascend is br0ken - it adds a \0
 			 * 	to the end of any string.
 			 * 	Compensate.
 			 */
-			if ((vp->vp_length > 0) && (vp->vp_strvalue[vp->vp_length - 1] == 0)) off--;
-			if (off < 0) off = 0;
-			memcpy(ut.session_id, vp->vp_strvalue + off, sizeof(ut.session_id));
+			if ((vp->vp_length > 0) && (vp->vp_strvalue[vp->vp_length - 1] == 0)) skip--;
+			if (skip < 0) skip = 0;
+			memcpy(ut.session_id, vp->vp_strvalue + skip, sizeof(ut.session_id));
 		} else if (vp->da == attr_nas_port_type) {
 			if (vp->vp_uint32 <= 4) ut.porttype = porttypes[vp->vp_uint32];
 		} else if (vp->da == attr_calling_station_id) {
@@ -418,18 +498,23 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 		goto finish;
 	}
 
+	if (radutmp_index(inst->mutable, request, fd, env->filename.vb_strvalue) < 0) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
 	/*
-	 *	Find the entry for this NAS / portno combination.
+	 *	Find the entry for this NAS / portno combination.  If
+	 *	there isn't one, we append a new entry to the file.
 	 */
-	if ((cache = nas_port_find(inst->mutable->nas_port_list, ut.nas_address, ut.nas_port)) != NULL) {
-		if (lseek(fd, (off_t)cache->offset, SEEK_SET) < 0) {
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
-		}
+	cache = nas_port_find(inst->mutable, ut.nas_address, ut.nas_port);
+	off = cache ? cache->offset : inst->mutable->indexed;
+	if (lseek(fd, off, SEEK_SET) < 0) {
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
 	}
 
 	r = 0;
-	off = 0;
 	while (read(fd, &u, sizeof(u)) == sizeof(u)) {
 		off += sizeof(u);
 		if ((u.nas_address != ut.nas_address) || (u.nas_port != ut.nas_port)) {
@@ -500,20 +585,9 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	 */
 	if ((r >= 0) && (status == FR_STATUS_START || status == FR_STATUS_ALIVE)) {
 		/*
-		 *	Remember where the entry was, because it's
-		 *	easier than searching through the entire file.
+		 *	New entries are added to the index the next
+		 *	time that it's updated.
 		 */
-		if (!cache) {
-			cache = talloc_zero(inst->mutable, NAS_PORT);
-			if (cache) {
-				cache->nasaddr = ut.nas_address;
-				cache->port = ut.nas_port;
-				cache->offset = off;
-				cache->next = inst->mutable->nas_port_list;
-				inst->mutable->nas_port_list = cache;
-			}
-		}
-
 		ut.type = P_LOGIN;
 		if (write(fd, &ut, sizeof(u)) < 0) {
 			REDEBUG("Failed writing: %s", fr_syserror(errno));
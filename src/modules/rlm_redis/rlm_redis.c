@@ -33,6 +33,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_util.h>
@@ -83,8 +84,37 @@ typedef struct {
 	rlm_redis_lua_t		lua;					//!< Array of functions to register.
 
 	fr_redis_cluster_t	*cluster;				//!< Redis cluster.
+
+	trunk_conf_t		trunk_conf;				//!< Configuration for the trunks to each cluster node.
 } rlm_redis_t;
 
+/** rlm_redis thread instance
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t	*cluster_thread;		//!< Trunks to each of the cluster nodes.
+									///< NULL if asynchronous I/O is unavailable.
+} rlm_redis_thread_t;
+
+/** Resume context for a command or lua function call sent over a trunk
+ *
+ */
+typedef struct {
+	fr_redis_command_set_t	*cmds;					//!< Commands currently in flight.
+	redis_lua_func_t const	*func;					//!< Function being called.  NULL for plain commands.
+
+	uint8_t const		*key;					//!< Used to determine the cluster node.
+	size_t			key_len;				//!< Length of the key.
+	bool			read_only;				//!< May be sent to a replica.
+
+	char			*cmd;					//!< Formatted command.
+	size_t			cmd_len;				//!< Length of the formatted command.
+	bool			load;					//!< Upload the function along with the EVALSHA.
+
+	fr_redis_rcode_t	status;					//!< Of running the command.
+	redisReply		*reply;					//!< To the command.
+} redis_xlat_rctx_t;
+
 static int lua_func_body_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 
 static conf_parser_t module_lua_func[] = {
@@ -103,6 +133,7 @@ static conf_parser_t module_lua[] = {
 static conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_SUBSECTION("lua", 0, rlm_redis_t, lua, module_lua) },
 	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_redis_t, trunk_conf, trunk_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -247,6 +278,263 @@ parse_reply:
 	return 0;
 }
 
+/** Check the reply to a command, or to the transaction used to load and call a lua function
+ *
+ */
+static void _redis_xlat_complete(request_t *request, fr_dlist_head_t *completed, void *uctx)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(uctx, redis_xlat_rctx_t);
+	fr_redis_command_t	*cmd;
+	redisReply		*reply;
+
+	rctx->cmds = NULL;	/* Freed by the trunk once we return */
+	rctx->status = REDIS_RCODE_ERROR;
+
+	/*
+	 *	The reply we care about is always the last one,
+	 *	either to the command itself, or to the EXEC.
+	 */
+	cmd = fr_dlist_tail(completed);
+	reply = cmd ? fr_redis_command_get_result(cmd) : NULL;
+	if (!reply || (fr_dlist_num_elements(completed) != (rctx->load ? 4 : 1))) {
+		REDEBUG("Expected %i replies, got %u", rctx->load ? 4 : 1, fr_dlist_num_elements(completed));
+		goto finish;
+	}
+
+	if (!rctx->load) {
+		if (reply->type == REDIS_REPLY_ERROR) {
+			/*
+			 *	Node doesn't have the function cached, the
+			 *	resume function will send it up along
+			 *	with the EVALSHA.
+			 */
+			if (rctx->func &&
+			    (strncmp(REDIS_ERROR_NO_SCRIPT_STR, reply->str, sizeof(REDIS_ERROR_NO_SCRIPT_STR) - 1) == 0)) {
+				rctx->status = REDIS_RCODE_NO_SCRIPT;
+				goto finish;
+			}
+
+			REDEBUG("Server error: %s", reply->str);
+			goto finish;
+		}
+
+		rctx->reply = fr_redis_command_steal_result(cmd);
+		rctx->status = REDIS_RCODE_SUCCESS;
+		goto finish;
+	}
+
+	/* MULTI + SCRIPT LOAD + EVALSHA + EXEC */
+	if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != 2)) {
+		REDEBUG("Bad response to EXEC, expected array of 2 elements");
+		fr_redis_reply_print(L_DBG_LVL_OFF, reply, request, 0);
+		goto finish;
+	}
+
+	if (reply->element[0]->type != REDIS_REPLY_STRING) {
+		REDEBUG("Loading lua function \"%s\" failed", rctx->func->name);
+		fr_redis_reply_print(L_DBG_LVL_OFF, reply->element[0], request, 0);
+		goto finish;
+	}
+
+	if (strcmp(reply->element[0]->str, rctx->func->digest) != 0) {
+		REDEBUG("Function digest %s, does not match calculated digest %s",
+			reply->element[0]->str, rctx->func->digest);
+		goto finish;
+	}
+
+	if (reply->element[1]->type == REDIS_REPLY_ERROR) {
+		REDEBUG("Server error: %s", reply->element[1]->str);
+		goto finish;
+	}
+
+	rctx->reply = reply->element[1];
+	reply->element[1] = NULL;		/* This works because hiredis checks for NULL elements */
+	rctx->status = REDIS_RCODE_SUCCESS;
+
+finish:
+	unlang_interpret_mark_runnable(request);
+}
+
+/** The command set could not be sent, or failed part way through
+ *
+ */
+static void _redis_xlat_fail(request_t *request, UNUSED fr_dlist_head_t *completed, void *uctx)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(uctx, redis_xlat_rctx_t);
+
+	REDEBUG("Failed executing command");
+
+	rctx->cmds = NULL;	/* Freed by the trunk once we return */
+	rctx->status = REDIS_RCODE_ERROR;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Cancel any commands in flight if the request is cancelled
+ *
+ */
+static void redis_xlat_signal(xlat_ctx_t const *xctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(xctx->rctx, redis_xlat_rctx_t);
+
+	if (!rctx->cmds) return;
+
+	fr_redis_command_set_cancel(rctx->cmds);
+	rctx->cmds = NULL;
+}
+
+static int _redis_xlat_rctx_free(redis_xlat_rctx_t *rctx)
+{
+	fr_redis_reply_free(&rctx->reply);
+
+	return 0;
+}
+
+/** Allocate a resume context, formatting the command to send
+ *
+ */
+static redis_xlat_rctx_t *redis_xlat_rctx_alloc(request_t *request, redis_lua_func_t const *func,
+						uint8_t const *key, size_t key_len, bool read_only,
+						int argc, char const **argv, size_t const *arg_len)
+{
+	redis_xlat_rctx_t	*rctx;
+
+	MEM(rctx = talloc_zero(unlang_interpret_frame_talloc_ctx(request), redis_xlat_rctx_t));
+	talloc_set_destructor(rctx, _redis_xlat_rctx_free);
+	rctx->func = func;
+	rctx->read_only = read_only;
+
+	rctx->cmd = fr_redis_command_format_argv(rctx, &rctx->cmd_len, argc, argv, arg_len);
+	if (!rctx->cmd) {
+		RPEDEBUG("Failed formatting command");
+		talloc_free(rctx);
+		return NULL;
+	}
+
+	/*
+	 *	The key has to be copied out, as the arguments
+	 *	belong to the xlat input.
+	 */
+	if (key) {
+		MEM(rctx->key = talloc_memdup(rctx, key, key_len));
+		rctx->key_len = key_len;
+	}
+
+	return rctx;
+}
+
+static xlat_action_t redis_xlat_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+				       xlat_ctx_t const *xctx,
+				       request_t *request, fr_value_box_list_t *in);
+
+/** Check whether a command can share a connection with commands from other requests
+ *
+ * These change the protocol state of the connection, so that it
+ * no longer produces one reply per command.
+ */
+static bool redis_command_pipelinable(char const *name, size_t len)
+{
+	static char const *unsafe[] = { "SUBSCRIBE", "PSUBSCRIBE", "SSUBSCRIBE", "MONITOR" };
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(unsafe); i++) {
+		if ((strlen(unsafe[i]) == len) && (strncasecmp(unsafe[i], name, len) == 0)) return false;
+	}
+
+	return true;
+}
+
+/** Send a command, or a lua function call, to the node responsible for the key
+ *
+ * If the function was previously found not to be cached on the node, it's uploaded
+ * in the same transaction as the EVALSHA.
+ */
+static xlat_action_t redis_xlat_enqueue(request_t *request, fr_redis_cluster_thread_t *cluster_thread,
+					redis_xlat_rctx_t *rctx)
+{
+	fr_redis_command_set_t	*cmds;
+	char			*cmd;
+	size_t			len;
+
+	cmds = fr_redis_command_set_alloc(NULL, request, _redis_xlat_complete, _redis_xlat_fail, rctx);
+
+	if (rctx->load) {
+		RDEBUG3("Loading lua function \"%s\" (0x%s)", rctx->func->name, rctx->func->digest);
+		if (fr_redis_command_preformatted_add(cmds, "MULTI", sizeof("MULTI") - 1) != FR_REDIS_PIPELINE_OK) {
+		error:
+			RPEDEBUG("Failed adding command");
+			talloc_free(cmds);
+			talloc_free(rctx);
+			return XLAT_ACTION_FAIL;
+		}
+		MEM(cmd = fr_redis_command_format(cmds, &len, "SCRIPT LOAD %b",
+						  rctx->func->body, talloc_array_length(rctx->func->body) - 1));
+		if (fr_redis_command_preformatted_add(cmds, cmd, len) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	/*
+	 *	Copied so the command has the same lifetime
+	 *	as the command set.
+	 */
+	MEM(cmd = talloc_memdup(cmds, rctx->cmd, rctx->cmd_len));
+	if (fr_redis_command_preformatted_add(cmds, cmd, rctx->cmd_len) != FR_REDIS_PIPELINE_OK) goto error;
+
+	if (rctx->load &&
+	    (fr_redis_command_preformatted_add(cmds, "EXEC", sizeof("EXEC") - 1) != FR_REDIS_PIPELINE_OK)) goto error;
+
+	if (fr_redis_command_set_enqueue_by_key(cluster_thread, cmds,
+						rctx->key, rctx->key_len, rctx->read_only) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing command");
+		talloc_free(cmds);
+		talloc_free(rctx);
+		return XLAT_ACTION_FAIL;
+	}
+	rctx->cmds = cmds;
+
+	return unlang_xlat_yield(request, redis_xlat_resume, redis_xlat_signal, ~FR_SIGNAL_CANCEL, rctx);
+}
+
+/** Convert the reply to a command, or a lua function call, to a value box
+ *
+ */
+static xlat_action_t redis_xlat_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+				       xlat_ctx_t const *xctx,
+				       request_t *request, UNUSED fr_value_box_list_t *in)
+{
+	redis_xlat_rctx_t	*rctx = talloc_get_type_abort(xctx->rctx, redis_xlat_rctx_t);
+	rlm_redis_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_redis_thread_t);
+	xlat_action_t		action = XLAT_ACTION_DONE;
+	fr_value_box_t		*vb_out;
+
+	/*
+	 *	Send the function up to the node if it didn't
+	 *	have it cached, and call it again.
+	 */
+	if ((rctx->status == REDIS_RCODE_NO_SCRIPT) && !rctx->load) {
+		rctx->load = true;
+		return redis_xlat_enqueue(request, t->cluster_thread, rctx);
+	}
+
+	if (rctx->status != REDIS_RCODE_SUCCESS) {
+		action = XLAT_ACTION_FAIL;
+		goto finish;
+	}
+
+	MEM(vb_out = fr_value_box_alloc_null(ctx));
+	if (fr_redis_reply_to_value_box(ctx, vb_out, rctx->reply, FR_TYPE_VOID, NULL, false, false) < 0) {
+		RPERROR("Failed processing reply");
+		talloc_free(vb_out);
+		action = XLAT_ACTION_FAIL;
+		goto finish;
+	}
+	fr_dcursor_append(out, vb_out);
+
+finish:
+	talloc_free(rctx);
+
+	return action;
+}
+
 static xlat_arg_parser_t const redis_remap_xlat_args[] = {
 	{ .required = true, .concat = true, .type = FR_TYPE_STRING },
 	XLAT_ARG_PARSER_TERMINATOR
@@ -375,12 +663,16 @@ static xlat_arg_parser_t const redis_lua_func_args[] = {
  *
  * Lua functions either get uploaded when the module is instantiated or the first
  * time they get executed.
+ *
+ * If asynchronous I/O is available, calls are pipelined over the worker's trunk
+ * to the node responsible for the first key, and are always sent to the master.
  */
 static xlat_action_t redis_lua_func_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 					 xlat_ctx_t const *xctx,
 					 request_t *request, fr_value_box_list_t *in)
 {
 	rlm_redis_t			*inst = talloc_get_type_abort(xctx->mctx->mi->data, rlm_redis_t);
+	rlm_redis_thread_t		*t = talloc_get_type_abort(xctx->mctx->thread, rlm_redis_thread_t);
 	redis_lua_func_inst_t const	*xlat_inst = talloc_get_type_abort_const(xctx->inst, redis_lua_func_inst_t);
 	redis_lua_func_t		*func = xlat_inst->func;
 
@@ -452,6 +744,16 @@ static xlat_action_t redis_lua_func_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	 	key_len = arg_len[3];
 	}
 
+	if (t->cluster_thread) {
+		redis_xlat_rctx_t *rctx;
+
+		RDEBUG3("Calling script 0x%s", func->digest);
+		rctx = redis_xlat_rctx_alloc(request, func, key, key_len, func->read_only, argc, argv, arg_len);
+		if (!rctx) return XLAT_ACTION_FAIL;
+
+		return redis_xlat_enqueue(request, t->cluster_thread, rctx);
+	}
+
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, func->read_only);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
@@ -583,6 +885,10 @@ static xlat_arg_parser_t const redis_args[] = {
 @verbatim
 %redis(<redis command>)
 @endverbatim
+ *
+ * Commands are pipelined over the worker's trunk to the node responsible for
+ * the key, unless a specific node is requested with '@', or asynchronous I/O
+ * is unavailable.
  *
  * @ingroup xlat_functions
  */
@@ -591,6 +897,7 @@ static xlat_action_t redis_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				request_t *request, fr_value_box_list_t *in)
 {
 	rlm_redis_t const	*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_redis_t);
+	rlm_redis_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_redis_thread_t);
 	xlat_action_t		action = XLAT_ACTION_DONE;
 	fr_redis_conn_t		*conn;
 
@@ -735,6 +1042,21 @@ static xlat_action_t redis_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	 	key_len = arg_len[1];
 	}
 
+	if (t->cluster_thread) {
+		redis_xlat_rctx_t *rctx;
+
+		if (!redis_command_pipelinable(argv[0], arg_len[0])) {
+			REDEBUG("Command \"%pV\" cannot be pipelined", fr_value_box_list_head(in));
+			return XLAT_ACTION_FAIL;
+		}
+
+		RDEBUG2("Executing command: %pV", fr_value_box_list_head(in));
+		rctx = redis_xlat_rctx_alloc(request, NULL, key, key_len, read_only, argc, argv, arg_len);
+		if (!rctx) return XLAT_ACTION_FAIL;
+
+		return redis_xlat_enqueue(request, t->cluster_thread, rctx);
+	}
+
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, inst->cluster, request, key, key_len, read_only);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, inst->cluster, request, status, &reply)) {
@@ -858,6 +1180,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_redis_t);
+	rlm_redis_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_thread_t);
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, mctx->el, &inst->trunk_conf,
+							  inst->cluster, &inst->conf, mctx->mi->name);
+	if (!t->cluster_thread) PWARN("%s - Falling back to synchronous I/O", mctx->mi->name);
+
+	return 0;
+}
+
 static int mod_bootstrap(module_inst_ctx_t const *mctx)
 {
 	rlm_redis_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_redis_t);
@@ -904,6 +1238,10 @@ module_rlm_t rlm_redis = {
 		.config		= module_config,
 		.onload		= mod_load,
 		.bootstrap	= mod_bootstrap,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_redis_thread_t),
+		.thread_inst_type	= "rlm_redis_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
 	}
 };
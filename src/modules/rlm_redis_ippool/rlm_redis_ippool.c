@@ -50,6 +50,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
 #include <freeradius-devel/unlang/call_env.h>
 
@@ -76,10 +77,43 @@ typedef struct {
 						//!< allocated_address_attr if updates are successful.
 
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
+
+	trunk_conf_t		trunk_conf;	//!< Configuration for the trunks to each cluster node.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread instance
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t	*cluster_thread;	//!< Trunks to each of the cluster nodes.
+								///< NULL if asynchronous I/O is unavailable.
+} rlm_redis_ippool_thread_t;
+
+/** Resume context for running a Lua script
+ *
+ */
+typedef struct {
+	rlm_redis_ippool_t const	*inst;			//!< Module instance.
+	fr_redis_cluster_thread_t	*cluster_thread;	//!< To send the commands with.  NULL if
+								///< the script is run synchronously.
+	fr_redis_command_set_t		*cmds;			//!< Commands currently in flight.
+
+	uint8_t const			*key;			//!< Used to determine the cluster node.
+	size_t				key_len;		//!< Length of the key.
+
+	char const			*digest;		//!< Of the script.
+	char const			*script;		//!< To upload if the node doesn't have it cached.
+	char				*evalsha;		//!< Formatted EVALSHA command.
+	size_t				evalsha_len;		//!< Length of the EVALSHA command.
+	bool				load;			//!< Upload the script along with the EVALSHA.
+
+	fr_redis_rcode_t		status;			//!< Of running the script.
+	redisReply			*reply;			//!< From the script.
+} ippool_script_rctx_t;
+
 static conf_parser_t redis_config[] = {
 	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_redis_ippool_t, trunk_conf, trunk_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -552,15 +586,15 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
  * @param[in] wait_timeout	How long to wait for slaves to replicate the data.
  * @param[in] digest		of script.
  * @param[in] script		to upload.
- * @param[in] cmd		EVALSHA command to execute.
- * @param[in] ...		Arguments for the eval command.
+ * @param[in] cmd		EVALSHA command to execute, formatted with #fr_redis_command_format.
+ * @param[in] cmd_len		Length of the EVALSHA command.
  * @return status of the command.
  */
 static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_redis_cluster_t *cluster,
 				      uint8_t const *key, size_t key_len,
 				      uint32_t wait_num, fr_time_delta_t wait_timeout,
 				      char const digest[], char const *script,
-				      char const *cmd, ...)
+				      char const *cmd, size_t cmd_len)
 {
 	fr_redis_conn_t			*conn;
 	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
@@ -570,25 +604,17 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	fr_redis_rcode_t		s_ret, status;
 	unsigned int			pipelined = 0;
 
-	va_list				ap;
-
 	*out = NULL;
 
 #ifndef NDEBUG
 	memset(replies, 0, sizeof(replies));
 #endif
 
-	va_start(ap, cmd);
-
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
-
 	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, cmd, cmd_len);
 		pipelined = 1;
 		if (wait_num) {
 			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
@@ -612,9 +638,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	     	RDEBUG3("Loading script 0x%s", digest);
 		redisAppendCommand(conn->handle, "MULTI");
 		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, cmd, cmd_len);
 		redisAppendCommand(conn->handle, "EXEC");
 		pipelined = 4;
 		if (wait_num) {
@@ -686,54 +710,26 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 	}
 
 finish:
-	va_end(ap);
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Process the reply to the allocation script
  *
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request,
-					    redis_ippool_alloc_call_env_t *env, uint32_t lease_time)
+static ippool_rcode_t redis_ippool_allocate_reply(request_t *request, redis_ippool_alloc_call_env_t *env,
+						  redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	ippool_rcode_t		ret;
 
-	fr_assert(env->pool_name.vb_length > 0);
-	fr_assert(env->owner.vb_length > 0);
-
-	now = fr_time_to_timeval(fr_time());
-
-	status = ippool_script(&reply, request, inst->cluster,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       inst->wait_num, inst->wait_timeout,
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       (unsigned int)now.tv_sec, lease_time,
-			       (uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
-			       (uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
-	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	if (reply->elements == 0) {
 		REDEBUG("Got empty result array");
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	/*
@@ -742,11 +738,10 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 	if (reply->element[0]->type != REDIS_REPLY_INTEGER) {
 		REDEBUG("Server returned unexpected type \"%s\" for rcode element (result[0])",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 	ret = reply->element[0]->integer;
-	if (ret < 0) goto finish;
+	if (ret < 0) return ret;
 
 	/*
 	 *	Process IP address
@@ -776,8 +771,7 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 				if (fr_value_box_cast(NULL, tmpl_value(ip_map.rhs), FR_TYPE_IPV4_ADDR,
 						      NULL, &tmp)) {
 					RPEDEBUG("Failed converting integer to IPv4 address");
-					ret = IPPOOL_RCODE_FAIL;
-					goto finish;
+					return IPPOOL_RCODE_FAIL;
 				}
 			} else {
 				fr_value_box(&ip_map.rhs->data.literal,
@@ -791,16 +785,14 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 						      NULL, reply->element[1]->str, reply->element[1]->len, false);
 		do_ip_map:
 			if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) {
-				ret = IPPOOL_RCODE_FAIL;
-				goto finish;
+				return IPPOOL_RCODE_FAIL;
 			}
 			break;
 
 		default:
 			REDEBUG("Server returned unexpected type \"%s\" for IP element (result[1])",
 				fr_table_str_by_value(redis_reply_types, reply->element[1]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
@@ -825,8 +817,7 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 			fr_value_box_bstrndup_shallow(&range_map.rhs->data.literal,
 						      NULL, reply->element[2]->str, reply->element[2]->len, true);
 			if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) {
-				ret = IPPOOL_RCODE_FAIL;
-				goto finish;
+				return IPPOOL_RCODE_FAIL;
 			}
 		}
 			break;
@@ -837,8 +828,7 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 		default:
 			REDEBUG("Server returned unexpected type \"%s\" for range element (result[2])",
 				fr_table_str_by_value(redis_reply_types, reply->element[2]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
@@ -857,83 +847,35 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 		if (reply->element[3]->type != REDIS_REPLY_INTEGER) {
 			REDEBUG("Server returned unexpected type \"%s\" for expiry element (result[3])",
 				fr_table_str_by_value(redis_reply_types, reply->element[3]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 
 		fr_value_box(&expiry_map.rhs->data.literal, (uint32_t)reply->element[3]->integer, true);
 		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) {
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
-finish:
-	fr_redis_reply_free(&reply);
+
 	return ret;
 }
 
-/** Update an existing IP address in a pool
+/** Process the reply to the update script
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, request_t *request,
-					  redis_ippool_update_call_env_t *env,
-					  fr_ipaddr_t *ip,
-					  fr_value_box_t const *owner,
-					  fr_value_box_t const *gateway_id,
-					  uint32_t expires)
+static ippool_rcode_t redis_ippool_update_reply(request_t *request, redis_ippool_update_call_env_t *env,
+						redisReply *reply, uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
-
-	now = fr_time_to_timeval(fr_time());
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->addr.v4.s_addr),
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length,
-				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length,
-				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
+	ippool_rcode_t		ret;
 
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	if (reply->elements == 0) {
 		REDEBUG("Got empty result array");
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	/*
@@ -942,11 +884,10 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 	if (reply->element[0]->type != REDIS_REPLY_INTEGER) {
 		REDEBUG("Server returned unexpected type \"%s\" for rcode element (result[0])",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 	ret = reply->element[0]->integer;
-	if (ret < 0) goto finish;
+	if (ret < 0) return ret;
 
 	/*
 	 *	Process Range identifier
@@ -965,8 +906,7 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 			fr_value_box_bstrndup_shallow(&range_map.rhs->data.literal, NULL,
 						      reply->element[1]->str, reply->element[1]->len, true);
 			if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) {
-				ret = IPPOOL_RCODE_FAIL;
-				goto finish;
+				return IPPOOL_RCODE_FAIL;
 			}
 		}
 			break;
@@ -977,8 +917,7 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 		default:
 			REDEBUG("Server returned unexpected type \"%s\" for range element (result[1])",
 				fr_table_str_by_value(redis_reply_types, reply->element[0]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
@@ -998,75 +937,27 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 
 		fr_value_box(&expiry_map.rhs->data.literal, expires, false);
 		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) {
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
-finish:
-	fr_redis_reply_free(&reply);
-
 	return ret;
 }
 
-/** Release an existing IP address in a pool
+/** Process the reply to the release script
  *
  */
-static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, request_t *request,
-					   fr_value_box_t const *key_prefix,
-					   fr_ipaddr_t *ip,
-					   fr_value_box_t const *owner)
+static ippool_rcode_t redis_ippool_release_reply(request_t *request, redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
-
-	now = fr_time_to_timeval(fr_time());
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %u %b",
-				       lua_release_digest,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       (unsigned int)now.tv_sec,
-				       htonl(ip->addr.v4.s_addr),
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %s %b",
-				       lua_release_digest,
-				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
-				       (unsigned int)now.tv_sec,
-				       ip_buff,
-				       (uint8_t const *)owner->vb_strvalue, owner->vb_length);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	if (reply->elements == 0) {
 		REDEBUG("Got empty result array");
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	/*
@@ -1075,18 +966,229 @@ static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, reque
 	if (reply->element[0]->type != REDIS_REPLY_INTEGER) {
 		REDEBUG("Server returned unexpected type \"%s\" for rcode element (result[0])",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
+		return IPPOOL_RCODE_FAIL;
+	}
+	return reply->element[0]->integer;
+}
+
+/** Complete the command set used to run a script
+ *
+ * Checks the replies to each of the commands, and extracts the reply
+ * from the script.
+ */
+static void _ippool_script_complete(request_t *request, fr_dlist_head_t *completed, void *uctx)
+{
+	ippool_script_rctx_t	*rctx = talloc_get_type_abort(uctx, ippool_script_rctx_t);
+	uint32_t		wait_num = rctx->inst->wait_num;
+	fr_redis_command_t	*cmd;
+	redisReply		*replies[5];	/* Must be equal to the maximum number of pipelined commands */
+	size_t			reply_cnt = 0, i;
+
+	rctx->cmds = NULL;	/* Freed by the trunk once we return */
+	rctx->status = REDIS_RCODE_ERROR;
+
+	for (cmd = fr_dlist_head(completed);
+	     cmd && (reply_cnt < NUM_ELEMENTS(replies));
+	     cmd = fr_dlist_next(completed, cmd)) replies[reply_cnt++] = fr_redis_command_get_result(cmd);
+
+	if (reply_cnt != ((rctx->load ? 4 : 1) + (wait_num ? 1 : 0))) {
+		REDEBUG("Expected %u replies, got %zu", (rctx->load ? 4 : 1) + (wait_num ? 1 : 0), reply_cnt);
 		goto finish;
 	}
-	ret = reply->element[0]->integer;
-	if (ret < 0) goto finish;
+
+	for (i = 0; i < reply_cnt; i++) {
+		if (RDEBUG_ENABLED3) fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
+
+		if (replies[i]->type != REDIS_REPLY_ERROR) continue;
+
+		/*
+		 *	Node doesn't have the script cached, the
+		 *	resume function will send it up along
+		 *	with the EVALSHA.
+		 */
+		if (!rctx->load && (i == 0) &&
+		    (strncmp(REDIS_ERROR_NO_SCRIPT_STR, replies[i]->str, sizeof(REDIS_ERROR_NO_SCRIPT_STR) - 1) == 0)) {
+			rctx->status = REDIS_RCODE_NO_SCRIPT;
+			goto finish;
+		}
+
+		REDEBUG("Server error: %s", replies[i]->str);
+		goto finish;
+	}
+
+	if (!rctx->load) {
+		/* EVALSHA [+ WAIT] */
+		if ((reply_cnt > 1) && (ippool_wait_check(request, wait_num, replies[1]) < 0)) goto finish;
+
+		rctx->reply = fr_redis_command_steal_result(fr_dlist_head(completed));
+	} else {
+		/* MULTI + SCRIPT LOAD + EVALSHA + EXEC [+ WAIT] */
+		if (replies[3]->type != REDIS_REPLY_ARRAY) {
+			RERROR("Bad response to EXEC, expected array got %s",
+			       fr_table_str_by_value(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
+			goto finish;
+		}
+		if (replies[3]->elements != 2) {
+			RERROR("Bad response to EXEC, expected 2 result elements, got %zu",
+			       replies[3]->elements);
+			goto finish;
+		}
+		if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
+			RERROR("Bad response to SCRIPT LOAD, expected string got %s",
+			       fr_table_str_by_value(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
+			goto finish;
+		}
+		if (strcmp(replies[3]->element[0]->str, rctx->digest) != 0) {
+			RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
+				rctx->digest, replies[3]->element[0]->str);
+			goto finish;
+		}
+		if (replies[3]->element[1]->type == REDIS_REPLY_ERROR) {
+			REDEBUG("Server error: %s", replies[3]->element[1]->str);
+			goto finish;
+		}
+		if ((reply_cnt > 4) && (ippool_wait_check(request, wait_num, replies[4]) < 0)) goto finish;
+
+		rctx->reply = replies[3]->element[1];
+		replies[3]->element[1] = NULL;		/* This works because hiredis checks for NULL elements */
+	}
+	rctx->status = REDIS_RCODE_SUCCESS;
 
 finish:
-	fr_redis_reply_free(&reply);
+	unlang_interpret_mark_runnable(request);
+}
 
-	return ret;
+/** The command set used to run a script could not be sent, or failed part way through
+ *
+ */
+static void _ippool_script_fail(request_t *request, UNUSED fr_dlist_head_t *completed, void *uctx)
+{
+	ippool_script_rctx_t	*rctx = talloc_get_type_abort(uctx, ippool_script_rctx_t);
+
+	REDEBUG("Failed executing script 0x%s", rctx->digest);
+
+	rctx->cmds = NULL;	/* Freed by the trunk once we return */
+	rctx->status = REDIS_RCODE_ERROR;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Cancel any commands in flight if the request is cancelled
+ *
+ */
+static void ippool_script_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	ippool_script_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, ippool_script_rctx_t);
+
+	if (rctx->cmds) fr_redis_command_set_cancel(rctx->cmds);
+	talloc_free(rctx);
+}
+
+static int _ippool_script_rctx_free(ippool_script_rctx_t *rctx)
+{
+	fr_redis_reply_free(&rctx->reply);
+
+	return 0;
+}
+
+/** Run a script, yielding until the node responsible for the pool responds
+ *
+ * If the module was unable to create asynchronous connections to the cluster,
+ * the script is run synchronously, and the resume function called immediately.
+ *
+ * @param[out] p_result	Result of running the script.
+ * @param[in] mctx	Module calling context.
+ * @param[in] request	The current request.
+ * @param[in] rctx	holding the formatted EVALSHA command.
+ * @param[in] resume	Function to process the script's reply.
+ * @return an unlang_action_t.
+ */
+static unlang_action_t ippool_script_run(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					 ippool_script_rctx_t *rctx, module_method_t resume)
+{
+	rlm_redis_ippool_t const	*inst = rctx->inst;
+	fr_redis_command_set_t		*cmds;
+	char				*cmd;
+	size_t				len;
+
+	/*
+	 *	No asynchronous connections, run the script
+	 *	with the connection pool.
+	 */
+	if (!rctx->cluster_thread) {
+		rctx->status = ippool_script(&rctx->reply, request, inst->cluster, rctx->key, rctx->key_len,
+					     inst->wait_num, inst->wait_timeout, rctx->digest, rctx->script,
+					     rctx->evalsha, rctx->evalsha_len);
+		return resume(p_result, MODULE_CTX(mctx->mi, mctx->thread, mctx->env_data, rctx), request);
+	}
+
+	cmds = fr_redis_command_set_alloc(NULL, request, _ippool_script_complete, _ippool_script_fail, rctx);
+
+	if (rctx->load) {
+		RDEBUG3("Loading script 0x%s", rctx->digest);
+		if (fr_redis_command_preformatted_add(cmds, "MULTI", sizeof("MULTI") - 1) != FR_REDIS_PIPELINE_OK) {
+		error:
+			talloc_free(cmds);
+			talloc_free(rctx);
+			RETURN_MODULE_FAIL;
+		}
+		MEM(cmd = fr_redis_command_format(cmds, &len, "SCRIPT LOAD %s", rctx->script));
+		if (fr_redis_command_preformatted_add(cmds, cmd, len) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	RDEBUG3("Calling script 0x%s", rctx->digest);
+	if (fr_redis_command_preformatted_add(cmds, rctx->evalsha, rctx->evalsha_len) != FR_REDIS_PIPELINE_OK) goto error;
+
+	if (rctx->load &&
+	    (fr_redis_command_preformatted_add(cmds, "EXEC", sizeof("EXEC") - 1) != FR_REDIS_PIPELINE_OK)) goto error;
+
+	if (inst->wait_num) {
+		MEM(cmd = fr_redis_command_format(cmds, &len, "WAIT %i %i",
+						  inst->wait_num, fr_time_delta_to_msec(inst->wait_timeout)));
+		if (fr_redis_command_preformatted_add(cmds, cmd, len) != FR_REDIS_PIPELINE_OK) goto error;
+	}
+
+	if (fr_redis_command_set_enqueue_by_key(rctx->cluster_thread, cmds,
+						rctx->key, rctx->key_len, false) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing script 0x%s", rctx->digest);
+		goto error;
+	}
+	rctx->cmds = cmds;
+
+	return unlang_module_yield(request, resume, ippool_script_signal, ~FR_SIGNAL_CANCEL, rctx);
 }
 
+/** Allocate a resume context for running a script
+ *
+ */
+static ippool_script_rctx_t *ippool_script_rctx_alloc(module_ctx_t const *mctx, request_t *request,
+						      fr_value_box_t const *pool_name,
+						      char const *digest, char const *script)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+	ippool_script_rctx_t		*rctx;
+
+	MEM(rctx = talloc_zero(request, ippool_script_rctx_t));
+	talloc_set_destructor(rctx, _ippool_script_rctx_free);
+	rctx->inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	rctx->cluster_thread = t->cluster_thread;
+	rctx->key = (uint8_t const *)pool_name->vb_strvalue;
+	rctx->key_len = pool_name->vb_length;
+	rctx->digest = digest;
+	rctx->script = script;
+
+	return rctx;
+}
+
+/** Send the script up to the node if it didn't have it cached, and run it again
+ *
+ */
+#define IPPOOL_SCRIPT_RETRY(_resume) \
+	if ((rctx->status == REDIS_RCODE_NO_SCRIPT) && !rctx->load) { \
+		rctx->load = true; \
+		return ippool_script_run(p_result, mctx, request, rctx, _resume); \
+	}
+
 #define CHECK_POOL_NAME \
 	if (env->pool_name.vb_length > IPPOOL_MAX_KEY_PREFIX_SIZE) { \
 		REDEBUG("Pool name too long.  Expected %u bytes, got %ld bytes", \
@@ -1098,14 +1200,43 @@ finish:
 		RETURN_MODULE_NOOP; \
 	}
 
+static unlang_action_t CC_HINT(nonnull) mod_alloc_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							 request_t *request)
+{
+	redis_ippool_alloc_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_alloc_call_env_t);
+	ippool_script_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, ippool_script_rctx_t);
+	ippool_rcode_t			ret = IPPOOL_RCODE_FAIL;
+
+	IPPOOL_SCRIPT_RETRY(mod_alloc_resume)
+
+	if (rctx->status == REDIS_RCODE_SUCCESS) ret = redis_ippool_allocate_reply(request, env, rctx->reply);
+	talloc_free(rctx);
+
+	switch (ret) {
+	case IPPOOL_RCODE_SUCCESS:
+		RDEBUG2("IP address lease allocated");
+		RETURN_MODULE_UPDATED;
+
+	case IPPOOL_RCODE_POOL_EMPTY:
+		RWDEBUG("Pool contains no free addresses");
+		RETURN_MODULE_NOTFOUND;
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
 	redis_ippool_alloc_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_alloc_call_env_t);
+	ippool_script_rctx_t		*rctx;
 	uint32_t			lease_time;
+	struct timeval			now;
 
 	CHECK_POOL_NAME
 
+	fr_assert(env->owner.vb_length > 0);
+
 	/*
 	 *	If offer_time is defined, it will be FR_TYPE_UINT32.
 	 *	Fall back to lease_time otherwise.
@@ -1114,33 +1245,41 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 			env->offer_time.vb_uint32 : env->lease_time.vb_uint32;
 	ippool_action_print(request, POOL_ACTION_ALLOCATE, L_DBG_LVL_2, &env->pool_name, NULL,
 			    &env->owner, &env->gateway_id, lease_time);
-	switch (redis_ippool_allocate(inst, request, env, lease_time)) {
-	case IPPOOL_RCODE_SUCCESS:
-		RDEBUG2("IP address lease allocated");
-		RETURN_MODULE_UPDATED;
 
-	case IPPOOL_RCODE_POOL_EMPTY:
-		RWDEBUG("Pool contains no free addresses");
-		RETURN_MODULE_NOTFOUND;
+	now = fr_time_to_timeval(fr_time());
 
-	default:
+	rctx = ippool_script_rctx_alloc(mctx, request, &env->pool_name, lua_alloc_digest, lua_alloc_cmd);
+	rctx->evalsha = fr_redis_command_format(rctx, &rctx->evalsha_len, "EVALSHA %s 1 %b %u %u %b %b",
+						lua_alloc_digest,
+						(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+						(unsigned int)now.tv_sec, lease_time,
+						(uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
+						(uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
+	if (!rctx->evalsha) {
+		RPEDEBUG("Failed formatting allocation command");
+		talloc_free(rctx);
 		RETURN_MODULE_FAIL;
 	}
+
+	return ippool_script_run(p_result, mctx, request, rctx, mod_alloc_resume);
 }
 
-static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) mod_update_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							  request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
 	redis_ippool_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_update_call_env_t);
+	ippool_script_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, ippool_script_rctx_t);
+	ippool_rcode_t			ret = IPPOOL_RCODE_FAIL;
 
-	CHECK_POOL_NAME
+	IPPOOL_SCRIPT_RETRY(mod_update_resume)
 
-	ippool_action_print(request, POOL_ACTION_UPDATE, L_DBG_LVL_2, &env->pool_name,
-			    &env->requested_address, &env->owner, &env->gateway_id, env->lease_time.vb_uint32);
-	switch (redis_ippool_update(inst, request, env,
-				    &env->requested_address.datum.ip, &env->owner,
-				    &env->gateway_id,
-				    env->lease_time.vb_uint32)) {
+	if (rctx->status == REDIS_RCODE_SUCCESS) {
+		ret = redis_ippool_update_reply(request, env, rctx->reply, env->lease_time.vb_uint32);
+	}
+	talloc_free(rctx);
+
+	switch (ret) {
 	case IPPOOL_RCODE_SUCCESS:
 		RDEBUG2("Requested IP address' \"%pV\" lease updated", &env->requested_address);
 
@@ -1190,16 +1329,64 @@ static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module
 	}
 }
 
-static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) mod_update(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
-	redis_ippool_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_release_call_env_t);
+	redis_ippool_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_update_call_env_t);
+	ippool_script_rctx_t		*rctx;
+	fr_ipaddr_t			*ip = &env->requested_address.datum.ip;
+	struct timeval			now;
 
 	CHECK_POOL_NAME
 
-	ippool_action_print(request, POOL_ACTION_RELEASE, L_DBG_LVL_2, &env->pool_name,
-			    &env->requested_address, &env->owner, &env->gateway_id, 0);
-	switch (redis_ippool_release(inst, request, &env->pool_name, &env->requested_address.datum.ip, &env->owner)) {
+	ippool_action_print(request, POOL_ACTION_UPDATE, L_DBG_LVL_2, &env->pool_name,
+			    &env->requested_address, &env->owner, &env->gateway_id, env->lease_time.vb_uint32);
+
+	now = fr_time_to_timeval(fr_time());
+
+	rctx = ippool_script_rctx_alloc(mctx, request, &env->pool_name, lua_update_digest, lua_update_cmd);
+	if ((ip->af == AF_INET) && inst->ipv4_integer) {
+		rctx->evalsha = fr_redis_command_format(rctx, &rctx->evalsha_len, "EVALSHA %s 1 %b %u %u %u %b %b",
+							lua_update_digest,
+							(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+							(unsigned int)now.tv_sec, env->lease_time.vb_uint32,
+							htonl(ip->addr.v4.s_addr),
+							(uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
+							(uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
+	} else {
+		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
+
+		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
+		rctx->evalsha = fr_redis_command_format(rctx, &rctx->evalsha_len, "EVALSHA %s 1 %b %u %u %s %b %b",
+							lua_update_digest,
+							(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+							(unsigned int)now.tv_sec, env->lease_time.vb_uint32,
+							ip_buff,
+							(uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
+							(uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
+	}
+	if (!rctx->evalsha) {
+		RPEDEBUG("Failed formatting update command");
+		talloc_free(rctx);
+		RETURN_MODULE_FAIL;
+	}
+
+	return ippool_script_run(p_result, mctx, request, rctx, mod_update_resume);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_release_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							   request_t *request)
+{
+	redis_ippool_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_release_call_env_t);
+	ippool_script_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, ippool_script_rctx_t);
+	ippool_rcode_t			ret = IPPOOL_RCODE_FAIL;
+
+	IPPOOL_SCRIPT_RETRY(mod_release_resume)
+
+	if (rctx->status == REDIS_RCODE_SUCCESS) ret = redis_ippool_release_reply(request, rctx->reply);
+	talloc_free(rctx);
+
+	switch (ret) {
 	case IPPOOL_RCODE_SUCCESS:
 		RDEBUG2("IP address \"%pV\" released", &env->requested_address);
 		RETURN_MODULE_UPDATED;
@@ -1224,6 +1411,49 @@ static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, modul
 	}
 }
 
+static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	redis_ippool_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_release_call_env_t);
+	ippool_script_rctx_t		*rctx;
+	fr_ipaddr_t			*ip = &env->requested_address.datum.ip;
+	struct timeval			now;
+
+	CHECK_POOL_NAME
+
+	ippool_action_print(request, POOL_ACTION_RELEASE, L_DBG_LVL_2, &env->pool_name,
+			    &env->requested_address, &env->owner, &env->gateway_id, 0);
+
+	now = fr_time_to_timeval(fr_time());
+
+	rctx = ippool_script_rctx_alloc(mctx, request, &env->pool_name, lua_release_digest, lua_release_cmd);
+	if ((ip->af == AF_INET) && inst->ipv4_integer) {
+		rctx->evalsha = fr_redis_command_format(rctx, &rctx->evalsha_len, "EVALSHA %s 1 %b %u %u %b",
+							lua_release_digest,
+							(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+							(unsigned int)now.tv_sec,
+							htonl(ip->addr.v4.s_addr),
+							(uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length);
+	} else {
+		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
+
+		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
+		rctx->evalsha = fr_redis_command_format(rctx, &rctx->evalsha_len, "EVALSHA %s 1 %b %u %s %b",
+							lua_release_digest,
+							(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
+							(unsigned int)now.tv_sec,
+							ip_buff,
+							(uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length);
+	}
+	if (!rctx->evalsha) {
+		RPEDEBUG("Failed formatting release command");
+		talloc_free(rctx);
+		RETURN_MODULE_FAIL;
+	}
+
+	return ippool_script_run(p_result, mctx, request, rctx, mod_release_resume);
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_bulk_release(rlm_rcode_t *p_result, UNUSED module_ctx_t const *mctx,
 							 request_t *request)
 {
@@ -1274,6 +1504,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_redis_ippool_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, mctx->el, &inst->trunk_conf,
+							  inst->cluster, &inst->conf, mctx->mi->name);
+	if (!t->cluster_thread) PWARN("%s - Falling back to synchronous I/O", mctx->mi->name);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1289,7 +1531,11 @@ module_rlm_t rlm_redis_ippool = {
 		.inst_size	= sizeof(rlm_redis_ippool_t),
 		.config		= module_config,
 		.onload		= mod_load,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+		.thread_inst_type	= "rlm_redis_ippool_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
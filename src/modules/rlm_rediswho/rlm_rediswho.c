@@ -35,6 +35,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
 
 typedef struct {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
@@ -48,18 +49,41 @@ typedef struct {
 
 	char const		*insert;	//!< Command for inserting session data
 	char const		*trim;		//!< Command for trimming the session list.
+	char const		**session;	//!< Commands for maintaining the set of active sessions.
 	char const		*expire;	//!< Command for expiring entries.
+
+	trunk_conf_t		trunk_conf;	//!< Configuration for the trunks to each cluster node.
 } rlm_rediswho_t;
 
+/** rlm_rediswho thread instance
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t	*cluster_thread;	//!< Trunks to each of the cluster nodes.
+								///< NULL if asynchronous I/O is unavailable.
+} rlm_rediswho_thread_t;
+
+/** Resume context for the commands issued for an accounting packet
+ *
+ */
+typedef struct {
+	rlm_rediswho_t const		*inst;			//!< Module instance.
+	fr_redis_command_set_t		*cmds;			//!< Commands currently in flight.
+	bool				insert;			//!< Whether the first command is the insert.
+	rlm_rcode_t			rcode;			//!< Result of running the commands.
+} rediswho_rctx_t;
+
 static conf_parser_t section_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("insert", CONF_FLAG_REQUIRED | CONF_FLAG_XLAT, rlm_rediswho_t, insert) },
 	{ FR_CONF_OFFSET_FLAGS("trim", CONF_FLAG_XLAT, rlm_rediswho_t, trim) }, /* required only if trim_count > 0 */
+	{ FR_CONF_OFFSET_FLAGS("session", CONF_FLAG_XLAT | CONF_FLAG_MULTI, rlm_rediswho_t, session) },
 	{ FR_CONF_OFFSET_FLAGS("expire", CONF_FLAG_REQUIRED, rlm_rediswho_t, expire) },
 	CONF_PARSER_TERMINATOR
 };
 
 static conf_parser_t module_config[] = {
 	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET_SUBSECTION("trunk", 0, rlm_rediswho_t, trunk_conf, trunk_config) },
 
 	{ FR_CONF_OFFSET("trim_count", rlm_rediswho_t, trim_count), .dflt = "-1" },
 
@@ -158,7 +182,14 @@ static int rediswho_command(rlm_rediswho_t const *inst, request_t *request, char
 		break;
 
 	case REDIS_REPLY_INTEGER:
-		if (reply->integer > 0) ret = reply->integer;
+		ret = (reply->integer > 0) ? reply->integer : 0;
+		break;
+
+	/*
+	 *	LTRIM et al return +OK
+	 */
+	case REDIS_REPLY_STATUS:
+		ret = 0;
 		break;
 
 	/*
@@ -175,12 +206,226 @@ static int rediswho_command(rlm_rediswho_t const *inst, request_t *request, char
 	return ret;
 }
 
+/** Check the replies to the insert, trim and expire commands
+ *
+ */
+static void _rediswho_complete(request_t *request, fr_dlist_head_t *completed, void *uctx)
+{
+	rediswho_rctx_t		*rctx = talloc_get_type_abort(uctx, rediswho_rctx_t);
+	fr_redis_command_t	*cmd;
+	redisReply		*reply;
+	int			i = 0;
+
+	rctx->cmds = NULL;	/* Freed by the trunk once we return */
+	rctx->rcode = RLM_MODULE_FAIL;
+
+	for (cmd = fr_dlist_head(completed); cmd; cmd = fr_dlist_next(completed, cmd), i++) {
+		reply = fr_redis_command_get_result(cmd);
+		if (!reply) {
+			REDEBUG("Missing reply to command %i", i);
+			goto finish;
+		}
+
+		/*
+		 *	Write the response to the debug log
+		 */
+		fr_redis_reply_print(L_DBG_LVL_2, reply, request, i);
+
+		if (reply->type == REDIS_REPLY_ERROR) {
+			REDEBUG("Server error: %s", reply->str);
+			goto finish;
+		}
+
+		/*
+		 *	Only the insert needs to produce an integer,
+		 *	the trim command usually returns +OK.
+		 */
+		if ((i == 0) && rctx->insert && (reply->type != REDIS_REPLY_INTEGER)) {
+			REDEBUG("Expected type \"integer\" got type \"%s\"",
+				fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+			goto finish;
+		}
+	}
+
+	rctx->rcode = RLM_MODULE_OK;
+
+finish:
+	unlang_interpret_mark_runnable(request);
+}
+
+/** The command set could not be sent, or failed part way through
+ *
+ */
+static void _rediswho_fail(request_t *request, UNUSED fr_dlist_head_t *completed, void *uctx)
+{
+	rediswho_rctx_t		*rctx = talloc_get_type_abort(uctx, rediswho_rctx_t);
+
+	RERROR("Failed inserting accounting data");
+
+	rctx->cmds = NULL;	/* Freed by the trunk once we return */
+	rctx->rcode = RLM_MODULE_FAIL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Cancel any commands in flight if the request is cancelled
+ *
+ */
+static void rediswho_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	rediswho_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, rediswho_rctx_t);
+
+	if (rctx->cmds) fr_redis_command_set_cancel(rctx->cmds);
+	talloc_free(rctx);
+}
+
+static unlang_action_t mod_accounting_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, UNUSED request_t *request)
+{
+	rediswho_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, rediswho_rctx_t);
+	rlm_rcode_t		rcode = rctx->rcode;
+
+	talloc_free(rctx);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** Expand a command and add it to the command set
+ *
+ * @param[in,out] key	Where to write the key (the second argument), if no
+ *			previous command provided one.
+ * @param[out] key_len	Length of the key.
+ * @param[in] cmds	to add the command to.
+ * @param[in] request	The current request.
+ * @param[in] fmt	of the command.
+ * @return
+ *	- 1 if the command was added.
+ *	- 0 if the command was empty.
+ *	- -1 on error.
+ */
+static int rediswho_command_add(uint8_t const **key, size_t *key_len,
+				fr_redis_command_set_t *cmds, request_t *request, char const *fmt)
+{
+	int			argc;
+	char const		*argv[MAX_REDIS_ARGS];
+	char			argv_buf[MAX_REDIS_COMMAND_LEN];
+	char			*cmd;
+	size_t			len;
+
+	if (!fmt || !*fmt) return 0;
+
+	argc = rad_expand_xlat(request, fmt, MAX_REDIS_ARGS, argv, false, sizeof(argv_buf), argv_buf);
+	if (argc < 0) {
+		RPEDEBUG("Invalid command: %s", fmt);
+		return -1;
+	}
+
+	cmd = fr_redis_command_format_argv(cmds, &len, argc, argv, NULL);
+	if (!cmd) {
+		RPEDEBUG("Invalid command: %s", fmt);
+		return -1;
+	}
+
+	if (fr_redis_command_preformatted_add(cmds, cmd, len) != FR_REDIS_PIPELINE_OK) {
+		RPEDEBUG("Failed adding command: %s", fmt);
+		return -1;
+	}
+
+	/*
+	 *	argv points into argv_buf, so the key has to be
+	 *	copied out before it goes out of scope.
+	 */
+	if (!*key && (argc > 1)) {
+		*key_len = strlen(argv[1]);
+		*key = (uint8_t const *)talloc_bstrndup(cmds, argv[1], *key_len);
+	}
+
+	return 1;
+}
+
+/** Send the insert, trim, session and expire commands in a single pipelined command set
+ *
+ * All the commands for a user operate on the same key, so they can be sent
+ * together to the node responsible for it, instead of waiting for each reply
+ * in turn.  The session commands use a different key, which must hash to
+ * the same cluster slot as the insert key.
+ *
+ * Because we don't have the reply to the insert before sending the trim,
+ * the trim command is sent whenever trim_count is set.  Trimming a list that's
+ * already short enough is a noop.
+ */
+static unlang_action_t mod_accounting_async(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					    fr_redis_cluster_thread_t *cluster_thread,
+					    CONF_SECTION *cs,
+					    char const *insert,
+					    char const *trim,
+					    char const *expire)
+{
+	rlm_rediswho_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_rediswho_t);
+	rediswho_rctx_t		*rctx;
+	fr_redis_command_set_t	*cmds;
+	CONF_PAIR		*cp;
+	uint8_t const		*key = NULL;
+	size_t			key_len = 0;
+	int			ret, count;
+
+	MEM(rctx = talloc_zero(request, rediswho_rctx_t));
+	rctx->inst = inst;
+
+	/*
+	 *	The command set is freed by the trunk once
+	 *	the complete or fail callbacks have run.
+	 */
+	cmds = fr_redis_command_set_alloc(NULL, request, _rediswho_complete, _rediswho_fail, rctx);
+
+	ret = rediswho_command_add(&key, &key_len, cmds, request, insert);
+	if (ret < 0) {
+	error:
+		talloc_free(cmds);
+		talloc_free(rctx);
+		RETURN_MODULE_FAIL;
+	}
+	rctx->insert = (ret > 0);
+	count = ret;
+
+	if (inst->trim_count >= 0) {
+		ret = rediswho_command_add(&key, &key_len, cmds, request, trim);
+		if (ret < 0) goto error;
+		count += ret;
+	}
+
+	for (cp = cf_pair_find(cs, "session"); cp; cp = cf_pair_find_next(cs, cp, "session")) {
+		ret = rediswho_command_add(&key, &key_len, cmds, request, cf_pair_value(cp));
+		if (ret < 0) goto error;
+		count += ret;
+	}
+
+	ret = rediswho_command_add(&key, &key_len, cmds, request, expire);
+	if (ret < 0) goto error;
+	count += ret;
+
+	if (count == 0) {
+		talloc_free(cmds);
+		talloc_free(rctx);
+		RETURN_MODULE_OK;
+	}
+
+	if (fr_redis_command_set_enqueue_by_key(cluster_thread, cmds, key, key_len, false) != FR_REDIS_PIPELINE_OK) {
+		RERROR("Failed inserting accounting data");
+		goto error;
+	}
+	rctx->cmds = cmds;
+
+	return unlang_module_yield(request, mod_accounting_resume, rediswho_signal, ~FR_SIGNAL_CANCEL, rctx);
+}
+
 static unlang_action_t mod_accounting_all(rlm_rcode_t *p_result, rlm_rediswho_t const *inst, request_t *request,
+					  CONF_SECTION *cs,
 					  char const *insert,
 					  char const *trim,
 					  char const *expire)
 {
-	int ret;
+	CONF_PAIR	*cp;
+	int		ret;
 
 	ret = rediswho_command(inst, request, insert);
 	if (ret < 0) RETURN_MODULE_FAIL;
@@ -190,6 +435,10 @@ static unlang_action_t mod_accounting_all(rlm_rcode_t *p_result, rlm_rediswho_t
 		if (rediswho_command(inst, request, trim) < 0) RETURN_MODULE_FAIL;
 	}
 
+	for (cp = cf_pair_find(cs, "session"); cp; cp = cf_pair_find_next(cs, cp, "session")) {
+		if (rediswho_command(inst, request, cf_pair_value(cp)) < 0) RETURN_MODULE_FAIL;
+	}
+
 	if (rediswho_command(inst, request, expire) < 0) RETURN_MODULE_FAIL;
 	RETURN_MODULE_OK;
 }
@@ -197,8 +446,8 @@ static unlang_action_t mod_accounting_all(rlm_rcode_t *p_result, rlm_rediswho_t
 static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_rediswho_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_rediswho_t);
+	rlm_rediswho_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_rediswho_thread_t);
 	CONF_SECTION		*conf = mctx->mi->conf;
-	rlm_rcode_t		rcode;
 	fr_pair_t		*vp;
 	fr_dict_enum_value_t	*dv;
 	CONF_SECTION		*cs;
@@ -226,7 +475,13 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 	trim = cf_pair_value(cf_pair_find(cs, "trim"));
 	expire = cf_pair_value(cf_pair_find(cs, "expire"));
 
-	return mod_accounting_all(&rcode, inst, request, insert, trim, expire);
+	/*
+	 *	No asynchronous connections, run the commands
+	 *	with the connection pool.
+	 */
+	if (!t->cluster_thread) return mod_accounting_all(p_result, inst, request, cs, insert, trim, expire);
+
+	return mod_accounting_async(p_result, mctx, request, t->cluster_thread, cs, insert, trim, expire);
 }
 
 static int mod_instantiate(module_inst_ctx_t const *mctx)
@@ -240,6 +495,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_rediswho_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_rediswho_t);
+	rlm_rediswho_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_rediswho_thread_t);
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, mctx->el, &inst->trunk_conf,
+							  inst->cluster, &inst->conf, mctx->mi->name);
+	if (!t->cluster_thread) PWARN("%s - Falling back to synchronous I/O", mctx->mi->name);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -255,7 +522,11 @@ module_rlm_t rlm_rediswho = {
 		.inst_size	= sizeof(rlm_rediswho_t),
 		.config		= module_config,
 		.onload		= mod_load,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_rediswho_thread_t),
+		.thread_inst_type	= "rlm_rediswho_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
@@ -1174,6 +1174,66 @@ static int json_pair_alloc(rlm_rest_t const *instance, rlm_rest_section_t const
 	return max - max_attrs;
 }
 
+/** State for parsing a JSON response as it's received
+ *
+ */
+typedef struct {
+	struct json_tokener	*tok;		//!< Incremental parser.
+	struct json_object	*json;		//!< Root of the tree, once it's complete.
+	bool			done;		//!< Parsing finished, successfully or otherwise.
+} rest_json_decoder_t;
+
+static int _rest_json_decoder_free(rest_json_decoder_t *dec)
+{
+	if (dec->json) json_object_put(dec->json);
+	json_tokener_free(dec->tok);
+
+	return 0;
+}
+
+/** Feed a chunk of the response body to the JSON parser
+ *
+ * Parsing each chunk as it arrives means the cost of parsing is
+ * spread over the time the server takes to send the body, instead
+ * of being paid all at once when the transfer completes.
+ *
+ * If the body can't be parsed incrementally, rest_decode_json
+ * parses the complete body instead.
+ *
+ * @param[in] ctx	response context.
+ * @param[in] in	chunk of body data.
+ * @param[in] inlen	length of the chunk.
+ */
+static void rest_decode_json_chunk(rlm_rest_response_t *ctx, char const *in, size_t inlen)
+{
+	rest_json_decoder_t	*dec = ctx->decoder;
+
+	if (!dec) {
+		MEM(dec = talloc_zero(NULL, rest_json_decoder_t));
+		dec->tok = json_tokener_new();
+		if (!dec->tok) {
+			talloc_free(dec);
+			return;
+		}
+		talloc_set_destructor(dec, _rest_json_decoder_free);
+		ctx->decoder = dec;
+	}
+
+	if (dec->done) return;
+
+	if (inlen > INT_MAX) {
+		dec->done = true;
+		return;
+	}
+
+	dec->json = json_tokener_parse_ex(dec->tok, in, (int)inlen);
+#ifdef HAVE_JSON_TOKENER_GET_ERROR
+	if (dec->json || (json_tokener_get_error(dec->tok) != json_tokener_continue)) dec->done = true;
+#else
+	if (dec->json || (dec->tok->err != json_tokener_continue)) dec->done = true;
+#endif
+}
+
 /** Converts JSON response into fr_pair_ts and adds them to the request.
  *
  * Converts the raw JSON string into a json-c object tree and passes it to
@@ -1181,6 +1241,9 @@ static int json_pair_alloc(rlm_rest_t const *instance, rlm_rest_section_t const
  * which decrements the reference count of the root node by one, and frees
  * the entire tree.
  *
+ * If the tree was already built as the body was received, it's used
+ * directly.
+ *
  * @see rest_encode_json
  * @see json_pair_alloc
  *
@@ -1195,8 +1258,10 @@ static int json_pair_alloc(rlm_rest_t const *instance, rlm_rest_section_t const
  *	- -1 on unrecoverable error.
  */
 static int rest_decode_json(rlm_rest_t const *instance, rlm_rest_section_t const *section,
-			    request_t *request, UNUSED fr_curl_io_request_t *randle, char *raw, UNUSED size_t rawlen)
+			    request_t *request, fr_curl_io_request_t *randle, char *raw, UNUSED size_t rawlen)
 {
+	rlm_rest_curl_context_t	*ctx = talloc_get_type_abort(randle->uctx, rlm_rest_curl_context_t);
+	rest_json_decoder_t	*dec = ctx->response.decoder;
 	char const *p = raw;
 
 	struct json_object *json;
@@ -1209,7 +1274,12 @@ static int rest_decode_json(rlm_rest_t const *instance, rlm_rest_section_t const
 	fr_skip_whitespace(p);
 	if (*p == '\0') return 0;
 
-	json = json_tokener_parse(p);
+	if (dec && dec->json) {
+		json = dec->json;
+		dec->json = NULL;
+	} else {
+		json = json_tokener_parse(p);
+	}
 	if (!json) {
 		REDEBUG("Malformed JSON data \"%s\"", raw);
 		return -1;
@@ -1523,6 +1593,10 @@ static size_t rest_response_body(void *in, size_t size, size_t nmemb, void *user
 		out_p += (end - p);
 		*out_p = '\0';
 		ctx->used += (end - p);
+
+#ifdef HAVE_JSON
+		if (ctx->type == REST_HTTP_BODY_JSON) rest_decode_json_chunk(ctx, p, end - p);
+#endif
 	}
 		break;
 	}
@@ -1607,6 +1681,7 @@ static void rest_response_init(rlm_rest_section_t const *section,
 	ctx->code = 0;
 	ctx->header = header;
 	TALLOC_FREE(ctx->buffer);
+	TALLOC_FREE(ctx->decoder);
 }
 
 /** Extracts pointer to buffer containing response data
@@ -83,6 +83,13 @@ static fr_table_num_sorted_t const http_negotiation_table[] = {
 									///< libcurl will fall back to HTTP 1.1 if HTTP 2
 									///< can't be negotiated with the HTTPS server.
 									///< For clear text HTTP servers, libcurl will use 1.1.
+#endif
+#if CURL_AT_LEAST_VERSION(7,88,0)
+	{ L("3.0"),		CURL_HTTP_VERSION_3ONLY },		//!< Enforce HTTP 3 requests.
+#endif
+#if CURL_AT_LEAST_VERSION(7,66,0)
+	{ L("3.0+auto"),	CURL_HTTP_VERSION_3 },			//!< Attempt HTTP 3 requests. libcurl will fall back
+									///< to earlier versions if HTTP 3 can't be used.
 #endif
 	{ L("default"), 	CURL_HTTP_VERSION_NONE }		//!< We don't care about what version the library uses.
 									///< libcurl will use whatever it thinks fit.
@@ -1390,6 +1397,7 @@ module_rlm_t rlm_rest = {
 	.common = {
 		.magic			= MODULE_MAGIC_INIT,
 		.name			= "rest",
+		.flags			= MODULE_TYPE_INSTANTIATE_PARALLEL,
 		.inst_size		= sizeof(rlm_rest_t),
 		.thread_inst_size	= sizeof(rlm_rest_thread_t),
 		.config			= module_config,
@@ -102,37 +102,40 @@ static void _sigtran_pipe_error(UNUSED fr_event_list_t *el, int fd, UNUSED int f
 	fr_assert(0);
 }
 
-/** Drain any data we received
+/** Read the responses from the osmocom thread
  *
- * We don't care about this data, we just don't want the kernel to
- * signal the other side that our read buffer's full.
+ * The osmocom thread may have completed several transactions since
+ * we were last woken up, so read as many as we can at once.
  */
 static void _sigtran_pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *uctx)
 {
 	ssize_t			len;
-	void			*ptr;
+	void			*ptrs[64];
+	size_t			i;
 	sigtran_transaction_t	*txn;
 
-	len = read(fd, &ptr, sizeof(ptr));
+	len = read(fd, ptrs, sizeof(ptrs));
 	if (len < 0) {
 		ERROR("worker - ctrl_pipe (%i) read failed : %s", fd, fr_syserror(errno));
 		return;
 	}
 
-	if (len != sizeof(ptr)) {
-		ERROR("worker - ctrl_pipe (%i) data too short, expected %zu bytes, got %zi bytes",
-		      fd, sizeof(ptr), len);
+	if ((len == 0) || ((len % sizeof(ptrs[0])) != 0)) {
+		ERROR("worker - ctrl_pipe (%i) data too short, expected a multiple of %zu bytes, got %zi bytes",
+		      fd, sizeof(ptrs[0]), len);
 		return;
 	}
 
-	/*
-	 *	Check talloc header is still OK
-	 */
-	txn = talloc_get_type_abort(ptr, sigtran_transaction_t);
-	if (txn->ctx.defunct) return;		/* Request was stopped */
+	for (i = 0; i < (len / sizeof(ptrs[0])); i++) {
+		/*
+		 *	Check talloc header is still OK
+		 */
+		txn = talloc_get_type_abort(ptrs[i], sigtran_transaction_t);
+		if (txn->ctx.defunct) continue;		/* Request was stopped */
 
-	fr_assert(txn->ctx.request);
-	unlang_interpret_mark_runnable(txn->ctx.request);	/* Continue processing */
+		fr_assert(txn->ctx.request);
+		unlang_interpret_mark_runnable(txn->ctx.request);	/* Continue processing */
+	}
 }
 
 /** Called by a new thread to register a new req_pipe
@@ -329,56 +329,24 @@ int sigtran_event_submit(struct osmo_fd *ofd, sigtran_transaction_t *txn)
 	return 0;
 }
 
-/** Processes a request for a new pipe from a worker thread
+/** Maximum number of transactions read from a pipe at once
  *
- * @param ofd	for the main ctrl_pipe.
- * @param what	happened.
- * @return
- *	- 0 on success, with pointer written to registration pipe for new osmo_fd.
- *	- -1 on error, with NULL pointer written to registration pipe.
  */
-static int event_process_request(struct osmo_fd *ofd, unsigned int what)
-{
-	sigtran_transaction_t	*txn;
-
-	void			*ptr;
-	ssize_t			len;
-
-	if (what & BSC_FD_EXCEPT) {
-		ERROR("pipe (%i) closed by osmocom thread, event thread exiting", ofd->fd);
-		do_exit = true;
-		return -1;
-	}
-
-	if (!(what & BSC_FD_READ)) return 0;
-
-	len = read(ofd->fd, &ptr, sizeof(ptr));
-	if (len < 0) {
-		ERROR("osmocom thread - Failed reading from pipe (%i): %s", ofd->fd, fr_syserror(errno));
-		return -1;
-	}
-	if (len == 0) {
-		DEBUG4("Ignoring zero length read");
-		return 0;
-	}
-	if (len != sizeof(ptr)) {
-		ERROR("osmocom thread - Failed reading data from pipe (%i): Too short, "
-		      "expected %zu bytes, got %zu bytes", ofd->fd, sizeof(ptr), len);
-		ptr = NULL;
-
-		if (sigtran_event_submit(ofd, NULL) < 0) {
-		fatal_error:
-			DEBUG3("Event loop will exit");
-			do_exit = true;
-			return -1;
-		}
-
-		return -1;
-	}
+#define SIGTRAN_BATCH_MAX	(64)
 
-	DEBUG3("osmocom thread - Read %zu bytes from pipe %i (%p)", len, ofd->fd, ptr);
+static int event_process_request(struct osmo_fd *ofd, unsigned int what);
 
-	txn = talloc_get_type_abort(ptr, sigtran_transaction_t);
+/** Process one transaction received from a worker, or on the ctrl_pipe
+ *
+ * @param ofd	the transaction was received on.
+ * @param txn	to process.
+ * @return
+ *	- 1 if ofd was freed.  No more transactions may be read from it.
+ *	- 0 on success.
+ *	- -1 on fatal error.  The event loop will exit.
+ */
+static int event_process_txn(struct osmo_fd *ofd, sigtran_transaction_t *txn)
+{
 	txn->ctx.ofd = ofd;
 	switch (txn->request.type) {
 	case SIGTRAN_REQUEST_THREAD_REGISTER:
@@ -403,9 +371,9 @@ static int event_process_request(struct osmo_fd *ofd, unsigned int what)
 		DEBUG3("osmocom thread - Deregistering req_pipe (%i).  Signalled by worker", ofd->fd);
 		txn->response.type = SIGTRAN_RESPONSE_OK;
 
-		if (sigtran_event_submit(ofd, txn) < 0) goto fatal_error;
+		if (sigtran_event_submit(ofd, txn) < 0) return -1;
 		talloc_free(ofd);	/* Ordering is important */
-		return 0;
+		return 1;
 
 	case SIGTRAN_REQUEST_LINK_UP:
 		DEBUG3("osmocom thread - Bringing link up");
@@ -443,9 +411,9 @@ static int event_process_request(struct osmo_fd *ofd, unsigned int what)
 		do_exit = true;
 		txn->response.type = SIGTRAN_RESPONSE_OK;
 
-		if (sigtran_event_submit(ofd, txn) < 0) goto fatal_error;
+		if (sigtran_event_submit(ofd, txn) < 0) return -1;
 		talloc_free(ofd);	/* Ordering is important */
-		return 0;
+		return 1;
 
 #ifndef NDEBUG
 	case SIGTRAN_REQUEST_TEST:
@@ -455,10 +423,85 @@ static int event_process_request(struct osmo_fd *ofd, unsigned int what)
 
 	default:
 		fr_assert(0);
-		goto fatal_error;
+		return -1;
+	}
+
+	if (sigtran_event_submit(ofd, txn) < 0) return -1;
+
+	return 0;
+}
+
+/** Processes requests from a worker thread, or from the ctrl_pipe
+ *
+ * Workers may have written several transactions since we were last
+ * woken up, so we read as many as we can, up to #SIGTRAN_BATCH_MAX,
+ * with a single read.
+ *
+ * @param ofd	the pipe which is readable.
+ * @param what	happened.
+ * @return
+ *	- 0 on success, with pointer written to registration pipe for new osmo_fd.
+ *	- -1 on error, with NULL pointer written to registration pipe.
+ */
+static int event_process_request(struct osmo_fd *ofd, unsigned int what)
+{
+	void			*ptrs[SIGTRAN_BATCH_MAX];
+	ssize_t			len;
+	size_t			i, num;
+
+	if (what & BSC_FD_EXCEPT) {
+		ERROR("pipe (%i) closed by osmocom thread, event thread exiting", ofd->fd);
+		do_exit = true;
+		return -1;
+	}
+
+	if (!(what & BSC_FD_READ)) return 0;
+
+	len = read(ofd->fd, ptrs, sizeof(ptrs));
+	if (len < 0) {
+		ERROR("osmocom thread - Failed reading from pipe (%i): %s", ofd->fd, fr_syserror(errno));
+		return -1;
 	}
+	if (len == 0) {
+		DEBUG4("Ignoring zero length read");
+		return 0;
+	}
+	if ((len % sizeof(ptrs[0])) != 0) {
+		ERROR("osmocom thread - Failed reading data from pipe (%i): Too short, "
+		      "expected a multiple of %zu bytes, got %zu bytes", ofd->fd, sizeof(ptrs[0]), len);
+
+		if (sigtran_event_submit(ofd, NULL) < 0) {
+		fatal_error:
+			DEBUG3("Event loop will exit");
+			do_exit = true;
+			return -1;
+		}
 
-	if (sigtran_event_submit(ofd, txn) < 0) goto fatal_error;
+		return -1;
+	}
+
+	num = len / sizeof(ptrs[0]);
+
+	DEBUG3("osmocom thread - Read %zu transaction(s) from pipe %i", num, ofd->fd);
+
+	for (i = 0; i < num; i++) {
+		switch (event_process_txn(ofd, talloc_get_type_abort(ptrs[i], sigtran_transaction_t))) {
+		case 0:
+			break;
+
+		case 1:
+			/*
+			 *	The pipe has been closed.  Nothing
+			 *	should have been written after the
+			 *	request to close it.
+			 */
+			fr_assert(i == (num - 1));
+			return 0;
+
+		default:
+			goto fatal_error;
+		}
+	}
 
 	return 0;
 }
@@ -36,7 +36,11 @@
 #define LOG_PREFIX "sql - cassandra"
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+
+#include <ctype.h>
 
 #ifdef HAVE_WDOCUMENTATION
 DIAG_OFF(documentation)
@@ -51,6 +55,20 @@ DIAG_ON(documentation)
 #include "rlm_sql.h"
 #include "rlm_sql_trunk.h"
 
+/** Most statements we'll put in an unlogged batch
+ *
+ * Cassandra warns about batches larger than 5KB by default, so
+ * there's no point going much larger than this.
+ */
+#define CASSANDRA_MAX_BATCH_SIZE	64
+
+/** Most queries a connection may have in flight
+ *
+ * Completed futures are handed back to the worker over a pipe, one pointer
+ * each, and the IO threads must never block writing to it.
+ */
+#define CASSANDRA_MAX_PIPELINE_DEPTH	1024
+
 typedef struct {
 	bool			done_connect_keyspace;		//!< Whether we've connected to a keyspace.
 	pthread_mutex_t		connect_mutex;			//!< Mutex to prevent multiple connections attempting
@@ -127,8 +145,25 @@ typedef struct {
 	char const		*tls_private_key_password;	//!< String to decrypt private key.
 	char const 		*tls_verify_cert_str;		//!< Whether we validate the cert provided by the
 								//!< server.
+
+	uint32_t		pipeline_depth;			//!< Maximum number of queries in flight per connection.
+	uint32_t		page_size;			//!< Number of rows to fetch per page of a result.
+	bool			prepare_statements;		//!< Whether queries are sent as prepared statements.
+	uint32_t		max_statements;			//!< Maximum number of statements prepared per connection.
+	bool			batch_writes;			//!< Whether writes are sent in unlogged batches.
+	uint32_t		max_batch_size;			//!< Maximum number of writes in a batch.
 } rlm_sql_cassandra_t;
 
+/** A statement prepared by a connection
+ *
+ */
+typedef struct {
+	char const		*text;				//!< Parameterized query.
+	CassPrepared const	*prepared;			//!< NULL until the statement has been prepared.
+	bool			failed;				//!< Preparing the statement failed, so queries of this
+								///< form are always sent as text.
+} cassandra_stmt_t;
+
 /** Cassandra cluster connection
  *
  */
@@ -136,23 +171,28 @@ typedef struct {
 	connection_t		*conn;				//!< Generic connection structure for managing this handle.
 	rlm_sql_cassandra_t const	*inst;			//!< Module instance for this connection.
 	rlm_sql_config_t const	*config;			//!< SQL instance config
-	CassIterator		*iterator;			//!< Row set iterator.
 
 	TALLOC_CTX		*log_ctx;			//!< Prevent unneeded memory allocation by keeping a
 								//!< permanent pool, to store log entries.
 	fr_dlist_head_t		queries;			//!< Outstanding queries on this connection.
-	fr_event_timer_t const	*read_ev;			//!< Polling event for reading query results.
-	fr_event_timer_t const	*write_ev;			//!< Polling event for sending queries.
-	uint			poll_interval;			//!< Interval between read polling.
-	uint			poll_count;			//!< How many consecutive polls had no available results.
+	fr_event_list_t		*el;				//!< pipe[0] is inserted into.
+	int			pipe[2];			//!< Futures are returned on once they're set.
+	fr_event_timer_t const	*write_ev;			//!< Event for sending queries.
+	fr_hash_table_t		*statements;			//!< Statements prepared by this connection, by text.
 } rlm_sql_cassandra_conn_t;
 
-/** Structure for tracking outstanding queries
+/** Structure for tracking outstanding futures
  *
+ * There's one of these for each future which hasn't been set yet.
  */
 typedef struct {
 	fr_dlist_t		entry;				//!< Entry in list of outstanding queries.
-	fr_sql_query_t		*query_ctx;			//!< SQL query ctx.
+	rlm_sql_cassandra_conn_t	*conn;			//!< Connection the future is returned to.
+	fr_sql_query_t		**query_ctx;			//!< SQL query ctxs waiting on the future.  More than one
+								///< for a batch, none if a statement is being prepared.
+								///< Set to NULL if the query is cancelled.
+	CassStatement		*statement;			//!< Kept to fetch further pages of the result.
+	cassandra_stmt_t	*preparing;			//!< Statement being prepared.
 	CassFuture		*future;			//!< Future produced when submitting query.
 } cassandra_query_t;
 
@@ -160,7 +200,9 @@ typedef struct {
  *
  */
 typedef struct {
-	CassResult const	*result;			//!< Cassandra result handle
+	CassResult const	**results;			//!< Cassandra result handles, one per page.
+	size_t			page;				//!< Page rows are being fetched from.
+	CassIterator		*iterator;			//!< Row iterator for the current page.
 	sql_log_entry_t		error;				//!< Most recent Cassandra error message for this query.
 } cassandra_query_ctx_t;
 
@@ -232,6 +274,13 @@ static const conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET("tcp_nodelay", rlm_sql_cassandra_t, tcp_nodelay), .dflt = "no" },
 
 	{ FR_CONF_POINTER("tls", 0, CONF_FLAG_SUBSECTION | CONF_FLAG_OK_MISSING, NULL), .subcs = (void const *) tls_config },
+
+	{ FR_CONF_OFFSET("pipeline_depth", rlm_sql_cassandra_t, pipeline_depth), .dflt = "256" },
+	{ FR_CONF_OFFSET("page_size", rlm_sql_cassandra_t, page_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("prepare_statements", rlm_sql_cassandra_t, prepare_statements), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_statements", rlm_sql_cassandra_t, max_statements), .dflt = "64" },
+	{ FR_CONF_OFFSET("batch_writes", rlm_sql_cassandra_t, batch_writes), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_batch_size", rlm_sql_cassandra_t, max_batch_size), .dflt = "16" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -327,13 +376,573 @@ static void sql_set_query_error_printf(TALLOC_CTX *ctx, cassandra_query_ctx_t *c
 	cass_query_ctx->error.type = L_ERR;
 }
 
+static uint32_t sql_stmt_hash(void const *data)
+{
+	cassandra_stmt_t const *stmt = data;
+
+	return fr_hash_string(stmt->text);
+}
+
+static int8_t sql_stmt_cmp(void const *one, void const *two)
+{
+	cassandra_stmt_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->text, b->text), 0);
+}
+
+static int _sql_stmt_free(cassandra_stmt_t *stmt)
+{
+	if (stmt->prepared) cass_prepared_free(stmt->prepared);
+
+	return 0;
+}
+
+static int _sql_query_free(cassandra_query_t *cass_query)
+{
+	if (cass_query->future) cass_future_free(cass_query->future);
+	if (cass_query->statement) cass_statement_free(cass_query->statement);
+
+	return 0;
+}
+
+static void sql_results_free(cassandra_query_ctx_t *cass_query_ctx)
+{
+	size_t i;
+
+	if (cass_query_ctx->iterator) {
+		cass_iterator_free(cass_query_ctx->iterator);
+		cass_query_ctx->iterator = NULL;
+	}
+
+	for (i = 0; i < talloc_array_length(cass_query_ctx->results); i++) cass_result_free(cass_query_ctx->results[i]);
+	TALLOC_FREE(cass_query_ctx->results);
+	cass_query_ctx->page = 0;
+}
+
+static int _sql_query_ctx_free(cassandra_query_ctx_t *cass_query_ctx)
+{
+	sql_results_free(cass_query_ctx);
+
+	return 0;
+}
+
+static inline CC_HINT(always_inline) bool sql_is_ident_char(char c)
+{
+	return isalnum((uint8_t)c) || (c == '_');
+}
+
+/** Replace the string and numeric literals in a query with bind markers
+ *
+ * Queries are built by expanding attributes into a template, so the same template
+ * always produces the same text once the expanded values are taken out.  That text
+ * can be prepared once per connection, and executed with the values bound to it.
+ *
+ * Numbers which are part of a larger token, such as the groups of a UUID, or the
+ * digits of a blob, are left alone.  Queries containing bind markers, comments, or
+ * dollar quoted strings are sent as text.
+ *
+ * @param[in] ctx	to allocate the text and parameters in.
+ * @param[out] text_out	The query with literals replaced by ?.
+ * @param[out] params_out	The unquoted values of the literals.
+ * @param[in] query	to parameterize.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the query should be sent as is.
+ */
+static int sql_query_parameterize(TALLOC_CTX *ctx, char **text_out, char ***params_out, char const *query)
+{
+	char const	*p = query, *start = query, *q, *seg;
+	char		*text, *value;
+	char		**params;
+	size_t		num = 0;
+
+	MEM(text = talloc_strdup(ctx, ""));
+	MEM(params = talloc_array(ctx, char *, 0));
+
+	while (*p) {
+		switch (*p) {
+		case '?':
+		case ':':
+		case '$':
+		error:
+			talloc_free(text);
+			talloc_free(params);
+			return -1;
+
+		case '-':
+			if (p[1] == '-') goto error;
+			p++;
+			continue;
+
+		case '/':
+			if ((p[1] == '*') || (p[1] == '/')) goto error;
+			p++;
+			continue;
+
+		/*
+		 *	Quoted identifier, skip over it.
+		 */
+		case '"':
+			q = strchr(p + 1, '"');
+			if (!q) goto error;
+			p = q + 1;
+			continue;
+
+		case '\'':
+			MEM(value = talloc_strdup(params, ""));
+			for (seg = q = p + 1; ; q++) {
+				if (!*q) goto error;
+				if (*q != '\'') continue;
+				if (q[1] != '\'') break;
+
+				/*
+				 *	'' is an escaped quote, keep one of them
+				 */
+				q++;
+				MEM(value = talloc_strndup_append_buffer(value, seg, q - seg));
+				seg = q + 1;
+			}
+			MEM(value = talloc_strndup_append_buffer(value, seg, q - seg));
+			q++;
+			break;
+
+		default:
+			if (!isdigit((uint8_t)*p) ||
+			    ((p > query) && (sql_is_ident_char(p[-1]) || (p[-1] == '.') || (p[-1] == '-')))) {
+				p++;
+				continue;
+			}
+
+			for (q = p; isdigit((uint8_t)*q) || (*q == '.'); q++);
+
+			/*
+			 *	Exponents, UUIDs, blobs and other oddities
+			 */
+			if (sql_is_ident_char(*q) || (*q == '-')) {
+				p = q;
+				continue;
+			}
+			MEM(value = talloc_strndup(params, p, q - p));
+			break;
+		}
+
+		/*
+		 *	Literal is between p and q
+		 */
+		MEM(params = talloc_realloc(ctx, params, char *, num + 1));
+		params[num++] = value;
+		MEM(text = talloc_strndup_append_buffer(text, start, p - start));
+		MEM(text = talloc_strdup_append_buffer(text, "?"));
+		p = start = q;
+	}
+
+	if (num == 0) goto error;
+
+	MEM(text = talloc_strndup_append_buffer(text, start, p - start));
+
+	*text_out = text;
+	*params_out = params;
+
+	return 0;
+}
+
+static inline CC_HINT(always_inline) int sql_param_to_int64(int64_t *out, char const *value)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtoll(value, &end, 10);
+	if ((end == value) || *end || errno) return -1;
+
+	return 0;
+}
+
+/** Bind the parameters of a query to a prepared statement
+ *
+ * Parameters are converted to the types the server expects.
+ *
+ * @param[in] statement	bound to the prepared statement.
+ * @param[in] prepared	statement, holding the types of the parameters.
+ * @param[in] params	as produced by #sql_query_parameterize.
+ * @return
+ *	- 0 on success.
+ *	- -1 if a parameter couldn't be converted, and the query should be sent as text.
+ */
+static int sql_statement_bind(CassStatement *statement, CassPrepared const *prepared, char **params)
+{
+	size_t i;
+
+	for (i = 0; i < talloc_array_length(params); i++) {
+		CassDataType const	*type = cass_prepared_parameter_data_type(prepared, i);
+		char const		*value = params[i];
+		char			*end;
+		int64_t			i64;
+		double			d;
+		CassUuid		uuid;
+		CassInet		inet;
+		CassError		ret;
+
+		if (!type) return -1;
+
+		switch (cass_data_type_type(type)) {
+		case CASS_VALUE_TYPE_ASCII:
+		case CASS_VALUE_TYPE_TEXT:
+		case CASS_VALUE_TYPE_VARCHAR:
+			ret = cass_statement_bind_string(statement, i, value);
+			break;
+
+		case CASS_VALUE_TYPE_INT:
+			if ((sql_param_to_int64(&i64, value) < 0) || (i64 < INT32_MIN) || (i64 > INT32_MAX)) return -1;
+			ret = cass_statement_bind_int32(statement, i, (cass_int32_t)i64);
+			break;
+
+		case CASS_VALUE_TYPE_BIGINT:
+		case CASS_VALUE_TYPE_COUNTER:
+		case CASS_VALUE_TYPE_TIMESTAMP:
+			if (sql_param_to_int64(&i64, value) < 0) return -1;
+			ret = cass_statement_bind_int64(statement, i, (cass_int64_t)i64);
+			break;
+
+		case CASS_VALUE_TYPE_FLOAT:
+		case CASS_VALUE_TYPE_DOUBLE:
+			errno = 0;
+			d = strtod(value, &end);
+			if ((end == value) || *end || errno) return -1;
+			if (cass_data_type_type(type) == CASS_VALUE_TYPE_FLOAT) {
+				ret = cass_statement_bind_float(statement, i, (cass_float_t)d);
+			} else {
+				ret = cass_statement_bind_double(statement, i, (cass_double_t)d);
+			}
+			break;
+
+		case CASS_VALUE_TYPE_UUID:
+		case CASS_VALUE_TYPE_TIMEUUID:
+			if (cass_uuid_from_string(value, &uuid) != CASS_OK) return -1;
+			ret = cass_statement_bind_uuid(statement, i, uuid);
+			break;
+
+		case CASS_VALUE_TYPE_INET:
+			if (cass_inet_from_string(value, &inet) != CASS_OK) return -1;
+			ret = cass_statement_bind_inet(statement, i, inet);
+			break;
+
+		default:
+			return -1;
+		}
+
+		if (ret != CASS_OK) return -1;
+	}
+
+	return 0;
+}
+
+/** Called by a libcassandra IO thread when a future is set
+ *
+ * Retrieving the error status of a future from its callback locks up, so
+ * the future is handed back to the worker which sent it, and dealt with
+ * in #sql_future_read.  Writes of a pointer to a pipe are atomic.
+ */
+static void _sql_future_set(UNUSED CassFuture *future, void *data)
+{
+	cassandra_query_t *cass_query = data;
+
+	while ((write(cass_query->conn->pipe[1], &cass_query, sizeof(cass_query)) < 0) && (errno == EINTR));
+}
+
+static void sql_future_send(rlm_sql_cassandra_conn_t *c, cassandra_query_t *cass_query, CassFuture *future)
+{
+	cass_query->future = future;
+	if (!fr_dlist_entry_in_list(&cass_query->entry)) fr_dlist_insert_tail(&c->queries, cass_query);
+
+	(void) cass_future_set_callback(future, _sql_future_set, cass_query);
+}
+
+static cassandra_query_t *sql_query_alloc(rlm_sql_cassandra_conn_t *c, fr_sql_query_t **query_ctx, size_t num)
+{
+	cassandra_query_t *cass_query;
+
+	MEM(cass_query = talloc_zero(c, cassandra_query_t));
+	cass_query->conn = c;
+	MEM(cass_query->query_ctx = talloc_array(cass_query, fr_sql_query_t *, num));
+	if (num > 0) memcpy(cass_query->query_ctx, query_ctx, sizeof(*query_ctx) * num);
+	talloc_set_destructor(cass_query, _sql_query_free);
+
+	return cass_query;
+}
+
+/** Find the prepared statement for a parameterized query
+ *
+ * The first time a query of a particular form is seen on a connection,
+ * the statement is prepared in the background, and the query is sent
+ * as text.  Later queries use the statement once it has been prepared.
+ *
+ * @param[in] c		to find the statement on.
+ * @param[in] text	Parameterized query.  Always consumed.
+ * @return
+ *	- The prepared statement.
+ *	- NULL if the query should be sent as text.
+ */
+static CassPrepared const *sql_stmt_find(rlm_sql_cassandra_conn_t *c, char *text)
+{
+	cassandra_stmt_t	find, *stmt;
+	cassandra_query_t	*cass_query;
+
+	find.text = text;
+	stmt = fr_hash_table_find(c->statements, &find);
+	if (stmt) {
+		talloc_free(text);
+		return stmt->prepared;
+	}
+
+	if (fr_hash_table_num_elements(c->statements) >= c->inst->max_statements) {
+		talloc_free(text);
+		return NULL;
+	}
+
+	MEM(stmt = talloc_zero(c->statements, cassandra_stmt_t));
+	stmt->text = talloc_steal(stmt, text);
+	talloc_set_destructor(stmt, _sql_stmt_free);
+	if (!fr_hash_table_insert(c->statements, stmt)) {
+		talloc_free(stmt);
+		return NULL;
+	}
+
+	DEBUG3("Preparing statement: %s", stmt->text);
+	cass_query = sql_query_alloc(c, NULL, 0);
+	cass_query->preparing = stmt;
+	sql_future_send(c, cass_query, cass_session_prepare_n(c->inst->session, stmt->text,
+							      talloc_array_length(stmt->text) - 1));
+
+	return NULL;
+}
+
+/** Create the statement for a query, bound to a prepared statement if possible
+ *
+ */
+static CassStatement *sql_statement_alloc(rlm_sql_cassandra_conn_t *c, fr_sql_query_t *query_ctx)
+{
+	rlm_sql_cassandra_t const	*inst = c->inst;
+	request_t			*request = query_ctx->request;
+	CassStatement			*statement = NULL;
+	CassPrepared const		*prepared;
+	char				*text;
+	char				**params;
+
+	if (inst->prepare_statements &&
+	    (sql_query_parameterize(query_ctx, &text, &params, query_ctx->query_str) == 0)) {
+		prepared = sql_stmt_find(c, text);
+		if (prepared) {
+			statement = cass_prepared_bind(prepared);
+			if (sql_statement_bind(statement, prepared, params) < 0) {
+				cass_statement_free(statement);
+				statement = NULL;
+			} else {
+				ROPTIONAL(RDEBUG3, DEBUG3, "Executing prepared statement");
+			}
+		}
+		talloc_free(params);
+	}
+
+	if (!statement) statement = cass_statement_new_n(query_ctx->query_str,
+							 talloc_array_length(query_ctx->query_str) - 1, 0);
+
+	if (inst->consistency_str) cass_statement_set_consistency(statement, inst->consistency);
+	if (inst->page_size) cass_statement_set_paging_size(statement, inst->page_size);
+
+	return statement;
+}
+
+/** Whether a query can be sent in an unlogged batch
+ *
+ * Only plain INSERT, UPDATE and DELETE statements can go in a batch.  Queries
+ * which are batches already, or are conditional (lightweight transactions can't
+ * span partitions), are sent on their own.
+ */
+static bool sql_query_batchable(fr_sql_query_t const *query_ctx)
+{
+	char const *p = query_ctx->query_str;
+
+	if (query_ctx->type != SQL_QUERY_OTHER) return false;
+
+	fr_skip_whitespace(p);
+	if ((strncasecmp(p, "INSERT", 6) != 0) &&
+	    (strncasecmp(p, "UPDATE", 6) != 0) &&
+	    (strncasecmp(p, "DELETE", 6) != 0)) return false;
+
+	return (strcasestr(p, " IF ") == NULL);
+}
+
+/** Send a single query, or several writes in an unlogged batch
+ *
+ * Statements are consumed.
+ */
+static void sql_query_send(rlm_sql_cassandra_conn_t *c, fr_sql_query_t **query_ctx,
+			   CassStatement **statements, size_t num)
+{
+	rlm_sql_cassandra_t const	*inst = c->inst;
+	cassandra_query_t		*cass_query;
+	CassBatch			*batch;
+	size_t				i;
+
+	cass_query = sql_query_alloc(c, query_ctx, num);
+
+	/*
+	 *	The statement is kept so further pages of the
+	 *	result can be fetched with it.
+	 */
+	if (num == 1) {
+		cass_query->statement = statements[0];
+		sql_future_send(c, cass_query, cass_session_execute(inst->session, cass_query->statement));
+		return;
+	}
+
+	DEBUG3("Sending %zu writes in an unlogged batch", num);
+
+	batch = cass_batch_new(CASS_BATCH_TYPE_UNLOGGED);
+	if (inst->consistency_str) cass_batch_set_consistency(batch, inst->consistency);
+	for (i = 0; i < num; i++) {
+		cass_batch_add_statement(batch, statements[i]);
+		cass_statement_free(statements[i]);	/* The batch holds a reference */
+	}
+	sql_future_send(c, cass_query, cass_session_execute_batch(inst->session, batch));
+	cass_batch_free(batch);
+}
+
+/** Process a future which has been set
+ *
+ */
+static void sql_future_done(rlm_sql_cassandra_conn_t *c, cassandra_query_t *cass_query)
+{
+	rlm_sql_cassandra_t const	*inst = c->inst;
+	CassFuture			*future = cass_query->future;
+	CassResult const		*result;
+	fr_sql_query_t			*query_ctx;
+	cassandra_query_ctx_t		*cass_query_ctx;
+	request_t			*request;
+	CassError			ret;
+	size_t				i, num = talloc_array_length(cass_query->query_ctx);
+
+	cass_query->future = NULL;
+	ret = cass_future_error_code(future);
+
+	if (cass_query->preparing) {
+		if (ret != CASS_OK) {
+			char const	*error;
+			size_t		len;
+
+			cass_future_error_message(future, &error, &len);
+			DEBUG2("Failed preparing statement, queries of this form will be sent as text: %.*s",
+			       (int)len, error);
+		} else {
+			cass_query->preparing->prepared = cass_future_get_prepared(future);
+		}
+		goto done;
+	}
+
+	if (ret != CASS_OK) {
+		char const	*error;
+		size_t		len;
+
+		cass_future_error_message(future, &error, &len);
+
+		for (i = 0; i < num; i++) {
+			query_ctx = cass_query->query_ctx[i];
+			if (!query_ctx) continue;
+
+			cass_query_ctx = talloc_get_type_abort(query_ctx->uctx, cassandra_query_ctx_t);
+			sql_set_query_error(c->log_ctx, cass_query_ctx, error, len);
+
+			switch (ret) {
+			case CASS_ERROR_SERVER_SYNTAX_ERROR:
+			case CASS_ERROR_SERVER_INVALID_QUERY:
+				query_ctx->rcode = RLM_SQL_QUERY_INVALID;
+				break;
+
+			default:
+				query_ctx->rcode = RLM_SQL_ERROR;
+			}
+			trunk_request_signal_fail(query_ctx->treq);
+		}
+		goto done;
+	}
+
+	/*
+	 *	Batches don't return rows.  Results of single queries
+	 *	are collected a page at a time, and the request is only
+	 *	resumed once we have all of them.
+	 */
+	query_ctx = (num == 1) ? cass_query->query_ctx[0] : NULL;
+	if (query_ctx && (result = cass_future_get_result(future))) {
+		cass_query_ctx = talloc_get_type_abort(query_ctx->uctx, cassandra_query_ctx_t);
+
+		i = talloc_array_length(cass_query_ctx->results);
+		MEM(cass_query_ctx->results = talloc_realloc(cass_query_ctx, cass_query_ctx->results,
+							     CassResult const *, i + 1));
+		cass_query_ctx->results[i] = result;
+
+		if (cass_result_has_more_pages(result)) {
+			request = query_ctx->request;
+			ROPTIONAL(RDEBUG3, DEBUG3, "Fetching page %zu of result", i + 2);
+
+			cass_future_free(future);
+			cass_statement_set_paging_state(cass_query->statement, result);
+			sql_future_send(c, cass_query, cass_session_execute(inst->session, cass_query->statement));
+			return;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		query_ctx = cass_query->query_ctx[i];
+		if (!query_ctx) continue;
+
+		query_ctx->rcode = RLM_SQL_OK;
+		query_ctx->status = SQL_QUERY_RETURNED;
+		if (query_ctx->request) unlang_interpret_mark_runnable(query_ctx->request);
+	}
+
+done:
+	cass_future_free(future);
+	fr_dlist_remove(&c->queries, cass_query);
+	talloc_free(cass_query);
+}
+
+static void sql_future_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_cassandra_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_cassandra_conn_t);
+	cassandra_query_t		*cass_query;
+
+	while (read(fd, &cass_query, sizeof(cass_query)) == sizeof(cass_query)) sql_future_done(c, cass_query);
+}
+
 static void _sql_connection_close(UNUSED fr_event_list_t *el, void *h, UNUSED void *uctx)
 {
-	rlm_sql_cassandra_conn_t *conn = talloc_get_type_abort(h, rlm_sql_cassandra_conn_t);
+	rlm_sql_cassandra_conn_t	*c = talloc_get_type_abort(h, rlm_sql_cassandra_conn_t);
+	cassandra_query_t		*cass_query;
 
 	DEBUG2("Socket destructor called, closing socket");
 
-	if (conn->iterator) cass_iterator_free(conn->iterator);
+	/*
+	 *	Futures can't be cancelled, so wait for the IO
+	 *	threads to hand back the outstanding ones, as
+	 *	they write to our pipe.
+	 */
+	if (c->pipe[0] >= 0) {
+		(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
+		(void) fr_blocking(c->pipe[0]);
+
+		while (fr_dlist_num_elements(&c->queries) > 0) {
+			if (read(c->pipe[0], &cass_query, sizeof(cass_query)) != sizeof(cass_query)) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			fr_dlist_remove(&c->queries, cass_query);
+			talloc_free(cass_query);
+		}
+
+		close(c->pipe[0]);
+		close(c->pipe[1]);
+	}
+
 	talloc_free(h);
 }
 
@@ -351,11 +960,10 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 		.inst = inst,
 		.config = config,
 		.log_ctx = talloc_pool(c, 2048),		/* Pre-allocate some memory for log messages */
-		.poll_interval = 1000
+		.el = conn->el,
+		.pipe = { -1, -1 }
 	};
 
-	*h = c;
-
 	/*
 	 *	We do this one inside sql_socket_init, to allow pool.start = 0 to
 	 *	work as expected (allow the server to start if Cassandra is
@@ -395,6 +1003,29 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 
 	fr_dlist_init(&c->queries, cassandra_query_t, entry);
 
+	if (pipe(c->pipe) < 0) {
+		ERROR("Failed creating pipe: %s", fr_syserror(errno));
+	error:
+		if (c->pipe[0] >= 0) {
+			close(c->pipe[0]);
+			close(c->pipe[1]);
+		}
+		talloc_free(c);
+		return CONNECTION_STATE_FAILED;
+	}
+	(void) fr_nonblock(c->pipe[0]);
+
+	if (fr_event_fd_insert(c, NULL, conn->el, c->pipe[0], sql_future_read, NULL, NULL, c) < 0) {
+		PERROR("Failed inserting pipe");
+		goto error;
+	}
+
+	if (inst->prepare_statements) {
+		MEM(c->statements = fr_hash_table_talloc_alloc(c, cassandra_stmt_t, sql_stmt_hash, sql_stmt_cmp, NULL));
+	}
+
+	*h = c;
+
 	return CONNECTION_STATE_CONNECTED;
 }
 
@@ -410,137 +1041,56 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 	trunk_request_t			*treq;
 	fr_sql_query_t			*query_ctx;
 	CassStatement			*statement;
-	cassandra_query_t		*cass_query;
 	cassandra_query_ctx_t		*cass_query_ctx;
+	fr_sql_query_t			*batch[CASSANDRA_MAX_BATCH_SIZE];
+	CassStatement			*batch_statements[CASSANDRA_MAX_BATCH_SIZE];
+	size_t				batch_len = 0;
 
 	while (trunk_connection_pop_request(&treq, tconn) == 0) {
-		if (!treq) return;
+		if (!treq) break;
 
 		query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
 		request = query_ctx->request;
 
-		switch (query_ctx->status) {
-		case SQL_QUERY_PREPARED:
-			ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
-			statement = cass_statement_new_n(query_ctx->query_str, talloc_array_length(query_ctx->query_str) - 1, 0);
-			if (inst->consistency_str) cass_statement_set_consistency(statement, inst->consistency);
-
-			/*
-			 *	Allocate tracking and driver specific structures.
-			 */
-			MEM(cass_query = talloc_zero(conn, cassandra_query_t));
-			MEM(cass_query_ctx = talloc_zero(query_ctx, cassandra_query_ctx_t));
-			query_ctx->uctx = cass_query_ctx;
-
-			/*
-			 *	Executing the query returns a future which will later be polled for its result.
-			 *	Failures are not visible at this point.
-			 */
-			cass_query->future = cass_session_execute(inst->session, statement);
-			cass_query->query_ctx = query_ctx;
-			cass_statement_free(statement);
-
-			/*
-			 *	Insert the tracking structure into the list of outstanding queries.
-			 */
-			fr_dlist_insert_tail(&sql_conn->queries, cass_query);
-			query_ctx->status = SQL_QUERY_SUBMITTED;
-			query_ctx->tconn = tconn;
-			trunk_request_signal_sent(treq);
-			return;
+		if (query_ctx->status != SQL_QUERY_PREPARED) break;
 
-		default:
-			return;
-		}
-	}
-}
-
-static void sql_trunk_connection_read_poll(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
-{
-	rlm_sql_cassandra_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_cassandra_conn_t);
-	cassandra_query_t		*cass_query, *next_query = NULL;
-	fr_sql_query_t			*query_ctx;
-	cassandra_query_ctx_t		*cass_query_ctx;
-	CassError			ret;
-	request_t			*request;
-	bool				handled = false;
+		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
 
-	next_query = fr_dlist_head(&c->queries);
-	while (next_query) {
 		/*
-		 *	If the future is not ready, move to the next.
+		 *	Allocate driver specific structures.
 		 */
-		if (!cass_future_ready(next_query->future)) goto next;
-
-		cass_query = next_query;
-		next_query = fr_dlist_remove(&c->queries, cass_query);
-
-		query_ctx = cass_query->query_ctx;
-		request = query_ctx->request;
-		handled = true;
-		cass_query_ctx = talloc_get_type_abort(query_ctx->uctx, cassandra_query_ctx_t);
-
-		ret = cass_future_error_code(cass_query->future);
-		if (ret != CASS_OK) {
-			char const	*error;
-			size_t		len;
+		MEM(cass_query_ctx = talloc_zero(query_ctx, cassandra_query_ctx_t));
+		talloc_set_destructor(cass_query_ctx, _sql_query_ctx_free);
+		query_ctx->uctx = cass_query_ctx;
 
-			cass_future_error_message(cass_query->future, &error, &len);
-			sql_set_query_error(c->log_ctx, cass_query_ctx, error, len);
+		statement = sql_statement_alloc(sql_conn, query_ctx);
 
-			switch (ret) {
-			case CASS_ERROR_SERVER_SYNTAX_ERROR:
-			case CASS_ERROR_SERVER_INVALID_QUERY:
-				query_ctx->rcode = RLM_SQL_QUERY_INVALID;
-				break;
+		/*
+		 *	Executing the query returns a future, which is handed
+		 *	back to us once it's set.  Failures are not visible
+		 *	at this point.
+		 */
+		query_ctx->status = SQL_QUERY_SUBMITTED;
+		query_ctx->tconn = tconn;
+		trunk_request_signal_sent(treq);
 
-			default:
-				query_ctx->rcode = RLM_SQL_ERROR;
-			}
-			trunk_request_signal_fail(query_ctx->treq);
-			cass_future_free(cass_query->future);
-			talloc_free(cass_query);
-			goto next;
+		if (!inst->batch_writes || !sql_query_batchable(query_ctx)) {
+			sql_query_send(sql_conn, &query_ctx, &statement, 1);
+			continue;
 		}
 
-		query_ctx->rcode = RLM_SQL_OK;
-		cass_query_ctx->result = cass_future_get_result(cass_query->future);
-		cass_future_free(cass_query->future);
-		if (request) unlang_interpret_mark_runnable(request);
-		talloc_free(cass_query);
-	next:
-		next_query = fr_dlist_next(&c->queries, next_query);
-	}
-
-	/*
-	 *	Adjust poll interval.  The aim is to return results as fast as
-	 *	possible, but without over polling.
-	 */
-	if (!handled) {
 		/*
-		 *	Nothing was ready - increase the interval
+		 *	Writes which are sent together go in the same batch.
 		 */
-		if (c->poll_interval < fr_time_delta_to_usec(c->config->query_timeout)/2) c->poll_interval += 100;
-		c->poll_count ++;
-	} else {
-		/*
-		 *	Results were immediately available - decrease the interval
-		 */
-		if (c->poll_count == 0) {
-			c->poll_interval /= 2;
+		batch[batch_len] = query_ctx;
+		batch_statements[batch_len++] = statement;
+		if (batch_len == inst->max_batch_size) {
+			sql_query_send(sql_conn, batch, batch_statements, batch_len);
+			batch_len = 0;
 		}
-		c->poll_count = 0;
 	}
 
-	/*
-	 *	There are still outstanding queries, add another polling event
-	 */
-	if (fr_dlist_num_elements(&c->queries)) {
-		if (fr_event_timer_in(c, el, &c->read_ev, fr_time_delta_from_usec(c->poll_interval),
-				      sql_trunk_connection_read_poll, c) < 0) {
-			ERROR("Unable to insert polling event");
-		}
-	}
+	if (batch_len > 0) sql_query_send(sql_conn, batch, batch_statements, batch_len);
 }
 
 static void sql_trunk_connection_write_poll(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
@@ -551,36 +1101,23 @@ static void sql_trunk_connection_write_poll(UNUSED fr_event_list_t *el, UNUSED f
 }
 
 /*
- *	While libcassandra support installing callbacks to handle futures being set,
- *	in testing, in the callback attempting to retrieve the error status of the
- *	future locked up.  So we have to resort to polling.
- *
- *	This "notify" callback sets up the appropriate polling events.
+ *	Futures are handed back over the connection's pipe, which is
+ *	always being read, so this only has to arrange for the trunk
+ *	to write when it wants to.
  */
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function */
-static void sql_trunk_connection_notify(UNUSED trunk_connection_t *tconn, connection_t *conn, UNUSED fr_event_list_t *el,
+static void sql_trunk_connection_notify(trunk_connection_t *tconn, connection_t *conn, fr_event_list_t *el,
 					trunk_connection_event_t notify_on, UNUSED void *uctx)
 {
 	rlm_sql_cassandra_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_cassandra_conn_t);
 
 	switch (notify_on) {
 	case TRUNK_CONN_EVENT_NONE:
-		if (c->read_ev) fr_event_timer_delete(&c->read_ev);
+	case TRUNK_CONN_EVENT_READ:
 		if (c->write_ev) fr_event_timer_delete(&c->write_ev);
 		return;
 
 	case TRUNK_CONN_EVENT_BOTH:
-	case TRUNK_CONN_EVENT_READ:
-		if (fr_dlist_num_elements(&c->queries)) {
-			if (fr_event_timer_in(c, el, &c->read_ev, fr_time_delta_from_usec(c->poll_interval),
-					      sql_trunk_connection_read_poll, c) < 0) {
-				ERROR("Unable to insert polling event");
-			}
-		}
-		if (notify_on == TRUNK_CONN_EVENT_READ) return;
-
-		FALL_THROUGH;
-
 	case TRUNK_CONN_EVENT_WRITE:
 		if (fr_event_timer_in(c, el, &c->write_ev, fr_time_delta_from_usec(0),
 				      sql_trunk_connection_write_poll, tconn) < 0) {
@@ -600,19 +1137,22 @@ static void sql_request_cancel(connection_t *conn, void *preq, trunk_cancel_reas
 	fr_sql_query_t			*query_ctx = talloc_get_type_abort(preq, fr_sql_query_t);
 	rlm_sql_cassandra_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_cassandra_conn_t);
 	cassandra_query_t		*cass_query = NULL;
+	size_t				i;
 
 	if (!query_ctx->treq) return;
 	if (reason != TRUNK_CANCEL_REASON_SIGNAL) return;
 
 	/*
 	 *	There is no query cancellation for Cassandra.
-	 *	So, remove the query from the list of outstanding queries so
-	 *	if it does return, we don't do anything.
+	 *	So, forget the query ctx, so if the query does
+	 *	return, we don't do anything with the result.
+	 *	The future is freed when it's handed back.
 	 */
 	while ((cass_query = fr_dlist_next(&sql_conn->queries, cass_query))) {
-		if (cass_query->query_ctx == query_ctx) {
-			fr_dlist_remove(&sql_conn->queries, cass_query);
-			cass_future_free(cass_query->future);
+		for (i = 0; i < talloc_array_length(cass_query->query_ctx); i++) {
+			if (cass_query->query_ctx[i] != query_ctx) continue;
+
+			cass_query->query_ctx[i] = NULL;
 			return;
 		}
 	}
@@ -621,14 +1161,20 @@ static void sql_request_cancel(connection_t *conn, void *preq, trunk_cancel_reas
 static int sql_num_rows(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
 	cassandra_query_ctx_t	*cass_query_ctx = query_ctx->uctx;
+	size_t			i;
+	int			rows = 0;
+
+	for (i = 0; i < talloc_array_length(cass_query_ctx->results); i++) {
+		rows += cass_result_row_count(cass_query_ctx->results[i]);
+	}
 
-	return cass_query_ctx->result ? cass_result_row_count(cass_query_ctx->result) : 0;
+	return rows;
 }
 
 static sql_rcode_t sql_fields(char const **out[], fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
 	cassandra_query_ctx_t	*cass_query_ctx = query_ctx->uctx;
-	CassResult const	*result = cass_query_ctx->result;
+	CassResult const	*result = cass_query_ctx->results ? cass_query_ctx->results[0] : NULL;
 
 	unsigned int	fields, i;
 	char const	**names;
@@ -660,7 +1206,7 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 	rlm_sql_cassandra_conn_t 	*conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_cassandra_conn_t);
 	CassRow	const 			*cass_row;
 	cassandra_query_ctx_t		*cass_query_ctx = query_ctx->uctx;
-	CassResult const		*result = cass_query_ctx->result;
+	CassResult const		*result;
 	int				fields, i;
 	char				**row;
 
@@ -680,25 +1226,38 @@ do {\
 } while(0)
 
 	query_ctx->rcode = RLM_SQL_OK;
-	if (!result) RETURN_MODULE_OK;					/* no result */
+	if (!cass_query_ctx->results) RETURN_MODULE_OK;			/* no result */
 
 	/*
-	 *	Start of the result set, initialise the iterator.
+	 *	Free the previous result (also gets called on finish_query)
 	 */
-	if (!conn->iterator) conn->iterator = cass_iterator_from_result(result);
-	if (!conn->iterator) RETURN_MODULE_OK;				/* no result */
+	TALLOC_FREE(query_ctx->row);
 
 	/*
-	 *	Free the previous result (also gets called on finish_query)
+	 *	Move on to the next page when we run out of rows
+	 *	in this one.
 	 */
-	TALLOC_FREE(query_ctx->row);
+	for (;;) {
+		if (cass_query_ctx->page >= talloc_array_length(cass_query_ctx->results)) {
+			query_ctx->rcode = RLM_SQL_NO_MORE_ROWS;	/* no more rows */
+			RETURN_MODULE_OK;
+		}
+		result = cass_query_ctx->results[cass_query_ctx->page];
+
+		/*
+		 *	Start of the page, initialise the iterator.
+		 */
+		if (!cass_query_ctx->iterator) cass_query_ctx->iterator = cass_iterator_from_result(result);
+		if (!cass_query_ctx->iterator) RETURN_MODULE_OK;	/* no result */
 
-	if (!cass_iterator_next(conn->iterator)) {
-		query_ctx->rcode = RLM_SQL_NO_MORE_ROWS;		/* no more rows */
-		RETURN_MODULE_OK;
+		if (cass_iterator_next(cass_query_ctx->iterator)) break;
+
+		cass_iterator_free(cass_query_ctx->iterator);
+		cass_query_ctx->iterator = NULL;
+		cass_query_ctx->page++;
 	}
 
-	cass_row = cass_iterator_get_row(conn->iterator);		/* this shouldn't fail ? */
+	cass_row = cass_iterator_get_row(cass_query_ctx->iterator);	/* this shouldn't fail ? */
 	fields = cass_result_column_count(result);			/* get the number of fields... */
 
 	MEM(row = query_ctx->row = talloc_zero_array(query_ctx, char *, fields + 1));
@@ -794,20 +1353,9 @@ do {\
 
 static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_cassandra_conn_t	*conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_cassandra_conn_t);
-
 	if (query_ctx->row) TALLOC_FREE(query_ctx->row);
 
-	if (conn->iterator) {
-		cass_iterator_free(conn->iterator);
-		conn->iterator = NULL;
-	}
-
-	if (query_ctx->uctx) {
-		cassandra_query_ctx_t *cass_query_ctx = talloc_get_type_abort(query_ctx->uctx, cassandra_query_ctx_t);
-		if (cass_query_ctx->result) cass_result_free(cass_query_ctx->result);
-		cass_query_ctx->result = NULL;
-	}
+	if (query_ctx->uctx) sql_results_free(talloc_get_type_abort(query_ctx->uctx, cassandra_query_ctx_t));
 
 	return RLM_SQL_OK;
 }
@@ -831,8 +1379,8 @@ static sql_rcode_t sql_finish_query(fr_sql_query_t *query_ctx, rlm_sql_config_t
 {
 	cassandra_query_ctx_t	*cass_query_ctx = talloc_get_type_abort(query_ctx->uctx, cassandra_query_ctx_t);
 
-	cass_result_free(cass_query_ctx->result);
 	talloc_const_free(cass_query_ctx->error.msg);
+	cass_query_ctx->error.msg = NULL;
 
 	return sql_free_result(query_ctx, config);
 }
@@ -849,6 +1397,13 @@ static int sql_affected_rows(UNUSED fr_sql_query_t *query_ctx, UNUSED rlm_sql_co
 	return 1;
 }
 
+static uint32_t sql_pipeline_depth(module_instance_t const *mi)
+{
+	rlm_sql_cassandra_t const *inst = talloc_get_type_abort_const(mi->data, rlm_sql_cassandra_t);
+
+	return inst->pipeline_depth;
+}
+
 static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_sql_cassandra_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_sql_cassandra_t);
@@ -882,6 +1437,12 @@ do {\
 	}\
 } while (0)
 
+	FR_INTEGER_BOUND_CHECK("pipeline_depth", inst->pipeline_depth, >=, 1);
+	FR_INTEGER_BOUND_CHECK("pipeline_depth", inst->pipeline_depth, <=, CASSANDRA_MAX_PIPELINE_DEPTH);
+	FR_INTEGER_BOUND_CHECK("max_statements", inst->max_statements, <=, CASSANDRA_MAX_PIPELINE_DEPTH);
+	FR_INTEGER_BOUND_CHECK("max_batch_size", inst->max_batch_size, >=, 2);
+	FR_INTEGER_BOUND_CHECK("max_batch_size", inst->max_batch_size, <=, CASSANDRA_MAX_BATCH_SIZE);
+
 	MEM(inst->mutable = talloc_zero(NULL, rlm_sql_cassandra_mutable_t));
 	if ((ret = pthread_mutex_init(&inst->mutable->connect_mutex, NULL)) < 0) {
 		ERROR("Failed initializing mutex: %s", fr_syserror(ret));
@@ -1049,7 +1610,6 @@ rlm_sql_driver_t rlm_sql_cassandra = {
 		.instantiate			= mod_instantiate,
 		.detach				= mod_detach
 	},
-	.flags				= RLM_SQL_MULTI_QUERY_CONN,
 	.sql_query_resume		= sql_query_resume,
 	.sql_select_query_resume	= sql_query_resume,
 	.sql_num_rows			= sql_num_rows,
@@ -1060,6 +1620,7 @@ rlm_sql_driver_t rlm_sql_cassandra = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
+	.sql_pipeline_depth		= sql_pipeline_depth,
 	.trunk_io_funcs = {
 		.connection_alloc	= sql_trunk_connection_alloc,
 		.connection_notify	= sql_trunk_connection_notify,
@@ -65,14 +65,28 @@ static fr_table_num_sorted_t const server_warnings_table[] = {
 };
 static size_t server_warnings_table_len = NUM_ELEMENTS(server_warnings_table);
 
+/** Which non-blocking call is in progress on a connection
+ *
+ */
+typedef enum {
+	MYSQL_ASYNC_NONE = 0,			//!< No call in progress.
+	MYSQL_ASYNC_QUERY,			//!< mysql_real_query_start().
+	MYSQL_ASYNC_STORE,			//!< mysql_store_result_start().
+	MYSQL_ASYNC_NEXT			//!< mysql_next_result_start().
+} rlm_sql_mysql_async_t;
+
 typedef struct {
 	MYSQL		db;			//!< Structure representing connection details.
 	MYSQL		*sock;			//!< Connection details as returned by connection init functions.
-	MYSQL_RES	*result;		//!< Result from most recent query.
+	MYSQL_RES	*result;		//!< Result set rows are currently being fetched from.
+	MYSQL_RES	**results;		//!< Further result sets of the current query, in order.
+	MYSQL_RES	*stored;		//!< Result set being retrieved by mysql_store_result_start().
 	connection_t	*conn;			//!< Generic connection structure for this connection.
 	int		fd;			//!< fd for this connection's I/O events.
 	fr_sql_query_t	*query_ctx;		//!< Current query running on this connection.
 	int		status;			//!< returned by the most recent non-blocking function call.
+	rlm_sql_mysql_async_t	async;		//!< Which non-blocking call status relates to.
+	uint64_t	affected_rows;		//!< Rows affected by the first statement of a non-SELECT query.
 } rlm_sql_mysql_conn_t;
 
 typedef struct {
@@ -394,6 +408,14 @@ static void _sql_connection_close(fr_event_list_t *el, void *h, UNUSED void *uct
 		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
 		c->fd = -1;
 	}
+	if (c->result) mysql_free_result(c->result);
+	if (c->stored) mysql_free_result(c->stored);
+	if (c->results) {
+		size_t i;
+
+		for (i = 0; i < talloc_array_length(c->results); i++) mysql_free_result(c->results[i]);
+	}
+
 	mysql_close(&c->db);
 	c->query_ctx = NULL;
 	talloc_free(h);
@@ -476,24 +498,28 @@ static sql_rcode_t sql_check_error(MYSQL *server, int client_errno)
 	return RLM_SQL_OK;
 }
 
-static sql_rcode_t sql_store_result(rlm_sql_mysql_conn_t *conn, UNUSED rlm_sql_config_t const *config)
+/** Make the next result set of the current query the one rows are fetched from
+ *
+ * @return
+ *	- true if there was another result set.
+ *	- false if there are no more result sets.
+ */
+static bool sql_next_stored_result(rlm_sql_mysql_conn_t *conn)
 {
-	sql_rcode_t rcode;
-	int ret;
+	size_t num = talloc_array_length(conn->results);
 
-retry_store_result:
-	conn->result = mysql_store_result(conn->sock);
-	if (!conn->result) {
-		rcode = sql_check_error(conn->sock, 0);
-		if (rcode != RLM_SQL_OK) return rcode;
-		ret = mysql_next_result(conn->sock);
-		if (ret == 0) {
-			/* there are more results */
-			goto retry_store_result;
-		} else if (ret > 0) return sql_check_error(NULL, ret);
-		/* ret == -1 signals no more results */
+	if (num == 0) return false;
+
+	conn->result = conn->results[0];
+	if (num == 1) {
+		TALLOC_FREE(conn->results);
+		return true;
 	}
-	return RLM_SQL_OK;
+
+	memmove(conn->results, conn->results + 1, sizeof(conn->results[0]) * (num - 1));
+	MEM(conn->results = talloc_realloc(conn, conn->results, MYSQL_RES *, num - 1));
+
+	return true;
 }
 
 static int sql_num_rows(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
@@ -541,7 +567,6 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 	fr_sql_query_t		*query_ctx = talloc_get_type_abort(uctx, fr_sql_query_t);
 	rlm_sql_mysql_conn_t	*conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_mysql_conn_t);
 	MYSQL_ROW		row;
-	int			ret;
 	unsigned int		num_fields, i;
 	unsigned long		*field_lens;
 
@@ -569,18 +594,11 @@ retry_fetch_row:
 		mysql_free_result(conn->result);
 		conn->result = NULL;
 
-		ret = mysql_next_result(conn->sock);
-		if (ret == 0) {
-			/* there are more results */
-			if ((sql_store_result(conn, &query_ctx->inst->config) == 0) && (conn->result != NULL)) {
-				goto retry_fetch_row;
-			}
-		} else if (ret > 0) {
-			query_ctx->rcode = sql_check_error(NULL, ret);
-			if (query_ctx->rcode == RLM_SQL_OK) RETURN_MODULE_OK;
-			RETURN_MODULE_FAIL;
-		}
-		/* If ret is -1 then there are no more rows */
+		/*
+		 *	All result sets were retrieved along with the
+		 *	first, so moving on to the next doesn't block.
+		 */
+		if (sql_next_stored_result(conn)) goto retry_fetch_row;
 
 		query_ctx->rcode = RLM_SQL_NO_MORE_ROWS;
 		RETURN_MODULE_OK;
@@ -612,6 +630,10 @@ static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_con
 		mysql_free_result(conn->result);
 		conn->result = NULL;
 	}
+	while (sql_next_stored_result(conn)) {
+		mysql_free_result(conn->result);
+		conn->result = NULL;
+	}
 	TALLOC_FREE(query_ctx->row);
 
 	return RLM_SQL_OK;
@@ -799,6 +821,16 @@ static sql_rcode_t sql_finish_query(fr_sql_query_t *query_ctx, rlm_sql_config_t
 		return RLM_SQL_OK;
 	}
 
+	/*
+	 *	The remaining result sets were retrieved with the non-blocking
+	 *	API when the query completed, so there's nothing to drain.
+	 */
+	if ((query_ctx->status == SQL_QUERY_RESULTS_FETCHED) ||
+	    ((query_ctx->status == SQL_QUERY_RETURNED) && (query_ctx->type != SQL_QUERY_SELECT))) {
+		sql_free_result(query_ctx, config);
+		return RLM_SQL_OK;
+	}
+
 	/*
 	 *	If there's no result associated with the
 	 *	connection handle, assume the first result in the
@@ -842,6 +874,12 @@ static int sql_affected_rows(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t
 {
 	rlm_sql_mysql_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_mysql_conn_t);
 
+	/*
+	 *	Any further result sets of non-SELECT queries have
+	 *	already been read, so use the count recorded before that.
+	 */
+	if (query_ctx->type != SQL_QUERY_SELECT) return conn->affected_rows;
+
 	return mysql_affected_rows(conn->sock);
 }
 
@@ -878,6 +916,88 @@ TRUNK_NOTIFY_FUNC(sql_trunk_connection_notify, rlm_sql_mysql_conn_t)
 #undef LOG_PREFIX
 #define LOG_PREFIX log_prefix
 
+/** Retrieve the remaining result sets of a query
+ *
+ * Called when the non-blocking call in sql_conn->async has completed, to start
+ * the next one.  Queries such as stored procedure calls return several result
+ * sets, and reading them with the blocking API when rows are fetched, or when
+ * the query is finished, would stall the worker.  Instead they're all retrieved
+ * with the non-blocking API before the request resumes.
+ *
+ * Result sets of SELECT queries are kept for #sql_fetch_row, those of other
+ * queries are discarded.
+ *
+ * @param[in] sql_conn	the query is running on.
+ * @param[in] query_ctx	being run.
+ * @param[in] err	returned by the call which completed.
+ * @return
+ *	- 1 if waiting for I/O.
+ *	- 0 when all result sets have been retrieved.
+ *	- -1 on error.
+ */
+static int sql_results_next(rlm_sql_mysql_conn_t *sql_conn, fr_sql_query_t *query_ctx, int err)
+{
+	for (;;) {
+		switch (sql_conn->async) {
+		/*
+		 *	Retrieve any result set of the first statement,
+		 *	mysql_next_result() fails if it's not consumed.
+		 */
+		case MYSQL_ASYNC_QUERY:
+			if (err) goto error;
+
+			sql_conn->affected_rows = mysql_affected_rows(sql_conn->sock);
+			sql_conn->async = MYSQL_ASYNC_STORE;
+			sql_conn->status = mysql_store_result_start(&sql_conn->stored, sql_conn->sock);
+			if (sql_conn->status) return 1;
+			continue;
+
+		case MYSQL_ASYNC_STORE:
+			if (!sql_conn->stored) {
+				if (mysql_errno(sql_conn->sock)) goto error;
+			} else if (query_ctx->type != SQL_QUERY_SELECT) {
+				mysql_free_result(sql_conn->stored);
+			} else if (!sql_conn->result) {
+				sql_conn->result = sql_conn->stored;
+			} else {
+				size_t num = talloc_array_length(sql_conn->results);
+
+				MEM(sql_conn->results = talloc_realloc(sql_conn, sql_conn->results, MYSQL_RES *, num + 1));
+				sql_conn->results[num] = sql_conn->stored;
+			}
+			sql_conn->stored = NULL;
+
+			if (!mysql_more_results(sql_conn->sock)) goto done;
+
+			sql_conn->async = MYSQL_ASYNC_NEXT;
+			sql_conn->status = mysql_next_result_start(&err, sql_conn->sock);
+			if (sql_conn->status) return 1;
+			continue;
+
+		case MYSQL_ASYNC_NEXT:
+			if (err > 0) goto error;
+			if (err < 0) goto done;		/* No more results */
+
+			sql_conn->async = MYSQL_ASYNC_STORE;
+			sql_conn->status = mysql_store_result_start(&sql_conn->stored, sql_conn->sock);
+			if (sql_conn->status) return 1;
+			continue;
+
+		case MYSQL_ASYNC_NONE:
+			fr_assert(0);
+			goto done;
+		}
+	}
+
+done:
+	sql_conn->async = MYSQL_ASYNC_NONE;
+	return 0;
+
+error:
+	sql_conn->async = MYSQL_ASYNC_NONE;
+	return -1;
+}
+
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 				  connection_t *conn, UNUSED void *uctx)
@@ -889,6 +1009,7 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 	fr_sql_query_t		*query_ctx;
 	char const		*info;
 	int			err;
+	int			ret;
 
 	if (trunk_connection_pop_request(&treq, tconn) != 0) return;
 	if (!treq) return;
@@ -905,10 +1026,12 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 	switch (query_ctx->status) {
 	case SQL_QUERY_PREPARED:
 		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
+		sql_conn->async = MYSQL_ASYNC_QUERY;
 		sql_conn->status = mysql_real_query_start(&err, sql_conn->sock, query_ctx->query_str, strlen(query_ctx->query_str));
 		query_ctx->tconn = tconn;
 
 		if (sql_conn->status) {
+		submitted:
 			ROPTIONAL(RDEBUG3, DEBUG3, "Waiting for IO");
 			query_ctx->status = SQL_QUERY_SUBMITTED;
 			sql_conn->query_ctx = query_ctx;
@@ -917,6 +1040,8 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 		}
 
 		if (err) {
+			sql_conn->async = MYSQL_ASYNC_NONE;
+
 			/*
 			 *	Need to check what kind of error this is - it may
 			 *	be a unique key conflict, we run the next query.
@@ -935,8 +1060,16 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 				if (request) unlang_interpret_mark_runnable(request);
 				return;
 			}
-		} else {
+		} else if (query_ctx->type == SQL_QUERY_SELECT) {
+			/*
+			 *	Results are retrieved when the request is requeued.
+			 */
+			sql_conn->async = MYSQL_ASYNC_NONE;
 			query_ctx->rcode = RLM_SQL_OK;
+		} else {
+			ret = sql_results_next(sql_conn, query_ctx, 0);
+			if (ret > 0) goto submitted;
+			query_ctx->rcode = (ret < 0) ? sql_check_error(sql_conn->sock, 0) : RLM_SQL_OK;
 		}
 		query_ctx->status = SQL_QUERY_RETURNED;
 
@@ -945,9 +1078,11 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 	case SQL_QUERY_RETURNED:
 		ROPTIONAL(RDEBUG2, DEBUG2, "Fetching results");
 		fr_assert(query_ctx->tconn == tconn);
-		sql_conn->status = mysql_store_result_start(&sql_conn->result, sql_conn->sock);
+		sql_conn->async = MYSQL_ASYNC_STORE;
+		sql_conn->status = mysql_store_result_start(&sql_conn->stored, sql_conn->sock);
 
-		if (sql_conn->status) {
+		ret = sql_conn->status ? 1 : sql_results_next(sql_conn, query_ctx, 0);
+		if (ret > 0) {
 			ROPTIONAL(RDEBUG3, DEBUG3, "Waiting for IO");
 			query_ctx->status = SQL_QUERY_FETCHING_RESULTS;
 			sql_conn->query_ctx = query_ctx;
@@ -955,7 +1090,7 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 			return;
 		}
 		query_ctx->status = SQL_QUERY_RESULTS_FETCHED;
-		query_ctx->rcode = RLM_SQL_OK;
+		query_ctx->rcode = (ret < 0) ? sql_check_error(sql_conn->sock, 0) : RLM_SQL_OK;
 
 		break;
 
@@ -984,6 +1119,7 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 	fr_sql_query_t		*query_ctx;
 	char const		*info;
 	int			err = 0;
+	int			ret;
 	request_t		*request;
 
 	/*
@@ -1000,11 +1136,7 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 
 	switch (query_ctx->status) {
 	case SQL_QUERY_SUBMITTED:
-		sql_conn->status = mysql_real_query_cont(&err, sql_conn->sock, sql_conn->status);
-		break;
-
 	case SQL_QUERY_FETCHING_RESULTS:
-		sql_conn->status = mysql_store_result_cont(&sql_conn->result, sql_conn->sock, sql_conn->status);
 		break;
 
 	default:
@@ -1015,11 +1147,38 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 		return;
 	}
 
+	switch (sql_conn->async) {
+	case MYSQL_ASYNC_QUERY:
+		sql_conn->status = mysql_real_query_cont(&err, sql_conn->sock, sql_conn->status);
+		break;
+
+	case MYSQL_ASYNC_STORE:
+		sql_conn->status = mysql_store_result_cont(&sql_conn->stored, sql_conn->sock, sql_conn->status);
+		break;
+
+	case MYSQL_ASYNC_NEXT:
+		sql_conn->status = mysql_next_result_cont(&err, sql_conn->sock, sql_conn->status);
+		break;
+
+	case MYSQL_ASYNC_NONE:
+		return;
+	}
+
 	/*
 	 *	Are we still waiting for any further I/O?
 	 */
 	if (sql_conn->status != 0) return;
 
+	request = query_ctx->request;
+
+	if ((sql_conn->async == MYSQL_ASYNC_QUERY) && (err || (query_ctx->type == SQL_QUERY_SELECT))) {
+		sql_conn->async = MYSQL_ASYNC_NONE;
+		ret = 0;
+	} else {
+		ret = sql_results_next(sql_conn, query_ctx, err);
+		if (ret > 0) return;
+	}
+
 	sql_conn->query_ctx = NULL;
 
 	switch (query_ctx->status) {
@@ -1035,10 +1194,9 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 		fr_assert(0);
 	}
 
-	request = query_ctx->request;
 	if (request) unlang_interpret_mark_runnable(request);
 
-	if (err) {
+	if (err || (ret < 0)) {
 		info = mysql_info(sql_conn->sock);
 		query_ctx->rcode = sql_check_error(sql_conn->sock, 0);
 		if (info) ROPTIONAL(RERROR, ERROR, "%s", info);
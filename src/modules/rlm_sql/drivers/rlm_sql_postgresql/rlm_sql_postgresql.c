@@ -43,6 +43,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 
 #include <sys/stat.h>
 
@@ -63,23 +64,60 @@ RCSID("$Id$")
 typedef struct {
 	char const	*db_string;		//!< Text based configuration string.
 	bool		send_application_name;	//!< Whether we send the application name to PostgreSQL.
+	bool		prepare_statements;	//!< Whether queries are sent as prepared statements.
+	uint32_t	max_statements;		//!< Maximum number of statements prepared per connection.
+	uint32_t	pipeline_depth;		//!< Maximum number of queries in flight per connection.
 	fr_trie_t	*states;		//!< sql state trie.
 } rlm_sql_postgresql_t;
 
+/** A statement prepared on a connection
+ *
+ */
+typedef struct {
+	char const	*text;			//!< Query with its literals replaced by placeholders.
+	char		name[16];		//!< Name the statement was prepared with.
+	bool		prepared;		//!< False if preparing the statement failed, in which
+						///< case queries of this form are sent as text.
+} rlm_sql_postgres_stmt_t;
+
+/** Result of a query
+ *
+ * Kept with the query rather than the connection, as in pipeline mode several
+ * queries may have results outstanding on the same connection.
+ */
 typedef struct {
-	PGconn		*db;
 	PGresult	*result;
 	int		cur_row;
 	int		num_fields;
 	int		affected_rows;
 	char		**row;
+
+	rlm_sql_postgres_stmt_t	*stmt;		//!< Statement the query was sent with, in pipeline mode.
+	bool		preparing;		//!< The statement is being prepared ahead of the query.
+} rlm_sql_postgres_query_t;
+
+typedef struct {
+	PGconn		*db;
 	connection_t	*conn;			//!< Generic connection structure for this connection.
 	int		fd;			//!< fd for this connection's I/O events.
 	fr_sql_query_t	*query_ctx;		//!< Current query running on this connection.
+
+	fr_hash_table_t	*statements;		//!< Statements prepared on this connection, by text.
+	uint32_t	num_statements;		//!< Used to name new statements.
+	rlm_sql_postgres_stmt_t	*preparing;	//!< Statement being prepared for the current query.
+	char		**params;		//!< Parameters for the current query.
+
+	fr_sql_query_t	**pipeline;		//!< Queries sent in pipeline mode, in the order they were sent.
+						///< NULL entries are queries which have been cancelled.
+	uint32_t	pipeline_head;		//!< Oldest query in the pipeline.
+	uint32_t	pipeline_count;		//!< Number of queries in the pipeline.
 } rlm_sql_postgres_conn_t;
 
 static conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", rlm_sql_postgresql_t, send_application_name), .dflt = "yes" },
+	{ FR_CONF_OFFSET("prepare_statements", rlm_sql_postgresql_t, prepare_statements), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_statements", rlm_sql_postgresql_t, max_statements), .dflt = "64" },
+	{ FR_CONF_OFFSET("pipeline_depth", rlm_sql_postgresql_t, pipeline_depth), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -143,13 +181,35 @@ static int affected_rows(PGresult * result)
 	return atoi(PQcmdTuples(result));
 }
 
-/** Free the row of the current result that's stored in the conn struct
+/** Free the row of the current result that's stored in the query's result struct
  *
  */
-static void free_result_row(rlm_sql_postgres_conn_t *conn)
+static void free_result_row(rlm_sql_postgres_query_t *res)
 {
-	TALLOC_FREE(conn->row);
-	conn->num_fields = 0;
+	TALLOC_FREE(res->row);
+	res->num_fields = 0;
+}
+
+static int _sql_query_result_free(rlm_sql_postgres_query_t *res)
+{
+	if (res->result) PQclear(res->result);
+	return 0;
+}
+
+/** Return the result struct for a query, allocating it if needed
+ *
+ */
+static rlm_sql_postgres_query_t *sql_query_result(fr_sql_query_t *query_ctx)
+{
+	rlm_sql_postgres_query_t *res;
+
+	if (query_ctx->uctx) return talloc_get_type_abort(query_ctx->uctx, rlm_sql_postgres_query_t);
+
+	MEM(res = talloc_zero(query_ctx, rlm_sql_postgres_query_t));
+	talloc_set_destructor(res, _sql_query_result_free);
+	query_ctx->uctx = res;
+
+	return res;
 }
 
 #if defined(PG_DIAG_SQLSTATE) && defined(PG_DIAG_MESSAGE_PRIMARY)
@@ -227,6 +287,232 @@ static sql_rcode_t sql_classify_error(UNUSED PGresult const *result)
 }
 #endif
 
+static uint32_t sql_stmt_hash(void const *data)
+{
+	rlm_sql_postgres_stmt_t const *stmt = data;
+
+	return fr_hash_string(stmt->text);
+}
+
+static int8_t sql_stmt_cmp(void const *one, void const *two)
+{
+	rlm_sql_postgres_stmt_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->text, b->text), 0);
+}
+
+static inline CC_HINT(always_inline) bool sql_is_ident_char(char c)
+{
+	return isalnum((uint8_t)c) || (c == '_') || (c == '$');
+}
+
+/** Replace the string and numeric literals in a query with placeholders
+ *
+ * Queries are built by expanding attributes into a template, so the same template
+ * always produces the same text once the expanded values are taken out.  That text
+ * can be prepared once per connection, and executed with the values as parameters.
+ *
+ * We're conservative about what we parameterize.  Queries containing placeholders,
+ * comments, multiple statements, or escape string constants (where the escaping
+ * rules depend on server settings) are left alone.
+ *
+ * @param[in] ctx	to allocate the text and parameters in.
+ * @param[out] text_out	The query with literals replaced by $1..$n.
+ * @param[out] params_out	The unquoted values of the literals.
+ * @param[in] query	to parameterize.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the query should be sent as is.
+ */
+static int sql_query_parameterize(TALLOC_CTX *ctx, char **text_out, char ***params_out, char const *query)
+{
+	char const	*p = query, *start = query, *q, *seg;
+	char		*text, *value;
+	char		**params;
+	size_t		num = 0;
+
+	MEM(text = talloc_strdup(ctx, ""));
+	MEM(params = talloc_array(ctx, char *, 0));
+
+	while (*p) {
+		switch (*p) {
+		case '$':
+		case ';':
+		case '\\':
+		error:
+			talloc_free(text);
+			talloc_free(params);
+			return -1;
+
+		case '-':
+			if (p[1] == '-') goto error;
+			p++;
+			continue;
+
+		case '/':
+			if (p[1] == '*') goto error;
+			p++;
+			continue;
+
+		/*
+		 *	Quoted identifier, skip over it.
+		 */
+		case '"':
+			q = strchr(p + 1, '"');
+			if (!q) goto error;
+			p = q + 1;
+			continue;
+
+		case '\'':
+			/*
+			 *	E'', B'', X'', U&'' etc...
+			 */
+			if ((p > query) && (sql_is_ident_char(p[-1]) || (p[-1] == '&'))) goto error;
+
+			MEM(value = talloc_strdup(params, ""));
+			for (seg = q = p + 1; ; q++) {
+				if (!*q || (*q == '\\')) goto error;
+				if (*q != '\'') continue;
+				if (q[1] != '\'') break;
+
+				/*
+				 *	'' is an escaped quote, keep one of them
+				 */
+				q++;
+				MEM(value = talloc_strndup_append_buffer(value, seg, q - seg));
+				seg = q + 1;
+			}
+			MEM(value = talloc_strndup_append_buffer(value, seg, q - seg));
+			q++;
+			break;
+
+		default:
+			if (!isdigit((uint8_t)*p) || ((p > query) && (sql_is_ident_char(p[-1]) || (p[-1] == '.')))) {
+				p++;
+				continue;
+			}
+
+			for (q = p; isdigit((uint8_t)*q) || (*q == '.'); q++);
+
+			/*
+			 *	Exponents and other oddities
+			 */
+			if (sql_is_ident_char(*q)) {
+				p = q;
+				continue;
+			}
+			MEM(value = talloc_strndup(params, p, q - p));
+			break;
+		}
+
+		/*
+		 *	Literal is between p and q
+		 */
+		MEM(params = talloc_realloc(ctx, params, char *, num + 1));
+		params[num++] = value;
+		MEM(text = talloc_strndup_append_buffer(text, start, p - start));
+		MEM(text = talloc_asprintf_append_buffer(text, "$%zu", num));
+		p = start = q;
+	}
+
+	if (num == 0) goto error;
+
+	MEM(text = talloc_strndup_append_buffer(text, start, p - start));
+
+	*text_out = text;
+	*params_out = params;
+
+	return 0;
+}
+
+/** Find the statement for a parameterized query, adding it if there's room
+ *
+ * @param[out] new	Set to true if the statement was added, and must be prepared.
+ * @param[in] inst	Driver instance.
+ * @param[in] sql_conn	to find the statement on.
+ * @param[in] text	Parameterized query.  Always consumed.
+ * @return
+ *	- The statement to use.
+ *	- NULL if the query should be sent as text.
+ */
+static rlm_sql_postgres_stmt_t *sql_stmt_find(bool *new, rlm_sql_postgresql_t const *inst,
+					      rlm_sql_postgres_conn_t *sql_conn, char *text)
+{
+	rlm_sql_postgres_stmt_t	find, *stmt;
+
+	*new = false;
+
+	find.text = text;
+	stmt = fr_hash_table_find(sql_conn->statements, &find);
+	if (stmt) {
+		talloc_free(text);
+		return stmt->prepared ? stmt : NULL;
+	}
+
+	if (fr_hash_table_num_elements(sql_conn->statements) >= inst->max_statements) {
+		talloc_free(text);
+		return NULL;
+	}
+
+	MEM(stmt = talloc_zero(sql_conn->statements, rlm_sql_postgres_stmt_t));
+	stmt->text = talloc_steal(stmt, text);
+	snprintf(stmt->name, sizeof(stmt->name), "fr_%u", sql_conn->num_statements++);
+	stmt->prepared = true;
+	if (!fr_hash_table_insert(sql_conn->statements, stmt)) {
+		talloc_free(stmt);
+		return NULL;
+	}
+	*new = true;
+
+	return stmt;
+}
+
+/** Send a query, as a prepared statement if possible
+ *
+ * The first time a query of a particular form is sent on a connection, the
+ * statement is prepared, and the query is sent once the result of preparing
+ * it comes back.
+ *
+ * @return
+ *	- 1 on success.
+ *	- 0 on failure.
+ */
+static int sql_query_send(rlm_sql_postgresql_t const *inst, rlm_sql_postgres_conn_t *sql_conn,
+			  fr_sql_query_t *query_ctx)
+{
+	request_t		*request = query_ctx->request;
+	rlm_sql_postgres_stmt_t	*stmt;
+	char			*text;
+	char			**params;
+	bool			new;
+
+	TALLOC_FREE(sql_conn->params);
+
+	if (!inst->prepare_statements ||
+	    (sql_query_parameterize(sql_conn, &text, &params, query_ctx->query_str) < 0)) {
+	send_text:
+		return PQsendQuery(sql_conn->db, query_ctx->query_str);
+	}
+
+	stmt = sql_stmt_find(&new, inst, sql_conn, text);
+	if (!stmt) {
+		talloc_free(params);
+		goto send_text;
+	}
+	sql_conn->params = params;
+
+	if (!new) {
+		ROPTIONAL(RDEBUG3, DEBUG3, "Executing prepared statement %s", stmt->name);
+		return PQsendQueryPrepared(sql_conn->db, stmt->name, talloc_array_length(sql_conn->params),
+					   (char const * const *)sql_conn->params, NULL, NULL, 0);
+	}
+
+	sql_conn->preparing = stmt;
+
+	ROPTIONAL(RDEBUG3, DEBUG3, "Preparing statement %s: %s", stmt->name, stmt->text);
+	return PQsendPrepare(sql_conn->db, stmt->name, stmt->text, 0, NULL);
+}
+
 static void _sql_connect_io_notify(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
 	rlm_sql_postgres_conn_t		*c = talloc_get_type_abort(uctx, rlm_sql_postgres_conn_t);
@@ -248,6 +534,9 @@ static void _sql_connect_io_notify(fr_event_list_t *el, int fd, UNUSED int flags
 		       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
 		       PQbackendPID(c->db));
 		PQsetnonblocking(c->db, 1);
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		if (c->pipeline && !PQenterPipelineMode(c->db)) goto error;
+#endif
 		connection_signal_connected(c->conn);
 		return;
 
@@ -282,6 +571,11 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 	MEM(c = talloc_zero(conn, rlm_sql_postgres_conn_t));
 	c->conn = conn;
 	c->fd = -1;
+	if (inst->prepare_statements) {
+		MEM(c->statements = fr_hash_table_talloc_alloc(c, rlm_sql_postgres_stmt_t,
+							       sql_stmt_hash, sql_stmt_cmp, NULL));
+	}
+	if (inst->pipeline_depth > 1) MEM(c->pipeline = talloc_zero_array(c, fr_sql_query_t *, inst->pipeline_depth));
 
 	DEBUG2("Starting connection to PostgreSQL server using parameters: %s", inst->db_string);
 
@@ -299,6 +593,12 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 		       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
 		       PQbackendPID(c->db));
 		PQsetnonblocking(c->db, 1);
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		if (c->pipeline && !PQenterPipelineMode(c->db)) {
+			ERROR("Failed entering pipeline mode: %s", PQerrorMessage(c->db));
+			goto error;
+		}
+#endif
 		connection_signal_connected(c->conn);
 		return CONNECTION_STATE_CONNECTING;
 
@@ -336,11 +636,6 @@ static void _sql_connection_close(fr_event_list_t *el, void *h, UNUSED void *uct
 		c->fd = -1;
 	}
 
-	if (c->result) {
-		PQclear(c->result);
-		c->result = NULL;
-	}
-
 	/* PQfinish also frees the memory used by the PGconn structure */
 	PQfinish(c->db);
 	c->query_ctx = NULL;
@@ -351,6 +646,82 @@ SQL_TRUNK_CONNECTION_ALLOC
 
 TRUNK_NOTIFY_FUNC(sql_trunk_connection_notify, rlm_sql_postgres_conn_t)
 
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+/** Send a query as text on a connection in pipeline mode
+ *
+ * Pipeline mode only supports the extended query protocol, so the query is sent
+ * as an unnamed statement, and may only contain a single SQL statement.
+ *
+ * @return
+ *	- 1 on success.
+ *	- 0 on failure.
+ */
+static int sql_query_send_text_pipelined(rlm_sql_postgres_conn_t *sql_conn, fr_sql_query_t *query_ctx)
+{
+	if (!PQsendQueryParams(sql_conn->db, query_ctx->query_str, 0, NULL, NULL, NULL, NULL, 0)) return 0;
+
+	return PQpipelineSync(sql_conn->db);
+}
+
+/** Send a query on a connection in pipeline mode, as a prepared statement if possible
+ *
+ * Each query is followed by its own sync point, so an error only aborts the
+ * query which caused it, and each query is committed independently of the others.
+ *
+ * A new statement is prepared in the same segment of the pipeline as the query
+ * which uses it.  If preparing the statement fails, the query is aborted, and is
+ * sent again as text once its sync point is reached.
+ *
+ * @return
+ *	- 1 on success.
+ *	- 0 on failure.
+ */
+static int sql_query_send_pipelined(rlm_sql_postgresql_t const *inst, rlm_sql_postgres_conn_t *sql_conn,
+				    fr_sql_query_t *query_ctx, rlm_sql_postgres_query_t *res)
+{
+	request_t		*request = query_ctx->request;
+	char			*text;
+	char			**params;
+	bool			new;
+	int			ret;
+
+	res->stmt = NULL;
+	res->preparing = false;
+
+	if (!inst->prepare_statements ||
+	    (sql_query_parameterize(sql_conn, &text, &params, query_ctx->query_str) < 0)) {
+	send_text:
+		return sql_query_send_text_pipelined(sql_conn, query_ctx);
+	}
+
+	res->stmt = sql_stmt_find(&new, inst, sql_conn, text);
+	if (!res->stmt) {
+		talloc_free(params);
+		goto send_text;
+	}
+
+	if (new) {
+		ROPTIONAL(RDEBUG3, DEBUG3, "Preparing statement %s: %s", res->stmt->name, res->stmt->text);
+		if (!PQsendPrepare(sql_conn->db, res->stmt->name, res->stmt->text, 0, NULL)) {
+			talloc_free(params);
+			return 0;
+		}
+		res->preparing = true;
+	}
+
+	/*
+	 *	libpq copies the parameters into its output buffer.
+	 */
+	ROPTIONAL(RDEBUG3, DEBUG3, "Executing prepared statement %s", res->stmt->name);
+	ret = PQsendQueryPrepared(sql_conn->db, res->stmt->name, talloc_array_length(params),
+				  (char const * const *)params, NULL, NULL, 0);
+	talloc_free(params);
+	if (!ret) return 0;
+
+	return PQpipelineSync(sql_conn->db);
+}
+#endif
+
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 				  connection_t *conn, UNUSED void *uctx)
@@ -359,18 +730,37 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 	request_t		*request;
 	trunk_request_t		*treq;
 	fr_sql_query_t		*query_ctx;
+	rlm_sql_postgres_query_t *res;
 	int			err;
 
-	if (trunk_connection_pop_request(&treq, tconn) != 0) return;
-	if (!treq) return;
+	/*
+	 *	Without pipelining there's only ever one request on
+	 *	a connection, in pipeline mode we send as many as the
+	 *	pipeline has room for.
+	 */
+	while (!sql_conn->pipeline || (sql_conn->pipeline_count < talloc_array_length(sql_conn->pipeline))) {
+		if (trunk_connection_pop_request(&treq, tconn) != 0) return;
+		if (!treq) return;
 
-	query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
-	request = query_ctx->request;
+		query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
+		request = query_ctx->request;
+
+		if (query_ctx->status != SQL_QUERY_PREPARED) return;
+
+		res = sql_query_result(query_ctx);
+		res->cur_row = 0;
+		res->affected_rows = 0;
 
-	switch (query_ctx->status) {
-	case SQL_QUERY_PREPARED:
 		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
-		err = PQsendQuery(sql_conn->db, query_ctx->query_str);
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		if (sql_conn->pipeline) {
+			err = sql_query_send_pipelined(talloc_get_type_abort(query_ctx->inst->driver_submodule->data,
+									     rlm_sql_postgresql_t),
+						       sql_conn, query_ctx, res);
+		} else
+#endif
+		err = sql_query_send(talloc_get_type_abort(query_ctx->inst->driver_submodule->data, rlm_sql_postgresql_t),
+				     sql_conn, query_ctx);
 		query_ctx->tconn = tconn;
 		if (!err) {
 			ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
@@ -379,14 +769,209 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 		}
 
 		query_ctx->status = SQL_QUERY_SUBMITTED;
-		sql_conn->query_ctx = query_ctx;
 		trunk_request_signal_sent(treq);
-		return;
 
-	default:
+		if (!sql_conn->pipeline) {
+			sql_conn->query_ctx = query_ctx;
+			return;
+		}
+
+		sql_conn->pipeline[(sql_conn->pipeline_head + sql_conn->pipeline_count) %
+				   talloc_array_length(sql_conn->pipeline)] = query_ctx;
+		sql_conn->pipeline_count++;
+	}
+}
+
+/** Record the status of a query's result, and map it to an rcode
+ *
+ */
+static sql_rcode_t sql_result_status(rlm_sql_postgresql_t *inst, request_t *request, rlm_sql_postgres_query_t *res)
+{
+	ExecStatusType		status;
+	int			numfields;
+
+	status = PQresultStatus(res->result);
+	switch (status){
+	/*
+	 *  Successful completion of a command returning no data.
+	 */
+	case PGRES_COMMAND_OK:
+		/*
+		 *  Affected_rows function only returns the number of affected rows of a command
+		 *  returning no data...
+		 */
+		res->affected_rows = affected_rows(res->result);
+		ROPTIONAL(RDEBUG2, DEBUG2, "query affected rows = %i", res->affected_rows);
+		break;
+	/*
+	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 */
+#ifdef HAVE_PGRES_SINGLE_TUPLE
+	case PGRES_SINGLE_TUPLE:
+#endif
+#ifdef HAVE_PGRES_TUPLES_CHUNK
+	case PGRES_TUPLES_CHUNK:
+#endif
+	case PGRES_TUPLES_OK:
+		res->cur_row = 0;
+		res->affected_rows = PQntuples(res->result);
+		numfields = PQnfields(res->result); /*Check row storing functions..*/
+		ROPTIONAL(RDEBUG2, DEBUG2, "query returned rows = %i, fields = %i", res->affected_rows, numfields);
+		break;
+
+#ifdef HAVE_PGRES_COPY_BOTH
+	case PGRES_COPY_BOTH:
+#endif
+	case PGRES_COPY_OUT:
+	case PGRES_COPY_IN:
+		DEBUG2("Data transfer started");
+		break;
+
+	/*
+	 *  Weird.. this shouldn't happen.
+	 */
+	case PGRES_EMPTY_QUERY:
+	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
+	case PGRES_NONFATAL_ERROR:
+	case PGRES_FATAL_ERROR:
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	case PGRES_PIPELINE_SYNC:
+	case PGRES_PIPELINE_ABORTED:
+#endif
+		break;
+	}
+
+	return sql_classify_error(inst, status, res->result);
+}
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+/** Read the results of pipelined queries
+ *
+ * Results arrive in the order the queries were sent.  A query is complete once
+ * the sync point following it has been reached.
+ */
+static void sql_trunk_request_demux_pipeline(rlm_sql_postgres_conn_t *sql_conn)
+{
+	uint32_t		len = talloc_array_length(sql_conn->pipeline);
+	fr_sql_query_t		*query_ctx;
+	request_t		*request;
+	rlm_sql_postgres_query_t *res;
+	PGresult		*result;
+
+	if (PQconsumeInput(sql_conn->db) == 0) {
+		ERROR("SQL query failed: %s", PQerrorMessage(sql_conn->db));
+
+		while (sql_conn->pipeline_count > 0) {
+			query_ctx = sql_conn->pipeline[sql_conn->pipeline_head];
+			sql_conn->pipeline[sql_conn->pipeline_head] = NULL;
+			sql_conn->pipeline_head = (sql_conn->pipeline_head + 1) % len;
+			sql_conn->pipeline_count--;
+
+			if (!query_ctx) continue;
+			query_ctx->rcode = RLM_SQL_ERROR;
+			if (query_ctx->request) unlang_interpret_mark_runnable(query_ctx->request);
+		}
 		return;
 	}
+
+	while (sql_conn->pipeline_count > 0) {
+		if (PQisBusy(sql_conn->db)) return;
+
+		/*
+		 *	NULL marks the end of one query's results,
+		 *	the sync point follows it.
+		 */
+		result = PQgetResult(sql_conn->db);
+		if (!result) continue;
+
+		query_ctx = sql_conn->pipeline[sql_conn->pipeline_head];
+
+		if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+			PQclear(result);
+
+			sql_conn->pipeline[sql_conn->pipeline_head] = NULL;
+			sql_conn->pipeline_head = (sql_conn->pipeline_head + 1) % len;
+			sql_conn->pipeline_count--;
+
+			if (!query_ctx) continue;	/* Cancelled */
+
+			request = query_ctx->request;
+			res = sql_query_result(query_ctx);
+
+			/*
+			 *	The statement couldn't be prepared, so the query
+			 *	was aborted.  Send it again as text, there's room
+			 *	in the pipeline as its entry has just been freed.
+			 */
+			if (res->stmt && !res->stmt->prepared && (!res->result || (query_ctx->rcode != RLM_SQL_OK))) {
+				if (res->result) {
+					PQclear(res->result);
+					res->result = NULL;
+				}
+				res->stmt = NULL;
+
+				ROPTIONAL(RDEBUG2, DEBUG2, "Sending query as text: %s", query_ctx->query_str);
+				if (sql_query_send_text_pipelined(sql_conn, query_ctx)) {
+					sql_conn->pipeline[(sql_conn->pipeline_head + sql_conn->pipeline_count) % len] = query_ctx;
+					sql_conn->pipeline_count++;
+					continue;
+				}
+
+				ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
+				query_ctx->rcode = RLM_SQL_RECONNECT;
+				query_ctx->status = SQL_QUERY_RETURNED;
+				if (request) unlang_interpret_mark_runnable(request);
+				continue;
+			}
+
+			if (!res->result) {
+				ROPTIONAL(RERROR, ERROR, "Failed getting query result: %s", PQerrorMessage(sql_conn->db));
+				query_ctx->rcode = RLM_SQL_ERROR;
+			}
+			query_ctx->status = SQL_QUERY_RETURNED;
+			if (request) unlang_interpret_mark_runnable(request);
+			continue;
+		}
+
+		/*
+		 *	Results for cancelled queries are discarded.
+		 */
+		if (!query_ctx) {
+			PQclear(result);
+			continue;
+		}
+		res = sql_query_result(query_ctx);
+
+		/*
+		 *	Result of preparing the statement, the result of
+		 *	executing it follows.
+		 */
+		if (res->preparing) {
+			res->preparing = false;
+			if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Failed preparing statement %s: %s",
+					  res->stmt->name, PQresultErrorMessage(result));
+				res->stmt->prepared = false;
+			}
+			PQclear(result);
+			continue;
+		}
+
+		/*
+		 *	Results after the first for a query are discarded.
+		 */
+		if (res->result) {
+			PQclear(result);
+			continue;
+		}
+
+		res->result = result;
+		query_ctx->rcode = sql_result_status(talloc_get_type_abort(query_ctx->inst->driver_submodule->data,
+									   rlm_sql_postgresql_t),
+						     query_ctx->request, res);
+	}
 }
+#endif
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_connection_t *tconn,
@@ -395,14 +980,21 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
 	rlm_sql_postgresql_t	*inst;
 	fr_sql_query_t		*query_ctx;
+	rlm_sql_postgres_query_t *res;
 	request_t		*request;
 	PGresult		*tmp_result;
-	ExecStatusType		status;
-	int			numfields;
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	if (sql_conn->pipeline) {
+		sql_trunk_request_demux_pipeline(sql_conn);
+		return;
+	}
+#endif
 
 	query_ctx = sql_conn->query_ctx;
 	request = query_ctx->request;
 	inst = talloc_get_type_abort(query_ctx->inst->driver_submodule->data, rlm_sql_postgresql_t);
+	res = sql_query_result(query_ctx);
 
 	switch (query_ctx->status) {
 	case SQL_QUERY_SUBMITTED:
@@ -415,7 +1007,7 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 
 		query_ctx->status = SQL_QUERY_RETURNED;
 
-		sql_conn->result = PQgetResult(sql_conn->db);
+		res->result = PQgetResult(sql_conn->db);
 
 		/* Discard results for appended queries */
 		while ((tmp_result = PQgetResult(sql_conn->db)) != NULL)
@@ -426,64 +1018,45 @@ static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_con
 		 *  condition return value WILL be wrong SOME of the time
 		 *  regardless! Pick your poison...
 		 */
-		if (!sql_conn->result) {
+		if (!res->result) {
 			ROPTIONAL(RERROR, ERROR, "Failed getting query result: %s", PQerrorMessage(sql_conn->db));
 			query_ctx->rcode = RLM_SQL_RECONNECT;
 			break;
 		}
 
-		status = PQresultStatus(sql_conn->result);
-		switch (status){
-		/*
-		 *  Successful completion of a command returning no data.
-		 */
-		case PGRES_COMMAND_OK:
-			/*
-			 *  Affected_rows function only returns the number of affected rows of a command
-			 *  returning no data...
-			 */
-			sql_conn->affected_rows = affected_rows(sql_conn->result);
-			ROPTIONAL(RDEBUG2, DEBUG2, "query affected rows = %i", sql_conn->affected_rows);
-			break;
-		/*
-		 *  Successful completion of a command returning data (such as a SELECT or SHOW).
-		 */
-#ifdef HAVE_PGRES_SINGLE_TUPLE
-		case PGRES_SINGLE_TUPLE:
-#endif
-#ifdef HAVE_PGRES_TUPLES_CHUNK
-		case PGRES_TUPLES_CHUNK:
-#endif
-		case PGRES_TUPLES_OK:
-			sql_conn->cur_row = 0;
-			sql_conn->affected_rows = PQntuples(sql_conn->result);
-			numfields = PQnfields(sql_conn->result); /*Check row storing functions..*/
-			ROPTIONAL(RDEBUG2, DEBUG2, "query returned rows = %i, fields = %i", sql_conn->affected_rows, numfields);
-			break;
-
-#ifdef HAVE_PGRES_COPY_BOTH
-		case PGRES_COPY_BOTH:
-#endif
-		case PGRES_COPY_OUT:
-		case PGRES_COPY_IN:
-			DEBUG2("Data transfer started");
-			break;
-
 		/*
-		 *  Weird.. this shouldn't happen.
+		 *  That was the result of preparing the statement,
+		 *  now send the actual query.
 		 */
-		case PGRES_EMPTY_QUERY:
-		case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
-		case PGRES_NONFATAL_ERROR:
-		case PGRES_FATAL_ERROR:
-#ifdef HAVE_PGRES_PIPELINE_SYNC
-		case PGRES_PIPELINE_SYNC:
-		case PGRES_PIPELINE_ABORTED:
-#endif
-			break;
+		if (sql_conn->preparing) {
+			rlm_sql_postgres_stmt_t	*stmt = sql_conn->preparing;
+			int			err;
+
+			sql_conn->preparing = NULL;
+
+			if (PQresultStatus(res->result) == PGRES_COMMAND_OK) {
+				err = PQsendQueryPrepared(sql_conn->db, stmt->name, talloc_array_length(sql_conn->params),
+							  (char const * const *)sql_conn->params, NULL, NULL, 0);
+			} else {
+				ROPTIONAL(RDEBUG2, DEBUG2, "Failed preparing statement, sending query as text: %s",
+					  PQresultErrorMessage(res->result));
+				stmt->prepared = false;
+				err = PQsendQuery(sql_conn->db, query_ctx->query_str);
+			}
+			PQclear(res->result);
+			res->result = NULL;
+
+			if (!err) {
+				ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
+				query_ctx->rcode = RLM_SQL_RECONNECT;
+				break;
+			}
+
+			query_ctx->status = SQL_QUERY_SUBMITTED;
+			return;
 		}
 
-		query_ctx->rcode = sql_classify_error(inst, status, sql_conn->result);
+		query_ctx->rcode = sql_result_status(inst, request, res);
 		break;
 
 	default:
@@ -502,7 +1075,25 @@ static void sql_request_cancel(connection_t *conn, void *preq, trunk_cancel_reas
 
 	if (!query_ctx->treq) return;
 	if (reason != TRUNK_CANCEL_REASON_SIGNAL) return;
-	if (sql_conn->query_ctx == query_ctx) sql_conn->query_ctx = NULL;
+
+	/*
+	 *	The query's results are discarded when they arrive.
+	 */
+	if (sql_conn->pipeline) {
+		uint32_t i, len = talloc_array_length(sql_conn->pipeline);
+
+		for (i = 0; i < sql_conn->pipeline_count; i++) {
+			uint32_t slot = (sql_conn->pipeline_head + i) % len;
+
+			if (sql_conn->pipeline[slot] == query_ctx) sql_conn->pipeline[slot] = NULL;
+		}
+		return;
+	}
+
+	if (sql_conn->query_ctx == query_ctx) {
+		sql_conn->query_ctx = NULL;
+		sql_conn->preparing = NULL;
+	}
 }
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
@@ -516,6 +1107,13 @@ static void sql_request_cancel_mux(UNUSED fr_event_list_t *el, trunk_connection_
 	PGresult		*tmp_result;
 
 	if ((trunk_connection_pop_cancellation(&treq, tconn)) == 0) {
+		/*
+		 *	A cancel request would abort whichever query the
+		 *	server is running, which in pipeline mode may not
+		 *	be this one.  Let it run and discard its results.
+		 */
+		if (sql_conn->pipeline) goto complete;
+
 		cancel = PQgetCancel(sql_conn->db);
 		if (!cancel) goto complete;
 		if (PQcancel(cancel, errbuf, sizeof(errbuf)) == 0) {
@@ -540,17 +1138,19 @@ SQL_QUERY_RESUME
 
 static sql_rcode_t sql_fields(char const **out[], fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *res = sql_query_result(query_ctx);
 
 	int		fields, i;
 	char const	**names;
 
-	fields = PQnfields(conn->result);
+	if (!res->result) return RLM_SQL_ERROR;
+
+	fields = PQnfields(res->result);
 	if (fields <= 0) return RLM_SQL_ERROR;
 
 	MEM(names = talloc_array(query_ctx, char const *, fields));
 
-	for (i = 0; i < fields; i++) names[i] = PQfname(conn->result, i);
+	for (i = 0; i < fields; i++) names[i] = PQfname(res->result, i);
 	*out = names;
 
 	return RLM_SQL_OK;
@@ -560,28 +1160,28 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 {
 	fr_sql_query_t		*query_ctx = talloc_get_type_abort(uctx, fr_sql_query_t);
 	int			records, i, len;
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *res = sql_query_result(query_ctx);
 
 	query_ctx->row = NULL;
 
 	query_ctx->rcode = RLM_SQL_NO_MORE_ROWS;
-	if (conn->cur_row >= PQntuples(conn->result)) RETURN_MODULE_OK;
+	if (!res->result || (res->cur_row >= PQntuples(res->result))) RETURN_MODULE_OK;
 
-	free_result_row(conn);
+	free_result_row(res);
 
-	records = PQnfields(conn->result);
-	conn->num_fields = records;
+	records = PQnfields(res->result);
+	res->num_fields = records;
 
-	if ((PQntuples(conn->result) > 0) && (records > 0)) {
-		conn->row = talloc_zero_array(conn, char *, records + 1);
+	if ((PQntuples(res->result) > 0) && (records > 0)) {
+		res->row = talloc_zero_array(res, char *, records + 1);
 		for (i = 0; i < records; i++) {
-			if (PQgetisnull(conn->result, conn->cur_row, i)) continue;
-			len = PQgetlength(conn->result, conn->cur_row, i);
-			conn->row[i] = talloc_array(conn->row, char, len + 1);
-			strlcpy(conn->row[i], PQgetvalue(conn->result, conn->cur_row, i), len + 1);
+			if (PQgetisnull(res->result, res->cur_row, i)) continue;
+			len = PQgetlength(res->result, res->cur_row, i);
+			res->row[i] = talloc_array(res->row, char, len + 1);
+			strlcpy(res->row[i], PQgetvalue(res->result, res->cur_row, i), len + 1);
 		}
-		conn->cur_row++;
-		query_ctx->row = conn->row;
+		res->cur_row++;
+		query_ctx->row = res->row;
 
 		query_ctx->rcode = RLM_SQL_OK;
 	}
@@ -591,23 +1191,21 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 
 static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn;
-
-	if (query_ctx->treq && !(query_ctx->treq->state &
-	    (TRUNK_REQUEST_STATE_SENT | TRUNK_REQUEST_STATE_REAPABLE | TRUNK_REQUEST_STATE_COMPLETE))) return RLM_SQL_OK;
-
-	if (!query_ctx->tconn || !query_ctx->tconn->conn || !query_ctx->tconn->conn->h) return RLM_SQL_ERROR;
+	rlm_sql_postgres_query_t *res;
 
-	if (!(query_ctx->tconn->state & TRUNK_CONN_PROCESSING)) return RLM_SQL_ERROR;
-
-	conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	/*
+	 *	Results are held by the query, so can be freed
+	 *	whatever state the connection is in.
+	 */
+	if (!query_ctx->uctx) return RLM_SQL_OK;
+	res = talloc_get_type_abort(query_ctx->uctx, rlm_sql_postgres_query_t);
 
-	if (conn->result != NULL) {
-		PQclear(conn->result);
-		conn->result = NULL;
+	if (res->result != NULL) {
+		PQclear(res->result);
+		res->result = NULL;
 	}
 
-	free_result_row(conn);
+	free_result_row(res);
 
 	return 0;
 }
@@ -626,12 +1224,21 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 			fr_sql_query_t *query_ctx)
 {
 	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *res = query_ctx->uctx;
 	char const		*p, *q;
 	size_t			i = 0;
 
 	fr_assert(outlen > 0);
 
-	p = PQerrorMessage(conn->db);
+	/*
+	 *	Prefer the error for this query's result, in pipeline
+	 *	mode the connection's error may belong to another query.
+	 */
+	if (res && res->result && (*PQresultErrorMessage(res->result) != '\0')) {
+		p = PQresultErrorMessage(res->result);
+	} else {
+		p = PQerrorMessage(conn->db);
+	}
 	while ((q = strchr(p, '\n'))) {
 		out[i].type = L_ERR;
 		out[i].msg = talloc_typed_asprintf(ctx, "%.*s", (int) (q - p), p);
@@ -649,9 +1256,14 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 
 static int sql_affected_rows(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	return sql_query_result(query_ctx)->affected_rows;
+}
+
+static uint32_t sql_pipeline_depth(module_instance_t const *mi)
+{
+	rlm_sql_postgresql_t const *inst = talloc_get_type_abort_const(mi->data, rlm_sql_postgresql_t);
 
-	return conn->affected_rows;
+	return inst->pipeline_depth > 1 ? inst->pipeline_depth : 1;
 }
 
 static ssize_t sql_escape_func(request_t *request, char *out, size_t outlen, char const *in, void *arg)
@@ -691,6 +1303,14 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	char 			application_name[NAMEDATALEN];
 	char			*db_string;
 
+	FR_INTEGER_BOUND_CHECK("pipeline_depth", inst->pipeline_depth, >=, 1);
+#ifndef HAVE_PGRES_PIPELINE_SYNC
+	if (inst->pipeline_depth > 1) {
+		cf_log_err(mctx->mi->conf, "pipeline_depth > 1 requires libpq 14 or later");
+		return -1;
+	}
+#endif
+
 	/*
 	 *	Allow the user to set their own, or disable it
 	 */
@@ -853,6 +1473,7 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
+	.sql_pipeline_depth		= sql_pipeline_depth,
 	.sql_escape_func		= sql_escape_func,
 	.sql_escape_arg_alloc		= sql_escape_arg_alloc,
 	.sql_escape_arg_free		= sql_escape_arg_free,
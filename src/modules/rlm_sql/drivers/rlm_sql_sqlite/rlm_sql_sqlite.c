@@ -26,9 +26,14 @@ RCSID("$Id$")
 
 #define LOG_PREFIX "sql - sqlite"
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
 
+#include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
 
 #include <sqlite3.h>
@@ -50,19 +55,70 @@ RCSID("$Id$")
 typedef sqlite_int64 sqlite3_int64;
 #endif
 
+typedef struct rlm_sql_sqlite_writer_s rlm_sql_sqlite_writer_t;
+
 typedef struct {
-	sqlite3 *db;
-	sqlite3_stmt *statement;
-	int col_count;
+	sqlite3			*db;
+	rlm_sql_sqlite_writer_t	*writer;		//!< Writes are sent to.  NULL if they're run on this connection.
+	fr_event_list_t		*el;			//!< pipe[0] is inserted into.
+	int			pipe[2];		//!< The writer thread returns completed writes on.
+	uint32_t		outstanding;		//!< Writes sent to the writer thread, which haven't been returned.
 } rlm_sql_sqlite_conn_t;
 
+/** A write, run by the writer thread
+ *
+ * Everything the writer thread uses is copied into the job, so the
+ * query can be freed while the job is still running.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the writer's queue.
+	rlm_sql_sqlite_conn_t	*c;			//!< Connection which submitted the job.
+	fr_sql_query_t		*query_ctx;		//!< To resume.  NULL if the query was freed.
+	char			*query_str;		//!< Copy of the query.
+
+	sql_rcode_t		rcode;			//!< Written by the writer thread.
+	int			changes;		//!< Written by the writer thread.
+	char			error[256];		//!< Written by the writer thread, if rcode != RLM_SQL_OK.
+} rlm_sql_sqlite_job_t;
+
+/** State of a query, so that a connection can have several queries in progress
+ *
+ */
 typedef struct {
-	char const	*filename;
-	bool		bootstrap;
+	sqlite3_stmt		*statement;		//!< Being stepped through.
+	int			col_count;
+	int			changes;		//!< Rows changed by the query.
+	char			*error;			//!< Returned by the writer thread.
+	rlm_sql_sqlite_job_t	*job;			//!< Being run by the writer thread.
+} rlm_sql_sqlite_query_t;
+
+struct rlm_sql_sqlite_writer_s {
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	fr_dlist_head_t		queue;			//!< Jobs waiting for the writer thread.
+	bool			stop;			//!< Tell the writer thread to exit.
+	bool			running;		//!< Whether the thread was started.
+	pthread_t		thread;
+	sqlite3			*db;			//!< Only used by the writer thread.
+	uint32_t		batch_size;		//!< Maximum number of jobs per transaction.
+};
+
+typedef struct {
+	char const		*filename;
+	bool			bootstrap;
+
+	bool			writer_thread;		//!< Run writes in a dedicated thread.
+	uint32_t		writer_batch_size;	//!< Maximum number of writes per transaction.
+	uint32_t		pipeline_depth;		//!< Maximum number of queries in progress per connection.
+
+	rlm_sql_sqlite_writer_t	*writer;		//!< NULL unless writer_thread = yes.
 } rlm_sql_sqlite_t;
 
 static const conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_OUTPUT | CONF_FLAG_REQUIRED, rlm_sql_sqlite_t, filename) },
+	{ FR_CONF_OFFSET("writer_thread", rlm_sql_sqlite_t, writer_thread), .dflt = "no" },
+	{ FR_CONF_OFFSET("writer_batch_size", rlm_sql_sqlite_t, writer_batch_size), .dflt = "64" },
+	{ FR_CONF_OFFSET("pipeline_depth", rlm_sql_sqlite_t, pipeline_depth), .dflt = "32" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -369,6 +425,332 @@ static void _sql_greatest(sqlite3_context *ctx, int num_values, sqlite3_value **
 	sqlite3_result_int64(ctx, max);
 }
 
+/** Set the options every connection needs
+ *
+ */
+static int sql_db_init(sqlite3 *db, rlm_sql_config_t const *config)
+{
+	int status;
+
+	status = sqlite3_busy_timeout(db, fr_time_delta_to_msec(config->query_timeout));
+	if (sql_check_error(db, status) != RLM_SQL_OK) {
+		sql_print_error(db, status, "Error setting busy timeout");
+		return -1;
+	}
+
+	/*
+	 *	Enable extended return codes for extra debugging info.
+	 */
+	status = sqlite3_extended_result_codes(db, 1);
+	if (sql_check_error(db, status) != RLM_SQL_OK) {
+		sql_print_error(db, status, "Error enabling extended result codes");
+		return -1;
+	}
+
+	status = sqlite3_create_function_v2(db, "GREATEST", -1, SQLITE_ANY, NULL,
+					    _sql_greatest, NULL, NULL, NULL);
+	if (sql_check_error(db, status) != RLM_SQL_OK) {
+		sql_print_error(db, status, "Failed registering 'GREATEST' sql function");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Run one job, and record the result in it
+ *
+ * Runs in the writer thread, so doesn't log, or touch anything outside the job.
+ */
+static void sql_writer_exec(sqlite3 *db, rlm_sql_sqlite_job_t *job)
+{
+	sqlite3_stmt	*statement = NULL;
+	int		status;
+
+	status = sqlite3_prepare_v2(db, job->query_str, -1, &statement, NULL);
+	if (status == SQLITE_OK) {
+		while ((status = sqlite3_step(statement)) == SQLITE_ROW);
+	}
+
+	job->rcode = sql_check_error(db, status);
+	if (job->rcode == RLM_SQL_OK) {
+		job->changes = sqlite3_changes(db);
+	} else {
+		strlcpy(job->error, sqlite3_errmsg(db), sizeof(job->error));
+	}
+
+	(void) sqlite3_finalize(statement);
+}
+
+/** Run a batch of jobs in a single transaction
+ *
+ * Committing the batch at once means one sync of the WAL, instead of
+ * one per job.  Each job runs in its own savepoint, so a job which fails
+ * doesn't affect the others.
+ */
+static void sql_writer_batch(sqlite3 *db, fr_dlist_head_t *batch)
+{
+	rlm_sql_sqlite_job_t	*job = NULL;
+	bool			txn;
+
+	txn = (fr_dlist_num_elements(batch) > 1) &&
+	      (sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) == SQLITE_OK);
+
+	while ((job = fr_dlist_next(batch, job))) {
+		if (!txn) {
+			sql_writer_exec(db, job);
+			continue;
+		}
+
+		(void) sqlite3_exec(db, "SAVEPOINT fr_job", NULL, NULL, NULL);
+		sql_writer_exec(db, job);
+		if (job->rcode != RLM_SQL_OK) (void) sqlite3_exec(db, "ROLLBACK TO fr_job", NULL, NULL, NULL);
+		(void) sqlite3_exec(db, "RELEASE fr_job", NULL, NULL, NULL);
+	}
+
+	if (txn && (sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)) {
+		char error[256];
+
+		strlcpy(error, sqlite3_errmsg(db), sizeof(error));
+		(void) sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+		while ((job = fr_dlist_next(batch, job))) {
+			if (job->rcode != RLM_SQL_OK) continue;
+
+			job->rcode = RLM_SQL_ERROR;
+			job->changes = 0;
+			strlcpy(job->error, error, sizeof(job->error));
+		}
+	}
+}
+
+static void *sql_writer_thread(void *arg)
+{
+	rlm_sql_sqlite_writer_t	*writer = arg;
+	rlm_sql_sqlite_job_t	*job;
+	fr_dlist_head_t		batch;
+	sigset_t		sigset;
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	fr_dlist_init(&batch, rlm_sql_sqlite_job_t, entry);
+
+	pthread_mutex_lock(&writer->mutex);
+	while (true) {
+		if (fr_dlist_empty(&writer->queue)) {
+			if (writer->stop) break;
+
+			pthread_cond_wait(&writer->cond, &writer->mutex);
+			continue;
+		}
+
+		/*
+		 *	Take everything which queued up while the
+		 *	last batch was running.
+		 */
+		while ((fr_dlist_num_elements(&batch) < writer->batch_size) &&
+		       (job = fr_dlist_pop_head(&writer->queue))) fr_dlist_insert_tail(&batch, job);
+		pthread_mutex_unlock(&writer->mutex);
+
+		sql_writer_batch(writer->db, &batch);
+
+		/*
+		 *	Hand the jobs back to the connections which
+		 *	submitted them.  Writes of a pointer to a pipe
+		 *	are atomic.
+		 */
+		while ((job = fr_dlist_pop_head(&batch))) {
+			while ((write(job->c->pipe[1], &job, sizeof(job)) < 0) && (errno == EINTR));
+		}
+
+		pthread_mutex_lock(&writer->mutex);
+	}
+	pthread_mutex_unlock(&writer->mutex);
+
+	return NULL;
+}
+
+static int _sql_writer_free(rlm_sql_sqlite_writer_t *writer)
+{
+	if (writer->running) {
+		pthread_mutex_lock(&writer->mutex);
+		writer->stop = true;
+		pthread_cond_signal(&writer->cond);
+		pthread_mutex_unlock(&writer->mutex);
+
+		(void) pthread_join(writer->thread, NULL);
+	}
+
+	if (writer->db) (void) sqlite3_close(writer->db);
+
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->mutex);
+
+	return 0;
+}
+
+/** Open the writer's connection, and start the writer thread
+ *
+ */
+static int sql_writer_start(rlm_sql_sqlite_t *inst, rlm_sql_config_t const *config)
+{
+	rlm_sql_sqlite_writer_t	*writer;
+	int			status;
+
+	MEM(writer = talloc_zero(NULL, rlm_sql_sqlite_writer_t));
+	pthread_mutex_init(&writer->mutex, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	fr_dlist_init(&writer->queue, rlm_sql_sqlite_job_t, entry);
+	writer->batch_size = inst->writer_batch_size;
+	talloc_set_destructor(writer, _sql_writer_free);
+
+	status = sqlite3_open_v2(inst->filename, &writer->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
+	if (!writer->db || (sql_check_error(writer->db, status) != RLM_SQL_OK)) {
+		sql_print_error(writer->db, status, "Error opening SQLite database \"%s\"", inst->filename);
+	error:
+		talloc_free(writer);
+		return -1;
+	}
+
+	if (sql_db_init(writer->db, config) < 0) goto error;
+
+	/*
+	 *	The journal mode is stored in the database, so the
+	 *	connections the workers open use WAL too.  With WAL,
+	 *	readers don't wait for the writer, or the writer for
+	 *	the readers.
+	 */
+	status = sqlite3_exec(writer->db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+	if (sql_check_error(writer->db, status) != RLM_SQL_OK) {
+		sql_print_error(writer->db, status, "Failed enabling WAL mode");
+		goto error;
+	}
+
+	if (fr_schedule_pthread_create(&writer->thread, sql_writer_thread, writer) < 0) {
+		PERROR("Failed starting writer thread");
+		goto error;
+	}
+	writer->running = true;
+	inst->writer = writer;
+
+	return 0;
+}
+
+static int _sql_query_state_free(rlm_sql_sqlite_query_t *q)
+{
+	/*
+	 *	The job is freed when the writer returns it.
+	 */
+	if (q->job) q->job->query_ctx = NULL;
+
+	return 0;
+}
+
+/** Return the state for a query, allocating it if needed
+ *
+ */
+static rlm_sql_sqlite_query_t *sql_query_state(fr_sql_query_t *query_ctx)
+{
+	rlm_sql_sqlite_query_t *q;
+
+	if (query_ctx->uctx) {
+		q = talloc_get_type_abort(query_ctx->uctx, rlm_sql_sqlite_query_t);
+		TALLOC_FREE(q->error);
+		q->changes = 0;
+		return q;
+	}
+
+	MEM(q = talloc_zero(query_ctx, rlm_sql_sqlite_query_t));
+	talloc_set_destructor(q, _sql_query_state_free);
+	query_ctx->uctx = q;
+
+	return q;
+}
+
+/** Whether a query starts or ends a transaction
+ *
+ * The writer thread runs its own transactions, and reads don't run on
+ * the writer's connection, so transactions made up of several queries
+ * can't work.
+ */
+static bool sql_is_transaction(char const *query)
+{
+	static char const *keywords[] = { "BEGIN", "COMMIT", "END", "ROLLBACK", "SAVEPOINT", "RELEASE" };
+	size_t i;
+
+	while (isspace((uint8_t)*query)) query++;
+
+	for (i = 0; i < NUM_ELEMENTS(keywords); i++) {
+		size_t len = strlen(keywords[i]);
+
+		if ((strncasecmp(query, keywords[i], len) == 0) &&
+		    !isalnum((uint8_t)query[len]) && (query[len] != '_')) return true;
+	}
+
+	return false;
+}
+
+/** Send a write to the writer thread
+ *
+ */
+static void sql_job_send(rlm_sql_sqlite_conn_t *c, fr_sql_query_t *query_ctx, rlm_sql_sqlite_query_t *q)
+{
+	rlm_sql_sqlite_job_t	*job;
+
+	MEM(job = talloc_zero(NULL, rlm_sql_sqlite_job_t));
+	job->c = c;
+	job->query_ctx = query_ctx;
+	MEM(job->query_str = talloc_typed_strdup(job, query_ctx->query_str));
+
+	q->job = job;
+	query_ctx->status = SQL_QUERY_SUBMITTED;
+	c->outstanding++;
+
+	pthread_mutex_lock(&c->writer->mutex);
+	fr_dlist_insert_tail(&c->writer->queue, job);
+	pthread_cond_signal(&c->writer->cond);
+	pthread_mutex_unlock(&c->writer->mutex);
+}
+
+/** Record the result of a write returned by the writer thread, and resume the request
+ *
+ */
+static void sql_job_done(rlm_sql_sqlite_conn_t *c, rlm_sql_sqlite_job_t *job)
+{
+	fr_sql_query_t		*query_ctx = job->query_ctx;
+	rlm_sql_sqlite_query_t	*q;
+
+	c->outstanding--;
+
+	/*
+	 *	The query was freed while the job was running,
+	 *	so no one is waiting for the result.
+	 */
+	if (!query_ctx) {
+		talloc_free(job);
+		return;
+	}
+
+	q = talloc_get_type_abort(query_ctx->uctx, rlm_sql_sqlite_query_t);
+	q->job = NULL;
+	q->changes = job->changes;
+	if (job->rcode != RLM_SQL_OK) MEM(q->error = talloc_typed_strdup(q, job->error));
+
+	query_ctx->rcode = job->rcode;
+	query_ctx->status = SQL_QUERY_RETURNED;
+	talloc_free(job);
+
+	if (query_ctx->request) unlang_interpret_mark_runnable(query_ctx->request);
+}
+
+static void sql_job_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_sqlite_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_sqlite_conn_t);
+	rlm_sql_sqlite_job_t	*job;
+
+	while (read(fd, &job, sizeof(job)) == sizeof(job)) sql_job_done(c, job);
+}
+
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static connection_state_t _sql_connection_init(void **h, connection_t *conn, void *uctx)
 {
@@ -379,6 +761,7 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 	int			status;
 
 	MEM(c = talloc_zero(conn, rlm_sql_sqlite_conn_t));
+	c->pipe[0] = c->pipe[1] = -1;
 
 	INFO("Opening SQLite database \"%s\"", inst->filename);
 	status = sqlite3_open_v2(inst->filename, &(c->db), SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
@@ -389,29 +772,40 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 			INFO("Use the sqlite driver 'bootstrap' option to automatically create the database file");
 		}
 	error:
+		if (c->db) (void) sqlite3_close(c->db);
+		if (c->pipe[0] >= 0) {
+			close(c->pipe[0]);
+			close(c->pipe[1]);
+		}
 		talloc_free(c);
 		return CONNECTION_STATE_FAILED;
 	}
-	status = sqlite3_busy_timeout(c->db, fr_time_delta_to_sec(config->query_timeout));
-	if (sql_check_error(c->db, status) != RLM_SQL_OK) {
-		sql_print_error(c->db, status, "Error setting busy timeout");
-		goto error;
-	}
+
+	if (sql_db_init(c->db, config) < 0) goto error;
 
 	/*
-	 *	Enable extended return codes for extra debugging info.
+	 *	Writes go to the writer thread, so this connection
+	 *	is only used for reads.
 	 */
-	status = sqlite3_extended_result_codes(c->db, 1);
-	if (sql_check_error(c->db, status) != RLM_SQL_OK) {
-		sql_print_error(c->db, status, "Error enabling extended result codes");
-		goto error;
-	}
+	if (inst->writer) {
+		status = sqlite3_exec(c->db, "PRAGMA query_only = 1", NULL, NULL, NULL);
+		if (sql_check_error(c->db, status) != RLM_SQL_OK) {
+			sql_print_error(c->db, status, "Failed making connection read-only");
+			goto error;
+		}
 
-	status = sqlite3_create_function_v2(c->db, "GREATEST", -1, SQLITE_ANY, NULL,
-					    _sql_greatest, NULL, NULL, NULL);
-	if (sql_check_error(c->db, status) != RLM_SQL_OK) {
-		sql_print_error(c->db, status, "Failed registering 'GREATEST' sql function");
-		goto error;
+		if (pipe(c->pipe) < 0) {
+			ERROR("Failed creating pipe: %s", fr_syserror(errno));
+			goto error;
+		}
+		(void) fr_nonblock(c->pipe[0]);
+
+		if (fr_event_fd_insert(c, NULL, conn->el, c->pipe[0], sql_job_read, NULL, NULL, c) < 0) {
+			PERROR("Failed inserting pipe");
+			goto error;
+		}
+		c->writer = inst->writer;
+		c->el = conn->el;
 	}
 
 	*h = c;
@@ -426,6 +820,29 @@ static void _sql_connection_close(UNUSED fr_event_list_t *el, void *h, UNUSED vo
 
 	DEBUG2("Socket destructor called, closing socket");
 
+	/*
+	 *	Wait for the writer to return the jobs from this
+	 *	connection, as it writes to our pipe.
+	 */
+	if (c->writer) {
+		rlm_sql_sqlite_job_t *job;
+
+		(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
+		(void) fr_blocking(c->pipe[0]);
+
+		while (c->outstanding > 0) {
+			if (read(c->pipe[0], &job, sizeof(job)) != sizeof(job)) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			sql_job_done(c, job);
+		}
+
+		close(c->pipe[0]);
+		close(c->pipe[1]);
+		c->writer = NULL;
+	}
+
 	if (c->db) {
 		status = sqlite3_close(c->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
@@ -435,17 +852,17 @@ static void _sql_connection_close(UNUSED fr_event_list_t *el, void *h, UNUSED vo
 
 static sql_rcode_t sql_fields(char const **out[], fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_sqlite_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_sqlite_conn_t);
+	rlm_sql_sqlite_query_t *q = talloc_get_type_abort(query_ctx->uctx, rlm_sql_sqlite_query_t);
 
 	int		fields, i;
 	char const	**names;
 
-	fields = sqlite3_column_count(conn->statement);
+	fields = sqlite3_column_count(q->statement);
 	if (fields <= 0) return RLM_SQL_ERROR;
 
 	MEM(names = talloc_array(query_ctx, char const *, fields));
 
-	for (i = 0; i < fields; i++) names[i] = sqlite3_column_name(conn->statement, i);
+	for (i = 0; i < fields; i++) names[i] = sqlite3_column_name(q->statement, i);
 	*out = names;
 
 	return RLM_SQL_OK;
@@ -456,6 +873,7 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 	fr_sql_query_t		*query_ctx = talloc_get_type_abort(uctx, fr_sql_query_t);
 	int			status, i = 0;
 	rlm_sql_sqlite_conn_t	*conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_sqlite_conn_t);
+	rlm_sql_sqlite_query_t	*q = talloc_get_type_abort(query_ctx->uctx, rlm_sql_sqlite_query_t);
 	char			**row;
 
 	TALLOC_FREE(query_ctx->row);
@@ -463,7 +881,7 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 	/*
 	 *	Executes the SQLite query and iterates over the results
 	 */
-	status = sqlite3_step(conn->statement);
+	status = sqlite3_step(q->statement);
 
 	/*
 	 *	Error getting next row
@@ -486,30 +904,30 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 	 *	We only need to do this once per result set, because
 	 *	the number of columns won't change.
 	 */
-	if (conn->col_count == 0) {
-		conn->col_count = sqlite3_column_count(conn->statement);
-		if (conn->col_count == 0) goto error;
+	if (q->col_count == 0) {
+		q->col_count = sqlite3_column_count(q->statement);
+		if (q->col_count == 0) goto error;
 	}
 
 	/*
 	 *	Free the previous result (also gets called on finish_query)
 	 */
-	MEM(row = query_ctx->row = talloc_zero_array(query_ctx, char *, conn->col_count + 1));
+	MEM(row = query_ctx->row = talloc_zero_array(query_ctx, char *, q->col_count + 1));
 
-	for (i = 0; i < conn->col_count; i++) {
-		switch (sqlite3_column_type(conn->statement, i)) {
+	for (i = 0; i < q->col_count; i++) {
+		switch (sqlite3_column_type(q->statement, i)) {
 		case SQLITE_INTEGER:
-			MEM(row[i] = talloc_typed_asprintf(row, "%d", sqlite3_column_int(conn->statement, i)));
+			MEM(row[i] = talloc_typed_asprintf(row, "%d", sqlite3_column_int(q->statement, i)));
 			break;
 
 		case SQLITE_FLOAT:
-			MEM(row[i] = talloc_typed_asprintf(row, "%f", sqlite3_column_double(conn->statement, i)));
+			MEM(row[i] = talloc_typed_asprintf(row, "%f", sqlite3_column_double(q->statement, i)));
 			break;
 
 		case SQLITE_TEXT:
 		{
 			char const *p;
-			p = (char const *) sqlite3_column_text(conn->statement, i);
+			p = (char const *) sqlite3_column_text(q->statement, i);
 
 			if (p) MEM(row[i] = talloc_typed_strdup(row, p));
 		}
@@ -520,9 +938,9 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 			uint8_t const *p;
 			size_t len;
 
-			p = sqlite3_column_blob(conn->statement, i);
+			p = sqlite3_column_blob(q->statement, i);
 			if (p) {
-				len = sqlite3_column_bytes(conn->statement, i);
+				len = sqlite3_column_bytes(q->statement, i);
 
 				MEM(row[i] = talloc_zero_array(row, char, len + 1));
 				memcpy(row[i], p, len);
@@ -541,14 +959,17 @@ static unlang_action_t sql_fetch_row(rlm_rcode_t *p_result, UNUSED int *priority
 
 static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_sqlite_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_sqlite_conn_t);
+	rlm_sql_sqlite_query_t *q;
 
-	if (conn->statement) {
+	if (!query_ctx->uctx) return RLM_SQL_OK;
+	q = talloc_get_type_abort(query_ctx->uctx, rlm_sql_sqlite_query_t);
+
+	if (q->statement) {
 		TALLOC_FREE(query_ctx->row);
 
-		(void) sqlite3_finalize(conn->statement);
-		conn->statement = NULL;
-		conn->col_count = 0;
+		(void) sqlite3_finalize(q->statement);
+		q->statement = NULL;
+		q->col_count = 0;
 	}
 
 	/*
@@ -575,11 +996,20 @@ static size_t sql_error(UNUSED TALLOC_CTX *ctx, sql_log_entry_t out[], NDEBUG_UN
 			fr_sql_query_t *query_ctx)
 {
 	rlm_sql_sqlite_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_sqlite_conn_t);
+	rlm_sql_sqlite_query_t *q = query_ctx->uctx;
 	char const *error;
 
 	fr_assert(outlen > 0);
 
-	error = sqlite3_errmsg(conn->db);
+	/*
+	 *	Errors from the writer thread are copied into the
+	 *	query, as the writer's connection is in use.
+	 */
+	if (q && q->error) {
+		error = q->error;
+	} else {
+		error = sqlite3_errmsg(conn->db);
+	}
 	if (!error) return 0;
 
 	out[0].type = L_ERR;
@@ -596,11 +1026,22 @@ static sql_rcode_t sql_finish_query(fr_sql_query_t *query_ctx, rlm_sql_config_t
 static int sql_affected_rows(fr_sql_query_t *query_ctx,
 			     UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_sqlite_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_sqlite_conn_t);
+	if (!query_ctx->uctx) return -1;
 
-	if (conn->db) return sqlite3_changes(conn->db);
+	return talloc_get_type_abort(query_ctx->uctx, rlm_sql_sqlite_query_t)->changes;
+}
 
-	return -1;
+static uint32_t sql_pipeline_depth(module_instance_t const *mi)
+{
+	rlm_sql_sqlite_t const *inst = talloc_get_type_abort_const(mi->data, rlm_sql_sqlite_t);
+
+	/*
+	 *	Without the writer thread, queries run to completion
+	 *	on the worker, one at a time.
+	 */
+	if (!inst->writer_thread) return 1;
+
+	return inst->pipeline_depth > 1 ? inst->pipeline_depth : 1;
 }
 
 SQL_TRUNK_CONNECTION_ALLOC
@@ -613,34 +1054,54 @@ static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t
 	trunk_request_t		*treq;
 	request_t		*request;
 	fr_sql_query_t		*query_ctx;
+	rlm_sql_sqlite_query_t	*q;
 	int			status;
 	char const		*z_tail;
 
-	if (trunk_connection_pop_request(&treq, tconn) != 0) return;
-	if (!treq) return;
+	while ((trunk_connection_pop_request(&treq, tconn) == 0) && treq) {
+		query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
+		request = query_ctx->request;
+		query_ctx->tconn = tconn;
+		q = sql_query_state(query_ctx);
 
-	query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
-	request = query_ctx->request;
-	query_ctx->tconn = tconn;
+		/*
+		 *	Writes are run by the writer thread, and the
+		 *	request yields until the writer returns them.
+		 */
+		if (sql_conn->writer && (query_ctx->type == SQL_QUERY_OTHER)) {
+			if (sql_is_transaction(query_ctx->query_str)) {
+				ROPTIONAL(RERROR, ERROR, "Transactions can't be used with 'writer_thread = yes': %s",
+					  query_ctx->query_str);
+				query_ctx->rcode = RLM_SQL_ERROR;
+				goto error;
+			}
 
-	ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
-	status = sqlite3_prepare_v2(sql_conn->db, query_ctx->query_str, strlen(query_ctx->query_str),
-				    &sql_conn->statement, &z_tail);
-	query_ctx->rcode = sql_check_error(sql_conn->db, status);
-	if (query_ctx->rcode != RLM_SQL_OK) {
-	error:
-		query_ctx->status = SQL_QUERY_FAILED;
-		trunk_request_signal_fail(treq);
-		return;
-	}
+			ROPTIONAL(RDEBUG2, DEBUG2, "Sending query to writer: %s", query_ctx->query_str);
+			sql_job_send(sql_conn, query_ctx, q);
+			trunk_request_signal_sent(treq);
+			continue;
+		}
 
-	if (query_ctx->type == SQL_QUERY_OTHER) {
-		status = sqlite3_step(sql_conn->statement);
+		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
+		status = sqlite3_prepare_v2(sql_conn->db, query_ctx->query_str, strlen(query_ctx->query_str),
+					    &q->statement, &z_tail);
 		query_ctx->rcode = sql_check_error(sql_conn->db, status);
-		if (query_ctx->rcode == RLM_SQL_ERROR) goto error;
-	}
+		if (query_ctx->rcode != RLM_SQL_OK) {
+		error:
+			query_ctx->status = SQL_QUERY_FAILED;
+			trunk_request_signal_fail(treq);
+			continue;
+		}
 
-	trunk_request_signal_reapable(treq);
+		if (query_ctx->type == SQL_QUERY_OTHER) {
+			status = sqlite3_step(q->statement);
+			query_ctx->rcode = sql_check_error(sql_conn->db, status);
+			if (query_ctx->rcode == RLM_SQL_ERROR) goto error;
+			q->changes = sqlite3_changes(sql_conn->db);
+		}
+
+		trunk_request_signal_reapable(treq);
+	}
 }
 
 SQL_QUERY_RESUME
@@ -676,6 +1137,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 							   main_config->raddb_dir, config->sql_db));
 	}
 
+	FR_INTEGER_BOUND_CHECK("writer_batch_size", inst->writer_batch_size, >=, 1);
+	FR_INTEGER_BOUND_CHECK("writer_batch_size", inst->writer_batch_size, <=, 10000);
+	FR_INTEGER_BOUND_CHECK("pipeline_depth", inst->pipeline_depth, >=, 1);
+	FR_INTEGER_BOUND_CHECK("pipeline_depth", inst->pipeline_depth, <=, 1000);
+
 	/*
 	 *	We will try to create the database if it doesn't exist, up to and
 	 * 	including creating the directory it should live in, in which case
@@ -777,6 +1243,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	}
 
 	close(fd);
+
+	if (inst->writer_thread && (sql_writer_start(inst, config) < 0)) return -1;
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_sql_sqlite_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_sql_sqlite_t);
+
+	TALLOC_FREE(inst->writer);
+
 	return 0;
 }
 
@@ -800,12 +1278,14 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 		.inst_size			= sizeof(rlm_sql_sqlite_t),
 		.config				= driver_config,
 		.onload				= mod_load,
-		.instantiate			= mod_instantiate
+		.instantiate			= mod_instantiate,
+		.detach				= mod_detach
 	},
 	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY,
 	.sql_query_resume		= sql_query_resume,
 	.sql_select_query_resume	= sql_query_resume,
 	.sql_affected_rows		= sql_affected_rows,
+	.sql_pipeline_depth		= sql_pipeline_depth,
 	.sql_fetch_row			= sql_fetch_row,
 	.sql_fields			= sql_fields,
 	.sql_free_result		= sql_free_result,
@@ -733,6 +733,8 @@ static unlang_action_t mod_map_resume(rlm_rcode_t *p_result, UNUSED int *priorit
 	rlm_sql_row_t		row;
 	int			i, j, field_cnt, rows = 0;
 	int			field_index[MAX_SQL_FIELD_INDEX];
+	map_t const		*row_maps[MAX_SQL_FIELD_INDEX];
+	void			*row_values[MAX_SQL_FIELD_INDEX];
 	char			map_rhs_buff[128];
 	bool			found_field = false;	/* Did we find any matching fields in the result set ? */
 
@@ -824,13 +826,21 @@ static unlang_action_t mod_map_resume(rlm_rcode_t *p_result, UNUSED int *priorit
 		for (map = map_list_head(maps), j = 0;
 		     map && (j < MAX_SQL_FIELD_INDEX);
 		     map = map_list_next(maps, map), j++) {
+			row_maps[j] = NULL;
+
 			if (field_index[j] < 0) continue;	/* We didn't find the map RHS in the field set */
 			if (!row[field_index[j]]) {
-				RWARN("Database returned NULL for %s", fields[j]);
+				RWARN("Database returned NULL for %s", fields[field_index[j]]);
 				continue;
 			}
-			if (map_to_request(request, map, _sql_map_proc_get_value, row[field_index[j]]) < 0) goto error;
+			row_maps[j] = map;
+			row_values[j] = row[field_index[j]];
 		}
+
+		/*
+		 *	Apply all of the maps for the row at once.
+		 */
+		if (map_list_to_request(request, row_maps, row_values, j, _sql_map_proc_get_value) < 0) goto error;
 	}
 
 	if (query_ctx->rcode == RLM_SQL_ERROR) goto error;
@@ -2143,11 +2153,22 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	}
 
 	/*
-	 *	Most SQL trunks can only have one running request per connection.
+	 *	Most SQL trunks can only have one running request per connection,
+	 *	unless the driver has been configured to pipeline queries, in which
+	 *	case the configured per connection limits apply up to the pipeline depth.
 	 */
 	if (!(inst->driver->flags & RLM_SQL_MULTI_QUERY_CONN)) {
-		inst->config.trunk_conf.target_req_per_conn = 1;
-		inst->config.trunk_conf.max_req_per_conn = 1;
+		trunk_conf_t	*trunk_conf = &inst->config.trunk_conf;
+		uint32_t	depth = 1;
+
+		if (inst->driver->sql_pipeline_depth) depth = inst->driver->sql_pipeline_depth(inst->driver_submodule);
+
+		if (!trunk_conf->target_req_per_conn || (trunk_conf->target_req_per_conn > depth)) {
+			trunk_conf->target_req_per_conn = depth;
+		}
+		if (!trunk_conf->max_req_per_conn || (trunk_conf->max_req_per_conn > depth)) {
+			trunk_conf->max_req_per_conn = depth;
+		}
 	}
 	if (!inst->driver->trunk_io_funcs.connection_notify) {
 		inst->config.trunk_conf.always_writable = true;
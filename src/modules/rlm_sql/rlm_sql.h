@@ -200,6 +200,8 @@ typedef struct {
 
 	int		(*sql_num_rows)(fr_sql_query_t *query_ctx, rlm_sql_config_t const *config);
 	int		(*sql_affected_rows)(fr_sql_query_t *query_ctx, rlm_sql_config_t const *config);
+	uint32_t	(*sql_pipeline_depth)(module_instance_t const *mi);	//!< How many queries a connection can
+									///< have in flight, if more than one.
 
 	unlang_function_t	sql_fetch_row;
 	sql_rcode_t	(*sql_fields)(char const **out[], fr_sql_query_t *query_ctx, rlm_sql_config_t const *config);
@@ -34,6 +34,7 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/function.h>
 
 #include <ctype.h>
+#include <pthread.h>
 
 /*
  *	Note: When your counter spans more than 1 period (ie 3 months
@@ -53,6 +54,40 @@ RCSID("$Id$")
  *	Reset Time.
  */
 
+/** A session contributing to a cached counter
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the counter's session tree.
+	char const		*id;		//!< Session identifier.
+	uint64_t		last;		//!< Last value of the increment seen for this session.
+} sqlcounter_session_t;
+
+/** Running counter for a key in the current reset period
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the tree of counters.
+	char const		*key;		//!< Expansion of "key".
+	uint64_t		counter;	//!< Current value.
+	fr_time_t		synced;		//!< When the value was last read from SQL.
+	fr_rb_tree_t		*sessions;	//!< Sessions seen since the counter was created.
+} sqlcounter_entry_t;
+
+/** Counters shared by all threads
+ *
+ * Lives outside of the instance data, as that's read only once the
+ * module has been instantiated.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects the tree and the entries within it.
+	fr_rb_tree_t		*entries;	//!< sqlcounter_entry_t, keyed by key.
+	fr_time_t		period;		//!< Reset period the entries belong to.
+} rlm_sqlcounter_mutable_t;
+
+typedef struct {
+	fr_time_delta_t		sync_interval;	//!< How often to re-read a cached counter from SQL.
+	uint32_t		max_entries;	//!< Maximum number of counters to cache.
+} rlm_sqlcounter_cache_config_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -77,8 +112,18 @@ typedef struct {
 
 	fr_time_t	reset_time;
 	fr_time_t	last_reset;
+
+	rlm_sqlcounter_cache_config_t	cache;		//!< Running counter configuration.
+	rlm_sqlcounter_mutable_t	*mutable;	//!< Running counters, if enabled.
 } rlm_sqlcounter_t;
 
+static const conf_parser_t cache_config[] = {
+	{ FR_CONF_OFFSET("sync_interval", rlm_sqlcounter_cache_config_t, sync_interval), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", rlm_sqlcounter_cache_config_t, max_entries), .dflt = "65536" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("sql_module_instance", CONF_FLAG_REQUIRED, rlm_sqlcounter_t, sql_name) },
 
@@ -99,6 +144,8 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("counter_name", CONF_FLAG_ATTRIBUTE | CONF_FLAG_REQUIRED, rlm_sqlcounter_t, counter_attr) },
 	{ FR_CONF_OFFSET_FLAGS("check_name", CONF_FLAG_ATTRIBUTE | CONF_FLAG_REQUIRED, rlm_sqlcounter_t, limit_attr) },
 
+	{ FR_CONF_OFFSET_SUBSECTION("cache", 0, rlm_sqlcounter_t, cache, cache_config) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -106,6 +153,8 @@ typedef struct {
 	xlat_exp_head_t	*query_xlat;		//!< Tokenized xlat to run query.
 	tmpl_t		*reply_attr;		//!< Attribute to write timeout to.
 	tmpl_t		*reply_msg_attr;	//!< Attribute to write reply message to.
+	fr_value_box_t	increment;		//!< Session's contribution to the counter, from accounting packets.
+	fr_value_box_t	session;		//!< Session identifier, from accounting packets.
 } sqlcounter_call_env_t;
 
 static fr_dict_t const *dict_freeradius;
@@ -248,12 +297,83 @@ static int find_prev_reset(rlm_sqlcounter_t *inst, fr_time_t now)
 	return ret;
 }
 
+static int8_t sqlcounter_entry_cmp(void const *one, void const *two)
+{
+	sqlcounter_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->key, b->key);
+	return CMP(ret, 0);
+}
+
+static int8_t sqlcounter_session_cmp(void const *one, void const *two)
+{
+	sqlcounter_session_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->id, b->id);
+	return CMP(ret, 0);
+}
+
+/** Find the running counter for a key
+ *
+ * If the reset period has changed since the counters were created,
+ * they're all discarded, and will be re-read from SQL.
+ *
+ * @note Must be called with the mutex held.
+ */
+static sqlcounter_entry_t *sqlcounter_entry_find(rlm_sqlcounter_t const *inst, char const *key)
+{
+	rlm_sqlcounter_mutable_t *mutable = inst->mutable;
+
+	if (fr_time_neq(mutable->period, inst->last_reset)) {
+		talloc_free(mutable->entries);
+		MEM(mutable->entries = fr_rb_inline_talloc_alloc(mutable, sqlcounter_entry_t, node,
+								 sqlcounter_entry_cmp, NULL));
+		mutable->period = inst->last_reset;
+		return NULL;
+	}
+
+	return fr_rb_find(mutable->entries, &(sqlcounter_entry_t){ .key = key });
+}
+
+/** Record the value of a counter read from SQL
+ *
+ * Sessions already seen for the key are kept, so that
+ * later accounting packets only add what's new.
+ */
+static void sqlcounter_entry_sync(rlm_sqlcounter_t const *inst, char const *key, uint64_t counter)
+{
+	rlm_sqlcounter_mutable_t	*mutable = inst->mutable;
+	sqlcounter_entry_t		*entry;
+
+	pthread_mutex_lock(&mutable->mutex);
+	entry = sqlcounter_entry_find(inst, key);
+	if (!entry) {
+		if (fr_rb_num_elements(mutable->entries) >= inst->cache.max_entries) goto done;
+
+		MEM(entry = talloc_zero(mutable->entries, sqlcounter_entry_t));
+		entry->key = talloc_strdup(entry, key);
+		MEM(entry->sessions = fr_rb_inline_talloc_alloc(entry, sqlcounter_session_t, node,
+								sqlcounter_session_cmp, NULL));
+		fr_rb_insert(mutable->entries, entry);
+	}
+	entry->counter = counter;
+	entry->synced = fr_time();
+
+done:
+	pthread_mutex_unlock(&mutable->mutex);
+}
+
 typedef struct {
 	bool			last_success;
 	fr_value_box_list_t	result;
 	rlm_sqlcounter_t	*inst;
 	sqlcounter_call_env_t	*env;
 	fr_pair_t		*limit;
+	char			*key;		//!< Expanded key, if the counter should be cached.
+	bool			cached;		//!< counter came from the cache.
+	uint64_t		counter;	//!< Cached counter value.
 } sqlcounter_rctx_t;
 
 /** Handle the result of calling the SQL query to retrieve the `counter` value.
@@ -274,10 +394,22 @@ static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, UNUSED int *p
 	int			ret;
 	char			msg[128];
 
-	if (!sql_result || (sscanf(sql_result->vb_strvalue, "%" PRIu64, &counter) != 1)) {
-		RDEBUG2("No integer found in result string \"%pV\".  May be first session, setting counter to 0",
-			sql_result);
-		counter = 0;
+	if (rctx->cached) {
+		counter = rctx->counter;
+		RDEBUG2("Using cached counter value %" PRIu64, counter);
+	} else {
+		if (!sql_result || (sscanf(sql_result->vb_strvalue, "%" PRIu64, &counter) != 1)) {
+			RDEBUG2("No integer found in result string \"%pV\".  May be first session, setting counter to 0",
+				sql_result);
+			counter = 0;
+		}
+
+		/*
+		 *	Don't cache a zero value if the query failed,
+		 *	that'd give the user a free pass until the
+		 *	next sync.
+		 */
+		if (rctx->key && rctx->last_success) sqlcounter_entry_sync(inst, rctx->key, counter);
 	}
 
 	/*
@@ -428,6 +560,30 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 		.env = env,
 		.limit = limit
 	};
+	fr_value_box_list_init(&rctx->result);
+
+	/*
+	 *	Use the running counter if we have a recent one,
+	 *	and avoid the query altogether.
+	 */
+	if (inst->mutable) {
+		if (tmpl_aexpand(rctx, &rctx->key, request, inst->key, NULL, NULL) < 0) {
+			RPWDEBUG("Failed expanding key, not using cached counter");
+			rctx->key = NULL;
+		} else {
+			sqlcounter_entry_t *entry;
+
+			pthread_mutex_lock(&inst->mutable->mutex);
+			entry = sqlcounter_entry_find(inst, rctx->key);
+			if (entry && fr_time_delta_lt(fr_time_sub(fr_time(), entry->synced), inst->cache.sync_interval)) {
+				rctx->counter = entry->counter;
+				rctx->cached = true;
+			}
+			pthread_mutex_unlock(&inst->mutable->mutex);
+
+			if (rctx->cached) return mod_authorize_resume(p_result, NULL, request, rctx);
+		}
+	}
 
 	if (unlang_function_push(request, NULL, mod_authorize_resume, NULL, 0, UNLANG_SUB_FRAME, rctx) < 0) {
 	error:
@@ -435,12 +591,100 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 		RETURN_MODULE_FAIL;
 	}
 
-	fr_value_box_list_init(&rctx->result);
 	if (unlang_xlat_push(rctx, &rctx->last_success, &rctx->result, request, env->query_xlat, UNLANG_SUB_FRAME) < 0) goto error;
 
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Add the usage reported by an accounting packet to the running counter
+ *
+ * Counters which aren't cached are left alone, the next
+ * authorization will read them from SQL.  The first packet
+ * seen for a session only records the session's current
+ * usage, as that may already be included in the SQL value.
+ */
+static unlang_action_t sqlcounter_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, bool stop)
+{
+	rlm_sqlcounter_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_sqlcounter_t);
+	sqlcounter_call_env_t	*env = talloc_get_type_abort(mctx->env_data, sqlcounter_call_env_t);
+	sqlcounter_entry_t	*entry;
+	sqlcounter_session_t	*session;
+	char			*key;
+	uint64_t		value, counter;
+
+	if ((env->session.type != FR_TYPE_STRING) || (env->increment.type != FR_TYPE_UINT64)) {
+		RDEBUG2("No session identifier or increment, not updating counter");
+		RETURN_MODULE_NOOP;
+	}
+	value = env->increment.vb_uint64;
+
+	if (tmpl_aexpand(request, &key, request, inst->key, NULL, NULL) < 0) {
+		RPEDEBUG("Failed expanding key");
+		RETURN_MODULE_FAIL;
+	}
+
+	pthread_mutex_lock(&inst->mutable->mutex);
+	entry = sqlcounter_entry_find(inst, key);
+	if (!entry) {
+		pthread_mutex_unlock(&inst->mutable->mutex);
+		RDEBUG2("No cached counter for \"%s\"", key);
+		talloc_free(key);
+		RETURN_MODULE_NOOP;
+	}
+
+	session = fr_rb_find(entry->sessions, &(sqlcounter_session_t){ .id = env->session.vb_strvalue });
+	if (!session) {
+		if (!stop) {
+			MEM(session = talloc(entry->sessions, sqlcounter_session_t));
+			*session = (sqlcounter_session_t) {
+				.id = talloc_strdup(session, env->session.vb_strvalue),
+				.last = value
+			};
+			fr_rb_insert(entry->sessions, session);
+		}
+	} else {
+		if (value > session->last) entry->counter += value - session->last;
+		session->last = value;
+
+		if (stop) {
+			fr_rb_delete(entry->sessions, session);
+			talloc_free(session);
+		}
+	}
+	counter = entry->counter;
+	pthread_mutex_unlock(&inst->mutable->mutex);
+
+	RDEBUG2("Cached counter for \"%s\" is now %" PRIu64, key, counter);
+	talloc_free(key);
+
+	RETURN_MODULE_UPDATED;
+}
+
+/** Update the running counter from an accounting packet
+ *
+ * If running counters aren't enabled, this behaves as it always has,
+ * and checks the counter.
+ */
+static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_sqlcounter_t const *inst = talloc_get_type_abort_const(mctx->mi->data, rlm_sqlcounter_t);
+
+	if (!inst->mutable) return mod_authorize(p_result, mctx, request);
+
+	return sqlcounter_accounting(p_result, mctx, request, false);
+}
+
+/** Update the running counter from an accounting stop, and forget the session
+ */
+static unlang_action_t CC_HINT(nonnull) mod_accounting_stop(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_sqlcounter_t const *inst = talloc_get_type_abort_const(mctx->mi->data, rlm_sqlcounter_t);
+
+	if (!inst->mutable) return mod_authorize(p_result, mctx, request);
+
+	return sqlcounter_accounting(p_result, mctx, request, true);
+}
+
 /** Custom call_env parser to tokenize the SQL query xlat used for counter retrieval
  */
 static int call_env_query_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci,
@@ -486,6 +730,14 @@ static const call_env_method_t sqlcounter_call_env = {
 		  .pair.func = call_env_query_parse },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("reply_name", FR_TYPE_VOID, CALL_ENV_FLAG_PARSE_ONLY, sqlcounter_call_env_t, reply_attr) },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("reply_message_name", FR_TYPE_VOID, CALL_ENV_FLAG_PARSE_ONLY, sqlcounter_call_env_t, reply_msg_attr) },
+		{ FR_CALL_ENV_SUBSECTION("cache", NULL, CALL_ENV_FLAG_NONE,
+			((call_env_parser_t[]) {
+				{ FR_CALL_ENV_OFFSET("increment", FR_TYPE_UINT64, CALL_ENV_FLAG_NULLABLE, sqlcounter_call_env_t, increment),
+				  .pair.dflt = "&Acct-Session-Time", .pair.dflt_quote = T_BARE_WORD },
+				{ FR_CALL_ENV_OFFSET("session", FR_TYPE_STRING, CALL_ENV_FLAG_NULLABLE, sqlcounter_call_env_t, session),
+				  .pair.dflt = "&Acct-Session-Id", .pair.dflt_quote = T_BARE_WORD },
+				CALL_ENV_TERMINATOR
+			}))},
 		CALL_ENV_TERMINATOR
 	}
 };
@@ -536,6 +788,26 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (fr_time_delta_ispos(inst->cache.sync_interval)) {
+		MEM(inst->mutable = talloc_zero(NULL, rlm_sqlcounter_mutable_t));
+		pthread_mutex_init(&inst->mutable->mutex, NULL);
+		MEM(inst->mutable->entries = fr_rb_inline_talloc_alloc(inst->mutable, sqlcounter_entry_t, node,
+								       sqlcounter_entry_cmp, NULL));
+		inst->mutable->period = inst->last_reset;
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_sqlcounter_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_sqlcounter_t);
+
+	if (!inst->mutable) return 0;
+
+	pthread_mutex_destroy(&inst->mutable->mutex);
+	TALLOC_FREE(inst->mutable);
+
 	return 0;
 }
 
@@ -589,9 +861,12 @@ module_rlm_t rlm_sqlcounter = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
+		.detach		= mod_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
+			{ .section = SECTION_NAME("accounting", "Stop"), .method = mod_accounting_stop, .method_env = &sqlcounter_call_env },
+			{ .section = SECTION_NAME("accounting", CF_IDENT_ANY), .method = mod_accounting, .method_env = &sqlcounter_call_env },
 			{ .section = SECTION_NAME(CF_IDENT_ANY, CF_IDENT_ANY), .method = mod_authorize, .method_env = &sqlcounter_call_env },
 			MODULE_BINDING_TERMINATOR
 		}
@@ -33,6 +33,33 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/function.h>
 
 #include <ctype.h>
+#include <pthread.h>
+
+/** An address reserved by the "alloc_reserve" query, waiting to be handed out
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the pool's list of reserved addresses.
+	fr_time_t		expires;	//!< When we stop handing this address out locally.
+	char const		*address;	//!< Address as returned by the database.
+} sqlippool_buffer_entry_t;
+
+/** Reserved addresses for a single pool
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the tree of pools.
+	char const		*pool_name;	//!< Pool the addresses were reserved from.
+	fr_dlist_head_t		free;		//!< Reserved addresses, oldest first.
+} sqlippool_buffer_t;
+
+/** Allocation buffers shared by all threads
+ *
+ * Lives outside of the instance data, as that's read only once the
+ * module has been instantiated.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects the tree and all the lists within it.
+	fr_rb_tree_t		*pools;		//!< sqlippool_buffer_t, keyed by pool name.
+} rlm_sqlippool_mutable_t;
 
 /*
  *	Define a structure for our module configuration.
@@ -41,7 +68,12 @@ typedef struct {
 	char const      *name;
 	char const	*sql_name;
 
+	uint32_t	buffer_size;		//!< How many addresses "alloc_reserve" should return.
+	fr_time_delta_t	buffer_lifetime;	//!< How long the database holds reserved addresses for.
+
 	rlm_sql_t const	*sql;
+
+	rlm_sqlippool_mutable_t	*mutable;	//!< Allocation buffers.
 } rlm_sqlippool_t;
 
 /**  Call environment used by module alloc method
@@ -56,6 +88,8 @@ typedef struct {
 	tmpl_t		*existing;			//!< tmpl to expand as query for finding the existing IP.
 	tmpl_t		*requested;			//!< tmpl to expand as query for finding the requested IP.
 	tmpl_t		*find;				//!< tmpl to expand as query for finding an unused IP.
+	tmpl_t		*reserve;			//!< tmpl to expand as query for reserving a block of unused IPs.
+	tmpl_t		*claim;				//!< tmpl to expand as query for assigning a reserved IP.
 	tmpl_t		*update;			//!< tmpl to expand as query for updating the found IP.
 	tmpl_t		*pool_check;			//!< tmpl to expand as query for checking for existence of the pool.
 	fr_value_box_t	commit;				//!< SQL query to commit transaction.
@@ -78,12 +112,16 @@ typedef enum {
 	IPPOOL_ALLOC_REQUESTED_RUN,		//!< Run the "requested" query
 	IPPOOL_ALLOC_FIND,			//!< Expanding the "find" query
 	IPPOOL_ALLOC_FIND_RUN,			//!< Run the "find" query
+	IPPOOL_ALLOC_RESERVE,			//!< Expanding the "reserve" query
+	IPPOOL_ALLOC_RESERVE_RUN,		//!< Run the "reserve" query
 	IPPOOL_ALLOC_NO_ADDRESS,		//!< No address was found
 	IPPOOL_ALLOC_POOL_CHECK,		//!< Expanding the "pool_check" query
 	IPPOOL_ALLOC_POOL_CHECK_RUN,		//!< Run the "pool_check" query
 	IPPOOL_ALLOC_MAKE_PAIR,			//!< Make the pair.
 	IPPOOL_ALLOC_UPDATE,			//!< Expanding the "update" query
 	IPPOOL_ALLOC_UPDATE_RUN,		//!< Run the "update" query
+	IPPOOL_ALLOC_CLAIM,			//!< Expanding the "claim" query
+	IPPOOL_ALLOC_CLAIM_RUN,			//!< Run the "claim" query
 	IPPOOL_ALLOC_COMMIT_RUN,		//!< RUn the "commit" query
 } ippool_alloc_status_t;
 
@@ -99,6 +137,9 @@ typedef struct {
 	fr_value_box_t		*query;		//!< Current query being run.
 	fr_sql_query_t		*query_ctx;	//!< Query context for allocation queries.
 	rlm_rcode_t		rcode;		//!< Result code to return after running "commit".
+	rlm_sqlippool_t const	*inst;		//!< Module instance.
+	bool			buffered;	//!< The current address came from the allocation buffer.
+	bool			reserved;	//!< We've already run the "reserve" query for this request.
 } ippool_alloc_ctx_t;
 
 /** Resume context for IP update / release
@@ -113,6 +154,9 @@ typedef struct {
 static conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("sql_module_instance", rlm_sqlippool_t, sql_name), .dflt = "sql" },
 
+	{ FR_CONF_OFFSET("buffer_size", rlm_sqlippool_t, buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("buffer_lifetime", rlm_sqlippool_t, buffer_lifetime), .dflt = "30" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -179,6 +223,112 @@ finish:
 	return retval;
 }
 
+static int8_t sqlippool_buffer_cmp(void const *one, void const *two)
+{
+	sqlippool_buffer_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->pool_name, b->pool_name);
+	return CMP(ret, 0);
+}
+
+/** Take an address from the allocation buffer of a pool
+ *
+ * Addresses which have been in the buffer for too long are discarded.
+ * We don't need to tell the database, it'll release them once the
+ * reservation expires.
+ *
+ * @param[out] out	Where to write the address.
+ * @param[in] outlen	Length of the output buffer.
+ * @param[in] inst	Module instance.
+ * @param[in] pool_name	Pool to allocate from.
+ * @return
+ *	- >0 the length of the address written to out.
+ *	- 0 if the buffer for this pool is empty.
+ */
+static int sqlippool_buffer_pop(char *out, int outlen, rlm_sqlippool_t const *inst, fr_value_box_t const *pool_name)
+{
+	sqlippool_buffer_t		*buffer;
+	sqlippool_buffer_entry_t	*entry;
+	fr_time_t			now = fr_time();
+	int				len = 0;
+
+	pthread_mutex_lock(&inst->mutable->mutex);
+	buffer = fr_rb_find(inst->mutable->pools, &(sqlippool_buffer_t){ .pool_name = pool_name->vb_strvalue });
+	if (!buffer) goto done;
+
+	while ((entry = fr_dlist_pop_head(&buffer->free))) {
+		if (fr_time_lt(now, entry->expires)) {
+			len = strlen(entry->address);
+			if (len < outlen) {
+				strcpy(out, entry->address);
+			} else {
+				len = 0;
+			}
+		}
+		talloc_free(entry);
+		if (len > 0) break;
+	}
+
+done:
+	pthread_mutex_unlock(&inst->mutable->mutex);
+	return len;
+}
+
+/** Add the addresses returned by the "alloc_reserve" query to the allocation buffer of a pool
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] pool_name	Pool the addresses were reserved from.
+ * @param[in] query_ctx	Query which returned the addresses, one per row.
+ * @return the number of addresses added.
+ */
+static int sqlippool_buffer_fill(rlm_sqlippool_t const *inst, fr_value_box_t const *pool_name, fr_sql_query_t *query_ctx)
+{
+	rlm_rcode_t		p_result;
+	request_t		*request = query_ctx->request;
+	sqlippool_buffer_t	*buffer;
+	fr_time_t		expires;
+	int			count = 0;
+
+	/*
+	 *	Stop handing the addresses out well before the
+	 *	database considers them free again, to allow
+	 *	for clock skew, and for the "claim" query
+	 *	being queued.
+	 */
+	expires = fr_time_add(fr_time(), fr_time_delta_div(inst->buffer_lifetime, fr_time_delta_wrap(2)));
+
+	pthread_mutex_lock(&inst->mutable->mutex);
+	buffer = fr_rb_find(inst->mutable->pools, &(sqlippool_buffer_t){ .pool_name = pool_name->vb_strvalue });
+	if (!buffer) {
+		MEM(buffer = talloc_zero(inst->mutable->pools, sqlippool_buffer_t));
+		buffer->pool_name = talloc_strdup(buffer, pool_name->vb_strvalue);
+		fr_dlist_talloc_init(&buffer->free, sqlippool_buffer_entry_t, entry);
+		fr_rb_insert(inst->mutable->pools, buffer);
+	}
+
+	while ((query_ctx->inst->fetch_row(&p_result, NULL, request, query_ctx) == UNLANG_ACTION_CALCULATE_RESULT) &&
+	       (query_ctx->rcode == RLM_SQL_OK)) {
+		sqlippool_buffer_entry_t	*entry;
+		rlm_sql_row_t			row = query_ctx->row;
+
+		if (!row || !row[0]) continue;
+
+		MEM(entry = talloc(buffer, sqlippool_buffer_entry_t));
+		*entry = (sqlippool_buffer_entry_t) {
+			.expires = expires,
+			.address = talloc_strdup(entry, row[0])
+		};
+		fr_dlist_insert_tail(&buffer->free, entry);
+		count++;
+	}
+	pthread_mutex_unlock(&inst->mutable->mutex);
+
+	query_ctx->inst->driver->sql_finish_select_query(query_ctx, &query_ctx->inst->config);
+
+	return count;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -212,6 +362,30 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	if (inst->buffer_size > 0) {
+		if (!fr_time_delta_ispos(inst->buffer_lifetime)) {
+			cf_log_err(conf, "'buffer_lifetime' must be greater than zero when 'buffer_size' is set");
+			return -1;
+		}
+
+		MEM(inst->mutable = talloc_zero(NULL, rlm_sqlippool_mutable_t));
+		pthread_mutex_init(&inst->mutable->mutex, NULL);
+		MEM(inst->mutable->pools = fr_rb_inline_talloc_alloc(inst->mutable, sqlippool_buffer_t, node,
+								     sqlippool_buffer_cmp, NULL));
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_sqlippool_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_sqlippool_t);
+
+	if (!inst->mutable) return 0;
+
+	pthread_mutex_destroy(&inst->mutable->mutex);
+	TALLOC_FREE(inst->mutable);
+
 	return 0;
 }
 
@@ -328,13 +502,58 @@ static unlang_action_t mod_alloc_resume(rlm_rcode_t *p_result, UNUSED int *prior
 
 	expand_find:
 		/*
-		 *	Neither "existing" nor "requested" found an address, expand "find" query
+		 *	Neither "existing" nor "requested" found an address.
+		 *
+		 *	If we're buffering allocations, try the addresses
+		 *	we've already reserved, and if there aren't any,
+		 *	reserve another block of them.
+		 */
+		if (alloc_ctx->inst->mutable && env->reserve && env->claim) {
+			allocation_len = sqlippool_buffer_pop(allocation, sizeof(allocation), alloc_ctx->inst, &env->pool_name);
+			if (allocation_len > 0) {
+				alloc_ctx->buffered = true;
+				goto make_pair;
+			}
+
+			if (!alloc_ctx->reserved) {
+				alloc_ctx->status = IPPOOL_ALLOC_RESERVE;
+				REPEAT_MOD_ALLOC_RESUME;
+				if (unlang_tmpl_push(alloc_ctx, &alloc_ctx->values, request, env->reserve, NULL) < 0) goto error;
+				return UNLANG_ACTION_PUSHED_CHILD;
+			}
+		}
+
+	expand_find_query:
+		/*
+		 *	Expand "find" query
 		 */
 		alloc_ctx->status = IPPOOL_ALLOC_FIND;
 		REPEAT_MOD_ALLOC_RESUME;
 		if (unlang_tmpl_push(alloc_ctx, &alloc_ctx->values, request, env->find, NULL) < 0) goto error;
 		return UNLANG_ACTION_PUSHED_CHILD;
 
+	case IPPOOL_ALLOC_RESERVE:
+		alloc_ctx->reserved = true;
+		if (query && query->vb_length) SUBMIT_QUERY(query->vb_strvalue, IPPOOL_ALLOC_RESERVE_RUN, SQL_QUERY_SELECT, select);
+		goto expand_find_query;
+
+	case IPPOOL_ALLOC_RESERVE_RUN:
+	{
+		int	count;
+
+		TALLOC_FREE(alloc_ctx->query);
+		if (query_ctx->rcode != RLM_SQL_OK) goto error;
+
+		count = sqlippool_buffer_fill(alloc_ctx->inst, &env->pool_name, query_ctx);
+		RDEBUG2("Reserved %d address(es) from pool \"%pV\"", count, &env->pool_name);
+
+		/*
+		 *	Either picks up one of the new addresses, or
+		 *	falls back to the "find" query.
+		 */
+		goto expand_find;
+	}
+
 	case IPPOOL_ALLOC_FIND:
 		SUBMIT_QUERY(query->vb_strvalue, IPPOOL_ALLOC_FIND_RUN, SQL_QUERY_SELECT, select);
 
@@ -398,6 +617,17 @@ static unlang_action_t mod_alloc_resume(rlm_rcode_t *p_result, UNUSED int *prior
 		RDEBUG2("Allocated IP %s", allocation);
 		alloc_ctx->rcode = RLM_MODULE_UPDATED;
 
+		/*
+		 *	Addresses from the allocation buffer are only
+		 *	reserved, assign the address to this client.
+		 */
+		if (alloc_ctx->buffered) {
+			alloc_ctx->status = IPPOOL_ALLOC_CLAIM;
+			REPEAT_MOD_ALLOC_RESUME;
+			if (unlang_tmpl_push(alloc_ctx, &alloc_ctx->values, request, env->claim, NULL) < 0) goto error;
+			return UNLANG_ACTION_PUSHED_CHILD;
+		}
+
 		/*
 		 *	If we have an update query expand it
 		 */
@@ -451,6 +681,36 @@ static unlang_action_t mod_alloc_resume(rlm_rcode_t *p_result, UNUSED int *prior
 
 		goto finish;
 
+	case IPPOOL_ALLOC_CLAIM:
+		if (query && query->vb_length) SUBMIT_QUERY(query->vb_strvalue, IPPOOL_ALLOC_CLAIM_RUN, SQL_QUERY_OTHER, query);
+		goto finish;
+
+	case IPPOOL_ALLOC_CLAIM_RUN:
+	{
+		fr_pair_t	*vp;
+		int		affected;
+
+		TALLOC_FREE(alloc_ctx->query);
+		if (query_ctx->rcode != RLM_SQL_OK) goto error;
+
+		affected = sql->driver->sql_affected_rows(query_ctx, &query_ctx->inst->config);
+		sql->driver->sql_finish_query(query_ctx, &query_ctx->inst->config);
+		if (affected > 0) goto finish;
+
+		/*
+		 *	The reservation expired, or someone else got
+		 *	the address.  Remove it from the request and
+		 *	try again.
+		 */
+		RDEBUG2("Reserved address could not be claimed, trying another");
+		if (tmpl_find_vp(&vp, request, env->allocated_address_attr) == 0) {
+			fr_pair_delete(fr_pair_parent_list(vp), vp);
+		}
+		alloc_ctx->buffered = false;
+		alloc_ctx->rcode = RLM_MODULE_NOOP;
+		goto expand_find;
+	}
+
 	case IPPOOL_ALLOC_UPDATE_RUN:
 		TALLOC_FREE(alloc_ctx->query);
 		if (env->update) sql->driver->sql_finish_query(query_ctx, &query_ctx->inst->config);
@@ -512,6 +772,7 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(rlm_rcode_t *p_result, module_
 		.env = env,
 		.trunk = thread->trunk,
 		.sql = inst->sql,
+		.inst = inst,
 		.request = request,
 	};
 	talloc_set_destructor(alloc_ctx, sqlippool_alloc_ctx_free);
@@ -711,6 +972,10 @@ static const call_env_method_t sqlippool_alloc_method_env = {
 						ippool_alloc_call_env_t, requested), QUERY_ESCAPE },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_find", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY | CALL_ENV_FLAG_REQUIRED,
 						ippool_alloc_call_env_t, find), QUERY_ESCAPE },
+		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_reserve", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
+						ippool_alloc_call_env_t, reserve), QUERY_ESCAPE },
+		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_claim", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
+						ippool_alloc_call_env_t, claim), QUERY_ESCAPE },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_update", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
 						ippool_alloc_call_env_t, update), QUERY_ESCAPE },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("pool_check", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
@@ -776,7 +1041,8 @@ module_rlm_t rlm_sqlippool = {
 		.name		= "sqlippool",
 		.inst_size	= sizeof(rlm_sqlippool_t),
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
@@ -17,7 +17,7 @@
 /**
  * $Id$
  * @file rlm_stats.c
- * @brief Keep RADIUS statistics. Eventually, also non-RADIUS statistics
+ * @brief Keep packet statistics for any protocol
  *
  * @copyright 2017 Network RADIUS SAS (license@networkradius.com)
  */
@@ -41,52 +41,91 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
-typedef struct {
-	pthread_mutex_t		mutex;
-	fr_dlist_head_t		list;				//!< for threads to know about each other
-	uint64_t		stats[FR_RADIUS_CODE_MAX];
-} rlm_stats_mutable_t;
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
-/*
- *	@todo - MULTI_PROTOCOL - make this protocol agnostic.
- *	Perhaps keep stats in a hash table by (request->dict, request->code) ?
+/** Packet codes at or above this are counted as code 0
+ *
+ */
+#define RLM_STATS_CODE_MAX	(64)
+
+/** How many protocols a thread can keep counters for
+ *
  */
+#define RLM_STATS_PROTO_MAX	(8)
 
+/** Counters for one protocol
+ *
+ * Counters are kept by (request->dict, packet code), so the module
+ * works with any protocol.  Only the RADIUS counters can currently be
+ * queried, via Status-Server.
+ */
 typedef struct {
-	rlm_stats_mutable_t	*mutable;
-	fr_dict_attr_t const	*type_da;			//!< FreeRADIUS-Stats4-Type
-	fr_dict_attr_t const	*ipv4_da;			//!< FreeRADIUS-Stats4-IPv4-Address
-	fr_dict_attr_t const	*ipv6_da;			//!< FreeRADIUS-Stats4-IPv6-Address
+	fr_dict_t const		*dict;				//!< Protocol these counters are for.
+	uint64_t		stats[RLM_STATS_CODE_MAX];
+} rlm_stats_proto_t;
 
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Only held when threads come and go, and for reads.
+	fr_dlist_head_t		list;				//!< for threads to know about each other
+	rlm_stats_proto_t	retired[RLM_STATS_PROTO_MAX];	//!< Totals from threads which have exited.
+} rlm_stats_mutable_t;
 
+typedef struct {
+	rlm_stats_mutable_t	*mutable;
+	uint32_t		max_entries;			//!< Size of the per-thread src and dst sketches.
 } rlm_stats_t;
 
+/** Counters for a source or destination address
+ *
+ */
 typedef struct {
-	fr_rb_node_t		src_node;
-	fr_rb_node_t		dst_node;
+	fr_rb_node_t		node;				//!< Entry in the writer's index.
+	fr_dict_t const		*dict;				//!< Protocol of the packets.
 	fr_ipaddr_t		ipaddr;				//!< IP address of this thing
 	fr_time_t		created;			//!< when it was created
 	fr_time_t		last_packet;			//!< when we last saw a packet
-	uint64_t		stats[FR_RADIUS_CODE_MAX];	//!< actual statistic
+	uint64_t		count;				//!< Packets seen, including ones inherited on eviction.
+	uint64_t		error;				//!< Upper bound on how much of count was inherited.
+	uint64_t		stats[RLM_STATS_CODE_MAX];	//!< actual statistic
 } rlm_stats_data_t;
 
+/** A bounded "space saving" sketch of the busiest addresses
+ *
+ * Holds at most max_entries addresses.  When it's full, a new address
+ * replaces the one with the smallest count, inheriting that count.
+ * The busiest addresses are kept, however many distinct addresses send
+ * packets.
+ */
 typedef struct {
-	rlm_stats_t		*inst;
+	rlm_stats_data_t	*slots;				//!< Fixed array, so readers can scan it.
+	uint32_t		used;				//!< How many slots are in use.
+	fr_rb_tree_t		*index;				//!< Writer's index into slots.  Never used by readers.
+} rlm_stats_sketch_t;
 
-	fr_time_t		last_global_update;
+typedef struct {
+	rlm_stats_t		*inst;
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
-	fr_time_t		last_manage;			//!< when we deleted old things
-
-	fr_rb_tree_t		*src;				//!< stats by source
-	fr_rb_tree_t		*dst;				//!< stats by destination
+	/** Sequence counter protecting everything below
+	 *
+	 * Odd while the owning thread is updating the counters.
+	 * Other threads copy the counters, and retry if the
+	 * sequence was odd, or changed while they were copying.
+	 */
+	atomic_uint_fast64_t	seq;
 
-	uint64_t		stats[FR_RADIUS_CODE_MAX];
+	rlm_stats_proto_t	proto[RLM_STATS_PROTO_MAX];
 
-	pthread_mutex_t		mutex;
+	rlm_stats_sketch_t	src;				//!< stats by source
+	rlm_stats_sketch_t	dst;				//!< stats by destination
 } rlm_stats_thread_t;
 
 static const conf_parser_t module_config[] = {
+	{ FR_CONF_OFFSET("max_entries", rlm_stats_t, max_entries), .dflt = "100" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -110,159 +149,263 @@ fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
 	{ NULL }
 };
 
-static void coalesce(uint64_t final_stats[FR_RADIUS_CODE_MAX], rlm_stats_thread_t *t,
-		     size_t tree_offset, rlm_stats_data_t *mydata)
+static inline void stats_write_begin(rlm_stats_thread_t *t)
 {
-	rlm_stats_data_t *stats;
-	rlm_stats_thread_t *other;
-	fr_rb_tree_t **tree;
-	uint64_t local_stats[FR_RADIUS_CODE_MAX];
+	atomic_store_explicit(&t->seq, atomic_load_explicit(&t->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
 
-	tree = (fr_rb_tree_t **) (((uint8_t *) t) + tree_offset);
+static inline void stats_write_end(rlm_stats_thread_t *t)
+{
+	atomic_store_explicit(&t->seq, atomic_load_explicit(&t->seq, memory_order_relaxed) + 1, memory_order_release);
+}
 
-	/*
-	 *	Bootstrap with my statistics, where we don't need a
-	 *	lock.
-	 */
-	stats = fr_rb_find(*tree, mydata);
-	if (!stats) {
-		memset(final_stats, 0, sizeof(uint64_t) * FR_RADIUS_CODE_MAX);
-	} else {
-		memcpy(final_stats, stats->stats, sizeof(stats->stats));
-	}
+static inline uint64_t stats_read_begin(rlm_stats_thread_t *t)
+{
+	uint64_t seq;
 
-	/*
-	 *	Loop over all of the other thread instances, locking
-	 *	them, and adding their statistics in.
-	 */
-	pthread_mutex_lock(&t->inst->mutable->mutex);
-	for (other = fr_dlist_head(&t->inst->mutable->list);
-	     other != NULL;
-	     other = fr_dlist_next(&t->inst->mutable->list, other)) {
-		int i;
+	while ((seq = atomic_load_explicit(&t->seq, memory_order_acquire)) & 0x01);
 
-		if (other == t) continue;
+	return seq;
+}
 
-		tree = (fr_rb_tree_t **) (((uint8_t *) other) + tree_offset);
-		pthread_mutex_lock(&other->mutex);
-		stats = fr_rb_find(*tree, mydata);
+static inline bool stats_read_retry(rlm_stats_thread_t *t, uint64_t seq)
+{
+	atomic_thread_fence(memory_order_acquire);
 
-		if (!stats) {
-			pthread_mutex_unlock(&other->mutex);
-			continue;
-		}
-		memcpy(&local_stats, stats->stats, sizeof(stats->stats));
+	return atomic_load_explicit(&t->seq, memory_order_relaxed) != seq;
+}
 
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			final_stats[i] += local_stats[i];
-		}
+static inline int stats_code(unsigned int code)
+{
+	return (code < RLM_STATS_CODE_MAX) ? code : 0;
+}
+
+/** Find the counters for a protocol, optionally claiming an empty slot for them
+ *
+ */
+static rlm_stats_proto_t *stats_proto(rlm_stats_proto_t proto[static RLM_STATS_PROTO_MAX], fr_dict_t const *dict,
+				      bool create)
+{
+	int i;
+
+	for (i = 0; i < RLM_STATS_PROTO_MAX; i++) {
+		if (proto[i].dict == dict) return &proto[i];
 
-		pthread_mutex_unlock(&other->mutex);
+		if (!proto[i].dict) {
+			if (!create) return NULL;
+
+			proto[i].dict = dict;
+			return &proto[i];
+		}
 	}
-	pthread_mutex_unlock(&t->inst->mutable->mutex);
+
+	return NULL;
 }
 
+static int8_t data_cmp(const void *one, const void *two)
+{
+	rlm_stats_data_t const *a = one;
+	rlm_stats_data_t const *b = two;
+	int8_t ret;
 
-/*
- *	Do the statistics
+	ret = CMP(a->dict, b->dict);
+	if (ret != 0) return ret;
+
+	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+}
+
+/** Count a packet against an address in the sketch
+ *
+ * @note Must be called between stats_write_begin() and stats_write_end().
  */
-static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static void stats_sketch_update(rlm_stats_sketch_t *sketch, fr_dict_t const *dict, fr_ipaddr_t const *ipaddr,
+				fr_time_t now, int src_code, int dst_code)
 {
-	rlm_stats_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_stats_t);
-	rlm_stats_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_stats_thread_t);
-	int			i;
-	uint32_t		stats_type;
+	rlm_stats_data_t	*data, *min;
+	uint32_t		i;
 
+	data = fr_rb_find(sketch->index, &(rlm_stats_data_t){ .dict = dict, .ipaddr = *ipaddr });
+	if (data) goto update;
 
-	fr_pair_t *vp;
-	rlm_stats_data_t mydata;
-	char buffer[64];
-	uint64_t local_stats[NUM_ELEMENTS(inst->mutable->stats)];
+	if (sketch->used < talloc_array_length(sketch->slots)) {
+		data = &sketch->slots[sketch->used++];
+		data->count = 0;
+		data->error = 0;
+		goto replace;
+	}
 
 	/*
-	 *	Increment counters only in "send foo" sections.
-	 *
-	 *	i.e. only when we have a reply to send.
-	 *
-	 *	FIXME - Nothing sets request_state anymore
+	 *	Full, replace the address with the fewest packets.
+	 *	Its inherited count bounds how much the new
+	 *	address may have been undercounted.
 	 */
-#if 0
-	if (request->request_state == REQUEST_SEND) {
-		int src_code, dst_code;
-		rlm_stats_data_t *stats;
-
-		src_code = request->packet->code;
-		if (src_code >= FR_RADIUS_CODE_MAX) src_code = 0;
+	min = &sketch->slots[0];
+	for (i = 1; i < sketch->used; i++) {
+		if (sketch->slots[i].count < min->count) min = &sketch->slots[i];
+	}
+	data = min;
+	fr_rb_remove(sketch->index, data);
+	data->error = data->count;
+
+replace:
+	data->dict = dict;
+	data->ipaddr = *ipaddr;
+	data->created = now;
+	memset(data->stats, 0, sizeof(data->stats));
+	fr_rb_insert(sketch->index, data);
+
+update:
+	data->last_packet = now;
+	data->count++;
+	data->stats[src_code]++;
+	data->stats[dst_code]++;
+}
 
-		dst_code = request->reply->code;
-		if (dst_code >= FR_RADIUS_CODE_MAX) dst_code = 0;
+/** Add one thread's counters for an address to the totals
+ *
+ */
+static void stats_sketch_merge(uint64_t final_stats[static RLM_STATS_CODE_MAX], rlm_stats_thread_t *t,
+			       size_t sketch_offset, fr_dict_t const *dict, fr_ipaddr_t const *ipaddr)
+{
+	rlm_stats_sketch_t	*sketch = (rlm_stats_sketch_t *) (((uint8_t *) t) + sketch_offset);
+	uint64_t		local_stats[RLM_STATS_CODE_MAX];
+	uint64_t		seq;
+	bool			found;
+	uint32_t		i;
 
-		pthread_mutex_lock(&t->mutex);
-		t->stats[src_code]++;
-		t->stats[dst_code]++;
+	do {
+		seq = stats_read_begin(t);
+		found = false;
 
-		/*
-		 *	Update source statistics
-		 */
-		mydata.ipaddr = request->packet->socket.inet.src_ipaddr;
-		stats = fr_rb_find(t->src, &mydata);
-		if (!stats) {
-			MEM(stats = talloc_zero(t, rlm_stats_data_t));
+		for (i = 0; i < sketch->used; i++) {
+			rlm_stats_data_t const *data = &sketch->slots[i];
 
-			stats->ipaddr = request->packet->socket.inet.src_ipaddr;
-			stats->created = request->async->recv_time;
+			if ((data->dict != dict) || (fr_ipaddr_cmp(&data->ipaddr, ipaddr) != 0)) continue;
 
-			(void) fr_rb_insert(t->src, stats);
+			memcpy(local_stats, data->stats, sizeof(local_stats));
+			found = true;
+			break;
 		}
+	} while (stats_read_retry(t, seq));
 
-		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
+	if (!found) return;
 
-		/*
-		 *	Update destination statistics
-		 */
-		mydata.ipaddr = request->packet->socket.inet.dst_ipaddr;
-		stats = fr_rb_find(t->dst, &mydata);
-		if (!stats) {
-			MEM(stats = talloc_zero(t, rlm_stats_data_t));
+	for (i = 0; i < RLM_STATS_CODE_MAX; i++) final_stats[i] += local_stats[i];
+}
 
-			stats->ipaddr = request->packet->socket.inet.dst_ipaddr;
-			stats->created = request->async->recv_time;
+/** Add one thread's counters for a protocol to the totals
+ *
+ */
+static void stats_proto_merge(uint64_t final_stats[static RLM_STATS_CODE_MAX], rlm_stats_thread_t *t,
+			      fr_dict_t const *dict)
+{
+	rlm_stats_proto_t const	*proto;
+	uint64_t		local_stats[RLM_STATS_CODE_MAX];
+	uint64_t		seq;
+	int			i;
 
-			(void) fr_rb_insert(t->dst, stats);
-		}
+	do {
+		seq = stats_read_begin(t);
 
-		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
-		pthread_mutex_unlock(&t->mutex);
+		proto = stats_proto(t->proto, dict, false);
+		if (proto) memcpy(local_stats, proto->stats, sizeof(local_stats));
+	} while (stats_read_retry(t, seq));
 
-		/*
-		 *	@todo - periodically clean up old entries.
-		 */
+	if (!proto) return;
 
-		if ((t->last_global_update + NSEC) > request->async->recv_time) {
-			RETURN_MODULE_UPDATED;
-		}
+	for (i = 0; i < RLM_STATS_CODE_MAX; i++) final_stats[i] += local_stats[i];
+}
+
+/** Merge the counters from every thread
+ *
+ * Threads never lock anything when counting packets.  All of the work
+ * of combining the counters is done here, when they're read.
+ *
+ * @param[out] final_stats	Totals.
+ * @param[in] inst		Module instance.
+ * @param[in] sketch_offset	Offset of the sketch to read, or 0 for the per-protocol totals.
+ * @param[in] dict		Protocol to return counters for.
+ * @param[in] ipaddr		Address to return counters for.  Ignored for per-protocol totals.
+ */
+static void coalesce(uint64_t final_stats[static RLM_STATS_CODE_MAX], rlm_stats_t const *inst,
+		     size_t sketch_offset, fr_dict_t const *dict, fr_ipaddr_t const *ipaddr)
+{
+	rlm_stats_proto_t const	*retired;
+
+	memset(final_stats, 0, sizeof(uint64_t) * RLM_STATS_CODE_MAX);
 
-		t->last_global_update = request->async->recv_time;
+	pthread_mutex_lock(&inst->mutable->mutex);
+	if (!sketch_offset) {
+		int i;
+
+		retired = stats_proto(inst->mutable->retired, dict, false);
+		if (retired) for (i = 0; i < RLM_STATS_CODE_MAX; i++) final_stats[i] = retired->stats[i];
+	}
 
-		pthread_mutex_lock(&inst->mutable->mutex);
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			inst->mutable->stats[i] += t->stats[i];
-			t->stats[i] = 0;
+	fr_dlist_foreach(&inst->mutable->list, rlm_stats_thread_t, other) {
+		if (!sketch_offset) {
+			stats_proto_merge(final_stats, other, dict);
+		} else {
+			stats_sketch_merge(final_stats, other, sketch_offset, dict, ipaddr);
 		}
-		pthread_mutex_unlock(&inst->mutable->mutex);
+	}
+	pthread_mutex_unlock(&inst->mutable->mutex);
+}
+
+/*
+ *	Increment counters for the packet and its reply
+ */
+static unlang_action_t CC_HINT(nonnull) mod_stats_count(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_stats_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_stats_thread_t);
+	rlm_stats_proto_t	*proto;
+	int			src_code, dst_code;
+	fr_time_t		now = request->async->recv_time;
 
-		RETURN_MODULE_UPDATED;
+	src_code = stats_code(request->packet->code);
+	dst_code = stats_code(request->reply->code);
+
+	stats_write_begin(t);
+
+	proto = stats_proto(t->proto, request->dict, true);
+	if (proto) {
+		proto->stats[src_code]++;
+		proto->stats[dst_code]++;
 	}
-#endif
+
+	stats_sketch_update(&t->src, request->dict, &request->packet->socket.inet.src_ipaddr,
+			    now, src_code, dst_code);
+	stats_sketch_update(&t->dst, request->dict, &request->packet->socket.inet.dst_ipaddr,
+			    now, src_code, dst_code);
+
+	stats_write_end(t);
+
+	if (!proto) {
+		RWDEBUG("Too many protocols, not counting %s packets", fr_dict_root(request->dict)->name);
+		RETURN_MODULE_NOOP;
+	}
+
+	RETURN_MODULE_UPDATED;
+}
+
+/*
+ *	Do the statistics
+ */
+static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_stats_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_stats_t);
+	int			i;
+	uint32_t		stats_type;
+
+	fr_pair_t		*vp;
+	char			buffer[64];
+	uint64_t		local_stats[RLM_STATS_CODE_MAX];
 
 	/*
 	 *	Ignore "authenticate" and anything other than Status-Server
 	 */
-	if ((request->packet->code != FR_RADIUS_CODE_STATUS_SERVER)) {
+	if ((request->dict != dict_radius) || (request->packet->code != FR_RADIUS_CODE_STATUS_SERVER)) {
 		RETURN_MODULE_NOOP;
 	}
 
@@ -281,19 +424,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 
 	switch (stats_type) {
 	case FR_STATS4_TYPE_VALUE_GLOBAL:			/* global */
-		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
-		 */
-		pthread_mutex_lock(&inst->mutable->mutex);
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			inst->mutable->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		memcpy(&local_stats, inst->mutable->stats, sizeof(inst->mutable->stats));
-		pthread_mutex_unlock(&inst->mutable->mutex);
+		coalesce(local_stats, inst, 0, dict_radius, NULL);
 		vp = NULL;
 		break;
 
@@ -302,8 +433,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		if (!vp) vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_freeradius_stats4_ipv6_address);
 		if (!vp) RETURN_MODULE_NOOP;
 
-		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, src), &mydata);
+		coalesce(local_stats, inst, offsetof(rlm_stats_thread_t, src), dict_radius, &vp->vp_ip);
 		break;
 
 	case FR_STATS4_TYPE_VALUE_LISTENER:			/* dst */
@@ -311,8 +441,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 		if (!vp) vp = fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_freeradius_stats4_ipv6_address);
 		if (!vp) RETURN_MODULE_NOOP;
 
-		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, dst), &mydata);
+		coalesce(local_stats, inst, offsetof(rlm_stats_thread_t, dst), dict_radius, &vp->vp_ip);
 		break;
 
 	default:
@@ -328,12 +457,11 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	}
 
 	/*
-	 *	@todo - do this only for RADIUS
-	 *	key off of packet ID, and Stats4-Packet-Counters TLV.
+	 *	@todo - key off of packet ID, and Stats4-Packet-Counters TLV.
 	 */
 	strcpy(buffer, "FreeRADIUS-Stats4-");
 
-	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
+	for (i = 0; i < MIN(RLM_STATS_CODE_MAX, FR_RADIUS_CODE_MAX); i++) {
 		fr_dict_attr_t const *da;
 
 		if (!local_stats[i]) continue;
@@ -351,13 +479,15 @@ static unlang_action_t CC_HINT(nonnull) mod_stats(rlm_rcode_t *p_result, module_
 	RETURN_MODULE_OK;
 }
 
-
-static int8_t data_cmp(const void *one, const void *two)
+static int stats_sketch_init(rlm_stats_thread_t *t, rlm_stats_sketch_t *sketch, uint32_t max_entries)
 {
-	rlm_stats_data_t const *a = one;
-	rlm_stats_data_t const *b = two;
+	sketch->slots = talloc_zero_array(t, rlm_stats_data_t, max_entries);
+	if (unlikely(!sketch->slots)) return -1;
 
-	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	sketch->index = fr_rb_inline_talloc_alloc(t, rlm_stats_data_t, node, data_cmp, NULL);
+	if (unlikely(!sketch->index)) return -1;
+
+	return 0;
 }
 
 /** Instantiate thread data for the submodule.
@@ -371,15 +501,10 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	(void) talloc_set_type(t, rlm_stats_thread_t);
 
 	t->inst = inst;
+	atomic_init(&t->seq, 0);
 
-	t->src = fr_rb_inline_talloc_alloc(t, rlm_stats_data_t, src_node, data_cmp, NULL);
-	if (unlikely(!t->src)) return -1;
-
-	t->dst = fr_rb_inline_talloc_alloc(t, rlm_stats_data_t, dst_node, data_cmp, NULL);
-	if (unlikely(!t->dst)) {
-		TALLOC_FREE(t->src);
-		return -1;
-	}
+	if ((stats_sketch_init(t, &t->src, inst->max_entries) < 0) ||
+	    (stats_sketch_init(t, &t->dst, inst->max_entries) < 0)) return -1;
 
 	pthread_mutex_lock(&inst->mutable->mutex);
 	fr_dlist_insert_head(&inst->mutable->list, t);
@@ -391,20 +516,28 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 
 /** Destroy thread data for the submodule.
  *
+ * The per-protocol totals are kept, so they don't go backwards.  The
+ * per-address counters from this thread are discarded.
  */
 static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_stats_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_stats_thread_t);
 	rlm_stats_t		*inst = t->inst;
-	int			i;
+	int			i, j;
 
 	pthread_mutex_lock(&inst->mutable->mutex);
-	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-		inst->mutable->stats[i] += t->stats[i];
+	for (i = 0; i < RLM_STATS_PROTO_MAX; i++) {
+		rlm_stats_proto_t *retired;
+
+		if (!t->proto[i].dict) break;
+
+		retired = stats_proto(inst->mutable->retired, t->proto[i].dict, true);
+		if (!retired) break;
+
+		for (j = 0; j < RLM_STATS_CODE_MAX; j++) retired->stats[j] += t->proto[i].stats[j];
 	}
 	fr_dlist_remove(&inst->mutable->list, t);
 	pthread_mutex_unlock(&inst->mutable->mutex);
-	pthread_mutex_destroy(&t->mutex);
 
 	return 0;
 }
@@ -413,6 +546,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_stats_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_stats_t);
 
+	FR_INTEGER_BOUND_CHECK("max_entries", inst->max_entries, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_entries", inst->max_entries, <=, 65536);
+
 	MEM(inst->mutable = talloc_zero(NULL, rlm_stats_mutable_t));
 	pthread_mutex_init(&inst->mutable->mutex, NULL);
 	fr_dlist_init(&inst->mutable->list, rlm_stats_thread_t, entry);
@@ -460,6 +596,7 @@ module_rlm_t rlm_stats = {
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
+			{ .section = SECTION_NAME("send", CF_IDENT_ANY), .method = mod_stats_count },
 			{ .section = SECTION_NAME(CF_IDENT_ANY, CF_IDENT_ANY), .method = mod_stats },
 			MODULE_BINDING_TERMINATOR
 		}
@@ -96,6 +96,8 @@ typedef struct {
 	int			fd;			//!< File descriptor.
 
 	trunk_request_t     	**coalesced;		//!< Outbound coalesced requests.
+	fr_tacacs_packet_t	**obfuscate;		//!< Packets encoded by this call to request_mux(),
+							///< which still need their bodies obfuscated.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -278,6 +280,7 @@ static connection_state_t conn_init(void **h_out, connection_t *conn, void *uctx
 	 *	Initialize the buffer of coalesced packets we're doing to write.
 	 */
 	h->coalesced = talloc_zero_array(h, trunk_request_t *, h->inst->max_send_coalesce);
+	h->obfuscate = talloc_zero_array(h, fr_tacacs_packet_t *, h->inst->max_send_coalesce);
 
 	/*
 	 *	Open the outgoing socket.
@@ -618,10 +621,11 @@ static int encode(udp_handle_t *h, request_t *request, udp_request_t *u)
 	}
 
 	/*
-	 *	Encode the packet.
+	 *	Encode the packet.  The body is obfuscated later, in
+	 *	a batch with the other packets request_mux() sends.
 	 */
 	packet_len = fr_tacacs_encode(&FR_DBUFF_TMP(u->packet, (size_t) inst->max_packet_size), NULL,
-				      inst->secret, inst->secretlen, request->reply->code, &request->request_pairs);
+				      NULL, 0, request->reply->code, &request->request_pairs);
 	if (packet_len < 0) {
 		RPERROR("Failed encoding packet");
 		return -1;
@@ -796,7 +800,7 @@ static void request_mux(fr_event_list_t *el,
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	rlm_tacacs_tcp_t const	*inst = h->inst;
 	ssize_t			sent;
-	uint16_t		i, queued;
+	uint16_t		i, queued, encoded = 0;
 	uint8_t const		*written;
 	uint8_t			*partial;
 
@@ -892,6 +896,7 @@ static void request_mux(fr_event_list_t *el,
 		 *	Remember that we've encoded this packet.
 		 */
 		h->coalesced[queued] = treq;
+		h->obfuscate[encoded++] = (fr_tacacs_packet_t *) u->packet;
 		h->send.write += u->packet_len;
 
 		fr_assert(h->send.write <= h->send.end);
@@ -924,6 +929,21 @@ static void request_mux(fr_event_list_t *el,
 	 */
 	(void)talloc_get_type_abort(h, udp_handle_t);
 
+	/*
+	 *	The packets were encoded without a secret.  Obfuscate
+	 *	all of their bodies at once, which lets the pad
+	 *	calculations for different packets run in parallel.
+	 */
+	if (inst->secret && encoded) {
+		if (fr_tacacs_body_xor_batch(h->obfuscate, encoded, inst->secret, inst->secretlen) < 0) {
+			PERROR("%s - Failed obfuscating packets for connection %s", h->module_name, h->name);
+			trunk_connection_signal_reconnect(tconn, CONNECTION_FAILED);
+			return;
+		}
+
+		for (i = 0; i < encoded; i++) h->obfuscate[i]->hdr.flags &= ~FR_TAC_PLUS_UNENCRYPTED_FLAG;
+	}
+
 	/*
 	 *	Send the packets as one system call.
 	 */
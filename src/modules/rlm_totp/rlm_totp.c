@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/base32.h>
+#include <freeradius-devel/util/sha1.h>
 
 #include <freeradius-devel/unlang/call_env.h>
 
@@ -55,9 +56,33 @@ static const call_env_method_t method_env = {
 	}
 };
 
+/** The last time step used by a key
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of entries.
+	fr_dlist_t		entry;			//!< Entry in the expiry list.
+	fr_time_t		expires;		//!< When the time step is outside of the window.
+	uint64_t		counter;		//!< The last time step which was accepted.
+	uint8_t			key[SHA1_DIGEST_LENGTH];
+} totp_used_t;
+
+/** Time steps which have been used, so that each OTP can only be used once
+ *
+ * Shared by all threads.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;
+	fr_rb_tree_t		*tree;			//!< Entries, by key.
+	fr_dlist_head_t		expiry;			//!< Entries, roughly oldest first.
+	uint8_t			secret[32];		//!< Random key for the HMAC.
+} totp_used_cache_t;
+
 /* Define a structure for the configuration variables */
 typedef struct rlm_totp_t {
-	fr_totp_t	totp;			//! configuration entries passed to libfreeradius-totp
+	fr_totp_t		totp;			//! configuration entries passed to libfreeradius-totp
+	bool			replay_protection;	//!< Reject OTPs which have already been used.
+	totp_used_cache_t	*used;			//!< OTPs which have already been used.
 } rlm_totp_t;
 
 /* Map configuration file names to internal variables */
@@ -67,9 +92,89 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("lookback_steps", rlm_totp_t, totp.lookback_steps), .dflt = "1" },
 	{ FR_CONF_OFFSET("lookback_interval", rlm_totp_t, totp.lookback_interval), .dflt = "30" },
 	{ FR_CONF_OFFSET("lookforward_steps", rlm_totp_t, totp.lookforward_steps), .dflt = "0" },
+	{ FR_CONF_OFFSET("replay_protection", rlm_totp_t, replay_protection), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
 };
 
+static int8_t totp_used_cmp(void const *one, void const *two)
+{
+	totp_used_t const *a = one, *b = two;
+
+	return CMP(memcmp(a->key, b->key, sizeof(a->key)), 0);
+}
+
+static int _totp_used_cache_free(totp_used_cache_t *used)
+{
+	pthread_mutex_destroy(&used->mutex);
+	return 0;
+}
+
+/** Record that a key has used a time step
+ *
+ * RFC 6238 Section 5.2 says that an OTP must not be accepted a second
+ * time.  We remember the last time step accepted for each key, and
+ * reject that time step and any earlier one.  That also stops an OTP
+ * from an earlier step in the window being used after a later one.
+ *
+ * Keys are stored as an HMAC with a random secret, so the cache holds
+ * nothing which can be used to recover them.
+ *
+ * @return
+ *	- true if the time step has not been used.
+ *	- false if it is a replay.
+ */
+static bool totp_used_check(rlm_totp_t const *inst, uint8_t const *key, size_t keylen, uint64_t counter)
+{
+	totp_used_cache_t	*used = inst->used;
+	totp_used_t		find, *u;
+	fr_time_t		now = fr_time();
+	bool			ok = true;
+
+	fr_hmac_sha1(find.key, key, keylen, used->secret, sizeof(used->secret));
+
+	pthread_mutex_lock(&used->mutex);
+
+	/*
+	 *	Entries are appended as they are used, and time steps
+	 *	are close to "now", so the list is very nearly in
+	 *	expiry order.  Any stragglers are caught by the check
+	 *	below.
+	 */
+	while ((u = fr_dlist_head(&used->expiry)) && fr_time_lteq(u->expires, now)) {
+		fr_dlist_remove(&used->expiry, u);
+		fr_rb_remove(used->tree, u);
+		talloc_free(u);
+	}
+
+	u = fr_rb_find(used->tree, &find);
+	if (u && fr_time_gt(u->expires, now) && (counter <= u->counter)) {
+		ok = false;
+		goto done;
+	}
+
+	if (!u) {
+		MEM(u = talloc_zero(used, totp_used_t));
+		memcpy(u->key, find.key, sizeof(u->key));
+		fr_rb_insert(used->tree, u);
+	} else {
+		fr_dlist_remove(&used->expiry, u);
+	}
+
+	/*
+	 *	The time step can be matched until the earliest time
+	 *	in the window is after it.
+	 */
+	u->counter = counter;
+	u->expires = fr_time_from_sec((counter + 1) * inst->totp.time_step +
+				      (uint64_t) inst->totp.lookback_steps * inst->totp.lookback_interval);
+	fr_dlist_insert_tail(&used->expiry, u);
+
+done:
+	pthread_mutex_unlock(&used->mutex);
+
+	return ok;
+}
+
 /*
  *  Do the authentication
  */
@@ -84,6 +189,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	uint8_t const		*our_key;
 	size_t			our_keylen;
 	uint8_t			buffer[80];	/* multiple of 5*8 characters */
+	uint64_t		counter;
 
 	if (fr_type_is_null(user_password->type)) RETURN_MODULE_NOOP;
 
@@ -119,8 +225,13 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		our_keylen = len;
 	}
 
-	switch (fr_totp_cmp(&inst->totp, request, fr_time_to_sec(request->packet->timestamp), our_key, our_keylen, user_password->vb_strvalue)) {
+	switch (fr_totp_cmp(&inst->totp, request, fr_time_to_sec(request->packet->timestamp), our_key, our_keylen,
+			    user_password->vb_strvalue, &counter)) {
 	case 0:
+		if (inst->used && !totp_used_check(inst, our_key, our_keylen, counter)) {
+			REDEBUG("TOTP.From-User has already been used");
+			RETURN_MODULE_REJECT;
+		}
 		RETURN_MODULE_OK;
 
 	case -2:
@@ -160,6 +271,27 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 
 	if (inst->totp.otp_length == 7) inst->totp.otp_length = 8;
 
+	if (inst->replay_protection) {
+		totp_used_cache_t *used;
+
+		MEM(used = talloc_zero(NULL, totp_used_cache_t));
+		pthread_mutex_init(&used->mutex, NULL);
+		talloc_set_destructor(used, _totp_used_cache_free);
+		MEM(used->tree = fr_rb_inline_talloc_alloc(used, totp_used_t, node, totp_used_cmp, NULL));
+		fr_dlist_talloc_init(&used->expiry, totp_used_t, entry);
+		fr_rand_buffer(used->secret, sizeof(used->secret));
+		inst->used = used;
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_totp_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_totp_t);
+
+	TALLOC_FREE(inst->used);
+
 	return 0;
 }
 
@@ -179,7 +311,8 @@ module_rlm_t rlm_totp = {
 		.name		= "totp",
 		.inst_size	= sizeof(rlm_totp_t),
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
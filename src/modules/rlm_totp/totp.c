@@ -63,16 +63,19 @@ static void totp_log(char const *fmt, ...)
  * @param[in] key	Key to encrypt.
  * @param[in] keylen	Length of key field.
  * @param[in] totp	TOTP password entered by the user.
+ * @param[out] counter	the time step which the password matched.  May be NULL.
  * @return
  *	-  0  On Success
  *	- -1  On Failure
  *	- -2  On incorrect arguments
  */
-int fr_totp_cmp(fr_totp_t const *cfg, request_t *request, time_t now, uint8_t const *key, size_t keylen, char const *totp)
+int fr_totp_cmp(fr_totp_t const *cfg, request_t *request, time_t now, uint8_t const *key, size_t keylen, char const *totp,
+		uint64_t *counter)
 {
 	time_t		diff, then;
 	uint32_t	steps;
-	unsigned int	i;
+	unsigned int	i, j, num_tested = 0;
+	uint64_t	tested[32];
 	uint8_t		offset;
 	uint32_t	challenge;
 	uint64_t	padded;
@@ -110,6 +113,17 @@ int fr_totp_cmp(fr_totp_t const *cfg, request_t *request, time_t now, uint8_t co
 		then = now - diff;
 	repeat:
 		padded = ((uint64_t) then) / cfg->time_step;
+
+		/*
+		 *	When lookback_interval is smaller than time_step,
+		 *	several times fall into the same time step.  Only
+		 *	calculate the HMAC once for each time step.
+		 */
+		for (j = 0; j < num_tested; j++) {
+			if (tested[j] == padded) goto next;
+		}
+		if (num_tested < NUM_ELEMENTS(tested)) tested[num_tested++] = padded;
+
 		data[0] = padded >> 56;
 		data[1] = padded >> 48;
 		data[2] = padded >> 40;
@@ -156,8 +170,12 @@ int fr_totp_cmp(fr_totp_t const *cfg, request_t *request, time_t now, uint8_t co
 			RDEBUG3("Received %s", totp);
 		}
 
-		if (fr_digest_cmp((uint8_t const *) buffer, (uint8_t const *) totp, cfg->otp_length) == 0) return 0;
+		if (fr_digest_cmp((uint8_t const *) buffer, (uint8_t const *) totp, cfg->otp_length) == 0) {
+			if (counter) *counter = padded;
+			return 0;
+		}
 
+	next:
 		/*
 		 *	We've tested backwards, now do the equivalent time slot forwards
 		 */
@@ -219,7 +237,7 @@ int main(int argc, char **argv)
 
 		(void) sscanf(argv[2], "%llu", &now);
 
-		if (fr_totp_cmp(&totp, NULL, (time_t) now, (uint8_t const *) argv[3], strlen(argv[3]), argv[4]) == 0) {
+		if (fr_totp_cmp(&totp, NULL, (time_t) now, (uint8_t const *) argv[3], strlen(argv[3]), argv[4], NULL) == 0) {
 			return 0;
 		}
 		printf("Fail\n");
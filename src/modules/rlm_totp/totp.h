@@ -38,7 +38,8 @@ typedef struct {
 	uint32_t lookforward_steps;	//!< number of steps to look forwards
 } fr_totp_t;
 
-int fr_totp_cmp(fr_totp_t const *cfg, request_t *request, time_t now, uint8_t const *key, size_t keylen, char const *totp) CC_HINT(nonnull(1,4,6));
+int fr_totp_cmp(fr_totp_t const *cfg, request_t *request, time_t now, uint8_t const *key, size_t keylen, char const *totp,
+		uint64_t *counter) CC_HINT(nonnull(1,4,6));
 
 #ifdef __cplusplus
 }
@@ -31,22 +31,36 @@ RCSID("$Id$")
 #include <freeradius-devel/server/log.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include "io.h"
 #include "log.h"
 
+typedef struct unbound_cache_s unbound_cache_t;
+
 typedef struct {
 	uint32_t	timeout;
 
 	char const	*filename;		//!< Unbound configuration file
 	char const	*resolvconf;		//!< resolv.conf file to use
 	char const	*hosts;			//!< hosts file to load
+
+	struct {
+		uint32_t		max_entries;	//!< Maximum number of cached responses.  0 disables the cache.
+		fr_time_delta_t		max_ttl;	//!< Longest time to cache a positive response for.
+		fr_time_delta_t		negative_ttl;	//!< Longest time to cache a negative response for.
+		bool			prefetch;	//!< Refresh entries before they expire.
+
+		unbound_cache_t		*data;		//!< Responses shared by all threads.
+	} cache;
 } rlm_unbound_t;
 
 typedef struct {
 	unbound_io_event_base_t	*ev_b;		//!< Unbound event base
 	rlm_unbound_t		*inst;		//!< Instance data
 	unbound_log_t		*u_log;		//!< Unbound log structure
+	TALLOC_CTX		*prefetch_ctx;	//!< Background refreshes of cache entries.
 } rlm_unbound_thread_t;
 
 typedef struct {
@@ -62,8 +76,19 @@ typedef struct {
 	fr_value_box_list_t	list;		//!< Where to put the parsed results
 	TALLOC_CTX		*out_ctx;	//!< CTX to allocate parsed results in
 	fr_event_timer_t const	*ev;		//!< Event for timeout
+	uint16_t		rrtype;		//!< Type of record being looked up.
+	char const		*cache_name;	//!< Lowercased name to cache the response under.
+						///< NULL if caching is disabled.
 } unbound_request_t;
 
+static const conf_parser_t cache_config[] = {
+	{ FR_CONF_OFFSET("max_entries", rlm_unbound_t, cache.max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_ttl", rlm_unbound_t, cache.max_ttl), .dflt = "3600" },
+	{ FR_CONF_OFFSET("negative_ttl", rlm_unbound_t, cache.negative_ttl), .dflt = "60" },
+	{ FR_CONF_OFFSET("prefetch", rlm_unbound_t, cache.prefetch), .dflt = "yes" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
@@ -72,60 +97,379 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("timeout", rlm_unbound_t, timeout), .dflt = "3000" },
 	{ FR_CONF_OFFSET_FLAGS("resolvconf", CONF_FLAG_FILE_INPUT, rlm_unbound_t, resolvconf) },
 	{ FR_CONF_OFFSET_FLAGS("hosts", CONF_FLAG_FILE_INPUT, rlm_unbound_t, hosts) },
+	{ FR_CONF_POINTER("cache", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
-static int _unbound_request_free(unbound_request_t *ur)
+/** A DNS response, shared by all threads
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the cache tree.
+	fr_dlist_t		entry;		//!< Entry in the LRU list.
+
+	char const		*name;		//!< Lowercased name which was looked up.
+	uint16_t		rrtype;		//!< Type of record which was looked up.
+
+	uint8_t			*packet;	//!< Wire format response.
+	size_t			packet_len;	//!< Length of the response.
+
+	fr_time_t		expires;	//!< When the lowest TTL runs out.
+	fr_time_t		prefetch;	//!< When to refresh the entry in the background.
+	bool			prefetching;	//!< A refresh is in progress.
+} unbound_cache_entry_t;
+
+struct unbound_cache_s {
+	pthread_mutex_t		mutex;		//!< Protects the tree and the LRU list.
+	fr_rb_tree_t		*tree;		//!< Entries, by name and type.
+	fr_dlist_head_t		lru;		//!< Entries, least recently used first.
+};
+
+/** A background refresh of a cache entry
+ *
+ */
+typedef struct {
+	int			async_id;	//!< Id of async query.
+	rlm_unbound_thread_t	*t;		//!< Thread running the query.
+	char const		*name;		//!< Lowercased name being looked up.
+	uint16_t		rrtype;		//!< Type of record being looked up.
+} unbound_prefetch_t;
+
+static int8_t unbound_cache_cmp(void const *one, void const *two)
+{
+	unbound_cache_entry_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->rrtype, b->rrtype);
+	if (ret != 0) return ret;
+
+	return CMP(strcmp(a->name, b->name), 0);
+}
+
+static int _unbound_cache_free(unbound_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+	return 0;
+}
+
+/** Normalise a name so that lookups are case insensitive, and ignore the trailing dot
+ *
+ */
+static char *unbound_cache_name(TALLOC_CTX *ctx, char const *name)
 {
+	char	*out, *p;
+	size_t	len = strlen(name);
+
+	if ((len > 1) && (name[len - 1] == '.')) len--;
+
+	MEM(out = talloc_bstrndup(ctx, name, len));
+	for (p = out; *p; p++) *p = tolower((uint8_t) *p);
+
+	return out;
+}
+
+/** Skip over a name in a DNS packet
+ *
+ */
+static uint8_t const *unbound_name_skip(uint8_t const *p, uint8_t const *end)
+{
+	while (p < end) {
+		if (*p == 0) return p + 1;
+		if ((*p & 0xc0) == 0xc0) return ((p + 2) <= end) ? p + 2 : NULL;
+		if ((*p & 0xc0) != 0) return NULL;
+		p += *p + 1;
+	}
+
+	return NULL;
+}
+
+/** Figure out how long a response can be cached for
+ *
+ *  Positive answers are cached for the lowest TTL of the answer
+ *  records.  NXDOMAIN, and answers with no records, are cached for
+ *  the lower of the SOA TTL and the SOA minimum (RFC 2308), if there's
+ *  an SOA, or for negative_ttl if there isn't.
+ *
+ * @return
+ *	- 0 if the response can't be cached.
+ *	- the TTL in seconds.
+ */
+static uint32_t unbound_cache_ttl(rlm_unbound_t const *inst, uint8_t const *packet, size_t packet_len)
+{
+	uint8_t const	*p, *end = packet + packet_len;
+	uint16_t	qdcount, ancount, nscount, i;
+	uint32_t	ttl = UINT32_MAX, negative = fr_time_delta_to_sec(inst->cache.negative_ttl);
+	uint8_t		rcode;
+
+	if (packet_len < 12) return 0;
+
+	rcode = packet[3] & 0x0f;
+	if ((rcode != 0) && (rcode != 3)) return 0;
+
+	qdcount = fr_nbo_to_uint16(packet + 4);
+	ancount = fr_nbo_to_uint16(packet + 6);
+	nscount = fr_nbo_to_uint16(packet + 8);
+
+	p = packet + 12;
+	for (i = 0; i < qdcount; i++) {
+		p = unbound_name_skip(p, end);
+		if (!p || ((p + 4) > end)) return 0;
+		p += 4;
+	}
+
 	/*
-	 *	Cancel an outstanding async unbound call if the request is being freed
+	 *	Negative answer, look for an SOA in the authority
+	 *	section.
 	 */
-	if ((ur->async_id != 0) && (ur->done == 0)) ub_cancel(ur->t->ev_b->ub, ur->async_id);
+	if ((rcode == 3) || (ancount == 0)) {
+		for (i = 0; i < nscount; i++) {
+			uint16_t rdlength;
+
+			p = unbound_name_skip(p, end);
+			if (!p || ((p + 10) > end)) return 0;
+
+			rdlength = fr_nbo_to_uint16(p + 8);
+			if ((p + 10 + rdlength) > end) return 0;
+
+			if ((fr_nbo_to_uint16(p) == 6) && (rdlength >= 22)) {
+				uint32_t minimum = fr_nbo_to_uint32(p + 10 + rdlength - 4);
+
+				ttl = fr_nbo_to_uint32(p + 4);
+				if (minimum < ttl) ttl = minimum;
+				break;
+			}
+
+			p += 10 + rdlength;
+		}
+
+		return (ttl < negative) ? ttl : negative;
+	}
+
+	for (i = 0; i < ancount; i++) {
+		uint32_t rr_ttl;
+
+		p = unbound_name_skip(p, end);
+		if (!p || ((p + 10) > end)) return 0;
+
+		rr_ttl = fr_nbo_to_uint32(p + 4);
+		if (rr_ttl < ttl) ttl = rr_ttl;
+
+		p += 10 + fr_nbo_to_uint16(p + 8);
+		if (p > end) return 0;
+	}
+
+	if (ttl > fr_time_delta_to_sec(inst->cache.max_ttl)) ttl = fr_time_delta_to_sec(inst->cache.max_ttl);
+
+	return ttl;
+}
+
+/** Find a response in the cache
+ *
+ * @param[out] prefetch	set to true if the caller should refresh the entry.
+ * @param[in] ctx	to copy the response into.
+ * @param[in] inst	Module instance.
+ * @param[in] name	Lowercased name to look up.
+ * @param[in] rrtype	Type of record to look up.
+ * @param[out] packet_len Length of the response.
+ * @return
+ *	- a copy of the response.
+ *	- NULL if there's no unexpired response.
+ */
+static uint8_t *unbound_cache_find(bool *prefetch, TALLOC_CTX *ctx, rlm_unbound_t const *inst,
+				   char const *name, uint16_t rrtype, size_t *packet_len)
+{
+	unbound_cache_t		*cache = inst->cache.data;
+	unbound_cache_entry_t	*entry;
+	uint8_t			*packet = NULL;
+	fr_time_t		now = fr_time();
+
+	*prefetch = false;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(unbound_cache_entry_t){ .name = name, .rrtype = rrtype });
+	if (!entry) goto done;
+
+	if (fr_time_lteq(entry->expires, now)) {
+		fr_rb_remove(cache->tree, entry);
+		fr_dlist_remove(&cache->lru, entry);
+		talloc_free(entry);
+		goto done;
+	}
+
+	fr_dlist_remove(&cache->lru, entry);
+	fr_dlist_insert_tail(&cache->lru, entry);
+
+	if (inst->cache.prefetch && !entry->prefetching && fr_time_gteq(now, entry->prefetch)) {
+		entry->prefetching = true;
+		*prefetch = true;
+	}
+
+	MEM(packet = talloc_memdup(ctx, entry->packet, entry->packet_len));
+	*packet_len = entry->packet_len;
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+
+	return packet;
+}
+
+/** Add a response to the cache, replacing any existing entry
+ *
+ */
+static void unbound_cache_store(rlm_unbound_t const *inst, char const *name, uint16_t rrtype,
+				uint8_t const *packet, size_t packet_len)
+{
+	unbound_cache_t		*cache = inst->cache.data;
+	unbound_cache_entry_t	*entry, *old;
+	uint32_t		ttl;
+	fr_time_t		now = fr_time();
+
+	ttl = unbound_cache_ttl(inst, packet, packet_len);
+
+	MEM(entry = talloc_zero(NULL, unbound_cache_entry_t));
+	entry->name = talloc_strdup(entry, name);
+	entry->rrtype = rrtype;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	old = fr_rb_find(cache->tree, entry);
+	if (old) {
+		fr_rb_remove(cache->tree, old);
+		fr_dlist_remove(&cache->lru, old);
+		talloc_free(old);
+	}
+
+	/*
+	 *	Not cacheable, any stale entry is removed.
+	 */
+	if (!ttl) {
+		pthread_mutex_unlock(&cache->mutex);
+		talloc_free(entry);
+		return;
+	}
+
+	MEM(entry->packet = talloc_memdup(entry, packet, packet_len));
+	entry->packet_len = packet_len;
+	entry->expires = fr_time_add(now, fr_time_delta_from_sec(ttl));
+
+	/*
+	 *	Refresh when 90% of the TTL has gone, which is
+	 *	what unbound does for its own cache.
+	 */
+	entry->prefetch = fr_time_add(now, fr_time_delta_from_msec((int64_t) ttl * 900));
+
+	if (fr_rb_num_elements(cache->tree) >= inst->cache.max_entries) {
+		old = fr_dlist_pop_head(&cache->lru);
+		fr_rb_remove(cache->tree, old);
+		talloc_free(old);
+	}
+
+	talloc_steal(cache, entry);
+	fr_rb_insert(cache->tree, entry);
+	fr_dlist_insert_tail(&cache->lru, entry);
+
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Allow another refresh of an entry, after one failed
+ *
+ */
+static void unbound_cache_prefetch_failed(rlm_unbound_t const *inst, char const *name, uint16_t rrtype)
+{
+	unbound_cache_t		*cache = inst->cache.data;
+	unbound_cache_entry_t	*entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(unbound_cache_entry_t){ .name = name, .rrtype = rrtype });
+	if (entry) entry->prefetching = false;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static int _unbound_prefetch_free(unbound_prefetch_t *pf)
+{
+	if (pf->async_id != 0) {
+		ub_cancel(pf->t->ev_b->ub, pf->async_id);
+		unbound_cache_prefetch_failed(pf->t->inst, pf->name, pf->rrtype);
+	}
 
 	return 0;
 }
 
-/**	Callback called by unbound when resolution started with ub_resolve_event() completes
+/** Callback called by unbound when a background refresh completes
  *
- * @param mydata	the request tracking structure set up before ub_resolve_event() was called
- * @param rcode		should be the rcode from the reply packet, but appears not to be
- * @param packet	wire format reply packet
- * @param packet_len	length of wire format packet
- * @param sec		DNSSEC status code
- * @param why_bogus	String describing DNSSEC issue if sec = 1
- * @param rate_limited	Was the request rate limited due to unbound workload
  */
-static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int packet_len, int sec,
-				  char *why_bogus
+static void unbound_prefetch_callback(void *mydata, UNUSED int rcode, void *packet, int packet_len, int sec,
+				      UNUSED char *why_bogus
 #if UNBOUND_VERSION_MAJOR > 1 || (UNBOUND_VERSION_MAJOR == 1 && UNBOUND_VERSION_MINOR > 7)
-				  , UNUSED int rate_limited
+				      , UNUSED int rate_limited
 #endif
-				  )
+				      )
+{
+	unbound_prefetch_t	*pf = talloc_get_type_abort(mydata, unbound_prefetch_t);
+
+	pf->async_id = 0;
+
+	if ((sec == 1) || !packet || (packet_len <= 0)) {
+		unbound_cache_prefetch_failed(pf->t->inst, pf->name, pf->rrtype);
+	} else {
+		unbound_cache_store(pf->t->inst, pf->name, pf->rrtype, packet, packet_len);
+	}
+
+	talloc_free(pf);
+}
 
+/** Refresh a cache entry in the background
+ *
+ *  The prefetch is owned by the thread, so it's cancelled if the
+ *  thread exits.
+ */
+static void unbound_prefetch(rlm_unbound_thread_t *t, char const *name, uint16_t rrtype)
 {
-	unbound_request_t	*ur = talloc_get_type_abort(mydata, unbound_request_t);
-	request_t		*request = ur->request;
-	fr_dbuff_t		dbuff;
-	uint16_t		qdcount = 0, ancount = 0, i, rdlength = 0;
-	uint8_t			pktrcode = 0, skip = 0;
-	ssize_t			used;
-	fr_value_box_t		*vb;
+	unbound_prefetch_t	*pf;
+
+	MEM(pf = talloc_zero(t->prefetch_ctx, unbound_prefetch_t));
+	pf->t = t;
+	pf->name = talloc_strdup(pf, name);
+	pf->rrtype = rrtype;
+	talloc_set_destructor(pf, _unbound_prefetch_free);
 
 	/*
-	 *	Request has completed remove timeout event and set
-	 *	async_id to 0 so ub_cancel() is not called when ur is freed
+	 *	The callback may run, and free pf, before
+	 *	ub_resolve_event() returns.
 	 */
-	if (ur->ev) (void)fr_event_timer_delete(&ur->ev);
-	ur->async_id = 0;
+	if (ub_resolve_event(t->ev_b->ub, name, rrtype, 1, pf, unbound_prefetch_callback, &pf->async_id) != 0) {
+		unbound_cache_prefetch_failed(t->inst, name, rrtype);
+		talloc_free(pf);
+	}
+}
 
+static int _unbound_request_free(unbound_request_t *ur)
+{
 	/*
-	 *	Bogus responses have the "sec" flag set to 1
+	 *	Cancel an outstanding async unbound call if the request is being freed
 	 */
-	if (sec == 1) {
-		RERROR("%s", why_bogus);
-		ur->done = -16;
-		goto resume;
-	}
+	if ((ur->async_id != 0) && (ur->done == 0)) ub_cancel(ur->t->ev_b->ub, ur->async_id);
+
+	return 0;
+}
+
+/** Parse a wire format response into value boxes
+ *
+ * Sets ur->done to 1 on success, or to a negative value on error.
+ *
+ * @param[in] ur		the request tracking structure.
+ * @param[in] packet		wire format reply packet.
+ * @param[in] packet_len	length of wire format packet.
+ */
+static void unbound_response_parse(unbound_request_t *ur, uint8_t const *packet, int packet_len)
+{
+	request_t		*request = ur->request;
+	fr_dbuff_t		dbuff;
+	uint16_t		qdcount = 0, ancount = 0, i, rdlength = 0;
+	uint8_t			pktrcode = 0, skip = 0;
+	int			rcode;
+	ssize_t			used;
+	fr_value_box_t		*vb;
 
 	RHEXDUMP4((uint8_t const *)packet, packet_len, "Unbound callback called with packet [length %d]", packet_len);
 
@@ -143,14 +487,14 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 	if (rcode != 0) {
 		ur->done = 0 - rcode;
 		REDEBUG("DNS rcode is %d", rcode);
-		goto resume;
+		return;
 	}
 
 	fr_dbuff_out(&qdcount, &dbuff);
 	if (qdcount > 1) {
 		RERROR("DNS results packet with multiple questions");
 		ur->done = -32;
-		goto resume;
+		return;
 	}
 
 	/*	How many answer records do we have? */
@@ -207,7 +551,7 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 				talloc_free(vb);
 				fr_value_box_list_talloc_free(&ur->list);
 				ur->done = -32;
-				goto resume;
+				return;
 			}
 			break;
 
@@ -248,6 +592,48 @@ static void xlat_unbound_callback(void *mydata, int rcode, void *packet, int pac
 	}
 
 	ur->done = 1;
+}
+
+/**	Callback called by unbound when resolution started with ub_resolve_event() completes
+ *
+ * @param mydata	the request tracking structure set up before ub_resolve_event() was called
+ * @param rcode		should be the rcode from the reply packet, but appears not to be
+ * @param packet	wire format reply packet
+ * @param packet_len	length of wire format packet
+ * @param sec		DNSSEC status code
+ * @param why_bogus	String describing DNSSEC issue if sec = 1
+ * @param rate_limited	Was the request rate limited due to unbound workload
+ */
+static void xlat_unbound_callback(void *mydata, UNUSED int rcode, void *packet, int packet_len, int sec,
+				  char *why_bogus
+#if UNBOUND_VERSION_MAJOR > 1 || (UNBOUND_VERSION_MAJOR == 1 && UNBOUND_VERSION_MINOR > 7)
+				  , UNUSED int rate_limited
+#endif
+				  )
+
+{
+	unbound_request_t	*ur = talloc_get_type_abort(mydata, unbound_request_t);
+	request_t		*request = ur->request;
+
+	/*
+	 *	Request has completed remove timeout event and set
+	 *	async_id to 0 so ub_cancel() is not called when ur is freed
+	 */
+	if (ur->ev) (void)fr_event_timer_delete(&ur->ev);
+	ur->async_id = 0;
+
+	/*
+	 *	Bogus responses have the "sec" flag set to 1
+	 */
+	if (sec == 1) {
+		RERROR("%s", why_bogus);
+		ur->done = -16;
+		goto resume;
+	}
+
+	if (ur->cache_name) unbound_cache_store(ur->t->inst, ur->cache_name, ur->rrtype, packet, packet_len);
+
+	unbound_response_parse(ur, packet, packet_len);
 
 resume:
 	unlang_interpret_mark_runnable(ur->request);
@@ -353,6 +739,7 @@ static xlat_action_t xlat_unbound(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	fr_value_box_t			*query_vb = fr_value_box_list_next(in, host_vb);
 	fr_value_box_t			*count_vb = fr_value_box_list_next(in, query_vb);
 	unbound_request_t		*ur;
+	bool				cached = false;
 
 	if (host_vb->vb_length == 0) {
 		REDEBUG("Can't resolve zero length host");
@@ -379,8 +766,7 @@ static xlat_action_t xlat_unbound(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	if (strcmp(query_vb->vb_strvalue, _record) == 0) { \
 		ur->return_type = _return; \
 		ur->has_priority = _hasprio; \
-		ub_resolve_event(t->ev_b->ub, host_vb->vb_strvalue, _rrvalue, 1, ur, \
-				xlat_unbound_callback, &ur->async_id); \
+		ur->rrtype = _rrvalue; \
 	}
 
 	/* coverity[dereference] */
@@ -396,6 +782,35 @@ static xlat_action_t xlat_unbound(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		return XLAT_ACTION_FAIL;
 	}
 
+	/*
+	 *	Answer from the shared cache if we can.  Entries
+	 *	which are close to expiring are refreshed in the
+	 *	background, so that lookups don't wait for them.
+	 */
+	if (inst->cache.data) {
+		uint8_t		*packet;
+		size_t		packet_len;
+		bool		prefetch;
+
+		ur->cache_name = unbound_cache_name(ur, host_vb->vb_strvalue);
+
+		packet = unbound_cache_find(&prefetch, ur, inst, ur->cache_name, ur->rrtype, &packet_len);
+		if (packet) {
+			RDEBUG2("Using cached response");
+
+			if (prefetch) unbound_prefetch(t, ur->cache_name, ur->rrtype);
+
+			unbound_response_parse(ur, packet, packet_len);
+			talloc_free(packet);
+			cached = true;
+		}
+	}
+
+	if (!cached) {
+		ub_resolve_event(t->ev_b->ub, host_vb->vb_strvalue, ur->rrtype, 1, ur,
+				 xlat_unbound_callback, &ur->async_id);
+	}
+
 	/*
 	 *	unbound returned before we yielded - run the callback
 	 *	This is when serving results from local data
@@ -425,6 +840,8 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	int			res;
 
 	t->inst = inst;
+	MEM(t->prefetch_ctx = talloc_new(t));
+
 	if (unbound_io_init(t, &t->ev_b, mctx->el) < 0) {
 		PERROR("Unable to create unbound event base");
 		return -1;
@@ -477,12 +894,50 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_unbound_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_unbound_thread_t);
 
+	/*
+	 *	Cancel refreshes while the unbound context still exists.
+	 */
+	talloc_free(t->prefetch_ctx);
 	talloc_free(t->u_log);
 	talloc_free(t->ev_b);
 
 	return 0;
 }
 
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_unbound_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_unbound_t);
+	unbound_cache_t		*cache;
+
+	if (!inst->cache.max_entries) return 0;
+
+	FR_TIME_DELTA_BOUND_CHECK("cache.max_ttl", inst->cache.max_ttl, >=, fr_time_delta_from_sec(1));
+
+	/*
+	 *	Not parented by the instance data, as that's read only
+	 *	once instantiation is complete.
+	 */
+	MEM(cache = talloc_zero(NULL, unbound_cache_t));
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _unbound_cache_free);
+
+	MEM(cache->tree = fr_rb_inline_talloc_alloc(cache, unbound_cache_entry_t, node, unbound_cache_cmp, NULL));
+	fr_dlist_init(&cache->lru, unbound_cache_entry_t, entry);
+
+	inst->cache.data = cache;
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_unbound_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_unbound_t);
+
+	TALLOC_FREE(inst->cache.data);
+
+	return 0;
+}
+
 static int mod_bootstrap(module_inst_ctx_t const *mctx)
 {
 	rlm_unbound_t const	*inst = talloc_get_type_abort(mctx->mi->data, rlm_unbound_t);
@@ -507,6 +962,8 @@ module_rlm_t rlm_unbound = {
 		.inst_size		= sizeof(rlm_unbound_t),
 		.config			= module_config,
 		.bootstrap		= mod_bootstrap,
+		.instantiate		= mod_instantiate,
+		.detach			= mod_detach,
 
 		.thread_inst_size	= sizeof(rlm_unbound_thread_t),
 		.thread_inst_type	= "rlm_unbound_thread_t",
@@ -27,7 +27,12 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
 
 #include <wbclient.h>
 #include <core/ntstatus.h>
@@ -35,85 +40,327 @@ RCSID("$Id$")
 #include "rlm_winbind.h"
 #include "auth_wbclient_pap.h"
 
-/** PAP authentication direct to winbind via Samba's libwbclient library
+/** A PAP authentication, which may be run by one of the pool threads
  *
- * @param[in] request The current request
- * @param[in] env The call_env for the current winbind authentication
- * @param[in] t The module thread instance data.
+ * Everything the pool thread uses is copied into the job, so the
+ * request can be freed while the job is still running.
+ */
+struct winbind_auth_job_s {
+	fr_dlist_t			entry;		//!< Entry in the pool's queue.
+	rlm_winbind_thread_t		*t;		//!< Thread which submitted the job.
+	request_t			*request;	//!< To resume.  NULL if the request was cancelled.
+
+	winbind_ctx_t			*wbctx;		//!< Reserved for this job.
+	struct wbcAuthUserParams	authparams;
+
+	wbcErr				err;		//!< Written by the pool thread.
+	struct wbcAuthUserInfo		*info;		//!< Written by the pool thread.
+	struct wbcAuthErrorInfo		*error;		//!< Written by the pool thread.
+};
+
+struct winbind_pool_s {
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	fr_dlist_head_t			queue;		//!< Jobs waiting for a thread.
+	bool				stop;		//!< Tell the threads to exit.
+	pthread_t			*threads;
+	uint32_t			num_threads;	//!< How many threads were started.
+};
+
+static int _winbind_auth_job_free(winbind_auth_job_t *job)
+{
+	if (job->wbctx) winbind_slab_release(job->wbctx);
+	if (job->info) wbcFreeMemory(job->info);
+	if (job->error) wbcFreeMemory(job->error);
+
+	return 0;
+}
+
+static void *winbind_pool_thread(void *arg)
+{
+	winbind_pool_t		*pool = arg;
+	winbind_auth_job_t	*job;
+	sigset_t		sigset;
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		job = fr_dlist_pop_head(&pool->queue);
+		if (!job) {
+			if (pool->stop) break;
+
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->err = wbcCtxAuthenticateUserEx(job->wbctx->ctx, &job->authparams, &job->info, &job->error);
+
+		/*
+		 *	Hand the job back to the thread which submitted
+		 *	it.  Writes of a pointer to a pipe are atomic.
+		 */
+		while ((write(job->t->pipe[1], &job, sizeof(job)) < 0) && (errno == EINTR));
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static int _winbind_pool_free(winbind_pool_t *pool)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) (void) pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+/** Start the threads which call winbind
  *
+ * @param[in] num_threads	to start.
  * @return
- *	- 0	Success
- *	- -1	Authentication failure
- *	- -648	Password expired
+ *	- The pool on success.
+ *	- NULL on failure.
+ */
+winbind_pool_t *winbind_pool_alloc(uint32_t num_threads)
+{
+	winbind_pool_t	*pool;
+
+	/*
+	 *	Not parented by the module instance, as the instance
+	 *	data is read only once instantiation is complete.
+	 */
+	MEM(pool = talloc_zero(NULL, winbind_pool_t));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	fr_dlist_init(&pool->queue, winbind_auth_job_t, entry);
+	MEM(pool->threads = talloc_array(pool, pthread_t, num_threads));
+	talloc_set_destructor(pool, _winbind_pool_free);
+
+	while (pool->num_threads < num_threads) {
+		if (fr_schedule_pthread_create(&pool->threads[pool->num_threads], winbind_pool_thread, pool) < 0) {
+			PERROR("Failed starting winbind thread");
+			talloc_free(pool);
+			return NULL;
+		}
+		pool->num_threads++;
+	}
+
+	return pool;
+}
+
+/** Read completed jobs from the pool threads
  *
  */
-int do_auth_wbclient_pap(request_t *request, winbind_auth_call_env_t *env, rlm_winbind_thread_t *t)
+static void winbind_pool_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
-	int				ret = -1;
-	winbind_ctx_t			*wbctx;
-	struct wbcContext		*wb_ctx;
-	struct wbcAuthUserParams	authparams;
-	wbcErr				err;
-	struct wbcAuthUserInfo		*info = NULL;
-	struct wbcAuthErrorInfo		*error = NULL;
+	rlm_winbind_thread_t	*t = talloc_get_type_abort(uctx, rlm_winbind_thread_t);
+	winbind_auth_job_t	*job;
+
+	while (read(fd, &job, sizeof(job)) == sizeof(job)) {
+		t->outstanding--;
+
+		/*
+		 *	The request went away while the job was
+		 *	running, so no one is waiting for the result.
+		 */
+		if (!job->request) {
+			talloc_free(job);
+			continue;
+		}
+
+		unlang_interpret_mark_runnable(job->request);
+	}
+}
+
+/** Set up the pipe the pool threads return jobs through
+ *
+ * @param[in] t		Thread instance data.
+ * @param[in] el	Event list of the thread.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int winbind_pool_thread_instantiate(rlm_winbind_thread_t *t, fr_event_list_t *el)
+{
+	if (pipe(t->pipe) < 0) {
+		ERROR("Failed creating pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	(void) fr_nonblock(t->pipe[0]);
+
+	if (fr_event_fd_insert(t, NULL, el, t->pipe[0], winbind_pool_read, NULL, NULL, t) < 0) {
+		PERROR("Failed inserting winbind pipe");
+		close(t->pipe[0]);
+		close(t->pipe[1]);
+		t->pipe[0] = t->pipe[1] = -1;
+		return -1;
+	}
+	t->el = el;
+
+	return 0;
+}
+
+/** Wait for jobs from this thread to complete, and close the pipe
+ *
+ * Jobs from requests which were cancelled may still be running.
+ */
+void winbind_pool_thread_detach(rlm_winbind_thread_t *t)
+{
+	if (t->pipe[0] < 0) return;
+
+	(void) fr_event_fd_delete(t->el, t->pipe[0], FR_EVENT_FILTER_IO);
+	(void) fr_blocking(t->pipe[0]);
+
+	while (t->outstanding > 0) {
+		winbind_auth_job_t *job;
+
+		if (read(t->pipe[0], &job, sizeof(job)) != sizeof(job)) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		t->outstanding--;
+		talloc_free(job);
+	}
+
+	close(t->pipe[0]);
+	close(t->pipe[1]);
+	t->pipe[0] = t->pipe[1] = -1;
+}
+
+/** Start PAP authentication against winbind via Samba's libwbclient library
+ *
+ * If there's a pool of threads, the call to winbind is made by one of
+ * them, and the request is marked runnable when it completes.
+ * Otherwise the call is made immediately.  Either way,
+ * #winbind_auth_pap_result should be called to get the result.
+ *
+ * @param[out] out	The job.  Must be freed by the caller, unless the
+ *			request is cancelled.  Then it must be passed to
+ *			#winbind_auth_pap_cancel.
+ * @param[in] request	The current request.
+ * @param[in] env	The call_env for the current winbind authentication.
+ * @param[in] t		The module thread instance data.
+ * @return
+ *	- 1 if the job was queued, and the request should yield.
+ *	- 0 if the job has completed.
+ *	- -1 on error.
+ */
+int winbind_auth_pap_start(winbind_auth_job_t **out, request_t *request, winbind_auth_call_env_t *env,
+			   rlm_winbind_thread_t *t)
+{
+	winbind_auth_job_t		*job;
+	winbind_pool_t			*pool = t->inst->pool;
+
+	*out = NULL;
 
 	/*
-	 * Clear the auth parameters - this is important, as
-	 * there are options that will cause wbcAuthenticateUserEx
-	 * to bomb out if not zero.
+	 *	Not parented by the request, as the job may outlive it.
 	 */
-	memset(&authparams, 0, sizeof(authparams));
+	MEM(job = talloc_zero(NULL, winbind_auth_job_t));
+	talloc_set_destructor(job, _winbind_auth_job_free);
+	job->t = t;
+	job->request = request;
 
 	/*
 	 * username must be set for this function to be called
 	 */
 	fr_assert(env->username.type == FR_TYPE_STRING);
 
-	authparams.account_name = env->username.vb_strvalue;
+	job->authparams.account_name = talloc_bstrndup(job, env->username.vb_strvalue, env->username.vb_length);
 
 	if (env->domain.type == FR_TYPE_STRING) {
-		authparams.domain_name = env->domain.vb_strvalue;
+		job->authparams.domain_name = talloc_bstrndup(job, env->domain.vb_strvalue, env->domain.vb_length);
 	} else {
 		RWDEBUG2("No domain specified; authentication may fail because of this");
 	}
 
-
 	/*
 	 * Build the wbcAuthUserParams structure with what we know
 	 */
-	authparams.level = WBC_AUTH_USER_LEVEL_PLAIN;
-	authparams.password.plaintext = env->password.vb_strvalue;
+	job->authparams.level = WBC_AUTH_USER_LEVEL_PLAIN;
+	job->authparams.password.plaintext = talloc_bstrndup(job, env->password.vb_strvalue, env->password.vb_length);
 
 	/*
 	 * Parameters documented as part of the MSV1_0_SUBAUTH_LOGON structure
 	 * at https://msdn.microsoft.com/aa378767.aspx
 	 */
-	authparams.parameter_control |= WBC_MSV1_0_CLEARTEXT_PASSWORD_ALLOWED |
-					WBC_MSV1_0_ALLOW_WORKSTATION_TRUST_ACCOUNT |
-					WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
+	job->authparams.parameter_control |= WBC_MSV1_0_CLEARTEXT_PASSWORD_ALLOWED |
+					     WBC_MSV1_0_ALLOW_WORKSTATION_TRUST_ACCOUNT |
+					     WBC_MSV1_0_ALLOW_SERVER_TRUST_ACCOUNT;
 
 	/*
 	 * Send auth request across to winbind
 	 */
-	wbctx = winbind_slab_reserve(t->slab);
-	if (!wbctx) {
+	job->wbctx = winbind_slab_reserve(t->slab);
+	if (!job->wbctx) {
 		RERROR("Unable to get winbind context");
-		goto done;
+		talloc_free(job);
+		return -1;
+	}
+
+	RDEBUG2("Sending authentication request user='%s' domain='%s'", job->authparams.account_name,
+									job->authparams.domain_name);
+
+	*out = job;
+
+	if (!pool) {
+		job->err = wbcCtxAuthenticateUserEx(job->wbctx->ctx, &job->authparams, &job->info, &job->error);
+		return 0;
 	}
-	wb_ctx = wbctx->ctx;
 
-	RDEBUG2("Sending authentication request user='%s' domain='%s'", authparams.account_name,
-									authparams.domain_name);
+	pthread_mutex_lock(&pool->mutex);
+	fr_dlist_insert_tail(&pool->queue, job);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	t->outstanding++;
 
-	err = wbcCtxAuthenticateUserEx(wb_ctx, &authparams, &info, &error);
+	return 1;
+}
 
-	winbind_slab_release(wbctx);
+/** Stop waiting for a job
+ *
+ * The job is freed when the pool thread returns it.
+ */
+void winbind_auth_pap_cancel(winbind_auth_job_t *job)
+{
+	job->request = NULL;
+}
+
+/** Get the result of PAP authentication against winbind
+ *
+ * @param[in] request	The current request.
+ * @param[in] job	which has completed.
+ * @return
+ *	- 0	Success
+ *	- -1	Authentication failure
+ *	- -648	Password expired
+ *
+ */
+int winbind_auth_pap_result(request_t *request, winbind_auth_job_t *job)
+{
+	int				ret = -1;
+	struct wbcAuthErrorInfo		*error = job->error;
 
 	/*
 	 * Try and give some useful feedback on what happened. There are only
 	 * a few errors that can actually be returned from wbcCtxAuthenticateUserEx.
 	 */
-	switch (err) {
+	switch (job->err) {
 	case WBC_ERR_SUCCESS:
 		ret = 0;
 		RDEBUG2("Authenticated successfully");
@@ -161,18 +408,12 @@ int do_auth_wbclient_pap(request_t *request, winbind_auth_call_env_t *env, rlm_w
 		 * neither of which are particularly likely.
 		 */
 		if (error && error->display_string) {
-			REDEBUG2("Failed authenticating user: %s (%s)", error->display_string, wbcErrorString(err));
+			REDEBUG2("Failed authenticating user: %s (%s)", error->display_string, wbcErrorString(job->err));
 		} else {
-			REDEBUG2("Failed authenticating user: Winbind error (%s)", wbcErrorString(err));
+			REDEBUG2("Failed authenticating user: Winbind error (%s)", wbcErrorString(job->err));
 		}
 		break;
 	}
 
-
-done:
-	if (info) wbcFreeMemory(info);
-	if (error) wbcFreeMemory(error);
-
 	return ret;
 }
-
@@ -4,4 +4,15 @@
 
 RCSIDH(auth_wbclient_h, "$Id$")
 
-int do_auth_wbclient_pap(request_t *request, winbind_auth_call_env_t *env, rlm_winbind_thread_t *t);
+winbind_pool_t	*winbind_pool_alloc(uint32_t num_threads);
+
+int		winbind_pool_thread_instantiate(rlm_winbind_thread_t *t, fr_event_list_t *el);
+
+void		winbind_pool_thread_detach(rlm_winbind_thread_t *t);
+
+int		winbind_auth_pap_start(winbind_auth_job_t **out, request_t *request, winbind_auth_call_env_t *env,
+				       rlm_winbind_thread_t *t);
+
+void		winbind_auth_pap_cancel(winbind_auth_job_t *job);
+
+int		winbind_auth_pap_result(request_t *request, winbind_auth_job_t *job);
@@ -50,6 +50,7 @@ static conf_parser_t reuse_winbind_config[] = {
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_POINTER("group", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) group_config },
 	{ FR_CONF_OFFSET_SUBSECTION("reuse", 0, rlm_winbind_t, reuse, reuse_winbind_config) },
+	{ FR_CONF_OFFSET("threads", rlm_winbind_t, threads), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -315,6 +316,22 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		     mctx->mi->name);
 	}
 
+	FR_INTEGER_BOUND_CHECK("threads", inst->threads, <=, 64);
+
+	if (inst->threads > 0) {
+		inst->pool = winbind_pool_alloc(inst->threads);
+		if (!inst->pool) return -1;
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_winbind_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_winbind_t);
+
+	TALLOC_FREE(inst->pool);
+
 	return 0;
 }
 
@@ -355,7 +372,39 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 }
 
 
+/** Get the result of authentication
+ *
+ * No need for many debug outputs or errors as the result function
+ * is chatty enough.
+ */
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	winbind_auth_job_t	*job = mctx->rctx;
+	int			ret;
+
+	ret = winbind_auth_pap_result(request, job);
+	talloc_free(job);
+
+	if (ret == 0) {
+		RDEBUG2("User authenticated successfully using winbind");
+		RETURN_MODULE_OK;
+	}
+
+	RETURN_MODULE_REJECT;
+}
+
+/** The request was cancelled while winbind was being called
+ *
+ */
+static void mod_authenticate_signal(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	winbind_auth_pap_cancel(mctx->rctx);
+}
+
 /** Authenticate the user via libwbclient and winbind
+ *
+ * If a pool of threads is configured, winbind is called from one of them,
+ * and the request yields until it returns.
  *
  * @param[out] p_result		The result of the module call.
  * @param[in] mctx		Module instance data.
@@ -365,6 +414,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 {
 	winbind_auth_call_env_t	*env = talloc_get_type_abort(mctx->env_data, winbind_auth_call_env_t);
 	rlm_winbind_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_winbind_thread_t);
+	winbind_auth_job_t	*job;
 
 	/*
 	 *	Make sure the supplied password isn't empty
@@ -383,17 +433,17 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Login attempt with password");
 	}
 
-	/*
-	 *	Authenticate and return OK if successful. No need for
-	 *	many debug outputs or errors as the auth function is
-	 *	chatty enough.
-	 */
-	if (do_auth_wbclient_pap(request, env, t) == 0) {
-		RDEBUG2("User authenticated successfully using winbind");
-		RETURN_MODULE_OK;
-	}
+	switch (winbind_auth_pap_start(&job, request, env, t)) {
+	case 1:
+		return unlang_module_yield(request, mod_authenticate_resume, mod_authenticate_signal,
+					   ~FR_SIGNAL_CANCEL, job);
 
-	RETURN_MODULE_REJECT;
+	case 0:
+		return mod_authenticate_resume(p_result, &(module_ctx_t){ .rctx = job }, request);
+
+	default:
+		RETURN_MODULE_FAIL;
+	}
 }
 
 static const call_env_method_t winbind_autz_method_env = {
@@ -535,12 +585,20 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	t->pipe[0] = t->pipe[1] = -1;
+	if (inst->pool && (winbind_pool_thread_instantiate(t, mctx->el) < 0)) return -1;
+
 	return 0;
 }
 
 static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_winbind_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_winbind_thread_t);
+
+	/*
+	 *	Jobs hold winbind handles from the slab
+	 */
+	winbind_pool_thread_detach(t);
 	talloc_free(t->slab);
 	return 0;
 }
@@ -562,6 +620,7 @@ module_rlm_t rlm_winbind = {
 		.inst_size	= sizeof(rlm_winbind_t),
 		.config		= module_config,
 		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
 		.bootstrap	= mod_bootstrap,
 		.thread_inst_size	= sizeof(rlm_winbind_thread_t),
 		.thread_instantiate	= mod_thread_instantiate,
@@ -5,6 +5,9 @@
 #include <wbclient.h>
 #include <freeradius-devel/util/slab.h>
 
+typedef struct winbind_pool_s winbind_pool_t;
+typedef struct winbind_auth_job_s winbind_auth_job_t;
+
 /*
  *      Structure for the module configuration.
  */
@@ -14,6 +17,9 @@ typedef struct {
 	/* group config */
 	bool			group_add_domain;
 	fr_slab_config_t	reuse;
+
+	uint32_t		threads;	//!< Number of threads to call winbind from.
+	winbind_pool_t		*pool;		//!< Threads calling winbind, NULL if threads = 0.
 } rlm_winbind_t;
 
 typedef struct {
@@ -26,6 +32,10 @@ FR_SLAB_FUNCS(winbind, winbind_ctx_t)
 typedef struct {
 	rlm_winbind_t const	*inst;		//!< Instance of rlm_winbind
 	winbind_slab_list_t	*slab;		//!< Slab list for winbind handles.
+
+	fr_event_list_t		*el;		//!< Event list the pipe is registered with.
+	int			pipe[2];	//!< Completed jobs are returned through this.
+	uint32_t		outstanding;	//!< Jobs submitted to the pool, which haven't been returned.
 } rlm_winbind_thread_t;
 
 typedef struct {
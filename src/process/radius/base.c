@@ -134,6 +134,7 @@ typedef struct {
 typedef struct {
 	fr_time_delta_t	session_timeout;	//!< Maximum time between the last response and next request.
 	uint32_t	max_session;		//!< Maximum ongoing session allowed.
+	size_t		max_memory;		//!< Soft limit on the memory used by sessions.
 
 	uint8_t       	state_server_id;	//!< Sets a specific byte in the state to allow the
 						//!< authenticating server to be identified in packet
@@ -169,6 +170,7 @@ typedef struct {
 static const conf_parser_t session_config[] = {
 	{ FR_CONF_OFFSET("timeout", process_radius_auth_t, session_timeout), .dflt = "15" },
 	{ FR_CONF_OFFSET("max", process_radius_auth_t, max_session), .dflt = "4096" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_memory", FR_TYPE_SIZE, 0, process_radius_auth_t, max_memory), .dflt = "0" },
 	{ FR_CONF_OFFSET("state_server_id", process_radius_auth_t, state_server_id) },
 
 	CONF_PARSER_TERMINATOR
@@ -885,6 +887,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->auth.state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->auth.max_session,
 						   inst->auth.session_timeout, inst->auth.state_server_id,
 						   fr_hash_string(cf_section_name2(inst->server_cs)));
+	if (!inst->auth.state_tree ||
+	    (fr_state_tree_account_set(inst->auth.state_tree, cf_section_name2(inst->server_cs),
+				       inst->auth.max_memory) < 0)) return -1;
 
 	return 0;
 }
@@ -160,6 +160,7 @@ typedef struct {
 typedef struct {
 	fr_time_delta_t	session_timeout;	//!< Maximum time between the last response and next request.
 	uint32_t	max_session;		//!< Maximum ongoing session allowed.
+	size_t		max_memory;		//!< Soft limit on the memory used by sessions.
 
 	uint32_t	max_rounds;		//!< maximum number of authentication rounds allowed
 
@@ -199,6 +200,7 @@ typedef struct {
 static const conf_parser_t session_config[] = {
 	{ FR_CONF_OFFSET("timeout", process_tacacs_auth_t, session_timeout), .dflt = "15" },
 	{ FR_CONF_OFFSET("max", process_tacacs_auth_t, max_session), .dflt = "4096" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("max_memory", FR_TYPE_SIZE, 0, process_tacacs_auth_t, max_memory), .dflt = "0" },
 	{ FR_CONF_OFFSET("max_rounds", process_tacacs_auth_t, max_rounds), .dflt = "4" },
 	{ FR_CONF_OFFSET("state_server_id", process_tacacs_auth_t, state_server_id) },
 
@@ -1065,6 +1067,10 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->auth.state_tree = fr_state_tree_init(inst, attr_tacacs_state, main_config->spawn_workers, inst->auth.max_session,
 						   inst->auth.session_timeout, inst->auth.state_server_id,
 						   fr_hash_string(cf_section_name2(inst->server_cs)));
+	if (!inst->auth.state_tree ||
+	    (fr_state_tree_account_set(inst->auth.state_tree, cf_section_name2(inst->server_cs),
+				       inst->auth.max_memory) < 0)) return -1;
+
 	return 0;
 }
 
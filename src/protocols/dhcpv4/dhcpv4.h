@@ -30,6 +30,7 @@ RCSIDH(dhcp_h, "$Id$")
 extern "C" {
 #endif
 
+#include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/pcap.h>
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/protocol/dhcpv4/rfc2131.h>
@@ -213,6 +214,18 @@ int		fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *p_ll,
 
 fr_packet_t	*fr_dhcpv4_raw_packet_recv(int sockfd, struct sockaddr_ll *p_ll,
 						  fr_packet_t *request, fr_pair_list_t *list);
+
+#  ifdef PACKET_TX_RING
+typedef struct fr_dhcpv4_raw_ring_s fr_dhcpv4_raw_ring_t;
+
+fr_dhcpv4_raw_ring_t *fr_dhcpv4_raw_ring_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+					       char const *interface, uint32_t frames);
+
+int		fr_dhcpv4_raw_ring_queue(fr_dhcpv4_raw_ring_t *ring, uint8_t const dst_mac[static ETH_ADDR_LEN],
+					 fr_socket_t const *inet, uint8_t const *data, size_t data_len);
+
+void		fr_dhcpv4_raw_ring_flush(fr_dhcpv4_raw_ring_t *ring);
+#  endif
 #endif
 
 /*
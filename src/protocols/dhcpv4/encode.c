@@ -541,8 +541,8 @@ static ssize_t encode_vsio_data(fr_dbuff_t *dbuff,
 	 *
 	 *	And leave room for data-len1
 	 */
-	FR_DBUFF_IN_RETURN(&work_dbuff, dv->attr);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t) 0x00);
+	fr_dbuff_in_unchecked(&work_dbuff, (uint32_t) dv->attr);
+	fr_dbuff_in_bytes_unchecked(&work_dbuff, (uint8_t) 0x00);
 
 	/*
 	 *	https://tools.ietf.org/html/rfc3925#section-4
@@ -32,7 +32,11 @@
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/udpfromto.h>
 
+#include <freeradius-devel/util/inet.h>
+
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
 
 #ifdef HAVE_SYS_SOCKET_H
 #endif
@@ -88,43 +92,37 @@ int fr_dhcpv4_raw_socket_open(struct sockaddr_ll *link_layer, int ifindex)
 	return fd;
 }
 
-/** Create the requisite L2/L3 headers, and write a DHCPv4 packet to a raw socket
+/** Create the requisite L2/L3 headers for a DHCPv4 packet
  *
- * @param[in] sockfd		to write to.
- * @param[in] link_layer	information, as returned by fr_dhcpv4_raw_socket_open.
- * @param[in] packet		to write.
- * @param[in] list		to send.
- * @return
- *	- 0 on success.
- *	- -1 on failure.
+ * @param[out] frame		to write the headers and packet to.  Must be at least
+ *				ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + data_len bytes.
+ * @param[in] dst_mac		Destination ethernet address.
+ * @param[in] src_mac		Source ethernet address.
+ * @param[in] inet		Source and destination IP addresses and ports.
+ * @param[in] data		Encoded DHCPv4 packet.
+ * @param[in] data_len		Length of the encoded packet.
+ * @return the length of the frame.
  */
-int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
-			      fr_packet_t *packet, fr_pair_list_t *list)
+static size_t raw_frame_build(uint8_t *frame, uint8_t const dst_mac[static ETH_ADDR_LEN],
+			      uint8_t const src_mac[static ETH_ADDR_LEN], fr_socket_t const *inet,
+			      uint8_t const *data, size_t data_len)
 {
-	uint8_t			dhcp_packet[1518] = { 0 };
-	ethernet_header_t	*eth_hdr = (ethernet_header_t *)dhcp_packet;
-	ip_header_t		*ip_hdr = (ip_header_t *)(dhcp_packet + ETH_HDR_SIZE);
-	udp_header_t		*udp_hdr = (udp_header_t *) (dhcp_packet + ETH_HDR_SIZE + IP_HDR_SIZE);
-	dhcp_packet_t		*dhcp = (dhcp_packet_t *)(dhcp_packet + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE);
+	ethernet_header_t	*eth_hdr = (ethernet_header_t *)frame;
+	ip_header_t		*ip_hdr = (ip_header_t *)(frame + ETH_HDR_SIZE);
+	udp_header_t		*udp_hdr = (udp_header_t *) (frame + ETH_HDR_SIZE + IP_HDR_SIZE);
+	dhcp_packet_t		*dhcp = (dhcp_packet_t *)(frame + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE);
 
-	uint16_t		l4_len = (UDP_HDR_SIZE + packet->data_len);
-	fr_pair_t		*vp;
-
-	/* set ethernet source address to our MAC address (Client-Hardware-Address). */
-	uint8_t dhmac[ETH_ADDR_LEN] = { 0 };
-	if ((vp = fr_pair_find_by_da(list, NULL, attr_dhcp_client_hardware_address))) {
-		if (vp->vp_type == FR_TYPE_ETHERNET) memcpy(dhmac, vp->vp_ether, sizeof(vp->vp_ether));
-	}
+	uint16_t		l4_len = (UDP_HDR_SIZE + data_len);
 
 	/* fill in Ethernet layer (L2) */
-	memcpy(eth_hdr->dst_addr, eth_bcast, ETH_ADDR_LEN);
-	memcpy(eth_hdr->src_addr, dhmac, ETH_ADDR_LEN);
+	memcpy(eth_hdr->dst_addr, dst_mac, ETH_ADDR_LEN);
+	memcpy(eth_hdr->src_addr, src_mac, ETH_ADDR_LEN);
 	eth_hdr->ether_type = htons(ETH_TYPE_IP);
 
 	/* fill in IP layer (L3) */
 	ip_hdr->ip_vhl = IP_VHL(4, 5);
 	ip_hdr->ip_tos = 0;
-	ip_hdr->ip_len = htons(IP_HDR_SIZE +  UDP_HDR_SIZE + packet->data_len);
+	ip_hdr->ip_len = htons(IP_HDR_SIZE +  UDP_HDR_SIZE + data_len);
 	ip_hdr->ip_id = 0;
 	ip_hdr->ip_off = 0;
 	ip_hdr->ip_ttl = 64;
@@ -132,16 +130,16 @@ int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
 	ip_hdr->ip_sum = 0; /* Filled later */
 
 	/* saddr: packet src IP addr (default: 0.0.0.0). */
-	ip_hdr->ip_src.s_addr = packet->socket.inet.src_ipaddr.addr.v4.s_addr;
+	ip_hdr->ip_src.s_addr = inet->inet.src_ipaddr.addr.v4.s_addr;
 
 	/* daddr: packet destination IP addr (should be 255.255.255.255 for broadcast). */
-	ip_hdr->ip_dst.s_addr = packet->socket.inet.dst_ipaddr.addr.v4.s_addr;
+	ip_hdr->ip_dst.s_addr = inet->inet.dst_ipaddr.addr.v4.s_addr;
 
 	/* IP header checksum */
 	ip_hdr->ip_sum = fr_ip_header_checksum((uint8_t const *)ip_hdr, 5);
 
-	udp_hdr->src = htons(packet->socket.inet.src_port);
-	udp_hdr->dst = htons(packet->socket.inet.dst_port);
+	udp_hdr->src = htons(inet->inet.src_port);
+	udp_hdr->dst = htons(inet->inet.dst_port);
 
 	udp_hdr->len = htons(l4_len);
 	udp_hdr->checksum = 0; /* UDP checksum will be done after dhcp header */
@@ -149,15 +147,42 @@ int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
 	/* DHCP layer (L7) */
 
 	/* just copy what FreeRADIUS has encoded for us. */
-	memcpy(dhcp, packet->data, packet->data_len);
+	memcpy(dhcp, data, data_len);
 
 	/* UDP checksum is done here */
-	udp_hdr->checksum = fr_udp_checksum((uint8_t const *)(dhcp_packet + ETH_HDR_SIZE + IP_HDR_SIZE),
+	udp_hdr->checksum = fr_udp_checksum((uint8_t const *)(frame + ETH_HDR_SIZE + IP_HDR_SIZE),
 					    l4_len, udp_hdr->checksum,
-					    packet->socket.inet.src_ipaddr.addr.v4, packet->socket.inet.dst_ipaddr.addr.v4);
+					    inet->inet.src_ipaddr.addr.v4, inet->inet.dst_ipaddr.addr.v4);
 
-	return sendto(sockfd, dhcp_packet, (ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + packet->data_len),
-		      0, (struct sockaddr *) link_layer, sizeof(struct sockaddr_ll));
+	return ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + data_len;
+}
+
+/** Create the requisite L2/L3 headers, and write a DHCPv4 packet to a raw socket
+ *
+ * @param[in] sockfd		to write to.
+ * @param[in] link_layer	information, as returned by fr_dhcpv4_raw_socket_open.
+ * @param[in] packet		to write.
+ * @param[in] list		to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dhcpv4_raw_packet_send(int sockfd, struct sockaddr_ll *link_layer,
+			      fr_packet_t *packet, fr_pair_list_t *list)
+{
+	uint8_t			dhcp_packet[1518] = { 0 };
+	size_t			len;
+	fr_pair_t		*vp;
+
+	/* set ethernet source address to our MAC address (Client-Hardware-Address). */
+	uint8_t dhmac[ETH_ADDR_LEN] = { 0 };
+	if ((vp = fr_pair_find_by_da(list, NULL, attr_dhcp_client_hardware_address))) {
+		if (vp->vp_type == FR_TYPE_ETHERNET) memcpy(dhmac, vp->vp_ether, sizeof(vp->vp_ether));
+	}
+
+	len = raw_frame_build(dhcp_packet, eth_bcast, dhmac, &packet->socket, packet->data, packet->data_len);
+
+	return sendto(sockfd, dhcp_packet, len, 0, (struct sockaddr *) link_layer, sizeof(struct sockaddr_ll));
 }
 
 /*
@@ -327,4 +352,203 @@ fr_packet_t *fr_dhcpv4_raw_packet_recv(int sockfd, struct sockaddr_ll *link_laye
 
 	return packet;
 }
+
+#ifdef PACKET_TX_RING
+/** A PACKET_MMAP transmit ring
+ *
+ * Frames are built in memory shared with the kernel, and all of the frames
+ * queued while processing one set of events are sent with a single syscall.
+ */
+struct fr_dhcpv4_raw_ring_s {
+	int			fd;			//!< PF_PACKET socket the ring is attached to.
+	fr_event_list_t		*el;			//!< Event list the flush callback is registered with.
+	uint8_t			src_mac[ETH_ADDR_LEN];	//!< Of the interface.
+
+	uint8_t			*map;			//!< Ring memory.
+	size_t			map_len;		//!< Length of the ring memory.
+	uint32_t		frame_size;		//!< Size of each frame.
+	uint32_t		frames;			//!< Number of frames in the ring.
+
+	uint32_t		head;			//!< Next frame to fill.
+	uint32_t		queued;			//!< Frames filled since the last flush.
+};
+
+#define RAW_RING_FRAME_SIZE	2048		//!< Holds a TPACKET2 header and the largest frame we send.
+#define RAW_RING_BLOCK_SIZE	(RAW_RING_FRAME_SIZE * 16)
+
+static void raw_ring_flush_cb(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_dhcpv4_raw_ring_flush(uctx);
+}
+
+static int _raw_ring_free(fr_dhcpv4_raw_ring_t *ring)
+{
+	if (ring->el) (void) fr_event_post_delete(ring->el, raw_ring_flush_cb, ring);
+
+	/*
+	 *	Closing the socket discards anything which
+	 *	is still queued.
+	 */
+	fr_dhcpv4_raw_ring_flush(ring);
+
+	if (ring->map) munmap(ring->map, ring->map_len);
+	if (ring->fd >= 0) close(ring->fd);
+
+	return 0;
+}
+
+/** Open a raw socket with a transmit ring
+ *
+ * The ring is flushed after each pass through the event loop.
+ *
+ * @param[in] ctx		to allocate the ring in.
+ * @param[in] el		to register the flush callback with.
+ * @param[in] interface		to send on.
+ * @param[in] frames		Number of frames in the ring.  Rounded up to a whole
+ *				number of blocks.
+ * @return
+ *	- The ring on success.
+ *	- NULL on failure.
+ */
+fr_dhcpv4_raw_ring_t *fr_dhcpv4_raw_ring_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+					       char const *interface, uint32_t frames)
+{
+	fr_dhcpv4_raw_ring_t	*ring;
+	struct sockaddr_ll	link_layer;
+	struct tpacket_req	req;
+	fr_ethernet_t		ether;
+	int			ifindex, version = TPACKET_V2;
+
+	ifindex = if_nametoindex(interface);
+	if (ifindex == 0) {
+		fr_strerror_printf("Unknown interface \"%s\"", interface);
+		return NULL;
+	}
+
+	if (fr_interface_to_ethernet(interface, &ether) < 0) {
+		fr_strerror_printf("Interface \"%s\" has no ethernet address", interface);
+		return NULL;
+	}
+
+	MEM(ring = talloc_zero(ctx, fr_dhcpv4_raw_ring_t));
+	ring->fd = -1;
+	talloc_set_destructor(ring, _raw_ring_free);
+	memcpy(ring->src_mac, ether.addr, sizeof(ring->src_mac));
+
+	/*
+	 *	We only send, so no protocol, and the socket
+	 *	doesn't receive anything.
+	 */
+	ring->fd = socket(PF_PACKET, SOCK_RAW, 0);
+	if (ring->fd < 0) {
+		fr_strerror_printf("Cannot open socket: %s", fr_syserror(errno));
+	error:
+		talloc_free(ring);
+		return NULL;
+	}
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fr_strerror_printf("Failed setting TPACKET_V2: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	ring->frame_size = RAW_RING_FRAME_SIZE;
+	req = (struct tpacket_req) {
+		.tp_block_size = RAW_RING_BLOCK_SIZE,
+		.tp_frame_size = RAW_RING_FRAME_SIZE,
+		.tp_block_nr = (frames + (RAW_RING_BLOCK_SIZE / RAW_RING_FRAME_SIZE) - 1) /
+			       (RAW_RING_BLOCK_SIZE / RAW_RING_FRAME_SIZE),
+	};
+	req.tp_frame_nr = req.tp_block_nr * (RAW_RING_BLOCK_SIZE / RAW_RING_FRAME_SIZE);
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		fr_strerror_printf("Failed creating transmit ring: %s", fr_syserror(errno));
+		goto error;
+	}
+	ring->frames = req.tp_frame_nr;
+	ring->map_len = (size_t)req.tp_block_size * req.tp_block_nr;
+
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		fr_strerror_printf("Failed mapping transmit ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	memset(&link_layer, 0, sizeof(link_layer));
+	link_layer.sll_family = AF_PACKET;
+	link_layer.sll_protocol = htons(ETH_P_IP);
+	link_layer.sll_ifindex = ifindex;
+
+	if (bind(ring->fd, (struct sockaddr *)&link_layer, sizeof(link_layer)) < 0) {
+		fr_strerror_printf("Cannot bind raw socket: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (fr_event_post_insert(el, raw_ring_flush_cb, ring) < 0) goto error;
+	ring->el = el;
+
+	return ring;
+}
+
+/** Queue a DHCPv4 packet for sending to a client which doesn't have an address yet
+ *
+ * The packet is sent the next time the ring is flushed.
+ *
+ * @param[in] ring		to queue the packet in.
+ * @param[in] dst_mac		Client's hardware address.
+ * @param[in] inet		Source and destination IP addresses and ports.
+ * @param[in] data		Encoded DHCPv4 packet.
+ * @param[in] data_len		Length of the encoded packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the ring is full, or the packet is too large.  The caller
+ *	  should send the packet some other way.
+ */
+int fr_dhcpv4_raw_ring_queue(fr_dhcpv4_raw_ring_t *ring, uint8_t const dst_mac[static ETH_ADDR_LEN],
+			     fr_socket_t const *inet, uint8_t const *data, size_t data_len)
+{
+	struct tpacket2_hdr	*hdr;
+	uint8_t			*frame;
+	size_t			offset = TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+
+	if ((offset + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE + data_len) > ring->frame_size) {
+		fr_strerror_const("Packet too large for transmit ring");
+		return -1;
+	}
+
+	hdr = (struct tpacket2_hdr *)(ring->map + ((size_t)ring->head * ring->frame_size));
+
+	/*
+	 *	The kernel hasn't finished with this frame, so the
+	 *	ring is full.  Push out what we have, and let the
+	 *	caller fall back to a normal send.
+	 */
+	if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+		fr_dhcpv4_raw_ring_flush(ring);
+		fr_strerror_const("Transmit ring is full");
+		return -1;
+	}
+
+	frame = ((uint8_t *)hdr) + offset;
+	hdr->tp_len = raw_frame_build(frame, dst_mac, ring->src_mac, inet, data, data_len);
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+	ring->head = (ring->head + 1) % ring->frames;
+	ring->queued++;
+
+	return 0;
+}
+
+/** Tell the kernel to send all queued frames
+ *
+ */
+void fr_dhcpv4_raw_ring_flush(fr_dhcpv4_raw_ring_t *ring)
+{
+	if (!ring->queued || (ring->fd < 0)) return;
+
+	ring->queued = 0;
+	(void) send(ring->fd, NULL, 0, MSG_DONTWAIT);
+}
+#endif
 #endif
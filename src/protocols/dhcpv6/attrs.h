@@ -36,6 +36,7 @@ extern HIDDEN fr_dict_attr_t const *attr_hop_count;
 extern HIDDEN fr_dict_attr_t const *attr_relay_link_address;
 extern HIDDEN fr_dict_attr_t const *attr_relay_peer_address;
 extern HIDDEN fr_dict_attr_t const *attr_relay_message;
+extern HIDDEN fr_dict_attr_t const *attr_interface_id;
 
 /*
  *	A private function that is used only in base.c and encode.c
@@ -51,6 +51,7 @@ fr_dict_attr_t const *attr_hop_count;
 fr_dict_attr_t const *attr_relay_link_address;
 fr_dict_attr_t const *attr_relay_peer_address;
 fr_dict_attr_t const *attr_relay_message;
+fr_dict_attr_t const *attr_interface_id;
 fr_dict_attr_t const *attr_option_request;
 
 extern fr_dict_attr_autoload_t libfreeradius_dhcpv6_dict_attr[];
@@ -61,6 +62,7 @@ fr_dict_attr_autoload_t libfreeradius_dhcpv6_dict_attr[] = {
 	{ .out = &attr_relay_link_address, .name = "Relay-Link-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_dhcpv6 },
 	{ .out = &attr_relay_peer_address, .name = "Relay-Peer-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_dhcpv6 },
 	{ .out = &attr_relay_message, .name = "Relay-Message", .type = FR_TYPE_GROUP, .dict = &dict_dhcpv6 },
+	{ .out = &attr_interface_id, .name = "Interface-ID", .type = FR_TYPE_OCTETS, .dict = &dict_dhcpv6 },
 	{ .out = &attr_option_request, .name = "Option-Request", .type = FR_TYPE_UINT16, .dict = &dict_dhcpv6 },
 	{ NULL }
 };
@@ -266,6 +268,242 @@ uint8_t const *fr_dhcpv6_option_find(uint8_t const *start, uint8_t const *end, u
 	return NULL;
 }
 
+/** Index the relay layers of a Relay-Forward packet
+ *
+ * Records where each layer's header, and Interface-ID option are, and
+ * where the message from the client is, so that a reply can copy the
+ * relay headers instead of encoding them again.
+ *
+ * @param[out] idx		to fill in.
+ * @param[in] packet		a Relay-Forward packet which has passed fr_dhcpv6_ok().
+ * @param[in] packet_len	length of the packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the packet isn't a well formed Relay-Forward.
+ */
+int fr_dhcpv6_relay_index(fr_dhcpv6_relay_index_t *idx, uint8_t const *packet, size_t packet_len)
+{
+	uint8_t const *p = packet, *end = packet + packet_len;
+
+	idx->depth = 0;
+
+	while (((size_t)(end - p) >= DHCPV6_HDR_LEN) && (p[0] == FR_DHCPV6_RELAY_FORWARD)) {
+		uint8_t const		*option, *relay_message = NULL;
+		fr_dhcpv6_relay_layer_t	*layer;
+
+		if (idx->depth >= NUM_ELEMENTS(idx->layer)) {
+			fr_strerror_const("Too many layers forwarded packets");
+			return -1;
+		}
+
+		if ((size_t)(end - p) < DHCPV6_RELAY_HDR_LEN) {
+			fr_strerror_const("Packet is too small for relay header");
+			return -1;
+		}
+
+		layer = &idx->layer[idx->depth++];
+		layer->hdr = p;
+		layer->interface_id = NULL;
+
+		option = p + DHCPV6_RELAY_HDR_LEN;
+		while (option < end) {
+			uint16_t len;
+
+			if ((size_t)(end - option) < DHCPV6_OPT_HDR_LEN) {
+				fr_strerror_const("Not enough room for option header");
+				return -1;
+			}
+
+			len = DHCPV6_GET_OPTION_LEN(option);
+			if ((size_t)(end - option) < (DHCPV6_OPT_HDR_LEN + len)) {
+				fr_strerror_const("Option length overflows the packet");
+				return -1;
+			}
+
+			if (DHCPV6_GET_OPTION_NUM(option) == FR_RELAY_MESSAGE) {
+				relay_message = option;
+			} else if (DHCPV6_GET_OPTION_NUM(option) == attr_interface_id->attr) {
+				layer->interface_id = option;
+			}
+
+			option += DHCPV6_OPT_HDR_LEN + len;
+		}
+
+		if (!relay_message) {
+			fr_strerror_const("Packet does not contain a Relay-Message option");
+			return -1;
+		}
+
+		p = relay_message + DHCPV6_OPT_HDR_LEN;
+		end = p + DHCPV6_GET_OPTION_LEN(relay_message);
+	}
+
+	if (!idx->depth) {
+		fr_strerror_const("Packet is not a Relay-Forward");
+		return -1;
+	}
+
+	idx->inner = p;
+	idx->inner_len = end - p;
+
+	return 0;
+}
+
+/** Find the reply to the client in a Relay-Reply
+ *
+ * Only succeeds if each relay layer of the reply echoes the corresponding
+ * layer of the Relay-Forward, and has no other options.  The relay layers
+ * can then be copied from the Relay-Forward with fr_dhcpv6_relay_reply_wrap().
+ *
+ * @param[in] idx	of the Relay-Forward.
+ * @param[in] reply	pairs of the Relay-Reply.
+ * @return
+ *	- The pairs of the reply to the client.
+ *	- NULL if the relay layers must be encoded from the pairs.
+ */
+fr_pair_list_t *fr_dhcpv6_relay_reply_inner(fr_dhcpv6_relay_index_t const *idx, fr_pair_list_t *reply)
+{
+	fr_pair_list_t	*list = reply;
+	fr_pair_t	*vp;
+	unsigned int	i;
+
+	for (i = 0; i < idx->depth; i++) {
+		uint8_t const	*hdr = idx->layer[i].hdr;
+		uint8_t const	*interface_id = idx->layer[i].interface_id;
+		fr_pair_t	*relay_message = NULL;
+		bool		echoed = false;
+
+		for (vp = fr_pair_list_head(list); vp; vp = fr_pair_list_next(list, vp)) {
+			if (vp->da == attr_packet_type) {
+				if (vp->vp_uint32 != FR_DHCPV6_RELAY_REPLY) return NULL;
+
+			} else if (vp->da == attr_hop_count) {
+				if (vp->vp_uint8 != hdr[1]) return NULL;
+
+			} else if (vp->da == attr_relay_link_address) {
+				if (memcmp(vp->vp_ipv6addr, hdr + 2, DHCPV6_LINK_ADDRESS_LEN) != 0) return NULL;
+
+			} else if (vp->da == attr_relay_peer_address) {
+				if (memcmp(vp->vp_ipv6addr, hdr + 2 + DHCPV6_LINK_ADDRESS_LEN,
+					   DHCPV6_PEER_ADDRESS_LEN) != 0) return NULL;
+
+			} else if (vp->da == attr_interface_id) {
+				if (!interface_id || echoed ||
+				    (vp->vp_length != DHCPV6_GET_OPTION_LEN(interface_id)) ||
+				    (memcmp(vp->vp_octets, interface_id + DHCPV6_OPT_HDR_LEN, vp->vp_length) != 0)) return NULL;
+				echoed = true;
+
+			} else if (vp->da == attr_relay_message) {
+				if (relay_message) return NULL;
+				relay_message = vp;
+
+			/*
+			 *	Anything else we'd have to encode.
+			 */
+			} else if ((vp->da->dict == dict_dhcpv6) && !vp->da->flags.internal) {
+				return NULL;
+			}
+		}
+
+		if (!relay_message || (echoed != (interface_id != NULL))) return NULL;
+
+		list = &relay_message->vp_group;
+	}
+
+	/*
+	 *	The reply to the client must be at the same depth as
+	 *	the message from the client.
+	 */
+	vp = fr_pair_find_by_da(list, NULL, attr_packet_type);
+	if (!vp || (vp->vp_uint32 == FR_DHCPV6_RELAY_FORWARD) || (vp->vp_uint32 == FR_DHCPV6_RELAY_REPLY)) return NULL;
+
+	return list;
+}
+
+/** How much room the relay layers of a Relay-Reply need
+ *
+ * @param[in] idx	of the Relay-Forward being replied to.
+ * @return the length of the relay layers, without the reply to the client.
+ */
+size_t fr_dhcpv6_relay_envelope_len(fr_dhcpv6_relay_index_t const *idx)
+{
+	size_t		len = 0;
+	unsigned int	i;
+
+	for (i = 0; i < idx->depth; i++) {
+		len += DHCPV6_RELAY_HDR_LEN + DHCPV6_OPT_HDR_LEN;
+		if (idx->layer[i].interface_id) {
+			len += DHCPV6_OPT_HDR_LEN + DHCPV6_GET_OPTION_LEN(idx->layer[i].interface_id);
+		}
+	}
+
+	return len;
+}
+
+/** Wrap a reply to the client in the relay layers of the Relay-Forward
+ *
+ * Each layer's header is copied from the Relay-Forward, with the message
+ * type changed to Relay-Reply.  The Interface-ID option is echoed if the
+ * layer had one.
+ *
+ * @param[in] buffer		The reply to the client must already be encoded at
+ *				buffer + fr_dhcpv6_relay_envelope_len().
+ * @param[in] buffer_len	length of the buffer.
+ * @param[in] idx		of the Relay-Forward being replied to.
+ * @param[in] inner_len		length of the encoded reply to the client.
+ * @return
+ *	- >0 the length of the Relay-Reply.
+ *	- <0 on error.
+ */
+ssize_t fr_dhcpv6_relay_reply_wrap(uint8_t *buffer, size_t buffer_len,
+				   fr_dhcpv6_relay_index_t const *idx, size_t inner_len)
+{
+	size_t		envelope_len = fr_dhcpv6_relay_envelope_len(idx);
+	size_t		len = inner_len;
+	uint8_t		*p = buffer + envelope_len;
+	unsigned int	i = idx->depth;
+
+	if ((envelope_len + inner_len) > buffer_len) {
+		fr_strerror_const("Relay-Reply overflows the output buffer");
+		return -1;
+	}
+
+	/*
+	 *	Work outwards from the reply to the client, as each
+	 *	layer needs the length of the layers inside it.
+	 */
+	while (i-- > 0) {
+		uint8_t const *interface_id = idx->layer[i].interface_id;
+
+		if (len > UINT16_MAX) {
+			fr_strerror_const("Relay-Message overflows the option length");
+			return -1;
+		}
+
+		p -= DHCPV6_OPT_HDR_LEN;
+		fr_nbo_from_uint16(p, FR_RELAY_MESSAGE);
+		fr_nbo_from_uint16(p + 2, len);
+		len += DHCPV6_OPT_HDR_LEN;
+
+		if (interface_id) {
+			size_t iid_len = DHCPV6_OPT_HDR_LEN + DHCPV6_GET_OPTION_LEN(interface_id);
+
+			p -= iid_len;
+			memcpy(p, interface_id, iid_len);
+			len += iid_len;
+		}
+
+		p -= DHCPV6_RELAY_HDR_LEN;
+		memcpy(p, idx->layer[i].hdr, DHCPV6_RELAY_HDR_LEN);
+		p[0] = FR_DHCPV6_RELAY_REPLY;
+		len += DHCPV6_RELAY_HDR_LEN;
+	}
+
+	fr_assert(p == buffer);
+
+	return len;
+}
+
 static bool duid_match(uint8_t const *option, fr_dhcpv6_decode_ctx_t const *packet_ctx)
 {
 	uint16_t len;
@@ -136,6 +136,25 @@ typedef struct {
 	size_t			duid_len;		//!< length of the expected DUID
 } fr_dhcpv6_decode_ctx_t;
 
+/** One relay layer of a Relay-Forward
+ *
+ */
+typedef struct {
+	uint8_t const		*hdr;			//!< Start of the layer's header.
+	uint8_t const		*interface_id;		//!< Interface-ID option, including its header, or NULL.
+} fr_dhcpv6_relay_layer_t;
+
+/** Where the relay layers of a Relay-Forward are
+ *
+ * Pointers are into the packet, which must outlive the index.
+ */
+typedef struct {
+	fr_dhcpv6_relay_layer_t	layer[DHCPV6_MAX_RELAY_NESTING + 1];	//!< Outermost first.
+	unsigned int		depth;			//!< How many relay layers there are.
+	uint8_t const		*inner;			//!< The message from the client.
+	size_t			inner_len;		//!< Length of the message from the client.
+} fr_dhcpv6_relay_index_t;
+
 typedef struct {
 	bool			dns_label;
 	bool			partial_dns_label;
@@ -161,6 +180,15 @@ static inline bool fr_dhcpv6_flag_any_dns_label(fr_dict_attr_t const *da)
  */
 uint8_t const	*fr_dhcpv6_option_find(uint8_t const *start, uint8_t const *end, unsigned int option);
 
+int		fr_dhcpv6_relay_index(fr_dhcpv6_relay_index_t *idx, uint8_t const *packet, size_t packet_len);
+
+fr_pair_list_t	*fr_dhcpv6_relay_reply_inner(fr_dhcpv6_relay_index_t const *idx, fr_pair_list_t *reply);
+
+size_t		fr_dhcpv6_relay_envelope_len(fr_dhcpv6_relay_index_t const *idx);
+
+ssize_t		fr_dhcpv6_relay_reply_wrap(uint8_t *buffer, size_t buffer_len,
+					   fr_dhcpv6_relay_index_t const *idx, size_t inner_len);
+
 bool		fr_dhcpv6_ok(uint8_t const *packet, size_t packet_len,
 			     uint32_t max_attributes);
 
@@ -70,8 +70,9 @@ static ssize_t encode_child(fr_dbuff_t *dbuff,
  */
 static inline ssize_t encode_option_hdr(fr_dbuff_marker_t *m, uint16_t option, size_t data_len)
 {
-	FR_DBUFF_IN_RETURN(m, option);
-	FR_DBUFF_IN_RETURN(m, (uint16_t) data_len);
+	FR_DBUFF_RESERVE_RETURN(m, DHCPV6_OPT_HDR_LEN);
+	fr_dbuff_in_unchecked(m, option);
+	fr_dbuff_in_unchecked(m, (uint16_t) data_len);
 
 	return sizeof(option) + sizeof(uint16_t);
 }
@@ -576,9 +577,9 @@ static ssize_t encode_vsio(fr_dbuff_t *dbuff,
 		return PAIR_ENCODE_FATAL_ERROR;
 	}
 
-	FR_DBUFF_EXTEND_LOWAT_OR_RETURN(&work_dbuff, DHCPV6_OPT_HDR_LEN);
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, DHCPV6_OPT_HDR_LEN + sizeof(uint32_t));
 	fr_dbuff_advance(&work_dbuff, DHCPV6_OPT_HDR_LEN);
-	FR_DBUFF_IN_RETURN(&work_dbuff, dv->attr);
+	fr_dbuff_in_unchecked(&work_dbuff, (uint32_t) dv->attr);
 
 	/*
 	 *	https://tools.ietf.org/html/rfc8415#section-21.17 says:
@@ -644,9 +645,10 @@ static ssize_t encode_relay_message(fr_dbuff_t *dbuff,
 	/*
 	 *	Write out the header
 	 */
-	FR_DBUFF_IN_RETURN(&work_dbuff, (uint16_t)da->attr);	/* Write out the option header */
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, DHCPV6_OPT_HDR_LEN);
+	fr_dbuff_in_unchecked(&work_dbuff, (uint16_t)da->attr);	/* Write out the option header */
 	fr_dbuff_marker(&len_m, &work_dbuff);			/* Mark where we'll need to put the length field */
-	FR_DBUFF_ADVANCE_RETURN(&work_dbuff, 2);		/* Advanced past the length field */
+	fr_dbuff_advance(&work_dbuff, 2);			/* Advanced past the length field */
 
 	vp = fr_dcursor_current(cursor);
 	slen = fr_dhcpv6_encode(&work_dbuff, NULL, 0, 0, &vp->vp_group);
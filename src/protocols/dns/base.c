@@ -40,6 +40,7 @@ fr_dict_t const *dict_dns;
 static _Thread_local fr_dns_labels_t	fr_dns_labels;
 static _Thread_local fr_dns_block_t	fr_dns_blocks[256];
 static _Thread_local uint8_t		fr_dns_marker[65536];
+static _Thread_local fr_dns_suffix_t	fr_dns_suffixes[FR_DNS_SUFFIX_MAX];
 
 extern fr_dict_autoload_t dns_dict[];
 fr_dict_autoload_t dns_dict[] = {
@@ -395,6 +396,16 @@ fr_dns_labels_t *fr_dns_labels_get(uint8_t const *packet, size_t packet_len, boo
 	lb->blocks[0].start = DNS_HDR_LEN;
 	lb->blocks[0].end = DNS_HDR_LEN;
 
+	/*
+	 *	Start a new generation of the suffix hash, instead of
+	 *	clearing it.  Only clear it when the generation wraps.
+	 */
+	lb->suffixes = fr_dns_suffixes;
+	if (++lb->generation == 0) {
+		memset(fr_dns_suffixes, 0, sizeof(fr_dns_suffixes));
+		lb->generation = 1;
+	}
+
 	if (init_mark) {
 		fr_assert(packet_len <= 65535);
 		memset(lb->mark, 0, packet_len);
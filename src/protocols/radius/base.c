@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include "radius.h"
 
 #include <freeradius-devel/io/pair.h>
+#include <freeradius-devel/util/decode.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/net.h>
 #include <freeradius-devel/util/proto.h>
@@ -342,25 +343,27 @@ invalid:
 	return packet_len;
 }
 
-/** Sign a previously encoded packet
+/** Check a packet can be signed, and find its Message-Authenticator
  *
- * Calculates the request/response authenticator for packets which need it, and fills
- * in the message-authenticator value if the attribute is present in the encoded packet.
+ * If the packet contains a Message-Authenticator, the value is zeroed, and the
+ * authenticator field is set to what it must contain when the HMAC is calculated.
  *
- * @param[in,out] packet	(request or response).
- * @param[in] vector		original packet vector to use
- * @param[in] secret		to sign the packet with.
+ * @param[out] ma		Where to write a pointer to the Message-Authenticator value.
+ *				NULL if the packet doesn't contain one.
+ * @param[in,out] packet	to check.
+ * @param[in] vector		original packet vector to use.
  * @param[in] secret_len	The length of the secret.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
-int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
-		   uint8_t const *secret, size_t secret_len)
+static int radius_sign_prepare(uint8_t **ma, uint8_t *packet, uint8_t const *vector, size_t secret_len)
 {
 	uint8_t		*msg, *end;
 	size_t		packet_len = fr_nbo_to_uint16(packet + 2);
 
+	*ma = NULL;
+
 	/*
 	 *	No real limit on secret length, this is just
 	 *	to catch uninitialised fields.
@@ -419,7 +422,10 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 		case FR_RADIUS_CODE_DISCONNECT_NAK:
 		case FR_RADIUS_CODE_COA_ACK:
 		case FR_RADIUS_CODE_COA_NAK:
-			if (!vector) goto need_original;
+			if (!vector) {
+				fr_strerror_const("Cannot sign response packet without a request packet");
+				return -1;
+			}
 			memcpy(packet + 4, vector, RADIUS_AUTH_VECTOR_LENGTH);
 			break;
 
@@ -429,28 +435,40 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 			break;
 
 		default:
-			goto bad_packet;
+			fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
+			return -1;
 		}
 
 		/*
 		 *	Force Message-Authenticator to be zero,
-		 *	calculate the HMAC, and put it into the
-		 *	Message-Authenticator attribute.
+		 *	the caller calculates the HMAC, and puts
+		 *	it into the Message-Authenticator attribute.
 		 */
 		memset(msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		*ma = msg + 2;
 		break;
 	}
 
-	/*
-	 *	Initialize the request authenticator.
-	 */
+	return 0;
+}
+
+/** Set the authenticator field to what it must contain when the authenticator is calculated
+ *
+ * @param[in,out] packet	to set the authenticator field of.
+ * @param[in] vector		original packet vector to use.
+ * @return
+ *	- <0 on error
+ *	- 0 if the packet's authenticator is random, and doesn't need calculating.
+ *	- 1 if the caller needs to calculate the authenticator.
+ */
+static int radius_sign_vector_set(uint8_t *packet, uint8_t const *vector)
+{
 	switch (packet[0]) {
 	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
 	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
 	case FR_RADIUS_CODE_COA_REQUEST:
 		memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		break;
+		return 1;
 
 	case FR_RADIUS_CODE_ACCESS_ACCEPT:
 	case FR_RADIUS_CODE_ACCESS_REJECT:
@@ -462,27 +480,55 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 	case FR_RADIUS_CODE_COA_NAK:
 	case FR_RADIUS_CODE_PROTOCOL_ERROR:
 		if (!vector) {
-		need_original:
 			fr_strerror_const("Cannot sign response packet without a request packet");
 			return -1;
 		}
 		memcpy(packet + 4, vector, RADIUS_AUTH_VECTOR_LENGTH);
-		break;
+		return 1;
 
 		/*
 		 *	The Request Authenticator is random numbers.
-		 *	We don't need to sign anything else, so
-		 *	return.
+		 *	We don't need to sign anything else.
 		 */
 	case FR_RADIUS_CODE_ACCESS_REQUEST:
 	case FR_RADIUS_CODE_STATUS_SERVER:
 		return 0;
 
 	default:
-	bad_packet:
 		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
 		return -1;
 	}
+}
+
+/** Sign a previously encoded packet
+ *
+ * Calculates the request/response authenticator for packets which need it, and fills
+ * in the message-authenticator value if the attribute is present in the encoded packet.
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] vector		original packet vector to use
+ * @param[in] secret		to sign the packet with.
+ * @param[in] secret_len	The length of the secret.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
+		   uint8_t const *secret, size_t secret_len)
+{
+	uint8_t		*ma;
+	size_t		packet_len = fr_nbo_to_uint16(packet + 2);
+	int		ret;
+
+	if (radius_sign_prepare(&ma, packet, vector, secret_len) < 0) return -1;
+
+	if (ma) fr_hmac_md5(ma, packet, packet_len, secret, secret_len);
+
+	/*
+	 *	Initialize the request authenticator.
+	 */
+	ret = radius_sign_vector_set(packet, vector);
+	if (ret <= 0) return ret;
 
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
@@ -500,6 +546,81 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 	return 0;
 }
 
+/** Sign a batch of previously encoded packets, all using the same secret
+ *
+ * Produces the same result as calling #fr_radius_sign on each packet, but computes
+ * the Message-Authenticator HMACs and the authenticators for multiple packets at once,
+ * see #fr_md5_calc_batch.
+ *
+ * @param[in,out] batch		of packets to sign.  The ret field of each entry is
+ *				set to the result of signing that packet.
+ * @param[in] num		Number of packets in the batch.
+ * @param[in] secret		to sign the packets with.
+ * @param[in] secret_len	The length of the secret.
+ * @return The number of packets which couldn't be signed.  fr_strerror() describes
+ *	the last failure.
+ */
+unsigned int fr_radius_sign_batch(fr_radius_sign_batch_t *batch, unsigned int num,
+				  uint8_t const *secret, size_t secret_len)
+{
+	unsigned int	i, j, done, todo, failed = 0;
+
+	for (done = 0; done < num; done += todo) {
+		struct iovec	iov[RADIUS_SIGN_BATCH_MAX][2];
+		fr_md5_batch_t	md5[RADIUS_SIGN_BATCH_MAX];
+		uint8_t		*ma;
+
+		todo = num - done;
+		if (todo > RADIUS_SIGN_BATCH_MAX) todo = RADIUS_SIGN_BATCH_MAX;
+
+		/*
+		 *	Message-Authenticator first, as it's
+		 *	covered by the authenticator.
+		 */
+		for (i = 0, j = 0; i < todo; i++) {
+			fr_radius_sign_batch_t *b = &batch[done + i];
+
+			b->ret = radius_sign_prepare(&ma, b->packet, b->vector, secret_len);
+			if (b->ret < 0) {
+				failed++;
+				continue;
+			}
+			if (!ma) continue;
+
+			iov[j][0] = (struct iovec){ .iov_base = b->packet, .iov_len = fr_nbo_to_uint16(b->packet + 2) };
+			md5[j] = (fr_md5_batch_t){ .iov = iov[j], .iovcnt = 1, .out = ma };
+			j++;
+		}
+		if (j) fr_hmac_md5_batch(md5, j, secret, secret_len);
+
+		/*
+		 *	Request / Response Authenticator = MD5(packet + secret)
+		 */
+		for (i = 0, j = 0; i < todo; i++) {
+			fr_radius_sign_batch_t *b = &batch[done + i];
+			int ret;
+
+			if (b->ret < 0) continue;
+
+			ret = radius_sign_vector_set(b->packet, b->vector);
+			if (ret < 0) {
+				b->ret = -1;
+				failed++;
+				continue;
+			}
+			if (ret == 0) continue;
+
+			iov[j][0] = (struct iovec){ .iov_base = b->packet, .iov_len = fr_nbo_to_uint16(b->packet + 2) };
+			iov[j][1] = (struct iovec){ .iov_base = UNCONST(uint8_t *, secret), .iov_len = secret_len };
+			md5[j] = (fr_md5_batch_t){ .iov = iov[j], .iovcnt = 2, .out = b->packet + 4 };
+			j++;
+		}
+		if (j) fr_md5_calc_batch(md5, j);
+	}
+
+	return failed;
+}
+
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
@@ -950,12 +1071,16 @@ static const bool disallow_tunnel_passwords[FR_RADIUS_CODE_MAX] = {
 	[ FR_RADIUS_CODE_PROTOCOL_ERROR ] = true,
 };
 
+static fr_pair_list_lazy_t *radius_lazy_passthrough_prepare(fr_pair_list_t *vps);
+static ssize_t radius_lazy_passthrough(fr_dbuff_t *dbuff, fr_pair_list_lazy_t *lazy);
+
 ssize_t fr_radius_encode(fr_dbuff_t *dbuff, fr_pair_list_t *vps, fr_radius_encode_ctx_t *packet_ctx)
 {
 	ssize_t			slen;
 	fr_pair_t const		*vp;
 	fr_dcursor_t		cursor;
 	fr_dbuff_t		work_dbuff, length_dbuff;
+	fr_pair_list_lazy_t	*lazy = NULL;
 
 	packet_ctx->disallow_tunnel_passwords = disallow_tunnel_passwords[packet_ctx->code];
 
@@ -1052,10 +1177,23 @@ ssize_t fr_radius_encode(fr_dbuff_t *dbuff, fr_pair_list_t *vps, fr_radius_encod
 					 0x00, 0x00, 0x00, packet_ctx->request_code);
 	}
 
+	/*
+	 *	If the list is still being decoded from a packet,
+	 *	only encode the attributes which have been decoded.
+	 *	The rest are copied from the original packet below.
+	 */
+	if (packet_ctx->passthrough) lazy = radius_lazy_passthrough_prepare(vps);
+
 	/*
 	 *	Loop over the reply attributes for the packet.
 	 */
-	fr_pair_dcursor_iter_init(&cursor, vps, fr_radius_next_encodable, dict_radius);
+	if (lazy) {
+		fr_pair_list_lazy_set(vps, NULL);
+		fr_pair_dcursor_iter_init(&cursor, vps, fr_radius_next_encodable, dict_radius);
+		fr_pair_list_lazy_set(vps, lazy);
+	} else {
+		fr_pair_dcursor_iter_init(&cursor, vps, fr_radius_next_encodable, dict_radius);
+	}
 	while ((vp = fr_dcursor_current(&cursor))) {
 		PAIR_VERIFY(vp);
 
@@ -1066,6 +1204,16 @@ ssize_t fr_radius_encode(fr_dbuff_t *dbuff, fr_pair_list_t *vps, fr_radius_encod
 		if (slen < 0) return slen;
 	} /* done looping over all attributes */
 
+	/*
+	 *	Encoding may have caused more attributes to be
+	 *	decoded, or all of them, in which case they've
+	 *	already been encoded above.
+	 */
+	if (lazy && (vps->lazy == lazy)) {
+		slen = radius_lazy_passthrough(&work_dbuff, lazy);
+		if (slen < 0) return slen;
+	}
+
 	/*
 	 *	Add Proxy-State to the end of the packet if the caller requested it.
 	 */
@@ -1085,12 +1233,16 @@ ssize_t fr_radius_encode(fr_dbuff_t *dbuff, fr_pair_list_t *vps, fr_radius_encod
 	return fr_dbuff_set(dbuff, &work_dbuff);
 }
 
-ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
-			 uint8_t *packet, size_t packet_len,
-			 fr_radius_decode_ctx_t *decode_ctx)
+/** Check the packet header, and verify the packet if required
+ *
+ * @param[in] packet		to check.
+ * @param[in] decode_ctx	request_authenticator is filled in if not set.
+ * @return
+ *	- 0 on success.
+ *	- <0 on failure.
+ */
+static ssize_t radius_decode_header(uint8_t *packet, fr_radius_decode_ctx_t *decode_ctx)
 {
-	ssize_t			slen;
-	uint8_t const		*attr, *end;
 	static const uint8_t   	zeros[RADIUS_AUTH_VECTOR_LENGTH] = {};
 
 	if (!decode_ctx->request_authenticator) {
@@ -1161,6 +1313,19 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 		}
 	}
 
+	return 0;
+}
+
+ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
+			 uint8_t *packet, size_t packet_len,
+			 fr_radius_decode_ctx_t *decode_ctx)
+{
+	ssize_t			slen;
+	uint8_t const		*attr, *end;
+
+	slen = radius_decode_header(packet, decode_ctx);
+	if (slen < 0) return slen;
+
 	attr = packet + 20;
 	end = packet + packet_len;
 
@@ -1190,6 +1355,305 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	return packet_len;
 }
 
+/** State for decoding attributes from a packet as they're looked for
+ *
+ */
+typedef struct {
+	fr_pair_list_lazy_t	lazy;			//!< Registered with the pair list.
+	TALLOC_CTX		*ctx;			//!< To allocate pairs in.
+	fr_radius_ctx_t		common;			//!< Copy of the caller's, with our own copy of the secret.
+	fr_radius_decode_ctx_t	decode_ctx;		//!< Copy of the caller's.
+	uint8_t			vector[RADIUS_AUTH_VECTOR_LENGTH];	//!< Copy of the request authenticator.
+
+	uint8_t const		*packet;		//!< Start of the packet.
+	uint8_t const		*end;			//!< End of the packet.
+
+	unsigned int		pending;		//!< Number of attribute types still to decode.
+	uint16_t		next[UINT8_MAX + 1];	//!< Offset of the first attribute of each type
+							///< still to decode.  0 if there are none.
+} radius_lazy_t;
+
+/** Decode one attribute, or a set of attributes the decoder treats as one
+ *
+ * If the attribute can't be decoded, it's added as a raw attribute, so
+ * that one bad attribute doesn't lose all the ones after it.
+ *
+ * @return
+ *	- > 0 the number of bytes consumed.
+ *	- -1 if we ran out of memory.
+ */
+static inline CC_HINT(always_inline)
+ssize_t radius_lazy_decode_pair(fr_pair_list_t *out, radius_lazy_t *lazy, uint8_t const *attr)
+{
+	fr_dict_attr_t const	*da;
+	ssize_t			slen;
+
+	slen = fr_radius_decode_pair(lazy->ctx, out, attr, (lazy->end - attr), &lazy->decode_ctx);
+	talloc_free_children(lazy->decode_ctx.tmp_ctx);
+	if ((slen > 0) && fr_cond_assert(slen <= (lazy->end - attr))) return slen;
+
+	/*
+	 *	fr_radius_decode_lazy() checked the attribute
+	 *	headers, so we can always skip to the next one.
+	 */
+	da = fr_dict_attr_child_by_num(fr_dict_root(dict_radius), attr[0]);
+	if (!da) return attr[1];
+
+	if (fr_pair_raw_from_network(lazy->ctx, out, da, attr + 2, attr[1] - 2) < 0) return -1;
+
+	return attr[1];
+}
+
+/** Decode all remaining attributes of a single type
+ *
+ */
+static int radius_lazy_decode_type(fr_pair_list_t *out, radius_lazy_t *lazy, uint8_t type)
+{
+	uint8_t const	*attr = lazy->packet + lazy->next[type];
+	ssize_t		slen;
+
+	lazy->next[type] = 0;
+	lazy->pending--;
+
+	while (attr < lazy->end) {
+		if (attr[0] != type) {
+			attr += attr[1];
+			continue;
+		}
+
+		slen = radius_lazy_decode_pair(out, lazy, attr);
+		if (slen < 0) return -1;
+
+		attr += slen;
+	}
+
+	return lazy->pending ? 0 : 1;
+}
+
+/** Decode all remaining attributes, in packet order
+ *
+ */
+static int radius_lazy_decode_all(fr_pair_list_t *out, radius_lazy_t *lazy)
+{
+	uint8_t const	*attr = lazy->packet + RADIUS_HEADER_LENGTH;
+	ssize_t		slen;
+
+	while (attr < lazy->end) {
+		if (!lazy->next[attr[0]]) {
+			attr += attr[1];
+			continue;
+		}
+
+		slen = radius_lazy_decode_pair(out, lazy, attr);
+		if (slen < 0) return -1;
+
+		attr += slen;
+	}
+
+	memset(lazy->next, 0, sizeof(lazy->next));
+	lazy->pending = 0;
+
+	return 1;
+}
+
+/** Decode the attributes the pair list is being searched for
+ *
+ * Only top level attributes of the RADIUS dictionary can be decoded
+ * from a packet.  Anything else can't be in the list yet, so there's
+ * nothing to do.
+ */
+static int _radius_lazy_decode(fr_pair_list_t *out, fr_dict_attr_t const *da, void *uctx)
+{
+	radius_lazy_t	*lazy = talloc_get_type_abort(uctx, radius_lazy_t);
+
+	if (!da) return radius_lazy_decode_all(out, lazy);
+
+	if (da->parent != fr_dict_root(dict_radius)) return 0;
+
+	if (da->attr <= UINT8_MAX) {
+		if (!lazy->next[da->attr]) return 0;
+
+		return radius_lazy_decode_type(out, lazy, da->attr);
+	}
+
+	/*
+	 *	Tag groups are created from whichever tagged
+	 *	attributes are in the packet.
+	 */
+	if ((da->attr > FR_TAG_BASE) && (da->attr < (FR_TAG_BASE + 0x20))) return radius_lazy_decode_all(out, lazy);
+
+	return 0;
+}
+
+/** Whether an attribute can be copied from one packet to another without being decoded
+ *
+ * Anything which depends on the shared secret or the authenticator
+ * must be re-encoded, as must anything which may contain such
+ * attributes.  Unknown attributes are decoded as raw octets, and
+ * would be re-encoded exactly as they were.
+ */
+static bool radius_lazy_passthrough_ok(fr_dict_attr_t const *da)
+{
+	if (!da) return true;
+
+	if (da->attr == FR_MESSAGE_AUTHENTICATOR) return false;
+
+	if (fr_type_is_structural(da->type)) return false;
+
+	return !fr_radius_flag_extended(da) && !fr_radius_flag_encrypted(da);
+}
+
+/** Get a list ready for passing through the attributes which haven't been decoded
+ *
+ * Decodes any attributes which can't be copied verbatim.
+ *
+ * @param[in] vps	being encoded.
+ * @return
+ *	- The lazy decode state of the list, if there are attributes to copy.
+ *	- NULL if the list isn't being lazily decoded from a RADIUS packet,
+ *	  or everything has been decoded.
+ */
+static fr_pair_list_lazy_t *radius_lazy_passthrough_prepare(fr_pair_list_t *vps)
+{
+	radius_lazy_t		*lazy;
+	fr_dict_attr_t const	*da;
+	unsigned int		i;
+
+	if (!vps->lazy || (vps->lazy->func != _radius_lazy_decode)) return NULL;
+
+	lazy = talloc_get_type_abort(vps->lazy->uctx, radius_lazy_t);
+
+	for (i = 0; i <= UINT8_MAX; i++) {
+		if (!lazy->next[i]) continue;
+
+		da = fr_dict_attr_child_by_num(fr_dict_root(dict_radius), i);
+		if (radius_lazy_passthrough_ok(da)) continue;
+
+		/*
+		 *	Nothing left to copy, or we failed decoding
+		 *	and the rest of the attributes are gone.
+		 */
+		if (fr_pair_list_lazy_resolve(vps, da) != 0) return NULL;
+	}
+
+	return vps->lazy;
+}
+
+/** Copy the attributes which haven't been decoded from the original packet
+ *
+ * @param[out] dbuff	to write the attributes to.
+ * @param[in] list_lazy	as returned by #radius_lazy_passthrough_prepare.
+ * @return
+ *	- >= 0 the number of bytes written.
+ *	- <0 the number of bytes we would have needed.
+ */
+static ssize_t radius_lazy_passthrough(fr_dbuff_t *dbuff, fr_pair_list_lazy_t *list_lazy)
+{
+	radius_lazy_t	*lazy = talloc_get_type_abort(list_lazy->uctx, radius_lazy_t);
+	fr_dbuff_t	work_dbuff = FR_DBUFF(dbuff);
+	uint8_t const	*attr;
+
+	for (attr = lazy->packet + RADIUS_HEADER_LENGTH; attr < lazy->end; attr += attr[1]) {
+		if (!lazy->next[attr[0]]) continue;
+
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, attr, attr[1]);
+	}
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+/** Decode a RADIUS packet, leaving the attributes to be decoded when they're looked for
+ *
+ * The header is checked, and the packet verified, as with #fr_radius_decode.
+ * The attributes are only indexed.  They're decoded into the list the first
+ * time something looks for them, or walks over the list.  Looking for one
+ * attribute decodes all the instances of that attribute, and nothing else.
+ *
+ * Attributes are added to the list in the order they're decoded, not
+ * the order they're in the packet.  Attributes which can't be decoded
+ * are added as raw attributes, instead of failing the decode.
+ *
+ * @param[in] ctx		to allocate the decoder state, and the pairs in.
+ * @param[in] out		where the pairs will be added.
+ * @param[in] packet		to decode.  Must remain valid until the list
+ *				has been fully decoded, or freed.
+ * @param[in] packet_len	length of the packet.
+ * @param[in] decode_ctx	is copied, so need not remain valid after this call.
+ * @return
+ *	- packet_len on success.
+ *	- <0 on failure.
+ */
+ssize_t fr_radius_decode_lazy(TALLOC_CTX *ctx, fr_pair_list_t *out,
+			      uint8_t *packet, size_t packet_len,
+			      fr_radius_decode_ctx_t *decode_ctx)
+{
+	ssize_t		slen;
+	radius_lazy_t	*lazy;
+	uint8_t const	*attr, *end = packet + packet_len;
+
+	slen = radius_decode_header(packet, decode_ctx);
+	if (slen < 0) return slen;
+
+	/*
+	 *	Nothing to decode.
+	 */
+	if (packet_len <= RADIUS_HEADER_LENGTH) return packet_len;
+
+	lazy = talloc_zero(ctx, radius_lazy_t);
+	if (unlikely(!lazy)) {
+		fr_strerror_const("Failed allocating lazy decode state");
+		return -1;
+	}
+
+	lazy->ctx = ctx;
+	lazy->packet = packet;
+	lazy->end = end;
+
+	lazy->common = *decode_ctx->common;
+	if (lazy->common.secret) {
+		lazy->common.secret = talloc_bstrndup(lazy, lazy->common.secret, lazy->common.secret_length);
+		if (unlikely(!lazy->common.secret)) {
+		oom:
+			talloc_free(lazy);
+			fr_strerror_const("Failed allocating lazy decode state");
+			return -1;
+		}
+	}
+
+	lazy->decode_ctx = *decode_ctx;
+	lazy->decode_ctx.common = &lazy->common;
+	lazy->decode_ctx.tmp_ctx = talloc(lazy, uint8_t);
+	if (unlikely(!lazy->decode_ctx.tmp_ctx)) goto oom;
+
+	memcpy(lazy->vector, decode_ctx->request_authenticator, sizeof(lazy->vector));
+	lazy->decode_ctx.request_authenticator = lazy->vector;
+
+	/*
+	 *	The caller MUST have called fr_radius_ok() first,
+	 *	so the attribute lengths are sane.
+	 */
+	for (attr = packet + RADIUS_HEADER_LENGTH; attr < end; attr += attr[1]) {
+		if (!fr_cond_assert((attr + 2) <= end) || !fr_cond_assert(attr[1] >= 2)) {
+			talloc_free(lazy);
+			fr_strerror_const("Malformed attribute");
+			return -1;
+		}
+
+		if (lazy->next[attr[0]]) continue;
+
+		lazy->next[attr[0]] = attr - packet;
+		lazy->pending++;
+	}
+
+	lazy->lazy = (fr_pair_list_lazy_t){
+		.func = _radius_lazy_decode,
+		.uctx = lazy
+	};
+	fr_pair_list_lazy_set(out, &lazy->lazy);
+
+	return packet_len;
+}
+
 /** Simple wrapper for callers who just need a shared secret
  *
  */
@@ -409,6 +409,10 @@ static ssize_t decode_concat(TALLOC_CTX *ctx, fr_pair_list_t *list,
  */
 #define decode_value fr_radius_decode_pair_value
 
+/** Octets values shorter than this are copied, even if they could be borrowed from the packet
+ */
+#define RADIUS_DECODE_BORROW_MIN	(64)
+
 /** decode an RFC-format TLV
  *
  */
@@ -1929,6 +1933,23 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_pair_list_t *out,
 		 *	doesn't.  Therefore it's malformed.
 		 */
 		if (parent->flags.length && (data_len != parent->flags.length)) goto raw;
+
+		/*
+		 *	Point into the packet instead of copying.
+		 *	Values decoded into temporary buffers
+		 *	(decrypted, concatenated) won't be in range.
+		 *	Small values are cheaper to copy than to
+		 *	take a reference for.
+		 */
+		if (packet_ctx->packet_buffer && (data_len >= RADIUS_DECODE_BORROW_MIN) && !vp->da->flags.secret &&
+		    (p >= packet_ctx->packet_buffer) && ((p + data_len) <= packet_ctx->end)) {
+			if (fr_value_box_mem_borrow(vp, &vp->data, vp->da, packet_ctx->packet_buffer,
+						    p, data_len, true) < 0) {
+				talloc_free(vp);
+				return -1;
+			}
+			break;
+		}
 		FALL_THROUGH;
 
 	default:
@@ -2217,6 +2238,53 @@ static ssize_t fr_radius_decode_proto(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	return fr_radius_decode(ctx, out, UNCONST(uint8_t *, data), packet_len, test_ctx);
 }
 
+/** Decode a packet lazily, then materialise all of its attributes
+ *
+ * The output should be identical to #fr_radius_decode_proto.
+ */
+static ssize_t fr_radius_decode_lazy_proto(TALLOC_CTX *ctx, fr_pair_list_t *out,
+					   uint8_t const *data, size_t data_len, void *proto_ctx)
+{
+	fr_radius_decode_ctx_t	*test_ctx = talloc_get_type_abort(proto_ctx, fr_radius_decode_ctx_t);
+	decode_fail_t	reason;
+	fr_pair_t	*vp;
+	size_t		packet_len = data_len;
+	ssize_t		slen;
+
+	if (!fr_radius_ok(data, &packet_len, 200, false, &reason)) {
+		fr_strerror_printf("Packet failed verification - %s", reason_name[reason]);
+		return -1;
+	}
+
+	vp = fr_pair_afrom_da(ctx, attr_packet_type);
+	if (!vp) {
+		fr_strerror_const("Failed creating Packet-Type");
+		return -1;
+	}
+	vp->vp_uint32 = data[0];
+	fr_pair_append(out, vp);
+
+	vp = fr_pair_afrom_da(ctx, attr_packet_authentication_vector);
+	if (!vp) {
+		fr_strerror_const("Failed creating Packet-Authentication-Vector");
+		return -1;
+	}
+	(void) fr_pair_value_memdup(vp, data + 4, 16, true);
+	fr_pair_append(out, vp);
+
+	test_ctx->end = data + packet_len;
+
+	slen = fr_radius_decode_lazy(ctx, out, UNCONST(uint8_t *, data), packet_len, test_ctx);
+	if (slen < 0) return slen;
+
+	/*
+	 *	The packet data isn't valid after we return.
+	 */
+	if (fr_pair_list_lazy_resolve(out, NULL) < 0) return -1;
+
+	return slen;
+}
+
 static ssize_t decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *out, NDEBUG_UNUSED fr_dict_attr_t const *parent,
 			   uint8_t const *data, size_t data_len, void *decode_ctx)
 {
@@ -2243,3 +2311,9 @@ fr_test_point_proto_decode_t radius_tp_decode_proto = {
 	.test_ctx	= decode_test_ctx,
 	.func		= fr_radius_decode_proto
 };
+
+extern fr_test_point_proto_decode_t radius_tp_decode_lazy_proto;
+fr_test_point_proto_decode_t radius_tp_decode_lazy_proto = {
+	.test_ctx	= decode_test_ctx,
+	.func		= fr_radius_decode_lazy_proto
+};
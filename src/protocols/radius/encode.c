@@ -757,16 +757,17 @@ static ssize_t encode_extended(fr_dbuff_t *dbuff,
 	 *	Encode the header for "short" or "long" attributes
 	 */
 	hlen = 3 + extra;
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[0]->attr);
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, hlen);
+	fr_dbuff_in_unchecked(&work_dbuff, (uint8_t)da_stack->da[0]->attr);
 	fr_dbuff_marker(&length_field, &work_dbuff);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, hlen); /* this gets overwritten later*/
+	fr_dbuff_in_unchecked(&work_dbuff, hlen); /* this gets overwritten later*/
 
 	/*
 	 *	Encode which extended attribute it is.
 	 */
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[1]->attr);
+	fr_dbuff_in_unchecked(&work_dbuff, (uint8_t)da_stack->da[1]->attr);
 
-	if (extra) FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, 0x00);	/* flags start off at zero */
+	if (extra) fr_dbuff_in_unchecked(&work_dbuff, (uint8_t)0x00);	/* flags start off at zero */
 
 	FR_PROTO_STACK_PRINT(da_stack, depth);
 
@@ -777,11 +778,11 @@ static ssize_t encode_extended(fr_dbuff_t *dbuff,
 		fr_assert(da_stack->da[2]);
 		fr_assert(da_stack->da[2]->type == FR_TYPE_VENDOR);
 
-		FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t) da_stack->da[2]->attr);
-
 		fr_assert(da_stack->da[3]);
 
-		FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, (uint8_t)da_stack->da[3]->attr);
+		FR_DBUFF_RESERVE_RETURN(&work_dbuff, 5);
+		fr_dbuff_in_unchecked(&work_dbuff, (uint32_t) da_stack->da[2]->attr);
+		fr_dbuff_in_unchecked(&work_dbuff, (uint8_t)da_stack->da[3]->attr);
 
 		hlen += 5;
 		vendor_hdr = 5;
@@ -1007,18 +1008,23 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 
 	fr_dbuff_marker(&hdr, &work_dbuff);
 
+	hdr_len = dv->flags.type_size + dv->flags.length;
+
+	/*
+	 *	Reserve space for the whole header, so
+	 *	we only check once.
+	 */
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, 6 + hdr_len);
+
 	/*
 	 *	Build the Vendor-Specific header
 	 */
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, FR_VENDOR_SPECIFIC);
+	fr_dbuff_in_bytes_unchecked(&work_dbuff, FR_VENDOR_SPECIFIC);
 
 	fr_dbuff_marker(&length_field, &work_dbuff);
-	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, 0);
-
-	FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t)dv->attr);	/* Copy in the 32bit vendor ID */
+	fr_dbuff_in_bytes_unchecked(&work_dbuff, 0);
 
-
-	hdr_len = dv->flags.type_size + dv->flags.length;
+	fr_dbuff_in_unchecked(&work_dbuff, (uint32_t)dv->attr);	/* Copy in the 32bit vendor ID */
 
 	/*
 	 *	Vendors use different widths for their
@@ -1030,15 +1036,15 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 		return PAIR_ENCODE_FATAL_ERROR;
 
 	case 4:
-		fr_dbuff_in(&work_dbuff, (uint32_t)da->attr);
+		fr_dbuff_in_unchecked(&work_dbuff, (uint32_t)da->attr);
 		break;
 
 	case 2:
-		fr_dbuff_in(&work_dbuff, (uint16_t)da->attr);
+		fr_dbuff_in_unchecked(&work_dbuff, (uint16_t)da->attr);
 		break;
 
 	case 1:
-		fr_dbuff_in(&work_dbuff, (uint8_t)da->attr);
+		fr_dbuff_in_unchecked(&work_dbuff, (uint8_t)da->attr);
 		break;
 	}
 
@@ -1054,7 +1060,7 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 		break;
 
 	case 2:
-		fr_dbuff_in_bytes(&work_dbuff, 0);
+		fr_dbuff_in_bytes_unchecked(&work_dbuff, 0);
 		FALL_THROUGH;
 
 	case 1:
@@ -1063,7 +1069,7 @@ static ssize_t encode_vendor_attr(fr_dbuff_t *dbuff,
 		 *	will get over-ridden later.
 		 */
 		fr_dbuff_marker(&vsa_length_field, &work_dbuff);
-		fr_dbuff_in_bytes(&work_dbuff, 0);
+		fr_dbuff_in_bytes_unchecked(&work_dbuff, 0);
 		break;
 	}
 
@@ -20,57 +20,111 @@
  * @file protocols/radius/id.c
  * @brief Functions to allocate 8-bit IDs for a particular socket.
  *
+ * An ID pool can also cover multiple sockets, each of which has its own 8-bit ID space.  The IDs are
+ * then allocated from one free list of 256 x N entries, and the "slot" of an ID says which socket the
+ * packet has to be sent on.  This lets the application add sockets to increase the number of
+ * outstanding packets, without managing multiple ID trackers.
+ *
+ * The free list is a ring, so allocating and freeing an ID is O(1), and IDs are re-used in LRU order.
+ * The tracking entries are cache line aligned, so that an entry never straddles two cache lines.
+ *
+ * The structures are not thread-safe.  Each one should be used by only one thread, as with the bios.
+ *
  * @copyright 2024 Network RADIUS SAS (legal@networkradius.com)
  */
 RCSID("$Id$")
 
 #include <freeradius-devel/radius/id.h>
 
+#define ID_CACHE_LINE_SIZE	(64)
+
+/*
+ *	A whole number of entries per cache line.  If the structure grows, it should be padded to a cache line.
+ */
+static_assert((ID_CACHE_LINE_SIZE % sizeof(fr_radius_id_ctx_t)) == 0,
+	      "fr_radius_id_ctx_t must divide the cache line size");
+
 struct fr_radius_id_s {
-	int			num_free_ids;	//!< number of used IDs
+	uint32_t		num_slots;	//!< number of 8-bit ID spaces, i.e. sockets
+	uint32_t		num_ids;	//!< 256 * num_slots
 
-	int			free_start;
-	int			free_end;
+	uint32_t		num_free_ids;	//!< number of unused IDs
 
-	fr_radius_id_ctx_t     	id[256];	//!< pointers to request / reply data
+	uint32_t		free_start;	//!< where the next ID is taken from
+	uint32_t		free_end;	//!< where the next freed ID is put
 
-	int			free_ids[256];
-};
+	fr_radius_id_ctx_t     	*id;		//!< pointers to request / reply data, indexed by (slot * 256) + id
 
+	uint32_t		*free_ids;	//!< ring of free entries, each of which is (slot * 256) + id
+};
 
+#define ID_FREE		(UINT32_MAX)
 
 /** Allocate a tracking structure for one packet code.
  *
+ *  The structure covers one socket.
  */
 fr_radius_id_t *fr_radius_id_alloc(TALLOC_CTX *ctx)
+{
+	return fr_radius_id_pool_alloc(ctx, 1);
+}
+
+/** Allocate a tracking structure for one packet code, across multiple sockets.
+ *
+ * @param[in] ctx		to allocate the structure in.
+ * @param[in] num_slots		the number of sockets, each with its own 8-bit ID space.
+ * @return
+ *	- NULL on error.
+ *	- a new ID pool on success.
+ */
+fr_radius_id_t *fr_radius_id_pool_alloc(TALLOC_CTX *ctx, uint32_t num_slots)
 {
 	uint32_t i;
 	fr_radius_id_t *track;
 
+	if (!num_slots || (num_slots > 65536)) {
+		fr_strerror_printf("Invalid number of ID slots %u", num_slots);
+		return NULL;
+	}
+
 	track = talloc_zero(ctx, fr_radius_id_t);
 	if (!track) return NULL;
 
-	track->num_free_ids = 256;
+	track->num_slots = num_slots;
+	track->num_ids = num_slots * 256;
+	track->num_free_ids = track->num_ids;
 	track->free_start = 0;
 	track->free_end = 0;
 
-	for (i = 0; i < 256; i++) {
+	if (!talloc_aligned_array(track, (void **) &track->id, ID_CACHE_LINE_SIZE,
+				  track->num_ids * sizeof(track->id[0]))) {
+	fail:
+		talloc_free(track);
+		return NULL;
+	}
+	memset(track->id, 0, track->num_ids * sizeof(track->id[0]));
+
+	track->free_ids = talloc_array(track, uint32_t, track->num_ids);
+	if (!track->free_ids) goto fail;
+
+	for (i = 0; i < track->num_ids; i++) {
 		track->free_ids[i] = i;
 	}
 
 	/*
-	 *	Shuffle the entirs using a Fisher-Yates shuffle.
+	 *	Shuffle the entirs using a Fisher-Yates shuffle.  When there are multiple slots, this also
+	 *	spreads the packets across the sockets.
 	 *
-	 *	We loop from i=255..1, choosing random numbers j, such that 0 <= j <= i
+	 *	We loop from i=num_ids-1..1, choosing random numbers j, such that 0 <= j <= i
 	 *	And then swap a[j],a[i]
 	 *
 	 *	We choose a 32-bit random number, and then take the modulo of that and i+1.  Which means that
 	 *	the resulting random number j is [0..i], whereas taking the modulo with i, then the random
 	 *	number j will instead be chosen to be [0..i)
 	 */
-	for (i = 255; i >= 1; i--) {
+	for (i = track->num_ids - 1; i >= 1; i--) {
 		uint32_t j = fr_rand() % (i + 1); /* small bias, but we don't care much */
-		int tmp;
+		uint32_t tmp;
 
 		if (j == i) continue;
 
@@ -79,83 +133,107 @@ fr_radius_id_t *fr_radius_id_alloc(TALLOC_CTX *ctx)
 		track->free_ids[i] = tmp;
 	}
 
-
 	return track;
 }
 
 /** Allocate an ID for a packet, using LRU
  *
+ * @param[in] track	the ID pool.
+ * @param[in] packet	to allocate an ID for.  packet->id is set.
+ * @param[out] slot	the socket the packet must be sent on.  May be NULL if the pool has only one slot.
+ * @return
+ *	- NULL if all IDs are in use.
+ *	- the tracking entry for the packet.
  */
-fr_radius_id_ctx_t *fr_radius_id_pop(fr_radius_id_t *track, fr_packet_t *packet)
+fr_radius_id_ctx_t *fr_radius_id_pool_pop(fr_radius_id_t *track, fr_packet_t *packet, uint32_t *slot)
 {
-	int id;
+	uint32_t idx;
 
-	id = track->free_ids[track->free_start];
-	fr_assert(id >= 0);
-	fr_assert(id < 256);
+	fr_assert(slot || (track->num_slots == 1));
+
+	if (!track->num_free_ids) return NULL;
+
+	idx = track->free_ids[track->free_start];
+	fr_assert(idx < track->num_ids);
 
-	fr_assert(!track->id[id].packet);
+	fr_assert(!track->id[idx].packet);
 
-	track->free_ids[track->free_start] = -1;
+	track->free_ids[track->free_start] = ID_FREE;
 
-	track->free_start++;
-	track->free_start &= 0xff;
+	if (++track->free_start == track->num_ids) track->free_start = 0;
 
-	fr_assert(track->num_free_ids > 0);
 	track->num_free_ids--;
 
-	track->id[id] = (fr_radius_id_ctx_t) {
+	track->id[idx] = (fr_radius_id_ctx_t) {
 		.packet = packet,
 	};
-	packet->id = id;
+	packet->id = idx & 0xff;
+	if (slot) *slot = idx >> 8;
 
-	return &track->id[id];
+	return &track->id[idx];
 }
 
 /** De-allocate an ID for a packet, using LRU
  *
+ * @param[in] track	the ID pool.
+ * @param[in] slot	the packet was sent on.
+ * @param[in] packet	to de-allocate the ID for.
  */
-void fr_radius_id_push(fr_radius_id_t *track, fr_packet_t const *packet)
+void fr_radius_id_pool_push(fr_radius_id_t *track, uint32_t slot, fr_packet_t const *packet)
 {
+	uint32_t idx;
+
 	fr_assert(packet->id >= 0);
 	fr_assert(packet->id < 256);
+	fr_assert(slot < track->num_slots);
+
+	idx = (slot << 8) | packet->id;
 
-	fr_assert(track->id[packet->id].packet == packet);
-	fr_assert(track->num_free_ids < 256);
-	fr_assert(track->free_start != track->free_end);
-	fr_assert(track->free_end >= 0);
-	fr_assert(track->free_end < 256);
-	fr_assert(track->free_ids[track->free_end] == -1);
+	fr_assert(track->id[idx].packet == packet);
+	fr_assert(track->num_free_ids < track->num_ids);
+	fr_assert(!track->num_free_ids || (track->free_start != track->free_end));
+	fr_assert(track->free_end < track->num_ids);
+	fr_assert(track->free_ids[track->free_end] == ID_FREE);
 
-	track->free_ids[track->free_end] = packet->id;
+	track->free_ids[track->free_end] = idx;
 
-	track->free_end++;
-	track->free_end &= 0xff;
+	if (++track->free_end == track->num_ids) track->free_end = 0;
 
-	track->id[packet->id].packet = NULL;
+	track->id[idx].packet = NULL;
 	track->num_free_ids++;
 }
 
-fr_radius_id_ctx_t *fr_radius_id_find(fr_radius_id_t *track, int id)
+/** Find the tracking entry for an ID
+ *
+ */
+fr_radius_id_ctx_t *fr_radius_id_pool_find(fr_radius_id_t *track, uint32_t slot, int id)
 {
 	fr_assert(id >= 0);
 	fr_assert(id < 256);
 
-	return &track->id[id];
+	if (slot >= track->num_slots) return NULL;
+
+	return &track->id[(slot << 8) | id];
 }
 
 /**  Forces the next ID to be the given one
  *
  */
-int fr_radius_id_force(fr_radius_id_t *track, int id)
+int fr_radius_id_pool_force(fr_radius_id_t *track, uint32_t slot, int id)
 {
-	int i, first;
+	uint32_t i, idx, first;
 
 	fr_assert(id >= 0);
 	fr_assert(id < 256);
 
-	for (i = 0; i < 256; i++) {
-		if (track->free_ids[(track->free_start + i) & 0xff] != id) continue;
+	if (slot >= track->num_slots) goto fail;
+
+	idx = (slot << 8) | id;
+
+	for (i = 0; i < track->num_free_ids; i++) {
+		uint32_t pos = (track->free_start + i) % track->num_ids;
+
+		if (track->free_ids[pos] != idx) continue;
 
 		/*
 		 *	It's already the first one.  We don't need to do any more.
@@ -163,12 +241,21 @@ int fr_radius_id_force(fr_radius_id_t *track, int id)
 		if (i == 0) return 0;
 
 		first = track->free_ids[track->free_start];
-		track->free_ids[track->free_start] = id;
-		track->free_ids[(track->free_start + i) & 0xff] = first;
+		track->free_ids[track->free_start] = idx;
+		track->free_ids[pos] = first;
 
 		return 0;
 	}
 
+fail:
 	fr_strerror_const("Cannot assign ID");
 	return -1;
 }
+
+/** Return the number of IDs which are in use
+ *
+ */
+uint32_t fr_radius_id_used(fr_radius_id_t const *track)
+{
+	return track->num_ids - track->num_free_ids;
+}
@@ -40,13 +40,40 @@ typedef struct {
 
 fr_radius_id_t	*fr_radius_id_alloc(TALLOC_CTX *ctx);
 
-fr_radius_id_ctx_t *fr_radius_id_pop(fr_radius_id_t *track, fr_packet_t *packet) CC_HINT(nonnull);
+fr_radius_id_t	*fr_radius_id_pool_alloc(TALLOC_CTX *ctx, uint32_t num_slots);
 
-void		fr_radius_id_push(fr_radius_id_t *track, fr_packet_t const *packet) CC_HINT(nonnull);
+fr_radius_id_ctx_t *fr_radius_id_pool_pop(fr_radius_id_t *track, fr_packet_t *packet, uint32_t *slot) CC_HINT(nonnull(1,2));
 
-fr_radius_id_ctx_t *fr_radius_id_find(fr_radius_id_t *track, int id) CC_HINT(nonnull);
+void		fr_radius_id_pool_push(fr_radius_id_t *track, uint32_t slot, fr_packet_t const *packet) CC_HINT(nonnull);
 
-int		fr_radius_id_force(fr_radius_id_t *track, int id) CC_HINT(nonnull);
+fr_radius_id_ctx_t *fr_radius_id_pool_find(fr_radius_id_t *track, uint32_t slot, int id) CC_HINT(nonnull);
+
+int		fr_radius_id_pool_force(fr_radius_id_t *track, uint32_t slot, int id) CC_HINT(nonnull);
+
+uint32_t	fr_radius_id_used(fr_radius_id_t const *track) CC_HINT(nonnull);
+
+/*
+ *	Functions for trackers which have only one slot, i.e. one socket.
+ */
+static inline CC_HINT(nonnull) fr_radius_id_ctx_t *fr_radius_id_pop(fr_radius_id_t *track, fr_packet_t *packet)
+{
+	return fr_radius_id_pool_pop(track, packet, NULL);
+}
+
+static inline CC_HINT(nonnull) void fr_radius_id_push(fr_radius_id_t *track, fr_packet_t const *packet)
+{
+	fr_radius_id_pool_push(track, 0, packet);
+}
+
+static inline CC_HINT(nonnull) fr_radius_id_ctx_t *fr_radius_id_find(fr_radius_id_t *track, int id)
+{
+	return fr_radius_id_pool_find(track, 0, id);
+}
+
+static inline CC_HINT(nonnull) int fr_radius_id_force(fr_radius_id_t *track, int id)
+{
+	return fr_radius_id_pool_force(track, 0, id);
+}
 
 static inline CC_HINT(nonnull) int fr_radius_code_id_alloc(TALLOC_CTX *ctx, fr_radius_code_id_t codes, int code)
 {
@@ -27,6 +27,7 @@
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/dbuff.h>
 #include <freeradius-devel/io/test_point.h>
 
@@ -117,6 +118,8 @@ typedef struct {
 	uint8_t			id;
 
 	bool			add_proxy_state;       	//!< do we add a Proxy-State?
+	bool			passthrough;		//!< Copy attributes which haven't been decoded yet
+							///< from the packet they were received in.
 	bool			disallow_tunnel_passwords; //!< not all packets can have tunnel passwords
 	bool			seen_message_authenticator;
 } fr_radius_encode_ctx_t;
@@ -128,6 +131,8 @@ typedef struct {
 
 	TALLOC_CTX		*tmp_ctx;		//!< for temporary things cleaned up during decoding
 	uint8_t const  		*end;			//!< end of the packet
+	uint8_t const		*packet_buffer;		//!< talloced buffer holding the packet.  If set, large
+							///< octets values point into it instead of being copied.
 
 	uint8_t			request_code;		//!< original code for the request.
 
@@ -200,6 +205,20 @@ int		fr_radius_allow_reply(int code, bool allowed[static FR_RADIUS_CODE_MAX]);
 int		fr_radius_sign(uint8_t *packet, uint8_t const *vector,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 
+/** A packet to sign with #fr_radius_sign_batch
+ *
+ */
+typedef struct {
+	uint8_t			*packet;	//!< Encoded packet to sign.
+	uint8_t const		*vector;	//!< Original packet vector, for responses.  May be NULL.
+	int			ret;		//!< Set to the result of signing this packet.
+} fr_radius_sign_batch_t;
+
+#define RADIUS_SIGN_BATCH_MAX	(FR_MD5_BATCH_LANES * 8)	//!< Packets signed together, on the stack.
+
+unsigned int	fr_radius_sign_batch(fr_radius_sign_batch_t *batch, unsigned int num,
+				     uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+
 int		fr_radius_verify(uint8_t *packet, uint8_t const *vector,
 				 uint8_t const *secret, size_t secret_len,
 				 bool require_message_authenticator, bool limit_proxy_state) CC_HINT(nonnull (1,3));
@@ -218,6 +237,10 @@ ssize_t		fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 				 uint8_t *packet, size_t packet_len,
 				 fr_radius_decode_ctx_t *decode_ctx) CC_HINT(nonnull);
 
+ssize_t		fr_radius_decode_lazy(TALLOC_CTX *ctx, fr_pair_list_t *out,
+				      uint8_t *packet, size_t packet_len,
+				      fr_radius_decode_ctx_t *decode_ctx) CC_HINT(nonnull);
+
 ssize_t		fr_radius_decode_simple(TALLOC_CTX *ctx, fr_pair_list_t *out,
 					uint8_t *packet, size_t packet_len,
 					uint8_t const *vector, char const *secret) CC_HINT(nonnull(1,2,3,6));
@@ -225,6 +225,119 @@ done:
 	return 0;
 }
 
+/** XOR the bodies of many packets which share a secret
+ *
+ *  Within a packet, each 16 byte block of the pad depends on the
+ *  previous one.  Packets are independent, so the pad chains of all
+ *  of the packets are run in lockstep, and each step digests one
+ *  block for every packet which still needs it, through
+ *  fr_md5_calc_batch().
+ *
+ *  The length of each body is taken from its header.  Like
+ *  fr_tacacs_body_xor(), this function doesn't change the flags.
+ *
+ * @param[in] pkts		to encrypt or decrypt.
+ * @param[in] num		number of packets.
+ * @param[in] secret		shared by all of the packets.
+ * @param[in] secret_len	length of the secret.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_tacacs_body_xor_batch(fr_tacacs_packet_t **pkts, unsigned int num, char const *secret, size_t secret_len)
+{
+	size_t		prefix_len, offset;
+	uint8_t		*prefix, *pad;
+	struct iovec	*iov;
+	fr_md5_batch_t	*batch;
+	unsigned int	i, active;
+	TALLOC_CTX	*ctx;
+
+	if (!num) return 0;
+
+	if (!secret_len) {
+		fr_strerror_const("Failed to encrypt/decrypt the packets, as the secret has zero length.");
+		return -1;
+	}
+
+	prefix_len = sizeof(pkts[0]->hdr.session_id) + secret_len + sizeof(pkts[0]->hdr.version) + sizeof(pkts[0]->hdr.seq_no);
+
+	MEM(ctx = talloc_new(NULL));
+	MEM(prefix = talloc_array(ctx, uint8_t, num * prefix_len));
+	MEM(pad = talloc_array(ctx, uint8_t, 2 * num * MD5_DIGEST_LENGTH));
+	MEM(iov = talloc_array(ctx, struct iovec, 2 * num));
+	MEM(batch = talloc_array(ctx, fr_md5_batch_t, num));
+
+	/*
+	 *	{session_id, key, version, seq_no} starts every block
+	 *	of every pad.
+	 */
+	for (i = 0; i < num; i++) {
+		uint8_t *p = prefix + (i * prefix_len);
+
+		memcpy(p, &pkts[i]->hdr.session_id, sizeof(pkts[i]->hdr.session_id));
+		p += sizeof(pkts[i]->hdr.session_id);
+		memcpy(p, secret, secret_len);
+		p += secret_len;
+		memcpy(p, &pkts[i]->hdr.version, sizeof(pkts[i]->hdr.version));
+		p += sizeof(pkts[i]->hdr.version);
+		memcpy(p, &pkts[i]->hdr.seq_no, sizeof(pkts[i]->hdr.seq_no));
+	}
+
+	/*
+	 *	MD5_1 = MD5{session_id, key, version, seq_no}
+	 *	MD5_n = MD5{session_id, key, version, seq_no, MD5_n-1}
+	 *
+	 *	Pads alternate between two buffers, so the previous
+	 *	block is still there to be digested.
+	 */
+	for (offset = 0; ; offset += MD5_DIGEST_LENGTH) {
+		uint8_t	*prev = pad + (((offset / MD5_DIGEST_LENGTH) & 1) ? 0 : num * MD5_DIGEST_LENGTH);
+		uint8_t	*next = pad + (((offset / MD5_DIGEST_LENGTH) & 1) ? num * MD5_DIGEST_LENGTH : 0);
+
+		active = 0;
+		for (i = 0; i < num; i++) {
+			if (ntohl(pkts[i]->hdr.length) <= offset) continue;
+
+			iov[2 * i] = (struct iovec) {
+				.iov_base = prefix + (i * prefix_len),
+				.iov_len = prefix_len
+			};
+			iov[(2 * i) + 1] = (struct iovec) {
+				.iov_base = prev + (i * MD5_DIGEST_LENGTH),
+				.iov_len = MD5_DIGEST_LENGTH
+			};
+
+			batch[active++] = (fr_md5_batch_t) {
+				.iov = &iov[2 * i],
+				.iovcnt = (offset == 0) ? 1 : 2,
+				.out = next + (i * MD5_DIGEST_LENGTH)
+			};
+		}
+		if (!active) break;
+
+		fr_md5_calc_batch(batch, active);
+
+		for (i = 0; i < num; i++) {
+			size_t		body_len = ntohl(pkts[i]->hdr.length);
+			size_t		len, j;
+			uint8_t		*body = ((uint8_t *) pkts[i]) + sizeof(pkts[i]->hdr) + offset;
+			uint8_t const	*p = next + (i * MD5_DIGEST_LENGTH);
+
+			if (body_len <= offset) continue;
+
+			len = body_len - offset;
+			if (len > MD5_DIGEST_LENGTH) len = MD5_DIGEST_LENGTH;
+
+			for (j = 0; j < len; j++) body[j] ^= p[j];
+		}
+	}
+
+	talloc_free(ctx);
+
+	return 0;
+}
+
 /**
  *	Return how long a TACACS+ packet is
  *
@@ -230,6 +230,7 @@ static ssize_t tacacs_encode_body_arg_n(fr_dbuff_t *dbuff, uint8_t arg_cnt, uint
 
 		} else {
 			ssize_t slen;
+			size_t name_len;
 			fr_sbuff_t sbuff;
 			fr_dbuff_t arg_dbuff = FR_DBUFF_MAX(&work_dbuff, 255);
 			fr_value_box_t box;
@@ -238,8 +239,10 @@ static ssize_t tacacs_encode_body_arg_n(fr_dbuff_t *dbuff, uint8_t arg_cnt, uint
 			/*
 			 *	Print it as "name=value"
 			 */
-			FR_DBUFF_IN_MEMCPY_RETURN(&arg_dbuff, vp->da->name, strlen(vp->da->name));
-			FR_DBUFF_IN_BYTES_RETURN(&arg_dbuff, (uint8_t) '=');
+			name_len = strlen(vp->da->name);
+			FR_DBUFF_RESERVE_RETURN(&arg_dbuff, name_len + 1);
+			fr_dbuff_in_memcpy_unchecked(&arg_dbuff, vp->da->name, name_len);
+			fr_dbuff_in_bytes_unchecked(&arg_dbuff, (uint8_t) '=');
 
 			sbuff = FR_SBUFF_OUT(buffer, sizeof(buffer));
 
@@ -334,9 +337,10 @@ static ssize_t tacacs_encode_chap(fr_dbuff_t *dbuff, fr_tacacs_packet_t *packet,
 		return -1;
 	}
 
-	FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, chap->vp_octets, 1);
-	FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, challenge->vp_octets, challenge->vp_length);
-	FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, chap->vp_octets + 1, chap->vp_length - 1);
+	FR_DBUFF_RESERVE_RETURN(&work_dbuff, chap->vp_length + challenge->vp_length);
+	fr_dbuff_in_memcpy_unchecked(&work_dbuff, chap->vp_octets, 1);
+	fr_dbuff_in_memcpy_unchecked(&work_dbuff, challenge->vp_octets, challenge->vp_length);
+	fr_dbuff_in_memcpy_unchecked(&work_dbuff, chap->vp_octets + 1, chap->vp_length - 1);
 
 	packet->authen_start.data_len = chap->vp_length + challenge->vp_length;
 
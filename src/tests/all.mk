@@ -81,10 +81,10 @@ ci-test: raddb/test.conf test
 #
 #  The tests do a lot of rooting through files, which slows down non-test builds.
 #
-#  Therefore only include the test subdirectories if we're running the tests.
-#  Or, if we're trying to clean things up.
+#  Therefore only include the test subdirectories if we're running the tests
+#  or benchmarks.  Or, if we're trying to clean things up.
 #
-ifneq "$(findstring test,$(MAKECMDGOALS))$(findstring clean,$(MAKECMDGOALS))" ""
+ifneq "$(findstring test,$(MAKECMDGOALS))$(findstring bench,$(MAKECMDGOALS))$(findstring clean,$(MAKECMDGOALS))" ""
 
 #
 #  Add LSAN / ASAN options.  And shut them up on OSX, which has leaks in libc.
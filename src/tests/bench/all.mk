@@ -0,0 +1,34 @@
+#
+#  Microbenchmarks for hot path code.
+#
+#	make bench
+#
+#  runs all of the benchmarks, and writes the results to
+#  $(BUILD_DIR)/tests/bench/<name>.txt.  To compare against a previous
+#  run, copy those files somewhere, and then
+#
+#	make BENCH_BASELINE=/path/to/old/results bench
+#
+#  The target fails if any case is more than BENCH_THRESHOLD percent
+#  slower than the baseline, or does more allocations.
+#
+SUBMAKEFILES := util_bench.mk io_bench.mk radius_bench.mk xlat_bench.mk
+
+BENCH_PROGRAMS	:= util io radius xlat
+BENCH_THRESHOLD	?= 10
+BENCH_TIME	?= 0.5
+BENCH_ARGS	:= -D $(top_srcdir)/share/dictionary -r $(BENCH_THRESHOLD) -t $(BENCH_TIME)
+
+$(BUILD_DIR)/tests/bench:
+	${Q}mkdir -p $@
+
+define BENCH_PROGRAM
+.PHONY: bench.${1}
+bench.${1}: $(BUILD_DIR)/bin/local/${1}_bench | $(BUILD_DIR)/tests/bench
+	@echo "BENCH ${1}"
+	${Q}$(TEST_BIN)/${1}_bench $(BENCH_ARGS) -o $(BUILD_DIR)/tests/bench/${1}.txt $(if $(BENCH_BASELINE),-b $(BENCH_BASELINE)/${1}.txt)
+endef
+$(foreach x,$(BENCH_PROGRAMS),$(eval $(call BENCH_PROGRAM,$x)))
+
+.PHONY: bench
+bench: $(addprefix bench.,$(BENCH_PROGRAMS))
@@ -0,0 +1,143 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Benchmarks for atomic queues and ring buffers
+ *
+ * These are single threaded, and measure the cost of the operations
+ * without contention.  atomic_queue_bench measures contention.
+ *
+ * @file src/tests/bench/io_bench.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+static void bench_init(void);
+#define BENCH_INIT bench_init()
+
+#include <freeradius-devel/util/bench.h>
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/io/ring_buffer.h>
+
+#define QUEUE_SIZE	(4096)
+#define QUEUE_BATCH	(32)
+#define RING_SIZE	(1024 * 1024)
+
+/**********************************************************************/
+typedef struct request_s request_t;
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request);
+
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request)
+{
+}
+/**********************************************************************/
+
+static TALLOC_CTX		*autofree;
+static fr_atomic_queue_t	*aq;
+static fr_atomic_queue_t	*aq_compact;
+static fr_ring_buffer_t		*rb;
+
+static void bench_init(void)
+{
+	autofree = talloc_autofree_context();
+
+	aq = fr_atomic_queue_alloc(autofree, QUEUE_SIZE);
+	aq_compact = fr_atomic_queue_alloc_compact(autofree, QUEUE_SIZE);
+	rb = fr_ring_buffer_create(autofree, RING_SIZE);
+
+	if (!aq || !aq_compact || !rb) {
+		fr_perror("io_bench");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static void bench_atomic_queue(fr_atomic_queue_t *q, size_t n)
+{
+	size_t	i;
+	void	*data;
+
+	for (i = 0; i < n; i++) {
+		(void) fr_atomic_queue_push(q, (void *) (uintptr_t) (i + 1));
+		(void) fr_atomic_queue_pop(q, &data);
+		BENCH_KEEP(data);
+	}
+}
+
+static void bench_atomic_queue_push_pop(UNUSED bench_t *b, size_t n)
+{
+	bench_atomic_queue(aq, n);
+}
+
+static void bench_atomic_queue_push_pop_compact(UNUSED bench_t *b, size_t n)
+{
+	bench_atomic_queue(aq_compact, n);
+}
+
+/** One operation is one entry pushed and popped, in batches
+ *
+ */
+static void bench_atomic_queue_push_pop_n(UNUSED bench_t *b, size_t n)
+{
+	size_t	i, num;
+	void	*data[QUEUE_BATCH];
+
+	for (i = 0; i < QUEUE_BATCH; i++) data[i] = (void *) (uintptr_t) (i + 1);
+
+	for (i = 0; i < n; i += num) {
+		num = n - i;
+		if (num > QUEUE_BATCH) num = QUEUE_BATCH;
+
+		num = fr_atomic_queue_push_n(aq, data, num);
+		(void) fr_atomic_queue_pop_n(aq, data, num);
+		if (!num) break;
+	}
+	BENCH_KEEP(data[0]);
+}
+
+/** Allocate and free in FIFO order, as the channels do
+ *
+ */
+static void bench_ring_buffer(size_t n, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		BENCH_KEEP(fr_ring_buffer_alloc(rb, size));
+		(void) fr_ring_buffer_free(rb, size);
+	}
+}
+
+static void bench_ring_buffer_alloc_free_64(UNUSED bench_t *b, size_t n)
+{
+	bench_ring_buffer(n, 64);
+}
+
+static void bench_ring_buffer_alloc_free_4096(UNUSED bench_t *b, size_t n)
+{
+	bench_ring_buffer(n, 4096);
+}
+
+BENCH_LIST = {
+	{ "atomic_queue_push_pop",		bench_atomic_queue_push_pop },
+	{ "atomic_queue_push_pop_compact",	bench_atomic_queue_push_pop_compact },
+	{ "atomic_queue_push_pop_n",		bench_atomic_queue_push_pop_n },
+
+	{ "ring_buffer_alloc_free_64",		bench_ring_buffer_alloc_free_64 },
+	{ "ring_buffer_alloc_free_4096",	bench_ring_buffer_alloc_free_4096 },
+
+	{ NULL }
+};
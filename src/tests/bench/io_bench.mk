@@ -0,0 +1,5 @@
+TARGET		:= io_bench$(E)
+SOURCES		:= io_bench.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io$(L)
+TGT_LDLIBS	:= $(LIBS)
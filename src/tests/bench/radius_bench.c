@@ -0,0 +1,166 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Benchmarks for RADIUS encoding and decoding
+ *
+ * @file src/tests/bench/radius_bench.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+static void bench_init(void);
+#define BENCH_INIT bench_init()
+
+#include <freeradius-devel/util/bench.h>
+
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/util/version.h>
+
+static TALLOC_CTX		*autofree;
+static fr_dict_gctx_t const	*dict_gctx;
+static fr_dict_t		*dict_internal;
+
+static char const		secret[] = "testing123";
+
+static fr_radius_ctx_t		common_ctx = {
+	.secret = secret,
+	.secret_length = sizeof(secret) - 1,
+};
+
+/*
+ *	An Access-Request as sent by a typical NAS.
+ */
+static uint8_t access_request[] = {
+	0x01, 0x2a, 0x00, 0x00,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+
+	/* User-Name = "bob@example.com" */
+	0x01, 0x11, 'b', 'o', 'b', '@', 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+	/* NAS-IP-Address = 192.0.2.1 */
+	0x04, 0x06, 0xc0, 0x00, 0x02, 0x01,
+	/* NAS-Port = 1 */
+	0x05, 0x06, 0x00, 0x00, 0x00, 0x01,
+	/* Service-Type = Framed-User */
+	0x06, 0x06, 0x00, 0x00, 0x00, 0x02,
+	/* Framed-Protocol = PPP */
+	0x07, 0x06, 0x00, 0x00, 0x00, 0x01,
+	/* Called-Station-Id = "00-00-5e-00-53-00" */
+	0x1e, 0x13, '0', '0', '-', '0', '0', '-', '5', 'e', '-', '0', '0', '-', '5', '3', '-', '0', '0',
+	/* Calling-Station-Id = "00-00-5e-00-53-01" */
+	0x1f, 0x13, '0', '0', '-', '0', '0', '-', '5', 'e', '-', '0', '0', '-', '5', '3', '-', '0', '1',
+	/* NAS-Identifier = "nas1" */
+	0x20, 0x06, 'n', 'a', 's', '1',
+	/* NAS-Port-Type = Ethernet */
+	0x3d, 0x06, 0x00, 0x00, 0x00, 0x0f,
+	/* Vendor-Specific.Cisco.AVPair = "connect-progress=LAN Ses Up" */
+	0x1a, 0x23, 0x00, 0x00, 0x00, 0x09, 0x01, 0x1d,
+	'c', 'o', 'n', 'n', 'e', 'c', 't', '-', 'p', 'r', 'o', 'g', 'r', 'e', 's', 's', '=',
+	'L', 'A', 'N', ' ', 'S', 'e', 's', ' ', 'U', 'p',
+};
+
+static fr_pair_list_t		request_pairs;
+
+static ssize_t radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out)
+{
+	fr_radius_decode_ctx_t decode_ctx = {
+		.common = &common_ctx,
+		.request_authenticator = access_request + 4,
+		.end = access_request + sizeof(access_request),
+		.tmp_ctx = ctx,
+	};
+
+	return fr_radius_decode(ctx, out, access_request, sizeof(access_request), &decode_ctx);
+}
+
+static void bench_init(void)
+{
+	autofree = talloc_autofree_context();
+
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+	error:
+		fr_perror("radius_bench");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!bench_dict_dir) {
+		fprintf(stderr, "radius_bench: -D <dict_dir> is required\n");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	dict_gctx = fr_dict_global_ctx_init(autofree, true, bench_dict_dir);
+	if (!dict_gctx) goto error;
+
+	if (fr_dict_internal_afrom_file(&dict_internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) goto error;
+
+	if (fr_radius_global_init() < 0) goto error;
+
+	access_request[2] = sizeof(access_request) >> 8;
+	access_request[3] = sizeof(access_request) & 0xff;
+
+	fr_pair_list_init(&request_pairs);
+	if (radius_decode(autofree, &request_pairs) < 0) goto error;
+}
+
+static void bench_radius_decode(bench_t *b, size_t n)
+{
+	size_t		i;
+	fr_pair_list_t	list;
+
+	fr_pair_list_init(&list);
+
+	for (i = 0; i < n; i++) {
+		BENCH_KEEP(radius_decode(b->ctx, &list));
+	}
+}
+
+static void bench_radius_decode_free(bench_t *b, size_t n)
+{
+	size_t		i;
+	fr_pair_list_t	list;
+
+	fr_pair_list_init(&list);
+
+	for (i = 0; i < n; i++) {
+		BENCH_KEEP(radius_decode(b->ctx, &list));
+		fr_pair_list_free(&list);
+	}
+}
+
+static void bench_radius_encode(UNUSED bench_t *b, size_t n)
+{
+	size_t		i;
+	uint8_t		buffer[4096];
+	fr_radius_encode_ctx_t encode_ctx = {
+		.common = &common_ctx,
+		.request_authenticator = access_request + 4,
+		.request_code = FR_RADIUS_CODE_ACCESS_REQUEST,
+		.code = FR_RADIUS_CODE_ACCESS_REQUEST,
+		.id = 0x2a,
+	};
+
+	for (i = 0; i < n; i++) {
+		BENCH_KEEP(fr_radius_encode(&FR_DBUFF_TMP(buffer, sizeof(buffer)), &request_pairs, &encode_ctx));
+	}
+}
+
+BENCH_LIST = {
+	{ "radius_decode",			bench_radius_decode },
+	{ "radius_decode_free",			bench_radius_decode_free },
+	{ "radius_encode",			bench_radius_encode },
+
+	{ NULL }
+};
@@ -0,0 +1,5 @@
+TARGET		:= radius_bench$(E)
+SOURCES		:= radius_bench.c
+
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L)
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,339 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Benchmarks for pairs, value boxes, dictionaries and tries
+ *
+ * @file src/tests/bench/util_bench.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+static void bench_init(void);
+#define BENCH_INIT bench_init()
+
+#include <freeradius-devel/util/bench.h>
+
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/pair.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/rb.h>
+#include <freeradius-devel/util/timer_wheel.h>
+#include <freeradius-devel/util/trie.h>
+#include <freeradius-devel/util/value.h>
+#include <freeradius-devel/util/version.h>
+
+#define TRIE_KEYS	(1024)
+#define TIMER_ENTRIES	(100000)
+#define TIMER_SPAN	(fr_time_delta_from_sec(5))
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+static fr_pair_list_t	test_pairs;
+
+static fr_trie_t	*trie;
+static fr_trie_t	*trie_compiled;
+static uint32_t		trie_keys[TRIE_KEYS];
+
+/*
+ *	Outstanding requests in a proxy, as tracked by the retry bio.
+ */
+typedef struct {
+	fr_rb_node_t		rb_node;
+	fr_timer_wheel_node_t	tw_node;
+	fr_time_t		rb_when;
+	fr_time_t		tw_when;
+} timer_entry_t;
+
+static timer_entry_t	*timer_entries;
+static fr_rb_tree_t	*timer_tree;
+static fr_timer_wheel_t	*timer_wheel;
+static fr_time_t	timer_rb_now;
+static fr_time_t	timer_tw_now;
+
+static int8_t timer_entry_cmp(void const *one, void const *two)
+{
+	timer_entry_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = fr_time_cmp(a->rb_when, b->rb_when);
+	if (ret != 0) return ret;
+
+	return CMP(a, b);
+}
+
+static fr_value_box_t	box_uint32;
+static fr_value_box_t	box_string_uint32;
+static fr_value_box_t	box_string_ipv4;
+
+static void bench_init(void)
+{
+	fr_dict_attr_t const	**attrs[] = {
+		&fr_dict_attr_test_string, &fr_dict_attr_test_octets,
+		&fr_dict_attr_test_ipv4_addr, &fr_dict_attr_test_ipv4_prefix,
+		&fr_dict_attr_test_ipv6_addr, &fr_dict_attr_test_ipv6_prefix,
+		&fr_dict_attr_test_ifid, &fr_dict_attr_test_ethernet,
+		&fr_dict_attr_test_bool, &fr_dict_attr_test_uint8,
+		&fr_dict_attr_test_uint16, &fr_dict_attr_test_uint64,
+		&fr_dict_attr_test_int32, &fr_dict_attr_test_date,
+		&fr_dict_attr_test_time_delta, &fr_dict_attr_test_uint32,
+		NULL
+	};
+	size_t			i;
+
+	autofree = talloc_autofree_context();
+
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+	error:
+		fr_perror("util_bench");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	/*
+	 *	A typical request sized list.  Test-Uint32 is last.
+	 */
+	fr_pair_list_init(&test_pairs);
+	for (i = 0; attrs[i]; i++) {
+		fr_pair_t *vp;
+
+		vp = fr_pair_afrom_da(autofree, *attrs[i]);
+		if (!vp) goto error;
+		fr_pair_append(&test_pairs, vp);
+	}
+
+	/*
+	 *	/16s to /32s spread over the address space, like a
+	 *	large client list.
+	 */
+	trie = fr_trie_alloc(autofree, NULL, NULL);
+	trie_compiled = fr_trie_alloc(autofree, NULL, NULL);
+	if (!trie || !trie_compiled) goto error;
+
+	for (i = 0; i < TRIE_KEYS; i++) {
+		uint32_t	key = htonl(fr_rand());
+		size_t		bits = 16 + (i % 17);
+
+		trie_keys[i] = key;
+		(void) fr_trie_insert_by_key(trie, &trie_keys[i], bits, &trie_keys[i]);
+		(void) fr_trie_insert_by_key(trie_compiled, &trie_keys[i], bits, &trie_keys[i]);
+	}
+	if (fr_trie_compile(trie_compiled) < 0) goto error;
+
+	/*
+	 *	Timers spread over the next few seconds, in both a tree and a wheel.
+	 */
+	timer_entries = talloc_zero_array(autofree, timer_entry_t, TIMER_ENTRIES);
+	timer_tree = fr_rb_inline_alloc(autofree, timer_entry_t, rb_node, timer_entry_cmp, NULL);
+	timer_rb_now = timer_tw_now = fr_time_wrap(NSEC);
+	timer_wheel = fr_timer_wheel_alloc(autofree, timer_entry_t, tw_node, fr_time_delta_from_msec(1), 1024,
+					   timer_tw_now);
+	if (!timer_entries || !timer_tree || !timer_wheel) goto error;
+
+	for (i = 0; i < TIMER_ENTRIES; i++) {
+		fr_time_t when = fr_time_add(timer_rb_now,
+					     fr_time_delta_wrap(fr_rand() % fr_time_delta_unwrap(TIMER_SPAN)));
+
+		timer_entries[i].rb_when = timer_entries[i].tw_when = when;
+		(void) fr_rb_insert(timer_tree, &timer_entries[i]);
+		fr_timer_wheel_insert(timer_wheel, &timer_entries[i], when);
+	}
+
+	fr_value_box(&box_uint32, (uint32_t) 123456789, false);
+	fr_value_box_strdup_shallow(&box_string_uint32, NULL, "123456789", false);
+	fr_value_box_strdup_shallow(&box_string_ipv4, NULL, "192.0.2.1", false);
+}
+
+static void bench_pair_find_by_da_first(UNUSED bench_t *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) BENCH_KEEP(fr_pair_find_by_da(&test_pairs, NULL, fr_dict_attr_test_string));
+}
+
+static void bench_pair_find_by_da_last(UNUSED bench_t *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) BENCH_KEEP(fr_pair_find_by_da(&test_pairs, NULL, fr_dict_attr_test_uint32));
+}
+
+static void bench_pair_find_by_da_missing(UNUSED bench_t *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) BENCH_KEEP(fr_pair_find_by_da(&test_pairs, NULL, fr_dict_attr_test_int64));
+}
+
+static void bench_value_box_cast(bench_t *b, size_t n, fr_type_t type, fr_value_box_t const *src)
+{
+	size_t		i;
+	fr_value_box_t	dst;
+
+	for (i = 0; i < n; i++) {
+		(void) fr_value_box_cast(b->ctx, &dst, type, NULL, src);
+		BENCH_KEEP(dst.vb_uint64);
+	}
+}
+
+static void bench_value_box_cast_uint32_to_string(bench_t *b, size_t n)
+{
+	bench_value_box_cast(b, n, FR_TYPE_STRING, &box_uint32);
+}
+
+static void bench_value_box_cast_string_to_uint32(bench_t *b, size_t n)
+{
+	bench_value_box_cast(b, n, FR_TYPE_UINT32, &box_string_uint32);
+}
+
+static void bench_value_box_cast_string_to_ipv4(bench_t *b, size_t n)
+{
+	bench_value_box_cast(b, n, FR_TYPE_IPV4_ADDR, &box_string_ipv4);
+}
+
+static void bench_value_box_cast_uint32_to_uint64(bench_t *b, size_t n)
+{
+	bench_value_box_cast(b, n, FR_TYPE_UINT64, &box_uint32);
+}
+
+static void bench_dict_attr_by_name(UNUSED bench_t *b, size_t n)
+{
+	size_t			i;
+	fr_dict_attr_t const	*root = fr_dict_root(test_dict);
+
+	for (i = 0; i < n; i++) BENCH_KEEP(fr_dict_attr_by_name(NULL, root, "Test-IPv4-Addr"));
+}
+
+static void bench_dict_attr_child_by_num(UNUSED bench_t *b, size_t n)
+{
+	size_t			i;
+	fr_dict_attr_t const	*root = fr_dict_root(test_dict);
+
+	for (i = 0; i < n; i++) BENCH_KEEP(fr_dict_attr_child_by_num(root, FR_TEST_ATTR_IPV4_ADDR));
+}
+
+static void bench_trie_lookup(fr_trie_t *ft, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t key = trie_keys[i & (TRIE_KEYS - 1)] ^ htonl(i & 0xff);
+
+		BENCH_KEEP(fr_trie_lookup_by_key(ft, &key, 32));
+	}
+}
+
+static void bench_trie_lookup_by_key(UNUSED bench_t *b, size_t n)
+{
+	bench_trie_lookup(trie, n);
+}
+
+static void bench_trie_lookup_by_key_compiled(UNUSED bench_t *b, size_t n)
+{
+	bench_trie_lookup(trie_compiled, n);
+}
+
+/*
+ *	A reply arrives, and the request is moved to a later time.
+ */
+static void bench_timer_rb_reinsert(UNUSED bench_t *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		timer_entry_t *entry = &timer_entries[(i * 7919) % TIMER_ENTRIES];
+
+		(void) fr_rb_remove_by_inline_node(timer_tree, &entry->rb_node);
+		entry->rb_when = fr_time_add(entry->rb_when, fr_time_delta_from_usec(1));
+		(void) fr_rb_insert(timer_tree, entry);
+	}
+}
+
+static void bench_timer_wheel_reinsert(UNUSED bench_t *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		timer_entry_t *entry = &timer_entries[(i * 7919) % TIMER_ENTRIES];
+
+		entry->tw_when = fr_time_add(entry->tw_when, fr_time_delta_from_usec(1));
+		fr_timer_wheel_update(timer_wheel, entry, entry->tw_when);
+	}
+}
+
+/*
+ *	Time passes, and the requests which are due are retried.  The clock advances by the average gap
+ *	between requests, so the number of outstanding requests stays the same.
+ */
+static void bench_timer_rb_expire(UNUSED bench_t *b, size_t n)
+{
+	size_t		i;
+	fr_time_delta_t	gap = fr_time_delta_wrap(fr_time_delta_unwrap(TIMER_SPAN) / TIMER_ENTRIES);
+
+	for (i = 0; i < n; i++) {
+		timer_entry_t *entry;
+
+		timer_rb_now = fr_time_add(timer_rb_now, gap);
+
+		while ((entry = fr_rb_first(timer_tree)) && fr_time_lteq(entry->rb_when, timer_rb_now)) {
+			(void) fr_rb_remove_by_inline_node(timer_tree, &entry->rb_node);
+			entry->rb_when = fr_time_add(entry->rb_when, TIMER_SPAN);
+			(void) fr_rb_insert(timer_tree, entry);
+		}
+	}
+}
+
+static void bench_timer_wheel_expire(UNUSED bench_t *b, size_t n)
+{
+	size_t		i;
+	fr_time_delta_t	gap = fr_time_delta_wrap(fr_time_delta_unwrap(TIMER_SPAN) / TIMER_ENTRIES);
+
+	for (i = 0; i < n; i++) {
+		timer_entry_t *entry;
+
+		timer_tw_now = fr_time_add(timer_tw_now, gap);
+
+		while ((entry = fr_timer_wheel_peek(timer_wheel, timer_tw_now)) != NULL) {
+			entry->tw_when = fr_time_add(entry->tw_when, TIMER_SPAN);
+			fr_timer_wheel_update(timer_wheel, entry, entry->tw_when);
+		}
+	}
+}
+
+BENCH_LIST = {
+	{ "pair_find_by_da_first",		bench_pair_find_by_da_first },
+	{ "pair_find_by_da_last",		bench_pair_find_by_da_last },
+	{ "pair_find_by_da_missing",		bench_pair_find_by_da_missing },
+
+	{ "value_box_cast_uint32_to_string",	bench_value_box_cast_uint32_to_string },
+	{ "value_box_cast_string_to_uint32",	bench_value_box_cast_string_to_uint32 },
+	{ "value_box_cast_string_to_ipv4",	bench_value_box_cast_string_to_ipv4 },
+	{ "value_box_cast_uint32_to_uint64",	bench_value_box_cast_uint32_to_uint64 },
+
+	{ "dict_attr_by_name",			bench_dict_attr_by_name },
+	{ "dict_attr_child_by_num",		bench_dict_attr_child_by_num },
+
+	{ "trie_lookup_by_key",			bench_trie_lookup_by_key },
+	{ "trie_lookup_by_key_compiled",	bench_trie_lookup_by_key_compiled },
+
+	{ "timer_rb_reinsert",			bench_timer_rb_reinsert },
+	{ "timer_wheel_reinsert",		bench_timer_wheel_reinsert },
+	{ "timer_rb_expire",			bench_timer_rb_expire },
+	{ "timer_wheel_expire",			bench_timer_wheel_expire },
+
+	{ NULL }
+};
@@ -0,0 +1,5 @@
+TARGET		:= util_bench$(E)
+SOURCES		:= util_bench.c
+
+TGT_PREREQS	:= libfreeradius-util$(L)
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,184 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Benchmarks for xlat evaluation
+ *
+ * Expansions are tokenized once, and evaluated with
+ * xlat_aeval_compiled(), which runs a synchronous interpreter, the same
+ * as modules which expand strings at runtime.
+ *
+ * @file src/tests/bench/xlat_bench.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+static void bench_init(void);
+#define BENCH_INIT bench_init()
+
+#include <freeradius-devel/util/bench.h>
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/unlang/xlat.h>
+#include <freeradius-devel/util/version.h>
+
+typedef enum {
+	BENCH_XLAT_STRING = 0,
+	BENCH_XLAT_ATTR,
+	BENCH_XLAT_FUNC,
+	BENCH_XLAT_EXPR,
+	BENCH_XLAT_MAX
+} bench_xlat_t;
+
+static char const *bench_xlat_str[BENCH_XLAT_MAX] = {
+	[BENCH_XLAT_STRING]	= "user=%{User-Name} nas=%{NAS-IP-Address} port=%{NAS-Port}",
+	[BENCH_XLAT_ATTR]	= "%{User-Name}",
+	[BENCH_XLAT_FUNC]	= "%length(%{User-Name})",
+	[BENCH_XLAT_EXPR]	= "&NAS-Port + 1",
+};
+
+static TALLOC_CTX		*autofree;
+static fr_event_list_t		*el;
+static fr_dict_t		*dict_internal;
+static fr_dict_t		*dict_radius;
+static request_t		*request;
+static xlat_exp_head_t		*bench_xlat[BENCH_XLAT_MAX];
+
+static void bench_pair_add(char const *name, char const *value)
+{
+	fr_dict_attr_t const	*da;
+	fr_pair_t		*vp;
+
+	da = fr_dict_attr_by_name(NULL, fr_dict_root(dict_radius), name);
+	if (!da) {
+	error:
+		fr_perror("xlat_bench");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	vp = fr_pair_afrom_da(request->request_ctx, da);
+	if (!vp) goto error;
+
+	if (fr_pair_value_from_str(vp, value, strlen(value), NULL, false) < 0) goto error;
+
+	fr_pair_append(&request->request_pairs, vp);
+}
+
+static void bench_init(void)
+{
+	tmpl_rules_t	t_rules;
+	int		i;
+
+	autofree = talloc_autofree_context();
+
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+	error:
+		fr_perror("xlat_bench");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!bench_dict_dir) {
+		fprintf(stderr, "xlat_bench: -D <dict_dir> is required\n");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, true, bench_dict_dir)) goto error;
+	if (fr_dict_internal_afrom_file(&dict_internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) goto error;
+	if (fr_dict_protocol_afrom_file(&dict_radius, "radius", NULL, __FILE__) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+	if (unlang_global_init() < 0) goto error;
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	if (!el) goto error;
+
+	if (xlat_instantiate() < 0) goto error;
+	if (xlat_thread_instantiate(autofree, el) < 0) goto error;
+	unlang_thread_instantiate(autofree);
+
+	t_rules = (tmpl_rules_t) {
+		.attr = {
+			.dict_def = dict_radius,
+			.list_def = request_attr_request,
+		},
+		.xlat = {
+			.runtime_el = el,
+		},
+		.at_runtime = true,
+	};
+
+	for (i = 0; i < BENCH_XLAT_MAX; i++) {
+		fr_sbuff_t	in = FR_SBUFF_IN(bench_xlat_str[i], strlen(bench_xlat_str[i]));
+		fr_slen_t	slen;
+
+		if (i == BENCH_XLAT_EXPR) {
+			slen = xlat_tokenize_expression(autofree, &bench_xlat[i], &in, NULL, &t_rules);
+		} else {
+			slen = xlat_tokenize(autofree, &bench_xlat[i], &in, NULL, &t_rules, 0);
+		}
+		if (slen <= 0) {
+			fr_perror("xlat_bench - Failed parsing \"%s\"", bench_xlat_str[i]);
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	request = request_alloc_internal(autofree, &(request_init_args_t){ .namespace = dict_radius });
+	if (!request) goto error;
+
+	bench_pair_add("User-Name", "bob@example.com");
+	bench_pair_add("NAS-IP-Address", "192.0.2.1");
+	bench_pair_add("NAS-Port", "1");
+}
+
+static void bench_xlat_eval(bench_t *b, size_t n, bench_xlat_t which)
+{
+	size_t	i;
+	char	*out;
+
+	for (i = 0; i < n; i++) {
+		BENCH_KEEP(xlat_aeval_compiled(b->ctx, &out, request, bench_xlat[which], NULL, NULL));
+	}
+}
+
+static void bench_xlat_eval_string(bench_t *b, size_t n)
+{
+	bench_xlat_eval(b, n, BENCH_XLAT_STRING);
+}
+
+static void bench_xlat_eval_attr(bench_t *b, size_t n)
+{
+	bench_xlat_eval(b, n, BENCH_XLAT_ATTR);
+}
+
+static void bench_xlat_eval_func(bench_t *b, size_t n)
+{
+	bench_xlat_eval(b, n, BENCH_XLAT_FUNC);
+}
+
+static void bench_xlat_eval_expr(bench_t *b, size_t n)
+{
+	bench_xlat_eval(b, n, BENCH_XLAT_EXPR);
+}
+
+BENCH_LIST = {
+	{ "xlat_eval_string",			bench_xlat_eval_string },
+	{ "xlat_eval_attr",			bench_xlat_eval_attr },
+	{ "xlat_eval_func",			bench_xlat_eval_func },
+	{ "xlat_eval_expr",			bench_xlat_eval_expr },
+
+	{ NULL }
+};
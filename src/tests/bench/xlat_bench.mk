@@ -0,0 +1,5 @@
+TARGET		:= xlat_bench$(E)
+SOURCES		:= xlat_bench.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-radius$(L)
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,8 @@
+#
+#  Test the "shm" cache driver
+#
+#  Each cache instance uses its own file under the build directory.
+#
+cache_shm.test:
+
+export CACHE_SHM_TEST_DIR := $(BUILD_DIR)/tests/modules/cache_shm
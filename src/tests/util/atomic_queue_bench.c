@@ -0,0 +1,187 @@
+/*
+ * atomic_queue_bench.c	Benchmarks for atomic queues
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#define MAX_BATCH	(256)
+#define MAX_PRODUCERS	(64)
+
+/**********************************************************************/
+typedef struct request_s request_t;
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request);
+
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request)
+{
+}
+/**********************************************************************/
+
+typedef struct {
+	fr_atomic_queue_t	*aq;
+	size_t			count;		//!< Number of entries to push.
+	size_t			batch;		//!< 1 for fr_atomic_queue_push()
+	pthread_t		id;
+} bench_producer_t;
+
+static NEVER_RETURNS void usage(void)
+{
+	fprintf(stderr, "usage: atomic_queue_bench [OPTS]\n");
+	fprintf(stderr, "  -b batch               batch size for push_n / pop_n (default 32).\n");
+	fprintf(stderr, "  -n count               entries each producer pushes (default 1000000).\n");
+	fprintf(stderr, "  -p producers           number of producer threads (default 4).\n");
+	fprintf(stderr, "  -s size                set queue size (default 4096).\n");
+
+	fr_exit_now(EXIT_SUCCESS);
+}
+
+static void *bench_produce(void *arg)
+{
+	bench_producer_t	*p = arg;
+	void			*data[MAX_BATCH];
+	size_t			i, sent = 0;
+
+	for (i = 0; i < p->batch; i++) data[i] = (void *) (uintptr_t) (i + 1);
+
+	while (sent < p->count) {
+		size_t num = p->count - sent;
+
+		if (num > p->batch) num = p->batch;
+
+		if (p->batch == 1) {
+			if (fr_atomic_queue_push(p->aq, data[0])) sent++;
+			continue;
+		}
+
+		sent += fr_atomic_queue_push_n(p->aq, data, num);
+	}
+
+	return NULL;
+}
+
+/** Run one benchmark, and print the time per entry
+ *
+ */
+static void bench_run(char const *name, bool compact, size_t batch,
+		      size_t size, size_t producers, size_t count)
+{
+	fr_atomic_queue_t	*aq;
+	bench_producer_t	p[MAX_PRODUCERS];
+	void			*data[MAX_BATCH];
+	size_t			i, received = 0, total = producers * count;
+	fr_time_t		start;
+	fr_time_delta_t		elapsed;
+
+	aq = compact ? fr_atomic_queue_alloc_compact(NULL, size) : fr_atomic_queue_alloc(NULL, size);
+	if (!aq) {
+		fprintf(stderr, "Failed allocating queue\n");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	start = fr_time();
+
+	for (i = 0; i < producers; i++) {
+		p[i].aq = aq;
+		p[i].count = count;
+		p[i].batch = batch;
+
+		if (pthread_create(&p[i].id, NULL, bench_produce, &p[i]) != 0) {
+			fprintf(stderr, "Failed creating thread\n");
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	while (received < total) {
+		if (batch == 1) {
+			if (fr_atomic_queue_pop(aq, &data[0])) received++;
+			continue;
+		}
+
+		received += fr_atomic_queue_pop_n(aq, data, batch);
+	}
+
+	for (i = 0; i < producers; i++) pthread_join(p[i].id, NULL);
+
+	elapsed = fr_time_sub(fr_time(), start);
+
+	printf("%-24s %10.2f ns/entry  %10.2f Mentries/s\n", name,
+	       (double) fr_time_delta_unwrap(elapsed) / total,
+	       ((double) total * 1000) / fr_time_delta_unwrap(elapsed));
+
+	fr_atomic_queue_free(&aq);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	size_t			batch = 32, count = 1000000, producers = 4, size = 4096;
+
+	while ((c = getopt(argc, argv, "b:hn:p:s:")) != -1) switch (c) {
+		case 'b':
+			batch = strtoul(optarg, NULL, 10);
+			if (!batch || (batch > MAX_BATCH)) usage();
+			break;
+
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'p':
+			producers = strtoul(optarg, NULL, 10);
+			if (!producers || (producers > MAX_PRODUCERS)) usage();
+			break;
+
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			if (!size) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed starting time\n");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	printf("%zu producers, 1 consumer, %zu entries each, queue size %zu, batch %zu\n",
+	       producers, count, size, batch);
+
+	bench_run("single, padded", false, 1, size, producers, count);
+	bench_run("single, compact", true, 1, size, producers, count);
+	bench_run("batch, padded", false, batch, size, producers, count);
+	bench_run("batch, compact", true, batch, size, producers, count);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET 		:= atomic_queue_bench$(E)
+
+SOURCES		:= atomic_queue_bench.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io$(L)
+TGT_LDLIBS	:= $(LIBS)
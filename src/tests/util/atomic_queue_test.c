@@ -51,6 +51,7 @@ void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *
 static NEVER_RETURNS void usage(void)
 {
 	fprintf(stderr, "usage: atomic_queue_test [OPTS]\n");
+	fprintf(stderr, "  -c                     Use a compact queue.\n");
 	fprintf(stderr, "  -s size                set queue size.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -61,14 +62,21 @@ int main(int argc, char *argv[])
 {
 	int			c, i, ret = 0;
 	int			size;
+	size_t			num;
+	bool			compact = false;
 	intptr_t		val;
 	void			*data;
+	void			**array;
 	fr_atomic_queue_t	*aq;
 	TALLOC_CTX		*autofree = talloc_autofree_context();
 
 	size = 4;
 
-	while ((c = getopt(argc, argv, "hs:tx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "chs:tx")) != -1) switch (c) {
+		case 'c':
+			compact = true;
+			break;
+
 		case 's':
 			size = atoi(optarg);
 			break;
@@ -86,7 +94,7 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	aq = fr_atomic_queue_alloc(autofree, size);
+	aq = compact ? fr_atomic_queue_alloc_compact(autofree, size) : fr_atomic_queue_alloc(autofree, size);
 
 #ifndef NDEBUG
 	if (debug_lvl) {
@@ -168,6 +176,64 @@ int main(int argc, char *argv[])
 		fr_exit_now(EXIT_FAILURE);
 	}
 
+#ifndef NDEBUG
+	if (debug_lvl) {
+		printf("Empty\n");
+		fr_atomic_queue_debug(aq, stdout);
+
+		if (debug_lvl > 1) printf("Batch filling with %d\n", size);
+	}
+#endif
+
+	/*
+	 *	Batch push one more than will fit.  The queue has
+	 *	wrapped once, so this also checks the sequence
+	 *	numbers of re-used entries.
+	 */
+	array = talloc_array(autofree, void *, size + 1);
+	for (i = 0; i <= size; i++) {
+		val = i + OFFSET;
+		array[i] = (void *) val;
+	}
+
+	num = fr_atomic_queue_push_n(aq, array, size + 1);
+	if (num != (size_t) size) {
+		fprintf(stderr, "Batch push expected %d, pushed %zu\n", size, num);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_atomic_queue_push_n(aq, array, 1) != 0) {
+		fprintf(stderr, "Batch pushed an entry past the end of the queue.");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Pop them in two batches, to check that partial
+	 *	batches leave the rest of the queue alone.
+	 */
+	memset(array, 0, sizeof(array[0]) * (size + 1));
+
+	num = fr_atomic_queue_pop_n(aq, array, size / 2);
+	num += fr_atomic_queue_pop_n(aq, array + num, size + 1);
+	if (num != (size_t) size) {
+		fprintf(stderr, "Batch pop expected %d, popped %zu\n", size, num);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < size; i++) {
+		val = (intptr_t) array[i];
+		if (val != (i + OFFSET)) {
+			fprintf(stderr, "Batch pop expected %d, got %d\n",
+				i + OFFSET, (int) val);
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	if (fr_atomic_queue_pop_n(aq, array, 1) != 0) {
+		fprintf(stderr, "Batch popped an entry past the end of the queue.");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
 #ifndef NDEBUG
 	if (debug_lvl) {
 		printf("Empty\n");
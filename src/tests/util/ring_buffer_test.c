@@ -126,6 +126,7 @@ static void  free_blocks(fr_ring_buffer_t *rb, UNUSED uint32_t *seed, int *start
 static NEVER_RETURNS void usage(void)
 {
 	fprintf(stderr, "usage: ring_buffer_test [OPTS]\n");
+	fprintf(stderr, "  -H                     Use a ring buffer backed by huge pages.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 	fprintf(stderr, "  -s <string>            Set random seed to <string>.\n");
 	fprintf(stderr, "  -l <length>            Set the iteration number to <length>.\n");
@@ -140,10 +141,15 @@ int main(int argc, char *argv[])
 	int i, start, end, length = 1000;
 	fr_ring_buffer_t *rb;
 	uint32_t	seed;
+	bool		hugepage = false;
 
 	TALLOC_CTX	*autofree = talloc_autofree_context();
 
-	while ((c = getopt(argc, argv, "hl:s:x")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "Hhl:s:x")) != -1) switch (c) {
+		case 'H':
+			hugepage = true;
+			break;
+
 		case 'l':
 			length = strtol(optarg, NULL, 10);
 			break;
@@ -165,7 +171,11 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	rb = fr_ring_buffer_create(autofree, ARRAY_SIZE * 1024);
+	if (hugepage) {
+		rb = fr_ring_buffer_create_hugepage(autofree, ARRAY_SIZE * 1024);
+	} else {
+		rb = fr_ring_buffer_create(autofree, ARRAY_SIZE * 1024);
+	}
 	if (!rb) {
 		fprintf(stderr, "Failed creating ring buffer\n");
 		fr_exit_now(EXIT_FAILURE);